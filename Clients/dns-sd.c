@@ -552,6 +552,8 @@ static void print_usage(const char *arg0, int print_all)
         fprintf(stderr, "%s -S                         (Test multiple operations on a shared socket)\n", arg0);
         fprintf(stderr, "%s -T                                    (Test creating a large TXT record)\n", arg0);
         fprintf(stderr, "%s -U                                          (Test updating a TXT record)\n", arg0);
+        fprintf(stderr, "%s -W      (Show the service types and hosts sending the most multicast DNS)\n", arg0);
+        fprintf(stderr, "%s -Y        (Show DNS traffic by interface and the clients that caused it)\n", arg0);
         fprintf(stderr, "%s -ble                                  (Use kDNSServiceInterfaceIndexBLE)\n", arg0);
         fprintf(stderr, "%s -i <Interface>         (Run dns-sd cmd on a specific interface (en0/en1)\n", arg0);
         fprintf(stderr, "%s -includep2p                        (Set kDNSServiceFlagsIncludeP2P flag)\n", arg0);
@@ -659,6 +661,52 @@ static int CopyLabels(char *dst, const char *lim, const char **srcp, int labels)
     return 0;
 }
 
+// For a big zone the browse can report thousands of instances at once, so rather than starting a resolve for every one of
+// them straight away, at most ZONEDATA_MAX_RESOLVES are outstanding at a time and the rest wait their turn in order
+#define ZONEDATA_MAX_RESOLVES 32
+
+typedef struct zonedata_pending
+{
+    struct zonedata_pending *next;
+    uint32_t ifIndex;
+    char name[kDNSServiceMaxServiceName];
+    char type[kDNSServiceMaxDomainName];
+    char domain[kDNSServiceMaxDomainName];
+} zonedata_pending;
+
+static zonedata_pending *zonedata_queue;
+static zonedata_pending **zonedata_queue_tail = &zonedata_queue;
+static int zonedata_resolving;
+
+static void DNSSD_API zonedata_resolve(DNSServiceRef sdref, const DNSServiceFlags flags, uint32_t ifIndex, DNSServiceErrorType errorCode,
+                                       const char *fullname, const char *hosttarget, uint16_t opaqueport, uint16_t txtLen, const unsigned char *txt, void *context);
+
+static void zonedata_start_resolves(void)
+{
+    while (zonedata_queue && zonedata_resolving < ZONEDATA_MAX_RESOLVES)
+    {
+        zonedata_pending *const p = zonedata_queue;
+        DNSServiceRef *const newref = malloc(sizeof(*newref));
+        zonedata_queue = p->next;
+        if (!zonedata_queue) zonedata_queue_tail = &zonedata_queue;
+        *newref = client;
+        if (DNSServiceResolve(newref, kDNSServiceFlagsShareConnection, p->ifIndex, p->name, p->type, p->domain, zonedata_resolve, newref) == kDNSServiceErr_NoError)
+            zonedata_resolving++;
+        else
+            free(newref);
+        free(p);
+    }
+}
+
+// Called when one of our resolves is finished with, to let the next one start
+static void zonedata_resolve_done(DNSServiceRef sdref, void *context)
+{
+    DNSServiceRefDeallocate(sdref);
+    free(context);
+    zonedata_resolving--;
+    zonedata_start_resolves();
+}
+
 static void DNSSD_API zonedata_resolve(DNSServiceRef sdref, const DNSServiceFlags flags, uint32_t ifIndex, DNSServiceErrorType errorCode,
                                        const char *fullname, const char *hosttarget, uint16_t opaqueport, uint16_t txtLen, const unsigned char *txt, void *context)
 {
@@ -676,12 +724,12 @@ static void DNSSD_API zonedata_resolve(DNSServiceRef sdref, const DNSServiceFlag
     (void)context;      // Unused
 
     //if (!(flags & kDNSServiceFlagsAdd)) return;
-    if (errorCode) { printf("Error code %d\n", errorCode); return; }
+    if (errorCode) { printf("Error code %d\n", errorCode); zonedata_resolve_done(sdref, context); return; }
 
-    if (CopyLabels(n, n + kDNSServiceMaxDomainName, &p, 3)) return;     // Fetch name+type
+    if (CopyLabels(n, n + kDNSServiceMaxDomainName, &p, 3)) { zonedata_resolve_done(sdref, context); return; }    // Fetch name+type
     p = fullname;
-    if (CopyLabels(t, t + kDNSServiceMaxDomainName, &p, 1)) return;     // Skip first label
-    if (CopyLabels(t, t + kDNSServiceMaxDomainName, &p, 2)) return;     // Fetch next two labels (service type)
+    if (CopyLabels(t, t + kDNSServiceMaxDomainName, &p, 1)) { zonedata_resolve_done(sdref, context); return; }    // Skip first label
+    if (CopyLabels(t, t + kDNSServiceMaxDomainName, &p, 2)) { zonedata_resolve_done(sdref, context); return; }    // Fetch next two labels (service type)
 
     if (num_printed++ == 0)
     {
@@ -713,20 +761,19 @@ static void DNSSD_API zonedata_resolve(DNSServiceRef sdref, const DNSServiceFlag
     }
     printf("\n");
 
-    DNSServiceRefDeallocate(sdref);
-    free(context);
+    zonedata_resolve_done(sdref, context);
 
     if (!(flags & kDNSServiceFlagsMoreComing))
     {
         fflush(stdout);
-        if (exitWhenNoMoreComing) exit(0);
+        if (exitWhenNoMoreComing && !zonedata_resolving && !zonedata_queue) exit(0);
     }
 }
 
 static void DNSSD_API zonedata_browse(DNSServiceRef sdref, const DNSServiceFlags flags, uint32_t ifIndex, DNSServiceErrorType errorCode,
                                       const char *replyName, const char *replyType, const char *replyDomain, void *context)
 {
-    DNSServiceRef *newref;
+    zonedata_pending *p;
 
     (void)sdref;        // Unused
     (void)context;      // Unused
@@ -735,9 +782,15 @@ static void DNSSD_API zonedata_browse(DNSServiceRef sdref, const DNSServiceFlags
     if (!(flags & kDNSServiceFlagsAdd)) return;
     if (errorCode) { printf("Error code %d\n", errorCode); return; }
 
-    newref = malloc(sizeof(*newref));
-    *newref = client;
-    DNSServiceResolve(newref, kDNSServiceFlagsShareConnection, ifIndex, replyName, replyType, replyDomain, zonedata_resolve, newref);
+    p = calloc(1, sizeof(*p));
+    if (!p) return;
+    p->ifIndex = ifIndex;
+    strncpy(p->name,   replyName,   sizeof(p->name)   - 1);
+    strncpy(p->type,   replyType,   sizeof(p->type)   - 1);
+    strncpy(p->domain, replyDomain, sizeof(p->domain) - 1);
+    *zonedata_queue_tail = p;
+    zonedata_queue_tail = &p->next;
+    zonedata_start_resolves();
 }
 
 static void DNSSD_API browse_reply(DNSServiceRef sdref, const DNSServiceFlags flags, uint32_t ifIndex, DNSServiceErrorType errorCode,
@@ -2151,7 +2204,7 @@ int main(int argc, char **argv)
     }
 
     if (argc < 2) goto Fail;        // Minimum command line is the command name and one argument
-    operation = getfirstoption(argc, argv, "ABCDEFHILMNPQRSTUVZhlq"
+    operation = getfirstoption(argc, argv, "ABCDEFHILMNPQRSTUVWYZhlq"
                                "X"
                                "Gg"
                                , &opi);
@@ -2352,6 +2405,26 @@ int main(int argc, char **argv)
         else printf("Currently running daemon (system service) is version %d.%d.%d\n",  v / 10000, v / 100 % 100, v % 100);
         exit(0);
     }
+
+    case 'W':   {
+        static char text[kDNSServiceTopTalkers_MaxSize];
+        uint32_t size = sizeof(text);
+        err = DNSServiceGetProperty(kDNSServiceProperty_TopTalkers, text, &size);
+        if (err) fprintf(stderr, "DNSServiceGetProperty failed %ld\n", (long int)err);
+        else if (size > sizeof(text) || !size || text[size - 1]) fprintf(stderr, "DNSServiceGetProperty returned %u bytes\n", size);
+        else fputs(text, stdout);
+        exit(err ? 1 : 0);
+    }
+
+    case 'Y':   {
+        static char text[kDNSServiceTraffic_MaxSize];
+        uint32_t size = sizeof(text);
+        err = DNSServiceGetProperty(kDNSServiceProperty_Traffic, text, &size);
+        if (err) fprintf(stderr, "DNSServiceGetProperty failed %ld\n", (long int)err);
+        else if (size > sizeof(text) || !size || text[size - 1]) fprintf(stderr, "DNSServiceGetProperty returned %u bytes\n", size);
+        else fputs(text, stdout);
+        exit(err ? 1 : 0);
+    }
 #ifdef APPLE_OSX_mDNSResponder
     case 'O': {
         // check if the user specifies the flag "-compress"
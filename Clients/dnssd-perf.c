@@ -0,0 +1,882 @@
+/* -*- Mode: C; tab-width: 4; c-file-style: "bsd"; c-basic-offset: 4; fill-column: 108; indent-tabs-mode: nil; -*-
+ *
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * dnssd-perf is a load generator for mdnsd that needs nothing but the dns_sd.h API, so it builds wherever
+ * dns-sd does. It covers the ground of dnssdutil's gaiperf, MDNSReplierCmd and MDNSDiscoveryTestCmd,
+ * which depend on CoreFoundation and dispatch:
+ *
+ *   dnssd-perf replier  registers a number of synthetic services (and, optionally, host address records),
+ *                       and keeps them registered until it is stopped
+ *   dnssd-perf gaiperf  keeps a number of DNSServiceGetAddrInfo() operations outstanding at once, starting
+ *                       a new one as each gets its first answer
+ *   dnssd-perf browse   runs a number of concurrent browses until each has found the expected number
+ *                       of instances, optionally resolving every instance it finds
+ *   dnssd-perf ipcbench measures the daemon's IPC throughput alone: requests and replies per second for
+ *                       record registration, browse fan-out and DNSServiceGetAddrInfo() churn, all on the
+ *                       LocalOnly interface, with and without a shared connection
+ *
+ * Each of the first three reports latency percentiles for its operations and, where /proc makes it possible,
+ * the CPU time mdnsd used while the test ran; ipcbench reports rates, optionally as JSON lines for tracking. Run the replier on one machine and the other tests on another to load
+ * the network path, or all of them on one machine to load the daemon alone.
+ *
+ * Build with: gcc dnssd-perf.c -o dnssd-perf -I../mDNSShared -ldns_sd
+ */
+
+#include <stdio.h>          // For printf()
+#include <stdlib.h>         // For malloc(), qsort()
+#include <string.h>         // For strcmp()
+#include <errno.h>          // For errno, EINTR
+#include <signal.h>         // For signal()
+#include <time.h>           // For clock_gettime()
+#include <unistd.h>         // For getopt(), sysconf()
+#include <poll.h>           // For poll()
+#include <arpa/inet.h>      // For htons()
+#include "dns_sd.h"
+
+#define kDaemonPidFile      "/var/run/mdnsd.pid"    // Where mDNSPosix's mdnsd writes its pid by default
+#define kDefaultServiceType "_dnssd-perf._tcp"
+#define kHostNameFormat     "dnssd-perf-host-%d.local."
+#define kInstanceNameFormat "dnssd-perf-%d"
+#define kMaxRefs            8192        // Most operations outstanding at once
+
+//*************************************************************************************************************
+// Globals
+
+static int gShareConnection = 1;        // Run every operation over one connection to the daemon (-s turns this off)
+static DNSServiceRef gConnection;
+static volatile int gStopNow;
+static int gTimeoutMs = 5000;
+static int gDurationSec;                // Zero means run until finished (or, for the replier, until stopped)
+static long gDaemonPid;
+
+// The refs to poll: gConnection alone when sharing a connection, otherwise every outstanding operation.
+// Slots emptied during a pass of the event loop are only compacted before the next, so a slot's index
+// stays meaningful throughout a pass.
+static DNSServiceRef gPollRefs[kMaxRefs];
+static int gNumPollRefs;
+static int gPollRefsDirty;
+
+//*************************************************************************************************************
+// Timing and statistics
+
+typedef struct
+{
+    double *values;
+    size_t count;
+    size_t capacity;
+} Samples;
+
+static double NowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static void SamplesAdd(Samples *const s, const double value)
+{
+    if (s->count == s->capacity)
+    {
+        const size_t capacity = s->capacity ? s->capacity * 2 : 1024;
+        double *const values = realloc(s->values, capacity * sizeof(values[0]));
+        if (!values) return;
+        s->values = values;
+        s->capacity = capacity;
+    }
+    s->values[s->count++] = value;
+}
+
+static int CompareDoubles(const void *const a, const void *const b)
+{
+    const double x = *(const double *)a, y = *(const double *)b;
+    return (x < y) ? -1 : (x > y);
+}
+
+static double Percentile(const Samples *const s, const double p)
+{
+    size_t i = (size_t)(p / 100.0 * (double)s->count);
+    if (i >= s->count) i = s->count - 1;
+    return s->values[i];
+}
+
+static void SamplesReport(const char *const label, Samples *const s)
+{
+    double total = 0;
+    size_t i;
+
+    if (!s->count) { printf("%-24s %8s\n", label, "none"); return; }
+    qsort(s->values, s->count, sizeof(s->values[0]), CompareDoubles);
+    for (i = 0; i < s->count; i++) total += s->values[i];
+    printf("%-24s %8zu %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n", label, s->count, s->values[0],
+           Percentile(s, 50), Percentile(s, 90), Percentile(s, 99), s->values[s->count - 1], total / (double)s->count);
+}
+
+static void SamplesReportHeader(void)
+{
+    printf("%-24s %8s %9s %9s %9s %9s %9s %9s\n", "latency (ms)", "count", "min", "p50", "p90", "p99", "max", "mean");
+}
+
+//*************************************************************************************************************
+// Daemon CPU
+
+static long FindDaemonPid(void)
+{
+    FILE *const f = fopen(kDaemonPidFile, "r");
+    long pid = 0;
+    if (f)
+    {
+        if (fscanf(f, "%ld", &pid) != 1) pid = 0;
+        fclose(f);
+    }
+    return pid;
+}
+
+// Returns the user plus system CPU time the daemon has used, in seconds, or -1 if it can't be read
+static double DaemonCPUSeconds(void)
+{
+    char path[64], buf[1024];
+    const char *p;
+    unsigned long utime, stime;
+    size_t len;
+    FILE *f;
+
+    if (gDaemonPid <= 0) return -1;
+    snprintf(path, sizeof(path), "/proc/%ld/stat", gDaemonPid);
+    f = fopen(path, "r");
+    if (!f) return -1;
+    len = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[len] = 0;
+
+    // The command name is in parentheses and may contain spaces, so count fields from the last ')'.
+    // utime and stime are the 14th and 15th fields, the 12th and 13th after the name.
+    p = strrchr(buf, ')');
+    if (!p || sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) return -1;
+    return (double)(utime + stime) / (double)sysconf(_SC_CLK_TCK);
+}
+
+static void ReportDaemonCPU(const double cpuStart, const double wallMs)
+{
+    const double cpuEnd = DaemonCPUSeconds();
+    if (cpuStart < 0 || cpuEnd < 0) { printf("Daemon CPU: unavailable (use -p to give the mdnsd pid)\n"); return; }
+    printf("Daemon CPU: %.2f s over %.2f s (%.1f%%)\n", cpuEnd - cpuStart, wallMs / 1e3,
+           wallMs > 0 ? (cpuEnd - cpuStart) * 1e5 / wallMs : 0);
+}
+
+//*************************************************************************************************************
+// Event loop
+
+static void PollAdd(const DNSServiceRef ref)
+{
+    if (gNumPollRefs < kMaxRefs) gPollRefs[gNumPollRefs++] = ref;
+}
+
+static void PollRemove(const DNSServiceRef ref)
+{
+    int i;
+    for (i = 0; i < gNumPollRefs; i++)
+        if (gPollRefs[i] == ref) { gPollRefs[i] = NULL; gPollRefsDirty = 1; return; }
+}
+
+static void PollCompact(void)
+{
+    int i, n = 0;
+    if (!gPollRefsDirty) return;
+    for (i = 0; i < gNumPollRefs; i++) if (gPollRefs[i]) gPollRefs[n++] = gPollRefs[i];
+    gNumPollRefs = n;
+    gPollRefsDirty = 0;
+}
+
+// Returns the flags and the ref to hand to a DNSService call starting a new operation
+static DNSServiceFlags OpPrepare(DNSServiceRef *const ref, const DNSServiceFlags flags)
+{
+    if (!gShareConnection) { *ref = NULL; return flags; }
+    *ref = gConnection;
+    return flags | kDNSServiceFlagsShareConnection;
+}
+
+static void OpStarted(const DNSServiceRef ref)
+{
+    if (!gShareConnection) PollAdd(ref);
+}
+
+static void OpStop(DNSServiceRef *const ref)
+{
+    if (!*ref) return;
+    if (!gShareConnection) PollRemove(*ref);
+    DNSServiceRefDeallocate(*ref);
+    *ref = NULL;
+}
+
+// Waits up to timeoutMs for replies and dispatches them. Returns -1 if the daemon connection failed.
+static int ProcessEvents(const int timeoutMs)
+{
+    static struct pollfd fds[kMaxRefs];
+    static DNSServiceRef refs[kMaxRefs];
+    int i, n, count;
+
+    PollCompact();
+    count = gNumPollRefs;
+    for (i = 0; i < count; i++)
+    {
+        refs[i] = gPollRefs[i];
+        fds[i].fd = DNSServiceRefSockFD(refs[i]);
+        fds[i].events = POLLIN;
+        fds[i].revents = 0;
+    }
+    n = poll(fds, (nfds_t)count, timeoutMs);
+    if (n < 0) return (errno == EINTR) ? 0 : -1;
+    for (i = 0; i < count && n > 0; i++)
+    {
+        if (!fds[i].revents) continue;
+        n--;
+        if (gPollRefs[i] != refs[i]) continue;          // Stopped by an earlier callback in this pass
+        if (DNSServiceProcessResult(refs[i]) != kDNSServiceErr_NoError)
+        {
+            // The operation itself is left for its owner to stop, when it times out
+            if (refs[i] == gConnection) return -1;
+            PollRemove(refs[i]);
+        }
+    }
+    return 0;
+}
+
+static int ConnectionSetUp(void)
+{
+    DNSServiceErrorType err;
+    if (!gShareConnection) return 0;
+    err = DNSServiceCreateConnection(&gConnection);
+    if (err) { fprintf(stderr, "DNSServiceCreateConnection failed %d\n", err); return -1; }
+    PollAdd(gConnection);
+    return 0;
+}
+
+static void ConnectionTearDown(void)
+{
+    if (!gConnection) return;
+    PollRemove(gConnection);
+    DNSServiceRefDeallocate(gConnection);
+    gConnection = NULL;
+}
+
+static void HandleSignal(int sig)
+{
+    (void)sig;
+    gStopNow = 1;
+}
+
+//*************************************************************************************************************
+// replier
+
+typedef struct
+{
+    DNSServiceRef ref;
+    double start;
+} RegisterOp;
+
+static Samples gRegisterLatency;
+static int gRegisterErrors;
+
+static void DNSSD_API RegisterReply(DNSServiceRef sdref, const DNSServiceFlags flags, DNSServiceErrorType errorCode,
+                                    const char *name, const char *regtype, const char *domain, void *context)
+{
+    RegisterOp *const op = context;
+    (void)sdref; (void)flags; (void)name; (void)regtype; (void)domain;
+    if (errorCode) gRegisterErrors++;
+    else if (op->start) { SamplesAdd(&gRegisterLatency, NowMs() - op->start); op->start = 0; }
+}
+
+static void DNSSD_API RegisterRecordReply(DNSServiceRef sdref, DNSRecordRef rec, const DNSServiceFlags flags,
+                                          DNSServiceErrorType errorCode, void *context)
+{
+    RegisterOp *const op = context;
+    (void)sdref; (void)rec; (void)flags;
+    if (errorCode) gRegisterErrors++;
+    else if (op->start) { SamplesAdd(&gRegisterLatency, NowMs() - op->start); op->start = 0; }
+}
+
+static int ReplierCmd(const int count, const int addresses, const char *const type)
+{
+    RegisterOp *const services = calloc((size_t)count, sizeof(RegisterOp));
+    RegisterOp *const hosts = calloc((size_t)count, sizeof(RegisterOp));
+    DNSServiceRef recordConnection = NULL;
+    double start;
+    int i, outstanding;
+
+    if (!services || !hosts || ConnectionSetUp()) return 1;
+    if (addresses)
+    {
+        // DNSServiceRegisterRecord needs a connection made by DNSServiceCreateConnection
+        if (gShareConnection) recordConnection = gConnection;
+        else if (DNSServiceCreateConnection(&recordConnection) == kDNSServiceErr_NoError) PollAdd(recordConnection);
+        else { fprintf(stderr, "DNSServiceCreateConnection failed\n"); return 1; }
+    }
+
+    start = NowMs();
+    for (i = 0; i < count; i++)
+    {
+        char name[64], txt[32];
+        DNSServiceFlags flags = OpPrepare(&services[i].ref, 0);
+        DNSServiceErrorType err;
+
+        snprintf(name, sizeof(name), kInstanceNameFormat, i);
+        txt[0] = (char)snprintf(txt + 1, sizeof(txt) - 1, "i=%d", i);
+        services[i].start = NowMs();
+        err = DNSServiceRegister(&services[i].ref, flags, kDNSServiceInterfaceIndexAny, name, type, NULL, NULL,
+                                 htons(9), (uint16_t)(txt[0] + 1), txt, RegisterReply, &services[i]);
+        if (err) { services[i].ref = NULL; gRegisterErrors++; continue; }
+        OpStarted(services[i].ref);
+
+        if (recordConnection)
+        {
+            char host[kDNSServiceMaxDomainName];
+            DNSRecordRef rec;
+            const unsigned char addr[4] = { 169, 254, (unsigned char)(1 + i / 254 % 254), (unsigned char)(1 + i % 254) };
+            snprintf(host, sizeof(host), kHostNameFormat, i);
+            hosts[i].start = NowMs();
+            err = DNSServiceRegisterRecord(recordConnection, &rec, kDNSServiceFlagsUnique, kDNSServiceInterfaceIndexAny, host,
+                                           kDNSServiceType_A, kDNSServiceClass_IN, sizeof(addr), addr, 120, RegisterRecordReply, &hosts[i]);
+            if (err) gRegisterErrors++;
+        }
+        // Keep the daemon's replies flowing, or a large registration burst fills the socket buffers
+        if (ProcessEvents(0) < 0) { fprintf(stderr, "Lost connection to the daemon\n"); return 1; }
+    }
+
+    printf("Registering %d services%s of type %s\n", count, recordConnection ? " and host records" : "", type);
+    for (;;)
+    {
+        outstanding = count * (recordConnection ? 2 : 1) - (int)gRegisterLatency.count - gRegisterErrors;
+        if (outstanding <= 0 || gStopNow || NowMs() - start > gTimeoutMs) break;
+        if (ProcessEvents(100) < 0) { fprintf(stderr, "Lost connection to the daemon\n"); return 1; }
+    }
+    SamplesReportHeader();
+    SamplesReport("registration", &gRegisterLatency);
+    if (gRegisterErrors || outstanding > 0) printf("Errors %d, still outstanding %d\n", gRegisterErrors, outstanding);
+
+    // Stay registered (and keep answering the daemon) until told to stop
+    printf("Registered; %s\n", gDurationSec ? "waiting for the test duration to expire" : "press ^C to stop");
+    fflush(stdout);
+    while (!gStopNow && (!gDurationSec || NowMs() - start < gDurationSec * 1e3))
+        if (ProcessEvents(500) < 0) { fprintf(stderr, "Lost connection to the daemon\n"); return 1; }
+
+    for (i = 0; i < count; i++) OpStop(&services[i].ref);
+    if (recordConnection && recordConnection != gConnection) DNSServiceRefDeallocate(recordConnection);
+    return 0;
+}
+
+//*************************************************************************************************************
+// gaiperf
+
+typedef struct
+{
+    DNSServiceRef ref;
+    double start;
+} GAIOp;
+
+static Samples gGAILatency;
+static int gGAIErrors, gGAITimeouts, gGAICompleted;
+
+static void DNSSD_API GAIReply(DNSServiceRef sdref, DNSServiceFlags flags, uint32_t interfaceIndex, DNSServiceErrorType errorCode,
+                               const char *hostname, const struct sockaddr *address, uint32_t ttl, void *context)
+{
+    GAIOp *const op = context;
+    (void)sdref; (void)interfaceIndex; (void)hostname; (void)address; (void)ttl;
+    if (errorCode == kDNSServiceErr_NoSuchRecord) return;              // e.g. no AAAA record; wait for the other family
+    if (errorCode) gGAIErrors++;
+    else if (!(flags & kDNSServiceFlagsAdd)) return;
+    else { SamplesAdd(&gGAILatency, NowMs() - op->start); gGAICompleted++; }
+    OpStop(&op->ref);
+}
+
+// Runs total lookups, concurrency at a time, and returns how long they took in ms, or -1 if the daemon went away
+static double RunGAIs(const int concurrency, const int total, const DNSServiceProtocol protocol, const uint32_t ifIndex,
+                      char **const names, const int numNames, const int numHosts)
+{
+    GAIOp *const ops = calloc((size_t)concurrency, sizeof(GAIOp));
+    double start, wallMs;
+    int started = 0, i;
+
+    if (!ops) return -1;
+    start = NowMs();
+    while (!gStopNow && (gGAICompleted + gGAIErrors + gGAITimeouts < total))
+    {
+        const double now = NowMs();
+        if (gDurationSec && now - start > gDurationSec * 1e3) break;
+        for (i = 0; i < concurrency; i++)
+        {
+            GAIOp *const op = &ops[i];
+            if (op->ref && now - op->start > gTimeoutMs) { OpStop(&op->ref); gGAITimeouts++; }
+            if (!op->ref && started < total)
+            {
+                char host[kDNSServiceMaxDomainName];
+                const char *name = host;
+                const DNSServiceFlags flags = OpPrepare(&op->ref, 0);
+                if (numNames) name = names[started % numNames];
+                else snprintf(host, sizeof(host), kHostNameFormat, started % numHosts);
+                op->start = NowMs();
+                started++;
+                if (DNSServiceGetAddrInfo(&op->ref, flags, ifIndex, protocol, name, GAIReply, op))
+                {
+                    op->ref = NULL;
+                    gGAIErrors++;
+                    continue;
+                }
+                OpStarted(op->ref);
+            }
+        }
+        if (ProcessEvents(10) < 0) { fprintf(stderr, "Lost connection to the daemon\n"); free(ops); return -1; }
+    }
+    wallMs = NowMs() - start;
+    for (i = 0; i < concurrency; i++) OpStop(&ops[i].ref);
+    free(ops);
+    return wallMs;
+}
+
+static int GAIPerfCmd(const int concurrency, const int total, const DNSServiceProtocol protocol,
+                      char **const names, const int numNames, const int numHosts)
+{
+    double cpuStart, wallMs;
+
+    if (ConnectionSetUp()) return 1;
+    printf("Running %d DNSServiceGetAddrInfo operations, %d at a time, over %d names\n", total, concurrency,
+           numNames ? numNames : numHosts);
+    cpuStart = DaemonCPUSeconds();
+    wallMs = RunGAIs(concurrency, total, protocol, kDNSServiceInterfaceIndexAny, names, numNames, numHosts);
+    if (wallMs < 0) return 1;
+
+    SamplesReportHeader();
+    SamplesReport("getaddrinfo", &gGAILatency);
+    printf("Completed %d, errors %d, timeouts %d, %.0f operations/s\n", gGAICompleted, gGAIErrors, gGAITimeouts,
+           wallMs > 0 ? gGAICompleted * 1e3 / wallMs : 0);
+    ReportDaemonCPU(cpuStart, wallMs);
+    return (gGAIErrors || gGAITimeouts) ? 1 : 0;
+}
+
+//*************************************************************************************************************
+// browse
+
+typedef struct
+{
+    DNSServiceRef ref;
+    double start;
+    int found;
+    int complete;
+} BrowseOp;
+
+typedef struct
+{
+    DNSServiceRef ref;
+    double start;
+} ResolveOp;
+
+static Samples gBrowseInstanceLatency, gBrowseCompleteLatency, gResolveLatency;
+static ResolveOp gResolves[kMaxRefs];
+static int gExpected, gResolve, gResolveErrors, gResolveTimeouts, gBrowsesComplete;
+
+static void DNSSD_API ResolveReply(DNSServiceRef sdref, const DNSServiceFlags flags, uint32_t ifIndex, DNSServiceErrorType errorCode,
+                                   const char *fullname, const char *hosttarget, uint16_t opaqueport, uint16_t txtLen,
+                                   const unsigned char *txtRecord, void *context)
+{
+    ResolveOp *const op = context;
+    (void)sdref; (void)flags; (void)ifIndex; (void)fullname; (void)hosttarget; (void)opaqueport; (void)txtLen; (void)txtRecord;
+    if (errorCode) gResolveErrors++;
+    else SamplesAdd(&gResolveLatency, NowMs() - op->start);
+    OpStop(&op->ref);
+}
+
+static void StartResolve(const char *const name, const char *const type, const char *const domain, const uint32_t ifIndex)
+{
+    int i;
+    for (i = 0; i < kMaxRefs && gResolves[i].ref; i++) continue;
+    if (i == kMaxRefs) { gResolveErrors++; return; }
+    gResolves[i].start = NowMs();
+    if (DNSServiceResolve(&gResolves[i].ref, OpPrepare(&gResolves[i].ref, 0), ifIndex, name, type, domain, ResolveReply, &gResolves[i]))
+    {
+        gResolves[i].ref = NULL;
+        gResolveErrors++;
+        return;
+    }
+    OpStarted(gResolves[i].ref);
+}
+
+static void DNSSD_API BrowseReply(DNSServiceRef sdref, const DNSServiceFlags flags, uint32_t ifIndex, DNSServiceErrorType errorCode,
+                                  const char *name, const char *type, const char *domain, void *context)
+{
+    BrowseOp *const op = context;
+    (void)sdref;
+    if (errorCode || !(flags & kDNSServiceFlagsAdd)) return;
+    if (strncmp(name, "dnssd-perf-", 11)) return;                       // Not one of the replier's
+    SamplesAdd(&gBrowseInstanceLatency, NowMs() - op->start);
+    if (++op->found == gExpected && !op->complete)
+    {
+        SamplesAdd(&gBrowseCompleteLatency, NowMs() - op->start);
+        op->complete = 1;
+        gBrowsesComplete++;
+    }
+    if (gResolve) StartResolve(name, type, domain, ifIndex);
+}
+
+// Runs one round of concurrent browses, returning how many didn't find every instance, or -1 on failure
+static int BrowseRound(BrowseOp *const ops, const int concurrency, const char *const type, const uint32_t ifIndex)
+{
+    const int target = gBrowsesComplete + concurrency;
+    const double roundStart = NowMs();
+    int i, incomplete = 0;
+
+    for (i = 0; i < concurrency; i++)
+    {
+        const DNSServiceFlags flags = OpPrepare(&ops[i].ref, 0);
+        ops[i].start = NowMs();
+        ops[i].found = 0;
+        ops[i].complete = 0;
+        if (DNSServiceBrowse(&ops[i].ref, flags, ifIndex, type, NULL, BrowseReply, &ops[i]))
+        {
+            ops[i].ref = NULL;
+            fprintf(stderr, "DNSServiceBrowse failed\n");
+            return -1;
+        }
+        OpStarted(ops[i].ref);
+    }
+    // Each round ends when every browse has found all the instances, or after the timeout
+    while (!gStopNow && gBrowsesComplete < target && NowMs() - roundStart < gTimeoutMs)
+        if (ProcessEvents(10) < 0) { fprintf(stderr, "Lost connection to the daemon\n"); return -1; }
+    // Give outstanding resolves the rest of their time
+    for (;;)
+    {
+        int pending = 0;
+        const double now = NowMs();
+        for (i = 0; i < kMaxRefs; i++)
+            if (gResolves[i].ref)
+            {
+                if (now - gResolves[i].start > gTimeoutMs) { OpStop(&gResolves[i].ref); gResolveTimeouts++; }
+                else pending++;
+            }
+        if (!pending || gStopNow) break;
+        if (ProcessEvents(10) < 0) { fprintf(stderr, "Lost connection to the daemon\n"); return -1; }
+    }
+    for (i = 0; i < concurrency; i++)
+    {
+        if (!ops[i].complete) incomplete++;
+        OpStop(&ops[i].ref);
+    }
+    return incomplete;
+}
+
+static int BrowseCmd(const int concurrency, const int rounds, const char *const type)
+{
+    BrowseOp *const ops = calloc((size_t)concurrency, sizeof(BrowseOp));
+    double cpuStart, start;
+    int round, incomplete = 0;
+
+    if (!ops || ConnectionSetUp()) return 1;
+    printf("Running %d rounds of %d concurrent browses for %s, expecting %d instances each\n", rounds, concurrency, type, gExpected);
+    cpuStart = DaemonCPUSeconds();
+    start = NowMs();
+    for (round = 0; round < rounds && !gStopNow; round++)
+    {
+        const int n = BrowseRound(ops, concurrency, type, kDNSServiceInterfaceIndexAny);
+        if (n < 0) return 1;
+        incomplete += n;
+    }
+
+    SamplesReportHeader();
+    SamplesReport("browse (per instance)", &gBrowseInstanceLatency);
+    SamplesReport("browse (all instances)", &gBrowseCompleteLatency);
+    if (gResolve) SamplesReport("resolve", &gResolveLatency);
+    printf("Browses complete %d, incomplete %d", gBrowsesComplete, incomplete);
+    if (gResolve) printf(", resolve errors %d, resolve timeouts %d", gResolveErrors, gResolveTimeouts);
+    printf("\n");
+    ReportDaemonCPU(cpuStart, NowMs() - start);
+    return (incomplete || gResolveErrors || gResolveTimeouts) ? 1 : 0;
+}
+
+//*************************************************************************************************************
+// ipcbench
+
+// Every record ipcbench registers is on the LocalOnly interface, and every browse and lookup is scoped to it, so the
+// core answers from its local record lists without probing or any network traffic, leaving the client library, the
+// socket round trips and uds_daemon as the work measured. Run it against a daemon started with -interfaces naming no
+// real interface, and with -replycap 0 -processreplycap 0 so that the browse fan-out can't trip the reply queue caps;
+// "make ipcbench" in mDNSPosix does that with a private mdnsd and socket.
+
+#define kBenchBatchSize 256             // Records per DNSServiceRegisterRecordBatch() call
+
+static int gJSON;                       // -j: one JSON object per result instead of a table
+static int gBenchReplies, gBenchErrors;
+
+static void DNSSD_API BenchRecordReply(DNSServiceRef sdref, DNSRecordRef rec, const DNSServiceFlags flags,
+                                       DNSServiceErrorType errorCode, void *context)
+{
+    (void)sdref; (void)rec; (void)flags; (void)context;
+    if (errorCode) gBenchErrors++;
+    else gBenchReplies++;
+}
+
+// Fills in entry i of the synthetic record set: the address record for host i, or the PTR record for instance i
+static void BenchRecord(DNSServiceRegisterRecordBatchEntry *const e, const int i, const int ptr, char *const name,
+                        unsigned char *const rdata, const char *const type)
+{
+    memset(e, 0, sizeof(*e));
+    e->interfaceIndex = kDNSServiceInterfaceIndexLocalOnly;
+    e->rrclass  = kDNSServiceClass_IN;
+    e->ttl      = 120;
+    e->callBack = BenchRecordReply;
+    e->fullname = name;
+    e->rdata    = rdata;
+    if (ptr)
+    {
+        // rdata is the instance name in wire format: one label for the instance, then the type and "local"
+        char instance[kDNSServiceMaxDomainName];
+        const char *p;
+        size_t len = 0;
+        snprintf(name, kDNSServiceMaxDomainName, "%s.local.", type);
+        snprintf(instance, sizeof(instance), kInstanceNameFormat ".%s.local", i, type);
+        for (p = instance; *p; )
+        {
+            const char *const dot = strchr(p, '.');
+            const size_t label = dot ? (size_t)(dot - p) : strlen(p);
+            rdata[len++] = (unsigned char)label;
+            memcpy(rdata + len, p, label);
+            len += label;
+            p += label + (dot ? 1 : 0);
+        }
+        rdata[len++] = 0;
+        e->flags  = kDNSServiceFlagsShared;
+        e->rrtype = kDNSServiceType_PTR;
+        e->rdlen  = (uint16_t)len;
+    }
+    else
+    {
+        snprintf(name, kDNSServiceMaxDomainName, kHostNameFormat, i);
+        rdata[0] = 169; rdata[1] = 254; rdata[2] = (unsigned char)(1 + i / 254 % 254); rdata[3] = (unsigned char)(1 + i % 254);
+        e->flags  = kDNSServiceFlagsUnique;
+        e->rrtype = kDNSServiceType_A;
+        e->rdlen  = 4;
+    }
+}
+
+static void BenchReport(const char *const bench, const char *const mode, const int requests, const double requestMs,
+                        const int replies, const double replyMs, const double cpuStart)
+{
+    const double cpuEnd = DaemonCPUSeconds();
+    const double cpu = (cpuStart >= 0 && cpuEnd >= 0) ? cpuEnd - cpuStart : -1;
+    const double requestRate = requestMs > 0 ? requests * 1e3 / requestMs : 0;
+    const double replyRate = replyMs > 0 ? replies * 1e3 / replyMs : 0;
+
+    if (gJSON)
+    {
+        printf("{\"benchmark\":\"%s\",\"mode\":\"%s\",\"requests\":%d,\"replies\":%d,\"errors\":%d,"
+               "\"seconds\":%.6f,\"requests_per_sec\":%.1f,\"replies_per_sec\":%.1f,\"daemon_cpu_seconds\":",
+               bench, mode, requests, replies, gBenchErrors, replyMs / 1e3, requestRate, replyRate);
+        if (cpu >= 0) printf("%.3f}\n", cpu);
+        else printf("null}\n");
+    }
+    else
+    {
+        printf("%-12s %-10s %9d %9d %9.3f %12.0f %12.0f", bench, mode, requests, replies, replyMs / 1e3, requestRate, replyRate);
+        if (cpu >= 0) printf(" %9.3f", cpu);
+        if (gBenchErrors) printf("  (%d errors)", gBenchErrors);
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+// Registers count records on conn, one DNSServiceRegisterRecord() at a time or in batches, and waits for all their
+// callbacks. Sets *requestMs to the time the registration calls took, and returns the total time, or -1 on failure.
+static double BenchRegister(const DNSServiceRef conn, const int count, const int ptr, const int batch, const char *const type,
+                            double *const requestMs)
+{
+    DNSServiceRegisterRecordBatchEntry entries[kBenchBatchSize];
+    static char names[kBenchBatchSize][kDNSServiceMaxDomainName];
+    static unsigned char rdata[kBenchBatchSize][kDNSServiceMaxDomainName];
+    DNSRecordRef refs[kBenchBatchSize];
+    const int target = gBenchReplies + count;
+    const double start = NowMs();
+    int i, j, n;
+
+    for (i = 0; i < count; i += n)
+    {
+        n = (batch && count - i > kBenchBatchSize) ? kBenchBatchSize : (batch ? count - i : 1);
+        for (j = 0; j < n; j++) BenchRecord(&entries[j], i + j, ptr, names[j], rdata[j], type);
+        if (batch)
+        {
+            if (DNSServiceRegisterRecordBatch(conn, refs, (uint32_t)n, entries, NULL)) gBenchErrors += n;
+        }
+        else
+        {
+            const DNSServiceRegisterRecordBatchEntry *const e = &entries[0];
+            if (DNSServiceRegisterRecord(conn, &refs[0], e->flags, e->interfaceIndex, e->fullname, e->rrtype, e->rrclass,
+                                         e->rdlen, e->rdata, e->ttl, e->callBack, e->context)) gBenchErrors++;
+        }
+        // Keep the daemon's replies flowing, or a large registration burst fills the socket buffers
+        if (ProcessEvents(0) < 0) { fprintf(stderr, "Lost connection to the daemon\n"); return -1; }
+    }
+    *requestMs = NowMs() - start;
+    while (!gStopNow && gBenchReplies + gBenchErrors < target && NowMs() - start < gTimeoutMs)
+        if (ProcessEvents(10) < 0) { fprintf(stderr, "Lost connection to the daemon\n"); return -1; }
+    return NowMs() - start;
+}
+
+static int IPCBenchCmd(const int records, const int concurrency, const int lookups, const char *const type)
+{
+    static const char *const modes[] = { "shared", "separate" };
+    BrowseOp *const browses = calloc((size_t)concurrency, sizeof(BrowseOp));
+    DNSServiceRef conn;
+    double cpuStart, requestMs, ms;
+    int mode, batch;
+
+    if (!browses) return 1;
+    if (!gJSON)
+        printf("%-12s %-10s %9s %9s %9s %12s %12s %9s\n", "benchmark", "mode", "requests", "replies", "seconds",
+               "requests/s", "replies/s", "mdnsd cpu");
+
+    // Record registration needs a DNSServiceCreateConnection() connection, so its modes are one call per record or batches
+    for (batch = 0; batch <= 1; batch++)
+    {
+        if (DNSServiceCreateConnection(&conn)) { fprintf(stderr, "DNSServiceCreateConnection failed\n"); return 1; }
+        PollAdd(conn);
+        gBenchReplies = gBenchErrors = 0;
+        cpuStart = DaemonCPUSeconds();
+        ms = BenchRegister(conn, records, 0, batch, type, &requestMs);
+        if (ms < 0) return 1;
+        BenchReport("regrecord", batch ? "batch" : "single", records, requestMs, gBenchReplies, ms, cpuStart);
+        PollRemove(conn);
+        DNSServiceRefDeallocate(conn);
+    }
+
+    // The browses and lookups find records that stay registered, untimed, for the rest of the run
+    if (DNSServiceCreateConnection(&conn)) { fprintf(stderr, "DNSServiceCreateConnection failed\n"); return 1; }
+    PollAdd(conn);
+    gBenchReplies = gBenchErrors = 0;
+    if (BenchRegister(conn, records, 0, 1, type, &requestMs) < 0 || BenchRegister(conn, records, 1, 1, type, &requestMs) < 0) return 1;
+    if (gBenchErrors || gBenchReplies < 2 * records) { fprintf(stderr, "Couldn't register the benchmark records\n"); return 1; }
+
+    gExpected = records;
+    for (mode = 0; mode < 2; mode++)
+    {
+        const size_t found = gBrowseInstanceLatency.count;
+        int incomplete;
+        gShareConnection = (mode == 0);
+        if (ConnectionSetUp()) return 1;
+
+        gBrowsesComplete = 0;
+        cpuStart = DaemonCPUSeconds();
+        requestMs = NowMs();
+        incomplete = BrowseRound(browses, concurrency, type, kDNSServiceInterfaceIndexLocalOnly);
+        ms = NowMs() - requestMs;
+        if (incomplete < 0) return 1;
+        gBenchErrors = incomplete;
+        BenchReport("browse", modes[mode], concurrency, ms, (int)(gBrowseInstanceLatency.count - found), ms, cpuStart);
+
+        gGAICompleted = gGAIErrors = gGAITimeouts = 0;
+        cpuStart = DaemonCPUSeconds();
+        ms = RunGAIs(concurrency, lookups, kDNSServiceProtocol_IPv4, kDNSServiceInterfaceIndexLocalOnly, NULL, 0, records);
+        if (ms < 0) return 1;
+        gBenchErrors = gGAIErrors + gGAITimeouts;
+        BenchReport("getaddrinfo", modes[mode], lookups, ms, gGAICompleted, ms, cpuStart);
+
+        ConnectionTearDown();
+    }
+
+    PollRemove(conn);
+    DNSServiceRefDeallocate(conn);
+    free(browses);
+    return 0;
+}
+
+//*************************************************************************************************************
+// Main
+
+static void Usage(const char *const arg0)
+{
+    fprintf(stderr, "Usage: %s [common options] replier [-r count] [-a] [-T type]\n", arg0);
+    fprintf(stderr, "       %s [common options] gaiperf [-c concurrency] [-n operations] [-4|-6] [-r count | hostname...]\n", arg0);
+    fprintf(stderr, "       %s [common options] browse [-c concurrency] [-n rounds] [-e expected] [-R] [-T type]\n", arg0);
+    fprintf(stderr, "       %s [common options] ipcbench [-r count] [-c concurrency] [-n lookups] [-j] [-T type]\n", arg0);
+    fprintf(stderr, "Common options:\n");
+    fprintf(stderr, "  -s             give every operation its own daemon connection instead of sharing one\n");
+    fprintf(stderr, "  -t ms          per-operation timeout (default %d)\n", gTimeoutMs);
+    fprintf(stderr, "  -d seconds     stop after this long (the replier otherwise runs until ^C)\n");
+    fprintf(stderr, "  -p pid         measure this daemon's CPU use (default: the pid in %s)\n", kDaemonPidFile);
+    fprintf(stderr, "Test options:\n");
+    fprintf(stderr, "  -r count       number of services the replier registers, and gaiperf's names are drawn from (default 100)\n");
+    fprintf(stderr, "  -a             replier also registers an address record dnssd-perf-host-N.local. for each service\n");
+    fprintf(stderr, "  -T type        service type (default " kDefaultServiceType ")\n");
+    fprintf(stderr, "  -c n           operations outstanding at once (default 10)\n");
+    fprintf(stderr, "  -n n           gaiperf operations in total (default 1000), or browse rounds (default 1)\n");
+    fprintf(stderr, "  -e n           instances each browse must find to complete (default: the -r count)\n");
+    fprintf(stderr, "  -R             resolve each instance found\n");
+    fprintf(stderr, "  -j             ipcbench prints one JSON object per result\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *const arg0 = argv[0];
+    const char *type = kDefaultServiceType;
+    DNSServiceProtocol protocol = 0;
+    int count = 100, concurrency = 10, total = -1, addresses = 0, opt;
+    const char *cmd;
+
+    while ((opt = getopt(argc, argv, "+st:d:p:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's': gShareConnection = 0; break;
+        case 't': gTimeoutMs = atoi(optarg); break;
+        case 'd': gDurationSec = atoi(optarg); break;
+        case 'p': gDaemonPid = atol(optarg); break;
+        default: Usage(arg0); return 2;
+        }
+    }
+    if (optind >= argc) { Usage(arg0); return 2; }
+    cmd = argv[optind];
+    argc -= optind;
+    argv += optind;
+    optind = 1;
+    gExpected = -1;
+    while ((opt = getopt(argc, argv, "r:aT:c:n:46e:Rj")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r': count = atoi(optarg); break;
+        case 'a': addresses = 1; break;
+        case 'T': type = optarg; break;
+        case 'c': concurrency = atoi(optarg); break;
+        case 'n': total = atoi(optarg); break;
+        case '4': protocol |= kDNSServiceProtocol_IPv4; break;
+        case '6': protocol |= kDNSServiceProtocol_IPv6; break;
+        case 'e': gExpected = atoi(optarg); break;
+        case 'R': gResolve = 1; break;
+        case 'j': gJSON = 1; break;
+        default: Usage(arg0); return 2;
+        }
+    }
+    if (count <= 0 || concurrency <= 0 || concurrency > kMaxRefs / 2) { Usage(arg0); return 2; }
+    if (!gDaemonPid) gDaemonPid = FindDaemonPid();
+    if (gExpected < 0) gExpected = count;
+    signal(SIGINT, HandleSignal);
+    signal(SIGTERM, HandleSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!strcmp(cmd, "replier")) return ReplierCmd(count, addresses, type);
+    if (!strcmp(cmd, "gaiperf"))
+        return GAIPerfCmd(concurrency, total > 0 ? total : 1000, protocol ? protocol : kDNSServiceProtocol_IPv4,
+                          argv + optind, argc - optind, count);
+    if (!strcmp(cmd, "browse")) return BrowseCmd(concurrency, total > 0 ? total : 1, type);
+    if (!strcmp(cmd, "ipcbench")) return IPCBenchCmd(count, concurrency, total > 0 ? total : 1000, type);
+    Usage(arg0);
+    return 2;
+}
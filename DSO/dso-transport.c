@@ -101,6 +101,15 @@ dso_transport_finalize(dso_transport_t *transport)
 #endif
         transport->connection = NULL;
     }
+    LogInfo("dso_transport_finalize: output queue: %u messages, %u writes (%u short), max depth %lu, refused %u times",
+            transport->queue_stats.messages, transport->queue_stats.flushes, transport->queue_stats.short_writes,
+            (unsigned long)transport->queue_stats.max_depth, transport->queue_stats.refused);
+#ifndef DSO_USES_NETWORK_FRAMEWORK
+    if (transport->output_queue != NULL) {
+        freeL("dso_output_queue", transport->output_queue);
+        transport->output_queue = NULL;
+    }
+#endif
     while (*tp) {
         if (*tp == transport) {
             *tp = transport->next;
@@ -126,6 +135,20 @@ int32_t dso_transport_idle(void *context, int64_t now_in, int64_t next_timer_eve
     mDNS *m = context;
     mDNSs32 now = (mDNSs32)now_in;
     mDNSs32 next_event = (mDNSs32)next_timer_event;
+#ifndef DSO_USES_NETWORK_FRAMEWORK
+    dso_transport_t *transport;
+
+    // Write out whatever was queued since the last pass through the event loop.   If the remote end isn't
+    // reading, some may be left over; try again shortly.
+    for (transport = dso_transport_states; transport != NULL; transport = transport->next) {
+        if (transport->queue_stats.depth != 0 && dso_transport_flush(transport) && transport->queue_stats.depth != 0) {
+            mDNSs32 retry = now + mDNSPlatformOneSecond / 10;
+            if (next_event - retry > 0) {
+                next_event = retry;
+            }
+        }
+    }
+#endif
 
     // Notice if a DSO connection state is active but hasn't seen activity in a while.
     for (cs = dso_connect_states; cs != NULL; cs = cnext) {
@@ -191,10 +214,11 @@ void dso_set_callback(dso_state_t *dso, void *context, dso_event_callback_t cb)
 // EWOULDBLOCK; in that case, things are so dysfunctional that killing the connection isn't any worse than
 // allowing it to continue.
 
-// An additional note about the motivation for this code: the idea originally was that we'd do scatter/gather
-// I/O here: this lets us write everything out in a single sendmsg() call.   This isn't used with the mDNSPlatformTCP
-// code because it doesn't support scatter/gather.   Network Framework does, however, and in principle we could
-// write to the descriptor directly if that were really needed.
+// An additional note about the motivation for this code: the idea is that we do scatter/gather I/O here: this
+// lets us write everything out at once.   With Network Framework, the hunks are chained together as dispatch
+// data, and shared payloads are handed over without being copied.   The mDNSPlatformTCP code doesn't support
+// scatter/gather, and may be doing TLS, so there the hunks are gathered into a single buffer and written with
+// one mDNSPlatformWriteTCP call, rather than one call (and one TCP segment or TLS record) per hunk.
 
 bool dso_write_start(dso_transport_t *transport, size_t length)
 {
@@ -224,6 +248,7 @@ bool dso_write_start(dso_transport_t *transport, size_t length)
     // versus how many bytes that we've written have completed, and if that creeps above MAX_UNSENT_BYTES,
     // we return false here to indicate that there is congestion.
     if (transport->unsent_bytes > MAX_UNSENT_BYTES) {
+        transport->queue_stats.refused++;
         return false;
     } else {
         return true;
@@ -236,6 +261,11 @@ bool dso_write_start(dso_transport_t *transport, size_t length)
     transport->write_lengths[0] = 2;
     transport->num_to_write = 1;
 
+    // If the remote end isn't reading what's already queued, don't add to it.
+    if (transport->queue_stats.depth > MAX_UNSENT_BYTES) {
+        transport->queue_stats.refused++;
+        return false;
+    }
     return mDNSPlatformTCPWritable(transport->connection);
 #endif // DSO_USES_NETWORK_FRAMEWORK
 }
@@ -255,6 +285,12 @@ bool dso_write_finish(dso_transport_t *transport)
         return false;
     }
     transport->unsent_bytes += bytes_to_write;
+    transport->queue_stats.depth = transport->unsent_bytes;
+    if (transport->queue_stats.depth > transport->queue_stats.max_depth) {
+        transport->queue_stats.max_depth = transport->queue_stats.depth;
+    }
+    transport->queue_stats.messages++;
+    transport->queue_stats.flushes++;
     nw_connection_send(transport->connection, transport->to_write, NW_CONNECTION_DEFAULT_STREAM_CONTEXT, true,
                        ^(nw_error_t  _Nullable error) {
                            dso_state_t *dso;
@@ -267,6 +303,7 @@ bool dso_write_finish(dso_transport_t *transport)
                                }
                            } else {
                                dso->transport->unsent_bytes -= bytes_to_write;
+                               dso->transport->queue_stats.depth = dso->transport->unsent_bytes;
                                LogMsg("dso_write_finish completion routine: %d bytes written, %d bytes outstanding",
                                       bytes_to_write, dso->transport->unsent_bytes);
                            }
@@ -276,7 +313,7 @@ bool dso_write_finish(dso_transport_t *transport)
     transport->to_write = NULL;
     return true;
 #else
-    ssize_t result, total = 0;
+    ssize_t total = 0;
     int i;
 
    if (transport->num_to_write > MAX_WRITE_HUNKS) {
@@ -286,20 +323,68 @@ bool dso_write_finish(dso_transport_t *transport)
         return false;
     }
 
-    // This is our ersatz scatter/gather I/O.
-    for (i = 0; i < transport->num_to_write; i++) {
-        result = mDNSPlatformWriteTCP(transport->connection, (const char *)transport->to_write[i], transport->write_lengths[i]);
-        if (result != transport->write_lengths[i]) {
-            if (result < 0) {
-                LogMsg("dso_write_finish: fatal: mDNSPlatformWrite on %s returned %d", transport->dso->remote_name, errno);
-            } else {
-                LogMsg("dso_write_finish: fatal: mDNSPlatformWrite: short write on %s: %ld < %ld",
-                       transport->dso->remote_name, (long)result, (long)total);
-            }
+    // This is our ersatz scatter/gather I/O: the hunks are gathered onto the end of the output queue, which is
+    // written out by dso_transport_idle, or right away once there's enough of it.
+    if (transport->output_queue == NULL) {
+        transport->output_queue = mallocL("dso_output_queue", DSO_OUTPUT_QUEUE_SIZE);
+        if (transport->output_queue == NULL) {
+            LogMsg("dso_write_finish: fatal: no memory for output queue on %s", transport->dso->remote_name);
             dso_drop(transport->dso);
             return false;
         }
     }
+    for (i = 0; i < transport->num_to_write; i++) {
+        total += transport->write_lengths[i];
+    }
+    if (transport->queue_stats.depth + total > DSO_OUTPUT_QUEUE_SIZE) {
+        LogMsg("dso_write_finish: fatal: output queue on %s is full (%lu bytes)", transport->dso->remote_name,
+               (unsigned long)transport->queue_stats.depth);
+        dso_drop(transport->dso);
+        return false;
+    }
+    for (i = 0; i < transport->num_to_write; i++) {
+        memcpy(transport->output_queue + transport->queue_stats.depth, transport->to_write[i], transport->write_lengths[i]);
+        transport->queue_stats.depth += transport->write_lengths[i];
+    }
+    transport->num_to_write = 0;
+    transport->queue_stats.messages++;
+    if (transport->queue_stats.depth > transport->queue_stats.max_depth) {
+        transport->queue_stats.max_depth = transport->queue_stats.depth;
+    }
+    if (transport->queue_stats.depth >= DSO_OUTPUT_FLUSH_THRESHOLD) {
+        return dso_transport_flush(transport);
+    }
+#endif
+    return true;
+}
+
+// Write out as much of the output queue as the connection will take.   What the connection doesn't take stays
+// queued for next time.   Returns false if the connection failed, in which case it has been dropped.
+bool dso_transport_flush(dso_transport_t *transport)
+{
+#ifdef DSO_USES_NETWORK_FRAMEWORK
+    (void)transport;
+#else
+    size_t unsent = transport->queue_stats.depth;
+    long result;
+
+    if (unsent == 0 || transport->connection == NULL) {
+        return true;
+    }
+    result = mDNSPlatformWriteTCP(transport->connection, (const char *)transport->output_queue, unsent);
+    transport->queue_stats.flushes++;
+    if (result < 0) {
+        LogMsg("dso_transport_flush: fatal: mDNSPlatformWrite on %s returned %d", transport->dso->remote_name, errno);
+        transport->queue_stats.depth = 0;
+        dso_drop(transport->dso);
+        return false;
+    }
+    if ((size_t)result < unsent) {
+        // The remote end isn't keeping up; keep the rest for next time.
+        transport->queue_stats.short_writes++;
+        memmove(transport->output_queue, transport->output_queue + result, unsent - result);
+    }
+    transport->queue_stats.depth = unsent - result;
 #endif
     return true;
 }
@@ -350,15 +435,67 @@ void dso_write(dso_transport_t *transport, const uint8_t *buf, size_t length)
 #endif
 }
 
+// Like dso_write, but for data in a shared payload.   With Network Framework the payload is sent without
+// being copied, and a reference to it is held until the send is done with it.
+void dso_write_payload(dso_transport_t *transport, dso_payload_t *payload)
+{
+#ifdef DSO_USES_NETWORK_FRAMEWORK
+    if (payload->length == 0 || transport->write_failed) {
+        return;
+    }
+    dso_payload_retain(payload);
+    // The destructor can run while the lock is held, so the release is done later.
+    dispatch_data_t dpd = dispatch_data_create(payload->data, payload->length, dso_dispatch_queue, ^{
+            dispatch_async(dso_dispatch_queue, ^{
+                    KQueueLock();
+                    dso_payload_release(payload);
+                    KQueueUnlock("dso_write_payload destructor");
+                });
+        });
+    if (dpd == NULL) {
+        dso_payload_release(payload);
+        transport->write_failed = true;
+        return;
+    }
+    if (transport->to_write != NULL) {
+        dispatch_data_t dpc = dispatch_data_create_concat(transport->to_write, dpd);
+        dispatch_release(dpd);
+        dispatch_release(transport->to_write);
+        if (dpc == NULL) {
+            transport->to_write = NULL;
+            transport->write_failed = true;
+            return;
+        }
+        transport->to_write = dpc;
+    } else {
+        transport->to_write = dpd;
+    }
+#else
+    dso_write(transport, payload->data, payload->length);
+#endif
+}
+
 // Write a DSO message
 int dso_message_write(dso_state_t *dso, dso_message_t *msg, bool disregard_low_water)
 {
     dso_transport_t *transport = dso->transport;
+    dso_hunk_t hunks[DSO_MESSAGE_MAX_HUNKS];
+    int i, num_hunks;
+
+    num_hunks = dso_message_hunks(msg, hunks, DSO_MESSAGE_MAX_HUNKS);
+    if (num_hunks < 0) {
+        LogMsg("dso_message_write: fatal internal programming error: too many hunks in message");
+        return mStatus_BadParamErr;
+    }
     if (transport->connection != NULL) {
         if (dso_write_start(transport, dso_message_length(msg)) || disregard_low_water) {
-            dso_write(transport, msg->buf, msg->no_copy_bytes_offset);
-            dso_write(transport, msg->no_copy_bytes, msg->no_copy_bytes_len);
-            dso_write(transport, &msg->buf[msg->no_copy_bytes_offset], msg->cur - msg->no_copy_bytes_offset);
+            for (i = 0; i < num_hunks; i++) {
+                if (hunks[i].payload != NULL) {
+                    dso_write_payload(transport, hunks[i].payload);
+                } else {
+                    dso_write(transport, hunks[i].bytes, hunks[i].length);
+                }
+            }
             return dso_write_finish(transport);
         }
     }
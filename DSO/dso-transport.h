@@ -34,6 +34,25 @@
 // allow us to use TCP_NOTSENT_LOWAT directly.
 #define MAX_UNSENT_BYTES 60000
 
+// When not using NW Framework, messages are queued on the connection and written together once per pass
+// through the event loop, or as soon as this many bytes are waiting.
+#define DSO_OUTPUT_FLUSH_THRESHOLD 16384
+
+// The output queue also holds whatever the remote end hasn't yet read.   Once MAX_UNSENT_BYTES are waiting,
+// the connection is reported as not writable; there is room for one more maximum-sized message beyond that,
+// and a connection that overflows its queue is dropped.
+#define DSO_OUTPUT_QUEUE_SIZE (MAX_UNSENT_BYTES + 65537)
+
+// Statistics about a connection's output queue
+typedef struct dso_queue_stats {
+    size_t depth;                  // Bytes waiting to be written (or, with NW Framework, to complete)
+    size_t max_depth;              // The most bytes that have been waiting at once
+    uint32_t messages;             // Messages queued
+    uint32_t flushes;              // Writes to the connection
+    uint32_t short_writes;         // Writes that left some of the queue behind
+    uint32_t refused;              // Times dso_write_start reported the connection as not writable
+} dso_queue_stats_t;
+
 struct dso_transport {
     dso_state_t *dso;			   // DSO state for which this is the transport 
     struct dso_transport *next;    // Transport is on list of transports.
@@ -59,11 +78,13 @@ struct dso_transport {
 
     uint8_t lenbuf[2];             // Buffer for storing the length in a DNS TCP message
 
-#define MAX_WRITE_HUNKS 4          // When writing a DSO message, we need this many separate hunks.
+#define MAX_WRITE_HUNKS (DSO_MESSAGE_MAX_HUNKS + 1) // A DSO message's hunks, plus its length.
     const uint8_t *to_write[MAX_WRITE_HUNKS];
     ssize_t write_lengths[MAX_WRITE_HUNKS];
     int num_to_write;
+    uint8_t *output_queue;         // Messages waiting to be written, gathered from their hunks.
 #endif // DSO_USES_NETWORK_FRAMEWORK
+    dso_queue_stats_t queue_stats;
 
     uint8_t *outbuf;               // Output buffer for building and sending DSO messages
     size_t outbuf_size;
@@ -131,6 +152,8 @@ mStatus dso_listen(dso_connect_state_t *listen_context);
 bool dso_write_start(dso_transport_t *transport, size_t length);
 bool dso_write_finish(dso_transport_t *transport);
 void dso_write(dso_transport_t *transport, const uint8_t *buf, size_t length);
+void dso_write_payload(dso_transport_t *transport, dso_payload_t *payload);
+bool dso_transport_flush(dso_transport_t *transport);
 #endif // __DSO_TRANSPORT_H
 
 // Local Variables:
@@ -67,12 +67,13 @@ extern uint16_t srp_random16(void);
 static dso_state_t *dso_connections;
 static dso_state_t *dso_connections_needing_cleanup; // DSO connections that have been shut down but aren't yet freed.
 static uint32_t dso_serial; // Used to uniquely mark DSO objects, incremented once for each dso_state_t created.
+static dso_state_t *dso_connections_by_serial[DSO_SERIAL_HASH_SIZE]; // dso_connections, hashed on serial number.
 
 dso_state_t *dso_find_by_serial(uint32_t serial)
 {
     dso_state_t *dsop;
 
-    for (dsop = dso_connections; dsop; dsop = dsop->next) {
+    for (dsop = dso_connections_by_serial[serial % DSO_SERIAL_HASH_SIZE]; dsop; dsop = dsop->serial_next) {
         if (dsop->serial == serial) {
             return dsop;
         }
@@ -80,6 +81,20 @@ dso_state_t *dso_find_by_serial(uint32_t serial)
     return NULL;
 }
 
+static void dso_serial_unlink(dso_state_t *dso)
+{
+    dso_state_t **dsopp = &dso_connections_by_serial[dso->serial % DSO_SERIAL_HASH_SIZE];
+
+    while (*dsopp != NULL) {
+        if (*dsopp == dso) {
+            *dsopp = dso->serial_next;
+            break;
+        }
+        dsopp = &(*dsopp)->serial_next;
+    }
+    dso->serial_next = NULL;
+}
+
 // This function is called either when an error has occurred requiring the a DSO connection be
 // dropped, or else when a connection to a DSO endpoint has been cleanly closed and is ready to be
 // dropped for that reason.
@@ -102,6 +117,7 @@ void dso_drop(dso_state_t *dso)
             return;
         }
     }
+    dso_serial_unlink(dso);
     dso->next = dso_connections_needing_cleanup;
     dso_connections_needing_cleanup = dso;
 }
@@ -197,6 +213,8 @@ dso_state_t *dso_create(bool is_server, int max_outstanding_queries, const char
 
     dso->next = dso_connections;
     dso_connections = dso;
+    dso->serial_next = dso_connections_by_serial[dso->serial % DSO_SERIAL_HASH_SIZE];
+    dso_connections_by_serial[dso->serial % DSO_SERIAL_HASH_SIZE] = dso;
 out:
     return dso;
 }
@@ -225,25 +243,70 @@ void dso_start_tlv(dso_message_t *state, int opcode)
     state->cur += 4;
 }
 
-// Add some bytes to a TLV that's being built, but don't copy them--just remember the
-// pointer to the buffer.   This is used so that when we have a message to forward, we
-// don't copy it into the output buffer--we just use scatter/gather I/O.
-void dso_add_tlv_bytes_no_copy(dso_message_t *state, const uint8_t *bytes, size_t len)
+static void dso_add_tlv_hunk(dso_message_t *state, const uint8_t *bytes, size_t len, dso_payload_t *payload)
 {
+    dso_hunk_t *hunk;
+
     if (!state->building_tlv) {
         LogMsg("add_tlv_bytes called when not building a TLV!");
         assert(0);
     }
-    if (state->no_copy_bytes_len) {
-        LogMsg("add_tlv_bytesNoCopy called twice on the same DSO message.");
+    if (state->num_no_copy == DSO_MESSAGE_MAX_NO_COPY) {
+        LogMsg("add_tlv_bytesNoCopy called more than %d times on the same DSO message.", DSO_MESSAGE_MAX_NO_COPY);
         assert(0);
+        return;
     }
-    state->no_copy_bytes_len = len;
-    state->no_copy_bytes = bytes;
-    state->no_copy_bytes_offset = state->cur;
+    hunk = &state->no_copy[state->num_no_copy];
+    hunk->bytes = bytes;
+    hunk->length = len;
+    hunk->payload = payload;
+    state->no_copy_offsets[state->num_no_copy] = state->cur;
+    state->num_no_copy++;
+    state->no_copy_bytes_len += len;
     state->tlv_len += len;
 }
 
+// Add some bytes to a TLV that's being built, but don't copy them--just remember the
+// pointer to the buffer.   This is used so that when we have a message to forward, we
+// don't copy it into the output buffer--we just use scatter/gather I/O.
+void dso_add_tlv_bytes_no_copy(dso_message_t *state, const uint8_t *bytes, size_t len)
+{
+    dso_add_tlv_hunk(state, bytes, len, NULL);
+}
+
+// Add a shared payload to a TLV that's being built.   Like dso_add_tlv_bytes_no_copy, the data isn't
+// copied; the caller must hold its reference to the payload until the message has been written.
+void dso_add_tlv_payload(dso_message_t *state, dso_payload_t *payload)
+{
+    dso_add_tlv_hunk(state, payload->data, payload->length, payload);
+}
+
+// Make a shared payload holding a copy of bytes, with one reference held by the caller.
+dso_payload_t *dso_payload_create(const uint8_t *bytes, size_t len)
+{
+    dso_payload_t *payload = mDNSPlatformMemAllocateClear(sizeof *payload + len);
+    if (payload == NULL) {
+        return NULL;
+    }
+    payload->refcount = 1;
+    payload->length = len;
+    payload->data = (uint8_t *)(payload + 1);
+    memcpy(payload->data, bytes, len);
+    return payload;
+}
+
+void dso_payload_retain(dso_payload_t *payload)
+{
+    payload->refcount++;
+}
+
+void dso_payload_release(dso_payload_t *payload)
+{
+    if (--payload->refcount == 0) {
+        free(payload);
+    }
+}
+
 // Add some bytes to a TLV that's being built.
 void dso_add_tlv_bytes(dso_message_t *state, const uint8_t *bytes, size_t len)
 {
@@ -328,6 +391,33 @@ void dso_finish_tlv(dso_message_t *state)
     state->building_tlv = false;
 }
 
+// Activities with no name all go in the last bucket of the by_name table; the others are spread over the rest.
+static dso_activity_t **dso_activity_name_bucket(dso_state_t *dso, const char *name)
+{
+    uint32_t hash = 5381;
+    const char *s;
+
+    if (name == NULL) {
+        return &dso->by_name[DSO_ACTIVITY_HASH_SIZE - 1];
+    }
+    for (s = name; *s; s++) {
+        hash = ((hash << 5) + hash) + (uint8_t)*s;
+    }
+    return &dso->by_name[hash % (DSO_ACTIVITY_HASH_SIZE - 1)];
+}
+
+static dso_activity_t **dso_activity_context_bucket(dso_state_t *dso, const void *context)
+{
+    uintptr_t hash = (uintptr_t)context;
+    return &dso->by_context[(hash ^ (hash >> 4) ^ (hash >> 12)) % DSO_ACTIVITY_HASH_SIZE];
+}
+
+static bool dso_activity_matches(dso_activity_t *activity, const char *name, const char *activity_type, void *context)
+{
+    return (activity->activity_type == activity_type && ((activity->name == NULL || name == NULL || !strcmp(activity->name, name)) &&
+                                                         (context == NULL || context == activity->context)));
+}
+
 dso_activity_t *dso_find_activity(dso_state_t *dso, const char *name, const char *activity_type, void *context)
 {
     dso_activity_t *activity;
@@ -338,10 +428,24 @@ dso_activity_t *dso_find_activity(dso_state_t *dso, const char *name, const char
     }
         
     // An activity can be identified by name or context, but if name is present, that's what identifies it.
-    for (activity = dso->activities; activity; activity = activity->next) {
-        if (activity->activity_type == activity_type && ((activity->name == NULL || name == NULL|| !strcmp(activity->name, name)) &&
-                                                         (context == NULL && context == activity->context))) {
-            return activity;
+    // So with a name, the activity is either in that name's bucket or has no name; with only a context,
+    // it's in that context's bucket.
+    if (name != NULL) {
+        for (activity = *dso_activity_name_bucket(dso, name); activity; activity = activity->name_next) {
+            if (dso_activity_matches(activity, name, activity_type, context)) {
+                return activity;
+            }
+        }
+        for (activity = *dso_activity_name_bucket(dso, NULL); activity; activity = activity->name_next) {
+            if (dso_activity_matches(activity, name, activity_type, context)) {
+                return activity;
+            }
+        }
+    } else {
+        for (activity = *dso_activity_context_bucket(dso, context); activity; activity = activity->context_next) {
+            if (dso_activity_matches(activity, name, activity_type, context)) {
+                return activity;
+            }
         }
     }
     return NULL;
@@ -353,7 +457,7 @@ dso_activity_t *dso_add_activity(dso_state_t *dso, const char *name, const char
 {
     size_t namelen = name ? strlen(name) + 1 : 0;
     size_t len;
-    dso_activity_t *activity;
+    dso_activity_t *activity, **app;
     void *ap;
 
     // Shouldn't add an activity that's already been added.
@@ -385,25 +489,34 @@ dso_activity_t *dso_add_activity(dso_state_t *dso, const char *name, const char
     activity->activity_type = activity_type;
     activity->finalize = finalize;
 
-    // Retain this activity on the list.
+    // Retain this activity on the list, and in the tables used to find it.
     activity->next = dso->activities;
+    activity->prev = NULL;
+    if (dso->activities != NULL) {
+        dso->activities->prev = activity;
+    }
     dso->activities = activity;
+    app = dso_activity_name_bucket(dso, activity->name);
+    activity->name_next = *app;
+    *app = activity;
+    app = dso_activity_context_bucket(dso, context);
+    activity->context_next = *app;
+    *app = activity;
     return activity;
 }
 
 void dso_drop_activity(dso_state_t *dso, dso_activity_t *activity)
 {
-    dso_activity_t **app = &dso->activities;
+    dso_activity_t **app = activity->prev != NULL ? &activity->prev->next : &dso->activities;
     bool matched = false;
 
     // Remove this activity from the list.
-    while (*app) {
-        if (*app == activity) {
-            *app = activity->next;
-            matched = true;
-        } else {
-            app = &((*app)->next);
+    if (*app == activity) {
+        *app = activity->next;
+        if (activity->next != NULL) {
+            activity->next->prev = activity->prev;
         }
+        matched = true;
     }
 
     // If an activity that's not on the DSO list is passed here, it's an internal consistency
@@ -413,6 +526,20 @@ void dso_drop_activity(dso_state_t *dso, dso_activity_t *activity)
         assert(0);
     }
 
+    // It's in the hash tables if it was on the list.
+    for (app = dso_activity_name_bucket(dso, activity->name); *app; app = &(*app)->name_next) {
+        if (*app == activity) {
+            *app = activity->name_next;
+            break;
+        }
+    }
+    for (app = dso_activity_context_bucket(dso, activity->context); *app; app = &(*app)->context_next) {
+        if (*app == activity) {
+            *app = activity->context_next;
+            break;
+        }
+    }
+
     activity->finalize(activity);
     free(activity);
 }
@@ -515,6 +642,36 @@ size_t dso_message_length(dso_message_t *state)
     return state->cur + state->no_copy_bytes_len;
 }
 
+// Describe the message as the list of hunks that have to be sent, in order, to send it: the pieces of the
+// buffer interleaved with the data that wasn't copied into it.   Returns the number of hunks, or -1 if
+// there isn't room in hunks for them all.
+int dso_message_hunks(dso_message_t *state, dso_hunk_t *hunks, int max_hunks)
+{
+    size_t offset = 0;
+    int i, num_hunks = 0;
+
+    for (i = 0; i <= state->num_no_copy; i++) {
+        size_t end = i < state->num_no_copy ? state->no_copy_offsets[i] : state->cur;
+        if (end > offset) {
+            if (num_hunks == max_hunks) {
+                return -1;
+            }
+            hunks[num_hunks].bytes = &state->buf[offset];
+            hunks[num_hunks].length = end - offset;
+            hunks[num_hunks].payload = NULL;
+            num_hunks++;
+            offset = end;
+        }
+        if (i < state->num_no_copy && state->no_copy[i].length != 0) {
+            if (num_hunks == max_hunks) {
+                return -1;
+            }
+            hunks[num_hunks++] = state->no_copy[i];
+        }
+    }
+    return num_hunks;
+}
+
 void dso_retry_delay(dso_state_t *dso, const DNSMessageHeader *header)
 {
     dso_disconnect_context_t context;
@@ -25,6 +25,12 @@
 // Maximum number of additional TLVs we support in a DSO message.
 #define MAX_ADDITLS           10
 
+// Number of buckets in each of the hash tables a DSO state uses to find its activities.
+#define DSO_ACTIVITY_HASH_SIZE 64
+
+// Number of buckets in the hash table used to find DSO states by serial number.
+#define DSO_SERIAL_HASH_SIZE   64
+
 typedef enum {
     kDSOType_Keepalive = 1,
     kDSOType_RetryDelay = 2,
@@ -100,6 +106,29 @@ typedef struct dsotlv {
     const uint8_t *payload;
 } dso_tlv_t;
 
+// Maximum number of pieces of TLV data that a DSO message can send without copying them into its buffer.
+#define DSO_MESSAGE_MAX_NO_COPY 4
+
+// Maximum number of hunks a DSO message is sent as: the pieces that aren't copied, and the parts of the
+// buffer before, between and after them.
+#define DSO_MESSAGE_MAX_HUNKS   (2 * DSO_MESSAGE_MAX_NO_COPY + 1)
+
+// Data that can be sent, without copying, in DSO messages on any number of sessions--for example, a DNS Push
+// update that goes to every subscriber.   It is freed when the last reference to it is released; a transport
+// that sends asynchronously holds a reference until the send completes.
+typedef struct dso_payload {
+    int refcount;
+    size_t length;
+    uint8_t *data;                // Points just past the structure, in the same allocation
+} dso_payload_t;
+
+// One contiguous piece of an outgoing DSO message.
+typedef struct dso_hunk {
+    const uint8_t *bytes;
+    size_t length;
+    dso_payload_t *payload;       // The shared payload that bytes belongs to, if any.
+} dso_hunk_t;
+
 // DSO message under construction
 typedef struct dso_message {
     uint8_t *buf;                 // The buffer in which we are constructing the message
@@ -109,15 +138,19 @@ typedef struct dso_message {
     int outstanding_query_number; // Number of the outstanding query state entry for this message, or -1
     size_t tlv_len;               // Current length of the TLV we are building.
     size_t tlv_len_offset;        // Where to store the length of the current TLV when finished.
-    const uint8_t *no_copy_bytes; // One TLV can have data that isn't copied into the buffer
-    size_t no_copy_bytes_len;     // Length of that data, if any.
-    size_t no_copy_bytes_offset;  // Where in the buffer the data should be interposed.
+    dso_hunk_t no_copy[DSO_MESSAGE_MAX_NO_COPY];     // TLV data that isn't copied into the buffer
+    size_t no_copy_offsets[DSO_MESSAGE_MAX_NO_COPY]; // Where in the buffer each piece should be interposed.
+    int num_no_copy;              // Number of pieces of data that aren't copied
+    size_t no_copy_bytes_len;     // Total length of that data, if any.
 } dso_message_t;
 
 // Record of ongoing activity
 typedef struct dso_activity dso_activity_t;
 struct dso_activity {
     dso_activity_t *next;
+    dso_activity_t *prev;       // Previous activity on the DSO state's list, so that it can be dropped quickly
+    dso_activity_t *name_next;  // Next activity in the same bucket of the DSO state's by_name table
+    dso_activity_t *context_next; // Next activity in the same bucket of the DSO state's by_context table
     void (*finalize)(dso_activity_t *activity);
     const char *activity_type;  // Name of the activity type, must be the same pointer for all activities of a type.
     void *context;              // Activity implementation's context (if any).
@@ -135,6 +168,7 @@ typedef void (*dso_transport_finalize_t)(dso_transport_t *transport);
 // DNS Stateless Operations state
 struct dso_state {
     dso_state_t *next;
+    dso_state_t *serial_next;        // Next DSO state in the same bucket of the serial number table
     void *context;                   // The context of the next layer up (e.g., a Discovery Proxy)
     dso_event_callback_t cb;         // Called when an event happens
 
@@ -153,6 +187,9 @@ struct dso_state {
     event_time_t keepalive_due;      // When the next keepalive is due (to be received or sent)
     event_time_t inactivity_due;     // When next activity has to happen for connection to remain active
     dso_activity_t *activities;      // Outstanding DSO activities.
+    dso_activity_t *by_name[DSO_ACTIVITY_HASH_SIZE];    // The activities again, hashed on their names;
+                                                        // activities with no name are in the last bucket.
+    dso_activity_t *by_context[DSO_ACTIVITY_HASH_SIZE]; // And hashed on their contexts.
 
     dso_tlv_t primary;               // Primary TLV for current message
     dso_tlv_t additl[MAX_ADDITLS];   // Additional TLVs
@@ -173,6 +210,10 @@ void dso_release(dso_state_t **dsop);
 void dso_start_tlv(dso_message_t *state, int opcode);
 void dso_add_tlv_bytes(dso_message_t *state, const uint8_t *bytes, size_t len);
 void dso_add_tlv_bytes_no_copy(dso_message_t *state, const uint8_t *bytes, size_t len);
+void dso_add_tlv_payload(dso_message_t *state, dso_payload_t *payload);
+dso_payload_t *dso_payload_create(const uint8_t *bytes, size_t len);
+void dso_payload_retain(dso_payload_t *payload);
+void dso_payload_release(dso_payload_t *payload);
 void dso_add_tlv_byte(dso_message_t *state, uint8_t byte);
 void dso_add_tlv_u16(dso_message_t *state, uint16_t u16);
 void dso_add_tlv_u32(dso_message_t *state, uint32_t u32);
@@ -185,6 +226,7 @@ void dso_ignore_response(dso_state_t *dso, void *context);
 bool dso_make_message(dso_message_t *state, uint8_t *outbuf, size_t outbuf_size,
                       dso_state_t *dso, bool unidirectional, void *callback_state);
 size_t dso_message_length(dso_message_t *state);
+int dso_message_hunks(dso_message_t *state, dso_hunk_t *hunks, int max_hunks);
 void dso_retry_delay(dso_state_t *dso, const DNSMessageHeader *header);
 void dso_keepalive(dso_state_t *dso, const DNSMessageHeader *header);
 void dso_message_received(dso_state_t *dso, const uint8_t *message, size_t message_length);
@@ -58,6 +58,12 @@ struct dns_name_pointer {
     int length;
 };
 
+// When compression is enabled, names written outside of RDATA are remembered in a small table so that later names
+// can be compressed against them.
+#ifndef DNS_TOWIRE_MAX_SUFFIXES
+#define DNS_TOWIRE_MAX_SUFFIXES 48
+#endif
+
 typedef struct dns_towire_state dns_towire_state_t;
 struct dns_towire_state {
     dns_wire_t *NULLABLE message;
@@ -65,9 +71,16 @@ struct dns_towire_state {
     uint8_t *NONNULL lim;
     uint8_t *NULLABLE p_rdlength;
     uint8_t *NULLABLE p_opt;
+    uint8_t *NULLABLE p_name;         // Start of a name whose labels have been written but that isn't yet terminated.
+    uint8_t *NULLABLE p_name_end;     // Where the labels of that name end.
+    dns_wire_t *NULLABLE suffix_message; // The message the suffix table refers to.
+    int num_suffixes;
+    uint16_t suffix_offsets[DNS_TOWIRE_MAX_SUFFIXES]; // Message offsets of names that can be pointed to.
+    uint32_t suffix_hashes[DNS_TOWIRE_MAX_SUFFIXES];
     uint16_t line, outer_line;
     bool truncated : 1;
-    unsigned int error : 31;
+    bool compress : 1;       // Compress names against earlier names in the same message.
+    unsigned int error : 30;
 };
 
 typedef struct dns_transaction dns_transaction_t;
@@ -86,8 +99,10 @@ typedef dns_label_t dns_name_t;
 struct dns_label {
     dns_label_t *NULLABLE next;
     uint8_t len;
+    uint8_t flags;
     char data[DNS_MAX_LABEL_SIZE];
 };
+#define DNS_LABEL_IN_ARENA 1  // The label was parsed into a message's arena, and is freed with the message.
 
 typedef struct dns_rdata_txt dns_rdata_txt_t;
 struct dns_rdata_txt {
@@ -166,6 +181,15 @@ struct dns_edns0 {
     uint8_t data[0];
 };
 
+// A parsed message and everything in it are allocated from an arena, so that parsing a message is usually a
+// single allocation, and freeing it frees everything at once.
+typedef struct dns_arena_chunk dns_arena_chunk_t;
+struct dns_arena_chunk {
+    dns_arena_chunk_t *NULLABLE next;   // The chunk that filled up before this one.
+    size_t size, used;
+    uint8_t data[0];
+};
+
 typedef struct dns_message dns_message_t;
 struct dns_message {
     int ref_count;
@@ -175,6 +199,7 @@ struct dns_message {
     dns_rr_t *NULLABLE authority;
     dns_rr_t *NULLABLE additional;
     dns_edns0_t *NULLABLE edns0;
+    dns_arena_chunk_t *NULLABLE arena;  // The chunk currently being allocated from; the message is in the first.
 };
 
 // Masks for bitfield data
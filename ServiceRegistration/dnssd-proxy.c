@@ -109,6 +109,9 @@ struct served_domain {
     struct interface *interface;        // Interface to which this domain applies (may be NULL).
 } *served_domains;
 
+typedef struct dp_push_subscription dp_push_subscription_t;
+typedef struct dp_cached_response dp_cached_response_t;
+
 typedef struct dnssd_query {
     dnssd_txn_t *txn;
     wakeup_t *wakeup;
@@ -124,6 +127,11 @@ typedef struct dnssd_query {
     int serviceFlags;               // Service flags to use with this query.
     bool is_dns_push;
     bool is_edns0;
+    bool push_tls;                  // DNS Push over TLS, which uses the newer semantics for removes.
+    dp_push_subscription_t *subscription; // The shared subscription this query runs, or is a subscriber to.
+    struct dnssd_query *subscriber_next;  // The next subscriber to the same shared subscription.
+    dp_cached_response_t *cache_entry;    // If this query is watching a cached response for changes, the response.
+    size_t answers_offset;          // Where the answers start in the data of a DNS response.
     uint16_t type, qclass;          // Original query type and class.
     dns_towire_state_t towire;
     uint8_t *p_dso_length;          // Where to store the DSO length just before we write out a push notification.
@@ -131,6 +139,46 @@ typedef struct dnssd_query {
     size_t data_size;		        // Size of the data payload of the response
 } dnssd_query_t;
 
+// An answer that's currently part of a shared DNS Push subscription, remembered so that subscribers that join
+// later can be sent it.
+typedef struct dp_push_answer dp_push_answer_t;
+struct dp_push_answer {
+    dp_push_answer_t *next;
+    uint16_t rrtype, rrclass, rdlen;
+    uint32_t ttl;
+    uint8_t *rdata;                 // Follows the structure in the same allocation.
+};
+
+// One upstream query, shared by every DNS Push subscriber asking for the same name, type and class in the same
+// served domain.   Each change is encoded once, in query's response, and the same update is sent to every
+// subscriber.
+struct dp_push_subscription {
+    dp_push_subscription_t *next;
+    dnssd_query_t *query;           // The upstream query; it isn't associated with any one connection.
+    dnssd_query_t *subscribers;     // The subscribers' queries, linked through subscriber_next.
+    int num_subscribers;
+    dp_push_answer_t *answers;      // What the subscribers have been told is there now.
+};
+dp_push_subscription_t *push_subscriptions;
+
+// A response to a one-shot DNS query, kept so that repeat queries can be answered immediately.   The answers are
+// kept as they were sent, after translation.   The query that produced them keeps running, and any change it
+// reports invalidates the response.
+struct dp_cached_response {
+    dp_cached_response_t *next;
+    dnssd_query_t *watcher;         // The query that produced the answers.
+    int64_t added;                  // When the response was cached, relative to ioloop_timenow().
+    size_t answers_offset;          // Where the answers started, which name compression depends on.
+    size_t length;                  // Length of the answers.
+    uint16_t ancount;
+    uint8_t *answers;               // Follows the structure in the same allocation.
+};
+dp_cached_response_t *response_cache;
+int response_cache_count;
+
+#define DP_RESPONSE_CACHE_MAX     64 // Most responses to keep at once.
+#define DP_RESPONSE_CACHE_MAX_TTL 10 // Per dnssd-hybrid 5.5.1, answers have at most a ten second TTL.
+
 const char push_subscription_activity_type[] = "push subscription";
 
 const char local_suffix[] = ".local.";
@@ -139,6 +187,12 @@ const char local_suffix[] = ".local.";
 
 // Forward references
 static served_domain_t *NULLABLE new_served_domain(interface_t *NULLABLE interface, char *NONNULL domain);
+static void dp_push_subscription_remove(dnssd_query_t *NONNULL query);
+void dnssd_query_finalize_callback(void *context);
+void dp_query_send_dns_response(dnssd_query_t *NONNULL query);
+void dns_push_query_callback(DNSServiceRef sdRef, DNSServiceFlags flags, uint32_t interfaceIndex,
+                             DNSServiceErrorType errorCode, const char *fullname, uint16_t rrtype, uint16_t rrclass,
+                             uint16_t rdlen, const void *rdata, uint32_t ttl, void *context);
 
 // Code
 
@@ -177,6 +231,12 @@ dns_push_finalize(dso_activity_t *activity)
 {
     dnssd_query_t *query = (dnssd_query_t *)activity->context;
     INFO("dnssd_push_finalize: " PUB_S_SRP, activity->name);
+    // A subscriber to a shared subscription has no transaction of its own to finalize it.
+    if (query->subscription != NULL) {
+        dp_push_subscription_remove(query);
+        dnssd_query_finalize_callback(query);
+        return;
+    }
     dnssd_query_cancel(query);
 }
 
@@ -196,6 +256,7 @@ dnssd_query_finalize_callback(void *context)
     if (query->question) {
         message_free(query->question);
     }
+    free(query->response);
     free(query->name);
     free(query);
 }
@@ -786,6 +847,178 @@ embiggen(dnssd_query_t *query)
     return true;
 }
 
+// Walks count answers in a cached response, which must exactly fill length bytes.   If out is NULL, the lowest TTL
+// is stored in *min_ttl if it is lower than what's there; otherwise the answers are copied to out, with each TTL
+// reduced by elapsed seconds.
+static bool
+dp_cache_walk(const uint8_t *answers, size_t length, int count, uint32_t elapsed, uint8_t *out, uint32_t *min_ttl)
+{
+    size_t offset = 0;
+    int i;
+
+    if (out != NULL) {
+        memcpy(out, answers, length);
+    }
+    for (i = 0; i < count; i++) {
+        uint32_t ttl;
+        uint16_t rdlen;
+
+        // Skip the owner name, which ends either with the root label or with a compression pointer.
+        while (offset < length && answers[offset] != 0 && (answers[offset] & 0xC0) != 0xC0) {
+            offset += answers[offset] + 1;
+        }
+        if (offset >= length) {
+            return false;
+        }
+        offset += answers[offset] == 0 ? 1 : 2;
+        if (offset + 10 > length) {
+            return false;
+        }
+        offset += 4; // Type and class
+        ttl = (((uint32_t)answers[offset] << 24) | ((uint32_t)answers[offset + 1] << 16) |
+               ((uint32_t)answers[offset + 2] << 8) | answers[offset + 3]);
+        if (out != NULL) {
+            ttl = ttl > elapsed ? ttl - elapsed : 0;
+            out[offset] = (ttl >> 24) & 0xff;
+            out[offset + 1] = (ttl >> 16) & 0xff;
+            out[offset + 2] = (ttl >> 8) & 0xff;
+            out[offset + 3] = ttl & 0xff;
+        } else if (ttl < *min_ttl) {
+            *min_ttl = ttl;
+        }
+        offset += 4;
+        rdlen = (answers[offset] << 8) | answers[offset + 1];
+        offset += 2 + rdlen;
+        if (offset > length) {
+            return false;
+        }
+    }
+    return offset == length;
+}
+
+static void
+dp_cache_remove(dp_cached_response_t *entry)
+{
+    dp_cached_response_t **ep;
+    dnssd_query_t *watcher = entry->watcher;
+
+    for (ep = &response_cache; *ep != NULL; ep = &(*ep)->next) {
+        if (*ep == entry) {
+            *ep = entry->next;
+            response_cache_count--;
+            break;
+        }
+    }
+    watcher->cache_entry = NULL;
+    if (watcher->wakeup != NULL) {
+        ioloop_cancel_wake_event(watcher->wakeup);
+    }
+    // The watcher is freed when its transaction is finalized.
+    dnssd_query_cancel(watcher);
+    free(entry);
+}
+
+void
+dp_cache_expire(void *context)
+{
+    dnssd_query_t *query = context;
+
+    if (query->cache_entry != NULL) {
+        INFO("dp_cache_expire: " PRI_S_SRP " %d %d", query->name, query->type, query->qclass);
+        dp_cache_remove(query->cache_entry);
+    }
+}
+
+// Called with the response that was just sent to query, the answers of which end at end.   Returns true if the
+// response was cached, in which case query now belongs to the cache.
+static bool
+dp_cache_insert(dnssd_query_t *query, uint8_t *end)
+{
+    dp_cached_response_t *entry, **ep;
+    uint8_t *start = &query->response->data[query->answers_offset];
+    uint16_t ancount = ntohs(query->response->ancount);
+    uint32_t min_ttl = DP_RESPONSE_CACHE_MAX_TTL;
+    size_t length;
+
+    // Only a query that's still running can tell us when the answers change.
+    if (query->txn == NULL || query->is_dns_push || query->answers_offset == 0 || end < start) {
+        return false;
+    }
+    length = end - start;
+    if (!dp_cache_walk(start, length, ancount, 0, NULL, &min_ttl) || min_ttl == 0) {
+        return false;
+    }
+    if (query->wakeup == NULL) {
+        query->wakeup = ioloop_wakeup_create();
+        if (query->wakeup == NULL) {
+            return false;
+        }
+    }
+    entry = malloc(sizeof *entry + length);
+    if (entry == NULL) {
+        ERROR("dp_cache_insert: no memory to cache response for " PRI_S_SRP, query->name);
+        return false;
+    }
+
+    // Make room by dropping the oldest response.
+    if (response_cache_count >= DP_RESPONSE_CACHE_MAX) {
+        for (ep = &response_cache; (*ep)->next != NULL; ep = &(*ep)->next)
+            ;
+        dp_cache_remove(*ep);
+    }
+
+    entry->watcher = query;
+    entry->added = ioloop_timenow();
+    entry->answers_offset = query->answers_offset;
+    entry->length = length;
+    entry->ancount = ancount;
+    entry->answers = (uint8_t *)(entry + 1);
+    memcpy(entry->answers, start, length);
+    entry->next = response_cache;
+    response_cache = entry;
+    response_cache_count++;
+
+    query->cache_entry = entry;
+    query->connection = NULL;
+    ioloop_add_wake_event(query->wakeup, query, dp_cache_expire, NULL, min_ttl * IOLOOP_SECOND);
+    INFO("dp_cache_insert: " PRI_S_SRP " %d %d, %d answers for %d seconds",
+         query->name, query->type, query->qclass, ancount, min_ttl);
+    return true;
+}
+
+// If there's a cached response to the question query is asking, answer from it.
+static bool
+dp_cache_answer(comm_t *comm, dnssd_query_t *query)
+{
+    dp_cached_response_t *entry;
+    int64_t elapsed;
+
+    for (entry = response_cache; entry != NULL; entry = entry->next) {
+        dnssd_query_t *watcher = entry->watcher;
+        if (watcher->type == query->type && watcher->qclass == query->qclass &&
+            watcher->served_domain == query->served_domain && !strcasecmp(watcher->name, query->name)) {
+            break;
+        }
+    }
+    if (entry == NULL || entry->answers_offset != query->answers_offset ||
+        query->towire.p + entry->length > query->towire.lim) {
+        return false;
+    }
+    elapsed = (ioloop_timenow() - entry->added) / IOLOOP_SECOND;
+    if (!dp_cache_walk(entry->answers, entry->length, entry->ancount, (uint32_t)elapsed, query->towire.p, NULL)) {
+        return false;
+    }
+    query->towire.p += entry->length;
+    query->response->ancount = htons(entry->ancount);
+    INFO("dp_cache_answer: " PRI_S_SRP " %d %d, %d answers", query->name, query->type, query->qclass, entry->ancount);
+
+    // Steal the question
+    query->question = comm->message;
+    comm->message = NULL;
+    dp_query_send_dns_response(query);
+    return true;
+}
+
 void
 dp_query_send_dns_response(dnssd_query_t *query)
 {
@@ -796,6 +1029,7 @@ dp_query_send_dns_response(dnssd_query_t *query)
     uint16_t tc = towire->truncated ? dns_flags_tc : 0;
     uint16_t bitfield = ntohs(query->response->bitfield);
     uint16_t mask = 0;
+    bool cacheable = !towire->truncated && dns_rcode_get(query->response) == dns_rcode_noerror;
 
     // Send an SOA record if it's a .local query.
     if (query->served_domain != NULL && query->served_domain->interface != NULL && !towire->truncated) {
@@ -904,6 +1138,11 @@ dp_query_send_dns_response(dnssd_query_t *query)
         query->connection->send_response(query->connection, query->question, &iov, 1);
     }
 
+    // If the answers are worth keeping, the query stays running to watch for changes to them.
+    if (cacheable && !towire->error && dp_cache_insert(query, revert)) {
+        return;
+    }
+
     // Free up state
     // Query will be freed automatically next time through the io loop.
     dnssd_query_cancel(query);
@@ -964,6 +1203,15 @@ dp_push_response(dnssd_query_t *query)
         dns_u16_to_wire(&query->towire, dso_length);
         if (query->connection != NULL) {
             query->connection->send_response(query->connection, query->question, &iov, 1);
+        } else if (query->subscription != NULL) {
+            // A shared subscription's update goes, as is, to every subscriber.
+            dnssd_query_t *subscriber;
+            for (subscriber = query->subscription->subscribers; subscriber != NULL;
+                 subscriber = subscriber->subscriber_next) {
+                if (subscriber->connection != NULL) {
+                    subscriber->connection->send_response(subscriber->connection, subscriber->question, &iov, 1);
+                }
+            }
         }
         dp_query_towire_reset(query);
     }
@@ -1019,6 +1267,13 @@ dns_query_callback(DNSServiceRef sdRef, DNSServiceFlags flags, uint32_t interfac
 
     INFO(PRI_S_SRP " %d %d %x %d", fullname, rrtype, rrclass, rdlen, errorCode);
 
+    // Anything we hear after the response was cached means the cached answers are no longer right.
+    if (query->cache_entry != NULL) {
+        INFO("dns_query_callback: invalidating cached response for " PRI_S_SRP, query->name);
+        dp_cache_remove(query->cache_entry);
+        return;
+    }
+
     if (errorCode == kDNSServiceErr_NoError) {
     re_add:
         dp_query_add_data_to_response(query, fullname, rrtype, rrclass, rdlen, rdata,
@@ -1100,8 +1355,6 @@ dp_query_start(comm_t *comm, dnssd_query_t *query, int *rcode, DNSServiceQueryRe
         if (query->served_domain->interface != NULL) {
             if (len + sizeof local_suffix > sizeof name) {
                 *rcode = dns_rcode_servfail;
-                free(query->name);
-                free(query);
                 ERROR("question name %s is too long for .local.", name);
                 return false;
             }
@@ -1111,8 +1364,6 @@ dp_query_start(comm_t *comm, dnssd_query_t *query, int *rcode, DNSServiceQueryRe
             int dlen = strlen(query->served_domain->domain_ld) + 1;
             if (len + dlen > sizeof name) {
                 *rcode = dns_rcode_servfail;
-                free(query->name);
-                free(query);
                 ERROR("question name %s is too long for %s.", name, query->served_domain->domain);
                 return false;
             }
@@ -1230,6 +1481,7 @@ dp_query_generate(comm_t *comm, dns_rr_t *question, bool dns_push, int *rcode)
 
     // Remember whether this is a long-lived query.
     query->is_dns_push = dns_push;
+    query->push_tls = dns_push && comm->tls_context != NULL;
 
     // Start writing the response
     dp_query_towire_reset(query);
@@ -1241,6 +1493,181 @@ dp_query_generate(comm_t *comm, dns_rr_t *question, bool dns_push, int *rcode)
     return query;
 }
 
+dp_push_subscription_t *
+dp_push_subscription_find(dnssd_query_t *query)
+{
+    dp_push_subscription_t *subscription;
+
+    for (subscription = push_subscriptions; subscription != NULL; subscription = subscription->next) {
+        dnssd_query_t *upstream = subscription->query;
+        if (upstream->type == query->type && upstream->qclass == query->qclass &&
+            upstream->served_domain == query->served_domain && upstream->push_tls == query->push_tls &&
+            !strcasecmp(upstream->name, query->name)) {
+            return subscription;
+        }
+    }
+    return NULL;
+}
+
+// Starts the upstream query for a new shared subscription to question.
+dp_push_subscription_t *
+dp_push_subscription_create(comm_t *comm, dns_rr_t *question, int *rcode)
+{
+    dp_push_subscription_t *subscription = calloc(1, sizeof *subscription);
+    dnssd_query_t *query;
+
+    if (subscription == NULL) {
+        ERROR("Unable to allocate memory for push subscription");
+        *rcode = dns_rcode_servfail;
+        return NULL;
+    }
+    query = dp_query_generate(comm, question, true, rcode);
+    if (query == NULL) {
+        free(subscription);
+        return NULL;
+    }
+    // The upstream query answers to the subscription, not to any one connection.
+    query->connection = NULL;
+    query->subscription = subscription;
+    subscription->query = query;
+    if (!dp_query_start(comm, query, rcode, dns_push_query_callback)) {
+        free(query->response);
+        free(query->name);
+        free(query);
+        free(subscription);
+        return NULL;
+    }
+    subscription->next = push_subscriptions;
+    push_subscriptions = subscription;
+    return subscription;
+}
+
+void
+dp_push_subscription_add(dp_push_subscription_t *subscription, dnssd_query_t *query)
+{
+    query->subscription = subscription;
+    query->subscriber_next = subscription->subscribers;
+    subscription->subscribers = query;
+    subscription->num_subscribers++;
+    INFO("dp_push_subscription_add: " PRI_S_SRP " now has %d subscribers", query->name, subscription->num_subscribers);
+}
+
+// Called when a subscriber goes away.   When the last one does, the upstream query is canceled; the query itself
+// is freed when its transaction is finalized.
+static void
+dp_push_subscription_remove(dnssd_query_t *query)
+{
+    dp_push_subscription_t *subscription = query->subscription, **sp;
+    dnssd_query_t **qp;
+    dp_push_answer_t *answer, *next;
+
+    for (qp = &subscription->subscribers; *qp != NULL; qp = &(*qp)->subscriber_next) {
+        if (*qp == query) {
+            *qp = query->subscriber_next;
+            subscription->num_subscribers--;
+            break;
+        }
+    }
+    query->subscription = NULL;
+    query->subscriber_next = NULL;
+    if (subscription->subscribers != NULL) {
+        return;
+    }
+
+    for (sp = &push_subscriptions; *sp != NULL; sp = &(*sp)->next) {
+        if (*sp == subscription) {
+            *sp = subscription->next;
+            break;
+        }
+    }
+    subscription->query->subscription = NULL;
+    dnssd_query_cancel(subscription->query);
+    for (answer = subscription->answers; answer != NULL; answer = next) {
+        next = answer->next;
+        free(answer);
+    }
+    free(subscription);
+}
+
+// Drops every subscriber, which in turn gets rid of the subscription.
+void
+dp_push_subscription_drop(dp_push_subscription_t *subscription)
+{
+    int remaining = subscription->num_subscribers;
+
+    while (remaining-- > 0) {
+        dnssd_query_t *subscriber = subscription->subscribers;
+        if (subscriber->connection != NULL && subscriber->activity != NULL) {
+            dso_drop_activity(subscriber->connection->dso, subscriber->activity);
+        } else {
+            dp_push_subscription_remove(subscriber);
+        }
+    }
+}
+
+// Keeps track of what's there now, as the upstream query reports changes.
+void
+dp_push_subscription_note(dp_push_subscription_t *subscription, DNSServiceFlags flags, uint16_t rrtype,
+                          uint16_t rrclass, uint16_t rdlen, const void *rdata, uint32_t ttl)
+{
+    dp_push_answer_t **ap = &subscription->answers, *answer;
+    bool add = (flags & kDNSServiceFlagsAdd) != 0;
+
+    // Forget whatever this replaces or removes; a remove with no rdata removes every record of the type.
+    while (*ap != NULL) {
+        answer = *ap;
+        if (answer->rrtype == rrtype && answer->rrclass == rrclass &&
+            (rdlen == 0 ? !add : (answer->rdlen == rdlen && !memcmp(answer->rdata, rdata, rdlen)))) {
+            *ap = answer->next;
+            free(answer);
+        } else {
+            ap = &answer->next;
+        }
+    }
+    if (!add || rdlen == 0) {
+        return;
+    }
+    answer = malloc(sizeof *answer + rdlen);
+    if (answer == NULL) {
+        ERROR("dp_push_subscription_note: no memory to remember answer for " PRI_S_SRP, subscription->query->name);
+        return;
+    }
+    answer->rrtype = rrtype;
+    answer->rrclass = rrclass;
+    answer->rdlen = rdlen;
+    answer->ttl = ttl;
+    answer->rdata = (uint8_t *)(answer + 1);
+    memcpy(answer->rdata, rdata, rdlen);
+    answer->next = subscription->answers;
+    subscription->answers = answer;
+}
+
+// A subscriber that joins an existing subscription missed the updates sent so far, so send it what's there now.
+void
+dp_push_subscription_replay(dp_push_subscription_t *subscription, dnssd_query_t *query)
+{
+    dp_push_answer_t *answer;
+
+    for (answer = subscription->answers; answer != NULL; answer = answer->next) {
+        uint8_t *revert;
+
+        dns_push_start(query);
+        revert = query->towire.p;
+        dp_query_add_data_to_response(query, query->name, answer->rrtype, answer->rrclass, answer->rdlen,
+                                      answer->rdata, answer->ttl);
+        if (query->towire.truncated) {
+            query->towire.truncated = false;
+            query->towire.p = revert;
+            query->towire.error = 0;
+            dp_push_response(query);
+            dns_push_start(query);
+            dp_query_add_data_to_response(query, query->name, answer->rrtype, answer->rrclass, answer->rdlen,
+                                          answer->rdata, answer->ttl);
+        }
+    }
+    dp_push_response(query);
+}
+
 // This is the callback for DNS push query results, as opposed to push updates.
 void
 dns_push_query_callback(DNSServiceRef sdRef, DNSServiceFlags flags, uint32_t interfaceIndex,
@@ -1265,6 +1692,9 @@ dns_push_query_callback(DNSServiceRef sdRef, DNSServiceFlags flags, uint32_t int
     // query_state_waiting means that we're answering a regular DNS question
     if (errorCode == kDNSServiceErr_NoError) {
         dns_push_start(query);
+        if (query->subscription != NULL) {
+            dp_push_subscription_note(query->subscription, flags, rrtype, rrclass, rdlen, rdata, ttl);
+        }
 
         // If kDNSServiceFlagsAdd is set, it's an add, otherwise a delete.
         re_add:
@@ -1273,7 +1703,7 @@ dns_push_query_callback(DNSServiceRef sdRef, DNSServiceFlags flags, uint32_t int
         } else {
 	    // There was a verion of the code that used different semantics, we use those semantics on non-tls
 	    // connections for now, but should delete this soon.
-	    if (query->connection->tls_context != NULL) {
+	    if (query->push_tls) {
                 // I think if this happens it means delete all RRs of this type.
                 if (rdlen == 0) {
                     dp_query_add_data_to_response(query, fullname, rrtype, dns_qclass_any, rdlen, rdata, -2);
@@ -1308,7 +1738,9 @@ dns_push_query_callback(DNSServiceRef sdRef, DNSServiceFlags flags, uint32_t int
         }
     } else {
         ERROR("dns_push_query_callback: unexpected error code %d", errorCode);
-        if (query->connection != NULL) {
+        if (query->subscription != NULL) {
+            dp_push_subscription_drop(query->subscription);
+        } else if (query->connection != NULL) {
             dso_drop_activity(query->connection->dso, query->activity);
         }
     }
@@ -1320,6 +1752,7 @@ dns_push_subscribe(comm_t *comm, const dns_wire_t *header, dso_state_t *dso, dns
 {
     int rcode;
     dnssd_query_t *query = dp_query_generate(comm, question, true, &rcode);
+    dp_push_subscription_t *subscription;
 
     if (!query) {
         dp_simple_response(comm, rcode);
@@ -1329,11 +1762,28 @@ dns_push_subscribe(comm_t *comm, const dns_wire_t *header, dso_state_t *dso, dns
     dso_activity_t *activity = dso_add_activity(dso, activity_name, push_subscription_activity_type, query,
                                                 dns_push_finalize);
     query->activity = activity;
-    if (!dp_query_start(comm, query, &rcode, dns_push_query_callback)) {
+
+    // Hardwired answers never change, so there's no need for an upstream query to share.
+    if (query->served_domain != NULL && dnssd_hardwired_response(query, dns_push_query_callback)) {
+        dp_simple_response(comm, dns_rcode_noerror);
+        return;
+    }
+
+    // Other subscribers to the same thing share one upstream query.
+    subscription = dp_push_subscription_find(query);
+    if (subscription != NULL) {
+        dp_push_subscription_add(subscription, query);
+        dp_simple_response(comm, dns_rcode_noerror);
+        dp_push_subscription_replay(subscription, query);
+        return;
+    }
+    subscription = dp_push_subscription_create(comm, question, &rcode);
+    if (subscription == NULL) {
         dso_drop_activity(dso, activity);
         dp_simple_response(comm, rcode);
         return;
     }
+    dp_push_subscription_add(subscription, query);
     dp_simple_response(comm, dns_rcode_noerror);
 }
 
@@ -1568,10 +2018,17 @@ dp_dns_query(comm_t *comm, dns_rr_t *question)
         ERROR("dp_dns_query: failure encoding question: %s", failnote);
         goto fail;
     }
+    query->answers_offset = query->towire.p - query->response->data;
 
     // We should check for OPT RR, but for now assume it's there.
     query->is_edns0 = true;
 
+    // Repeat queries are answered from the cache, if we can.   There's no transaction to finalize the query.
+    if (dp_cache_answer(comm, query)) {
+        dnssd_query_finalize_callback(query);
+        return;
+    }
+
     if (!dp_query_start(comm, query, &rcode, dns_query_callback)) {
     fail:
         dp_simple_response(comm, rcode);
@@ -1664,7 +2121,7 @@ void dns_input(comm_t *comm)
 static int
 usage(const char *progname)
 {
-    ERROR("usage: %s", progname);
+    ERROR("usage: %s [--tls-fail] [--tls-workers <count>]", progname);
     ERROR("ex: dnssd-proxy");
     return 1;
 }
@@ -2063,6 +2520,11 @@ main(int argc, char **argv)
     for (i = 1; i < argc; i++) {
         if (!strcmp(argv[i], "--tls-fail")) {
             tls_fail = true;
+#ifndef EXCLUDE_TLS
+        } else if (!strcmp(argv[i], "--tls-workers") && i + 1 < argc) {
+            // Zero does TLS on the main thread.
+            srp_tls_set_workers(atoi(argv[++i]));
+#endif
         } else {
             return usage(argv[0]);
         }
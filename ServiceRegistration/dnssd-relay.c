@@ -71,6 +71,43 @@ char *tls_cacert_filename = NULL;
 char *tls_cert_filename = "/etc/dnssd-relay/server.crt";
 char *tls_key_filename = "/etc/dnssd-relay/server.key";
 
+// A link on which mDNS traffic is relayed.   The proxy names it by its interface index in Link Identifier TLVs.
+typedef struct relay_link relay_link_t;
+typedef struct relay_session relay_session_t;
+struct relay_link {
+    relay_link_t *next;
+    char *name;
+    uint32_t link_id;
+    relay_session_t *subscriber;  // Proxy session that has asked for this link's traffic, if any.
+    message_t *destination;       // Reused to tell send_response where to send on this link.
+};
+
+// mDNS messages are relayed in both directions without being parsed: the bytes received on a link are
+// carried as the payload of an mDNS Message TLV, and the payload of an mDNS Message TLV from the proxy is
+// sent on the link as is.   So as not to spend a DSO frame per multicast packet, messages to the proxy are
+// batched; the first is the primary TLV and each later one is another mDNS Message additional TLV, each
+// followed by its own Link Identifier and IP Source Address TLVs.   Messages from the proxy may be batched
+// the same way.   Each mDNS message takes three TLVs, so with MAX_ADDITLS additional TLVs a receiver can
+// take four per frame, which is also the number of payloads a DSO message can carry without copying them.
+#define RELAY_BATCH_MAX       4
+#define RELAY_BATCH_MAX_BYTES 32768 // Keeps a full batch well under the 64k DSO message limit
+#define RELAY_BATCH_DELAY     5     // Milliseconds a partial batch waits for more messages
+
+struct relay_session {
+    relay_session_t *next;
+    comm_t *connection;
+    message_t *batch[RELAY_BATCH_MAX];
+    uint32_t batch_link_ids[RELAY_BATCH_MAX];
+    int batch_count;
+    size_t batch_bytes;
+    wakeup_t *flush_wakeup;
+    bool flush_pending;
+};
+
+relay_link_t *relay_links;
+relay_session_t *relay_sessions;
+comm_t *mdns_listener4, *mdns_listener6;
+
 // Code
 
 int64_t dso_transport_idle(void *context, int64_t now, int64_t next_event)
@@ -108,9 +145,315 @@ dso_send_formerr(dso_state_t *dso, const dns_wire_t *header)
     return true;
 }
 
+static relay_link_t *
+relay_link_find(uint32_t link_id)
+{
+    relay_link_t *link;
+
+    for (link = relay_links; link != NULL; link = link->next) {
+        if (link->link_id == link_id) {
+            break;
+        }
+    }
+    return link;
+}
+
+static relay_session_t *
+relay_session_find(comm_t *comm, bool create)
+{
+    relay_session_t *session;
+
+    for (session = relay_sessions; session != NULL; session = session->next) {
+        if (session->connection == comm) {
+            return session;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    session = calloc(1, sizeof *session);
+    if (session == NULL) {
+        ERROR("relay_session_find: no memory for session on " PRI_S_SRP, comm->name);
+        return NULL;
+    }
+    session->connection = comm;
+    session->next = relay_sessions;
+    relay_sessions = session;
+    return session;
+}
+
+// Store an IP Source Address TLV's payload: the port, then the IPv4 or IPv6 address.
+static void
+relay_address_to_tlv(dso_message_t *state, const addr_t *address)
+{
+    if (address->sa.sa_family == AF_INET) {
+        dso_add_tlv_bytes(state, (const uint8_t *)&address->sin.sin_port, sizeof address->sin.sin_port);
+        dso_add_tlv_bytes(state, (const uint8_t *)&address->sin.sin_addr, sizeof address->sin.sin_addr);
+    } else {
+        dso_add_tlv_bytes(state, (const uint8_t *)&address->sin6.sin6_port, sizeof address->sin6.sin6_port);
+        dso_add_tlv_bytes(state, (const uint8_t *)&address->sin6.sin6_addr, sizeof address->sin6.sin6_addr);
+    }
+}
+
+static bool
+relay_address_from_tlv(addr_t *address, const dso_tlv_t *tlv)
+{
+    memset(address, 0, sizeof *address);
+    if (tlv->length == 2 + sizeof address->sin.sin_addr) {
+        address->sa.sa_family = AF_INET;
+        memcpy(&address->sin.sin_port, tlv->payload, 2);
+        memcpy(&address->sin.sin_addr, tlv->payload + 2, sizeof address->sin.sin_addr);
+        return true;
+    } else if (tlv->length == 2 + sizeof address->sin6.sin6_addr) {
+        address->sa.sa_family = AF_INET6;
+        memcpy(&address->sin6.sin6_port, tlv->payload, 2);
+        memcpy(&address->sin6.sin6_addr, tlv->payload + 2, sizeof address->sin6.sin6_addr);
+        return true;
+    }
+    return false;
+}
+
+// Send everything batched up for the proxy as a single unidirectional DSO message.   The mDNS messages
+// themselves go out straight from the buffers they were received into.
+static void
+relay_session_flush(relay_session_t *session)
+{
+    uint8_t tlvbuf[DNS_HEADER_SIZE + RELAY_BATCH_MAX * 48];
+    dso_hunk_t hunks[DSO_MESSAGE_MAX_HUNKS];
+    struct iovec iov[DSO_MESSAGE_MAX_HUNKS];
+    dso_state_t *dso = session->connection->dso;
+    dso_message_t state;
+    int i, num_hunks;
+
+    if (session->flush_pending) {
+        ioloop_cancel_wake_event(session->flush_wakeup);
+        session->flush_pending = false;
+    }
+    if (session->batch_count == 0) {
+        return;
+    }
+
+    if (dso != NULL && dso_make_message(&state, tlvbuf, sizeof tlvbuf, dso, true, NULL)) {
+        for (i = 0; i < session->batch_count; i++) {
+            message_t *message = session->batch[i];
+            dso_start_tlv(&state, kDSOType_mDNSMessage);
+            dso_add_tlv_bytes_no_copy(&state, (const uint8_t *)&message->wire, message->length);
+            dso_finish_tlv(&state);
+            dso_start_tlv(&state, kDSOType_LinkIdentifier);
+            dso_add_tlv_u32(&state, session->batch_link_ids[i]);
+            dso_finish_tlv(&state);
+            dso_start_tlv(&state, kDSOType_IPSourceAddress);
+            relay_address_to_tlv(&state, &message->src);
+            dso_finish_tlv(&state);
+        }
+        num_hunks = dso_message_hunks(&state, hunks, DSO_MESSAGE_MAX_HUNKS);
+        if (num_hunks < 0) {
+            ERROR("relay_session_flush: too many hunks relaying to " PRI_S_SRP, session->connection->name);
+        } else {
+            for (i = 0; i < num_hunks; i++) {
+                iov[i].iov_base = (void *)hunks[i].bytes;
+                iov[i].iov_len = hunks[i].length;
+            }
+            session->connection->send_response(session->connection, NULL, iov, num_hunks);
+        }
+    }
+
+    for (i = 0; i < session->batch_count; i++) {
+        message_free(session->batch[i]);
+        session->batch[i] = NULL;
+    }
+    session->batch_count = 0;
+    session->batch_bytes = 0;
+}
+
+static void
+relay_session_flush_callback(void *context)
+{
+    relay_session_t *session = context;
+
+    session->flush_pending = false;
+    relay_session_flush(session);
+}
+
+// Queue an mDNS message for the proxy, taking ownership of it.   A full batch goes out right away; otherwise
+// the batch waits briefly in case more traffic arrives on any of the session's links.
+static void
+relay_session_queue(relay_session_t *session, relay_link_t *link, message_t *message)
+{
+    if (session->batch_count > 0 && session->batch_bytes + message->length > RELAY_BATCH_MAX_BYTES) {
+        relay_session_flush(session);
+    }
+    session->batch[session->batch_count] = message;
+    session->batch_link_ids[session->batch_count] = link->link_id;
+    session->batch_count++;
+    session->batch_bytes += message->length;
+
+    if (session->batch_count == RELAY_BATCH_MAX) {
+        relay_session_flush(session);
+        return;
+    }
+    if (!session->flush_pending) {
+        if (session->flush_wakeup == NULL) {
+            session->flush_wakeup = ioloop_wakeup_create();
+        }
+        if (session->flush_wakeup == NULL ||
+            !ioloop_add_wake_event(session->flush_wakeup, session, relay_session_flush_callback, NULL,
+                                   RELAY_BATCH_DELAY)) {
+            relay_session_flush(session);
+            return;
+        }
+        session->flush_pending = true;
+    }
+}
+
+static void
+relay_session_drop(comm_t *comm)
+{
+    relay_session_t **p_session, *session;
+    relay_link_t *link;
+    int i;
+
+    for (p_session = &relay_sessions; *p_session != NULL; p_session = &(*p_session)->next) {
+        if ((*p_session)->connection == comm) {
+            break;
+        }
+    }
+    session = *p_session;
+    if (session == NULL) {
+        return;
+    }
+    *p_session = session->next;
+
+    for (link = relay_links; link != NULL; link = link->next) {
+        if (link->subscriber == session) {
+            link->subscriber = NULL;
+        }
+    }
+    for (i = 0; i < session->batch_count; i++) {
+        message_free(session->batch[i]);
+    }
+    if (session->flush_wakeup != NULL) {
+        ioloop_cancel_wake_event(session->flush_wakeup);
+        ioloop_wakeup_release(session->flush_wakeup);
+    }
+    free(session);
+}
+
+// Send an mDNS message from the proxy out on a link: to the given address if there is one, otherwise to
+// the mDNS multicast groups.
+static void
+relay_link_send(relay_link_t *link, const addr_t *destination, const uint8_t *payload, size_t length)
+{
+    struct iovec iov;
+    addr_t *dest = &link->destination->src;
+
+    iov.iov_base = (void *)payload;
+    iov.iov_len = length;
+    link->destination->ifindex = link->link_id;
+
+    if (destination != NULL) {
+        comm_t *listener = destination->sa.sa_family == AF_INET ? mdns_listener4 : mdns_listener6;
+        if (listener != NULL) {
+            *dest = *destination;
+            listener->send_response(listener, link->destination, &iov, 1);
+        }
+        return;
+    }
+    if (mdns_listener4 != NULL) {
+        memset(dest, 0, sizeof *dest);
+        dest->sin.sin_family = AF_INET;
+        dest->sin.sin_port = htons(5353);
+        inet_pton(AF_INET, "224.0.0.251", &dest->sin.sin_addr);
+        mdns_listener4->send_response(mdns_listener4, link->destination, &iov, 1);
+    }
+    if (mdns_listener6 != NULL) {
+        memset(dest, 0, sizeof *dest);
+        dest->sin6.sin6_family = AF_INET6;
+        dest->sin6.sin6_port = htons(5353);
+        inet_pton(AF_INET6, "ff02::fb", &dest->sin6.sin6_addr);
+        mdns_listener6->send_response(mdns_listener6, link->destination, &iov, 1);
+    }
+}
+
+// Each mDNS Message TLV from the proxy is followed by the Link Identifier of the link to send it on and
+// optionally an IP Source Address to send it to; several can arrive in one DSO message.
+static void
+relay_mdns_message(comm_t *comm, dso_state_t *dso)
+{
+    const dso_tlv_t *payload = &dso->primary;
+    relay_link_t *link = NULL;
+    addr_t destination;
+    bool have_destination = false;
+    int i;
+
+    for (i = 0; i <= dso->num_additls; i++) {
+        const dso_tlv_t *tlv = i < dso->num_additls ? &dso->additl[i] : NULL;
+
+        if (tlv == NULL || tlv->opcode == kDSOType_mDNSMessage) {
+            if (link == NULL) {
+                INFO("relay_mdns_message: mDNS message from " PRI_S_SRP " for no known link", comm->name);
+            } else {
+                relay_link_send(link, have_destination ? &destination : NULL, payload->payload, payload->length);
+            }
+            payload = tlv;
+            link = NULL;
+            have_destination = false;
+        } else if (tlv->opcode == kDSOType_LinkIdentifier && tlv->length == 4) {
+            uint32_t link_id;
+            memcpy(&link_id, tlv->payload, sizeof link_id);
+            link = relay_link_find(ntohl(link_id));
+        } else if (tlv->opcode == kDSOType_IPSourceAddress) {
+            have_destination = relay_address_from_tlv(&destination, tlv);
+        }
+    }
+}
+
+static void
+relay_link_request(comm_t *comm, dso_state_t *dso, bool discontinue)
+{
+    relay_session_t *session;
+    relay_link_t *link = NULL;
+    uint32_t link_id;
+
+    if (dso->primary.length == 4) {
+        memcpy(&link_id, dso->primary.payload, sizeof link_id);
+        link = relay_link_find(ntohl(link_id));
+    }
+    if (discontinue) {
+        session = relay_session_find(comm, false);
+        if (link != NULL && session != NULL && link->subscriber == session) {
+            INFO("relay_link_request: " PRI_S_SRP " discontinued link " PUB_S_SRP, comm->name, link->name);
+            link->subscriber = NULL;
+        }
+        return;
+    }
+    if (link == NULL) {
+        dp_simple_response(comm, dns_rcode_refused);
+        return;
+    }
+    session = relay_session_find(comm, true);
+    if (session == NULL) {
+        dp_simple_response(comm, dns_rcode_servfail);
+        return;
+    }
+    INFO("relay_link_request: relaying link " PUB_S_SRP " to " PRI_S_SRP, link->name, comm->name);
+    link->subscriber = session;
+    dp_simple_response(comm, dns_rcode_noerror);
+}
+
 static void dso_message(comm_t *comm, const dns_wire_t *header, dso_state_t *dso)
 {
     switch(dso->primary.opcode) {
+    case kDSOType_mDNSLinkRequest:
+        relay_link_request(comm, dso, false);
+        break;
+    case kDSOType_mDNSLinkDiscontinue:
+        relay_link_request(comm, dso, true);
+        break;
+    case kDSOType_mDNSMessage:
+        relay_mdns_message(comm, dso);
+        break;
+
     case kDSOType_DNSPushSubscribe:
         dns_push_subscription_change("DNS Push Subscribe", comm, header, dso);
         break;
@@ -253,6 +596,7 @@ void dso_transport_finalize(comm_t *comm)
 {
     dso_state_t *dso = comm->dso;
     INFO("dso_transport_finalize: " PRI_S_SRP, dso->remote_name);
+    relay_session_drop(comm);
     if (comm) {
         ioloop_close(&comm->io);
     }
@@ -314,6 +658,27 @@ void dns_evaluate(comm_t *comm)
     }
 }
 
+// Multicast DNS traffic on a relayed link goes to the proxy that asked for it, as is.
+void mdns_input(comm_t *comm)
+{
+    relay_link_t *link;
+
+    if (comm->message != NULL) {
+        for (link = relay_links; link != NULL; link = link->next) {
+            if (link->link_id == (uint32_t)comm->message->ifindex) {
+                break;
+            }
+        }
+        if (link != NULL && link->subscriber != NULL) {
+            relay_session_queue(link->subscriber, link, comm->message);
+            comm->message = NULL;
+        } else {
+            message_free(comm->message);
+            comm->message = NULL;
+        }
+    }
+}
+
 void dns_input(comm_t *comm)
 {
     dns_evaluate(comm);
@@ -396,6 +761,63 @@ static bool interface_handler(void *context, const char *filename, char **hunks,
     return true;
 }
 
+static bool relay_link_handler(void *context, const char *filename, char **hunks, int num_hunks, int lineno)
+{
+    relay_link_t *link = calloc(1, sizeof *link);
+    if (link == NULL) {
+        ERROR("Unable to allocate relay link " PUB_S_SRP, hunks[1]);
+        return false;
+    }
+    link->link_id = if_nametoindex(hunks[1]);
+    if (link->link_id == 0) {
+        ERROR("Unknown relay link interface " PUB_S_SRP, hunks[1]);
+        free(link);
+        return false;
+    }
+    link->name = strdup(hunks[1]);
+    link->destination = message_allocate(DNS_HEADER_SIZE);
+    if (link->name == NULL || link->destination == NULL) {
+        ERROR("Unable to allocate relay link " PUB_S_SRP, hunks[1]);
+        if (link->destination != NULL) {
+            message_free(link->destination);
+        }
+        free(link->name);
+        free(link);
+        return false;
+    }
+    link->next = relay_links;
+    relay_links = link;
+    return true;
+}
+
+// Join the mDNS multicast group on every relayed link.
+static bool join_mdns_groups(comm_t *listener, int family)
+{
+    relay_link_t *link;
+
+    for (link = relay_links; link != NULL; link = link->next) {
+        int ret;
+        if (family == AF_INET) {
+            struct ip_mreqn mreq;
+            memset(&mreq, 0, sizeof mreq);
+            inet_pton(AF_INET, "224.0.0.251", &mreq.imr_multiaddr);
+            mreq.imr_ifindex = link->link_id;
+            ret = setsockopt(listener->io.fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof mreq);
+        } else {
+            struct ipv6_mreq mreq;
+            memset(&mreq, 0, sizeof mreq);
+            inet_pton(AF_INET6, "ff02::fb", &mreq.ipv6mr_multiaddr);
+            mreq.ipv6mr_interface = link->link_id;
+            ret = setsockopt(listener->io.fd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof mreq);
+        }
+        if (ret < 0) {
+            ERROR("Unable to join the mDNS group on " PUB_S_SRP ": " PUB_S_SRP, link->name, strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
 static bool port_handler(void *context, const char *filename, char **hunks, int num_hunks, int lineno)
 {
     char *ep = NULL;
@@ -448,6 +870,7 @@ config_file_verb_t dp_verbs[] = {
     { "tls-cert",     2, 2, tls_cert_handler },     // tls-cert <filename>
     { "tls-cacert",   2, 2, tls_cacert_handler },   // tls-cacert <filename>
     { "listen-addr",  2, 2, listen_addr_handler },  // listen-addr <IP address>
+    { "relay-link",   2, 2, relay_link_handler },   // relay-link <interface name>
 };
 #define NUMCFVERBS ((sizeof dp_verbs) / sizeof (config_file_verb_t))
 
@@ -455,7 +878,7 @@ int
 main(int argc, char **argv)
 {
     int i;
-    comm_t *listener[4 + MAX_ADDRS];
+    comm_t *listener[6 + MAX_ADDRS];
     int num_listeners = 0;
 
     udp_port = tcp_port = 53;
@@ -511,6 +934,22 @@ main(int argc, char **argv)
         num_listeners++;
     }
 
+    // One socket per address family takes the mDNS traffic for all of the relayed links; the interface
+    // each message arrived on says which link it belongs to.
+    if (relay_links != NULL) {
+        mdns_listener4 = setup_listener_socket(AF_INET, IPPROTO_UDP, false, 5353, NULL,
+                                               "IPv4 mDNS Relay Listener", mdns_input, 0, 0);
+        mdns_listener6 = setup_listener_socket(AF_INET6, IPPROTO_UDP, false, 5353, NULL,
+                                               "IPv6 mDNS Relay Listener", mdns_input, 0, 0);
+        if (mdns_listener4 == NULL || mdns_listener6 == NULL ||
+            !join_mdns_groups(mdns_listener4, AF_INET) || !join_mdns_groups(mdns_listener6, AF_INET6)) {
+            ERROR("mDNS relay listener: fail.");
+            return 1;
+        }
+        listener[num_listeners++] = mdns_listener4;
+        listener[num_listeners++] = mdns_listener6;
+    }
+
     for (i = 0; i < num_listeners; i++) {
         INFO("Started " PRI_S_SRP, listener[i]->name);
     }
@@ -36,8 +36,70 @@
 #include "srp.h"
 #include "dns-msg.h"
 
-bool
-dns_opt_parse(dns_edns0_t *NONNULL *NULLABLE ret, dns_rr_t *rr)
+// The first chunk of a message's arena is sized for a typical parse of a len byte message, on the basis that each
+// RR becomes a dns_rr_t plus its labels, but large messages start smaller.   Heavily compressed or large messages
+// can need more chunks.
+#define DNS_ARENA_INITIAL_SIZE(len) ((sizeof (dns_message_t)) + 8 * (len) + 256)
+#define DNS_ARENA_MAX_INITIAL_SIZE 16384
+#define DNS_ARENA_CHUNK_SIZE 1024
+#define DNS_ARENA_ALIGN(size) (((size) + 7) & ~(size_t)7)
+
+static dns_message_t *NULLABLE
+dns_arena_create(unsigned len)
+{
+    size_t size = DNS_ARENA_INITIAL_SIZE(len);
+    dns_arena_chunk_t *chunk;
+    dns_message_t *message;
+
+    if (size > DNS_ARENA_MAX_INITIAL_SIZE) {
+        size = DNS_ARENA_MAX_INITIAL_SIZE;
+    }
+    size = DNS_ARENA_ALIGN(size);
+    chunk = malloc(sizeof(*chunk) + size);
+    if (chunk == NULL) {
+        return NULL;
+    }
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = DNS_ARENA_ALIGN(sizeof(*message));
+    message = (dns_message_t *)chunk->data;
+    memset(message, 0, sizeof(*message));
+    message->arena = chunk;
+    return message;
+}
+
+// Allocates zeroed memory for part of a parsed message: from the message's arena if there's a message, and
+// otherwise from the heap.
+static void *NULLABLE
+dns_parse_calloc(dns_message_t *NULLABLE message, size_t size)
+{
+    dns_arena_chunk_t *chunk;
+    void *ret;
+
+    if (message == NULL || message->arena == NULL) {
+        return calloc(1, size);
+    }
+    chunk = message->arena;
+    size = DNS_ARENA_ALIGN(size);
+    if (chunk->used + size > chunk->size) {
+        size_t chunk_size = size > DNS_ARENA_CHUNK_SIZE ? size : DNS_ARENA_CHUNK_SIZE;
+        chunk = malloc(sizeof(*chunk) + chunk_size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->size = chunk_size;
+        chunk->used = 0;
+        chunk->next = message->arena;
+        message->arena = chunk;
+    }
+    ret = &chunk->data[chunk->used];
+    chunk->used += size;
+    memset(ret, 0, size);
+    return ret;
+}
+
+static bool
+dns_opt_parse_arena(dns_message_t *NULLABLE message, dns_edns0_t *NONNULL *NULLABLE ret, dns_rr_t *rr)
 {
     dns_edns0_t *edns0, **p_edns0 = ret;
     unsigned offset = 0;
@@ -65,7 +127,7 @@ dns_opt_parse(dns_edns0_t *NONNULL *NULLABLE ret, dns_rr_t *rr)
             return false;
         }
 
-        edns0 = calloc(1, tlv_len + sizeof(*edns0));
+        edns0 = dns_parse_calloc(message, tlv_len + sizeof(*edns0));
         if (edns0 == NULL) {
             return false;
         }
@@ -80,8 +142,14 @@ dns_opt_parse(dns_edns0_t *NONNULL *NULLABLE ret, dns_rr_t *rr)
     return true;
 }
 
-dns_label_t * NULLABLE
-dns_label_parse(const uint8_t *buf, unsigned mlen, unsigned *NONNULL offp)
+bool
+dns_opt_parse(dns_edns0_t *NONNULL *NULLABLE ret, dns_rr_t *rr)
+{
+    return dns_opt_parse_arena(NULL, ret, rr);
+}
+
+static dns_label_t * NULLABLE
+dns_label_parse_arena(dns_message_t *NULLABLE message, const uint8_t *buf, unsigned mlen, unsigned *NONNULL offp)
 {
     uint8_t llen = buf[*offp];
     dns_label_t *rv;
@@ -92,7 +160,7 @@ dns_label_parse(const uint8_t *buf, unsigned mlen, unsigned *NONNULL offp)
         return NULL;
     }
 
-    rv = calloc(1, (sizeof(*rv) - DNS_MAX_LABEL_SIZE) + llen + 1);
+    rv = dns_parse_calloc(message, (sizeof(*rv) - DNS_MAX_LABEL_SIZE) + llen + 1);
     if (rv == NULL) {
         DEBUG("memory allocation for %u byte label (%.*s) failed.\n",
               *offp + llen + 1, *offp + llen + 1, &buf[*offp + 1]);
@@ -100,15 +168,24 @@ dns_label_parse(const uint8_t *buf, unsigned mlen, unsigned *NONNULL offp)
     }
 
     rv->len = llen;
+    if (message != NULL) {
+        rv->flags = DNS_LABEL_IN_ARENA;
+    }
     memcpy(rv->data, &buf[*offp + 1], llen);
     rv->data[llen] = 0; // We NUL-terminate the label for convenience
     *offp += llen + 1;
     return rv;
 }
 
+dns_label_t * NULLABLE
+dns_label_parse(const uint8_t *buf, unsigned mlen, unsigned *NONNULL offp)
+{
+    return dns_label_parse_arena(NULL, buf, mlen, offp);
+}
+
 static bool
-dns_name_parse_in(dns_label_t *NONNULL *NULLABLE ret, const uint8_t *buf, unsigned len,
-                  unsigned *NONNULL offp, unsigned base)
+dns_name_parse_in(dns_message_t *NULLABLE message, dns_label_t *NONNULL *NULLABLE ret, const uint8_t *buf,
+                  unsigned len, unsigned *NONNULL offp, unsigned base)
 {
     dns_label_t *rv;
 
@@ -148,7 +225,7 @@ dns_name_parse_in(dns_label_t *NONNULL *NULLABLE ret, const uint8_t *buf, unsign
                   pointer, buf[pointer]);
             return false;
         }
-        return dns_name_parse_in(ret, buf, len, &pointer, pointer);
+        return dns_name_parse_in(message, ret, buf, len, &pointer, pointer);
     }
     // We don't support binary labels, which are historical, and at this time there are no other valid
     // DNS label types.
@@ -157,7 +234,7 @@ dns_name_parse_in(dns_label_t *NONNULL *NULLABLE ret, const uint8_t *buf, unsign
         return false;
     }
 
-    rv = dns_label_parse(buf, len, offp);
+    rv = dns_label_parse_arena(message, buf, len, offp);
     if (rv == NULL) {
         return false;
     }
@@ -167,19 +244,22 @@ dns_name_parse_in(dns_label_t *NONNULL *NULLABLE ret, const uint8_t *buf, unsign
     if (rv->len == 0) {
         return true;
     }
-    return dns_name_parse_in(&rv->next, buf, len, offp, base);
+    return dns_name_parse_in(message, &rv->next, buf, len, offp, base);
 }
 
-bool
-dns_name_parse(dns_label_t *NONNULL *NULLABLE ret, const uint8_t *buf,
-               unsigned len, unsigned *NONNULL offp, unsigned base)
+static bool
+dns_name_parse_arena(dns_message_t *NULLABLE message, dns_label_t *NONNULL *NULLABLE ret, const uint8_t *buf,
+                     unsigned len, unsigned *NONNULL offp, unsigned base)
 {
     dns_label_t *rv = NULL, *next;
 
-    if (!dns_name_parse_in(&rv, buf, len, offp, base)) {
-        for (; rv != NULL; rv = next) {
-            next = rv->next;
-            free(rv);
+    if (!dns_name_parse_in(message, &rv, buf, len, offp, base)) {
+        // Labels in the arena go away with the message.
+        if (message == NULL) {
+            for (; rv != NULL; rv = next) {
+                next = rv->next;
+                free(rv);
+            }
         }
         return false;
     }
@@ -187,6 +267,13 @@ dns_name_parse(dns_label_t *NONNULL *NULLABLE ret, const uint8_t *buf,
     return true;
 }
 
+bool
+dns_name_parse(dns_label_t *NONNULL *NULLABLE ret, const uint8_t *buf,
+               unsigned len, unsigned *NONNULL offp, unsigned base)
+{
+    return dns_name_parse_arena(NULL, ret, buf, len, offp, base);
+}
+
 bool
 dns_u8_parse(const uint8_t *buf, unsigned len, unsigned *NONNULL offp, uint8_t *NONNULL ret)
 {
@@ -360,9 +447,9 @@ dns_rrdata_dump(dns_rr_t *rr)
     DEBUG(PUB_S_SRP, outbuf);
 }
 
-bool
-dns_rdata_parse_data(dns_rr_t *NONNULL rr, const uint8_t *buf, unsigned *NONNULL offp, unsigned target, unsigned rdlen,
-                     unsigned rrstart)
+static bool
+dns_rdata_parse_data_arena(dns_message_t *NULLABLE message, dns_rr_t *NONNULL rr, const uint8_t *buf,
+                           unsigned *NONNULL offp, unsigned target, unsigned rdlen, unsigned rrstart)
 {
     switch(rr->type) {
     case dns_rrtype_key:
@@ -372,7 +459,7 @@ dns_rdata_parse_data(dns_rr_t *NONNULL rr, const uint8_t *buf, unsigned *NONNULL
             return false;
         }
         rr->data.key.len = target - *offp;
-        rr->data.key.key = malloc(rr->data.key.len);
+        rr->data.key.key = dns_parse_calloc(message, rr->data.key.len);
         if (!rr->data.key.key) {
             return false;
         }
@@ -389,13 +476,13 @@ dns_rdata_parse_data(dns_rr_t *NONNULL rr, const uint8_t *buf, unsigned *NONNULL
             !dns_u32_parse(buf, target, offp, &rr->data.sig.expiry) ||
             !dns_u32_parse(buf, target, offp, &rr->data.sig.inception) ||
             !dns_u16_parse(buf, target, offp, &rr->data.sig.key_tag) ||
-            !dns_name_parse(&rr->data.sig.signer, buf, target, offp, *offp)) {
+            !dns_name_parse_arena(message, &rr->data.sig.signer, buf, target, offp, *offp)) {
             return false;
         }
         // The signature is what's left of the RRDATA.  It covers the message up to the signature, so we
         // remember where it starts so as to know what memory to cover to validate it.
         rr->data.sig.len = target - *offp;
-        rr->data.sig.signature = malloc(rr->data.sig.len);
+        rr->data.sig.signature = dns_parse_calloc(message, rr->data.sig.len);
         if (!rr->data.sig.signature) {
             return false;
         }
@@ -415,7 +502,7 @@ dns_rdata_parse_data(dns_rr_t *NONNULL rr, const uint8_t *buf, unsigned *NONNULL
     case dns_rrtype_ns:
     case dns_rrtype_ptr:
     case dns_rrtype_cname:
-        if (!dns_name_parse(&rr->data.ptr.name, buf, target, offp, *offp)) {
+        if (!dns_name_parse_arena(message, &rr->data.ptr.name, buf, target, offp, *offp)) {
             return false;
         }
         break;
@@ -440,7 +527,7 @@ dns_rdata_parse_data(dns_rr_t *NONNULL rr, const uint8_t *buf, unsigned *NONNULL
 
     case dns_rrtype_txt:
         rr->data.txt.len = target - *offp;
-        rr->data.txt.data = malloc(rr->data.txt.len);
+        rr->data.txt.data = dns_parse_calloc(message, rr->data.txt.len);
         if (rr->data.txt.data == NULL) {
             DEBUG("dns_rdata_parse: no memory for TXT RR");
             return false;
@@ -451,7 +538,7 @@ dns_rdata_parse_data(dns_rr_t *NONNULL rr, const uint8_t *buf, unsigned *NONNULL
 
     default:
         if (rdlen > 0) {
-            rr->data.unparsed.data = malloc(rdlen);
+            rr->data.unparsed.data = dns_parse_calloc(message, rdlen);
             if (rr->data.unparsed.data == NULL) {
                 return false;
             }
@@ -468,8 +555,15 @@ dns_rdata_parse_data(dns_rr_t *NONNULL rr, const uint8_t *buf, unsigned *NONNULL
     return true;
 }
 
+bool
+dns_rdata_parse_data(dns_rr_t *NONNULL rr, const uint8_t *buf, unsigned *NONNULL offp, unsigned target, unsigned rdlen,
+                     unsigned rrstart)
+{
+    return dns_rdata_parse_data_arena(NULL, rr, buf, offp, target, rdlen, rrstart);
+}
+
 static bool
-dns_rdata_parse(dns_rr_t *NONNULL rr,
+dns_rdata_parse(dns_message_t *NULLABLE message, dns_rr_t *NONNULL rr,
                 const uint8_t *buf, unsigned len, unsigned *NONNULL offp, unsigned rrstart)
 {
     uint16_t rdlen;
@@ -482,17 +576,17 @@ dns_rdata_parse(dns_rr_t *NONNULL rr,
     if (target > len) {
         return false;
     }
-    return dns_rdata_parse_data(rr, buf, offp, target, rdlen, rrstart);
+    return dns_rdata_parse_data_arena(message, rr, buf, offp, target, rdlen, rrstart);
 }
 
-bool
-dns_rr_parse(dns_rr_t *NONNULL rr,
-             const uint8_t *buf, unsigned len, unsigned *NONNULL offp, bool rrdata_expected)
+static bool
+dns_rr_parse_arena(dns_message_t *NULLABLE message, dns_rr_t *NONNULL rr,
+                   const uint8_t *buf, unsigned len, unsigned *NONNULL offp, bool rrdata_expected)
 {
     int rrstart = *offp; // Needed to mark the start of the SIG RR for SIG(0).
 
     memset(rr, 0, sizeof(*rr));
-    if (!dns_name_parse(&rr->name, buf, len, offp, *offp)) {
+    if (!dns_name_parse_arena(message, &rr->name, buf, len, offp, *offp)) {
         return false;
     }
 
@@ -508,7 +602,7 @@ dns_rr_parse(dns_rr_t *NONNULL rr,
         if (!dns_u32_parse(buf, len, offp, &rr->ttl)) {
             return false;
         }
-        if (!dns_rdata_parse(rr, buf, len, offp, rrstart)) {
+        if (!dns_rdata_parse(message, rr, buf, len, offp, rrstart)) {
             return false;
         }
     }
@@ -522,6 +616,13 @@ dns_rr_parse(dns_rr_t *NONNULL rr,
     return true;
 }
 
+bool
+dns_rr_parse(dns_rr_t *NONNULL rr,
+             const uint8_t *buf, unsigned len, unsigned *NONNULL offp, bool rrdata_expected)
+{
+    return dns_rr_parse_arena(NULL, rr, buf, len, offp, rrdata_expected);
+}
+
 void
 dns_rrdata_free(dns_rr_t *rr)
 {
@@ -568,6 +669,42 @@ dns_message_free(dns_message_t *message)
 {
     int i;
     dns_edns0_t *edns0, *next;
+    dns_arena_chunk_t *chunk, *next_chunk;
+
+    // Everything in a parsed message is in its arena, except for names that were changed after parsing.
+    if (message->arena != NULL) {
+#define FREE_NAMES(count, sets)                                             \
+        if (message->sets) {                                                \
+            for (i = 0; i < message->count; i++) {                          \
+                dns_rr_t *set = &message->sets[i];                          \
+                if (set->name) {                                            \
+                    dns_name_free(set->name);                               \
+                }                                                           \
+                switch(set->type) {                                         \
+                case dns_rrtype_sig:                                        \
+                    dns_name_free(set->data.sig.signer);                    \
+                    break;                                                  \
+                case dns_rrtype_srv:                                        \
+                case dns_rrtype_ns:                                         \
+                case dns_rrtype_ptr:                                        \
+                case dns_rrtype_cname:                                      \
+                    dns_name_free(set->data.ptr.name);                      \
+                    break;                                                  \
+                }                                                           \
+            }                                                               \
+        }
+        FREE_NAMES(qdcount, questions);
+        FREE_NAMES(ancount, answers);
+        FREE_NAMES(nscount, authority);
+        FREE_NAMES(arcount, additional);
+#undef FREE_NAMES
+        // The message itself is in the first chunk, so don't look at it once freeing starts.
+        for (chunk = message->arena; chunk != NULL; chunk = next_chunk) {
+            next_chunk = chunk->next;
+            free(chunk);
+        }
+        return;
+    }
 
 #define FREE(count, sets)                           \
     if (message->sets) {                            \
@@ -603,7 +740,7 @@ dns_wire_parse(dns_message_t *NONNULL *NULLABLE ret, dns_wire_t *message, unsign
     if (len < DNS_HEADER_SIZE) {
         return false;
     }
-    rv = calloc(1, sizeof(*rv));
+    rv = dns_arena_create(len);
     if (rv == NULL) {
         return false;
     }
@@ -618,7 +755,7 @@ dns_wire_parse(dns_message_t *NONNULL *NULLABLE ret, dns_wire_t *message, unsign
     DEBUG("Section %s, %d records", name, rv->count);                               \
                                                                                     \
     if (rv->count != 0) {                                                           \
-        rv->sets = calloc(rv->count, sizeof(*rv->sets));                            \
+        rv->sets = dns_parse_calloc(rv, rv->count * sizeof(*rv->sets));             \
         if (rv->sets == NULL) {                                                     \
             dns_message_free(rv);                                                   \
             return false;                                                           \
@@ -626,7 +763,7 @@ dns_wire_parse(dns_message_t *NONNULL *NULLABLE ret, dns_wire_t *message, unsign
     }                                                                               \
                                                                                     \
     for (i = 0; i < rv->count; i++) {                                               \
-        if (!dns_rr_parse(&rv->sets[i], message->data, data_len, &offset, rrdata_expected)) {    \
+        if (!dns_rr_parse_arena(rv, &rv->sets[i], message->data, data_len, &offset, rrdata_expected)) { \
             dns_message_free(rv);                                                   \
             ERROR(name " %d RR parse failed.\n", i);                                \
             return false;                                                           \
@@ -641,7 +778,7 @@ dns_wire_parse(dns_message_t *NONNULL *NULLABLE ret, dns_wire_t *message, unsign
     for (i = 0; i < rv->arcount; i++) {
         // Parse EDNS(0)
         if (rv->additional[i].type == dns_rrtype_opt) {
-            if (!dns_opt_parse(&rv->edns0, &rv->additional[i])) {
+            if (!dns_opt_parse_arena(rv, &rv->edns0, &rv->additional[i])) {
                 dns_message_free(rv);
                 return false;
             }
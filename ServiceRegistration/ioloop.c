@@ -32,6 +32,10 @@
 #ifdef USE_KQUEUE
 #include <sys/event.h>
 #endif
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
 #include <sys/wait.h>
 #include <fcntl.h>
 #include <sys/time.h>
@@ -50,13 +54,16 @@
 #endif
 
 io_t *ios;
-wakeup_t *wakeups;
 subproc_t *subprocesses;
 int64_t ioloop_now;
 
 #ifdef USE_KQUEUE
 int kq;
 #endif
+#ifdef USE_EPOLL
+int epfd = -1;
+int wakeup_timerfd = -1;
+#endif
 
 int
 getipaddr(addr_t *addr, const char *p)
@@ -88,18 +95,84 @@ ioloop_timenow()
     return now;
 }
 
+// Bursts of updates allocate and free a message per datagram or frame, so small messages are recycled through a
+// pool of fixed-size buffers rather than going through malloc each time.
+static message_t *message_pool[MESSAGE_POOL_MAX];
+static message_pool_stats_t message_pool_stats;
+
+#define MESSAGE_POOL_STATS_INTERVAL (10 * IOLOOP_MINUTE) // How often to log how the pool is doing.
+
+void
+message_pool_stats_get(message_pool_stats_t *stats)
+{
+    *stats = message_pool_stats;
+}
+
+static void
+message_pool_stats_note(void)
+{
+    static int64_t last_logged;
+    int64_t now = ioloop_timenow();
+    message_pool_stats_t *stats = &message_pool_stats;
+
+    if (last_logged == 0) {
+        last_logged = now;
+        return;
+    }
+    if (now - last_logged < MESSAGE_POOL_STATS_INTERVAL) {
+        return;
+    }
+    INFO("message_pool_stats: %llu allocations, %llu from the pool, %llu oversized; %d in use (high water %d), %d free",
+         (unsigned long long)stats->allocations, (unsigned long long)stats->pool_hits,
+         (unsigned long long)stats->oversized, stats->outstanding, stats->high_water, stats->in_pool);
+    last_logged = now;
+}
+
 message_t *
 message_allocate(size_t message_size)
 {
-    message_t *message = (message_t *)malloc(message_size + (sizeof (message_t)) - (sizeof (dns_wire_t)));
-    if (message)
+    message_t *message;
+    size_t capacity;
+
+    if (message_size <= MESSAGE_POOL_BUFFER_SIZE) {
+        capacity = MESSAGE_POOL_BUFFER_SIZE;
+        if (message_pool_stats.in_pool > 0) {
+            message = message_pool[--message_pool_stats.in_pool];
+            message_pool_stats.pool_hits++;
+        } else {
+            message = (message_t *)malloc(capacity + (sizeof (message_t)) - (sizeof (dns_wire_t)));
+        }
+    } else {
+        capacity = message_size;
+        message = (message_t *)malloc(capacity + (sizeof (message_t)) - (sizeof (dns_wire_t)));
+    }
+    if (message) {
         memset(message, 0, (sizeof (message_t)) - (sizeof (dns_wire_t)));
+        message->capacity = (uint16_t)capacity;
+        message_pool_stats.allocations++;
+        if (capacity == MESSAGE_POOL_BUFFER_SIZE) {
+            if (++message_pool_stats.outstanding > message_pool_stats.high_water) {
+                message_pool_stats.high_water = message_pool_stats.outstanding;
+            }
+        } else {
+            message_pool_stats.oversized++;
+        }
+        message_pool_stats_note();
+    }
     return message;
 }
 
 void
 message_free(message_t *message)
 {
+    if (message->capacity == MESSAGE_POOL_BUFFER_SIZE) {
+        message_pool_stats.outstanding--;
+        if (message_pool_stats.in_pool < MESSAGE_POOL_MAX) {
+            message_pool[message_pool_stats.in_pool++] = message;
+            message_pool_stats.returned++;
+            return;
+        }
+    }
     free(message);
 }
 
@@ -118,9 +191,37 @@ comm_free(comm_t *comm)
     free(comm);
 }
 
+#ifdef USE_EPOLL
+// Registrations are made once per io and then modified in place as the reader and writer come and go, so the wait
+// itself never has to walk the ios list.
+static void
+epoll_update(io_t *io)
+{
+    struct epoll_event ev;
+    int rv;
+
+    if (io->sock == -1) {
+        return;
+    }
+    memset(&ev, 0, sizeof ev);
+    ev.events = (io->want_read ? EPOLLIN : 0) | (io->want_write ? EPOLLOUT : 0);
+    ev.data.ptr = io;
+    rv = epoll_ctl(epfd, EPOLL_CTL_MOD, io->sock, &ev);
+    if (rv < 0 && errno == ENOENT) {
+        rv = epoll_ctl(epfd, EPOLL_CTL_ADD, io->sock, &ev);
+    }
+    if (rv < 0) {
+        ERROR("epoll_ctl %d: %s", io->sock, strerror(errno));
+    }
+}
+#endif
+
 void
 ioloop_close(io_t *io)
 {
+#ifdef USE_EPOLL
+    epoll_ctl(epfd, EPOLL_CTL_DEL, io->sock, NULL);
+#endif
     close(io->sock);
     io->sock = -1;
 }
@@ -146,10 +247,11 @@ ioloop_add_reader(io_t *io, io_callback_t callback, io_callback_t finalize)
 
     io->read_callback = callback;
     io->finalize = finalize;
-#ifdef USE_SELECT
+#if defined(USE_SELECT) || defined(USE_EPOLL)
     io->want_read = true;
 #endif
 #ifdef USE_EPOLL
+    epoll_update(io);
 #endif
 #ifdef USE_KQUEUE
     struct kevent ev;
@@ -169,10 +271,11 @@ ioloop_add_writer(io_t *io, io_callback_t callback, io_callback_t finalize)
     add_io(io);
 
     io->write_callback = callback;
-#ifdef USE_SELECT
+#if defined(USE_SELECT) || defined(USE_EPOLL)
     io->want_write = true;
 #endif
 #ifdef USE_EPOLL
+    epoll_update(io);
 #endif
 #ifdef USE_KQUEUE
     struct kevent ev;
@@ -189,10 +292,11 @@ ioloop_add_writer(io_t *io, io_callback_t callback, io_callback_t finalize)
 void
 drop_writer(io_t *io)
 {
-#ifdef USE_SELECT
+#if defined(USE_SELECT) || defined(USE_EPOLL)
     io->want_write = false;
 #endif
 #ifdef USE_EPOLL
+    epoll_update(io);
 #endif
 #ifdef USE_KQUEUE
     struct kevent ev;
@@ -206,43 +310,172 @@ drop_writer(io_t *io)
 #endif // USE_EPOLL
 }
 
+// Wakeups are kept on a hashed timer wheel.   Each slot holds the wakeups due in any of the ticks that hash to it,
+// so adding and canceling a wakeup is O(1), and each pass through ioloop_events only looks at the slots for the
+// ticks that have gone by since the last pass, rather than at every wakeup.
+#define IOLOOP_WHEEL_TICK  100  // Milliseconds per tick
+#define IOLOOP_WHEEL_SLOTS 512  // Ticks per revolution, which is a bit under a minute
+wakeup_t *wakeup_wheel[IOLOOP_WHEEL_SLOTS];
+int64_t wakeup_wheel_tick;      // The most recently serviced tick, which is serviced again on the next pass.
+
 static void
-add_remove_wakeup(wakeup_t *io, bool remove)
+wakeup_unlink(wakeup_t *wakeup)
 {
-    wakeup_t **p_wakeups;
-
-    // Add the new reader to the end of the list if it's not on the list.
-    for (p_wakeups = &wakeups; *p_wakeups != NULL && *p_wakeups != io; p_wakeups = &((*p_wakeups)->next))
-        ;
-    if (remove) {
-        if (*p_wakeups != NULL) {
-            *p_wakeups = io->next;
-            io->next = NULL;
+    if (wakeup->p_prev != NULL) {
+        *wakeup->p_prev = wakeup->next;
+        if (wakeup->next != NULL) {
+            wakeup->next->p_prev = wakeup->p_prev;
         }
-    } else {
-        if (*p_wakeups == NULL) {
-            *p_wakeups = io;
-            io->next = NULL;
+        wakeup->next = NULL;
+        wakeup->p_prev = NULL;
+    }
+}
+
+static void
+wakeup_link(wakeup_t **list, wakeup_t *wakeup)
+{
+    wakeup->next = *list;
+    if (wakeup->next != NULL) {
+        wakeup->next->p_prev = &wakeup->next;
+    }
+    wakeup->p_prev = list;
+    *list = wakeup;
+}
+
+static void
+wakeup_finalize(void *context)
+{
+    wakeup_t *wakeup = context;
+    if (wakeup->ref_count == 0) {
+        wakeup_unlink(wakeup);
+        if (wakeup->finalize != NULL) {
+            wakeup->finalize(wakeup->context);
         }
+        free(wakeup);
     }
 }
 
 void
-ioloop_add_wake_event(wakeup_t *wakeup, void *context, wakeup_callback_t callback, int milliseconds)
+ioloop_wakeup_retain_(wakeup_t *wakeup, const char *file, int line)
 {
-    add_remove_wakeup(wakeup, false);
-    wakeup->wakeup_time = ioloop_timenow() + milliseconds;
+    (void)file; (void)line;
+    RETAIN(wakeup);
+}
+
+void
+ioloop_wakeup_release_(wakeup_t *wakeup, const char *file, int line)
+{
+    (void)file; (void)line;
+    RELEASE(wakeup, wakeup_finalize);
+}
+
+wakeup_t *
+ioloop_wakeup_create(void)
+{
+    wakeup_t *ret = calloc(1, sizeof(*ret));
+    if (ret) {
+        RETAIN_HERE(ret);
+    }
+    return ret;
+}
+
+bool
+ioloop_add_wake_event(wakeup_t *wakeup, void *context, wakeup_callback_t callback, finalize_callback_t finalize,
+                      int milliseconds)
+{
+    int64_t tick;
+
+    if (callback == NULL) {
+        ERROR("ioloop_add_wake_event called with null callback");
+        return false;
+    }
+    wakeup_unlink(wakeup);
     wakeup->wakeup = callback;
     wakeup->context = context;
+    wakeup->finalize = finalize;
+    if (milliseconds < 0) {
+        milliseconds = 0;
+    }
+    wakeup->wakeup_time = ioloop_timenow() + milliseconds;
+
+    // A wakeup that's due in a tick that's already gone by goes in the most recent tick, which is always serviced.
+    tick = wakeup->wakeup_time / IOLOOP_WHEEL_TICK;
+    if (tick < wakeup_wheel_tick) {
+        tick = wakeup_wheel_tick;
+    }
+    wakeup_link(&wakeup_wheel[tick % IOLOOP_WHEEL_SLOTS], wakeup);
+    return true;
 }
 
 void
 ioloop_cancel_wake_event(wakeup_t *wakeup)
 {
-    add_remove_wakeup(wakeup, true);
+    wakeup_unlink(wakeup);
     wakeup->wakeup_time = 0;
 }
 
+// Runs the wakeups that are due, looking only at the slots for ticks that have gone by since the last pass.
+static int
+ioloop_run_wakeups(void)
+{
+    int64_t now_tick = ioloop_now / IOLOOP_WHEEL_TICK;
+    int64_t tick = wakeup_wheel_tick;
+    wakeup_t *due = NULL, *wakeup, *next;
+    int nev = 0;
+
+    // If we've been away for a whole revolution or more, every slot needs a look, but only one.
+    if (tick == 0 || now_tick - tick >= IOLOOP_WHEEL_SLOTS) {
+        tick = now_tick - IOLOOP_WHEEL_SLOTS + 1;
+    }
+    for (; tick <= now_tick; tick++) {
+        for (wakeup = wakeup_wheel[tick % IOLOOP_WHEEL_SLOTS]; wakeup != NULL; wakeup = next) {
+            next = wakeup->next;
+            if (wakeup->wakeup_time <= ioloop_now) {
+                wakeup_unlink(wakeup);
+                wakeup_link(&due, wakeup);
+            }
+        }
+    }
+    wakeup_wheel_tick = now_tick;
+
+    // All ioloop wakeups are one-shot.   A callback may cancel, reschedule or release any wakeup, including
+    // ones that are still on the due list, which is why they're taken off the list one at a time.
+    while (due != NULL) {
+        wakeup = due;
+        wakeup_unlink(wakeup);
+        wakeup->wakeup_time = 0;
+        RETAIN_HERE(wakeup);
+        wakeup->wakeup(wakeup->context);
+        RELEASE_HERE(wakeup, wakeup_finalize);
+        ++nev;
+    }
+    return nev;
+}
+
+// Returns the time of the earliest wakeup due within the next revolution of the wheel.   Wakeups further out are
+// at least a revolution away, so if that's all there is, we just wake up in a revolution and look again.
+static int64_t
+ioloop_next_wakeup(void)
+{
+    int64_t tick, limit = wakeup_wheel_tick + IOLOOP_WHEEL_SLOTS;
+    int64_t earliest = INT64_MAX;
+    bool any = false;
+    wakeup_t *wakeup;
+
+    for (tick = wakeup_wheel_tick; tick < limit; tick++) {
+        for (wakeup = wakeup_wheel[tick % IOLOOP_WHEEL_SLOTS]; wakeup != NULL; wakeup = wakeup->next) {
+            any = true;
+            if (wakeup->wakeup_time < (tick + 1) * IOLOOP_WHEEL_TICK && wakeup->wakeup_time < earliest) {
+                earliest = wakeup->wakeup_time;
+            }
+        }
+        if (earliest != INT64_MAX) {
+            return earliest;
+        }
+    }
+    return any ? limit * IOLOOP_WHEEL_TICK : INT64_MAX;
+}
+
 static void
 subproc_free(subproc_t *subproc)
 {
@@ -263,6 +496,29 @@ ioloop_init(void)
         ERROR("kqueue(): %s", strerror(errno));
         return false;
     }
+#endif
+#ifdef USE_EPOLL
+    struct epoll_event ev;
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        ERROR("epoll_create1(): %s", strerror(errno));
+        return false;
+    }
+    // The wakeup list is serviced through a timerfd that ioloop_events arms for the earliest wakeup; it's registered
+    // edge-triggered with a NULL data pointer so the dispatch loop can tell it apart from an io.
+    wakeup_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (wakeup_timerfd < 0) {
+        ERROR("timerfd_create(): %s", strerror(errno));
+        return false;
+    }
+    memset(&ev, 0, sizeof ev);
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, wakeup_timerfd, &ev) < 0) {
+        ERROR("epoll_ctl timerfd: %s", strerror(errno));
+        return false;
+    }
 #endif
     return true;
 }
@@ -271,8 +527,8 @@ int
 ioloop_events(int64_t timeout_when)
 {
     io_t *io, **iop;
-    wakeup_t *wakeup, **p_wakeup;
     int nev = 0, rv;
+    int64_t wakeup_time;
     int64_t now = ioloop_timenow();
     int64_t next_event = timeout_when;
     int64_t timeout = 0;
@@ -302,27 +558,16 @@ ioloop_events(int64_t timeout_when)
 #ifdef USE_KQUEUE
     struct timespec ts;
 #endif
-    p_wakeup = &wakeups;
-    while (*p_wakeup) {
-        wakeup = *p_wakeup;
-        if (wakeup->wakeup_time != 0) {
-            // We loop here in case the wakeup callback sets another wakeup--if it does, we check
-            // again.
-            while (wakeup->wakeup_time <= ioloop_now) {
-                wakeup->wakeup_time = 0;
-                wakeup->wakeup(wakeup->context);
-                ++nev;
-                if (wakeup->wakeup_time == 0) {
-                    // Take the wakeup off the list.
-                    *p_wakeup = wakeup->next;
-                    wakeup->next = NULL;
-                    break;
-                }
-            }
-            if (wakeup->wakeup_time < next_event) {
-                next_event = wakeup->wakeup_time;
-            }
-        }
+#ifdef USE_EPOLL
+    struct itimerspec its;
+    int wait_timeout = 0;
+
+    memset(&its, 0, sizeof its);
+#endif
+    nev += ioloop_run_wakeups();
+    wakeup_time = ioloop_next_wakeup();
+    if (wakeup_time < next_event) {
+        next_event = wakeup_time;
     }
 
     iop = &ios;
@@ -358,6 +603,15 @@ ioloop_events(int64_t timeout_when)
 #ifdef USE_KQUEUE
         ts.tv_sec = timeout / 1000;
         ts.tv_nsec = (timeout % 1000) * 1000 * 1000;
+#endif
+#ifdef USE_EPOLL
+        its.it_value.tv_sec = timeout / 1000;
+        its.it_value.tv_nsec = (timeout % 1000) * 1000 * 1000;
+        // An all-zero it_value disarms the timer, so a wakeup that's already due still needs a nonzero expiry.
+        if (timeout <= 0) {
+            its.it_value.tv_nsec = 1;
+        }
+        wait_timeout = -1;
 #endif
     }
 
@@ -454,6 +708,56 @@ ioloop_events(int64_t timeout_when)
         }
         nev += rv;
     } while (rv == KEV_MAX);
+#endif
+#ifdef USE_EPOLL
+#define EPOLL_EV_MAX 64
+    struct epoll_event evs[EPOLL_EV_MAX];
+    int i;
+
+    // When we're only polling, its is all zero, which disarms the timer, and wait_timeout is zero.
+    if (timerfd_settime(wakeup_timerfd, 0, &its, NULL) < 0) {
+        ERROR("timerfd_settime: %s", strerror(errno));
+        exit(1);
+    }
+    INFO("waiting %lld/%lld seconds", (long long)its.it_value.tv_sec, (long long)its.it_value.tv_nsec);
+    do {
+        rv = epoll_wait(epfd, evs, EPOLL_EV_MAX, wait_timeout);
+        now = ioloop_timenow();
+        INFO("%lld.%03lld seconds passed waiting, got %d events", (long long)((now - ioloop_now) / 1000),
+             (long long)((now - ioloop_now) % 1000), rv);
+        ioloop_now = now;
+        wait_timeout = 0;
+        if (rv < 0) {
+            if (errno == EINTR) {
+                rv = 0;
+            } else {
+                ERROR("epoll_wait: %s", strerror(errno));
+                exit(1);
+            }
+        }
+        for (i = 0; i < rv; i++) {
+            io = evs[i].data.ptr;
+            if (io == NULL) {
+                uint64_t expirations;
+                // Nothing to do but drain it; due wakeups are run at the top of the next call.
+                if (read(wakeup_timerfd, &expirations, sizeof expirations) < 0 && errno != EAGAIN) {
+                    ERROR("timerfd read: %s", strerror(errno));
+                }
+                continue;
+            }
+            // A callback earlier in this batch may have closed this io; it isn't freed until the next call, so it's
+            // still safe to look at.
+            if (io->sock == -1) {
+                continue;
+            }
+            if ((evs[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && io->want_read) {
+                io->read_callback(io);
+            } else if ((evs[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && io->want_write) {
+                io->write_callback(io);
+            }
+        }
+        nev += rv;
+    } while (rv == EPOLL_EV_MAX);
 #endif
     return nev;
 }
@@ -466,12 +770,22 @@ udp_read_callback(io_t *io)
     int rv;
     struct msghdr msg;
     struct iovec bufp;
-    uint8_t msgbuf[DNS_MAX_UDP_PAYLOAD];
+    uint8_t discard;
     char cmsgbuf[128];
     struct cmsghdr *cmh;
     message_t *message;
 
-    bufp.iov_base = msgbuf;
+    // Receive straight into a pool buffer, which is big enough for any datagram we accept.
+    message = message_allocate(DNS_MAX_UDP_PAYLOAD);
+    if (!message) {
+        ERROR("udp_read_callback: out of memory");
+        // Read the datagram anyway, so that we don't spin on it.
+        if (recv(connection->io.sock, &discard, sizeof discard, 0) < 0) {
+            ERROR("udp_read_callback: %s", strerror(errno));
+        }
+        return;
+    }
+    bufp.iov_base = &message->wire;
     bufp.iov_len = DNS_MAX_UDP_PAYLOAD;
     msg.msg_iov = &bufp;
     msg.msg_iovlen = 1;
@@ -483,16 +797,11 @@ udp_read_callback(io_t *io)
     rv = recvmsg(connection->io.sock, &msg, 0);
     if (rv < 0) {
         ERROR("udp_read_callback: %s", strerror(errno));
-        return;
-    }
-    message = message_allocate(rv);
-    if (!message) {
-        ERROR("udp_read_callback: out of memory");
+        message_free(message);
         return;
     }
     memcpy(&message->src, &src, sizeof src);
     message->length = rv;
-    memcpy(&message->wire, msgbuf, rv);
 
     // For UDP, we use the interface index as part of the validation strategy, so go get
     // the interface index.
@@ -590,16 +899,22 @@ tcp_read_callback(io_t *context)
             connection->message_length = (((uint16_t)connection->message_length_bytes[0] << 8) |
                                           ((uint16_t)connection->message_length_bytes[1]));
 
+            // If the previous frame's message wasn't taken by the datagram callback, reuse it for this frame
+            // as long as it's big enough.
+            if (connection->message != NULL && connection->message->capacity < connection->message_length) {
+                message_free(connection->message);
+                connection->message = NULL;
+            }
             if (connection->message == NULL) {
                 connection->message = message_allocate(connection->message_length);
                 if (!connection->message) {
                     ERROR("udp_read_callback: out of memory");
                     return;
                 }
-                connection->buf = (uint8_t *)&connection->message->wire;
-                connection->message->length = connection->message_length;
-                memset(&connection->message->src, 0, sizeof connection->message->src);
             }
+            connection->buf = (uint8_t *)&connection->message->wire;
+            connection->message->length = connection->message_length;
+            memset(&connection->message->src, 0, sizeof connection->message->src);
         }
     } else {
         connection->message_cur += rv;
@@ -1044,7 +1359,18 @@ connect_callback(io_t *context)
     // If this is a TLS connection, set up TLS.
     if (connection->tls_context == (tls_context_t *)-1) {
 #ifndef EXCLUDE_TLS
-        srp_tls_connect_callback(connection);
+        // Setting up TLS may hand the socket off to a TLS worker and give us a different one to use, so stop
+        // watching this one first.
+        drop_writer(&connection->io);
+#ifdef USE_EPOLL
+        epoll_ctl(epfd, EPOLL_CTL_DEL, connection->io.sock, NULL);
+#endif
+        if (!srp_tls_connect_callback(connection)) {
+            ERROR("connect_callback: TLS setup failed.");
+            connection->disconnected(connection, 0);
+            comm_close(connection);
+            return;
+        }
 #else
         ERROR("connect_callback: tls_context triggered with TLS excluded.");
         connection->disconnected(connection, 0);
@@ -63,9 +63,28 @@ struct message {
 #endif
     int ifindex;
     uint16_t length;
+    uint16_t capacity; // Bytes of wire data there's room for; pool buffers all have the same capacity.
     dns_wire_t wire;
 };
 
+// Messages no bigger than this come from a pool of preallocated buffers, which is refilled as messages are freed.
+#ifndef MESSAGE_POOL_BUFFER_SIZE
+#define MESSAGE_POOL_BUFFER_SIZE DNS_MAX_UDP_PAYLOAD
+#endif
+#ifndef MESSAGE_POOL_MAX
+#define MESSAGE_POOL_MAX 64 // Free buffers kept in the pool; more than this are given back to malloc.
+#endif
+
+typedef struct message_pool_stats {
+    uint64_t allocations; // Calls to message_allocate that succeeded.
+    uint64_t pool_hits;   // Allocations satisfied from the pool.
+    uint64_t oversized;   // Allocations too big for a pool buffer.
+    uint64_t returned;    // Buffers given back to the pool by message_free.
+    int in_pool;          // Free buffers currently in the pool.
+    int outstanding;      // Pool-sized buffers currently in use.
+    int high_water;       // Most pool-sized buffers that have been in use at once.
+} message_pool_stats_t;
+
 
 typedef struct dso_transport comm_t;
 typedef struct io io_t;
@@ -126,6 +145,7 @@ struct wakeup {
 #ifdef IOLOOP_MACOS
     dispatch_source_t NULLABLE dispatch_source;
 #else
+    wakeup_t *NULLABLE *NULLABLE p_prev;  // What points to this wakeup in its timer wheel slot, if it's scheduled.
     int64_t wakeup_time;
 #endif
 };
@@ -196,6 +216,7 @@ struct subproc {
 struct dnssd_txn {
     int ref_count;
     DNSServiceRef NULLABLE sdref;
+    dnssd_txn_t *NULLABLE parent; // Shared connection that sdref was created on, if any.
     void *NULLABLE context;
     void *NULLABLE aux_pointer;
     dnssd_txn_finalize_callback_t NULLABLE finalize_callback;
@@ -206,6 +227,7 @@ int getipaddr(addr_t *NONNULL addr, const char *NONNULL p);
 int64_t ioloop_timenow(void);
 message_t *NULLABLE message_allocate(size_t message_size);
 void message_free(message_t *NONNULL message);
+void message_pool_stats_get(message_pool_stats_t *NONNULL stats);
 void ioloop_close(io_t *NONNULL io);
 void ioloop_add_reader(io_t *NONNULL io, io_callback_t NONNULL callback);
 wakeup_t *NULLABLE ioloop_wakeup_create(void);
@@ -263,6 +285,12 @@ subproc_t *NULLABLE ioloop_subproc(const char *NONNULL exepath, char *NULLABLE *
 dnssd_txn_t *NULLABLE
 ioloop_dnssd_txn_add_(DNSServiceRef NONNULL ref, void *NULLABLE context,
                       dnssd_txn_finalize_callback_t NULLABLE callback, const char *NONNULL file, int line);
+#define ioloop_dnssd_txn_add_subordinate(ref, context, finalize, parent) \
+    ioloop_dnssd_txn_add_subordinate_(ref, context, finalize, parent, __FILE__, __LINE__)
+dnssd_txn_t *NULLABLE
+ioloop_dnssd_txn_add_subordinate_(DNSServiceRef NONNULL ref, void *NULLABLE context,
+                                  dnssd_txn_finalize_callback_t NULLABLE callback, dnssd_txn_t *NONNULL parent,
+                                  const char *NONNULL file, int line);
 void ioloop_dnssd_txn_cancel(dnssd_txn_t *NONNULL txn);
 #define ioloop_dnssd_txn_retain(txn) ioloop_dnssd_txn_retain_(txn, __FILE__, __LINE__)
 void ioloop_dnssd_txn_retain_(dnssd_txn_t *NONNULL txn, const char *NONNULL file, int line);
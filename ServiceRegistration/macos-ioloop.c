@@ -1230,6 +1230,10 @@ dnssd_txn_finalize(dnssd_txn_t *txn)
     if (txn->finalize_callback) {
         txn->finalize_callback(txn->context);
     }
+    // The subordinate's sdref has to be deallocated before the connection it shares.
+    if (txn->parent != NULL) {
+        RELEASE_HERE(txn->parent, dnssd_txn_finalize);
+    }
     free(txn);
 }
 
@@ -1264,6 +1268,27 @@ ioloop_dnssd_txn_add_(DNSServiceRef ref, void *context, finalize_callback_t fina
     return txn;
 }
 
+// A transaction whose sdref was created with kDNSServiceFlagsShareConnection on parent's sdref.  Results for it
+// arrive on the parent's dispatch queue, so we don't set one here; we hold a reference to the parent so that
+// the shared connection outlives every operation that was started on it.
+dnssd_txn_t *
+ioloop_dnssd_txn_add_subordinate_(DNSServiceRef ref, void *context, finalize_callback_t finalize_callback,
+                                  dnssd_txn_t *parent, const char *file, int line)
+{
+    dnssd_txn_t *txn = calloc(1, sizeof(*txn));
+    (void)file; (void)line;
+
+    if (txn != NULL) {
+        RETAIN(txn);
+        txn->sdref = ref;
+        txn->context = context;
+        txn->finalize_callback = finalize_callback;
+        txn->parent = parent;
+        RETAIN(parent);
+    }
+    return txn;
+}
+
 void
 ioloop_dnssd_txn_set_aux_pointer(dnssd_txn_t *NONNULL txn, void *aux_pointer)
 {
@@ -255,6 +255,9 @@ interface_finalize(void *context)
     if (interface->deconfigure_wakeup != NULL) {
         ioloop_wakeup_release(interface->deconfigure_wakeup);
     }
+    if (interface->ra_evaluation_wakeup != NULL) {
+        ioloop_wakeup_release(interface->ra_evaluation_wakeup);
+    }
     free(interface);
 }
 
@@ -801,6 +804,35 @@ router_discovery_start(interface_t *interface)
     interface->router_discovery_in_progress = true;
 }
 
+static icmp_message_t *NULLABLE *NONNULL
+router_source_bucket(interface_t *interface, const struct in6_addr *source)
+{
+    unsigned hash = 0;
+    int i;
+
+    // Router sources are link-local, so only the interface identifier varies.
+    for (i = 8; i < 16; i++) {
+        hash = hash * 31 + source->s6_addr[i];
+    }
+    return &interface->routers_by_source[hash % ROUTER_SOURCE_HASH_SIZE];
+}
+
+static void
+router_source_unhash(interface_t *interface, icmp_message_t *router)
+{
+    icmp_message_t **p_router;
+
+    for (p_router = router_source_bucket(interface, &router->source); *p_router != NULL;
+         p_router = &(*p_router)->source_next)
+    {
+        if (*p_router == router) {
+            *p_router = router->source_next;
+            router->source_next = NULL;
+            return;
+        }
+    }
+}
+
 static void
 flush_stale_routers(interface_t *interface, uint64_t now)
 {
@@ -815,6 +847,7 @@ flush_stale_routers(interface_t *interface, uint64_t now)
             INFO("flush_stale_routers: flushing stale router - ifname: " PUB_S_SRP
                  ", router src: " PRI_SEGMENTED_IPv6_ADDR_SRP, interface->name,
                  SEGMENTED_IPv6_ADDR_PARAM_SRP(router->source.s6_addr, __router_src_addr_buf));
+            router_source_unhash(interface, router);
             icmp_message_free(router);
         } else {
             p_router = &(*p_router)->next;
@@ -952,6 +985,12 @@ routing_policy_evaluate(interface_t *interface, bool assume_changed)
     bool stale_routers_exist = false;
     uint64_t stale_refresh_time = 0;
 
+    // This evaluation covers any router advertisements that were waiting for one.
+    if (interface->ra_evaluation_pending) {
+        ioloop_cancel_wake_event(interface->ra_evaluation_wakeup);
+        interface->ra_evaluation_pending = false;
+    }
+
     // No action on interfaces that aren't eligible for routing or that isn't currently active.
     if (interface->ineligible || interface->inactive) {
         INFO("not evaluating policy on " PUB_S_SRP " because it's " PUB_S_SRP, interface->name,
@@ -1224,11 +1263,55 @@ router_solicit(icmp_message_t *message)
     start_vicarious_router_discovery_if_appropriate(interface);
 }
 
+static void
+ra_policy_evaluate(void *context)
+{
+    interface_t *interface = context;
+
+    interface->ra_evaluation_pending = false;
+    routing_policy_evaluate(interface, false);
+}
+
+// Routers often send several advertisements in quick succession (e.g., one per prefix, or in reply to a burst of
+// solicits), so rather than evaluating policy for each one, wait briefly and evaluate once for all of them.
+static void
+ra_policy_evaluate_schedule(interface_t *interface)
+{
+    if (interface->ra_evaluation_pending) {
+        return;
+    }
+    if (interface->ra_evaluation_wakeup == NULL) {
+        interface->ra_evaluation_wakeup = ioloop_wakeup_create();
+        if (interface->ra_evaluation_wakeup == NULL) {
+            ERROR("No memory for router advertisement evaluation wakeup on " PUB_S_SRP ".", interface->name);
+            routing_policy_evaluate(interface, false);
+            return;
+        }
+    }
+    ioloop_add_wake_event(interface->ra_evaluation_wakeup, interface, ra_policy_evaluate, NULL,
+                          ROUTER_ADVERTISEMENT_EVALUATION_DELAY);
+    interface->ra_evaluation_pending = true;
+}
+
+// True if an advertisement says exactly what the previous one from the same router did.   The options were
+// allocated with calloc, so any padding in them is zero and they can be compared directly.
+static bool
+router_advertisement_unchanged(icmp_message_t *router, icmp_message_t *message)
+{
+    return (router->flags == message->flags && router->router_lifetime == message->router_lifetime &&
+            router->reachable_time == message->reachable_time &&
+            router->retransmission_timer == message->retransmission_timer &&
+            router->cur_hop_limit == message->cur_hop_limit && router->num_options == message->num_options &&
+            (router->num_options == 0 ||
+             !memcmp(router->options, message->options, router->num_options * sizeof(*router->options))));
+}
+
 static void
 router_advertisement(icmp_message_t *message)
 {
-    interface_t *iface;
-    icmp_message_t *router, **rp;
+    interface_t *iface, *interface = message->interface;
+    icmp_message_t *router, *next, *source_next, **p_bucket;
+    bool unchanged, was_stale, new_router;
     if (message->hop_limit != 255 || message->code != 0 || !IN6_IS_ADDR_LINKLOCAL(&message->source)) {
         ERROR("Invalid router advertisement, hop limit = %d, code = %d", message->hop_limit, message->code);
         icmp_message_free(message);
@@ -1244,22 +1327,47 @@ router_advertisement(icmp_message_t *message)
     }
 
     // See if we've had other advertisements from this router.
-    for (rp = &message->interface->routers; *rp != NULL; rp = &(*rp)->next) {
-        router = *rp;
+    p_bucket = router_source_bucket(interface, &message->source);
+    for (router = *p_bucket; router != NULL; router = router->source_next) {
         if (!memcmp(&router->source, &message->source, sizeof(message->source))) {
-            message->next = router->next;
-            *rp = message;
-            icmp_message_free(router);
             break;
         }
     }
-    // If not, save it.
-    if (*rp == NULL) {
-        *rp = message;
+
+    if (router != NULL) {
+        // If so, the new advertisement takes the old one's place in both lists.
+        unchanged = router_advertisement_unchanged(router, message);
+        was_stale = message->received_time - router->received_time > MAX_ROUTER_RECEIVED_TIME_GAP_BEFORE_STALE;
+        new_router = router->new_router;
+        next = router->next;
+        source_next = router->source_next;
+        if (router->options != NULL) {
+            free(router->options);
+        }
+        *router = *message;
+        router->next = next;
+        router->source_next = source_next;
+        free(message);
+
+        // A router repeating what it said last time changes nothing that policy depends on, except while router
+        // discovery is still looking for answers.   Its new received time is picked up when the stale router
+        // evaluation comes due.
+        if (unchanged && !was_stale &&
+            interface->router_discovery_complete && !interface->router_discovery_in_progress)
+        {
+            router->new_router = new_router;
+            return;
+        }
+    } else {
+        // If not, save it.
+        message->next = interface->routers;
+        interface->routers = message;
+        message->source_next = *p_bucket;
+        *p_bucket = message;
     }
 
     // Something may have changed, so do a policy recalculation for this interface
-    routing_policy_evaluate(message->interface, false);
+    ra_policy_evaluate_schedule(interface);
 }
 
 static void
@@ -2946,11 +3054,16 @@ interface_shutdown(interface_t *interface)
     if (interface->vicarious_discovery_complete != NULL) {
         ioloop_cancel_wake_event(interface->vicarious_discovery_complete);
     }
+    if (interface->ra_evaluation_wakeup != NULL) {
+        ioloop_cancel_wake_event(interface->ra_evaluation_wakeup);
+    }
+    interface->ra_evaluation_pending = false;
     for (router = interface->routers; router; router = next) {
         next = router->next;
         icmp_message_free(router);
     }
     interface->routers = NULL;
+    memset(interface->routers_by_source, 0, sizeof(interface->routers_by_source));
     if (interface->ip_configuration_service != NULL) {
         CFRelease(interface->ip_configuration_service);
         interface->ip_configuration_service = NULL;
@@ -25,6 +25,9 @@
 #define MIN_DELAY_BETWEEN_RAS 4000
 #define MSEC_PER_SEC (NSEC_PER_SEC / NSEC_PER_MSEC)
 #define MAX_ROUTER_RECEIVED_TIME_GAP_BEFORE_STALE 600 * MSEC_PER_SEC
+// Router advertisements that arrive within this many milliseconds of each other share one policy evaluation.
+#define ROUTER_ADVERTISEMENT_EVALUATION_DELAY 250
+#define ROUTER_SOURCE_HASH_SIZE 8
 
 // Fix this
 #ifndef IPV6_ROUTER_MODE_EXCLUSIVE
@@ -65,6 +68,12 @@ struct interface {
     // List of ICMP messages from different routers.
     icmp_message_t *NULLABLE routers;
 
+    // The same routers, hashed on their source addresses.
+    icmp_message_t *NULLABLE routers_by_source[ROUTER_SOURCE_HASH_SIZE];
+
+    // Wakeup event for the policy evaluation that router advertisements received on this interface are waiting for.
+    wakeup_t *NULLABLE ra_evaluation_wakeup;
+
     // The link to which this interface is connected.
     network_link_t *NULLABLE link;
 
@@ -139,6 +148,9 @@ struct interface {
     // multicast.   If we hear no replies during that time, we trigger router discovery.
     bool vicarious_router_discovery_in_progress;
 
+    // True if ra_evaluation_wakeup has been scheduled.
+    bool ra_evaluation_pending;
+
     // Indicates that we have received an interface removal event, it is useful when srp-mdns-proxy is changed to a new
     // network where the network signature are the same and they both have no IPv6 service (so no IPv6 prefix will be
     // removed), in such case there will be no change from srp-mdns-proxy's point of view. However, configd may still
@@ -199,6 +211,7 @@ typedef struct icmp_option {
 
 struct icmp_message {
     icmp_message_t *NULLABLE next;
+    icmp_message_t *NULLABLE source_next; // Next router in the same routers_by_source bucket.
     interface_t *NULLABLE interface;
     icmp_option_t *NULLABLE options;
     bool new_router;                     // If this router information is a newly recevied one.
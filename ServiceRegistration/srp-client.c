@@ -58,14 +58,17 @@ typedef struct update_context {
     uint32_t lease_time;
     uint32_t key_lease_time;
     uint32_t serial;
+    uint32_t change_serial; // Registration changes up to this serial are carried in message.
     bool notified;  // Callers have been notified.
     bool connected; // UDP context is connected.
     bool removing;  // We are removing the current registration(s)
+    bool full_update; // Send every service instance, not just the ones that changed.
 } update_context_t;
 
 struct _DNSServiceRef_t {
     reg_state_t *NULLABLE next;
     uint32_t serial;
+    uint32_t change_serial; // Bumped from the client's change_serial whenever the instance's records change.
     DNSServiceFlags flags;
     uint32_t interfaceIndex;
     char *NULLABLE name;
@@ -92,6 +95,9 @@ struct client_state {
     uint32_t lease_time;
     uint32_t key_lease_time;
     uint32_t registration_serial;
+    uint32_t change_serial;       // Last serial handed out to a changed registration.
+    uint32_t acked_change_serial; // Every registration change up to this serial has been accepted by the server.
+    bool need_full_update;        // The next update must carry every service instance.
     uint32_t srp_max_attempt_interval;
     uint32_t srp_max_retry_interval;
     service_addr_t stable_server;
@@ -123,7 +129,8 @@ static int do_srp_update(client_state_t *client, bool definite);
 static void udp_response(void *v_update_context, void *v_message, size_t message_length);
 static dns_wire_t *NULLABLE generate_srp_update(client_state_t *client, uint32_t update_lease_time,
                                                 uint32_t update_key_lease_time, size_t *NONNULL p_length,
-                                                service_addr_t *NONNULL server, uint32_t serial, bool remove);
+                                                service_addr_t *NONNULL server, uint32_t serial,
+                                                uint32_t clean_serial, bool remove);
 static bool srp_is_network_active(void);
 
 #define VALIDATE_IP_ADDR                                         \
@@ -146,6 +153,7 @@ srp_host_init(void *context)
     new_client->lease_time = 3600;       // 1 hour for registration leases
     new_client->key_lease_time = 604800; // 7 days for key leases
     new_client->registration_serial = 0;
+    new_client->need_full_update = true;
     new_client->srp_max_attempt_interval = 1000 * 60 * 60; // By default, never wait longer than an hour to do another
                                                            // registration attempt.
     new_client->srp_max_retry_interval = 1000 * 15;        // Default retry interval is 15 seconds--three attempts.
@@ -163,6 +171,8 @@ srp_host_key_reset(void)
         srp_keypair_free(current_client->key);
         current_client->key = NULL;
     }
+    // A new key means the server has to see everything again.
+    current_client->need_full_update = true;
     return srp_reset_key("com.apple.srp-client.host-key", current_client->os_context);
 }
 
@@ -510,6 +520,7 @@ DNSServiceUpdateRecord(DNSServiceRef sdRef, DNSRecordRef RecordRef, DNSServiceFl
 
     registration->txtRecord = txtRecord;
     registration->txtLen = rdlen;
+    registration->change_serial = ++current_client->change_serial;
     network_state_changed = true;
     return kDNSServiceErr_NoError;
 }
@@ -541,6 +552,7 @@ DNSServiceRegister(DNSServiceRef *sdRef, DNSServiceFlags flags, uint32_t interfa
     }
 
     reg->serial = current_client->registration_serial++;
+    reg->change_serial = ++current_client->change_serial;
     reg->flags = flags;
     reg->interfaceIndex = interfaceIndex;
     reg->called_back = true;
@@ -756,6 +768,8 @@ udp_retransmit(void *v_update_context)
     if (context->next_retransmission_time == 0 || next_server != NULL) {
         if (next_server != NULL) {
             context->server = next_server;
+            // The new server may not have any of our instances, so tell it about all of them.
+            context->full_update = true;
         }
         srp_disconnect_udp(context->udp_context);
         context->connected = false;
@@ -783,8 +797,12 @@ udp_retransmit(void *v_update_context)
         }
 
         if (context->message == NULL) {
+            // Instances whose records haven't changed since the server last accepted them can be left out, unless
+            // this is a full update or a removal.
+            uint32_t clean_serial = (context->full_update || context->removing) ? 0 : client->acked_change_serial;
+            context->change_serial = client->change_serial;
             context->message = generate_srp_update(client, client->lease_time, client->key_lease_time, &context->message_length,
-                                                   context->server, context->serial, context->removing);
+                                                   context->server, context->serial, clean_serial, context->removing);
             if (context->message == NULL) {
                 ERROR("No memory for message.");
                 return;
@@ -819,6 +837,8 @@ renew_callback(void *v_update_context)
     update_context_t *context = v_update_context;
     client_state_t *client = context->client;
     INFO("renew callback");
+    // Renewals always carry every instance, so that the server's view can't drift from ours.
+    client->need_full_update = true;
     do_srp_update(client, true);
 }
 
@@ -957,6 +977,12 @@ udp_response(void *v_update_context, void *v_message, size_t message_length)
         // Set up to renew.  Time is in milliseconds, and we want to renew at 80% of the lease time.
         srp_set_wakeup(client->os_context, context->udp_context, (new_lease_time * 1000) * 8 / 10, renew_callback);
 
+        // Everything we sent is now known to the server.
+        client->acked_change_serial = context->change_serial;
+        if (context->full_update) {
+            client->need_full_update = false;
+        }
+
         do_callbacks(client, context->serial, kDNSServiceErr_NoError, true);
         break;
     case dns_rcode_yxdomain:
@@ -994,7 +1020,9 @@ udp_response(void *v_update_context, void *v_message, size_t message_length)
                 client->hostname_rename_number = srp_random16();
             }
             // When we get a name conflict response, we need to re-do the update immediately
-            // (with a 0-500ms delay of course).
+            // (with a 0-500ms delay of course).  The instance names change along with the hostname, so this has
+            // to be a full update.
+            client->need_full_update = true;
             do_srp_update(client, true);
         }
         break;
@@ -1016,7 +1044,8 @@ udp_response(void *v_update_context, void *v_message, size_t message_length)
 // Generate a new SRP update message
 static dns_wire_t *
 generate_srp_update(client_state_t *client, uint32_t update_lease_time, uint32_t update_key_lease_time,
-                    size_t *NONNULL p_length, service_addr_t *server, uint32_t serial, bool removing)
+                    size_t *NONNULL p_length, service_addr_t *server, uint32_t serial, uint32_t clean_serial,
+                    bool removing)
 {
     dns_wire_t *message;
     const char *zone_name = "default.service.arpa";
@@ -1032,6 +1061,7 @@ generate_srp_update(client_state_t *client, uint32_t update_lease_time, uint32_t
     service_addr_t *addr;
     reg_state_t *reg;
     char *conflict_hostname = NULL, *chosen_hostname;
+    int num_instances = 0, num_sent = 0;
 
 #define INCREMENT(x) (x) = htons(ntohs(x) + 1)
     memset(&towire, 0, sizeof towire);
@@ -1060,6 +1090,7 @@ generate_srp_update(client_state_t *client, uint32_t update_lease_time, uint32_t
     towire.p = &message->data[0];               // We start storing RR data here.
     towire.lim = &message->data[DNS_DATA_SIZE]; // This is the limit to how much we can store.
     towire.message = message;
+    towire.compress = true;
 
     // Generate a random UUID.
     message->id = srp_random16();
@@ -1159,6 +1190,14 @@ generate_srp_update(client_state_t *client, uint32_t update_lease_time, uint32_t
         if (removing && reg->serial > serial) {
             continue;
         }
+        num_instances++;
+
+        // The host description is always sent, but service instances the server already has can be left out
+        // when their records haven't changed.
+        if (reg->change_serial <= clean_serial) {
+            continue;
+        }
+        num_sent++;
 
         // Service:
         //   * Update PTR RR
@@ -1241,6 +1280,9 @@ generate_srp_update(client_state_t *client, uint32_t update_lease_time, uint32_t
         INCREMENT(message->nscount);
     }
 
+    INFO("generate_srp_update: " PUB_S_SRP " update with %d of %d service instances",
+         clean_serial == 0 ? "full" : "incremental", num_sent, num_instances);
+
     // What about services with more than one name?   Are these multiple service descriptions?
 
     // ARCOUNT = 2
@@ -1343,6 +1385,8 @@ do_srp_update(client_state_t *client, bool definite)
         // If possible, use the server we used last time.
         active_update->client = client;
         sync_from_stable_storage(active_update);
+        // If we can't use the server that accepted our last update, it won't know about our instances.
+        active_update->full_update = client->need_full_update || active_update->server == NULL;
         if (active_update->server == NULL) {
             active_update->server = servers;
         }
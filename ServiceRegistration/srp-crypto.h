@@ -161,7 +161,22 @@ int srp_sign(uint8_t *NONNULL output, size_t max, uint8_t *NONNULL message, size
              uint8_t *NONNULL rdata, size_t rdlen, srp_key_t *NONNULL key);
 
 // verify_*.c:
+// Public keys imported from KEY RRs are kept in a direct-mapped cache, indexed by a hash of the key data, so that
+// a host renewing its lease doesn't need its key imported again.
+#ifndef SRP_KEY_CACHE_SIZE
+#define SRP_KEY_CACHE_SIZE 256
+#endif
+
+typedef struct srp_verify_stats srp_verify_stats_t;
+struct srp_verify_stats {
+    uint64_t verifies;              // Calls to srp_sig0_verify
+    uint64_t failures;              // Calls that didn't validate
+    uint64_t key_cache_hits;        // Keys that had already been imported
+    uint64_t key_cache_misses;      // Keys that had to be imported
+};
+
 bool srp_sig0_verify(dns_wire_t *NONNULL message, dns_rr_t *NONNULL key, dns_rr_t *NONNULL signature);
+void srp_verify_stats_get(srp_verify_stats_t *NONNULL stats);
 void srp_print_key(srp_key_t *NONNULL key);
 
 // hash_*.c:
@@ -63,6 +63,18 @@
 
 static addr_t dns_server;
 static hmac_key_t *key;
+static update_server_t auth_server = { &dns_server };
+
+// After this many connection attempts in a row have failed, updates that are waiting for the connection
+// are answered with SERVFAIL rather than being held through another backoff interval.
+#define UPDATE_SERVER_MAX_CONNECT_FAILURES 3
+#define UPDATE_SERVER_MIN_BACKOFF          1000  // milliseconds
+#define UPDATE_SERVER_MAX_BACKOFF          60000 // milliseconds
+
+static void update_server_connect(update_server_t *server);
+static void update_server_reply_callback(comm_t *comm);
+static void update_server_connect_callback(comm_t *comm);
+static void update_server_disconnect_callback(comm_t *comm, int error);
 
 static int
 usage(const char *progname)
@@ -289,6 +301,20 @@ srp_update_free(update_t *update)
 // I think this is unlikely to be an actual problem, and there's no way to address it without a _lot_ of
 // complexity.
 
+// Returns true if an update other than skip has a message outstanding to the server with this ID.
+static bool
+update_server_id_in_use(update_server_t *server, update_t *skip, uint16_t id)
+{
+    update_t *update;
+
+    for (update = server->updates; update != NULL; update = update->next) {
+        if (update != skip && update->state != connect_to_server && update->update->id == id) {
+            return true;
+        }
+    }
+    return false;
+}
+
 bool
 construct_update(update_t *update)
 {
@@ -308,7 +334,10 @@ construct_update(update_t *update)
     memset(msg, 0, DNS_HEADER_SIZE);
     dns_qr_set(msg, dns_qr_query);
     dns_opcode_set(msg, dns_opcode_update);
-    msg->id = srp_random16();
+    // Other updates may be outstanding on the same connection, so the ID has to be one they aren't using.
+    do {
+        msg->id = srp_random16();
+    } while (update_server_id_in_use(update->server, update, msg->id));
 
     // An update always has one question, which is the zone name.
     msg->qdcount = htons(1);
@@ -428,10 +457,19 @@ void
 update_finished(update_t *update, int rcode)
 {
     comm_t *comm = update->client;
+    update_t **p_update;
     struct iovec iov;
     dns_wire_t response;
     INFO("Update Finished, rcode = " PUB_S_SRP, dns_rcode_name(rcode));
 
+    // The connection to the server stays up for the other updates; just take this one off its list.
+    for (p_update = &update->server->updates; *p_update != NULL; p_update = &(*p_update)->next) {
+        if (*p_update == update) {
+            *p_update = update->next;
+            break;
+        }
+    }
+
     memset(&response, 0, DNS_HEADER_SIZE);
     response.id = update->message->wire.id;
     response.bitfield = update->message->wire.bitfield;
@@ -451,7 +489,6 @@ update_finished(update_t *update, int rcode)
     // So in each of these cases, perhaps we should just gc the instance.
     // This would mean that there is nothing to signal: either the instance is a mismatch, and we
     // overwrite it and return success, or the host is a mismatch and we gc the instance and return failure.
-    ioloop_close(&update->server->io);
     srp_update_free(update);
 }
 
@@ -542,16 +579,13 @@ update_send(update_t *update)
     // Transmit the update
     iov[0].iov_base = update->update;
     iov[0].iov_len = update->update_length;
-    update->server->send_response(update->server, update->message, iov, 1);
+    update->server->connection->send_response(update->server->connection, update->message, iov, 1);
 }
 
-void
-update_connect_callback(comm_t *comm)
+// Construct and send the first update once the server connection is up.
+static void
+update_begin(update_t *update)
 {
-    update_t *update = comm->context;
-
-    // Once we're connected, construct the first update.
-    INFO("Connected to " PUB_S_SRP ".", comm->name);
     // STATE CHANGE: connect_to_server -> refresh_existing
     update->state = refresh_existing;
     if (!construct_update(update)) {
@@ -561,6 +595,26 @@ update_connect_callback(comm_t *comm)
     update_send(update);
 }
 
+static void
+update_server_connect_callback(comm_t *comm)
+{
+    update_server_t *server = comm->context;
+    update_t *update, *next;
+
+    INFO("Connected to " PUB_S_SRP ".", comm->name);
+    server->connected = true;
+    server->connect_failures = 0;
+    server->next_connect_time = 0;
+
+    // Every update that was waiting for the connection can go out now.
+    for (update = server->updates; update != NULL; update = next) {
+        next = update->next; // update_begin can finish the update, which frees it.
+        if (update->state == connect_to_server) {
+            update_begin(update);
+        }
+    }
+}
+
 const char *NONNULL
 update_state_name(update_state_t state)
 {
@@ -585,26 +639,114 @@ update_state_name(update_state_t state)
     return "unknown state";
 }
 
-void
-update_disconnect_callback(comm_t *comm, int error)
+static void
+update_server_reconnect(void *context)
+{
+    update_server_t *server = context;
+
+    server->reconnect_pending = false;
+    update_server_connect(server);
+}
+
+// Called when a connection attempt fails or the connection drops: updates that are still waiting get another
+// attempt after a backoff that doubles with each consecutive failure, up to a limit.
+static void
+update_server_connect_failed(update_server_t *server)
+{
+    update_t *update, *next;
+    int backoff, i;
+
+    server->connect_failures++;
+    backoff = UPDATE_SERVER_MIN_BACKOFF;
+    for (i = 1; i < server->connect_failures && backoff < UPDATE_SERVER_MAX_BACKOFF; i++) {
+        backoff *= 2;
+    }
+    if (backoff > UPDATE_SERVER_MAX_BACKOFF) {
+        backoff = UPDATE_SERVER_MAX_BACKOFF;
+    }
+    server->next_connect_time = ioloop_timenow() + backoff;
+
+    if (server->connect_failures >= UPDATE_SERVER_MAX_CONNECT_FAILURES) {
+        for (update = server->updates; update != NULL; update = next) {
+            next = update->next;
+            update_finished(update, dns_rcode_servfail);
+        }
+        return;
+    }
+    if (server->updates != NULL) {
+        update_server_connect(server);
+    }
+}
+
+// Connect to the server unless there's already a connection or a connection attempt in progress.   If the
+// backoff from earlier failures hasn't elapsed yet, the attempt is made when it has.
+static void
+update_server_connect(update_server_t *server)
+{
+    int64_t now;
+
+    if (server->connection != NULL || server->reconnect_pending) {
+        return;
+    }
+    now = ioloop_timenow();
+    if (now < server->next_connect_time) {
+        if (server->reconnect_wakeup == NULL) {
+            server->reconnect_wakeup = ioloop_wakeup_create();
+        }
+        if (server->reconnect_wakeup != NULL &&
+            ioloop_add_wake_event(server->reconnect_wakeup, server, update_server_reconnect, NULL,
+                                  (int)(server->next_connect_time - now))) {
+            server->reconnect_pending = true;
+            return;
+        }
+        ERROR("update_server_connect: unable to schedule reconnect; trying now.");
+    }
+    server->connection = connect_to_host(server->address, false, update_server_reply_callback,
+                                         update_server_connect_callback, update_server_disconnect_callback,
+                                         server);
+    if (server->connection == NULL) {
+        ERROR("update_server_connect: unable to start connection to authoritative server.");
+        update_server_connect_failed(server);
+    }
+}
+
+static void
+update_server_disconnect_callback(comm_t *comm, int error)
 {
-    update_t *update = comm->context;
+    update_server_t *server = comm->context;
+    update_t *update, *next;
+    bool was_connected = server->connected;
+
+    server->connection = NULL;
+    server->connected = false;
+    ioloop_close(&comm->io);
+
+    // Updates that have a message outstanding can't safely be resent, since the server may already have
+    // applied it, so they fail.   This could be bad if any updates succeeded.
+    for (update = server->updates; update != NULL; update = next) {
+        next = update->next;
+        if (update->state != connect_to_server) {
+            ERROR("%s disconnected during update in state %s: %s",
+                  comm->name, update_state_name(update->state), strerror(error));
+            update_finished(update, dns_rcode_servfail);
+        }
+    }
 
-    if (update->state == connect_to_server) {
+    // A server that closes an idle connection is not a failure; the next update just reconnects.
+    if (was_connected) {
         INFO(PUB_S_SRP " disconnected: " PUB_S_SRP, comm->name, strerror(error));
-        update_finished(update, dns_rcode_servfail);
+        if (server->updates != NULL) {
+            update_server_connect(server);
+        }
     } else {
-        // This could be bad if any updates succeeded.
-        ERROR("%s disconnected during update in state %s: %s",
-              comm->name, update_state_name(update->state), strerror(error));
-        update_finished(update, dns_rcode_servfail);
+        INFO("Connection to " PUB_S_SRP " failed: " PUB_S_SRP, comm->name, strerror(error));
+        update_server_connect_failed(server);
     }
 }
 
-void
-update_reply_callback(comm_t *comm)
+static void
+update_reply_callback(update_t *update, comm_t *comm)
 {
-    update_t *update = comm->context;
     dns_wire_t *wire = &comm->message->wire;
     char namebuf[DNS_MAX_NAME_SIZE + 1], namebuf1[DNS_MAX_NAME_SIZE + 1];
     service_instance_t **pinstance;
@@ -629,16 +771,6 @@ update_reply_callback(comm_t *comm)
         update_finished(update, dns_rcode_servfail);
         return;
     }
-    if (update->update == NULL) {
-        ERROR("Received a response from auth server when no update has been sent yet.");
-        update_finished(update, dns_rcode_servfail);
-    }
-    // This isn't an error in the protocol, because we might be pipelining.   But we _aren't_ pipelining,
-    // so there is only one message in flight.   So the message IDs should match.
-    if (update->update->id != wire->id) {
-        ERROR("Response doesn't have the expected id: %x != %x.", wire->id, update->update->id);
-        update_finished(update, dns_rcode_servfail);
-    }
 
     // Handle the case where the update succeeded.
     switch(dns_rcode_get(wire)) {
@@ -860,11 +992,29 @@ update_reply_callback(comm_t *comm)
      return;
 }
 
+// Updates are pipelined on the server connection, so the reply goes to whichever update sent the message
+// with its ID.
+static void
+update_server_reply_callback(comm_t *comm)
+{
+    update_server_t *server = comm->context;
+    dns_wire_t *wire = &comm->message->wire;
+    update_t *update;
+
+    for (update = server->updates; update != NULL; update = update->next) {
+        if (update->state != connect_to_server && update->update->id == wire->id) {
+            update_reply_callback(update, comm);
+            return;
+        }
+    }
+    ERROR("Response from " PUB_S_SRP " with id %x doesn't match any outstanding update.", comm->name, wire->id);
+}
+
 bool
 srp_update_start(comm_t *connection, dns_message_t *parsed_message, dns_host_description_t *host,
                  service_instance_t *instance, service_t *service, dns_name_t *update_zone)
 {
-    update_t *update;
+    update_t *update, **p_update;
 
     // Allocate the data structure
     update = calloc(1, sizeof *update);
@@ -889,13 +1039,17 @@ srp_update_start(comm_t *connection, dns_message_t *parsed_message, dns_host_des
     update->state = connect_to_server;
     update->zone_name = update_zone;
     update->client = connection;
-
-    // Start the connection to the server
-    update->server = connect_to_host(&dns_server, false, update_reply_callback,
-                                     update_connect_callback, update_disconnect_callback, update);
-    if (update->server == NULL) {
-        free(update);
-        return false;
+    update->server = &auth_server;
+
+    // Queue the update on the server.   If the connection is already up it can be sent right away;
+    // otherwise it goes out when the connection completes.
+    for (p_update = &auth_server.updates; *p_update != NULL; p_update = &(*p_update)->next)
+        ;
+    *p_update = update;
+    if (auth_server.connected) {
+        update_begin(update);
+    } else {
+        update_server_connect(&auth_server);
     }
     return true;
 }
@@ -95,8 +95,24 @@ enum update_event {
 };
 
 typedef struct update update_t;
+typedef struct update_server update_server_t;
+
+// The update_server_t structure holds the one connection to an authoritative server that all of the updates
+// being forwarded to it share. Updates are pipelined on it and their replies are matched up by message ID.
+struct update_server {
+    addr_t *NONNULL address;
+    comm_t *NULLABLE connection;                  // Connection to the server, if connected or connecting.
+    wakeup_t *NULLABLE reconnect_wakeup;          // Fires when the reconnect backoff has elapsed.
+    update_t *NULLABLE updates;                   // Updates in progress on this server, oldest first.
+    int64_t next_connect_time;                    // No connection attempt is made before this time.
+    int connect_failures;                         // Consecutive failed connection attempts.
+    bool connected;
+    bool reconnect_pending;                       // The reconnect wakeup has been scheduled.
+};
+
 struct update {
-    comm_t *NONNULL server;                       // Connection to authoritative server
+    update_t *NULLABLE next;                      // Next update on the same server.
+    update_server_t *NONNULL server;              // Authoritative server the update is being sent to.
     comm_t *NONNULL client;                       // Connection to SRP client (which might just be a UDP socket).
     update_state_t state;
     dns_host_description_t *NONNULL host;
@@ -28,6 +28,9 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 #include <dns_sd.h>
 #include <net/if.h>
@@ -83,6 +86,16 @@ static xpc_connection_t xpc_listener;
 srp_wanted_state_t *srp_wanted;
 srp_xpc_client_t *srp_xpc_clients;
 
+// Every host record and service instance is advertised over one shared connection to mDNSResponder, so that
+// re-advertising a large set of hosts after a restart doesn't need a connection and dispatch source per record.
+static dnssd_txn_t *shared_connection;
+
+// Registrations started on the shared connection that mDNSResponder hasn't answered yet, and the size of the batch
+// they belong to.  When the last one is answered, we log how the batch went.
+static int advertise_outstanding;
+static int advertise_batch;
+static int advertise_batch_failures;
+
 // Forward references...
 static void try_new_hostname(adv_host_t *host);
 static void register_host_completion(DNSServiceRef sdref, DNSRecordRef rref,
@@ -93,6 +106,9 @@ static void update_from_host(adv_host_t *host);
 static void start_host_update(adv_host_t *host);
 static void prepare_update(adv_host_t *host);
 static void lease_callback(void *context);
+static void srp_db_save_host(adv_host_t *host);
+static void srp_db_forget_host(adv_host_t *host);
+static void srp_restore_host(adv_host_t *host);
 
 
 static void
@@ -140,24 +156,96 @@ adv_instance_vec_create(int size)
     return vec;
 }
 
+// Since instance vectors aren't modified once they are shared, the copy can share the original.
 static adv_instance_vec_t *
 adv_instance_vec_copy(adv_instance_vec_t *vec)
 {
-    adv_instance_vec_t *new_vec;
-    int i;
+    RETAIN_HERE(vec);
+    return vec;
+}
+
+static uint32_t
+adv_instance_name_hash(const char *instance_name, const char *service_type)
+{
+    uint32_t hash = 2166136261U;
+    const char *s;
+
+    for (s = instance_name; *s; s++) {
+        hash = (hash ^ (uint8_t)*s) * 16777619U;
+    }
+    hash = (hash ^ '.') * 16777619U;
+    for (s = service_type; *s; s++) {
+        hash = (hash ^ (uint8_t)*s) * 16777619U;
+    }
+    return hash;
+}
 
-    new_vec = adv_instance_vec_create(vec->num);
-    if (new_vec != NULL) {
-        RETAIN_HERE(new_vec);
+static bool
+adv_instance_vec_index(adv_instance_vec_t *vec)
+{
+    int i, slot, size = 8;
+    adv_instance_t *instance;
+
+    while (size < vec->num * 2) {
+        size *= 2;
+    }
+    vec->index = malloc(size * sizeof(*vec->index));
+    if (vec->index == NULL) {
+        return false;
+    }
+    vec->index_size = size;
+    for (i = 0; i < size; i++) {
+        vec->index[i] = -1;
+    }
+    for (i = 0; i < vec->num; i++) {
+        instance = vec->vec[i];
+        if (instance == NULL) {
+            continue;
+        }
+        slot = adv_instance_name_hash(instance->instance_name, instance->service_type) & (size - 1);
+        while (vec->index[slot] != -1) {
+            adv_instance_t *other = vec->vec[vec->index[slot]];
+            // If the same name appears twice, the first one wins, as it would in a linear search.
+            if (!strcmp(other->instance_name, instance->instance_name) &&
+                !strcmp(other->service_type, instance->service_type)) {
+                break;
+            }
+            slot = (slot + 1) & (size - 1);
+        }
+        if (vec->index[slot] == -1) {
+            vec->index[slot] = i;
+        }
+    }
+    return true;
+}
+
+// Return the position in vec of the instance with the given name and service type, or -1 if there isn't one.
+static int
+adv_instance_vec_find(adv_instance_vec_t *vec, const char *instance_name, const char *service_type)
+{
+    int i, slot;
+    adv_instance_t *instance;
+
+    // If we can't allocate an index, a linear search still gets the right answer.
+    if (vec->index == NULL && !adv_instance_vec_index(vec)) {
         for (i = 0; i < vec->num; i++) {
-            if (vec->vec[i] != NULL) {
-                new_vec->vec[i] = vec->vec[i];
-                RETAIN_HERE(new_vec->vec[i]);
+            instance = vec->vec[i];
+            if (instance != NULL &&
+                !strcmp(instance->instance_name, instance_name) && !strcmp(instance->service_type, service_type)) {
+                return i;
             }
         }
-        new_vec->num = vec->num;
+        return -1;
+    }
+    slot = adv_instance_name_hash(instance_name, service_type) & (vec->index_size - 1);
+    while (vec->index[slot] != -1) {
+        instance = vec->vec[vec->index[slot]];
+        if (!strcmp(instance->instance_name, instance_name) && !strcmp(instance->service_type, service_type)) {
+            return vec->index[slot];
+        }
+        slot = (slot + 1) & (vec->index_size - 1);
     }
-    return new_vec;
+    return -1;
 }
 
 static void
@@ -171,6 +259,9 @@ adv_instance_vec_finalize(adv_instance_vec_t *vec)
             vec->vec[i] = NULL;
         }
     }
+    if (vec->index != NULL) {
+        free(vec->index);
+    }
     free(vec->vec);
     free(vec);
 }
@@ -247,12 +338,90 @@ advertise_finished(comm_t *connection, message_t *message, int rcode, client_upd
     ioloop_send_message(connection, message, &iov, 1);
 }
 
+static dnssd_txn_t *
+shared_connection_get(int *p_err)
+{
+    DNSServiceRef sdref;
+
+    if (shared_connection == NULL) {
+        *p_err = DNSServiceCreateConnection(&sdref);
+        if (*p_err != kDNSServiceErr_NoError) {
+            return NULL;
+        }
+        INFO("shared_connection_get: new mDNSResponder connection %p", sdref);
+        shared_connection = ioloop_dnssd_txn_add(sdref, NULL, NULL);
+        if (shared_connection == NULL) {
+            ERROR("shared_connection_get: no memory for shared connection transaction");
+            DNSServiceRefDeallocate(sdref);
+            *p_err = kDNSServiceErr_Unknown;
+            return NULL;
+        }
+    }
+    *p_err = kDNSServiceErr_NoError;
+    return shared_connection;
+}
+
+// When mDNSResponder goes away, everything registered on the shared connection goes with it.  Forget the connection
+// so that the next registration makes a new one; the old one is freed when the last host and instance let go of it.
 static void
-host_txn_finalize_callback(void *context)
+shared_connection_lost(void)
 {
-    adv_host_t *host = context;
-    host->txn = NULL;
+    if (shared_connection != NULL) {
+        INFO("shared_connection_lost: dropping mDNSResponder connection %p", shared_connection->sdref);
+        ioloop_dnssd_txn_release(shared_connection);
+        shared_connection = NULL;
+    }
+}
+
+static void
+advertise_started(bool *pending)
+{
+    if (*pending) {
+        return;
+    }
+    *pending = true;
+    advertise_outstanding++;
+    advertise_batch++;
+}
+
+static void
+advertise_done(bool *pending, bool failed)
+{
+    if (!*pending) {
+        return;
+    }
+    *pending = false;
+    if (failed) {
+        advertise_batch_failures++;
+    }
+    if (--advertise_outstanding == 0) {
+        INFO("advertise_done: all %d registrations in the batch are done, %d failed.",
+             advertise_batch, advertise_batch_failures);
+        advertise_batch = 0;
+        advertise_batch_failures = 0;
+    }
+}
+
+// Remove the host's address or key record from mDNSResponder and let go of the connection it was registered on.
+static void
+host_record_remove(adv_host_t *host)
+{
+    int err;
+
+    if (host->txn != NULL) {
+        if (host->rref != NULL && host->txn->sdref != NULL) {
+            err = DNSServiceRemoveRecord(host->txn->sdref, host->rref, 0);
+            if (err != kDNSServiceErr_NoError) {
+                INFO("host_record_remove: DNSServiceRemoveRecord for " PRI_S_SRP " failed: %d",
+                     host->registered_name, err);
+            }
+        }
+        ioloop_dnssd_txn_release(host->txn);
+        host->txn = NULL;
+    }
     host->rref = NULL;
+    host->rref_update = NULL;
+    advertise_done(&host->advertise_pending, false);
 }
 
 static void
@@ -260,6 +429,7 @@ instance_txn_finalize_callback(void *context)
 {
     adv_instance_t *instance = context;
     instance->txn = NULL;
+    advertise_done(&instance->advertise_pending, false);
 }
 
 static void
@@ -334,15 +504,11 @@ update_finalize(adv_update_t *NONNULL update)
         adv_update_t **p_updates = &host->updates;
 
         // Once the update is done, we want to make sure that any results that come in on the host registration do not
-        // reference the update, which will we are about to free.  So get rid of the update pointer that's in the
-        // host address transaction aux data.
-        if (update->host->txn != NULL) {
-            adv_update_t *host_txn_update = ioloop_dnssd_txn_get_aux_pointer(host->txn);
-            // If we are retrying an update, the update on the host DNSServiceRegisterRecord transaction might not be
-            // the transaction we are finalizing, but if it is, we definitely want to make it go away.
-            if (host_txn_update == update) {
-                ioloop_dnssd_txn_set_aux_pointer(host->txn, NULL);
-            }
+        // reference the update, which will we are about to free.  If we are retrying an update, the update waiting on
+        // the host DNSServiceRegisterRecord might not be the one we are finalizing, but if it is, we definitely want
+        // to make it go away.
+        if (host->rref_update == update) {
+            host->rref_update = NULL;
         }
         INFO("finalizing update %p for host " PRI_S_SRP, update, host->registered_name);
 
@@ -467,12 +633,12 @@ host_finalize(adv_host_t *host)
 
     // Remove all the advertised address records (currently only one).
     if (host->txn != NULL) {
-        if (host->txn->sdref == NULL) {
-            INFO("host_finalize: releasing DNSSD transaction for " PRI_S_SRP ", but there's no sdref.", host->name);
+        if (host->rref == NULL) {
+            INFO("host_finalize: releasing DNSSD connection for " PRI_S_SRP ", but there's no record.", host->name);
         } else {
             INFO("host_finalize: removing AAAA record(s) for " PRI_S_SRP, host->registered_name);
         }
-        ioloop_dnssd_txn_release(host->txn);
+        host_record_remove(host);
     } else {
         INFO("host_finalize: no host address transaction for " PRI_S_SRP, host->registered_name);
     }
@@ -540,6 +706,7 @@ lease_callback(void *context)
 
     // De-link the host.
     *p_hosts = host->next;
+    srp_db_forget_host(host);
 
     // Get rid of any transactions attached to the host, any timer events, and any other associated data.
     host_finalize(host);
@@ -550,6 +717,7 @@ update_finished(adv_update_t *update)
 {
     adv_host_t *host = update->host;
     client_update_t *client = update->client;
+    const bool accepted = client != NULL;
     int num_addresses = 0;
     adv_address_t **addresses = NULL;
     int num_instances = 0;
@@ -622,7 +790,15 @@ update_finished(adv_update_t *update)
         if (update->add_addresses != NULL) {
             for (i = 0; i < update->num_add_addresses; i++) {
                 if (update->add_addresses[i] != NULL) {
-                    if (update->add_addresses[i] != update->selected_addr) {
+                    // An update made from the host itself (update_from_host) adds back addresses we've just retained.
+                    bool retained = false;
+                    int k;
+                    for (k = 1; k < j; k++) {
+                        if (addresses[k] == update->add_addresses[i]) {
+                            retained = true;
+                        }
+                    }
+                    if (update->add_addresses[i] != update->selected_addr && !retained) {
 #ifdef DEBUG_VERBOSE
                         uint8_t *rdp = update->add_addresses[i]->rdata;
                         SEGMENTED_IPv6_ADDR_GEN_SRP(rdp, rdp_buf);
@@ -684,9 +860,9 @@ update_finished(adv_update_t *update)
                 adv_instance_t *instance = update->update_instances->vec[i];
                 INFO("update_finished: updated instance " PRI_S_SRP " " PRI_S_SRP " %d",
                       instance->instance_name, instance->service_type, instance->port);
-                // Implicit RETAIN/RELEASE
-                instances->vec[j] = instance;
-                update->update_instances->vec[i] = NULL;
+                // update_instances may be shared with the host, so leave it alone and take our own reference.
+                instances->vec[j++] = instance;
+                RETAIN_HERE(instance);
             } else {
                 if (host->instances->vec[i] != NULL) {
                     adv_instance_t *instance = host->instances->vec[i];
@@ -717,7 +893,7 @@ update_finished(adv_update_t *update)
     RELEASE_HERE(host->instances, adv_instance_vec_finalize);
 
     host->addresses = addresses;
-    host->num_addresses = num_addresses;
+    host->num_addresses = j;
     host->instances = instances;
 
     if (client) {
@@ -781,6 +957,9 @@ update_finished(adv_update_t *update)
         ioloop_add_wake_event(host->lease_wakeup, host, lease_callback, NULL, host->lease_interval * 1000);
         host->lease_expiry = ioloop_timenow() + host->lease_interval * 1000;
     }
+    if (accepted) {
+        srp_db_save_host(host);
+    }
 out:
     update_finalize(update);
 }
@@ -799,6 +978,8 @@ register_instance_completion(DNSServiceRef sdref, DNSServiceFlags flags, DNSServ
     adv_update_t *update = instance->update;
     adv_host_t *host = instance->host;
 
+    advertise_done(&instance->advertise_pending, error_code != kDNSServiceErr_NoError);
+
     // It's possible that we could restart a host update due to an error while a callback is still pending on a stale
     // update.  In this case, we just cancel all of the work that's been done on the stale update (it's probably already
     // moot anyway.
@@ -851,6 +1032,7 @@ register_instance_completion(DNSServiceRef sdref, DNSServiceFlags flags, DNSServ
         }
 
         if (error_code == kDNSServiceErr_ServiceNotRunning || error_code == kDNSServiceErr_DefunctConnection) {
+            shared_connection_lost();
             service_disconnected(host);
         }
     }
@@ -877,14 +1059,19 @@ static bool
 register_instance(adv_instance_t *instance)
 {
     int err;
-    DNSServiceRef sdref;
-
-    INFO("DNSServiceRegister(" PRI_S_SRP ", " PRI_S_SRP ", " PRI_S_SRP ", %d)",
-         instance->instance_name, instance->service_type, instance->host->registered_name, instance->port);
-    err = DNSServiceRegister(&sdref, kDNSServiceFlagsUnique, advertise_interface,
-                             instance->instance_name, instance->service_type, local_suffix,
-                             instance->host->registered_name, htons(instance->port), instance->txt_length,
-                             instance->txt_data, register_instance_completion, instance);
+    DNSServiceRef sdref = NULL;
+    dnssd_txn_t *connection;
+
+    connection = shared_connection_get(&err);
+    if (connection != NULL) {
+        INFO("DNSServiceRegister(" PRI_S_SRP ", " PRI_S_SRP ", " PRI_S_SRP ", %d)",
+             instance->instance_name, instance->service_type, instance->host->registered_name, instance->port);
+        sdref = connection->sdref;
+        err = DNSServiceRegister(&sdref, kDNSServiceFlagsUnique | kDNSServiceFlagsShareConnection,
+                                 advertise_interface, instance->instance_name, instance->service_type, local_suffix,
+                                 instance->host->registered_name, htons(instance->port), instance->txt_length,
+                                 instance->txt_data, register_instance_completion, instance);
+    }
     // This would happen if we pass NULL for regtype, which we don't, or if we run out of memory, or if
     // the server isn't running; in the second two cases, we can always try again later.
     if (err != kDNSServiceErr_NoError) {
@@ -895,6 +1082,7 @@ register_instance(adv_instance_t *instance)
             {
                 INFO("DNSServiceRegister failed: " PUB_S_SRP ,
                      err == kDNSServiceErr_ServiceNotRunning ? "not running" : "defunct");
+                shared_connection_lost();
                 service_disconnected(instance->host);
             } else {
                 INFO("DNSServiceRegister failed: %d", err);
@@ -903,12 +1091,13 @@ register_instance(adv_instance_t *instance)
         }
         return false;
     }
-    instance->txn = ioloop_dnssd_txn_add(sdref, instance, instance_txn_finalize_callback);
+    instance->txn = ioloop_dnssd_txn_add_subordinate(sdref, instance, instance_txn_finalize_callback, connection);
     if (instance->txn == NULL) {
         ERROR("register_instance: no memory.");
         DNSServiceRefDeallocate(sdref);
         return false;
     }
+    advertise_started(&instance->advertise_pending);
     if (instance->update != NULL) {
         instance->update->num_instances_started++;
     }
@@ -1127,28 +1316,26 @@ static void
 register_host_completion(DNSServiceRef sdref, DNSRecordRef rref,
                          DNSServiceFlags flags, DNSServiceErrorType error_code, void *context)
 {
-    dnssd_txn_t *txn = context;
-    adv_update_t *update = ioloop_dnssd_txn_get_aux_pointer(txn);
-    adv_host_t *host = ioloop_dnssd_txn_get_context(txn);
+    adv_host_t *host = context;
+    adv_update_t *update = host->rref_update;
     (void)sdref;
     (void)rref;
-    (void)error_code;
     (void)flags;
 
+    advertise_done(&host->advertise_pending, error_code != kDNSServiceErr_NoError);
+    if (error_code == kDNSServiceErr_ServiceNotRunning || error_code == kDNSServiceErr_DefunctConnection) {
+        shared_connection_lost();
+    }
+
     // It's possible that we could restart a host update due to an error while a callback is still pending on a stale
     // update.  In this case, we just cancel all of the work that's been done on the stale update (it's probably already
     // moot anyway.
-    if (update != NULL && (host == NULL || host->updates != update)) {
+    if (update != NULL && host->updates != update) {
         INFO("register_host_completion: registration for host completed with invalid state.");
         update_finalize(update);
         return;
     }
 
-    if (host == NULL) {
-        ERROR("register_host_completion called on null host.");
-        return;
-    }
-
     if (error_code == kDNSServiceErr_NoError) {
         // If we get here while a hostname update is pending, it means that the conflict was resolved when
         // we re-registered the host as a side effect of the update, so we no longer need to update the
@@ -1397,15 +1584,14 @@ start_host_update(adv_host_t *host)
     // DNSServiceRegisterRecord, because it assumes that you'd only ever want to update it with a record
     // of the same type.   We can't use that, so we just remove the record (if it exists) and then add
     // the intended record.
-    if (remove_preexisting && host->txn != NULL) {
-        ioloop_dnssd_txn_release(host->txn);
-        host->txn = NULL;
+    // If the connection the record was registered on has died since, the record is already gone.
+    if (host->txn != NULL && (remove_preexisting || host->txn != shared_connection)) {
+        host_record_remove(host);
     }
 
-    // If we don't think we have a connection, make one.
+    // If we don't think we have a connection, use the shared one, making it if need be.
     if (host->txn == NULL) {
-        DNSServiceRef sdref;
-        err = DNSServiceCreateConnection(&sdref);
+        dnssd_txn_t *connection = shared_connection_get(&err);
         // In principle the only way this can fail is if the daemon isn't running.
         if (err != kDNSServiceErr_NoError) {
             // If this is a "no memory" error, that actually means that we've run out of file descriptors.
@@ -1429,17 +1615,8 @@ start_host_update(adv_host_t *host)
             }
             return;
         }
-        INFO("Adding transaction %p", sdref);
-        host->txn = ioloop_dnssd_txn_add(sdref, host, host_txn_finalize_callback);
-        if (host->txn == NULL) {
-            ERROR("start_host_update: no memory for host transaction");
-            if (update->client != NULL) {
-                update_failed(update, dns_rcode_servfail, true);
-            } else {
-                wait_retry(host);
-            }
-            return;
-        }
+        host->txn = connection;
+        ioloop_dnssd_txn_retain(host->txn);
     }
 
     if (add_rdata != NULL) {
@@ -1448,15 +1625,19 @@ start_host_update(adv_host_t *host)
              kDNSServiceFlagsUnique | kDNSServiceFlagsNoAutoRename,
              advertise_interface, host ? host->registered_name : 0,
              add_rrtype, dns_qclass_in, add_rdlen, add_rdata, 3600,
-             register_host_completion, host ? host->txn : 0);
-        ioloop_dnssd_txn_set_aux_pointer(host->txn, update);
+             register_host_completion, host);
+        host->rref_update = update;
         err = DNSServiceRegisterRecord(host->txn->sdref, &host->rref,
                                        kDNSServiceFlagsUnique | kDNSServiceFlagsNoAutoRename,
                                        advertise_interface, host->registered_name,
                                        add_rrtype, dns_qclass_in, add_rdlen, add_rdata, 3600,
-                                       register_host_completion, host->txn);
+                                       register_host_completion, host);
         if (err != kDNSServiceErr_NoError) {
             ERROR("start_host_update: DNSServiceRegisterRecord failed on host: %d", err);
+            host->rref_update = NULL;
+            if (err == kDNSServiceErr_DefunctConnection || err == kDNSServiceErr_ServiceNotRunning) {
+                shared_connection_lost();
+            }
             if (update->client != NULL) {
                 update_failed(update, dns_rcode_servfail, true);
                 return;
@@ -1464,6 +1645,8 @@ start_host_update(adv_host_t *host)
                 service_disconnected(host);
                 return;
             }
+        } else {
+            advertise_started(&host->advertise_pending);
         }
     }
     // If we didn't have to do an add, start the service updates immediately.
@@ -1639,28 +1822,23 @@ prepare_update(adv_host_t *host)
         adv_instance_t *add_instance = add_instances->vec[i];
 
         if (add_instance != NULL) {
-            for (j = 0; j < host->instances->num; j++) {
+            // See if the instance names match.
+            j = adv_instance_vec_find(host->instances, add_instance->instance_name, add_instance->service_type);
+            if (j >= 0) {
                 adv_instance_t *host_instance = host->instances->vec[j];
 
-                // See if the instance names match.
-                if (host_instance != NULL &&
-                    !strcmp(add_instance->instance_name, host_instance->instance_name) &&
-                    !strcmp(add_instance->service_type, host_instance->service_type))
+                // If the rdata is the same, it's not an add or an update.
+                if (add_instance->txt_length == host_instance->txt_length &&
+                    add_instance->port == host_instance->port &&
+                    (add_instance->txt_length == 0 ||
+                     !memcmp(add_instance->txt_data, host_instance->txt_data, add_instance->txt_length)))
                 {
-                    // If the rdata is the same, it's not an add or an update.
-                    if (add_instance->txt_length == host_instance->txt_length &&
-                        add_instance->port == host_instance->port &&
-                        (add_instance->txt_length == 0 ||
-                         !memcmp(add_instance->txt_data, host_instance->txt_data, add_instance->txt_length)))
-                    {
-                        RELEASE_HERE(add_instance, adv_instance_finalize);
-                    } else {
-                        // Implicit RETAIN/RELEASE
-                        update_instances->vec[j] = add_instance;
-                    }
-                    add_instances->vec[i] = NULL;
-                    break;
+                    RELEASE_HERE(add_instance, adv_instance_finalize);
+                } else {
+                    // Implicit RETAIN/RELEASE
+                    update_instances->vec[j] = add_instance;
                 }
+                add_instances->vec[i] = NULL;
             }
         }
     }
@@ -1723,6 +1901,628 @@ fail:
     wait_retry(host);
 }
 
+// A checksum on the key, ignoring up to three bytes at the end, for telling keys apart in the logs.
+static uint32_t
+srp_key_id(const uint8_t *key, int len)
+{
+    uint32_t key_id = 0;
+    int i;
+    for (i = 0; i < len; i += 4) {
+        key_id += ((key[i] << 24) | (key[i + 1] << 16) | (key[i + 2] << 8) | (key[i + 3]));
+    }
+    return key_id;
+}
+
+// The registration database.  Every update we accept is appended to lease_db_path as a snapshot of the host it
+// leaves behind, and every host we drop is appended as a removal, so that after a restart we can put the hosts whose
+// leases are still running back on the air without waiting for each SRP client to re-register.
+//
+// The file starts with SRP_DB_MAGIC and SRP_DB_VERSION, each a 32-bit integer, followed by records:
+//
+//     length (u32)   type (u8)   body (length - 1 bytes)   checksum (u32, FNV-1a over type and body)
+//
+// All integers are in network byte order.  A host record's body is the host name, the KEY rdata, the host and key
+// lease intervals, the lease expiry in wall clock seconds, the addresses (type and data each) and the service
+// instances (name, type, port and TXT data each); names and data are preceded by a u16 length, lists by a u16 count.
+// A removal's body is just the host name.  The last record for a name wins.  Each record goes out in a single
+// write(), so a crash leaves at most one torn record at the end of the file, which the checksum catches.
+//
+// At startup the whole file is read in, the hosts whose leases haven't run out are put on the host list without
+// being advertised, and the file is rewritten (compacted) to hold just them.  The hosts are then re-advertised a
+// batch at a time, so that a proxy with thousands of hosts doesn't hand them all to mDNSResponder at once; an update
+// for a host that is still waiting its turn puts it back on the air before the update is applied.  While running,
+// the file is compacted again whenever it has grown to twice its size at the last compaction.
+#define SRP_DB_MAGIC                0x53525044  // 'SRPD'
+#define SRP_DB_VERSION              1
+#define SRP_DB_HOST                 1
+#define SRP_DB_REMOVE               2
+#define SRP_DB_HEADER_SIZE          8
+#define SRP_DB_FRAME_SIZE           9           // Length, type and checksum
+#define SRP_DB_MIN_COMPACT          65536       // Don't bother compacting a file smaller than this
+#define SRP_RESTORE_BATCH           16          // Hosts re-advertised per batch after a restart
+#define SRP_RESTORE_MAX_OUTSTANDING 64          // Hold the next batch while this many registrations are unanswered
+#define SRP_RESTORE_INTERVAL        100         // Milliseconds between batches
+
+#ifndef SRP_LEASE_DB_PATH
+#define SRP_LEASE_DB_PATH "/var/lib/srp-mdns-proxy/leases"
+#endif
+
+static const char *lease_db_path = SRP_LEASE_DB_PATH;
+static int lease_db_fd = -1;
+static size_t lease_db_size;        // Current size of the file
+static size_t lease_db_compacted;   // Size of the file when it was last compacted
+static wakeup_t *restore_wakeup;
+
+static uint32_t
+srp_db_checksum(const uint8_t *data, size_t len)
+{
+    uint32_t hash = 2166136261U;
+    size_t i;
+    for (i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+static void
+srp_db_blob_to_wire(dns_towire_state_t *towire, const void *data, size_t len)
+{
+    dns_u16_to_wire(towire, (uint16_t)len);
+    if (len > 0) {
+        dns_rdata_raw_data_to_wire(towire, data, len);
+    }
+}
+
+static bool
+srp_db_blob_parse(const uint8_t *buf, unsigned len, unsigned *offp, const uint8_t **ret, uint16_t *ret_len)
+{
+    if (!dns_u16_parse(buf, len, offp, ret_len) || *offp + *ret_len > len) {
+        return false;
+    }
+    *ret = buf + *offp;
+    *offp += *ret_len;
+    return true;
+}
+
+static char *
+srp_db_strdup(const uint8_t *data, uint16_t len)
+{
+    char *ret = malloc(len + 1);
+    if (ret != NULL) {
+        memcpy(ret, data, len);
+        ret[len] = 0;
+    }
+    return ret;
+}
+
+// Starts a record in buf, which has room for size bytes; the body goes at towire->p.
+static void
+srp_db_record_begin(dns_towire_state_t *towire, uint8_t *buf, size_t size, uint8_t type)
+{
+    memset(towire, 0, sizeof *towire);
+    towire->p = buf;
+    towire->lim = buf + size;
+    dns_u32_to_wire(towire, 0); // Length, filled in by srp_db_record_end
+    dns_u8_to_wire(towire, type);
+}
+
+// Finishes the record begun in buf, returning its length, or zero if it didn't fit.
+static size_t
+srp_db_record_end(dns_towire_state_t *towire, uint8_t *buf)
+{
+    const size_t len = towire->p - buf - 4;
+    uint32_t checksum;
+
+    if (towire->error) {
+        return 0;
+    }
+    checksum = srp_db_checksum(&buf[4], len);
+    buf[0] = (uint8_t)(len >> 24);
+    buf[1] = (uint8_t)(len >> 16);
+    buf[2] = (uint8_t)(len >> 8);
+    buf[3] = (uint8_t)len;
+    dns_u32_to_wire(towire, checksum);
+    return towire->error ? 0 : (size_t)(towire->p - buf);
+}
+
+// Returns the host's record in a newly allocated buffer, or NULL if we're out of memory.
+static uint8_t *
+srp_db_host_record(adv_host_t *host, size_t *ret_len)
+{
+    dns_towire_state_t towire;
+    const int64_t remaining = host->lease_expiry - ioloop_timenow();
+    const size_t name_len = strlen(host->name);
+    size_t size = SRP_DB_FRAME_SIZE + 2 + name_len + 2 + host->key_rdlen + 12 + 2 + 2 + 1; // +1 for towire's slack
+    uint16_t num_addresses = 0, num_instances = 0;
+    uint8_t *buf;
+    int i;
+
+    for (i = 0; i < host->num_addresses; i++) {
+        if (host->addresses[i] != NULL) {
+            size += 4 + host->addresses[i]->rdlen;
+            num_addresses++;
+        }
+    }
+    for (i = 0; i < host->instances->num; i++) {
+        adv_instance_t *instance = host->instances->vec[i];
+        if (instance != NULL) {
+            size += 8 + strlen(instance->instance_name) + strlen(instance->service_type) + instance->txt_length;
+            num_instances++;
+        }
+    }
+    buf = malloc(size);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    srp_db_record_begin(&towire, buf, size, SRP_DB_HOST);
+    srp_db_blob_to_wire(&towire, host->name, name_len);
+    srp_db_blob_to_wire(&towire, host->key_rdata, host->key_rdlen);
+    dns_u32_to_wire(&towire, host->lease_interval);
+    dns_u32_to_wire(&towire, host->key_lease);
+    dns_u32_to_wire(&towire, (uint32_t)(time(NULL) + (remaining > 0 ? remaining / IOLOOP_SECOND : 0)));
+    dns_u16_to_wire(&towire, num_addresses);
+    for (i = 0; i < host->num_addresses; i++) {
+        adv_address_t *address = host->addresses[i];
+        if (address != NULL) {
+            dns_u16_to_wire(&towire, address->rrtype);
+            srp_db_blob_to_wire(&towire, address->rdata, address->rdlen);
+        }
+    }
+    dns_u16_to_wire(&towire, num_instances);
+    for (i = 0; i < host->instances->num; i++) {
+        adv_instance_t *instance = host->instances->vec[i];
+        if (instance != NULL) {
+            srp_db_blob_to_wire(&towire, instance->instance_name, strlen(instance->instance_name));
+            srp_db_blob_to_wire(&towire, instance->service_type, strlen(instance->service_type));
+            dns_u16_to_wire(&towire, (uint16_t)instance->port);
+            srp_db_blob_to_wire(&towire, instance->txt_data, instance->txt_length);
+        }
+    }
+    *ret_len = srp_db_record_end(&towire, buf);
+    if (*ret_len == 0) {
+        ERROR("srp_db_host_record: record for " PRI_S_SRP " doesn't fit in %zu bytes", host->name, size);
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+static bool
+srp_db_write(int fd, const uint8_t *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t ret = write(fd, buf, len);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buf += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+// Rewrites the database to hold just the hosts we have now.  The new file is written alongside the old one and
+// renamed over it, so that a crash part of the way through leaves the old one in place.
+static void
+srp_db_compact(void)
+{
+    static const uint8_t header[SRP_DB_HEADER_SIZE] = {
+        SRP_DB_MAGIC >> 24, (SRP_DB_MAGIC >> 16) & 0xff, (SRP_DB_MAGIC >> 8) & 0xff, SRP_DB_MAGIC & 0xff,
+        0, 0, 0, SRP_DB_VERSION
+    };
+    char temp_path[PATH_MAX];
+    size_t size = SRP_DB_HEADER_SIZE;
+    int num_hosts = 0;
+    adv_host_t *host;
+    int fd;
+
+    if (lease_db_path == NULL) {
+        return;
+    }
+    snprintf(temp_path, sizeof temp_path, "%s.new", lease_db_path);
+    fd = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        ERROR("srp_db_compact: can't create " PRI_S_SRP ": " PUB_S_SRP, temp_path, strerror(errno));
+        return;
+    }
+    if (!srp_db_write(fd, header, sizeof header)) {
+        goto fail;
+    }
+    for (host = hosts; host != NULL; host = host->next) {
+        size_t len;
+        uint8_t *record = srp_db_host_record(host, &len);
+        if (record == NULL) {
+            goto fail;
+        }
+        if (!srp_db_write(fd, record, len)) {
+            free(record);
+            goto fail;
+        }
+        free(record);
+        size += len;
+        num_hosts++;
+    }
+    if (fsync(fd) < 0 || rename(temp_path, lease_db_path) < 0) {
+        goto fail;
+    }
+    close(fd);
+
+    // Appends go to the new file from now on.
+    if (lease_db_fd >= 0) {
+        close(lease_db_fd);
+    }
+    lease_db_fd = open(lease_db_path, O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (lease_db_fd < 0) {
+        ERROR("srp_db_compact: can't reopen " PRI_S_SRP ": " PUB_S_SRP, lease_db_path, strerror(errno));
+    }
+    lease_db_size = lease_db_compacted = size;
+    INFO("srp_db_compact: wrote %d hosts in %zu bytes", num_hosts, size);
+    return;
+
+fail:
+    ERROR("srp_db_compact: can't write " PRI_S_SRP ": " PUB_S_SRP, temp_path, strerror(errno));
+    close(fd);
+    unlink(temp_path);
+}
+
+static void
+srp_db_append(const uint8_t *record, size_t len)
+{
+    if (lease_db_fd < 0) {
+        return;
+    }
+    if (!srp_db_write(lease_db_fd, record, len)) {
+        ERROR("srp_db_append: can't write " PRI_S_SRP ": " PUB_S_SRP, lease_db_path, strerror(errno));
+        return;
+    }
+    lease_db_size += len;
+    if (lease_db_size >= SRP_DB_MIN_COMPACT && lease_db_size >= lease_db_compacted * 2) {
+        srp_db_compact();
+    }
+}
+
+// Called when an update from a client has been applied to the host.
+static void
+srp_db_save_host(adv_host_t *host)
+{
+    size_t len;
+    uint8_t *record;
+
+    if (lease_db_fd < 0) {
+        return;
+    }
+    record = srp_db_host_record(host, &len);
+    if (record != NULL) {
+        srp_db_append(record, len);
+        free(record);
+    }
+}
+
+// Called when the host goes away, for whatever reason.
+static void
+srp_db_forget_host(adv_host_t *host)
+{
+    uint8_t buf[SRP_DB_FRAME_SIZE + 2 + DNS_MAX_NAME_SIZE_ESCAPED + 1];
+    dns_towire_state_t towire;
+    size_t len;
+
+    if (lease_db_fd < 0) {
+        return;
+    }
+    srp_db_record_begin(&towire, buf, sizeof buf, SRP_DB_REMOVE);
+    srp_db_blob_to_wire(&towire, host->name, strlen(host->name));
+    len = srp_db_record_end(&towire, buf);
+    if (len != 0) {
+        srp_db_append(buf, len);
+    }
+}
+
+static adv_host_t *
+srp_db_find_host(const uint8_t *name, uint16_t name_len, adv_host_t ***p_ret)
+{
+    adv_host_t **p_hosts, *host;
+
+    for (p_hosts = &hosts; (host = *p_hosts) != NULL; p_hosts = &host->next) {
+        if (strlen(host->name) == name_len && !memcmp(host->name, name, name_len)) {
+            break;
+        }
+    }
+    *p_ret = p_hosts;
+    return host;
+}
+
+// Builds a host from a host record, without advertising it.  Returns false if the record doesn't make sense.
+static bool
+srp_db_load_host(const uint8_t *body, unsigned len, time_t now)
+{
+    const uint8_t *name, *key, *data, *instance_name, *service_type;
+    uint16_t name_len, key_len, data_len, instance_name_len, service_type_len, rrtype, port, count;
+    uint32_t lease_interval, key_lease, expiry;
+    adv_host_t *host, **p_hosts;
+    unsigned off = 0;
+    int i;
+
+    if (!srp_db_blob_parse(body, len, &off, &name, &name_len) || name_len == 0 ||
+        !srp_db_blob_parse(body, len, &off, &key, &key_len) || key_len < 4 ||
+        !dns_u32_parse(body, len, &off, &lease_interval) ||
+        !dns_u32_parse(body, len, &off, &key_lease) ||
+        !dns_u32_parse(body, len, &off, &expiry))
+    {
+        return false;
+    }
+
+    // A later record for the same host replaces an earlier one.
+    host = srp_db_find_host(name, name_len, &p_hosts);
+    if (host != NULL) {
+        *p_hosts = host->next;
+        host_finalize(host);
+    }
+    if ((time_t)expiry <= now) {
+        return true;
+    }
+
+    host = calloc(1, sizeof *host);
+    if (host == NULL) {
+        goto nomem;
+    }
+    host->instances = adv_instance_vec_create(0);
+    host->retry_wakeup = ioloop_wakeup_create();
+    host->lease_wakeup = ioloop_wakeup_create();
+    host->name = srp_db_strdup(name, name_len);
+    host->key_rdata = malloc(key_len);
+    if (host->instances == NULL || host->retry_wakeup == NULL || host->lease_wakeup == NULL || host->name == NULL ||
+        host->key_rdata == NULL)
+    {
+        goto nomem;
+    }
+    host->registered_name = host->name;
+    host->key_rdlen = key_len;
+    memcpy(host->key_rdata, key, key_len);
+    host->key.type = dns_rrtype_key;
+    host->key.qclass = dns_qclass_in;
+    memcpy(&host->key.data.key.flags, &host->key_rdata[0], 2); // Stored as the update left it; see srp_update_start
+    host->key.data.key.protocol = host->key_rdata[2];
+    host->key.data.key.algorithm = host->key_rdata[3];
+    host->key.data.key.len = key_len - 4;
+    host->key.data.key.key = &host->key_rdata[4];
+    host->key_id = srp_key_id(host->key.data.key.key, host->key.data.key.len);
+    host->lease_interval = lease_interval;
+    host->key_lease = key_lease;
+    host->lease_expiry = ioloop_timenow() + (int64_t)(expiry - now) * IOLOOP_SECOND;
+    host->restore_pending = true;
+
+    if (!dns_u16_parse(body, len, &off, &count)) {
+        goto bad;
+    }
+    if (count > 0) {
+        host->addresses = calloc(count, sizeof *host->addresses);
+        if (host->addresses == NULL) {
+            goto nomem;
+        }
+    }
+    for (i = 0; i < count; i++) {
+        adv_address_t *address;
+        if (!dns_u16_parse(body, len, &off, &rrtype) || !srp_db_blob_parse(body, len, &off, &data, &data_len) ||
+            !((rrtype == dns_rrtype_a && data_len == 4) || (rrtype == dns_rrtype_aaaa && data_len == 16)))
+        {
+            goto bad;
+        }
+        address = calloc(1, sizeof *address);
+        if (address == NULL) {
+            goto nomem;
+        }
+        address->host = host;
+        address->rrtype = rrtype;
+        address->rdlen = data_len;
+        memcpy(address->rdata, data, data_len);
+        RETAIN_HERE(address);
+        host->addresses[host->num_addresses++] = address;
+    }
+
+    if (!dns_u16_parse(body, len, &off, &count)) {
+        goto bad;
+    }
+    RELEASE_HERE(host->instances, adv_instance_vec_finalize);
+    host->instances = adv_instance_vec_create(count);
+    if (host->instances == NULL) {
+        goto nomem;
+    }
+    for (i = 0; i < count; i++) {
+        adv_instance_t *instance;
+        if (!srp_db_blob_parse(body, len, &off, &instance_name, &instance_name_len) ||
+            !srp_db_blob_parse(body, len, &off, &service_type, &service_type_len) ||
+            !dns_u16_parse(body, len, &off, &port) || !srp_db_blob_parse(body, len, &off, &data, &data_len))
+        {
+            goto bad;
+        }
+        instance = calloc(1, sizeof *instance);
+        if (instance == NULL) {
+            goto nomem;
+        }
+        RETAIN_HERE(instance);
+        host->instances->vec[host->instances->num++] = instance;
+        instance->host = host;
+        instance->port = port;
+        instance->instance_name = srp_db_strdup(instance_name, instance_name_len);
+        instance->service_type = srp_db_strdup(service_type, service_type_len);
+        if (data_len > 0) {
+            instance->txt_data = malloc(data_len);
+            if (instance->txt_data != NULL) {
+                memcpy(instance->txt_data, data, data_len);
+                instance->txt_length = data_len;
+            }
+        }
+        if (instance->instance_name == NULL || instance->service_type == NULL ||
+            (data_len > 0 && instance->txt_data == NULL))
+        {
+            goto nomem;
+        }
+    }
+    if (off != len) {
+        goto bad;
+    }
+
+    *p_hosts = host;
+    return true;
+
+nomem:
+    ERROR("srp_db_load_host: no memory for host " PRI_S_SRP, host != NULL && host->name != NULL ? host->name : "");
+    if (host != NULL) {
+        host_finalize(host);
+    }
+    return true;
+bad:
+    host_finalize(host);
+    return false;
+}
+
+// Puts a host loaded from the database back on the air, as it was before we restarted.
+static void
+srp_restore_host(adv_host_t *host)
+{
+    host->restore_pending = false;
+    INFO("srp_restore_host: re-advertising " PRI_S_SRP " with %d addresses and %d instances, lease %" PRId64 " ms",
+         host->name, host->num_addresses, host->instances->num, host->lease_expiry - ioloop_timenow());
+    update_from_host(host);
+}
+
+static void
+srp_restore_callback(void *context)
+{
+    adv_host_t *host, *next;
+    int restored = 0;
+
+    (void)context;
+
+    for (host = hosts; host != NULL; host = next) {
+        next = host->next;
+        if (!host->restore_pending) {
+            continue;
+        }
+        if (restored == SRP_RESTORE_BATCH || advertise_outstanding >= SRP_RESTORE_MAX_OUTSTANDING) {
+            ioloop_add_wake_event(restore_wakeup, NULL, srp_restore_callback, NULL, SRP_RESTORE_INTERVAL);
+            return;
+        }
+        srp_restore_host(host);
+        restored++;
+    }
+    INFO("srp_restore_callback: all stored hosts have been re-advertised.");
+}
+
+// Checks the framing of the record at *offp, leaving *offp at the start of its type and *ret_len set to the length
+// of its type and body.
+static bool
+srp_db_record_parse(const uint8_t *buf, unsigned len, unsigned *offp, uint32_t *ret_len)
+{
+    unsigned checksum_off;
+    uint32_t checksum;
+
+    if (!dns_u32_parse(buf, len, offp, ret_len) || *ret_len == 0 || *ret_len > len - *offp) {
+        return false;
+    }
+    checksum_off = *offp + *ret_len;
+    return dns_u32_parse(buf, len, &checksum_off, &checksum) && checksum == srp_db_checksum(&buf[*offp], *ret_len);
+}
+
+// Reads in the database, if there is one, and starts re-advertising the hosts in it.
+static void
+srp_db_load(void)
+{
+    uint8_t *buf = NULL;
+    struct stat st;
+    unsigned off, num_records = 0;
+    uint32_t magic, version, len;
+    time_t now = time(NULL);
+    int fd, num_hosts = 0;
+    adv_host_t *host;
+
+    if (lease_db_path == NULL) {
+        return;
+    }
+    fd = open(lease_db_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            ERROR("srp_db_load: can't open " PRI_S_SRP ": " PUB_S_SRP, lease_db_path, strerror(errno));
+        }
+        goto out;
+    }
+    if (fstat(fd, &st) < 0 || (uint64_t)st.st_size > UINT32_MAX || (buf = malloc(st.st_size + 1)) == NULL) {
+        ERROR("srp_db_load: can't read " PRI_S_SRP, lease_db_path);
+        close(fd);
+        goto out;
+    }
+    for (off = 0; off < (unsigned)st.st_size; ) {
+        ssize_t ret = read(fd, buf + off, st.st_size - off);
+        if (ret <= 0) {
+            break;
+        }
+        off += ret;
+    }
+    close(fd);
+
+    len = off;
+    off = 0;
+    if (!dns_u32_parse(buf, len, &off, &magic) || !dns_u32_parse(buf, len, &off, &version) ||
+        magic != SRP_DB_MAGIC || version != SRP_DB_VERSION)
+    {
+        ERROR("srp_db_load: " PRI_S_SRP " isn't a version %d lease database; starting afresh.",
+              lease_db_path, SRP_DB_VERSION);
+        goto out;
+    }
+    while (off < len) {
+        uint32_t record_len;
+        const unsigned start = off;
+        if (!srp_db_record_parse(buf, len, &off, &record_len)) {
+            ERROR("srp_db_load: discarding %u bytes of damaged or incomplete records at offset %u", len - start, start);
+            break;
+        }
+        if (buf[off] == SRP_DB_HOST) {
+            if (!srp_db_load_host(&buf[off + 1], record_len - 1, now)) {
+                ERROR("srp_db_load: skipping malformed host record at offset %u", start);
+            }
+        } else if (buf[off] == SRP_DB_REMOVE) {
+            const uint8_t *name;
+            uint16_t name_len;
+            unsigned name_off = 0;
+            adv_host_t **p_hosts;
+            if (srp_db_blob_parse(&buf[off + 1], record_len - 1, &name_off, &name, &name_len) &&
+                (host = srp_db_find_host(name, name_len, &p_hosts)) != NULL)
+            {
+                *p_hosts = host->next;
+                host_finalize(host);
+            }
+        }
+        off += record_len + 4;
+        num_records++;
+    }
+    for (host = hosts; host != NULL; host = host->next) {
+        num_hosts++;
+    }
+    INFO("srp_db_load: %u records in " PRI_S_SRP " left %d hosts with unexpired leases", num_records,
+         lease_db_path, num_hosts);
+
+out:
+    free(buf);
+    // Start the new file with just the hosts we've kept, which also gets it open for appending.
+    srp_db_compact();
+    if (hosts != NULL) {
+        restore_wakeup = ioloop_wakeup_create();
+        if (restore_wakeup == NULL) {
+            ERROR("srp_db_load: no memory for restore wakeup");
+            for (host = hosts; host != NULL; host = host->next) {
+                srp_restore_host(host);
+            }
+        } else {
+            srp_restore_callback(NULL);
+        }
+    }
+}
+
 typedef enum { missed, match, conflict } instance_outcome_t;
 static instance_outcome_t
 compare_instance(adv_instance_t *instance,
@@ -1762,11 +2562,7 @@ srp_update_start(comm_t *connection, dns_message_t *parsed_message, message_t *r
     const char *updatestr = lease_time == 0 ? "remove" : "update";
     dns_name_print(new_host->name, new_host_name, sizeof new_host_name);
 
-    // Compute a checksum on the key, ignoring up to three bytes at the end.
-    for (i = 0; i < new_host->key->data.key.len; i += 4) {
-        key_id += ((new_host->key->data.key.key[i] << 24) | (new_host->key->data.key.key[i + 1] << 16) |
-                   (new_host->key->data.key.key[i + 2] << 8) | (new_host->key->data.key.key[i + 3]));
-    }
+    key_id = srp_key_id(new_host->key->data.key.key, new_host->key->data.key.len);
 
     // Log the update info.
     INFO("srp_update_start: host update for " PRI_S_SRP ", key id %" PRIx32, new_host_name, key_id);
@@ -1802,12 +2598,11 @@ srp_update_start(comm_t *connection, dns_message_t *parsed_message, message_t *r
             extract_instance_name(instance_name, sizeof instance_name, service_type, sizeof service_type, new_instance);
 
             // First check for a match or conflict in the host itself.
-            for (i = 0; i < host->instances->num; i++) {
+            i = adv_instance_vec_find(host->instances, instance_name, service_type);
+            if (i >= 0) {
                 outcome = compare_instance(host->instances->vec[i], new_host, host,
                                            instance_name, service_type);
-                if (outcome != missed) {
-                    goto found_something;
-                }
+                goto found_something;
             }
             // Then look for the same thing in any subsequent updates that have been baked.
             for (update = host->updates; update; update = update->next) {
@@ -2018,6 +2813,12 @@ found_something:
     }
     *p_client_update = client_update;
 
+    // A host we reloaded at startup but haven't re-advertised yet has to be put back as it was before this update
+    // can be worked out against it.
+    if (host->restore_pending) {
+        srp_restore_host(host);
+    }
+
     // If we aren't already applying an update to this host, apply this update now.
     if (host->updates == NULL) {
         INFO("srp_update_start: No ongoing host update: preparing this update to be applied.");
@@ -2318,6 +3119,7 @@ srp_mdns_flush(void)
         host_finalize(host);
     }
     hosts = NULL;
+    srp_db_compact();
 }
 
 static bool
@@ -2411,7 +3213,8 @@ adv_xpc_message(xpc_connection_t connection, xpc_object_t request)
 static void
 usage(void)
 {
-    ERROR("srp-mdns-proxy [--max-lease-time <seconds>] [--min-lease-time <seconds>] [--log-stderr]");
+    ERROR("srp-mdns-proxy [--max-lease-time <seconds>] [--min-lease-time <seconds>] [--lease-db <path>] "
+          "[--no-lease-db] [--log-stderr]");
     exit(1);
 }
 
@@ -2441,6 +3244,14 @@ main(int argc, char **argv)
                 usage();
             }
             i++;
+        } else if (!strcmp(argv[i], "--lease-db")) {
+            if (i + 1 == argc) {
+                usage();
+            }
+            lease_db_path = argv[i + 1];
+            i++;
+        } else if (!strcmp(argv[i], "--no-lease-db")) {
+            lease_db_path = NULL;
         } else if (!strcmp(argv[i], "--log-stderr")) {
             log_stderr = true;
         } else {
@@ -2518,6 +3329,9 @@ main(int argc, char **argv)
         }
     }
 
+    // Put back the hosts we were advertising before we restarted.
+    srp_db_load();
+
     do {
         int something = 0;
         ioloop();
@@ -37,6 +37,7 @@ struct adv_instance {
     int port;                      // Port on which service can be found.
     char *NULLABLE txt_data;       // Contents of txt record
     uint16_t txt_length;           // length of txt record contents
+    bool advertise_pending;        // True until mDNSResponder has answered the registration.
 };
 
 // An address registration
@@ -53,7 +54,7 @@ struct adv_host {
     int ref_count;
     wakeup_t *NONNULL retry_wakeup;        // Wakeup for retry when we run into a temporary failure
     wakeup_t *NONNULL lease_wakeup;        // Wakeup at least expiry time
-    dnssd_txn_t *NULLABLE txn;             // dnssd transaction for host RR
+    dnssd_txn_t *NULLABLE txn;             // Shared mDNSResponder connection on which rref is registered
     adv_host_t *NULLABLE next;             // Hosts are maintained in a linked list.
     adv_update_t *NULLABLE updates;        // Updates to this host, if any
     client_update_t *NULLABLE clients;     // Updates that clients have sent for which replies have not yet been sent.
@@ -64,6 +65,8 @@ struct adv_host {
     adv_address_t *NULLABLE *NULLABLE addresses; // One or more addresses
     adv_instance_vec_t *NONNULL instances; // Zero or more service instances.
     DNSRecordRef NULLABLE rref;            // Record reference for key or address.
+    adv_update_t *NULLABLE rref_update;    // Update waiting on the registration of rref, if any.
+    bool advertise_pending;                // True until mDNSResponder has answered the rref registration.
     dns_rr_t key;                          // The key data represented as an RR; key->name is NULL.
     uint32_t key_id;                       // A possibly-unique id that is computed across the key for brevity in
                                            // debugging
@@ -75,6 +78,7 @@ struct adv_host {
     uint32_t key_lease;                    // Interval for key lease
     int64_t lease_expiry;                  // Time when lease expires, relative to ioloop_timenow().
     bool have_registration;                // True if we've registered a key or address record for the host.
+    bool restore_pending;                  // Loaded from the lease database, but not yet re-advertised.
 
     // True if we have a pending late conflict resolution. If we get a conflict after the update for the
     // host registration has expired, and there happens to be another update in progress, then we want
@@ -130,10 +134,14 @@ struct adv_update {
     bool registering_key;
 };
 
+// Instance vectors are not modified once they have been attached to a host or shared with another update, so that
+// copying one is just a matter of taking another reference.
 struct adv_instance_vec {
     int ref_count;
     int num;
     adv_instance_t * NULLABLE *NONNULL vec;
+    int *NULLABLE index;    // Open-addressed table of positions in vec, hashed by name; built on first lookup.
+    int index_size;         // Number of slots in index, a power of two, or zero if it hasn't been built.
 };
 
 struct adv_host_vec {
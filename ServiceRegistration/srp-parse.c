@@ -40,6 +40,35 @@
 
 static dns_name_t *service_update_zone; // The zone to update when we receive an update for default.service.arpa.
 
+#define SRP_VERIFY_STATS_INTERVAL (10 * IOLOOP_MINUTE) // How often to log the signature verification rate.
+
+// Logs how many signatures have been verified and how well the key cache is doing, now and then.
+static void
+srp_verify_stats_note(void)
+{
+    static int64_t last_logged;
+    static uint64_t last_verifies;
+    int64_t now = ioloop_timenow();
+    srp_verify_stats_t stats;
+    uint64_t lookups;
+
+    if (last_logged == 0) {
+        last_logged = now;
+        return;
+    }
+    if (now - last_logged < SRP_VERIFY_STATS_INTERVAL) {
+        return;
+    }
+    srp_verify_stats_get(&stats);
+    lookups = stats.key_cache_hits + stats.key_cache_misses;
+    INFO("srp_verify_stats: %llu verifies in %lld seconds, %llu total, %llu failed; key cache hit rate %llu%%",
+         (unsigned long long)(stats.verifies - last_verifies), (long long)((now - last_logged) / IOLOOP_SECOND),
+         (unsigned long long)stats.verifies, (unsigned long long)stats.failures,
+         (unsigned long long)(lookups == 0 ? 0 : stats.key_cache_hits * 100 / lookups));
+    last_logged = now;
+    last_verifies = stats.verifies;
+}
+
 // Free the data structures into which the SRP update was parsed.   The pointers to the various DNS objects that these
 // structures point to are owned by the parsed DNS message, and so these do not need to be freed here.
 void
@@ -549,9 +578,11 @@ srp_evaluate(comm_t *connection, dns_message_t *message, message_t *raw_message)
     // Now that we have the key, we can validate the signature.   If the signature doesn't validate,
     // there is no need to pass the message on.
     if (!srp_sig0_verify(&raw_message->wire, host_description->key, signature)) {
+        srp_verify_stats_note();
         ERROR("signature is not valid");
         goto badsig;
     }
+    srp_verify_stats_note();
 
     // Now that we have validated the SRP message, go through and fix up all instances of
     // *default.service.arpa to use the replacement zone, if this update is for
@@ -28,9 +28,26 @@ typedef struct srp_key srp_key_t;
 #include <mbedtls/x509.h>
 #include <mbedtls/ssl.h>
 
+#define SRP_TLS_BUFFER_SIZE 16384   // One TLS record's worth of plaintext
+
+typedef struct tls_worker tls_worker_t;
 struct tls_context {
     struct mbedtls_ssl_context context;
     enum { handshake_in_progress, handshake_complete } state;
+
+    // The rest is used only when the connection has been handed off to a TLS worker (see tls-mbedtls.c).
+    tls_context_t *NULLABLE next;   // On the worker's list of connections
+    tls_worker_t *NULLABLE worker;
+    addr_t address;                 // The remote end, for the client session cache
+    int sock;                       // The network socket, which the worker now owns
+    int inner;                      // The worker's end of the socketpair that carries plaintext to and from the ioloop
+    bool client;
+    bool want_write;                // TLS is waiting for the network socket to become writable
+    bool closing;
+    size_t to_ioloop_len, to_ioloop_sent;
+    size_t to_peer_len;
+    uint8_t to_ioloop[SRP_TLS_BUFFER_SIZE]; // Decrypted, waiting to be written to inner
+    uint8_t to_peer[SRP_TLS_BUFFER_SIZE];   // Read from inner, waiting to be encrypted
 };
 #endif // SRP_CRYPTO_MBEDTLS_INTERNAL
 
@@ -40,6 +57,7 @@ bool srp_tls_client_init(void);
 bool srp_tls_server_init(const char *NULLABLE cacert_file,
 			 const char *NULLABLE srvcrt_file, const char *NULLABLE server_key_file);
 bool srp_tls_accept_setup(comm_t *NONNULL comm);
+void srp_tls_set_workers(int num_workers);
 bool srp_tls_listen_callback(comm_t *NONNULL comm);
 bool srp_tls_connect_callback(comm_t *NONNULL comm);
 ssize_t srp_tls_read(comm_t *NONNULL comm, unsigned char *NONNULL buf, size_t max);
@@ -27,6 +27,10 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
 
 #include "srp.h"
 #define SRP_CRYPTO_MBEDTLS_INTERNAL
@@ -34,6 +38,11 @@
 #include "srp-crypto.h"
 #include "ioloop.h"
 #include "srp-tls.h"
+#include <mbedtls/ssl_ticket.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
 
 // Context that is shared amongs all TLS connections, regardless of which server cert/key is in use.
 mbedtls_entropy_context entropy;
@@ -47,6 +56,83 @@ mbedtls_pk_context srvkey;
 mbedtls_ssl_config tls_server_config;
 mbedtls_ssl_config tls_client_config;
 
+// TLS workers.  Handshakes and record encryption are done on a small pool of threads rather than on the ioloop,
+// so that a burst of clients (re)connecting at once doesn't hold up mDNS processing and every other session.  When
+// a TLS connection is set up, its network socket is handed to the worker with the fewest connections, and the comm
+// gets one end of a socketpair in its place.  The worker carries the plaintext DNS stream between the socketpair
+// and the TLS session, so to the ioloop the connection is plain TCP; either side closing its socket closes the
+// other.  The TLS configurations are only read once they've been set up, and the RNG, ticket keys and client
+// session cache, which all the workers share, are each serialized with a mutex.  If no workers can be started (or
+// srp_tls_set_workers(0) has been called), TLS is done on the ioloop through srp_tls_read and srp_tls_write.
+#define SRP_TLS_MAX_WORKERS     16
+#define SRP_TLS_DEFAULT_WORKERS 4       // At most, and no more than there are CPUs
+#define SRP_TLS_TICKET_LIFETIME 86400   // Seconds for which a session ticket can be used to resume a session
+#define SRP_TLS_CLIENT_SESSIONS 16      // Servers whose sessions we remember, to resume them when we reconnect
+
+struct tls_worker {
+    pthread_t thread;
+    pthread_mutex_t mutex;              // Protects pending and num_connections
+    tls_context_t *pending;             // Handed off, but not yet picked up by the worker
+    tls_context_t *connections;         // Only ever touched by the worker
+    int num_connections;
+    int wakeup[2];                      // A pipe we write to when there's something on pending
+};
+
+static tls_worker_t tls_workers[SRP_TLS_MAX_WORKERS];
+static int tls_num_workers = -1;        // Not yet decided
+static int tls_workers_started;
+static pthread_mutex_t tls_rng_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef MBEDTLS_SSL_SESSION_TICKETS
+static mbedtls_ssl_ticket_context tls_ticket_context;
+static pthread_mutex_t tls_ticket_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+typedef struct {
+    addr_t address;
+    mbedtls_ssl_session session;
+    bool valid;
+} tls_client_session_t;
+static tls_client_session_t tls_client_sessions[SRP_TLS_CLIENT_SESSIONS];
+static int tls_client_session_next;     // The one to replace when we need a new one
+static pthread_mutex_t tls_session_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int
+srp_tls_random(void *ctx, unsigned char *buf, size_t len)
+{
+    int status;
+
+    pthread_mutex_lock(&tls_rng_mutex);
+    status = mbedtls_ctr_drbg_random(ctx, buf, len);
+    pthread_mutex_unlock(&tls_rng_mutex);
+    return status;
+}
+
+#ifdef MBEDTLS_SSL_SESSION_TICKETS
+static int
+srp_tls_ticket_write(void *ctx, const mbedtls_ssl_session *session,
+                     unsigned char *start, const unsigned char *end, size_t *tlen, uint32_t *lifetime)
+{
+    int status;
+
+    pthread_mutex_lock(&tls_ticket_mutex);
+    status = mbedtls_ssl_ticket_write(ctx, session, start, end, tlen, lifetime);
+    pthread_mutex_unlock(&tls_ticket_mutex);
+    return status;
+}
+
+static int
+srp_tls_ticket_parse(void *ctx, mbedtls_ssl_session *session, unsigned char *buf, size_t len)
+{
+    int status;
+
+    pthread_mutex_lock(&tls_ticket_mutex);
+    status = mbedtls_ssl_ticket_parse(ctx, session, buf, len);
+    pthread_mutex_unlock(&tls_ticket_mutex);
+    return status;
+}
+#endif // MBEDTLS_SSL_SESSION_TICKETS
+
 bool
 srp_tls_init(void)
 {
@@ -76,7 +162,7 @@ mbedtls_config_init(mbedtls_ssl_config *config, int flags)
         return false;
     }
 
-    mbedtls_ssl_conf_rng(config, mbedtls_ctr_drbg_random, &ctr_drbg);
+    mbedtls_ssl_conf_rng(config, srp_tls_random, &ctr_drbg);
     return true;
 }
 
@@ -137,6 +223,20 @@ srp_tls_server_init(const char *cacert_file, const char *srvcert_file, const cha
         ERROR("Unable to configure own cert: %x", -status);
         return false;
     }
+
+#ifdef MBEDTLS_SSL_SESSION_TICKETS
+    // With a session ticket, a client that reconnects can resume its session without the public key operations of
+    // a full handshake.   If we can't issue tickets, clients just get full handshakes.
+    mbedtls_ssl_ticket_init(&tls_ticket_context);
+    status = mbedtls_ssl_ticket_setup(&tls_ticket_context, srp_tls_random, &ctr_drbg,
+                                      MBEDTLS_CIPHER_AES_256_GCM, SRP_TLS_TICKET_LIFETIME);
+    if (status != 0) {
+        ERROR("Unable to set up TLS session tickets: %x", -status);
+    } else {
+        mbedtls_ssl_conf_session_tickets_cb(&tls_server_config, srp_tls_ticket_write, srp_tls_ticket_parse,
+                                            &tls_ticket_context);
+    }
+#endif
     return true;
 }
 
@@ -144,10 +244,10 @@ static int
 srp_tls_io_send(void *ctx, const unsigned char *buf, size_t len)
 {
     ssize_t ret;
-    comm_t *comm = ctx;
-    ret = write(comm->io.sock, buf, len);
+    int *sock = ctx;
+    ret = send(*sock, buf, len, MSG_NOSIGNAL);
     if (ret < 0) {
-        if (errno == EAGAIN) {
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
             return MBEDTLS_ERR_SSL_WANT_WRITE;
         } else {
             return MBEDTLS_ERR_SSL_INTERNAL_ERROR;
@@ -161,8 +261,8 @@ static int
 srp_tls_io_recv(void *ctx, unsigned char *buf, size_t max)
 {
     ssize_t ret;
-    comm_t *comm = ctx;
-    ret = read(comm->io.sock, buf, max);
+    int *sock = ctx;
+    ret = read(*sock, buf, max);
     if (ret < 0) {
         if (errno == EWOULDBLOCK || errno == EAGAIN) {
             return MBEDTLS_ERR_SSL_WANT_READ;
@@ -176,56 +276,453 @@ srp_tls_io_recv(void *ctx, unsigned char *buf, size_t max)
     }
 }
 
-bool
-srp_tls_listen_callback(comm_t *comm)
+static bool
+srp_tls_same_address(const addr_t *a, const addr_t *b)
 {
+    if (a->sa.sa_family != b->sa.sa_family) {
+        return false;
+    }
+    if (a->sa.sa_family == AF_INET) {
+        return (a->sin.sin_port == b->sin.sin_port &&
+                !memcmp(&a->sin.sin_addr, &b->sin.sin_addr, sizeof a->sin.sin_addr));
+    }
+    if (a->sa.sa_family == AF_INET6) {
+        return (a->sin6.sin6_port == b->sin6.sin6_port &&
+                !memcmp(&a->sin6.sin6_addr, &b->sin6.sin6_addr, sizeof a->sin6.sin6_addr));
+    }
+    return false;
+}
+
+// Must be called with tls_session_mutex held.
+static tls_client_session_t *
+srp_tls_client_session_find(const addr_t *address)
+{
+    int i;
+
+    for (i = 0; i < SRP_TLS_CLIENT_SESSIONS; i++) {
+        if (tls_client_sessions[i].valid && srp_tls_same_address(&tls_client_sessions[i].address, address)) {
+            return &tls_client_sessions[i];
+        }
+    }
+    return NULL;
+}
+
+// Offers the server the session (and ticket, if it gave us one) we last had with it, so that it can resume it.
+static void
+srp_tls_client_session_restore(mbedtls_ssl_context *context, const addr_t *address)
+{
+    tls_client_session_t *saved;
     int status;
 
-    // Allocate the TLS config and state structures.
-    comm->tls_context = calloc(1, sizeof *comm->tls_context);
-    if (comm->tls_context == NULL) {
-        return false;
+    pthread_mutex_lock(&tls_session_mutex);
+    saved = srp_tls_client_session_find(address);
+    if (saved != NULL) {
+        status = mbedtls_ssl_set_session(context, &saved->session);
+        if (status != 0) {
+            ERROR("Unable to offer saved TLS session: %x", -status);
+        }
+    }
+    pthread_mutex_unlock(&tls_session_mutex);
+}
+
+static void
+srp_tls_client_session_save(mbedtls_ssl_context *context, const addr_t *address)
+{
+    tls_client_session_t *saved;
+    int status;
+
+    pthread_mutex_lock(&tls_session_mutex);
+    saved = srp_tls_client_session_find(address);
+    if (saved == NULL) {
+        saved = &tls_client_sessions[tls_client_session_next];
+        tls_client_session_next = (tls_client_session_next + 1) % SRP_TLS_CLIENT_SESSIONS;
     }
-    status = mbedtls_ssl_setup(&comm->tls_context->context, &tls_server_config);
+    if (saved->valid) {
+        mbedtls_ssl_session_free(&saved->session);
+    }
+    mbedtls_ssl_session_init(&saved->session);
+    saved->address = *address;
+    status = mbedtls_ssl_get_session(context, &saved->session);
+    saved->valid = status == 0;
     if (status != 0) {
-        ERROR("Unable to set up TLS listener state: %x", -status);
-        return false;
+        ERROR("Unable to save TLS session: %x", -status);
+        mbedtls_ssl_session_free(&saved->session);
     }
+    pthread_mutex_unlock(&tls_session_mutex);
+}
 
-    // Set up the I/O functions.
-    mbedtls_ssl_set_bio(&comm->tls_context->context, comm, srp_tls_io_send, srp_tls_io_recv, NULL);
+void
+srp_tls_set_workers(int num_workers)
+{
+    if (tls_workers_started != 0) {
+        ERROR("srp_tls_set_workers: TLS workers are already running.");
+        return;
+    }
+    tls_num_workers = num_workers < 0 ? 0 : (num_workers > SRP_TLS_MAX_WORKERS ? SRP_TLS_MAX_WORKERS : num_workers);
+}
 
-    // Start the TLS handshake.
-    status = mbedtls_ssl_handshake(&comm->tls_context->context);
-    if (status != 0 && status != MBEDTLS_ERR_SSL_WANT_READ && status != MBEDTLS_ERR_SSL_WANT_WRITE) {
-        ERROR("TLS handshake failed: %x", -status);
-        srp_tls_context_free(comm);
-        ioloop_close(&comm->io);
+static void
+srp_tls_worker_wake(tls_worker_t *worker)
+{
+    uint8_t byte = 0;
+
+    // If the pipe is full, the worker has plenty to wake it already.
+    if (write(worker->wakeup[1], &byte, 1) < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+        ERROR("srp_tls_worker_wake: %s", strerror(errno));
     }
-    return true;
 }
 
-bool
-srp_tls_connect_callback(comm_t *comm)
+// Moves as much as can be moved without blocking between the TLS session and the ioloop's end of the socketpair.
+static void
+srp_tls_worker_process(tls_context_t *tls)
+{
+    bool progress;
+    ssize_t len;
+    int status;
+
+    if (tls->state == handshake_in_progress) {
+        status = mbedtls_ssl_handshake(&tls->context);
+        tls->want_write = status == MBEDTLS_ERR_SSL_WANT_WRITE;
+        if (status == MBEDTLS_ERR_SSL_WANT_READ || status == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            return;
+        }
+        if (status != 0) {
+            ERROR("TLS handshake failed: %x", -status);
+            tls->closing = true;
+            return;
+        }
+        tls->state = handshake_complete;
+        if (tls->client) {
+            srp_tls_client_session_save(&tls->context, &tls->address);
+        }
+    }
+
+    do {
+        progress = false;
+        tls->want_write = false;
+
+        // Decrypt whatever the peer has sent, as long as there's room for it.
+        if (tls->to_ioloop_len == 0) {
+            status = mbedtls_ssl_read(&tls->context, tls->to_ioloop, sizeof tls->to_ioloop);
+            if (status > 0) {
+                tls->to_ioloop_len = status;
+                tls->to_ioloop_sent = 0;
+                progress = true;
+            } else if (status == MBEDTLS_ERR_SSL_WANT_WRITE) {
+                tls->want_write = true;
+#ifdef MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET
+            } else if (status == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET) {
+                if (tls->client) {
+                    srp_tls_client_session_save(&tls->context, &tls->address);
+                }
+                progress = true;
+#endif
+            } else if (status != MBEDTLS_ERR_SSL_WANT_READ) {
+                if (status != 0 && status != MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY && status != MBEDTLS_ERR_SSL_CONN_EOF) {
+                    ERROR("Unexpected response from SSL read: %x", -status);
+                }
+                tls->closing = true;
+                return;
+            }
+        }
+
+        // Pass it on to the ioloop.
+        if (tls->to_ioloop_sent < tls->to_ioloop_len) {
+            len = send(tls->inner, &tls->to_ioloop[tls->to_ioloop_sent],
+                       tls->to_ioloop_len - tls->to_ioloop_sent, MSG_NOSIGNAL);
+            if (len < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    tls->closing = true;
+                    return;
+                }
+            } else {
+                tls->to_ioloop_sent += len;
+                if (tls->to_ioloop_sent == tls->to_ioloop_len) {
+                    tls->to_ioloop_len = tls->to_ioloop_sent = 0;
+                }
+                progress = true;
+            }
+        }
+
+        // Pick up whatever the ioloop wants sent, once what it gave us last has been taken.
+        if (tls->to_peer_len == 0) {
+            len = recv(tls->inner, tls->to_peer, sizeof tls->to_peer, 0);
+            if (len == 0) {
+                // The ioloop has closed the connection.
+                tls->closing = true;
+                return;
+            } else if (len < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    tls->closing = true;
+                    return;
+                }
+            } else {
+                tls->to_peer_len = len;
+                progress = true;
+            }
+        }
+        if (tls->to_peer_len != 0) {
+            // If mbedtls asks to be called again, it has to be with the same data, which is why we don't pick up
+            // anything more from the ioloop until this has all been taken.
+            status = mbedtls_ssl_write(&tls->context, tls->to_peer, tls->to_peer_len);
+            if (status > 0) {
+                memmove(tls->to_peer, &tls->to_peer[status], tls->to_peer_len - status);
+                tls->to_peer_len -= status;
+                progress = true;
+            } else if (status == MBEDTLS_ERR_SSL_WANT_WRITE) {
+                tls->want_write = true;
+            } else if (status != MBEDTLS_ERR_SSL_WANT_READ) {
+                ERROR("Unexpected response from SSL write: %x", -status);
+                tls->closing = true;
+                return;
+            }
+        }
+    } while (progress);
+}
+
+static void
+srp_tls_worker_close(tls_worker_t *worker, tls_context_t *tls)
+{
+    // Best effort: the socket is nonblocking, and the peer may be gone already.
+    mbedtls_ssl_close_notify(&tls->context);
+    close(tls->sock);
+    close(tls->inner);
+    mbedtls_ssl_free(&tls->context);
+    free(tls);
+
+    pthread_mutex_lock(&worker->mutex);
+    worker->num_connections--;
+    pthread_mutex_unlock(&worker->mutex);
+}
+
+static void *
+srp_tls_worker(void *context)
+{
+    tls_worker_t *worker = context;
+    struct pollfd *fds = NULL;
+    tls_context_t **polled = NULL;
+    tls_context_t *tls, *pending, **tp;
+    int max_polled = 0;
+    int num_polled, count, i;
+    uint8_t drain[64];
+
+    while (true) {
+        // Each connection gets two pollfds: the network socket, then the ioloop's socket.
+        count = 0;
+        for (tls = worker->connections; tls != NULL; tls = tls->next) {
+            count++;
+        }
+        if (count > max_polled) {
+            struct pollfd *new_fds = realloc(fds, (2 * count + 1) * sizeof *fds);
+            if (new_fds != NULL) {
+                fds = new_fds;
+                tls_context_t **new_polled = realloc(polled, count * sizeof *polled);
+                if (new_polled != NULL) {
+                    polled = new_polled;
+                    max_polled = count;
+                }
+            }
+            if (max_polled < count) {
+                ERROR("srp_tls_worker: no memory to poll %d connections.", count);
+            }
+        }
+        if (fds == NULL) {
+            fds = calloc(1, sizeof *fds);
+            if (fds == NULL) {
+                ERROR("srp_tls_worker: no memory.");
+                sleep(1);
+                continue;
+            }
+        }
+
+        fds[0].fd = worker->wakeup[0];
+        fds[0].events = POLLIN;
+        num_polled = 0;
+        for (tls = worker->connections; tls != NULL && num_polled < max_polled; tls = tls->next) {
+            struct pollfd *pfd = &fds[1 + 2 * num_polled];
+            pfd[0].fd = tls->sock;
+            pfd[0].events = (tls->want_write ? POLLOUT : 0) | (tls->to_ioloop_len == 0 ? POLLIN : 0);
+            pfd[1].fd = tls->inner;
+            pfd[1].events = ((tls->to_ioloop_sent < tls->to_ioloop_len ? POLLOUT : 0) |
+                             (tls->state == handshake_complete && tls->to_peer_len == 0 ? POLLIN : 0));
+            polled[num_polled++] = tls;
+        }
+        if (poll(fds, 1 + 2 * num_polled, -1) < 0) {
+            if (errno != EINTR) {
+                ERROR("srp_tls_worker: poll: %s", strerror(errno));
+            }
+            continue;
+        }
+
+        for (i = 0; i < num_polled; i++) {
+            if (fds[1 + 2 * i].revents != 0 || fds[2 + 2 * i].revents != 0) {
+                srp_tls_worker_process(polled[i]);
+            }
+        }
+
+        // Pick up new connections, and get their handshakes going.
+        if (fds[0].revents != 0) {
+            while (read(worker->wakeup[0], drain, sizeof drain) > 0)
+                ;
+            pthread_mutex_lock(&worker->mutex);
+            pending = worker->pending;
+            worker->pending = NULL;
+            pthread_mutex_unlock(&worker->mutex);
+            while (pending != NULL) {
+                tls = pending;
+                pending = tls->next;
+                tls->next = worker->connections;
+                worker->connections = tls;
+                srp_tls_worker_process(tls);
+            }
+        }
+
+        for (tp = &worker->connections; *tp != NULL; ) {
+            tls = *tp;
+            if (tls->closing) {
+                *tp = tls->next;
+                srp_tls_worker_close(worker, tls);
+            } else {
+                tp = &tls->next;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Starts the workers if they haven't been started yet; returns false if we have none.
+static bool
+srp_tls_workers_start(void)
 {
+    tls_worker_t *worker;
+    long cpus;
     int status;
 
-    // Allocate the TLS config and state structures.
-    comm->tls_context = calloc(1, sizeof *comm->tls_context);
-    if (comm->tls_context == NULL) {
+    if (tls_num_workers < 0) {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        tls_num_workers = cpus < 1 ? 1 : (cpus > SRP_TLS_DEFAULT_WORKERS ? SRP_TLS_DEFAULT_WORKERS : (int)cpus);
+    }
+    while (tls_workers_started < tls_num_workers) {
+        worker = &tls_workers[tls_workers_started];
+        if (pipe(worker->wakeup) < 0) {
+            ERROR("srp_tls_workers_start: pipe: %s", strerror(errno));
+            break;
+        }
+        if (fcntl(worker->wakeup[0], F_SETFL, O_NONBLOCK) < 0 || fcntl(worker->wakeup[1], F_SETFL, O_NONBLOCK) < 0) {
+            ERROR("srp_tls_workers_start: Can't set O_NONBLOCK: %s", strerror(errno));
+            close(worker->wakeup[0]);
+            close(worker->wakeup[1]);
+            break;
+        }
+        pthread_mutex_init(&worker->mutex, NULL);
+        status = pthread_create(&worker->thread, NULL, srp_tls_worker, worker);
+        if (status != 0) {
+            ERROR("srp_tls_workers_start: pthread_create: %s", strerror(status));
+            pthread_mutex_destroy(&worker->mutex);
+            close(worker->wakeup[0]);
+            close(worker->wakeup[1]);
+            break;
+        }
+        pthread_detach(worker->thread);
+        tls_workers_started++;
+    }
+    // If we couldn't start as many workers as we wanted, make do with the ones we have.
+    tls_num_workers = tls_workers_started;
+    return tls_num_workers > 0;
+}
+
+// Hands the connection's TLS session to a worker, and gives the comm the ioloop's end of a socketpair to use in
+// place of its network socket.
+static bool
+srp_tls_handoff(comm_t *comm, tls_context_t *tls)
+{
+    tls_worker_t *worker = NULL;
+    int least = 0;
+    int pair[2];
+    int flags;
+    int i;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+        ERROR("srp_tls_handoff: socketpair: %s", strerror(errno));
         return false;
     }
-    status = mbedtls_ssl_setup(&comm->tls_context->context, &tls_client_config);
-    if (status != 0) {
-        ERROR("Unable to set up TLS connect state: %x", -status);
+    // The worker never blocks; the ioloop's end behaves as the network socket did.
+    flags = fcntl(comm->io.sock, F_GETFL);
+    if (flags < 0 || fcntl(pair[0], F_SETFL, flags) < 0 || fcntl(pair[1], F_SETFL, O_NONBLOCK) < 0 ||
+        fcntl(comm->io.sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+        ERROR("srp_tls_handoff: Can't set O_NONBLOCK: %s", strerror(errno));
+        close(pair[0]);
+        close(pair[1]);
         return false;
     }
+    tls->sock = comm->io.sock;
+    tls->inner = pair[1];
+    comm->io.sock = pair[0];
+    mbedtls_ssl_set_bio(&tls->context, &tls->sock, srp_tls_io_send, srp_tls_io_recv, NULL);
+
+    for (i = 0; i < tls_num_workers; i++) {
+        pthread_mutex_lock(&tls_workers[i].mutex);
+        if (worker == NULL || tls_workers[i].num_connections < least) {
+            worker = &tls_workers[i];
+            least = worker->num_connections;
+        }
+        pthread_mutex_unlock(&tls_workers[i].mutex);
+    }
+    tls->worker = worker;
+    pthread_mutex_lock(&worker->mutex);
+    tls->next = worker->pending;
+    worker->pending = tls;
+    worker->num_connections++;
+    pthread_mutex_unlock(&worker->mutex);
+    srp_tls_worker_wake(worker);
+    return true;
+}
+
+static tls_context_t *
+srp_tls_context_create(comm_t *comm, mbedtls_ssl_config *config, bool client)
+{
+    tls_context_t *tls;
+    int status;
 
-    // Set up the I/O functions.
-    mbedtls_ssl_set_bio(&comm->tls_context->context, comm, srp_tls_io_send, srp_tls_io_recv, NULL);
+    // Allocate the TLS state structure.
+    tls = calloc(1, sizeof *tls);
+    if (tls == NULL) {
+        return NULL;
+    }
+    mbedtls_ssl_init(&tls->context);
+    status = mbedtls_ssl_setup(&tls->context, config);
+    if (status != 0) {
+        ERROR("Unable to set up TLS %s state: %x", client ? "connect" : "listener", -status);
+        mbedtls_ssl_free(&tls->context);
+        free(tls);
+        return NULL;
+    }
+    tls->state = handshake_in_progress;
+    tls->client = client;
+    tls->address = comm->address;
+    tls->sock = tls->inner = -1;
+    if (client) {
+        srp_tls_client_session_restore(&tls->context, &comm->address);
+    }
+    return tls;
+}
+
+static bool
+srp_tls_start(comm_t *comm, tls_context_t *tls)
+{
+    int status;
+
+    comm->tls_context = NULL;
+    if (srp_tls_workers_start() && srp_tls_handoff(comm, tls)) {
+        return true;
+    }
+
+    // No workers, so do TLS on the ioloop.
+    comm->tls_context = tls;
+    mbedtls_ssl_set_bio(&tls->context, &comm->io.sock, srp_tls_io_send, srp_tls_io_recv, NULL);
 
     // Start the TLS handshake.
-    status = mbedtls_ssl_handshake(&comm->tls_context->context);
+    status = mbedtls_ssl_handshake(&tls->context);
     if (status != 0 && status != MBEDTLS_ERR_SSL_WANT_READ && status != MBEDTLS_ERR_SSL_WANT_WRITE) {
         ERROR("TLS handshake failed: %x", -status);
         srp_tls_context_free(comm);
@@ -234,6 +731,26 @@ srp_tls_connect_callback(comm_t *comm)
     return true;
 }
 
+bool
+srp_tls_listen_callback(comm_t *comm)
+{
+    tls_context_t *tls = srp_tls_context_create(comm, &tls_server_config, false);
+    if (tls == NULL) {
+        return false;
+    }
+    return srp_tls_start(comm, tls);
+}
+
+bool
+srp_tls_connect_callback(comm_t *comm)
+{
+    tls_context_t *tls = srp_tls_context_create(comm, &tls_client_config, true);
+    if (tls == NULL) {
+        return false;
+    }
+    return srp_tls_start(comm, tls);
+}
+
 ssize_t
 srp_tls_read(comm_t *comm, unsigned char *buf, size_t max)
 {
@@ -121,6 +121,164 @@ dns_parse_label(const char *cur, const char *NONNULL *NONNULL nextp, uint8_t *NO
     return 0;
 }
 
+// Name compression.  Every name written outside of RDATA is remembered, along with each of its suffixes, in the
+// towire state's suffix table.  When a name is terminated, either with a root label or with a pointer, we look for
+// the longest suffix of it that's already in the message and replace that suffix with a pointer.  Names in RDATA
+// are left alone, because not every RR type may be compressed and because the SIG(0) code rewrites its RDATA after
+// the fact.
+
+#define DNS_COMPRESSION_MAX_OFFSET 0x3fff // Largest offset a compression pointer can hold.
+
+static uint8_t
+dns_compression_lower(uint8_t c)
+{
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// Find the next label of the name that's at *offset in the message, following pointers.   Returns false if the name
+// runs off the end of the buffer or loops.
+static bool
+dns_compression_label(const uint8_t *base, size_t limit, size_t *offset, int *hops)
+{
+    while (*offset < limit && (base[*offset] & 0xc0) == 0xc0) {
+        if (*offset + 1 >= limit || ++*hops > DNS_MAX_LABELS) {
+            return false;
+        }
+        *offset = ((base[*offset] & 0x3f) << 8) | base[*offset + 1];
+    }
+    if (*offset >= limit || (base[*offset] & 0xc0) != 0 || *offset + 1 + base[*offset] > limit) {
+        return false;
+    }
+    return true;
+}
+
+static bool
+dns_compression_hash(const uint8_t *base, size_t limit, size_t offset, uint32_t *hash)
+{
+    uint32_t h = 2166136261U;
+    int i, hops = 0, labels = 0;
+
+    do {
+        if (!dns_compression_label(base, limit, &offset, &hops) || ++labels > DNS_MAX_LABELS) {
+            return false;
+        }
+        h = (h ^ base[offset]) * 16777619U;
+        for (i = 1; i <= base[offset]; i++) {
+            h = (h ^ dns_compression_lower(base[offset + i])) * 16777619U;
+        }
+        i = base[offset];
+        offset += 1 + i;
+    } while (i != 0);
+    *hash = h;
+    return true;
+}
+
+static bool
+dns_compression_names_equal(const uint8_t *base, size_t limit, size_t a, size_t b)
+{
+    int i, len, hops_a = 0, hops_b = 0, labels = 0;
+
+    do {
+        if (!dns_compression_label(base, limit, &a, &hops_a) || !dns_compression_label(base, limit, &b, &hops_b) ||
+            ++labels > DNS_MAX_LABELS) {
+            return false;
+        }
+        len = base[a];
+        if (len != base[b]) {
+            return false;
+        }
+        for (i = 1; i <= len; i++) {
+            if (dns_compression_lower(base[a + i]) != dns_compression_lower(base[b + i])) {
+                return false;
+            }
+        }
+        a += 1 + len;
+        b += 1 + len;
+    } while (len != 0);
+    return true;
+}
+
+// The name starting at name has just been terminated.   Compress it against the names already in the message,
+// and remember whatever is left of it for names that come later.   Returns where the whole name can be found
+// if it was already in the message, or NULL.
+static uint8_t *
+dns_name_compress(dns_towire_state_t *NONNULL txn, uint8_t *NONNULL name)
+{
+    const uint8_t *base = (uint8_t *)txn->message;
+    size_t limit, label_offsets[DNS_MAX_LABELS], offset, end;
+    uint32_t hashes[DNS_MAX_LABELS];
+    int num_labels = 0, i, j, match = -1;
+    uint8_t *ret = NULL;
+
+    if (!txn->compress || txn->message == NULL || txn->error || txn->p_rdlength != NULL) {
+        return NULL;
+    }
+    if (txn->suffix_message != txn->message) {
+        txn->suffix_message = txn->message;
+        txn->num_suffixes = 0;
+    }
+    limit = txn->lim - base;
+    end = txn->p - base;
+
+    // Anything in the table at or after this name was written before the message was rewound, so it's stale.
+    for (i = 0; i < txn->num_suffixes; i++) {
+        if (txn->suffix_offsets[i] >= name - base) {
+            txn->num_suffixes = i;
+            break;
+        }
+    }
+
+    // Find the literal labels at the start of the name; the name ends with either a root label or a pointer.
+    for (offset = name - base; offset < end && base[offset] != 0 && (base[offset] & 0xc0) == 0;
+         offset += 1 + base[offset]) {
+        if (num_labels == DNS_MAX_LABELS) {
+            return NULL;
+        }
+        label_offsets[num_labels] = offset;
+        if (!dns_compression_hash(base, limit, offset, &hashes[num_labels])) {
+            return NULL;
+        }
+        num_labels++;
+    }
+
+    // Look for the longest suffix that we've already got.
+    for (i = 0; i < num_labels && match < 0; i++) {
+        for (j = 0; j < txn->num_suffixes; j++) {
+            if (txn->suffix_hashes[j] == hashes[i] &&
+                dns_compression_names_equal(base, limit, txn->suffix_offsets[j], label_offsets[i])) {
+                match = j;
+                break;
+            }
+        }
+        if (match >= 0) {
+            break;
+        }
+    }
+
+    // Replace it with a pointer.   The suffix we're replacing is at least a label and a terminator, so the pointer
+    // always fits in the same space.
+    if (match >= 0) {
+        txn->p = (uint8_t *)base + label_offsets[i];
+        *txn->p++ = 0xc0 | (txn->suffix_offsets[match] >> 8);
+        *txn->p++ = txn->suffix_offsets[match] & 0xff;
+        if (i == 0) {
+            ret = (uint8_t *)base + txn->suffix_offsets[match];
+        }
+        num_labels = i;
+    }
+
+    // What's left of the name is new, so remember it.
+    for (i = 0; i < num_labels && txn->num_suffixes < DNS_TOWIRE_MAX_SUFFIXES; i++) {
+        if (label_offsets[i] > DNS_COMPRESSION_MAX_OFFSET) {
+            break;
+        }
+        txn->suffix_offsets[txn->num_suffixes] = (uint16_t)label_offsets[i];
+        txn->suffix_hashes[txn->num_suffixes] = hashes[i];
+        txn->num_suffixes++;
+    }
+    return ret;
+}
+
 // Convert a name to wire format.   Does not store the root label (0) at the end.   Does not support binary labels.
 void
 dns_name_to_wire_(dns_name_pointer_t *NULLABLE r_pointer, dns_towire_state_t *NONNULL txn,
@@ -135,6 +293,11 @@ dns_name_to_wire_(dns_name_pointer_t *NULLABLE r_pointer, dns_towire_state_t *NO
         np.message_start = (uint8_t *)txn->message;
         np.name_start = txn->p;
 
+        // If this continues a name we've already started writing, remember where the whole name starts.
+        if (txn->p_name == NULL || txn->p_name_end != txn->p) {
+            txn->p_name = txn->p;
+        }
+
         cur = name;
         do {
             // Note that nothing is stored through txn->p until dns_name_parse has verified that
@@ -163,6 +326,7 @@ dns_name_to_wire_(dns_name_pointer_t *NULLABLE r_pointer, dns_towire_state_t *NO
             txn->line = line;
             return;
         }
+        txn->p_name_end = txn->p;
         if (r_pointer != NULL) {
             *r_pointer = np;
         }
@@ -175,10 +339,14 @@ dns_full_name_to_wire_(dns_name_pointer_t *NULLABLE r_pointer, dns_towire_state_
                        const char *NONNULL name, int line)
 {
     dns_name_pointer_t np;
+    uint8_t *name_start, *whole_name;
+
     if (!txn->error) {
         memset(&np, 0, sizeof np);
         dns_name_to_wire(&np, txn, name);
         if (!txn->error) {
+            name_start = txn->p_name;
+            txn->p_name = NULL;
             if (txn->p + 1 >= txn->lim) {
                 txn->error = ENOBUFS;
                 txn->truncated = true;
@@ -193,6 +361,12 @@ dns_full_name_to_wire_(dns_name_pointer_t *NULLABLE r_pointer, dns_towire_state_
                 txn->line = line;
                 return;
             }
+            if (name_start != NULL) {
+                whole_name = dns_name_compress(txn, name_start);
+                if (whole_name != NULL && np.name_start == name_start) {
+                    np.name_start = whole_name;
+                }
+            }
             if (r_pointer) {
                 *r_pointer = np;
             }
@@ -205,8 +379,13 @@ void
 dns_pointer_to_wire_(dns_name_pointer_t *NULLABLE r_pointer, dns_towire_state_t *NONNULL txn,
                      dns_name_pointer_t *NONNULL pointer, int line)
 {
+    uint8_t *name_start, *whole_name;
+
     if (!txn->error) {
         uint16_t offset = pointer->name_start - pointer->message_start;
+        // If this pointer ends a name whose labels we just wrote, we can try to compress that name.
+        name_start = (txn->p_name != NULL && txn->p_name_end == txn->p) ? txn->p_name : NULL;
+        txn->p_name = NULL;
         if (offset > DNS_MAX_POINTER) {
             txn->error = ETOOMANYREFS;
             txn->line = line;
@@ -229,6 +408,12 @@ dns_pointer_to_wire_(dns_name_pointer_t *NULLABLE r_pointer, dns_towire_state_t
                 return;
             }
         }
+        if (name_start != NULL) {
+            whole_name = dns_name_compress(txn, name_start);
+            if (whole_name != NULL && r_pointer != NULL && r_pointer->name_start == name_start) {
+                r_pointer->name_start = whole_name;
+            }
+        }
     }
 }
 
@@ -41,6 +41,57 @@ create_public_sec_key(const dns_rr_t *const key_record);
 static CFDataRef
 create_data_to_verify(dns_wire_t *const message, const dns_rr_t *const signature);
 
+typedef struct srp_key_cache_entry srp_key_cache_entry_t;
+struct srp_key_cache_entry {
+    uint8_t key[ECDSA_KEY_SIZE];    // The KEY RR's public key data
+    SecKeyRef public_key;           // The same public key, imported; NULL if the entry is unused
+};
+static srp_key_cache_entry_t srp_key_cache[SRP_KEY_CACHE_SIZE];
+static srp_verify_stats_t srp_verify_stats;
+
+static uint32_t
+srp_key_hash(const uint8_t *const key, const size_t len)
+{
+    uint32_t hash = 2166136261U; // FNV-1a
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ key[i]) * 16777619U;
+    }
+    return hash;
+}
+
+// Returns the SecKeyRef for a KEY RR, creating it if it isn't in the cache.   The cache keeps the reference.
+static SecKeyRef
+srp_key_cache_lookup(const dns_rr_t *const key_record)
+{
+    srp_key_cache_entry_t *entry = &srp_key_cache[srp_key_hash(key_record->data.key.key, ECDSA_KEY_SIZE) %
+                                                  SRP_KEY_CACHE_SIZE];
+
+    if (entry->public_key != NULL && !memcmp(entry->key, key_record->data.key.key, ECDSA_KEY_SIZE)) {
+        srp_verify_stats.key_cache_hits++;
+        return entry->public_key;
+    }
+    srp_verify_stats.key_cache_misses++;
+
+    // Whatever was in this slot is replaced.
+    if (entry->public_key != NULL) {
+        CFRelease(entry->public_key);
+        entry->public_key = NULL;
+    }
+    entry->public_key = create_public_sec_key(key_record);
+    if (entry->public_key != NULL) {
+        memcpy(entry->key, key_record->data.key.key, ECDSA_KEY_SIZE);
+    }
+    return entry->public_key;
+}
+
+void
+srp_verify_stats_get(srp_verify_stats_t *stats)
+{
+    *stats = srp_verify_stats;
+}
+
 bool
 srp_sig0_verify(dns_wire_t *message, dns_rr_t *key, dns_rr_t *signature)
 {
@@ -50,6 +101,8 @@ srp_sig0_verify(dns_wire_t *message, dns_rr_t *key, dns_rr_t *signature)
     CFDataRef data_to_verify_cfdata = NULL;
     CFDataRef sig_to_match_cfdata = NULL;
 
+    srp_verify_stats.verifies++;
+
     // The algorithm in KEY and SIG(0) has to match.
     require_action_quiet(key->data.key.algorithm == signature->data.sig.algorithm, exit,
                          ERROR("KEY algorithm does not match the SIG(0) algorithm - "
@@ -68,8 +121,8 @@ srp_sig0_verify(dns_wire_t *message, dns_rr_t *key, dns_rr_t *signature)
     require_action_quiet(signature->data.sig.len == ECDSA_SHA256_SIG_SIZE, exit,
                          ERROR("Invalid SIG(0) length - SIG(0) length: %d", signature->data.sig.len));
 
-    // Get SecKeyRef given the KEY data.
-    public_key = create_public_sec_key(key);
+    // Get SecKeyRef given the KEY data, which the cache holds on to.
+    public_key = srp_key_cache_lookup(key);
     require_action_quiet(public_key != NULL, exit, ERROR("Failed to create public_key"));
 
     // Create signature to check.
@@ -110,8 +163,8 @@ exit:
     if (sig_to_match_cfdata != NULL) {
         CFRelease(sig_to_match_cfdata);
     }
-    if (public_key != NULL) {
-        CFRelease(public_key);
+    if (!valid) {
+        srp_verify_stats.failures++;
     }
 
     return valid;
@@ -32,57 +32,131 @@
 #include "srp-crypto.h"
 
 
+typedef struct srp_key_cache_entry srp_key_cache_entry_t;
+struct srp_key_cache_entry {
+    bool valid;
+    uint8_t key[ECDSA_KEY_SIZE];    // The KEY RR's public key data
+    mbedtls_ecp_point pubkey;       // The same public key, imported
+};
+static srp_key_cache_entry_t srp_key_cache[SRP_KEY_CACHE_SIZE];
+static srp_verify_stats_t srp_verify_stats;
+
+// The group is loaded once, which also lets mbedtls keep its precomputed multiples of the generator across calls.
+static mbedtls_ecp_group srp_verify_group;
+static bool srp_verify_group_loaded;
+
+static uint32_t
+srp_key_hash(const uint8_t *key, size_t len)
+{
+    uint32_t hash = 2166136261U; // FNV-1a
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ key[i]) * 16777619U;
+    }
+    return hash;
+}
+
+// Returns the public key for a KEY RR, importing it if it isn't in the cache.
+static mbedtls_ecp_point *
+srp_key_cache_lookup(dns_rr_t *key)
+{
+    srp_key_cache_entry_t *entry = &srp_key_cache[srp_key_hash(key->data.key.key, ECDSA_KEY_SIZE) %
+                                                  SRP_KEY_CACHE_SIZE];
+    char errbuf[128];
+    int status;
+
+    if (entry->valid && !memcmp(entry->key, key->data.key.key, ECDSA_KEY_SIZE)) {
+        srp_verify_stats.key_cache_hits++;
+        return &entry->pubkey;
+    }
+    srp_verify_stats.key_cache_misses++;
+
+    // Whatever was in this slot is replaced.
+    if (entry->valid) {
+        mbedtls_ecp_point_free(&entry->pubkey);
+        entry->valid = false;
+    }
+    mbedtls_ecp_point_init(&entry->pubkey);
+    if ((status = mbedtls_mpi_read_binary(&entry->pubkey.X, key->data.key.key, ECDSA_KEY_PART_SIZE)) != 0 ||
+        (status = mbedtls_mpi_read_binary(&entry->pubkey.Y, key->data.key.key + ECDSA_KEY_PART_SIZE,
+                                          ECDSA_KEY_PART_SIZE)) != 0 ||
+        (status = mbedtls_mpi_lset(&entry->pubkey.Z, 1)) != 0) {
+        mbedtls_strerror(status, errbuf, sizeof errbuf);
+        ERROR("mbedtls_mpi_read_binary: reading key: " PUB_S_SRP, errbuf);
+        mbedtls_ecp_point_free(&entry->pubkey);
+        return NULL;
+    }
+    memcpy(entry->key, key->data.key.key, ECDSA_KEY_SIZE);
+    entry->valid = true;
+    return &entry->pubkey;
+}
+
+void
+srp_verify_stats_get(srp_verify_stats_t *stats)
+{
+    *stats = srp_verify_stats;
+}
+
 // Given a DNS message, a signature, and a public key, validate the message
 bool
 srp_sig0_verify(dns_wire_t *message, dns_rr_t *key, dns_rr_t *signature)
 {
-    mbedtls_ecp_point pubkey;
-    mbedtls_ecp_group group;
+    mbedtls_ecp_point *pubkey;
     mbedtls_sha256_context sha;
     int status;
     char errbuf[128];
     uint8_t hash[ECDSA_SHA256_HASH_SIZE];
     mbedtls_mpi r, s;
-    uint8_t *rdata;
+    uint8_t *rdata = NULL;
     size_t rdlen;
+    bool ret = false;
+
+    srp_verify_stats.verifies++;
 
     // The key algorithm and the signature algorithm have to match or we can't validate the signature.
     if (key->data.key.algorithm != signature->data.sig.algorithm) {
-        return false;
+        goto fail;
     }
 
     // Key must be the right length (DNS ECDSA KEY isn't compressed).
     if (key->data.key.len != ECDSA_KEY_SIZE) {
-        return false;
+        goto fail;
     }
 
     // Currently only support ecdsa
     if (signature->data.sig.algorithm != dnssec_keytype_ecdsa) {
-        return false;
+        goto fail;
     }
 
     // Make sure the signature is the right size.
     if (signature->data.sig.len != ECDSA_SHA256_SIG_SIZE) {
-        return false;
+        goto fail;
     }
 
-    // Take the KEY RR and turn it into a public key we can use to check the signature.
     // Initialize the ECP group (SECP256).
-    mbedtls_ecp_point_init(&pubkey);
-    mbedtls_ecp_group_init(&group);
-    mbedtls_ecp_group_load(&group, MBEDTLS_ECP_DP_SECP256R1);
+    if (!srp_verify_group_loaded) {
+        mbedtls_ecp_group_init(&srp_verify_group);
+        if ((status = mbedtls_ecp_group_load(&srp_verify_group, MBEDTLS_ECP_DP_SECP256R1)) != 0) {
+            mbedtls_strerror(status, errbuf, sizeof errbuf);
+            ERROR("mbedtls_ecp_group_load: " PUB_S_SRP, errbuf);
+            mbedtls_ecp_group_free(&srp_verify_group);
+            goto fail;
+        }
+        srp_verify_group_loaded = true;
+    }
+
+    // Take the KEY RR and turn it into a public key we can use to check the signature, unless we already have.
+    pubkey = srp_key_cache_lookup(key);
+    if (pubkey == NULL) {
+        goto fail;
+    }
+
     mbedtls_mpi_init(&r);
     mbedtls_mpi_init(&s);
     mbedtls_sha256_init(&sha);
     memset(hash, 0, sizeof hash);
 
-    if ((status = mbedtls_mpi_read_binary(&pubkey.X, key->data.key.key, ECDSA_KEY_PART_SIZE)) != 0 ||
-        (status = mbedtls_mpi_read_binary(&pubkey.Y, key->data.key.key + ECDSA_KEY_PART_SIZE, ECDSA_KEY_PART_SIZE)) != 0) {
-        mbedtls_strerror(status, errbuf, sizeof errbuf);
-        ERROR("mbedtls_mpi_read_binary: reading key: " PUB_S_SRP, errbuf);
-    }
-    mbedtls_mpi_lset(&pubkey.Z, 1);
-
     if ((status = mbedtls_mpi_read_binary(&r, signature->data.sig.signature, ECDSA_SHA256_SIG_PART_SIZE)) != 0 ||
         (status = mbedtls_mpi_read_binary(&s, signature->data.sig.signature + ECDSA_SHA256_SIG_PART_SIZE,
                                           ECDSA_SHA256_SIG_PART_SIZE)) != 0) {
@@ -99,15 +173,17 @@ srp_sig0_verify(dns_wire_t *message, dns_rr_t *key, dns_rr_t *signature)
     rdlen = SIG_STATIC_RDLEN + dns_name_wire_length(signature->data.sig.signer);
     rdata = malloc(rdlen);
     if (rdata == NULL) {
+        message->arcount = htons(ntohs(message->arcount) + 1);
         ERROR("no memory for SIG RR canonicalization");
-        return 0;
+        goto out;
     }
     memcpy(rdata, &message->data[signature->data.sig.start + SIG_HEADERLEN], SIG_STATIC_RDLEN);
     if (!dns_name_to_wire_canonical(rdata + SIG_STATIC_RDLEN, rdlen - SIG_STATIC_RDLEN,
                                     signature->data.sig.signer)) {
         // Should never happen.
+        message->arcount = htons(ntohs(message->arcount) + 1);
         ERROR("dns_name_wire_length and dns_name_to_wire_canonical got different lengths!");
-        return 0;
+        goto out;
     }
 
     // First compute the hash across the SIG RR, then hash the message up to the SIG RR
@@ -121,19 +197,29 @@ srp_sig0_verify(dns_wire_t *message, dns_rr_t *key, dns_rr_t *signature)
         message->arcount = htons(ntohs(message->arcount) + 1);
         mbedtls_strerror(status, errbuf, sizeof errbuf);
         ERROR("mbedtls_sha_256 hash failed: " PUB_S_SRP, errbuf);
-        return 0;
+        goto out;
     }
     message->arcount = htons(ntohs(message->arcount) + 1);
-    free(rdata);
 
     // Now check the signature against the hash
-    status = mbedtls_ecdsa_verify(&group, hash, sizeof hash, &pubkey, &r, &s);
+    status = mbedtls_ecdsa_verify(&srp_verify_group, hash, sizeof hash, pubkey, &r, &s);
     if (status != 0) {
         mbedtls_strerror(status, errbuf, sizeof errbuf);
         ERROR("mbedtls_ecdsa_verify failed: " PUB_S_SRP, errbuf);
-        return 0;
+        goto out;
+    }
+    ret = true;
+
+out:
+    free(rdata);
+    mbedtls_sha256_free(&sha);
+    mbedtls_mpi_free(&r);
+    mbedtls_mpi_free(&s);
+fail:
+    if (!ret) {
+        srp_verify_stats.failures++;
     }
-    return 1;
+    return ret;
 }
 
 // Function to copy out the public key as binary data
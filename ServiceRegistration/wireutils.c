@@ -54,7 +54,10 @@ void dns_name_free(dns_label_t *name)
         return;
     }
     next = name->next;
-    free(name);
+    // Labels in a parsed message's arena are freed along with the message.
+    if (!(name->flags & DNS_LABEL_IN_ARENA)) {
+        free(name);
+    }
     if (next != NULL) {
         return dns_name_free(next);
     }
@@ -181,6 +181,13 @@ mDNSexport mDNSu32 NumCacheRecordsForInterfaceID(const mDNS *const m, mDNSInterf
     mDNSu32 slot, used = 0;
     CacheGroup *cg;
     const CacheRecord *rr;
+    if (!m->rrcache_partition_overflow)     // Every record is accounted to a partition, so just look it up
+    {
+        for (slot = 0; slot < CachePartitionCount; slot++)
+            if (m->rrcache_partitions[slot].used && m->rrcache_partitions[slot].InterfaceID == id)
+                return(m->rrcache_partitions[slot].used);
+        return(0);
+    }
     FORALL_CACHERECORDS(slot, cg, rr)
     {
         if (rr->resrec.InterfaceID == id)
@@ -483,6 +490,22 @@ mDNSexport mDNSBool mDNSAddrIsDNSMulticast(const mDNSAddr *ip)
 #pragma mark - Domain Name Utility Functions
 #endif
 
+// Labels are compared and lower-cased four bytes at a time. The loads are written a byte at a time, so there
+// are no alignment requirements, and compilers turn them into a single load on little-endian machines; nothing is
+// ever read past the end of the label (or name) being examined. This is plain portable C so it works the same on
+// every platform mDNSCore builds for. Note that P[0] ends up in the low byte of the word.
+#define mDNSGetWord(P) ((mDNSu32)(P)[0] | (mDNSu32)(P)[1] << 8 | (mDNSu32)(P)[2] << 16 | (mDNSu32)(P)[3] << 24)
+
+// Lower-cases the ASCII letters in all four bytes of w at once. Bytes with the top bit set are never changed.
+mDNSlocal mDNSu32 LowerCaseWord(const mDNSu32 w)
+{
+    const mDNSu32 heptets = w & 0x7F7F7F7F;
+    const mDNSu32 aboveZ  = heptets + (0x7F - 'Z') * 0x01010101;   // Top bit of each byte set if heptet > 'Z'
+    const mDNSu32 fromA   = heptets + (0x80 - 'A') * 0x01010101;   // Top bit of each byte set if heptet >= 'A'
+    const mDNSu32 upper   = (fromA ^ aboveZ) & ~w & 0x80808080;
+    return(w | (upper >> 2));                                       // 0x80 >> 2 is 'a' - 'A'
+}
+
 #if !APPLE_OSX_mDNSResponder
 
 mDNSexport mDNSBool SameDomainLabel(const mDNSu8 *a, const mDNSu8 *b)
@@ -494,7 +517,15 @@ mDNSexport mDNSBool SameDomainLabel(const mDNSu8 *a, const mDNSu8 *b)
     { debugf("Malformed label (too long)"); return(mDNSfalse); }
 
     if (len != *b++) return(mDNSfalse);
-    for (i=0; i<len; i++)
+    for (i=0; i+4 <= len; i+=4)
+    {
+        const mDNSu32 aw = mDNSGetWord(a + i);
+        const mDNSu32 bw = mDNSGetWord(b + i);
+        if (aw != bw && LowerCaseWord(aw) != LowerCaseWord(bw)) return(mDNSfalse);
+    }
+    a += i;
+    b += i;
+    for (; i<len; i++)
     {
         mDNSu8 ac = *a++;
         mDNSu8 bc = *b++;
@@ -513,6 +544,7 @@ mDNSexport mDNSBool SameDomainName(const domainname *const d1, const domainname
     const mDNSu8 *      b   = d2->c;
     const mDNSu8 *const max = d1->c + MAX_DOMAIN_NAME;          // Maximum that's valid
 
+    if (d1 == d2) return(mDNStrue);     // Such as two groups sharing an interned name
     while (*a || *b)
     {
         if (a + 1 + *a >= max)
@@ -1004,7 +1036,16 @@ mDNSexport mStatus DNSNameToLowerCase(domainname *d, domainname *result)
         }
         len = *a++;
         *b++ = len;
-        for (i = 0; i < len; i++)
+        for (i = 0; i + 4 <= len; i += 4)
+        {
+            const mDNSu32 w = LowerCaseWord(mDNSGetWord(a));
+            *b++ = (mDNSu8)(w      );
+            *b++ = (mDNSu8)(w >>  8);
+            *b++ = (mDNSu8)(w >> 16);
+            *b++ = (mDNSu8)(w >> 24);
+            a += 4;
+        }
+        for (; i < len; i++)
         {
             mDNSu8 ac = *a++;
             if (mDNSIsUpperCase(ac)) ac += 'a' - 'A';
@@ -1231,6 +1272,7 @@ mDNSexport void mDNS_SetupResourceRecord(AuthRecord *rr, RData *RDataStorage, mD
     rr->TimeExpire        = 0;
     rr->ARType            = artype;
     rr->AuthFlags         = 0;
+    rr->UpdateInterval    = 0;
 
     // Field Group 3: Transient state for Authoritative Records (set in mDNS_Register_internal)
     // Field Group 4: Transient uDNS state for Authoritative Records (set in mDNS_Register_internal)
@@ -1285,6 +1327,43 @@ mDNSexport void mDNS_SetupQuestion(DNSQuestion *const q, const mDNSInterfaceID I
     q->QuestionContext     = context;
 }
 
+// Hash of raw rdata, the 32-bit MurmurHash3 of it. The rotate-and-add sum used before let rdata differing only
+// in the order of a few words (common among the TXT records of one kind of device) collide, which sent those
+// known-answer and conflict comparisons on to a full SameRDataBody(); a byte-level avalanche hash makes rdatahash
+// a reliable first filter for every rdata type that isn't compared by name.
+#define RDHashRotl(X, R) (((X) << (R)) | ((X) >> (32 - (R))))
+
+mDNSlocal mDNSu32 RawRDataHashValue(const mDNSu8 *const ptr, const int len, mDNSu32 h)
+{
+    const mDNSu32 c1 = 0xCC9E2D51, c2 = 0x1B873593;
+    mDNSu32 k;
+    int i;
+
+    for (i = 0; i + 4 <= len; i += 4)
+    {
+        k = (mDNSu32)ptr[i] | (mDNSu32)ptr[i+1] << 8 | (mDNSu32)ptr[i+2] << 16 | (mDNSu32)ptr[i+3] << 24;
+        k *= c1; k = RDHashRotl(k, 15); k *= c2;
+        h ^= k;  h = RDHashRotl(h, 13); h = h * 5 + 0xE6546B64;
+    }
+    k = 0;
+    switch (len & 3)
+    {
+    case 3: k ^= (mDNSu32)ptr[i+2] << 16; fallthrough();
+        /* FALLTHROUGH */
+    case 2: k ^= (mDNSu32)ptr[i+1] << 8; fallthrough();
+        /* FALLTHROUGH */
+    case 1: k ^= ptr[i];
+        k *= c1; k = RDHashRotl(k, 15); k *= c2; h ^= k;
+        break;
+    default: break;
+    }
+    h ^= (mDNSu32)len;
+    h ^= h >> 16; h *= 0x85EBCA6B;
+    h ^= h >> 13; h *= 0xC2B2AE35;
+    h ^= h >> 16;
+    return(h);
+}
+
 mDNSexport mDNSu32 RDataHashValue(const ResourceRecord *const rr)
 {
     int len = rr->rdlength;
@@ -1337,20 +1416,7 @@ mDNSexport mDNSu32 RDataHashValue(const ResourceRecord *const rr)
         /* FALLTHROUGH */
     }
 
-    default:
-    {
-        int i;
-        for (i=0; i+1 < len; i+=2)
-        {
-            sum += (((mDNSu32)(ptr[i])) << 8) | ptr[i+1];
-            sum = (sum<<3) | (sum>>29);
-        }
-        if (i < len)
-        {
-            sum += ((mDNSu32)(ptr[i])) << 8;
-        }
-        return(sum);
-    }
+    default: return(len > 0 ? RawRDataHashValue(ptr, len, sum) : sum);
     }
 }
 
@@ -1569,10 +1635,12 @@ mDNSexport mDNSBool SameNameCacheRecordAnswersQuestion(const CacheRecord *const
 
 mDNSlocal mDNSBool RecordAnswersQuestion(const ResourceRecord *const rr, mDNSBool isAuthRecord, const DNSQuestion *const q)
 {
-    if (!SameNameRecordAnswersQuestion(rr, isAuthRecord, q))
+    // Callers walking a m->QuestionHash chain also see questions for other names that share the slot, so check
+    // the name hash before anything else
+    if (rr->namehash != q->qnamehash || !SameNameRecordAnswersQuestion(rr, isAuthRecord, q))
         return mDNSfalse;
 
-    return(rr->namehash == q->qnamehash && SameDomainName(rr->name, &q->qname));
+    return(SameDomainName(rr->name, &q->qname));
 }
 
 mDNSexport mDNSBool ResourceRecordAnswersQuestion(const ResourceRecord *const rr, const DNSQuestion *const q)
@@ -1853,8 +1921,11 @@ mDNSexport mDNSBool ValidateRData(const mDNSu16 rrtype, const mDNSu16 rdlength,
 #pragma mark - DNS Message Creation Functions
 #endif
 
+mDNSlocal void ResetCompressionTable(const DNSMessage *const msg);
+
 mDNSexport void InitializeDNSMessage(DNSMessageHeader *h, mDNSOpaque16 id, mDNSOpaque16 flags)
 {
+    ResetCompressionTable((const DNSMessage *)h);
     h->id             = id;
     h->flags          = flags;
     h->numQuestions   = 0;
@@ -1865,6 +1936,36 @@ mDNSexport void InitializeDNSMessage(DNSMessageHeader *h, mDNSOpaque16 id, mDNSO
 
 #endif // !STANDALONE
 
+// Returns true if the name at "result" in the packet (following compression pointers as necessary) is the same as domname
+mDNSlocal mDNSBool CompressionTargetMatches(const mDNSu8 *const base, const mDNSu8 *const end, const mDNSu8 *const result,
+                                            const mDNSu8 *const domname)
+{
+    const mDNSu8 *name = domname;
+    const mDNSu8 *targ = result;
+    while (targ + *name < end)
+    {
+        // First see if this label matches
+        int i;
+        const mDNSu8 *pointertarget;
+        for (i=0; i <= *name; i++) if (targ[i] != name[i]) break;
+        if (i <= *name) break;                          // If label did not match, bail out
+        targ += 1 + *name;                              // Else, did match, so advance target pointer
+        name += 1 + *name;                              // and proceed to check next label
+        if (*name == 0 && *targ == 0) return(mDNStrue); // If no more labels, we found a match!
+        if (*name == 0) break;                          // If no more labels to match, we failed, so bail out
+
+        // The label matched, so now follow the pointer (if appropriate) and then see if the next label matches
+        if (targ[0] < 0x40) continue;                   // If length value, continue to check next label
+        if (targ[0] < 0xC0) break;                      // If 40-BF, not valid
+        if (targ+1 >= end) break;                       // Second byte not present!
+        pointertarget = base + (((mDNSu16)(targ[0] & 0x3F)) << 8) + targ[1];
+        if (targ < pointertarget) break;                // Pointertarget must point *backwards* in the packet
+        if (pointertarget[0] >= 0x40) break;            // Pointertarget must point to a valid length byte
+        targ = pointertarget;
+    }
+    return(mDNSfalse);
+}
+
 mDNSexport const mDNSu8 *FindCompressionPointer(const mDNSu8 *const base, const mDNSu8 *const end, const mDNSu8 *const domname)
 {
     const mDNSu8 *result = end - *domname - 1;
@@ -1876,54 +1977,205 @@ mDNSexport const mDNSu8 *FindCompressionPointer(const mDNSu8 *const base, const
     {
         // If the length byte and first character of the label match, then check further to see
         // if this location in the packet will yield a useful name compression pointer.
-        if (result[0] == domname[0] && result[1] == domname[1])
-        {
-            const mDNSu8 *name = domname;
-            const mDNSu8 *targ = result;
-            while (targ + *name < end)
-            {
-                // First see if this label matches
-                int i;
-                const mDNSu8 *pointertarget;
-                for (i=0; i <= *name; i++) if (targ[i] != name[i]) break;
-                if (i <= *name) break;                          // If label did not match, bail out
-                targ += 1 + *name;                              // Else, did match, so advance target pointer
-                name += 1 + *name;                              // and proceed to check next label
-                if (*name == 0 && *targ == 0) return(result);   // If no more labels, we found a match!
-                if (*name == 0) break;                          // If no more labels to match, we failed, so bail out
-
-                // The label matched, so now follow the pointer (if appropriate) and then see if the next label matches
-                if (targ[0] < 0x40) continue;                   // If length value, continue to check next label
-                if (targ[0] < 0xC0) break;                      // If 40-BF, not valid
-                if (targ+1 >= end) break;                       // Second byte not present!
-                pointertarget = base + (((mDNSu16)(targ[0] & 0x3F)) << 8) + targ[1];
-                if (targ < pointertarget) break;                // Pointertarget must point *backwards* in the packet
-                if (pointertarget[0] >= 0x40) break;            // Pointertarget must point to a valid length byte
-                targ = pointertarget;
-            }
-        }
+        if (result[0] == domname[0] && result[1] == domname[1] && CompressionTargetMatches(base, end, result, domname))
+            return(result);
         result--;   // We failed to match at this search position, so back up the tentative result pointer and try again
     }
     return(mDNSNULL);
 }
 
-// domainname is a fully-qualified name (i.e. assumed to be ending in a dot, even if it doesn't)
-// msg points to the message we're building (pass mDNSNULL if we don't want to use compression pointers)
-// end points to the end of the message so far
-// ptr points to where we want to put the name
-// limit points to one byte past the end of the buffer that we must not overrun
-// domainname is the name to put
-mDNSexport mDNSu8 *putDomainNameAsLabels(const DNSMessage *const msg,
-                                         mDNSu8 *ptr, const mDNSu8 *const limit, const domainname *const name)
+// Scanning the whole message for every name makes building a large message quadratic in its size, so as names are
+// written into the message most recently passed to InitializeDNSMessage, the offset of each label written is
+// remembered under a hash of the name suffix starting there. The table is only a hint: every candidate is checked
+// against the bytes actually in the packet before it's used, so it doesn't matter if the message has since been
+// rewound and overwritten. Messages that weren't started with InitializeDNSMessage, or that have more labels than
+// the table can hold, get the old backwards scan.
+// Each thread has its own table, describing the message that thread last passed to InitializeDNSMessage, since
+// dnsextd builds replies on several threads at once. A message started on one thread and finished on another
+// doesn't match the second thread's table, and so just gets the backwards scan too.
+#define CompressionTableBuckets 128     // Must be a power of two
+#define CompressionTableEntries 512
+#define CompressionMaxOffset    0x3FFF  // Largest offset that fits in a compression pointer
+
+typedef struct
+{
+    mDNSu32 hash;
+    mDNSu16 offset;
+    mDNSu16 next;                       // Index + 1 of the next entry in this bucket, or zero
+} CompressionTableEntry;
+
+typedef struct
+{
+    const DNSMessage *msg;              // The message the table describes, or NULL
+    mDNSBool overflowed;                // Some labels couldn't be recorded, so a miss in the table proves nothing
+    mDNSu16 count;
+    mDNSu16 buckets[CompressionTableBuckets];
+    CompressionTableEntry entries[CompressionTableEntries];
+} CompressionTable;
+
+#if defined(_MSC_VER)
+    #define CompressionTableThreadLocal __declspec(thread)
+#elif defined(__GNUC__)
+    #define CompressionTableThreadLocal __thread
+#elif defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L) && !defined(__STDC_NO_THREADS__)
+    #define CompressionTableThreadLocal _Thread_local
+#else
+    #define CompressionTableThreadLocal // Platforms without thread-local storage only build messages on one thread
+#endif
+
+mDNSlocal CompressionTableThreadLocal CompressionTable compressionTable;
+
+mDNSlocal void ResetCompressionTable(const DNSMessage *const msg)
+{
+    compressionTable.msg        = msg;
+    compressionTable.overflowed = mDNSfalse;
+    compressionTable.count      = 0;
+    mDNSPlatformMemZero(compressionTable.buckets, sizeof(compressionTable.buckets));
+}
+
+// Fills in hashes[i] with the hash of the name suffix starting at the i'th label, and returns the number of labels.
+// Working back from the last label means each label's bytes are only hashed once.
+mDNSlocal int HashNameSuffixes(const mDNSu8 *const name, mDNSu32 hashes[MAX_DOMAIN_NAME / 2])
+{
+    const mDNSu8 *labels[MAX_DOMAIN_NAME / 2];
+    const mDNSu8 *const max = name + MAX_DOMAIN_NAME;
+    const mDNSu8 *np = name;
+    mDNSu32 hash = 0;
+    int count = 0, i;
+
+    while (*np && np + 1 + *np < max && count < MAX_DOMAIN_NAME / 2) { labels[count++] = np; np += 1 + *np; }
+    for (i = count - 1; i >= 0; i--)
+    {
+        const mDNSu8 *p;
+        for (p = labels[i]; p <= labels[i] + *labels[i]; p++) hash = hash * 37 + *p;
+        hashes[i] = hash;
+    }
+    return(count);
+}
+
+mDNSlocal const mDNSu8 *LookupCompressionTable(const mDNSu8 *const base, const mDNSu8 *const end, const mDNSu8 *const domname,
+                                               const mDNSu32 hash)
+{
+    mDNSu16 index;
+    for (index = compressionTable.buckets[hash & (CompressionTableBuckets - 1)]; index; index = compressionTable.entries[index - 1].next)
+    {
+        const CompressionTableEntry *const entry = &compressionTable.entries[index - 1];
+        const mDNSu8 *const result = base + entry->offset;
+        if (entry->hash == hash && result + *domname + 1 <= end && CompressionTargetMatches(base, end, result, domname))
+            return(result);
+    }
+    return(mDNSNULL);
+}
+
+mDNSlocal void AddToCompressionTable(const mDNSu8 *const base, const mDNSu8 *const label, const mDNSu32 hash)
+{
+    const mDNSu32 offset = (mDNSu32)(label - base);
+    CompressionTableEntry *entry;
+    mDNSu16 *const bucket = &compressionTable.buckets[hash & (CompressionTableBuckets - 1)];
+
+    if (offset > CompressionMaxOffset) return;    // Can't be the target of a pointer anyway
+    if (compressionTable.count >= CompressionTableEntries) { compressionTable.overflowed = mDNStrue; return; }
+    entry = &compressionTable.entries[compressionTable.count++];
+    entry->hash   = hash;
+    entry->offset = (mDNSu16)offset;
+    entry->next   = *bucket;
+    *bucket       = compressionTable.count;
+}
+
+// Records the labels of the name at ptr that are written out in full, rather than reached through a compression
+// pointer, as putDomainNameWithHashes would have when it wrote them
+mDNSlocal void AddNameToCompressionTable(const DNSMessage *const msg, const mDNSu8 *ptr, const mDNSu8 *const end)
+{
+    domainname name;
+    mDNSu32 hashes[MAX_DOMAIN_NAME / 2];
+    int label, numlabels;
+
+    if (!getDomainName(msg, ptr, end, &name)) return;
+    numlabels = HashNameSuffixes(name.c, hashes);
+    for (label = 0; label < numlabels && *ptr && *ptr <= MAX_DOMAIN_LABEL; label++, ptr += 1 + *ptr)
+        AddToCompressionTable((const mDNSu8 *)msg, ptr, hashes[label]);
+}
+
+mDNSexport void AddMessageToCompressionTable(const DNSMessage *const msg, const mDNSu8 *const end)
+{
+    const mDNSu32 numRecords = (mDNSu32)msg->h.numAnswers + msg->h.numAuthorities + msg->h.numAdditionals;
+    const mDNSu8 *ptr = msg->data;
+    mDNSu32 i;
+
+    if (compressionTable.msg != msg) return;    // Not the message the table describes, so it gets the backwards scan anyway
+    for (i = 0; ptr && i < msg->h.numQuestions; i++)
+    {
+        AddNameToCompressionTable(msg, ptr, end);
+        ptr = skipQuestion(msg, ptr, end);
+    }
+    for (i = 0; ptr && i < numRecords; i++)
+    {
+        const mDNSu8 *rdata;
+        mDNSu16 rrtype, rdlength;
+
+        AddNameToCompressionTable(msg, ptr, end);
+        ptr = skipDomainName(msg, ptr, end);
+        if (!ptr || ptr + 10 > end) return;
+        rrtype   = (mDNSu16)((mDNSu16)ptr[0] << 8 | ptr[1]);
+        rdlength = (mDNSu16)((mDNSu16)ptr[8] << 8 | ptr[9]);
+        rdata    = ptr + 10;
+        if (rdata + rdlength > end) return;
+        // The rdata names later records are most likely to share, such as the instance names a browse response's
+        // PTRs point at; names in other rdata simply aren't offered as targets
+        switch (rrtype)
+        {
+        case kDNSType_NS:
+        case kDNSType_CNAME:
+        case kDNSType_PTR:
+        case kDNSType_DNAME: AddNameToCompressionTable(msg, rdata, rdata + rdlength); break;
+        case kDNSType_MX:
+        case kDNSType_AFSDB:
+        case kDNSType_RT:
+        case kDNSType_KX:    if (rdlength > 2) AddNameToCompressionTable(msg, rdata + 2, rdata + rdlength); break;
+        case kDNSType_SRV:   if (rdlength > 6) AddNameToCompressionTable(msg, rdata + 6, rdata + rdlength); break;
+        default:             break;
+        }
+        ptr = rdata + rdlength;
+    }
+}
+
+// Fills in the cached suffix hashes for one name, or sets *numlabels to zero if the name has too many labels to cache
+mDNSlocal void CacheNameSuffixes(const domainname *const name, mDNSu32 cached[RRWireCacheLabels], mDNSu8 *const numlabels)
+{
+    mDNSu32 hashes[MAX_DOMAIN_NAME / 2];
+    const int count = HashNameSuffixes(name->c, hashes);
+    if (count > RRWireCacheLabels) { *numlabels = 0; return; }
+    mDNSPlatformMemCopy(cached, hashes, count * sizeof(hashes[0]));
+    *numlabels = (mDNSu8)count;
+}
+
+// The guts of putDomainNameAsLabels. If cachedlabels is non-zero, cachedhashes holds the suffix hashes of the
+// name from the record's RRWireCache, and they're used in place of hashing the name again.
+mDNSlocal mDNSu8 *putDomainNameWithHashes(const DNSMessage *const msg, mDNSu8 *ptr, const mDNSu8 *const limit,
+                                          const domainname *const name, const mDNSu32 *const cachedhashes, const int cachedlabels)
 {
     const mDNSu8 *const base        = (const mDNSu8 *)msg;
     const mDNSu8 *      np          = name->c;
     const mDNSu8 *const max         = name->c + MAX_DOMAIN_NAME;    // Maximum that's valid
     const mDNSu8 *      pointer     = mDNSNULL;
     const mDNSu8 *const searchlimit = ptr;
+    const mDNSu8 *const tablebase   = (const mDNSu8 *)compressionTable.msg;
+    mDNSBool            tracked;
+    mDNSu32             namehashes[MAX_DOMAIN_NAME / 2];
+    const mDNSu32      *hashes      = namehashes;
+    int                 label = 0, numlabels = 0;
 
     if (!ptr) { LogMsg("putDomainNameAsLabels %##s ptr is null", name->c); return(mDNSNULL); }
 
+    // Names written without compression still go into the table if they're being written into the tracked message,
+    // since later names may point at them
+    tracked = tablebase && (base ? base == tablebase : (ptr >= tablebase && ptr < tablebase + sizeof(DNSMessage)));
+    if (tracked)
+    {
+        if (cachedlabels) { hashes = cachedhashes; numlabels = cachedlabels; }
+        else numlabels = HashNameSuffixes(np, namehashes);
+    }
+
     if (!*np)       // If just writing one-byte root label, make sure we have space for that
     {
         if (ptr >= limit) return(mDNSNULL);
@@ -1946,7 +2198,15 @@ mDNSexport mDNSu8 *putDomainNameAsLabels(const DNSMessage *const msg,
             if (np + 1 + *np >= max)
             { LogMsg("Malformed domain name %##s (more than 256 bytes)", name->c); return(mDNSNULL); }
 
-            if (base) pointer = FindCompressionPointer(base, searchlimit, np);
+            if (base)
+            {
+                if (!tracked) pointer = FindCompressionPointer(base, searchlimit, np);
+                else if (label < numlabels)
+                {
+                    pointer = LookupCompressionTable(base, searchlimit, np, hashes[label]);
+                    if (!pointer && compressionTable.overflowed) pointer = FindCompressionPointer(base, searchlimit, np);
+                }
+            }
             if (pointer)                    // Use a compression pointer if we can
             {
                 const mDNSu16 offset = (mDNSu16)(pointer - base);
@@ -1961,6 +2221,8 @@ mDNSexport mDNSu8 *putDomainNameAsLabels(const DNSMessage *const msg,
                 mDNSu8 len = *np++;
                 // If we don't at least have enough space for this label *plus* a terminating zero on the end, give up
                 if (ptr + 1 + len >= limit) return(mDNSNULL);
+                if (tracked && label < numlabels) AddToCompressionTable(tablebase, ptr, hashes[label]);
+                label++;
                 *ptr++ = len;
                 for (i=0; i<len; i++) *ptr++ = *np++;
             }
@@ -1971,6 +2233,18 @@ mDNSexport mDNSu8 *putDomainNameAsLabels(const DNSMessage *const msg,
     return(ptr);
 }
 
+// domainname is a fully-qualified name (i.e. assumed to be ending in a dot, even if it doesn't)
+// msg points to the message we're building (pass mDNSNULL if we don't want to use compression pointers)
+// end points to the end of the message so far
+// ptr points to where we want to put the name
+// limit points to one byte past the end of the buffer that we must not overrun
+// domainname is the name to put
+mDNSexport mDNSu8 *putDomainNameAsLabels(const DNSMessage *const msg,
+                                         mDNSu8 *ptr, const mDNSu8 *const limit, const domainname *const name)
+{
+    return(putDomainNameWithHashes(msg, ptr, limit, name, mDNSNULL, 0));
+}
+
 #ifndef STANDALONE
 
 mDNSlocal mDNSu8 *putVal16(mDNSu8 *ptr, mDNSu16 val)
@@ -1992,7 +2266,10 @@ mDNSlocal mDNSu8 *putVal32(mDNSu8 *ptr, mDNSu32 val)
 // Copy the RDATA information. The actual in memory storage for the data might be bigger than what the rdlength
 // says. Hence, the only way to copy out the data from a resource record is to use putRData.
 // msg points to the message we're building (pass mDNSNULL for "msg" if we don't want to use compression pointers)
-mDNSexport mDNSu8 *putRData(const DNSMessage *const msg, mDNSu8 *ptr, const mDNSu8 *const limit, const ResourceRecord *const rr)
+// The guts of putRData. targethashes and targetlabels are passed on to putDomainNameWithHashes for the name
+// GetRRDomainNameTarget() returns, if the record type has one.
+mDNSlocal mDNSu8 *putRDataWithHashes(const DNSMessage *const msg, mDNSu8 *ptr, const mDNSu8 *const limit, const ResourceRecord *const rr,
+                                     const mDNSu32 *const targethashes, const int targetlabels)
 {
     const RDataBody2 *const rdb = (RDataBody2 *)rr->rdata->u.data;
     switch (rr->rrtype)
@@ -2009,7 +2286,7 @@ mDNSexport mDNSu8 *putRData(const DNSMessage *const msg, mDNSu8 *ptr, const mDNS
     case kDNSType_NS:
     case kDNSType_CNAME:
     case kDNSType_PTR:
-    case kDNSType_DNAME: return(putDomainNameAsLabels(msg, ptr, limit, &rdb->name));
+    case kDNSType_DNAME: return(putDomainNameWithHashes(msg, ptr, limit, &rdb->name, targethashes, targetlabels));
 
     case kDNSType_SOA:  ptr = putDomainNameAsLabels(msg, ptr, limit, &rdb->soa.mname);
         if (!ptr) return(mDNSNULL);
@@ -2038,7 +2315,7 @@ mDNSexport mDNSu8 *putRData(const DNSMessage *const msg, mDNSu8 *ptr, const mDNS
     case kDNSType_RT:
     case kDNSType_KX:   if (ptr + 3 > limit) return(mDNSNULL);
         ptr = putVal16(ptr, rdb->mx.preference);
-        return(putDomainNameAsLabels(msg, ptr, limit, &rdb->mx.exchange));
+        return(putDomainNameWithHashes(msg, ptr, limit, &rdb->mx.exchange, targethashes, targetlabels));
 
     case kDNSType_RP:   ptr = putDomainNameAsLabels(msg, ptr, limit, &rdb->rp.mbox);
         if (!ptr) return(mDNSNULL);
@@ -2065,7 +2342,7 @@ mDNSexport mDNSu8 *putRData(const DNSMessage *const msg, mDNSu8 *ptr, const mDNS
         *ptr++ = (mDNSu8)(rdb->srv.weight   &  0xFF);
         *ptr++ = rdb->srv.port.b[0];
         *ptr++ = rdb->srv.port.b[1];
-        return(putDomainNameAsLabels(msg, ptr, limit, &rdb->srv.target));
+        return(putDomainNameWithHashes(msg, ptr, limit, &rdb->srv.target, targethashes, targetlabels));
 
     case kDNSType_OPT:  {
         int len = 0;
@@ -2202,10 +2479,21 @@ mDNSexport mDNSu8 *putRData(const DNSMessage *const msg, mDNSu8 *ptr, const mDNS
     }
 }
 
+mDNSexport mDNSu8 *putRData(const DNSMessage *const msg, mDNSu8 *ptr, const mDNSu8 *const limit, const ResourceRecord *const rr)
+{
+    return(putRDataWithHashes(msg, ptr, limit, rr, mDNSNULL, 0));
+}
+
 #define IsUnicastUpdate(X) (!mDNSOpaque16IsZero((X)->h.id) && ((X)->h.flags.b[0] & kDNSFlag0_OP_Mask) == kDNSFlag0_OP_Update)
 
-mDNSexport mDNSu8 *PutResourceRecordTTLWithLimit(DNSMessage *const msg, mDNSu8 *ptr, mDNSu16 *count,
-    const ResourceRecord *rr, mDNSu32 ttl, const mDNSu8 *limit)
+// Our own records are written out again for every announcement, response and goodbye, and apart from the
+// compression pointers the bytes are the same every time. The names and most rdata are already held in wire
+// format, so what's redone is working out the suffix hashes putDomainNameAsLabels looks up in the compression
+// table. If cache is non-NULL, those are computed the first time the record is written and reused after that.
+// Whoever changes the record's name or rdata must clear cache->valid; like the table itself the hashes are only
+// hints, so a stale cache costs compression, never correctness.
+mDNSexport mDNSu8 *PutResourceRecordTTLWithCache(DNSMessage *const msg, mDNSu8 *ptr, mDNSu16 *count,
+    const ResourceRecord *rr, mDNSu32 ttl, const mDNSu8 *limit, RRWireCache *const cache)
 {
     mDNSu8 *endofrdata;
     mDNSu16 actualLength;
@@ -2228,7 +2516,17 @@ mDNSexport mDNSu8 *PutResourceRecordTTLWithLimit(DNSMessage *const msg, mDNSu8 *
         return(mDNSNULL);
     }
 
-    ptr = putDomainNameAsLabels(msg, ptr, limit, rr->name);
+    if (cache && !cache->valid)
+    {
+        const domainname *const target = GetRRDomainNameTarget(rr);
+        CacheNameSuffixes(rr->name, cache->namehashes, &cache->namelabels);
+        if (target) CacheNameSuffixes(target, cache->targethashes, &cache->targetlabels);
+        else cache->targetlabels = 0;
+        cache->valid = mDNStrue;
+    }
+
+    ptr = cache ? putDomainNameWithHashes(msg, ptr, limit, rr->name, cache->namehashes, cache->namelabels) :
+                  putDomainNameAsLabels(msg, ptr, limit, rr->name);
     // If we're out-of-space, return mDNSNULL
     if (!ptr || ptr + 10 >= limit)
     {
@@ -2248,7 +2546,8 @@ mDNSexport mDNSu8 *PutResourceRecordTTLWithLimit(DNSMessage *const msg, mDNSu8 *
     ptr[7] = (mDNSu8)( ttl        &  0xFF);
     // ptr[8] and ptr[9] filled in *after* we find out how much space the rdata takes
 
-    endofrdata = putRData(rdatacompressionbase, ptr+10, limit, rr);
+    endofrdata = cache ? putRDataWithHashes(rdatacompressionbase, ptr+10, limit, rr, cache->targethashes, cache->targetlabels) :
+                         putRData(rdatacompressionbase, ptr+10, limit, rr);
     if (!endofrdata)
     {
         LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEBUG,
@@ -2277,6 +2576,12 @@ mDNSexport mDNSu8 *PutResourceRecordTTLWithLimit(DNSMessage *const msg, mDNSu8 *
     return(endofrdata);
 }
 
+mDNSexport mDNSu8 *PutResourceRecordTTLWithLimit(DNSMessage *const msg, mDNSu8 *ptr, mDNSu16 *count,
+    const ResourceRecord *rr, mDNSu32 ttl, const mDNSu8 *limit)
+{
+    return(PutResourceRecordTTLWithCache(msg, ptr, count, rr, ttl, limit, mDNSNULL));
+}
+
 mDNSlocal mDNSu8 *putEmptyResourceRecord(DNSMessage *const msg, mDNSu8 *ptr, const mDNSu8 *const limit, mDNSu16 *count, const AuthRecord *rr)
 {
     ptr = putDomainNameAsLabels(msg, ptr, limit, rr->resrec.name);
@@ -3175,6 +3480,7 @@ mDNSexport const mDNSu8 *GetLargeResourceRecord(mDNS *const m, const DNSMessage
     rr->LastCachedAnswerTime = 0;
 #endif
     rr->CRActiveQuestion  = mDNSNULL;
+    rr->KnownAnswerIndex  = KnownAnswerIndexNone;
     rr->UnansweredQueries = 0;
     rr->LastUnansweredTime= 0;
     rr->NextInCFList      = mDNSNULL;
@@ -3581,6 +3887,401 @@ mDNSexport void DumpPacket(mStatus status, mDNSBool sent, const char *transport,
     DNSMessageDumpToLog(msg, end);
 }
 
+// ***************************************************************************
+#if COMPILER_LIKES_PRAGMA_MARK
+#pragma mark -
+#pragma mark - Packet Ring
+#endif
+
+typedef struct
+{
+    mDNSs32 time;                           // m->timenow (or mDNS_TimeNow_NoLock) when recorded
+    mDNSInterfaceID InterfaceID;
+    const char *transport;                  // "UDP", "TCP" or "TLS"
+    mDNSAddr srcaddr;                       // Zero for packets we sent; filled in from the interface when dumped
+    mDNSAddr dstaddr;
+    mDNSIPPort srcport;
+    mDNSIPPort dstport;
+    mDNSu16 length;                         // Original message length
+    mDNSu16 caplen;                         // Bytes kept, at most PacketRingSnapLen
+    mDNSBool sent;
+    mDNSu8 data[PacketRingSnapLen];
+} PacketRingEntry;
+
+struct mDNSPacketRing_struct
+{
+    mDNSu32 count;                          // Number of entries
+    mDNSu32 recorded;                       // Packets recorded since the ring was created; the next one goes in recorded % count
+    PacketRingEntry entries[1];
+};
+
+mDNSexport mStatus mDNS_PacketRingInit(mDNS *const m, mDNSu32 count)
+{
+    mDNSPacketRing *ring;
+
+    if (m->PacketRing) { mDNSPlatformMemFree(m->PacketRing); m->PacketRing = mDNSNULL; }
+    if (!count) return(mStatus_NoError);
+
+    ring = (mDNSPacketRing *)mDNSPlatformMemAllocateClear(sizeof(*ring) + (count - 1) * sizeof(ring->entries[0]));
+    if (!ring) return(mStatus_NoMemoryErr);
+    ring->count = count;
+    m->PacketRing = ring;
+    return(mStatus_NoError);
+}
+
+// Note: unlike DumpPacket, this expects the message exactly as it is on the wire, header fields in network byte order
+mDNSexport void mDNS_PacketRingRecord(mDNS *const m, mDNSBool sent, const char *transport,
+    const mDNSAddr *srcaddr, mDNSIPPort srcport, const mDNSAddr *dstaddr, mDNSIPPort dstport, const mDNSu8 *const msg,
+    const mDNSu8 *const end, mDNSInterfaceID InterfaceID)
+{
+    mDNSPacketRing *const ring = m->PacketRing;
+    PacketRingEntry *entry;
+    const mDNSu32 length = (mDNSu32)(end - msg);
+
+    if (!ring) return;
+    entry = &ring->entries[ring->recorded++ % ring->count];
+    entry->time        = m->timenow ? m->timenow : mDNS_TimeNow_NoLock(m);
+    entry->InterfaceID = InterfaceID;
+    entry->transport   = transport;
+    if (srcaddr) entry->srcaddr = *srcaddr; else entry->srcaddr = zeroAddr;
+    if (dstaddr) entry->dstaddr = *dstaddr; else entry->dstaddr = zeroAddr;
+    entry->srcport     = srcport;
+    entry->dstport     = dstport;
+    entry->length      = (mDNSu16)length;
+    entry->caplen      = (mDNSu16)(length < PacketRingSnapLen ? length : PacketRingSnapLen);
+    entry->sent        = sent;
+    mDNSPlatformMemCopy(entry->data, msg, entry->caplen);
+}
+
+// pcapng block types and options. Blocks are written in host byte order, which the section header's magic records.
+#define PCAPNG_BLOCK_SHB    0x0A0D0D0A
+#define PCAPNG_BLOCK_IDB    0x00000001
+#define PCAPNG_BLOCK_EPB    0x00000006
+#define PCAPNG_OPT_END      0
+#define PCAPNG_OPT_COMMENT  1
+#define PCAPNG_OPT_IF_NAME  2
+#define PCAPNG_OPT_TSRESOL  9
+#define PCAPNG_LINKTYPE_RAW 101             // Packets start with an IPv4 or IPv6 header
+
+#define PacketRingIPHeaderSpace (40 + 8)    // Room for an IPv6 and a UDP header in front of the message
+
+mDNSlocal mDNSu8 *PutPCAPNGU16(mDNSu8 *ptr, mDNSu16 val) { mDNSPlatformMemCopy(ptr, &val, sizeof(val)); return(ptr + sizeof(val)); }
+mDNSlocal mDNSu8 *PutPCAPNGU32(mDNSu8 *ptr, mDNSu32 val) { mDNSPlatformMemCopy(ptr, &val, sizeof(val)); return(ptr + sizeof(val)); }
+
+mDNSlocal mDNSu8 *PutPCAPNGOption(mDNSu8 *ptr, mDNSu16 code, const void *value, mDNSu16 len)
+{
+    ptr = PutPCAPNGU16(ptr, code);
+    ptr = PutPCAPNGU16(ptr, len);
+    mDNSPlatformMemCopy(ptr, value, len);
+    ptr += len;
+    while (len++ % 4) *ptr++ = 0;
+    return(ptr);
+}
+
+// Fills in the block type and both copies of the total length, and hands the block to the writer
+mDNSlocal void WritePCAPNGBlock(mDNSPacketRingWriter *writer, void *context, mDNSu32 type, mDNSu8 *block, mDNSu8 *ptr)
+{
+    const mDNSu32 len = (mDNSu32)(ptr - block) + 4;
+    (void)PutPCAPNGU32(block, type);
+    (void)PutPCAPNGU32(block + 4, len);
+    (void)PutPCAPNGU32(ptr, len);
+    writer(context, block, len);
+}
+
+mDNSlocal mDNSu8 *PutIPChecksum(mDNSu8 *const hdr, mDNSu32 len, mDNSu8 *const sum)
+{
+    mDNSu32 total = 0, i;
+    for (i = 0; i + 1 < len; i += 2) total += ((mDNSu32)hdr[i] << 8) | hdr[i + 1];
+    while (total >> 16) total = (total & 0xFFFF) + (total >> 16);
+    total = ~total & 0xFFFF;
+    sum[0] = (mDNSu8)(total >> 8);
+    sum[1] = (mDNSu8)(total & 0xFF);
+    return(hdr + len);
+}
+
+// Makes up the IP and UDP headers the platform layer stripped off. Packets that went over TCP get a UDP header
+// too, which is enough for a capture tool to decode the DNS message; the real transport is in the packet comment.
+mDNSlocal mDNSu8 *PutPacketRingIPHeader(mDNSu8 *ptr, const PacketRingEntry *const entry, const mDNSAddr *src)
+{
+    const mDNSAddr *const dst = &entry->dstaddr;
+    const mDNSu32 udplen = 8 + entry->length;
+    const mDNSBool v6 = (src->type == mDNSAddrType_IPv6 || (src->type != mDNSAddrType_IPv4 && dst->type == mDNSAddrType_IPv6));
+
+    if (v6)
+    {
+        mDNSPlatformMemZero(ptr, 40);
+        ptr[0] = 0x60;
+        ptr[4] = (mDNSu8)(udplen >> 8);
+        ptr[5] = (mDNSu8)(udplen & 0xFF);
+        ptr[6] = 17;                        // UDP
+        ptr[7] = 255;
+        if (src->type == mDNSAddrType_IPv6) mDNSPlatformMemCopy(ptr +  8, &src->ip.v6, 16);
+        if (dst->type == mDNSAddrType_IPv6) mDNSPlatformMemCopy(ptr + 24, &dst->ip.v6, 16);
+        ptr += 40;
+    }
+    else
+    {
+        const mDNSu32 iplen = 20 + udplen;
+        mDNSPlatformMemZero(ptr, 20);
+        ptr[0] = 0x45;
+        ptr[2] = (mDNSu8)(iplen >> 8);
+        ptr[3] = (mDNSu8)(iplen & 0xFF);
+        ptr[8] = 255;
+        ptr[9] = 17;                        // UDP
+        if (src->type == mDNSAddrType_IPv4) mDNSPlatformMemCopy(ptr + 12, &src->ip.v4, 4);
+        if (dst->type == mDNSAddrType_IPv4) mDNSPlatformMemCopy(ptr + 16, &dst->ip.v4, 4);
+        ptr = PutIPChecksum(ptr, 20, ptr + 10);
+    }
+
+    // The UDP checksum is left zero, meaning "not computed"
+    ptr[0] = entry->srcport.b[0];
+    ptr[1] = entry->srcport.b[1];
+    ptr[2] = entry->dstport.b[0];
+    ptr[3] = entry->dstport.b[1];
+    ptr[4] = (mDNSu8)(udplen >> 8);
+    ptr[5] = (mDNSu8)(udplen & 0xFF);
+    ptr[6] = 0;
+    ptr[7] = 0;
+    return(ptr + 8);
+}
+
+// Writes the ring out, oldest packet first, as a pcapng capture with one interface block per interface seen.
+// Timestamps are in 1/1024ths of a second since 1970, worked back from the current mDNSPlatformUTC().
+mDNSexport mDNSu32 mDNS_PacketRingWritePCAP(mDNS *const m, mDNSPacketRingWriter *writer, void *context)
+{
+    mDNSPacketRing *const ring = m->PacketRing;
+    mDNSu8 block[28 + PacketRingIPHeaderSpace + PacketRingSnapLen + 64];
+    mDNSInterfaceID *interfaces;
+    mDNSu32 numInterfaces = 0, num, first, i, j;
+    mDNSu8 *ptr;
+    mDNSs32 utc, now;
+
+    if (!ring) return(0);
+
+    mDNS_Lock(m);
+    utc = mDNSPlatformUTC();
+    now = m->timenow;
+    num   = (ring->recorded < ring->count) ? ring->recorded : ring->count;
+    first = (ring->recorded < ring->count) ? 0 : ring->recorded % ring->count;
+
+    interfaces = (mDNSInterfaceID *)mDNSPlatformMemAllocate((num ? num : 1) * sizeof(interfaces[0]));
+    if (!interfaces) { mDNS_Unlock(m); return(0); }
+
+    // Section header: byte-order magic, version 1.0, section length unknown
+    ptr = block + 8;
+    ptr = PutPCAPNGU32(ptr, 0x1A2B3C4D);
+    ptr = PutPCAPNGU16(ptr, 1);
+    ptr = PutPCAPNGU16(ptr, 0);
+    ptr = PutPCAPNGU32(ptr, 0xFFFFFFFF);
+    ptr = PutPCAPNGU32(ptr, 0xFFFFFFFF);
+    WritePCAPNGBlock(writer, context, PCAPNG_BLOCK_SHB, block, ptr);
+
+    for (i = 0; i < num; i++)
+    {
+        const mDNSInterfaceID id = ring->entries[(first + i) % ring->count].InterfaceID;
+        const mDNSu8 tsresol = 0x80 | 10;   // 2^-10 seconds
+        const char *name;
+        char namebuf[32];
+
+        for (j = 0; j < numInterfaces && interfaces[j] != id; j++) continue;
+        if (j < numInterfaces) continue;
+        interfaces[numInterfaces++] = id;
+
+        name = id ? InterfaceNameForID(m, id) : "any";
+        if (!name) { mDNS_snprintf(namebuf, sizeof(namebuf), "interface %p", id); name = namebuf; }
+
+        ptr = block + 8;
+        ptr = PutPCAPNGU16(ptr, PCAPNG_LINKTYPE_RAW);
+        ptr = PutPCAPNGU16(ptr, 0);
+        ptr = PutPCAPNGU32(ptr, PacketRingIPHeaderSpace + PacketRingSnapLen);
+        ptr = PutPCAPNGOption(ptr, PCAPNG_OPT_IF_NAME, name, (mDNSu16)mDNSPlatformStrLen(name));
+        ptr = PutPCAPNGOption(ptr, PCAPNG_OPT_TSRESOL, &tsresol, 1);
+        ptr = PutPCAPNGOption(ptr, PCAPNG_OPT_END, mDNSNULL, 0);
+        WritePCAPNGBlock(writer, context, PCAPNG_BLOCK_IDB, block, ptr);
+    }
+
+    for (i = 0; i < num; i++)
+    {
+        const PacketRingEntry *const entry = &ring->entries[(first + i) % ring->count];
+        const mDNSu32 age = (mDNSu32)(now - entry->time);
+        mDNSu32 secs = (mDNSu32)utc - age / mDNSPlatformOneSecond;
+        mDNSu32 frac = (age % mDNSPlatformOneSecond) * 1024 / mDNSPlatformOneSecond;
+        const mDNSAddr *src = &entry->srcaddr;
+        mDNSu8 *pkt;
+        char comment[32];
+
+        if (frac) { secs--; frac = 1024 - frac; }
+
+        // For packets we sent, use the address of the interface they went out on
+        if (entry->sent)
+        {
+            const NetworkInterfaceInfo *intf;
+            const mDNSAddr_Type type = entry->dstaddr.type;
+            for (intf = m->HostInterfaces; intf; intf = intf->next)
+                if (intf->InterfaceID == entry->InterfaceID && intf->ip.type == type) { src = &intf->ip; break; }
+        }
+
+        for (j = 0; interfaces[j] != entry->InterfaceID; j++) continue;
+
+        ptr = block + 8;
+        ptr = PutPCAPNGU32(ptr, j);
+        ptr = PutPCAPNGU32(ptr, secs >> 22);
+        ptr = PutPCAPNGU32(ptr, (secs << 10) | frac);
+        pkt = ptr + 8;
+        ptr = PutPacketRingIPHeader(pkt, entry, src);
+        mDNSPlatformMemCopy(ptr, entry->data, entry->caplen);
+        ptr += entry->caplen;
+        (void)PutPCAPNGU32(pkt - 8, (mDNSu32)(ptr - pkt));
+        (void)PutPCAPNGU32(pkt - 4, (mDNSu32)(ptr - pkt) - entry->caplen + entry->length);
+        while ((ptr - block) % 4) *ptr++ = 0;
+        mDNS_snprintf(comment, sizeof(comment), "%s %s", entry->sent ? "Sent" : "Received", entry->transport);
+        ptr = PutPCAPNGOption(ptr, PCAPNG_OPT_COMMENT, comment, (mDNSu16)mDNSPlatformStrLen(comment));
+        ptr = PutPCAPNGOption(ptr, PCAPNG_OPT_END, mDNSNULL, 0);
+        WritePCAPNGBlock(writer, context, PCAPNG_BLOCK_EPB, block, ptr);
+    }
+
+    mDNSPlatformMemFree(interfaces);
+    mDNS_Unlock(m);
+    return(num);
+}
+
+// ***************************************************************************
+#if COMPILER_LIKES_PRAGMA_MARK
+#pragma mark -
+#pragma mark - Traffic Statistics
+#endif
+
+// Space-saving update: returns the slot for the key, 'found' if it's already tracked, otherwise a free slot or the
+// one with the smallest count, which the key takes over. The caller (re)writes the key.
+mDNSlocal mDNSTrafficStatsEntry *TrafficStatsCount(mDNSTrafficStatsTable *const t, mDNSTrafficStatsEntry *e)
+{
+    t->total++;
+    if (!e)
+    {
+        mDNSu32 i, min = 0;
+        if (t->used < TrafficStatsSlots) e = &t->slot[t->used++];
+        else
+        {
+            e = &t->slot[0];
+            for (i = 1; i < TrafficStatsSlots; i++) if (t->slot[i].count < e->count) e = &t->slot[i];
+            min = e->count;
+        }
+        mDNSPlatformMemZero(e, sizeof(*e));
+        e->count = e->error = min;
+    }
+    e->count++;
+    return(e);
+}
+
+mDNSlocal void TrafficStatsHalve(mDNSTrafficStatsTable *const t)
+{
+    mDNSu32 i;
+    t->total /= 2;
+    for (i = 0; i < t->used; i++)
+    {
+        mDNSTrafficStatsEntry *const e = &t->slot[i];
+        e->count /= 2; e->error /= 2; e->queries /= 2; e->responses /= 2; e->bytes /= 2;
+    }
+}
+
+// "_name._proto" from the label before "_tcp" or "_udp" and that label, lower-cased and NUL-padded to the full
+// length (so that types can be compared as blocks); "(other)" if there isn't one
+mDNSlocal void TrafficStatsServiceType(const domainname *const name, char type[TrafficStatsTypeLen])
+{
+    const mDNSu8 *prev = mDNSNULL, *label = name->c;
+    static const char other[] = "(other)";
+
+    mDNSPlatformMemZero(type, TrafficStatsTypeLen);
+    for (; *label && label + 1 + *label < name->c + MAX_DOMAIN_NAME; prev = label, label += 1 + *label)
+    {
+        if (prev && label[0] == 4 && label[1] == '_' && prev[0] >= 2 && prev[1] == '_' &&
+            (SameDomainLabel(label, (const mDNSu8 *)"\x4_tcp") || SameDomainLabel(label, (const mDNSu8 *)"\x4_udp")))
+        {
+            const mDNSu8 *l;
+            char *p = type;
+            for (l = prev; l <= label; l += 1 + *l)
+            {
+                int i;
+                if (l != prev && p < type + TrafficStatsTypeLen - 1) *p++ = '.';
+                for (i = 1; i <= *l && p < type + TrafficStatsTypeLen - 1; i++)
+                {
+                    const mDNSu8 c = l[i];
+                    *p++ = (c >= 'A' && c <= 'Z') ? (char)(c + 'a' - 'A') : (c > ' ' && c < 0x7F) ? (char)c : '?';
+                }
+            }
+            return;
+        }
+    }
+    mDNSPlatformMemCopy(type, other, sizeof(other));
+}
+
+// Called for each multicast DNS packet received, with the header counts already in host byte order
+mDNSexport void mDNS_TrafficStatsRecord(mDNS *const m, const DNSMessage *const msg, const mDNSu8 *const end, const mDNSAddr *const srcaddr)
+{
+    mDNSTrafficStats *const s = &m->TrafficStats;
+    const mDNSBool query = !(msg->h.flags.b[0] & kDNSFlag0_QR_Response);
+    const mDNSu8 *ptr = msg->data;
+    mDNSTrafficStatsEntry *e = mDNSNULL;
+    mDNSu32 i, n;
+
+    if (!s->NextDecay) s->NextDecay = NonZeroTime(m->timenow + TrafficStatsDecayInterval);
+    else if (m->timenow - s->NextDecay >= 0)
+    {
+        TrafficStatsHalve(&s->types);
+        TrafficStatsHalve(&s->sources);
+        s->decays++;
+        s->NextDecay = NonZeroTime(m->timenow + TrafficStatsDecayInterval);
+    }
+
+    for (i = 0; i < s->sources.used; i++) if (mDNSSameAddress(&s->sources.slot[i].key.addr, srcaddr)) { e = &s->sources.slot[i]; break; }
+    e = TrafficStatsCount(&s->sources, e);
+    e->key.addr = *srcaddr;
+    if (query) e->queries++; else e->responses++;
+    e->bytes += (mDNSu32)(end - (const mDNSu8 *)msg);
+
+    // The names asked about in a query, or answered in a response; known answers and additionals aren't counted
+    if (!query)
+        for (i = 0; i < msg->h.numQuestions && ptr; i++) ptr = skipQuestion(msg, ptr, end);
+    n = query ? msg->h.numQuestions : msg->h.numAnswers;
+    for (i = 0; i < n && i < TrafficStatsMaxNames && ptr; i++)
+    {
+        domainname name;
+        char type[TrafficStatsTypeLen];
+        mDNSu32 j;
+
+        ptr = getDomainName(msg, ptr, end, &name);
+        if (!ptr) break;
+        if (query) ptr = (ptr + 4 <= end) ? ptr + 4 : mDNSNULL;
+        else       ptr = (ptr + 10 <= end) ? ptr + 10 + ((mDNSu16)ptr[8] << 8 | ptr[9]) : mDNSNULL;
+        if (!ptr || ptr > end) break;
+
+        TrafficStatsServiceType(&name, type);
+        e = mDNSNULL;
+        for (j = 0; j < s->types.used; j++)
+            if (mDNSPlatformMemSame(s->types.slot[j].key.type, type, TrafficStatsTypeLen)) { e = &s->types.slot[j]; break; }
+        e = TrafficStatsCount(&s->types, e);
+        mDNSPlatformMemCopy(e->key.type, type, TrafficStatsTypeLen);
+        if (query) e->queries++; else e->responses++;
+    }
+}
+
+mDNSexport void mDNS_TrafficStatsReset(mDNS *const m)
+{
+    mDNSPlatformMemZero(&m->TrafficStats, sizeof(m->TrafficStats));
+}
+
+mDNSexport mDNSu32 mDNS_TrafficStatsSorted(const mDNSTrafficStatsTable *const t, const mDNSTrafficStatsEntry *sorted[TrafficStatsSlots])
+{
+    mDNSu32 i, j;
+    for (i = 0; i < t->used; i++)
+    {
+        const mDNSTrafficStatsEntry *const e = &t->slot[i];
+        for (j = i; j > 0 && sorted[j - 1]->count < e->count; j--) sorted[j] = sorted[j - 1];
+        sorted[j] = e;
+    }
+    return(t->used);
+}
+
 // ***************************************************************************
 #if COMPILER_LIKES_PRAGMA_MARK
 #pragma mark -
@@ -3592,6 +4293,17 @@ struct TCPSocket_struct { mDNSIPPort port; TCPSocketFlags flags; /* ... */ };
 // Stub definition of UDPSocket_struct so we can access port field. (Rest of UDPSocket_struct is platform-dependent.)
 struct UDPSocket_struct { mDNSIPPort     port;  /* ... */ };
 
+mDNSexport void mDNSCountInterfaceTraffic(mDNSInterfaceTraffic *t, const DNSMessage *msg, const mDNSu8 *end)
+{
+    mDNSTrafficKind kind = mDNSTrafficKind_Query;
+    if (msg->h.flags.b[0] & kDNSFlag0_QR_Mask)
+        kind = mDNSTrafficKind_Response;
+    else if ((msg->h.flags.b[0] & kDNSFlag0_OP_Mask) == kDNSFlag0_OP_StdQuery && msg->h.numAuthorities)
+        kind = mDNSTrafficKind_Probe;
+    t->packets[kind]++;
+    t->bytes[kind] += (mDNSu32)(end - (const mDNSu8 *)msg);
+}
+
 // Note: When we sign a DNS message using DNSDigest_SignMessage(), the current real-time clock value is used, which
 // is why we generally defer signing until we send the message, to ensure the signature is as fresh as possible.
 mDNSexport mStatus mDNSSendDNSMessage(mDNS *const m, DNSMessage *const msg, mDNSu8 *end,
@@ -3616,6 +4328,18 @@ mDNSexport mStatus mDNSSendDNSMessage(mDNS *const m, DNSMessage *const msg, mDNS
         return mStatus_BadParamErr;
     }
 
+    if (InterfaceID)
+    {
+        NetworkInterfaceInfo *intf = m->HostInterfaces;
+        while (intf && intf->InterfaceID != InterfaceID) intf = intf->next;
+        if (intf)
+        {
+            intf->PacketsSent++;
+            mDNSCountInterfaceTraffic(&intf->TrafficOut, msg, end);
+            if (mDNSOpaque16IsZero(msg->h.id)) intf->McastRateCount++;
+        }
+    }
+
     // Put all the integer values in IETF byte-order (MSB first, LSB second)
     SwapDNSHeaderBytes(msg);
 
@@ -3669,6 +4393,14 @@ mDNSexport mStatus mDNSSendDNSMessage(mDNS *const m, DNSMessage *const msg, mDNS
         }
     }
 
+    // Record the packet as it went on the wire, before the header is swapped back
+    if (m->PacketRing && end)
+    {
+        const char *const transport = !tcpSrc ? "UDP" : tcpSrc->flags ? "TLS" : "TCP";
+        const mDNSIPPort srcport = tcpSrc ? tcpSrc->port : udpSrc ? udpSrc->port : MulticastDNSPort;
+        mDNS_PacketRingRecord(m, mDNStrue, transport, mDNSNULL, srcport, dst, dstport, (const mDNSu8 *)msg, end, InterfaceID);
+    }
+
     // Swap the integer values back the way they were (remember that numAdditionals may have been changed by putHINFO and/or SignMessage)
     SwapDNSHeaderBytes(msg);
 
@@ -3720,6 +4452,11 @@ mDNSexport void mDNS_Lock_(mDNS *const m, const char * const functionname)
             LogMsg("%s: mDNS_Lock: m->timenow already set (%ld/%ld)", functionname, m->timenow, mDNS_TimeNow_NoLock(m));
         m->timenow = mDNS_TimeNow_NoLock(m);
         if (m->timenow == 0) m->timenow = 1;
+        if (m->ExecuteProfiling)
+        {
+            m->ExecuteProfile.LockTaken   = mDNSPlatformRawTime();
+            m->ExecuteProfile.LockTakenBy = functionname;
+        }
     }
     else if (m->timenow == 0)
     {
@@ -3748,13 +4485,44 @@ mDNSlocal AuthRecord *AnyLocalRecordReady(const mDNS *const m)
     return mDNSNULL;
 }
 
+// Deadlines that fall within this long after the earliest one are merged into a single wakeup (see GetNextScheduledEvent)
+#ifndef mDNSSchedulingCoalesceWindow
+#define mDNSSchedulingCoalesceWindow (mDNSPlatformOneSecond / 100)
+#endif
+
+// Deferrable maintenance (cache expiry and reconfirmation, NAT mapping refreshes, uDNS tasks such as LLQ refreshes,
+// SRV updates, and cache table resizing) that isn't due yet is put off to the next multiple of mDNSMaintenanceTick,
+// so timers that were set independently of each other share wakeups. Being tied to the clock rather than to when
+// the deadline was set, the tick it moves to doesn't change as the deadline gets closer.
+#ifndef mDNSMaintenanceTick
+#define mDNSMaintenanceTick (mDNSPlatformOneSecond / 4)
+#endif
+
+typedef struct
+{
+    mDNSs32 due;        // When to handle it, given the choice (a deferrable deadline's tick)
+    mDNSs32 latest;     // When it must be handled by
+} ScheduledDeadline;
+
+#define ScheduleEvent(T) do { const mDNSs32 t_ = (T); \
+    deadlines[numdeadlines].due = t_; deadlines[numdeadlines++].latest = t_ + mDNSSchedulingCoalesceWindow; \
+    if (e - t_ > 0) e = t_; } while (0)
+#define ScheduleDeferrable(T) do { const mDNSs32 t_ = (T); \
+    deadlines[numdeadlines].due = t_ + (mDNSs32)((mDNSMaintenanceTick - (mDNSu32)t_ % mDNSMaintenanceTick) % mDNSMaintenanceTick); \
+    deadlines[numdeadlines].latest = deadlines[numdeadlines].due; numdeadlines++; \
+    if (e - t_ > 0) e = t_; } while (0)
+
 mDNSlocal mDNSs32 GetNextScheduledEvent(const mDNS *const m)
 {
     mDNSs32 e = m->timenow + FutureTime;
+    ScheduledDeadline deadlines[20];
+    mDNSu32 numdeadlines = 0, i;
+    mDNSs32 latest, wake;
+
     if (m->mDNSPlatformStatus != mStatus_NoError) return(e);
     if (m->NewQuestions)
     {
-        if (m->NewQuestions->DelayAnswering) e = m->NewQuestions->DelayAnswering;
+        if (m->NewQuestions->DelayAnswering) ScheduleEvent(m->NewQuestions->DelayAnswering);
         else return(m->timenow);
     }
     if (m->NewLocalOnlyQuestions) return(m->timenow);
@@ -3764,38 +4532,50 @@ mDNSlocal mDNSs32 GetNextScheduledEvent(const mDNS *const m)
     if (m->LocalRemoveEvents) return(m->timenow);
 
 #ifndef UNICAST_DISABLED
-    if (e - m->NextuDNSEvent         > 0) e = m->NextuDNSEvent;
-    if (e - m->NextScheduledNATOp    > 0) e = m->NextScheduledNATOp;
-    if (m->NextSRVUpdate && e - m->NextSRVUpdate > 0) e = m->NextSRVUpdate;
+    ScheduleDeferrable(m->NextuDNSEvent);
+    ScheduleDeferrable(m->NextScheduledNATOp);
+    if (m->NextSRVUpdate) ScheduleDeferrable(m->NextSRVUpdate);
 #endif
 
-    if (e - m->NextCacheCheck        > 0) e = m->NextCacheCheck;
-    if (e - m->NextScheduledSPS      > 0) e = m->NextScheduledSPS;
-    if (e - m->NextScheduledKA       > 0) e = m->NextScheduledKA;
+    ScheduleDeferrable(m->NextCacheCheck);
+    if (m->NextCacheResize) ScheduleDeferrable(m->NextCacheResize);
+    if (m->NextCacheShrink) ScheduleDeferrable(m->NextCacheShrink);
+    ScheduleEvent(m->NextScheduledSPS);
+    ScheduleEvent(m->NextScheduledKA);
 
 #if MDNSRESPONDER_SUPPORTS(APPLE, BONJOUR_ON_DEMAND)
-    if (m->NextBonjourDisableTime && (e - m->NextBonjourDisableTime > 0)) e = m->NextBonjourDisableTime;
+    if (m->NextBonjourDisableTime) ScheduleEvent(m->NextBonjourDisableTime);
 #endif
 
     // NextScheduledSPRetry only valid when DelaySleep not set
-    if (!m->DelaySleep && m->SleepLimit && e - m->NextScheduledSPRetry > 0) e = m->NextScheduledSPRetry;
-    if (m->DelaySleep && e - m->DelaySleep > 0) e = m->DelaySleep;
+    if (!m->DelaySleep && m->SleepLimit) ScheduleEvent(m->NextScheduledSPRetry);
+    if (m->DelaySleep) ScheduleEvent(m->DelaySleep);
 
     if (m->SuppressSending)
     {
-        if (e - m->SuppressSending       > 0) e = m->SuppressSending;
+        ScheduleEvent(m->SuppressSending);
     }
     else
     {
-        if (e - m->NextScheduledQuery    > 0) e = m->NextScheduledQuery;
-        if (e - m->NextScheduledProbe    > 0) e = m->NextScheduledProbe;
-        if (e - m->NextScheduledResponse > 0) e = m->NextScheduledResponse;
+        ScheduleEvent(m->NextScheduledQuery);
+        ScheduleEvent(m->NextScheduledProbe);
+        ScheduleEvent(m->NextScheduledResponse);
     }
-    if (e - m->NextScheduledStopTime > 0) e = m->NextScheduledStopTime;
-
-    if (m->NextBLEServiceTime && (e - m->NextBLEServiceTime > 0)) e = m->NextBLEServiceTime;
-
-    return(e);
+    ScheduleEvent(m->NextScheduledStopTime);
+
+    if (m->NextBLEServiceTime) ScheduleEvent(m->NextBLEServiceTime);
+
+    // Work that is already due is never deferred. Otherwise, rather than waking at e and then again a little later
+    // for the next deadline, wake once at the last deadline that can be reached without making any deadline late;
+    // mDNS_Execute handles everything that has come due by the time it runs.
+    if (e - m->timenow <= 0) return(e);
+    latest = deadlines[0].latest;
+    for (i = 1; i < numdeadlines; i++)
+        if (deadlines[i].latest - latest < 0) latest = deadlines[i].latest;
+    wake = e;
+    for (i = 0; i < numdeadlines; i++)
+        if (deadlines[i].due - wake > 0 && deadlines[i].due - latest <= 0) wake = deadlines[i].due;
+    return(wake);
 }
 
 #define LogTSE TSE++,LogMsg
@@ -3841,6 +4621,10 @@ mDNSexport void ShowTaskSchedulingError(mDNS *const m)
 
     if (m->timenow - m->NextCacheCheck        >= 0)
         LogTSE("Task Scheduling Error: m->NextCacheCheck %d",        m->timenow - m->NextCacheCheck);
+    if (m->NextCacheResize && m->timenow - m->NextCacheResize >= 0)
+        LogTSE("Task Scheduling Error: m->NextCacheResize %d",       m->timenow - m->NextCacheResize);
+    if (m->NextCacheShrink && m->timenow - m->NextCacheShrink >= 0)
+        LogTSE("Task Scheduling Error: m->NextCacheShrink %d",       m->timenow - m->NextCacheShrink);
     if (m->timenow - m->NextScheduledSPS      >= 0)
         LogTSE("Task Scheduling Error: m->NextScheduledSPS %d",      m->timenow - m->NextScheduledSPS);
     if (m->timenow - m->NextScheduledKA       >= 0)
@@ -3870,9 +4654,76 @@ mDNSexport void ShowTaskSchedulingError(mDNS *const m)
     if (!TSE) LogMsg("Task Scheduling Error: *** No likely causes identified");
     else LogMsg("Task Scheduling Error: *** %d potential cause%s identified (significant only if the same cause consistently appears)", TSE, TSE > 1 ? "s" : "");
 
+    // If we're profiling mDNS_Execute, the phase histograms show which part of it has been taking the time
+    if (m->ExecuteProfiling) LogExecuteProfile(m);
+
     mDNS_Unlock(m);
 }
 
+mDNSexport const char *const ExecutePhaseNames[ExecutePhase_Count] =
+{
+    "CacheCheck", "SPS", "NewQuestions", "LocalEvents", "SendQueries", "SendResponses", "Unicast"
+};
+
+mDNSexport mDNSu32 ExecuteHistogramBucket(mDNSs32 ticks)
+{
+    mDNSu32 bucket = 0;
+    while (ticks > 0 && bucket < ExecuteHistogramBuckets - 1) { ticks >>= 1; bucket++; }
+    return(bucket);
+}
+
+// Returns the bucket holding the given percentile of the samples in an mDNSExecuteProfile histogram
+mDNSlocal int ExecuteHistogramPercentile(const mDNSu32 *const hist, const mDNSu32 percent, const mDNSu32 total)
+{
+    const mDNSu32 target = (total / 100) * percent + ((total % 100) * percent + 99) / 100;
+    mDNSu32 seen = 0;
+    int b;
+    for (b = 0; b < ExecuteHistogramBuckets - 1; b++)
+    {
+        seen += hist[b];
+        if (seen >= target) break;
+    }
+    return(b);
+}
+
+// Appends "name p50/p99/max" for one histogram, each figure being the upper bound in ms of the bucket it fell in
+mDNSlocal char *PutExecuteHistogramSummary(char *ptr, const char *const end, const char *const name, const mDNSu32 *const hist)
+{
+    const int Percentiles[3] = { 50, 99, 100 };
+    mDNSu32 total = 0;
+    int b, i;
+
+    for (b = 0; b < ExecuteHistogramBuckets; b++) total += hist[b];
+    if (!total) return(ptr);
+    ptr += mDNS_snprintf(ptr, (mDNSu32)(end - ptr), " %s", name);
+    for (i = 0; i < 3; i++)
+    {
+        b = ExecuteHistogramPercentile(hist, Percentiles[i], total);
+        if (b == ExecuteHistogramBuckets - 1)
+            ptr += mDNS_snprintf(ptr, (mDNSu32)(end - ptr), "%s>%d", i ? "/" : " ", ((1 << (b - 1)) * 1000) / mDNSPlatformOneSecond);
+        else
+            ptr += mDNS_snprintf(ptr, (mDNSu32)(end - ptr), "%s<%d", i ? "/" : " ", ((1 << b) * 1000 + mDNSPlatformOneSecond - 1) / mDNSPlatformOneSecond);
+    }
+    return(ptr);
+}
+
+mDNSexport void LogExecuteProfile(mDNS *const m)
+{
+    char buffer[MaxMsg];
+    char *ptr = buffer;
+    int phase;
+
+    buffer[0] = 0;
+    ptr = PutExecuteHistogramSummary(ptr, buffer + sizeof(buffer), "Late", m->ExecuteProfile.Lateness);
+    for (phase = 0; phase < ExecutePhase_Count; phase++)
+        ptr = PutExecuteHistogramSummary(ptr, buffer + sizeof(buffer), ExecutePhaseNames[phase], m->ExecuteProfile.Duration[phase]);
+    ptr = PutExecuteHistogramSummary(ptr, buffer + sizeof(buffer), "Lock", m->ExecuteProfile.LockHold);
+    LogMsg("mDNS_Execute profile (ms, p50/p99/max):%s", buffer);
+    if (m->ExecuteProfile.LockHoldLongestBy)
+        LogMsg("mDNS lock: longest hold %ld ms, taken by %s",
+               (m->ExecuteProfile.LockHoldLongest * 1000) / mDNSPlatformOneSecond, m->ExecuteProfile.LockHoldLongestBy);
+}
+
 mDNSexport void mDNS_Unlock_(mDNS *const m, const char *const functionname)
 {
     // Decrement mDNS_busy
@@ -3888,12 +4739,237 @@ mDNSexport void mDNS_Unlock_(mDNS *const m, const char *const functionname)
         m->NextScheduledEvent = GetNextScheduledEvent(m);
         if (m->timenow == 0) LogMsg("%s: mDNS_Unlock: ERROR! m->timenow aready zero", functionname);
         m->timenow = 0;
+        // Profiling may have been switched on while the lock was held, in which case there's no start time for this hold
+        if (m->ExecuteProfiling && m->ExecuteProfile.LockTakenBy)
+        {
+            const mDNSs32 held = mDNSPlatformRawTime() - m->ExecuteProfile.LockTaken;
+            m->ExecuteProfile.LockHold[ExecuteHistogramBucket(held)]++;
+            if (!m->ExecuteProfile.LockHoldLongestBy || held > m->ExecuteProfile.LockHoldLongest)
+            {
+                m->ExecuteProfile.LockHoldLongest   = held;
+                m->ExecuteProfile.LockHoldLongestBy = m->ExecuteProfile.LockTakenBy;
+            }
+            m->ExecuteProfile.LockTakenBy = mDNSNULL;
+        }
     }
 
     // MUST release the platform lock LAST!
     mDNSPlatformUnlock(m);
 }
 
+// ***************************************************************************
+#if COMPILER_LIKES_PRAGMA_MARK
+#pragma mark -
+#pragma mark - Base 64 and Base 32 Encoding
+#endif
+
+// The decoders look each character up once in a 256-entry table instead of searching the alphabet for it, and the
+// encoders convert whole groups (three bytes to four characters, five to eight) without branching, leaving only the
+// last partial group to be padded.
+
+#define kBaseNInvalid   0xFF
+#define kBaseNSpace     0xFE
+#define kBaseNPad       0xFD
+
+static const char Base64Alphabet[]    = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static const char Base32HexAlphabet[] = "0123456789ABCDEFGHIJKLMNOPQRSTUV";
+
+// Value of each character: its position in the alphabet, or one of the kBaseN codes above
+static const mDNSu8 Base64Values[256] =
+{
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFE, 0xFE, 0xFE, 0xFE, 0xFE, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFE, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF, 0xFF, 0x3F,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0xFD, 0xFF, 0xFF,
+    0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+    0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+// Base 32 hex is case-insensitive (NSEC3 owner names are usually in lower case)
+static const mDNSu8 Base32HexValues[256] =
+{
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFE, 0xFE, 0xFE, 0xFE, 0xFE, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFE, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xFF, 0xFF, 0xFF, 0xFD, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18,
+    0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18,
+    0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+mDNSexport mDNSs32 mDNSBase64Encode(const mDNSu8 *data, mDNSu32 len, char *buf, mDNSu32 buflen)
+{
+    const mDNSu8 *const end = data + len;
+    char *p = buf;
+
+    if (len > 0xBFFFFFF0 || buflen < mDNSBase64EncodedLength(len) + 1) return(-1);
+    for (; end - data >= 3; data += 3, p += 4)
+    {
+        const mDNSu32 q = ((mDNSu32)data[0] << 16) | ((mDNSu32)data[1] << 8) | data[2];
+        p[0] = Base64Alphabet[ q >> 18        ];
+        p[1] = Base64Alphabet[(q >> 12) & 0x3F];
+        p[2] = Base64Alphabet[(q >>  6) & 0x3F];
+        p[3] = Base64Alphabet[ q        & 0x3F];
+    }
+    if (data < end)
+    {
+        const mDNSu32 q = ((mDNSu32)data[0] << 16) | ((end - data > 1) ? (mDNSu32)data[1] << 8 : 0);
+        p[0] = Base64Alphabet[ q >> 18        ];
+        p[1] = Base64Alphabet[(q >> 12) & 0x3F];
+        p[2] = (end - data > 1) ? Base64Alphabet[(q >> 6) & 0x3F] : '=';
+        p[3] = '=';
+        p += 4;
+    }
+    *p = 0;
+    return((mDNSs32)(p - buf));
+}
+
+mDNSlocal void Base32HexEncodeGroup(const mDNSu8 d[5], char p[8])
+{
+    p[0] = Base32HexAlphabet[  d[0] >> 3                          ];
+    p[1] = Base32HexAlphabet[((d[0] & 0x07) << 2) | (d[1] >> 6)   ];
+    p[2] = Base32HexAlphabet[ (d[1] >> 1) & 0x1F                  ];
+    p[3] = Base32HexAlphabet[((d[1] & 0x01) << 4) | (d[2] >> 4)   ];
+    p[4] = Base32HexAlphabet[((d[2] & 0x0F) << 1) | (d[3] >> 7)   ];
+    p[5] = Base32HexAlphabet[ (d[3] >> 2) & 0x1F                  ];
+    p[6] = Base32HexAlphabet[((d[3] & 0x03) << 3) | (d[4] >> 5)   ];
+    p[7] = Base32HexAlphabet[  d[4] & 0x1F                        ];
+}
+
+mDNSexport mDNSs32 mDNSBase32HexEncode(const mDNSu8 *data, mDNSu32 len, char *buf, mDNSu32 buflen)
+{
+    // Number of characters carrying data for each length of the last partial group
+    static const mDNSu8 tailChars[5] = { 0, 2, 4, 5, 7 };
+    const mDNSu8 *const end = data + len;
+    char *p = buf;
+
+    if (len > 0x9FFFFFF0 || buflen < mDNSBase32HexEncodedLength(len) + 1) return(-1);
+    for (; end - data >= 5; data += 5, p += 8) Base32HexEncodeGroup(data, p);
+    if (data < end)
+    {
+        const int n = (int)(end - data);
+        mDNSu8 last[5] = { 0, 0, 0, 0, 0 };
+        int i;
+        mDNSPlatformMemCopy(last, data, (mDNSu32)n);
+        Base32HexEncodeGroup(last, p);
+        for (i = tailChars[n]; i < 8; i++) p[i] = '=';
+        p += 8;
+    }
+    *p = 0;
+    return((mDNSs32)(p - buf));
+}
+
+mDNSlocal mDNSBool BaseNWholeGroup(const mDNSu8 *s, const mDNSu8 *values, mDNSu32 group)
+{
+    mDNSu32 i;
+    for (i = 0; i < group; i++) if (values[s[i]] >= 64) return(mDNSfalse);
+    return(mDNStrue);
+}
+
+// Four base 64 characters to three bytes, or eight base 32 characters (as two halves of 20 bits) to five
+mDNSlocal void BaseNDecodeGroup(const mDNSu8 *s, const mDNSu8 *values, int bits, mDNSu8 *out)
+{
+    const mDNSu32 hi = ((mDNSu32)values[s[0]] << (3 * bits)) | ((mDNSu32)values[s[1]] << (2 * bits)) |
+                       ((mDNSu32)values[s[2]] << bits) | values[s[3]];
+    if (bits == 6)
+    {
+        out[0] = (mDNSu8)(hi >> 16); out[1] = (mDNSu8)(hi >> 8); out[2] = (mDNSu8)hi;
+    }
+    else
+    {
+        const mDNSu32 lo = ((mDNSu32)values[s[4]] << 15) | ((mDNSu32)values[s[5]] << 10) | ((mDNSu32)values[s[6]] << 5) | values[s[7]];
+        out[0] = (mDNSu8)(hi >> 12); out[1] = (mDNSu8)(hi >> 4); out[2] = (mDNSu8)((hi << 4) | (lo >> 16));
+        out[3] = (mDNSu8)(lo >> 8);  out[4] = (mDNSu8)lo;
+    }
+}
+
+// Decodes characters of 'bits' bits each, in groups of 'group' characters (padded at the end with '=' for base 64,
+// optionally for base 32). The padding must be exactly what completes the last group, and the bits left over
+// after the last whole byte must be zero, so that each byte string has only one accepted encoding.
+mDNSlocal mDNSs32 BaseNDecode(const char *src, mDNSu8 *target, mDNSu32 targsize, const mDNSu8 *values,
+                              int bits, mDNSu32 group, mDNSBool padRequired)
+{
+    const mDNSu8 *s = (const mDNSu8 *)src;
+    mDNSu32 acc = 0, n = 0, chars = 0, pads = 0;
+    int have = 0;
+
+    for (; *s; s++)
+    {
+        const mDNSu8 v = values[*s];
+        // A whole group on a byte boundary, the usual case, goes straight to bytes. The terminating NUL isn't in the
+        // alphabet, so the checks stop at it before reading past the end of the string.
+        if (have == 0 && !pads && BaseNWholeGroup(s, values, group))
+        {
+            const mDNSu32 bytes = group * bits / 8;
+            if (target)
+            {
+                if (n + bytes > targsize) return(-1);
+                BaseNDecodeGroup(s, values, bits, &target[n]);
+            }
+            n += bytes;
+            chars += group;
+            s += group - 1;
+            continue;
+        }
+        if (v < 64)
+        {
+            if (pads) return(-1);         // Data after the padding
+            acc = (acc << bits) | v;
+            have += bits;
+            chars++;
+            if (have >= 8)
+            {
+                have -= 8;
+                if (target)
+                {
+                    if (n >= targsize) return(-1);
+                    target[n] = (mDNSu8)(acc >> have);
+                }
+                n++;
+                acc &= (1U << have) - 1;
+            }
+        }
+        else if (v == kBaseNPad) pads++;
+        else if (v != kBaseNSpace) return(-1);
+    }
+
+    if (have >= bits || acc) return(-1);  // A character with no whole byte in it, or stray bits
+    if (pads || padRequired)
+    {
+        if (pads != (group - chars % group) % group) return(-1);
+    }
+    return((mDNSs32)n);
+}
+
+mDNSexport mDNSs32 mDNSBase64Decode(const char *src, mDNSu8 *target, mDNSu32 targsize)
+{
+    return(BaseNDecode(src, target, targsize, Base64Values, 6, 4, mDNStrue));
+}
+
+mDNSexport mDNSs32 mDNSBase32HexDecode(const char *src, mDNSu8 *target, mDNSu32 targsize)
+{
+    return(BaseNDecode(src, target, targsize, Base32HexValues, 5, 8, mDNSfalse));
+}
+
 // ***************************************************************************
 #if COMPILER_LIKES_PRAGMA_MARK
 #pragma mark -
@@ -204,6 +204,10 @@ extern mStatus DNSNameToLowerCase(domainname *d, domainname *result);
 #endif
 
 extern void InitializeDNSMessage(DNSMessageHeader *h, mDNSOpaque16 id, mDNSOpaque16 flags);
+// For a message just passed to InitializeDNSMessage that keeps the questions and records already at its start (as
+// SendResponses keeps the answers built for the previous interface), with its counts set to cover them. Tells the
+// compression table about the names in them, so that names written after them can still point back into them.
+extern void AddMessageToCompressionTable(const DNSMessage *const msg, const mDNSu8 *const end);
 extern const mDNSu8 *FindCompressionPointer(const mDNSu8 *const base, const mDNSu8 *const end, const mDNSu8 *const domname);
 extern mDNSu8 *putDomainNameAsLabels(const DNSMessage *const msg, mDNSu8 *ptr, const mDNSu8 *const limit, const domainname *const name);
 extern mDNSu8 *putRData(const DNSMessage *const msg, mDNSu8 *ptr, const mDNSu8 *const limit, const ResourceRecord *const rr);
@@ -215,6 +219,8 @@ extern mDNSu8 *putRData(const DNSMessage *const msg, mDNSu8 *ptr, const mDNSu8 *
 
 extern mDNSu8 *PutResourceRecordTTLWithLimit(DNSMessage *const msg, mDNSu8 *ptr, mDNSu16 *count, const ResourceRecord *rr,
     mDNSu32 ttl, const mDNSu8 *limit);
+extern mDNSu8 *PutResourceRecordTTLWithCache(DNSMessage *const msg, mDNSu8 *ptr, mDNSu16 *count, const ResourceRecord *rr,
+    mDNSu32 ttl, const mDNSu8 *limit, RRWireCache *const cache);
 
 #define PutResourceRecordTTL(msg, ptr, count, rr, ttl) \
     PutResourceRecordTTLWithLimit((msg), (ptr), (count), (rr), (ttl), (msg)->data + AllowedRRSpace(msg))
@@ -231,6 +237,17 @@ extern mDNSu8 *PutResourceRecordTTLWithLimit(DNSMessage *const msg, mDNSu8 *ptr,
 
 #define PutRR_OS(P, C, RR) PutRR_OS_TTL((P), (C), (RR), (RR)->rroriginalttl)
 
+// The PutAR variants take an AuthRecord rather than a ResourceRecord, and reuse the record's WireCache
+#define PutAuthRecordTTL(msg, ptr, count, ar, ttl) \
+    PutResourceRecordTTLWithCache((msg), (ptr), (count), &(ar)->resrec, (ttl), (msg)->data + AllowedRRSpace(msg), &(ar)->WireCache)
+
+#define PutAuthRecord(MSG, P, C, AR) PutAuthRecordTTL((MSG), (P), (C), (AR), (AR)->resrec.rroriginalttl)
+
+#define PutAR_OS_TTL(ptr, count, ar, ttl) \
+    PutResourceRecordTTLWithCache(&m->omsg, (ptr), (count), &(ar)->resrec, (ttl), m->omsg.data + AllowedRRSpace(&m->omsg) - OwnerRecordSpace - TraceRecordSpace, &(ar)->WireCache)
+
+#define PutAR_OS(P, C, AR) PutAR_OS_TTL((P), (C), (AR), (AR)->resrec.rroriginalttl)
+
 extern mDNSu8 *putQuestion(DNSMessage *const msg, mDNSu8 *ptr, const mDNSu8 *const limit, const domainname *const name, mDNSu16 rrtype, mDNSu16 rrclass);
 extern mDNSu8 *putZone(DNSMessage *const msg, mDNSu8 *ptr, mDNSu8 *limit, const domainname *zone, mDNSOpaque16 zoneClass);
 extern mDNSu8 *putPrereqNameNotInUse(const domainname *const name, DNSMessage *const msg, mDNSu8 *const ptr, mDNSu8 *const end);
@@ -241,7 +258,17 @@ extern mDNSu8 *putDeleteAllRRSets(DNSMessage *msg, mDNSu8 *ptr, const domainname
 extern mDNSu8 *putUpdateLease(DNSMessage *msg, mDNSu8 *ptr, mDNSu32 lease);
 extern mDNSu8 *putUpdateLeaseWithLimit(DNSMessage *msg, mDNSu8 *ptr, mDNSu32 lease, mDNSu8 *limit);
 
-extern int baseEncode(char *buffer, int blen, const mDNSu8 *data, int len, int encAlg);
+// Base 64 (RFC 4648 section 4) and base 32 with the extended hex alphabet (section 7), as used in TSIG keys and
+// DNSSEC records. The encoders write the padded, NUL-terminated text and return its length, or -1 if buflen (which
+// must allow for the NUL) is too small. The decoders skip white space, and return the number of bytes decoded, or -1
+// if the text is malformed or doesn't fit in targsize bytes; target may be NULL to just check the text. Base 32 hex
+// is decoded in either case, with its padding optional.
+#define mDNSBase64EncodedLength(N)      (((N) + 2) / 3 * 4)
+#define mDNSBase32HexEncodedLength(N)   (((N) + 4) / 5 * 8)
+extern mDNSs32 mDNSBase64Encode(const mDNSu8 *data, mDNSu32 len, char *buf, mDNSu32 buflen);
+extern mDNSs32 mDNSBase32HexEncode(const mDNSu8 *data, mDNSu32 len, char *buf, mDNSu32 buflen);
+extern mDNSs32 mDNSBase64Decode(const char *src, mDNSu8 *target, mDNSu32 targsize);
+extern mDNSs32 mDNSBase32HexDecode(const char *src, mDNSu8 *target, mDNSu32 targsize);
 extern void NSEC3Parse(const ResourceRecord *const rr, mDNSu8 **salt, int *hashLength, mDNSu8 **nxtName, int *bitmaplen, mDNSu8 **bitmap);
 
 // ***************************************************************************
@@ -250,7 +277,7 @@ extern void NSEC3Parse(const ResourceRecord *const rr, mDNSu8 **salt, int *hashL
 #pragma mark - DNS Message Parsing Functions
 #endif
 
-#define HashSlotFromNameHash(X) ((X) % CACHE_HASH_SLOTS)
+#define HashSlotFromNameHash(M, X) CacheHashSlot((M), (X))
 extern mDNSu32 DomainNameHashValue(const domainname *const name);
 extern void SetNewRData(ResourceRecord *const rr, RData *NewRData, mDNSu16 rdlength);
 extern const mDNSu8 *skipDomainName(const DNSMessage *const msg, const mDNSu8 *ptr, const mDNSu8 *const end);
@@ -273,6 +300,10 @@ extern mDNSBool GetPktLease(mDNS *const m, const DNSMessage *const msg, const mD
 extern void DumpPacket(mStatus status, mDNSBool sent, const char *transport, const mDNSAddr *srcaddr, mDNSIPPort srcport,
     const mDNSAddr *dstaddr, mDNSIPPort dstport, const DNSMessage *const msg, const mDNSu8 *const end,
     mDNSInterfaceID interfaceID);
+extern void mDNS_PacketRingRecord(mDNS *const m, mDNSBool sent, const char *transport, const mDNSAddr *srcaddr,
+    mDNSIPPort srcport, const mDNSAddr *dstaddr, mDNSIPPort dstport, const mDNSu8 *const msg, const mDNSu8 *const end,
+    mDNSInterfaceID InterfaceID);
+extern void mDNS_TrafficStatsRecord(mDNS *const m, const DNSMessage *const msg, const mDNSu8 *const end, const mDNSAddr *const srcaddr);
 extern mDNSBool RRAssertsNonexistence(const ResourceRecord *const rr, mDNSu16 type);
 extern mDNSBool RRAssertsExistence(const ResourceRecord *const rr, mDNSu16 type);
 extern mDNSBool BitmapTypeCheck(mDNSu8 *bmap, int bitmaplen, mDNSu16 type);
@@ -290,6 +321,8 @@ extern mDNSBool GetReverseIPv6Addr(const domainname *inQName, mDNSu8 outIPv6[16]
 extern mStatus mDNSSendDNSMessage(mDNS *const m, DNSMessage *const msg, mDNSu8 *end,
                                   mDNSInterfaceID InterfaceID, TCPSocket *tcpSrc, UDPSocket *udpSrc, const mDNSAddr *dst,
                                   mDNSIPPort dstport, DomainAuthInfo *authInfo, mDNSBool useBackgroundTrafficClass);
+// Counts one message (header in host byte order, as it is just before sending and just after receiving) against t
+extern void mDNSCountInterfaceTraffic(mDNSInterfaceTraffic *t, const DNSMessage *msg, const mDNSu8 *end);
 
 // ***************************************************************************
 #if COMPILER_LIKES_PRAGMA_MARK
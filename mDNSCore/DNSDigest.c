@@ -657,7 +657,7 @@ void md5_block_data_order (MD5_CTX *c, const void *p,int num);
 int HASH_UPDATE (HASH_CTX *c, const void *data_, unsigned long len)
 {
     const unsigned char *data=(const unsigned char *)data_;
-    const unsigned char * const data_end=(const unsigned char *)data_;
+    const unsigned char * const data_end=(const unsigned char *)data_ + len;
     register HASH_LONG * p;
     register unsigned long l;
     int sw,sc,ew,ec;
@@ -1138,148 +1138,297 @@ void md5_block_data_order (MD5_CTX *c, const void *data_, int num)
 }
 #endif
 
-
 // ***************************************************************************
 #if COMPILER_LIKES_PRAGMA_MARK
-#pragma mark - base64 -> binary conversion
+#pragma mark - SHA-256
 #endif
 
-static const char Base64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-static const char Pad64 = '=';
+// FIPS 180-4 SHA-256, used for hmac-sha256 TSIG (RFC 4635).
+// The block function uses the SHA instructions where the CPU has them (x86 SHA extensions, checked at run time,
+// or ARMv8 Crypto when the compiler targets it) and falls back to the portable C rounds otherwise.
 
+#define SHA256_CBLOCK 64
 
-#define mDNSisspace(x) (x == '\t' || x == '\n' || x == '\v' || x == '\f' || x == '\r' || x == ' ')
+typedef struct
+{
+    mDNSu32 h[8];
+    mDNSu32 Nl, Nh;                             // message length so far in bytes, low and high words
+    mDNSu8  data[SHA256_CBLOCK];
+    mDNSu32 num;                                // bytes waiting in data
+} sha256_ctx;
 
-mDNSlocal const char *mDNSstrchr(const char *s, int c)
+static const mDNSu32 sha256_K[64] =
 {
-    while (1)
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define SHA256_BE32(p) ((mDNSu32)(p)[0] << 24 | (mDNSu32)(p)[1] << 16 | (mDNSu32)(p)[2] << 8 | (mDNSu32)(p)[3])
+
+mDNSlocal void sha256_block_c(mDNSu32 state[8], const mDNSu8 *data, mDNSu32 num)
+{
+    mDNSu32 W[16];
+    mDNSu32 a, b, c, d, e, f, g, h, t1, t2;
+    int i;
+
+    while (num--)
     {
-        if (c == *s) return s;
-        if (!*s) return mDNSNULL;
-        s++;
+        a = state[0]; b = state[1]; c = state[2]; d = state[3];
+        e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+        for (i = 0; i < 64; i++)
+        {
+            if (i < 16)
+                W[i] = SHA256_BE32(data + 4 * i);
+            else
+            {
+                const mDNSu32 w15 = W[(i + 1) & 15], w2 = W[(i + 14) & 15];
+                W[i & 15] += (SHA256_ROTR(w15, 7) ^ SHA256_ROTR(w15, 18) ^ (w15 >> 3)) + W[(i + 9) & 15] +
+                             (SHA256_ROTR(w2, 17) ^ SHA256_ROTR(w2, 19) ^ (w2 >> 10));
+            }
+            t1 = h + (SHA256_ROTR(e, 6) ^ SHA256_ROTR(e, 11) ^ SHA256_ROTR(e, 25)) + ((e & f) ^ (~e & g)) + sha256_K[i] + W[i & 15];
+            t2 = (SHA256_ROTR(a, 2) ^ SHA256_ROTR(a, 13) ^ SHA256_ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+        data += SHA256_CBLOCK;
     }
 }
 
-// skips all whitespace anywhere.
-// converts characters, four at a time, starting at (or after)
-// src from base - 64 numbers into three 8 bit bytes in the target area.
-// it returns the number of data bytes stored at the target, or -1 on error.
-// adapted from BIND sources
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(DNSDIGEST_NO_SHA_INSTRUCTIONS)
+#define SHA256_X86_SHA 1
+#include <immintrin.h>
+#include <cpuid.h>
 
-mDNSlocal mDNSs32 DNSDigest_Base64ToBin(const char *src, mDNSu8 *target, mDNSu32 targsize)
+// Four rounds per pass: rnds2 takes the state as ABEF/CDGH halves and two rounds of W+K in the low quadword.
+// msg1/msg2 extend the schedule four words at a time, so only W[i..i+15] is ever live in MSG0-MSG3.
+__attribute__((target("sha,sse4.1"))) mDNSlocal void sha256_block_x86(mDNSu32 state[8], const mDNSu8 *data, mDNSu32 num)
 {
-    int tarindex, state, ch;
-    const char *pos;
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    __m128i STATE0, STATE1, MSG, TMP, MSG0, MSG1, MSG2, MSG3, ABEF_SAVE, CDGH_SAVE;
+    int i;
 
-    state = 0;
-    tarindex = 0;
+    TMP    = _mm_loadu_si128((const __m128i *)&state[0]);
+    STATE1 = _mm_loadu_si128((const __m128i *)&state[4]);
+    TMP    = _mm_shuffle_epi32(TMP, 0xB1);              // CDAB
+    STATE1 = _mm_shuffle_epi32(STATE1, 0x1B);           // EFGH
+    STATE0 = _mm_alignr_epi8(TMP, STATE1, 8);           // ABEF
+    STATE1 = _mm_blend_epi16(STATE1, TMP, 0xF0);        // CDGH
 
-    while ((ch = *src++) != '\0') {
-        if (mDNSisspace(ch))    /* Skip whitespace anywhere. */
-            continue;
+    while (num--)
+    {
+        ABEF_SAVE = STATE0;
+        CDGH_SAVE = STATE1;
 
-        if (ch == Pad64)
-            break;
+        MSG0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data +  0)), MASK);
+        MSG1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16)), MASK);
+        MSG2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 32)), MASK);
+        MSG3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 48)), MASK);
 
-        pos = mDNSstrchr(Base64, ch);
-        if (pos == 0)       /* A non-base64 character. */
-            return (-1);
+        for (i = 0; i < 16; i++)
+        {
+            MSG    = _mm_add_epi32(MSG0, _mm_loadu_si128((const __m128i *)&sha256_K[4 * i]));
+            STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);
+            MSG    = _mm_shuffle_epi32(MSG, 0x0E);
+            STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
 
-        switch (state) {
-        case 0:
-            if (target) {
-                if ((mDNSu32)tarindex >= targsize)
-                    return (-1);
-                target[tarindex] = (mDNSu8)((pos - Base64) << 2);
-            }
-            state = 1;
-            break;
-        case 1:
-            if (target) {
-                if ((mDNSu32)tarindex + 1 >= targsize)
-                    return (-1);
-                target[tarindex]   |=  (pos - Base64) >> 4;
-                target[tarindex+1]  = (mDNSu8)(((pos - Base64) & 0x0f) << 4);
-            }
-            tarindex++;
-            state = 2;
-            break;
-        case 2:
-            if (target) {
-                if ((mDNSu32)tarindex + 1 >= targsize)
-                    return (-1);
-                target[tarindex]   |=  (pos - Base64) >> 2;
-                target[tarindex+1]  = (mDNSu8)(((pos - Base64) & 0x03) << 6);
-            }
-            tarindex++;
-            state = 3;
-            break;
-        case 3:
-            if (target) {
-                if ((mDNSu32)tarindex >= targsize)
-                    return (-1);
-                target[tarindex] |= (pos - Base64);
+            TMP = MSG0;
+            if (i < 12)
+            {
+                TMP = _mm_sha256msg1_epu32(MSG0, MSG1);
+                TMP = _mm_add_epi32(TMP, _mm_alignr_epi8(MSG3, MSG2, 4));
+                TMP = _mm_sha256msg2_epu32(TMP, MSG3);
             }
-            tarindex++;
-            state = 0;
-            break;
-        default:
-            return -1;
+            MSG0 = MSG1; MSG1 = MSG2; MSG2 = MSG3; MSG3 = TMP;
         }
+
+        STATE0 = _mm_add_epi32(STATE0, ABEF_SAVE);
+        STATE1 = _mm_add_epi32(STATE1, CDGH_SAVE);
+        data += SHA256_CBLOCK;
     }
 
-    /*
-     * We are done decoding Base-64 chars.  Let's see if we ended
-     * on a byte boundary, and/or with erroneous trailing characters.
-     */
+    TMP    = _mm_shuffle_epi32(STATE0, 0x1B);           // FEBA
+    STATE1 = _mm_shuffle_epi32(STATE1, 0xB1);           // DCHG
+    STATE0 = _mm_blend_epi16(TMP, STATE1, 0xF0);        // DCBA
+    STATE1 = _mm_alignr_epi8(STATE1, TMP, 8);           // HGFE
+
+    _mm_storeu_si128((__m128i *)&state[0], STATE0);
+    _mm_storeu_si128((__m128i *)&state[4], STATE1);
+}
+
+mDNSlocal mDNSBool sha256_x86_supported(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return(mDNSfalse);
+    if (!(ecx & bit_SSSE3) || !(ecx & bit_SSE4_1)) return(mDNSfalse);
+    if (__get_cpuid_max(0, mDNSNULL) < 7) return(mDNSfalse);
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return((ebx & (1U << 29)) != 0);                    // CPUID.(EAX=7,ECX=0):EBX.SHA
+}
+
+#elif defined(__aarch64__) && (defined(__ARM_FEATURE_SHA2) || defined(__ARM_FEATURE_CRYPTO)) && !defined(DNSDIGEST_NO_SHA_INSTRUCTIONS)
+#define SHA256_ARM_SHA 1
+#include <arm_neon.h>
+
+// Four rounds per pass: sha256h/sha256h2 update the ABCD/EFGH halves from W+K, and su0/su1 extend the schedule.
+mDNSlocal void sha256_block_arm(mDNSu32 state[8], const mDNSu8 *data, mDNSu32 num)
+{
+    uint32x4_t STATE0, STATE1, ABCD_SAVE, EFGH_SAVE, MSG0, MSG1, MSG2, MSG3, WK, TMP;
+    int i;
+
+    STATE0 = vld1q_u32(&state[0]);
+    STATE1 = vld1q_u32(&state[4]);
+
+    while (num--)
+    {
+        ABCD_SAVE = STATE0;
+        EFGH_SAVE = STATE1;
+
+        MSG0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data +  0)));
+        MSG1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16)));
+        MSG2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 32)));
+        MSG3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 48)));
+
+        for (i = 0; i < 16; i++)
+        {
+            WK     = vaddq_u32(MSG0, vld1q_u32(&sha256_K[4 * i]));
+            TMP    = STATE0;
+            STATE0 = vsha256hq_u32(STATE0, STATE1, WK);
+            STATE1 = vsha256h2q_u32(STATE1, TMP, WK);
+
+            TMP = MSG0;
+            if (i < 12)
+                TMP = vsha256su1q_u32(vsha256su0q_u32(MSG0, MSG1), MSG2, MSG3);
+            MSG0 = MSG1; MSG1 = MSG2; MSG2 = MSG3; MSG3 = TMP;
+        }
+
+        STATE0 = vaddq_u32(STATE0, ABCD_SAVE);
+        STATE1 = vaddq_u32(STATE1, EFGH_SAVE);
+        data += SHA256_CBLOCK;
+    }
 
-    if (ch == Pad64) {      /* We got a pad char. */
-        ch = *src++;        /* Skip it, get next. */
-        switch (state) {
-        case 0:     /* Invalid = in first position */
-        case 1:     /* Invalid = in second position */
-            return (-1);
-
-        case 2:     /* Valid, means one byte of info */
-            /* Skip any number of spaces. */
-            for ((void)mDNSNULL; ch != '\0'; ch = *src++)
-                if (!mDNSisspace(ch))
-                    break;
-            /* Make sure there is another trailing = sign. */
-            if (ch != Pad64)
-                return (-1);
-            ch = *src++;        /* Skip the = */
-        /* Fall through to "single trailing =" case. */
-        /* FALLTHROUGH */
-
-        case 3:     /* Valid, means two bytes of info */
-            /*
-             * We know this char is an =.  Is there anything but
-             * whitespace after it?
-             */
-            for ((void)mDNSNULL; ch != '\0'; ch = *src++)
-                if (!mDNSisspace(ch))
-                    return (-1);
-
-            /*
-             * Now make sure for cases 2 and 3 that the "extra"
-             * bits that slopped past the last full byte were
-             * zeros.  If we don't check them, they become a
-             * subliminal channel.
-             */
-            if (target && target[tarindex] != 0)
-                return (-1);
+    vst1q_u32(&state[0], STATE0);
+    vst1q_u32(&state[4], STATE1);
+}
+#endif
+
+mDNSlocal void sha256_block_data_order(mDNSu32 state[8], const mDNSu8 *data, mDNSu32 num)
+{
+#if SHA256_X86_SHA
+    static int have_sha = -1;
+    if (have_sha < 0) have_sha = sha256_x86_supported();
+    if (have_sha) sha256_block_x86(state, data, num);
+    else          sha256_block_c(state, data, num);
+#elif SHA256_ARM_SHA
+    sha256_block_arm(state, data, num);
+#else
+    sha256_block_c(state, data, num);
+#endif
+}
+
+mDNSlocal void sha256_init(sha256_ctx *c)
+{
+    static const mDNSu32 H0[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    mDNSPlatformMemCopy(c->h, H0, sizeof(H0));
+    c->Nl = c->Nh = 0;
+    c->num = 0;
+}
+
+mDNSlocal void sha256_update(sha256_ctx *c, const void *data_, mDNSu32 len)
+{
+    const mDNSu8 *data = (const mDNSu8 *)data_;
+    mDNSu32 n;
+
+    if (c->Nl + len < c->Nl) c->Nh++;
+    c->Nl += len;
+
+    if (c->num)
+    {
+        n = SHA256_CBLOCK - c->num;
+        if (len < n)
+        {
+            mDNSPlatformMemCopy(c->data + c->num, data, len);
+            c->num += len;
+            return;
         }
-    } else {
-        /*
-         * We ended by seeing the end of the string.  Make sure we
-         * have no partial bytes lying around.
-         */
-        if (state != 0)
-            return (-1);
+        mDNSPlatformMemCopy(c->data + c->num, data, n);
+        sha256_block_data_order(c->h, c->data, 1);
+        data += n;
+        len  -= n;
+        c->num = 0;
+    }
+
+    n = len / SHA256_CBLOCK;
+    if (n)
+    {
+        sha256_block_data_order(c->h, data, n);
+        data += n * SHA256_CBLOCK;
+        len  -= n * SHA256_CBLOCK;
+    }
+
+    if (len)
+    {
+        mDNSPlatformMemCopy(c->data, data, len);
+        c->num = len;
+    }
+}
+
+mDNSlocal void sha256_final(mDNSu8 *md, sha256_ctx *c)
+{
+    const mDNSu32 hi = (c->Nh << 3) | (c->Nl >> 29), lo = c->Nl << 3;
+    int i;
+
+    c->data[c->num++] = 0x80;
+    if (c->num > SHA256_CBLOCK - 8)
+    {
+        mDNSPlatformMemZero(c->data + c->num, SHA256_CBLOCK - c->num);
+        sha256_block_data_order(c->h, c->data, 1);
+        c->num = 0;
+    }
+    mDNSPlatformMemZero(c->data + c->num, SHA256_CBLOCK - 8 - c->num);
+    for (i = 0; i < 4; i++)
+    {
+        c->data[SHA256_CBLOCK - 8 + i] = (mDNSu8)(hi >> (24 - 8 * i));
+        c->data[SHA256_CBLOCK - 4 + i] = (mDNSu8)(lo >> (24 - 8 * i));
     }
+    sha256_block_data_order(c->h, c->data, 1);
 
-    return (tarindex);
+    for (i = 0; i < 8; i++)
+    {
+        md[4 * i + 0] = (mDNSu8)(c->h[i] >> 24);
+        md[4 * i + 1] = (mDNSu8)(c->h[i] >> 16);
+        md[4 * i + 2] = (mDNSu8)(c->h[i] >>  8);
+        md[4 * i + 3] = (mDNSu8)(c->h[i]      );
+    }
+    mDNSPlatformMemZero(c, sizeof(*c));
+}
+
+
+
+// ***************************************************************************
+#if COMPILER_LIKES_PRAGMA_MARK
+#pragma mark - String Utilities
+#endif
+
+mDNSlocal const char *mDNSstrchr(const char *s, int c)
+{
+    while (1)
+    {
+        if (c == *s) return s;
+        if (!*s) return mDNSNULL;
+        s++;
+    }
 }
 
 
@@ -1292,47 +1441,200 @@ mDNSlocal mDNSs32 DNSDigest_Base64ToBin(const char *src, mDNSu8 *target, mDNSu32
 #define HMAC_IPAD   0x36
 #define HMAC_OPAD   0x5c
 #define MD5_LEN     16
+#define SHA256_LEN  32
+#define HMAC_MAX_DIGEST_LEN SHA256_LEN
+
+#define HMAC_MD5_AlgName    "\010" "hmac-md5" "\007" "sig-alg" "\003" "reg" "\003" "int"
+#define HMAC_SHA256_AlgName "\013" "hmac-sha256"
+
+// A running HMAC. Both hashes have a 64 byte block, so the key ^ pad blocks are compressed once when the key is
+// set up (DNSDigest_ConstructHMACKey) and each message resumes from the saved chaining state instead of hashing them again.
+typedef struct
+{
+    mDNSu8 algorithm;
+    union
+    {
+        MD5_CTX    md5;
+        sha256_ctx sha256;
+    } u;
+} hmac_ctx;
 
-#define HMAC_MD5_AlgName "\010" "hmac-md5" "\007" "sig-alg" "\003" "reg" "\003" "int"
+mDNSlocal mDNSu32 hmac_digest_len(mDNSu8 algorithm)
+{
+    return((algorithm == TSIG_HMAC_SHA256) ? SHA256_LEN : MD5_LEN);
+}
+
+mDNSlocal const mDNSu8 *hmac_alg_name(mDNSu8 algorithm)
+{
+    return((const mDNSu8 *)((algorithm == TSIG_HMAC_SHA256) ? HMAC_SHA256_AlgName : HMAC_MD5_AlgName));
+}
+
+mDNSlocal void hmac_hash(mDNSu8 algorithm, const mDNSu8 *data, mDNSu32 len, mDNSu8 *digest)
+{
+    if (algorithm == TSIG_HMAC_SHA256)
+    {
+        sha256_ctx c;
+        sha256_init(&c);
+        sha256_update(&c, data, len);
+        sha256_final(digest, &c);
+    }
+    else
+    {
+        MD5_CTX c;
+        MD5_Init(&c);
+        MD5_Update(&c, data, len);
+        MD5_Final(digest, &c);
+    }
+}
+
+// Compress one HMAC_LEN pad block and save the resulting chaining state
+mDNSlocal void hmac_pad_state(mDNSu8 algorithm, const mDNSu8 *pad, mDNSu32 state[8])
+{
+    if (algorithm == TSIG_HMAC_SHA256)
+    {
+        sha256_ctx c;
+        sha256_init(&c);
+        sha256_block_data_order(c.h, pad, 1);
+        mDNSPlatformMemCopy(state, c.h, sizeof(c.h));
+    }
+    else
+    {
+        MD5_CTX c;
+        MD5_Init(&c);
+        MD5_Update(&c, pad, HMAC_LEN);
+        state[0] = c.A; state[1] = c.B; state[2] = c.C; state[3] = c.D;
+        state[4] = state[5] = state[6] = state[7] = 0;
+    }
+}
+
+// Start a hash as if the pad block behind state has already been digested
+mDNSlocal void hmac_resume(hmac_ctx *c, mDNSu8 algorithm, const mDNSu32 state[8])
+{
+    c->algorithm = algorithm;
+    if (algorithm == TSIG_HMAC_SHA256)
+    {
+        mDNSPlatformMemCopy(c->u.sha256.h, state, sizeof(c->u.sha256.h));
+        c->u.sha256.Nl  = HMAC_LEN;
+        c->u.sha256.Nh  = 0;
+        c->u.sha256.num = 0;
+    }
+    else
+    {
+        MD5_Init(&c->u.md5);
+        c->u.md5.A  = state[0];
+        c->u.md5.B  = state[1];
+        c->u.md5.C  = state[2];
+        c->u.md5.D  = state[3];
+        c->u.md5.Nl = HMAC_LEN << 3;
+    }
+}
+
+mDNSlocal void hmac_update(hmac_ctx *c, const void *data, mDNSu32 len)
+{
+    if (c->algorithm == TSIG_HMAC_SHA256) sha256_update(&c->u.sha256, data, len);
+    else                                  MD5_Update(&c->u.md5, data, len);
+}
+
+mDNSlocal void hmac_start(hmac_ctx *c, const DomainAuthInfo *info)
+{
+    hmac_resume(c, info->algorithm, info->hmac_istate);
+}
+
+// Finish the inner hash, run the outer one over it and return the digest length
+mDNSlocal mDNSu32 hmac_finish(hmac_ctx *c, const DomainAuthInfo *info, mDNSu8 *digest)
+{
+    const mDNSu32 len = hmac_digest_len(c->algorithm);
+
+    if (c->algorithm == TSIG_HMAC_SHA256) sha256_final(digest, &c->u.sha256);
+    else                                  MD5_Final(digest, &c->u.md5);
+
+    hmac_resume(c, info->algorithm, info->hmac_ostate);
+    hmac_update(c, digest, len);
+
+    if (c->algorithm == TSIG_HMAC_SHA256) sha256_final(digest, &c->u.sha256);
+    else                                  MD5_Final(digest, &c->u.md5);
+
+    return(len);
+}
 
 // Adapted from Appendix, RFC 2104
-mDNSlocal void DNSDigest_ConstructHMACKey(DomainAuthInfo *info, const mDNSu8 *key, mDNSu32 len)
+mDNSlocal void DNSDigest_ConstructHMACKey(DomainAuthInfo *info, mDNSu8 algorithm, const mDNSu8 *key, mDNSu32 len)
 {
-    MD5_CTX k;
-    mDNSu8 buf[MD5_LEN];
+    mDNSu8 buf[HMAC_MAX_DIGEST_LEN];
+    mDNSu8 ipad[HMAC_LEN];
+    mDNSu8 opad[HMAC_LEN];
     int i;
 
-    // If key is longer than HMAC_LEN reset it to MD5(key)
+    // If key is longer than HMAC_LEN reset it to H(key)
     if (len > HMAC_LEN)
     {
-        MD5_Init(&k);
-        MD5_Update(&k, key, len);
-        MD5_Final(buf, &k);
+        hmac_hash(algorithm, key, len, buf);
         key = buf;
-        len = MD5_LEN;
+        len = hmac_digest_len(algorithm);
     }
 
     // store key in pads
-    mDNSPlatformMemZero(info->keydata_ipad, HMAC_LEN);
-    mDNSPlatformMemZero(info->keydata_opad, HMAC_LEN);
-    mDNSPlatformMemCopy(info->keydata_ipad, key, len);
-    mDNSPlatformMemCopy(info->keydata_opad, key, len);
+    mDNSPlatformMemZero(ipad, HMAC_LEN);
+    mDNSPlatformMemZero(opad, HMAC_LEN);
+    mDNSPlatformMemCopy(ipad, key, len);
+    mDNSPlatformMemCopy(opad, key, len);
 
     // XOR key with ipad and opad values
     for (i = 0; i < HMAC_LEN; i++)
     {
-        info->keydata_ipad[i] ^= HMAC_IPAD;
-        info->keydata_opad[i] ^= HMAC_OPAD;
+        ipad[i] ^= HMAC_IPAD;
+        opad[i] ^= HMAC_OPAD;
     }
 
+    // Only the chaining state after each pad block is kept, the key itself isn't
+    info->algorithm = algorithm;
+    hmac_pad_state(algorithm, ipad, info->hmac_istate);
+    hmac_pad_state(algorithm, opad, info->hmac_ostate);
+
+    mDNSPlatformMemZero(ipad, HMAC_LEN);
+    mDNSPlatformMemZero(opad, HMAC_LEN);
+    mDNSPlatformMemZero(buf, sizeof(buf));
+}
+
+// Returns the length of an "hmac-sha256:" or "hmac-md5:" prefix on b64key (setting *algorithm), 0 if there is
+// none, or -1 for an algorithm we don't know
+mDNSlocal mDNSs32 DNSDigest_ParseAlgorithmPrefix(const char *b64key, mDNSu8 *algorithm)
+{
+    static const struct { const char *name; mDNSu8 algorithm; } algs[] =
+    {
+        { "hmac-sha256", TSIG_HMAC_SHA256 },
+        { "hmac-md5",    TSIG_HMAC_MD5    }
+    };
+    const char *colon = mDNSstrchr(b64key, ':');
+    unsigned int i;
+
+    *algorithm = TSIG_HMAC_MD5;
+    if (!colon) return(0);          // ':' isn't in the base64 alphabet, so no colon means no prefix
+
+    for (i = 0; i < sizeof(algs) / sizeof(algs[0]); i++)
+    {
+        const char *a = algs[i].name, *k = b64key;
+        while (*a && k < colon && (*k == *a || (*a >= 'a' && *a <= 'z' && *k == *a - 'a' + 'A'))) { a++; k++; }
+        if (!*a && k == colon)
+        {
+            *algorithm = algs[i].algorithm;
+            return((mDNSs32)(colon + 1 - b64key));
+        }
+    }
+    return(-1);
 }
 
 mDNSexport mDNSs32 DNSDigest_ConstructHMACKeyfromBase64(DomainAuthInfo *info, const char *b64key)
 {
     mDNSu8 keybuf[1024];
-    mDNSs32 keylen = DNSDigest_Base64ToBin(b64key, keybuf, sizeof(keybuf));
+    mDNSu8 algorithm;
+    mDNSs32 keylen;
+    mDNSs32 skip = DNSDigest_ParseAlgorithmPrefix(b64key, &algorithm);
+    if (skip < 0) { LogMsg("ERROR: DNSDigest_ConstructHMACKeyfromBase64 - unsupported TSIG algorithm"); return(-1); }
+    keylen = mDNSBase64Decode(b64key + skip, keybuf, sizeof(keybuf));
     if (keylen < 0) return(keylen);
-    DNSDigest_ConstructHMACKey(info, keybuf, (mDNSu32)keylen);
+    DNSDigest_ConstructHMACKey(info, algorithm, keybuf, (mDNSu32)keylen);
+    mDNSPlatformMemZero(keybuf, (mDNSu32)keylen);
     return(keylen);
 }
 
@@ -1342,39 +1644,40 @@ mDNSexport void DNSDigest_SignMessage(DNSMessage *msg, mDNSu8 **end, DomainAuthI
     mDNSu8  *rdata, *const countPtr = (mDNSu8 *)&msg->h.numAdditionals; // Get existing numAdditionals value
     mDNSu32 utc32;
     mDNSu8 utc48[6];
-    mDNSu8 digest[MD5_LEN];
+    mDNSu8 digest[HMAC_MAX_DIGEST_LEN];
     mDNSu8 *ptr = *end;
     mDNSu32 len;
+    mDNSu32 digestlen;
     mDNSOpaque16 buf;
-    MD5_CTX c;
+    hmac_ctx c;
+    const mDNSu8 *const algname = hmac_alg_name(info->algorithm);
     mDNSu16 numAdditionals = (mDNSu16)((mDNSu16)countPtr[0] << 8 | countPtr[1]);
 
-    // Init MD5 context, digest inner key pad and message
-    MD5_Init(&c);
-    MD5_Update(&c, info->keydata_ipad, HMAC_LEN);
-    MD5_Update(&c, (mDNSu8 *)msg, (unsigned long)(*end - (mDNSu8 *)msg));
+    // Init HMAC context (inner key pad is already digested) and digest message
+    hmac_start(&c, info);
+    hmac_update(&c, (mDNSu8 *)msg, (mDNSu32)(*end - (mDNSu8 *)msg));
 
     // Construct TSIG RR, digesting variables as apporpriate
     mDNS_SetupResourceRecord(&tsig, mDNSNULL, 0, kDNSType_TSIG, 0, kDNSRecordTypeKnownUnique, AuthRecordAny, mDNSNULL, mDNSNULL);
 
     // key name
     AssignDomainName(&tsig.namestorage, &info->keyname);
-    MD5_Update(&c, info->keyname.c, DomainNameLength(&info->keyname));
+    hmac_update(&c, info->keyname.c, DomainNameLength(&info->keyname));
 
     // class
     tsig.resrec.rrclass = kDNSQClass_ANY;
     buf = mDNSOpaque16fromIntVal(kDNSQClass_ANY);
-    MD5_Update(&c, buf.b, sizeof(mDNSOpaque16));
+    hmac_update(&c, buf.b, sizeof(mDNSOpaque16));
 
     // ttl
     tsig.resrec.rroriginalttl = 0;
-    MD5_Update(&c, (mDNSu8 *)&tsig.resrec.rroriginalttl, sizeof(tsig.resrec.rroriginalttl));
+    hmac_update(&c, (mDNSu8 *)&tsig.resrec.rroriginalttl, sizeof(tsig.resrec.rroriginalttl));
 
     // alg name
-    AssignConstStringDomainName(&tsig.resrec.rdata->u.name, HMAC_MD5_AlgName);
-    len = DomainNameLengthLimit((domainname *)HMAC_MD5_AlgName, (mDNSu8 *)HMAC_MD5_AlgName + sizeof HMAC_MD5_AlgName);
+    AssignDomainName(&tsig.resrec.rdata->u.name, (const domainname *)algname);
+    len = DomainNameLength((const domainname *)algname);
     rdata = tsig.resrec.rdata->u.data + len;
-    MD5_Update(&c, (mDNSu8 *)HMAC_MD5_AlgName, len);
+    hmac_update(&c, algname, len);
 
     // time
     // get UTC (universal time), convert to 48-bit unsigned in network byte order
@@ -1389,36 +1692,30 @@ mDNSexport void DNSDigest_SignMessage(DNSMessage *msg, mDNSu8 **end, DomainAuthI
 
     mDNSPlatformMemCopy(rdata, utc48, 6);
     rdata += 6;
-    MD5_Update(&c, utc48, 6);
+    hmac_update(&c, utc48, 6);
 
     // 300 sec is fudge recommended in RFC 2485
     rdata[0] = (mDNSu8)((300 >> 8)  & 0xff);
     rdata[1] = (mDNSu8)( 300        & 0xff);
-    MD5_Update(&c, rdata, sizeof(mDNSOpaque16));
+    hmac_update(&c, rdata, sizeof(mDNSOpaque16));
     rdata += sizeof(mDNSOpaque16);
 
     // digest error (tcode) and other data len (zero) - we'll add them to the rdata later
     buf.b[0] = (mDNSu8)((tcode >> 8) & 0xff);
     buf.b[1] = (mDNSu8)( tcode       & 0xff);
-    MD5_Update(&c, buf.b, sizeof(mDNSOpaque16));  // error
+    hmac_update(&c, buf.b, sizeof(mDNSOpaque16));  // error
     buf.NotAnInteger = 0;
-    MD5_Update(&c, buf.b, sizeof(mDNSOpaque16));  // other data len
+    hmac_update(&c, buf.b, sizeof(mDNSOpaque16));  // other data len
 
-    // finish the message & tsig var hash
-    MD5_Final(digest, &c);
-
-    // perform outer MD5 (outer key pad, inner digest)
-    MD5_Init(&c);
-    MD5_Update(&c, info->keydata_opad, HMAC_LEN);
-    MD5_Update(&c, digest, MD5_LEN);
-    MD5_Final(digest, &c);
+    // finish the message & tsig var hash, then the outer hash (outer key pad, inner digest)
+    digestlen = hmac_finish(&c, info, digest);
 
     // set remaining rdata fields
-    rdata[0] = (mDNSu8)((MD5_LEN >> 8)  & 0xff);
-    rdata[1] = (mDNSu8)( MD5_LEN        & 0xff);
+    rdata[0] = (mDNSu8)((digestlen >> 8)  & 0xff);
+    rdata[1] = (mDNSu8)( digestlen        & 0xff);
     rdata += sizeof(mDNSOpaque16);
-    mDNSPlatformMemCopy(rdata, digest, MD5_LEN);                          // MAC
-    rdata += MD5_LEN;
+    mDNSPlatformMemCopy(rdata, digest, digestlen);                        // MAC
+    rdata += digestlen;
     rdata[0] = msg->h.id.b[0];                                            // original ID
     rdata[1] = msg->h.id.b[1];
     rdata[2] = (mDNSu8)((tcode >> 8) & 0xff);
@@ -1441,21 +1738,22 @@ mDNSexport mDNSBool DNSDigest_VerifyMessage(DNSMessage *msg, mDNSu8 *end, LargeC
     mDNSu8          *   ptr = (mDNSu8*) &lcr->r.resrec.rdata->u.data;
     mDNSs32 now;
     mDNSs32 then;
-    mDNSu8 thisDigest[MD5_LEN];
-    mDNSu8 thatDigest[MD5_LEN];
+    mDNSu8 thisDigest[HMAC_MAX_DIGEST_LEN];
+    mDNSu8 thatDigest[HMAC_MAX_DIGEST_LEN];
+    mDNSu32 digestlen = hmac_digest_len(info->algorithm);
     mDNSOpaque16 buf;
     mDNSu8 utc48[6];
     mDNSs32 delta;
     mDNSu16 fudge;
     domainname      *   algo;
-    MD5_CTX c;
+    hmac_ctx c;
     mDNSBool ok = mDNSfalse;
 
-    // We only support HMAC-MD5 for now
+    // The algorithm has to be the one the key was configured for
 
     algo = (domainname*) ptr;
 
-    if (!SameDomainName(algo, (domainname *)HMAC_MD5_AlgName))
+    if (!SameDomainName(algo, (const domainname *)hmac_alg_name(info->algorithm)))
     {
         LogMsg("ERROR: DNSDigest_VerifyMessage - TSIG algorithm not supported: %##s", algo->c);
         *rcode = kDNSFlag1_RC_NotAuth;
@@ -1506,62 +1804,63 @@ mDNSexport mDNSBool DNSDigest_VerifyMessage(DNSMessage *msg, mDNSu8 *end, LargeC
 
     // MAC size
 
+    if (NToH16(ptr) != digestlen)
+    {
+        LogMsg("ERROR: DNSDigest_VerifyMessage - MAC size %d, expected %d", NToH16(ptr), digestlen);
+        *rcode = kDNSFlag1_RC_NotAuth;
+        *tcode = TSIG_ErrBadSig;
+        ok = mDNSfalse;
+        goto exit;
+    }
+
     ptr += sizeof(mDNSu16);
 
     // MAC
 
-    mDNSPlatformMemCopy(thatDigest, ptr, MD5_LEN);
+    mDNSPlatformMemCopy(thatDigest, ptr, digestlen);
 
-    // Init MD5 context, digest inner key pad and message
+    // Init HMAC context (inner key pad is already digested) and digest message
 
-    MD5_Init(&c);
-    MD5_Update(&c, info->keydata_ipad, HMAC_LEN);
-    MD5_Update(&c, (mDNSu8*) msg, (unsigned long)(end - (mDNSu8*) msg));
+    hmac_start(&c, info);
+    hmac_update(&c, (mDNSu8*) msg, (mDNSu32)(end - (mDNSu8*) msg));
 
     // Key name
 
-    MD5_Update(&c, lcr->r.resrec.name->c, DomainNameLength(lcr->r.resrec.name));
+    hmac_update(&c, lcr->r.resrec.name->c, DomainNameLength(lcr->r.resrec.name));
 
     // Class name
 
     buf = mDNSOpaque16fromIntVal(lcr->r.resrec.rrclass);
-    MD5_Update(&c, buf.b, sizeof(mDNSOpaque16));
+    hmac_update(&c, buf.b, sizeof(mDNSOpaque16));
 
     // TTL
 
-    MD5_Update(&c, (mDNSu8*) &lcr->r.resrec.rroriginalttl, sizeof(lcr->r.resrec.rroriginalttl));
+    hmac_update(&c, (mDNSu8*) &lcr->r.resrec.rroriginalttl, sizeof(lcr->r.resrec.rroriginalttl));
 
     // Algorithm
 
-    MD5_Update(&c, algo->c, DomainNameLength(algo));
+    hmac_update(&c, algo->c, DomainNameLength(algo));
 
     // Time
 
-    MD5_Update(&c, utc48, 6);
+    hmac_update(&c, utc48, 6);
 
     // Fudge
 
     buf = mDNSOpaque16fromIntVal(fudge);
-    MD5_Update(&c, buf.b, sizeof(mDNSOpaque16));
+    hmac_update(&c, buf.b, sizeof(mDNSOpaque16));
 
     // Digest error and other data len (both zero) - we'll add them to the rdata later
 
     buf.NotAnInteger = 0;
-    MD5_Update(&c, buf.b, sizeof(mDNSOpaque16));  // error
-    MD5_Update(&c, buf.b, sizeof(mDNSOpaque16));  // other data len
-
-    // Finish the message & tsig var hash
-
-    MD5_Final(thisDigest, &c);
+    hmac_update(&c, buf.b, sizeof(mDNSOpaque16));  // error
+    hmac_update(&c, buf.b, sizeof(mDNSOpaque16));  // other data len
 
-    // perform outer MD5 (outer key pad, inner digest)
+    // Finish the message & tsig var hash, then the outer hash (outer key pad, inner digest)
 
-    MD5_Init(&c);
-    MD5_Update(&c, info->keydata_opad, HMAC_LEN);
-    MD5_Update(&c, thisDigest, MD5_LEN);
-    MD5_Final(thisDigest, &c);
+    hmac_finish(&c, info, thisDigest);
 
-    if (!mDNSPlatformMemSame(thisDigest, thatDigest, MD5_LEN))
+    if (!mDNSPlatformMemSame(thisDigest, thatDigest, digestlen))
     {
         LogMsg("ERROR: DNSDigest_VerifyMessage - bad signature");
         *rcode = kDNSFlag1_RC_NotAuth;
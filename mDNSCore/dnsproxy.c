@@ -38,8 +38,8 @@ static nw_nat64_prefix_t gDNS64Prefix;
 // sets up the sockets and whenever it receives a packet, it calls ProxyTCPCallback or ProxyUDPCallback
 // defined here. For TCP socket, the platform does the "accept" and only sends the received packets
 // on the newly accepted socket. A single UDP socket (per address family) is used to send/recv
-// requests/responses from all clients. For TCP, there is one socket per request. Hence, there is some
-// extra state that needs to be disposed at the end.
+// requests/responses from all clients. For TCP, there is one socket per connection, and the platform
+// context that comes with it is disposed when the connection goes away.
 //
 // When a DNS request is received, ProxyCallbackCommon checks for malformed packet etc. and also checks
 // for duplicates, before creating DNSProxyClient state and starting a question with the "core"
@@ -56,10 +56,20 @@ static nw_nat64_prefix_t gDNS64Prefix;
 //     return the RRSIGs or the NSEC records with the RRSIGs in the Additional section. We need to
 //     ask the "core" to fetch the DNSSEC records and do the validation if the CD bit is not set.
 //
-// Once the response is sent to the client, the client state is disposed. When there is no response
+// Once the response is sent to the client, the client state is disposed. A TCP connection is kept open after
+// that, and as RFC 7766 allows, a client may have several queries outstanding on it at once, each answered
+// as soon as its own answer is ready rather than in the order they were asked. Connections with nothing
+// outstanding are closed after DNSPROXY_TCP_IDLE_TIMEOUT; as the proxy has no timers of its own, this is
+// checked whenever a query arrives. When there is no response
 // from the "core", it eventually times out and we will not find any answers in the cache and we send a
 // "NXDomain" response back. Thus, we don't need any special timers to reap the client state in the case
 // of errors. 
+//
+// Many clients behind the proxy tend to ask for the same names at about the same time. A query whose
+// answer is already in the cache, and still fresh, is answered straight away without starting a question.
+// A query identical to one already outstanding doesn't start a question either: the client is marked as
+// a follower of the one that did (its leader), and gets its own response built when the leader's answer
+// arrives.
 
 typedef struct DNSProxyClient_struct DNSProxyClient;
 
@@ -88,20 +98,61 @@ struct DNSProxyClient_struct {
     mDNSu8 *optRR;                  // EDNS0 option
     mDNSu16 optLen;                 // Total Length of the EDNS0 option 
     mDNSu16 rcvBufSize;             // How much can the client receive ?
-    void *context;                  // Platform context to be disposed if non-NULL
     domainname qname;               // q->qname can't be used for duplicate check
     DNSQuestion q;                  // as it can change underneath us for CNAMEs
     mDNSu16 qtype;
+    DNSProxyClient *leader;         // Client whose identical question we're waiting on; q isn't started if set
 #if MDNSRESPONDER_SUPPORTS(APPLE, DNS_PROXY_DNS64)
     DNSProxyDNS64State dns64state;
 #endif
 };
 
+// The number of queries a TCP client may have outstanding on one connection; more than that get ServFail
+#ifndef DNSPROXY_TCP_MAX_PIPELINED
+#define DNSPROXY_TCP_MAX_PIPELINED  16
+#endif
+
+// The number of TCP connections kept open; when a new one arrives, the one idle the longest makes way for it
+#ifndef DNSPROXY_TCP_MAX_CONNS
+#define DNSPROXY_TCP_MAX_CONNS      32
+#endif
+
+// How long a TCP connection with no queries outstanding is kept open (RFC 7766, Section 6.2.3)
+#ifndef DNSPROXY_TCP_IDLE_TIMEOUT
+#define DNSPROXY_TCP_IDLE_TIMEOUT   (10 * mDNSPlatformOneSecond)
+#endif
+
+typedef struct DNSProxyTCPConn_struct DNSProxyTCPConn;
+struct DNSProxyTCPConn_struct
+{
+    DNSProxyTCPConn *next;
+    void *socket;                   // Socket the connection's queries come in on
+    void *context;                  // Platform context to be disposed when the connection is closed
+    mDNSs32 lastUsed;               // When the last query on it was received or answered
+};
+
 #define MIN_DNS_MESSAGE_SIZE    512
 static DNSProxyClient *DNSProxyClients;
+static DNSProxyTCPConn *DNSProxyTCPConns;
+
+mDNSlocal DNSProxyTCPConn *FindProxyTCPConn(const void *const socket)
+{
+    DNSProxyTCPConn *conn;
+
+    for (conn = DNSProxyTCPConns; conn; conn = conn->next)
+    {
+        if (conn->socket == socket) break;
+    }
+    return(conn);
+}
 
 mDNSlocal void FreeDNSProxyClient(DNSProxyClient *pc)
 {
+    if (pc->tcp)
+    {
+        DNSProxyTCPConn *const conn = FindProxyTCPConn(pc->socket);
+        if (conn) conn->lastUsed = mDNSPlatformRawTime();
+    }
     if (pc->optRR)
         mDNSPlatformMemFree(pc->optRR);
     mDNSPlatformMemFree(pc);
@@ -366,10 +417,10 @@ again:
                 len += (ptr - orig); 
                 orig = ptr;
             }
-            if (cr->soa)
+            if (NegativeCacheRecordSOA(m, cr))
             {
                 LogInfo("AddResourceRecords: soa set for %s", CRDisplayString(m ,cr));
-                soa = cr->soa;
+                soa = NegativeCacheRecordSOA(m, cr);
             }
             // If we are using CNAME to answer a question and CNAME is not the type we
             // are looking for, note down the CNAME record so that we can follow them
@@ -433,14 +484,75 @@ again:
     return ptr;
 }
 
-mDNSlocal void ProxyClientCallback(mDNS *const m, DNSQuestion *question, const ResourceRecord *const answer, QC_result AddRecord)
+mDNSlocal void ProxySendMessage(mDNS *const m, DNSProxyClient *pc, mDNSu8 *const end)
+{
+    debugf("ProxySendMessage: InterfaceID is %p for response to client", pc->interfaceID);
+
+    if (!pc->tcp)
+    {
+        mDNSSendDNSMessage(m, &m->omsg, end, pc->interfaceID, mDNSNULL, (UDPSocket *)pc->socket, &pc->addr, pc->port, mDNSNULL, mDNSfalse);
+    }
+    else
+    {
+        mDNSSendDNSMessage(m, &m->omsg, end, pc->interfaceID, (TCPSocket *)pc->socket, mDNSNULL, &pc->addr, pc->port, mDNSNULL, mDNSfalse);
+    }
+}
+
+// Builds the response to pc from what's in the cache, and sends it
+mDNSlocal void ProxySendResponse(mDNS *const m, DNSProxyClient *pc)
 {
-    DNSProxyClient *pc = question->QuestionContext;
-    DNSProxyClient **ppc = &DNSProxyClients;
     mDNSu8 *ptr;
     mDNSu8 *prevptr;
     mStatus error;
 
+    ptr = AddResourceRecords(pc, &prevptr, &error);
+    if (!ptr)
+    {
+        LogInfo("ProxySendResponse: AddResourceRecords NULL for %##s (%s)", &pc->qname.c, DNSTypeName(pc->qtype));
+        if (error == mStatus_NoError && prevptr)
+        {
+            // No space to add the record. Set the Truncate bit for UDP.
+            //
+            // TBD: For TCP, we need to send the rest of the data. But finding out what is left
+            // is harder. We should allocate enough buffer in the first place to send all
+            // of the data.
+            if (!pc->tcp)
+            {
+                m->omsg.h.flags.b[0] |= kDNSFlag0_TC;
+                ptr = prevptr;
+            }
+            else
+            {
+                LogInfo("ProxySendResponse: ERROR!! Not enough space to return in TCP for %##s (%s)", &pc->qname.c, DNSTypeName(pc->qtype));
+                ptr = prevptr;
+            }
+        }
+        else
+        {
+            mDNSOpaque16 flags   = { { kDNSFlag0_QR_Response | kDNSFlag0_OP_StdQuery, kDNSFlag1_RC_ServFail } };
+            // We could not find the record for some reason. Return a response, so that the client
+            // is not waiting forever.
+            LogInfo("ProxySendResponse: No response");
+            if (!mDNSOpaque16IsZero(pc->q.responseFlags))
+                flags = pc->q.responseFlags;
+            InitializeDNSMessage(&m->omsg.h, pc->msgid, flags);
+            ptr = putQuestion(&m->omsg, m->omsg.data, m->omsg.data + AbsoluteMaxDNSMessageData, &pc->qname, pc->qtype, pc->q.qclass);
+            if (!ptr)
+            {
+                LogInfo("ProxySendResponse: putQuestion NULL for %##s (%s)", &pc->qname.c, DNSTypeName(pc->qtype));
+                return;
+            }
+        }
+    }
+    ProxySendMessage(m, pc, ptr);
+}
+
+mDNSlocal void ProxyClientCallback(mDNS *const m, DNSQuestion *question, const ResourceRecord *const answer, QC_result AddRecord)
+{
+    DNSProxyClient *pc = question->QuestionContext;
+    DNSProxyClient **ppc = &DNSProxyClients;
+    DNSProxyClient *f;
+
     if (!AddRecord)
         return;
 
@@ -482,6 +594,7 @@ mDNSlocal void ProxyClientCallback(mDNS *const m, DNSQuestion *question, const R
     if (pc->dns64state == kDNSProxyDNS64State_PTRSynthesisNXDomain)
     {
         const mDNSOpaque16 flags = { { kDNSFlag0_QR_Response | kDNSFlag0_OP_StdQuery, kDNSFlag1_RC_NXDomain } };
+        mDNSu8 *ptr;
         InitializeDNSMessage(&m->omsg.h, pc->msgid, flags);
         ptr = putQuestion(&m->omsg, m->omsg.data, m->omsg.data + AbsoluteMaxDNSMessageData, &pc->qname, pc->qtype,
             pc->q.qclass);
@@ -489,6 +602,10 @@ mDNSlocal void ProxyClientCallback(mDNS *const m, DNSQuestion *question, const R
         {
             LogInfo("ProxyClientCallback: putQuestion NULL for %##s (%s)", &pc->qname.c, DNSTypeName(pc->qtype));
         }
+        else
+        {
+            ProxySendMessage(m, pc, ptr);
+        }
     }
     else
 #endif
@@ -499,58 +616,19 @@ mDNSlocal void ProxyClientCallback(mDNS *const m, DNSQuestion *question, const R
             LogInfo("ProxyClientCallback: Received %s, not answering yet", RRDisplayString(m, answer));
             return;
         }
-        ptr = AddResourceRecords(pc, &prevptr, &error);
-        if (!ptr)
+        ProxySendResponse(m, pc);
+
+        // Everyone who asked the same thing in the meantime gets the same answer
+        for (f = DNSProxyClients; f; f = f->next)
         {
-            LogInfo("ProxyClientCallback: AddResourceRecords NULL for %##s (%s)", &pc->qname.c, DNSTypeName(pc->qtype));
-            if (error == mStatus_NoError && prevptr)
-            {
-                // No space to add the record. Set the Truncate bit for UDP.
-                //
-                // TBD: For TCP, we need to send the rest of the data. But finding out what is left
-                // is harder. We should allocate enough buffer in the first place to send all
-                // of the data.
-                if (!pc->tcp)
-                {
-                    m->omsg.h.flags.b[0] |= kDNSFlag0_TC;
-                    ptr = prevptr;
-                }
-                else
-                {
-                    LogInfo("ProxyClientCallback: ERROR!! Not enough space to return in TCP for %##s (%s)", &pc->qname.c, DNSTypeName(pc->qtype));
-                    ptr = prevptr;
-                }
-            }
-            else
-            {
-                mDNSOpaque16 flags   = { { kDNSFlag0_QR_Response | kDNSFlag0_OP_StdQuery, kDNSFlag1_RC_ServFail } };
-                // We could not find the record for some reason. Return a response, so that the client
-                // is not waiting forever.
-                LogInfo("ProxyClientCallback: No response");
-                if (!mDNSOpaque16IsZero(pc->q.responseFlags))
-                    flags = pc->q.responseFlags;
-                InitializeDNSMessage(&m->omsg.h, pc->msgid, flags);
-                ptr = putQuestion(&m->omsg, m->omsg.data, m->omsg.data + AbsoluteMaxDNSMessageData, &pc->qname, pc->qtype, pc->q.qclass);
-                if (!ptr)
-                {
-                    LogInfo("ProxyClientCallback: putQuestion NULL for %##s (%s)", &pc->qname.c, DNSTypeName(pc->qtype));
-                    goto done;
-                }
-            }
+            if (f->leader != pc) continue;
+            f->q.TargetQID      = pc->q.TargetQID;
+            f->q.qDNSServer     = pc->q.qDNSServer;
+            f->q.responseFlags  = pc->q.responseFlags;
+            ProxySendResponse(m, f);
         }
     }
-    debugf("ProxyClientCallback: InterfaceID is %p for response to client", pc->interfaceID);
-
-    if (!pc->tcp)
-    {
-        mDNSSendDNSMessage(m, &m->omsg, ptr, pc->interfaceID, mDNSNULL, (UDPSocket *)pc->socket, &pc->addr, pc->port, mDNSNULL, mDNSfalse);
-    }
-    else
-    {
-        mDNSSendDNSMessage(m, &m->omsg, ptr, pc->interfaceID, (TCPSocket *)pc->socket, mDNSNULL, &pc->addr, pc->port, mDNSNULL, mDNSfalse);
-    }
 
-done:
     mDNS_StopQuery(m, question);
 
     while (*ppc && *ppc != pc)
@@ -561,12 +639,109 @@ done:
         return;
     }
     *ppc = pc->next;
-    mDNSPlatformDisposeProxyContext(pc->context);
     FreeDNSProxyClient(pc);
+
+    for (ppc = &DNSProxyClients; *ppc; )
+    {
+        f = *ppc;
+        if (f->leader != pc) { ppc = &f->next; continue; }
+        *ppc = f->next;
+        FreeDNSProxyClient(f);
+    }
+}
+
+// When a client leaves before its question is answered, the next client waiting on it takes the question over
+mDNSlocal void ProxyPromoteFollower(mDNS *const m, const DNSProxyClient *const old)
+{
+    DNSProxyClient *next = mDNSNULL;
+    DNSProxyClient *f;
+
+    for (f = DNSProxyClients; f; f = f->next)
+    {
+        if (f->leader != old) continue;
+        if (!next)
+        {
+            next = f;
+            f->leader = mDNSNULL;
+        }
+        else
+        {
+            f->leader = next;
+        }
+    }
+    if (next) mDNS_StartQuery(m, &next->q);
+}
+
+mDNSlocal DNSProxyClient *FindProxyLeader(const DNSProxyClient *const pc)
+{
+    DNSProxyClient *c;
+
+#if MDNSRESPONDER_SUPPORTS(APPLE, DNS_PROXY_DNS64)
+    // The DNS64 states make each client's question its own
+    if (gDNS64Enabled) return(mDNSNULL);
+#endif
+    for (c = DNSProxyClients; c; c = c->next)
+    {
+        if (!c->leader && c->qtype == pc->qtype && c->q.qclass == pc->q.qclass && SameDomainName(&c->qname, &pc->qname))
+        {
+            return(c);
+        }
+    }
+    return(mDNSNULL);
+}
+
+// Answers pc straight from the cache if every record there that answers it is still fresh. Names that go
+// through a CNAME are left to the question, which knows how to follow the chain.
+mDNSlocal mDNSBool ProxyAnswerFromCache(mDNS *const m, DNSProxyClient *pc)
+{
+#if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+    CacheGroup *cg;
+    CacheRecord *cr;
+    mDNSBool found = mDNSfalse;
+
+#if MDNSRESPONDER_SUPPORTS(APPLE, DNS_PROXY_DNS64)
+    if (pc->dns64state != kDNSProxyDNS64State_Initial) return(mDNSfalse);
+#endif
+    if (pc->q.qtype == kDNSQType_ANY) return(mDNSfalse);
+
+    mDNS_Lock(m);
+    // Only a unicast question with the right server can be answered from unicast records
+    SetValidDNSServers(m, &pc->q);
+    pc->q.qDNSServer = GetServerForQuestion(m, &pc->q);
+    pc->q.TargetQID  = onesID;
+    cg = CacheGroupForName(m, DomainNameHashValue(&pc->q.qname), &pc->q.qname);
+    for (cr = cg ? cg->members : mDNSNULL; cr; cr = cr->next)
+    {
+        if (!SameNameCacheRecordAnswersQuestion(cr, &pc->q)) continue;
+        if ((cr->resrec.rrtype != pc->q.qtype && cr->resrec.rrtype == kDNSType_CNAME) ||
+            ((mDNSs32)cr->resrec.rroriginalttl - (m->timenow - cr->TimeRcvd) / mDNSPlatformOneSecond) < 1)
+        {
+            found = mDNSfalse;
+            break;
+        }
+        found = mDNStrue;
+    }
+    mDNS_Unlock(m);
+
+    if (!found)
+    {
+        pc->q.TargetQID       = zeroID;
+        pc->q.qDNSServer      = mDNSNULL;
+        pc->q.validDNSServers = zeroOpaque128;
+        return(mDNSfalse);
+    }
+    LogInfo("ProxyAnswerFromCache: Answering %##s (%s) from the cache", pc->qname.c, DNSTypeName(pc->qtype));
+    ProxySendResponse(m, pc);
+    return(mDNStrue);
+#else
+    (void)m;
+    (void)pc;
+    return(mDNSfalse);
+#endif
 }
 
 mDNSlocal void SendError(void *socket, DNSMessage *const msg, const mDNSu8 *const end, const mDNSAddr *dstaddr,
-    const mDNSIPPort dstport, const mDNSInterfaceID InterfaceID, mDNSBool tcp, void *context, mDNSu8 rcode)
+    const mDNSIPPort dstport, const mDNSInterfaceID InterfaceID, mDNSBool tcp, mDNSu8 rcode)
 {
     mDNS *const m = &mDNSStorage;
     int pktlen = (int)(end - (mDNSu8 *)msg);
@@ -591,7 +766,6 @@ mDNSlocal void SendError(void *socket, DNSMessage *const msg, const mDNSu8 *cons
     {
         mDNSSendDNSMessage(m, &m->omsg, (mDNSu8 *)&m->omsg + pktlen, InterfaceID, (TCPSocket *)socket, mDNSNULL, dstaddr, dstport, mDNSNULL, mDNSfalse);
     }
-    mDNSPlatformDisposeProxyContext(context);
 }
 
 mDNSlocal DNSQuestion *IsDuplicateClient(const mDNSAddr *const addr, const mDNSIPPort port, const mDNSOpaque16 id,
@@ -654,6 +828,7 @@ mDNSlocal void ProxyCallbackCommon(void *socket, DNSMessage *const msg, const mD
 
     (void) dstaddr;
     (void) dstport;
+    (void) context;
 
     debugf("ProxyCallbackCommon: DNS Query coming from InterfaceID %p", InterfaceID);
     // Ignore if the DNS Query is not from a Valid Input InterfaceID
@@ -680,7 +855,7 @@ mDNSlocal void ProxyCallbackCommon(void *socket, DNSMessage *const msg, const mD
     if (QR_OP != kDNSFlag0_QR_Query)
     {
         LogInfo("ProxyCallbackCommon: Not a query(%d) for pkt from %#a:%d", QR_OP, srcaddr, mDNSVal16(srcport));
-        SendError(socket, msg, end, srcaddr, srcport, InterfaceID, tcp, context, kDNSFlag1_RC_NotImpl);
+        SendError(socket, msg, end, srcaddr, srcport, InterfaceID, tcp, kDNSFlag1_RC_NotImpl);
         return;
     }
     
@@ -688,7 +863,7 @@ mDNSlocal void ProxyCallbackCommon(void *socket, DNSMessage *const msg, const mD
     {
         LogInfo("ProxyCallbackCommon: Malformed pkt from %#a:%d, Q:%d, An:%d, Au:%d", srcaddr, mDNSVal16(srcport),
             msg->h.numQuestions, msg->h.numAnswers, msg->h.numAuthorities);
-        SendError(socket, msg, end, srcaddr, srcport, InterfaceID, tcp, context, kDNSFlag1_RC_FormErr);
+        SendError(socket, msg, end, srcaddr, srcport, InterfaceID, tcp, kDNSFlag1_RC_FormErr);
         return;
     }
     ptr = msg->data;
@@ -696,7 +871,7 @@ mDNSlocal void ProxyCallbackCommon(void *socket, DNSMessage *const msg, const mD
     if (!ptr)
     {
         LogInfo("ProxyCallbackCommon: Question cannot be parsed for pkt from %#a:%d", srcaddr, mDNSVal16(srcport));
-        SendError(socket, msg, end, srcaddr, srcport, InterfaceID, tcp, context, kDNSFlag1_RC_FormErr);
+        SendError(socket, msg, end, srcaddr, srcport, InterfaceID, tcp, kDNSFlag1_RC_FormErr);
         return;
     }
     else
@@ -743,7 +918,6 @@ mDNSlocal void ProxyCallbackCommon(void *socket, DNSMessage *const msg, const mD
     pc->socket = socket;
     pc->tcp = tcp;
     pc->requestFlags = msg->h.flags;
-    pc->context = context;
     AssignDomainName(&pc->qname, &q.qname);
     if (optRR)
     {
@@ -772,8 +946,8 @@ mDNSlocal void ProxyCallbackCommon(void *socket, DNSMessage *const msg, const mD
     pc->q.ReturnIntermed  = mDNStrue;
     pc->q.ProxyQuestion   = mDNStrue;
     pc->q.responseFlags   = zeroID;
-#if MDNSRESPONDER_SUPPORTS(APPLE, DNS_PROXY_DNS64)
     pc->qtype = pc->q.qtype;
+#if MDNSRESPONDER_SUPPORTS(APPLE, DNS_PROXY_DNS64)
     if (gDNS64Enabled)
     {
         if (pc->qtype == kDNSType_PTR)
@@ -798,48 +972,171 @@ mDNSlocal void ProxyCallbackCommon(void *socket, DNSMessage *const msg, const mD
     }
 #endif
 
+    if (ProxyAnswerFromCache(m, pc))
+    {
+        FreeDNSProxyClient(pc);
+        return;
+    }
+    pc->leader = FindProxyLeader(pc);
+
     while (*ppc)
         ppc = &((*ppc)->next);
     *ppc = pc;
 
+    if (pc->leader)
+    {
+        LogInfo("ProxyCallbackCommon: Waiting on the outstanding question for %##s (%s)", pc->qname.c, DNSTypeName(pc->qtype));
+        return;
+    }
     mDNS_StartQuery(m, &pc->q);
 }
 
+// Frees every client waiting on conn's socket and closes the connection
+mDNSlocal void ProxyCloseTCPConn(mDNS *const m, DNSProxyTCPConn *const conn)
+{
+    DNSProxyTCPConn **pconn = &DNSProxyTCPConns;
+    DNSProxyClient **ppc;
+    DNSProxyClient *pc;
+
+    for (;;)
+    {
+        // Promoting a follower may start the question of another client on this connection, so start over each time
+        for (ppc = &DNSProxyClients; *ppc && (*ppc)->socket != conn->socket; )
+            ppc = &(*ppc)->next;
+        pc = *ppc;
+        if (!pc) break;
+        *ppc = pc->next;
+        if (!pc->leader)
+        {
+            mDNS_StopQuery(m, &pc->q);
+            ProxyPromoteFollower(m, pc);
+        }
+        FreeDNSProxyClient(pc);
+    }
+
+    while (*pconn && *pconn != conn)
+        pconn = &(*pconn)->next;
+    if (*pconn) *pconn = conn->next;
+    mDNSPlatformDisposeProxyContext(conn->context);
+    mDNSPlatformMemFree(conn);
+}
+
+mDNSlocal mDNSu32 ProxyTCPConnOutstanding(const DNSProxyTCPConn *const conn)
+{
+    const DNSProxyClient *pc;
+    mDNSu32 count = 0;
+
+    for (pc = DNSProxyClients; pc; pc = pc->next)
+    {
+        if (pc->socket == conn->socket) count++;
+    }
+    return(count);
+}
+
+// Closes connections that have had nothing outstanding for DNSPROXY_TCP_IDLE_TIMEOUT, and returns
+// the one that has been idle the longest of those that are left
+mDNSlocal DNSProxyTCPConn *ProxyReapIdleTCPConns(mDNS *const m, mDNSu32 *const outCount)
+{
+    const mDNSs32 now = mDNSPlatformRawTime();
+    DNSProxyTCPConn *conn = DNSProxyTCPConns;
+    DNSProxyTCPConn *oldest = mDNSNULL;
+    mDNSu32 count = 0;
+
+    while (conn)
+    {
+        DNSProxyTCPConn *const next = conn->next;
+        if (ProxyTCPConnOutstanding(conn) == 0)
+        {
+            if (now - conn->lastUsed >= DNSPROXY_TCP_IDLE_TIMEOUT)
+            {
+                LogInfo("ProxyReapIdleTCPConns: Closing idle connection %p", conn->socket);
+                ProxyCloseTCPConn(m, conn);
+                conn = next;
+                continue;
+            }
+            if (!oldest || conn->lastUsed - oldest->lastUsed < 0) oldest = conn;
+        }
+        count++;
+        conn = next;
+    }
+    if (outCount) *outCount = count;
+    return(oldest);
+}
+
 mDNSexport void ProxyUDPCallback(void *socket, DNSMessage *const msg, const mDNSu8 *const end, const mDNSAddr *const srcaddr,
     const mDNSIPPort srcport, const mDNSAddr *dstaddr, const mDNSIPPort dstport, const mDNSInterfaceID InterfaceID, void *context)
 {
     LogInfo("ProxyUDPCallback: DNS Message from %#a:%d to %#a:%d length %d", srcaddr, mDNSVal16(srcport), dstaddr, mDNSVal16(dstport), (int)(end - (mDNSu8 *)msg));
+    (void)ProxyReapIdleTCPConns(&mDNSStorage, mDNSNULL);
     ProxyCallbackCommon(socket, msg, end, srcaddr, srcport, dstaddr, dstport, InterfaceID, mDNSfalse, context);
 }
 
 mDNSexport void ProxyTCPCallback(void *socket, DNSMessage *const msg, const mDNSu8 *const end, const mDNSAddr *const srcaddr,
     const mDNSIPPort srcport, const mDNSAddr *dstaddr, const mDNSIPPort dstport, const mDNSInterfaceID InterfaceID, void *context)
 {
+    mDNS *const m = &mDNSStorage;
+    DNSProxyTCPConn *conn;
+
     LogInfo("ProxyTCPCallback: DNS Message from %#a:%d to %#a:%d length %d", srcaddr, mDNSVal16(srcport), dstaddr, mDNSVal16(dstport), (int)(end - (mDNSu8 *)msg));
-    
-    // If the connection was closed from the other side or incoming packet does not match stored input interface list, locate the client
-    // state and free it.
+
+    conn = FindProxyTCPConn(socket);
+    if (conn)
+    {
+        conn->lastUsed = mDNSPlatformRawTime();
+    }
+
+    // If the connection was closed from the other side or incoming packet does not match stored input interface list,
+    // free the state of every client on it along with the connection.
     if (((end - (mDNSu8 *)msg) == 0) || (!CheckDNSProxyIpIntf(InterfaceID)))
     {
-        DNSProxyClient **ppc = &DNSProxyClients;
-        DNSProxyClient **prevpc;
+        LogInfo("ProxyTCPCallback: free");
+        if (conn)
+            ProxyCloseTCPConn(m, conn);
+        else
+            mDNSPlatformDisposeProxyContext(context);
+        return;
+    }
 
-        prevpc = ppc;
-        while (*ppc && (*ppc)->socket != socket)
+    if (!conn)
+    {
+        mDNSu32 count;
+        DNSProxyTCPConn *const oldest = ProxyReapIdleTCPConns(m, &count);
+        if (count >= DNSPROXY_TCP_MAX_CONNS)
         {
-            prevpc = ppc;
-            ppc=&(*ppc)->next;
+            if (!oldest)
+            {
+                LogMsg("ProxyTCPCallback: Too many connections (%u) with queries outstanding, refusing %#a:%d", count,
+                    srcaddr, mDNSVal16(srcport));
+                mDNSPlatformDisposeProxyContext(context);
+                return;
+            }
+            ProxyCloseTCPConn(m, oldest);
         }
-        if (!*ppc)
+        conn = (DNSProxyTCPConn *) mDNSPlatformMemAllocateClear(sizeof(*conn));
+        if (!conn)
         {
-            mDNSPlatformDisposeProxyContext(socket);
-            LogMsg("ProxyTCPCallback: socket cannot be found");
+            LogMsg("ProxyTCPCallback: Memory failure for pkt from %#a:%d, ignoring this", srcaddr, mDNSVal16(srcport));
+            mDNSPlatformDisposeProxyContext(context);
             return;
         }
-        *prevpc = (*ppc)->next;
-        LogInfo("ProxyTCPCallback: free");
-        mDNSPlatformDisposeProxyContext(socket);
-        FreeDNSProxyClient(*ppc);
+        conn->socket   = socket;
+        conn->context  = context;
+        conn->lastUsed = mDNSPlatformRawTime();
+        conn->next     = DNSProxyTCPConns;
+        DNSProxyTCPConns = conn;
+    }
+    else
+    {
+        (void)ProxyReapIdleTCPConns(m, mDNSNULL);
+    }
+
+    if (ProxyTCPConnOutstanding(conn) >= DNSPROXY_TCP_MAX_PIPELINED)
+    {
+        LogInfo("ProxyTCPCallback: Too many queries outstanding from %#a:%d", srcaddr, mDNSVal16(srcport));
+        if ((unsigned)(end - (mDNSu8 *)msg) >= sizeof(DNSMessageHeader))
+        {
+            SendError(socket, msg, end, srcaddr, srcport, InterfaceID, mDNStrue, kDNSFlag1_RC_ServFail);
+        }
         return;
     }
     ProxyCallbackCommon(socket, msg, end, srcaddr, srcport, dstaddr, dstport, InterfaceID, mDNStrue, context);
@@ -933,6 +1230,10 @@ mDNSexport void DNSProxyTerminate(void)
         m->dp_ipintf[i]  = 0;
     m->dp_opintf         = 0; 
     
+    // The listeners are gone, so are the connections accepted on them
+    while (DNSProxyTCPConns)
+        ProxyCloseTCPConn(m, DNSProxyTCPConns);
+
     LogInfo("DNSProxyTerminate Cleared interface list: Input [%d, %d, %d, %d, %d] Output [%d]", m->dp_ipintf[0],
             m->dp_ipintf[1], m->dp_ipintf[2], m->dp_ipintf[3], m->dp_ipintf[4], m->dp_opintf);
 #if MDNSRESPONDER_SUPPORTS(APPLE, DNS_PROXY_DNS64)
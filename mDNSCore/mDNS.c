@@ -24,6 +24,7 @@
  */
 
 #include "DNSCommon.h"                  // Defines general DNS utility routines
+#include "mDNSTrace.h"                  // Static tracepoints
 #include "uDNS.h"                       // Defines entry points into unicast-specific routines
 
 #if MDNSRESPONDER_SUPPORTS(APPLE, D2D)
@@ -104,6 +105,8 @@ typedef mDNSu32 DeadvertiseFlags;
 mDNSlocal void DeadvertiseInterface(mDNS *const m, NetworkInterfaceInfo *set, DeadvertiseFlags flags);
 mDNSlocal void AdvertiseInterfaceIfNeeded(mDNS *const m, NetworkInterfaceInfo *set);
 mDNSlocal mDNSu8 *GetValueForMACAddr(mDNSu8 *ptr, mDNSu8 *limit, mDNSEthAddr *eth);
+mDNSlocal const domainname *InternDomainName(mDNS *const m, const domainname *const name, const mDNSu32 namehash);
+mDNSlocal void ReleaseInternedName(mDNS *const m, const domainname *const name);
 
 // ***************************************************************************
 #if COMPILER_LIKES_PRAGMA_MARK
@@ -118,6 +121,9 @@ mDNSlocal mDNSu8 *GetValueForMACAddr(mDNSu8 *ptr, mDNSu8 *limit, mDNSEthAddr *et
 
 #define kMaxUpdateCredits 10
 #define kUpdateCreditRefreshInterval (mDNSPlatformOneSecond * 6)
+#define kMinUpdateInterval mDNSPlatformOneSecond
+#define kUpdateAnnounceTick (mDNSPlatformOneSecond / 4)
+#define UpdateAnnounceCount ((mDNSu8)2)
 
 // define special NR_AnswerTo values
 #define NR_AnswerMulticast  (mDNSu8*)~0
@@ -305,34 +311,39 @@ mDNSlocal void ReleaseAuthEntity(AuthHash *r, AuthEntity *e)
     r->rrauth_totalused--;
 }
 
-mDNSlocal void ReleaseAuthGroup(AuthHash *r, AuthGroup **cp)
+mDNSlocal void ReleaseAuthGroup(mDNS *const m, AuthHash *r, AuthGroup **cp)
 {
     AuthEntity *e = (AuthEntity *)(*cp);
     LogMsg("ReleaseAuthGroup:  Releasing AuthGroup %##s", (*cp)->name->c);
     if ((*cp)->rrauth_tail != &(*cp)->members)
         LogMsg("ERROR: (*cp)->members == mDNSNULL but (*cp)->rrauth_tail != &(*cp)->members)");
-    if ((*cp)->name != (domainname*)((*cp)->namestorage)) mDNSPlatformMemFree((*cp)->name);
+    if (r == &m->rrauth) ReleaseInternedName(m, (*cp)->name);
+    else mDNSPlatformMemFree((*cp)->name);
     (*cp)->name = mDNSNULL;
     *cp = (*cp)->next;          // Cut record from list
     ReleaseAuthEntity(r, e);
 }
 
-mDNSlocal AuthEntity *GetAuthEntity(AuthHash *r, const AuthGroup *const PreserveAG)
+mDNSlocal AuthEntity *GetAuthEntity(mDNS *const m, AuthHash *r, const AuthGroup *const PreserveAG)
 {
     AuthEntity *e = mDNSNULL;
 
     if (r->rrauth_lock) { LogMsg("GetFreeCacheRR ERROR! Cache already locked!"); return(mDNSNULL); }
     r->rrauth_lock = 1;
 
-    if (!r->rrauth_free)
+    if (!r->rrauth_free && (!r->rrauth_mem_limit || (r->rrauth_size + 1) * sizeof(AuthEntity) <= r->rrauth_mem_limit))
     {
         // We allocate just one AuthEntity at a time because we need to be able
         // free them all individually which normally happens when we parse /etc/hosts into
         // AuthHash where we add the "new" entries and discard (free) the already added
         // entries. If we allocate as chunks, we can't free them individually.
         AuthEntity *storage = (AuthEntity *) mDNSPlatformMemAllocateClear(sizeof(*storage));
-        storage->next = mDNSNULL;
-        r->rrauth_free = storage;
+        if (storage)
+        {
+            storage->next = mDNSNULL;
+            r->rrauth_free = storage;
+            r->rrauth_size++;
+        }
     }
 
     // If we still have no free records, recycle all the records we can.
@@ -341,13 +352,13 @@ mDNSlocal AuthEntity *GetAuthEntity(AuthHash *r, const AuthGroup *const Preserve
     {
         mDNSu32 oldtotalused = r->rrauth_totalused;
         mDNSu32 slot;
-        for (slot = 0; slot < AUTH_HASH_SLOTS; slot++)
+        for (slot = 0; slot < AuthHashSlots(r); slot++)
         {
-            AuthGroup **cp = &r->rrauth_hash[slot];
+            AuthGroup **cp = &AuthHashHead(r, slot);
             while (*cp)
             {
                 if ((*cp)->members || (*cp)==PreserveAG) cp=&(*cp)->next;
-                else ReleaseAuthGroup(r, cp);
+                else ReleaseAuthGroup(m, r, cp);
             }
         }
         LogInfo("GetAuthEntity: Recycled %d records to reduce auth cache from %d to %d",
@@ -376,9 +387,9 @@ mDNSlocal AuthEntity *GetAuthEntity(AuthHash *r, const AuthGroup *const Preserve
 mDNSexport AuthGroup *AuthGroupForName(AuthHash *r, const mDNSu32 namehash, const domainname *const name)
 {
     AuthGroup *ag;
-    const mDNSu32 slot = namehash % AUTH_HASH_SLOTS;
+    const mDNSu32 slot = namehash % AuthHashSlots(r);
 
-    for (ag = r->rrauth_hash[slot]; ag; ag=ag->next)
+    for (ag = AuthHashHead(r, slot); ag; ag=ag->next)
         if (ag->namehash == namehash && SameDomainName(ag->name, name))
             break;
     return(ag);
@@ -389,31 +400,32 @@ mDNSexport AuthGroup *AuthGroupForRecord(AuthHash *r, const ResourceRecord *cons
     return(AuthGroupForName(r, rr->namehash, rr->name));
 }
 
-mDNSlocal AuthGroup *GetAuthGroup(AuthHash *r, const ResourceRecord *const rr)
+mDNSlocal AuthGroup *GetAuthGroup(mDNS *const m, AuthHash *r, const ResourceRecord *const rr)
 {
-    mDNSu16 namelen = DomainNameLength(rr->name);
-    AuthGroup *ag = (AuthGroup*)GetAuthEntity(r, mDNSNULL);
-    const mDNSu32 slot = rr->namehash % AUTH_HASH_SLOTS;
+    AuthGroup *ag = (AuthGroup*)GetAuthEntity(m, r, mDNSNULL);
+    const mDNSu32 slot = rr->namehash % AuthHashSlots(r);
     if (!ag) { LogMsg("GetAuthGroup: Failed to allocate memory for %##s", rr->name->c); return(mDNSNULL); }
-    ag->next         = r->rrauth_hash[slot];
+    ag->next         = AuthHashHead(r, slot);
     ag->namehash     = rr->namehash;
     ag->members      = mDNSNULL;
     ag->rrauth_tail  = &ag->members;
     ag->NewLocalOnlyRecords = mDNSNULL;
-    if (namelen > sizeof(ag->namestorage))
-        ag->name = (domainname *) mDNSPlatformMemAllocate(namelen);
+    if (r == &m->rrauth)
+        ag->name = (domainname *) InternDomainName(m, rr->name, rr->namehash);
     else
-        ag->name = (domainname*)ag->namestorage;
+    {
+        ag->name = (domainname *) mDNSPlatformMemAllocate(DomainNameLength(rr->name));
+        if (ag->name) AssignDomainName(ag->name, rr->name);
+    }
     if (!ag->name)
     {
         LogMsg("GetAuthGroup: Failed to allocate name storage for %##s", rr->name->c);
         ReleaseAuthEntity(r, (AuthEntity*)ag);
         return(mDNSNULL);
     }
-    AssignDomainName(ag->name, rr->name);
 
     if (AuthGroupForRecord(r, rr)) LogMsg("GetAuthGroup: Already have AuthGroup for %##s", rr->name->c);
-    r->rrauth_hash[slot] = ag;
+    AuthHashHead(r, slot) = ag;
     if (AuthGroupForRecord(r, rr) != ag) LogMsg("GetAuthGroup: Not finding AuthGroup for %##s", rr->name->c);
 
     return(ag);
@@ -424,9 +436,8 @@ mDNSexport AuthGroup *InsertAuthRecord(mDNS *const m, AuthHash *r, AuthRecord *r
 {
     AuthGroup *ag;
 
-    (void)m;
     ag = AuthGroupForRecord(r, &rr->resrec);
-    if (!ag) ag = GetAuthGroup(r, &rr->resrec);   // If we don't have a AuthGroup for this name, make one now
+    if (!ag) ag = GetAuthGroup(m, r, &rr->resrec);   // If we don't have a AuthGroup for this name, make one now
     if (ag)
     {
         *(ag->rrauth_tail) = rr;                // Append this record to tail of cache slot list
@@ -460,10 +471,503 @@ mDNSexport AuthGroup *RemoveAuthRecord(mDNS *const m, AuthHash *r, AuthRecord *r
     return a;
 }
 
+mDNSexport void AuthHashSize(AuthHash *r, mDNSu32 names)
+{
+    const mDNSu32 current = AuthHashSlots(r);
+    mDNSu32 slots = (names > AUTH_HASH_MAX_SLOTS) ? AUTH_HASH_MAX_SLOTS : (names | 1);     // Odd, like AUTH_HASH_SLOTS
+    AuthGroup **table = mDNSNULL;
+    mDNSu32 slot;
+
+    if (slots <= AUTH_HASH_SLOTS) slots = AUTH_HASH_SLOTS;
+    if (slots == current || (names && slots > current / 4 && slots < current * 2)) return;
+    if (slots > AUTH_HASH_SLOTS)
+    {
+        table = (AuthGroup **)mDNSPlatformMemAllocateClear(slots * (mDNSu32)sizeof(*table));
+        if (!table) { LogMsg("AuthHashSize: Failed to allocate %u slots", slots); return; }
+    }
+    else mDNSPlatformMemZero(r->rrauth_hash, sizeof(r->rrauth_hash));
+
+    // Take every AuthGroup off the old table and chain it into the new one
+    for (slot = 0; slot < current; slot++)
+    {
+        AuthGroup *ag = r->rrauth_table ? r->rrauth_table[slot] : r->rrauth_hash[slot];
+        if (!r->rrauth_table) r->rrauth_hash[slot] = mDNSNULL;
+        while (ag)
+        {
+            AuthGroup *const next = ag->next;
+            AuthGroup **const head = table ? &table[ag->namehash % slots] : &r->rrauth_hash[ag->namehash % slots];
+            ag->next = *head;
+            *head    = ag;
+            ag       = next;
+        }
+    }
+    if (r->rrauth_table) mDNSPlatformMemFree(r->rrauth_table);
+    r->rrauth_table = table;
+    r->rrauth_slots = table ? slots : 0;
+    LogInfo("AuthHashSize: %u slots for %u names", slots, names);
+}
+
+mDNSlocal void AddRecordToSPSHashes(mDNS *const m, AuthRecord *const rr);
+mDNSlocal void RemoveRecordFromSPSHashes(mDNS *const m, AuthRecord *const rr);
+
+// The records in m->ResourceRecords are also chained by name hash, so that query processing and conflict checks only
+// need to look at the records that could have the name they're after. This can't reuse AuthGroups the way m->rrauth
+// does, because AuthGroup members are linked through rr->next, which m->ResourceRecords is already using.
+#define FirstRecordForNameHash(M, X) ((M)->ResourceRecordHash[(X) % AUTH_HASH_SLOTS])
+
+mDNSlocal void AddRecordToNameHash(mDNS *const m, AuthRecord *const rr)
+{
+    AuthRecord **rp;
+
+    rr->NameHashSlot = (mDNSu16)(rr->resrec.namehash % AUTH_HASH_SLOTS);
+    rp = &m->ResourceRecordHash[rr->NameHashSlot];
+    rr->NextInNameHash = *rp;
+    *rp = rr;
+    AddRecordToSPSHashes(m, rr);
+}
+
+// Safe to call for a record that isn't in the hash, which leaves the hash unchanged
+mDNSexport void RemoveRecordFromNameHash(mDNS *const m, AuthRecord *const rr)
+{
+    AuthRecord **rp = &m->ResourceRecordHash[rr->NameHashSlot];
+
+    RemoveRecordFromSPSHashes(m, rr);
+    while (*rp && *rp != rr) rp = &(*rp)->NextInNameHash;
+    if (!*rp) return;
+    *rp = rr->NextInNameHash;
+    // If someone is about to look at this, bump the pointer forward
+    if (m->NextHashedRecord == rr) m->NextHashedRecord = rr->NextInNameHash;
+    rr->NextInNameHash = mDNSNULL;
+}
+
+// When we're a Sleep Proxy Server, the proxy records in m->ResourceRecords (the ones with a non-zero WakeUp.HMAC) are also
+// chained by owner H-MAC, by proxied address (for the ARP/NDP records) and by TCP connection (for the keepalive records).
+// The hashes follow the name hash: a record goes in when it goes on m->ResourceRecords and comes out when it comes off,
+// so proxy records sitting in m->DuplicateRecords are not in them. The keys can't change while the record is hashed,
+// except that WakeUp.HMAC may be cleared, so lookups still check that the record actually matches what they're after.
+mDNSlocal mDNSu32 SPSHashBytes(mDNSu32 sum, const mDNSu8 *p, int len)
+{
+    while (len--)
+    {
+        sum += *p++;
+        sum = (sum << 3) | (sum >> 29);
+    }
+    return(sum);
+}
+
+mDNSlocal mDNSu32 SPSAddressHashValue(mDNSu32 sum, const mDNSAddr *const addr)
+{
+    if      (addr->type == mDNSAddrType_IPv4) sum = SPSHashBytes(sum, addr->ip.v4.b, sizeof(mDNSv4Addr));
+    else if (addr->type == mDNSAddrType_IPv6) sum = SPSHashBytes(sum, addr->ip.v6.b, sizeof(mDNSv6Addr));
+    return(sum);
+}
+
+mDNSlocal mDNSu16 SPSKeepaliveHashSlot(const mDNSAddr *const laddr, const mDNSAddr *const raddr, const mDNSIPPort lport, const mDNSIPPort rport)
+{
+    mDNSu32 sum = SPSAddressHashValue(SPSAddressHashValue(0, laddr), raddr);
+    sum = SPSHashBytes(sum, lport.b, sizeof(lport));
+    sum = SPSHashBytes(sum, rport.b, sizeof(rport));
+    return((mDNSu16)(sum % SPS_HASH_SLOTS));
+}
+
+#define SPSOwnerHashSlot(E)   ((mDNSu16)(SPSHashBytes(0, (E)->b, sizeof(mDNSEthAddr)) % SPS_HASH_SLOTS))
+#define SPSAddressHashSlot(A) ((mDNSu16)(SPSAddressHashValue(0, (A)) % SPS_HASH_SLOTS))
+#define SPSv4HashSlot(A)      ((mDNSu16)(SPSHashBytes(0, (A)->b, sizeof(mDNSv4Addr)) % SPS_HASH_SLOTS))
+#define SPSv6HashSlot(A)      ((mDNSu16)(SPSHashBytes(0, (A)->b, sizeof(mDNSv6Addr)) % SPS_HASH_SLOTS))
+
+#define FirstRecordForOwner(M, E)       ((M)->SPSOwnerHash[SPSOwnerHashSlot(E)])
+#define FirstRecordForProxyAddress(M,S) ((M)->SPSAddressHash[(S)])
+
+// The keepalive records in m->SPSKeepaliveHash are also kept in m->KeepaliveHeap, a pairing heap ordered by KATimeExpire
+// (the same structure as m->rrcache_checkheap), so mDNS_SendKeepalives only visits the records that are due.
+
+#define KeepaliveIsScheduled(M, AR) ((M)->KeepaliveHeap == (AR) || (AR)->KAPrev)
+
+mDNSlocal AuthRecord *MeldKeepaliveHeaps(AuthRecord *a, AuthRecord *b)
+{
+    if (!a) return(b);
+    if (!b) return(a);
+    if (a->KATimeExpire - b->KATimeExpire > 0) { AuthRecord *const t = a; a = b; b = t; }
+    b->KAPrev    = a;
+    b->KASibling = a->KAChild;
+    if (a->KAChild) a->KAChild->KAPrev = b;
+    a->KAChild   = b;
+    return(a);
+}
+
+mDNSlocal AuthRecord *MergeKeepaliveSubheaps(AuthRecord *first)
+{
+    AuthRecord *pairs = mDNSNULL, *result = mDNSNULL;
+    while (first)
+    {
+        AuthRecord *const a = first;
+        AuthRecord *const b = a->KASibling;
+        AuthRecord *pair;
+        first = b ? b->KASibling : mDNSNULL;
+        a->KASibling = a->KAPrev = mDNSNULL;
+        if (b) b->KASibling = b->KAPrev = mDNSNULL;
+        pair = MeldKeepaliveHeaps(a, b);
+        pair->KASibling = pairs;
+        pairs = pair;
+    }
+    while (pairs)
+    {
+        AuthRecord *const next = pairs->KASibling;
+        pairs->KASibling = mDNSNULL;
+        result = MeldKeepaliveHeaps(result, pairs);
+        pairs = next;
+    }
+    return(result);
+}
+
+mDNSlocal void UpdateNextScheduledKA(mDNS *const m)
+{
+    m->NextScheduledKA = m->KeepaliveHeap ? m->KeepaliveHeap->KATimeExpire : m->timenow + FutureTime;
+}
+
+mDNSlocal void ScheduleKeepalive(mDNS *const m, AuthRecord *const ar)
+{
+    ar->KAChild = ar->KASibling = ar->KAPrev = mDNSNULL;
+    m->KeepaliveHeap = MeldKeepaliveHeaps(m->KeepaliveHeap, ar);
+    UpdateNextScheduledKA(m);
+}
+
+// Returns the root, which must be due, and leaves it unscheduled
+mDNSlocal AuthRecord *PopKeepalive(mDNS *const m)
+{
+    AuthRecord *const ar = m->KeepaliveHeap;
+    m->KeepaliveHeap = MergeKeepaliveSubheaps(ar->KAChild);
+    ar->KAChild = mDNSNULL;
+    return(ar);
+}
+
+mDNSlocal void CancelKeepalive(mDNS *const m, AuthRecord *const ar)
+{
+    if (!KeepaliveIsScheduled(m, ar)) return;
+    if (m->KeepaliveHeap == ar) m->KeepaliveHeap = mDNSNULL;
+    else
+    {
+        if (ar->KAPrev->KAChild == ar) ar->KAPrev->KAChild   = ar->KASibling;
+        else                           ar->KAPrev->KASibling = ar->KASibling;
+        if (ar->KASibling) ar->KASibling->KAPrev = ar->KAPrev;
+        ar->KASibling = ar->KAPrev = mDNSNULL;
+    }
+    m->KeepaliveHeap = MeldKeepaliveHeaps(m->KeepaliveHeap, MergeKeepaliveSubheaps(ar->KAChild));
+    ar->KAChild = mDNSNULL;
+    UpdateNextScheduledKA(m);
+}
+
+mDNSlocal void AddRecordToSPSHashes(mDNS *const m, AuthRecord *const rr)
+{
+    rr->SPSHashes = 0;
+    if (!rr->WakeUp.HMAC.l[0]) return;
+
+    rr->OwnerHashSlot   = SPSOwnerHashSlot(&rr->WakeUp.HMAC);
+    rr->NextInOwnerHash = m->SPSOwnerHash[rr->OwnerHashSlot];
+    m->SPSOwnerHash[rr->OwnerHashSlot] = rr;
+    rr->SPSHashes |= SPSHash_Owner;
+
+    if (rr->AddressProxy.type == mDNSAddrType_IPv4 || rr->AddressProxy.type == mDNSAddrType_IPv6)
+    {
+        rr->AddressHashSlot   = SPSAddressHashSlot(&rr->AddressProxy);
+        rr->NextInAddressHash = m->SPSAddressHash[rr->AddressHashSlot];
+        m->SPSAddressHash[rr->AddressHashSlot] = rr;
+        rr->SPSHashes |= SPSHash_Address;
+    }
+
+    if (mDNS_KeepaliveRecord(&rr->resrec))
+    {
+        mDNSu32 timeout = 0, seq = 0, ack = 0;
+        mDNSu16 win = 0;
+        mDNSAddr laddr = zeroAddr, raddr = zeroAddr;
+        mDNSEthAddr eth;
+        mDNSIPPort lport = zeroIPPort, rport = zeroIPPort;
+
+        mDNS_ExtractKeepaliveInfo(rr, &timeout, &laddr, &raddr, &eth, &seq, &ack, &lport, &rport, &win);
+        // Records that don't parse can never match an incoming TCP packet, so there's no point hashing them
+        if (timeout && !mDNSAddressIsZero(&laddr) && !mDNSAddressIsZero(&raddr) && seq && ack && !mDNSIPPortIsZero(lport) && !mDNSIPPortIsZero(rport) && win)
+        {
+            rr->KeepaliveHashSlot   = SPSKeepaliveHashSlot(&laddr, &raddr, lport, rport);
+            rr->NextInKeepaliveHash = m->SPSKeepaliveHash[rr->KeepaliveHashSlot];
+            m->SPSKeepaliveHash[rr->KeepaliveHashSlot] = rr;
+            rr->SPSHashes |= SPSHash_Keepalive;
+            // A fresh proxy record has KATimeExpire zero, meaning send a keepalive straight away
+            if (!rr->KATimeExpire) rr->KATimeExpire = m->timenow;
+            ScheduleKeepalive(m, rr);
+        }
+    }
+}
+
+mDNSlocal void RemoveRecordFromSPSHashes(mDNS *const m, AuthRecord *const rr)
+{
+    AuthRecord **rp;
+
+    if (rr->SPSHashes & SPSHash_Owner)
+    {
+        rp = &m->SPSOwnerHash[rr->OwnerHashSlot];
+        while (*rp && *rp != rr) rp = &(*rp)->NextInOwnerHash;
+        if (*rp) *rp = rr->NextInOwnerHash;
+        // If someone is about to look at this, bump the pointer forward
+        if (m->NextOwnerRecord == rr) m->NextOwnerRecord = rr->NextInOwnerHash;
+        rr->NextInOwnerHash = mDNSNULL;
+    }
+    if (rr->SPSHashes & SPSHash_Address)
+    {
+        rp = &m->SPSAddressHash[rr->AddressHashSlot];
+        while (*rp && *rp != rr) rp = &(*rp)->NextInAddressHash;
+        if (*rp) *rp = rr->NextInAddressHash;
+        rr->NextInAddressHash = mDNSNULL;
+    }
+    if (rr->SPSHashes & SPSHash_Keepalive)
+    {
+        rp = &m->SPSKeepaliveHash[rr->KeepaliveHashSlot];
+        while (*rp && *rp != rr) rp = &(*rp)->NextInKeepaliveHash;
+        if (*rp) *rp = rr->NextInKeepaliveHash;
+        rr->NextInKeepaliveHash = mDNSNULL;
+        CancelKeepalive(m, rr);
+    }
+    rr->SPSHashes = 0;
+}
+
+// ***************************************************************************
+#if COMPILER_LIKES_PRAGMA_MARK
+#pragma mark -
+#pragma mark - Size-class slabs for variable-length cache storage
+#endif
+
+static const mDNSu32 MemSlabClassSizes[MemSlabClasses] = { 64, 128, 256, 512, 1024, 0 };
+
+// Every object handed out is preceded by a header naming the slab it came from (NULL for oversize allocations)
+typedef union { MemSlab *slab; double align; } MemSlabHeader;
+
+struct MemSlab_struct
+{
+    MemSlab      *next;                     // Links for the owning class's list of available slabs
+    MemSlab      *prev;
+    void         *freelist;                 // Free objects, linked through their first word
+    mDNSu16       inuse;
+    mDNSu16       capacity;
+    mDNSu8        slabclass;
+    MemSlabHeader objects[1];               // capacity * (sizeof(MemSlabHeader) + objsize) bytes of objects
+};
+
+#define MemSlabStride(C) ((mDNSu32)sizeof(MemSlabHeader) + (C)->objsize)
+
+mDNSlocal void InitMemSlabs(mDNS *const m)
+{
+    int i;
+    for (i = 0; i < MemSlabClasses; i++)
+    {
+        mDNSPlatformMemZero(&m->rrcache_slabs[i], sizeof(m->rrcache_slabs[i]));
+        m->rrcache_slabs[i].objsize = MemSlabClassSizes[i];
+    }
+}
+
+mDNSlocal void MemSlabMakeAvailable(MemSlabClass *const c, MemSlab *const slab)
+{
+    slab->prev = mDNSNULL;
+    slab->next = c->available;
+    if (c->available) c->available->prev = slab;
+    c->available = slab;
+}
+
+mDNSlocal void MemSlabMakeUnavailable(MemSlabClass *const c, MemSlab *const slab)
+{
+    if (slab->prev) slab->prev->next = slab->next;
+    else c->available = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->next = slab->prev = mDNSNULL;
+}
+
+mDNSlocal MemSlab *NewMemSlab(MemSlabClass *const c, const mDNSu8 slabclass)
+{
+    const mDNSu32 stride = MemSlabStride(c);
+    const mDNSu32 header = (mDNSu32)(sizeof(MemSlab) - sizeof(MemSlabHeader));
+    const mDNSu16 capacity = (mDNSu16)((MemSlabBytes - header) / stride);
+    MemSlab *const slab = (MemSlab *)mDNSPlatformMemAllocate(header + capacity * stride);
+    mDNSu16 i;
+
+    if (!slab) return(mDNSNULL);
+    slab->inuse     = 0;
+    slab->capacity  = capacity;
+    slab->slabclass = slabclass;
+    slab->freelist  = mDNSNULL;
+    for (i = capacity; i > 0; i--)
+    {
+        MemSlabHeader *const h = (MemSlabHeader *)((mDNSu8 *)slab->objects + (i - 1) * stride);
+        h->slab = slab;
+        *(void **)(h + 1) = slab->freelist;
+        slab->freelist = h + 1;
+    }
+    c->slabs++;
+    return(slab);
+}
+
+mDNSlocal void *MemSlabAllocate(mDNS *const m, const mDNSu32 len)
+{
+    mDNSu8 i;
+    MemSlabClass *c;
+    void *obj;
+
+    for (i = 0; i < MemSlabOversize && len > m->rrcache_slabs[i].objsize; i++) continue;
+    c = &m->rrcache_slabs[i];
+    if (i == MemSlabOversize)
+    {
+        MemSlabHeader *const h = (MemSlabHeader *)mDNSPlatformMemAllocate((mDNSu32)sizeof(MemSlabHeader) + len);
+        if (!h) return(mDNSNULL);
+        h->slab = mDNSNULL;
+        obj = h + 1;
+    }
+    else
+    {
+        MemSlab *slab = c->available;
+        if (!slab)
+        {
+            if (c->empty) { slab = c->empty; c->empty = mDNSNULL; }
+            else slab = NewMemSlab(c, i);
+            if (!slab) return(mDNSNULL);
+            MemSlabMakeAvailable(c, slab);
+        }
+        obj = slab->freelist;
+        slab->freelist = *(void **)obj;
+        slab->inuse++;
+        if (!slab->freelist) MemSlabMakeUnavailable(c, slab);
+    }
+    c->allocs++;
+    if (++c->inuse > c->peak) c->peak = c->inuse;
+    return(obj);
+}
+
+mDNSlocal void MemSlabFree(mDNS *const m, void *const obj)
+{
+    MemSlabHeader *const h = (MemSlabHeader *)obj - 1;
+    MemSlab *const slab = h->slab;
+    MemSlabClass *c;
+
+    if (!slab)
+    {
+        m->rrcache_slabs[MemSlabOversize].inuse--;
+        mDNSPlatformMemFree(h);
+        return;
+    }
+    c = &m->rrcache_slabs[slab->slabclass];
+    c->inuse--;
+    if (!slab->freelist) MemSlabMakeAvailable(c, slab);
+    *(void **)obj = slab->freelist;
+    slab->freelist = obj;
+    if (--slab->inuse == 0)
+    {
+        MemSlabMakeUnavailable(c, slab);
+        if (!c->empty) c->empty = slab;
+        else
+        {
+            mDNSPlatformMemFree(slab);
+            c->slabs--;
+            c->released++;
+        }
+    }
+}
+
+mDNSlocal void ReleaseEmptyMemSlabs(mDNS *const m)
+{
+    int i;
+    for (i = 0; i < MemSlabClasses; i++)
+    {
+        MemSlabClass *const c = &m->rrcache_slabs[i];
+        if (c->empty)
+        {
+            mDNSPlatformMemFree(c->empty);
+            c->empty = mDNSNULL;
+            c->slabs--;
+            c->released++;
+        }
+    }
+}
+
+// Interned names are hashed into a power of two number of buckets, so fold the high bits of the name hash in first
+#define InternedNameMinSlots        64
+#define InternedNameSlot(HASH, SLOTS) (((HASH) ^ ((HASH) >> 16)) & ((SLOTS) - 1))
+
+mDNSlocal InternedName *InternedNameEntry(const domainname *const name)
+{
+    return((InternedName *)((mDNSu8 *)name - InternedNameHeaderSize));
+}
+
+// Doubles the bucket array; if that can't be allocated we carry on with the one we have and longer chains
+mDNSlocal void GrowInternedNames(mDNS *const m)
+{
+    const mDNSu32 slots = m->names_slots ? m->names_slots * 2 : InternedNameMinSlots;
+    InternedName **const hash = (InternedName **) mDNSPlatformMemAllocateClear(slots * (mDNSu32)sizeof(*hash));
+    mDNSu32 i;
+
+    if (!hash) return;
+    for (i = 0; i < m->names_slots; i++)
+    {
+        while (m->names_hash[i])
+        {
+            InternedName *const n = m->names_hash[i];
+            const mDNSu32 slot = InternedNameSlot(n->namehash, slots);
+            m->names_hash[i] = n->next;
+            n->next = hash[slot];
+            hash[slot] = n;
+        }
+    }
+    if (m->names_hash) mDNSPlatformMemFree(m->names_hash);
+    m->names_hash  = hash;
+    m->names_slots = slots;
+}
+
+// Returns the interned copy of name, taking a reference on it, or NULL if it had to be copied and there was no memory
+mDNSlocal const domainname *InternDomainName(mDNS *const m, const domainname *const name, const mDNSu32 namehash)
+{
+    const mDNSu16 namelen = DomainNameLength(name);
+    InternedName *n;
+    mDNSu32 slot;
+
+    if (m->names_count >= m->names_slots * 2) GrowInternedNames(m);
+    if (!m->names_hash || namelen > MAX_DOMAIN_NAME) return(mDNSNULL);
+
+    slot = InternedNameSlot(namehash, m->names_slots);
+    for (n = m->names_hash[slot]; n; n = n->next)
+    {
+        if (n->namehash == namehash && SameDomainName(&n->name, name))
+        {
+            n->refs++;
+            m->names_shared++;
+            return(&n->name);
+        }
+    }
+
+    n = (InternedName *) MemSlabAllocate(m, InternedNameHeaderSize + namelen);
+    if (!n) return(mDNSNULL);
+    n->namehash = namehash;
+    n->refs     = 1;
+    mDNSPlatformMemCopy(n->name.c, name->c, namelen);
+    n->next = m->names_hash[slot];
+    m->names_hash[slot] = n;
+    m->names_count++;
+    m->names_bytes += InternedNameHeaderSize + namelen;
+    return(&n->name);
+}
+
+mDNSlocal void ReleaseInternedName(mDNS *const m, const domainname *const name)
+{
+    InternedName *const n = InternedNameEntry(name);
+    InternedName **p;
+
+    if (--n->refs) return;
+    for (p = &m->names_hash[InternedNameSlot(n->namehash, m->names_slots)]; *p && *p != n; p = &(*p)->next) continue;
+    if (!*p) { LogMsg("ReleaseInternedName: ERROR!! %##s is not in the name store", name->c); return; }
+    *p = n->next;
+    m->names_count--;
+    m->names_bytes -= InternedNameHeaderSize + DomainNameLength(&n->name);
+    MemSlabFree(m, n);
+}
+
 mDNSexport CacheGroup *CacheGroupForName(const mDNS *const m, const mDNSu32 namehash, const domainname *const name)
 {
     CacheGroup *cg;
-    mDNSu32    slot = HashSlotFromNameHash(namehash);
+    mDNSu32    slot = HashSlotFromNameHash(m, namehash);
     for (cg = m->rrcache_hash[slot]; cg; cg=cg->next)
         if (cg->namehash == namehash && SameDomainName(cg->name, name))
             break;
@@ -475,6 +979,128 @@ mDNSlocal CacheGroup *CacheGroupForRecord(const mDNS *const m, const ResourceRec
     return(CacheGroupForName(m, rr->namehash, rr->name));
 }
 
+// The cache hash table is a linear hash table. Slots below (rrcache_slots - rrcache_hash_base) have already been
+// split this round and are addressed using twice the base modulus; the rest are still addressed using the base modulus.
+mDNSexport mDNSu32 CacheHashSlot(const mDNS *const m, const mDNSu32 namehash)
+{
+    mDNSu32 slot = namehash % m->rrcache_hash_base;
+    if (slot < m->rrcache_slots - m->rrcache_hash_base) slot = namehash % (m->rrcache_hash_base * 2);
+    return(slot);
+}
+
+mDNSlocal mDNSBool SetCacheHashCapacity(mDNS *const m, mDNSu32 capacity)
+{
+    CacheGroup **hash;
+
+    if (capacity <= CACHE_HASH_SLOTS)
+    {
+        capacity = CACHE_HASH_SLOTS;
+        hash     = m->rrcache_hash_initial;
+    }
+    else
+    {
+        hash = (CacheGroup **)mDNSPlatformMemAllocate(capacity * (mDNSu32)sizeof(*hash));
+        if (!hash)
+        {
+            LogMsg("SetCacheHashCapacity: Failed to allocate %u cache hash slots", capacity);
+            return(mDNSfalse);
+        }
+    }
+    if (hash != m->rrcache_hash)
+    {
+        mDNSPlatformMemCopy(hash, m->rrcache_hash, m->rrcache_slots * (mDNSu32)sizeof(*hash));
+        if (m->rrcache_hash != m->rrcache_hash_initial) mDNSPlatformMemFree(m->rrcache_hash);
+        m->rrcache_hash = hash;
+    }
+    m->rrcache_hash_capacity = capacity;
+    return(mDNStrue);
+}
+
+// Splits the next slot of this round in two, moving the CacheGroups that now hash to the new slot
+mDNSlocal mDNSBool SplitCacheHashSlot(mDNS *const m)
+{
+    const mDNSu32 from = m->rrcache_slots - m->rrcache_hash_base;
+    const mDNSu32 to   = m->rrcache_slots;
+    CacheGroup **cp, **tail;
+
+    if (to >= CACHE_HASH_MAX_SLOTS) return(mDNSfalse);
+    if (to >= m->rrcache_hash_capacity && !SetCacheHashCapacity(m, m->rrcache_hash_capacity * 2)) return(mDNSfalse);
+
+    m->rrcache_hash[to] = mDNSNULL;
+    m->rrcache_slots++;
+
+    cp   = &m->rrcache_hash[from];
+    tail = &m->rrcache_hash[to];
+    while (*cp)
+    {
+        CacheGroup *const cg = *cp;
+        if (CacheHashSlot(m, cg->namehash) == to)
+        {
+            *cp      = cg->next;
+            cg->next = mDNSNULL;
+            *tail    = cg;
+            tail     = &cg->next;
+        }
+        else cp = &cg->next;
+    }
+    if (m->rrcache_slots == m->rrcache_hash_base * 2) m->rrcache_hash_base *= 2;
+    return(mDNStrue);
+}
+
+// Undoes the most recent split, appending the last slot's CacheGroups to the slot it was split from
+mDNSlocal mDNSBool MergeCacheHashSlot(mDNS *const m)
+{
+    mDNSu32 from, to;
+    CacheGroup **cp;
+
+    if (m->rrcache_slots <= CACHE_HASH_SLOTS) return(mDNSfalse);
+    if (m->rrcache_slots == m->rrcache_hash_base) m->rrcache_hash_base /= 2;
+    from = m->rrcache_slots - 1;
+    to   = from - m->rrcache_hash_base;
+
+    for (cp = &m->rrcache_hash[to]; *cp; cp = &(*cp)->next) continue;
+    *cp = m->rrcache_hash[from];
+    m->rrcache_hash[from] = mDNSNULL;
+    m->rrcache_slots--;
+
+    if (m->rrcache_slots == CACHE_HASH_SLOTS)
+        SetCacheHashCapacity(m, CACHE_HASH_SLOTS);
+    else if (m->rrcache_hash_capacity > CACHE_HASH_SLOTS && m->rrcache_slots <= m->rrcache_hash_capacity / 4)
+        SetCacheHashCapacity(m, m->rrcache_hash_capacity / 2);
+    return(mDNStrue);
+}
+
+#define CacheHashNeedsGrow(M)   ((M)->rrcache_groups > (M)->rrcache_slots * CACHE_HASH_MAX_LOAD && (M)->rrcache_slots < CACHE_HASH_MAX_SLOTS)
+#define CacheHashNeedsShrink(M) ((M)->rrcache_groups * CACHE_HASH_MIN_LOAD < (M)->rrcache_slots && (M)->rrcache_slots > CACHE_HASH_SLOTS)
+
+mDNSlocal void CheckCacheHashLoad(mDNS *const m)
+{
+    if (!m->NextCacheResize && (CacheHashNeedsGrow(m) || CacheHashNeedsShrink(m)))
+        m->NextCacheResize = NonZeroTime(m->timenow);
+}
+
+// Called from mDNS_Execute. Does at most CACHE_HASH_RESIZE_STEPS splits or merges, and returns the time of the
+// next pass, or zero if the table is now within its load bounds.
+mDNSlocal mDNSs32 ResizeCacheHash(mDNS *const m)
+{
+    int steps;
+    for (steps = 0; steps < CACHE_HASH_RESIZE_STEPS; steps++)
+    {
+        if (CacheHashNeedsGrow(m))
+        {
+            // If we can't get memory for a bigger table just keep the current one for a while
+            if (!SplitCacheHashSlot(m)) return(NonZeroTime(m->timenow + 60 * mDNSPlatformOneSecond));
+        }
+        else if (CacheHashNeedsShrink(m)) MergeCacheHashSlot(m);
+        else
+        {
+            debugf("ResizeCacheHash: %u CacheGroups in %u slots", m->rrcache_groups, m->rrcache_slots);
+            return(0);
+        }
+    }
+    return(NonZeroTime(m->timenow));
+}
+
 mDNSexport mDNSBool mDNS_AddressIsLocalSubnet(mDNS *const m, const mDNSInterfaceID InterfaceID, const mDNSAddr *addr)
 {
     NetworkInterfaceInfo *intf;
@@ -504,13 +1130,54 @@ mDNSexport mDNSBool mDNS_AddressIsLocalSubnet(mDNS *const m, const mDNSInterface
     return(mDNSfalse);
 }
 
+// The first entry in m->HostInterfaces for each InterfaceID is also chained into m->InterfaceIDHash, since
+// packet and record processing look interfaces up by InterfaceID far more often than the list changes
+#define InterfaceIDHashSlot(ID) (IIDPrintable(ID) % INTERFACE_HASH_SLOTS)
+
 mDNSlocal NetworkInterfaceInfo *FirstInterfaceForID(mDNS *const m, const mDNSInterfaceID InterfaceID)
 {
-    NetworkInterfaceInfo *intf = m->HostInterfaces;
-    while (intf && intf->InterfaceID != InterfaceID) intf = intf->next;
+    NetworkInterfaceInfo *intf = m->InterfaceIDHash[InterfaceIDHashSlot(InterfaceID)];
+    while (intf && intf->InterfaceID != InterfaceID) intf = intf->NextInIDHash;
     return(intf);
 }
 
+// Makes the InterfaceIDHash entry for InterfaceID the first one in m->HostInterfaces with that InterfaceID again,
+// after set, which used to be that entry, has been unlinked from m->HostInterfaces or moved within it
+mDNSlocal void RehashInterfaceID(mDNS *const m, NetworkInterfaceInfo *const set)
+{
+    NetworkInterfaceInfo **p = &m->InterfaceIDHash[InterfaceIDHashSlot(set->InterfaceID)];
+    NetworkInterfaceInfo *intf;
+
+    while (*p && (*p)->InterfaceID != set->InterfaceID) p = &(*p)->NextInIDHash;
+    if (*p) *p = (*p)->NextInIDHash;
+    set->NextInIDHash = mDNSNULL;
+
+    for (intf = m->HostInterfaces; intf && intf->InterfaceID != set->InterfaceID; intf = intf->next) continue;
+    if (intf)
+    {
+        intf->NextInIDHash = m->InterfaceIDHash[InterfaceIDHashSlot(intf->InterfaceID)];
+        m->InterfaceIDHash[InterfaceIDHashSlot(intf->InterfaceID)] = intf;
+    }
+}
+
+// For platform layers that reorder m->HostInterfaces themselves
+mDNSexport void mDNS_RehashInterfaces(mDNS *const m)
+{
+    NetworkInterfaceInfo *intf;
+    int slot;
+
+    for (slot = 0; slot < INTERFACE_HASH_SLOTS; slot++) m->InterfaceIDHash[slot] = mDNSNULL;
+    for (intf = m->HostInterfaces; intf; intf = intf->next)
+    {
+        intf->NextInIDHash = mDNSNULL;
+        if (!FirstInterfaceForID(m, intf->InterfaceID))
+        {
+            intf->NextInIDHash = m->InterfaceIDHash[InterfaceIDHashSlot(intf->InterfaceID)];
+            m->InterfaceIDHash[InterfaceIDHashSlot(intf->InterfaceID)] = intf;
+        }
+    }
+}
+
 mDNSlocal NetworkInterfaceInfo *FirstIPv4LLInterfaceForID(mDNS *const m, const mDNSInterfaceID InterfaceID)
 {
     NetworkInterfaceInfo *intf;
@@ -680,21 +1347,80 @@ mDNSexport void AnswerQuestionByFollowingCNAME(mDNS *const m, DNSQuestion *q, Re
 
 // #define DEBUG_PUNYCODE 1
 
+// Converting a label means a UTS #46 mapping and normalization pass in ICU, and apps on localized systems start and
+// restart the same IDN questions over and over, so the UTS #46 object is opened once and the most recent label
+// conversions (failures included) are remembered in a small table shared by all questions, least recently used
+// entry replaced first.
+#ifndef PUNYCODE_CACHE_SIZE
+#define PUNYCODE_CACHE_SIZE 16
+#endif
+
+typedef struct
+{
+    mDNSu32 lastUse;                        // sPunycodeClock when this entry was last used; zero if it's unused
+    mDNSu8  label[1 + MAX_DOMAIN_LABEL];    // High-ASCII label as a length byte followed by its UTF-8
+    mDNSu8  ace[1 + MAX_DOMAIN_LABEL];      // Its ACE ("xn--") form, or a zero length byte if it doesn't convert
+} PunycodeCacheEntry;
+
+mDNSlocal PunycodeCacheEntry sPunycodeCache[PUNYCODE_CACHE_SIZE];
+mDNSlocal mDNSu32 sPunycodeClock;
+mDNSlocal UIDNA *sUTS46;
+
+mDNSlocal PunycodeCacheEntry *PunycodeCacheLookup(const mDNSu8 *const src)
+{
+    PunycodeCacheEntry *victim = &sPunycodeCache[0];
+    mDNSu32 i;
+
+    if (++sPunycodeClock == 0) // On wrap-around start the ages afresh, rather than have old entries look new
+    {
+        for (i = 0; i < PUNYCODE_CACHE_SIZE; i++) if (sPunycodeCache[i].lastUse) sPunycodeCache[i].lastUse = 1;
+        sPunycodeClock = 2;
+    }
+    for (i = 0; i < PUNYCODE_CACHE_SIZE; i++)
+    {
+        PunycodeCacheEntry *const e = &sPunycodeCache[i];
+        if (e->lastUse && e->label[0] == src[0] && mDNSPlatformMemSame(e->label + 1, src + 1, src[0]))
+        {
+            e->lastUse = sPunycodeClock;
+            return(e);
+        }
+        if (!e->lastUse) { victim = e; break; }  // Entries are filled in order and never emptied, so the rest are unused
+        if ((mDNSs32)(e->lastUse - victim->lastUse) < 0) victim = e;
+    }
+
+    // Not seen recently: convert it and remember the result in place of the least recently used entry
+    {
+        UErrorCode errorCode = U_ZERO_ERROR;
+        UIDNAInfo info = UIDNA_INFO_INITIALIZER;
+        char buffer[MAX_DOMAIN_NAME];
+        int32_t len = -1;
+
+        if (!sUTS46) sUTS46 = uidna_openUTS46(UIDNA_USE_STD3_RULES|UIDNA_NONTRANSITIONAL_TO_UNICODE, &errorCode);
+        if (sUTS46) len = uidna_nameToASCII_UTF8(sUTS46, (const char *)src+1, src[0], buffer, (int32_t)sizeof(buffer), &info, &errorCode);
+        #if DEBUG_PUNYCODE
+        if (errorCode) LogMsg("uidna_nameToASCII_UTF8(%##s) failed errorCode %d", src, errorCode);
+        if (info.errors) LogMsg("uidna_nameToASCII_UTF8(%##s) failed info.errors 0x%08X", src, info.errors);
+        if (len > MAX_DOMAIN_LABEL) LogMsg("uidna_nameToASCII_UTF8(%##s) result too long %d", src, len);
+        #endif
+        if (!sUTS46) return(mDNSNULL);     // Couldn't open ICU's UTS #46 support; try again next time
+        mDNSPlatformMemCopy(victim->label, src, 1 + src[0]);
+        if (errorCode || info.errors || len < 0 || len > MAX_DOMAIN_LABEL) victim->ace[0] = 0;
+        else
+        {
+            victim->ace[0] = (mDNSu8)len;
+            mDNSPlatformMemCopy(victim->ace + 1, buffer, (mDNSu32)len);
+        }
+        victim->lastUse = sPunycodeClock;
+        return(victim);
+    }
+}
+
 mDNSlocal mDNSu8 *PunycodeConvert(const mDNSu8 *const src, mDNSu8 *const dst, const mDNSu8 *const end)
 {
-    UErrorCode errorCode = U_ZERO_ERROR;
-    UIDNAInfo info = UIDNA_INFO_INITIALIZER;
-    UIDNA *uts46 = uidna_openUTS46(UIDNA_USE_STD3_RULES|UIDNA_NONTRANSITIONAL_TO_UNICODE, &errorCode);
-    int32_t len = uidna_nameToASCII_UTF8(uts46, (const char *)src+1, src[0], (char *)dst+1, (int32_t)(end-(dst+1)), &info, &errorCode);
-    uidna_close(uts46);
-    #if DEBUG_PUNYCODE
-    if (errorCode) LogMsg("uidna_nameToASCII_UTF8(%##s) failed errorCode %d", src, errorCode);
-    if (info.errors) LogMsg("uidna_nameToASCII_UTF8(%##s) failed info.errors 0x%08X", src, info.errors);
-    if (len > MAX_DOMAIN_LABEL) LogMsg("uidna_nameToASCII_UTF8(%##s) result too long %d", src, len);
-    #endif
-    if (errorCode || info.errors || len > MAX_DOMAIN_LABEL) return mDNSNULL;
-    *dst = len;
-    return(dst + 1 + len);
+    const PunycodeCacheEntry *const e = PunycodeCacheLookup(src);
+    if (!e || !e->ace[0] || dst + 1 + e->ace[0] > end) return mDNSNULL;
+    mDNSPlatformMemCopy(dst, e->ace, 1 + e->ace[0]);
+    return(dst + 1 + e->ace[0]);
 }
 
 mDNSlocal mDNSBool IsHighASCIILabel(const mDNSu8 *d)
@@ -992,6 +1718,8 @@ mDNSlocal mDNSBool PacketRRMatchesSignature(const CacheRecord *const pktrr, cons
 {
     if (!pktrr)  { LogMsg("PacketRRMatchesSignature ERROR: pktrr is NULL"); return(mDNSfalse); }
     if (!authrr) { LogMsg("PacketRRMatchesSignature ERROR: authrr is NULL"); return(mDNSfalse); }
+    // Most of the records sharing a name hash chain have some other name, so turn those away before anything else
+    if (pktrr->resrec.namehash != authrr->resrec.namehash) return(mDNSfalse);
     if (pktrr->resrec.InterfaceID &&
         authrr->resrec.InterfaceID &&
         pktrr->resrec.InterfaceID != authrr->resrec.InterfaceID) return(mDNSfalse);
@@ -1001,7 +1729,6 @@ mDNSlocal mDNSBool PacketRRMatchesSignature(const CacheRecord *const pktrr, cons
         !mDNSPlatformValidRecordForInterface(authrr, pktrr->resrec.InterfaceID)) return(mDNSfalse);
     return (mDNSBool)(
                pktrr->resrec.rrclass == authrr->resrec.rrclass &&
-               pktrr->resrec.namehash == authrr->resrec.namehash &&
                SameDomainName(pktrr->resrec.name, authrr->resrec.name));
 }
 
@@ -1191,7 +1918,7 @@ mDNSlocal void SetTargetToHostName(mDNS *const m, AuthRecord *const rr)
     {
         const domainname *const n = SetUnicastTargetToHostName(m, rr);
         if (n) newname = n;
-        else { if (target) target->c[0] = 0; SetNewRData(&rr->resrec, mDNSNULL, 0); return; }
+        else { if (target) target->c[0] = 0; SetNewRData(&rr->resrec, mDNSNULL, 0); rr->WireCache.valid = mDNSfalse; return; }
     }
 
     if (target && SameDomainName(target, newname))
@@ -1201,6 +1928,7 @@ mDNSlocal void SetTargetToHostName(mDNS *const m, AuthRecord *const rr)
     {
         AssignDomainName(target, newname);
         SetNewRData(&rr->resrec, mDNSNULL, 0);      // Update rdlength, rdestimate, rdatahash
+        rr->WireCache.valid = mDNSfalse;
 
         // If we're in the middle of probing this record, we need to start again,
         // because changing its rdata may change the outcome of the tie-breaker.
@@ -1355,7 +2083,8 @@ mDNSlocal mDNSBool CheckAuthRecordConflict(AuthHash *r, AuthRecord *rr)
     {
         const AuthRecord *s1 = rr->RRSet ? rr->RRSet : rr;
         const AuthRecord *s2 = rp->RRSet ? rp->RRSet : rp;
-        if (s1 != s2 && SameResourceRecordSignature(rp, rr) && !IdenticalSameNameRecord(&rp->resrec, &rr->resrec))
+        // A record still delivering its removal events (e.g. an /etc/hosts entry being replaced) is on its way out
+        if (rp->resrec.RecordType != kDNSRecordTypeDeregistering && s1 != s2 && SameResourceRecordSignature(rp, rr) && !IdenticalSameNameRecord(&rp->resrec, &rr->resrec))
             return mDNStrue;
         else
             rp = rp->next;
@@ -1693,10 +2422,14 @@ mDNSexport mStatus mDNS_Register_internal(mDNS *const m, AuthRecord *const rr)
 //  rr->LastMCInterface   = Set for us in InitializeLastAPTime()
     rr->NewRData          = mDNSNULL;
     rr->newrdlength       = 0;
+    rr->WireCache.valid   = mDNSfalse;
     rr->UpdateCallback    = mDNSNULL;
     rr->UpdateCredits     = kMaxUpdateCredits;
     rr->NextUpdateCredit  = 0;
     rr->UpdateBlocked     = 0;
+    rr->LastUpdateAnnounce = 0;
+    rr->SentInResponses   = 0;
+    rr->SentInProbes      = 0;
 
     // For records we're holding as proxy (except reverse-mapping PTR records) two announcements is sufficient
     if (rr->WakeUp.HMAC.l[0] && !rr->AddressProxy.type) rr->AnnounceCount = 2;
@@ -1765,6 +2498,9 @@ mDNSexport mStatus mDNS_Register_internal(mDNS *const m, AuthRecord *const rr)
 
     rr->resrec.namehash   = DomainNameHashValue(rr->resrec.name);
     rr->resrec.rdatahash  = target ? DomainNameHashValue(target) : RDataHashValue(&rr->resrec);
+    rr->NameHashSlot      = (mDNSu16)(rr->resrec.namehash % AUTH_HASH_SLOTS);
+    rr->NextInNameHash    = mDNSNULL;
+    rr->SPSHashes         = 0;
 
     if (RRLocalOnly(rr))
     {
@@ -1793,6 +2529,7 @@ mDNSexport mStatus mDNS_Register_internal(mDNS *const m, AuthRecord *const rr)
         // records to the list, so we now need to update p to advance to the new end to the list before appending our new record.
         while (*p) p=&(*p)->next;
         *p = rr;
+        AddRecordToNameHash(m, rr);
         if (rr->resrec.RecordType == kDNSRecordTypeUnique) rr->resrec.RecordType = kDNSRecordTypeVerified;
         rr->ProbeCount    = 0;
         rr->ProbeRestartCount = 0;
@@ -1812,7 +2549,7 @@ mDNSexport mStatus mDNS_Register_internal(mDNS *const m, AuthRecord *const rr)
     }
     else
     {
-        for (r = m->ResourceRecords; r; r=r->next)
+        for (r = FirstRecordForNameHash(m, rr->resrec.namehash); r; r=r->NextInNameHash)
             if (RecordIsLocalDuplicate(r, rr))
             {
                 if (r->resrec.RecordType == kDNSRecordTypeDeregistering) r->AnnounceCount = 0;
@@ -1852,6 +2589,7 @@ mDNSexport mStatus mDNS_Register_internal(mDNS *const m, AuthRecord *const rr)
         {
             if (!m->NewLocalRecords) m->NewLocalRecords = rr;
             *p = rr;
+            AddRecordToNameHash(m, rr);
         }
     }
 
@@ -1910,6 +2648,7 @@ mDNSlocal void CompleteRDataUpdate(mDNS *const m, AuthRecord *const rr)
     RData *OldRData = rr->resrec.rdata;
     mDNSu16 OldRDLen = rr->resrec.rdlength;
     SetNewRData(&rr->resrec, rr->NewRData, rr->newrdlength);    // Update our rdata
+    rr->WireCache.valid = mDNSfalse;
     rr->NewRData = mDNSNULL;                                    // Clear the NewRData pointer ...
     if (rr->UpdateCallback)
         rr->UpdateCallback(m, rr, OldRData, OldRDLen);          // ... and let the client know
@@ -1971,6 +2710,7 @@ mDNSexport mStatus mDNS_Deregister_internal(mDNS *const m, AuthRecord *const rr,
                 {
                     dup->next = rr->next;       // And then...
                     rr->next  = dup;            // ... splice it in right after the record we're about to delete
+                    AddRecordToNameHash(m, dup);
                 }
                 dup->resrec.RecordType        = rr->resrec.RecordType;
                 dup->ProbeCount      = rr->ProbeCount;
@@ -2109,6 +2849,7 @@ mDNSexport mStatus mDNS_Deregister_internal(mDNS *const m, AuthRecord *const rr,
         {
             *p = rr->next;                  // Cut this record from the list
             if (m->NewLocalRecords == rr) m->NewLocalRecords = rr->next;
+            RemoveRecordFromNameHash(m, rr);
             DecrementAutoTargetServices(m, rr);
         }
         // If someone is about to look at this, bump the pointer forward
@@ -2199,7 +2940,7 @@ mDNSlocal void AddRRSetAdditionalsToResponseList(mDNS *const m, AuthRecord ***nr
     AuthRecord *rr2;
     if (additional->resrec.RecordType & kDNSRecordTypeUniqueMask)
     {
-        for (rr2 = m->ResourceRecords; rr2; rr2 = rr2->next)
+        for (rr2 = FirstRecordForNameHash(m, additional->resrec.namehash); rr2; rr2 = rr2->NextInNameHash)
         {
             if ((rr2->resrec.namehash == additional->resrec.namehash) &&
                 (rr2->resrec.rrtype   == additional->resrec.rrtype) &&
@@ -2237,7 +2978,7 @@ mDNSlocal void AddAdditionalsToResponseList(mDNS *const m, AuthRecord *ResponseR
         // For SRV records, automatically add the Address record(s) for the target host
         if (rr->resrec.rrtype == kDNSType_SRV)
         {
-            for (rr2=m->ResourceRecords; rr2; rr2=rr2->next)                    // Scan list of resource records
+            for (rr2=FirstRecordForNameHash(m, rr->resrec.rdatahash); rr2; rr2=rr2->NextInNameHash) // Records named like the target
                 if (RRTypeIsAddressType(rr2->resrec.rrtype) &&                  // For all address records (A/AAAA) ...
                     ResourceRecordIsValidInterfaceAnswer(rr2, InterfaceID) &&   // ... which are valid for answer ...
                     rr->resrec.rdatahash == rr2->resrec.namehash &&         // ... whose name is the name of the SRV target
@@ -2246,7 +2987,7 @@ mDNSlocal void AddAdditionalsToResponseList(mDNS *const m, AuthRecord *ResponseR
         }
         else if (RRTypeIsAddressType(rr->resrec.rrtype))    // For A or AAAA, put counterpart as additional
         {
-            for (rr2=m->ResourceRecords; rr2; rr2=rr2->next)                    // Scan list of resource records
+            for (rr2=FirstRecordForNameHash(m, rr->resrec.namehash); rr2; rr2=rr2->NextInNameHash) // Records with this name
                 if (RRTypeIsAddressType(rr2->resrec.rrtype) &&                  // For all address records (A/AAAA) ...
                     ResourceRecordIsValidInterfaceAnswer(rr2, InterfaceID) &&   // ... which are valid for answer ...
                     rr->resrec.namehash == rr2->resrec.namehash &&              // ... and have the same name
@@ -2319,14 +3060,14 @@ mDNSlocal void SendDelayedUnicastResponse(mDNS *const m, const mDNSAddr *const d
             if (rr->resrec.RecordType & kDNSRecordTypeUniqueMask)
                 rr->resrec.rrclass |= kDNSClass_UniqueRRSet;        // Temporarily set the cache flush bit so PutResourceRecord will set it
 
-            newptr = PutResourceRecord(&m->omsg, responseptr, &m->omsg.h.numAnswers, &rr->resrec);
+            newptr = PutAuthRecord(&m->omsg, responseptr, &m->omsg.h.numAnswers, rr);
 
             rr->resrec.rrclass &= ~kDNSClass_UniqueRRSet;           // Make sure to clear cache flush bit back to normal state
             if (!newptr && m->omsg.h.numAnswers)
             {
                 break; // If packet full, send it now
             }
-            if (newptr) responseptr = newptr;
+            if (newptr) { responseptr = newptr; rr->SentInResponses++; }
             ResponseRecords = rr->NextResponse;
             rr->NextResponse    = mDNSNULL;
             rr->NR_AnswerTo     = mDNSNULL;
@@ -2340,10 +3081,10 @@ mDNSlocal void SendDelayedUnicastResponse(mDNS *const m, const mDNSAddr *const d
             rr = ResponseRecords;
             if (rr->resrec.RecordType & kDNSRecordTypeUniqueMask)
                 rr->resrec.rrclass |= kDNSClass_UniqueRRSet;        // Temporarily set the cache flush bit so PutResourceRecord will set it
-            newptr = PutResourceRecord(&m->omsg, responseptr, &m->omsg.h.numAdditionals, &rr->resrec);
+            newptr = PutAuthRecord(&m->omsg, responseptr, &m->omsg.h.numAdditionals, rr);
             rr->resrec.rrclass &= ~kDNSClass_UniqueRRSet;           // Make sure to clear cache flush bit back to normal state
 
-            if (newptr) responseptr = newptr;
+            if (newptr) { responseptr = newptr; rr->SentInResponses++; }
             if (newptr && m->omsg.h.numAnswers) rr->RequireGoodbye = mDNStrue;
             else if (rr->resrec.RecordType & kDNSRecordTypeUniqueMask) rr->ImmedAnswer = mDNSInterfaceMark;
             ResponseRecords = rr->NextResponse;
@@ -2674,6 +3415,15 @@ mDNSlocal mDNSBool ShouldSendGoodbyesBeforeSleep(mDNS *const m, const NetworkInt
     }
 }
 
+// True if rr comes out as the same bytes on every interface it's answered on: it's being sent on all interfaces,
+// has no rdata change pending (which would add a per-interface courtesy goodbye), and its TTL doesn't depend on
+// whether this particular interface is sending sleep goodbyes
+mDNSlocal mDNSBool AnswerIsInterfaceIndependent(mDNS *const m, const NetworkInterfaceInfo *intf, AuthRecord *rr)
+{
+    return (rr->ImmedAnswer == mDNSInterfaceMark && rr->resrec.InterfaceID == mDNSInterface_Any && !rr->NewRData &&
+            mDNSPlatformValidRecordForInterface(rr, intf->InterfaceID) && !ShouldSendGoodbyesBeforeSleep(m, intf, rr));
+}
+
 // Note about acceleration of announcements to facilitate automatic coalescing of
 // multiple independent threads of announcements into a single synchronized thread:
 // The announcements in the packet may be at different stages of maturity;
@@ -2696,6 +3446,8 @@ mDNSlocal void SendResponses(mDNS *const m)
     AuthRecord *rr, *r2;
     mDNSs32 maxExistingAnnounceInterval = 0;
     const NetworkInterfaceInfo *intf = GetFirstActiveInterface(m->HostInterfaces);
+    mDNSu8 *sharedAnswersEnd = mDNSNULL;    // End of an answer section in m->omsg that the next interface may send as it is
+    mDNSu16 sharedNumAnswers = 0;
 
     m->NextScheduledResponse = m->timenow + FutureTime;
 
@@ -2907,71 +3659,125 @@ mDNSlocal void SendResponses(mDNS *const m)
         int numAnnounce = 0;
         int numAnswer   = 0;
         mDNSu8 *responseptr = m->omsg.data;
+        mDNSu8 *answersEnd = m->omsg.data;     // End of the interface-independent answers at the start of this packet
+        mDNSu16 numShared = 0;
         mDNSu8 *newptr;
+        mDNSBool shareable = mDNStrue;
+        int pass;
         InitializeDNSMessage(&m->omsg.h, zeroID, ResponseFlags);
 
+        // If the last interface sent everything in a single packet, the interface-independent answers it started that packet
+        // with are still at the front of m->omsg. When this interface has exactly the same ones to send (the same records
+        // in the same list order, since each was passed on here as soon as it was sent on the last interface), the First
+        // Pass would only write the same bytes again, so keep them and just do its per-record bookkeeping. Everything
+        // that differs -- interface-specific answers such as address records, and the additionals, NSECs and OPT below,
+        // which carry this interface's addresses and MAC -- is still built per interface after them.
+        if (!pktcount && sharedAnswersEnd && sharedAnswersEnd <= m->omsg.data + AllowedRRSpace(&m->omsg) - OwnerRecordSpace - TraceRecordSpace)
+        {
+            mDNSu16 count = 0;
+            for (rr = m->ResourceRecords; rr; rr=rr->next)
+                if (rr->SendRNow == intf->InterfaceID && AnswerIsInterfaceIndependent(m, intf, rr)) count++;
+            if (count == sharedNumAnswers)
+            {
+                for (rr = m->ResourceRecords; rr; rr=rr->next)
+                    if (rr->SendRNow == intf->InterfaceID && AnswerIsInterfaceIndependent(m, intf, rr))
+                    {
+                        const mDNSBool active = (rr->resrec.RecordType != kDNSRecordTypeDeregistering);
+                        rr->RequireGoodbye = active;
+                        rr->SentInResponses++;
+                        if (!active) numDereg++;
+                        else if (rr->LastAPTime == m->timenow) numAnnounce++;else numAnswer++;
+                        if (active && (rr->resrec.RecordType & kDNSRecordTypeActiveUniqueMask) && !rr->SendNSECNow)
+                            rr->SendNSECNow = mDNSInterfaceMark;
+                        rr->SendRNow = GetNextActiveInterfaceID(intf);
+                    }
+                m->omsg.h.numAnswers = numShared = sharedNumAnswers;
+                responseptr = answersEnd = sharedAnswersEnd;
+                AddMessageToCompressionTable(&m->omsg, responseptr);   // So the names after them can still be compressed
+                m->mDNSStats.SharedResponseAnswers++;
+            }
+        }
+        if (!pktcount && responseptr == m->omsg.data) sharedAnswersEnd = mDNSNULL;     // About to be overwritten
+
         // First Pass. Look for:
         // 1. Deregistering records that need to send their goodbye packet
         // 2. Updated records that need to retract their old data
         // 3. Answers and announcements we need to send
-        for (rr = m->ResourceRecords; rr; rr=rr->next)
+        // Interface-independent answers go in first (pass 0, skipped if they were taken over from the last interface above)
+        // so that they form a prefix of the answer section the next interface can reuse; then everything else (pass 1).
+        for (pass = (responseptr == m->omsg.data) ? 0 : 1; pass < 2; pass++)
         {
-
-            // Skip this interface if the record InterfaceID is *Any and the record is not
-            // appropriate for the interface type.
-            if ((rr->SendRNow == intf->InterfaceID) &&
-                ((rr->resrec.InterfaceID == mDNSInterface_Any) && !mDNSPlatformValidRecordForInterface(rr, intf->InterfaceID)))
-            {
-                rr->SendRNow = GetNextActiveInterfaceID(intf);
-            }
-            else if (rr->SendRNow == intf->InterfaceID)
+            for (rr = m->ResourceRecords; rr; rr=rr->next)
             {
-                RData  *OldRData    = rr->resrec.rdata;
-                mDNSu16 oldrdlength = rr->resrec.rdlength;
-                mDNSu8 active = (mDNSu8)
-                                (rr->resrec.RecordType != kDNSRecordTypeDeregistering && !ShouldSendGoodbyesBeforeSleep(m, intf, rr));
-                newptr = mDNSNULL;
-                if (rr->NewRData && active)
+                if (rr->SendRNow == intf->InterfaceID && AnswerIsInterfaceIndependent(m, intf, rr) != !pass) continue;
+                // Skip this interface if the record InterfaceID is *Any and the record is not
+                // appropriate for the interface type.
+                if ((rr->SendRNow == intf->InterfaceID) &&
+                    ((rr->resrec.InterfaceID == mDNSInterface_Any) && !mDNSPlatformValidRecordForInterface(rr, intf->InterfaceID)))
+                {
+                    rr->SendRNow = GetNextActiveInterfaceID(intf);
+                }
+                else if (rr->SendRNow == intf->InterfaceID)
                 {
-                    // See if we should send a courtesy "goodbye" for the old data before we replace it.
-                    if (ResourceRecordIsValidAnswer(rr) && rr->resrec.RecordType == kDNSRecordTypeShared && rr->RequireGoodbye)
+                    RData  *OldRData    = rr->resrec.rdata;
+                    mDNSu16 oldrdlength = rr->resrec.rdlength;
+                    mDNSu8 active = (mDNSu8)
+                                    (rr->resrec.RecordType != kDNSRecordTypeDeregistering && !ShouldSendGoodbyesBeforeSleep(m, intf, rr));
+                    newptr = mDNSNULL;
+                    if (rr->NewRData && active)
                     {
-                        newptr = PutRR_OS_TTL(responseptr, &m->omsg.h.numAnswers, &rr->resrec, 0);
-                        if (newptr) { responseptr = newptr; numDereg++; rr->RequireGoodbye = mDNSfalse; }
-                        else continue; // If this packet is already too full to hold the goodbye for this record, skip it for now and we'll retry later
+                        // See if we should send a courtesy "goodbye" for the old data before we replace it.
+                        if (ResourceRecordIsValidAnswer(rr) && rr->resrec.RecordType == kDNSRecordTypeShared && rr->RequireGoodbye)
+                        {
+                            newptr = PutAR_OS_TTL(responseptr, &m->omsg.h.numAnswers, rr, 0);
+                            if (newptr) { responseptr = newptr; numDereg++; rr->RequireGoodbye = mDNSfalse; }
+                            else continue; // If this packet is already too full to hold the goodbye for this record, skip it for now and we'll retry later
+                        }
+                        SetNewRData(&rr->resrec, rr->NewRData, rr->newrdlength);
+                        rr->WireCache.valid = mDNSfalse;
                     }
-                    SetNewRData(&rr->resrec, rr->NewRData, rr->newrdlength);
-                }
 
-                if (rr->resrec.RecordType & kDNSRecordTypeUniqueMask)
-                    rr->resrec.rrclass |= kDNSClass_UniqueRRSet;        // Temporarily set the cache flush bit so PutResourceRecord will set it
-                newptr = PutRR_OS_TTL(responseptr, &m->omsg.h.numAnswers, &rr->resrec, active ? rr->resrec.rroriginalttl : 0);
-                rr->resrec.rrclass &= ~kDNSClass_UniqueRRSet;           // Make sure to clear cache flush bit back to normal state
-                if (newptr)
-                {
-                    responseptr = newptr;
-                    rr->RequireGoodbye = active;
-                    if (rr->resrec.RecordType == kDNSRecordTypeDeregistering) numDereg++;
-                    else if (rr->LastAPTime == m->timenow) numAnnounce++;else numAnswer++;
-                }
+                    if (rr->resrec.RecordType & kDNSRecordTypeUniqueMask)
+                        rr->resrec.rrclass |= kDNSClass_UniqueRRSet;        // Temporarily set the cache flush bit so PutResourceRecord will set it
+                    newptr = PutAR_OS_TTL(responseptr, &m->omsg.h.numAnswers, rr, active ? rr->resrec.rroriginalttl : 0);
+                    rr->resrec.rrclass &= ~kDNSClass_UniqueRRSet;           // Make sure to clear cache flush bit back to normal state
+                    if (newptr)
+                    {
+                        responseptr = newptr;
+                        rr->SentInResponses++;
+                        rr->RequireGoodbye = active;
+                        if (rr->resrec.RecordType == kDNSRecordTypeDeregistering) numDereg++;
+                        else if (rr->LastAPTime == m->timenow) numAnnounce++;else numAnswer++;
+                    }
+                    else if (!pass) shareable = mDNSfalse;
 
-                if (rr->NewRData && active)
-                    SetNewRData(&rr->resrec, OldRData, oldrdlength);
+                    if (rr->NewRData && active)
+                    {
+                        SetNewRData(&rr->resrec, OldRData, oldrdlength);
+                        rr->WireCache.valid = mDNSfalse;
+                    }
 
-                // The first time through (pktcount==0), if this record is verified unique
-                // (i.e. typically A, AAAA, SRV, TXT and reverse-mapping PTR), set the flag to add an NSEC too.
-                if (!pktcount && active && (rr->resrec.RecordType & kDNSRecordTypeActiveUniqueMask) && !rr->SendNSECNow)
-                    rr->SendNSECNow = mDNSInterfaceMark;
+                    // The first time through (pktcount==0), if this record is verified unique
+                    // (i.e. typically A, AAAA, SRV, TXT and reverse-mapping PTR), set the flag to add an NSEC too.
+                    if (!pktcount && active && (rr->resrec.RecordType & kDNSRecordTypeActiveUniqueMask) && !rr->SendNSECNow)
+                        rr->SendNSECNow = mDNSInterfaceMark;
 
-                if (newptr)     // If succeeded in sending, advance to next interface
-                {
-                    // If sending on all interfaces, go to next interface; else we're finished now
-                    if (rr->ImmedAnswer == mDNSInterfaceMark && rr->resrec.InterfaceID == mDNSInterface_Any)
-                        rr->SendRNow = GetNextActiveInterfaceID(intf);
-                    else
-                        rr->SendRNow = mDNSNULL;
+                    if (newptr)     // If succeeded in sending, advance to next interface
+                    {
+                        // If sending on all interfaces, go to next interface; else we're finished now
+                        if (rr->ImmedAnswer == mDNSInterfaceMark && rr->resrec.InterfaceID == mDNSInterface_Any)
+                            rr->SendRNow = GetNextActiveInterfaceID(intf);
+                        else
+                            rr->SendRNow = mDNSNULL;
+                    }
                 }
             }
+
+            if (!pass)
+            {
+                answersEnd = responseptr;
+                numShared  = m->omsg.h.numAnswers;
+            }
         }
 
         // Second Pass. Add additional records, if there's space.
@@ -3005,11 +3811,12 @@ mDNSlocal void SendResponses(mDNS *const m)
 
                         if (rr->resrec.RecordType & kDNSRecordTypeUniqueMask)
                             rr->resrec.rrclass |= kDNSClass_UniqueRRSet;    // Temporarily set the cache flush bit so PutResourceRecord will set it
-                        newptr = PutRR_OS(newptr, &m->omsg.h.numAdditionals, &rr->resrec);
+                        newptr = PutAR_OS(newptr, &m->omsg.h.numAdditionals, rr);
                         rr->resrec.rrclass &= ~kDNSClass_UniqueRRSet;       // Make sure to clear cache flush bit back to normal state
                         if (newptr)
                         {
                             responseptr = newptr;
+                            rr->SentInResponses++;
                             rr->ImmedAdditional = mDNSNULL;
                             rr->RequireGoodbye = mDNStrue;
                             // If we successfully put this additional record in the packet, we record LastMCTime & LastMCInterface.
@@ -3122,6 +3929,15 @@ mDNSlocal void SendResponses(mDNS *const m)
                    numAnswer,                numAnswer                == 1 ? "" : "s",
                    m->omsg.h.numAdditionals, m->omsg.h.numAdditionals == 1 ? "" : "s", intf->InterfaceID);
 
+            // Only a first packet that had room for all its interface-independent answers can hand them on; any later packet overwrites them
+            if (!pktcount && shareable && numShared)
+            {
+                sharedAnswersEnd = answersEnd;
+                sharedNumAnswers = numShared;
+            }
+            else sharedAnswersEnd = mDNSNULL;
+
+            mDNS_TRACE4(send__response, responseptr - (mDNSu8 *)&m->omsg, intf->InterfaceID, m->omsg.h.numAnswers, m->omsg.h.numAdditionals);
             if (intf->IPv4Available) mDNSSendDNSMessage(m, &m->omsg, responseptr, intf->InterfaceID, mDNSNULL, mDNSNULL, &AllDNSLinkGroup_v4, MulticastDNSPort, mDNSNULL, mDNSfalse);
             if (intf->IPv6Available) mDNSSendDNSMessage(m, &m->omsg, responseptr, intf->InterfaceID, mDNSNULL, mDNSNULL, &AllDNSLinkGroup_v6, MulticastDNSPort, mDNSNULL, mDNSfalse);
             if (!m->SuppressSending) m->SuppressSending = NonZeroTime(m->timenow + (mDNSPlatformOneSecond+9)/10);
@@ -3178,35 +3994,220 @@ mDNSlocal void SendResponses(mDNS *const m)
             }
         }
     }
-    verbosedebugf("SendResponses: Next in %ld ticks", m->NextScheduledResponse - m->timenow);
+    verbosedebugf("SendResponses: Next in %ld ticks", m->NextScheduledResponse - m->timenow);
+}
+
+// Calling CheckCacheExpiration() walks every record in a CacheGroup, so we want to be lazy about how frequently we do it.
+// 1. If a cache record is currently referenced by *no* active questions,
+//    then we don't mind expiring it up to a minute late (who will know?)
+// 2. Else, if a cache record is due for some of its final expiration queries,
+//    we'll allow them to be late by up to 2% of the TTL
+// 3. Else, if a cache record has completed all its final expiration queries without success,
+//    and is expiring, and had an original TTL more than ten seconds, we'll allow it to be one second late
+// 4. Else, it is expiring and had an original TTL of ten seconds or less (includes explicit goodbye packets),
+//    so allow at most 1/10 second lateness
+// 5. For records with rroriginalttl set to zero, that means we really want to delete them immediately
+//    (we have a new record with DelayDelivery set, waiting for the old record to go away before we can notify clients).
+#define CacheCheckGracePeriod(CR) (                                                   \
+        ((CR)->CRActiveQuestion == mDNSNULL            ) ? (60 * mDNSPlatformOneSecond) : \
+        ((CR)->UnansweredQueries < MaxUnansweredQueries) ? (TicksTTL(CR)/50)            : \
+        ((CR)->resrec.rroriginalttl > 10               ) ? (mDNSPlatformOneSecond)      : \
+        ((CR)->resrec.rroriginalttl > 0                ) ? (mDNSPlatformOneSecond/10)   : 0)
+
+#define NextCacheCheckEvent(CR) ((CR)->NextRequiredQuery + CacheCheckGracePeriod(CR))
+
+// CacheGroups that have a pending cache check are kept in m->rrcache_checkheap, a pairing heap ordered by nextcheck,
+// so that mDNS_Execute only visits the CacheGroups that are actually due, and m->NextCacheCheck is just the root's time.
+// The heap is intrusive (linked through the CacheGroups themselves), so it never needs any memory allocation.
+
+#define CacheGroupIsScheduled(M, CG) ((M)->rrcache_checkheap == (CG) || (CG)->checkPrev)
+
+mDNSlocal CacheGroup *MeldCacheCheckHeaps(CacheGroup *a, CacheGroup *b)
+{
+    if (!a) return(b);
+    if (!b) return(a);
+    if (a->nextcheck - b->nextcheck > 0) { CacheGroup *const t = a; a = b; b = t; }
+    b->checkPrev    = a;
+    b->checkSibling = a->checkChild;
+    if (a->checkChild) a->checkChild->checkPrev = b;
+    a->checkChild   = b;
+    return(a);
+}
+
+// Standard two-pass pairing: meld the subheaps in pairs from left to right, then meld the results from right to left
+mDNSlocal CacheGroup *MergeCacheCheckSubheaps(CacheGroup *first)
+{
+    CacheGroup *pairs = mDNSNULL, *result = mDNSNULL;
+    while (first)
+    {
+        CacheGroup *const a = first;
+        CacheGroup *const b = a->checkSibling;
+        CacheGroup *pair;
+        first = b ? b->checkSibling : mDNSNULL;
+        a->checkSibling = a->checkPrev = mDNSNULL;
+        if (b) b->checkSibling = b->checkPrev = mDNSNULL;
+        pair = MeldCacheCheckHeaps(a, b);
+        pair->checkSibling = pairs;
+        pairs = pair;
+    }
+    while (pairs)
+    {
+        CacheGroup *const next = pairs->checkSibling;
+        pairs->checkSibling = mDNSNULL;
+        result = MeldCacheCheckHeaps(result, pairs);
+        pairs = next;
+    }
+    return(result);
+}
+
+// Detaches cg (together with its subheap) from its parent; cg must be scheduled and not the root
+mDNSlocal void CutCacheCheckSubheap(CacheGroup *const cg)
+{
+    if (cg->checkPrev->checkChild == cg) cg->checkPrev->checkChild   = cg->checkSibling;
+    else                                 cg->checkPrev->checkSibling = cg->checkSibling;
+    if (cg->checkSibling) cg->checkSibling->checkPrev = cg->checkPrev;
+    cg->checkSibling = cg->checkPrev = mDNSNULL;
+}
+
+mDNSlocal void UpdateNextCacheCheck(mDNS *const m)
+{
+    m->NextCacheCheck = m->rrcache_checkheap ? m->rrcache_checkheap->nextcheck : m->timenow + FutureTime;
+}
+
+mDNSlocal void CancelCacheGroupCheck(mDNS *const m, CacheGroup *const cg)
+{
+    CacheGroup *sub;
+    if (!CacheGroupIsScheduled(m, cg)) return;
+    if (m->rrcache_checkheap == cg) m->rrcache_checkheap = mDNSNULL;
+    else CutCacheCheckSubheap(cg);
+    sub = MergeCacheCheckSubheaps(cg->checkChild);
+    cg->checkChild = mDNSNULL;
+    m->rrcache_checkheap = MeldCacheCheckHeaps(m->rrcache_checkheap, sub);
+    UpdateNextCacheCheck(m);
+}
+
+// Makes sure cg gets checked no later than "event"
+mDNSlocal void ScheduleCacheGroupCheck(mDNS *const m, CacheGroup *const cg, const mDNSs32 event)
+{
+    if (CacheGroupIsScheduled(m, cg))
+    {
+        if (cg->nextcheck - event <= 0) return;
+        cg->nextcheck = event;
+        if (m->rrcache_checkheap == cg) { UpdateNextCacheCheck(m); return; }
+        CutCacheCheckSubheap(cg);
+    }
+    else
+    {
+        cg->nextcheck  = event;
+        cg->checkChild = cg->checkSibling = cg->checkPrev = mDNSNULL;
+    }
+    m->rrcache_checkheap = MeldCacheCheckHeaps(m->rrcache_checkheap, cg);
+    UpdateNextCacheCheck(m);
+}
+
+mDNSexport void ScheduleNextCacheCheckTime(mDNS *const m, const CacheRecord *const cr, const mDNSs32 event)
+{
+    CacheGroup *const cg = CacheGroupForRecord(m, &cr->resrec);
+    if (cg) ScheduleCacheGroupCheck(m, cg, event);
+}
+
+// Cache records that aren't answering any active question are kept in m->rrcache_lru, oldest first, so that when the
+// cache is full GetCacheEntity can evict exactly the records it needs instead of sweeping the whole table.
+// A record joins the tail when it enters the cache, when its last active question goes away, and when it's refreshed.
+
+#define CacheRecordInLRU(M, CR) ((M)->rrcache_lru == (CR) || (CR)->LRUPrev)
+
+mDNSlocal void RemoveCacheRecordFromLRU(mDNS *const m, CacheRecord *const cr)
+{
+    if (!CacheRecordInLRU(m, cr)) return;
+    if (cr->LRUPrev) cr->LRUPrev->LRUNext = cr->LRUNext;
+    else m->rrcache_lru = cr->LRUNext;
+    if (cr->LRUNext) cr->LRUNext->LRUPrev = cr->LRUPrev;
+    else m->rrcache_lru_tail = cr->LRUPrev;
+    cr->LRUPrev = cr->LRUNext = mDNSNULL;
+}
+
+// Also used to move a record that's already in the list to the most-recently-used end
+mDNSlocal void AddCacheRecordToLRU(mDNS *const m, CacheRecord *const cr)
+{
+    RemoveCacheRecordFromLRU(m, cr);
+    cr->LRUPrev = m->rrcache_lru_tail;
+    cr->LRUNext = mDNSNULL;
+    if (m->rrcache_lru_tail) m->rrcache_lru_tail->LRUNext = cr;
+    else m->rrcache_lru = cr;
+    m->rrcache_lru_tail = cr;
+}
+
+// Each mDNS question keeps a known answer set: the multicast records that have it as their CRActiveQuestion, so that
+// BuildQuestion can list its known answers, and mark the rest unanswered, without testing every member of the
+// CacheGroup against the question on every round. A record keeps its index in the set, so joining and leaving are O(1).
+// A record has only one CRActiveQuestion, so once two questions are answered by the same record neither set can be
+// complete; both are then marked partial and dropped, and BuildQuestion walks the CacheGroup for them as it always did.
+
+#define KnownAnswerSetMinCapacity 16
+
+mDNSlocal void KnownAnswerSetRemove(mDNS *const m, DNSQuestion *const q, CacheRecord *const cr)
+{
+    const mDNSu32 i = cr->KnownAnswerIndex;
+    if (i == KnownAnswerIndexNone) return;
+    cr->KnownAnswerIndex = KnownAnswerIndexNone;
+    if (i >= q->KnownAnswerCount || q->KnownAnswers[i] != cr)
+    {
+        LogMsg("KnownAnswerSetRemove: ERROR!! %s is not at %u in the set of %##s (%s)",
+               CRDisplayString(m, cr), i, q->qname.c, DNSTypeName(q->qtype));
+        return;
+    }
+    if (i < --q->KnownAnswerCount)          // Move the last record into the hole
+    {
+        q->KnownAnswers[i] = q->KnownAnswers[q->KnownAnswerCount];
+        q->KnownAnswers[i]->KnownAnswerIndex = i;
+    }
+}
+
+mDNSlocal void MarkKnownAnswerSetPartial(DNSQuestion *const q)
+{
+    mDNSu32 i;
+    for (i = 0; i < q->KnownAnswerCount; i++) q->KnownAnswers[i]->KnownAnswerIndex = KnownAnswerIndexNone;
+    if (q->KnownAnswers) mDNSPlatformMemFree(q->KnownAnswers);
+    q->KnownAnswers        = mDNSNULL;
+    q->KnownAnswerCount    = 0;
+    q->KnownAnswerCapacity = 0;
+    q->KnownAnswersPartial = mDNStrue;
+}
+
+mDNSlocal void KnownAnswerSetAdd(DNSQuestion *const q, CacheRecord *const cr)
+{
+    if (q->KnownAnswersPartial || !cr->resrec.InterfaceID || cr->KnownAnswerIndex != KnownAnswerIndexNone) return;
+    if (q->KnownAnswerCount == q->KnownAnswerCapacity)
+    {
+        const mDNSu32 capacity = q->KnownAnswerCapacity ? q->KnownAnswerCapacity * 2 : KnownAnswerSetMinCapacity;
+        CacheRecord **const grown = (CacheRecord **)mDNSPlatformMemAllocate(capacity * sizeof(CacheRecord *));
+        if (!grown) { MarkKnownAnswerSetPartial(q); return; }  // BuildQuestion can manage without it
+        if (q->KnownAnswers)
+        {
+            mDNSPlatformMemCopy(grown, q->KnownAnswers, q->KnownAnswerCount * sizeof(CacheRecord *));
+            mDNSPlatformMemFree(q->KnownAnswers);
+        }
+        q->KnownAnswers        = grown;
+        q->KnownAnswerCapacity = capacity;
+    }
+    cr->KnownAnswerIndex = q->KnownAnswerCount;
+    q->KnownAnswers[q->KnownAnswerCount++] = cr;
 }
 
-// Calling CheckCacheExpiration() is an expensive operation because it has to look at the entire cache,
-// so we want to be lazy about how frequently we do it.
-// 1. If a cache record is currently referenced by *no* active questions,
-//    then we don't mind expiring it up to a minute late (who will know?)
-// 2. Else, if a cache record is due for some of its final expiration queries,
-//    we'll allow them to be late by up to 2% of the TTL
-// 3. Else, if a cache record has completed all its final expiration queries without success,
-//    and is expiring, and had an original TTL more than ten seconds, we'll allow it to be one second late
-// 4. Else, it is expiring and had an original TTL of ten seconds or less (includes explicit goodbye packets),
-//    so allow at most 1/10 second lateness
-// 5. For records with rroriginalttl set to zero, that means we really want to delete them immediately
-//    (we have a new record with DelayDelivery set, waiting for the old record to go away before we can notify clients).
-#define CacheCheckGracePeriod(CR) (                                                   \
-        ((CR)->CRActiveQuestion == mDNSNULL            ) ? (60 * mDNSPlatformOneSecond) : \
-        ((CR)->UnansweredQueries < MaxUnansweredQueries) ? (TicksTTL(CR)/50)            : \
-        ((CR)->resrec.rroriginalttl > 10               ) ? (mDNSPlatformOneSecond)      : \
-        ((CR)->resrec.rroriginalttl > 0                ) ? (mDNSPlatformOneSecond/10)   : 0)
-
-#define NextCacheCheckEvent(CR) ((CR)->NextRequiredQuery + CacheCheckGracePeriod(CR))
+// All changes to a record's CRActiveQuestion go through here, to move it from one known answer set to the other
+mDNSlocal void SetCRActiveQuestion(mDNS *const m, CacheRecord *const cr, DNSQuestion *const q)
+{
+    if (cr->CRActiveQuestion) KnownAnswerSetRemove(m, cr->CRActiveQuestion, cr);
+    cr->CRActiveQuestion = q;
+    if (q) KnownAnswerSetAdd(q, cr);
+}
 
-mDNSexport void ScheduleNextCacheCheckTime(mDNS *const m, const mDNSu32 slot, const mDNSs32 event)
+// The records BuildQuestion has to look at for q: its known answer set if that's complete, else the whole CacheGroup
+mDNSlocal CacheRecord *NextAnswerCandidate(const DNSQuestion *const q, const CacheGroup *const cg, const CacheRecord *const cr, mDNSu32 *const i)
 {
-    if (m->rrcache_nextcheck[slot] - event > 0)
-        m->rrcache_nextcheck[slot] = event;
-    if (m->NextCacheCheck          - event > 0)
-        m->NextCacheCheck          = event;
+    if (!q->KnownAnswersPartial) return((*i < q->KnownAnswerCount) ? q->KnownAnswers[(*i)++] : mDNSNULL);
+    return(cr ? cr->next : cg ? cg->members : mDNSNULL);
 }
 
 // Note: MUST call SetNextCacheCheckTimeForRecord any time we change:
@@ -3227,7 +4228,7 @@ mDNSexport void SetNextCacheCheckTimeForRecord(mDNS *const m, CacheRecord *const
         verbosedebugf("SetNextCacheCheckTimeForRecord: NextRequiredQuery in %ld sec CacheCheckGracePeriod %d ticks for %s",
                       (rr->NextRequiredQuery - m->timenow) / mDNSPlatformOneSecond, CacheCheckGracePeriod(rr), CRDisplayString(m,rr));
     }
-    ScheduleNextCacheCheckTime(m, HashSlotFromNameHash(rr->resrec.namehash), NextCacheCheckEvent(rr));
+    ScheduleNextCacheCheckTime(m, rr, NextCacheCheckEvent(rr));
 }
 
 #define kMinimumReconfirmTime                     ((mDNSu32)mDNSPlatformOneSecond *  5)
@@ -3267,6 +4268,8 @@ mDNSexport mStatus mDNS_Reconfirm_internal(mDNS *const m, CacheRecord *const rr,
 // BuildQuestion puts a question into a DNS Query packet and if successful, updates the value of queryptr.
 // It also appends to the list of known answer records that need to be included,
 // and updates the forcast for the size of the known answer section.
+// Both passes walk the question's known answer set, whose records are known to answer it, and only fall back to
+// testing every member of the CacheGroup when that set is partial (see KnownAnswerSetAdd).
 mDNSlocal mDNSBool BuildQuestion(mDNS *const m, const NetworkInterfaceInfo *intf, DNSMessage *query, mDNSu8 **queryptr,
                                  DNSQuestion *q, CacheRecord ***kalistptrptr, mDNSu32 *answerforecast)
 {
@@ -3282,16 +4285,17 @@ mDNSlocal mDNSBool BuildQuestion(mDNS *const m, const NetworkInterfaceInfo *intf
     else
     {
         mDNSu32 forecast = *answerforecast;
-        const CacheGroup *const cg = CacheGroupForName(m, q->qnamehash, &q->qname);
+        const CacheGroup *const cg = q->KnownAnswersPartial ? CacheGroupForName(m, q->qnamehash, &q->qname) : mDNSNULL;
         CacheRecord *cr;
         CacheRecord **ka = *kalistptrptr;   // Make a working copy of the pointer we're going to update
+        mDNSu32 i;
 
-        for (cr = cg ? cg->members : mDNSNULL; cr; cr=cr->next)             // If we have a resource record in our cache,
+        for (i = 0, cr = NextAnswerCandidate(q, cg, mDNSNULL, &i); cr; cr = NextAnswerCandidate(q, cg, cr, &i))
             if (cr->resrec.InterfaceID == q->SendQNow &&                    // received on this interface
                 !(cr->resrec.RecordType & kDNSRecordTypeUniqueMask) &&      // which is a shared (i.e. not unique) record type
                 cr->NextInKAList == mDNSNULL && ka != &cr->NextInKAList &&  // which is not already in the known answer list
                 cr->resrec.rdlength <= SmallRecordLimit &&                  // which is small enough to sensibly fit in the packet
-                SameNameCacheRecordAnswersQuestion(cr, q) &&                // which answers our question
+                (!cg || SameNameCacheRecordAnswersQuestion(cr, q)) &&       // which answers our question
                 cr->TimeRcvd + TicksTTL(cr)/2 - m->timenow >                // and its half-way-to-expiry time is at least 1 second away
                 mDNSPlatformOneSecond)                                      // (also ensures we never include goodbye records with TTL=1)
             {
@@ -3324,10 +4328,10 @@ mDNSlocal mDNSBool BuildQuestion(mDNS *const m, const NetworkInterfaceInfo *intf
         *kalistptrptr    = ka;                  // Update the known answer list pointer
         if (ucast) q->ExpectUnicastResp = NonZeroTime(m->timenow);
 
-        for (cr = cg ? cg->members : mDNSNULL; cr; cr=cr->next)             // For every resource record in our cache,
+        for (i = 0, cr = NextAnswerCandidate(q, cg, mDNSNULL, &i); cr; cr = NextAnswerCandidate(q, cg, cr, &i))
             if (cr->resrec.InterfaceID == q->SendQNow &&                    // received on this interface
                 cr->NextInKAList == mDNSNULL && ka != &cr->NextInKAList &&  // which is not in the known answer list
-                SameNameCacheRecordAnswersQuestion(cr, q))                  // which answers our question
+                (!cg || SameNameCacheRecordAnswersQuestion(cr, q)))         // which answers our question
             {
                 cr->UnansweredQueries++;                                    // indicate that we're expecting a response
                 cr->LastUnansweredTime = m->timenow;
@@ -3550,6 +4554,51 @@ mDNSlocal void mDNSSendWakeOnResolve(mDNS *const m, DNSQuestion *q)
 }
 
 
+// Per-interface multicast load. mDNSCoreReceive and mDNSSendDNSMessage just bump McastRateCount on the first
+// NetworkInterfaceInfo for the InterfaceID; SendQueries folds the count into McastRate about once a second, with
+// some smoothing so that one burst (e.g. everyone re-announcing after a Wi-Fi blip) doesn't swing the scheduler.
+#define MulticastRateWindow     mDNSPlatformOneSecond
+#define MulticastRateHistory    (8 * MulticastRateWindow)   // After this long without a fold, the old rate is meaningless
+#define BusyLinkMulticastRate   40                          // Multicast packets per second at which a link counts as busy
+
+mDNSexport mDNSu32 mDNSCoreInterfaceMulticastRate(const NetworkInterfaceInfo *const intf, const mDNSs32 now)
+{
+    const mDNSs32 elapsed = now - intf->McastRateStart;
+    mDNSu32 sample;
+    if (elapsed < MulticastRateWindow) return(intf->McastRate);
+    sample = intf->McastRateCount / (mDNSu32)(elapsed / MulticastRateWindow);
+    return((elapsed >= MulticastRateHistory) ? sample : (intf->McastRate * 3 + sample) / 4);
+}
+
+mDNSlocal void UpdateMulticastRates(mDNS *const m)
+{
+    NetworkInterfaceInfo *intf;
+    for (intf = m->HostInterfaces; intf; intf = intf->next)
+    {
+        if (m->timenow - intf->McastRateStart >= MulticastRateWindow)
+        {
+            intf->McastRate      = mDNSCoreInterfaceMulticastRate(intf, m->timenow);
+            intf->McastRateCount = 0;
+            intf->McastRateStart = m->timenow;
+        }
+    }
+}
+
+// A question's link is busy if the interface it's bound to is, or for a non-specific question, if any multicast
+// interface is, since it goes out on all of them together.
+mDNSlocal mDNSBool QuestionLinkIsBusy(mDNS *const m, const DNSQuestion *const q)
+{
+    const NetworkInterfaceInfo *intf;
+    if (q->InterfaceID)
+    {
+        intf = FirstInterfaceForID(m, q->InterfaceID);
+        return(intf && intf->McastRate >= BusyLinkMulticastRate);
+    }
+    for (intf = m->HostInterfaces; intf; intf = intf->next)
+        if (intf->McastTxRx && intf->McastRate >= BusyLinkMulticastRate) return(mDNStrue);
+    return(mDNSfalse);
+}
+
 mDNSlocal mDNSBool AccelerateThisQuery(mDNS *const m, DNSQuestion *q)
 {
     // If more than 90% of the way to the query time, we should unconditionally accelerate it
@@ -3606,6 +4655,8 @@ mDNSlocal void SendQueries(mDNS *const m)
 
     // 1. If time for a query, work out what we need to do
 
+    UpdateMulticastRates(m);
+
     // We're expecting to send a query anyway, so see if any expiring cache records are close enough
     // to their NextRequiredQuery to be worth batching them together with this one
     FORALL_CACHERECORDS(slot, cg, cr)
@@ -3685,6 +4736,7 @@ mDNSlocal void SendQueries(mDNS *const m)
         if (mDNSOpaque16IsZero(q->TargetQID)
             && (q->SendQNow || (ActiveQuestion(q) && q->ThisQInterval <= maxExistingQuestionInterval && AccelerateThisQuery(m,q))))
         {
+            const mDNSBool busy = QuestionLinkIsBusy(m, q);
             // If at least halfway to next query time, advance to next interval
             // If less than halfway to next query time, then
             // treat this as logically a repeat of the last transmission, without advancing the interval
@@ -3694,7 +4746,16 @@ mDNSlocal void SendQueries(mDNS *const m)
                 // don't send it again until MaxQuestionInterval unless:
                 //  one of its cached answers needs to be refreshed,
                 //  or it's the initial query for a kDNSServiceFlagsThresholdFinder mode browse.
-                if (q->BrowseThreshold
+                if (q->OneShot && q->ThisQInterval > InitialQuestionInterval)
+                {
+                    // A snapshot browse has sent its one query, with all the known answers; from here on it only
+                    // listens, until the client's snapshot window closes and the question is stopped
+                    q->SendQNow = mDNSNULL;
+                    q->ThisQInterval = MaxQuestionInterval;
+                    q->LastQTime = m->timenow;
+                    q->RequestUnicast = 0;
+                }
+                else if (q->BrowseThreshold
                     && (q->CurrentAnswers >= q->BrowseThreshold)
                     && (q->CachedAnswerNeedsUpdate == mDNSfalse)
                     && !((q->flags & kDNSServiceFlagsThresholdFinder) && (q->ThisQInterval == InitialQuestionInterval)))
@@ -3711,6 +4772,13 @@ mDNSlocal void SendQueries(mDNS *const m)
                     // Mark this question for sending on all interfaces
                     q->SendQNow = mDNSInterfaceMark;
                     q->ThisQInterval *= QuestionIntervalStep;
+                    // Once past the initial burst of queries, back off an extra step on a busy link. Everyone else there
+                    // is asking too, and their answers refresh our cache just as well as answers to our own queries.
+                    if (busy && q->ThisQInterval > InitialQuestionInterval * QuestionIntervalStep3 && q->ThisQInterval < MaxQuestionInterval)
+                    {
+                        q->ThisQInterval *= QuestionIntervalStep;
+                        m->mDNSStats.BusyLinkQueryBackoffs++;
+                    }
                 }
 
                 debugf("SendQueries: %##s (%s) next interval %d seconds RequestUnicast = %d",
@@ -3746,7 +4814,8 @@ mDNSlocal void SendQueries(mDNS *const m)
 
             // If we recorded a duplicate suppression for this question less than half an interval ago,
             // then we consider it recent enough that we don't need to do an identical query ourselves.
-            ExpireDupSuppressInfo(q->DupSuppress, m->timenow - q->ThisQInterval/2);
+            // On a busy link, another host's query from up to three quarters of an interval ago will do.
+            ExpireDupSuppressInfo(q->DupSuppress, m->timenow - (busy ? q->ThisQInterval/4*3 : q->ThisQInterval/2));
 
             q->LastQTxTime      = m->timenow;
             q->RecentAnswerPkts = 0;
@@ -3884,6 +4953,8 @@ mDNSlocal void SendQueries(mDNS *const m)
                     {
                         if (Suppress)
                             m->mDNSStats.DupQuerySuppressions++;
+                        else
+                            q->SentInQueries++;
 
                         q->SendQNow = (q->InterfaceID || !q->SendOnAll) ? mDNSNULL : GetNextActiveInterfaceID(intf);
                         if (q->WakeOnResolveCount)
@@ -3991,9 +5062,9 @@ mDNSlocal void SendQueries(mDNS *const m)
         {
             if (ar->IncludeInProbe)
             {
-                mDNSu8 *newptr = PutResourceRecord(&m->omsg, queryptr, &m->omsg.h.numAuthorities, &ar->resrec);
+                mDNSu8 *newptr = PutAuthRecord(&m->omsg, queryptr, &m->omsg.h.numAuthorities, ar);
                 ar->IncludeInProbe = mDNSfalse;
-                if (newptr) queryptr = newptr;
+                if (newptr) { queryptr = newptr; ar->SentInProbes++; }
                 else LogMsg("SendQueries:   How did we fail to have space for the Update record %s", ARDisplayString(m,ar));
             }
         }
@@ -4045,6 +5116,7 @@ mDNSlocal void SendQueries(mDNS *const m)
                    m->omsg.h.numQuestions,   m->omsg.h.numQuestions   == 1 ? "" : "s",
                    m->omsg.h.numAnswers,     m->omsg.h.numAnswers     == 1 ? "" : "s",
                    m->omsg.h.numAuthorities, m->omsg.h.numAuthorities == 1 ? "" : "s", IIDPrintable(intf->InterfaceID), intf->ifname);
+            mDNS_TRACE4(send__query, queryptr - (mDNSu8 *)&m->omsg, intf->InterfaceID, m->omsg.h.numQuestions, m->omsg.h.numAnswers);
             if (intf->IPv4Available) mDNSSendDNSMessage(m, &m->omsg, queryptr, intf->InterfaceID, mDNSNULL, mDNSNULL, &AllDNSLinkGroup_v4, MulticastDNSPort, mDNSNULL, useBackgroundTrafficClass);
             if (intf->IPv6Available) mDNSSendDNSMessage(m, &m->omsg, queryptr, intf->InterfaceID, mDNSNULL, mDNSNULL, &AllDNSLinkGroup_v6, MulticastDNSPort, mDNSNULL, useBackgroundTrafficClass);
             if (!m->SuppressSending) m->SuppressSending = NonZeroTime(m->timenow + (mDNSPlatformOneSecond+9)/10);
@@ -4217,6 +5289,58 @@ mDNSlocal void AdjustUnansweredQueries(mDNS *const m, CacheRecord *const rr)
     }
 }
 
+// Only a plain add of a cached record is held back: anything that needs work after the callback (following a CNAME,
+// remembering an expired answer), or whose record won't still be there later (m->rec.r), is delivered straight away
+mDNSlocal mDNSBool AnswerCanBeBatched(const mDNS *const m, const DNSQuestion *const q, const CacheRecord *const rr,
+                                      const QC_result AddRecord, const mDNSBool followcname)
+{
+    if (!m->AnswerBatching || m->AnswerBatchCount >= AnswerBatchMax) return(mDNSfalse);
+    if (AddRecord != QC_add || followcname || rr == &m->rec.r) return(mDNSfalse);
+    if (rr->resrec.RecordType == kDNSRecordTypePacketNegative || rr->resrec.mortality == Mortality_Ghost) return(mDNSfalse);
+    if (q->qtype != kDNSType_NSEC && RRAssertsNonexistence(&rr->resrec, q->qtype)) return(mDNSfalse);
+#if MDNSRESPONDER_SUPPORTS(APPLE, DNS64)
+    if (DNS64ShouldAnswerQuestion(q, &rr->resrec)) return(mDNSfalse);
+#endif
+#if MDNSRESPONDER_SUPPORTS(APPLE, DNSSECv2)
+    if (q->DNSSECStatus.enable_dnssec) return(mDNSfalse);
+#endif
+    return(mDNStrue);
+}
+
+// Hands the held-back add events to their questions, in the order they happened, in one drop of the lock.
+// Callbacks may stop questions or release records further down the batch; ForgetBatchedAnswers clears those entries.
+mDNSlocal void FlushAnswerBatch(mDNS *const m)
+{
+    const mDNSBool batching = m->AnswerBatching;
+    mDNSu32 i, delivered = 0;
+
+    m->AnswerBatching = mDNSfalse;      // Anything a callback causes to be answered is answered there and then
+    mDNS_DropLockBeforeCallback();
+    for (i = 0; i < m->AnswerBatchCount; i++)
+    {
+        DNSQuestion *const q = m->AnswerBatch[i].q;
+        if (!q) continue;
+        m->AnswerBatch[i].q = mDNSNULL;
+        delivered++;
+        q->QuestionCallback(m, q, &m->AnswerBatch[i].cr->resrec, QC_add);
+    }
+    mDNS_ReclaimLockAfterCallback();
+    m->AnswerBatchCount = 0;
+    m->AnswerBatching   = batching;
+
+    m->mDNSStats.AnswerBatches++;
+    m->mDNSStats.AnswerBatchAnswers += delivered;
+    if (m->mDNSStats.AnswerBatchMaxAnswers < delivered) m->mDNSStats.AnswerBatchMaxAnswers = delivered;
+}
+
+// Drops the held-back add events for a question that's being stopped, or a record that's being released
+mDNSlocal void ForgetBatchedAnswers(mDNS *const m, const DNSQuestion *const q, const CacheRecord *const cr)
+{
+    mDNSu32 i;
+    for (i = 0; i < m->AnswerBatchCount; i++)
+        if (m->AnswerBatch[i].q == q || m->AnswerBatch[i].cr == cr) m->AnswerBatch[i].q = mDNSNULL;
+}
+
 // Note: AnswerCurrentQuestionWithResourceRecord can call a user callback, which may change the record list and/or question list.
 // Any code walking either list must use the m->CurrentQuestion (and possibly m->CurrentRecord) mechanism to protect against this.
 // In fact, to enforce this, the routine will *only* answer the question currently pointed to by m->CurrentQuestion,
@@ -4253,7 +5377,7 @@ mDNSexport void AnswerCurrentQuestionWithResourceRecord(mDNS *const m, CacheReco
     
     //  Set the record to immortal if appropriate
     if (AddRecord == QC_add && Question_uDNS(q) && rr->resrec.RecordType != kDNSRecordTypePacketNegative &&
-        q->allowExpired != AllowExpired_None && rr->resrec.mortality == Mortality_Mortal ) rr->resrec.mortality = Mortality_Immortal; // Update a non-expired cache record to immortal if appropriate
+        (q->allowExpired != AllowExpired_None || ServeStaleUnicastAnswers) && rr->resrec.mortality == Mortality_Mortal ) rr->resrec.mortality = Mortality_Immortal; // Update a non-expired cache record to immortal if appropriate
     
 #if MDNSRESPONDER_SUPPORTS(APPLE, METRICS)
     if ((AddRecord == QC_add) && Question_uDNS(q) && !followcname && !q->metrics.answered)
@@ -4290,7 +5414,7 @@ mDNSexport void AnswerCurrentQuestionWithResourceRecord(mDNS *const m, CacheReco
             {
                 responseLatencyMs = 0;
             }
-            MetricsUpdateDNSQueryStats(queryName, q->qtype, &rr->resrec, querySendCount, q->metrics.expiredAnswerState,
+            MetricsUpdateDNSQueryStats(queryName, &q->metrics.queryStatsDomains, q->qtype, &rr->resrec, querySendCount, q->metrics.expiredAnswerState,
                 q->metrics.dnsOverTCPState, responseLatencyMs, isForCellular);
         }
         q->metrics.answered = mDNStrue;
@@ -4307,9 +5431,15 @@ mDNSexport void AnswerCurrentQuestionWithResourceRecord(mDNS *const m, CacheReco
         if (!rr->CRActiveQuestion)
         {
             m->rrcache_active++;            // If not previously active, increment rrcache_active count
+            RemoveCacheRecordFromLRU(m, rr);
             AdjustUnansweredQueries(m, rr); // Adjust UnansweredQueries in case the record missed out on refresher queries
         }
-        rr->CRActiveQuestion = q;           // We know q is non-null
+        else                                // Both questions are answered by this record, so neither set is complete
+        {
+            MarkKnownAnswerSetPartial(rr->CRActiveQuestion);
+            MarkKnownAnswerSetPartial(q);
+        }
+        SetCRActiveQuestion(m, rr, q);      // We know q is non-null
         SetNextCacheCheckTimeForRecord(m, rr);
     }
 
@@ -4320,8 +5450,10 @@ mDNSexport void AnswerCurrentQuestionWithResourceRecord(mDNS *const m, CacheReco
     // (If we have an answer in the cache, then we'll automatically ask again in time to stop it expiring.)
     // We do this for mDNS questions and uDNS one-shot questions, but not for
     // uDNS LongLived questions, because that would mess up our LLQ lease renewal timing.
+    // An expired answer only stands in until a fresh one arrives, so it doesn't stop us asking.
     if ((AddRecord == QC_addnocache && !q->RequestUnicast) ||
-        (AddRecord == QC_add && (q->ExpectUnique || (rr->resrec.RecordType & kDNSRecordTypePacketUniqueMask))))
+        (AddRecord == QC_add && rr->resrec.mortality != Mortality_Ghost &&
+         (q->ExpectUnique || (rr->resrec.RecordType & kDNSRecordTypePacketUniqueMask))))
         if (ActiveQuestion(q) && (mDNSOpaque16IsZero(q->TargetQID) || !q->LongLived))
         {
             ResetQuestionState(m, q);
@@ -4366,6 +5498,19 @@ mDNSexport void AnswerCurrentQuestionWithResourceRecord(mDNS *const m, CacheReco
     // For CNAME results to non-CNAME questions, only inform the client if they explicitly requested that
     if (q->QuestionCallback && !q->NoAnswer && (!followcname || q->ReturnIntermed))
     {
+        if (AnswerCanBeBatched(m, q, rr, AddRecord, followcname))
+        {
+            m->AnswerBatch[m->AnswerBatchCount].q  = q;
+            m->AnswerBatch[m->AnswerBatchCount].cr = rr;
+            m->AnswerBatchCount++;
+            return;
+        }
+        // Anything held back goes first, so that a question sees its answers in the order they came
+        if (m->AnswerBatchCount)
+        {
+            FlushAnswerBatch(m);
+            if (m->CurrentQuestion != q) return;
+        }
         mDNS_DropLockBeforeCallback();      // Allow client (and us) to legally make mDNS API calls
         if (q->qtype != kDNSType_NSEC && RRAssertsNonexistence(&rr->resrec, q->qtype))
         {
@@ -4422,22 +5567,64 @@ mDNSexport void AnswerCurrentQuestionWithResourceRecord(mDNS *const m, CacheReco
     }
 }
 
+#define QuestionHashSlot(X) ((mDNSu16)((X) % QUESTION_HASH_SLOTS))
+#define FirstQuestionForNameHash(M, X) ((M)->QuestionHash[QuestionHashSlot(X)])
+
+// New questions are the tail of m->Questions starting at m->NewQuestions, so they're also the tail of each hash chain
+#define QuestionIsNew(M, Q) ((M)->NewQuestions && (mDNSs32)((Q)->QuestionSeq - (M)->NewQuestions->QuestionSeq) >= 0)
+
+mDNSlocal void AddQuestionToHash(mDNS *const m, DNSQuestion *const question)
+{
+    DNSQuestion **qp;
+
+    question->QHashSlot = QuestionHashSlot(question->qnamehash);
+    qp = &m->QuestionHash[question->QHashSlot];
+    // Keep the chain in m->Questions order. The question is nearly always the newest, so this usually walks to the end.
+    while (*qp && (mDNSs32)((*qp)->QuestionSeq - question->QuestionSeq) < 0) qp = &(*qp)->NextInQHash;
+    question->NextInQHash = *qp;
+    *qp = question;
+}
+
+mDNSlocal void RemoveQuestionFromHash(mDNS *const m, DNSQuestion *const question)
+{
+    DNSQuestion **qp = &m->QuestionHash[question->QHashSlot];
+
+    while (*qp && *qp != question) qp = &(*qp)->NextInQHash;
+    if (!*qp) { LogMsg("RemoveQuestionFromHash: ERROR!! %##s (%s) not found", question->qname.c, DNSTypeName(question->qtype)); return; }
+    *qp = question->NextInQHash;
+    // If we just removed the question that an answer-delivery walk is about to look at, bump it forward one question
+    if (m->NextHashedQuestion == question) m->NextHashedQuestion = question->NextInQHash;
+    question->NextInQHash = mDNSNULL;
+}
+
+#if MDNSRESPONDER_SUPPORTS(APPLE, DNS64)
+// Must be called if a question's qnamehash is changed while it's in m->Questions
+mDNSlocal void RehashQuestion(mDNS *const m, DNSQuestion *const question)
+{
+    if (question->QHashSlot == QuestionHashSlot(question->qnamehash)) return;
+    RemoveQuestionFromHash(m, question);
+    AddQuestionToHash(m, question);
+}
+#endif
+
 mDNSlocal void CacheRecordDeferredAdd(mDNS *const m, CacheRecord *cr)
 {
+    DNSQuestion *q;
     cr->DelayDelivery = 0;
     if (m->CurrentQuestion)
         LogMsg("CacheRecordDeferredAdd ERROR m->CurrentQuestion already set: %##s (%s)",
                m->CurrentQuestion->qname.c, DNSTypeName(m->CurrentQuestion->qtype));
-    m->CurrentQuestion = m->Questions;
-    while (m->CurrentQuestion && m->CurrentQuestion != m->NewQuestions)
+    q = FirstQuestionForNameHash(m, cr->resrec.namehash);
+    while (q && !QuestionIsNew(m, q))
     {
-        DNSQuestion *q = m->CurrentQuestion;
+        m->CurrentQuestion    = q;
+        m->NextHashedQuestion = q->NextInQHash; // Bumped by mDNS_StopQuery_internal if that question goes away
         if (CacheRecordAnswersQuestion(cr, q))
             AnswerCurrentQuestionWithResourceRecord(m, cr, QC_add);
-        if (m->CurrentQuestion == q)    // If m->CurrentQuestion was not auto-advanced, do it ourselves now
-            m->CurrentQuestion = q->next;
+        q = m->NextHashedQuestion;
     }
-    m->CurrentQuestion = mDNSNULL;
+    m->CurrentQuestion    = mDNSNULL;
+    m->NextHashedQuestion = mDNSNULL;
 }
 
 mDNSlocal mDNSs32 CheckForSoonToExpireRecords(mDNS *const m, const domainname *const name, const mDNSu32 namehash)
@@ -4476,7 +5663,7 @@ mDNSlocal void CacheRecordAdd(mDNS *const m, CacheRecord *cr)
 
     // We stop when we get to NewQuestions -- if we increment their CurrentAnswers/LargeAnswers/UniqueAnswers
     // counters here we'll end up double-incrementing them when we do it again in AnswerNewQuestion().
-    for (q = m->Questions; q && q != m->NewQuestions; q=q->next)
+    for (q = FirstQuestionForNameHash(m, cr->resrec.namehash); q && !QuestionIsNew(m, q); q = q->NextInQHash)
     {
         if (CacheRecordAnswersQuestion(cr, q))
         {
@@ -4526,16 +5713,17 @@ mDNSlocal void CacheRecordAdd(mDNS *const m, CacheRecord *cr)
     {
         if (m->CurrentQuestion)
             LogMsg("CacheRecordAdd ERROR m->CurrentQuestion already set: %##s (%s)", m->CurrentQuestion->qname.c, DNSTypeName(m->CurrentQuestion->qtype));
-        m->CurrentQuestion = m->Questions;
-        while (m->CurrentQuestion && m->CurrentQuestion != m->NewQuestions)
+        q = FirstQuestionForNameHash(m, cr->resrec.namehash);
+        while (q && !QuestionIsNew(m, q))
         {
-            q = m->CurrentQuestion;
+            m->CurrentQuestion    = q;
+            m->NextHashedQuestion = q->NextInQHash; // Bumped by mDNS_StopQuery_internal if that question goes away
             if (CacheRecordAnswersQuestion(cr, q))
                 AnswerCurrentQuestionWithResourceRecord(m, cr, QC_add);
-            if (m->CurrentQuestion == q)    // If m->CurrentQuestion was not auto-advanced, do it ourselves now
-                m->CurrentQuestion = q->next;
+            q = m->NextHashedQuestion;
         }
-        m->CurrentQuestion = mDNSNULL;
+        m->CurrentQuestion    = mDNSNULL;
+        m->NextHashedQuestion = mDNSNULL;
     }
 
     SetNextCacheCheckTimeForRecord(m, cr);
@@ -4553,21 +5741,23 @@ mDNSlocal void CacheRecordAdd(mDNS *const m, CacheRecord *cr)
 // Any code walking either list must use the CurrentQuestion and/or CurrentRecord mechanism to protect against this.
 mDNSlocal void NoCacheAnswer(mDNS *const m, CacheRecord *cr)
 {
+    DNSQuestion *q;
     LogMsg("No cache space: Delivering non-cached result for %##s", m->rec.r.resrec.name->c);
     if (m->CurrentQuestion)
         LogMsg("NoCacheAnswer ERROR m->CurrentQuestion already set: %##s (%s)", m->CurrentQuestion->qname.c, DNSTypeName(m->CurrentQuestion->qtype));
-    m->CurrentQuestion = m->Questions;
     // We do this for *all* questions, not stopping when we get to m->NewQuestions,
     // since we're not caching the record and we'll get no opportunity to do this later
-    while (m->CurrentQuestion)
+    q = FirstQuestionForNameHash(m, cr->resrec.namehash);
+    while (q)
     {
-        DNSQuestion *q = m->CurrentQuestion;
+        m->CurrentQuestion    = q;
+        m->NextHashedQuestion = q->NextInQHash; // Bumped by mDNS_StopQuery_internal if that question goes away
         if (CacheRecordAnswersQuestion(cr, q))
             AnswerCurrentQuestionWithResourceRecord(m, cr, QC_addnocache);  // QC_addnocache means "don't expect remove events for this"
-        if (m->CurrentQuestion == q)    // If m->CurrentQuestion was not auto-advanced, do it ourselves now
-            m->CurrentQuestion = q->next;
+        q = m->NextHashedQuestion;
     }
-    m->CurrentQuestion = mDNSNULL;
+    m->CurrentQuestion    = mDNSNULL;
+    m->NextHashedQuestion = mDNSNULL;
 }
 
 // CacheRecordRmv is only called from CheckCacheExpiration, which is called from mDNS_Execute.
@@ -4581,16 +5771,18 @@ mDNSlocal void NoCacheAnswer(mDNS *const m, CacheRecord *cr)
 // Any code walking either list must use the CurrentQuestion and/or CurrentRecord mechanism to protect against this.
 mDNSlocal void CacheRecordRmv(mDNS *const m, CacheRecord *cr)
 {
+    DNSQuestion *q;
     if (m->CurrentQuestion)
         LogMsg("CacheRecordRmv ERROR m->CurrentQuestion already set: %##s (%s)",
                m->CurrentQuestion->qname.c, DNSTypeName(m->CurrentQuestion->qtype));
-    m->CurrentQuestion = m->Questions;
 
     // We stop when we get to NewQuestions -- for new questions their CurrentAnswers/LargeAnswers/UniqueAnswers counters
     // will all still be zero because we haven't yet gone through the cache counting how many answers we have for them.
-    while (m->CurrentQuestion && m->CurrentQuestion != m->NewQuestions)
+    q = FirstQuestionForNameHash(m, cr->resrec.namehash);
+    while (q && !QuestionIsNew(m, q))
     {
-        DNSQuestion *q = m->CurrentQuestion;
+        m->CurrentQuestion    = q;
+        m->NextHashedQuestion = q->NextInQHash; // Bumped by mDNS_StopQuery_internal if that question goes away
         // When a question enters suppressed state, we generate RMV events and generate a negative
         // response. A cache may be present that answers this question e.g., cache entry generated
         // before the question became suppressed. We need to skip the suppressed questions here as
@@ -4638,20 +5830,110 @@ mDNSlocal void CacheRecordRmv(mDNS *const m, CacheRecord *cr)
                 AnswerCurrentQuestionWithResourceRecord(m, cr, QC_rmv);
             }
         }
-        if (m->CurrentQuestion == q)    // If m->CurrentQuestion was not auto-advanced, do it ourselves now
-            m->CurrentQuestion = q->next;
+        q = m->NextHashedQuestion;
     }
-    m->CurrentQuestion = mDNSNULL;
+    m->CurrentQuestion    = mDNSNULL;
+    m->NextHashedQuestion = mDNSNULL;
+}
+
+// See CachePartition in mDNSEmbeddedAPI.h. Every CacheRecord is counted as CreateNewCacheEntry makes it, and uncounted
+// by ReleaseCacheRecord or ReleaseAdditionalCacheRecords. There are only a handful of InterfaceIDs in use at once,
+// so looking one up is a short scan of a small array.
+mDNSlocal CachePartition *FindCachePartition(mDNS *const m, const mDNSInterfaceID InterfaceID)
+{
+    CachePartition *p;
+    for (p = m->rrcache_partitions; p < &m->rrcache_partitions[CachePartitionCount]; p++)
+        if (p->used && p->InterfaceID == InterfaceID) return(p);
+    return(mDNSNULL);
+}
+
+mDNSlocal void CountCacheRecordInPartition(mDNS *const m, CacheRecord *const cr)
+{
+    CachePartition *p = FindCachePartition(m, cr->resrec.InterfaceID);
+    if (!p)
+    {
+        for (p = m->rrcache_partitions; p < &m->rrcache_partitions[CachePartitionCount] && p->used; p++) continue;
+        if (p == &m->rrcache_partitions[CachePartitionCount])
+        {
+            cr->Partition = 0;
+            m->rrcache_partition_overflow++;
+            return;
+        }
+        p->InterfaceID = cr->resrec.InterfaceID;
+    }
+    p->used++;
+    cr->Partition = (mDNSu8)(p - m->rrcache_partitions + 1);
+}
+
+mDNSlocal void UncountCacheRecordInPartition(mDNS *const m, CacheRecord *const cr)
+{
+    if (cr->Partition) m->rrcache_partitions[cr->Partition - 1].used--;
+    else m->rrcache_partition_overflow--;
+    cr->Partition = 0;
+}
+
+// Returns the partition that a new record for InterfaceID must be recycled from if the cache is full,
+// or zero if it may take the least recently used record from anyone. The quota is a share of the cached
+// records, not of rrcache_size: CacheGroups take entities too, and evicting someone else's record often frees theirs.
+mDNSlocal mDNSu8 CachePartitionOverQuota(mDNS *const m, const mDNSInterfaceID InterfaceID)
+{
+    const CachePartition *const p = InterfaceID ? FindCachePartition(m, InterfaceID) : mDNSNULL;
+    const mDNSu32 records = m->rrcache_totalused - m->rrcache_groups;
+    if (!p || !m->rrcache_partition_quota || p->used * 100 < records * m->rrcache_partition_quota) return(0);
+    return((mDNSu8)(p - m->rrcache_partitions + 1));
+}
+
+// Storage from mDNS_GrowCacheReleasable is kept in blocks, each with its own free list, so that ShrinkCache can tell
+// when one has gone idle. Entities are taken from the permanent storage given to mDNS_Init and mDNS_GrowCache first,
+// then from the oldest block with room, so that once a burst is over it's the newest blocks that empty out.
+mDNSlocal CacheBlock *CacheBlockForEntity(const mDNS *const m, const CacheEntity *const e)
+{
+    CacheBlock *b;
+    for (b = m->rrcache_blocks; b; b = b->next)
+        if (e > (const CacheEntity *)b && e <= (const CacheEntity *)b + b->count) return(b);
+    return(mDNSNULL);
+}
+
+mDNSlocal CacheEntity *TakeFreeCacheEntity(mDNS *const m)
+{
+    CacheEntity *e = m->rrcache_free;
+    CacheBlock *b;
+    if (e)
+    {
+        m->rrcache_free = e->next;
+        return(e);
+    }
+    for (b = m->rrcache_blocks; b; b = b->next)
+    {
+        if (b->free)
+        {
+            e = b->free;
+            b->free = e->next;
+            b->used++;
+            return(e);
+        }
+    }
+    return(mDNSNULL);
 }
 
 mDNSlocal void ReleaseCacheEntity(mDNS *const m, CacheEntity *e)
 {
+    CacheBlock *const b = m->rrcache_blocks ? CacheBlockForEntity(m, e) : mDNSNULL;
 #if MDNS_MALLOC_DEBUGGING >= 1
     unsigned int i;
     for (i=0; i<sizeof(*e); i++) ((char*)e)[i] = 0xFF;
 #endif
-    e->next = m->rrcache_free;
-    m->rrcache_free = e;
+    if (b)
+    {
+        e->next = b->free;
+        b->free = e;
+        b->used--;
+    }
+    else
+    {
+        e->next = m->rrcache_free;
+        m->rrcache_free = e;
+    }
     m->rrcache_totalused--;
 }
 
@@ -4663,10 +5945,13 @@ mDNSlocal void ReleaseCacheGroup(mDNS *const m, CacheGroup **cp)
         LogMsg("ERROR: (*cp)->members == mDNSNULL but (*cp)->rrcache_tail != &(*cp)->members)");
     //if ((*cp)->name != (domainname*)((*cp)->namestorage))
     //  LogMsg("ReleaseCacheGroup: %##s, %p %p", (*cp)->name->c, (*cp)->name, (domainname*)((*cp)->namestorage));
-    if ((*cp)->name != (domainname*)((*cp)->namestorage)) mDNSPlatformMemFree((*cp)->name);
+    if ((*cp)->name != (domainname*)((*cp)->namestorage)) ReleaseInternedName(m, (*cp)->name);
     (*cp)->name = mDNSNULL;
+    CancelCacheGroupCheck(m, *cp);
     *cp = (*cp)->next;          // Cut record from list
     ReleaseCacheEntity(m, e);
+    m->rrcache_groups--;
+    CheckCacheHashLoad(m);
 }
 
 mDNSlocal void ReleaseAdditionalCacheRecords(mDNS *const m, CacheRecord **rp)
@@ -4677,7 +5962,7 @@ mDNSlocal void ReleaseAdditionalCacheRecords(mDNS *const m, CacheRecord **rp)
         *rp = (*rp)->next;          // Cut record from list
         if (rr->resrec.rdata && rr->resrec.rdata != (RData*)&rr->smallrdatastorage)
         {
-            mDNSPlatformMemFree(rr->resrec.rdata);
+            MemSlabFree(m, rr->resrec.rdata);
             rr->resrec.rdata = mDNSNULL;
         }
         // NSEC or SOA records that are not added to the CacheGroup do not share the name
@@ -4685,7 +5970,7 @@ mDNSlocal void ReleaseAdditionalCacheRecords(mDNS *const m, CacheRecord **rp)
         if (rr->resrec.name)
         {
             debugf("ReleaseAdditionalCacheRecords: freeing cached record %##s (%s)", rr->resrec.name->c, DNSTypeName(rr->resrec.rrtype));
-            mDNSPlatformMemFree((void *)rr->resrec.name);
+            MemSlabFree(m, (void *)rr->resrec.name);
             rr->resrec.name = mDNSNULL;
         }
         // Don't count the NSEC3 records used by anonymous browse/reg
@@ -4693,16 +5978,83 @@ mDNSlocal void ReleaseAdditionalCacheRecords(mDNS *const m, CacheRecord **rp)
         {
             m->rrcache_totalused_unicast -= rr->resrec.rdlength;
         }
+        UncountCacheRecordInPartition(m, rr);
         ReleaseCacheEntity(m, (CacheEntity *)rr);
     }
 }
 
+// Negative answers for different types of one name from one server carry the same SOA, so rather than each
+// negative cache entry keeping its own copy (a cache entity plus out-of-line rdata), a negative entry whose SOA is
+// identical to one already held by a sibling keeps none and uses the sibling's. When the holder is released its
+// copy is handed on to a sibling that was relying on it.
+mDNSlocal mDNSBool SameNegativeSource(const CacheRecord *const a, const CacheRecord *const b)
+{
+#if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+    return(a->resrec.InterfaceID == b->resrec.InterfaceID && a->resrec.dnsservice == b->resrec.dnsservice);
+#else
+    return(a->resrec.InterfaceID == b->resrec.InterfaceID && a->resrec.rDNSServer == b->resrec.rDNSServer);
+#endif
+}
+
+mDNSexport CacheRecord *NegativeCacheRecordSOA(const mDNS *const m, const CacheRecord *const neg)
+{
+    const CacheGroup *cg;
+    CacheRecord *cr;
+
+    if (neg->soa || neg->resrec.RecordType != kDNSRecordTypePacketNegative) return(neg->soa);
+    cg = CacheGroupForRecord(m, &neg->resrec);
+    for (cr = cg ? cg->members : mDNSNULL; cr; cr = cr->next)
+        if (cr->soa && cr != neg && cr->resrec.RecordType == kDNSRecordTypePacketNegative && SameNegativeSource(cr, neg))
+            return(cr->soa);
+    return(mDNSNULL);
+}
+
+mDNSlocal void SetNegativeCacheRecordSOA(mDNS *const m, CacheRecord *const neg, CacheRecord *const soa)
+{
+    const CacheGroup *const cg = CacheGroupForRecord(m, &neg->resrec);
+    const CacheRecord *cr;
+
+    if (neg->soa) ReleaseCacheRecord(m, neg->soa);
+    neg->soa = mDNSNULL;
+    for (cr = cg ? cg->members : mDNSNULL; cr; cr = cr->next)
+    {
+        if (cr->soa && cr != neg && cr->resrec.RecordType == kDNSRecordTypePacketNegative && SameNegativeSource(cr, neg) &&
+            IdenticalResourceRecord(&cr->soa->resrec, &soa->resrec))
+        {
+            m->mDNSStats.NegativeSOAShared++;
+            ReleaseCacheRecord(m, soa);
+            return;
+        }
+    }
+    neg->soa = soa;
+}
+
+mDNSlocal void HandOffNegativeSOA(const mDNS *const m, CacheRecord *const neg)
+{
+    const CacheGroup *const cg = CacheGroupForRecord(m, &neg->resrec);
+    CacheRecord *cr;
+
+    for (cr = cg ? cg->members : mDNSNULL; cr; cr = cr->next)
+    {
+        if (!cr->soa && cr != neg && cr->resrec.RecordType == kDNSRecordTypePacketNegative && SameNegativeSource(cr, neg))
+        {
+            cr->soa  = neg->soa;
+            neg->soa = mDNSNULL;
+            return;
+        }
+    }
+}
+
 mDNSexport void ReleaseCacheRecord(mDNS *const m, CacheRecord *r)
 {
     CacheGroup *cg;
 
+    if (r->soa && r->resrec.RecordType == kDNSRecordTypePacketNegative) HandOffNegativeSOA(m, r);
     //LogMsg("ReleaseCacheRecord: Releasing %s", CRDisplayString(m, r));
-    if (r->resrec.rdata && r->resrec.rdata != (RData*)&r->smallrdatastorage) mDNSPlatformMemFree(r->resrec.rdata);
+    RemoveCacheRecordFromLRU(m, r);
+    if (r->CRActiveQuestion) KnownAnswerSetRemove(m, r->CRActiveQuestion, r);
+    if (m->AnswerBatchCount) ForgetBatchedAnswers(m, mDNSNULL, r);
+    if (r->resrec.rdata && r->resrec.rdata != (RData*)&r->smallrdatastorage) MemSlabFree(m, r->resrec.rdata);
     r->resrec.rdata = mDNSNULL;
 #if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
     mdns_forget(&r->resrec.dnsservice);
@@ -4725,7 +6077,7 @@ mDNSexport void ReleaseCacheRecord(mDNS *const m, CacheRecord *r)
     if (r->resrec.name && cg && r->resrec.name != cg->name)
     {
         debugf("ReleaseCacheRecord: freeing %##s (%s)", r->resrec.name->c, DNSTypeName(r->resrec.rrtype));
-        mDNSPlatformMemFree((void *)r->resrec.name);
+        MemSlabFree(m, (void *)r->resrec.name);
     }
     r->resrec.name = mDNSNULL;
 
@@ -4736,19 +6088,24 @@ mDNSexport void ReleaseCacheRecord(mDNS *const m, CacheRecord *r)
 
     ReleaseAdditionalCacheRecords(m, &r->soa);
 
+    UncountCacheRecordInPartition(m, r);
     ReleaseCacheEntity(m, (CacheEntity *)r);
 }
 
 // Note: We want to be careful that we deliver all the CacheRecordRmv calls before delivering
 // CacheRecordDeferredAdd calls. The in-order nature of the cache lists ensures that all
 // callbacks for old records are delivered before callbacks for newer records.
-mDNSlocal void CheckCacheExpiration(mDNS *const m, const mDNSu32 slot, CacheGroup *const cg)
+mDNSlocal void CheckCacheExpiration(mDNS *const m, CacheGroup *const cg)
 {
     CacheRecord **rp = &cg->members;
 
     if (m->lock_rrcache) { LogMsg("CheckCacheExpiration ERROR! Cache already locked!"); return; }
     m->lock_rrcache = 1;
 
+    // We're about to look at every member, so forget the old check time and let the members below
+    // (and any callbacks they trigger) schedule the next one.
+    CancelCacheGroupCheck(m, cg);
+
     while (*rp)
     {
         CacheRecord *const rr = *rp;
@@ -4776,7 +6133,11 @@ mDNSlocal void CheckCacheExpiration(mDNS *const m, const mDNSu32 slot, CacheGrou
                     SetNextQueryTime(m, q);
                 }
                 CacheRecordRmv(m, rr);
+                // No longer active: a record that isn't released below (a ghost) must be evictable, and mustn't be
+                // counted off rrcache_active again on the next pass or when its question stops
+                SetCRActiveQuestion(m, rr, mDNSNULL);
                 m->rrcache_active--;
+                AddCacheRecordToLRU(m, rr);
             }
             
             event += MAX_GHOST_TIME;                                                    // Adjust so we can check for a ghost expiration
@@ -4831,13 +6192,14 @@ mDNSlocal void CheckCacheExpiration(mDNS *const m, const mDNSu32 slot, CacheGrou
         {
             verbosedebugf("CheckCacheExpiration:%6d %5d %s",
                           (event - m->timenow) / mDNSPlatformOneSecond, CacheCheckGracePeriod(rr), CRDisplayString(m, rr));
-            if (m->rrcache_nextcheck[slot] - event > 0)
-                m->rrcache_nextcheck[slot] = event;
+            ScheduleCacheGroupCheck(m, cg, event);
             rp = &rr->next;
         }
     }
     if (cg->rrcache_tail != rp) verbosedebugf("CheckCacheExpiration: Updating CacheGroup tail from %p to %p", cg->rrcache_tail, rp);
     cg->rrcache_tail = rp;
+    // An empty CacheGroup is released the next time mDNS_Execute looks at the cache
+    if (!cg->members) ScheduleCacheGroupCheck(m, cg, m->timenow);
     m->lock_rrcache = 0;
 }
 
@@ -4942,18 +6304,90 @@ mDNSlocal void AnswerSuppressedQuestion(mDNS *const m, DNSQuestion *q)
     }
 }
 
+// A prefetch is a core-owned question that stays up until the record it was started for would have expired, so the
+// refresh queries SendQueries makes for records with an active question still go out after the client's question stops.
+// Unless the refresh fails, the prefetch never hears about it: the refreshed record already answered it.
+mDNSlocal void UnicastPrefetchCallback(mDNS *const m, DNSQuestion *question, const ResourceRecord *const answer, QC_result AddRecord)
+{
+    (void)answer;   // Unused
+    if (AddRecord == QC_forceresponse)      // TimeoutQuestions is telling us our time is up
+    {
+        mDNS_StopQuery(m, question);
+        mDNSPlatformMemFree(question);
+    }
+}
+
+mDNSlocal void StartUnicastPrefetch(mDNS *const m, const DNSQuestion *const q, const mDNSu16 qtype, const mDNSs32 until)
+{
+    DNSQuestion *const pq = (DNSQuestion *)mDNSPlatformMemAllocateClear(sizeof(*pq));
+    if (!pq) return;
+    pq->InterfaceID      = q->InterfaceID;
+    pq->flags            = q->flags;
+    AssignDomainName(&pq->qname, &q->qname);
+    pq->qtype            = qtype;           // A CNAME is refreshed on its own, rather than by following it
+    pq->qclass           = q->qclass;
+    pq->LongLived        = mDNSfalse;
+    pq->ExpectUnique     = q->ExpectUnique;
+    pq->ForceMCast       = mDNSfalse;
+    pq->ReturnIntermed   = mDNSfalse;
+    pq->SuppressUnusable = mDNSfalse;
+    pq->AppendSearchDomains = mDNSfalse;
+    pq->TimeoutQuestion  = 1;
+    pq->StopTime         = NonZeroTime(until + mDNSPlatformOneSecond);
+    pq->WakeOnResolve    = 0;
+    pq->UseBackgroundTraffic = q->UseBackgroundTraffic;
+    pq->ProxyQuestion    = 0;
+    pq->pid              = mDNSPlatformGetPID();
+    pq->euid             = 0;
+    pq->QuestionCallback = UnicastPrefetchCallback;
+    pq->QuestionContext  = mDNSNULL;
+    if (mDNS_StartQuery_internal(m, pq) != mStatus_NoError) { mDNSPlatformMemFree(pq); return; }
+    LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO,
+              "[R%d->Q%d] StartUnicastPrefetch: refreshing " PRI_DM_NAME " (" PUB_S ") for %d more ticks",
+              q->request_id, mDNSVal16(pq->TargetQID), DM_NAME_PARAM(&pq->qname), DNSTypeName(pq->qtype), until - m->timenow);
+}
+
+// The question to be answered is not passed in as an explicit parameter; it is implicit that it is m->CurrentQuestion.
+// Called SERVE_STALE_CLIENT_TIMEOUT after a unicast question found only expired data in the cache. If upstream still hasn't
+// answered, the client gets that data (marked expired, with a short TTL) instead of waiting on. The stale answers aren't
+// counted in CurrentAnswers, so the question keeps asking, and the fresh answer is delivered as usual when it comes.
+mDNSexport void AnswerCurrentQuestionWithStaleRecords(mDNS *const m)
+{
+    DNSQuestion *const q = m->CurrentQuestion;
+    const CacheGroup *const cg = CacheGroupForName(m, q->qnamehash, &q->qname);
+    CacheRecord *cr;
+
+    q->staleTime = 0;
+    if (q->CurrentAnswers || !cg) return;
+    LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO,
+              "[R%d->Q%d] AnswerCurrentQuestionWithStaleRecords: no answer from upstream yet for " PRI_DM_NAME " (" PUB_S ")",
+              q->request_id, mDNSVal16(q->TargetQID), DM_NAME_PARAM(&q->qname), DNSTypeName(q->qtype));
+    m->lock_rrcache = 1;
+    for (cr = cg->members; cr; cr = cr->next)
+    {
+        if (cr->resrec.mortality != Mortality_Ghost || cr->resrec.RecordType == kDNSRecordTypePacketNegative) continue;
+        if (m->timenow - RRExpireTime(cr) >= SERVE_STALE_MAX_TIME || !SameNameCacheRecordAnswersQuestion(cr, q)) continue;
+        AnswerCurrentQuestionWithResourceRecord(m, cr, QC_add);
+        if (m->CurrentQuestion != q) break;     // If callback deleted q, then we're finished here
+    }
+    m->lock_rrcache = 0;
+}
+
 mDNSlocal void AnswerNewQuestion(mDNS *const m)
 {
     mDNSBool ShouldQueryImmediately = mDNStrue;
+    mDNSBool HaveStaleAnswers = mDNSfalse;
+    mDNSs32 PrefetchUntil = 0;
+    mDNSu16 PrefetchType = 0;
     DNSQuestion *const q = m->NewQuestions;     // Grab the question we're going to answer
 #if MDNSRESPONDER_SUPPORTS(APPLE, DNS64)
-    if (!mDNSOpaque16IsZero(q->TargetQID)) DNS64HandleNewQuestion(m, q);
+    if (!mDNSOpaque16IsZero(q->TargetQID)) { DNS64HandleNewQuestion(m, q); RehashQuestion(m, q); }
 #endif
     CacheGroup *const cg = CacheGroupForName(m, q->qnamehash, &q->qname);
 
     verbosedebugf("AnswerNewQuestion: Answering %##s (%s)", q->qname.c, DNSTypeName(q->qtype));
 
-    if (cg) CheckCacheExpiration(m, HashSlotFromNameHash(q->qnamehash), cg);
+    if (cg) CheckCacheExpiration(m, cg);
     if (m->NewQuestions != q) { LogInfo("AnswerNewQuestion: Question deleted while doing CheckCacheExpiration"); goto exit; }
     m->NewQuestions = q->next;
     // Advance NewQuestions to the next *after* calling CheckCacheExpiration, because if we advance it first
@@ -5033,7 +6467,24 @@ mDNSlocal void AnswerNewQuestion(mDNS *const m)
                 // SecsSinceRcvd is whole number of elapsed seconds, rounded down
                 mDNSu32 SecsSinceRcvd = ((mDNSu32)(m->timenow - cr->TimeRcvd)) / mDNSPlatformOneSecond;
                 mDNSBool IsExpired = (cr->resrec.rroriginalttl <= SecsSinceRcvd);
-                if (IsExpired && q->allowExpired != AllowExpired_AllowExpiredAnswers) continue;   // Go to next one in loop
+                if (IsExpired && q->allowExpired != AllowExpired_AllowExpiredAnswers)
+                {
+                    if (ServeStaleUnicastAnswers && !mDNSOpaque16IsZero(q->TargetQID) && cr->resrec.mortality == Mortality_Ghost &&
+                        cr->resrec.RecordType != kDNSRecordTypePacketNegative && m->timenow - RRExpireTime(cr) < SERVE_STALE_MAX_TIME)
+                        HaveStaleAnswers = mDNStrue;    // Keep it in mind in case upstream doesn't answer in time
+                    continue;   // Go to next one in loop
+                }
+
+                // A one-shot unicast question answered in the last tenth of a record's lifetime suggests someone will ask
+                // again soon, so unless another question is already keeping the record fresh, refresh it ahead of expiry
+                if (PrefetchUnicastAnswers && !IsExpired && !mDNSOpaque16IsZero(q->TargetQID) && !q->LongLived &&
+                    !cr->CRActiveQuestion && q->QuestionCallback != UnicastPrefetchCallback &&
+                    cr->resrec.RecordType != kDNSRecordTypePacketNegative && cr->resrec.rroriginalttl >= UNICAST_PREFETCH_MIN_TTL &&
+                    RRExpireTime(cr) - m->timenow < TicksTTL(cr) / 10 && (!PrefetchUntil || RRExpireTime(cr) - PrefetchUntil > 0))
+                {
+                    PrefetchUntil = RRExpireTime(cr);
+                    PrefetchType  = (cr->resrec.rrtype == kDNSType_CNAME) ? kDNSType_CNAME : q->qtype;
+                }
 
                 // If this record set is marked unique, then that means we can reasonably assume we have the whole set
                 // -- we don't need to rush out on the network and query immediately to see if there are more answers out there
@@ -5049,16 +6500,25 @@ mDNSlocal void AnswerNewQuestion(mDNS *const m)
                 cr->LastCachedAnswerTime = m->timenow;
                 dnssd_analytics_update_cache_request(mDNSOpaque16IsZero(q->TargetQID) ? CacheRequestType_multicast : CacheRequestType_unicast, CacheState_hit);
 #endif
+                m->mDNSStats.CacheHits++;
                 AnswerCurrentQuestionWithResourceRecord(m, cr, QC_add);
                 if (m->CurrentQuestion != q) break;     // If callback deleted q, then we're finished here
             }
             else if (mDNSOpaque16IsZero(q->TargetQID) && RRTypeIsAddressType(cr->resrec.rrtype) && RRTypeIsAddressType(q->qtype))
                 ShouldQueryImmediately = mDNSfalse;
+        if (m->CurrentQuestion == q && !q->CurrentAnswers) m->mDNSStats.CacheMisses++;
     }
     // We don't use LogInfo for this "Question deleted" message because it happens so routinely that
     // it's not remotely remarkable, and therefore unlikely to be of much help tracking down bugs.
     if (m->CurrentQuestion != q) { debugf("AnswerNewQuestion: Question deleted while giving cache answers"); goto exit; }
 
+    if (PrefetchUntil) StartUnicastPrefetch(m, q, PrefetchType, PrefetchUntil);
+    if (HaveStaleAnswers && !q->CurrentAnswers)
+    {
+        q->staleTime = NonZeroTime(m->timenow + SERVE_STALE_CLIENT_TIMEOUT);
+        if (m->NextuDNSEvent - q->staleTime > 0) m->NextuDNSEvent = q->staleTime;
+    }
+
 #if MDNSRESPONDER_SUPPORTS(APPLE, CACHE_ANALYTICS)
     dnssd_analytics_update_cache_request(mDNSOpaque16IsZero(q->TargetQID) ? CacheRequestType_multicast : CacheRequestType_unicast, CacheState_miss);
 #endif
@@ -5179,15 +6639,86 @@ mDNSlocal void AnswerNewLocalOnlyQuestion(mDNS *const m)
     m->CurrentRecord   = mDNSNULL;
 }
 
-mDNSlocal CacheEntity *GetCacheEntity(mDNS *const m, const CacheGroup *const PreserveCG)
+mDNSlocal void CountCacheEviction(mDNS *const m, const CacheRecord *const cr)
+{
+    const mDNSs32 age = m->timenow - cr->TimeRcvd;
+
+    if (m->timenow - m->rrcache_evict_window >= mDNSPlatformOneSecond)
+    {
+        // If the window we're closing ended more than a second ago, nothing was evicted in the one after it
+        m->rrcache_evict_rate   = (m->timenow - m->rrcache_evict_window < 2 * mDNSPlatformOneSecond) ? m->rrcache_evict_second : 0;
+        m->rrcache_evict_second = 0;
+        m->rrcache_evict_window = m->timenow;
+    }
+    m->rrcache_evictions++;
+    if (++m->rrcache_evict_second > m->rrcache_evict_peak) m->rrcache_evict_peak = m->rrcache_evict_second;
+    m->rrcache_evict_age = age;
+    if (m->rrcache_evict_age_max < age) m->rrcache_evict_age_max = age;
+}
+
+// Frees the least recently used cache record that isn't answering an active question, if there is one.
+// If partition is non-zero, only records accounted to that entry in m->rrcache_partitions are considered.
+// Records in the LRU list that have picked up a question some other way are simply dropped from the list.
+// Records still linked into the CacheFlushRecords list may not be recycled, or we'll crash, so they are
+// moved to the most-recently-used end and the next one is tried (or just passed over, for a partition).
+mDNSlocal mDNSBool EvictCacheRecord(mDNS *const m, const CacheGroup *const PreserveCG, const mDNSu8 partition)
+{
+    const CacheRecord *firstskipped = mDNSNULL;
+    CacheRecord *cr, *next;
+
+    for (cr = m->rrcache_lru; cr && cr != firstskipped; cr = next)
+    {
+        CacheGroup **cp;
+        CacheRecord **rp;
+
+        next = cr->LRUNext;
+        if (partition && cr->Partition != partition) continue;
+        if (cr->CRActiveQuestion) { RemoveCacheRecordFromLRU(m, cr); continue; }
+        if (cr->NextInCFList)
+        {
+            if (partition) continue;
+            if (!firstskipped) firstskipped = cr;
+            AddCacheRecordToLRU(m, cr);
+            continue;
+        }
+
+        cp = &m->rrcache_hash[HashSlotFromNameHash(m, cr->resrec.namehash)];
+        while (*cp && (*cp)->name != cr->resrec.name) cp = &(*cp)->next;
+        rp = *cp ? &(*cp)->members : mDNSNULL;
+        while (rp && *rp && *rp != cr) rp = &(*rp)->next;
+        if (!rp || !*rp)
+        {
+            LogMsg("EvictCacheRecord: ERROR!! %s not in its CacheGroup", CRDisplayString(m, cr));
+            RemoveCacheRecordFromLRU(m, cr);
+            continue;
+        }
+
+        CountCacheEviction(m, cr);
+        mDNS_TRACE4(cache__evict, cr->resrec.namehash, cr->resrec.rrtype, cr->resrec.InterfaceID, m->timenow - cr->TimeRcvd);
+        verbosedebugf("EvictCacheRecord: evicting %s, age %d", CRDisplayString(m, cr), m->timenow - cr->TimeRcvd);
+        *rp = cr->next;                             // Cut record from list
+        if ((*cp)->rrcache_tail == &cr->next) (*cp)->rrcache_tail = rp;
+        ReleaseCacheRecord(m, cr);
+        if (!(*cp)->members && *cp != PreserveCG) ReleaseCacheGroup(m, cp);
+        return(mDNStrue);
+    }
+    return(mDNSfalse);
+}
+
+// If partition is non-zero (see CachePartitionOverQuota) and the cache is full and can't grow, the entity is taken
+// from that partition if possible, rather than by evicting some other interface's record
+mDNSlocal CacheEntity *GetCacheEntity(mDNS *const m, const CacheGroup *const PreserveCG, const mDNSu8 partition)
 {
     CacheEntity *e = mDNSNULL;
 
     if (m->lock_rrcache) { LogMsg("GetFreeCacheRR ERROR! Cache already locked!"); return(mDNSNULL); }
     m->lock_rrcache = 1;
 
-    // If we have no free records, ask the client layer to give us some more memory
-    if (!m->rrcache_free && m->MainCallback)
+    e = TakeFreeCacheEntity(m);
+
+    // If we have no free records, ask the client layer to give us some more memory, unless we're at our limit
+    if (!e && m->MainCallback &&
+        !(m->rrcache_mem_limit && (m->rrcache_grow_refused || m->rrcache_size * sizeof(CacheEntity) >= m->rrcache_mem_limit)))
     {
         if (m->rrcache_totalused != m->rrcache_size)
         {
@@ -5212,49 +6743,21 @@ mDNSlocal CacheEntity *GetCacheEntity(mDNS *const m, const CacheGroup *const Pre
             mDNS_DropLockBeforeCallback();      // Allow client to legally make mDNS API calls from the callback
             m->MainCallback(m, mStatus_GrowCache);
             mDNS_ReclaimLockAfterCallback();    // Decrement mDNS_reentrancy to block mDNS API calls again
+            e = TakeFreeCacheEntity(m);
         }
     }
 
-    // If we still have no free records, recycle all the records we can.
-    // Enumerating the entire cache is moderately expensive, so when we do it, we reclaim all the records we can in one pass.
-    if (!m->rrcache_free)
+    // If we still have no free records, evict the least recently used record that isn't answering an active question,
+    // from our own partition if we're over quota
+    if (!e && partition && EvictCacheRecord(m, PreserveCG, partition))
     {
-        mDNSu32 oldtotalused = m->rrcache_totalused;
-        mDNSu32 slot;
-        for (slot = 0; slot < CACHE_HASH_SLOTS; slot++)
-        {
-            CacheGroup **cp = &m->rrcache_hash[slot];
-            while (*cp)
-            {
-                CacheRecord **rp = &(*cp)->members;
-                while (*rp)
-                {
-                    // Records that answer still-active questions are not candidates for recycling
-                    // Records that are currently linked into the CacheFlushRecords list may not be recycled, or we'll crash
-                    if ((*rp)->CRActiveQuestion || (*rp)->NextInCFList)
-                        rp=&(*rp)->next;
-                    else
-                    {
-                        CacheRecord *rr = *rp;
-                        *rp = (*rp)->next;          // Cut record from list
-                        ReleaseCacheRecord(m, rr);
-                    }
-                }
-                if ((*cp)->rrcache_tail != rp)
-                    verbosedebugf("GetFreeCacheRR: Updating rrcache_tail[%lu] from %p to %p", slot, (*cp)->rrcache_tail, rp);
-                (*cp)->rrcache_tail = rp;
-                if ((*cp)->members || (*cp)==PreserveCG) cp=&(*cp)->next;
-                else ReleaseCacheGroup(m, cp);
-            }
-        }
-        LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO, "GetCacheEntity recycled %d records to reduce cache from %d to %d",
-                  oldtotalused - m->rrcache_totalused, oldtotalused, m->rrcache_totalused);
+        m->rrcache_partition_evictions++;
+        e = TakeFreeCacheEntity(m);
     }
+    if (!e && EvictCacheRecord(m, PreserveCG, 0)) e = TakeFreeCacheEntity(m);
 
-    if (m->rrcache_free)    // If there are records in the free list, take one
+    if (e)
     {
-        e = m->rrcache_free;
-        m->rrcache_free = e->next;
         if (++m->rrcache_totalused >= m->rrcache_report)
         {
             LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO, "RR Cache now using %u objects", m->rrcache_totalused);
@@ -5270,46 +6773,111 @@ mDNSlocal CacheEntity *GetCacheEntity(mDNS *const m, const CacheGroup *const Pre
     return(e);
 }
 
-mDNSlocal CacheRecord *GetCacheRecord(mDNS *const m, CacheGroup *cg, mDNSu16 RDLength)
+// After a burst the cache can be left holding far more storage than it needs. Once usage has stayed below
+// CacheShrinkLowWater percent for CacheShrinkDelay, blocks that came from mDNS_GrowCacheReleasable and have
+// nothing in use are handed back, as long as usage stays under CacheShrinkHighWater percent without them, so we
+// don't give back a block just to ask for it again. Idle AuthEntity objects, which are allocated one at a time, are
+// freed at the same time, keeping AuthShrinkReserve of them.
+#define CacheShrinkDelay        (60 * mDNSPlatformOneSecond)
+#define CacheShrinkLowWater     50
+#define CacheShrinkHighWater    75
+#define AuthShrinkReserve       16
+
+mDNSlocal mDNSBool CacheShrinkWanted(const mDNS *const m)
+{
+    const CacheBlock *b;
+    if (m->rrcache_totalused * 100 < m->rrcache_size * CacheShrinkLowWater)
+        for (b = m->rrcache_blocks; b; b = b->next)
+            if (!b->used) return(mDNStrue);
+    return(m->rrauth.rrauth_size - m->rrauth.rrauth_totalused > AuthShrinkReserve);
+}
+
+// If all is set, every idle block is released regardless of the watermarks (used when shutting down)
+mDNSlocal void ShrinkCache(mDNS *const m, const mDNSBool all)
+{
+    CacheBlock *b, **bp;
+    mDNSu32 released = 0;
+
+    if (all || m->rrcache_totalused * 100 < m->rrcache_size * CacheShrinkLowWater)
+    {
+        for (bp = &m->rrcache_blocks; (b = *bp) != mDNSNULL; )
+        {
+            if (!b->used && (all || m->rrcache_totalused * 100 < (m->rrcache_size - b->count) * CacheShrinkHighWater))
+            {
+                *bp = b->next;
+                m->rrcache_size -= b->count;
+                m->rrcache_blocks_released++;
+                released++;
+                mDNSPlatformMemFree(b);
+            }
+            else bp = &b->next;
+        }
+        if (released)
+        {
+            m->rrcache_grow_refused = mDNSfalse;
+            LogInfo("ShrinkCache: released %u blocks; cache now %u entities, %u in use", released, m->rrcache_size, m->rrcache_totalused);
+        }
+    }
+
+    while (m->rrauth.rrauth_free && m->rrauth.rrauth_size - m->rrauth.rrauth_totalused > (all ? 0 : AuthShrinkReserve))
+    {
+        AuthEntity *const e = m->rrauth.rrauth_free;
+        m->rrauth.rrauth_free = e->next;
+        m->rrauth.rrauth_size--;
+        m->rrauth.rrauth_released++;
+        mDNSPlatformMemFree(e);
+    }
+}
+
+mDNSlocal CacheRecord *GetCacheRecord(mDNS *const m, CacheGroup *cg, mDNSu16 RDLength, const mDNSu8 partition)
 {
-    CacheRecord *r = (CacheRecord *)GetCacheEntity(m, cg);
+    CacheRecord *r = (CacheRecord *)GetCacheEntity(m, cg, partition);
     if (r)
     {
         r->resrec.rdata = (RData*)&r->smallrdatastorage;    // By default, assume we're usually going to be using local storage
         if (RDLength > InlineCacheRDSize)           // If RDLength is too big, allocate extra storage
         {
-            r->resrec.rdata = (RData*) mDNSPlatformMemAllocateClear(sizeofRDataHeader + RDLength);
-            if (r->resrec.rdata) r->resrec.rdata->MaxRDLength = r->resrec.rdlength = RDLength;
+            r->resrec.rdata = (RData*) MemSlabAllocate(m, sizeofRDataHeader + RDLength);
+            if (r->resrec.rdata)
+            {
+                mDNSPlatformMemZero(r->resrec.rdata, sizeofRDataHeader + RDLength);
+                r->resrec.rdata->MaxRDLength = r->resrec.rdlength = RDLength;
+            }
             else { ReleaseCacheEntity(m, (CacheEntity*)r); r = mDNSNULL; }
         }
     }
     return(r);
 }
 
-mDNSlocal CacheGroup *GetCacheGroup(mDNS *const m, const mDNSu32 slot, const ResourceRecord *const rr)
+mDNSlocal CacheGroup *GetCacheGroup(mDNS *const m, const mDNSu32 slot, const ResourceRecord *const rr, const mDNSu8 partition)
 {
     mDNSu16 namelen = DomainNameLength(rr->name);
-    CacheGroup *cg = (CacheGroup*)GetCacheEntity(m, mDNSNULL);
+    CacheGroup *cg = (CacheGroup*)GetCacheEntity(m, mDNSNULL, partition);
     if (!cg) { LogMsg("GetCacheGroup: Failed to allocate memory for %##s", rr->name->c); return(mDNSNULL); }
     cg->next         = m->rrcache_hash[slot];
     cg->namehash     = rr->namehash;
     cg->members      = mDNSNULL;
     cg->rrcache_tail = &cg->members;
+    // A name that fits in the group's own namestorage costs nothing extra there; a longer one is shared
     if (namelen > sizeof(cg->namestorage))
-        cg->name = (domainname *) mDNSPlatformMemAllocate(namelen);
+        cg->name = (domainname *) InternDomainName(m, rr->name, rr->namehash);
     else
+    {
         cg->name = (domainname*)cg->namestorage;
+        AssignDomainName(cg->name, rr->name);
+    }
     if (!cg->name)
     {
         LogMsg("GetCacheGroup: Failed to allocate name storage for %##s", rr->name->c);
         ReleaseCacheEntity(m, (CacheEntity*)cg);
         return(mDNSNULL);
     }
-    AssignDomainName(cg->name, rr->name);
 
     if (CacheGroupForRecord(m, rr)) LogMsg("GetCacheGroup: Already have CacheGroup for %##s", rr->name->c);
     m->rrcache_hash[slot] = cg;
     if (CacheGroupForRecord(m, rr) != cg) LogMsg("GetCacheGroup: Not finding CacheGroup for %##s", rr->name->c);
+    m->rrcache_groups++;
+    CheckCacheHashLoad(m);
 
     return(cg);
 }
@@ -5464,18 +7032,60 @@ mDNSlocal void mDNSCoreFreeProxyRR(mDNS *const m)
     m->SPSRRSet = mDNSNULL;
 }
 
+// Adds one run of a timed phase (started at 'start', in mDNSPlatformRawTime units) to its counters in m->mDNSStats
+mDNSlocal void CountPhaseTime(mDNSu32 *const runs, mDNSu32 *const total, mDNSu32 *const longest, const mDNSs32 start)
+{
+    const mDNSu32 elapsed = (mDNSu32)(mDNSPlatformRawTime() - start);
+    (*runs)++;
+    *total += elapsed;
+    if (*longest < elapsed) *longest = elapsed;
+}
+
+// Counts an mDNS_Execute wakeup in the per-minute figures shown in the state dump
+mDNSlocal void CountWakeup(mDNS *const m)
+{
+    mDNSStatistics *const stats = &m->mDNSStats;
+    if (!stats->WakeupMinuteStart || m->timenow - stats->WakeupMinuteStart >= mDNSPlatformOneSecond * 60)
+    {
+        // A minute with no wakeups at all in between counts as zero
+        if (stats->WakeupMinuteStart)
+            stats->WakeupsLastMinute = (m->timenow - stats->WakeupMinuteStart < mDNSPlatformOneSecond * 120) ? stats->WakeupsThisMinute : 0;
+        stats->WakeupMinuteStart = NonZeroTime(m->timenow);
+        stats->WakeupsThisMinute = 0;
+    }
+    stats->WakeupsThisMinute++;
+    if (stats->WakeupsMaxPerMinute < stats->WakeupsThisMinute) stats->WakeupsMaxPerMinute = stats->WakeupsThisMinute;
+}
+
+// When profiling, charges the time since *mark to 'phase' and moves *mark on to now. Costs one test when profiling is off.
+mDNSlocal void ProfileExecutePhase(mDNS *const m, const ExecutePhase phase, mDNSs32 *const mark)
+{
+    if (m->ExecuteProfiling)
+    {
+        const mDNSs32 now = mDNSPlatformRawTime();
+        m->ExecuteProfile.Duration[phase][ExecuteHistogramBucket(now - *mark)]++;
+        *mark = now;
+    }
+}
+
 mDNSexport mDNSs32 mDNS_Execute(mDNS *const m)
 {
     mDNS_Lock(m);   // Must grab lock before trying to read m->timenow
 
     if (m->timenow - m->NextScheduledEvent >= 0)
     {
+        const mDNSs32 start = mDNSPlatformRawTime();
+        mDNSs32 mark = start;
         int i;
         AuthRecord *head, *tail;
         mDNSu32 slot;
         AuthGroup *ag;
 
         verbosedebugf("mDNS_Execute");
+        CountWakeup(m);
+
+        if (m->ExecuteProfiling)
+            m->ExecuteProfile.Lateness[ExecuteHistogramBucket(m->timenow - m->NextScheduledEvent)]++;
 
         if (m->CurrentQuestion)
             LogMsg("mDNS_Execute: ERROR m->CurrentQuestion already set: %##s (%s)",
@@ -5494,30 +7104,43 @@ mDNSexport mDNSs32 mDNS_Execute(mDNS *const m)
         if (m->rrcache_size && m->timenow - m->NextCacheCheck >= 0)
         {
             mDNSu32 numchecked = 0;
-            m->NextCacheCheck = m->timenow + FutureTime;
-            for (slot = 0; slot < CACHE_HASH_SLOTS; slot++)
+            while (m->rrcache_checkheap && m->timenow - m->rrcache_checkheap->nextcheck >= 0)
             {
-                if (m->timenow - m->rrcache_nextcheck[slot] >= 0)
+                CacheGroup *const cg = m->rrcache_checkheap;
+                debugf("m->NextCacheCheck %4d %##s", numchecked, cg->name->c);
+                numchecked++;
+                CheckCacheExpiration(m, cg);
+                if (!cg->members)
                 {
-                    CacheGroup **cp = &m->rrcache_hash[slot];
-                    m->rrcache_nextcheck[slot] = m->timenow + FutureTime;
-                    while (*cp)
+                    CacheGroup **cp = &m->rrcache_hash[HashSlotFromNameHash(m, cg->namehash)];
+                    while (*cp && *cp != cg) cp = &(*cp)->next;
+                    if (*cp) ReleaseCacheGroup(m, cp);
+                    else
                     {
-                        debugf("m->NextCacheCheck %4d Slot %3d %##s", numchecked, slot, *cp ? (*cp)->name : (domainname*)"\x04NULL");
-                        numchecked++;
-                        CheckCacheExpiration(m, slot, *cp);
-                        if ((*cp)->members) cp=&(*cp)->next;
-                        else ReleaseCacheGroup(m, cp);
+                        LogMsg("mDNS_Execute: ERROR!! CacheGroup %##s not in cache hash table", cg->name->c);
+                        CancelCacheGroupCheck(m, cg);
                     }
                 }
-                // Even if we didn't need to actually check this slot yet, still need to
-                // factor its nextcheck time into our overall NextCacheCheck value
-                if (m->NextCacheCheck - m->rrcache_nextcheck[slot] > 0)
-                    m->NextCacheCheck = m->rrcache_nextcheck[slot];
             }
+            UpdateNextCacheCheck(m);
             debugf("m->NextCacheCheck %4d checked, next in %d", numchecked, m->NextCacheCheck - m->timenow);
         }
 
+        // If the cache hash table has grown or shrunk out of its load bounds, split or merge a few more of its slots
+        if (m->NextCacheResize && m->timenow - m->NextCacheResize >= 0)
+            m->NextCacheResize = ResizeCacheHash(m);
+        // If we've been holding on to more storage than we need for a while, give the idle part back
+        if (!m->NextCacheShrink)
+        {
+            if (CacheShrinkWanted(m)) m->NextCacheShrink = NonZeroTime(m->timenow + CacheShrinkDelay);
+        }
+        else if (m->timenow - m->NextCacheShrink >= 0)
+        {
+            if (CacheShrinkWanted(m)) ShrinkCache(m, mDNSfalse);
+            m->NextCacheShrink = 0;
+        }
+        ProfileExecutePhase(m, ExecutePhase_CacheCheck, &mark);
+
         if (m->timenow - m->NextScheduledSPS >= 0)
         {
             m->NextScheduledSPS = m->timenow + FutureTime;
@@ -5563,6 +7186,7 @@ mDNSexport mDNSs32 mDNS_Execute(mDNS *const m)
                 BeginSleepProcessing(m);
             }
         }
+        ProfileExecutePhase(m, ExecutePhase_SPS, &mark);
 
         // 4. See if we can answer any of our new local questions from the cache
         for (i=0; m->NewQuestions && i<1000; i++)
@@ -5571,6 +7195,7 @@ mDNSexport mDNSs32 mDNS_Execute(mDNS *const m)
             AnswerNewQuestion(m);
         }
         if (i >= 1000) LogMsg("mDNS_Execute: AnswerNewQuestion exceeded loop limit");
+        ProfileExecutePhase(m, ExecutePhase_NewQuestions, &mark);
 
         // Make sure we deliver *all* local RMV events, and clear the corresponding rr->AnsweredLocalQ flags, *before*
         // we begin generating *any* new ADD events in the m->NewLocalOnlyQuestions and m->NewLocalRecords loops below.
@@ -5580,8 +7205,8 @@ mDNSexport mDNSs32 mDNS_Execute(mDNS *const m)
             m->CurrentRecord = m->ResourceRecords;
             CheckRmvEventsForLocalRecords(m);
             // Walk the LocalOnly records and deliver the RMV events
-            for (slot = 0; slot < AUTH_HASH_SLOTS; slot++)
-                for (ag = m->rrauth.rrauth_hash[slot]; ag; ag = ag->next)
+            for (slot = 0; slot < AuthHashSlots(&m->rrauth); slot++)
+                for (ag = AuthHashHead(&m->rrauth, slot); ag; ag = ag->next)
                 {
                     m->CurrentRecord = ag->members;
                     if (m->CurrentRecord) CheckRmvEventsForLocalRecords(m);
@@ -5647,9 +7272,9 @@ mDNSexport mDNSs32 mDNS_Execute(mDNS *const m)
         if (m->NewLocalOnlyRecords)
         {
             m->NewLocalOnlyRecords = mDNSfalse;
-            for (slot = 0; slot < AUTH_HASH_SLOTS; slot++)
+            for (slot = 0; slot < AuthHashSlots(&m->rrauth); slot++)
             {
-                for (ag = m->rrauth.rrauth_hash[slot]; ag; ag = ag->next)
+                for (ag = AuthHashHead(&m->rrauth, slot); ag; ag = ag->next)
                 {
                     for (i=0; i<100 && ag->NewLocalOnlyRecords; i++)
                     {
@@ -5663,11 +7288,17 @@ mDNSexport mDNSs32 mDNS_Execute(mDNS *const m)
                         }
                         else LogMsg("mDNS_Execute: LocalOnlyRecord %s not ready", ARDisplayString(m, rr));
                     }
-                    // We limit about 100 per AuthGroup that can be serviced at a time
-                    if (i >= 100) LogMsg("mDNS_Execute: ag->NewLocalOnlyRecords exceeded loop limit");
+                    // We limit about 100 per AuthGroup that can be serviced at a time; the rest wait for the next pass,
+                    // which has to come straight away, since AnswerNewLocalOnlyQuestion doesn't look at them either
+                    if (ag->NewLocalOnlyRecords)
+                    {
+                        LogInfo("mDNS_Execute: ag->NewLocalOnlyRecords exceeded loop limit");
+                        m->NewLocalOnlyRecords = mDNStrue;
+                    }
                 }
             }
         }
+        ProfileExecutePhase(m, ExecutePhase_LocalEvents, &mark);
 
         // 5. See what packets we need to send
         if (m->mDNSPlatformStatus != mStatus_NoError || (m->SleepState == SleepState_Sleeping))
@@ -5700,6 +7331,7 @@ mDNSexport mDNSs32 mDNS_Execute(mDNS *const m)
                        m->timenow, m->NextScheduledProbe, m->timenow - m->NextScheduledProbe);
                 m->NextScheduledProbe = m->timenow + mDNSPlatformOneSecond;
             }
+            ProfileExecutePhase(m, ExecutePhase_SendQueries, &mark);
 
             // 7. Send Response packets, including probing records just advanced to announcing state
             if (m->timenow - m->NextScheduledResponse >= 0) SendResponses(m);
@@ -5708,6 +7340,7 @@ mDNSexport mDNSs32 mDNS_Execute(mDNS *const m)
                 LogMsg("mDNS_Execute: SendResponses didn't send all its responses; will try again in one second");
                 m->NextScheduledResponse = m->timenow + mDNSPlatformOneSecond;
             }
+            ProfileExecutePhase(m, ExecutePhase_SendResponses, &mark);
         }
 
         // Clear RandomDelay values, ready to pick a new different value next time
@@ -5725,6 +7358,14 @@ mDNSexport mDNSs32 mDNS_Execute(mDNS *const m)
         extern void serviceBLE();
         if (m->NextBLEServiceTime && (m->timenow - m->NextBLEServiceTime >= 0)) serviceBLE();
 #endif // APPLE_OSX_mDNSResponder && ENABLE_BLE_TRIGGERED_BONJOUR
+        ProfileExecutePhase(m, ExecutePhase_Unicast, &mark);
+        CountPhaseTime(&m->mDNSStats.ExecuteRuns, &m->mDNSStats.ExecuteTicks, &m->mDNSStats.ExecuteMaxTicks, start);
+
+        if (m->ExecuteProfiling && (!m->ExecuteProfile.NextReport || m->timenow - m->ExecuteProfile.NextReport >= 0))
+        {
+            if (m->ExecuteProfile.NextReport) LogExecuteProfile(m);
+            m->ExecuteProfile.NextReport = NonZeroTime(m->timenow + ExecuteProfileReportInterval);
+        }
     }
 
     // Note about multi-threaded systems:
@@ -5812,11 +7453,38 @@ mDNSlocal void ActivateUnicastQuery(mDNS *const m, DNSQuestion *const question,
 }
 
 // Caller should hold the lock
+// Restarting questions after a network change. Left alone, every active multicast question would be due in the next
+// SendQueries, and with thousands of questions that's a burst of back-to-back packets. So once there are more than
+// QuestionRestartBatch of them, the restarts are spread out in steps QuestionRestartStep apart over no more than
+// QuestionRestartWindow. The clients that started their questions most recently are the ones most likely to still be
+// waiting on an answer, so the newest questions go first. The steps are a whole InitialQuestionInterval apart because
+// SendQueries pulls in any question that's due within half its interval anyway.
+#define QuestionRestartBatch    32
+#define QuestionRestartStep     InitialQuestionInterval
+#define QuestionRestartWindow   (mDNSPlatformOneSecond * 3)
+
+// Returns how long to hold back the restart of the rank'th newest (from zero) of count questions restarted together
+mDNSlocal mDNSs32 QuestionRestartDelay(const mDNSu32 rank, const mDNSu32 count)
+{
+    const mDNSu32 maxsteps = (mDNSu32)(QuestionRestartWindow / QuestionRestartStep);
+    mDNSu32 steps = (count + QuestionRestartBatch - 1) / QuestionRestartBatch;
+    if (steps > maxsteps) steps = maxsteps;
+    if (steps <= 1) return(0);
+    return((mDNSs32)(rank * steps / count) * QuestionRestartStep);
+}
+
+mDNSlocal void NoteQuestionRestarts(mDNS *const m, const mDNSu32 count)
+{
+    if (count > 1) m->mDNSStats.QuestionRestartBursts++;
+    if (m->mDNSStats.QuestionRestartMax < count) m->mDNSStats.QuestionRestartMax = count;
+}
+
 mDNSexport void mDNSCoreRestartAddressQueries(mDNS *const m, mDNSBool SearchDomainsChanged, FlushCache flushCacheRecords,
                                               CallbackBeforeStartQuery BeforeStartCallback, void *context)
 {
     DNSQuestion *q;
     DNSQuestion *restart = mDNSNULL;
+    mDNSu32 count = 0;
 
     mDNS_CheckLock(m);
 
@@ -5893,8 +7561,10 @@ mDNSexport void mDNSCoreRestartAddressQueries(mDNS *const m, mDNSBool SearchDoma
             if (q->ResetHandler) q->ResetHandler(q);
             q->next = restart;
             restart = q;
+            count++;
         }
     }
+    NoteQuestionRestarts(m, count);
 
     // 3. Callback before we start the query
     if (BeforeStartCallback) BeforeStartCallback(m, context);
@@ -5910,9 +7580,25 @@ mDNSexport void mDNSCoreRestartAddressQueries(mDNS *const m, mDNSBool SearchDoma
     }
 }
 
+mDNSlocal void RestartMulticastQuestion(mDNS *const m, DNSQuestion *const q, const mDNSs32 delay)
+{
+    q->ThisQInterval    = InitialQuestionInterval;  // MUST be > zero for an active question
+    q->RequestUnicast   = kDefaultRequestUnicastCount;
+    q->LastQTime        = m->timenow - q->ThisQInterval + delay;
+    q->RecentAnswerPkts = 0;
+    ExpireDupSuppressInfo(q->DupSuppress, m->timenow);
+    if (!delay) m->NextScheduledQuery = m->timenow;
+    else
+    {
+        m->mDNSStats.QuestionRestartsSpread++;
+        SetNextQueryTime(m, q);
+    }
+}
+
 mDNSexport void mDNSCoreRestartQueries(mDNS *const m)
 {
     DNSQuestion *q;
+    mDNSu32 count = 0, started = 0;
 
 #ifndef UNICAST_DISABLED
     // Retrigger all our uDNS questions
@@ -5934,23 +7620,21 @@ mDNSexport void mDNSCoreRestartQueries(mDNS *const m)
     }
 #endif
 
-    // Retrigger all our mDNS questions
+    // Retrigger all our mDNS questions, newest first, spreading them out if there are a lot of them.
+    // m->Questions is in the order the questions were started, so the rank of each counts down from the oldest.
+    for (q = m->Questions; q; q=q->next)
+        if (mDNSOpaque16IsZero(q->TargetQID) && ActiveQuestion(q)) count++;
+    NoteQuestionRestarts(m, count);
     for (q = m->Questions; q; q=q->next)                // Scan our list of questions
-            mDNSCoreRestartQuestion(m, q);
+        if (mDNSOpaque16IsZero(q->TargetQID) && ActiveQuestion(q))
+            RestartMulticastQuestion(m, q, QuestionRestartDelay(count - ++started, count));
 }
 
 // restart question if it's multicast and currently active
 mDNSexport void mDNSCoreRestartQuestion(mDNS *const m, DNSQuestion *q)
 {
     if (mDNSOpaque16IsZero(q->TargetQID) && ActiveQuestion(q))
-    {
-        q->ThisQInterval    = InitialQuestionInterval;  // MUST be > zero for an active question
-        q->RequestUnicast   = kDefaultRequestUnicastCount;
-        q->LastQTime        = m->timenow - q->ThisQInterval;
-        q->RecentAnswerPkts = 0;
-        ExpireDupSuppressInfo(q->DupSuppress, m->timenow);
-        m->NextScheduledQuery = m->timenow;
-    }
+        RestartMulticastQuestion(m, q, 0);
 }
 
 // restart the probe/announce cycle for multicast record
@@ -6213,6 +7897,7 @@ mDNSexport mStatus UpdateKeepaliveRData(mDNS *const m, AuthRecord *rr, NetworkIn
         mDNSPlatformMemFree(rr->resrec.rdata);
     }
     SetNewRData(&rr->resrec, newrd, newrdlength);    // Update our rdata
+    rr->WireCache.valid = mDNSfalse;
 
     LogSPS("UpdateKeepaliveRData: successfully updated the record %s", ARDisplayString(m, rr));
     return mStatus_NoError;
@@ -7268,16 +8953,40 @@ mDNSexport mDNSs32 mDNSCoreIntervalToNextWake(mDNS *const m, mDNSs32 now, mDNSNe
 
 #define MustSendRecord(RR) ((RR)->NR_AnswerTo || (RR)->NR_AdditionalTo)
 
-mDNSlocal mDNSu8 *GenerateUnicastResponse(const DNSMessage *const query, const mDNSu8 *const end,
-                                          const mDNSInterfaceID InterfaceID, mDNSBool LegacyQuery, DNSMessage *const response, AuthRecord *ResponseRecords)
+// IPv6 header + UDP header + DNS message header, subtracted from the link MTU to get the space for the message body
+#define UnicastResponseOverhead (40 + 8 + 12)
+
+// EDNSPayload is the UDP payload size from the query's OPT record, or zero if the query had none. Without EDNS0 the
+// response is kept to the usual sizes (AllowedRRSpace). With it, answers and additionals both fill the space the
+// querier said it can take, up to what fits in one unfragmented packet on the interface (NormalMaxDNSMessageData if
+// the platform didn't give us an MTU), and an OPT is added to the reply. As with AllowedRRSpace, a first record too
+// big for one packet may still go out fragmented, so long as it fits in the querier's payload size.
+mDNSlocal mDNSu8 *GenerateUnicastResponse(mDNS *const m, const DNSMessage *const query, const mDNSu8 *const end,
+                                          const mDNSInterfaceID InterfaceID, mDNSBool LegacyQuery, mDNSu16 EDNSPayload,
+                                          DNSMessage *const response, AuthRecord *ResponseRecords)
 {
     mDNSu8          *responseptr     = response->data;
     const mDNSu8    *const limit     = response->data + sizeof(response->data);
+    const mDNSu8    *rrlimit         = mDNSNULL;   // Once the response has a record in it
+    const mDNSu8    *firstlimit      = mDNSNULL;   // For the first record
     const mDNSu8    *ptr             = query->data;
     AuthRecord  *rr;
     mDNSu32 maxttl = (!InterfaceID) ? mDNSMaximumUnicastTTLSeconds : mDNSMaximumMulticastTTLSeconds;
     int i;
 
+    if (EDNSPayload)
+    {
+        const NetworkInterfaceInfo *const intf = FirstInterfaceForID(m, InterfaceID);
+        mDNSu32 space = AbsoluteMaxDNSMessageData;
+        mDNSu32 linkspace = NormalMaxDNSMessageData;
+        if (EDNSPayload < 512) EDNSPayload = 512;   // RFC 6891 6.2.3: values below 512 are treated as 512
+        if (space > (mDNSu32)EDNSPayload - sizeof(DNSMessageHeader)) space = EDNSPayload - sizeof(DNSMessageHeader);
+        if (intf && intf->MTU > UnicastResponseOverhead + 512) linkspace = intf->MTU - UnicastResponseOverhead;
+        // Leave room for our own OPT record
+        firstlimit = response->data + space - DNSOpt_Header_Space;
+        rrlimit    = response->data + (linkspace < space ? linkspace : space) - DNSOpt_Header_Space;
+    }
+
     // Initialize the response fields so we can answer the questions
     InitializeDNSMessage(&response->h, query->h.id, ResponseFlags);
 
@@ -7313,9 +9022,12 @@ mDNSlocal mDNSu8 *GenerateUnicastResponse(const DNSMessage *const query, const m
     for (rr=ResponseRecords; rr; rr=rr->NextResponse)
         if (rr->NR_AnswerTo)
         {
-            mDNSu8 *p = PutResourceRecordTTL(response, responseptr, &response->h.numAnswers, &rr->resrec,
-                                             maxttl < rr->resrec.rroriginalttl ? maxttl : rr->resrec.rroriginalttl);
-            if (p) responseptr = p;
+            const mDNSu32 ttl = maxttl < rr->resrec.rroriginalttl ? maxttl : rr->resrec.rroriginalttl;
+            mDNSu8 *p = rrlimit ?
+                PutResourceRecordTTLWithCache(response, responseptr, &response->h.numAnswers, &rr->resrec, ttl,
+                                              response->h.numAnswers ? rrlimit : firstlimit, &rr->WireCache) :
+                PutAuthRecordTTL(response, responseptr, &response->h.numAnswers, rr, ttl);
+            if (p) { responseptr = p; rr->SentInResponses++; }
             else { debugf("GenerateUnicastResponse: Ran out of space for answers!"); response->h.flags.b[0] |= kDNSFlag0_TC; }
         }
 
@@ -7325,12 +9037,28 @@ mDNSlocal mDNSu8 *GenerateUnicastResponse(const DNSMessage *const query, const m
     for (rr=ResponseRecords; rr; rr=rr->NextResponse)
         if (rr->NR_AdditionalTo && !rr->NR_AnswerTo)
         {
-            mDNSu8 *p = PutResourceRecordTTL(response, responseptr, &response->h.numAdditionals, &rr->resrec,
-                                             maxttl < rr->resrec.rroriginalttl ? maxttl : rr->resrec.rroriginalttl);
-            if (p) responseptr = p;
+            const mDNSu32 ttl = maxttl < rr->resrec.rroriginalttl ? maxttl : rr->resrec.rroriginalttl;
+            mDNSu8 *p = rrlimit ?
+                PutResourceRecordTTLWithCache(response, responseptr, &response->h.numAdditionals, &rr->resrec, ttl,
+                                              (response->h.numAnswers || response->h.numAdditionals) ? rrlimit : firstlimit, &rr->WireCache) :
+                PutAuthRecordTTL(response, responseptr, &response->h.numAdditionals, rr, ttl);
+            if (p) { responseptr = p; rr->SentInResponses++; }
             else debugf("GenerateUnicastResponse: No more space for additionals");
         }
 
+    // ***
+    // *** 4. An EDNS0 query gets an OPT record back, advertising the payload size we can receive
+    // ***
+    if (rrlimit)
+    {
+        AuthRecord opt;
+        mDNSu8 *p;
+        mDNS_SetupResourceRecord(&opt, mDNSNULL, mDNSInterface_Any, kDNSType_OPT, 0, kDNSRecordTypeKnownUnique, AuthRecordAny, mDNSNULL, mDNSNULL);
+        opt.resrec.rrclass = sizeof(DNSMessageHeader) + AbsoluteMaxDNSMessageData;
+        p = PutResourceRecordTTLWithLimit(response, responseptr, &response->h.numAdditionals, &opt.resrec, 0, limit);
+        if (p) responseptr = p;
+    }
+
     return(responseptr);
 }
 
@@ -7389,7 +9117,7 @@ mDNSlocal mDNSBool PacketRecordMatches(const AuthRecord *const rr, const CacheRe
 mDNSlocal mDNSBool MatchDependentOn(const mDNS *const m, const CacheRecord *const pktrr, const AuthRecord *const master)
 {
     const AuthRecord *r1;
-    for (r1 = m->ResourceRecords; r1; r1=r1->next)
+    for (r1 = FirstRecordForNameHash(m, pktrr->resrec.namehash); r1; r1=r1->NextInNameHash)
     {
         if (PacketRecordMatches(r1, pktrr, master)) return(mDNStrue);
     }
@@ -7407,7 +9135,7 @@ mDNSlocal mDNSBool MatchDependentOn(const mDNS *const m, const CacheRecord *cons
 mDNSlocal const AuthRecord *FindRRSet(const mDNS *const m, const CacheRecord *const pktrr)
 {
     const AuthRecord *rr;
-    for (rr = m->ResourceRecords; rr; rr=rr->next)
+    for (rr = FirstRecordForNameHash(m, pktrr->resrec.namehash); rr; rr=rr->NextInNameHash)
     {
         if (IdenticalResourceRecord(&rr->resrec, &pktrr->resrec))
         {
@@ -7459,9 +9187,19 @@ mDNSlocal void ResolveSimultaneousProbe(mDNS *const m, const DNSMessage *const q
     int i;
     const mDNSu8 *ptr = LocateAuthorities(query, end);
     mDNSBool FoundUpdate = mDNSfalse;
+    domainname name;
 
     for (i = 0; i < query->h.numAuthorities; i++)
     {
+        // A probe for many names (a Sleep Proxy registration, say) carries the proposed records for all of them, and
+        // we're called for each of our probing records that it asks about, so records with some other name are
+        // passed over on their owner name alone instead of being unpacked again every time
+        if (!ptr || !getDomainName(query, ptr, end, &name)) break;
+        if (!SameDomainName(&name, &q->qname))
+        {
+            ptr = skipResourceRecord(query, ptr, end);
+            continue;
+        }
         ptr = GetLargeResourceRecord(m, query, ptr, end, q->InterfaceID, kDNSRecordTypePacketAuth, &m->rec);
         if (!ptr) break;
         if (m->rec.r.resrec.RecordType != kDNSRecordTypePacketNegative && CacheRecordAnswersQuestion(&m->rec.r, q))
@@ -7588,45 +9326,68 @@ mDNSlocal void ClearIdenticalProxyRecords(mDNS *const m, const OwnerOptData *con
     }
 }
 
+mDNSlocal void ClearProxyRecord(mDNS *const m, const OwnerOptData *const owner, AuthRecord *const rr)
+{
+    if (m->rec.r.resrec.InterfaceID == rr->resrec.InterfaceID && mDNSSameEthAddress(&owner->HMAC, &rr->WakeUp.HMAC))
+        if (owner->seq != rr->WakeUp.seq || m->timenow - rr->TimeRcvd > mDNSPlatformOneSecond * 60)
+        {
+            if (rr->AddressProxy.type == mDNSAddrType_IPv6)
+            {
+                // We don't do this here because we know that the host is waking up at this point, so we don't send
+                // Unsolicited Neighbor Advertisements -- even Neighbor Advertisements agreeing with what the host should be
+                // saying itself -- because it can cause some IPv6 stacks to falsely conclude that there's an address conflict.
+                #if MDNS_USE_Unsolicited_Neighbor_Advertisements
+                LogSPS("NDP Announcement -- Releasing traffic for H-MAC %.6a I-MAC %.6a %s",
+                       &rr->WakeUp.HMAC, &rr->WakeUp.IMAC, ARDisplayString(m,rr));
+                SendNDP(m, NDP_Adv, NDP_Override, rr, &rr->AddressProxy.ip.v6, &rr->WakeUp.IMAC, &AllHosts_v6, &AllHosts_v6_Eth);
+                #endif
+            }
+            LogSPS("ClearProxyRecords: Removing %3d AC %2d %02X H-MAC %.6a I-MAC %.6a %d %d %s",
+                   m->ProxyRecords, rr->AnnounceCount, rr->resrec.RecordType,
+                   &rr->WakeUp.HMAC, &rr->WakeUp.IMAC, rr->WakeUp.seq, owner->seq, ARDisplayString(m, rr));
+            if (rr->resrec.RecordType == kDNSRecordTypeDeregistering) rr->resrec.RecordType = kDNSRecordTypeShared;
+            rr->WakeUp.HMAC = zeroEthAddr;  // Clear HMAC so that mDNS_Deregister_internal doesn't waste packets trying to wake this host
+            rr->RequireGoodbye = mDNSfalse; // and we don't want to send goodbye for it, since real host is now back and functional
+            mDNS_Deregister_internal(m, rr, mDNS_Dereg_normal);
+            SetSPSProxyListChanged(m->rec.r.resrec.InterfaceID);
+        }
+}
+
 // Called from ProcessQuery when we get an mDNS packet with an owner record in it
-mDNSlocal void ClearProxyRecords(mDNS *const m, const OwnerOptData *const owner, AuthRecord *const thelist)
+mDNSlocal void ClearProxyRecords(mDNS *const m, const OwnerOptData *const owner)
 {
+    // Clear m->DuplicateRecords first, so that none of them take over from the m->ResourceRecords we remove
     if (m->CurrentRecord)
         LogMsg("ClearProxyRecords ERROR m->CurrentRecord already set %s", ARDisplayString(m, m->CurrentRecord));
-    m->CurrentRecord = thelist;
+    m->CurrentRecord = m->DuplicateRecords;
     while (m->CurrentRecord)
     {
         AuthRecord *const rr = m->CurrentRecord;
-        if (m->rec.r.resrec.InterfaceID == rr->resrec.InterfaceID && mDNSSameEthAddress(&owner->HMAC, &rr->WakeUp.HMAC))
-            if (owner->seq != rr->WakeUp.seq || m->timenow - rr->TimeRcvd > mDNSPlatformOneSecond * 60)
-            {
-                if (rr->AddressProxy.type == mDNSAddrType_IPv6)
-                {
-                    // We don't do this here because we know that the host is waking up at this point, so we don't send
-                    // Unsolicited Neighbor Advertisements -- even Neighbor Advertisements agreeing with what the host should be
-                    // saying itself -- because it can cause some IPv6 stacks to falsely conclude that there's an address conflict.
-                    #if MDNS_USE_Unsolicited_Neighbor_Advertisements
-                    LogSPS("NDP Announcement -- Releasing traffic for H-MAC %.6a I-MAC %.6a %s",
-                           &rr->WakeUp.HMAC, &rr->WakeUp.IMAC, ARDisplayString(m,rr));
-                    SendNDP(m, NDP_Adv, NDP_Override, rr, &rr->AddressProxy.ip.v6, &rr->WakeUp.IMAC, &AllHosts_v6, &AllHosts_v6_Eth);
-                    #endif
-                }
-                LogSPS("ClearProxyRecords: Removing %3d AC %2d %02X H-MAC %.6a I-MAC %.6a %d %d %s",
-                       m->ProxyRecords, rr->AnnounceCount, rr->resrec.RecordType,
-                       &rr->WakeUp.HMAC, &rr->WakeUp.IMAC, rr->WakeUp.seq, owner->seq, ARDisplayString(m, rr));
-                if (rr->resrec.RecordType == kDNSRecordTypeDeregistering) rr->resrec.RecordType = kDNSRecordTypeShared;
-                rr->WakeUp.HMAC = zeroEthAddr;  // Clear HMAC so that mDNS_Deregister_internal doesn't waste packets trying to wake this host
-                rr->RequireGoodbye = mDNSfalse; // and we don't want to send goodbye for it, since real host is now back and functional
-                mDNS_Deregister_internal(m, rr, mDNS_Dereg_normal);
-                SetSPSProxyListChanged(m->rec.r.resrec.InterfaceID);
-            }
+        ClearProxyRecord(m, owner, rr);
         // Mustn't advance m->CurrentRecord until *after* mDNS_Deregister_internal, because
         // new records could have been added to the end of the list as a result of that call.
         if (m->CurrentRecord == rr) // If m->CurrentRecord was not advanced for us, do it now
             m->CurrentRecord = rr->next;
     }
+
+    // Most mDNS packets from hosts that use a Sleep Proxy carry an owner option, so this is called a lot.
+    // Only walk the records with this owner, which for a host we're not holding anything for is none of them.
+    if (m->NextOwnerRecord)
+        LogMsg("ClearProxyRecords ERROR m->NextOwnerRecord already set %s", ARDisplayString(m, m->NextOwnerRecord));
+    m->NextOwnerRecord = FirstRecordForOwner(m, &owner->HMAC);
+    while (m->NextOwnerRecord)
+    {
+        AuthRecord *const rr = m->NextOwnerRecord;
+        m->NextOwnerRecord = rr->NextInOwnerHash;
+        ClearProxyRecord(m, owner, rr);
+    }
 }
 
+// A known answer can only suppress records with the same name, type and rdata, so ProcessQuery hashes its candidates
+// on those, and each known answer in a busy query (a browse can carry hundreds) only compares against its own slot.
+#define KnownAnswerHashSlots 64
+#define KnownAnswerHashSlot(RR) (((RR)->namehash + (RR)->rrtype + (RR)->rdatahash) % KnownAnswerHashSlots)
+
 // ProcessQuery examines a received query to see if we have any answers to give
 mDNSlocal mDNSu8 *ProcessQuery(mDNS *const m, const DNSMessage *const query, const mDNSu8 *const end,
                                const mDNSAddr *srcaddr, const mDNSInterfaceID InterfaceID, mDNSBool LegacyQuery, mDNSBool QueryWasMulticast,
@@ -7649,6 +9410,11 @@ mDNSlocal mDNSu8 *ProcessQuery(mDNS *const m, const DNSMessage *const query, con
     const mDNSu8 *ptr;
     mDNSu8       *responseptr        = mDNSNULL;
     AuthRecord   *rr;
+    AuthRecord   *ResponseHash[KnownAnswerHashSlots];   // ResponseRecords, by KnownAnswerHashSlot
+    AuthRecord   *ScheduledHash[KnownAnswerHashSlots];  // Records already due out on InterfaceID, named like ScheduledName
+    mDNSBool ScheduledHashValid = mDNSfalse;
+    mDNSu16 EDNSPayload = 0;
+    mDNSu32 ScheduledName = 0;
     int i;
 
     // ***
@@ -7667,8 +9433,7 @@ mDNSlocal mDNSu8 *ProcessQuery(mDNS *const m, const DNSMessage *const query, con
             for (opt = &m->rec.r.resrec.rdata->u.opt[0]; opt < e; opt++)
                 if (opt->opt == kDNSOpt_Owner && opt->u.owner.vers == 0 && opt->u.owner.HMAC.l[0])
                 {
-                    ClearProxyRecords(m, &opt->u.owner, m->DuplicateRecords);
-                    ClearProxyRecords(m, &opt->u.owner, m->ResourceRecords);
+                    ClearProxyRecords(m, &opt->u.owner);
                 }
         }
         m->rec.r.resrec.RecordType = 0;     // Clear RecordType to show we're not still using it
@@ -7706,18 +9471,19 @@ mDNSlocal mDNSu8 *ProcessQuery(mDNS *const m, const DNSMessage *const query, con
         // Clear the UnicastResponse flag -- don't want to confuse the rest of the code that follows later
         pktq.qclass &= ~kDNSQClass_UnicastResponse;
 
-        // Note: We use the m->CurrentRecord mechanism here because calling ResolveSimultaneousProbe
+        // Note: We use the m->NextHashedRecord mechanism here because calling ResolveSimultaneousProbe
         // can result in user callbacks which may change the record list and/or question list.
+        // Only the records chained under this question's name hash can answer it, so that's all we walk.
         // Also note: we just mark potential answer records here, without trying to build the
         // "ResponseRecords" list, because we don't want to risk user callbacks deleting records
         // from that list while we're in the middle of trying to build it.
-        if (m->CurrentRecord)
-            LogMsg("ProcessQuery ERROR m->CurrentRecord already set %s", ARDisplayString(m, m->CurrentRecord));
-        m->CurrentRecord = m->ResourceRecords;
-        while (m->CurrentRecord)
+        if (m->NextHashedRecord)
+            LogMsg("ProcessQuery ERROR m->NextHashedRecord already set %s", ARDisplayString(m, m->NextHashedRecord));
+        m->NextHashedRecord = FirstRecordForNameHash(m, pktq.qnamehash);
+        while (m->NextHashedRecord)
         {
-            rr = m->CurrentRecord;
-            m->CurrentRecord = rr->next;
+            rr = m->NextHashedRecord;
+            m->NextHashedRecord = rr->NextInNameHash;
             if (AnyTypeRecordAnswersQuestion(rr, &pktq) && (QueryWasMulticast || QueryWasLocalUnicast || rr->AllowRemoteQuery))
             {
                 m->mDNSStats.MatchingAnswersForQueries++;
@@ -7828,9 +9594,17 @@ mDNSlocal mDNSu8 *ProcessQuery(mDNS *const m, const DNSMessage *const query, con
     // ***
     // *** 3. Now we can safely build the list of marked answers
     // ***
-    for (rr = m->ResourceRecords; rr; rr=rr->next)              // Now build our list of potential answers
-        if (rr->NR_AnswerTo)                                    // If we marked the record...
-            AddRecordToResponseList(&nrp, rr, mDNSNULL);        // ... add it to the list
+    // Any record we marked is chained under the name hash of one of the questions, so parse the questions again
+    ptr = query->data;
+    for (i=0; i<query->h.numQuestions; i++)
+    {
+        DNSQuestion pktq;
+        ptr = getQuestion(query, ptr, end, InterfaceID, &pktq);
+        if (!ptr) goto exit;
+        for (rr = FirstRecordForNameHash(m, pktq.qnamehash); rr; rr=rr->NextInNameHash) // Now build our list of potential answers
+            if (rr->NR_AnswerTo)                                                       // If we marked the record...
+                AddRecordToResponseList(&nrp, rr, mDNSNULL);                           // ... add it to the list
+    }
 
     // ***
     // *** 4. Add additional records
@@ -7840,6 +9614,16 @@ mDNSlocal mDNSu8 *ProcessQuery(mDNS *const m, const DNSMessage *const query, con
     // ***
     // *** 5. Parse Answer Section and cancel any records disallowed by Known-Answer list
     // ***
+    if (query->h.numAnswers)
+    {
+        mDNSPlatformMemZero(ResponseHash, sizeof(ResponseHash));
+        for (rr=ResponseRecords; rr; rr=rr->NextResponse)
+        {
+            AuthRecord **const slot = &ResponseHash[KnownAnswerHashSlot(&rr->resrec)];
+            rr->NextInResponseHash = *slot;
+            *slot = rr;
+        }
+    }
     for (i=0; i<query->h.numAnswers; i++)                       // For each record in the query's answer section...
     {
         // Get the record...
@@ -7849,7 +9633,7 @@ mDNSlocal mDNSu8 *ProcessQuery(mDNS *const m, const DNSMessage *const query, con
         if (m->rec.r.resrec.RecordType != kDNSRecordTypePacketNegative)
         {
             // See if this Known-Answer suppresses any of our currently planned answers
-            for (rr=ResponseRecords; rr; rr=rr->NextResponse)
+            for (rr=ResponseHash[KnownAnswerHashSlot(&m->rec.r.resrec)]; rr; rr=rr->NextInResponseHash)
             {
                 if (MustSendRecord(rr) && ShouldSuppressKnownAnswer(&m->rec.r, rr))
                 {
@@ -7859,8 +9643,24 @@ mDNSlocal mDNSu8 *ProcessQuery(mDNS *const m, const DNSMessage *const query, con
                 }
             }
 
-            // See if this Known-Answer suppresses any previously scheduled answers (for multi-packet KA suppression)
-            for (rr=m->ResourceRecords; rr; rr=rr->next)
+            // See if this Known-Answer suppresses any previously scheduled answers (for multi-packet KA suppression).
+            // The known answers in a packet mostly share one name, so the scheduled records with that name are hashed
+            // the first time it comes up, and again only when a known answer with a different name comes along.
+            // Nothing here schedules a record, so a record can only drop out of the hash, and the check below catches that.
+            if (!ScheduledHashValid || ScheduledName != m->rec.r.resrec.namehash)
+            {
+                ScheduledHashValid = mDNStrue;
+                ScheduledName      = m->rec.r.resrec.namehash;
+                mDNSPlatformMemZero(ScheduledHash, sizeof(ScheduledHash));
+                for (rr=FirstRecordForNameHash(m, ScheduledName); rr; rr=rr->NextInNameHash)
+                    if (rr->ImmedAnswer == InterfaceID && rr->resrec.namehash == ScheduledName)
+                    {
+                        AuthRecord **const slot = &ScheduledHash[KnownAnswerHashSlot(&rr->resrec)];
+                        rr->NextInScheduledHash = *slot;
+                        *slot = rr;
+                    }
+            }
+            for (rr=ScheduledHash[KnownAnswerHashSlot(&m->rec.r.resrec)]; rr; rr=rr->NextInScheduledHash)
             {
                 // If we're planning to send this answer on this interface, and only on this interface, then allow KA suppression
                 if (rr->ImmedAnswer == InterfaceID && ShouldSuppressKnownAnswer(&m->rec.r, rr))
@@ -8045,7 +9845,12 @@ mDNSlocal mDNSu8 *ProcessQuery(mDNS *const m, const DNSMessage *const query, con
     // *** 9. If query is from a legacy client, or from a new client requesting a unicast reply, then generate a unicast response too
     // ***
     if (SendLegacyResponse)
-        responseptr = GenerateUnicastResponse(query, end, InterfaceID, LegacyQuery, response, ResponseRecords);
+    {
+        // The OPT record's rrclass is the querier's UDP payload size (RFC 6891). Read it off the wire so m->rec stays free.
+        ptr = LocateOptRR(query, end, 0);
+        if (ptr) EDNSPayload = (mDNSu16)((mDNSu16)ptr[3] << 8 | ptr[4]);
+        responseptr = GenerateUnicastResponse(m, query, end, InterfaceID, LegacyQuery, EDNSPayload, response, ResponseRecords);
+    }
 
 exit:
     m->rec.r.resrec.RecordType = 0;     // Clear RecordType to show we're not still using it
@@ -8172,7 +9977,7 @@ mDNSlocal DNSQuestion *ExpectingUnicastResponseForQuestion(const mDNS *const m,
     const mDNSOpaque16 id, const DNSQuestion *const question, mDNSBool tcp)
 {
     DNSQuestion *q;
-    for (q = m->Questions; q; q=q->next)
+    for (q = FirstQuestionForNameHash(m, question->qnamehash); q; q = q->NextInQHash)
     {
         if (!tcp && !q->LocalSocket) continue;
         if (mDNSSameIPPort(tcp ? q->tcpSrcPort : q->LocalSocket->port, port)       &&
@@ -8199,7 +10004,7 @@ mDNSlocal DNSQuestion *ExpectingUnicastResponseForRecord(mDNS *const m,
     DNSQuestion *q;
     (void)id;
 
-    for (q = m->Questions; q; q=q->next)
+    for (q = FirstQuestionForNameHash(m, rr->resrec.namehash); q; q = q->NextInQHash)
     {
         if (!q->DuplicateOf && ResourceRecordAnswersUnicastResponse(&rr->resrec, q))
         {
@@ -8256,14 +10061,15 @@ mDNSexport CacheRecord *CreateNewCacheEntry(mDNS *const m, const mDNSu32 slot, C
 {
     CacheRecord *rr = mDNSNULL;
     mDNSu16 RDLength = GetRDLengthMem(&m->rec.r.resrec);
+    const mDNSu8 partition = CachePartitionOverQuota(m, m->rec.r.resrec.InterfaceID);
 
     if (!m->rec.r.resrec.InterfaceID) debugf("CreateNewCacheEntry %s", CRDisplayString(m, &m->rec.r));
 
     //if (RDLength > InlineCacheRDSize)
     //  LogInfo("Rdata len %4d > InlineCacheRDSize %d %s", RDLength, InlineCacheRDSize, CRDisplayString(m, &m->rec.r));
 
-    if (!cg) cg = GetCacheGroup(m, slot, &m->rec.r.resrec); // If we don't have a CacheGroup for this name, make one now
-    if (cg) rr = GetCacheRecord(m, cg, RDLength);   // Make a cache record, being careful not to recycle cg
+    if (!cg) cg = GetCacheGroup(m, slot, &m->rec.r.resrec, partition); // If we don't have a CacheGroup for this name, make one now
+    if (cg) rr = GetCacheRecord(m, cg, RDLength, partition);   // Make a cache record, being careful not to recycle cg
     if (!rr) NoCacheAnswer(m, &m->rec.r);
     else
     {
@@ -8299,6 +10105,7 @@ mDNSexport CacheRecord *CreateNewCacheEntry(mDNS *const m, const mDNSu32 slot, C
         {
             m->rrcache_totalused_unicast += rr->resrec.rdlength;
         }
+        CountCacheRecordInPartition(m, rr);
 
 #if MDNSRESPONDER_SUPPORTS(APPLE, DNSSECv2)
         if (rr != mDNSNULL)
@@ -8307,17 +10114,21 @@ mDNSexport CacheRecord *CreateNewCacheEntry(mDNS *const m, const mDNSu32 slot, C
         }
 #endif // MDNSRESPONDER_SUPPORTS(APPLE, DNSSECv2)
 
+        rr->LRUPrev = rr->LRUNext = mDNSNULL;   // Not inherited from m->rec, which is never in the LRU list
+
         if (Add)
         {
+            mDNS_TRACE4(cache__add, rr->resrec.namehash, rr->resrec.rrtype, rr->resrec.InterfaceID, rr->resrec.rdlength);
             *(cg->rrcache_tail) = rr;               // Append this record to tail of cache slot list
             cg->rrcache_tail = &(rr->next);         // Advance tail pointer
+            AddCacheRecordToLRU(m, rr);             // Unreferenced until CacheRecordAdd finds a question for it
             CacheRecordAdd(m, rr);  // CacheRecordAdd calls SetNextCacheCheckTimeForRecord(m, rr); for us
         }
         else
         {
             // Can't use the "cg->name" if we are not adding to the cache as the
             // CacheGroup may be released anytime if it is empty
-            domainname *name = (domainname *) mDNSPlatformMemAllocate(DomainNameLength(cg->name));
+            domainname *name = (domainname *) MemSlabAllocate(m, DomainNameLength(cg->name));
             if (name)
             {
                 AssignDomainName(name, cg->name);
@@ -8359,6 +10170,7 @@ mDNSlocal void RefreshCacheRecord(mDNS *const m, CacheRecord *rr, mDNSu32 ttl)
     rr->resrec.rroriginalttl = ttl;
     rr->UnansweredQueries = 0;
     if (rr->resrec.mortality != Mortality_Mortal) rr->resrec.mortality = Mortality_Immortal;
+    if (CacheRecordInLRU(m, rr)) AddCacheRecordToLRU(m, rr);
     SetNextCacheCheckTimeForRecord(m, rr);
 }
 
@@ -8435,8 +10247,9 @@ mDNSlocal mDNSBool IsResponseAcceptable(mDNS *const m, const CacheRecord *crlist
     return mDNSfalse;
 }
 
+// authorities, if known, is where the response's authority section starts, saving another walk over its answers
 mDNSlocal void mDNSCoreReceiveNoUnicastAnswers(mDNS *const m, const DNSMessage *const response, const mDNSu8 *end,
-    const mDNSAddr *dstaddr, const mDNSIPPort dstport, const mDNSInterfaceID InterfaceID,
+    const mDNSu8 *const authorities, const mDNSAddr *dstaddr, const mDNSIPPort dstport, const mDNSInterfaceID InterfaceID,
 #if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
     const mdns_querier_t querier, const mdns_dns_service_t uDNSService,
 #endif
@@ -8565,7 +10378,7 @@ mDNSlocal void mDNSCoreReceiveNoUnicastAnswers(mDNS *const m, const DNSMessage *
                     if (q.qtype == kDNSType_SOA && SameDomainName(&q.qname, &localdomain)) negttl = 60 * 60 * 24;
 
                     // If we're going to make (or update) a negative entry, then look for the appropriate TTL from the SOA record
-                    if (response->h.numAuthorities && (ptr = LocateAuthorities(response, end)) != mDNSNULL)
+                    if (response->h.numAuthorities && (ptr = authorities ? authorities : LocateAuthorities(response, end)) != mDNSNULL)
                     {
                         ptr = GetLargeResourceRecord(m, response, ptr, end, InterfaceID, kDNSRecordTypePacketAuth, &m->rec);
                         if (ptr && m->rec.r.resrec.RecordType != kDNSRecordTypePacketNegative && m->rec.r.resrec.rrtype == kDNSType_SOA)
@@ -8582,7 +10395,7 @@ mDNSlocal void mDNSCoreReceiveNoUnicastAnswers(mDNS *const m, const DNSMessage *
 
                             // Create the SOA record as we may have to return this to the questions
                             // that we are acting as a proxy for currently or in the future.
-                            SOARecord = CreateNewCacheEntry(m, HashSlotFromNameHash(m->rec.r.resrec.namehash), cgSOA, 1, mDNSfalse, mDNSNULL);
+                            SOARecord = CreateNewCacheEntry(m, HashSlotFromNameHash(m, m->rec.r.resrec.namehash), cgSOA, 1, mDNSfalse, mDNSNULL);
 
                             // Special check for SOA queries: If we queried for a.b.c.d.com, and got no answer,
                             // with an Authority Section SOA record for d.com, then this is a hint that the authority
@@ -8646,9 +10459,7 @@ mDNSlocal void mDNSCoreReceiveNoUnicastAnswers(mDNS *const m, const DNSMessage *
                         }
                         if (SOARecord)
                         {
-                            if (neg->soa)
-                                ReleaseCacheRecord(m, neg->soa);
-                            neg->soa = SOARecord;
+                            SetNegativeCacheRecordSOA(m, neg, SOARecord);
                             SOARecord = mDNSNULL;
                         }
                     }
@@ -8669,7 +10480,7 @@ mDNSlocal void mDNSCoreReceiveNoUnicastAnswers(mDNS *const m, const DNSMessage *
                             // look up the cache group again to re-initialize cg again.
                             cg = CacheGroupForName(m, hash, name);
                             // Need to add with a delay so that we can tag the SOA record
-                            negcr = CreateNewCacheEntry(m, HashSlotFromNameHash(hash), cg, 1, mDNStrue, mDNSNULL);
+                            negcr = CreateNewCacheEntry(m, HashSlotFromNameHash(m, hash), cg, 1, mDNStrue, mDNSNULL);
 
                             if (negcr)
                             {
@@ -8685,9 +10496,7 @@ mDNSlocal void mDNSCoreReceiveNoUnicastAnswers(mDNS *const m, const DNSMessage *
 
                                 if (SOARecord)
                                 {
-                                    if (negcr->soa)
-                                        ReleaseCacheRecord(m, negcr->soa);
-                                    negcr->soa = SOARecord;
+                                    SetNegativeCacheRecordSOA(m, negcr, SOARecord);
                                     SOARecord = mDNSNULL;
                                 }
                                 CacheRecordDeferredAdd(m, negcr);
@@ -8762,7 +10571,14 @@ mDNSexport CacheRecord* mDNSCoreReceiveCacheCheck(mDNS *const m, const DNSMessag
         // If we found this exact resource record, refresh its TTL
         if (match)
         {
-            if (IdenticalSameNameRecord(&m->rec.r.resrec, &cr->resrec))
+            // Nearly every record we get here is a refresh of one we already hold with exactly the same rdata, so
+            // the case-sensitive comparison is done first; only if that fails do we need the case-insensitive one to
+            // tell a capitalization change from a different record
+            const ResourceRecord *const pktrr = &m->rec.r.resrec;
+            const mDNSBool exact = pktrr->rrtype == cr->resrec.rrtype && pktrr->rrclass == cr->resrec.rrclass &&
+                pktrr->rdlength == cr->resrec.rdlength && pktrr->rdatahash == cr->resrec.rdatahash &&
+                SameRDataBody(pktrr, &cr->resrec.rdata->u, SameDomainNameCS);
+            if (exact || IdenticalSameNameRecord(pktrr, &cr->resrec))
             {
                 if (m->rec.r.resrec.rdlength > InlineCacheRDSize)
                     verbosedebugf("mDNSCoreReceiveCacheCheck: Found record size %5d interface %p already in cache: %s",
@@ -8783,7 +10599,7 @@ mDNSexport CacheRecord* mDNSCoreReceiveCacheCheck(mDNS *const m, const DNSMessag
                     if (!(cr->resrec.RecordType & kDNSRecordTypePacketUniqueMask))
                     {
                         DNSQuestion *q;
-                        for (q = m->Questions; q; q=q->next)
+                        for (q = FirstQuestionForNameHash(m, cr->resrec.namehash); q; q = q->NextInQHash)
                         {
                             if (CacheRecordAnswersQuestion(cr, q))
                                 q->UniqueAnswers++;
@@ -8792,7 +10608,7 @@ mDNSexport CacheRecord* mDNSCoreReceiveCacheCheck(mDNS *const m, const DNSMessag
                     }
                 }
 
-                if (!SameRDataBody(&m->rec.r.resrec, &cr->resrec.rdata->u, SameDomainNameCS))
+                if (!exact)
                 {
                     // If the rdata of the packet record differs in name capitalization from the record in our cache
                     // then mDNSPlatformMemSame will detect this. In this case, throw the old record away, so that clients get
@@ -8805,7 +10621,7 @@ mDNSexport CacheRecord* mDNSCoreReceiveCacheCheck(mDNS *const m, const DNSMessag
                     LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO, "mDNSCoreReceiveCacheCheck: Discarding due to domainname case change old: " PRI_S, CRDisplayString(m, cr));
                     LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO, "mDNSCoreReceiveCacheCheck: Discarding due to domainname case change new: " PRI_S, CRDisplayString(m, &m->rec.r));
                     LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO, "mDNSCoreReceiveCacheCheck: Discarding due to domainname case change in %d slot %3d in %d %d",
-                              NextCacheCheckEvent(cr) - m->timenow, slot, m->rrcache_nextcheck[slot] - m->timenow, m->NextCacheCheck - m->timenow);
+                              NextCacheCheckEvent(cr) - m->timenow, slot, cg->nextcheck - m->timenow, m->NextCacheCheck - m->timenow);
                     // DO NOT break out here -- we want to continue as if we never found it
                 }
                 else if (m->rec.r.resrec.rroriginalttl > 0)
@@ -8848,7 +10664,7 @@ mDNSexport CacheRecord* mDNSCoreReceiveCacheCheck(mDNS *const m, const DNSMessag
                     // true for records like A etc. but not for PTR.
                     if (cr->resrec.RecordType & kDNSRecordTypePacketUniqueMask)
                     {
-                        for (q = m->Questions; q; q=q->next)
+                        for (q = FirstQuestionForNameHash(m, cr->resrec.namehash); q; q = q->NextInQHash)
                         {
                             if (!q->DuplicateOf && !q->LongLived &&
                                 ActiveQuestion(q) && CacheRecordAnswersQuestion(cr, q))
@@ -8909,6 +10725,37 @@ mDNSlocal void mDNSCoreResetRecord(mDNS *const m)
 // InterfaceID non-NULL tells us the interface this multicast response was received on
 // InterfaceID NULL tells us this was a unicast response
 // dstaddr NULL tells us we received this over an outgoing TCP connection we made
+// On a busy network most multicast responses answer other hosts' questions, about names we have no interest in. With
+// m->ResponseFilter set, a response none of whose records is named like one of our active questions or our own records
+// is dropped after a quick walk over the record names, without parsing any rdata or touching the cache. Records in the
+// same response as one of interest, like the SRV, TXT and addresses that come with a PTR, are all kept. The question
+// and record name hashes already give us membership tests as cheap as a Bloom filter's, with nothing extra to maintain.
+// A response that's malformed is left for mDNSCoreReceiveResponse to deal with.
+mDNSlocal mDNSBool ResponseIsOfInterest(const mDNS *const m, const DNSMessage *const response, const mDNSu8 *const end,
+    const int records)
+{
+    const mDNSu8 *ptr = LocateAnswers(response, end);
+    int i;
+
+    for (i = 0; i < records; i++)
+    {
+        domainname name;
+        mDNSu32 namehash;
+        const DNSQuestion *q;
+        const AuthRecord *rr;
+
+        if (ptr) ptr = getDomainName(response, ptr, end, &name);
+        if (!ptr || end - ptr < 10 || end - ptr - 10 < ((ptr[8] << 8) | ptr[9])) return(mDNStrue);
+        namehash = DomainNameHashValue(&name);
+        for (q = FirstQuestionForNameHash(m, namehash); q; q = q->NextInQHash)
+            if (q->qnamehash == namehash) return(mDNStrue);
+        for (rr = FirstRecordForNameHash(m, namehash); rr; rr = rr->NextInNameHash)
+            if (rr->resrec.namehash == namehash) return(mDNStrue);
+        ptr += 10 + ((ptr[8] << 8) | ptr[9]);   // Type, class, TTL, rdlength and rdata
+    }
+    return(mDNSfalse);
+}
+
 mDNSlocal void mDNSCoreReceiveResponse(mDNS *const m, const DNSMessage *const response, const mDNSu8 *end,
     const mDNSAddr *srcaddr, const mDNSIPPort srcport, const mDNSAddr *dstaddr, mDNSIPPort dstport,
 #if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
@@ -8937,6 +10784,7 @@ mDNSlocal void mDNSCoreReceiveResponse(mDNS *const m, const DNSMessage *const re
     int firstadditional = firstauthority  + response->h.numAuthorities;
     int totalrecords    = firstadditional + response->h.numAdditionals;
     const mDNSu8 *ptr   = response->data;
+    const mDNSu8 *authorities = mDNSNULL;  // Where the authority section starts, once we get there
 #if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
     DNSServer *uDNSServer = mDNSNULL;
 #endif
@@ -8963,6 +10811,27 @@ mDNSlocal void mDNSCoreReceiveResponse(mDNS *const m, const DNSMessage *const re
            response->h.numAuthorities, response->h.numAuthorities == 1 ? "y,  " : "ies,",
            response->h.numAdditionals, response->h.numAdditionals == 1 ? " "    : "s", end - response->data, LLQType);
 
+    if (m->ResponseFilter && ResponseIsMDNS && InterfaceID && LLQType == uDNS_LLQ_Not)
+    {
+        if (ResponseIsOfInterest(m, response, end, totalrecords))
+            m->ResponseFilterAccepted += (mDNSu32)totalrecords;
+        else
+        {
+            if (m->timenow - m->PassiveCacheWindow >= mDNSPlatformOneSecond)
+            {
+                m->PassiveCacheWindow = m->timenow;
+                m->PassiveCacheUsed   = 0;
+            }
+            if (m->PassiveCacheUsed + (mDNSu32)totalrecords > m->PassiveCacheBudget)
+            {
+                m->ResponseFilterRejected += (mDNSu32)totalrecords;
+                return;
+            }
+            m->PassiveCacheUsed      += (mDNSu32)totalrecords;
+            m->ResponseFilterPassive += (mDNSu32)totalrecords;
+        }
+    }
+
 #if MDNSRESPONDER_SUPPORTS(APPLE, METRICS) && !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
     if (mDNSSameIPPort(srcport, UnicastDNSPort))
     {
@@ -9060,6 +10929,14 @@ mDNSlocal void mDNSCoreReceiveResponse(mDNS *const m, const DNSMessage *const re
             {
                 continue;
             }
+#if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+            // Time the reply, and drop it if it comes from the loser of a race that's already been decided
+            if (dstaddr && !uDNS_NoteServerResponse(m, qptr, srcaddr, srcport))
+            {
+                returnEarly = mDNStrue;
+                continue;
+            }
+#endif
             if (!failure)
             {
                 CacheRecord *cr;
@@ -9130,6 +11007,7 @@ mDNSlocal void mDNSCoreReceiveResponse(mDNS *const m, const DNSMessage *const re
         const mDNSu8 RecordType =
             (i < firstauthority ) ? (mDNSu8)kDNSRecordTypePacketAns  :
             (i < firstadditional) ? (mDNSu8)kDNSRecordTypePacketAuth : (mDNSu8)kDNSRecordTypePacketAdd;
+        if (i == firstauthority) authorities = ptr;
         ptr = GetLargeResourceRecord(m, response, ptr, end, InterfaceID, RecordType, &m->rec);
         if (!ptr) goto exit;        // Break out of the loop and clean up our CacheFlushRecords list before exiting
 
@@ -9154,8 +11032,7 @@ mDNSlocal void mDNSCoreReceiveResponse(mDNS *const m, const DNSMessage *const re
             for (opt = &m->rec.r.resrec.rdata->u.opt[0]; opt < e; opt++)
                 if (opt->opt == kDNSOpt_Owner && opt->u.owner.vers == 0 && opt->u.owner.HMAC.l[0])
                 {
-                    ClearProxyRecords(m, &opt->u.owner, m->DuplicateRecords);
-                    ClearProxyRecords(m, &opt->u.owner, m->ResourceRecords);
+                    ClearProxyRecords(m, &opt->u.owner);
                 }
             mDNSCoreResetRecord(m);
             continue;
@@ -9308,13 +11185,14 @@ mDNSlocal void mDNSCoreReceiveResponse(mDNS *const m, const DNSMessage *const re
         // 1. Check that this packet resource record does not conflict with any of ours
         if (ResponseIsMDNS && m->rec.r.resrec.rrtype != kDNSType_NSEC)
         {
-            if (m->CurrentRecord)
-                LogMsg("mDNSCoreReceiveResponse ERROR m->CurrentRecord already set %s", ARDisplayString(m, m->CurrentRecord));
-            m->CurrentRecord = m->ResourceRecords;
-            while (m->CurrentRecord)
+            // Only our records chained under this record's name hash can match its signature
+            if (m->NextHashedRecord)
+                LogMsg("mDNSCoreReceiveResponse ERROR m->NextHashedRecord already set %s", ARDisplayString(m, m->NextHashedRecord));
+            m->NextHashedRecord = FirstRecordForNameHash(m, m->rec.r.resrec.namehash);
+            while (m->NextHashedRecord)
             {
-                AuthRecord *rr = m->CurrentRecord;
-                m->CurrentRecord = rr->next;
+                AuthRecord *rr = m->NextHashedRecord;
+                m->NextHashedRecord = rr->NextInNameHash;
                 // We accept all multicast responses, and unicast responses resulting from queries we issued
                 // For other unicast responses, this code accepts them only for responses with an
                 // (apparently) local source address that pertain to a record of our own that's in probing state
@@ -9480,7 +11358,7 @@ mDNSlocal void mDNSCoreReceiveResponse(mDNS *const m, const DNSMessage *const re
 
         if (m->rrcache_size && AcceptableResponse)
         {
-            const mDNSu32 slot = HashSlotFromNameHash(m->rec.r.resrec.namehash);
+            const mDNSu32 slot = HashSlotFromNameHash(m, m->rec.r.resrec.namehash);
             CacheGroup *cg = CacheGroupForRecord(m, &m->rec.r.resrec);
             CacheRecord *rr = mDNSNULL;
 
@@ -9520,7 +11398,7 @@ mDNSlocal void mDNSCoreReceiveResponse(mDNS *const m, const DNSMessage *const re
                     }
                     else if (rr->DelayDelivery)
                     {
-                        ScheduleNextCacheCheckTime(m, slot, rr->DelayDelivery);
+                        ScheduleNextCacheCheckTime(m, rr, rr->DelayDelivery);
                     }
                 }
             }
@@ -9536,7 +11414,6 @@ exit:
     while (CacheFlushRecords != (CacheRecord*)1)
     {
         CacheRecord *r1 = CacheFlushRecords, *r2;
-        const mDNSu32 slot = HashSlotFromNameHash(r1->resrec.namehash);
         const CacheGroup *cg = CacheGroupForRecord(m, &r1->resrec);
         mDNSBool purgedRecords = mDNSfalse;
         CacheFlushRecords = CacheFlushRecords->NextInCFList;
@@ -9680,7 +11557,7 @@ exit:
                     if (r2->resrec.mortality == Mortality_Ghost)
                     {
                         DNSQuestion * q;
-                        for (q = m->Questions; q; q=q->next)
+                        for (q = FirstQuestionForNameHash(m, r2->resrec.namehash); q; q = q->NextInQHash)
                         {
                             if (!q->LongLived && ActiveQuestion(q) &&
                                 CacheRecordAnswersQuestion(r2, q) &&
@@ -9712,12 +11589,12 @@ exit:
             }
             // If no longer delaying, deliver answer now, else schedule delivery for the appropriate time
             if (!r1->DelayDelivery) CacheRecordDeferredAdd(m, r1);
-            else ScheduleNextCacheCheckTime(m, slot, r1->DelayDelivery);
+            else ScheduleNextCacheCheckTime(m, r1, r1->DelayDelivery);
         }
     }
 
     // See if we need to generate negative cache entries for unanswered unicast questions
-    mDNSCoreReceiveNoUnicastAnswers(m, response, end, dstaddr, dstport, InterfaceID,
+    mDNSCoreReceiveNoUnicastAnswers(m, response, end, authorities, dstaddr, dstport, InterfaceID,
 #if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
         querier, uDNSService,
 #endif
@@ -10126,7 +12003,8 @@ mDNSlocal AuthRecord* mDNS_MatchKeepaliveInfo(mDNS *const m, const mDNSAddr* pla
     mDNSu32 timeout, seq, ack;
     mDNSu16 win;
 
-    for (ar = m->ResourceRecords; ar; ar=ar->next)
+    // Only the records hashed for this connection can match
+    for (ar = m->SPSKeepaliveHash[SPSKeepaliveHashSlot(pladdr, praddr, plport, prport)]; ar; ar=ar->NextInKeepaliveHash)
     {
         timeout = seq = ack = 0;
         win = 0;
@@ -10159,45 +12037,50 @@ mDNSlocal AuthRecord* mDNS_MatchKeepaliveInfo(mDNS *const m, const mDNSAddr* pla
     return mDNSNULL;
 }
 
+#define KeepaliveBatchSize 32
+
 mDNSlocal void mDNS_SendKeepalives(mDNS *const m)
 {
-    AuthRecord *ar;
+    mDNSKeepalivePacket batch[KeepaliveBatchSize];
+    int count = 0;
 
-    for (ar = m->ResourceRecords; ar; ar=ar->next)
+    // Hosts going to sleep behind us tend to register their keepalives together and with the same timeout, so the
+    // ones that come due together are handed to the platform layer together.
+    while (m->KeepaliveHeap && m->timenow - m->KeepaliveHeap->KATimeExpire >= 0)
     {
-        mDNSu32 timeout, seq, ack;
-        mDNSu16 win;
-        mDNSAddr laddr, raddr;
+        AuthRecord *const ar = PopKeepalive(m);
+        mDNSKeepalivePacket *const ka = &batch[count];
+        mDNSu32 timeout = 0;
         mDNSEthAddr eth;
-        mDNSIPPort lport, rport;
-
-        timeout = seq = ack = 0;
-        win = 0;
 
-        laddr = raddr = zeroAddr;
-        lport = rport = zeroIPPort;
+        ka->seq = ka->ack = 0;
+        ka->win = 0;
+        ka->laddr = ka->raddr = zeroAddr;
+        ka->lport = ka->rport = zeroIPPort;
 
+        // A record that has had its HMAC cleared is on its way out; leave it unscheduled
         if (!ar->WakeUp.HMAC.l[0]) continue;
 
-        mDNS_ExtractKeepaliveInfo(ar, &timeout, &laddr, &raddr, &eth, &seq, &ack, &lport, &rport, &win);
+        mDNS_ExtractKeepaliveInfo(ar, &timeout, &ka->laddr, &ka->raddr, &eth, &ka->seq, &ka->ack, &ka->lport, &ka->rport, &ka->win);
 
-        if (!timeout || mDNSAddressIsZero(&laddr) || mDNSAddressIsZero(&raddr) || !seq || !ack || mDNSIPPortIsZero(lport) || mDNSIPPortIsZero(rport) || !win)
+        // Only records that parsed are in the heap, but check again rather than spin on a zero timeout
+        if (!timeout || mDNSAddressIsZero(&ka->laddr) || mDNSAddressIsZero(&ka->raddr) || !ka->seq || !ka->ack || mDNSIPPortIsZero(ka->lport) || mDNSIPPortIsZero(ka->rport) || !ka->win)
         {
             debugf("mDNS_SendKeepalives: not a valid record %s for keepalive", ARDisplayString(m, ar));
             continue;
         }
-        LogMsg("mDNS_SendKeepalives: laddr %#a raddr %#a lport %d rport %d", &laddr, &raddr, mDNSVal16(lport), mDNSVal16(rport));
+        LogMsg("mDNS_SendKeepalives: laddr %#a raddr %#a lport %d rport %d", &ka->laddr, &ka->raddr, mDNSVal16(ka->lport), mDNSVal16(ka->rport));
 
-        // When we receive a proxy update, we set KATimeExpire to zero so that we always send a keepalive
-        // immediately (to detect any potential problems). After that we always set it to a non-zero value.
-        if (!ar->KATimeExpire || (m->timenow - ar->KATimeExpire >= 0))
+        if (++count == KeepaliveBatchSize)
         {
-            mDNSPlatformSendKeepalive(&laddr, &raddr, &lport, &rport, seq, ack, win);
-            ar->KATimeExpire = NonZeroTime(m->timenow + timeout * mDNSPlatformOneSecond);
+            mDNSPlatformSendKeepalives(batch, count);
+            count = 0;
         }
-        if (m->NextScheduledKA - ar->KATimeExpire > 0)
-            m->NextScheduledKA = ar->KATimeExpire;
+        ar->KATimeExpire = NonZeroTime(m->timenow + timeout * mDNSPlatformOneSecond);
+        ScheduleKeepalive(m, ar);
     }
+    if (count) mDNSPlatformSendKeepalives(batch, count);
+    UpdateNextScheduledKA(m);
 }
 
 mDNSlocal void mDNS_SendKeepaliveACK(mDNS *const m, AuthRecord *ar)
@@ -10380,8 +12263,7 @@ mDNSlocal void mDNSCoreReceiveUpdate(mDNS *const m,
         if (m->omsg.h.flags.b[1] & kDNSFlag1_RC_Mask)
         {
             LogMsg("Refusing sleep proxy registration from %#a:%d: Out of memory", srcaddr, mDNSVal16(srcport));
-            ClearProxyRecords(m, &owner, m->DuplicateRecords);
-            ClearProxyRecords(m, &owner, m->ResourceRecords);
+            ClearProxyRecords(m, &owner);
         }
         else
         {
@@ -10538,6 +12420,7 @@ mDNSexport void MakeNegativeCacheRecord(mDNS *const m, CacheRecord *const cr, co
     cr->LastCachedAnswerTime= 0;
 #endif
     cr->CRActiveQuestion   = mDNSNULL;
+    cr->KnownAnswerIndex   = KnownAnswerIndexNone;
     cr->UnansweredQueries  = 0;
     cr->LastUnansweredTime = 0;
     cr->NextInCFList       = mDNSNULL;
@@ -10558,9 +12441,96 @@ mDNSexport void mDNSCoreReceiveForQuerier(mDNS *const m, DNSMessage *const msg,
 }
 #endif
 
-mDNSexport void mDNSCoreReceive(mDNS *const m, DNSMessage *const msg, const mDNSu8 *const end,
-                                const mDNSAddr *const srcaddr, const mDNSIPPort srcport, const mDNSAddr *dstaddr, const mDNSIPPort dstport,
-                                const mDNSInterfaceID InterfaceID)
+// Tops the bucket up for the time since it was last looked at, and says whether it could pay for one more query.
+// A bucket that comes up short is throttled, and stays throttled until it's half full again.
+mDNSlocal mDNSBool QueryBucketReady(mDNSQueryBucket *const b, const mDNSs32 now, const mDNSu32 rate, const mDNSu32 burst)
+{
+    const mDNSu32 full = burst * mDNSPlatformOneSecond;
+    const mDNSs32 elapsed = now - b->LastRefill;
+
+    if (elapsed < 0 || (mDNSu32)elapsed >= full / rate) b->tokens = full;
+    else if ((b->tokens += (mDNSu32)elapsed * rate) > full) b->tokens = full;
+    b->LastRefill = now;
+
+    if (b->throttled && b->tokens < full / 2) return(mDNSfalse);
+    b->throttled = (b->tokens < (mDNSu32)mDNSPlatformOneSecond);
+    return(!b->throttled);
+}
+
+mDNSlocal void QueryBucketInit(mDNSQueryBucket *const b, const mDNSs32 now, const mDNSu32 burst)
+{
+    b->LastRefill = now;
+    b->tokens     = burst * mDNSPlatformOneSecond;
+    b->throttled  = mDNSfalse;
+}
+
+mDNSlocal mDNSQueryFloodSource *QueryFloodSourceFor(mDNS *const m, const mDNSAddr *const addr, const mDNSInterfaceID InterfaceID)
+{
+    mDNSQueryFlood *const f = &m->QueryFlood;
+    mDNSQueryFloodSource *s, *oldest = mDNSNULL;
+    mDNSu32 i;
+
+    for (i = 0; i < f->used; i++)
+    {
+        s = &f->source[i];
+        if (s->InterfaceID == InterfaceID && mDNSSameAddress(&s->addr, addr)) return(s);
+        if (!oldest || (oldest->bucket.throttled && !s->bucket.throttled) ||
+            (oldest->bucket.throttled == s->bucket.throttled && s->bucket.LastRefill - oldest->bucket.LastRefill < 0))
+            oldest = s;
+    }
+    s = (f->used < QueryFloodSources) ? &f->source[f->used++] : oldest;
+    s->addr        = *addr;
+    s->InterfaceID = InterfaceID;
+    s->dropped     = 0;
+    QueryBucketInit(&s->bucket, m->timenow, QueryFloodBurst);
+    return(s);
+}
+
+// Says whether a query on the mDNS port is within the flood limits (see mDNSQueryFlood), charging it if it is.
+mDNSlocal mDNSBool QueryFloodAllows(mDNS *const m, const mDNSAddr *const srcaddr, const mDNSInterfaceID InterfaceID)
+{
+    NetworkInterfaceInfo *const intf = FirstInterfaceForID(m, InterfaceID);
+    const NetworkInterfaceInfo *i;
+    mDNSQueryFloodSource *s;
+    mDNSBool wasThrottled;
+
+    if (!intf) return(mDNStrue);
+    for (i = m->HostInterfaces; i; i = i->next)
+        if (mDNSSameAddress(&i->ip, srcaddr)) return(mDNStrue);
+
+    s = QueryFloodSourceFor(m, srcaddr, InterfaceID);
+    wasThrottled = s->bucket.throttled;
+    if (!QueryBucketReady(&s->bucket, m->timenow, QueryFloodRate, QueryFloodBurst))
+    {
+        if (!wasThrottled)
+        {
+            m->mDNSStats.QueryFloodThrottles++;
+            LogInfo("QueryFloodAllows: throttling queries from %#a on %s", srcaddr, intf->ifname);
+        }
+        m->mDNSStats.QueryFloodSourceDrops++;
+        s->dropped++;
+        return(mDNSfalse);
+    }
+    wasThrottled = intf->QueryBucket.throttled;
+    if (!QueryBucketReady(&intf->QueryBucket, m->timenow, QueryFloodInterfaceRate, QueryFloodInterfaceBurst))
+    {
+        if (!wasThrottled)
+        {
+            m->mDNSStats.QueryFloodThrottles++;
+            LogInfo("QueryFloodAllows: throttling queries on %s", intf->ifname);
+        }
+        m->mDNSStats.QueryFloodInterfaceDrops++;
+        return(mDNSfalse);
+    }
+    s->bucket.tokens         -= (mDNSu32)mDNSPlatformOneSecond;
+    intf->QueryBucket.tokens -= (mDNSu32)mDNSPlatformOneSecond;
+    return(mDNStrue);
+}
+
+// Caller must hold the lock
+mDNSlocal void mDNSCoreReceivePacket(mDNS *const m, DNSMessage *const msg, const mDNSu8 *const end,
+                                     const mDNSAddr *const srcaddr, const mDNSIPPort srcport, const mDNSAddr *dstaddr, const mDNSIPPort dstport,
+                                     const mDNSInterfaceID InterfaceID)
 {
     mDNSInterfaceID ifid = InterfaceID;
     const mDNSu8 *const pkt = (mDNSu8 *)msg;
@@ -10579,17 +12549,13 @@ mDNSexport void mDNSCoreReceive(mDNS *const m, DNSMessage *const msg, const mDNS
 #ifdef _LEGACY_NAT_TRAVERSAL_
         if (mDNSSameIPPort(srcport, SSDPPort) || (m->SSDPSocket && mDNSSameIPPort(dstport, m->SSDPSocket->port)))
         {
-            mDNS_Lock(m);
             LNT_ConfigureRouterInfo(m, InterfaceID, (mDNSu8 *)msg, (mDNSu16)(end - pkt));
-            mDNS_Unlock(m);
             return;
         }
 #endif
         if (mDNSSameIPPort(srcport, NATPMPPort))
         {
-            mDNS_Lock(m);
             uDNS_ReceiveNATPacket(m, InterfaceID, (mDNSu8 *)msg, (mDNSu16)(end - pkt));
-            mDNS_Unlock(m);
             return;
         }
     }
@@ -10603,6 +12569,9 @@ mDNSexport void mDNSCoreReceive(mDNS *const m, DNSMessage *const msg, const mDNS
         LogMsg("DNS Message from %#a:%d to %#a:%d length %d too short", srcaddr, mDNSVal16(srcport), dstaddr, mDNSVal16(dstport), (int)(end - pkt));
         return;
     }
+
+    if (m->PacketRing)
+        mDNS_PacketRingRecord(m, mDNSfalse, TLS ? "TLS" : !dstaddr ? "TCP" : "UDP", srcaddr, srcport, dstaddr, dstport, pkt, end, InterfaceID);
     QR_OP = (mDNSu8)(msg->h.flags.b[0] & kDNSFlag0_QROP_Mask);
     // Read the integer parts which are in IETF byte-order (MSB first, LSB second)
     ptr = (mDNSu8 *)&msg->h.numQuestions;
@@ -10611,17 +12580,28 @@ mDNSexport void mDNSCoreReceive(mDNS *const m, DNSMessage *const msg, const mDNS
     msg->h.numAuthorities = (mDNSu16)((mDNSu16)ptr[4] << 8 | ptr[5]);
     msg->h.numAdditionals = (mDNSu16)((mDNSu16)ptr[6] << 8 | ptr[7]);
 
-    if (!m) { LogMsg("mDNSCoreReceive ERROR m is NULL"); return; }
-
     // We use zero addresses and all-ones addresses at various places in the code to indicate special values like "no address"
     // If we accept and try to process a packet with zero or all-ones source address, that could really mess things up
     if (!mDNSAddressIsValid(srcaddr)) { debugf("mDNSCoreReceive ignoring packet from %#a", srcaddr); return; }
 
-    mDNS_Lock(m);
     m->PktNum++;
+    if (InterfaceID)
+    {
+        NetworkInterfaceInfo *const intf = FirstInterfaceForID(m, InterfaceID);
+        if (intf)
+        {
+            intf->PacketsReceived++;
+            mDNSCountInterfaceTraffic(&intf->TrafficIn, msg, end);
+            if (mDNSOpaque16IsZero(msg->h.id)) intf->McastRateCount++;
+        }
+    }
+    // Shed query floods before any of the packet is parsed
+    if (QR_OP == StdQ && InterfaceID && mDNSSameIPPort(dstport, MulticastDNSPort) && !QueryFloodAllows(m, srcaddr, InterfaceID))
+        return;
     if (mDNSOpaque16IsZero(msg->h.id))
     {
         m->MPktNum++;
+        mDNS_TrafficStatsRecord(m, msg, end, srcaddr);
 #if APPLE_OSX_mDNSResponder
         // Track the number of multicast packets received from a source outside our subnet.
         // Check the destination address to avoid accounting for spurious packets that
@@ -10646,11 +12626,18 @@ mDNSexport void mDNSCoreReceive(mDNS *const m, DNSMessage *const msg, const mDNS
         }
 #endif
     if      (QR_OP == StdQ) mDNSCoreReceiveQuery   (m, msg, end, srcaddr, srcport, dstaddr, dstport, ifid);
+    else if (QR_OP == StdR)
+    {
+        // The answers this packet brings to questions are delivered together once it has all been taken in
+        m->AnswerBatching = mDNStrue;
 #if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
-    else if (QR_OP == StdR) mDNSCoreReceiveResponse(m, msg, end, srcaddr, srcport, dstaddr, dstport, mDNSNULL, mDNSNULL, ifid);
+        mDNSCoreReceiveResponse(m, msg, end, srcaddr, srcport, dstaddr, dstport, mDNSNULL, mDNSNULL, ifid);
 #else
-    else if (QR_OP == StdR) mDNSCoreReceiveResponse(m, msg, end, srcaddr, srcport, dstaddr, dstport, ifid);
+        mDNSCoreReceiveResponse(m, msg, end, srcaddr, srcport, dstaddr, dstport, ifid);
 #endif
+        m->AnswerBatching = mDNSfalse;
+        if (m->AnswerBatchCount) FlushAnswerBatch(m);
+    }
     else if (QR_OP == UpdQ) mDNSCoreReceiveUpdate  (m, msg, end, srcaddr, srcport, dstaddr, dstport, InterfaceID);
     else if (QR_OP == UpdR) mDNSCoreReceiveUpdateR (m, msg, end, srcaddr,                            InterfaceID);
     else
@@ -10673,12 +12660,84 @@ mDNSexport void mDNSCoreReceive(mDNS *const m, DNSMessage *const msg, const mDNS
             }
         }
     }
+}
+
+mDNSexport void mDNSCoreReceive(mDNS *const m, DNSMessage *const msg, const mDNSu8 *const end,
+                                const mDNSAddr *const srcaddr, const mDNSIPPort srcport, const mDNSAddr *dstaddr, const mDNSIPPort dstport,
+                                const mDNSInterfaceID InterfaceID)
+{
+    mDNSs32 start;
+
+    if (!m) { LogMsg("mDNSCoreReceive ERROR m is NULL"); return; }
+
+    mDNS_TRACE2(receive__start, end - (const mDNSu8 *)msg, InterfaceID);
+    mDNS_Lock(m);
+    start = mDNSPlatformRawTime();
+    mDNSCoreReceivePacket(m, msg, end, srcaddr, srcport, dstaddr, dstport, InterfaceID);
+    CountPhaseTime(&m->mDNSStats.ReceiveRuns, &m->mDNSStats.ReceiveTicks, &m->mDNSStats.ReceiveMaxTicks, start);
     // Packet reception often causes a change to the task list:
     // 1. Inbound queries can cause us to need to send responses
     // 2. Conflicing response packets received from other hosts can cause us to need to send defensive responses
     // 3. Other hosts announcing deletion of shared records can cause us to need to re-assert those records
     // 4. Response packets that answer questions may cause our client to issue new questions
     mDNS_Unlock(m);
+    mDNS_TRACE2(receive__done, end - (const mDNSu8 *)msg, InterfaceID);
+}
+
+// Cheap structural check of a received multicast DNS packet. It looks only at the packet itself (no mDNS state),
+// so it runs before the lock is taken; packets it rejects are ones mDNSCoreReceivePacket would have thrown away
+// without finding a single usable question or record. Anything not addressed to the mDNS port, or that may be
+// a NAT-PMP or SSDP reply, is passed through untouched and judged under the lock as before.
+mDNSlocal mDNSBool ReceivedPacketIsParseable(const mDNSReceivedPacket *const pkt)
+{
+    const DNSMessage *const msg = pkt->msg;
+    const mDNSu8 *const wire = (const mDNSu8 *)&msg->h.numQuestions;
+    const mDNSu8 *ptr = msg->data;
+    mDNSu16 numQuestions, numRecords;
+
+    if (!mDNSSameIPPort(pkt->dstport, MulticastDNSPort)) return(mDNStrue);
+    if (mDNSSameIPPort(pkt->srcport, NATPMPPort) || mDNSSameIPPort(pkt->srcport, SSDPPort)) return(mDNStrue);
+    if ((unsigned)(pkt->end - (const mDNSu8 *)msg) < sizeof(DNSMessageHeader)) return(mDNSfalse);
+    if (!mDNSAddressIsValid(&pkt->srcaddr)) return(mDNSfalse);
+
+    // The header counts are still in network byte order at this point
+    numQuestions = (mDNSu16)((mDNSu16)wire[0] << 8 | wire[1]);
+    numRecords   = (mDNSu16)(((mDNSu16)wire[2] << 8 | wire[3]) + ((mDNSu16)wire[4] << 8 | wire[5]) + ((mDNSu16)wire[6] << 8 | wire[7]));
+    if      (numQuestions) ptr = skipQuestion      (msg, ptr, pkt->end);
+    else if (numRecords)   ptr = skipResourceRecord(msg, ptr, pkt->end);
+    return(ptr != mDNSNULL);
+}
+
+// For platform layers that drain several datagrams from a socket per wakeup: taking the lock once for the
+// whole batch means m->NextScheduledEvent is only recomputed once, after the last packet has been handled.
+// Packets that can't be parsed at all are weeded out first, without the lock, so a burst of junk doesn't
+// hold up client requests waiting on it.
+mDNSexport void mDNSCoreReceiveBatch(mDNS *const m, mDNSReceivedPacket *const pkts, const mDNSu32 count)
+{
+    mDNSu32 i, usable = 0;
+    mDNSs32 start;
+
+    if (!m) { LogMsg("mDNSCoreReceiveBatch ERROR m is NULL"); return; }
+
+    for (i = 0; i < count; i++)
+    {
+        if (ReceivedPacketIsParseable(&pkts[i])) usable++;
+        else pkts[i].msg = mDNSNULL;
+    }
+    if (!usable) return;
+
+    mDNS_TRACE1(receive__batch__start, usable);
+    mDNS_Lock(m);
+    start = mDNSPlatformRawTime();
+    for (i = 0; i < count; i++)
+    {
+        mDNSReceivedPacket *const pkt = &pkts[i];
+        if (!pkt->msg) continue;
+        mDNSCoreReceivePacket(m, pkt->msg, pkt->end, &pkt->srcaddr, pkt->srcport, &pkt->dstaddr, pkt->dstport, pkt->InterfaceID);
+    }
+    CountPhaseTime(&m->mDNSStats.ReceiveRuns, &m->mDNSStats.ReceiveTicks, &m->mDNSStats.ReceiveMaxTicks, start);
+    mDNS_Unlock(m);
+    mDNS_TRACE1(receive__batch__done, usable);
 }
 
 // ***************************************************************************
@@ -10716,8 +12775,8 @@ mDNSlocal DNSQuestion *FindDuplicateQuestion(const mDNS *const m, const DNSQuest
     // Note: A question can only be marked as a duplicate of one that occurs *earlier* in the list.
     // This prevents circular references, where two questions are each marked as a duplicate of the other.
     // Accordingly, we break out of the loop when we get to 'question', because there's no point searching
-    // further in the list.
-    for (q = m->Questions; q && (q != question); q = q->next)
+    // further in the list. The hash chain is in the same order as m->Questions, so the same applies to it.
+    for (q = FirstQuestionForNameHash(m, question->qnamehash); q && (q != question); q = q->NextInQHash)
     {
         if (!SameQuestionKind(q, question))                             continue;
         if (q->qnamehash          != question->qnamehash)               continue;
@@ -10728,6 +12787,7 @@ mDNSlocal DNSQuestion *FindDuplicateQuestion(const mDNS *const m, const DNSQuest
         if (q->AuthInfo && !question->AuthInfo)                         continue;
         if (!q->Suppressed        != !question->Suppressed)             continue;
         if (q->BrowseThreshold    != question->BrowseThreshold)         continue;
+        if (q->OneShot            != question->OneShot)                 continue;
         if (AWDLIsIncluded(q)     != AWDLIsIncluded(question))          continue;
 #if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
         if (q->dnsservice         != question->dnsservice)              continue;
@@ -10756,7 +12816,8 @@ mDNSlocal void UpdateQuestionDuplicates(mDNS *const m, DNSQuestion *const questi
         return;
     }
 
-    for (q = m->Questions; q; q=q->next)        // Scan our list of questions
+    // Duplicates always have the same qnamehash as the question they duplicate
+    for (q = FirstQuestionForNameHash(m, question->qnamehash); q; q = q->NextInQHash)
         if (q->DuplicateOf == question)         // To see if any questions were referencing this as their duplicate
         {
             q->DuplicateOf = first;
@@ -10772,6 +12833,7 @@ mDNSlocal void UpdateQuestionDuplicates(mDNS *const m, DNSQuestion *const questi
                 q->RecentAnswerPkts  = question->RecentAnswerPkts;
                 q->RequestUnicast    = question->RequestUnicast;
                 q->LastQTxTime       = question->LastQTxTime;
+                q->KnownAnswersPartial = question->KnownAnswersPartial; // Its records follow in mDNS_StopQuery_internal
                 q->CNAMEReferrals    = question->CNAMEReferrals;
                 q->nta               = question->nta;
                 q->servAddr          = question->servAddr;
@@ -10794,6 +12856,9 @@ mDNSlocal void UpdateQuestionDuplicates(mDNS *const m, DNSQuestion *const questi
 #if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
                 q->LocalSocket       = question->LocalSocket;
                 // No need to close old q->LocalSocket first -- duplicate questions can't have their own sockets
+                // A pooled TCP connection finds its questions by scanning for tcpConn, so it moves over just as easily
+                q->tcpConn           = question->tcpConn;
+                q->tcpSrcPort        = question->tcpSrcPort;
 #endif
 
                 q->state             = question->state;
@@ -10805,6 +12870,7 @@ mDNSlocal void UpdateQuestionDuplicates(mDNS *const m, DNSQuestion *const questi
 
 #if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
                 question->LocalSocket = mDNSNULL;
+                question->tcpConn     = mDNSNULL;
 #endif
                 question->nta        = mDNSNULL;    // If we've got a GetZoneData in progress, transfer it to the newly active question
                 //  question->tcp        = mDNSNULL;
@@ -11035,72 +13101,124 @@ mDNSlocal mDNSBool DNSServerMatch(DNSServer *d, mDNSInterfaceID InterfaceID, mDN
     // - DNSServer is scoped and InterfaceID is not NULL - the InterfaceID of the question and the DNSServer
     //   should match (Refer to (2) above).
 
-    if (((d->scopeType == kScopeNone) && (!InterfaceID && ServiceID == -1))  ||
-        ((d->scopeType == kScopeInterfaceID) && d->interface == InterfaceID) ||
-        ((d->scopeType == kScopeServiceID) && d->serviceID == ServiceID))
+    if (((d->scopeType == kScopeNone) && (!InterfaceID && ServiceID == -1))  ||
+        ((d->scopeType == kScopeInterfaceID) && d->interface == InterfaceID) ||
+        ((d->scopeType == kScopeServiceID) && d->serviceID == ServiceID))
+    {
+        return mDNStrue;
+    }
+    return mDNSfalse;
+}
+
+// Rebuilds m->DNSServerIndex if the server list has changed since it was last built
+mDNSlocal const DNSServerIndex *GetDNSServerIndex(mDNS *const m)
+{
+    DNSServerIndex *const idx = &m->DNSServerIndex;
+    DNSServer *s;
+    int i;
+
+    if (idx->built) return(idx);
+
+    idx->count       = 0;
+    idx->domainCount = 0;
+    idx->maxLabels   = 0;
+    for (i = 0; i < DNSServerIndexSlots; i++) idx->slot[i] = -1;
+    for (s = m->DNSServers; s && idx->count < DNSServerIndexMaxServers; s = s->next)
+    {
+        const mDNSu32 hash = DomainNameHashValue(&s->domain);
+        const int index = idx->count;
+        DNSServerIndexDomain *dom = mDNSNULL;
+
+        if (s->flags & DNSServerFlag_Delete) continue;
+        idx->server[index]       = s;
+        idx->nextInDomain[index] = -1;
+        idx->count++;
+
+        for (i = idx->slot[hash % DNSServerIndexSlots]; i >= 0; i = idx->domain[i].next)
+        {
+            if (idx->domain[i].hash == hash && SameDomainName(idx->domain[i].domain, &s->domain)) { dom = &idx->domain[i]; break; }
+        }
+        if (dom)
+        {
+            idx->nextInDomain[dom->last] = (mDNSs16)index;
+            dom->last = (mDNSs16)index;
+        }
+        else
+        {
+            const int labels = CountLabels(&s->domain);
+            dom = &idx->domain[idx->domainCount];
+            dom->domain = &s->domain;
+            dom->hash   = hash;
+            dom->first  = dom->last = (mDNSs16)index;
+            dom->next   = idx->slot[hash % DNSServerIndexSlots];
+            idx->slot[hash % DNSServerIndexSlots] = idx->domainCount++;
+            if (labels > idx->maxLabels) idx->maxLabels = (mDNSu8)labels;
+        }
+    }
+    idx->built = mDNStrue;
+    return(idx);
+}
+
+// Returns the first of the servers configured for exactly this domain, or -1 if there are none
+mDNSlocal int DNSServerIndexFind(const DNSServerIndex *const idx, const domainname *const domain)
+{
+    const mDNSu32 hash = DomainNameHashValue(domain);
+    int i;
+
+    for (i = idx->slot[hash % DNSServerIndexSlots]; i >= 0; i = idx->domain[i].next)
     {
-        return mDNStrue;
+        if (idx->domain[i].hash == hash && SameDomainName(idx->domain[i].domain, domain)) return(idx->domain[i].first);
     }
-    return mDNSfalse;
+    return(-1);
+}
+
+// Returns the longest suffix of name that could be a configured domain. The caller works its way out from there to the
+// root, one label at a time, until it finds a domain with servers it can use.
+mDNSlocal const domainname *DNSServerIndexFirstSuffix(const DNSServerIndex *const idx, const domainname *const name)
+{
+    const int namecount = CountLabels(name);
+    return((namecount > idx->maxLabels) ? SkipLeadingLabels(name, namecount - idx->maxLabels) : name);
 }
 
-// Sets all the Valid DNS servers for a question
+#define DNSServerIndexNextSuffix(D) ((const domainname *)((D)->c + 1 + (D)->c[0]))
+
+// Sets all the Valid DNS servers for a question: the matching ones for the longest configured domain its name is under
 mDNSexport mDNSu32 SetValidDNSServers(mDNS *m, DNSQuestion *question)
 {
-    int bestmatchlen = -1, namecount = CountLabels(&question->qname);
-    DNSServer *curr;
-    int bettermatch, currcount;
-    int index = 0;
+    const DNSServerIndex *const idx = GetDNSServerIndex(m);
+    const domainname *suffix;
     mDNSu32 timeout = 0;
-    mDNSBool DEQuery;
+    mDNSBool DEQuery, found = mDNSfalse;
+    int index;
 
     question->validDNSServers = zeroOpaque128;
     DEQuery = DomainEnumQuery(&question->qname);
-    for (curr = m->DNSServers; curr; curr = curr->next)
+    for (suffix = DNSServerIndexFirstSuffix(idx, &question->qname); ; suffix = DNSServerIndexNextSuffix(suffix))
     {
-        debugf("SetValidDNSServers: Parsing DNS server Address %#a (Domain %##s), Scope: %d", &curr->addr, curr->domain.c, curr->scopeType);
-        // skip servers that will soon be deleted
-        if (curr->flags & DNSServerFlag_Delete)
+        for (index = DNSServerIndexFind(idx, suffix); index >= 0; index = idx->nextInDomain[index])
         {
-            debugf("SetValidDNSServers: Delete set for index %d, DNS server %#a (Domain %##s), scoped %d", index, &curr->addr, curr->domain.c, curr->scopeType);
-            continue;
-        }
-
-        // This happens normally when you unplug the interface where we reset the interfaceID to mDNSInterface_Any for all
-        // the DNS servers whose scope match the interfaceID. Few seconds later, we also receive the updated DNS configuration.
-        // But any questions that has mDNSInterface_Any scope that are started/restarted before we receive the update
-        // (e.g., CheckSuppressUnusableQuestions is called when interfaces are deregistered with the core) should not
-        // match the scoped entries by mistake.
-        //
-        // Note: DNS configuration change will help pick the new dns servers but currently it does not affect the timeout
+            DNSServer *const curr = idx->server[index];
+            debugf("SetValidDNSServers: Parsing DNS server Address %#a (Domain %##s), Scope: %d", &curr->addr, curr->domain.c, curr->scopeType);
 
-        // Skip DNSServers that are InterfaceID Scoped but have no valid interfaceid set OR DNSServers that are ServiceID Scoped but have no valid serviceid set
-        if (((curr->scopeType == kScopeInterfaceID) && (curr->interface == mDNSInterface_Any)) ||
-            ((curr->scopeType == kScopeServiceID) && (curr->serviceID <= 0)))
-        {
-            LogInfo("SetValidDNSServers: ScopeType[%d] Skipping DNS server %#a (Domain %##s) Interface:[%p] Serviceid:[%d]",
-                (int)curr->scopeType, &curr->addr, curr->domain.c, curr->interface, curr->serviceID);
-            continue;
-        }
+            // This happens normally when you unplug the interface where we reset the interfaceID to mDNSInterface_Any for all
+            // the DNS servers whose scope match the interfaceID. Few seconds later, we also receive the updated DNS configuration.
+            // But any questions that has mDNSInterface_Any scope that are started/restarted before we receive the update
+            // (e.g., CheckSuppressUnusableQuestions is called when interfaces are deregistered with the core) should not
+            // match the scoped entries by mistake.
+            //
+            // Note: DNS configuration change will help pick the new dns servers but currently it does not affect the timeout
 
-        currcount = CountLabels(&curr->domain);
-        if ((!DEQuery || !curr->isCell) && DNSServerMatch(curr, question->InterfaceID, question->ServiceID))
-        {
-            bettermatch = BetterMatchForName(&question->qname, namecount, &curr->domain, currcount, bestmatchlen);
+            // Skip DNSServers that are InterfaceID Scoped but have no valid interfaceid set OR DNSServers that are ServiceID Scoped but have no valid serviceid set
+            if (((curr->scopeType == kScopeInterfaceID) && (curr->interface == mDNSInterface_Any)) ||
+                ((curr->scopeType == kScopeServiceID) && (curr->serviceID <= 0)))
+            {
+                LogInfo("SetValidDNSServers: ScopeType[%d] Skipping DNS server %#a (Domain %##s) Interface:[%p] Serviceid:[%d]",
+                    (int)curr->scopeType, &curr->addr, curr->domain.c, curr->interface, curr->serviceID);
+                continue;
+            }
 
-            // If we found a better match (bettermatch == 1) then clear all the bits
-            // corresponding to the old DNSServers that we have may set before and start fresh.
-            // If we find an equal match, then include that DNSServer also by setting the corresponding
-            // bit
-            if ((bettermatch == 1) || (bettermatch == 0))
+            if ((!DEQuery || !curr->isCell) && DNSServerMatch(curr, question->InterfaceID, question->ServiceID))
             {
-                bestmatchlen = currcount;
-                if (bettermatch)
-                {
-                    debugf("SetValidDNSServers: Resetting all the bits");
-                    question->validDNSServers = zeroOpaque128;
-                    timeout = 0;
-                }
                 debugf("SetValidDNSServers: question %##s Setting the bit for DNS server Address %#a (Domain %##s), Scoped:%d index %d,"
                        " Timeout %d, interface %p", question->qname.c, &curr->addr, curr->domain.c, curr->scopeType, index, curr->timeout,
                        curr->interface);
@@ -11108,9 +13226,11 @@ mDNSexport mDNSu32 SetValidDNSServers(mDNS *m, DNSQuestion *question)
                 if (DEQuery)
                     debugf("DomainEnumQuery: Question %##s, DNSServer %#a, cell %d", question->qname.c, &curr->addr, curr->isCell);
                 bit_set_opaque128(question->validDNSServers, index);
+                found = mDNStrue;
             }
         }
-        index++;
+        // Once a domain has given us servers, shorter ones are no match
+        if (found || !suffix->c[0]) break;
     }
     question->noServerResponse = 0;
 
@@ -11120,80 +13240,85 @@ mDNSexport mDNSu32 SetValidDNSServers(mDNS *m, DNSQuestion *question)
     return (timeout ? timeout : DEFAULT_UDNS_TIMEOUT);
 }
 
+// A server's score estimates what sending it a query costs us: its smoothed round trip time, plus a retransmission
+// interval weighted by how often it has recently left our queries unanswered. Lower is better. A server we have not
+// timed yet scores on its losses alone, so it gets a turn before we settle on the ones we know.
+mDNSlocal mDNSs32 DNSServerScore(const DNSServer *server)
+{
+    return (server->srtt >> DNSSERVER_SRTT_SHIFT) + ((server->loss * MinQuestionInterval) >> 8);
+}
+
+typedef struct
+{
+    DNSServer *server;
+    int index;
+    mDNSs32 penaltyTime;
+    mDNSs32 score;
+} DNSServerChoice;
+
+// If there are multiple best servers for a given question, we will pick the one with the lowest score (see
+// DNSServerScore) if none of them are penalized. If some of them are penalized in that list, we pick the least
+// penalized one; among equally penalized servers the score decides, unless StrictUnicastOrdering asks us to keep to the
+// order in the list.
+mDNSlocal void ConsiderDNSServer(mDNS *const m, DNSServerChoice *const best, DNSServer *const curr, const int index)
+{
+    const mDNSs32 currPenaltyTime = PenaltyTimeForServer(m, curr);
+    const mDNSs32 currScore = DNSServerScore(curr);
+
+    debugf("GetBestServer: Address %#a (Domain %##s), PenaltyTime(abs) %d, PenaltyTime(rel) %d",
+           &curr->addr, curr->domain.c, curr->penaltyTime, currPenaltyTime);
+
+    if (currPenaltyTime < best->penaltyTime ||
+        (currPenaltyTime == best->penaltyTime && !StrictUnicastOrdering && currScore < best->score))
+    {
+        best->server      = curr;
+        best->index       = index;
+        best->penaltyTime = currPenaltyTime;
+        best->score       = currScore;
+    }
+}
+
 // Get the Best server that matches a name. If you find penalized servers, look for the one
 // that will come out of the penalty box soon
 mDNSlocal DNSServer *GetBestServer(mDNS *m, const domainname *name, mDNSInterfaceID InterfaceID, mDNSs32 ServiceID, mDNSOpaque128 validBits,
     int *selected, mDNSBool nameMatch)
 {
-    DNSServer *curmatch = mDNSNULL;
-    int bestmatchlen = -1, namecount = name ? CountLabels(name) : 0;
-    DNSServer *curr;
-    mDNSs32 bestPenaltyTime, currPenaltyTime;
-    int bettermatch, currcount;
-    int index = 0;
-    int currindex = -1;
+    const DNSServerIndex *const idx = GetDNSServerIndex(m);
+    DNSServerChoice best;
+    int index;
 
     debugf("GetBestServer: ValidDNSServer bits  0x%x%x", validBits.l[1], validBits.l[0]);
-    bestPenaltyTime = DNSSERVER_PENALTY_TIME + 1;
-    for (curr = m->DNSServers; curr; curr = curr->next)
-    {
-        // skip servers that will soon be deleted
-        if (curr->flags & DNSServerFlag_Delete)
-        {
-            debugf("GetBestServer: Delete set for index %d, DNS server %#a (Domain %##s), scoped %d", index, &curr->addr, curr->domain.c, curr->scopeType);
-            continue;
-        }
-
-        // Check if this is a valid DNSServer
-        if (!bit_get_opaque64(validBits, index))
-        {
-            debugf("GetBestServer: continuing for index %d", index);
-            index++;
-            continue;
-        }
-
-        currcount = CountLabels(&curr->domain);
-        currPenaltyTime = PenaltyTimeForServer(m, curr);
-
-        debugf("GetBestServer: Address %#a (Domain %##s), PenaltyTime(abs) %d, PenaltyTime(rel) %d",
-               &curr->addr, curr->domain.c, curr->penaltyTime, currPenaltyTime);
+    best.server      = mDNSNULL;
+    best.index       = -1;
+    best.penaltyTime = DNSSERVER_PENALTY_TIME + 1;
+    best.score       = 0;
 
-        // If there are multiple best servers for a given question, we will pick the first one
-        // if none of them are penalized. If some of them are penalized in that list, we pick
-        // the least penalized one. BetterMatchForName walks through all best matches and
-        // "currPenaltyTime < bestPenaltyTime" check lets us either pick the first best server
-        // in the list when there are no penalized servers and least one among them
-        // when there are some penalized servers.
-
-        if (DNSServerMatch(curr, InterfaceID, ServiceID))
+    if (nameMatch)
+    {
+        const domainname *suffix;
+        // Choose among the matching servers for the longest configured domain the name is under
+        for (suffix = DNSServerIndexFirstSuffix(idx, name); ; suffix = DNSServerIndexNextSuffix(suffix))
         {
-
-            // If we know that all the names are already equally good matches, then skip calling BetterMatchForName.
-            // This happens when we initially walk all the DNS servers and set the validity bit on the question.
-            // Actually we just need PenaltyTime match, but for the sake of readability we just skip the expensive
-            // part and still do some redundant steps e.g., InterfaceID match
-
-            if (nameMatch)
-                bettermatch = BetterMatchForName(name, namecount, &curr->domain, currcount, bestmatchlen);
-            else
-                bettermatch = 0;
-
-            // If we found a better match (bettermatch == 1) then we don't need to
-            // compare penalty times. But if we found an equal match, then we compare
-            // the penalty times to pick a better match
-
-            if ((bettermatch == 1) || ((bettermatch == 0) && currPenaltyTime < bestPenaltyTime))
+            for (index = DNSServerIndexFind(idx, suffix); index >= 0; index = idx->nextInDomain[index])
             {
-                currindex = index;
-                curmatch = curr;
-                bestmatchlen = currcount;
-                bestPenaltyTime = currPenaltyTime;
+                if (bit_get_opaque64(validBits, index) && DNSServerMatch(idx->server[index], InterfaceID, ServiceID))
+                    ConsiderDNSServer(m, &best, idx->server[index], index);
             }
+            if (best.server || !suffix->c[0]) break;
+        }
+    }
+    else
+    {
+        // If we know that all the names are already equally good matches, then we only need to compare penalty times and
+        // scores. This happens when we initially walk all the DNS servers and set the validity bit on the question.
+        for (index = 0; index < idx->count; index++)
+        {
+            if (bit_get_opaque64(validBits, index) && DNSServerMatch(idx->server[index], InterfaceID, ServiceID))
+                ConsiderDNSServer(m, &best, idx->server[index], index);
         }
-        index++;
     }
-    if (selected) *selected = currindex;
-    return curmatch;
+    if (selected) *selected = best.index;
+    return best.server;
 }
 
 // Look up a DNS Server, matching by name and InterfaceID
@@ -11263,6 +13388,28 @@ mDNSexport DNSServer *GetServerForQuestion(mDNS *m, DNSQuestion *question)
 
     return(curmatch);
 }
+
+// Look up the server to race a question's first query against: the best of its remaining valid DNSServers.
+// Unlike GetServerForQuestion, this leaves the server's valid bit set, so that if the question later gives
+// up on qDNSServer it still moves on to this one in the usual way.
+mDNSexport DNSServer *GetRaceServerForQuestion(mDNS *m, const DNSQuestion *question)
+{
+    mDNSInterfaceID InterfaceID = question->InterfaceID;
+    const DNSServer *const current = question->qDNSServer;
+    DNSServer *runnerUp;
+
+    if (InterfaceID == mDNSInterface_LocalOnly)
+        InterfaceID = mDNSNULL;
+
+    if (!current || mDNSOpaque128IsZero(&question->validDNSServers)) return(mDNSNULL);
+    runnerUp = GetBestServer(m, &question->qname, InterfaceID, question->ServiceID, question->validDNSServers, mDNSNULL, mDNSfalse);
+
+    // Racing a penalized server, or the same server listed twice, would only add traffic
+    if (runnerUp && (runnerUp->penaltyTime ||
+        (mDNSSameAddress(&runnerUp->addr, &current->addr) && mDNSSameIPPort(runnerUp->port, current->port))))
+        runnerUp = mDNSNULL;
+    return(runnerUp);
+}
 #endif // MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
 
 // Called in normal client context (lock not held)
@@ -11781,6 +13928,10 @@ mDNSlocal void InitCommonState(mDNS *const m, DNSQuestion *const question)
     question->LastAnswerPktNum  = m->PktNum;
     question->RecentAnswerPkts  = 0;
     question->CurrentAnswers    = 0;
+    question->KnownAnswers      = mDNSNULL;
+    question->KnownAnswerCount  = 0;
+    question->KnownAnswerCapacity = 0;
+    question->KnownAnswersPartial = mDNSfalse;
 
 #if APPLE_OSX_mDNSResponder
 
@@ -11799,6 +13950,8 @@ mDNSlocal void InitCommonState(mDNS *const m, DNSQuestion *const question)
 #else   // APPLE_OSX_mDNSResponder
    question->BrowseThreshold   = 0;
 #endif  // APPLE_OSX_mDNSResponder
+    // kDNSServiceFlagsBrowseSnapshot shares its value with kDNSServiceFlagsTimeout, which for a query sets TimeoutQuestion
+    question->OneShot = (question->qtype == kDNSType_PTR && (question->flags & kDNSServiceFlagsBrowseSnapshot) && !question->TimeoutQuestion);
     question->CachedAnswerNeedsUpdate = mDNSfalse;
 
     question->LargeAnswers      = 0;
@@ -11853,6 +14006,7 @@ mDNSlocal void InitCommonState(mDNS *const m, DNSQuestion *const question)
 
     question->LastQTxTime       = m->timenow;
     question->CNAMEReferrals    = 0;
+    question->SentInQueries     = 0;
 
     question->WakeOnResolveCount = 0;
     if (question->WakeOnResolve)
@@ -11890,12 +14044,19 @@ mDNSlocal void InitWABState(DNSQuestion *const question)
     mdns_querier_forget(&question->querier);
 #else
     question->unansweredQueries = 0;
+    question->raceState         = UnicastRace_None;
+    question->raceServer        = mDNSNULL;
+    question->uDNSSendTime      = 0;
 #endif
     question->nta               = mDNSNULL;
     question->servAddr          = zeroAddr;
     question->servPort          = zeroIPPort;
     question->tcp               = mDNSNULL;
+#if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+    question->tcpConn           = mDNSNULL;
+#endif
     question->NoAnswer          = NoAnswer_Normal;
+    question->staleTime         = 0;
 }
 
 mDNSlocal void InitLLQNATState(mDNS *const m)
@@ -12030,6 +14191,7 @@ mDNSexport mStatus mDNS_StartQuery_internal(mDNS *const m, DNSQuestion *const qu
         return(mStatus_AlreadyRegistered);
     }
     *q = question;
+    question->QuestionSeq = m->NextQuestionSeq++;
 
     // Intialize the question. The only ordering constraint we have today is that
     // InitDNSSECProxyState should be called after the DNS server is selected (in
@@ -12041,10 +14203,14 @@ mDNSexport mStatus mDNS_StartQuery_internal(mDNS *const m, DNSQuestion *const qu
     InitLLQState(question);
     InitDNSSECProxyState(m, question);
 
+    // InitCommonState has set qnamehash, so the question can now be found by name
+    if (!LocalOnlyOrP2PInterface(question->InterfaceID)) AddQuestionToHash(m, question);
+
     // FindDuplicateQuestion should be called last after all the intialization
     // as the duplicate logic could be potentially based on any field in the
     // question.
     question->DuplicateOf  = FindDuplicateQuestion(m, question);
+    if (question->DuplicateOf) m->mDNSStats.DuplicateQuestions++;
     if (question->DuplicateOf)
         question->AuthInfo = question->DuplicateOf->AuthInfo;
 
@@ -12095,6 +14261,7 @@ mDNSexport mStatus mDNS_StartQuery_internal(mDNS *const m, DNSQuestion *const qu
         }
     }
 
+    mDNS_TRACE4(question__start, question, question->qnamehash, question->qtype, question->InterfaceID);
     return(mStatus_NoError);
 }
 
@@ -12111,6 +14278,7 @@ mDNSexport void CancelGetZoneData(mDNS *const m, ZoneData *nta)
         if (nta->question.ThisQInterval != -1)
             LogMsg("CancelGetZoneData: Question %##s (%s) ThisQInterval %d not -1", nta->question.qname.c, DNSTypeName(nta->question.qtype), nta->question.ThisQInterval);
     }
+    GetZoneData_Unlink(m, nta);
     mDNSPlatformMemFree(nta);
 }
 
@@ -12121,11 +14289,17 @@ mDNSexport mStatus mDNS_StopQuery_internal(mDNS *const m, DNSQuestion *const que
     DNSQuestion **qp = &m->Questions;
 
     //LogInfo("mDNS_StopQuery_internal %##s (%s)", question->qname.c, DNSTypeName(question->qtype));
+    mDNS_TRACE4(question__stop, question, question->qnamehash, question->qtype, question->InterfaceID);
 
     if (LocalOnlyOrP2PInterface(question->InterfaceID))
         qp = &m->LocalOnlyQuestions;
     while (*qp && *qp != question) qp=&(*qp)->next;
-    if (*qp) *qp = (*qp)->next;
+    if (*qp)
+    {
+        *qp = (*qp)->next;
+        if (!LocalOnlyOrP2PInterface(question->InterfaceID)) RemoveQuestionFromHash(m, question);
+        if (m->AnswerBatchCount) ForgetBatchedAnswers(m, question, mDNSNULL);
+    }
     else
     {
 #if !ForceAlerts
@@ -12170,7 +14344,7 @@ mDNSexport mStatus mDNS_StopQuery_internal(mDNS *const m, DNSQuestion *const que
             isForCell  = (question->qDNSServer && question->qDNSServer->isCell);
 #endif
             durationMs = ((m->timenow - question->metrics.firstQueryTime) * 1000) / mDNSPlatformOneSecond;
-            MetricsUpdateDNSQueryStats(queryName, question->qtype, mDNSNULL, querySendCount,
+            MetricsUpdateDNSQueryStats(queryName, &question->metrics.queryStatsDomains, question->qtype, mDNSNULL, querySendCount,
                 question->metrics.expiredAnswerState, question->metrics.dnsOverTCPState, durationMs, isForCell);
         }
     }
@@ -12192,7 +14366,7 @@ mDNSexport mStatus mDNS_StopQuery_internal(mDNS *const m, DNSQuestion *const que
             // CRActiveQuestion replacement. If there are no such questions, but there's at least one unsuppressed inactive
             // question that is answered by this cache record, then use an inactive one to not forgo generating RMV events
             // via CacheRecordRmv() when the cache record expires.
-            for (q = m->Questions; q && (q != m->NewQuestions); q = q->next)
+            for (q = FirstQuestionForNameHash(m, cr->resrec.namehash); q && !QuestionIsNew(m, q); q = q->NextInQHash)
             {
                 if (!q->DuplicateOf && !q->Suppressed && CacheRecordAnswersQuestion(cr, q))
                 {
@@ -12210,10 +14384,15 @@ mDNSexport mStatus mDNS_StopQuery_internal(mDNS *const m, DNSQuestion *const que
             if (replacement)
                 debugf("mDNS_StopQuery_internal: Updating CRActiveQuestion to %p for cache record %s, Original question CurrentAnswers %d, new question "
                        "CurrentAnswers %d, Suppressed %d", replacement, CRDisplayString(m,cr), question->CurrentAnswers, replacement->CurrentAnswers, replacement->Suppressed);
-            cr->CRActiveQuestion = replacement;    // Question used to be active; new value may or may not be null
-            if (!replacement) m->rrcache_active--; // If no longer active, decrement rrcache_active count
+            SetCRActiveQuestion(m, cr, replacement); // Question used to be active; new value may or may not be null
+            if (!replacement)
+            {
+                m->rrcache_active--;               // If no longer active, decrement rrcache_active count
+                AddCacheRecordToLRU(m, cr);
+            }
         }
     }
+    MarkKnownAnswerSetPartial(question);    // Its records have all moved on above; this just frees the set
 
     // If we just deleted the question that CacheRecordAdd() or CacheRecordRmv() is about to look at,
     // bump its pointer forward one question.
@@ -12251,6 +14430,9 @@ mDNSexport mStatus mDNS_StopQuery_internal(mDNS *const m, DNSQuestion *const que
     // invalid before we even use it. By making sure that we update m->CurrentQuestion and m->NewQuestions if necessary
     // *first*, then they're all ready to be updated a second time if necessary when we cancel our GetZoneData query.
     if (question->tcp) { DisposeTCPConn(question->tcp); question->tcp = mDNSNULL; }
+#if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+    uDNS_ReleaseTCPConnection(m, question);
+#endif
     if (question->LocalSocket) { mDNSPlatformUDPClose(question->LocalSocket); question->LocalSocket = mDNSNULL; }
 #if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
     Querier_HandleStoppedDNSQuestion(question);
@@ -12320,6 +14502,21 @@ mDNSexport mStatus mDNS_StartQuery(mDNS *const m, DNSQuestion *const question)
     return(status);
 }
 
+// Gives new questions their initial answers from the cache now, rather than on the next mDNS_Execute pass.
+// For clients that have just started questions and want any cached answers delivered straight away;
+// it does exactly what mDNS_Execute would have done next for those questions, just sooner.
+mDNSexport void mDNS_AnswerNewQuestions(mDNS *const m)
+{
+    int i;
+    mDNS_Lock(m);
+    for (i=0; m->NewQuestions && i<1000; i++)
+    {
+        if (m->NewQuestions->DelayAnswering && m->timenow - m->NewQuestions->DelayAnswering < 0) break;
+        AnswerNewQuestion(m);
+    }
+    mDNS_Unlock(m);
+}
+
 mDNSexport mStatus mDNS_StopQuery(mDNS *const m, DNSQuestion *const question)
 {
     mStatus status;
@@ -12395,7 +14592,7 @@ mDNSlocal mStatus mDNS_StartBrowse_internal(mDNS *const m, DNSQuestion *const qu
     question->flags            = flags;
     question->qtype            = kDNSType_PTR;
     question->qclass           = kDNSClass_IN;
-    question->LongLived        = mDNStrue;
+    question->LongLived        = !(flags & kDNSServiceFlagsBrowseSnapshot);   // No point setting up an LLQ for a snapshot
     question->ExpectUnique     = mDNSfalse;
     question->ForceMCast       = ForceMCast;
     question->ReturnIntermed   = (flags & kDNSServiceFlagsReturnIntermediates) != 0;
@@ -12474,6 +14671,8 @@ mDNSexport mStatus mDNS_Register(mDNS *const m, AuthRecord *const rr)
 mDNSexport mStatus mDNS_Update(mDNS *const m, AuthRecord *const rr, mDNSu32 newttl,
                                const mDNSu16 newrdlength, RData *const newrdata, mDNSRecordUpdateCallback *Callback)
 {
+    mDNSBool pending;
+
     if (!ValidateRData(rr->resrec.rrtype, newrdlength, newrdata))
     {
         LogMsg("Attempt to update record with invalid rdata: %s", GetRRDisplayString_rdb(&rr->resrec, &newrdata->u, m->MsgBuffer));
@@ -12486,7 +14685,8 @@ mDNSexport mStatus mDNS_Update(mDNS *const m, AuthRecord *const rr, mDNSu32 newt
     if (newttl == 0) newttl = rr->resrec.rroriginalttl;
 
     // If we already have an update queued up which has not gone through yet, give the client a chance to free that memory
-    if (rr->NewRData)
+    pending = (rr->NewRData != mDNSNULL);
+    if (pending)
     {
         RData *n = rr->NewRData;
         rr->NewRData = mDNSNULL;                            // Clear the NewRData pointer ...
@@ -12512,6 +14712,25 @@ mDNSexport mStatus mDNS_Update(mDNS *const m, AuthRecord *const rr, mDNSu32 newt
     if (RRLocalOnly(rr) || (rr->resrec.rroriginalttl == newttl &&
                             rr->resrec.rdlength == newrdlength && mDNSPlatformMemSame(rr->resrec.rdata->u.data, newrdata->u.data, newrdlength)))
         CompleteRDataUpdate(m, rr);
+    else if (rr->UpdateInterval)
+    {
+        // Coalesced update mode: if an update is already waiting to be announced this one just replaces its rdata.
+        // Otherwise the new rdata gets a short announcement cycle starting no sooner than UpdateInterval after the
+        // last one started, on a kUpdateAnnounceTick boundary so that updates to other records share its packets.
+        if (!pending)
+        {
+            mDNSs32 interval = rr->UpdateInterval < kMinUpdateInterval ? kMinUpdateInterval : rr->UpdateInterval;
+            mDNSs32 next = rr->LastUpdateAnnounce ? rr->LastUpdateAnnounce + interval : m->timenow;
+            if (next - m->timenow < 0) next = m->timenow;
+            next += (mDNSs32)((kUpdateAnnounceTick - (mDNSu32)next % kUpdateAnnounceTick) % kUpdateAnnounceTick);
+            rr->LastUpdateAnnounce = NonZeroTime(next);
+            rr->AnnounceCount      = UpdateAnnounceCount;
+            rr->ThisAPInterval     = DefaultAPIntervalForRecordType(rr->resrec.RecordType);
+            rr->LastAPTime         = next - rr->ThisAPInterval;
+            SetNextAnnounceProbeTime(m, rr);
+        }
+        rr->resrec.rroriginalttl = newttl;
+    }
     else
     {
         rr->AnnounceCount = InitialAnnounceCount;
@@ -12982,6 +15201,16 @@ mDNSexport void mDNS_DeactivateNetWake_internal(mDNS *const m, NetworkInterfaceI
     }
 }
 
+// A multicast question needs attention when an interface comes or goes only if it is bound to that interface,
+// or is a non-specific question that the platform would actually send there. Unicast questions follow DNS
+// server changes instead.
+mDNSlocal mDNSBool QuestionUsesInterface(DNSQuestion *const q, const NetworkInterfaceInfo *const set)
+{
+    if (!mDNSOpaque16IsZero(q->TargetQID)) return(mDNSfalse);
+    if (q->InterfaceID) return(q->InterfaceID == set->InterfaceID);
+    return(mDNSPlatformValidQuestionForInterface(q, set));
+}
+
 mDNSexport mStatus mDNS_RegisterInterface(mDNS *const m, NetworkInterfaceInfo *set, InterfaceActivationSpeed activationSpeed)
 {
     AuthRecord *rr;
@@ -13007,6 +15236,14 @@ mDNSexport mStatus mDNS_RegisterInterface(mDNS *const m, NetworkInterfaceInfo *s
 
     // Assume this interface will be active now, unless we find a duplicate already in the list
     set->InterfaceActive = mDNStrue;
+    set->PacketsReceived = 0;
+    set->PacketsSent     = 0;
+    mDNSPlatformMemZero(&set->TrafficIn,  sizeof(set->TrafficIn));
+    mDNSPlatformMemZero(&set->TrafficOut, sizeof(set->TrafficOut));
+    set->McastRateCount  = 0;
+    set->McastRateStart  = m->timenow;
+    set->McastRate       = 0;
+    QueryBucketInit(&set->QueryBucket, m->timenow, QueryFloodInterfaceBurst);
     set->IPv4Available   = (mDNSu8)(set->ip.type == mDNSAddrType_IPv4 && set->McastTxRx);
     set->IPv6Available   = (mDNSu8)(set->ip.type == mDNSAddrType_IPv6 && set->McastTxRx);
 
@@ -13038,6 +15275,7 @@ mDNSexport mStatus mDNS_RegisterInterface(mDNS *const m, NetworkInterfaceInfo *s
 
     set->next = mDNSNULL;
     *p = set;
+    if (set->InterfaceActive) RehashInterfaceID(m, set);    // set is the first entry for its InterfaceID
 
     if (set->Advertise) AdvertiseInterfaceIfNeeded(m, set);
 
@@ -13063,6 +15301,7 @@ mDNSexport mStatus mDNS_RegisterInterface(mDNS *const m, NetworkInterfaceInfo *s
     if (set->McastTxRx && (FirstOfType || set->InterfaceActive))
     {
         DNSQuestion *q;
+        mDNSu32 count = 0, started = 0;
         // Normally, after an interface comes up, we pause half a second before beginning probing.
         // This is to guard against cases where there's rapid interface changes, where we could be confused by
         // seeing packets we ourselves sent just moments ago (perhaps when this interface had a different address)
@@ -13137,45 +15376,50 @@ mDNSexport mStatus mDNS_RegisterInterface(mDNS *const m, NetworkInterfaceInfo *s
         LogRedact(MDNS_LOG_CATEGORY_MDNS, MDNS_LOG_DEBUG, "Setting AnnounceOwner");
 
         m->mDNSStats.InterfaceUp++;
+        // As in mDNSCoreRestartQueries, reactivate the newest questions first, and spread them out if there are a lot
+        for (q = m->Questions; q; q=q->next)
+            if (QuestionUsesInterface(q, set)) count++;
+        NoteQuestionRestarts(m, count);
         for (q = m->Questions; q; q=q->next)                                // Scan our list of questions
         {
-            if (mDNSOpaque16IsZero(q->TargetQID))
-            {
-                if (!q->InterfaceID || q->InterfaceID == set->InterfaceID)      // If non-specific Q, or Q on this specific interface,
-                {                                                               // then reactivate this question
+            if (QuestionUsesInterface(q, set))                              // If multicast Q that can go out on this interface,
+            {                                                               // then reactivate this question
+                const mDNSs32 restartdelay = QuestionRestartDelay(count - ++started, count);
 #if MDNSRESPONDER_SUPPORTS(APPLE, SLOW_ACTIVATION)
-                    // If flapping, delay between first and second queries is nine seconds instead of one second
-                    mDNSBool dodelay = (activationSpeed == SlowActivation) && (q->FlappingInterface1 == set->InterfaceID || q->FlappingInterface2 == set->InterfaceID);
-                    mDNSs32 initial  = dodelay ? InitialQuestionInterval * QuestionIntervalStep2 : InitialQuestionInterval;
-                    mDNSs32 qdelay   = dodelay ? kDefaultQueryDelayTimeForFlappingInterface : 0;
-                    if (dodelay)
-                    {
-                        LogRedact(MDNS_LOG_CATEGORY_MDNS, MDNS_LOG_INFO,
-                            "No cache records expired for the question " PRI_DM_NAME " (" PUB_S ");"
-                            " delaying it by %d seconds", DM_NAME_PARAM(&q->qname), DNSTypeName(q->qtype), qdelay);
-                    }
+                // If flapping, delay between first and second queries is nine seconds instead of one second
+                mDNSBool dodelay = (activationSpeed == SlowActivation) && (q->FlappingInterface1 == set->InterfaceID || q->FlappingInterface2 == set->InterfaceID);
+                mDNSs32 initial  = dodelay ? InitialQuestionInterval * QuestionIntervalStep2 : InitialQuestionInterval;
+                mDNSs32 qdelay   = dodelay ? kDefaultQueryDelayTimeForFlappingInterface : 0;
+                if (dodelay)
+                {
+                    LogRedact(MDNS_LOG_CATEGORY_MDNS, MDNS_LOG_INFO,
+                        "No cache records expired for the question " PRI_DM_NAME " (" PUB_S ");"
+                        " delaying it by %d seconds", DM_NAME_PARAM(&q->qname), DNSTypeName(q->qtype), qdelay);
+                }
 #else
-                    mDNSs32 initial  = InitialQuestionInterval;
-                    mDNSs32 qdelay   = 0;
+                mDNSs32 initial  = InitialQuestionInterval;
+                mDNSs32 qdelay   = 0;
 #endif
 
-                    if (!q->ThisQInterval || q->ThisQInterval > initial)
-                    {
-                        q->ThisQInterval  = initial;
-                        q->RequestUnicast = kDefaultRequestUnicastCount;
-                    }
-                    q->LastQTime = m->timenow - q->ThisQInterval + qdelay;
-                    q->RecentAnswerPkts = 0;
-                    SetNextQueryTime(m,q);
+                if (!q->ThisQInterval || q->ThisQInterval > initial)
+                {
+                    q->ThisQInterval  = initial;
+                    q->RequestUnicast = kDefaultRequestUnicastCount;
                 }
+                q->LastQTime = m->timenow - q->ThisQInterval + qdelay + restartdelay;
+                q->RecentAnswerPkts = 0;
+                if (restartdelay) m->mDNSStats.QuestionRestartsSpread++;
+                SetNextQueryTime(m,q);
             }
         }
 
         // For all our non-specific authoritative resource records (and any dormant records specific to this interface)
-        // we now need them to re-probe if necessary, and then re-announce.
+        // we now need them to re-probe if necessary, and then re-announce. Records the platform would never send
+        // on this interface are left alone, so they don't re-announce on all the other interfaces.
         for (rr = m->ResourceRecords; rr; rr=rr->next)
         {
-            if (!rr->resrec.InterfaceID || rr->resrec.InterfaceID == set->InterfaceID)
+            if (rr->resrec.InterfaceID == set->InterfaceID ||
+                (!rr->resrec.InterfaceID && mDNSPlatformValidRecordForInterface(rr, set->InterfaceID)))
             {
                 mDNSCoreRestartRegistration(m, rr, numannounce);
             }
@@ -13248,6 +15492,7 @@ mDNSexport void mDNS_DeregisterInterface(mDNS *const m, NetworkInterfaceInfo *se
     // Unlink this record from our list
     *p = (*p)->next;
     set->next = mDNSNULL;
+    if (FirstInterfaceForID(m, set->InterfaceID) == set) RehashInterfaceID(m, set);
 
     if (!set->InterfaceActive)
     {
@@ -13318,7 +15563,7 @@ mDNSexport void mDNS_DeregisterInterface(mDNS *const m, NetworkInterfaceInfo *se
                 if (mDNSOpaque16IsZero(q->TargetQID))                   // Only deactivate multicast quesstions. (Unicast questions are stopped when/if the associated DNS server group goes away.)
                 {
                     if (q->InterfaceID == set->InterfaceID) q->ThisQInterval = 0;
-                    if (!q->InterfaceID || q->InterfaceID == set->InterfaceID)
+                    if (QuestionUsesInterface(q, set))
                     {
                         q->FlappingInterface2 = q->FlappingInterface1;
                         q->FlappingInterface1 = set->InterfaceID;       // Keep history of the last two interfaces to go away
@@ -13959,7 +16204,7 @@ mDNSlocal void mDNSCoreReceiveRawARP(mDNS *const m, const ARP_EthIP *const arp,
     // -- and we check for these in Pass 2 below.
     if (mDNSSameOpaque16(arp->op, ARP_op_request) && !mDNSSameIPv4Address(arp->spa, arp->tpa))
     {
-        for (rr = m->ResourceRecords; rr; rr=rr->next)
+        for (rr = FirstRecordForProxyAddress(m, SPSv4HashSlot(&arp->tpa)); rr; rr=rr->NextInAddressHash)
             if (rr->resrec.InterfaceID == InterfaceID && rr->resrec.RecordType != kDNSRecordTypeDeregistering &&
                 rr->AddressProxy.type == mDNSAddrType_IPv4 && mDNSSameIPv4Address(rr->AddressProxy.ip.v4, arp->tpa))
             {
@@ -14004,7 +16249,7 @@ mDNSlocal void mDNSCoreReceiveRawARP(mDNS *const m, const ARP_EthIP *const arp,
     else
     {
         if (!mDNSSameIPv4Address(arp->spa, zerov4Addr))
-            for (rr = m->ResourceRecords; rr; rr=rr->next)
+            for (rr = FirstRecordForProxyAddress(m, SPSv4HashSlot(&arp->spa)); rr; rr=rr->NextInAddressHash)
                 if (rr->resrec.InterfaceID == InterfaceID && rr->resrec.RecordType != kDNSRecordTypeDeregistering &&
                     rr->AddressProxy.type == mDNSAddrType_IPv4 && mDNSSameIPv4Address(rr->AddressProxy.ip.v4, arp->spa) && (rr->ProbeRestartCount < MAX_PROBE_RESTARTS))
                 {
@@ -14065,7 +16310,7 @@ mDNSlocal void mDNSCoreReceiveRawND(mDNS *const m, const mDNSEthAddr *const sha,
     {
         //const mDNSEthAddr *const sha = GetLinkLayerAddressOption(ndp, end, NDP_SrcLL);
         (void)end;
-        for (rr = m->ResourceRecords; rr; rr=rr->next)
+        for (rr = FirstRecordForProxyAddress(m, SPSv6HashSlot(&ndp->target)); rr; rr=rr->NextInAddressHash)
             if (rr->resrec.InterfaceID == InterfaceID && rr->resrec.RecordType != kDNSRecordTypeDeregistering &&
                 rr->AddressProxy.type == mDNSAddrType_IPv6 && mDNSSameIPv6Address(rr->AddressProxy.ip.v6, ndp->target))
             {
@@ -14107,7 +16352,7 @@ mDNSlocal void mDNSCoreReceiveRawND(mDNS *const m, const mDNSEthAddr *const sha,
         // Hence it is the NDP target address we care about, not the actual packet source address.
         if (ndp->type == NDP_Adv) spa = &ndp->target;
         if (!mDNSSameIPv6Address(*spa, zerov6Addr))
-            for (rr = m->ResourceRecords; rr; rr=rr->next)
+            for (rr = FirstRecordForProxyAddress(m, SPSv6HashSlot(spa)); rr; rr=rr->NextInAddressHash)
                 if (rr->resrec.InterfaceID == InterfaceID && rr->resrec.RecordType != kDNSRecordTypeDeregistering &&
                     rr->AddressProxy.type == mDNSAddrType_IPv6 && mDNSSameIPv6Address(rr->AddressProxy.ip.v6, *spa) && (rr->ProbeRestartCount < MAX_PROBE_RESTARTS))
                 {
@@ -14291,13 +16536,13 @@ mDNSlocal void mDNSCoreReceiveRawTransportPacket(mDNS *const m, const mDNSEthAdd
         AuthRecord *rr, *r2;
 
         mDNS_Lock(m);
-        for (rr = m->ResourceRecords; rr; rr=rr->next)
+        for (rr = FirstRecordForProxyAddress(m, SPSAddressHashSlot(dst)); rr; rr=rr->NextInAddressHash)
             if (rr->resrec.InterfaceID == InterfaceID &&
                 rr->resrec.RecordType != kDNSRecordTypeDeregistering &&
                 rr->AddressProxy.type && mDNSSameAddress(&rr->AddressProxy, dst))
             {
                 const mDNSu8 *const tp = (protocol == 6) ? (const mDNSu8 *)"\x4_tcp" : (const mDNSu8 *)"\x4_udp";
-                for (r2 = m->ResourceRecords; r2; r2=r2->next)
+                for (r2 = FirstRecordForOwner(m, &rr->WakeUp.HMAC); r2; r2=r2->NextInOwnerHash)
                     if (r2->resrec.InterfaceID == InterfaceID && mDNSSameEthAddress(&r2->WakeUp.HMAC, &rr->WakeUp.HMAC) &&
                         r2->resrec.RecordType != kDNSRecordTypeDeregistering &&
                         r2->resrec.rrtype == kDNSType_SRV && mDNSSameIPPort(r2->resrec.rdata->u.srv.port, port) &&
@@ -14470,6 +16715,187 @@ mDNSexport void mDNS_GrowCache(mDNS *const m, CacheEntity *storage, mDNSu32 numr
     mDNS_Unlock(m);
 }
 
+mDNSexport void mDNS_GrowCacheReleasable(mDNS *const m, CacheEntity *storage, mDNSu32 numrecords)
+{
+    if (!storage) return;
+    mDNS_Lock(m);
+    if (numrecords < 2 ||
+        (m->rrcache_mem_limit && (m->rrcache_size + numrecords - 1) * sizeof(CacheEntity) > m->rrcache_mem_limit))
+    {
+        LogInfo("mDNS_GrowCacheReleasable: not growing cache of %u entities by %u (limit %u bytes)",
+                m->rrcache_size, numrecords, m->rrcache_mem_limit);
+        m->rrcache_grow_refused = mDNStrue;
+        mDNSPlatformMemFree(storage);
+    }
+    else
+    {
+        CacheBlock *const b = (CacheBlock *)storage;
+        CacheBlock **bp = &m->rrcache_blocks;
+        mDNSu32 i;
+        for (i = 1; i < numrecords - 1; i++) storage[i].next = &storage[i+1];
+        storage[numrecords-1].next = mDNSNULL;
+        b->next  = mDNSNULL;
+        b->free  = &storage[1];
+        b->count = numrecords - 1;
+        b->used  = 0;
+        while (*bp) bp = &(*bp)->next;
+        *bp = b;
+        m->rrcache_size += b->count;
+    }
+    mDNS_Unlock(m);
+}
+
+// Cache snapshots let a platform layer carry the multicast cache across a restart, so clients get answers
+// straight away instead of waiting for the first round of queries. The format is private to this file:
+// a small header followed by one uncompressed resource record per cache entry, each prefixed with the
+// interface index it was received on. The platform layer owns the storage; the core does no file I/O.
+#define CacheSnapshotMagic       0x6D43534E  // 'mCSN'
+#define CacheSnapshotVersion     1
+#define CacheSnapshotHeaderSize  16
+
+mDNSlocal mDNSu8 *putSnapshotU32(mDNSu8 *ptr, mDNSu32 val)
+{
+    ptr[0] = (mDNSu8)((val >> 24) & 0xFF);
+    ptr[1] = (mDNSu8)((val >> 16) & 0xFF);
+    ptr[2] = (mDNSu8)((val >>  8) & 0xFF);
+    ptr[3] = (mDNSu8)( val        & 0xFF);
+    return(ptr + 4);
+}
+
+mDNSlocal mDNSu32 getSnapshotU32(const mDNSu8 *ptr)
+{
+    return((mDNSu32)ptr[0] << 24 | (mDNSu32)ptr[1] << 16 | (mDNSu32)ptr[2] << 8 | ptr[3]);
+}
+
+mDNSexport mDNSu32 mDNS_SnapshotCache(mDNS *const m, mDNSu8 *buffer, mDNSu32 length)
+{
+    const mDNSu8 *const limit = buffer + length;
+    mDNSu8 *ptr = buffer + CacheSnapshotHeaderSize;
+    mDNSu32 count = 0;
+    mDNSu32 slot;
+    CacheGroup *cg;
+    CacheRecord *cr;
+
+    if (length < CacheSnapshotHeaderSize) return(0);
+
+    mDNS_Lock(m);
+    FORALL_CACHERECORDS(slot, cg, cr)
+    {
+        const mDNSs32 remain = (RRExpireTime(cr) - m->timenow) / mDNSPlatformOneSecond;
+        mDNSu8 *const start = ptr;
+        mDNSu8 *rdata;
+        mDNSu16 rrclass;
+
+        // Unicast answers belong to whatever DNS configuration we come back up with, so we don't keep those,
+        // and records that are about to expire or haven't been delivered yet aren't worth restoring either
+        if (!cr->resrec.InterfaceID || cr->resrec.RecordType == kDNSRecordTypePacketNegative) continue;
+        if (cr->DelayDelivery || remain < 1) continue;
+
+        if (ptr + 4 > limit) break;
+        ptr = putSnapshotU32(ptr, mDNSPlatformInterfaceIndexfromInterfaceID(m, cr->resrec.InterfaceID, mDNStrue));
+        ptr = putDomainNameAsLabels(mDNSNULL, ptr, limit, cr->resrec.name);
+        if (!ptr || ptr + 10 > limit) { ptr = start; break; }
+        rrclass = cr->resrec.rrclass;
+        if (cr->resrec.RecordType & kDNSRecordTypePacketUniqueMask) rrclass |= kDNSClass_UniqueRRSet;
+        ptr[0] = (mDNSu8)(cr->resrec.rrtype >> 8);
+        ptr[1] = (mDNSu8)(cr->resrec.rrtype &  0xFF);
+        ptr[2] = (mDNSu8)(rrclass >> 8);
+        ptr[3] = (mDNSu8)(rrclass &  0xFF);
+        putSnapshotU32(ptr + 4, (mDNSu32)remain);
+        rdata = putRData(mDNSNULL, ptr + 10, limit, &cr->resrec);
+        if (!rdata) { ptr = start; break; }
+        ptr[8] = (mDNSu8)((rdata - ptr - 10) >> 8);
+        ptr[9] = (mDNSu8)((rdata - ptr - 10) &  0xFF);
+        ptr = rdata;
+        count++;
+    }
+
+    putSnapshotU32(buffer, CacheSnapshotMagic);
+    buffer[4] = (mDNSu8)(CacheSnapshotVersion >> 8);
+    buffer[5] = (mDNSu8)(CacheSnapshotVersion &  0xFF);
+    buffer[6] = buffer[7] = 0;
+    putSnapshotU32(buffer + 8, (mDNSu32)mDNSPlatformUTC());
+    putSnapshotU32(buffer + 12, count);
+    mDNS_Unlock(m);
+
+    LogInfo("mDNS_SnapshotCache: saved %u records (%u bytes)", count, (mDNSu32)(ptr - buffer));
+    return((mDNSu32)(ptr - buffer));
+}
+
+mDNSexport mDNSu32 mDNS_ForEachCachedAddress(mDNS *const m, mDNS_CachedAddressCallback *callback, void *context)
+{
+    mDNSu32 count = 0;
+    mDNSu32 slot;
+    CacheGroup *cg;
+    CacheRecord *cr;
+
+    mDNS_Lock(m);
+    FORALL_CACHERECORDS(slot, cg, cr)
+    {
+        mDNSs32 remain;
+        if (cr->resrec.rrtype != kDNSType_A && cr->resrec.rrtype != kDNSType_AAAA) continue;
+        if (!cr->resrec.InterfaceID || cr->resrec.RecordType == kDNSRecordTypePacketNegative || cr->DelayDelivery) continue;
+        remain = (RRExpireTime(cr) - m->timenow) / mDNSPlatformOneSecond;
+        if (remain < 1) continue;
+        callback(context, &cr->resrec, mDNSPlatformInterfaceIndexfromInterfaceID(m, cr->resrec.InterfaceID, mDNStrue), (mDNSu32)remain);
+        count++;
+    }
+    mDNS_Unlock(m);
+    return(count);
+}
+
+mDNSexport mDNSu32 mDNS_RestoreCacheSnapshot(mDNS *const m, const mDNSu8 *snapshot, mDNSu32 length)
+{
+    const mDNSu8 *const end = snapshot + length;
+    const mDNSu8 *ptr = snapshot + CacheSnapshotHeaderSize;
+    mDNSu32 count, restored = 0;
+    mDNSs32 elapsed;
+
+    if (length < CacheSnapshotHeaderSize || getSnapshotU32(snapshot) != CacheSnapshotMagic ||
+        (mDNSu16)((mDNSu16)snapshot[4] << 8 | snapshot[5]) != CacheSnapshotVersion)
+    {
+        LogMsg("mDNS_RestoreCacheSnapshot: ignoring snapshot with unrecognized header (%u bytes)", length);
+        return(0);
+    }
+    // If the clock went backwards we can't tell how old the snapshot is, so treat it as stale
+    elapsed = mDNSPlatformUTC() - (mDNSs32)getSnapshotU32(snapshot + 8);
+    if (elapsed < 0) return(0);
+    count = getSnapshotU32(snapshot + 12);
+
+    mDNS_Lock(m);
+    while (count-- && ptr && ptr + 4 <= end)
+    {
+        const mDNSInterfaceID InterfaceID = mDNSPlatformInterfaceIDfromInterfaceIndex(m, getSnapshotU32(ptr));
+        CacheGroup *cg;
+        CacheRecord *cr;
+
+        ptr = GetLargeResourceRecord(m, (const DNSMessage *)snapshot, ptr + 4, end, InterfaceID, kDNSRecordTypePacketAns, &m->rec);
+        if (!ptr || m->rec.r.resrec.RecordType == kDNSRecordTypePacketNegative) { mDNSCoreResetRecord(m); break; }
+
+        // Skip records for interfaces that didn't come back, ones that expired while we were down,
+        // and anything a packet has already put into the cache since mDNS_Init
+        if (!InterfaceID || m->rec.r.resrec.rroriginalttl <= (mDNSu32)elapsed) { mDNSCoreResetRecord(m); continue; }
+        m->rec.r.resrec.rroriginalttl -= (mDNSu32)elapsed;
+
+        cg = CacheGroupForRecord(m, &m->rec.r.resrec);
+        for (cr = cg ? cg->members : mDNSNULL; cr; cr = cr->next)
+            if (cr->resrec.InterfaceID == InterfaceID && IdenticalSameNameRecord(&cr->resrec, &m->rec.r.resrec)) break;
+
+        // Restored records are answers nobody has vouched for since we restarted, so schedule a reconfirmation:
+        // if the network still has them, the query refreshes them in place; if not, they age out quickly.
+        if (!cr && (cr = CreateNewCacheEntry(m, HashSlotFromNameHash(m, m->rec.r.resrec.namehash), cg, 0, mDNStrue, mDNSNULL)) != mDNSNULL)
+        {
+            mDNS_Reconfirm_internal(m, cr, kDefaultReconfirmTimeForNoAnswer);
+            restored++;
+        }
+        mDNSCoreResetRecord(m);
+    }
+    mDNS_Unlock(m);
+
+    LogInfo("mDNS_RestoreCacheSnapshot: restored %u records from a snapshot %d seconds old", restored, elapsed);
+    return(restored);
+}
+
 mDNSlocal mStatus mDNS_InitStorage(mDNS *const m, mDNS_PlatformSupport *const p,
                                    CacheEntity *rrcachestorage, mDNSu32 rrcachesize,
                                    mDNSBool AdvertiseLocalAddresses, mDNSCallback *Callback, void *Context)
@@ -14492,6 +16918,7 @@ mDNSlocal mStatus mDNS_InitStorage(mDNS *const m, mDNS_PlatformSupport *const p,
     m->MainCallback                  = Callback;
     m->MainContext                   = Context;
     m->rec.r.resrec.RecordType       = 0;
+    m->PacketRing                    = mDNSNULL;
 
     // For debugging: To catch and report locking failures
     m->mDNS_busy               = 0;
@@ -14551,23 +16978,61 @@ mDNSlocal mStatus mDNS_InitStorage(mDNS *const m, mDNS_PlatformSupport *const p,
     m->LocalOnlyQuestions      = mDNSNULL;
     m->NewLocalOnlyQuestions   = mDNSNULL;
     m->RestartQuestion         = mDNSNULL;
+    m->NextHashedQuestion      = mDNSNULL;
+    m->NextQuestionSeq         = 0;
+    for (slot = 0; slot < QUESTION_HASH_SLOTS; slot++) m->QuestionHash[slot] = mDNSNULL;
     m->rrcache_size            = 0;
     m->rrcache_totalused       = 0;
     m->rrcache_active          = 0;
     m->rrcache_report          = 10;
     m->rrcache_free            = mDNSNULL;
 
+    m->rrcache_hash            = m->rrcache_hash_initial;
+    m->rrcache_checkheap       = mDNSNULL;
+    InitMemSlabs(m);
+    m->rrcache_lru             = mDNSNULL;
+    m->rrcache_lru_tail        = mDNSNULL;
+    m->rrcache_evictions       = 0;
+    m->rrcache_evict_second    = 0;
+    m->rrcache_evict_rate      = 0;
+    m->rrcache_evict_peak      = 0;
+    m->rrcache_evict_window    = 0;
+    m->rrcache_evict_age       = 0;
+    m->rrcache_evict_age_max   = 0;
+    mDNSPlatformMemZero(m->rrcache_partitions, sizeof(m->rrcache_partitions));
+    m->rrcache_partition_quota     = CachePartitionDefaultQuota;
+    m->rrcache_partition_evictions = 0;
+    m->rrcache_partition_overflow  = 0;
+    m->ResponseFilter          = mDNSfalse;
+    m->PassiveCacheBudget      = 0;
+    m->PassiveCacheUsed        = 0;
+    m->PassiveCacheWindow      = 0;
+    m->ResponseFilterAccepted  = 0;
+    m->ResponseFilterPassive   = 0;
+    m->ResponseFilterRejected  = 0;
+    m->rrcache_slots           = CACHE_HASH_SLOTS;
+    m->rrcache_hash_base       = CACHE_HASH_SLOTS;
+    m->rrcache_hash_capacity   = CACHE_HASH_SLOTS;
+    m->rrcache_groups          = 0;
+    m->NextCacheResize         = 0;
+    m->rrcache_blocks          = mDNSNULL;
+    m->rrcache_mem_limit       = 0;
+    m->rrcache_grow_refused    = mDNSfalse;
+    m->NextCacheShrink         = 0;
+    m->rrcache_blocks_released = 0;
     for (slot = 0; slot < CACHE_HASH_SLOTS; slot++)
-    {
-        m->rrcache_hash[slot]      = mDNSNULL;
-        m->rrcache_nextcheck[slot] = timenow + FutureTime;;
-    }
+        m->rrcache_hash[slot] = mDNSNULL;
 
     mDNS_GrowCache_internal(m, rrcachestorage, rrcachesize);
     m->rrauth.rrauth_free            = mDNSNULL;
+    m->rrauth.rrauth_size            = 0;
+    m->rrauth.rrauth_mem_limit       = 0;
+    m->rrauth.rrauth_released        = 0;
 
     for (slot = 0; slot < AUTH_HASH_SLOTS; slot++)
         m->rrauth.rrauth_hash[slot] = mDNSNULL;
+    m->rrauth.rrauth_table = mDNSNULL;
+    m->rrauth.rrauth_slots = 0;
 
     // Fields below only required for mDNS Responder...
     m->hostlabel.c[0]          = 0;
@@ -14583,7 +17048,18 @@ mDNSlocal mStatus mDNS_InitStorage(mDNS *const m, mDNS_PlatformSupport *const p,
     m->NewLocalRecords         = mDNSNULL;
     m->NewLocalOnlyRecords     = mDNSfalse;
     m->CurrentRecord           = mDNSNULL;
+    m->NextHashedRecord        = mDNSNULL;
+    for (slot = 0; slot < AUTH_HASH_SLOTS; slot++) m->ResourceRecordHash[slot] = mDNSNULL;
+    m->NextOwnerRecord         = mDNSNULL;
+    m->KeepaliveHeap           = mDNSNULL;
+    for (slot = 0; slot < SPS_HASH_SLOTS; slot++)
+    {
+        m->SPSOwnerHash[slot]     = mDNSNULL;
+        m->SPSAddressHash[slot]   = mDNSNULL;
+        m->SPSKeepaliveHash[slot] = mDNSNULL;
+    }
     m->HostInterfaces          = mDNSNULL;
+    for (slot = 0; slot < INTERFACE_HASH_SLOTS; slot++) m->InterfaceIDHash[slot] = mDNSNULL;
     m->ProbeFailTime           = 0;
     m->NumFailedProbes         = 0;
     m->SuppressProbes          = 0;
@@ -14594,6 +17070,8 @@ mDNSlocal mStatus mDNS_InitStorage(mDNS *const m, mDNS_PlatformSupport *const p,
 
 #if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
     m->DNSServers               = mDNSNULL;
+    m->DNSServerIndex.built     = mDNSfalse;
+    m->DNSTCPConnections        = mDNSNULL;
 #endif
 
     m->Router                   = zeroAddr;
@@ -14632,6 +17110,8 @@ mDNSlocal mStatus mDNS_InitStorage(mDNS *const m, mDNS_PlatformSupport *const p,
     m->LastNATupseconds         = 0;
     m->LastNATReplyLocalTime    = timenow;
     m->LastNATMapResultCode     = NATErr_None;
+    m->NATGatewayLatency        = 0;
+    m->NATGatewayMaxLatency     = 0;
 
     m->UPnPInterfaceID          = 0;
     m->SSDPSocket               = mDNSNULL;
@@ -14786,6 +17266,10 @@ mDNSexport void DNSServerChangeForQuestion(mDNS *const m, DNSQuestion *q, DNSSer
     // of events for all of them are consistent. Duplicates for a question are always inserted
     // after in the list.
     q->qDNSServer = new;
+    // Any race was between the old server and one picked relative to it, which may be about to be freed
+    q->raceState    = UnicastRace_None;
+    q->raceServer   = mDNSNULL;
+    q->uDNSSendTime = 0;
     for (qptr = q->next ; qptr; qptr = qptr->next)
     {
         if (qptr->DuplicateOf == q) { qptr->validDNSServers = q->validDNSServers; qptr->qDNSServer = new; }
@@ -14812,6 +17296,7 @@ mDNSlocal void SetConfigState(mDNS *const m, mDNSBool delete)
                 NumUnreachableDNSServers--;
 #endif
         }
+        m->DNSServerIndex.built = mDNSfalse;
 #endif
         // We handle the mcast resolvers here itself as mDNSPlatformSetDNSConfig looks at
         // mcast resolvers. Today we get both mcast and ucast configuration using the same
@@ -14825,12 +17310,13 @@ mDNSlocal void SetConfigState(mDNS *const m, mDNSBool delete)
         for (ptr = m->DNSServers; ptr; ptr = ptr->next)
         {
             ptr->penaltyTime = 0;
-            ptr->flags &= ~DNSServerFlag_Delete;
+            ptr->flags &= ~(DNSServerFlag_Delete | DNSServerFlag_Changed);
 #if MDNSRESPONDER_SUPPORTS(APPLE, SYMPTOMS)
             if (ptr->flags & DNSServerFlag_Unreachable)
                 NumUnreachableDNSServers++;
 #endif
         }
+        m->DNSServerIndex.built = mDNSfalse;
 #endif
         for (mr = m->McastResolvers; mr; mr = mr->next)
             mr->flags &= ~McastResolver_FlagDelete;
@@ -14854,6 +17340,132 @@ mDNSlocal void SetDynDNSHostNameIfChanged(mDNS *const m, domainname *const fqdn)
     }
 }
 
+#if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+// What a DNS configuration change did to the DNS server list, so that uDNS_SetupDNSConfig need only re-target the
+// questions and cache records it can affect. A question's valid servers are the matching servers for the longest
+// domain its name falls under, in list order, so its choice can only change if a server for one of those domains was
+// added, deleted, altered, or moved relative to the others. We note the domains of all such servers; questions and
+// records under none of them keep their servers, with their valid server bits renumbered to suit the new list.
+#define DNSConfigChangeMaxServers   ((int)(sizeof(mDNSOpaque128) * mDNSNBBY))
+#define DNSConfigChangeMaxDomains   (2 * DNSConfigChangeMaxServers)
+
+typedef struct
+{
+    mDNSBool all;                                           // Treat every name as affected
+    int domainCount;
+    mDNSu32 domainHash[DNSConfigChangeMaxDomains];
+    const domainname *domain[DNSConfigChangeMaxDomains];    // Point into m->DNSServers, so valid until servers are freed
+    int oldCount;
+    const DNSServer *old[DNSConfigChangeMaxServers];        // The list before the change, indexed as validDNSServers was
+    mDNSs16 newIndex[DNSConfigChangeMaxServers];            // Each old server's index now, or -1 if its domain is affected
+} DNSConfigChange;
+
+mDNSlocal void DNSConfigChangeSnapshot(const mDNS *const m, DNSConfigChange *const change)
+{
+    const DNSServer *s;
+
+    change->all         = mDNSfalse;
+    change->domainCount = 0;
+    change->oldCount    = 0;
+    for (s = m->DNSServers; s; s = s->next)
+    {
+        if (s->flags & DNSServerFlag_Delete) continue;
+        if (change->oldCount == DNSConfigChangeMaxServers) { change->all = mDNStrue; break; }
+        change->old[change->oldCount++] = s;
+    }
+}
+
+mDNSlocal void DNSConfigChangeNoteDomain(DNSConfigChange *const change, const domainname *const domain)
+{
+    mDNSu32 hash;
+    int i;
+
+    if (change->all) return;
+    // Every name is under the root, so a change to the default servers touches everything
+    if (!domain->c[0] || change->domainCount == DNSConfigChangeMaxDomains) { change->all = mDNStrue; return; }
+    hash = DomainNameHashValue(domain);
+    for (i = 0; i < change->domainCount; i++)
+    {
+        if (change->domainHash[i] == hash && SameDomainName(change->domain[i], domain)) return;
+    }
+    change->domainHash[change->domainCount] = hash;
+    change->domain[change->domainCount++]   = domain;
+}
+
+// Compares the server list as mDNSPlatformSetDNSConfig left it with the snapshot. Servers the new configuration
+// dropped are still in the list, flagged for deletion; ones it added or altered are flagged as changed; and the ones it
+// kept have been moved to the end of the list in their new order.
+mDNSlocal void DNSConfigChangeCompare(const mDNS *const m, DNSConfigChange *const change)
+{
+    const DNSServer *s;
+    int i, index = 0;
+
+    for (s = m->DNSServers; s; s = s->next)
+    {
+        if (s->flags & (DNSServerFlag_Delete | DNSServerFlag_Changed)) DNSConfigChangeNoteDomain(change, &s->domain);
+    }
+    if (change->all) return;
+
+    // Walk the unchanged servers in their old and new order side by side. One that isn't where it was has moved
+    // relative to the others, which may change which of them a question tries first.
+    for (i = 0; i < change->oldCount; i++) change->newIndex[i] = -1;
+    i = 0;
+    for (s = m->DNSServers; s; s = s->next)
+    {
+        if (s->flags & DNSServerFlag_Delete) continue;
+        if (!(s->flags & DNSServerFlag_Changed))
+        {
+            while (i < change->oldCount && (change->old[i]->flags & (DNSServerFlag_Delete | DNSServerFlag_Changed))) i++;
+            if (i == change->oldCount) { change->all = mDNStrue; return; }
+            if (change->old[i] == s)
+            {
+                change->newIndex[i] = (mDNSs16)index;
+            }
+            else
+            {
+                DNSConfigChangeNoteDomain(change, &s->domain);
+                DNSConfigChangeNoteDomain(change, &change->old[i]->domain);
+            }
+            i++;
+        }
+        index++;
+    }
+}
+
+mDNSlocal mDNSBool DNSConfigChangeAffectsName(const DNSConfigChange *const change, const domainname *const name)
+{
+    const domainname *suffix;
+    int i;
+
+    if (change->all) return mDNStrue;
+    if (!change->domainCount) return mDNSfalse;
+    for (suffix = name; suffix->c[0]; suffix = (const domainname *)(suffix->c + 1 + suffix->c[0]))
+    {
+        const mDNSu32 hash = DomainNameHashValue(suffix);
+        for (i = 0; i < change->domainCount; i++)
+        {
+            if (change->domainHash[i] == hash && SameDomainName(change->domain[i], suffix)) return mDNStrue;
+        }
+    }
+    return mDNSfalse;
+}
+
+// Renumbers the valid server bits of a question the change didn't affect, so it carries on with the servers it has
+// yet to try. Every server it could have a bit for is one that kept its place.
+mDNSlocal void DNSConfigChangeRenumber(const DNSConfigChange *const change, DNSQuestion *const q)
+{
+    mDNSOpaque128 bits = zeroOpaque128;
+    int i;
+
+    for (i = 0; i < change->oldCount; i++)
+    {
+        if (bit_get_opaque64(q->validDNSServers, i) && change->newIndex[i] >= 0)
+            bit_set_opaque128(bits, change->newIndex[i]);
+    }
+    q->validDNSServers = bits;
+}
+#endif // !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+
 // Even though this is called “Setup” it is not called just once at startup.
 // It’s actually called multiple times, every time there’s a configuration change.
 mDNSexport mStatus uDNS_SetupDNSConfig(mDNS *const m)
@@ -14869,6 +17481,7 @@ mDNSexport mStatus uDNS_SetupDNSConfig(mDNS *const m)
     DNSServer   *ptr, **p = &m->DNSServers;
     const DNSServer *oldServers = m->DNSServers;
     DNSQuestion *q;
+    DNSConfigChange change;
 #endif
     McastResolver *mr, **mres = &m->McastResolvers;
 #if MDNSRESPONDER_SUPPORTS(COMMON, DNS_PUSH) && !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
@@ -14889,6 +17502,9 @@ mDNSexport mStatus uDNS_SetupDNSConfig(mDNS *const m)
     // configuration. We already processed search domains in uDNS_SetupWABQueries above and
     // hence we are ready to ack the configuration as this is the last call to mDNSPlatformSetConfig
     // for the dns configuration change notification.
+#if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+    DNSConfigChangeSnapshot(m, &change);
+#endif
     SetConfigState(m, mDNStrue);
     if (!mDNSPlatformSetDNSConfig(mDNStrue, mDNSfalse, &fqdn, mDNSNULL, mDNSNULL, mDNStrue))
     {
@@ -14953,6 +17569,12 @@ mDNSexport mStatus uDNS_SetupDNSConfig(mDNS *const m)
     DNS64RestartQuestions(m);
 #endif
 
+    // Only questions and records under the domains of the servers that changed need another look. On a VPN connect
+    // that's typically the split DNS domains it brings and nothing else.
+    DNSConfigChangeCompare(m, &change);
+    if (change.all) LogInfo("uDNS_SetupDNSConfig: Default DNS servers changed; re-targeting all questions");
+    else            LogInfo("uDNS_SetupDNSConfig: DNS servers changed for %d domains", change.domainCount);
+
     // First, restart questions whose suppression status will change. The suppression status of each question in a given
     // question set, i.e., a non-duplicate question and all of its duplicates, if any, may or may not change. For example,
     // a suppressed (or non-suppressed) question that is currently a duplicate of a suppressed (or non-suppressed) question
@@ -14965,6 +17587,11 @@ mDNSexport mStatus uDNS_SetupDNSConfig(mDNS *const m)
         mDNSBool oldSuppressed;
 
         if (mDNSOpaque16IsZero(q->TargetQID)) continue;
+        if (!DNSConfigChangeAffectsName(&change, &q->qname))
+        {
+            DNSConfigChangeRenumber(&change, q);
+            continue;
+        }
 
         SetValidDNSServers(m, q);
         q->triedAllServersOnce = mDNSfalse;
@@ -15010,6 +17637,7 @@ mDNSexport mStatus uDNS_SetupDNSConfig(mDNS *const m)
         const DNSServer *t;
 
         if (mDNSOpaque16IsZero(q->TargetQID) || q->DuplicateOf) continue;
+        if (!DNSConfigChangeAffectsName(&change, &q->qname)) continue;
 
         SetValidDNSServers(m, q);
         q->triedAllServersOnce = mDNSfalse;
@@ -15061,6 +17689,9 @@ mDNSexport mStatus uDNS_SetupDNSConfig(mDNS *const m)
     FORALL_CACHERECORDS(slot, cg, cr)
     {
         if (cr->resrec.InterfaceID) continue;
+        // A record still pointing at a server we're keeping, for a name no changed server covers, is fine as it is
+        if (cr->resrec.rDNSServer && !(cr->resrec.rDNSServer->flags & DNSServerFlag_Delete) &&
+            !DNSConfigChangeAffectsName(&change, cr->resrec.name)) continue;
 
         // We already walked the questions and restarted/reactivated them if the dns server
         // change affected the question. That should take care of updating the cache. But
@@ -15144,9 +17775,12 @@ mDNSexport mStatus uDNS_SetupDNSConfig(mDNS *const m)
             *p = (*p)->next;
             LogInfo("uDNS_SetupDNSConfig: Deleting server %p %#a:%d (%##s)", ptr, &ptr->addr, mDNSVal16(ptr->port), ptr->domain.c);
             mDNSPlatformMemFree(ptr);
+            m->DNSServerIndex.built = mDNSfalse;
+            FlushZoneDataCache(m);      // Zone data we learned through this server may not hold for the others
         }
         else
         {
+            (*p)->flags &= ~DNSServerFlag_Changed;
             p = &(*p)->next;
         }
     }
@@ -15171,6 +17805,7 @@ mDNSexport mStatus uDNS_SetupDNSConfig(mDNS *const m)
                 m->DNSServers ? "DNS server became" : "No DNS servers", count);
 
         // Force anything that needs to get zone data to get that information again
+        FlushZoneDataCache(m);
         RestartRecordGetZoneData(m);
     }
 #endif // !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
@@ -15359,7 +17994,7 @@ mDNSexport void mDNS_FinalExit(mDNS *const m)
     LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEFAULT, "mDNS_FinalExit: mDNSPlatformClose");
     mDNSPlatformClose(m);
 
-    for (slot = 0; slot < CACHE_HASH_SLOTS; slot++)
+    for (slot = 0; slot < m->rrcache_slots; slot++)
     {
         while (m->rrcache_hash[slot])
         {
@@ -15375,6 +18010,24 @@ mDNSexport void mDNS_FinalExit(mDNS *const m)
             ReleaseCacheGroup(m, &m->rrcache_hash[slot]);
         }
     }
+    m->NextCacheResize = 0;
+    m->NextCacheShrink = 0;
+    ShrinkCache(m, mDNStrue);
+    ReleaseEmptyMemSlabs(m);
+    if (m->rrcache_hash != m->rrcache_hash_initial)
+    {
+        mDNSPlatformMemFree(m->rrcache_hash);
+        m->rrcache_hash  = m->rrcache_hash_initial;
+        m->rrcache_slots = m->rrcache_hash_base = m->rrcache_hash_capacity = CACHE_HASH_SLOTS;
+    }
+    AuthHashSize(&m->rrauth, 0);
+    if (m->names_hash && !m->names_count)
+    {
+        mDNSPlatformMemFree(m->names_hash);
+        m->names_hash  = mDNSNULL;
+        m->names_slots = 0;
+    }
+    mDNS_PacketRingInit(m, 0);
     debugf("mDNS_FinalExit: RR Cache was using %ld records, %lu active", rrcache_totalused, rrcache_active);
     if (rrcache_active != m->rrcache_active)
         LogMsg("*** ERROR *** rrcache_totalused %lu; rrcache_active %lu != m->rrcache_active %lu", rrcache_totalused, rrcache_active, m->rrcache_active);
@@ -15382,6 +18035,11 @@ mDNSexport void mDNS_FinalExit(mDNS *const m)
     for (rr = m->ResourceRecords; rr; rr = rr->next)
         LogMsg("mDNS_FinalExit failed to send goodbye for: %p %02X %s", rr, rr->resrec.RecordType, ARDisplayString(m, rr));
 
+#if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+    uDNS_CloseTCPConnections(m);
+#endif
+    FlushZoneDataCache(m);
+
 #if MDNSRESPONDER_SUPPORTS(APPLE, DNSSECv2)
     uninit_trust_anchors();
 #endif // MDNSRESPONDER_SUPPORTS(APPLE, DNSSECv2)
@@ -97,6 +97,15 @@ typedef enum
 #error "Malloc debugging does not yet work on Windows"
 #endif
 
+// Set this symbol to 1 to have mallocL, callocL and freeL count the live blocks and bytes for each callsite tag, for the
+// allocation profile in the state dump ('make profile' in mDNSPosix builds an mdnsd this way). The tag is the msg argument:
+// a name for the explicitly tagged allocations, and "file:line" for those made through mDNSPlatformMemAllocate.
+// Ignored if MDNS_MALLOC_DEBUGGING is set.
+// #define MDNS_MALLOC_PROFILING 1
+#if MDNS_MALLOC_DEBUGGING
+#undef MDNS_MALLOC_PROFILING
+#endif
+
 //#define ForceAlerts 1
 //#define LogTimeStamps 1
 
@@ -137,10 +146,18 @@ extern "C" {
     #define MDNS_HAS_VA_ARG_MACROS      0
 #endif
 
+// mDNS_LogLevelEnabled() is what the LogInfo/LogRedact family test before touching their arguments, so a message
+// that won't be logged costs a load and a compare against a constant level.
+#if MDNSRESPONDER_SUPPORTS(APPLE, OS_LOG)
+    #define mDNS_LogLevelEnabled(LEVEL) (mDNS_LoggingEnabled)
+#else
+    #define mDNS_LogLevelEnabled(LEVEL) (mDNS_LoggingEnabled && ((int)(LEVEL) <= mDNS_LogLevel))
+#endif
+
 #if (MDNS_HAS_VA_ARG_MACROS)
     #if (MDNS_C99_VA_ARGS)
         #define MDNS_LOG_DEFINITION(LEVEL, ...) \
-            do { if (mDNS_LoggingEnabled) LogMsgWithLevel(MDNS_LOG_CATEGORY_DEFAULT, LEVEL, __VA_ARGS__); } while (0)
+            do { if (mDNS_LogLevelEnabled(LEVEL)) LogMsgWithLevel(MDNS_LOG_CATEGORY_DEFAULT, LEVEL, __VA_ARGS__); } while (0)
 
         #define debug_noop(...)   do {} while(0)
         #define LogMsg(...)       LogMsgWithLevel(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEFAULT, __VA_ARGS__)
@@ -150,7 +167,7 @@ extern "C" {
         #define LogDebug(...)     MDNS_LOG_DEFINITION(MDNS_LOG_DEBUG, __VA_ARGS__)
     #elif (MDNS_GNU_VA_ARGS)
         #define MDNS_LOG_DEFINITION(LEVEL, ARGS...) \
-            do { if (mDNS_LoggingEnabled) LogMsgWithLevel(MDNS_LOG_CATEGORY_DEFAULT, LEVEL, ARGS); } while (0)
+            do { if (mDNS_LogLevelEnabled(LEVEL)) LogMsgWithLevel(MDNS_LOG_CATEGORY_DEFAULT, LEVEL, ARGS); } while (0)
 
         #define debug_noop(ARGS...)   do {} while (0)
         #define LogMsg(ARGS... )      LogMsgWithLevel(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEFAULT, ARGS)
@@ -200,6 +217,18 @@ extern int mDNS_DebugMode;          // If non-zero, LogMsg() writes to stderr in
 extern const char ProgramName[];
 
 extern void LogMsgWithLevel(mDNSLogCategory_t category, mDNSLogLevel_t level, const char *format, ...) IS_A_PRINTF_STYLE_FUNCTION(3,4);
+
+#if !MDNSRESPONDER_SUPPORTS(APPLE, OS_LOG)
+extern int mDNS_LogLevel;           // LogInfo/LogRedact messages above this level are skipped; defaults to MDNS_LOG_DEBUG
+
+// Once mDNSLogRingStart() succeeds, messages less severe than errors are recorded in binary form and only formatted and
+// written when mDNSLogRingDrain() is called, e.g. from the event loop before it blocks. Format strings must be
+// literals. mDNSLogRingStop() drains what's left and goes back to logging synchronously.
+extern int  mDNSLogRingStart(void);        // Returns non-zero on success
+extern void mDNSLogRingDrain(void);
+extern void mDNSLogRingStop(void);
+#endif
+
 // LogMsgNoIdent needs to be fixed so that it logs without the ident prefix like it used to
 // (or completely overhauled to use the new "log to a separate file" facility)
 #define LogMsgNoIdent LogMsg
@@ -219,7 +248,7 @@ extern void LogMemCorruption(const char *format, ...);
 #else
 #define LogMemCorruption LogMsg
 #endif
-#else
+#elif !MDNS_MALLOC_PROFILING          // mallocL and friends are declared with the platform memory calls in mDNSEmbeddedAPI.h
 #define mallocL(MSG, SIZE) malloc(SIZE)
 #define callocL(MSG, SIZE) calloc(1, SIZE)
 #define freeL(MSG, PTR) free(PTR)
@@ -284,10 +313,10 @@ extern void LogMemCorruption(const char *format, ...);
     #if (MDNS_HAS_VA_ARG_MACROS)
         #if (MDNS_C99_VA_ARGS)
             #define LogRedact(CATEGORY, LEVEL, ...) \
-                do { if (mDNS_LoggingEnabled) LogMsgWithLevel(CATEGORY, LEVEL, __VA_ARGS__); } while (0)
+                do { if (mDNS_LogLevelEnabled(LEVEL)) LogMsgWithLevel(CATEGORY, LEVEL, __VA_ARGS__); } while (0)
         #elif (MDNS_GNU_VA_ARGS)
             #define LogRedact(CATEGORY, LEVEL, ARGS...) \
-                do { if (mDNS_LoggingEnabled) LogMsgWithLevel(CATEGORY, LEVEL, ARGS); } while (0)
+                do { if (mDNS_LogLevelEnabled(LEVEL)) LogMsgWithLevel(CATEGORY, LEVEL, ARGS); } while (0)
         #else
             #error "Unknown variadic macros"
         #endif
@@ -542,6 +542,15 @@ typedef struct
     mDNSu8 data[AbsoluteMaxDNSMessageData]; // 40 (IPv6) + 8 (UDP) + 12 (DNS header) + 8940 (data) = 9000
 } DNSMessage;
 
+// How far a large reply arriving over TCP has been passed on to mDNSCore ahead of its last byte (see TCPReplyStreamChunk)
+typedef struct
+{
+    mDNSu16 questionEnd;                    // Offset of the end of the question section, once it has arrived
+    mDNSu16 offset;                         // Offset of the first answer not streamed yet
+    mDNSu16 answers;                        // Number of answers streamed so far
+    mDNSBool done;                          // Nothing more from this reply will be streamed
+} TCPReplyStream;
+
 typedef struct tcpInfo_t
 {
     mDNS             *m;
@@ -556,6 +565,7 @@ typedef struct tcpInfo_t
     DNSMessage       *reply;
     mDNSu16 replylen;
     unsigned long nread;
+    TCPReplyStream stream;
     int numReplies;
 } tcpInfo_t;
 
@@ -646,6 +656,18 @@ typedef struct
     mDNSu16 window;
 } mDNSTCPInfo;
 
+// One keepalive to send on behalf of a sleeping host; see mDNSPlatformSendKeepalives
+typedef struct
+{
+    mDNSAddr laddr;
+    mDNSAddr raddr;
+    mDNSIPPort lport;
+    mDNSIPPort rport;
+    mDNSu32 seq;                        // Both in network byte order, as carried in the keepalive record
+    mDNSu32 ack;
+    mDNSu16 win;
+} mDNSKeepalivePacket;
+
 typedef packedstruct
 {
     mDNSIPPort src;
@@ -820,6 +842,7 @@ typedef enum
 #define kDNSOpt_Lease 2
 #define kDNSOpt_NSID  3
 #define kDNSOpt_Owner 4
+#define kDNSOpt_TCPKeepalive 11 // RFC 7828 edns-tcp-keepalive
 #define kDNSOpt_Trace 65001  // 65001-65534 Reserved for Local/Experimental Use 
 
 typedef struct
@@ -992,6 +1015,8 @@ typedef void mDNSRecordUpdateCallback (mDNS *const m, AuthRecord *const rr, RDat
 #define NATMAP_MIN_RETRY_INTERVAL     (mDNSPlatformOneSecond * 2)           // Min retry interval is 2 seconds
 #define NATMAP_INIT_RETRY             (mDNSPlatformOneSecond / 4)           // start at 250ms w/ exponential decay
 #define NATMAP_DEFAULT_LEASE          (60 * 60 * 2)                         // 2 hour lease life in seconds
+#define NATMAP_BURST_SIZE             8                                     // Most mapping requests sent to the gateway in one go
+#define NATMAP_BURST_SPACING          (mDNSPlatformOneSecond / 20)          // Least time between bursts (gateway latency if longer)
 #define NATMAP_VERS 0
 
 typedef enum
@@ -1175,6 +1200,8 @@ struct NATTraversalInfo_struct
     NATTProtocol lastSuccessfulProtocol;            // To send correct deletion request & update non-PCP external address operations
     mDNSBool sentNATPMP;                            // Whether we just sent a NAT-PMP packet, so we won't send another if
                                                     //    we receive another NAT-PMP "Unsupported Version" packet
+    mDNSs32 sentTime;                               // When we last sent a mapping request, for measuring gateway latency
+    mDNSu8 sendCount;                               // Requests sent since the last reply; only a reply to a single one is timed
 
 #ifdef _LEGACY_NAT_TRAVERSAL_
     tcpLNTInfo tcpInfo;                             // Legacy NAT traversal (UPnP) TCP connection
@@ -1250,6 +1277,7 @@ typedef mDNSu32 DNSServerFlags;
 #if MDNSRESPONDER_SUPPORTS(APPLE, SYMPTOMS)
 #define DNSServerFlag_Unreachable   (1U << 1)
 #endif
+#define DNSServerFlag_Changed       (1U << 2)   // Added, or its attributes changed, since the last uDNS_SetupDNSConfig
 
 typedef struct DNSServer
 {
@@ -1262,6 +1290,7 @@ typedef struct DNSServer
     ScopeType scopeType;        // See the ScopeType enum above
     mDNSu32 timeout;            // timeout value for questions
     mDNSu32 resGroupID;         // ID of the resolver group that contains this DNSServer
+    mDNSs32 srtt;               // Smoothed round trip time, in ticks scaled by 8; zero until we've timed a response
     mDNSIPPort port;            // DNS server's port number.
     mDNSBool usableA;           // True if A query results are usable over the interface, i.e., interface has IPv4.
     mDNSBool usableAAAA;        // True if AAAA query results are usable over the interface, i.e., interface has IPv6.
@@ -1269,8 +1298,37 @@ typedef struct DNSServer
     mDNSBool isExpensive;       // True if the interface to this server is expensive.
     mDNSBool isConstrained;     // True if the interface to this server is constrained.
     mDNSBool isCLAT46;          // True if the interface to this server supports CLAT46.
+    mDNSu8 loss;                // Recent fraction of our queries this server left unanswered, in 1/256ths
     domainname domain;          // name->server matching for "split dns"
 } DNSServer;
+
+// Index of m->DNSServers by domain, so that the servers for the longest configured domain a name falls under are found
+// with one hash probe per label of the name rather than a walk of the whole list. Servers are numbered as in a
+// question's validDNSServers: by position in the list, not counting those flagged for deletion. Rebuilt when next
+// needed after anything clears built, which everything that adds, removes or flags servers does.
+#define DNSServerIndexMaxServers    128     // One per bit of validDNSServers
+#define DNSServerIndexSlots         64
+
+typedef struct
+{
+    const domainname *domain;   // Points into the first server for the domain
+    mDNSu32 hash;
+    mDNSs16 next;               // Next domain in the same hash slot, or -1
+    mDNSs16 first;              // First and last servers for the domain; the others are chained through nextInDomain
+    mDNSs16 last;
+} DNSServerIndexDomain;
+
+typedef struct
+{
+    mDNSBool built;
+    mDNSu8 maxLabels;                                   // Labels in the longest domain; no name need look further out
+    mDNSs16 count;
+    mDNSs16 domainCount;
+    mDNSs16 slot[DNSServerIndexSlots];                  // First domain in each hash slot, or -1
+    mDNSs16 nextInDomain[DNSServerIndexMaxServers];     // Next server for the same domain, in list order, or -1
+    DNSServer *server[DNSServerIndexMaxServers];
+    DNSServerIndexDomain domain[DNSServerIndexMaxServers];
+} DNSServerIndex;
 #endif
 
 #define kNegativeRecordType_Unspecified 0 // Initializer of ResourceRecord didn't specify why the record is negative.
@@ -1289,7 +1347,9 @@ struct ResourceRecord_struct
     mDNSu16 rdestimate;                 // Upper bound on on-the-wire size of rdata after name compression
     mDNSu32 namehash;                   // Name-based (i.e. case-insensitive) hash of name
     mDNSu32 rdatahash;                  // For rdata containing domain name (e.g. PTR, SRV, CNAME etc.), case-insensitive name hash
-                                        // else, for all other rdata, 32-bit hash of the raw rdata
+                                        // else, for all other rdata, 32-bit hash of the raw rdata (zero if there is none)
+                                        // Kept up to date by SetNewRData(), which anything that changes rdata must call,
+                                        // and compared before any SameRDataBody() call on two full records.
                                         // Note: This requirement is important. Various routines like AddAdditionalsToResponseList(),
                                         // ReconfirmAntecedents(), etc., use rdatahash as a pre-flight check to see
                                         // whether it's worth doing a full SameDomainName() call. If the rdatahash
@@ -1347,7 +1407,9 @@ typedef enum
     mergeState_DontMerge = 1  // Set on fatal error conditions to disable merging
 } mergeState_t;
 
-#define AUTH_GROUP_NAME_SIZE    128
+// The name of an AuthGroup in m->rrauth is interned in m's name store (see InternedName below); the name of one in any
+// other AuthHash (such as one a platform layer builds while parsing /etc/hosts) is a copy made for that group alone,
+// of just the length needed, which whoever frees the group frees with mDNSPlatformMemFree()
 struct AuthGroup_struct             // Header object for a list of AuthRecords with the same name
 {
     AuthGroup      *next;               // Next AuthGroup object in this hash table bucket
@@ -1356,15 +1418,26 @@ struct AuthGroup_struct             // Header object for a list of AuthRecords w
     AuthRecord    **rrauth_tail;        // Tail end of that list
     domainname     *name;               // Common name for all AuthRecords in this list
     AuthRecord     *NewLocalOnlyRecords;
-    mDNSu8 namestorage[AUTH_GROUP_NAME_SIZE];
 };
 
 #ifndef AUTH_HASH_SLOTS
 #define AUTH_HASH_SLOTS 499
 #endif
+#ifndef AUTH_HASH_MAX_SLOTS
+#define AUTH_HASH_MAX_SLOTS 262143          // Largest table AuthHashSize() makes
+#endif
+
+// The proxy records we hold as a Sleep Proxy Server are also hashed by owner H-MAC, by proxied address and
+// by TCP keepalive tuple, so that the raw ARP/NDP/TCP handlers don't have to walk m->ResourceRecords for every packet.
+#ifndef SPS_HASH_SLOTS
+#define SPS_HASH_SLOTS 257
+#endif
+#define SPSHash_Owner     0x01
+#define SPSHash_Address   0x02
+#define SPSHash_Keepalive 0x04
 #define FORALL_AUTHRECORDS(SLOT,AG,AR)                              \
-    for ((SLOT) = 0; (SLOT) < AUTH_HASH_SLOTS; (SLOT)++)                                                                     \
-        for ((AG)=m->rrauth.rrauth_hash[(SLOT)]; (AG); (AG)=(AG)->next)                                                                         \
+    for ((SLOT) = 0; (SLOT) < AuthHashSlots(&m->rrauth); (SLOT)++)                                                           \
+        for ((AG)=AuthHashHead(&m->rrauth, (SLOT)); (AG); (AG)=(AG)->next)                                                                      \
             for ((AR) = (AG)->members; (AR); (AR)=(AR)->next)
 
 typedef union AuthEntity_union AuthEntity;
@@ -1373,11 +1446,20 @@ typedef struct {
     mDNSu32 rrauth_size;                // Total number of available auth entries
     mDNSu32 rrauth_totalused;           // Number of auth entries currently occupied
     mDNSu32 rrauth_report;
+    mDNSu32 rrauth_mem_limit;           // Most bytes of AuthEntity storage to allocate; zero for no limit
+    mDNSu32 rrauth_released;            // Idle auth entries given back to the platform
     mDNSu8 rrauth_lock;                 // For debugging: Set at times when these lists may not be modified
     AuthEntity *rrauth_free;
+    AuthGroup **rrauth_table;           // rrauth_slots entries once AuthHashSize() has resized the table; NULL for rrauth_hash
+    mDNSu32 rrauth_slots;
     AuthGroup *rrauth_hash[AUTH_HASH_SLOTS];
 }AuthHash;
 
+// An AuthHash starts out with the AUTH_HASH_SLOTS slots of rrauth_hash (so an all-zero one is an empty table), and
+// AuthHashSize() can move it to a table sized for the number of names to be held
+#define AuthHashSlots(R)      ((R)->rrauth_table ? (R)->rrauth_slots : (mDNSu32)AUTH_HASH_SLOTS)
+#define AuthHashHead(R, SLOT) (((R)->rrauth_table ? (R)->rrauth_table : (R)->rrauth_hash)[(SLOT)])
+
 // AuthRecordAny includes mDNSInterface_Any and interface specific auth records.
 typedef enum
 {
@@ -1397,6 +1479,18 @@ typedef enum
     AuthFlagsWakeOnly = 0x1     // WakeOnly service
 } AuthRecordFlags;
 
+// What PutResourceRecordTTLWithCache() remembers between sends of one of our records: the compression table
+// hashes of each suffix of the owner name and of the rdata's target name (see GetRRDomainNameTarget)
+#define RRWireCacheLabels 8
+typedef struct
+{
+    mDNSu8  valid;                      // Cleared whenever the record's name or rdata changes
+    mDNSu8  namelabels;                 // Labels in the owner name, or zero if it has more than RRWireCacheLabels
+    mDNSu8  targetlabels;               // Labels in the target name, or zero if there's none or it has too many
+    mDNSu32 namehashes[RRWireCacheLabels];
+    mDNSu32 targethashes[RRWireCacheLabels];
+} RRWireCache;
+
 struct AuthRecord_struct
 {
     // For examples of how to set up this structure for use in mDNS_Register(),
@@ -1426,6 +1520,7 @@ struct AuthRecord_struct
     mDNSs32 TimeExpire;                 // In platform time units
     AuthRecType ARType;                 // LocalOnly, P2P or Normal ?
     mDNSs32 KATimeExpire;               // In platform time units: time to send keepalive packet for the proxy record
+    mDNSs32 UpdateInterval;             // Set by client for coalesced updates: announce new rdata at most once in this time
 
     // Field Group 3: Transient state for Authoritative Records
     mDNSs32 ProbingConflictCount;       // Number of conflicting records observed during probing.
@@ -1447,19 +1542,37 @@ struct AuthRecord_struct
     mDNSInterfaceID SendRNow;           // The interface this query is being sent on right now
     mDNSv4Addr v4Requester;             // Recent v4 query for this record, or all-ones if more than one recent query
     mDNSv6Addr v6Requester;             // Recent v6 query for this record, or all-ones if more than one recent query
+    AuthRecord     *NextInNameHash;     // Next record in m->ResourceRecordHash[NameHashSlot]
+    mDNSu16 NameHashSlot;               // Slot of m->ResourceRecordHash this record was added to
+    AuthRecord     *NextInOwnerHash;    // Sleep Proxy records only: next record in m->SPSOwnerHash[OwnerHashSlot]
+    AuthRecord     *NextInAddressHash;  // Sleep Proxy records only: next record in m->SPSAddressHash[AddressHashSlot]
+    AuthRecord     *NextInKeepaliveHash;// Sleep Proxy records only: next record in m->SPSKeepaliveHash[KeepaliveHashSlot]
+    mDNSu16 OwnerHashSlot;
+    mDNSu16 AddressHashSlot;
+    mDNSu16 KeepaliveHashSlot;
+    mDNSu8 SPSHashes;                   // Which of the SPS hashes above this record is in (SPSHash_* bits)
+    AuthRecord     *KAChild;            // Pairing heap links for m->KeepaliveHeap, ordered by KATimeExpire
+    AuthRecord     *KASibling;
+    AuthRecord     *KAPrev;             // Parent if this is the leftmost child, else left sibling; NULL for the root
     AuthRecord     *NextResponse;       // Link to the next element in the chain of responses to generate
     const mDNSu8   *NR_AnswerTo;        // Set if this record was selected by virtue of being a direct answer to a question
     AuthRecord     *NR_AdditionalTo;    // Set if this record was selected by virtue of being additional to another
+    AuthRecord     *NextInResponseHash; // ProcessQuery's planned answers, by name, type and rdata, for known-answer suppression
+    AuthRecord     *NextInScheduledHash;// ProcessQuery's already-scheduled answers with one name, for known-answer suppression
     mDNSs32 ThisAPInterval;             // In platform time units: Current interval for announce/probe
     mDNSs32 LastAPTime;                 // In platform time units: Last time we sent announcement/probe
     mDNSs32 LastMCTime;                 // Last time we multicast this record (used to guard against packet-storm attacks)
     mDNSInterfaceID LastMCInterface;    // Interface this record was multicast on at the time LastMCTime was recorded
     RData          *NewRData;           // Set if we are updating this record with new rdata
     mDNSu16 newrdlength;                // ... and the length of the new RData
+    RRWireCache WireCache;              // Saved work for writing this record into messages
     mDNSRecordUpdateCallback *UpdateCallback;
     mDNSu32 UpdateCredits;              // Token-bucket rate limiting of excessive updates
     mDNSs32 NextUpdateCredit;           // Time next token is added to bucket
     mDNSs32 UpdateBlocked;              // Set if update delaying is in effect
+    mDNSs32 LastUpdateAnnounce;         // Coalesced updates: when the last update announcement was due to start
+    mDNSu32 SentInResponses;            // Times this record has been put in a multicast DNS response we sent
+    mDNSu32 SentInProbes;               // Times this record has been put in the authority section of a probe we sent
 
     // Field Group 4: Transient uDNS state for Authoritative Records
     regState_t state;           // Maybe combine this with resrec.RecordType state? Right now it's ambiguous and confusing.
@@ -1533,35 +1646,45 @@ typedef struct ARListElem
     AuthRecord ar;          // Note: Must be last element of structure, to accomodate oversized AuthRecords
 } ARListElem;
 
+#define KnownAnswerIndexNone 0xFFFFFFFF
+
 struct CacheRecord_struct
 {
+    // The fields are ordered by how often they're touched. Everything read when walking a CacheGroup's records
+    // to see which answer a question, and to age them, comes first so that it falls in the first two cache
+    // lines along with the start of the inline rdata; the list links and bookkeeping that are only used when a
+    // record is sent as a known answer, flushed, evicted or proxied are kept after the rdata.
     CacheRecord    *next;               // Next in list; first element of structure for efficiency reasons
     ResourceRecord resrec;              // 36 bytes when compiling for 32-bit; 48 when compiling for 64-bit (now 44/64)
 
-    // Transient state for Cache Records
-    CacheRecord    *NextInKAList;       // Link to the next element in the chain of known answers to send
+    // Transient state for Cache Records: hot
     mDNSs32 TimeRcvd;                   // In platform time units
     mDNSs32 DelayDelivery;              // Set if we want to defer delivery of this answer to local clients
+    DNSQuestion    *CRActiveQuestion;   // Points to an active question referencing this answer. Can never point to a NewQuestion.
     mDNSs32 NextRequiredQuery;          // In platform time units
+    mDNSs32 LastUnansweredTime;         // In platform time units; last time we incremented UnansweredQueries
+    mDNSu8  UnansweredQueries;          // Number of times we've issued a query for this record without getting an answer
+    mDNSu8  Partition;                  // Index + 1 of this record's entry in m->rrcache_partitions; zero if not accounted
+    mDNSOpaque16 responseFlags;         // Second 16 bit in the DNS response
 #if MDNSRESPONDER_SUPPORTS(APPLE, CACHE_ANALYTICS)
     mDNSs32 LastCachedAnswerTime;       // Last time this record was used as an answer from the cache (before a query)
                                         // In platform time units
 #else
-    // Extra four bytes here (on 64bit)
+    // Extra four bytes after smallrdatastorage (on 64bit)
 #endif
-    DNSQuestion    *CRActiveQuestion;   // Points to an active question referencing this answer. Can never point to a NewQuestion.
-    mDNSs32 LastUnansweredTime;         // In platform time units; last time we incremented UnansweredQueries
-    mDNSu8  UnansweredQueries;          // Number of times we've issued a query for this record without getting an answer
-    mDNSOpaque16 responseFlags;         // Second 16 bit in the DNS response
+    RData_small smallrdatastorage;      // Storage for small records is right here (4 bytes header + 68 bytes data = 72 bytes)
+
+    // Transient state for Cache Records: cold
+    CacheRecord    *NextInKAList;       // Link to the next element in the chain of known answers to send
     CacheRecord    *NextInCFList;       // Set if this is in the list of records we just received with the cache flush bit set
     CacheRecord    *soa;                // SOA record to return for proxy questions
+    CacheRecord    *LRUPrev;            // Links for m->rrcache_lru, the records not answering any active question,
+    CacheRecord    *LRUNext;            // least recently used first
 #if MDNSRESPONDER_SUPPORTS(APPLE, DNSSECv2)
     void *denial_of_existence_records;  // denial_of_existence_records_t
 #endif // MDNSRESPONDER_SUPPORTS(APPLE, DNSSECv2)
-
     mDNSAddr sourceAddress;             // node from which we received this record
-    // Size to here is 76 bytes when compiling 32-bit; 104 bytes when compiling 64-bit (now 160 bytes for 64-bit)
-    RData_small smallrdatastorage;      // Storage for small records is right here (4 bytes header + 68 bytes data = 72 bytes)
+    mDNSu32 KnownAnswerIndex;           // Index in CRActiveQuestion->KnownAnswers, or KnownAnswerIndexNone
 };
 
 // Should match the CacheGroup_struct members, except namestorage[].  Only used to calculate
@@ -1573,6 +1696,10 @@ struct CacheGroup_base
     CacheRecord    *members;
     CacheRecord   **rrcache_tail;
     domainname     *name;
+    mDNSs32         nextcheck;
+    CacheGroup     *checkChild;
+    CacheGroup     *checkSibling;
+    CacheGroup     *checkPrev;
 };
 
 struct CacheGroup_struct                // Header object for a list of CacheRecords with the same name
@@ -1582,14 +1709,43 @@ struct CacheGroup_struct                // Header object for a list of CacheReco
     CacheRecord    *members;            // List of CacheRecords with this same name
     CacheRecord   **rrcache_tail;       // Tail end of that list
     domainname     *name;               // Common name for all CacheRecords in this list
+    mDNSs32         nextcheck;          // Next time any of the members needs CheckCacheExpiration()
+    CacheGroup     *checkChild;         // Pairing heap links for m->rrcache_checkheap, ordered by nextcheck
+    CacheGroup     *checkSibling;
+    CacheGroup     *checkPrev;          // Parent if this is the leftmost child, else left sibling; NULL for the root
     mDNSu8 namestorage[sizeof(CacheRecord) - sizeof(struct CacheGroup_base)];  // match sizeof(CacheRecord)
 };
 
+// Names interned by the core: one refcounted copy of each name (compared case insensitively, keeping the case it
+// was first interned with) shared by the AuthGroups in m->rrauth and the CacheGroups whose names don't fit in their
+// namestorage. Each entry is allocated from the rrcache slabs with only as many name bytes as the name needs, so two
+// groups with the same name share a single copy and a group lookup that finds the very same pointer needs no label
+// by label comparison.
+typedef struct InternedName_struct InternedName;
+struct InternedName_struct
+{
+    InternedName   *next;               // Next name in this hash table bucket
+    mDNSu32         namehash;           // DomainNameHashValue() of name
+    mDNSu32         refs;               // Groups using this name
+    domainname      name;               // Only DomainNameLength(name) bytes of this are allocated
+};
+#define InternedNameHeaderSize ((mDNSu32)(sizeof(InternedName) - sizeof(domainname)))
+
 // Storage sufficient to hold either a CacheGroup header or a CacheRecord
 // -- for best efficiency (to avoid wasted unused storage) they should be the same size
 typedef union CacheEntity_union CacheEntity;
 union CacheEntity_union { CacheEntity *next; CacheGroup cg; CacheRecord cr; };
 
+// Storage added with mDNS_GrowCacheReleasable keeps its bookkeeping in its first CacheEntity
+typedef struct CacheBlock_struct CacheBlock;
+struct CacheBlock_struct
+{
+    CacheBlock *next;
+    CacheEntity *free;                  // The block's own free list, kept apart from m->rrcache_free
+    mDNSu32 count;                      // CacheEntity objects in the block after this header
+    mDNSu32 used;                       // How many of them are in use
+};
+
 typedef struct
 {
     CacheRecord r;
@@ -1668,8 +1824,8 @@ struct ServiceRecordSet_struct
 
 typedef struct
 {
-    mDNSs32 Time;
     mDNSInterfaceID InterfaceID;
+    mDNSs32 Time;
     mDNSs32 Type;                           // v4 or v6?
 } DupSuppressInfo;
 
@@ -1680,8 +1836,9 @@ typedef enum
 
     // All of these states indicate that we are doing DNS Push, and haven't given up yet.
 	LLQ_DNSPush_ServerDiscovery = 100,
-	LLQ_DNSPush_Connecting      = 101,
-	LLQ_DNSPush_Established     = 102,
+	LLQ_DNSPush_Connecting      = 101,  // Subscription waiting for the session, or for room for another outstanding request
+	LLQ_DNSPush_Subscribing     = 102,  // SUBSCRIBE sent, waiting for the response
+	LLQ_DNSPush_Established     = 103,
 
     // All of these states indicate that we are doing LLQ and haven't given up yet.
     LLQ_InitialRequest   = 200,
@@ -1732,10 +1889,28 @@ enum {
 };
 typedef mDNSu8 AllowExpiredState;
 
+// When RaceUnicastServers is set, a unicast question's first query also goes to the runner-up server shortly after
+// it goes to qDNSServer, and whichever answers first wins
+enum {
+    UnicastRace_None     = 0,               // Not racing
+    UnicastRace_Pending  = 1,               // Query sent to qDNSServer; raceServer gets it at raceTime unless answered first
+    UnicastRace_Running  = 2,               // Query outstanding at both servers
+    UnicastRace_Decided  = 3                // One of them answered; a late answer from the other only updates its RTT
+};
+typedef mDNSu8 UnicastRaceState;
+
 #define HMAC_LEN    64
 #define HMAC_IPAD   0x36
 #define HMAC_OPAD   0x5c
 #define MD5_LEN     16
+#define SHA256_LEN  32
+
+// TSIG algorithms DNSDigest.c can sign and verify with
+enum
+{
+    TSIG_HMAC_MD5    = 0,                   // hmac-md5.sig-alg.reg.int. (RFC 2845)
+    TSIG_HMAC_SHA256 = 1                    // hmac-sha256. (RFC 4635)
+};
 
 // Internal data structure to maintain authentication information
 typedef struct DomainAuthInfo
@@ -1747,8 +1922,9 @@ typedef struct DomainAuthInfo
     domainname hostname;
     mDNSIPPort port;
     char b64keydata[32];
-    mDNSu8 keydata_ipad[HMAC_LEN];              // padded key for inner hash rounds
-    mDNSu8 keydata_opad[HMAC_LEN];              // padded key for outer hash rounds
+    mDNSu8 algorithm;                           // TSIG_HMAC_MD5 or TSIG_HMAC_SHA256
+    mDNSu32 hmac_istate[8];                     // hash state after the key ^ ipad block, so signing starts at the message
+    mDNSu32 hmac_ostate[8];                     // hash state after the key ^ opad block
 } DomainAuthInfo;
 
 // Note: Within an mDNSQuestionCallback mDNS all API calls are legal except mDNS_Init(), mDNS_Exit(), mDNS_Execute()
@@ -1813,6 +1989,7 @@ typedef struct
     mDNSBool            answered;               // Has this question been answered?
     ExpiredAnswerMetric expiredAnswerState;     // Expired answer state (see ExpiredAnswerMetric above)
     DNSOverTCPMetric    dnsOverTCPState;        // DNS Over TCP state (see DNSOverTCPMetric above)
+    mDNSu16             queryStatsDomains;      // Query stats domains this question counts towards, cached by the metrics code.
 
 }   uDNSMetrics;
 #endif
@@ -1828,11 +2005,20 @@ extern mDNSu32 max_num_regservices;  // tracks the max number of simultaneous se
 
 typedef struct mDNS_DNSPushNotificationServer DNSPushNotificationServer;
 typedef struct mDNS_DNSPushNotificationZone   DNSPushNotificationZone;
+typedef struct mDNS_DNSTCPConnection          DNSTCPConnection;
 
 struct DNSQuestion_struct
 {
     // Internal state fields. These are used internally by mDNSCore; the client layer needn't be concerned with them.
+    // The fields are grouped by how often they're touched. The ones that the cache lookup, answering and query
+    // scheduling paths use for every question come first, followed by the client API fields those paths read, so that
+    // a multicast question does its work in the first few cache lines. The unicast, LLQ, DNS Push and proxy state,
+    // which a multicast question never touches, is kept together at the end. Within a group, wider fields come first,
+    // so that there's little padding.
     DNSQuestion          *next;
+    DNSQuestion          *NextInQHash;      // Next question in m->QuestionHash[QHashSlot]
+    DNSQuestion          *DuplicateOf;
+    mDNSInterfaceID SendQNow;               // The interface this query is being sent on right now
     mDNSu32 qnamehash;
     mDNSs32 DelayAnswering;                 // Set if we want to defer answering this question until the cache settles
     mDNSs32 LastQTime;                      // Last scheduled transmission of this Q on *all* applicable interfaces
@@ -1844,32 +2030,90 @@ struct DNSQuestion_struct
     mDNSs32 LastAnswerPktNum;               // The sequence number of the last response packet containing an answer to this Q
     mDNSu32 RecentAnswerPkts;               // Number of answers since the last time we sent this query
     mDNSu32 CurrentAnswers;                 // Number of records currently in the cache that answer this question
-    mDNSu32 BrowseThreshold;                // If we have received at least this number of answers,
-                                            // set the next question interval to MaxQuestionInterval
-    mDNSu32 LargeAnswers;                   // Number of answers with rdata > 1024 bytes
-    mDNSu32 UniqueAnswers;                  // Number of answers received with kDNSClass_UniqueRRSet bit set
-    mDNSInterfaceID FlappingInterface1;     // Set when an interface goes away, to flag if remove events are delivered for this Q
-    mDNSInterfaceID FlappingInterface2;     // Set when an interface goes away, to flag if remove events are delivered for this Q
-    DomainAuthInfo       *AuthInfo;         // Non-NULL if query is currently being done using Private DNS
-    DNSQuestion          *DuplicateOf;
-    DNSQuestion          *NextInDQList;
-    DupSuppressInfo DupSuppress[DupSuppressInfoSize];
-    mDNSInterfaceID SendQNow;               // The interface this query is being sent on right now
+    CacheRecord **KnownAnswers;             // Multicast records with this as their CRActiveQuestion (see KnownAnswerSetAdd)
+    mDNSu32 KnownAnswerCount;
+    mDNSu32 KnownAnswerCapacity;
+    mDNSBool KnownAnswersPartial;           // Set if another question is answered by some of the same records
+    mDNSu32 RequestUnicast;                 // Non-zero if we want to send query with kDNSQClass_UnicastResponse bit set
+    mDNSs32 LastQTxTime;                    // Last time this Q was sent on one (but not necessarily all) interfaces
+    mDNSu32 QuestionSeq;                    // Order of insertion into m->Questions
+    mDNSu16 QHashSlot;                      // Slot of m->QuestionHash this question was added to
     mDNSBool SendOnAll;                     // Set if we're sending this question on all active interfaces
     mDNSBool CachedAnswerNeedsUpdate;       // See SendQueries().  Set if we're sending this question 
                                             // because a cached answer needs to be refreshed.
-    mDNSu32 RequestUnicast;                 // Non-zero if we want to send query with kDNSQClass_UnicastResponse bit set
-    mDNSs32 LastQTxTime;                    // Last time this Q was sent on one (but not necessarily all) interfaces
-    mDNSu32 CNAMEReferrals;                 // Count of how many CNAME redirections we've done
     mDNSBool Suppressed;                    // This query should be suppressed, i.e., not sent on the wire.
+    mDNSBool InitialCacheMiss;              // True after the question cannot be answered from the cache
+    mDNSBool OneShot;                       // Snapshot browse: send the initial query once, then only listen
     mDNSu8 LOAddressAnswers;                // Number of answers from the local only auth records that are
                                             // answering A, AAAA, CNAME, or PTR (/etc/hosts)
-    mDNSu8 WakeOnResolveCount;              // Number of wakes that should be sent on resolve
-    mDNSBool InitialCacheMiss;              // True after the question cannot be answered from the cache
+
+    // Client API fields: The client must set up these fields *before* calling mDNS_StartQuery()
+    mDNSInterfaceID InterfaceID;            // Non-zero if you want to issue queries only on a single specific IP interface
+    mDNSQuestionCallback *QuestionCallback;
+    void                 *QuestionContext;
+    mDNSu32  flags;                         // flags from original DNSService*() API request.
+    mDNSOpaque16 TargetQID;                 // DNS or mDNS message ID.
+    mDNSu16 qtype;
+    mDNSu16 qclass;
+    mDNSBool LongLived;                     // Set by client for calls to mDNS_StartQuery to indicate LLQs to unicast layer.
+    mDNSBool ExpectUnique;                  // Set by client if it's expecting unique RR(s) for this question, not shared RRs
+    mDNSBool ForceMCast;                    // Set by client to force mDNS query, even for apparently uDNS names
+    mDNSBool ReturnIntermed;                // Set by client to request callbacks for intermediate CNAME/NXDOMAIN results
+    mDNSBool SuppressUnusable;              // Set by client to suppress unusable queries to be sent on the wire
+    mDNSBool TimeoutQuestion;               // Timeout this question if there is no reply in configured time
+    mDNSBool IsUnicastDotLocal;             // True if this is a dot-local query that should be answered via unicast DNS.
+    mDNSBool WakeOnResolve;                 // Send wakeup on resolve
+    mDNSBool UseBackgroundTraffic;          // Set by client to use background traffic class for request
+    mDNSBool AppendSearchDomains;           // Search domains can be appended for this query
+    mDNSBool ForcePathEval;                 // Perform a path evaluation even if kDNSServiceFlagsPathEvaluationDone is set.
+#if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+    mDNSBool RequireEncryption;             // Set by client to require encrypted queries
+#endif
+    mDNSu8 ProxyQuestion;                   // Proxy Question
+    domainname qname;
+    mDNSQuestionResetHandler ResetHandler;
+    mDNSs32 pid;                            // Process ID of the client that is requesting the question
+    mDNSu8  uuid[UUID_SIZE];                // Unique ID of the client that is requesting the question (valid only if pid is zero)
+    mDNSu32 euid;                           // Effective User Id of the client that is requesting the question
+    mDNSu32 request_id;                     // The ID of request that generates the current question
+    mDNSu32 SentInQueries;                  // Times this question has been put in a query we sent (multicast or unicast)
+#if MDNSRESPONDER_SUPPORTS(APPLE, AUDIT_TOKEN)
+    mDNSBool inAppBrowserRequest;           // Is request associated with an in-app-browser
+    audit_token_t  peerAuditToken;          // audit token of the peer requesting the question
+    audit_token_t  delegateAuditToken;      // audit token of the delegated client the question is for
+#endif
+
+    // Internal state used less often: when sending queries, and when interfaces or answers come and go
+    DupSuppressInfo DupSuppress[DupSuppressInfoSize];
+    mDNSInterfaceID FlappingInterface1;     // Set when an interface goes away, to flag if remove events are delivered for this Q
+    mDNSInterfaceID FlappingInterface2;     // Set when an interface goes away, to flag if remove events are delivered for this Q
+    DNSQuestion          *NextInDQList;
+    mDNSu32 BrowseThreshold;                // If we have received at least this number of answers,
+                                            // set the next question interval to MaxQuestionInterval
+    mDNSu32 LargeAnswers;                   // Number of answers with rdata > 1024 bytes
+    mDNSu32 UniqueAnswers;                  // Number of answers received with kDNSClass_UniqueRRSet bit set
+    mDNSu32 CNAMEReferrals;                 // Count of how many CNAME redirections we've done
     mDNSs32 StopTime;                       // Time this question should be stopped by giving them a negative answer
+    mDNSu8 WakeOnResolveCount;              // Number of wakes that should be sent on resolve
 
     // Wide Area fields. These are used internally by the uDNS core (Unicast)
+    AllowExpiredState allowExpired;         // Allow expired answers state (see enum AllowExpired_None, etc. above)
+    mDNSu8 NoAnswer;                        // Set if we want to suppress answers until tunnel setup has completed
+#if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+    mDNSBool Restart;                       // This question should be restarted soon.
+#endif
+    mDNSs32 staleTime;                      // When expired cache data stands in if upstream hasn't answered (ServeStaleUnicastAnswers)
+    DomainAuthInfo       *AuthInfo;         // Non-NULL if query is currently being done using Private DNS
     UDPSocket            *LocalSocket;
+    ZoneData             *nta;              // Used for getting zone data for private or LLQ query
+    struct tcpInfo_t *tcp;
+#if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+    DNSTCPConnection *tcpConn;              // Pooled connection a plain unicast query is outstanding on, if any
+#endif
+    mDNSAddr servAddr;                      // Address and port learned from _dns-llq, _dns-llq-tls or _dns-query-tls SRV query
+    mDNSIPPort servPort;
+    mDNSIPPort tcpSrcPort;                  // Local Port TCP packet received on;need this as tcp struct is disposed
+                                            // by tcpCallback before calling into mDNSCoreReceive
 
     // |-> DNS Configuration related fields used in uDNS (Subset of Wide Area/Unicast fields)
 #if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
@@ -1878,22 +2122,14 @@ struct DNSQuestion_struct
     mdns_querier_t        querier;          // The current querier.
 #else
     DNSServer            *qDNSServer;       // Caching server for this query (in the absence of an SRV saying otherwise)
+    DNSServer *raceServer;                  // Runner-up server the first query is raced against (RaceUnicastServers)
     mDNSOpaque128 validDNSServers;          // Valid DNSServers for this question
+    mDNSs32 uDNSSendTime;                   // When the query went to qDNSServer, for timing the reply; zero if retransmitted
+    mDNSs32 raceTime;                       // When the query is due to go (or went) to raceServer
     mDNSu16 noServerResponse;               // At least one server did not respond.
     mDNSBool triedAllServersOnce;           // True if all DNS servers have been tried once.
     mDNSu8 unansweredQueries;               // The number of unanswered queries to this server
-#endif
-    AllowExpiredState allowExpired;         // Allow expired answers state (see enum AllowExpired_None, etc. above)
-
-    ZoneData             *nta;              // Used for getting zone data for private or LLQ query
-    mDNSAddr servAddr;                      // Address and port learned from _dns-llq, _dns-llq-tls or _dns-query-tls SRV query
-    mDNSIPPort servPort;
-    struct tcpInfo_t *tcp;
-    mDNSIPPort tcpSrcPort;                  // Local Port TCP packet received on;need this as tcp struct is disposed
-                                            // by tcpCallback before calling into mDNSCoreReceive
-    mDNSu8 NoAnswer;                        // Set if we want to suppress answers until tunnel setup has completed
-#if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
-    mDNSBool Restart;                       // This question should be restarted soon.
+    UnicastRaceState raceState;             // See UnicastRace_None etc. above
 #endif
 
     // LLQ-specific fields. These fields are only meaningful when LongLived flag is set
@@ -1920,41 +2156,7 @@ struct DNSQuestion_struct
     mdns_dns_service_id_t CustomID;
 #endif
 
-    // Client API fields: The client must set up these fields *before* calling mDNS_StartQuery()
-    mDNSInterfaceID InterfaceID;            // Non-zero if you want to issue queries only on a single specific IP interface
-    mDNSu32  flags;                         // flags from original DNSService*() API request.
-    mDNSOpaque16 TargetQID;                 // DNS or mDNS message ID.
-    domainname qname;
-    domainname firstExpiredQname;           // first expired qname in request chain
-    mDNSu16 qtype;
-    mDNSu16 qclass;
-    mDNSBool LongLived;                     // Set by client for calls to mDNS_StartQuery to indicate LLQs to unicast layer.
-    mDNSBool ExpectUnique;                  // Set by client if it's expecting unique RR(s) for this question, not shared RRs
-    mDNSBool ForceMCast;                    // Set by client to force mDNS query, even for apparently uDNS names
-    mDNSBool ReturnIntermed;                // Set by client to request callbacks for intermediate CNAME/NXDOMAIN results
-    mDNSBool SuppressUnusable;              // Set by client to suppress unusable queries to be sent on the wire
-    mDNSBool TimeoutQuestion;               // Timeout this question if there is no reply in configured time
-    mDNSBool IsUnicastDotLocal;             // True if this is a dot-local query that should be answered via unicast DNS.
-    mDNSBool WakeOnResolve;                 // Send wakeup on resolve
-    mDNSBool UseBackgroundTraffic;          // Set by client to use background traffic class for request
-    mDNSBool AppendSearchDomains;           // Search domains can be appended for this query
-    mDNSBool ForcePathEval;                 // Perform a path evaluation even if kDNSServiceFlagsPathEvaluationDone is set.
-#if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
-    mDNSBool RequireEncryption;             // Set by client to require encrypted queries
-#endif
-#if MDNSRESPONDER_SUPPORTS(APPLE, AUDIT_TOKEN)
-    mDNSBool inAppBrowserRequest;           // Is request associated with an in-app-browser
-    audit_token_t  peerAuditToken;          // audit token of the peer requesting the question
-    audit_token_t  delegateAuditToken;      // audit token of the delegated client the question is for
-#endif
-    mDNSu8 ProxyQuestion;                   // Proxy Question
-    mDNSs32 pid;                            // Process ID of the client that is requesting the question
-    mDNSu8  uuid[UUID_SIZE];                // Unique ID of the client that is requesting the question (valid only if pid is zero)
-    mDNSu32 euid;                           // Effective User Id of the client that is requesting the question
-    mDNSu32 request_id;                     // The ID of request that generates the current question
-    mDNSQuestionCallback *QuestionCallback;
-    mDNSQuestionResetHandler ResetHandler;
-    void                 *QuestionContext;
+    domainname firstExpiredQname;           // first expired qname in request chain (only for allowExpired questions)
 #if MDNSRESPONDER_SUPPORTS(APPLE, METRICS)
     uDNSMetrics metrics;                    // Data used for collecting unicast DNS query metrics.
 #endif
@@ -1983,6 +2185,10 @@ struct ZoneData_struct
     mDNSBool ZonePrivate;               // Discovered result: Does zone require encrypted queries?
     ZoneDataCallback *ZoneDataCallback; // Caller-specified function to be called upon completion
     void             *ZoneDataContext;
+    ZoneData         *next;             // Next GetZoneData operation in progress
+    ZoneData         *Leader;           // Lookup already walking our part of the tree, whose result we will share
+    mDNSu32 ZoneTTL;                    // Shortest TTL (in seconds) of the answers so far, zero if not worth caching
+    mDNSu8 ZoneDataState;               // Walking, following Leader, or waiting for uDNS_Tasks (see uDNS.c)
     DNSQuestion question;               // Storage for any active question
 };
 
@@ -2029,6 +2235,36 @@ typedef struct ClientTunnel
 
 typedef struct NetworkInterfaceInfo_struct NetworkInterfaceInfo;
 
+// m->InterfaceIDHash finds the first NetworkInterfaceInfo for an InterfaceID without walking m->HostInterfaces
+#ifndef INTERFACE_HASH_SLOTS
+#define INTERFACE_HASH_SLOTS 37
+#endif
+
+// Token bucket for the query flood limits (see mDNSQueryFlood below). 'tokens' is in 1/mDNSPlatformOneSecond
+// queries, so that refilling at n queries per second adds n per tick.
+typedef struct
+{
+    mDNSs32 LastRefill;                 // When 'tokens' was last topped up
+    mDNSu32 tokens;
+    mDNSBool throttled;                 // Ran dry, and hasn't yet refilled far enough to be let through again
+} mDNSQueryBucket;
+
+// Kinds of DNS message, for the per-interface traffic counts: anything with the QR bit set is a response, a standard
+// query carrying authority records is a probe (the proposed records ride in the authority section), anything else is a query
+typedef enum
+{
+    mDNSTrafficKind_Query = 0,
+    mDNSTrafficKind_Response,
+    mDNSTrafficKind_Probe,
+    mDNSTrafficKind_Count
+} mDNSTrafficKind;
+
+typedef struct
+{
+    mDNSu32 packets[mDNSTrafficKind_Count];
+    mDNSu32 bytes[mDNSTrafficKind_Count];   // Whole DNS message, header included; not the IP or UDP headers
+} mDNSInterfaceTraffic;
+
 // A NetworkInterfaceInfo_struct serves two purposes:
 // 1. It holds the address, PTR and HINFO records to advertise a given IP address on a given physical interface
 // 2. It tells mDNSCore which physical interfaces are available; each physical interface has its own unique InterfaceID.
@@ -2042,6 +2278,7 @@ struct NetworkInterfaceInfo_struct
 {
     // Internal state fields. These are used internally by mDNSCore; the client layer needn't be concerned with them.
     NetworkInterfaceInfo *next;
+    NetworkInterfaceInfo *NextInIDHash; // Next in m->InterfaceIDHash chain, if this is the first entry for its InterfaceID
 
     mDNSu8 InterfaceActive;             // Set if interface is sending & receiving packets (see comment above)
     mDNSu8 IPv4Available;               // If InterfaceActive, set if v4 available on this InterfaceID
@@ -2054,6 +2291,15 @@ struct NetworkInterfaceInfo_struct
     mDNSs32 NextSPSAttempt;             // -1 if we're not currently attempting to register with any Sleep Proxy
     mDNSs32 NextSPSAttemptTime;
 
+    mDNSu32 PacketsReceived;            // Packets received on this InterfaceID (counted on the first entry for the InterfaceID)
+    mDNSu32 PacketsSent;                // Packets sent on this InterfaceID (counted on the first entry for the InterfaceID)
+    mDNSInterfaceTraffic TrafficIn;     // Received packets and bytes by kind (first entry only, as above)
+    mDNSInterfaceTraffic TrafficOut;    // Sent packets and bytes by kind (first entry only, as above)
+    mDNSu32 McastRateCount;             // Multicast packets sent or received since McastRateStart (first entry only, as above)
+    mDNSs32 McastRateStart;             // Start of the current multicast rate measurement window
+    mDNSu32 McastRate;                  // Smoothed multicast packets per second, as of McastRateStart
+    mDNSQueryBucket QueryBucket;        // Queries received from all sources together (first entry only, as above)
+
     // Standard AuthRecords that every Responder host should have (one per active IP address)
     AuthRecord RR_A;                    // 'A' or 'AAAA' (address) record for our ".local" name
     AuthRecord RR_PTR;                  // PTR (reverse lookup) record
@@ -2077,6 +2323,7 @@ struct NetworkInterfaceInfo_struct
                                         // address records
     mDNSBool SupportsUnicastMDNSResponse;  // Indicates that the interface supports unicast responses
                                         // to Bonjour queries.  Generally true for an interface.  
+    mDNSu32 MTU;                        // Link MTU in bytes, or zero if the platform layer doesn't know it
 };
 
 #define SLE_DELETE                      0x00000001
@@ -2114,9 +2361,24 @@ extern SearchListElem *SearchList;      // This really ought to be part of mDNS_
 
 typedef void mDNSCallback (mDNS *const m, mStatus result);
 
+// The cache hash table starts out with CACHE_HASH_SLOTS slots. It is grown and shrunk by linear hashing,
+// splitting or merging a bounded number of slots on each mDNS_Execute pass, so that the average number of
+// CacheGroups per slot stays between 1/CACHE_HASH_MIN_LOAD and CACHE_HASH_MAX_LOAD.
 #ifndef CACHE_HASH_SLOTS
 #define CACHE_HASH_SLOTS 499
 #endif
+#ifndef CACHE_HASH_MAX_SLOTS
+#define CACHE_HASH_MAX_SLOTS (CACHE_HASH_SLOTS * 1024)
+#endif
+#define CACHE_HASH_MAX_LOAD     2
+#define CACHE_HASH_MIN_LOAD     2
+#define CACHE_HASH_RESIZE_STEPS 64
+
+// Questions in m->Questions are also chained into m->QuestionHash by qnamehash, in the same relative order as
+// m->Questions, so that duplicate detection and answer delivery only visit questions with the right name hash.
+#ifndef QUESTION_HASH_SLOTS
+#define QUESTION_HASH_SLOTS 499
+#endif
 
 enum
 {
@@ -2148,10 +2410,205 @@ typedef struct
     mDNSu32 CacheRefreshQueries;            // Number of queries that we sent for refreshing cache
     mDNSu32 CacheRefreshed;                 // Number of times the cache was refreshed due to a response
     mDNSu32 WakeOnResolves;                 // Number of times we did a wake on resolve
+    mDNSu32 CacheHits;                      // Cached answers delivered to new questions
+    mDNSu32 CacheMisses;                    // New questions for which the cache had no answer
+    mDNSu32 DuplicateQuestions;             // New questions that became duplicates of an existing question
+    mDNSu32 ExecuteRuns;                    // Number of times mDNS_Execute found scheduled work to do
+    mDNSu32 ExecuteTicks;                   // Total time spent doing that work, in mDNSPlatformOneSecond units
+    mDNSu32 ExecuteMaxTicks;                // Longest single run of mDNS_Execute
+    mDNSu32 ReceiveRuns;                    // Number of times received packets were processed under the lock
+    mDNSu32 ReceiveTicks;                   // Total time spent processing received packets
+    mDNSu32 ReceiveMaxTicks;                // Longest single run of packet processing
+    mDNSu32 QuestionRestartBursts;          // Network changes that restarted more than one question at once
+    mDNSu32 QuestionRestartMax;             // Most questions restarted by a single network change
+    mDNSu32 QuestionRestartsSpread;         // Restarts held back to spread a burst out
+    mDNSu32 BusyLinkQueryBackoffs;          // Query intervals widened an extra step because the link was busy
+    mDNSu32 WakeupsThisMinute;              // mDNS_Execute runs since WakeupMinuteStart
+    mDNSu32 WakeupsLastMinute;              // mDNS_Execute runs in the last complete minute
+    mDNSu32 WakeupsMaxPerMinute;            // Most mDNS_Execute runs in any one minute
+    mDNSs32 WakeupMinuteStart;              // Start of the minute being counted in WakeupsThisMinute (0 if none yet)
+    mDNSu32 NegativeSOAShared;              // SOA copies not kept because a negative entry for the same name had one
+    mDNSu32 SharedResponseAnswers;          // Responses that reused the answer section built for the previous interface
+    mDNSu32 QueryFloodSourceDrops;          // Queries dropped unread because their source was over its rate limit
+    mDNSu32 QueryFloodInterfaceDrops;       // Queries dropped unread because their interface was over its rate limit
+    mDNSu32 QueryFloodThrottles;            // Times a source or interface went over its limit
+    mDNSu32 AnswerBatches;                  // Times a run of held-back cache answers was handed to its questions
+    mDNSu32 AnswerBatchAnswers;             // Answers delivered that way
+    mDNSu32 AnswerBatchMaxAnswers;          // Most answers delivered in any one batch
 } mDNSStatistics;
 
 extern void LogMDNSStatisticsToFD(int fd, mDNS *const m);
 
+// Multicast packets per second on an interface (sent and received, smoothed over a few seconds), as of time 'now'.
+// Pass the first NetworkInterfaceInfo for the InterfaceID, which is where the core does its per-interface counting.
+extern mDNSu32 mDNSCoreInterfaceMulticastRate(const NetworkInterfaceInfo *const intf, mDNSs32 now);
+
+// Optional profiling of mDNS_Execute. When m->ExecuteProfiling is set, each run records how long each of its phases took,
+// and how late the run started relative to m->NextScheduledEvent, in power-of-two histograms of mDNSPlatformRawTime ticks.
+// Bucket 0 counts zero-tick samples, bucket b counts samples of [2^(b-1), 2^b) ticks, and the last bucket everything beyond.
+// While profiling is on, a one-line summary is logged every ExecuteProfileReportInterval.
+// The same histogram is kept of how long the mDNS lock is held from the outermost mDNS_Lock to the matching mDNS_Unlock,
+// along with the longest single hold and the function that took the lock for it, to show where contention comes from.
+typedef enum
+{
+    ExecutePhase_CacheCheck = 0,    // Cache expiration and hash table resizing
+    ExecutePhase_SPS,               // Sleep Proxy record checks and keepalives
+    ExecutePhase_NewQuestions,      // Answering new questions from the cache
+    ExecutePhase_LocalEvents,       // Local-only questions and records
+    ExecutePhase_SendQueries,
+    ExecutePhase_SendResponses,
+    ExecutePhase_Unicast,           // Question timeouts, SRV updates, NAT traversal and uDNS tasks
+    ExecutePhase_Count
+} ExecutePhase;
+
+#define ExecuteHistogramBuckets 12
+#define ExecuteProfileReportInterval (mDNSPlatformOneSecond * 60)
+
+typedef struct
+{
+    mDNSu32 Duration[ExecutePhase_Count][ExecuteHistogramBuckets];
+    mDNSu32 Lateness[ExecuteHistogramBuckets];
+    mDNSu32 LockHold[ExecuteHistogramBuckets];
+    mDNSs32 LockHoldLongest;                // Ticks
+    const char *LockHoldLongestBy;          // Function that took the lock for the longest hold
+    mDNSs32 LockTaken;                      // mDNSPlatformRawTime of the current outermost mDNS_Lock
+    const char *LockTakenBy;
+    mDNSs32 NextReport;
+} mDNSExecuteProfile;
+
+extern const char *const ExecutePhaseNames[ExecutePhase_Count];
+extern mDNSu32 ExecuteHistogramBucket(mDNSs32 ticks);
+extern void LogExecuteProfile(mDNS *const m);
+
+// Optional flight recorder of recent DNS traffic. Once mDNS_PacketRingInit() has set aside room for the last 'count'
+// packets, every message sent by mDNSSendDNSMessage or received by mDNSCoreReceive is copied into the ring, cut to
+// PacketRingSnapLen bytes, with its addresses, interface and time. Nothing is formatted until the client layer calls
+// mDNS_PacketRingWritePCAP(), which hands the ring to 'writer' as a pcapng capture and returns the number of packets.
+#define PacketRingSnapLen 1500
+
+typedef struct mDNSPacketRing_struct mDNSPacketRing;
+typedef void mDNSPacketRingWriter(void *context, const void *data, mDNSu32 len);
+
+extern mStatus mDNS_PacketRingInit(mDNS *const m, mDNSu32 count);     // A count of zero frees the ring
+extern mDNSu32 mDNS_PacketRingWritePCAP(mDNS *const m, mDNSPacketRingWriter *writer, void *context);
+
+// Always-on summary of who is making the multicast traffic, for finding chatty devices and service types without a
+// packet capture. mDNSCoreReceive counts every multicast DNS packet against its source address, and the first
+// TrafficStatsMaxNames question names of a query (answer names of a response) against their service type, such as
+// "_ipp._tcp" for "Printer._ipp._tcp.local." ("(other)" for names that aren't part of a service).
+// Each table is a space-saving sketch (Metwally et al.): it tracks at most TrafficStatsSlots keys, and a key that
+// isn't tracked takes over the slot with the smallest count, inheriting that count as its possible overestimate
+// ('error'). Any key that accounts for more than 1/TrafficStatsSlots of the table's total is guaranteed a slot.
+// Every TrafficStatsDecayInterval all counts are halved, so the tables follow what is happening now.
+#define TrafficStatsSlots           32
+#define TrafficStatsTypeLen         40      // Longest service type kept, with its NUL; longer ones are cut short
+#define TrafficStatsMaxNames        8
+#define TrafficStatsDecayInterval   (300 * mDNSPlatformOneSecond)
+
+typedef struct
+{
+    mDNSu32 count;                          // Estimated packets (sources) or names (types) seen for the key
+    mDNSu32 error;                          // How much of 'count' may belong to keys that held the slot before
+    mDNSu32 queries;                        // Counted exactly since the key took the slot
+    mDNSu32 responses;
+    mDNSu32 bytes;                          // Sources only: length of the packets counted
+    union { mDNSAddr addr; char type[TrafficStatsTypeLen]; } key;
+} mDNSTrafficStatsEntry;
+
+typedef struct
+{
+    mDNSu32 total;                          // Everything counted, tracked or not
+    mDNSu32 used;                           // Slots in use, from the start of 'slot'
+    mDNSTrafficStatsEntry slot[TrafficStatsSlots];
+} mDNSTrafficStatsTable;
+
+typedef struct
+{
+    mDNSs32 NextDecay;                      // Zero until the first packet is counted
+    mDNSu32 decays;                         // Times the counts have been halved
+    mDNSTrafficStatsTable types;
+    mDNSTrafficStatsTable sources;
+} mDNSTrafficStats;
+
+extern void mDNS_TrafficStatsReset(mDNS *const m);
+// Fills 'sorted' with the table's entries, largest count first, and returns how many there are
+extern mDNSu32 mDNS_TrafficStatsSorted(const mDNSTrafficStatsTable *const t, const mDNSTrafficStatsEntry *sorted[TrafficStatsSlots]);
+
+// Load shedding for multicast query floods. Per-record rate limiting keeps us from answering too often, but every
+// query still costs a parse and a pass over the records, so a device stuck sending hundreds a second can keep the
+// daemon busy on its own. mDNSCoreReceive therefore charges each query arriving on the mDNS port to a token bucket
+// for its source (QueryFloodRate a second, bursts of QueryFloodBurst) and one for its interface, shared by every
+// source (QueryFloodInterfaceRate and QueryFloodInterfaceBurst), and drops it unread if either is empty. A bucket that
+// runs dry stays closed until it has refilled halfway, so a source hovering at the limit is shut out for a few
+// seconds rather than let through every other packet. Our own queries, looped back to us, are never charged.
+// At most QueryFloodSources sources are tracked; a new one takes over the least recently heard from, preferring ones
+// that aren't being throttled. A flood from ever-changing (spoofed) addresses gets past the per-source buckets, but
+// not the interface's.
+#define QueryFloodSources           64
+#define QueryFloodRate              20      // Queries per second
+#define QueryFloodBurst             60
+#define QueryFloodInterfaceRate     250
+#define QueryFloodInterfaceBurst    500
+
+typedef struct
+{
+    mDNSAddr        addr;
+    mDNSInterfaceID InterfaceID;
+    mDNSQueryBucket bucket;
+    mDNSu32         dropped;                // Queries dropped since the source took the slot
+} mDNSQueryFloodSource;
+
+typedef struct
+{
+    mDNSu32 used;                           // Slots in use, from the start of 'source'
+    mDNSQueryFloodSource source[QueryFloodSources];
+} mDNSQueryFlood;
+
+// Variable-length storage hung off cache entities (oversized rdata, long CacheGroup names, standalone record
+// names) comes from per-size-class slabs instead of individual mDNSPlatformMemAllocate() calls.
+// Allocations larger than the biggest class go straight to mDNSPlatformMemAllocate() but are still counted
+// in the last ("oversize") class. A slab whose objects have all been freed is returned to the platform,
+// except that each class holds on to one empty slab to avoid thrashing at a slab boundary.
+#define MemSlabClasses    6
+#define MemSlabOversize   (MemSlabClasses - 1)
+#define MemSlabBytes      4096
+
+typedef struct MemSlab_struct MemSlab;
+
+// While mDNSCoreReceiveResponse takes in a packet, the cache add events it generates are collected here and delivered
+// once the whole packet has been processed, all in a single drop of the lock, rather than a lock drop for every record
+#define AnswerBatchMax    64
+typedef struct
+{
+    DNSQuestion *q;                         // NULL if the question was stopped, or the record released, before delivery
+    CacheRecord *cr;
+} mDNSBatchedAnswer;
+
+typedef struct
+{
+    mDNSu32  objsize;                       // Largest allocation served by this class; zero for the oversize class
+    MemSlab *available;                     // Slabs with at least one free object
+    MemSlab *empty;                         // At most one completely free slab kept for reuse
+    mDNSu32  slabs;                         // Slabs currently allocated from the platform
+    mDNSu32  inuse;                         // Objects currently handed out
+    mDNSu32  peak;                          // High-water mark of inuse
+    mDNSu32  allocs;                        // Total allocations served
+    mDNSu32  released;                      // Slabs returned to the platform
+} MemSlabClass;
+
+// Cache records are also accounted per InterfaceID (zero for unicast), so a per-interface count is a lookup rather than
+// a walk of the cache, and so that one noisy interface (say a guest network with thousands of devices) can't push every
+// other interface's records out. Once the cache is full, a new record for a multicast interface that already holds at
+// least rrcache_partition_quota percent of the cached records recycles that interface's own least recently used record.
+#define CachePartitionCount         32
+#define CachePartitionDefaultQuota  75
+
+typedef struct
+{
+    mDNSInterfaceID InterfaceID;
+    mDNSu32 used;                           // Cache records held for InterfaceID; zero if this entry is free
+} CachePartition;
+
 // Time constant (~= 260 hours ~= 10 days and 21 hours) used to set
 // various time values to a point well into the future.
 #define FutureTime   0x38000000
@@ -2189,7 +2646,7 @@ struct mDNS_struct
     mDNSs32 NextScheduledEvent;         // Derived from values below
     mDNSs32 ShutdownTime;               // Set when we're shutting down; allows us to skip some unnecessary steps
     mDNSs32 SuppressSending;            // Don't send local-link mDNS packets during this time
-    mDNSs32 NextCacheCheck;             // Next time to refresh cache record before it expires
+    mDNSs32 NextCacheCheck;             // Next time to refresh cache record before it expires (nextcheck of rrcache_checkheap)
     mDNSs32 NextScheduledQuery;         // Next time to send query in its exponential backoff sequence
     mDNSs32 NextScheduledProbe;         // Next time to probe for new authoritative record
     mDNSs32 NextScheduledResponse;      // Next time to send authoritative record(s) in responses
@@ -2234,14 +2691,57 @@ struct mDNS_struct
     DNSQuestion *LocalOnlyQuestions;    // Questions with InterfaceID set to mDNSInterface_LocalOnly or mDNSInterface_P2P
     DNSQuestion *NewLocalOnlyQuestions; // Fresh local-only or P2P questions not yet answered
     DNSQuestion *RestartQuestion;       // Questions that are being restarted (stop followed by start)
+    DNSQuestion *NextHashedQuestion;    // Next question for an answer-delivery walk of a QuestionHash chain
+    mDNSu32 NextQuestionSeq;            // QuestionSeq to give the next question added to m->Questions
+    mDNSBool AnswerBatching;            // Set while a response is being taken in; add events it brings are held back
+    mDNSu32 AnswerBatchCount;           // Add events held in AnswerBatch, in the order they happened
+    mDNSBatchedAnswer AnswerBatch[AnswerBatchMax];
+    DNSQuestion *QuestionHash[QUESTION_HASH_SLOTS];
     mDNSu32 rrcache_size;               // Total number of available cache entries
     mDNSu32 rrcache_totalused;          // Number of cache entries currently occupied
     mDNSu32 rrcache_totalused_unicast;  // Number of cache entries currently occupied by unicast
     mDNSu32 rrcache_active;             // Number of cache entries currently occupied by records that answer active questions
     mDNSu32 rrcache_report;
     CacheEntity *rrcache_free;
-    CacheGroup *rrcache_hash[CACHE_HASH_SLOTS];
-    mDNSs32 rrcache_nextcheck[CACHE_HASH_SLOTS];
+    CacheGroup **rrcache_hash;          // rrcache_slots entries; points to rrcache_hash_initial until the table grows
+    CacheGroup *rrcache_checkheap;      // CacheGroups with a pending cache check, soonest first
+    mDNSu32 rrcache_slots;              // Number of slots in use (always between rrcache_hash_base and 2 * rrcache_hash_base)
+    mDNSu32 rrcache_hash_base;          // Linear hashing modulus for slots that have not yet been split this round
+    mDNSu32 rrcache_hash_capacity;      // Number of slots allocated
+    mDNSu32 rrcache_groups;             // Number of CacheGroups currently in the hash table
+    mDNSs32 NextCacheResize;            // Next time to split or merge cache hash slots; zero if the table is within bounds
+    CacheBlock *rrcache_blocks;         // Storage from mDNS_GrowCacheReleasable, oldest first
+    mDNSu32 rrcache_mem_limit;          // Most bytes of CacheEntity storage, including mDNS_Init's; zero for no limit
+    mDNSBool rrcache_grow_refused;      // Set when growth was turned away at the limit, until some storage is released
+    mDNSs32 NextCacheShrink;            // When to hand idle storage back to the platform; zero if there's nothing to do
+    mDNSu32 rrcache_blocks_released;    // Blocks of cache storage given back to the platform
+    CacheGroup *rrcache_hash_initial[CACHE_HASH_SLOTS];
+    MemSlabClass rrcache_slabs[MemSlabClasses];
+    InternedName **names_hash;          // names_slots buckets (a power of two); NULL until the first name is interned
+    mDNSu32 names_slots;
+    mDNSu32 names_count;                // Distinct names interned
+    mDNSu32 names_bytes;                // Bytes of name storage they take, headers included
+    mDNSu32 names_shared;               // Times a name was found already interned, saving a copy
+    CacheRecord *rrcache_lru;           // Unreferenced cache records, least recently used first; candidates for eviction
+    CacheRecord *rrcache_lru_tail;      // Most recently used unreferenced cache record
+    mDNSu32 rrcache_evictions;          // Total cache records evicted to make room for new ones
+    mDNSu32 rrcache_evict_second;       // Evictions so far in the current one-second window
+    mDNSu32 rrcache_evict_rate;         // Evictions in the last complete one-second window
+    mDNSu32 rrcache_evict_peak;         // Highest evictions in any one-second window
+    mDNSs32 rrcache_evict_window;       // Start of the current one-second window
+    mDNSs32 rrcache_evict_age;          // Age (time since received or refreshed) of the most recently evicted record
+    mDNSs32 rrcache_evict_age_max;      // Age of the oldest record ever evicted
+    CachePartition rrcache_partitions[CachePartitionCount]; // Cache records per InterfaceID, see CachePartition
+    mDNSu32 rrcache_partition_quota;    // Percent of the cache one multicast interface may fill once it's full; 0 for no limit
+    mDNSu32 rrcache_partition_evictions;// Records recycled within their own partition because it was over its quota
+    mDNSu32 rrcache_partition_overflow; // Records not accounted to a partition because all CachePartitionCount were in use
+    mDNSBool ResponseFilter;            // Drop multicast responses with nothing of interest to us (see ResponseIsOfInterest)
+    mDNSu32 PassiveCacheBudget;         // With ResponseFilter, records a second from such responses that are cached anyway
+    mDNSu32 PassiveCacheUsed;           // Records cached that way in the current one-second window
+    mDNSs32 PassiveCacheWindow;         // Start of that window
+    mDNSu32 ResponseFilterAccepted;     // Records in multicast responses that passed the filter
+    mDNSu32 ResponseFilterPassive;      // Records in responses that didn't, cached out of PassiveCacheBudget
+    mDNSu32 ResponseFilterRejected;     // Records in responses dropped by the filter
 
     AuthHash rrauth;
 
@@ -2264,8 +2764,16 @@ struct mDNS_struct
     AuthRecord *DuplicateRecords;       // Records currently 'on hold' because they are duplicates of existing records
     AuthRecord *NewLocalRecords;        // Fresh AuthRecords (public) not yet delivered to our local-only questions
     AuthRecord *CurrentRecord;          // Next AuthRecord about to be examined
+    AuthRecord *NextHashedRecord;       // Next AuthRecord about to be examined by a walk of a ResourceRecordHash chain
+    AuthRecord *ResourceRecordHash[AUTH_HASH_SLOTS]; // The records in ResourceRecords, chained by name hash
+    AuthRecord *NextOwnerRecord;        // Next AuthRecord about to be examined by a walk of an SPSOwnerHash chain
+    AuthRecord *SPSOwnerHash[SPS_HASH_SLOTS];     // The proxy records in ResourceRecords, chained by owner H-MAC
+    AuthRecord *SPSAddressHash[SPS_HASH_SLOTS];   // The proxy records in ResourceRecords with an AddressProxy, by address
+    AuthRecord *SPSKeepaliveHash[SPS_HASH_SLOTS]; // The proxy TCP keepalive records in ResourceRecords, by connection
+    AuthRecord *KeepaliveHeap;          // The same keepalive records, soonest KATimeExpire first
     mDNSBool NewLocalOnlyRecords;       // Fresh AuthRecords (local only) not yet delivered to our local questions
     NetworkInterfaceInfo *HostInterfaces;
+    NetworkInterfaceInfo *InterfaceIDHash[INTERFACE_HASH_SLOTS]; // First entry in HostInterfaces for each InterfaceID
     mDNSs32 ProbeFailTime;
     mDNSu32 NumFailedProbes;
     mDNSs32 SuppressProbes;
@@ -2277,6 +2785,8 @@ struct mDNS_struct
 
 #if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
     DNSServer        *DNSServers;           // list of DNS servers
+    DNSServerIndex    DNSServerIndex;       // DNSServers by domain
+    DNSTCPConnection *DNSTCPConnections;    // TCP connections to DNS servers, shared by questions that fell back to TCP
 #endif
     McastResolver    *McastResolvers;       // list of Mcast Resolvers
 
@@ -2310,6 +2820,8 @@ struct mDNS_struct
     mDNSu32 LastNATupseconds;                   // NAT engine uptime in seconds, from most recent NAT packet
     mDNSs32 LastNATReplyLocalTime;              // Local time in ticks when most recent NAT packet was received
     mDNSu16 LastNATMapResultCode;               // Most recent error code for mappings
+    mDNSs32 NATGatewayLatency;                  // Smoothed time the gateway takes to answer a mapping request, zero until measured
+    mDNSs32 NATGatewayMaxLatency;               // Longest it has taken
 
     tcpLNTInfo tcpAddrInfo;                     // legacy NAT traversal TCP connection info for external address
     tcpLNTInfo tcpDeviceInfo;                   // legacy NAT traversal TCP connection info for device info
@@ -2366,6 +2878,11 @@ struct mDNS_struct
 #endif
 
     mDNSStatistics   mDNSStats;
+    mDNSBool         ExecuteProfiling;      // Set by the client layer to turn on mDNSExecuteProfile collection
+    mDNSExecuteProfile ExecuteProfile;
+    mDNSPacketRing  *PacketRing;            // Set up by mDNS_PacketRingInit(); NULL when not recording packets
+    mDNSTrafficStats TrafficStats;
+    mDNSQueryFlood   QueryFlood;
 
     // Fixed storage, to avoid creating large objects on the stack
     // The imsg is declared as a union with a pointer type to enforce CPU-appropriate alignment
@@ -2380,7 +2897,7 @@ struct mDNS_struct
 };
 
 #define FORALL_CACHERECORDS(SLOT,CG,CR)                           \
-    for ((SLOT) = 0; (SLOT) < CACHE_HASH_SLOTS; (SLOT)++)         \
+    for ((SLOT) = 0; (SLOT) < m->rrcache_slots; (SLOT)++)         \
         for ((CG)=m->rrcache_hash[(SLOT)]; (CG); (CG)=(CG)->next) \
             for ((CR) = (CG)->members; (CR); (CR)=(CR)->next)
 
@@ -2446,6 +2963,9 @@ extern const mDNSOpaque64 zeroOpaque64;
 extern const mDNSOpaque128 zeroOpaque128;
     
 extern mDNSBool StrictUnicastOrdering;
+extern mDNSBool RaceUnicastServers;
+extern mDNSBool PrefetchUnicastAnswers;
+extern mDNSBool ServeStaleUnicastAnswers;
 
 #define localdomain           (*(const domainname *)"\x5" "local")
 #define DeviceInfoName        (*(const domainname *)"\xC" "_device-info" "\x4" "_tcp")
@@ -2577,6 +3097,20 @@ extern mStatus mDNS_Init      (mDNS *const m, mDNS_PlatformSupport *const p,
 
 extern void    mDNS_ConfigChanged(mDNS *const m);
 extern void    mDNS_GrowCache (mDNS *const m, CacheEntity *storage, mDNSu32 numrecords);
+// Like mDNS_GrowCache, but storage must come from mDNSPlatformMemAllocate, and mDNSCore frees it with mDNSPlatformMemFree
+// once the cache has been mostly idle for a while. The first entity holds the block's bookkeeping. If the block would take
+// the cache past m->rrcache_mem_limit it's freed straight away, and no more mStatus_GrowCache requests are made until
+// the cache gives some storage back.
+extern void    mDNS_GrowCacheReleasable(mDNS *const m, CacheEntity *storage, mDNSu32 numrecords);
+// mDNS_SnapshotCache serializes the multicast cache into buffer and returns the number of bytes used (call it before mDNS_StartExit);
+// mDNS_RestoreCacheSnapshot loads such a snapshot back after mDNS_Init and returns the number of records restored
+extern mDNSu32 mDNS_SnapshotCache(mDNS *const m, mDNSu8 *buffer, mDNSu32 length);
+extern mDNSu32 mDNS_RestoreCacheSnapshot(mDNS *const m, const mDNSu8 *snapshot, mDNSu32 length);
+// mDNS_ForEachCachedAddress calls callback with each multicast A and AAAA record in the cache that has been delivered and
+// has at least a second to live, with its interface index and remaining lifetime in seconds, and returns how many there were.
+// The callback runs under mDNS_Lock, so it must not call back into mDNSCore.
+typedef void mDNS_CachedAddressCallback(void *context, const ResourceRecord *rr, mDNSu32 ifindex, mDNSu32 remain);
+extern mDNSu32 mDNS_ForEachCachedAddress(mDNS *const m, mDNS_CachedAddressCallback *callback, void *context);
 extern void    mDNS_StartExit (mDNS *const m);
 extern void    mDNS_FinalExit (mDNS *const m);
 #define mDNS_Close(m) do { mDNS_StartExit(m); mDNS_FinalExit(m); } while(0)
@@ -2590,6 +3124,7 @@ extern mStatus mDNS_Update    (mDNS *const m, AuthRecord *const rr, mDNSu32 newt
 extern mStatus mDNS_Deregister(mDNS *const m, AuthRecord *const rr);
 
 extern mStatus mDNS_StartQuery(mDNS *const m, DNSQuestion *const question);
+extern void    mDNS_AnswerNewQuestions(mDNS *const m);
 extern mStatus mDNS_StopQuery (mDNS *const m, DNSQuestion *const question);
 extern mStatus mDNS_StopQueryWithRemoves(mDNS *const m, DNSQuestion *const question);
 extern mStatus mDNS_Reconfirm (mDNS *const m, CacheRecord *const cacherr);
@@ -2698,6 +3233,7 @@ extern mDNSBool mDNS_AddressIsLocalSubnet(mDNS *const m, const mDNSInterfaceID I
 
 #if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
 extern DNSServer *GetServerForQuestion(mDNS *m, DNSQuestion *question);
+extern DNSServer *GetRaceServerForQuestion(mDNS *m, const DNSQuestion *question);
 #endif
 extern mDNSu32 SetValidDNSServers(mDNS *m, DNSQuestion *question);
 #if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
@@ -2927,6 +3463,7 @@ extern DNSServer *mDNS_AddDNSServer(mDNS *const m, const domainname *d, const mD
                                     const mDNSIPPort port, ScopeType scopeType, mDNSu32 timeout, mDNSBool cellIntf, mDNSBool isExpensive, mDNSBool isConstrained, mDNSBool isCLAT46,
                                     mDNSu32 resGroupID, mDNSBool reqA, mDNSBool reqAAAA, mDNSBool reqDO);
 extern void PenalizeDNSServer(mDNS *const m, DNSQuestion *q, mDNSOpaque16 responseFlags);
+extern mDNSBool uDNS_NoteServerResponse(mDNS *const m, DNSQuestion *q, const mDNSAddr *srcaddr, mDNSIPPort srcport);
 #endif
 extern void mDNS_AddSearchDomain(const domainname *const domain, mDNSInterfaceID InterfaceID);
 
@@ -2939,6 +3476,7 @@ extern McastResolver *mDNS_AddMcastResolver(mDNS *const m, const domainname *d,
 // Routines called by the core, exported by DNSDigest.c
 
 // Convert an arbitrary base64 encoded key key into an HMAC key (stored in AuthInfo struct)
+// The key may be prefixed with "hmac-sha256:" or "hmac-md5:" to choose the TSIG algorithm; the default is hmac-md5
 extern mDNSs32 DNSDigest_ConstructHMACKeyfromBase64(DomainAuthInfo *info, const char *b64key);
 
 // sign a DNS message.  The message must be complete, with all values in network byte order.  end points to the end
@@ -3029,6 +3567,33 @@ extern void mDNSPlatformQsort       (void *base, int nel, int width, int (*compa
 extern void     mDNSPlatformValidateLists (void);
 extern void     mDNSPlatformAddListValidator(mDNSListValidator *validator,
                                              mDNSListValidationFunction *vf, const char *vfName, void *context);
+#elif MDNS_MALLOC_PROFILING
+extern void *mallocL(const char *msg, mDNSu32 size);
+extern void *callocL(const char *msg, mDNSu32 size);
+extern void freeL(const char *msg, void *x);
+
+#define mDNSMallocCallsiteLine_(L) # L
+#define mDNSMallocCallsiteLine(L) mDNSMallocCallsiteLine_(L)
+#define mDNSMallocCallsite __FILE__ ":" mDNSMallocCallsiteLine(__LINE__)
+#define         mDNSPlatformMemAllocate(X)      mallocL(mDNSMallocCallsite, X)
+#define         mDNSPlatformMemAllocateClear(X) callocL(mDNSMallocCallsite, X)
+#define         mDNSPlatformMemFree(X)          freeL(mDNSMallocCallsite, X)
+
+#ifndef MDNS_MALLOC_PROFILE_TAGS
+#define MDNS_MALLOC_PROFILE_TAGS 512   // Tags beyond this many are counted together under "(other tags)"
+#endif
+
+typedef struct
+{
+    const char *tag;
+    mDNSu32 blocks;                     // Live blocks
+    mDNSu32 bytes;                      // Live bytes, as requested (not counting allocator overhead)
+    mDNSu32 peakBytes;
+    mDNSu32 allocations;                // Every allocation ever made with this tag
+} mDNSMallocProfileEntry;
+
+// Copies out up to max entries, for the tags that have been used, and returns how many it copied
+extern mDNSu32 mDNSMallocProfileCopy(mDNSMallocProfileEntry *entries, mDNSu32 max);
 #else
 extern void *   mDNSPlatformMemAllocate(mDNSu32 len);
 extern void *   mDNSPlatformMemAllocateClear(mDNSu32 len);
@@ -3112,6 +3677,7 @@ extern void       mDNSPlatformSendRawPacket(const void *const msg, const mDNSu8
 extern void       mDNSPlatformSetLocalAddressCacheEntry(const mDNSAddr *const tpa, const mDNSEthAddr *const tha, mDNSInterfaceID InterfaceID);
 extern void       mDNSPlatformSourceAddrForDest(mDNSAddr *const src, const mDNSAddr *const dst);
 extern void       mDNSPlatformSendKeepalive(mDNSAddr *sadd, mDNSAddr *dadd, mDNSIPPort *lport, mDNSIPPort *rport, mDNSu32 seq, mDNSu32 ack, mDNSu16 win);
+extern void       mDNSPlatformSendKeepalives(const mDNSKeepalivePacket *packets, int count);
 extern mStatus    mDNSPlatformRetrieveTCPInfo(mDNSAddr *laddr, mDNSIPPort *lport, mDNSAddr *raddr,  mDNSIPPort *rport, mDNSTCPInfo *mti);
 extern mStatus    mDNSPlatformGetRemoteMacAddr(mDNSAddr *raddr);
 extern mStatus    mDNSPlatformStoreSPSMACAddr(mDNSAddr *spsaddr, char *ifname);
@@ -3186,6 +3752,8 @@ extern void     LNT_ClearState(mDNS *const m);
 // (on platforms like OT that allow asynchronous initialization of the networking stack).
 //
 // mDNSCoreReceive() is called when a UDP packet is received
+// mDNSCoreReceiveBatch() is the same for several UDP packets at once, all handled under a single lock
+// (packets that fail a lock-free sanity check first have their msg pointer set to NULL and are skipped)
 //
 // mDNSCoreMachineSleep() is called when the machine sleeps or wakes
 // (This refers to heavyweight laptop-style sleep/wake that disables network access,
@@ -3205,10 +3773,22 @@ typedef enum
 
 extern mStatus  mDNS_RegisterInterface  (mDNS *const m, NetworkInterfaceInfo *set, InterfaceActivationSpeed probeDelay);
 extern void     mDNS_DeregisterInterface(mDNS *const m, NetworkInterfaceInfo *set, InterfaceActivationSpeed probeDelay);
+extern void     mDNS_RehashInterfaces(mDNS *const m);     // Call after reordering m->HostInterfaces
 extern void     mDNSCoreInitComplete(mDNS *const m, mStatus result);
 extern void     mDNSCoreReceive(mDNS *const m, DNSMessage *const msg, const mDNSu8 *const end,
                                 const mDNSAddr *const srcaddr, const mDNSIPPort srcport,
                                 const mDNSAddr *dstaddr, const mDNSIPPort dstport, const mDNSInterfaceID InterfaceID);
+typedef struct
+{
+    DNSMessage     *msg;
+    const mDNSu8   *end;
+    mDNSAddr        srcaddr;
+    mDNSIPPort      srcport;
+    mDNSAddr        dstaddr;
+    mDNSIPPort      dstport;
+    mDNSInterfaceID InterfaceID;
+} mDNSReceivedPacket;
+extern void     mDNSCoreReceiveBatch(mDNS *const m, mDNSReceivedPacket *const pkts, const mDNSu32 count);
 #if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
 extern void     mDNSCoreReceiveForQuerier(mDNS *m, DNSMessage *msg, const mDNSu8 *end, mdns_querier_t querier, mdns_dns_service_t service);
 #endif
@@ -3244,8 +3824,10 @@ extern mDNSBool mDNSAddrIsDNSMulticast(const mDNSAddr *ip);
 
 extern CacheRecord *CreateNewCacheEntry(mDNS *const m, const mDNSu32 slot, CacheGroup *cg, mDNSs32 delay, mDNSBool Add, const mDNSAddr *sourceAddress);
 extern CacheGroup *CacheGroupForName(const mDNS *const m, const mDNSu32 namehash, const domainname *const name);
+extern mDNSu32 CacheHashSlot(const mDNS *const m, const mDNSu32 namehash);
 extern void ReleaseCacheRecord(mDNS *const m, CacheRecord *r);
-extern void ScheduleNextCacheCheckTime(mDNS *const m, const mDNSu32 slot, const mDNSs32 event);
+extern CacheRecord *NegativeCacheRecordSOA(const mDNS *const m, const CacheRecord *const neg);
+extern void ScheduleNextCacheCheckTime(mDNS *const m, const CacheRecord *const cr, const mDNSs32 event);
 extern void SetNextCacheCheckTimeForRecord(mDNS *const m, CacheRecord *const rr);
 extern void GrantCacheExtensions(mDNS *const m, DNSQuestion *q, mDNSu32 lease);
 extern void MakeNegativeCacheRecord(mDNS *const m, CacheRecord *const cr, const domainname *const name,
@@ -3257,6 +3839,7 @@ extern void MakeNegativeCacheRecord(mDNS *const m, CacheRecord *const cr, const
 #endif
 extern void CompleteDeregistration(mDNS *const m, AuthRecord *rr);
 extern void AnswerCurrentQuestionWithResourceRecord(mDNS *const m, CacheRecord *const rr, const QC_result AddRecord);
+extern void AnswerCurrentQuestionWithStaleRecords(mDNS *const m);
 extern void AnswerQuestionByFollowingCNAME(mDNS *const m, DNSQuestion *q, ResourceRecord *rr);
 extern char *InterfaceNameForID(mDNS *const m, const mDNSInterfaceID InterfaceID);
 #if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
@@ -3277,6 +3860,9 @@ extern AuthGroup *AuthGroupForName(AuthHash *r, const mDNSu32 namehash, const do
 extern AuthGroup *AuthGroupForRecord(AuthHash *r, const ResourceRecord *const rr);
 extern AuthGroup *InsertAuthRecord(mDNS *const m, AuthHash *r, AuthRecord *rr);
 extern AuthGroup *RemoveAuthRecord(mDNS *const m, AuthHash *r, AuthRecord *rr);
+// Resizes r's table to suit about names AuthGroups (no smaller than AUTH_HASH_SLOTS), unless it's already within a factor
+// of two or so. Zero goes back to rrauth_hash, freeing the table. For resizing m->rrauth, the lock must be held.
+extern void AuthHashSize(AuthHash *r, mDNSu32 names);
 
 #if APPLE_OSX_mDNSResponder
 // For now this LocalSleepProxy stuff is specific to Mac OS X.
@@ -3523,7 +4109,7 @@ struct CompileTimeAssertionChecks_mDNS
     // cause structure sizes (and therefore memory usage) to balloon unreasonably.
     char sizecheck_RDataBody           [(sizeof(RDataBody)            ==   264) ? 1 : -1];
     char sizecheck_ResourceRecord      [(sizeof(ResourceRecord)       <=    72) ? 1 : -1];
-    char sizecheck_AuthRecord          [(sizeof(AuthRecord)           <=  1176) ? 1 : -1];
+    char sizecheck_AuthRecord          [(sizeof(AuthRecord)           <=  1240) ? 1 : -1];
     char sizecheck_CacheRecord         [(sizeof(CacheRecord)          <=   232) ? 1 : -1];
     char sizecheck_CacheGroup          [(sizeof(CacheGroup)           <=   232) ? 1 : -1];
     char sizecheck_DNSQuestion         [(sizeof(DNSQuestion)          <=  1216) ? 1 : -1];
@@ -3531,10 +4117,10 @@ struct CompileTimeAssertionChecks_mDNS
     char sizecheck_NATTraversalInfo    [(sizeof(NATTraversalInfo)     <=   200) ? 1 : -1];
     char sizecheck_HostnameInfo        [(sizeof(HostnameInfo)         <=  3050) ? 1 : -1];
 #if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
-    char sizecheck_DNSServer           [(sizeof(DNSServer)            <=   328) ? 1 : -1];
+    char sizecheck_DNSServer           [(sizeof(DNSServer)            <=   336) ? 1 : -1];
 #endif
     char sizecheck_NetworkInterfaceInfo[(sizeof(NetworkInterfaceInfo) <=  9000) ? 1 : -1];
-    char sizecheck_ServiceRecordSet    [(sizeof(ServiceRecordSet)     <=  4760) ? 1 : -1];
+    char sizecheck_ServiceRecordSet    [(sizeof(ServiceRecordSet)     <=  5016) ? 1 : -1];
     char sizecheck_DomainAuthInfo      [(sizeof(DomainAuthInfo)       <=   944) ? 1 : -1];
 #if APPLE_OSX_mDNSResponder
     char sizecheck_ClientTunnel        [(sizeof(ClientTunnel)         <=  1560) ? 1 : -1];
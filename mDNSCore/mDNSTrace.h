@@ -0,0 +1,64 @@
+/* -*- Mode: C; tab-width: 4 -*-
+ *
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __mDNSTrace_h
+#define __mDNSTrace_h
+
+// Static tracepoints for profiling a running daemon without rebuilding it.
+//
+// When built with MDNS_USDT_PROBES set, each mDNS_TRACEn() below is a <sys/sdt.h> probe in the "mDNSResponder"
+// provider. On Linux that's a USDT note which bpftrace and perf attach to by name, e.g.
+//     bpftrace -e 'usdt:/usr/sbin/mdnsd:mDNSResponder:cache__add { @[arg1] = count(); }'
+// and on macOS a DTrace USDT probe (mDNSResponder$target:::cache-add). An unattached probe is a single nop, but
+// its arguments are still evaluated, so probes only take values that are already at hand. Without
+// MDNS_USDT_PROBES they compile away to nothing.
+//
+// Probe                    Arguments
+// receive__start           message length, InterfaceID
+// receive__done            message length, InterfaceID
+// receive__batch__start    packet count
+// receive__batch__done     packet count
+// cache__add               name hash, rrtype, InterfaceID, rdlength
+// cache__evict             name hash, rrtype, InterfaceID, age in ticks
+// question__start          question pointer, qname hash, qtype, InterfaceID
+// question__stop           question pointer, qname hash, qtype, InterfaceID
+// send__query              message length, InterfaceID, questions, known answers
+// send__response           message length, InterfaceID, answers, additionals
+// request__start           request op, request ID, client PID      (uds_daemon.c)
+// request__done            request op, request ID, mStatus result  (uds_daemon.c)
+// client__read__start      socket, bytes still needed               (dnssd_clientstub.c, in the client library)
+// client__read__done       socket, bytes read
+// client__reply__start     reply op, reply length
+// client__reply__done      reply op, reply length
+//
+// Pairing a *__start with its *__done (or question__start with question__stop on the question pointer) in a
+// bpftrace script gives latency histograms. Timestamps come from the tracer, so the probes never read the clock.
+
+#if MDNS_USDT_PROBES
+    #include <sys/sdt.h>
+    #define mDNS_TRACE1(NAME, A)          DTRACE_PROBE1(mDNSResponder, NAME, A)
+    #define mDNS_TRACE2(NAME, A, B)       DTRACE_PROBE2(mDNSResponder, NAME, A, B)
+    #define mDNS_TRACE3(NAME, A, B, C)    DTRACE_PROBE3(mDNSResponder, NAME, A, B, C)
+    #define mDNS_TRACE4(NAME, A, B, C, D) DTRACE_PROBE4(mDNSResponder, NAME, A, B, C, D)
+#else
+    #define mDNS_TRACE1(NAME, A)          do {} while (0)
+    #define mDNS_TRACE2(NAME, A, B)       do {} while (0)
+    #define mDNS_TRACE3(NAME, A, B, C)    do {} while (0)
+    #define mDNS_TRACE4(NAME, A, B, C, D) do {} while (0)
+#endif
+
+#endif // __mDNSTrace_h
@@ -56,6 +56,18 @@ mDNSexport SearchListElem *SearchList = mDNSNULL;
 // The value can be set to true by the Platform code e.g., MacOSX uses the plist mechanism
 mDNSBool StrictUnicastOrdering = mDNSfalse;
 
+// When true, a unicast question's first query also goes to the runner-up DNS server (see GetRaceServerForQuestion)
+// UNICAST_RACE_STAGGER after it goes to the chosen one, and the first reply from either wins
+mDNSBool RaceUnicastServers = mDNSfalse;
+
+// When true, a one-shot unicast question answered from the last tenth of a record's lifetime keeps a refresh query
+// running for that record after the question itself is gone (see StartUnicastPrefetch)
+mDNSBool PrefetchUnicastAnswers = mDNStrue;
+
+// When true, unicast answers are kept after they expire, and a new question that finds only such stale data is given it
+// if upstream hasn't answered within SERVE_STALE_CLIENT_TIMEOUT (RFC 8767)
+mDNSBool ServeStaleUnicastAnswers = mDNSfalse;
+
 extern mDNS mDNSStorage;
 
 // We keep track of the number of unicast DNS servers and log a message when we exceed 64.
@@ -194,6 +206,11 @@ mDNSexport DNSServer *mDNS_AddDNSServer(mDNS *const m, const domainname *domain,
 #endif
             server->flags &= ~DNSServerFlag_Delete;
         }
+        if (!server->isExpensive != !isExpensive || !server->isConstrained != !isConstrained ||
+            !server->isCLAT46 != !isCLAT46 || server->resGroupID != resGroupID)
+        {
+            server->flags |= DNSServerFlag_Changed;
+        }
         server->isExpensive   = isExpensive;
         server->isConstrained = isConstrained;
         server->isCLAT46      = isCLAT46;
@@ -220,6 +237,7 @@ mDNSexport DNSServer *mDNS_AddDNSServer(mDNS *const m, const domainname *domain,
             server->isExpensive   = isExpensive;
             server->isConstrained = isConstrained;
             server->isCLAT46      = isCLAT46;
+            server->flags         = DNSServerFlag_Changed;
             AssignDomainName(&server->domain, domain);
             *p = server; // Append new record at end of list
         }
@@ -231,9 +249,101 @@ mDNSexport DNSServer *mDNS_AddDNSServer(mDNS *const m, const domainname *domain,
         // all the resGroupIDs for a particular domain to match.
         server->resGroupID  = resGroupID;
     }
+    m->DNSServerIndex.built = mDNSfalse;
     return(server);
 }
 
+// Fold a round trip time measurement into the server's smoothed RTT, the way TCP does (RFC 6298),
+// and count the reply against its recent losses
+mDNSlocal void DNSServerSampleRTT(DNSServer *const server, mDNSs32 rtt)
+{
+    if (rtt < 0) rtt = 0;
+    if (!server->srtt) server->srtt = rtt << DNSSERVER_SRTT_SHIFT;
+    else               server->srtt += rtt - (server->srtt >> DNSSERVER_SRTT_SHIFT);
+    server->loss -= (mDNSu8)((server->loss + (1 << DNSSERVER_LOSS_SHIFT) - 1) >> DNSSERVER_LOSS_SHIFT);
+}
+
+mDNSlocal void DNSServerNoteLoss(DNSServer *const server)
+{
+    server->loss += (mDNSu8)((255 - server->loss) >> DNSSERVER_LOSS_SHIFT);
+}
+
+// Called for each UDP reply to a unicast question. Times the reply if we can tell which query it answers, and
+// settles any race between qDNSServer and raceServer. Returns mDNSfalse if the reply should be ignored because it
+// comes from the loser of a race that's already been decided.
+mDNSexport mDNSBool uDNS_NoteServerResponse(mDNS *const m, DNSQuestion *q, const mDNSAddr *srcaddr, mDNSIPPort srcport)
+{
+    DNSServer *const server = q->qDNSServer;
+    DNSServer *const other  = (q->raceState >= UnicastRace_Running) ? q->raceServer : mDNSNULL;
+    const mDNSBool fromServer = server && mDNSSameAddress(srcaddr, &server->addr) && mDNSSameIPPort(srcport, server->port);
+    const mDNSBool fromOther  = other  && mDNSSameAddress(srcaddr, &other->addr)  && mDNSSameIPPort(srcport, other->port);
+
+    if (q->raceState == UnicastRace_Decided)
+    {
+        // Once a race is decided, raceServer is whichever server lost it
+        if (!fromOther) return(mDNStrue);
+        if (q->raceTime) DNSServerSampleRTT(other, m->timenow - q->raceTime);
+        q->raceState  = UnicastRace_None;
+        q->raceServer = mDNSNULL;
+        return(mDNSfalse);
+    }
+
+    if (fromServer)
+    {
+        if (q->uDNSSendTime) DNSServerSampleRTT(server, m->timenow - q->uDNSSendTime);
+        q->uDNSSendTime = 0;
+        if      (q->raceState == UnicastRace_Pending) { q->raceState = UnicastRace_None; q->raceServer = mDNSNULL; }
+        else if (q->raceState == UnicastRace_Running)   q->raceState = UnicastRace_Decided;
+    }
+    else if (fromOther)
+    {
+        LogInfo("uDNS_NoteServerResponse: %#a:%d beat %#a:%d to answer %##s (%s)", &other->addr, mDNSVal16(other->port),
+                &server->addr, mDNSVal16(server->port), q->qname.c, DNSTypeName(q->qtype));
+        DNSServerSampleRTT(other, m->timenow - q->raceTime);
+        q->raceState    = UnicastRace_Decided;
+        q->raceServer   = server;
+        q->raceTime     = q->uDNSSendTime;
+        q->uDNSSendTime = 0;
+    }
+    return(mDNStrue);
+}
+
+// Called after a question's query goes to qDNSServer. Only a query's first transmission is timed, since
+// we can't tell which copy a reply to a retransmission answers; and only the first one is raced.
+mDNSlocal void uDNS_NoteQuerySent(mDNS *const m, DNSQuestion *const q)
+{
+    q->SentInQueries++;
+    q->uDNSSendTime = q->unansweredQueries ? 0 : NonZeroTime(m->timenow);
+    q->raceState    = UnicastRace_None;
+    q->raceServer   = mDNSNULL;
+    if (RaceUnicastServers && !q->unansweredQueries && !q->LongLived)
+    {
+        q->raceServer = GetRaceServerForQuestion(m, q);
+        if (q->raceServer)
+        {
+            q->raceState = UnicastRace_Pending;
+            q->raceTime  = NonZeroTime(m->timenow + UNICAST_RACE_STAGGER);
+        }
+    }
+}
+
+// Send the question's query to the runner-up server once qDNSServer's head start has run out
+mDNSlocal void uDNS_SendRaceQuery(mDNS *const m, DNSQuestion *const q)
+{
+    DNSServer *const other = q->raceServer;
+    mDNSu8 *end;
+    mStatus err = mStatus_NoMemoryErr;
+
+    InitializeDNSMessage(&m->omsg.h, q->TargetQID, uQueryFlags);
+    end = putQuestion(&m->omsg, m->omsg.data, m->omsg.data + AbsoluteMaxDNSMessageData, &q->qname, q->qtype, q->qclass);
+    if (end > m->omsg.data && q->LocalSocket)
+        err = mDNSSendDNSMessage(m, &m->omsg, end, other->interface, mDNSNULL, q->LocalSocket, &other->addr, other->port, mDNSNULL, q->UseBackgroundTraffic);
+    debugf("uDNS_SendRaceQuery: %##s (%s) to %#a:%d err %d", q->qname.c, DNSTypeName(q->qtype), &other->addr, mDNSVal16(other->port), err);
+
+    if (err) { q->raceState = UnicastRace_None; q->raceServer = mDNSNULL; }
+    else     { q->raceState = UnicastRace_Running; q->raceTime = NonZeroTime(m->timenow); q->SentInQueries++; }
+}
+
 // PenalizeDNSServer is called when the number of queries to the unicast
 // DNS server exceeds MAX_UCAST_UNANSWERED_QUERIES or when we receive an
 // error e.g., SERV_FAIL from DNS server.
@@ -245,6 +355,9 @@ mDNSexport void PenalizeDNSServer(mDNS *const m, DNSQuestion *q, mDNSOpaque16 re
 
     mDNS_CheckLock(m);
 
+    // Without response flags, we're here because the server left our queries unanswered
+    if (orig && mDNSOpaque16IsZero(responseFlags)) DNSServerNoteLoss(orig);
+
     LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO,
               "PenalizeDNSServer: Penalizing DNS server " PRI_IP_ADDR " question for question %p " PRI_DM_NAME " (" PUB_S ") SuppressUnusable %d",
               (q->qDNSServer ? &q->qDNSServer->addr : mDNSNULL), q, DM_NAME_PARAM(&q->qname), DNSTypeName(q->qtype), q->SuppressUnusable);
@@ -700,6 +813,7 @@ mDNSexport void RecreateNATMappings(mDNS *const m, const mDNSu32 waitTicks)
         n->retryInterval = NATMAP_INIT_RETRY;
         n->retryPortMap  = when;
         n->lastSuccessfulProtocol = NATTProtocolNone;
+        n->sendCount     = 0;
         if (!n->Protocol) n->NewResult = mStatus_NoError;
 #ifdef _LEGACY_NAT_TRAVERSAL_
         if (n->tcpInfo.sock) { mDNSPlatformTCPCloseConnection(n->tcpInfo.sock); n->tcpInfo.sock = mDNSNULL; }
@@ -711,6 +825,7 @@ mDNSexport void RecreateNATMappings(mDNS *const m, const mDNSu32 waitTicks)
     m->PCPNonce[2] = mDNSRandom(-1);
     m->retryIntervalGetAddr = 0;
     m->retryGetAddr = when;
+    m->NATGatewayLatency = 0;           // Probably not the same gateway any more
 
 #ifdef _LEGACY_NAT_TRAVERSAL_
     LNT_ClearState(m);
@@ -788,16 +903,39 @@ mDNSexport void natTraversalHandleAddressReply(mDNS *const m, mDNSu16 err, mDNSv
 // Both places that call NATSetNextRenewalTime() update m->NextScheduledNATOp correctly afterwards
 mDNSlocal void NATSetNextRenewalTime(mDNS *const m, NATTraversalInfo *n)
 {
+    const NATTraversalInfo *other;
+    mDNSs32 shared = 0;
+
     n->retryInterval = (n->ExpiryTime - m->timenow)/2;
     if (n->retryInterval < NATMAP_MIN_RETRY_INTERVAL)   // Min retry interval is 2 seconds
         n->retryInterval = NATMAP_MIN_RETRY_INTERVAL;
     n->retryPortMap = m->timenow + n->retryInterval;
+
+    // If other mappings are due to be renewed a little before this one, renew it along with the latest of them, so that
+    // renewals share a timer and go to the gateway together instead of trickling out one at a time. Renewing up to a
+    // quarter of the interval early still leaves a quarter of the lease in hand.
+    for (other = m->NATTraversals; other; other = other->next)
+        if (other != n && other->ExpiryTime && other->retryPortMap - m->timenow > 0 &&
+            n->retryPortMap - other->retryPortMap >= 0 && n->retryPortMap - other->retryPortMap <= n->retryInterval / 4 &&
+            (!shared || other->retryPortMap - shared > 0))
+            shared = other->retryPortMap;
+    if (shared) n->retryPortMap = shared;
+}
+
+// Fold the time the gateway took to answer into a smoothed estimate, as TCP does for its round trip time
+mDNSlocal void NATNoteGatewayLatency(mDNS *const m, const mDNSs32 latency)
+{
+    if (latency < 0) return;
+    m->NATGatewayLatency = m->NATGatewayLatency ? (7 * m->NATGatewayLatency + latency) / 8 : latency;
+    if (m->NATGatewayMaxLatency < latency) m->NATGatewayMaxLatency = latency;
 }
 
 mDNSlocal void natTraversalHandlePortMapReplyWithAddress(mDNS *const m, NATTraversalInfo *n, const mDNSInterfaceID InterfaceID, mDNSu16 err, mDNSv4Addr extaddr, mDNSIPPort extport, mDNSu32 lease, NATTProtocol protocol)
 {
     const char *prot = n->Protocol == 0 ? "Add" : n->Protocol == NATOp_MapUDP ? "UDP" : n->Protocol == NATOp_MapTCP ? "TCP" : "???";
     (void)prot;
+    if (n->sendCount == 1) NATNoteGatewayLatency(m, m->timenow - n->sentTime);   // A reply to a retransmission can't be timed
+    n->sendCount = 0;
     n->NewResult = err;
     if (err || lease == 0 || mDNSIPPortIsZero(extport))
     {
@@ -875,6 +1013,7 @@ mDNSexport mStatus mDNS_StartNATOperation_internal(mDNS *const m, NATTraversalIn
     traversal->NewResult       = mStatus_NoError;
     traversal->lastSuccessfulProtocol = NATTProtocolNone;
     traversal->sentNATPMP      = mDNSfalse;
+    traversal->sendCount       = 0;
     traversal->ExternalAddress = onesIPv4Addr;
     traversal->NewAddress      = zerov4Addr;
     traversal->ExternalPort    = zeroIPPort;
@@ -1164,12 +1303,15 @@ mDNSexport uDNS_LLQType uDNS_recvLLQResponse(mDNS *const m, const DNSMessage *co
     DNSQuestion pktQ, *q;
     if (msg->h.numQuestions && getQuestion(msg, msg->data, end, 0, &pktQ))
     {
-        const rdataOPT *opt = GetLLQOptData(m, msg, end);
+        const rdataOPT *opt = mDNSNULL;
+        mDNSBool optLocated = mDNSfalse;
 
         for (q = m->Questions; q; q = q->next)
         {
             if (!mDNSOpaque16IsZero(q->TargetQID) && q->LongLived && q->qtype == pktQ.qtype && q->qnamehash == pktQ.qnamehash && SameDomainName(&q->qname, &pktQ.qname))
             {
+                // Finding the OPT record means walking the whole message, so only do it for a response to one of our LLQs
+                if (!optLocated) { opt = GetLLQOptData(m, msg, end); optLocated = mDNStrue; }
                 debugf("uDNS_recvLLQResponse found %##s (%s) %d %#a %#a %X %X %X %X %d",
                        q->qname.c, DNSTypeName(q->qtype), q->state, srcaddr, &q->servAddr,
                        opt ? opt->u.llq.id.l[0] : 0, opt ? opt->u.llq.id.l[1] : 0, q->id.l[0], q->id.l[1], opt ? opt->u.llq.llqOp : 0);
@@ -1264,6 +1406,84 @@ struct TCPSocket_struct { mDNSIPPort port; TCPSocketFlags flags; /* ... */ };
 
 // tcpCallback is called to handle events (e.g. connection opening and data reception) on TCP connections for
 // Private DNS operations -- private queries, private LLQs, private record updates and private service updates
+// A reply with thousands of answers -- the PTR set for a big wide-area browse domain, say -- takes a while to arrive
+// over TCP, and nothing in it would reach a client until its last byte was in. So whenever another kTCPStreamAnswers of
+// its answers have arrived, TCPReplyStreamChunk copies them into a self-contained message (the reply's header and
+// question, then just those answers) for the caller to hand to mDNSCoreReceive straight away.
+// Only plain answers to the question itself are streamed; anything else (a CNAME to follow, an error, or the last few
+// answers) waits for the whole reply. Unicast answers don't flush the rest of their RRSet from the cache, so receiving
+// them in pieces is safe, and when the whole reply is in it goes to mDNSCoreReceive as before: the streamed answers
+// are just refreshed, and the rest of the message is processed as usual.
+#define kTCPStreamAnswers 64
+
+typedef struct
+{
+    DNSMessage       msg;
+    LargeCacheRecord lcr;
+} TCPReplyChunk;
+
+// Returns the next chunk of the reply, of which the first 'received' bytes have arrived, or NULL if there's nothing (more) to
+// stream yet. The chunk's header is in network byte order, ready for mDNSCoreReceive; the caller frees it.
+mDNSlocal TCPReplyChunk *TCPReplyStreamChunk(mDNS *const m, const DNSMessage *const reply, const mDNSu16 received,
+                                             TCPReplyStream *const stream, const DNSQuestion *const q, mDNSu8 **const chunkEnd)
+{
+    const mDNSu8 *const end = (const mDNSu8 *)reply + received;
+    const mDNSu8 *const hdr = (const mDNSu8 *)&reply->h;
+    const mDNSu16 numQuestions = (mDNSu16)(hdr[4] << 8 | hdr[5]);
+    const mDNSu16 numAnswers   = (mDNSu16)(hdr[6] << 8 | hdr[7]);
+    const mDNSu8 *ptr;
+    TCPReplyChunk *chunk;
+    mDNSu8 *out;
+    int i;
+
+    if (stream->done || received < sizeof(DNSMessageHeader)) return(mDNSNULL);
+    if (!stream->questionEnd)
+    {
+        if (numQuestions != 1 || (reply->h.flags.b[1] & kDNSFlag1_RC_Mask) || numAnswers <= kTCPStreamAnswers)
+        { stream->done = mDNStrue; return(mDNSNULL); }
+        ptr = skipQuestion(reply, reply->data, end);
+        if (!ptr) return(mDNSNULL);             // Question not all here yet
+        stream->questionEnd = stream->offset = (mDNSu16)(ptr - (const mDNSu8 *)reply);
+    }
+    if (stream->answers + kTCPStreamAnswers >= numAnswers) { stream->done = mDNStrue; return(mDNSNULL); }
+
+    // Wait until another kTCPStreamAnswers whole answers are here
+    ptr = (const mDNSu8 *)reply + stream->offset;
+    for (i = 0; i < kTCPStreamAnswers && ptr; i++) ptr = skipResourceRecord(reply, ptr, end);
+    if (!ptr) return(mDNSNULL);
+
+    chunk = (TCPReplyChunk *) mDNSPlatformMemAllocate(sizeof(*chunk));
+    if (!chunk) { stream->done = mDNStrue; return(mDNSNULL); }
+    InitializeDNSMessage(&chunk->msg.h, reply->h.id, reply->h.flags);
+    chunk->msg.h.numQuestions = 1;
+    mDNSPlatformMemCopy(chunk->msg.data, reply->data, stream->questionEnd - sizeof(DNSMessageHeader));
+    out = chunk->msg.data + (stream->questionEnd - sizeof(DNSMessageHeader));
+
+    ptr = (const mDNSu8 *)reply + stream->offset;
+    for (i = 0; i < kTCPStreamAnswers; i++)
+    {
+        mDNSu8 *next;
+        const mDNSu8 *const after = GetLargeResourceRecord(m, reply, ptr, end, mDNSInterface_Any, kDNSRecordTypePacketAns, &chunk->lcr);
+        const ResourceRecord *const rr = &chunk->lcr.r.resrec;
+        if (!after || rr->rrtype != q->qtype || rr->rrclass != q->qclass ||
+            rr->namehash != q->qnamehash || !SameDomainName(rr->name, &q->qname))
+        { stream->done = mDNStrue; break; }
+        next = PutResourceRecordTTLWithLimit(&chunk->msg, out, &chunk->msg.h.numAnswers, rr, rr->rroriginalttl, chunk->msg.data + AbsoluteMaxDNSMessageData);
+        if (!next) break;                       // The rest go in the next chunk
+        out = next;
+        ptr = after;
+        stream->offset = (mDNSu16)(ptr - (const mDNSu8 *)reply);
+        stream->answers++;
+    }
+    if (!chunk->msg.h.numAnswers) { mDNSPlatformMemFree(chunk); return(mDNSNULL); }
+
+    debugf("TCPReplyStreamChunk: %d answers to %##s (%s), %d of %d so far", chunk->msg.h.numAnswers, q->qname.c, DNSTypeName(q->qtype),
+           stream->answers, numAnswers);
+    SwapDNSHeaderBytes(&chunk->msg);
+    *chunkEnd = out;
+    return(chunk);
+}
+
 mDNSlocal void tcpCallback(TCPSocket *sock, void *context, mDNSBool ConnectionEstablished, mStatus err)
 {
     tcpInfo_t *tcpInfo = (tcpInfo_t *)context;
@@ -1395,6 +1615,7 @@ mDNSlocal void tcpCallback(TCPSocket *sock, void *context, mDNSBool ConnectionEs
 
             tcpInfo->reply = (DNSMessage *) mDNSPlatformMemAllocate(tcpInfo->replylen);
             if (!tcpInfo->reply) { LogMsg("ERROR: tcpCallback - malloc failed"); err = mStatus_NoMemoryErr; goto exit; }
+            mDNSPlatformMemZero(&tcpInfo->stream, sizeof(tcpInfo->stream));
         }
 
         n = mDNSPlatformReadTCP(sock, ((char *)tcpInfo->reply) + (tcpInfo->nread - 2), tcpInfo->replylen - (tcpInfo->nread - 2), &closed);
@@ -1466,6 +1687,22 @@ mDNSlocal void tcpCallback(TCPSocket *sock, void *context, mDNSBool ConnectionEs
             mDNSPlatformMemFree(reply);
             return;
         }
+        else if (q && !q->LongLived)     // LLQ replies need their LLQ option, so they're only ever processed whole
+        {
+            mDNSu8 *chunkEnd;
+            TCPReplyChunk *const chunk = TCPReplyStreamChunk(m, tcpInfo->reply, (mDNSu16)(tcpInfo->nread - 2), &tcpInfo->stream, q, &chunkEnd);
+            if (chunk)
+            {
+                const mDNSAddr Addr = tcpInfo->Addr;
+                const mDNSIPPort Port = tcpInfo->Port;
+                const mDNSBool tls = (sock->flags & kTCPSocketFlags_UseTLS) ? mDNStrue : mDNSfalse;
+                if (q->tcp) q->tcpSrcPort = q->tcp->SrcPort;
+                mDNSCoreReceive(m, &chunk->msg, chunkEnd, &Addr, Port, tls ? (mDNSAddr *)1 : mDNSNULL, q->tcpSrcPort, 0);
+                // As above, mDNSCoreReceive may have cancelled this operation, so don't touch tcpInfo after it
+                mDNSPlatformMemFree(chunk);
+                return;
+            }
+        }
     }
 
 exit:
@@ -1610,6 +1847,307 @@ mDNSexport void DisposeTCPConn(struct tcpInfo_t *tcp)
     mDNSPlatformMemFree(tcp);
 }
 
+#if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+// Append an OPT record carrying an empty edns-tcp-keepalive option, which asks the server how long it's willing
+// to hold an idle connection open for us (RFC 7828). PutResourceRecord only knows how to write the options
+// that carry data, so this one is laid out by hand.
+mDNSlocal mDNSu8 *putTCPKeepaliveOpt(DNSMessage *const msg, mDNSu8 *ptr, const mDNSu8 *const limit)
+{
+    if (!ptr || ptr + DNSOpt_Header_Space + 4 > limit) return(mDNSNULL);
+    *ptr++ = 0;                                         // Root name
+    *ptr++ = (mDNSu8)(kDNSType_OPT >> 8);
+    *ptr++ = (mDNSu8)(kDNSType_OPT & 0xFF);
+    *ptr++ = (mDNSu8)(NormalMaxDNSMessageData >> 8);    // Our UDP payload size
+    *ptr++ = (mDNSu8)(NormalMaxDNSMessageData & 0xFF);
+    *ptr++ = 0; *ptr++ = 0; *ptr++ = 0; *ptr++ = 0;     // Extended RCODE, version and flags
+    *ptr++ = 0; *ptr++ = 4;                             // RDLENGTH
+    *ptr++ = (mDNSu8)(kDNSOpt_TCPKeepalive >> 8);
+    *ptr++ = (mDNSu8)(kDNSOpt_TCPKeepalive & 0xFF);
+    *ptr++ = 0; *ptr++ = 0;                             // Clients send no TIMEOUT
+    msg->h.numAdditionals++;
+    return(ptr);
+}
+
+// If the server put an edns-tcp-keepalive option in its reply, adopt the idle timeout it gave us, which is in
+// units of 100ms. The header counts must be in host byte order.
+mDNSlocal void TCPConnectionNoteKeepalive(DNSTCPConnection *const conn, const DNSMessage *const msg, const mDNSu8 *const end)
+{
+    const mDNSu8 *ptr = LocateOptRR(msg, end, 0);
+    const mDNSu8 *rdend;
+
+    if (!ptr) return;
+    rdend = ptr + DNSOpt_Header_Space + ((mDNSu16)ptr[9] << 8 | ptr[10]);
+    if (rdend > end) return;
+    for (ptr += DNSOpt_Header_Space; ptr + 4 <= rdend; ptr += 4 + ((mDNSu16)ptr[2] << 8 | ptr[3]))
+    {
+        if (((mDNSu16)ptr[0] << 8 | ptr[1]) == kDNSOpt_TCPKeepalive && ((mDNSu16)ptr[2] << 8 | ptr[3]) == 2 && ptr + 6 <= rdend)
+        {
+            const mDNSs32 timeout = ((mDNSs32)ptr[4] << 8 | ptr[5]) * mDNSPlatformOneSecond / 10;
+            conn->idleTimeout = (timeout < DNS_TCP_MAX_IDLE_TIMEOUT) ? timeout : DNS_TCP_MAX_IDLE_TIMEOUT;
+            return;
+        }
+    }
+}
+
+mDNSlocal void TCPConnectionSendQuery(mDNS *const m, DNSTCPConnection *const conn, DNSQuestion *const q)
+{
+    const mDNSu8 *const limit = m->omsg.data + AbsoluteMaxDNSMessageData;
+    mDNSu8 *end;
+    mStatus err = mStatus_NoMemoryErr;
+
+    InitializeDNSMessage(&m->omsg.h, q->TargetQID, uQueryFlags);
+    end = putQuestion(&m->omsg, m->omsg.data, limit, &q->qname, q->qtype, q->qclass);
+    end = putTCPKeepaliveOpt(&m->omsg, end, limit);
+    if (end) err = mDNSSendDNSMessage(m, &m->omsg, end, mDNSInterface_Any, conn->sock, mDNSNULL, &conn->Addr, conn->Port, q->AuthInfo, mDNSfalse);
+    if (err) { LogInfo("TCPConnectionSendQuery: %##s (%s) to %#a:%d failed %d", q->qname.c, DNSTypeName(q->qtype), &conn->Addr, mDNSVal16(conn->Port), err); return; }
+
+    // As in tcpCallback: now that the query is on a TCP connection, wait at least 256 seconds before retrying
+    q->LastQTime = m->timenow;
+    if (q->ThisQInterval < (256 * mDNSPlatformOneSecond))
+        q->ThisQInterval = (256 * mDNSPlatformOneSecond);
+    SetNextQueryTime(m, q);
+}
+
+mDNSlocal void TCPConnectionDetach(mDNS *const m, DNSTCPConnection *const conn, DNSQuestion *const q)
+{
+    q->tcpConn = mDNSNULL;
+    if (conn->outstanding) conn->outstanding--;
+    if (!conn->outstanding)
+    {
+        conn->closeTime = NonZeroTime(m->timenow + conn->idleTimeout);
+        if (m->NextuDNSEvent - conn->closeTime > 0)
+            m->NextuDNSEvent = conn->closeTime;
+    }
+}
+
+mDNSlocal void TCPConnectionDispose(mDNS *const m, DNSTCPConnection *const conn)
+{
+    DNSTCPConnection **p = &m->DNSTCPConnections;
+    while (*p && *p != conn) p = &(*p)->next;
+    if (*p) *p = conn->next;
+    mDNSPlatformTCPCloseConnection(conn->sock);
+    if (conn->reply) mDNSPlatformMemFree(conn->reply);
+    mDNSPlatformMemFree(conn);
+}
+
+mDNSlocal void TCPConnectionQueue(mDNS *const m, DNSQuestion *const q, const mDNSAddr *const addr, const mDNSIPPort port);
+
+// The connection failed or the server closed it. Questions still waiting on a connection that has already carried
+// replies most likely crossed the server closing it as idle, so they go straight to a new connection; otherwise
+// they stay on their existing retry schedule, as they would have without the pool.
+mDNSlocal void TCPConnectionFailed(mDNS *const m, DNSTCPConnection *const conn)
+{
+    DNSTCPConnection **p = &m->DNSTCPConnections;
+    DNSQuestion *q;
+
+    if (conn->outstanding)
+        LogInfo("TCPConnectionFailed: %#a:%d with %u quer%s outstanding after %u repl%s", &conn->Addr, mDNSVal16(conn->Port),
+                conn->outstanding, conn->outstanding == 1 ? "y" : "ies", conn->numReplies, conn->numReplies == 1 ? "y" : "ies");
+
+    // Unlink it first so that the retries below get a new connection instead of this one
+    while (*p && *p != conn) p = &(*p)->next;
+    if (*p) *p = conn->next;
+    conn->next = mDNSNULL;
+
+    for (q = m->Questions; q; q = q->next)
+        if (q->tcpConn == conn)
+        {
+            q->tcpConn = mDNSNULL;
+            if (conn->numReplies) TCPConnectionQueue(m, q, &conn->Addr, conn->Port);
+        }
+    TCPConnectionDispose(m, conn);
+}
+
+mDNSlocal void DNSTCPConnectionCallback(TCPSocket *sock, void *context, mDNSBool ConnectionEstablished, mStatus err)
+{
+    DNSTCPConnection *const conn = (DNSTCPConnection *)context;
+    mDNS *const m = conn->m;
+    mDNSBool closed = mDNSfalse;
+    const mDNSBool Read_replylen = (conn->nread < 2);  // Do we need to read the replylen field first?
+    long n;
+
+    if (err) goto fail;
+
+    if (ConnectionEstablished)
+    {
+        DNSQuestion *q;
+        mDNS_Lock(m);
+        conn->connected = mDNStrue;
+        for (q = m->Questions; q; q = q->next)
+            if (q->tcpConn == conn) TCPConnectionSendQuery(m, conn, q);
+        mDNS_Unlock(m);
+        return;
+    }
+
+    if (Read_replylen)
+    {
+        mDNSu8 *lenptr = (mDNSu8 *)&conn->replylen;
+        n = mDNSPlatformReadTCP(sock, lenptr + conn->nread, 2 - conn->nread, &closed);
+        if (n < 0 || closed) goto fail;
+        conn->nread += n;
+        if (conn->nread < 2) return;
+
+        conn->replylen = (mDNSu16)((mDNSu16)lenptr[0] << 8 | lenptr[1]);
+        if (conn->replylen < sizeof(DNSMessageHeader))
+        { LogMsg("ERROR: DNSTCPConnectionCallback - length too short (%d bytes)", conn->replylen); goto fail; }
+
+        conn->reply = (DNSMessage *) mDNSPlatformMemAllocate(conn->replylen);
+        if (!conn->reply) { LogMsg("ERROR: DNSTCPConnectionCallback - malloc failed"); goto fail; }
+        mDNSPlatformMemZero(&conn->stream, sizeof(conn->stream));
+    }
+
+    // As in tcpCallback, a failed read is only an error if it's our first one this time through
+    n = mDNSPlatformReadTCP(sock, ((char *)conn->reply) + (conn->nread - 2), conn->replylen - (conn->nread - 2), &closed);
+    if (n < 0) { if (Read_replylen) return; else goto fail; }
+    if (closed) goto fail;
+    conn->nread += n;
+
+    if ((conn->nread - 2) == conn->replylen)
+    {
+        DNSMessage *const reply = conn->reply;
+        const mDNSu8 *const end = (mDNSu8 *)reply + conn->replylen;
+        DNSQuestion *q;
+
+        conn->reply    = mDNSNULL;
+        conn->nread    = 0;
+        conn->replylen = 0;
+        conn->numReplies++;
+
+        // Detach the question the reply is for FIRST; q->tcpSrcPort still lets mDNSCoreReceive match it,
+        // and if the reply makes the client cancel the question there's nothing left pointing at us.
+        // A reply for a question that has since gone away is dropped here.
+        mDNS_Lock(m);
+        for (q = m->Questions; q; q = q->next)
+            if (q->tcpConn == conn && mDNSSameOpaque16(q->TargetQID, reply->h.id)) break;
+        if (q) TCPConnectionDetach(m, conn, q);
+        mDNS_Unlock(m);
+
+        if (q)
+        {
+            mDNSCoreReceive(m, reply, end, &conn->Addr, conn->Port, mDNSNULL, conn->SrcPort, 0);
+            // mDNSCoreReceive has put the header counts in host byte order for us
+            TCPConnectionNoteKeepalive(conn, reply, end);
+        }
+        mDNSPlatformMemFree(reply);
+    }
+    else
+    {
+        // Pass on whatever answers can be streamed now. The connection outlives mDNSCoreReceive, but the question may not,
+        // so look it up again for each chunk.
+        for (;;)
+        {
+            TCPReplyChunk *chunk = mDNSNULL;
+            mDNSu8 *chunkEnd = mDNSNULL;
+            DNSQuestion *q;
+
+            mDNS_Lock(m);
+            for (q = m->Questions; q; q = q->next)
+                if (q->tcpConn == conn && mDNSSameOpaque16(q->TargetQID, conn->reply->h.id)) break;
+            if (q) chunk = TCPReplyStreamChunk(m, conn->reply, (mDNSu16)(conn->nread - 2), &conn->stream, q, &chunkEnd);
+            mDNS_Unlock(m);
+            if (!chunk) break;
+
+            mDNSCoreReceive(m, &chunk->msg, chunkEnd, &conn->Addr, conn->Port, mDNSNULL, conn->SrcPort, 0);
+            mDNSPlatformMemFree(chunk);
+        }
+    }
+    return;
+
+fail:
+    mDNS_Lock(m);
+    TCPConnectionFailed(m, conn);
+    mDNS_Unlock(m);
+}
+
+mDNSlocal DNSTCPConnection *GetTCPConnection(mDNS *const m, const DNSQuestion *const q, const mDNSAddr *const addr, const mDNSIPPort port)
+{
+    DNSTCPConnection *conn;
+    mStatus err;
+
+    for (conn = m->DNSTCPConnections; conn; conn = conn->next)
+        if (conn->InterfaceID == q->InterfaceID && mDNSSameAddress(&conn->Addr, addr) && mDNSSameIPPort(conn->Port, port))
+            return(conn);
+
+    conn = (DNSTCPConnection *) mDNSPlatformMemAllocateClear(sizeof(*conn));
+    if (!conn) { LogMsg("ERROR: GetTCPConnection - memallocate failed"); return(mDNSNULL); }
+    conn->m           = m;
+    conn->InterfaceID = q->InterfaceID;
+    conn->Addr        = *addr;
+    conn->Port        = port;
+    conn->idleTimeout = DNS_TCP_IDLE_TIMEOUT;
+    conn->sock        = mDNSPlatformTCPSocket(kTCPSocketFlags_Zero, addr->type, &conn->SrcPort, mDNSNULL, q->UseBackgroundTraffic);
+    if (!conn->sock) { LogMsg("GetTCPConnection: unable to create TCP socket"); mDNSPlatformMemFree(conn); return(mDNSNULL); }
+    mDNSPlatformSetSocktOpt(conn->sock, mDNSTransport_TCP, addr->type, q);
+
+    err = mDNSPlatformTCPConnect(conn->sock, addr, port, q->InterfaceID, DNSTCPConnectionCallback, conn);
+    if (err == mStatus_ConnEstablished) conn->connected = mDNStrue;
+    else if (err != mStatus_ConnPending)
+    {
+        LogInfo("GetTCPConnection: connection to %#a:%d failed", addr, mDNSVal16(port));
+        mDNSPlatformTCPCloseConnection(conn->sock);
+        mDNSPlatformMemFree(conn);
+        return(mDNSNULL);
+    }
+    conn->next = m->DNSTCPConnections;
+    m->DNSTCPConnections = conn;
+    return(conn);
+}
+
+// Put the question's query on the pooled connection to addr:port, opening one if need be. If the connection
+// is already up the query goes out right away, pipelined behind any others; if not, it goes once it's up.
+mDNSlocal void TCPConnectionQueue(mDNS *const m, DNSQuestion *const q, const mDNSAddr *const addr, const mDNSIPPort port)
+{
+    DNSTCPConnection *const conn = GetTCPConnection(m, q, addr, port);
+
+    if (q->tcpConn && q->tcpConn != conn) TCPConnectionDetach(m, q->tcpConn, q);
+    if (!conn) return;
+    if (q->tcpConn != conn)
+    {
+        q->tcpConn = conn;
+        conn->outstanding++;
+        conn->closeTime = 0;
+    }
+    q->tcpSrcPort = conn->SrcPort;
+    if (conn->connected) TCPConnectionSendQuery(m, conn, q);
+}
+
+mDNSexport void uDNS_ReleaseTCPConnection(mDNS *const m, DNSQuestion *const q)
+{
+    if (q->tcpConn) TCPConnectionDetach(m, q->tcpConn, q);
+}
+
+mDNSexport void uDNS_CloseTCPConnections(mDNS *const m)
+{
+    DNSQuestion *q;
+    for (q = m->Questions; q; q = q->next) q->tcpConn = mDNSNULL;
+    while (m->DNSTCPConnections) TCPConnectionDispose(m, m->DNSTCPConnections);
+}
+
+// Close pooled connections that have sat idle for their idle timeout, and return when the next one is due
+mDNSlocal mDNSs32 CheckTCPConnections(mDNS *const m)
+{
+    mDNSs32 nextevent = m->timenow + FutureTime;
+    DNSTCPConnection *conn = m->DNSTCPConnections;
+
+    while (conn)
+    {
+        DNSTCPConnection *const next = conn->next;
+        if (conn->closeTime)
+        {
+            if (m->timenow - conn->closeTime >= 0)
+            {
+                debugf("CheckTCPConnections: closing idle connection to %#a:%d after %u replies", &conn->Addr, mDNSVal16(conn->Port), conn->numReplies);
+                TCPConnectionDispose(m, conn);
+            }
+            else if (nextevent - conn->closeTime > 0)
+                nextevent = conn->closeTime;
+        }
+        conn = next;
+    }
+    return(nextevent);
+}
+#endif // !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+
 // Lock must be held
 mDNSexport void startLLQHandshake(mDNS *m, DNSQuestion *q)
 {
@@ -1745,6 +2283,231 @@ mDNSlocal const domainname *DNS_PUSH_NOTIFICATION_SERVICE_TYPE = (const domainna
 // GetZoneData_QuestionCallback calls GetZoneData_StartQuery
 mDNSlocal mStatus GetZoneData_StartQuery(mDNS *const m, ZoneData *zd, mDNSu16 qtype);
 
+// Registrations, LLQs and Push subscriptions in one zone all walk the same SOA chain and look up the same SRV
+// record, so we remember each finished lookup for every name it walked through (all of which are known to lie
+// in the discovered zone), and a lookup that reaches one of those names can stop there. Lookups that are walking
+// the same part of the tree at the same time don't each query for it either: the later one follows the earlier
+// one (its Leader) and is handed the same result when the Leader finishes.
+enum
+{
+    ZoneDataState_Walking = 0,          // Our own question is active
+    ZoneDataState_Following,            // Waiting for zd->Leader
+    ZoneDataState_Deferred,             // uDNS_Tasks resumes the walk: a new lookup with a cached result, or Leader was cancelled
+    ZoneDataState_Done
+};
+
+typedef struct ZoneDataCacheEntry_struct ZoneDataCacheEntry;
+struct ZoneDataCacheEntry_struct
+{
+    ZoneDataCacheEntry *next;
+    domainname  Name;                   // A name at or below the apex of ZoneName
+    ZoneService ZoneService;
+    domainname  ZoneName;
+    mDNSu16     ZoneClass;
+    domainname  Host;
+    mDNSIPPort  Port;
+    mDNSAddr    Addr;
+    mDNSBool    ZonePrivate;
+    mDNSs32     expire;
+};
+
+mDNSlocal ZoneDataCacheEntry *ZoneDataCache;
+mDNSlocal mDNSu32 ZoneDataCacheCount;
+mDNSlocal ZoneData *ZoneDataLookups;    // Every ZoneData between StartGetZoneData and CancelGetZoneData
+mDNSlocal ZoneData *CurrentZoneData;    // Leader whose followers are being called back; cleared if it's cancelled
+
+// Returns true if name is ancestor or is below it
+mDNSlocal mDNSBool NameIsWithin(const domainname *const name, const domainname *const ancestor)
+{
+    const int n = CountLabels(name);
+    const int a = CountLabels(ancestor);
+    return (n >= a && SameDomainName(SkipLeadingLabels(name, n - a), ancestor));
+}
+
+mDNSlocal ZoneDataCacheEntry *ZoneDataCacheLookup(mDNS *const m, const domainname *const name, const ZoneService service)
+{
+    ZoneDataCacheEntry **ep = &ZoneDataCache;
+    while (*ep)
+    {
+        ZoneDataCacheEntry *const e = *ep;
+        if (m->timenow - e->expire >= 0)
+        {
+            *ep = e->next;
+            ZoneDataCacheCount--;
+            mDNSPlatformMemFree(e);
+            continue;
+        }
+        if (e->ZoneService == service && SameDomainName(&e->Name, name)) return(e);
+        ep = &e->next;
+    }
+    return(mDNSNULL);
+}
+
+mDNSlocal void ZoneDataCacheAddName(mDNS *const m, const domainname *const name, const ZoneData *const zd)
+{
+    ZoneDataCacheEntry *e = ZoneDataCacheLookup(m, name, zd->ZoneService);
+    if (!e)
+    {
+        if (ZoneDataCacheCount >= ZONE_DATA_CACHE_MAX_ENTRIES)
+        {
+            // New entries go on the front, so the last one is the oldest
+            ZoneDataCacheEntry **ep = &ZoneDataCache;
+            while ((*ep)->next) ep = &(*ep)->next;
+            mDNSPlatformMemFree(*ep);
+            *ep = mDNSNULL;
+            ZoneDataCacheCount--;
+        }
+        e = (ZoneDataCacheEntry *) mDNSPlatformMemAllocateClear(sizeof(*e));
+        if (!e) return;
+        AssignDomainName(&e->Name, name);
+        e->ZoneService = zd->ZoneService;
+        e->next = ZoneDataCache;
+        ZoneDataCache = e;
+        ZoneDataCacheCount++;
+    }
+    AssignDomainName(&e->ZoneName, &zd->ZoneName);
+    e->ZoneClass   = zd->ZoneClass;
+    AssignDomainName(&e->Host, &zd->Host);
+    e->Port        = zd->Port;
+    e->Addr        = zd->Addr;
+    e->ZonePrivate = zd->ZonePrivate;
+    e->expire      = NonZeroTime(m->timenow + (mDNSs32)zd->ZoneTTL * mDNSPlatformOneSecond);
+}
+
+// Remembers the result for ChildName and each name the walk passed on its way up to ZoneName
+mDNSlocal void ZoneDataCacheAdd(mDNS *const m, const ZoneData *const zd)
+{
+    const domainname *name = &zd->ChildName;
+    if (!zd->ZoneTTL || !zd->ZoneName.c[0] || !NameIsWithin(name, &zd->ZoneName)) return;
+    while (1)
+    {
+        ZoneDataCacheAddName(m, name, zd);
+        if (SameDomainName(name, &zd->ZoneName)) break;
+        name = (const domainname *)(name->c + name->c[0] + 1);
+    }
+}
+
+mDNSexport void FlushZoneDataCache(mDNS *const m)
+{
+    (void)m;
+    while (ZoneDataCache)
+    {
+        ZoneDataCacheEntry *const e = ZoneDataCache;
+        ZoneDataCache = e->next;
+        mDNSPlatformMemFree(e);
+    }
+    ZoneDataCacheCount = 0;
+}
+
+mDNSlocal void ZoneDataSetTTL(ZoneData *const zd, const mDNSu32 ttl)
+{
+    if (zd->ZoneTTL > ttl) zd->ZoneTTL = ttl;
+}
+
+// Called from normal client callback context; the callbacks may cancel any lookup, including the one finishing
+mDNSlocal void GetZoneData_Complete(mDNS *const m, ZoneData *const zd, const mStatus err)
+{
+    ZoneData *const saved = CurrentZoneData;
+    ZoneData *f;
+
+    zd->ZoneDataState = ZoneDataState_Done;
+    if (!err) ZoneDataCacheAdd(m, zd);
+
+    CurrentZoneData = zd;
+    for (f = ZoneDataLookups; f && CurrentZoneData == zd; )
+    {
+        if (f->Leader != zd) { f = f->next; continue; }
+        f->Leader        = mDNSNULL;
+        f->ZoneDataState = ZoneDataState_Done;
+        AssignDomainName(&f->ZoneName, &zd->ZoneName);
+        f->ZoneClass     = zd->ZoneClass;
+        AssignDomainName(&f->Host, &zd->Host);
+        f->Port          = zd->Port;
+        f->Addr          = zd->Addr;
+        f->ZonePrivate   = zd->ZonePrivate;
+        f->ZoneTTL       = zd->ZoneTTL;
+        if (!err) ZoneDataCacheAdd(m, f);
+        f->ZoneDataCallback(m, err, f);
+        f = ZoneDataLookups;            // The callback may have changed the list, so start over
+    }
+    if (CurrentZoneData != zd) { CurrentZoneData = saved; return; }
+    CurrentZoneData = saved;
+    zd->ZoneDataCallback(m, err, zd);
+}
+
+// Continues the SOA walk at zd->CurrentSOA, unless the cache or another lookup already has the answer.
+// Called from normal client context (lock not held, or client callback)
+mDNSlocal void GetZoneData_ContinueWalk(mDNS *const m, ZoneData *const zd)
+{
+    const ZoneDataCacheEntry *const e = ZoneDataCacheLookup(m, zd->CurrentSOA, zd->ZoneService);
+    ZoneData *l;
+
+    if (e)
+    {
+        AssignDomainName(&zd->ZoneName, &e->ZoneName);
+        zd->ZoneClass   = e->ZoneClass;
+        AssignDomainName(&zd->Host, &e->Host);
+        zd->Port        = e->Port;
+        zd->Addr        = e->Addr;
+        zd->ZonePrivate = e->ZonePrivate;
+        zd->ZoneTTL     = 0;
+        debugf("GetZoneData_ContinueWalk: %##s found in zone data cache (zone %##s)", zd->CurrentSOA->c, zd->ZoneName.c);
+        GetZoneData_Complete(m, zd, mStatus_NoError);
+        return;
+    }
+
+    // A walking lookup that started at or below our name and hasn't yet got above it will find our zone too:
+    // every name between its ChildName and its CurrentSOA is known not to be a zone apex
+    for (l = ZoneDataLookups; l; l = l->next)
+        if (l != zd && l->ZoneDataState == ZoneDataState_Walking && l->ZoneService == zd->ZoneService &&
+            NameIsWithin(&l->ChildName, zd->CurrentSOA) && NameIsWithin(zd->CurrentSOA, l->CurrentSOA))
+        {
+            debugf("GetZoneData_ContinueWalk: %##s following lookup for %##s", zd->CurrentSOA->c, l->ChildName.c);
+            zd->Leader        = l;
+            zd->ZoneDataState = ZoneDataState_Following;
+            return;
+        }
+
+    zd->ZoneDataState = ZoneDataState_Walking;
+    AssignDomainName(&zd->question.qname, zd->CurrentSOA);
+    GetZoneData_StartQuery(m, zd, kDNSType_SOA);
+}
+
+// Called from CancelGetZoneData with the lock held, before zd is freed
+mDNSexport void GetZoneData_Unlink(mDNS *const m, ZoneData *zd)
+{
+    ZoneData **zp = &ZoneDataLookups;
+    ZoneData *f;
+
+    while (*zp && *zp != zd) zp = &(*zp)->next;
+    if (*zp) *zp = zd->next;
+    if (CurrentZoneData == zd) CurrentZoneData = mDNSNULL;
+
+    for (f = ZoneDataLookups; f; f = f->next)
+        if (f->Leader == zd)
+        {
+            f->Leader        = mDNSNULL;
+            f->ZoneDataState = ZoneDataState_Deferred;
+            m->NextuDNSEvent = m->timenow;
+        }
+}
+
+// Resumes deferred lookups. Called from uDNS_Tasks with the lock held
+mDNSlocal void GetZoneData_Tasks(mDNS *const m)
+{
+    while (1)
+    {
+        ZoneData *zd;
+        for (zd = ZoneDataLookups; zd; zd = zd->next)
+            if (zd->ZoneDataState == ZoneDataState_Deferred) break;
+        if (!zd) break;
+
+        mDNS_DropLockBeforeCallback();
+        GetZoneData_ContinueWalk(m, zd);
+        mDNS_ReclaimLockAfterCallback();
+    }
+}
+
 // GetZoneData_QuestionCallback is called from normal client callback context (core API calls allowed)
 mDNSlocal void GetZoneData_QuestionCallback(mDNS *const m, DNSQuestion *question, const ResourceRecord *const answer, QC_result AddRecord)
 {
@@ -1766,18 +2529,19 @@ mDNSlocal void GetZoneData_QuestionCallback(mDNS *const m, DNSQuestion *question
         {
             AssignDomainName(&zd->ZoneName, answer->name);
             zd->ZoneClass = answer->rrclass;
+            zd->ZoneTTL   = ZONE_DATA_CACHE_MAX_TTL;
+            ZoneDataSetTTL(zd, answer->rroriginalttl);
             GetZoneData_StartQuery(m, zd, kDNSType_SRV);
         }
         else if (zd->CurrentSOA->c[0])
         {
             zd->CurrentSOA = (domainname *)(zd->CurrentSOA->c + zd->CurrentSOA->c[0]+1);
-            AssignDomainName(&zd->question.qname, zd->CurrentSOA);
-            GetZoneData_StartQuery(m, zd, kDNSType_SOA);
+            GetZoneData_ContinueWalk(m, zd);
         }
         else
         {
             LogInfo("GetZoneData recursed to root label of %##s without finding SOA", zd->ChildName.c);
-            zd->ZoneDataCallback(m, mStatus_NoSuchNameErr, zd);
+            GetZoneData_Complete(m, zd, mStatus_NoSuchNameErr);
         }
     }
     else if (answer->rrtype == kDNSType_SRV)
@@ -1798,6 +2562,7 @@ mDNSlocal void GetZoneData_QuestionCallback(mDNS *const m, DNSQuestion *question
         else
 #endif
         {
+            ZoneDataSetTTL(zd, answer->rroriginalttl);
             if (answer->rdlength)
             {
                 AssignDomainName(&zd->Host, &answer->rdata->u.srv.target);
@@ -1831,7 +2596,7 @@ mDNSlocal void GetZoneData_QuestionCallback(mDNS *const m, DNSQuestion *question
                 }
                 else
                 {
-                    zd->ZoneDataCallback(m, mStatus_NoError, zd);
+                    GetZoneData_Complete(m, zd, mStatus_NoError);
                 }                    
             }
             else
@@ -1840,7 +2605,7 @@ mDNSlocal void GetZoneData_QuestionCallback(mDNS *const m, DNSQuestion *question
                 zd->Host.c[0] = 0;
                 zd->Port = zeroIPPort;
                 zd->Addr = zeroAddr;
-                zd->ZoneDataCallback(m, mStatus_NoError, zd);
+                GetZoneData_Complete(m, zd, mStatus_NoError);
             }
         }
     }
@@ -1852,6 +2617,7 @@ mDNSlocal void GetZoneData_QuestionCallback(mDNS *const m, DNSQuestion *question
             LogMsg("GetZoneData_QuestionCallback: Question %##s (%s) ThisQInterval %d not -1", question->qname.c, DNSTypeName(question->qtype), question->ThisQInterval);
         zd->Addr.type  = mDNSAddrType_IPv4;
         zd->Addr.ip.v4 = (answer->rdlength == 4) ? answer->rdata->u.ipv4 : zerov4Addr;
+        ZoneDataSetTTL(zd, answer->rroriginalttl);
         // In order to simulate firewalls blocking our outgoing TCP connections, returning immediate ICMP errors or TCP resets,
         // the code below will make us try to connect to loopback, resulting in an immediate "port unreachable" failure.
         // This helps us test to make sure we handle this case gracefully
@@ -1863,7 +2629,7 @@ mDNSlocal void GetZoneData_QuestionCallback(mDNS *const m, DNSQuestion *question
         zd->Addr.ip.v4.b[3] = 1;
 #endif
         // The caller needs to free the memory when done with zone data
-        zd->ZoneDataCallback(m, mStatus_NoError, zd);
+        GetZoneData_Complete(m, zd, mStatus_NoError);
     }
 }
 
@@ -1923,10 +2689,20 @@ mDNSexport ZoneData *StartGetZoneData(mDNS *const m, const domainname *const nam
     zd->ZoneDataContext  = ZoneDataContext;
 
     zd->question.QuestionContext = zd;
+    zd->question.ThisQInterval   = -1;  // Tells CancelGetZoneData there's nothing to stop until we start a question
+    zd->next                     = ZoneDataLookups;
+    ZoneDataLookups              = zd;
+
+    // Our caller hasn't got zd yet, so a cached result has to wait for uDNS_Tasks to be delivered
+    if (ZoneDataCacheLookup(m, zd->CurrentSOA, target))
+    {
+        zd->ZoneDataState = ZoneDataState_Deferred;
+        m->NextuDNSEvent  = m->timenow;
+        return zd;
+    }
 
     mDNS_DropLockBeforeCallback();      // GetZoneData_StartQuery expects to be called from a normal callback, so we emulate that here
-    AssignDomainName(&zd->question.qname, zd->CurrentSOA);
-    GetZoneData_StartQuery(m, zd, kDNSType_SOA);
+    GetZoneData_ContinueWalk(m, zd);
     mDNS_ReclaimLockAfterCallback();
 
     return zd;
@@ -2175,6 +2951,7 @@ mDNSlocal mStatus UnlinkResourceRecord(mDNS *const m, AuthRecord *const rr)
     {
         *list = rr->next;
         rr->next = mDNSNULL;
+        RemoveRecordFromNameHash(m, rr);
 
         // Temporary workaround to cancel any active NAT mapping operation
         if (rr->NATinfo.clientContext)
@@ -4425,6 +5202,7 @@ mDNSlocal void uDNS_HandleLLQState(mDNS *const m, DNSQuestion *q)
 
     case LLQ_DNSPush_ServerDiscovery:
     case LLQ_DNSPush_Connecting:
+    case LLQ_DNSPush_Subscribing:
     case LLQ_DNSPush_Established:
         // Sanity check the server state to see if it matches.   If we find that we aren't connected, when
         // we think we should be, change our state.
@@ -4450,6 +5228,12 @@ mDNSlocal void uDNS_HandleLLQState(mDNS *const m, DNSQuestion *q)
                 SetNextQueryTime(m, q);
                 break;
             case DNSPushServerSessionEstablished:
+                // A subscription still queued or in flight on an established session is just waiting its turn
+                if (q->state == LLQ_DNSPush_Connecting || q->state == LLQ_DNSPush_Subscribing)
+                {
+                    DNSPushSendSubscriptions(m, q->dnsPushServer);
+                    break;
+                }
                 LogMsg("uDNS_HandleLLQState: %##s, server connection established but question state is %d",
                        &q->dnsPushServer->serverName, q->state);
                 q->state = LLQ_DNSPush_Established;
@@ -4468,6 +5252,7 @@ mDNSlocal void uDNS_HandleLLQState(mDNS *const m, DNSQuestion *q)
             // Silence warnings; these are never reached without DNS Push
         case LLQ_DNSPush_ServerDiscovery:
         case LLQ_DNSPush_Connecting:
+        case LLQ_DNSPush_Subscribing:
         case LLQ_DNSPush_Established:
 #endif // MDNSRESPONDER_SUPPORTS(COMMON, DNS_PUSH)
         case LLQ_InitialRequest:   startLLQHandshake(m, q); break;
@@ -4483,6 +5268,14 @@ mDNSlocal void uDNS_HandleLLQState(mDNS *const m, DNSQuestion *q)
 mDNSlocal void uDNS_CheckCurrentQuestion(mDNS *const m)
 {
     DNSQuestion *q = m->CurrentQuestion;
+#if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+    if (q->raceState == UnicastRace_Pending && m->timenow - q->raceTime >= 0) uDNS_SendRaceQuery(m, q);
+#endif
+    if (q->staleTime && m->timenow - q->staleTime >= 0)
+    {
+        AnswerCurrentQuestionWithStaleRecords(m);
+        if (m->CurrentQuestion != q) return;
+    }
     if (m->timenow - NextQSendTime(q) < 0) return;
 
     if (q->LongLived)
@@ -4582,6 +5375,7 @@ mDNSlocal void uDNS_CheckCurrentQuestion(mDNS *const m)
                 else
                 {
                     err = mDNSSendDNSMessage(m, &m->omsg, end, q->qDNSServer->interface, mDNSNULL, q->LocalSocket, &q->qDNSServer->addr, q->qDNSServer->port, mDNSNULL, q->UseBackgroundTraffic);
+                    if (!err) uDNS_NoteQuerySent(m, q);
 
 #if MDNSRESPONDER_SUPPORTS(APPLE, METRICS)
                     if (!err)
@@ -4678,7 +5472,7 @@ mDNSlocal void uDNS_CheckCurrentQuestion(mDNS *const m)
             // passed to uDNS_CheckCurrentQuestion -- we only want one set of query packets hitting the wire --
             // but we want *all* of the questions to get answer callbacks.)
             CacheRecord *cr;
-            const mDNSu32 slot = HashSlotFromNameHash(q->qnamehash);
+            const mDNSu32 slot = HashSlotFromNameHash(m, q->qnamehash);
             CacheGroup *const cg = CacheGroupForName(m, q->qnamehash, &q->qname);
 
             if (!q->qDNSServer)
@@ -4750,8 +5544,8 @@ mDNSlocal void uDNS_CheckCurrentQuestion(mDNS *const m)
             // We're already using the m->CurrentQuestion pointer, so CacheRecordAdd can't use it to walk the question list.
             // To solve this problem we set cr->DelayDelivery to a nonzero value (which happens to be 'now') so that we
             // momentarily defer generating answer callbacks until mDNS_Execute time.
-            CreateNewCacheEntry(m, slot, cg, NonZeroTime(m->timenow), mDNStrue, mDNSNULL);
-            ScheduleNextCacheCheckTime(m, slot, NonZeroTime(m->timenow));
+            cr = CreateNewCacheEntry(m, slot, cg, NonZeroTime(m->timenow), mDNStrue, mDNSNULL);
+            if (cr) ScheduleNextCacheCheckTime(m, cr, NonZeroTime(m->timenow));
             m->rec.r.responseFlags = zeroID;
             m->rec.r.resrec.RecordType = 0;     // Clear RecordType to show we're not still using it
             // MUST NOT touch m->CurrentQuestion (or q) after this -- client callback could have deleted it
@@ -4764,6 +5558,11 @@ mDNSexport void CheckNATMappings(mDNS *m)
 {
     mDNSBool rfc1918 = mDNSv4AddrIsRFC1918(&m->AdvertisedV4.ip.v4);
     mDNSBool HaveRoutable = !rfc1918 && !mDNSIPv4AddressIsZero(m->AdvertisedV4.ip.v4);
+    // Mapping requests that fall due together (after RecreateNATMappings, say) go out NATMAP_BURST_SIZE at a time, with
+    // the bursts spaced by the gateway's usual reply time, so that a pile of them doesn't swamp a small home gateway
+    const mDNSs32 BurstSpacing = (m->NATGatewayLatency > NATMAP_BURST_SPACING) ?
+        ((m->NATGatewayLatency < mDNSPlatformOneSecond) ? m->NATGatewayLatency : mDNSPlatformOneSecond) : NATMAP_BURST_SPACING;
+    int burst = 0;
     m->NextScheduledNATOp = m->timenow + FutureTime;
 
     if (HaveRoutable) m->ExtAddress = m->AdvertisedV4.ip.v4;
@@ -4811,8 +5610,13 @@ mDNSexport void CheckNATMappings(mDNS *m)
         }
         else // Check if it's time to send port mapping packet(s)
         {
-            if (m->timenow - cur->retryPortMap >= 0) // Time to send a mapping request for this packet
+            if (m->timenow - cur->retryPortMap >= 0 && burst >= NATMAP_BURST_SIZE)
+            {
+                cur->retryPortMap = m->timenow + BurstSpacing;  // This burst is full; go with the next one
+            }
+            else if (m->timenow - cur->retryPortMap >= 0) // Time to send a mapping request for this packet
             {
+                burst++;
                 if (cur->ExpiryTime && cur->ExpiryTime - m->timenow < 0)    // Mapping has expired
                 {
                     cur->ExpiryTime    = 0;
@@ -4820,6 +5624,8 @@ mDNSexport void CheckNATMappings(mDNS *m)
                 }
 
                 uDNS_SendNATMsg(m, cur, mDNStrue, mDNSfalse); // Will also do UPnP discovery for us, if necessary
+                cur->sentTime = m->timenow;
+                if (cur->sendCount < 255) cur->sendCount++;
 
                 if (cur->ExpiryTime)                        // If have active mapping then set next renewal time halfway to expiry
                     NATSetNextRenewalTime(m, cur);
@@ -4951,6 +5757,9 @@ mDNSlocal mDNSs32 CheckRecordUpdates(mDNS *m)
 mDNSexport void uDNS_Tasks(mDNS *const m)
 {
     mDNSs32 nexte;
+#if MDNSRESPONDER_SUPPORTS(COMMON, DNS_PUSH)
+    DNSPushNotificationServer *server;
+#endif
 #if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
     DNSServer *d;
 #endif
@@ -4961,7 +5770,19 @@ mDNSexport void uDNS_Tasks(mDNS *const m)
     if (m->NextuDNSEvent - nexte > 0)
         m->NextuDNSEvent = nexte;
 
+    GetZoneData_Tasks(m);
+
+#if MDNSRESPONDER_SUPPORTS(COMMON, DNS_PUSH)
+    // Subscriptions made since the last pass go out together
+    for (server = m->DNSPushServers; server; server = server->next)
+        if (server->subscriptionsPending) DNSPushSendSubscriptions(m, server);
+#endif
+
 #if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+    nexte = CheckTCPConnections(m);
+    if (m->NextuDNSEvent - nexte > 0)
+        m->NextuDNSEvent = nexte;
+
     for (d = m->DNSServers; d; d=d->next)
         if (d->penaltyTime)
         {
@@ -4991,8 +5812,16 @@ mDNSexport void uDNS_Tasks(mDNS *const m)
         {
             uDNS_CheckCurrentQuestion(m);
             if (q == m->CurrentQuestion)
+            {
                 if (m->NextuDNSEvent - NextQSendTime(q) > 0)
                     m->NextuDNSEvent = NextQSendTime(q);
+                if (q->staleTime && m->NextuDNSEvent - q->staleTime > 0)
+                    m->NextuDNSEvent = q->staleTime;
+#if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+                if (q->raceState == UnicastRace_Pending && m->NextuDNSEvent - q->raceTime > 0)
+                    m->NextuDNSEvent = q->raceTime;
+#endif
+            }
         }
         // If m->CurrentQuestion wasn't modified out from under us, advance it now
         // We can't do this at the start of the loop because uDNS_CheckCurrentQuestion()
@@ -5557,10 +6386,13 @@ mDNSexport domainname  *uDNS_GetNextSearchDomain(mDNSInterfaceID InterfaceID, in
 
 mDNSexport void uDNS_RestartQuestionAsTCP(mDNS *m, DNSQuestion *const q, const mDNSAddr *const srcaddr, const mDNSIPPort srcport)
 {
-    // Don't reuse TCP connections. We might have failed over to a different DNS server
-    // while the first TCP connection is in progress. We need a new TCP connection to the
-    // new DNS server. So, always try to establish a new connection.
+    // Don't reuse a question's own TCP connection. We might have failed over to a different DNS server
+    // while the first TCP connection is in progress. We need a TCP connection to the server that
+    // told us to use TCP, which for plain queries is the pooled one for that server.
     if (q->tcp) { DisposeTCPConn(q->tcp); q->tcp = mDNSNULL; }
+#if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+    if (!q->LongLived) { TCPConnectionQueue(m, q, srcaddr, srcport); return; }
+#endif
     q->tcp = MakeTCPConn(m, mDNSNULL, mDNSNULL, kTCPSocketFlags_Zero, srcaddr, srcport, mDNSNULL, q, mDNSNULL);
 }
 
@@ -5716,6 +6548,7 @@ mDNSlocal void DNSPushProcessResponse(mDNS *const m, const DNSMessage *const msg
                     (rr->resrec.rrclass == mrr->rrclass &&
                      ((action == removeRRset && rr->resrec.rrtype == mrr->rrtype) ||
                       (action == removeRR    && rr->resrec.rrtype == mrr->rrtype  &&
+                       rr->resrec.rdlength == mrr->rdlength && rr->resrec.rdatahash == mrr->rdatahash &&
                        SameRDataBody(mrr, &rr->resrec.rdata->u, SameDomainName)))))
                 {
                     LogInfo("DNSPushProcessResponse purging %##s (%s) %s",
@@ -5748,7 +6581,7 @@ mDNSlocal void DNSPushProcessResponse(mDNS *const m, const DNSMessage *const msg
         // We only try to cache answers if we have a cache to put them in
         if (m->rrcache_size)
         {
-            const mDNSu32 slot = HashSlotFromNameHash(mrr->namehash);
+            const mDNSu32 slot = HashSlotFromNameHash(m, mrr->namehash);
             CacheGroup *cg = CacheGroupForName(m, mrr->namehash, mrr->name);
             CacheRecord *rr = mDNSNULL;
 
@@ -5832,7 +6665,7 @@ DNSPushStartConnecting(DNSPushNotificationServer *server)
 mDNSexport  void DNSPushReconcileConnection(mDNS *m, DNSQuestion *q)
 {
     DNSPushNotificationZone   *zone;
-    DNSPushNotificationZone   *nextZone;
+    DNSPushNotificationZone  **zp;
 
     if (q->dnsPushServer == mDNSNULL)
     {
@@ -5849,18 +6682,17 @@ mDNSexport  void DNSPushReconcileConnection(mDNS *m, DNSQuestion *q)
     }
     q->dnsPushServer->numberOfQuestions--;
 
-    nextZone = mDNSNULL;
-    for (zone = m->DNSPushZones; zone != mDNSNULL; zone = nextZone)
+    for (zp = &m->DNSPushZones; (zone = *zp) != mDNSNULL; )
     {
-        nextZone = zone->next;
         if (zone->numberOfQuestions == 0)
         {
-            if (zone == m->DNSPushZones)
-                m->DNSPushZones = nextZone;
+            *zp = zone->next;
             LogInfo("DNSPushReconcileConnection: zone %##s is being freed", &zone->zoneName);
             mDNSPlatformMemFree(zone);
-         }
-     }
+        }
+        else
+            zp = &zone->next;
+    }
 
     q->dnsPushServer = mDNSNULL;
 }
@@ -5884,7 +6716,8 @@ static void DNSPushSendKeepalive(DNSPushNotificationServer *server, mDNSu32 inac
     dso_message_write(server->connection, &state, mDNSfalse);
 }
 
-static void DNSPushNotificationSendSubscriptionChange(mDNSBool subscribe, dso_state_t *dso, DNSQuestion *q)
+// Returns false if the message couldn't be sent, e.g. because DNS_PUSH_MAX_OUTSTANDING SUBSCRIBEs are already awaiting a response
+static mDNSBool DNSPushNotificationSendSubscriptionChange(mDNSBool subscribe, dso_state_t *dso, DNSQuestion *q)
 {
     dso_message_t state;
     dso_transport_t *transport = dso->transport;
@@ -5892,9 +6725,11 @@ static void DNSPushNotificationSendSubscriptionChange(mDNSBool subscribe, dso_st
     if (transport == NULL || transport->outbuf == NULL) {
         // Should be impossible, don't crash.
         LogInfo("DNSPushNotificationSendSubscribe: no transport!");
-        return;
+        return mDNSfalse;
+    }
+    if (!dso_make_message(&state, transport->outbuf, transport->outbuf_size, dso, subscribe ? false : true, q)) {
+        return mDNSfalse;
     }
-    dso_make_message(&state, transport->outbuf, transport->outbuf_size, dso, subscribe ? false : true, q);
     dso_start_tlv(&state, subscribe ? kDSOType_DNSPushSubscribe : kDSOType_DNSPushUnsubscribe);
     len = DomainNameLengthLimit(&q->qname, q->qname.c + (sizeof q->qname));
     dso_add_tlv_bytes(&state, q->qname.c, len);
@@ -5902,6 +6737,34 @@ static void DNSPushNotificationSendSubscriptionChange(mDNSBool subscribe, dso_st
     dso_add_tlv_u16(&state, q->qclass);
     dso_finish_tlv(&state);
     dso_message_write(dso, &state, mDNSfalse);
+    return mDNStrue;
+}
+
+// RFC 8765 only allows one SUBSCRIBE TLV per message, so rather than packing them together we send every SUBSCRIBE
+// that is waiting on this session back to back, as far as the limit on outstanding requests allows. Whatever doesn't
+// fit goes out as responses come back.
+mDNSexport void DNSPushSendSubscriptions(mDNS *m, DNSPushNotificationServer *server)
+{
+    dso_activity_t *activity;
+    (void)m;
+
+    if (server->connection == mDNSNULL ||
+        (server->connectState != DNSPushServerConnected && server->connectState != DNSPushServerSessionEstablished))
+    {
+        return;
+    }
+    server->subscriptionsPending = mDNSfalse;
+    for (activity = server->connection->activities; activity; activity = activity->next)
+    {
+        DNSQuestion *const q = activity->context;
+        if (activity->activity_type != kDNSPushActivity_Subscription || q->state != LLQ_DNSPush_Connecting) continue;
+        if (!DNSPushNotificationSendSubscriptionChange(mDNStrue, server->connection, q))
+        {
+            server->subscriptionsPending = mDNStrue;
+            break;
+        }
+        q->state = LLQ_DNSPush_Subscribing;
+    }
 }
 
 static void DNSPushStop(mDNS *m, DNSPushNotificationServer *server)
@@ -5957,7 +6820,7 @@ static void DNSPushServerFree(mDNS *m, DNSPushNotificationServer *server)
         }
         else
         {
-        	sp = &server->next;
+        	sp = &(*sp)->next;
         }
     }
     mDNSPlatformMemFree(server);
@@ -6014,7 +6877,7 @@ static void DNSPushDSOCallback(void *context, const void *event_context,
         if (q) {
             // If we got an error on a subscribe, we need to evaluate what went wrong
             if (rcode == kDNSFlag1_RC_NoErr) {
-                LogMsg("DNSPushDSOCallback: Subscription for %##s/%d/%d succeeded.", q->qname.c, q->qtype, q->qclass);
+                LogInfo("DNSPushDSOCallback: Subscription for %##s/%d/%d succeeded.", q->qname.c, q->qtype, q->qclass);
                 q->state = LLQ_DNSPush_Established;
                 server->connectState = DNSPushServerSessionEstablished;
             } else {
@@ -6031,6 +6894,8 @@ static void DNSPushDSOCallback(void *context, const void *event_context,
                    dso->primary.opcode, receive_context->rcode, &server->serverName);
             server->connectState = DNSPushServerSessionEstablished;
         }
+        // The response freed up a slot for one of the subscriptions still waiting
+        if (server->subscriptionsPending) DNSPushSendSubscriptions(m, server);
 		break;
 
 	case kDSOEventType_Finalize:
@@ -6040,9 +6905,15 @@ static void DNSPushDSOCallback(void *context, const void *event_context,
 	case kDSOEventType_Connected:
         LogMsg("DNSPushDSOCallback: Connected to %##s", &server->serverName);
         server->connectState = DNSPushServerConnected;
+        // Anything subscribed on an earlier session has to be subscribed again on this one
         for (activity = dso->activities; activity; activity = activity->next) {
-            DNSPushNotificationSendSubscriptionChange(mDNStrue, dso, activity->context);
+            q = activity->context;
+            if (activity->activity_type == kDNSPushActivity_Subscription &&
+                (q->state == LLQ_DNSPush_Subscribing || q->state == LLQ_DNSPush_Established)) {
+                q->state = LLQ_DNSPush_Connecting;
+            }
         }
+        DNSPushSendSubscriptions(m, server);
 		break;
 
 	case kDSOEventType_ConnectFailed:
@@ -6124,17 +6995,14 @@ DNSPushNotificationServer *GetConnectionToDNSPushNotificationServer(mDNS *m, DNS
     // If we already have a question for this zone and if the server is the same, reuse it
     for (zone = m->DNSPushZones; zone != mDNSNULL; zone = zone->next)
     {
-        LogMsg("GetConnectionToDNSPushNotificationServer: zone compare zone %##s question %##s", &zone->zoneName, &q->nta->ChildName);
         if (SameDomainName(&q->nta->ChildName, &zone->zoneName))
         {
             DNSPushNotificationServer *zoneServer = mDNSNULL;
             zoneServer = zone->server;
             if (zoneServer != mDNSNULL) {
-                LogMsg("GetConnectionToDNSPushNotificationServer: server compare server %##s question %##s",
-                       &zoneServer->serverName, &q->nta->Host);
-                if (SameDomainName(&q->nta->Host, &zoneServer->serverName))
+                if (SameDomainName(&q->nta->Host, &zoneServer->serverName) && mDNSSameIPPort(q->nta->Port, zoneServer->port))
                 {
-                    LogMsg("GetConnectionToDNSPushNotificationServer: server and zone already present.");
+                    LogInfo("GetConnectionToDNSPushNotificationServer: server and zone already present.");
                     zone->numberOfQuestions++;
                     zoneServer->numberOfQuestions++;
                     return zoneServer;
@@ -6146,9 +7014,7 @@ DNSPushNotificationServer *GetConnectionToDNSPushNotificationServer(mDNS *m, DNS
     // If we have a connection to this server but it is for a differnt zone, create a new zone entry and reuse the connection
     for (server = m->DNSPushServers; server != mDNSNULL; server = server->next)
     {
-        LogMsg("GetConnectionToDNSPushNotificationServer: server compare server %##s question %##s",
-               &server->serverName, &q->nta->Host);
-        if (SameDomainName(&q->nta->Host, &server->serverName))
+        if (SameDomainName(&q->nta->Host, &server->serverName) && mDNSSameIPPort(q->nta->Port, server->port))
         {
             newZone = (DNSPushNotificationZone *) mDNSPlatformMemAllocateClear(sizeof(*newZone));
             if (newZone == NULL)
@@ -6164,7 +7030,7 @@ DNSPushNotificationServer *GetConnectionToDNSPushNotificationServer(mDNS *m, DNS
             m->DNSPushZones = newZone;
 
             server->numberOfQuestions++;
-            LogMsg("GetConnectionToDNSPushNotificationServer: server already present.");
+            LogInfo("GetConnectionToDNSPushNotificationServer: server already present.");
             return server;
         }
     }
@@ -6192,7 +7058,7 @@ DNSPushNotificationServer *GetConnectionToDNSPushNotificationServer(mDNS *m, DNS
     newServer->qDNSServer = q->qDNSServer;
 #endif
     ConvertDomainNameToCString(&newServer->serverName, name);
-    newServer->connection = dso_create(mDNSfalse, 10, name, DNSPushDSOCallback, newServer, NULL);
+    newServer->connection = dso_create(mDNSfalse, DNS_PUSH_MAX_OUTSTANDING, name, DNSPushDSOCallback, newServer, NULL);
     if (newServer->connection == NULL)
     {
         mDNSPlatformMemFree(newServer);
@@ -6243,11 +7109,11 @@ DNSPushNotificationServer *SubscribeToDNSPushNotificationServer(mDNS *m, DNSQues
         LogInfo("SubscribeToDNSPushNotificationServer: failed to add question %##s", &q->qname);
         return mDNSNULL;
     }
-    // If we're already connected, send the subscribe request immediately.
-    if (server->connectState == DNSPushServerConnected || server->connectState == DNSPushServerSessionEstablished)
-    {
-        DNSPushNotificationSendSubscriptionChange(mDNStrue, server->connection, q);
-    }
+    // If we're already connected, the SUBSCRIBE goes out from uDNS_Tasks at the end of this pass, along with any others
+    // made meanwhile; otherwise it goes out once we're connected.
+    q->state = LLQ_DNSPush_Connecting;
+    server->subscriptionsPending = mDNStrue;
+    m->NextuDNSEvent = m->timenow;
     return server;
 }
 
@@ -6270,8 +7136,9 @@ mDNSexport void UnSubscribeToDNSPushNotificationServer(mDNS *m, DNSQuestion *q)
     {
         if (q->dnsPushServer->connection != mDNSNULL)
         {
-            if (q->dnsPushServer->connectState == DNSPushServerSessionEstablished ||
-                q->dnsPushServer->connectState == DNSPushServerConnected)
+            // A subscription that never made it out doesn't need undoing
+            if ((q->dnsPushServer->connectState == DNSPushServerSessionEstablished ||
+                 q->dnsPushServer->connectState == DNSPushServerConnected) && q->state != LLQ_DNSPush_Connecting)
             {
                 // Ignore any response we get to a pending subscribe.
                 dso_ignore_response(q->dnsPushServer->connection, q);
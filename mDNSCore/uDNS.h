@@ -40,6 +40,15 @@ extern "C" {
 #define RESPONSE_WINDOW (60 * mDNSPlatformOneSecond)         // require server responses within one minute of request
 #define MAX_UCAST_UNANSWERED_QUERIES 2                       // number of unanswered queries from any one uDNS server before trying another server
 #define DNSSERVER_PENALTY_TIME (60 * mDNSPlatformOneSecond)  // number of seconds for which new questions don't pick this server
+#define DNSSERVER_SRTT_SHIFT 3                               // DNSServer srtt is scaled by 8 and moves 1/8 of the way to each sample
+#define DNSSERVER_LOSS_SHIFT 3                               // DNSServer loss moves 1/8 of the way towards 0 or 255 on each outcome
+#define UNICAST_RACE_STAGGER (mDNSPlatformOneSecond / 20)    // head start qDNSServer gets over the runner-up when racing servers
+#define UNICAST_PREFETCH_MIN_TTL 10                          // records with shorter TTLs (in seconds) are not worth prefetching
+#define SERVE_STALE_CLIENT_TIMEOUT (mDNSPlatformOneSecond * 18 / 10) // RFC 8767 client response timer: wait for upstream before serving stale
+#define SERVE_STALE_ANSWER_TTL 30                            // RFC 8767: TTL (in seconds) handed to clients with stale data
+#define SERVE_STALE_MAX_TIME (3 * 24 * 3600 * mDNSPlatformOneSecond) // RFC 8767: how long after expiry data may still be served
+#define ZONE_DATA_CACHE_MAX_TTL 300                          // longest (in seconds) we reuse a GetZoneData result before walking the tree again
+#define ZONE_DATA_CACHE_MAX_ENTRIES 64                       // names we remember GetZoneData results for
 
 // On some interfaces, we want to delay the first retransmission to a minimum of 2 seconds
 // rather than the default (1 second).
@@ -72,12 +81,17 @@ extern "C" {
 #define DEFAULT_UDNS_TIMEOUT    30 // in seconds
 
 #if MDNSRESPONDER_SUPPORTS(COMMON, DNS_PUSH)
+#define DNS_PUSH_MAX_OUTSTANDING 32     // SUBSCRIBEs we'll have awaiting a response on one session; the rest wait their turn
+
 // Push notification structures
+// Every question subscribed through a given server shares its one DSO session: each subscription is a DSO activity
+// on that session, and SUBSCRIBEs queued up during an event loop pass go out together from uDNS_Tasks.
 struct mDNS_DNSPushNotificationServer
 {
     dso_connect_state_t       *connectInfo;       // DSO Connection state information
     dso_state_t               *connection;        // DNS Stateful Operations/TCP Connection pointer, might be null.
     mDNSu32                    numberOfQuestions; // Number of questions for this server
+    mDNSBool                   subscriptionsPending; // Some questions are in LLQ_DNSPush_Connecting, waiting to be sent
     DNSPushServer_ConnectState connectState;      // Current status of connection attempt to this server
     mDNSs32                    lastDisconnect;    // Last time we got a disconnect, used to avoid constant reconnects
     domainname                 serverName;        // The hostname returned by the _dns-push-tls._tcp.<zone> SRV lookup
@@ -100,6 +114,34 @@ struct mDNS_DNSPushNotificationZone
 } ;
 #endif
 
+#if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+#define DNS_TCP_IDLE_TIMEOUT     (10 * mDNSPlatformOneSecond)   // how long we keep an idle pooled connection to a DNS server
+#define DNS_TCP_MAX_IDLE_TIMEOUT (120 * mDNSPlatformOneSecond)  // the most a server can stretch that with edns-tcp-keepalive
+
+// A TCP connection to a unicast DNS server, shared by every plain query that falls back to TCP with that server.
+// Queries are pipelined over it and replies matched to questions by message ID (RFC 7766), and it stays open
+// for a while after the last reply so that the next truncated answer doesn't have to pay for a new handshake.
+struct mDNS_DNSTCPConnection
+{
+    DNSTCPConnection *next;
+    mDNS             *m;
+    TCPSocket        *sock;
+    mDNSInterfaceID   InterfaceID;
+    mDNSAddr          Addr;
+    mDNSIPPort        Port;
+    mDNSIPPort        SrcPort;
+    mDNSBool          connected;
+    mDNSu32           outstanding;        // Number of questions waiting for a reply on this connection
+    mDNSu32           numReplies;
+    mDNSs32           idleTimeout;        // DNS_TCP_IDLE_TIMEOUT, unless the server has told us otherwise
+    mDNSs32           closeTime;          // When to close the connection if it stays idle; zero while in use
+    DNSMessage       *reply;
+    mDNSu16           replylen;
+    unsigned long     nread;
+    TCPReplyStream    stream;
+};
+#endif
+
 // Entry points into unicast-specific routines
 
 extern void LLQGotZoneData(mDNS *const m, mStatus err, const ZoneData *zoneInfo);
@@ -114,6 +156,7 @@ extern DNSPushNotificationServer *SubscribeToDNSPushNotificationServer(mDNS *m,
 extern void UnSubscribeToDNSPushNotificationServer(mDNS *m, DNSQuestion *q);
 extern void DNSPushReconcileConnection(mDNS *m, DNSQuestion *q);
 extern void DNSPushServerDrop(DNSPushNotificationServer *server);
+extern void DNSPushSendSubscriptions(mDNS *m, DNSPushNotificationServer *server);
 #endif
 
 extern void SleepRecordRegistrations(mDNS *m);
@@ -128,12 +171,15 @@ extern mStatus uDNS_UpdateRecord(mDNS *m, AuthRecord *rr);
 
 extern void SetNextQueryTime(mDNS *const m, const DNSQuestion *const q);
 extern mStatus mDNS_Register_internal(mDNS *const m, AuthRecord *const rr);
+extern void RemoveRecordFromNameHash(mDNS *const m, AuthRecord *const rr);
 extern mStatus mDNS_Deregister_internal(mDNS *const m, AuthRecord *const rr, mDNS_Dereg_type drt);
 extern mStatus mDNS_StartQuery_internal(mDNS *const m, DNSQuestion *const question);
 extern mStatus mDNS_StopQuery_internal(mDNS *const m, DNSQuestion *const question);
 extern mStatus mDNS_StartNATOperation_internal(mDNS *const m, NATTraversalInfo *traversal);
 
 extern void RecordRegistrationGotZoneData(mDNS *const m, mStatus err, const ZoneData *zoneData);
+extern void GetZoneData_Unlink(mDNS *const m, ZoneData *zd);
+extern void FlushZoneDataCache(mDNS *const m);
 extern mStatus uDNS_DeregisterRecord(mDNS *const m, AuthRecord *const rr);
 extern const domainname *GetServiceTarget(mDNS *m, AuthRecord *const rr);
 
@@ -173,6 +219,10 @@ extern uDNS_LLQType    uDNS_recvLLQResponse(mDNS *const m, const DNSMessage *con
 extern DomainAuthInfo *GetAuthInfoForName_internal(mDNS *m, const domainname *const name);
 extern DomainAuthInfo *GetAuthInfoForQuestion(mDNS *m, const DNSQuestion *const q);
 extern void DisposeTCPConn(struct tcpInfo_t *tcp);
+#if !MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+extern void uDNS_ReleaseTCPConnection(mDNS *const m, DNSQuestion *const q);
+extern void uDNS_CloseTCPConnections(mDNS *const m);
+#endif
 
 // NAT traversal
 extern void uDNS_ReceiveNATPacket(mDNS *m, const mDNSInterfaceID InterfaceID, mDNSu8 *pkt, mDNSu16 len); // Called for each received PCP or NAT-PMP packet
@@ -286,4 +286,12 @@
 	#endif
 #endif
 
+// Feature: Batched receipt of UDP packets with recvmsg_x, so that all of the datagrams queued on an mDNS socket are
+//          read with one system call per wakeup and handed to mDNSCore under one lock.
+// Enabled: Yes.
+
+#if !defined(MDNSRESPONDER_SUPPORTS_APPLE_RECVMSG_X)
+    #define MDNSRESPONDER_SUPPORTS_APPLE_RECVMSG_X                  1
+#endif
+
 #endif  // __ApplePlatformFeatures_h
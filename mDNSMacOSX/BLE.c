@@ -146,6 +146,10 @@ typedef struct matchingResponses
 typedef struct requestList
 {
     struct requestList  * next;
+    struct requestList  * prev;
+    struct requestList  * hashNext;     // Chain in the list's name/type hash table
+    struct requestList  * groupNext;    // Chain in the request's serviceHashGroup
+    struct serviceHashGroup * group;    // Set once the service hashes are computed and counted in the beacon
     unsigned int        refCount;
     domainname          name;
     mDNSu16             type;
@@ -169,6 +173,31 @@ typedef struct requestList
 static requestList_t* BLEBrowseListHead = NULL;
 static requestList_t* BLERegistrationListHead = NULL;
 
+// Each list is also indexed by name and type so that findInRequestList() does not walk the whole list.
+#define REQUEST_HASH_SLOTS 64
+static requestList_t* BLEBrowseHashTable[REQUEST_HASH_SLOTS];
+static requestList_t* BLERegistrationHashTable[REQUEST_HASH_SLOTS];
+
+// Requests that share a BLELabelHash value, i.e. the same service type and protocol.
+// A peer beacon only needs one Bloom filter check per group, and a group none of whose
+// members has the peer on its response list can be skipped entirely when the check fails.
+typedef struct serviceHashGroup
+{
+    struct serviceHashGroup * next;
+    serviceHash_t       hash;               // registeredHash for browses, browseHash for registrations
+    unsigned int        respondingCount;    // Members with a non-empty ourResponses list
+    requestList_t       * members;          // Chained through requestList_t.groupNext
+} serviceHashGroup_t;
+
+static serviceHashGroup_t* BLEBrowseGroups = NULL;
+static serviceHashGroup_t* BLERegistrationGroups = NULL;
+
+// The beacon Bloom filter is the OR of the browseHash of every browse and the registeredHash of every registration.
+// Counting the requests contributing each bit lets it be updated as requests come and go instead of rebuilt.
+#define BLOOM_FILTER_BITS (sizeof(serviceHash_t) * 8)
+static unsigned int  BLEBeaconBitCounts[BLOOM_FILTER_BITS];
+static serviceHash_t BLEBeaconBloomFilter = 0;
+
 // The kDNSServiceFlagsAutoTrigger should only be set for a request that would normally apply to AWDL.
 #define isAutoTriggerRequest(INTERFACE_INDEX, FLAGS) (    (FLAGS & kDNSServiceFlagsAutoTrigger) \
                                                        && (   (AWDLInterfaceID && (INTERFACE_INDEX == AWDLInterfaceID)) \
@@ -179,11 +208,11 @@ static requestList_t* BLERegistrationListHead = NULL;
 // Return true if any response matches one of our current registrations.
 mDNSlocal bool responseMatchesRegistrations(void)
 {
-    requestList_t   *ptr;
+    serviceHashGroup_t  *group;
 
-    for (ptr = BLERegistrationListHead; ptr; ptr = ptr->next)
+    for (group = BLERegistrationGroups; group; group = group->next)
     {
-        if (ptr->ourResponses)
+        if (group->respondingCount)
             return true;
     }
     return false;
@@ -210,6 +239,8 @@ mDNSlocal void addToResponseListForRequest(requestList_t *request, void * respon
         LogMsg("addToResponseListForRequest: calloc() failed!");
         return;
     }
+    if (!request->ourResponses && request->group)
+        request->group->respondingCount++;
     matchingResponse->response = response;
     matchingResponse->next = request->ourResponses;
     request->ourResponses = matchingResponse;
@@ -234,6 +265,8 @@ mDNSlocal bool removeFromResponseListForRequest(requestList_t *request, void * r
         matchingResponses_t *tmp = *nextp;
         *nextp = (*nextp)->next;
         free(tmp);
+        if (!request->ourResponses && request->group)
+            request->group->respondingCount--;
     }
     return responseRemoved;
 }
@@ -243,6 +276,9 @@ mDNSlocal void freeResponseListEntriesForRequest(requestList_t *request)
 {
     matchingResponses_t * ptr;
 
+    if (request->ourResponses && request->group)
+        request->group->respondingCount--;
+
     ptr = request->ourResponses; 
     while (ptr)
     {
@@ -257,13 +293,18 @@ mDNSlocal void freeResponseListEntriesForRequest(requestList_t *request)
 
 #pragma mark - Manage request lists
 
-// Return the address of the pointer to the entry, which can either be the address of "listHead"
-// or the address of the prior entry on the lists "next" pointer.
+mDNSlocal requestList_t ** requestHashTableForList(requestList_t ** listHead)
+{
+    return (listHead == &BLEBrowseListHead) ? BLEBrowseHashTable : BLERegistrationHashTable;
+}
+
+// Return the address of the pointer to the entry in its hash chain, which can either be the address of the
+// hash table slot or the address of the prior entry's "hashNext" pointer.
 mDNSlocal requestList_t ** findInRequestList(requestList_t ** listHead, const domainname *const name, mDNSu16 type)
 {
-    requestList_t **ptr = listHead;
+    requestList_t **ptr = &requestHashTableForList(listHead)[(DomainNameHashValue(name) + type) % REQUEST_HASH_SLOTS];
 
-    for ( ; *ptr; ptr = &(*ptr)->next)
+    for ( ; *ptr; ptr = &(*ptr)->hashNext)
         if ((*ptr)->type == type && SameDomainName(&(*ptr)->name, name))
             break;
 
@@ -280,6 +321,11 @@ mDNSlocal requestList_t * addToRequestList(requestList_t ** listHead, const doma
         (*ptr)->type = type;
         (*ptr)->flags = flags;
         AssignDomainName(&(*ptr)->name, name);
+
+        (*ptr)->next = *listHead;
+        if (*listHead)
+            (*listHead)->prev = *ptr;
+        *listHead = *ptr;
     }
     (*ptr)->refCount += 1;
 
@@ -288,6 +334,9 @@ mDNSlocal requestList_t * addToRequestList(requestList_t ** listHead, const doma
     return *ptr;
 }
 
+// Forward declaration.
+mDNSlocal void removeRequestHashes(requestList_t ** listHead, requestList_t * request);
+
 mDNSlocal void removeFromRequestList(requestList_t ** listHead, const domainname *const name, mDNSu16 type)
 {
     requestList_t **ptr = findInRequestList(listHead, name, type);
@@ -301,8 +350,17 @@ mDNSlocal void removeFromRequestList(requestList_t ** listHead, const domainname
     if (!(*ptr)->refCount)
     {
         requestList_t *tmp = *ptr;
-        *ptr = (*ptr)->next;
+        *ptr = tmp->hashNext;
+
+        if (tmp->prev)
+            tmp->prev->next = tmp->next;
+        else
+            *listHead = tmp->next;
+        if (tmp->next)
+            tmp->next->prev = tmp->prev;
+
         freeResponseListEntriesForRequest(tmp);
+        removeRequestHashes(listHead, tmp);
         mDNSPlatformMemFree(tmp);
     }
 }
@@ -544,6 +602,81 @@ mDNSlocal bool setBLEServiceHash(const domainname *const domain, requestList_t *
         return false;
 }
 
+// Count the hash this request contributes to our beacon and add the request to the group of requests
+// that a peer beacon is matched against with the same hash. Called once setBLEServiceHash() succeeds.
+mDNSlocal void addRequestHashes(requestList_t ** listHead, requestList_t * request)
+{
+    const bool          isBrowse   = (listHead == &BLEBrowseListHead);
+    serviceHash_t       beaconHash = isBrowse ? request->browseHash : request->registeredHash;
+    serviceHash_t       matchHash  = isBrowse ? request->registeredHash : request->browseHash;
+    serviceHashGroup_t  **groups   = isBrowse ? &BLEBrowseGroups : &BLERegistrationGroups;
+    serviceHashGroup_t  *group;
+
+    for (group = *groups; group; group = group->next)
+        if (group->hash == matchHash)
+            break;
+
+    if (!group)
+    {
+        group = (serviceHashGroup_t *) mDNSPlatformMemAllocateClear(sizeof(*group));
+        if (!group)
+        {
+            LogMsg("addRequestHashes: mDNSPlatformMemAllocateClear() failed!");
+            return;
+        }
+        group->hash = matchHash;
+        group->next = *groups;
+        *groups = group;
+    }
+    request->groupNext = group->members;
+    group->members = request;
+    request->group = group;
+    if (request->ourResponses)
+        group->respondingCount++;
+
+    for (unsigned int bit = 0; bit < BLOOM_FILTER_BITS; bit++)
+        if (beaconHash & ((serviceHash_t)1 << bit))
+            BLEBeaconBitCounts[bit]++;
+    BLEBeaconBloomFilter |= beaconHash;
+}
+
+mDNSlocal void removeRequestHashes(requestList_t ** listHead, requestList_t * request)
+{
+    const bool          isBrowse   = (listHead == &BLEBrowseListHead);
+    serviceHash_t       beaconHash = isBrowse ? request->browseHash : request->registeredHash;
+    serviceHashGroup_t  **groups   = isBrowse ? &BLEBrowseGroups : &BLERegistrationGroups;
+    serviceHashGroup_t  *group     = request->group;
+    requestList_t       **member;
+
+    if (!group)
+        return;
+
+    for (member = &group->members; *member; member = &(*member)->groupNext)
+        if (*member == request)
+        {
+            *member = request->groupNext;
+            break;
+        }
+    if (request->ourResponses)
+        group->respondingCount--;
+    request->group = NULL;
+
+    if (!group->members)
+    {
+        for ( ; *groups; groups = &(*groups)->next)
+            if (*groups == group)
+            {
+                *groups = group->next;
+                break;
+            }
+        mDNSPlatformMemFree(group);
+    }
+
+    for (unsigned int bit = 0; bit < BLOOM_FILTER_BITS; bit++)
+        if ((beaconHash & ((serviceHash_t)1 << bit)) && --BLEBeaconBitCounts[bit] == 0)
+            BLEBeaconBloomFilter &= ~((serviceHash_t)1 << bit);
+}
+
 // Indicates we are sending the final beacon with zeroed Bloom filter to let
 // peers know we are no longer actively seeking or providing any services.
 bool finalBeacon = false;
@@ -607,26 +740,14 @@ mDNSlocal void updateServiceTimer()
 // a peer beacon indicating a browse for one of our services.
 bool suppressBeacons = false;
 
-// Go through all the existing browses and registrations to create the
-// current Bloom filter value for the BLE beacon.
-// Update the current scan and beaconing state appropriately.
+// Update the current scan and beaconing state appropriately for the current Bloom filter value,
+// which addRequestHashes() and removeRequestHashes() keep up to date as requests come and go.
 mDNSlocal void updateBeaconAndScanState()
 {
-    requestList_t   *ptr;
-    serviceHash_t   beaconBloomFilter = 0;
+    serviceHash_t   beaconBloomFilter = BLEBeaconBloomFilter;
 
     updateServiceTimer();
 
-    for (ptr = BLEBrowseListHead; ptr; ptr = ptr->next)
-    {
-        beaconBloomFilter |= ptr->browseHash;
-    }
-
-    for (ptr = BLERegistrationListHead; ptr; ptr = ptr->next)
-    {
-        beaconBloomFilter |= ptr->registeredHash;
-    }
-
     // If only advertising registered services and not browsing, we don't start the beacon transmission 
     // until we receive a beacon from a peer matching one of our registrations.
     if (BLERegistrationListHead && !BLEBrowseListHead && !responseMatchesRegistrations())
@@ -680,16 +801,25 @@ typedef struct responseList
     mDNSEthAddr         peerMac;
 } responseList_t;
 
-#define RESPONSE_LIST_NUMBER 8
+#define RESPONSE_LIST_NUMBER 64
 static responseList_t* BLEResponseListHeads[RESPONSE_LIST_NUMBER];
 
+// OR of every peer Bloom filter seen since the response lists were last cleared.
+// If a new request's hash isn't covered by it, no cached response can match.
+static serviceHash_t BLEResponseFilterUnion = 0;
+
 // Return the address of the pointer to the entry, which can either be the address of the
 // corresponding BLEResponseListHeads[] entry, or the address of the prior responseList_t entry
 // on the lists "next" pointer.
 mDNSlocal responseList_t ** findInResponseList(mDNSEthAddr * ptrToMAC)
 {
-    // Use the least significant byte of the MAC address as our hash index to find the list.
-    responseList_t **ptr = & BLEResponseListHeads[ptrToMAC->b[5] % RESPONSE_LIST_NUMBER];
+    unsigned int hash = 0;
+
+    // Hash the whole MAC address to pick the list.
+    for (unsigned int i = 0; i < sizeof(ptrToMAC->b); i++)
+        hash = hash * 31 + ptrToMAC->b[i];
+
+    responseList_t **ptr = & BLEResponseListHeads[hash % RESPONSE_LIST_NUMBER];
 
     for ( ; *ptr; ptr = &(*ptr)->next)
     {
@@ -710,6 +840,7 @@ mDNSlocal responseList_t * addToResponseList(serviceHash_t peerBloomFilter, mDNS
         *ptr = (responseList_t *) mDNSPlatformMemAllocateClear(sizeof(**ptr));
         (*ptr)->peerBloomFilter = peerBloomFilter;
         memcpy(& (*ptr)->peerMac, ptrToMAC, sizeof(mDNSEthAddr));
+        BLEResponseFilterUnion |= peerBloomFilter;
     }
 
     return *ptr;
@@ -752,6 +883,7 @@ mDNSlocal void clearResponseLists()
             mDNSPlatformMemFree(tmp);
         }
     }
+    BLEResponseFilterUnion = 0;
 }
 
 // Check to see if we have cached a response that matches a service for which we just started a browse or registration.
@@ -759,6 +891,10 @@ mDNSlocal void checkCachedResponses(requestList_t *browse, requestList_t *regist
 {
     responseList_t *ptr;
 
+    if (    (!browse || (browse->registeredHash & BLEResponseFilterUnion) != browse->registeredHash)
+        &&  (!registration || (registration->browseHash & BLEResponseFilterUnion) != registration->browseHash))
+        return;
+
     for (unsigned int i = 0; i < RESPONSE_LIST_NUMBER; i++)
     {
         for (ptr = BLEResponseListHeads[i]; ptr; ptr = ptr->next)
@@ -784,134 +920,162 @@ mDNSlocal void checkCachedResponses(requestList_t *browse, requestList_t *regist
 static Byte  *BLEinstanceValue = (Byte *) "\x11ThresholdInstance\xc0\x27";
 #define BLEValueSize  strlen((const char *)BLEinstanceValue)
 
-// Find each local browse that matches the registered service hash in the BLE response.
-// Called on the CFRunLoop thread while handling a callback from CoreBluetooth.
-// Caller should hold  KQueueLock().
-mDNSlocal void findMatchingBrowse(responseList_t *response)
+// Update one browse for a peer response; "matched" is whether the response's Bloom filter
+// contains the registeredHash of the browse's group.
+mDNSlocal void updateBrowseForResponse(requestList_t *ptr, responseList_t *response, bool matched)
 {
-    requestList_t *ptr;
-
-    ptr = BLEBrowseListHead;
-    for ( ; ptr; ptr = ptr->next)
+    if (matched)
     {
-        // See if we potentially match a corresponding registration in the beacon.
-        // thus, compare using the "registeredHash" of our browse..
-        if ((ptr->registeredHash & response->peerBloomFilter) == ptr->registeredHash) 
-        {
-
-            LogInfo("findMatchingBrowse: Registration in response matched browse for: %##s", ptr->name.c);
+        LogInfo("findMatchingBrowse: Registration in response matched browse for: %##s", ptr->name.c);
 
-            if (inResponseListForRequest(ptr, response))
-            {
-                LogInfo("findMatchingBrowse: Already on response list for browse: %##s", ptr->name.c);
+        if (inResponseListForRequest(ptr, response))
+        {
+            LogInfo("findMatchingBrowse: Already on response list for browse: %##s", ptr->name.c);
+        }
+        else
+        {
+            LogInfo("findMatchingBrowse: Adding to response list for browse: %##s", ptr->name.c);
 
-                continue;
-            }
-            else
+            if (ptr->ourResponses == 0)
             {
-                LogInfo("findMatchingBrowse: Adding to response list for browse: %##s", ptr->name.c);
+                if (isAutoTriggerRequest(ptr->InterfaceID, ptr->flags))
+                {
+                    LogInfo("findMatchingBrowse: First BLE response, triggering browse for %##s on AWDL", ptr->name.c);
+                    // register with the AWDL D2D plugin, 
+                    internal_start_browsing_for_service(ptr->InterfaceID, & ptr->name, ptr->type, ptr->flags);
+                    ptr->triggeredOnAWDL = true;
+                }
 
-                if (ptr->ourResponses == 0)
+                // Browse on mDNSInterface_BLE is used to determine if there are one or more instances of the
+                // service type discoveryed over BLE.  If this is the first instance, add the psuedo instance defined by BLEinstanceValue.
+                if (ptr->InterfaceID == mDNSInterface_BLE)
                 {
-                    if (isAutoTriggerRequest(ptr->InterfaceID, ptr->flags))
-                    {
-	                    LogInfo("findMatchingBrowse: First BLE response, triggering browse for %##s on AWDL", ptr->name.c);
-	                    // register with the AWDL D2D plugin, 
-	                    internal_start_browsing_for_service(ptr->InterfaceID, & ptr->name, ptr->type, ptr->flags);
-                        ptr->triggeredOnAWDL = true;
-                    }
-
-	                // Browse on mDNSInterface_BLE is used to determine if there are one or more instances of the
-	                // service type discoveryed over BLE.  If this is the first instance, add the psuedo instance defined by BLEinstanceValue.
-	                if (ptr->InterfaceID == mDNSInterface_BLE)
-	                {
-	                    xD2DAddToCache(kD2DSuccess, 0, D2DBLETransport, ptr->key, ptr->keySize, BLEinstanceValue, BLEValueSize);
-	                }
+                    xD2DAddToCache(kD2DSuccess, 0, D2DBLETransport, ptr->key, ptr->keySize, BLEinstanceValue, BLEValueSize);
                 }
-                addToResponseListForRequest(ptr, response);
             }
+            addToResponseListForRequest(ptr, response);
         }
-        else
+    }
+    else
+    {
+        // If a previous response from this peer had matched the browse, remove that response from the
+        // list now.  If this is the last matching response, remove the corresponding key from the AWDL D2D plugin
+        if (removeFromResponseListForRequest(ptr, response) && (ptr->ourResponses == 0))
         {
-            // If a previous response from this peer had matched the browse, remove that response from the
-            // list now.  If this is the last matching response, remove the corresponding key from the AWDL D2D plugin
-            if (removeFromResponseListForRequest(ptr, response) && (ptr->ourResponses == 0))
+            if (ptr->InterfaceID == mDNSInterface_BLE)
             {
-                if (ptr->InterfaceID == mDNSInterface_BLE)
-                {
-                    xD2DRemoveFromCache(kD2DSuccess, 0, D2DBLETransport, ptr->key, ptr->keySize, BLEinstanceValue, BLEValueSize);
-                }
+                xD2DRemoveFromCache(kD2DSuccess, 0, D2DBLETransport, ptr->key, ptr->keySize, BLEinstanceValue, BLEValueSize);
+            }
 
-                if (isAutoTriggerRequest(ptr->InterfaceID, ptr->flags))
-                {
-                    LogInfo("findMatchingBrowse: Last BLE response, disabling browse for %##s on AWDL", ptr->name.c);
-                    internal_stop_browsing_for_service(ptr->InterfaceID, & ptr->name, ptr->type, ptr->flags);
-                    ptr->triggeredOnAWDL = false;
-                }
+            if (isAutoTriggerRequest(ptr->InterfaceID, ptr->flags))
+            {
+                LogInfo("findMatchingBrowse: Last BLE response, disabling browse for %##s on AWDL", ptr->name.c);
+                internal_stop_browsing_for_service(ptr->InterfaceID, & ptr->name, ptr->type, ptr->flags);
+                ptr->triggeredOnAWDL = false;
             }
         }
     }
 }
 
-// Find each local registration that matches the service browse hash BLE response Bloom filter.
+// Find each local browse that matches the registered service hash in the BLE response.
 // Called on the CFRunLoop thread while handling a callback from CoreBluetooth.
 // Caller should hold  KQueueLock().
-mDNSlocal void findMatchingRegistration(responseList_t *response)
+mDNSlocal void findMatchingBrowse(responseList_t *response)
 {
-    requestList_t   *ptr;
-    bool            matchingPeer;
+    serviceHashGroup_t  *group;
+    requestList_t       *ptr, *next;
 
-    ptr = BLERegistrationListHead;
-    for ( ; ptr; ptr = ptr->next)
+    for (group = BLEBrowseGroups; group; group = group->next)
     {
-        // See if we potentially match a corresponding browse in the beacon,
-        // thus, compare using the "browseHash" of our registration.
-        if ((ptr->browseHash & response->peerBloomFilter) == ptr->browseHash)
+        // See if we potentially match a corresponding registration in the beacon,
+        // thus, compare using the "registeredHash" shared by the browses in this group.
+        bool matched = ((group->hash & response->peerBloomFilter) == group->hash);
+
+        // No browse in this group has the response on its list, so there is nothing to remove either.
+        if (!matched && !group->respondingCount)
+            continue;
+
+        for (ptr = group->members; ptr; ptr = next)
         {
-            LogInfo("findMatchingRegistration: Incoming browse matched registration for: %##s", ptr->name.c);
+            next = ptr->groupNext;
+            updateBrowseForResponse(ptr, response, matched);
+        }
+    }
+}
 
-            if (inResponseListForRequest(ptr, response))
-            {
-                LogInfo("findMatchingRegistration: Already on response list for registration: %##s", ptr->name.c);
+// Update one registration for a peer response; "matched" is whether the response's Bloom filter
+// contains the browseHash of the registration's group.
+mDNSlocal void updateRegistrationForResponse(requestList_t *ptr, responseList_t *response, bool matched)
+{
+    if (matched)
+    {
+        LogInfo("findMatchingRegistration: Incoming browse matched registration for: %##s", ptr->name.c);
 
-                continue;
-            }
-            else
-            {
-                LogInfo("findMatchingRegistration: Adding to response list for registration: %##s", ptr->name.c);
+        if (inResponseListForRequest(ptr, response))
+        {
+            LogInfo("findMatchingRegistration: Already on response list for registration: %##s", ptr->name.c);
+        }
+        else
+        {
+            LogInfo("findMatchingRegistration: Adding to response list for registration: %##s", ptr->name.c);
 
-                // Also pass the registration to the AWDL D2D plugin if this is the first matching peer browse for
-                // an auto triggered local registration.
-                if ((ptr->ourResponses == 0) && isAutoTriggerRequest(ptr->InterfaceID, ptr->flags))
+            // Also pass the registration to the AWDL D2D plugin if this is the first matching peer browse for
+            // an auto triggered local registration.
+            if ((ptr->ourResponses == 0) && isAutoTriggerRequest(ptr->InterfaceID, ptr->flags))
+            {
+                LogInfo("findMatchingRegistration: First BLE response, triggering registration for %##s on AWDL", ptr->name.c);
+                if (ptr->resourceRecord == 0)
                 {
-                    LogInfo("findMatchingRegistration: First BLE response, triggering registration for %##s on AWDL", ptr->name.c);
-                    if (ptr->resourceRecord == 0)
-                    {
-                        LogInfo("findMatchingRegistration: resourceRecord pointer is NULL ??");
-                        continue;
-                    }
-
-                    internal_start_advertising_service(ptr->resourceRecord, (ptr->flags | kDNSServiceFlagsIncludeAWDL));
-                    // indicate the registration has been applied to the AWDL interface
-                    ptr->triggeredOnAWDL = true;
+                    LogInfo("findMatchingRegistration: resourceRecord pointer is NULL ??");
+                    return;
                 }
 
-                addToResponseListForRequest(ptr, response);
+                internal_start_advertising_service(ptr->resourceRecord, (ptr->flags | kDNSServiceFlagsIncludeAWDL));
+                // indicate the registration has been applied to the AWDL interface
+                ptr->triggeredOnAWDL = true;
             }
+
+            addToResponseListForRequest(ptr, response);
         }
-        else
+    }
+    else
+    {
+        // If a previous response from this peer had matched the browse, remove that response from the
+        // list now.  If this is the last matching response for a local auto triggered registration, 
+        // remove the advertised key/value pairs from the AWDL D2D plugin.
+        if (removeFromResponseListForRequest(ptr, response) && (ptr->ourResponses == 0) && isAutoTriggerRequest(ptr->InterfaceID, ptr->flags))
         {
-            // If a previous response from this peer had matched the browse, remove that response from the
-            // list now.  If this is the last matching response for a local auto triggered registration, 
-            // remove the advertised key/value pairs from the AWDL D2D plugin.
-            if (removeFromResponseListForRequest(ptr, response) && (ptr->ourResponses == 0) && isAutoTriggerRequest(ptr->InterfaceID, ptr->flags))
-            {
-                LogInfo("findMatchingRegistration: Last BLE response, disabling registration for %##s on AWDL", ptr->name.c);
+            LogInfo("findMatchingRegistration: Last BLE response, disabling registration for %##s on AWDL", ptr->name.c);
 
-                // Restore the saved ARType and call into the AWDL D2D plugin to stop the corresponding record advertisements over AWDL.
-                internal_stop_advertising_service(ptr->resourceRecord, (ptr->flags | kDNSServiceFlagsIncludeAWDL));
-                ptr->triggeredOnAWDL = false;
-            }
+            // Restore the saved ARType and call into the AWDL D2D plugin to stop the corresponding record advertisements over AWDL.
+            internal_stop_advertising_service(ptr->resourceRecord, (ptr->flags | kDNSServiceFlagsIncludeAWDL));
+            ptr->triggeredOnAWDL = false;
+        }
+    }
+}
+
+// Find each local registration that matches the service browse hash BLE response Bloom filter.
+// Called on the CFRunLoop thread while handling a callback from CoreBluetooth.
+// Caller should hold  KQueueLock().
+mDNSlocal void findMatchingRegistration(responseList_t *response)
+{
+    serviceHashGroup_t  *group;
+    requestList_t       *ptr, *next;
+    bool                matchingPeer;
+
+    for (group = BLERegistrationGroups; group; group = group->next)
+    {
+        // See if we potentially match a corresponding browse in the beacon,
+        // thus, compare using the "browseHash" shared by the registrations in this group.
+        bool matched = ((group->hash & response->peerBloomFilter) == group->hash);
+
+        if (!matched && !group->respondingCount)
+            continue;
+
+        for (ptr = group->members; ptr; ptr = next)
+        {
+            next = ptr->groupNext;
+            updateRegistrationForResponse(ptr, response, matched);
         }
     }
 
@@ -1027,6 +1191,7 @@ void responseReceived(serviceHash_t peerBloomFilter, mDNSEthAddr * ptrToMAC)
                     ptrToMAC->b[0], ptrToMAC->b[1], ptrToMAC->b[2], ptrToMAC->b[3], ptrToMAC->b[4], ptrToMAC->b[5]);
 
             ptr->peerBloomFilter = peerBloomFilter;
+            BLEResponseFilterUnion |= peerBloomFilter;
             findMatchingBrowse(ptr);
             findMatchingRegistration(ptr);
         }
@@ -1105,6 +1270,7 @@ void start_BLE_browse(mDNSInterfaceID InterfaceID, const domainname *const domai
     memcpy(ptr->key, key, keySize);
     ptr->keySize = keySize;
     ptr->InterfaceID = InterfaceID;
+    addRequestHashes(&BLEBrowseListHead, ptr);
 
     mDNS_Lock(& mDNSStorage);   // Must lock to initialize mDNSStorage.timenow.
     updateBeaconAndScanState();
@@ -1219,6 +1385,7 @@ void start_BLE_advertise(const ResourceRecord *const resourceRecord, const domai
     }
     ptr->resourceRecord = resourceRecord;
     ptr->InterfaceID = resourceRecord->InterfaceID;
+    addRequestHashes(&BLERegistrationListHead, ptr);
 
     mDNS_Lock(& mDNSStorage);   // Must lock to initialize mDNSStorage.timenow.
     updateBeaconAndScanState();
@@ -1477,10 +1644,57 @@ mDNSlocal void BLE_responseListTests(void)
     }
 }
 
+mDNSlocal void BLE_beaconHashTests(void)
+{
+    const domainname *ptrName = (const domainname*)"\x6" "_test9" "\x4" "_tcp" "\x5" "local";
+    const domainname *srvName = (const domainname*)"\x4" "inst" "\x6" "_test9" "\x4" "_tcp" "\x5" "local";
+    requestList_t   * ptr1;
+    requestList_t   * ptr2;
+
+    printf("BLE_beaconHashTests() entry:\n");
+
+    // Two browses for the same service type share a group, and the beacon bits stay set until the last one goes.
+    ptr1 = addToRequestList(&BLEBrowseListHead, ptrName, kDNSServiceType_PTR, 0);
+    ptr1->browseHash = 0x3;
+    ptr1->registeredHash = 0x30;
+    addRequestHashes(&BLEBrowseListHead, ptr1);
+
+    ptr2 = addToRequestList(&BLEBrowseListHead, srvName, kDNSServiceType_SRV, 0);
+    ptr2->browseHash = 0x6;
+    ptr2->registeredHash = 0x30;
+    addRequestHashes(&BLEBrowseListHead, ptr2);
+
+    if (BLEBeaconBloomFilter != 0x7)
+    {
+        printf("BLEBeaconBloomFilter = 0x%lx, should be 0x7\n", BLEBeaconBloomFilter);
+        FAILED;
+    }
+    if (!BLEBrowseGroups || BLEBrowseGroups->next || BLEBrowseGroups->hash != 0x30)
+    {
+        printf("both browses should be in a single group for hash 0x30\n");
+        FAILED;
+    }
+
+    removeFromRequestList(&BLEBrowseListHead, ptrName, kDNSServiceType_PTR);
+    if (BLEBeaconBloomFilter != 0x6)
+    {
+        printf("BLEBeaconBloomFilter = 0x%lx after first removal, should be 0x6\n", BLEBeaconBloomFilter);
+        FAILED;
+    }
+
+    removeFromRequestList(&BLEBrowseListHead, srvName, kDNSServiceType_SRV);
+    if (BLEBeaconBloomFilter || BLEBrowseGroups)
+    {
+        printf("beacon Bloom filter and groups should be empty after all hashed browses removed\n");
+        FAILED;
+    }
+}
+
 void BLE_unitTest(void)
 {
     BLE_requestListTests();
     BLE_responseListTests();
+    BLE_beaconHashTests();
     printf("All BLE.c unit tests PASSED.\n");
 }
 
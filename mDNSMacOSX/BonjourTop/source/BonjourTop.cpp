@@ -11,6 +11,8 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
+#include <signal.h>
 #include <netinet/in.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -26,6 +28,10 @@
 #include <sys/sysctl.h>
 #include <mach/mach.h>
 
+#include <thread>
+#include <vector>
+#include <algorithm>
+
 #define SERVICE_IPV4    0
 #define SERVICE_IPV6    1
 #define APP_IPV4        2
@@ -175,7 +181,6 @@ char Name2DeviceOS[][50] = {
     ""
 };
 
-BJ_UINT64 Hash(const char* pStr);
 BJ_UINT64 Hash2(char* pStr);
 
 
@@ -211,10 +216,33 @@ CBonjourTop::CBonjourTop()
     m_nFrameCount = 0;
     m_nTotalBytes = 0;
 
+    m_pFrame = &m_Frame;
+    m_nParseThreads = 0;
+    m_pRecordWorkers = NULL;
+
+    m_RecordTables.m_pPtrCache[SERVICE_IPV4] = &m_ServicePtrCache;
+    m_RecordTables.m_pPtrCache[SERVICE_IPV6] = &m_ServicePtrCacheIPv6;
+    m_RecordTables.m_pPtrCache[APP_IPV4] = &m_ApplPtrCache;
+    m_RecordTables.m_pPtrCache[APP_IPV6] = &m_ApplPtrCacheIPv6;
+    m_RecordTables.m_pBreakdown[SERVICE_IPV4][0] = &m_ServiceBreakdownIPv4iOS;
+    m_RecordTables.m_pBreakdown[SERVICE_IPV4][1] = &m_ServiceBreakdownIPv4OSX;
+    m_RecordTables.m_pBreakdown[SERVICE_IPV6][0] = &m_ServiceBreakdownIPv6iOS;
+    m_RecordTables.m_pBreakdown[SERVICE_IPV6][1] = &m_ServiceBreakdownIPv6OSX;
+    m_RecordTables.m_pBreakdown[APP_IPV4][0] = &m_AppBreakdownIPv4iOS;
+    m_RecordTables.m_pBreakdown[APP_IPV4][1] = &m_AppBreakdownIPv4OSX;
+    m_RecordTables.m_pBreakdown[APP_IPV6][0] = &m_AppBreakdownIPv6iOS;
+    m_RecordTables.m_pBreakdown[APP_IPV6][1] = &m_AppBreakdownIPv6OSX;
+
     m_StartTime = m_EndTime = time(NULL);
 
     m_SnapshotSeconds = 0;
 
+    m_StreamSeconds = 0;
+    m_pStreamTarget = "-";
+    m_hStream = NULL;
+    m_nStreamStart = 0;
+    m_nStreamNow = 0;
+
     m_MinAnswerCountForTruncatedFrames = 0;
     m_AvgAnswerCountForTruncatedFrames = 0;
     m_MaxAnswerCountForTruncatedFrames = 0;
@@ -249,6 +277,13 @@ static int CbClearDataDevice(const void* pNode, const void*)
     return 0;
 }
 
+static void ClearBreakdown(map<BJString, CStringShortTree*>& Breakdown)
+{
+    for (map<BJString, CStringShortTree*>::iterator it = Breakdown.begin(); it != Breakdown.end(); ++it)
+        delete it->second;
+    Breakdown.clear();
+}
+
 void CBonjourTop::Reset()
 {
     m_nFrameCount = 0;
@@ -267,15 +302,18 @@ void CBonjourTop::Reset()
     m_ApplPtrCacheIPv6.ClearAll();
 
     // Clear all data in the map
-    m_AppBreakdownIPv4OSX.clear();
-    m_AppBreakdownIPv4iOS.clear();
-    m_AppBreakdownIPv6OSX.clear();
-    m_AppBreakdownIPv6iOS.clear();
+    ClearBreakdown(m_AppBreakdownIPv4OSX);
+    ClearBreakdown(m_AppBreakdownIPv4iOS);
+    ClearBreakdown(m_AppBreakdownIPv6OSX);
+    ClearBreakdown(m_AppBreakdownIPv6iOS);
+
+    ClearBreakdown(m_ServiceBreakdownIPv4OSX);
+    ClearBreakdown(m_ServiceBreakdownIPv4iOS);
+    ClearBreakdown(m_ServiceBreakdownIPv6OSX);
+    ClearBreakdown(m_ServiceBreakdownIPv6iOS);
 
-    m_ServiceBreakdownIPv4OSX.clear();
-    m_ServiceBreakdownIPv4iOS.clear();
-    m_ServiceBreakdownIPv6OSX.clear();
-    m_ServiceBreakdownIPv6iOS.clear();
+    // nothing refers to the names once the caches are gone
+    m_NameTable.ClearAll();
 
     // Clear Socket Status
     for (int i = 0; i < NUM_SOCKET_STATUS; i++)
@@ -305,33 +343,77 @@ void CBonjourTop::SetIPAddr(const char* pStr)
 
 }
 
-void CBonjourTop::UpdateRecord(CStringTree&  Cache,CDNSRecord* pDNSRecord,BJString& RecordName,BJString& ServiceName,BJ_UINT32 nBytes,bool bGoodbye)
+// Wake (QU) frames are counted at most once a second per record.
+// Returns true when this frame counts.
+static bool CountWakeFrame(BJ_UINT64& nLastWakeFrameIndex,BJ_UINT64& lastQUFrameTime,BJ_UINT64 nFrameIndex,BJ_UINT64 nFrameTime)
+{
+    bool bCounted = false;
+
+    if (nLastWakeFrameIndex != nFrameIndex)
+    {
+        nLastWakeFrameIndex = nFrameIndex;
+        if (lastQUFrameTime +1000000ll < nFrameTime || lastQUFrameTime == 0) // last qu frame has been over 1 sec
+            bCounted = true;
+        lastQUFrameTime = nFrameTime;
+    }
+    return bCounted;
+}
+
+static void GetShortRecordVersion(BJ_UINT32 tracePlatform, BJ_UINT32 traceVersion, char deviceOS, bool& isOSX, BJ_UINT32& nVersion)
+{
+    isOSX = false;
+    nVersion = 0;
+
+    if (tracePlatform == TRACE_PLATFORM_UNKNOWN) // Pre iOS 7 or Pre OSX 10.9
+    {
+        if (deviceOS == 'i' || deviceOS == 't') // Pre iOS 7
+        {
+            isOSX = false;
+        }
+        else if (deviceOS == 'X') // Pre OSX 10.9
+        {
+            isOSX = true;
+        }
+    }
+    else if ((tracePlatform == TRACE_PLATFORM_OSX) || (tracePlatform == DISCOVERYD_TRACE_PLATFORM_OSX)) // >= OSX 10.9
+    {
+        isOSX = true;
+        nVersion = traceVersion;
+    }
+    else if ((tracePlatform == TRACE_PLATFORM_iOS) || (tracePlatform == DISCOVERYD_TRACE_PLATFORM_iOS)) // >= iOS 7.x
+    {
+        isOSX = false;
+        nVersion = traceVersion;
+    }
+    else if ((tracePlatform == TRACE_PLATFORM_APPLE_TV) || (tracePlatform == DISCOVERYD_TRACE_PLATFORM_APPLE_TV))
+    {
+        nVersion = traceVersion;
+    }
+}
+
+static bool ApplyPtrRecordUpdate(CRecordTables& Tables,const CRecordUpdate& Update,BJIPAddr* pSourceIPAddress)
 {
-    BJ_UINT64 nHashValue = 0;
-    char deviceOS = '?';
+    BJ_UINT64 nNameID = Update.m_nNameID;
+    BJ_UINT64 nFrameIndex = Update.m_nFrameIndex;
+    char deviceOS = Update.m_deviceOS;
+    CStringTree* pCache = Tables.m_pPtrCache[Update.m_nCacheType];
 
-    nHashValue = Hash(RecordName.GetBuffer());
-    CStringNode* pRecord = Cache.Find(&nHashValue);
+    CStringNode* pRecord = pCache->Find(&nNameID);
     if (pRecord == NULL)
     {
-        pRecord = (CStringNode*) Cache.FindwithAddRecord(&nHashValue);
-        strlcpy(pRecord->m_Value, RecordName.GetBuffer(), sizeof(pRecord->m_Value));
+        pRecord = (CStringNode*) pCache->FindwithAddRecord(&nNameID);
+        strlcpy(pRecord->m_Value, Update.m_pName, sizeof(pRecord->m_Value));
+        pRecord->m_nFirstUpdate = Update.m_nSequence;
     }
 
     if (pRecord == NULL)
-        return;
-    CDeviceNode dummyDevice;
-    CDeviceNode *device;
-    CIPDeviceNode *pipNode = m_IPtoNameMap.Find(&m_Frame.m_SourceIPAddress);
+        return false;
 
-    device = (pipNode)? pipNode->pDeviceNode : &dummyDevice;
-    pRecord->m_nBytes += 10 + nBytes;
-    deviceOS = device->GetDeviceOS();
-    device->frameTotal.Increment(m_nFrameCount);
+    pRecord->m_nBytes += 10 + Update.m_nBytes;
 
-    if (pRecord->m_nLastFrameIndex != m_nFrameCount)
+    if (pRecord->m_nLastFrameIndex != nFrameIndex)
     {
-        pRecord->m_nLastFrameIndex = m_nFrameCount;
+        pRecord->m_nLastFrameIndex = nFrameIndex;
 
         pRecord->m_nFrames++;
         if (deviceOS == 't' || deviceOS == 'i')
@@ -345,19 +427,17 @@ void CBonjourTop::UpdateRecord(CStringTree&  Cache,CDNSRecord* pDNSRecord,BJStri
     }
 
     // Update Total Device Count
-    if (pRecord->m_DeviceTotalTree.Find(&m_Frame.m_SourceIPAddress) == NULL)
+    if (pRecord->m_DeviceTotalTree.Find(pSourceIPAddress) == NULL)
     {
         pRecord->m_nDeviceTotalCount++;
-        pRecord->m_DeviceTotalTree.FindwithAddRecord(&m_Frame.m_SourceIPAddress);
+        pRecord->m_DeviceTotalTree.AddRecord(pSourceIPAddress);
     }
 
-    if (m_Frame.IsQueryFrame())
+    if (Update.m_bQuery)
     {
-        GetOSTypeFromQuery(pDNSRecord, ServiceName);
-        device->questionFrame.Increment(m_nFrameCount);
-        if (pRecord->m_nLastQueryFrameIndex != m_nFrameCount)
+        if (pRecord->m_nLastQueryFrameIndex != nFrameIndex)
         {
-            pRecord->m_nLastQueryFrameIndex = m_nFrameCount;
+            pRecord->m_nLastQueryFrameIndex = nFrameIndex;
 
             pRecord->m_nQuestionFrames++;
 
@@ -370,21 +450,18 @@ void CBonjourTop::UpdateRecord(CStringTree&  Cache,CDNSRecord* pDNSRecord,BJStri
                 pRecord->m_nQuestionFramesOSX++;
             }
 
-            if (pRecord->m_DeviceAskingTree.Find(&m_Frame.m_SourceIPAddress) == NULL)
+            if (pRecord->m_DeviceAskingTree.Find(pSourceIPAddress) == NULL)
             {
                 pRecord->m_nDeviceAskingCount++;
-                pRecord->m_DeviceAskingTree.FindwithAddRecord(&m_Frame.m_SourceIPAddress);
+                pRecord->m_DeviceAskingTree.AddRecord(pSourceIPAddress);
             }
         }
     }
     else
     {
-        GetOSTypeFromRegistration(pDNSRecord,ServiceName);
-
-        device->answerFrame.Increment(m_nFrameCount);
-        if (pRecord->m_nLastRespondsFrameIndex != m_nFrameCount)
+        if (pRecord->m_nLastRespondsFrameIndex != nFrameIndex)
         {
-            pRecord->m_nLastRespondsFrameIndex = m_nFrameCount;
+            pRecord->m_nLastRespondsFrameIndex = nFrameIndex;
 
             pRecord->m_nAnswerFrames++;
             if (deviceOS == 't' || deviceOS == 'i')
@@ -396,238 +473,363 @@ void CBonjourTop::UpdateRecord(CStringTree&  Cache,CDNSRecord* pDNSRecord,BJStri
                 pRecord->m_nAnswerFramesOSX++;
             }
 
-            if (bGoodbye)
+            if (Update.m_bGoodbye)
             {
                 pRecord->m_nGoodbyeFrames++;
             }
 
-            if (pRecord->m_DeviceAnsweringTree.Find(&m_Frame.m_SourceIPAddress) == NULL)
+            if (pRecord->m_DeviceAnsweringTree.Find(pSourceIPAddress) == NULL)
             {
                 pRecord->m_nDeviceAnsweringCount++;
-                pRecord->m_DeviceAnsweringTree.FindwithAddRecord(&m_Frame.m_SourceIPAddress);
+                pRecord->m_DeviceAnsweringTree.AddRecord(pSourceIPAddress);
             }
         }
     }
 
-    if (m_Frame.IsWakeFrame())
+    if (Update.m_bWake && CountWakeFrame(pRecord->m_nLastWakeFrameIndex, pRecord->m_lastQUFrameTime, nFrameIndex, Update.m_nFrameTime))
     {
-        if (pRecord->m_nLastWakeFrameIndex != m_nFrameCount)
-        {
-            pRecord->m_nLastWakeFrameIndex = m_nFrameCount;
-            if (pRecord->m_lastQUFrameTime +1000000ll < m_Frame.GetTime() || pRecord->m_lastQUFrameTime == 0) // last qu frame has been over 1 sec
-            {
-                pRecord->m_nWakeFrames++;
-                pRecord->m_lastQUFrameTime = m_Frame.GetTime();
-                device->QUFrame.Increment(m_nFrameCount);
-            }
-            pRecord->m_lastQUFrameTime = m_Frame.GetTime();
-        }
+        pRecord->m_nWakeFrames++;
+        return true;
     }
-
-
+    return false;
 }
 
-void CBonjourTop::UpdateShortRecordHelper(BJ_UINT32 cacheType, BJ_UINT32 tracePlatform, BJ_UINT32 traceVersion, char deviceOS, CDNSRecord* pDNSRecord,BJString& RecordName,BJString& ServiceName,BJ_UINT32 nBytes,bool bGoodbye)
+static bool ApplyShortRecordUpdate(CRecordTables& Tables,const CRecordUpdate& Update,BJIPAddr* pSourceIPAddress)
 {
-    bool isOSX = false;
+    bool isOSX;
+    BJ_UINT32 nVersion;
     BJString versionNumber = "mDNSResponder-";
     const int version_max_length = 11; // largest number is 0xffffffff = 4294967295
     char versionChar[version_max_length];
 
-    CStringShortTree *cache;
+    BJ_UINT64 nNameID = Update.m_nNameID;
+    BJ_UINT64 nFrameIndex = Update.m_nFrameIndex;
+    CStringShortTree *Cache;
     map<BJString, CStringShortTree*>* myMap;
 
-    if ((tracePlatform | 0x80) == tracePlatform)
+    if ((Update.m_TracePlatform | 0x80) == Update.m_TracePlatform)
     {
         versionNumber = "Discoveryd-";
     }
 
-    snprintf(versionChar, sizeof(versionChar), "%u", 0); // Set versionChar to "0" by default
-    if (tracePlatform == TRACE_PLATFORM_UNKNOWN) // Pre iOS 7 or Pre OSX 10.9
-    {
-        if (deviceOS == 'i' || deviceOS == 't') // Pre iOS 7
-        {
-            isOSX = false;
-        }
-        else if (deviceOS == 'X') // Pre OSX 10.9
-        {
-            isOSX = true;
-        }
-    }
-    else if ((tracePlatform == TRACE_PLATFORM_OSX) || (tracePlatform == DISCOVERYD_TRACE_PLATFORM_OSX)) // >= OSX 10.9
-    {
-        isOSX = true;
-        snprintf(versionChar, sizeof(versionChar), "%u", traceVersion);
-    }
-    else if ((tracePlatform == TRACE_PLATFORM_iOS) || (tracePlatform == DISCOVERYD_TRACE_PLATFORM_iOS)) // >= iOS 7.x
-    {
-        isOSX = false;
-        snprintf(versionChar, sizeof(versionChar), "%u", traceVersion);
-    }
-    else if ((tracePlatform == TRACE_PLATFORM_APPLE_TV) || (tracePlatform == DISCOVERYD_TRACE_PLATFORM_APPLE_TV))
-    {
-        snprintf(versionChar, sizeof(versionChar), "%u", traceVersion);
-    }
-
+    GetShortRecordVersion(Update.m_TracePlatform, Update.m_TraceVersion, Update.m_deviceOS, isOSX, nVersion);
+    snprintf(versionChar, sizeof(versionChar), "%u", nVersion);
     versionNumber += (const char*)versionChar;
 
-    switch (cacheType) {
-        case SERVICE_IPV4:
-            if (isOSX)
-            {
-                myMap = &m_ServiceBreakdownIPv4OSX;
-            }
-            else
-            {
-                myMap = &m_ServiceBreakdownIPv4iOS;
-            }
-            break;
-        case SERVICE_IPV6:
-            if (isOSX)
-            {
-                myMap = &m_ServiceBreakdownIPv6OSX;
-            }
-            else
-            {
-                myMap = &m_ServiceBreakdownIPv6iOS;
-            }
-            break;
-        case APP_IPV4:
-            if (isOSX)
-            {
-                myMap = &m_AppBreakdownIPv4OSX;
-            }
-            else
-            {
-                myMap = &m_AppBreakdownIPv4iOS;
-            }
-            break;
-        case APP_IPV6:
-            if (isOSX)
-            {
-                myMap = &m_AppBreakdownIPv6OSX;
-            }
-            else
-            {
-                myMap = &m_AppBreakdownIPv6iOS;
-            }
-            break;
-
-        default:
-            return;
-            break;
-    }
-
-    if (myMap->find(versionNumber) == myMap->end()) // Version number not found. Create new record
-    {
-        myMap->insert(std::pair<BJString, CStringShortTree*>(versionNumber, new CStringShortTree()));
-    }
-    cache = (*myMap)[versionNumber];
-    UpdateShortRecord(cache, pDNSRecord, RecordName, ServiceName, nBytes, bGoodbye);
-}
+    myMap = Tables.m_pBreakdown[Update.m_nCacheType][isOSX ? 1 : 0];
 
-void CBonjourTop::UpdateShortRecord(CStringShortTree*  Cache,CDNSRecord* pDNSRecord,BJString& RecordName,BJString& ServiceName,BJ_UINT32 nBytes,bool bGoodbye)
-{
-    if (Cache == NULL)
+    map<BJString, CStringShortTree*>::iterator it = myMap->find(versionNumber);
+    if (it == myMap->end()) // Version number not found. Create new record
     {
-        return;
+        it = myMap->insert(std::pair<BJString, CStringShortTree*>(versionNumber, new CStringShortTree())).first;
     }
+    Cache = it->second;
 
-    BJ_UINT64 nHashValue = 0;
-
-    nHashValue = Hash(RecordName.GetBuffer());
-    CStringShortNode* pRecord = Cache->Find(&nHashValue);
+    CStringShortNode* pRecord = Cache->Find(&nNameID);
     if (pRecord == NULL)
     {
-        pRecord = (CStringShortNode*) Cache->FindwithAddRecord(&nHashValue);
+        pRecord = (CStringShortNode*) Cache->FindwithAddRecord(&nNameID);
         if (pRecord)
-            strlcpy(pRecord->m_Value, RecordName.GetBuffer(), sizeof(pRecord->m_Value));
+        {
+            strlcpy(pRecord->m_Value, Update.m_pName, sizeof(pRecord->m_Value));
+            pRecord->m_nFirstUpdate = Update.m_nSequence;
+        }
     }
 
     if (pRecord == NULL)
     {
-        return;
+        return false;
     }
 
-    CDeviceNode dummyDevice;
-    CDeviceNode *device;
-    CIPDeviceNode *pipNode = m_IPtoNameMap.Find(&m_Frame.m_SourceIPAddress);
+    pRecord->m_nBytes += 10 + Update.m_nBytes;
 
-    device = (pipNode)? pipNode->pDeviceNode : &dummyDevice;
-    pRecord->m_nBytes += 10 + nBytes;
-    device->frameTotal.Increment(m_nFrameCount);
-
-    if (pRecord->m_nLastFrameIndex != m_nFrameCount)
+    if (pRecord->m_nLastFrameIndex != nFrameIndex)
     {
-        pRecord->m_nLastFrameIndex = m_nFrameCount;
+        pRecord->m_nLastFrameIndex = nFrameIndex;
         pRecord->m_nFrames++;
     }
 
     // Update Total Device Count
-    if (pRecord->m_DeviceTotalTree.Find(&m_Frame.m_SourceIPAddress) == NULL)
+    if (pRecord->m_DeviceTotalTree.Find(pSourceIPAddress) == NULL)
     {
         pRecord->m_nDeviceTotalCount++;
-        pRecord->m_DeviceTotalTree.FindwithAddRecord(&m_Frame.m_SourceIPAddress);
+        pRecord->m_DeviceTotalTree.AddRecord(pSourceIPAddress);
     }
 
-    if (m_Frame.IsQueryFrame())
+    if (Update.m_bQuery)
     {
-        GetOSTypeFromQuery(pDNSRecord, ServiceName);
-        device->questionFrame.Increment(m_nFrameCount);
-        if (pRecord->m_nLastQueryFrameIndex != m_nFrameCount)
+        if (pRecord->m_nLastQueryFrameIndex != nFrameIndex)
         {
-            pRecord->m_nLastQueryFrameIndex = m_nFrameCount;
+            pRecord->m_nLastQueryFrameIndex = nFrameIndex;
 
             pRecord->m_nQuestionFrames++;
 
-            if (pRecord->m_DeviceAskingTree.Find(&m_Frame.m_SourceIPAddress) == NULL)
+            if (pRecord->m_DeviceAskingTree.Find(pSourceIPAddress) == NULL)
             {
                 pRecord->m_nDeviceAskingCount++;
-                pRecord->m_DeviceAskingTree.FindwithAddRecord(&m_Frame.m_SourceIPAddress);
+                pRecord->m_DeviceAskingTree.AddRecord(pSourceIPAddress);
             }
 
         }
     }
     else
     {
-        GetOSTypeFromRegistration(pDNSRecord,ServiceName);
-
-        device->answerFrame.Increment(m_nFrameCount);
-        if (pRecord->m_nLastRespondsFrameIndex != m_nFrameCount)
+        if (pRecord->m_nLastRespondsFrameIndex != nFrameIndex)
         {
-            pRecord->m_nLastRespondsFrameIndex = m_nFrameCount;
+            pRecord->m_nLastRespondsFrameIndex = nFrameIndex;
 
             pRecord->m_nAnswerFrames++;
 
-            if (bGoodbye)
+            if (Update.m_bGoodbye)
             {
                 pRecord->m_nGoodbyeFrames++;
             }
 
-            if (pRecord->m_DeviceAnsweringTree.Find(&m_Frame.m_SourceIPAddress) == NULL)
+            if (pRecord->m_DeviceAnsweringTree.Find(pSourceIPAddress) == NULL)
             {
                 pRecord->m_nDeviceAnsweringCount++;
-                pRecord->m_DeviceAnsweringTree.FindwithAddRecord(&m_Frame.m_SourceIPAddress);
+                pRecord->m_DeviceAnsweringTree.AddRecord(pSourceIPAddress);
             }
         }
     }
 
-    if (m_Frame.IsWakeFrame())
+    if (Update.m_bWake && CountWakeFrame(pRecord->m_nLastWakeFrameIndex, pRecord->m_lastQUFrameTime, nFrameIndex, Update.m_nFrameTime))
+    {
+        pRecord->m_nWakeFrames++;
+        return true;
+    }
+    return false;
+}
+
+static bool ApplyRecordUpdate(CRecordTables& Tables,const CRecordUpdate& Update,BJIPAddr* pSourceIPAddress)
+{
+    if (Update.m_bShort)
+        return ApplyShortRecordUpdate(Tables, Update, pSourceIPAddress);
+    else
+        return ApplyPtrRecordUpdate(Tables, Update, pSourceIPAddress);
+}
+
+/////////////
+// Record updates applied by worker threads
+//
+// Every worker owns a private set of record tables and gets all updates for
+// the keys (interned record name IDs) assigned to it, in capture order. A key is
+// only ever touched by one worker, so each node ends up exactly as the serial
+// loop would leave it and the partial tables are merged by moving the nodes.
+// The one value flowing back is whether a wake frame counted (QUFrame of the
+// device), which the posting thread tracks itself in m_WakeState.
+
+class CWakeState
+{
+public:
+    CWakeState() {m_nLastWakeFrameIndex = 0; m_lastQUFrameTime = 0;};
+    BJ_UINT64 m_nLastWakeFrameIndex;
+    BJ_UINT64 m_lastQUFrameTime;
+};
+
+class CRecordWorker
+{
+public:
+    CRecordWorker();
+    ~CRecordWorker();
+
+    CStringTree m_PtrCache[4];
+    map<BJString, CStringShortTree*> m_Breakdown[4][2];
+    CRecordTables m_Tables;
+
+    vector<CRecordUpdate> m_Updates[2];
+};
+
+CRecordWorker::CRecordWorker()
+{
+    for (int i = 0; i < 4; i++)
+    {
+        m_Tables.m_pPtrCache[i] = &m_PtrCache[i];
+        m_Tables.m_pBreakdown[i][0] = &m_Breakdown[i][0];
+        m_Tables.m_pBreakdown[i][1] = &m_Breakdown[i][1];
+    }
+}
+
+CRecordWorker::~CRecordWorker()
+{
+    // trees not taken over by MergeRecordTables
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 2; j++)
+            for (map<BJString, CStringShortTree*>::iterator it = m_Breakdown[i][j].begin(); it != m_Breakdown[i][j].end(); ++it)
+                delete it->second;
+}
+
+class CRecordWorkers
+{
+public:
+    CRecordWorkers(int nThreads);
+    ~CRecordWorkers() { delete [] m_pWorkers;};
+
+    bool Post(CRecordUpdate& Update,BJIPAddr& SourceIPAddress);
+    void SwapBatch();
+    void ApplyBatch(int nWorker);
+
+    int m_nThreads;
+    CRecordWorker* m_pWorkers;
+
+private:
+    int m_nFill;                // batch being posted to, the other one belongs to the workers
+    vector<BJIPAddr> m_SourceIPAddress[2];
+    BJ_UINT64 m_nSourceFrameIndex;
+    BJ_UINT64 m_nPosted;
+    map<pair<BJ_UINT64, BJ_UINT64>, CWakeState> m_WakeState;
+};
+
+CRecordWorkers::CRecordWorkers(int nThreads)
+{
+    m_nThreads = nThreads;
+    m_pWorkers = new CRecordWorker[nThreads];
+    m_nFill = 0;
+    m_nSourceFrameIndex = 0;
+    m_nPosted = 0;
+}
+
+bool CRecordWorkers::Post(CRecordUpdate& Update,BJIPAddr& SourceIPAddress)
+{
+    vector<BJIPAddr>& Addresses = m_SourceIPAddress[m_nFill];
+    bool bCounted = false;
+
+    Update.m_nSequence = ++m_nPosted;
+
+    // all updates of a frame share its source address
+    if (Addresses.empty() || m_nSourceFrameIndex != Update.m_nFrameIndex)
+    {
+        Addresses.push_back(SourceIPAddress);
+        m_nSourceFrameIndex = Update.m_nFrameIndex;
+    }
+    Update.m_nSourceIPAddress = (BJ_UINT32) Addresses.size() - 1;
+
+    if (Update.m_bWake)
     {
-        if (pRecord->m_nLastWakeFrameIndex != m_nFrameCount)
+        // same table identity ApplyRecordUpdate ends up with
+        BJ_UINT64 nTable = Update.m_nCacheType;
+        if (Update.m_bShort)
         {
-            pRecord->m_nLastWakeFrameIndex = m_nFrameCount;
-            if (pRecord->m_lastQUFrameTime +1000000ll < m_Frame.GetTime() || pRecord->m_lastQUFrameTime == 0) // last qu frame has been over 1 sec
-            {
-                pRecord->m_nWakeFrames++;
-                pRecord->m_lastQUFrameTime = m_Frame.GetTime();
-                device->QUFrame.Increment(m_nFrameCount);
-            }
-            pRecord->m_lastQUFrameTime = m_Frame.GetTime();
+            bool isOSX;
+            BJ_UINT32 nVersion;
+            GetShortRecordVersion(Update.m_TracePlatform, Update.m_TraceVersion, Update.m_deviceOS, isOSX, nVersion);
+            nTable |= 0x04 | (isOSX ? 0x08 : 0) | (((Update.m_TracePlatform | 0x80) == Update.m_TracePlatform) ? 0x10 : 0) | ((BJ_UINT64) nVersion << 32);
         }
+        CWakeState& State = m_WakeState[make_pair(nTable, Update.m_nNameID)];
+        bCounted = CountWakeFrame(State.m_nLastWakeFrameIndex, State.m_lastQUFrameTime, Update.m_nFrameIndex, Update.m_nFrameTime);
+    }
+
+    m_pWorkers[Update.m_nNameID % m_nThreads].m_Updates[m_nFill].push_back(Update);
+
+    return bCounted;
+}
+
+// Hands the posted updates to the workers and starts a new batch.
+// Only called while no worker is running.
+void CRecordWorkers::SwapBatch()
+{
+    m_nFill ^= 1;
+    m_SourceIPAddress[m_nFill].clear();
+    for (int t = 0; t < m_nThreads; t++)
+        m_pWorkers[t].m_Updates[m_nFill].clear();
+}
+
+void CRecordWorkers::ApplyBatch(int nWorker)
+{
+    int nBatch = m_nFill ^ 1;
+    CRecordWorker* pWorker = &m_pWorkers[nWorker];
+    vector<CRecordUpdate>& Updates = pWorker->m_Updates[nBatch];
+
+    for (vector<CRecordUpdate>::iterator it = Updates.begin(); it != Updates.end(); ++it)
+        ApplyRecordUpdate(pWorker->m_Tables, *it, &m_SourceIPAddress[nBatch][it->m_nSourceIPAddress]);
+    Updates.clear();
+}
+
+// Fills in the per frame part of the update and applies it, or queues it for
+// a worker thread when the capture file is parsed in parallel.
+// Returns true when the frame counts as a wake frame for this record.
+bool CBonjourTop::PostRecordUpdate(CRecordUpdate& Update,BJString& RecordName,BJ_UINT32 nBytes,bool bGoodbye)
+{
+    Update.m_nNameID = m_NameTable.Intern(RecordName);
+    Update.m_pName = m_NameTable.GetName(Update.m_nNameID);
+    Update.m_nFrameIndex = m_nFrameCount;
+    Update.m_nFrameTime = m_pFrame->GetTime();
+    Update.m_nBytes = nBytes;
+    Update.m_bQuery = m_pFrame->IsQueryFrame();
+    Update.m_bWake = m_pFrame->IsWakeFrame();
+    Update.m_bGoodbye = bGoodbye;
+    Update.m_nSequence = 0;
+
+    if (m_pRecordWorkers == NULL)
+        return ApplyRecordUpdate(m_RecordTables, Update, &m_pFrame->m_SourceIPAddress);
+
+    return m_pRecordWorkers->Post(Update, m_pFrame->m_SourceIPAddress);
+}
+
+void CBonjourTop::UpdateRecord(BJ_UINT32 cacheType,CDNSRecord* pDNSRecord,BJString& RecordName,BJString& ServiceName,BJ_UINT32 nBytes,bool bGoodbye)
+{
+    CRecordUpdate Update;
+    CDeviceNode dummyDevice;
+    CDeviceNode *device;
+    CIPDeviceNode *pipNode = m_IPtoNameMap.Find(&m_pFrame->m_SourceIPAddress);
+
+    device = (pipNode)? pipNode->pDeviceNode : &dummyDevice;
+    Update.m_deviceOS = device->GetDeviceOS();
+    device->frameTotal.Increment(m_nFrameCount);
+
+    if (m_pFrame->IsQueryFrame())
+    {
+        GetOSTypeFromQuery(pDNSRecord, ServiceName);
+        device->questionFrame.Increment(m_nFrameCount);
+    }
+    else
+    {
+        GetOSTypeFromRegistration(pDNSRecord,ServiceName);
+        device->answerFrame.Increment(m_nFrameCount);
+    }
+
+    Update.m_bShort = false;
+    Update.m_nCacheType = cacheType;
+    Update.m_TracePlatform = TRACE_PLATFORM_UNKNOWN;
+    Update.m_TraceVersion = 0;
+
+    if (PostRecordUpdate(Update, RecordName, nBytes, bGoodbye))
+        device->QUFrame.Increment(m_nFrameCount);
+}
+
+void CBonjourTop::UpdateShortRecordHelper(BJ_UINT32 cacheType, BJ_UINT32 tracePlatform, BJ_UINT32 traceVersion, char deviceOS, CDNSRecord* pDNSRecord,BJString& RecordName,BJString& ServiceName,BJ_UINT32 nBytes,bool bGoodbye)
+{
+    CRecordUpdate Update;
+    CDeviceNode dummyDevice;
+    CDeviceNode *device;
+
+    if (cacheType > APP_IPV6)
+        return;
+
+    CIPDeviceNode *pipNode = m_IPtoNameMap.Find(&m_pFrame->m_SourceIPAddress);
+
+    device = (pipNode)? pipNode->pDeviceNode : &dummyDevice;
+    device->frameTotal.Increment(m_nFrameCount);
+
+    if (m_pFrame->IsQueryFrame())
+    {
+        GetOSTypeFromQuery(pDNSRecord, ServiceName);
+        device->questionFrame.Increment(m_nFrameCount);
+    }
+    else
+    {
+        GetOSTypeFromRegistration(pDNSRecord,ServiceName);
+        device->answerFrame.Increment(m_nFrameCount);
     }
 
+    Update.m_bShort = true;
+    Update.m_nCacheType = cacheType;
+    Update.m_TracePlatform = tracePlatform;
+    Update.m_TraceVersion = traceVersion;
+    Update.m_deviceOS = deviceOS;
 
+    if (PostRecordUpdate(Update, RecordName, nBytes, bGoodbye))
+        device->QUFrame.Increment(m_nFrameCount);
 }
 
 void CBonjourTop::GetOSTypeFromQuery(CDNSRecord *pDNSRecord,BJString& ServiceName)
@@ -637,7 +839,7 @@ void CBonjourTop::GetOSTypeFromQuery(CDNSRecord *pDNSRecord,BJString& ServiceNam
         StringMapNode* pStringNode = m_Service2osBrowseMap.Find(&ServiceName);
         if (pStringNode && *pStringNode->value.GetBuffer() != '?')
         {
-            CIPDeviceNode *ipNode = m_IPtoNameMap.FindwithAddRecord(&m_Frame.m_SourceIPAddress);
+            CIPDeviceNode *ipNode = m_IPtoNameMap.FindwithAddRecord(&m_pFrame->m_SourceIPAddress);
             if (ipNode->pDeviceNode)
             {
                 StringMapNode* pStringNode_temp = m_Service2osBrowseMap.Find(&ServiceName);
@@ -656,7 +858,7 @@ void CBonjourTop::GetOSTypeFromRegistration(CDNSRecord *pDNSRecord,BJString& Ser
     {
         BJString sInstanceName;
         pDNSRecord->GetRdata(sInstanceName,0,99);
-        CDNSRecord* pSRVRecord = m_Frame.FindAdditionRecord(sInstanceName, DNS_TYPE_SRV);
+        CDNSRecord* pSRVRecord = m_pFrame->FindAdditionRecord(sInstanceName, DNS_TYPE_SRV);
         if (pSRVRecord)
         {
             pSRVRecord->GetRdata(sDeviceName,0,1);
@@ -705,34 +907,39 @@ bool CBonjourTop::Name2OSType(BJString name,CDeviceNode* device)
 }
 void CBonjourTop::ProcessFrame(BJ_UINT8* pBuffer,BJ_INT32 nLength,BJ_UINT64 nFrameTime)
 {
-
     m_Frame.ParseDNSFrame(pBuffer, nLength, nFrameTime);
+    ProcessDNSFrame(&m_Frame);
+}
+
+void CBonjourTop::ProcessDNSFrame(CDNSFrame* pFrame)
+{
+    m_pFrame = pFrame;
 
     if (m_Collection.IsValid())
     {
         // setup static collectby
         CollectByPacketCount::nFrameIndex = m_nFrameCount;
-        CollectBySameSubnetDiffSubnet::bSameSubnet = m_Frame.m_SourceIPAddress.IsIPv6()? true: m_IPv4Addr.IsSameSubNet(&m_Frame.m_SourceIPAddress);
-        m_Collection.ProcessFrame(&m_Frame);
+        CollectBySameSubnetDiffSubnet::bSameSubnet = m_pFrame->m_SourceIPAddress.IsIPv6()? true: m_IPv4Addr.IsSameSubNet(&m_pFrame->m_SourceIPAddress);
+        m_Collection.ProcessFrame(m_pFrame);
         return;
     }
 
-    if (m_Frame.IsTruncatedFrame())
+    if (m_pFrame->IsTruncatedFrame())
     {
-        if (m_Frame.GetAnswerCount() > 0)
+        if (m_pFrame->GetAnswerCount() > 0)
         {
             if (m_AvgAnswerCountForTruncatedFrames)
             {
-                m_AvgAnswerCountForTruncatedFrames += m_Frame.GetAnswerCount();
+                m_AvgAnswerCountForTruncatedFrames += m_pFrame->GetAnswerCount();
                 m_AvgAnswerCountForTruncatedFrames /=2;
             }
             else
-                m_AvgAnswerCountForTruncatedFrames += m_Frame.GetAnswerCount();
+                m_AvgAnswerCountForTruncatedFrames += m_pFrame->GetAnswerCount();
 
-            if (m_MinAnswerCountForTruncatedFrames > m_Frame.GetAnswerCount() || m_MinAnswerCountForTruncatedFrames == 0)
-                m_MinAnswerCountForTruncatedFrames = m_Frame.GetAnswerCount();
-            if (m_MaxAnswerCountForTruncatedFrames < m_Frame.GetAnswerCount())
-                m_MaxAnswerCountForTruncatedFrames = m_Frame.GetAnswerCount();
+            if (m_MinAnswerCountForTruncatedFrames > m_pFrame->GetAnswerCount() || m_MinAnswerCountForTruncatedFrames == 0)
+                m_MinAnswerCountForTruncatedFrames = m_pFrame->GetAnswerCount();
+            if (m_MaxAnswerCountForTruncatedFrames < m_pFrame->GetAnswerCount())
+                m_MaxAnswerCountForTruncatedFrames = m_pFrame->GetAnswerCount();
 
         }
     }
@@ -749,9 +956,9 @@ void CBonjourTop::ProcessFrame(BJ_UINT8* pBuffer,BJ_INT32 nLength,BJ_UINT64 nFra
     }
     m_MinSnapshot[timeStruct->tm_hour][timeStruct->tm_min].m_nFrameCount++;
 
-    if (m_Frame.GetQuestionCount() == 0 && m_Frame.GetAnswerCount() > 0)
+    if (m_pFrame->GetQuestionCount() == 0 && m_pFrame->GetAnswerCount() > 0)
         m_SocketStatus[0].m_nAnswerOnlyFrames++;
-    else if (m_Frame.GetQuestionCount() > 0 && m_Frame.GetAnswerCount() == 0)
+    else if (m_pFrame->GetQuestionCount() > 0 && m_pFrame->GetAnswerCount() == 0)
         m_SocketStatus[0].m_nQuestionOnlyFrames++;
     else
         m_SocketStatus[0].m_nQandAFrames++;
@@ -761,9 +968,9 @@ void CBonjourTop::ProcessFrame(BJ_UINT8* pBuffer,BJ_INT32 nLength,BJ_UINT64 nFra
     BJString ApplRecordName;
 
     /// first get the name to address
-    for (int dnsItemsIndex =m_Frame.GetQuestionCount(); dnsItemsIndex < m_Frame.GetMaxRecords();dnsItemsIndex++)
+    for (int dnsItemsIndex =m_pFrame->GetQuestionCount(); dnsItemsIndex < m_pFrame->GetMaxRecords();dnsItemsIndex++)
     {
-        CDNSRecord* pDNSRecord = m_Frame.GetDnsRecord(dnsItemsIndex);
+        CDNSRecord* pDNSRecord = m_pFrame->GetDnsRecord(dnsItemsIndex);
         if (pDNSRecord == NULL)
             continue;
 
@@ -840,46 +1047,46 @@ void CBonjourTop::ProcessFrame(BJ_UINT8* pBuffer,BJ_INT32 nLength,BJ_UINT64 nFra
         }
     }
 
-    CIPDeviceNode* pipNode = m_IPtoNameMap.FindwithAddRecord(&m_Frame.m_SourceIPAddress);
+    CIPDeviceNode* pipNode = m_IPtoNameMap.FindwithAddRecord(&m_pFrame->m_SourceIPAddress);
     CDeviceNode* device = pipNode->pDeviceNode;
     if (device == NULL)
     {
         // find the device by mac address
-        CMACAddrDeviceNode *macDevice = m_MACtoDevice.FindwithAddRecord(&m_Frame.m_SourceMACAddress);
+        CMACAddrDeviceNode *macDevice = m_MACtoDevice.FindwithAddRecord(&m_pFrame->m_SourceMACAddress);
         device = macDevice->device;
         if (device == NULL)
         {
             // auto create a device record
-            BJString name = m_Frame.m_SourceIPAddress.GetString();
+            BJString name = m_pFrame->m_SourceIPAddress.GetString();
             device = m_DeviceMap.FindwithAddRecord(&name);
             device->bIPName = true;
             macDevice->device = device;
         }
 
-        if (m_Frame.m_SourceIPAddress.IsIPv4())
-            device->ipAddressv4 = m_Frame.m_SourceIPAddress;
+        if (m_pFrame->m_SourceIPAddress.IsIPv4())
+            device->ipAddressv4 = m_pFrame->m_SourceIPAddress;
         else
-            device->ipAddressv6 = m_Frame.m_SourceIPAddress;
+            device->ipAddressv6 = m_pFrame->m_SourceIPAddress;
         if (device->macAddress.IsEmpty())
-            device->macAddress = m_Frame.m_SourceMACAddress;
+            device->macAddress = m_pFrame->m_SourceMACAddress;
 
         pipNode->pDeviceNode = device;
     }
     device->bHasFrames = true;
     // update mac address
-    if (m_Frame.IsQueryFrame() ||  device->GetDeviceOS() == 'i' ) // iOS don't use BSP so we can use SourceIP
+    if (m_pFrame->IsQueryFrame() ||  device->GetDeviceOS() == 'i' ) // iOS don't use BSP so we can use SourceIP
     {
-        if (m_Frame.m_SourceIPAddress.IsIPv4())
-            device->ipAddressv4 = m_Frame.m_SourceIPAddress;
-        if (m_Frame.m_SourceIPAddress.IsIPv6())
-            device->ipAddressv6 =m_Frame.m_SourceIPAddress;
-        device->macAddress = m_Frame.m_SourceMACAddress;
+        if (m_pFrame->m_SourceIPAddress.IsIPv4())
+            device->ipAddressv4 = m_pFrame->m_SourceIPAddress;
+        if (m_pFrame->m_SourceIPAddress.IsIPv6())
+            device->ipAddressv6 =m_pFrame->m_SourceIPAddress;
+        device->macAddress = m_pFrame->m_SourceMACAddress;
     }
 
     BJ_UINT8 traceplatform = TRACE_PLATFORM_UNKNOWN;
     BJ_UINT32 traceversion = 0;
     BJMACAddr traceMac;
-    if (device /*&& device->GetDeviceOS() == '?' */&& m_Frame.GetTracingInfo(traceplatform, traceversion, traceMac))
+    if (device /*&& device->GetDeviceOS() == '?' */&& m_pFrame->GetTracingInfo(traceplatform, traceversion, traceMac))
     {
    //     printf("Tracing Data found platform=%d traceversion=%d\n",traceplatform,traceversion);
         char platformMap[]= "?Xitw";
@@ -894,14 +1101,14 @@ void CBonjourTop::ProcessFrame(BJ_UINT8* pBuffer,BJ_INT32 nLength,BJ_UINT64 nFra
         }
     }
 
-    for (int dnsItemsIndex =0; dnsItemsIndex < m_Frame.GetQuestionCount()+m_Frame.GetAnswerCount();dnsItemsIndex++)
+    for (int dnsItemsIndex =0; dnsItemsIndex < m_pFrame->GetQuestionCount()+m_pFrame->GetAnswerCount();dnsItemsIndex++)
     {
         RecordName = "";
         ApplRecordName = "";
         InstanceName = "";
         //    printf("Name = %s\n", GetDnsRecordName(&Frame,dnsItemsIndex,tempBuffer,sizeof(tempBuffer),0));
 
-        CDNSRecord* pDNSRecord = m_Frame.GetDnsRecord(dnsItemsIndex);
+        CDNSRecord* pDNSRecord = m_pFrame->GetDnsRecord(dnsItemsIndex);
         if (pDNSRecord == NULL)
             continue;
 
@@ -944,14 +1151,14 @@ void CBonjourTop::ProcessFrame(BJ_UINT8* pBuffer,BJ_INT32 nLength,BJ_UINT64 nFra
 
         m_nTotalBytes += 10 + nBytes;
 
-        if (m_Frame.m_SourceIPAddress.IsIPv4())
+        if (m_pFrame->m_SourceIPAddress.IsIPv4())
         {
-            UpdateRecord(m_ServicePtrCache,pDNSRecord,RecordName,RecordName, nBytes, (pDNSRecord->m_nTTL == 0));
+            UpdateRecord(SERVICE_IPV4,pDNSRecord,RecordName,RecordName, nBytes, (pDNSRecord->m_nTTL == 0));
             UpdateShortRecordHelper(SERVICE_IPV4, traceplatform, traceversion, device->GetDeviceOS(), pDNSRecord, RecordName, RecordName, nBytes, (pDNSRecord->m_nTTL == 0));
         }
         else
         {
-            UpdateRecord(m_ServicePtrCacheIPv6,pDNSRecord,RecordName,RecordName, nBytes, (pDNSRecord->m_nTTL == 0));
+            UpdateRecord(SERVICE_IPV6,pDNSRecord,RecordName,RecordName, nBytes, (pDNSRecord->m_nTTL == 0));
             UpdateShortRecordHelper(SERVICE_IPV6, traceplatform, traceversion, device->GetDeviceOS(), pDNSRecord, RecordName, RecordName, nBytes, (pDNSRecord->m_nTTL == 0));
         }
 
@@ -1013,15 +1220,15 @@ void CBonjourTop::ProcessFrame(BJ_UINT8* pBuffer,BJ_INT32 nLength,BJ_UINT64 nFra
                 ApplRecordName = "Other";
             }
 
-            if (m_Frame.m_SourceIPAddress.IsIPv4())
+            if (m_pFrame->m_SourceIPAddress.IsIPv4())
             {
-                UpdateRecord(m_ApplPtrCache,pDNSRecord,ApplRecordName,RecordName, nBytes, (pDNSRecord->m_nTTL == 0));
+                UpdateRecord(APP_IPV4,pDNSRecord,ApplRecordName,RecordName, nBytes, (pDNSRecord->m_nTTL == 0));
                 UpdateShortRecordHelper(APP_IPV4, traceplatform, traceversion, device->GetDeviceOS(), pDNSRecord, ApplRecordName, RecordName, nBytes, (pDNSRecord->m_nTTL == 0));
 
             }
             else
             {
-                UpdateRecord(m_ApplPtrCacheIPv6,pDNSRecord,ApplRecordName,RecordName, nBytes, (pDNSRecord->m_nTTL == 0));
+                UpdateRecord(APP_IPV6,pDNSRecord,ApplRecordName,RecordName, nBytes, (pDNSRecord->m_nTTL == 0));
                 UpdateShortRecordHelper(APP_IPV6, traceplatform, traceversion, device->GetDeviceOS(), pDNSRecord, ApplRecordName, RecordName, nBytes, (pDNSRecord->m_nTTL == 0));
             }
 
@@ -1490,86 +1697,314 @@ void CBonjourTop::LiveCapture()
                 }
                 Reset();
             }
+            StreamTick(time(NULL));
         }
     }
 }
 
 
 
-void CBonjourTop::CaptureFile()
+bool CBonjourTop::AcceptCaptureFrame(Frame* pFrame,BJ_UINT32 nWireLen,CIPAddrMap& LocalSubnetIPv6)
 {
-    CCaptureFile CaptureFile;
     BJIPAddr* pIPSrcAddr;
     BJIPAddr* pIPDestAddr;
 
-    CIPAddrMap LocalSubnetIPv6;
+    m_nFrameCount++;
+    m_nTotalBytes += nWireLen;
 
+    pIPSrcAddr = pFrame->GetSrcIPAddr();
+    pIPDestAddr = pFrame->GetDestIPAddr();
 
-    CaptureFile.Open(m_pTcpDumpFileName);
+    if (pIPSrcAddr->IsIPv4())
+    {
+        // check fragment flag
+        BJ_UINT8* pIP = pFrame->GetIPStart();
+        BJ_UINT16 flags = * ((BJ_UINT16*)(pIP+6));
+        if (flags)
+            return false;
 
-    m_StartTime = 0;
-    int nFrameIndex  = 0;
+        if (!m_IPv4Addr.IsEmptySubnet())
+        {
+            if (m_IPv4Addr.IsSameSubNet(pIPSrcAddr))
+            {
+                BJ_UINT8* pSourceMac = pFrame->GetEthernetStart()+6;
+                BJIPAddr IPv6Addr;
+                IPv6Addr.CreateLinkLocalIPv6(pSourceMac);
+                LocalSubnetIPv6.FindwithAddRecord(&IPv6Addr);
+
+            }
+            else
+            {
+                m_SocketStatus[4].m_nFrameCount++;
 
-    while (CaptureFile.NextFrame())
+                if (!m_Collection.IsValid())
+                    return false;
+            }
+        }
+        m_SocketStatus[(pIPDestAddr->IsBonjourMulticast())?0:2].m_nFrameCount++;
+    }
+    if (pIPSrcAddr->IsIPv6())
     {
-        nFrameIndex++;
+        if (!LocalSubnetIPv6.Find(pIPSrcAddr) && !m_IPv4Addr.IsEmptySubnet())
+        {
+            m_SocketStatus[5].m_nFrameCount++;
+             if (!m_Collection.IsValid())
+                 return false;
+        }
+        m_SocketStatus[(pIPDestAddr->IsBonjourMulticast())?1:3].m_nFrameCount++;
+    }
+    return true;
+}
 
-        BJ_UINT8* pBonjourBuffer = (BJ_UINT8*)CaptureFile.m_CurrentFrame.GetBonjourStart();
-        if (!pBonjourBuffer)
-            continue;
+/////////////
+// Parallel capture file parsing
+//
+// The per frame statistics are order dependent: device names are learned from
+// A/AAAA records of earlier frames and the OS attribution of a source changes
+// as frames arrive. So this thread still walks the frames in capture order,
+// while the workers parse the next batch of frames (link layer / IP decode and
+// ParseDNSFrame) and apply the record updates of the previous batch to their
+// partial tables (see CRecordWorkers). The results are identical to the
+// serial loop.
 
-        m_nFrameCount++;
-        m_nTotalBytes += CaptureFile.GetWiredLength();
+#define BJ_PARSE_FRAMES_PER_THREAD  64
 
-        pIPSrcAddr = CaptureFile.m_CurrentFrame.GetSrcIPAddr();
-        pIPDestAddr = CaptureFile.m_CurrentFrame.GetDestIPAddr();
-        m_Frame.m_SourceIPAddress = *CaptureFile.m_CurrentFrame.GetSrcIPAddr();;
-        m_Frame.m_SourceMACAddress = *CaptureFile.m_CurrentFrame.GetSrcMACAddr();
+class CParsedFrame
+{
+public:
+    Frame       m_LinkFrame;
+    BJ_UINT32   m_nWireLen;
+    BJ_UINT32   m_nCaptureLen;
+    BJ_UINT8*   m_pBonjourBuffer;
+    CDNSFrame   m_DNSFrame;
+};
 
+static void ParseFrameBatch(CParsedFrame* pBatch,int nCount,int nFirst,int nStride)
+{
+    for (int i = nFirst; i < nCount; i += nStride)
+    {
+        CParsedFrame* pParsed = &pBatch[i];
+
+        pParsed->m_pBonjourBuffer = pParsed->m_LinkFrame.GetBonjourStart();
+        if (!pParsed->m_pBonjourBuffer)
+            continue;
+
+        BJIPAddr* pIPSrcAddr = pParsed->m_LinkFrame.GetSrcIPAddr();
         if (pIPSrcAddr->IsIPv4())
-        {
-            // check fragment flag
-            BJ_UINT8* pIP = CaptureFile.m_CurrentFrame.GetIPStart();
-            BJ_UINT16 flags = * ((BJ_UINT16*)(pIP+6));
-            if (flags)
+        {   // fragments are dropped by AcceptCaptureFrame, don't parse them
+            BJ_UINT8* pIP = pParsed->m_LinkFrame.GetIPStart();
+            if (* ((BJ_UINT16*)(pIP+6)))
                 continue;
+        }
+
+        pParsed->m_DNSFrame.m_SourceIPAddress = *pIPSrcAddr;
+        pParsed->m_DNSFrame.m_SourceMACAddress = *pParsed->m_LinkFrame.GetSrcMACAddr();
+        pParsed->m_DNSFrame.ParseDNSFrame(pParsed->m_pBonjourBuffer,
+                                          pParsed->m_nCaptureLen - (BJ_UINT32) (pParsed->m_pBonjourBuffer - pParsed->m_LinkFrame.GetEthernetStart()),
+                                          pParsed->m_LinkFrame.GetTime());
+    }
+}
+
+static void RunCaptureWorker(CRecordWorkers* pRecordWorkers,int nWorker,CParsedFrame* pBatch,int nCount)
+{
+    pRecordWorkers->ApplyBatch(nWorker);
+    ParseFrameBatch(pBatch, nCount, nWorker, pRecordWorkers->m_nThreads);
+}
+
+static int ReadFrameBatch(CCaptureFile& CaptureFile,CParsedFrame* pBatch,int nMax)
+{
+    int nCount = 0;
 
-            if (!m_IPv4Addr.IsEmptySubnet())
+    while (nCount < nMax && CaptureFile.NextFrame())
+    {
+        pBatch[nCount].m_LinkFrame = CaptureFile.m_CurrentFrame;
+        pBatch[nCount].m_nWireLen = CaptureFile.GetWiredLength();
+        pBatch[nCount].m_nCaptureLen = CaptureFile.GetCaptureLength();
+        nCount++;
+    }
+    return nCount;
+}
+
+template <class NodeType>
+static bool FirstUpdateLess(const NodeType* pLeft,const NodeType* pRight)
+{
+    return pLeft->m_nFirstUpdate < pRight->m_nFirstUpdate;
+}
+
+// Moves the nodes of the partial trees into Target. They are inserted in the
+// order the serial loop would have created them, so the tree has the same
+// shape (Export walks it in tree order).
+template <class TreeType,class NodeType>
+static void MergeTrees(TreeType* pTarget,vector<TreeType*>& Sources)
+{
+    vector<NodeType*> Nodes;
+
+    pTarget->DetachNodes(Nodes);
+    for (typename vector<TreeType*>::iterator it = Sources.begin(); it != Sources.end(); ++it)
+        (*it)->DetachNodes(Nodes);
+
+    sort(Nodes.begin(), Nodes.end(), FirstUpdateLess<NodeType>);
+
+    for (typename vector<NodeType*>::iterator it = Nodes.begin(); it != Nodes.end(); ++it)
+        pTarget->AdoptNode(*it);
+}
+
+void CBonjourTop::MergeRecordTables(vector<CRecordTables*>& Sources)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        vector<CStringTree*> PtrCaches;
+        for (vector<CRecordTables*>::iterator it = Sources.begin(); it != Sources.end(); ++it)
+            PtrCaches.push_back((*it)->m_pPtrCache[i]);
+        MergeTrees<CStringTree,CStringNode>(m_RecordTables.m_pPtrCache[i], PtrCaches);
+
+        for (int j = 0; j < 2; j++)
+        {
+            map<BJString, vector<CStringShortTree*> > Versions;
+            map<BJString, CStringShortTree*>* myMap = m_RecordTables.m_pBreakdown[i][j];
+
+            for (vector<CRecordTables*>::iterator it = Sources.begin(); it != Sources.end(); ++it)
             {
-                if (m_IPv4Addr.IsSameSubNet(pIPSrcAddr))
-                {
-                    BJ_UINT8* pSourceMac = CaptureFile.m_CurrentFrame.GetEthernetStart()+6;
-                    BJIPAddr IPv6Addr;
-                    IPv6Addr.CreateLinkLocalIPv6(pSourceMac);
-                    LocalSubnetIPv6.FindwithAddRecord(&IPv6Addr);
+                map<BJString, CStringShortTree*>* pSourceMap = (*it)->m_pBreakdown[i][j];
+                for (map<BJString, CStringShortTree*>::iterator s = pSourceMap->begin(); s != pSourceMap->end(); ++s)
+                    Versions[s->first].push_back(s->second);
+            }
 
-                }
-                else
-                {
-                    m_SocketStatus[4].m_nFrameCount++;
+            for (map<BJString, vector<CStringShortTree*> >::iterator v = Versions.begin(); v != Versions.end(); ++v)
+            {
+                map<BJString, CStringShortTree*>::iterator myIt = myMap->find(v->first);
+                if (myIt == myMap->end())
+                    myIt = myMap->insert(std::pair<BJString, CStringShortTree*>(v->first, new CStringShortTree())).first;
 
-                    if (!m_Collection.IsValid())
-                        continue;
-                }
+                MergeTrees<CStringShortTree,CStringShortNode>(myIt->second, v->second);
             }
-            m_SocketStatus[(pIPDestAddr->IsBonjourMulticast())?0:2].m_nFrameCount++;
-        }
-        if (pIPSrcAddr->IsIPv6())
-        {
-            if (!LocalSubnetIPv6.Find(pIPSrcAddr) && !m_IPv4Addr.IsEmptySubnet())
+
+            // the partial trees are empty now
+            for (vector<CRecordTables*>::iterator it = Sources.begin(); it != Sources.end(); ++it)
             {
-                m_SocketStatus[5].m_nFrameCount++;
-                 if (!m_Collection.IsValid())
-                     continue;
+                map<BJString, CStringShortTree*>* pSourceMap = (*it)->m_pBreakdown[i][j];
+                for (map<BJString, CStringShortTree*>::iterator s = pSourceMap->begin(); s != pSourceMap->end(); ++s)
+                    delete s->second;
+                pSourceMap->clear();
             }
-            m_SocketStatus[(pIPDestAddr->IsBonjourMulticast())?1:3].m_nFrameCount++;
         }
+    }
+}
+
+void CBonjourTop::CaptureFileParallel(CCaptureFile& CaptureFile,CIPAddrMap& LocalSubnetIPv6,int nThreads)
+{
+    int nBatchSize = nThreads * BJ_PARSE_FRAMES_PER_THREAD;
+    CParsedFrame* pBatch[2];
+    int nCount[2];
+    int nCurrent = 0;
+    vector<thread> workers;
+
+    pBatch[0] = new CParsedFrame[nBatchSize];
+    pBatch[1] = new CParsedFrame[nBatchSize];
+    m_pRecordWorkers = new CRecordWorkers(nThreads);
+
+    nCount[nCurrent] = ReadFrameBatch(CaptureFile, pBatch[nCurrent], nBatchSize);
+    for (int t = 0; t < nThreads; t++)
+        workers.push_back(thread(RunCaptureWorker, m_pRecordWorkers, t, pBatch[nCurrent], nCount[nCurrent]));
+
+    while (nCount[nCurrent] > 0)
+    {
+        for (vector<thread>::iterator it = workers.begin(); it != workers.end(); ++it)
+            it->join();
+        workers.clear();
+
+        // let the workers apply the last batch of updates and parse the next
+        // batch of frames while this one is aggregated
+        int nNext = nCurrent ^ 1;
+        nCount[nNext] = ReadFrameBatch(CaptureFile, pBatch[nNext], nBatchSize);
+        m_pRecordWorkers->SwapBatch();
+        for (int t = 0; t < nThreads; t++)
+            workers.push_back(thread(RunCaptureWorker, m_pRecordWorkers, t, pBatch[nNext], nCount[nNext]));
+
+        for (int i = 0; i < nCount[nCurrent]; i++)
+        {
+            CParsedFrame* pParsed = &pBatch[nCurrent][i];
+
+            if (!pParsed->m_pBonjourBuffer)
+                continue;
+
+            if (!AcceptCaptureFrame(&pParsed->m_LinkFrame, pParsed->m_nWireLen, LocalSubnetIPv6))
+                continue;
+
+            ProcessDNSFrame(&pParsed->m_DNSFrame);
+        }
+        nCurrent = nNext;
+    }
+
+    for (vector<thread>::iterator it = workers.begin(); it != workers.end(); ++it)
+        it->join();
+    workers.clear();
+
+    // the updates of the last batch
+    m_pRecordWorkers->SwapBatch();
+    for (int t = 0; t < nThreads; t++)
+        workers.push_back(thread(RunCaptureWorker, m_pRecordWorkers, t, pBatch[0], 0));
+    for (vector<thread>::iterator it = workers.begin(); it != workers.end(); ++it)
+        it->join();
+
+    vector<CRecordTables*> Partial;
+    for (int t = 0; t < nThreads; t++)
+        Partial.push_back(&m_pRecordWorkers->m_pWorkers[t].m_Tables);
+    MergeRecordTables(Partial);
+
+    delete m_pRecordWorkers;
+    m_pRecordWorkers = NULL;
+    m_pFrame = &m_Frame;
+    delete [] pBatch[0];
+    delete [] pBatch[1];
+}
+
+void CBonjourTop::CaptureFile()
+{
+    CCaptureFile CaptureFile;
+
+    CIPAddrMap LocalSubnetIPv6;
+
+
+    CaptureFile.Open(m_pTcpDumpFileName);
+
+    m_StartTime = 0;
+
+    int nThreads = m_nParseThreads;
+    if (nThreads <= 0)
+        nThreads = thread::hardware_concurrency();
+
+    // frames have to stay valid after NextFrame() to be parsed in the background,
+    // and streaming resets the tables between frames so it needs the serial loop
+    if (nThreads > 1 && CaptureFile.IsMapped() && m_StreamSeconds <= 0)
+    {
+        CaptureFileParallel(CaptureFile, LocalSubnetIPv6, nThreads);
+    }
+    else
+    {
+        while (CaptureFile.NextFrame())
+        {
+            StreamTick(CaptureFile.m_CurrentFrame.GetTime() / 1000000);
+
+            BJ_UINT8* pBonjourBuffer = (BJ_UINT8*)CaptureFile.m_CurrentFrame.GetBonjourStart();
+            if (!pBonjourBuffer)
+                continue;
+
+            if (!AcceptCaptureFrame(&CaptureFile.m_CurrentFrame, CaptureFile.GetWiredLength(), LocalSubnetIPv6))
+                continue;
 
-        ProcessFrame(pBonjourBuffer,CaptureFile.GetBufferLen((pBonjourBuffer)),CaptureFile.m_CurrentFrame.GetTime());
+            m_Frame.m_SourceIPAddress = *CaptureFile.m_CurrentFrame.GetSrcIPAddr();
+            m_Frame.m_SourceMACAddress = *CaptureFile.m_CurrentFrame.GetSrcMACAddr();
 
+            ProcessFrame(pBonjourBuffer,CaptureFile.GetBufferLen((pBonjourBuffer)),CaptureFile.m_CurrentFrame.GetTime());
+        }
     }
     m_EndTime = CaptureFile.GetDeltaTime();
 
+    // leave stdout to the stream
+    if (m_StreamSeconds > 0 && strcmp(m_pStreamTarget, "-") == 0)
+        return;
+
     PrintResults(2,false);
     if ( m_CurrentDisplay ==  BJ_DISPLAY_APP)
         m_CurrentDisplay =  BJ_DISPLAY_APPv6;
@@ -1771,23 +2206,212 @@ void CBonjourTop::WriteVendorFile()
     fclose(hFile);
 }
 
-void CBonjourTop::WindowSizeChanged()
+/////////////
+// Streaming export
+//
+// With -l every interval is written as JSON lines, one object per service,
+// application, OS type and active device, and then the aggregates are Reset()
+// so each interval holds deltas and memory stays bounded no matter how long
+// BonjourTop runs. Device identities are kept across intervals for the OS
+// attribution.
+
+class CStreamContext
 {
-    window_size_changed = true;
+public:
+    FILE* hFile;
+    BJ_UINT64 nTime;
+    BJ_UINT64 nInterval;
+    const char* pType;
+    const char* pIPVersion;
+    BJ_UINT64 nDevices[3];      // iOS, OSX, other
+    BJ_UINT64 nFrames[3];
+};
+
+static void StreamString(FILE* hFile, const char* pStr)
+{
+    fputc('"', hFile);
+    for (const unsigned char* p = (const unsigned char*) (pStr ? pStr : ""); *p; p++)
+    {
+        if (*p == '"' || *p == '\\')
+            fprintf(hFile, "\\%c", *p);
+        else if (*p < 0x20)
+            fprintf(hFile, "\\u%04x", *p);
+        else
+            fputc(*p, hFile);
+    }
+    fputc('"', hFile);
 }
 
-BJ_UINT64 Hash(const char* pStr)
+static void StreamHeader(CStreamContext* pContext, const char* pType)
 {
-    // to fix
-    BJ_UINT64 hash = 0;
-    int c;
+    fprintf(pContext->hFile, "{\"time\":%llu,\"interval\":%llu,\"type\":\"%s\"", pContext->nTime, pContext->nInterval, pType);
+}
+
+static int CbStreamRecord(const void* pNode, const void* pParam)
+{
+    CStringNode* pRecord = (CStringNode*)pNode;
+    CStreamContext* pContext = (CStreamContext*)pParam;
+
+    StreamHeader(pContext, pContext->pType);
+    fprintf(pContext->hFile, ",\"ip\":\"%s\",\"name\":", pContext->pIPVersion);
+    StreamString(pContext->hFile, pRecord->m_Value);
+    fprintf(pContext->hFile, ",\"bytes\":%llu,\"frames\":%llu,\"frames_ios\":%llu,\"frames_osx\":%llu,\"questions\":%llu,\"answers\":%llu,\"devices\":%llu,\"qu\":%llu,\"goodbyes\":%llu}\n",
+            pRecord->m_nBytes, pRecord->m_nFrames, pRecord->m_nFramesiOS, pRecord->m_nFramesOSX,
+            pRecord->m_nQuestionFrames, pRecord->m_nAnswerFrames, pRecord->m_nDeviceTotalCount,
+            pRecord->m_nWakeFrames, pRecord->m_nGoodbyeFrames);
+    return 0;
+}
 
-    while ((c = *pStr++))
-        hash += c;
+static int CbStreamDevice(const void* pNode, const void* pParam)
+{
+    CDeviceNode* pDevice = (CDeviceNode*)pNode;
+    CStreamContext* pContext = (CStreamContext*)pParam;
 
-    return hash;
+    if (pDevice->bDuplicate || pDevice->frameTotal.GetValue() == 0)
+        return 0;
+
+    char deviceOS = pDevice->GetDeviceOS();
+    int nOS = (deviceOS == 'i' || deviceOS == 't') ? 0 : (deviceOS == 'X') ? 1 : 2;
+    pContext->nDevices[nOS]++;
+    pContext->nFrames[nOS] += pDevice->frameTotal.GetValue();
+
+    StreamHeader(pContext, "device");
+    fprintf(pContext->hFile, ",\"name\":");
+    StreamString(pContext->hFile, pDevice->m_Key.GetBuffer());
+    fprintf(pContext->hFile, ",\"os\":\"%c\",\"ipv4\":", deviceOS);
+    StreamString(pContext->hFile, pDevice->ipAddressv4.IsEmpty() ? "" : pDevice->ipAddressv4.GetString());
+    fprintf(pContext->hFile, ",\"ipv6\":");
+    StreamString(pContext->hFile, pDevice->ipAddressv6.IsEmpty() ? "" : pDevice->ipAddressv6.GetString());
+    fprintf(pContext->hFile, ",\"mac\":\"%s\",\"frames\":%llu,\"questions\":%llu,\"answers\":%llu,\"qu\":%llu}\n",
+            pDevice->macAddress.GetString(), pDevice->frameTotal.GetValue(), pDevice->questionFrame.GetValue(),
+            pDevice->answerFrame.GetValue(), pDevice->QUFrame.GetValue());
+    return 0;
+}
+
+bool CBonjourTop::OpenStream()
+{
+    if (m_hStream)
+        return true;
+
+    if (strcmp(m_pStreamTarget, "-") == 0)
+    {
+        m_hStream = stdout;
+    }
+    else if (strncmp(m_pStreamTarget, "unix:", 5) == 0)
+    {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strlcpy(addr.sun_path, m_pStreamTarget + 5, sizeof(addr.sun_path));
+
+        // a collector going away must not kill us, the write fails instead
+        signal(SIGPIPE, SIG_IGN);
+
+        int nSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (nSocket < 0)
+            return false;
+        if (connect(nSocket, (struct sockaddr*)&addr, sizeof(addr)) != 0 || (m_hStream = fdopen(nSocket, "w")) == NULL)
+        {
+            close(nSocket);
+            return false;
+        }
+    }
+    else
+    {
+        m_hStream = fopen(m_pStreamTarget, "a");
+    }
+
+    if (m_hStream == NULL)
+        printf("stream open failed %s\n", m_pStreamTarget);
+
+    return m_hStream != NULL;
+}
 
+// Called with the current time (capture time when reading a file), emits the
+// interval and resets the aggregates once m_StreamSeconds have passed.
+void CBonjourTop::StreamTick(BJ_UINT64 nNow)
+{
+    if (m_StreamSeconds <= 0)
+        return;
+
+    m_nStreamNow = nNow;
+    if (m_nStreamStart == 0)
+    {
+        m_nStreamStart = nNow;
+        return;
+    }
+
+    if (nNow < m_nStreamStart + m_StreamSeconds)
+        return;
+
+    StreamResults(nNow);
+    Reset();
+    m_nStreamStart = nNow;
+}
+
+void CBonjourTop::StreamResults(BJ_UINT64 nNow)
+{
+    // a lost collector is retried every interval, the interval is dropped meanwhile
+    if (!OpenStream())
+        return;
+
+    CStreamContext Context;
+    memset(&Context, 0, sizeof(Context));
+    Context.hFile = m_hStream;
+    Context.nTime = nNow;
+    Context.nInterval = nNow - m_nStreamStart;
+
+    StreamHeader(&Context, "total");
+    fprintf(m_hStream, ",\"frames\":%llu,\"bytes\":%llu}\n", m_nFrameCount, m_nTotalBytes);
+
+    struct { const char* pType; const char* pIPVersion; CStringTree* pCache; } Caches[] = {
+        { "service", "v4", &m_ServicePtrCache },
+        { "service", "v6", &m_ServicePtrCacheIPv6 },
+        { "app", "v4", &m_ApplPtrCache },
+        { "app", "v6", &m_ApplPtrCacheIPv6 },
+    };
+    for (size_t i = 0; i < sizeof(Caches) / sizeof(Caches[0]); i++)
+    {
+        Context.pType = Caches[i].pType;
+        Context.pIPVersion = Caches[i].pIPVersion;
+        if (Caches[i].pCache->GetRoot())
+            Caches[i].pCache->GetRoot()->CallBack(&CbStreamRecord, &Context);
+    }
+
+    if (m_DeviceMap.GetRoot())
+        m_DeviceMap.GetRoot()->CallBack(&CbStreamDevice, &Context);
+
+    const char* pOSNames[] = { "iOS", "OSX", "other" };
+    for (int i = 0; i < 3; i++)
+    {
+        StreamHeader(&Context, "os");
+        fprintf(m_hStream, ",\"os\":\"%s\",\"devices\":%llu,\"frames\":%llu}\n", pOSNames[i], Context.nDevices[i], Context.nFrames[i]);
+    }
+
+    if (fflush(m_hStream) != 0 || ferror(m_hStream))
+    {
+        if (m_hStream != stdout)
+            fclose(m_hStream);
+        m_hStream = NULL;
+    }
+}
+
+// Emits whatever the last, partial, interval holds
+void CBonjourTop::CloseStream()
+{
+    if (m_StreamSeconds <= 0 || m_nStreamStart == 0)
+        return;
 
+    StreamResults(m_nStreamNow);
+
+    if (m_hStream && m_hStream != stdout)
+        fclose(m_hStream);
+    m_hStream = NULL;
+}
+
+void CBonjourTop::WindowSizeChanged()
+{
+    window_size_changed = true;
 }
 
 BJ_UINT64 Hash2(char* pStr)
@@ -1847,11 +2471,11 @@ void CStringNode::UpdateOSTypeCounts(CDeviceMap* pGlobalDeviceMap,CIPAddrMap *pI
     m_nDeviceAnsweringOSXCount = 0;
     m_nDeviceTotaliOSCount = 0;
     m_nDeviceTotalOSXCount = 0;
-    m_DeviceAskingTree.GetDeviceOSTypes(m_DeviceAskingTree.GetRoot(),pIp2NameMap,m_nDeviceAskingiOSCount,m_nDeviceAskingOSXCount,nDeviceUnknown);
+    m_DeviceAskingTree.GetDeviceOSTypes(pIp2NameMap,m_nDeviceAskingiOSCount,m_nDeviceAskingOSXCount,nDeviceUnknown);
     nDeviceUnknown = 0;
-    m_DeviceAnsweringTree.GetDeviceOSTypes(m_DeviceAnsweringTree.GetRoot(),pIp2NameMap,m_nDeviceAnsweringiOSCount,m_nDeviceAnsweringOSXCount,nDeviceUnknown);
+    m_DeviceAnsweringTree.GetDeviceOSTypes(pIp2NameMap,m_nDeviceAnsweringiOSCount,m_nDeviceAnsweringOSXCount,nDeviceUnknown);
     nDeviceUnknown = 0;
-    m_DeviceTotalTree.GetDeviceOSTypes(m_DeviceTotalTree.GetRoot(), pIp2NameMap, m_nDeviceTotaliOSCount, m_nDeviceTotalOSXCount, nDeviceUnknown);
+    m_DeviceTotalTree.GetDeviceOSTypes(pIp2NameMap, m_nDeviceTotaliOSCount, m_nDeviceTotalOSXCount, nDeviceUnknown);
 }
 
 void CStringNode::Print(bool bCursers,bool bDescendingSort,BJ_UINT32 &nIndex, BJ_UINT32 nStartIndex,BJ_UINT32 nEndIndex)
@@ -1998,37 +2622,34 @@ void CDeviceMap::GetDeviceOSTypes(CDeviceNode *node, CDeviceMap *pGlobalDeviceMa
     }
 }
 
-void CIPAddrMap::GetDeviceOSTypes(CIPDeviceNode* node, CIPAddrMap* pGobalMap, BJ_UINT64& iOS,BJ_UINT64& OSX,BJ_UINT64& unknowOS)
+void CIPAddrMap::GetDeviceOSTypes(CIPAddrMap* pGobalMap, BJ_UINT64& iOS,BJ_UINT64& OSX,BJ_UINT64& unknowOS)
 {
-    if (node == NULL)
-        return;
-
-    GetDeviceOSTypes(dynamic_cast<CIPDeviceNode*>(node->m_rbLeft),pGobalMap, iOS, OSX, unknowOS);
-    GetDeviceOSTypes(dynamic_cast<CIPDeviceNode*>(node->m_rbRight),pGobalMap,iOS, OSX, unknowOS);
-
-    char deviceType = '?';
-    if (pGobalMap)
+    for (BJ_UINT64 i = 0; i < GetCount(); i++)
     {
-        CIPDeviceNode *ipDevice = pGobalMap->Find(&node->m_Key);
+        CIPDeviceNode* node = GetNode(i);
+        char deviceType = '?';
+        if (pGobalMap)
+        {
+            CIPDeviceNode *ipDevice = pGobalMap->Find(&node->m_Key);
 
-        if (ipDevice && ipDevice->pDeviceNode )
-            deviceType = ipDevice->pDeviceNode->GetDeviceOS();
+            if (ipDevice && ipDevice->pDeviceNode )
+                deviceType = ipDevice->pDeviceNode->GetDeviceOS();
 
-    }
+        }
 
-    switch (deviceType)
-    {
-        case 'i':
-        case 't':
-            iOS++;
-            break;
-        case 'X':
-            OSX++;
-            break;
-        default:
-            unknowOS++;
+        switch (deviceType)
+        {
+            case 'i':
+            case 't':
+                iOS++;
+                break;
+            case 'X':
+                OSX++;
+                break;
+            default:
+                unknowOS++;
+        }
     }
-
 }
 
 
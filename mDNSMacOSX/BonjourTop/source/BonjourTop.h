@@ -12,11 +12,14 @@
 #include <iostream>
 #include <stdio.h>
 #include <map>
+#include <vector>
 #include <utility>
 
 #include "bjtypes.h"
 #include "bjsocket.h"
 #include "LLRBTree.h"
+#include "bjHashTable.h"
+#include "bjNameTable.h"
 #include "DNSFrame.h"
 #include "bjStringtoStringMap.h"
 #include "bjstring.h"
@@ -93,10 +96,10 @@ public:
 
 };
 
-class CIPAddrMap: public CLLRBTree<BJIPAddr,CIPDeviceNode>
+class CIPAddrMap: public CBJHashTable<BJIPAddr,CIPDeviceNode>
 {
 public:
-    void GetDeviceOSTypes(CIPDeviceNode* node, CIPAddrMap* pGobalMap, BJ_UINT64& iOS,BJ_UINT64& OSX,BJ_UINT64& unknowOS);
+    void GetDeviceOSTypes(CIPAddrMap* pGobalMap, BJ_UINT64& iOS,BJ_UINT64& OSX,BJ_UINT64& unknowOS);
 };
 
 ////////////////////
@@ -278,7 +281,7 @@ public:
 
 };
 
-class CMACDeviceMap: public CLLRBTree<BJMACAddr,CMACAddrDeviceNode>
+class CMACDeviceMap: public CBJHashTable<BJMACAddr,CMACAddrDeviceNode>
 {
 
 };
@@ -342,6 +345,7 @@ public:
         m_nWakeFrames = 0;
         m_nGoodbyeFrames = 0;
         m_lastQUFrameTime = 0;
+        m_nFirstUpdate = 0;
     };
     inline void Clear() {};
 
@@ -381,6 +385,7 @@ public:
     BJ_UINT64       m_nWakeFrames;
     BJ_UINT64       m_lastQUFrameTime;
     BJ_UINT64       m_nGoodbyeFrames;
+    BJ_UINT64       m_nFirstUpdate;     // CRecordUpdate that created the node
 };
 
 class CStringTree: public CLLRBTree<BJ_UINT64,CStringNode>
@@ -430,6 +435,7 @@ public:
         m_nLastFrameIndex = m_nLastQueryFrameIndex = m_nLastRespondsFrameIndex = m_nLastWakeFrameIndex = 0;
         m_nDeviceAskingCount = m_nDeviceAnsweringCount = m_nDeviceTotalCount = 0;
         m_nWakeFrames = m_lastQUFrameTime = m_nGoodbyeFrames = 0;
+        m_nFirstUpdate = 0;
     };
     inline void Clear(){};
 
@@ -454,6 +460,7 @@ public:
     BJ_UINT64       m_nWakeFrames;
     BJ_UINT64       m_lastQUFrameTime;
     BJ_UINT64       m_nGoodbyeFrames;
+    BJ_UINT64       m_nFirstUpdate;     // CRecordUpdate that created the node
 };
 
 class CStringShortTree: public CLLRBTree<BJ_UINT64, CStringShortNode>
@@ -463,6 +470,39 @@ public:
 
 ///////////
 
+// One UpdateRecord / UpdateShortRecordHelper change to a record node. It only
+// depends on the node and these values, so it can be applied on another thread.
+class CRecordUpdate
+{
+public:
+    BJ_UINT64   m_nSequence;        // post order, used to rebuild the trees in their serial shape
+    BJ_UINT64   m_nNameID;          // CBonjourTop::m_NameTable ID, the record cache key
+    BJ_UINT64   m_nFrameIndex;
+    BJ_UINT64   m_nFrameTime;
+    BJ_UINT32   m_nBytes;
+    BJ_UINT32   m_nCacheType;       // SERVICE_IPV4 .. APP_IPV6
+    BJ_UINT32   m_TracePlatform;
+    BJ_UINT32   m_TraceVersion;
+    const char* m_pName;            // interned, stays valid while the name table lives
+    BJ_UINT32   m_nSourceIPAddress; // offset into the batch, used by CRecordWorkers
+    char        m_deviceOS;
+    bool        m_bShort;           // service/app breakdown tables instead of the ptr caches
+    bool        m_bQuery;
+    bool        m_bWake;
+    bool        m_bGoodbye;
+};
+
+// The record tables a CRecordUpdate is applied to
+class CRecordTables
+{
+public:
+    CStringTree* m_pPtrCache[4];                            // indexed by cache type
+    map<BJString, CStringShortTree*>* m_pBreakdown[4][2];   // [cache type][isOSX]
+};
+
+class CCaptureFile;
+class Frame;
+class CRecordWorkers;
 
 class CBonjourTop
 {
@@ -479,17 +519,26 @@ public:
     void ExportResults();
     void Reset();
 
+    bool OpenStream();
+    void StreamTick(BJ_UINT64 nNow);
+    void StreamResults(BJ_UINT64 nNow);
+    void CloseStream();
+
     void WriteDeviceFile();
     void WriteVendorFile();
 
     void ProcessFrame(BJ_UINT8* pBuffer,BJ_INT32 nLength, BJ_UINT64 frameTime);
+    void ProcessDNSFrame(CDNSFrame* pFrame);
+    bool AcceptCaptureFrame(Frame* pFrame,BJ_UINT32 nWireLen,CIPAddrMap& LocalSubnetIPv6);
+    void CaptureFileParallel(CCaptureFile& CaptureFile,CIPAddrMap& LocalSubnetIPv6,int nThreads);
     bool Name2OSType(BJString name,CDeviceNode* device);
 
-    void UpdateRecord(CStringTree &Cache,CDNSRecord* pDNSRecord,BJString& RecordName,BJString& ServiceName,BJ_UINT32 nBytes,bool bGoodbye);
+    void UpdateRecord(BJ_UINT32 cacheType,CDNSRecord* pDNSRecord,BJString& RecordName,BJString& ServiceName,BJ_UINT32 nBytes,bool bGoodbye);
 
     void UpdateShortRecordHelper(BJ_UINT32 cacheType, BJ_UINT32 tracePlatform, BJ_UINT32 traceVersion, char deviceOS, CDNSRecord* pDNSRecord,BJString& RecordName,BJString& ServiceName,BJ_UINT32 nBytes,bool bGoodbye);
 
-    void UpdateShortRecord(CStringShortTree* Cache,CDNSRecord* pDNSRecord,BJString& RecordName,BJString& ServiceName,BJ_UINT32 nBytes,bool bGoodbye);
+    bool PostRecordUpdate(CRecordUpdate& Update,BJString& RecordName,BJ_UINT32 nBytes,bool bGoodbye);
+    void MergeRecordTables(vector<CRecordTables*>& Sources);
 
     void GetOSTypeFromQuery(CDNSRecord *pDNSRecord,BJString& ServiceName);
     void GetOSTypeFromRegistration(CDNSRecord *pDNSRecord,BJString& ServiceName);
@@ -509,6 +558,8 @@ public:
     BJString m_DeviceFileName;
 
     CDNSFrame m_Frame;
+    CDNSFrame* m_pFrame;        // frame being aggregated, m_Frame unless parsed by a worker thread
+    int m_nParseThreads;        // capture file parse threads, 0 = one per core, 1 = serial
 
 #define NUM_SOCKET_STATUS   6
 #define HOURS_IN_DAY        24
@@ -543,6 +594,14 @@ public:
 
     BJ_INT32 m_SnapshotSeconds;
 
+    BJ_INT32 m_StreamSeconds;       // emit and reset the aggregates every x seconds, 0 = off
+    const char* m_pStreamTarget;    // "-", a file name or unix:/path/to/socket
+    FILE* m_hStream;
+    BJ_UINT64 m_nStreamStart;       // start of the current interval in seconds, 0 = not started
+    BJ_UINT64 m_nStreamNow;         // latest time seen by StreamTick()
+
+    CNameTable m_NameTable;     // record names, the caches below are keyed by their IDs
+
     CStringTree m_ServicePtrCache;
     CStringTree m_ApplPtrCache;
 
@@ -559,6 +618,9 @@ public:
     map<BJString, CStringShortTree*> m_AppBreakdownIPv6OSX;
     map<BJString, CStringShortTree*> m_AppBreakdownIPv6iOS;
 
+    CRecordTables m_RecordTables;
+    CRecordWorkers* m_pRecordWorkers;   // not NULL while record updates are applied by worker threads
+
     CDeviceMap m_DeviceMap;
 
     CMACAddrTree m_MacMap;
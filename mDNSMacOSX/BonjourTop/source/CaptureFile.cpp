@@ -10,6 +10,11 @@
 #include <stdio.h>
 #include <pcap.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
 
 #define BJ_MAX_PACKET (1024*20)
 
@@ -27,8 +32,12 @@ CCaptureFile::CCaptureFile()
 {
     m_pFileHeader = NULL;
     m_pFrameData = NULL;
+    m_pFrameStart = NULL;
     m_pFrameHeader = NULL;
     m_hFile = NULL;
+    m_pMap = NULL;
+    m_nMapLen = 0;
+    m_nMapOffset = 0;
 
     m_nFirstFrameTime = 0;
 
@@ -55,12 +64,60 @@ bool CCaptureFile::Clear()
     delete m_pFrameData; m_pFrameData = NULL;
     delete m_pFrameHeader; m_pFrameHeader = NULL;
 
-    fclose(m_hFile); m_hFile = NULL;
+    if (m_hFile)
+        fclose(m_hFile);
+    m_hFile = NULL;
+
+    if (m_pMap)
+        munmap(m_pMap, m_nMapLen);
+    m_pMap = NULL;
+    m_nMapLen = 0;
+    m_nMapOffset = 0;
+    return true;
+}
+
+bool CCaptureFile::MapFile(const char* pFileName)
+{
+    struct stat sb;
+    int fd = open(pFileName, O_RDONLY);
+
+    if (fd < 0)
+        return false;
+
+    if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode) || sb.st_size < (off_t) sizeof(pcap_file_header))
+    {
+        close(fd);
+        return false;
+    }
+
+    void* pMap = mmap(NULL, (size_t) sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (pMap == MAP_FAILED)
+        return false;
+
+    // the file is read front to back exactly once
+    madvise(pMap, (size_t) sb.st_size, MADV_SEQUENTIAL);
+
+    m_pMap = (BJ_UINT8*) pMap;
+    m_nMapLen = (size_t) sb.st_size;
+    m_nMapOffset = sizeof(pcap_file_header);
+    memcpy(m_pFileHeader, m_pMap, sizeof(pcap_file_header));
+
     return true;
 }
 
 bool CCaptureFile::Open(const char* pFileName)
 {
+    if (MapFile(pFileName))
+    {
+        pcap_file_header* pHeader = (pcap_file_header*)m_pFileHeader;
+        m_datalinkType = (Frame::BJ_DATALINKTYPE) pHeader->linktype;
+        m_CurrentFrame.SetDatalinkType(m_datalinkType);
+        return true;
+    }
+
+    // not a regular file (or mmap failed), fall back to stdio
     m_hFile = fopen(pFileName, "r");
 
     if (!m_hFile)
@@ -82,10 +139,44 @@ bool CCaptureFile::Open(const char* pFileName)
     return true;
 }
 
+bool CCaptureFile::NextMappedFrame()
+{
+    packetheader* pFrameHeader = NULL;
+
+    if (m_nMapLen - m_nMapOffset < sizeof(packetheader))
+        return false;
+
+    pFrameHeader = (packetheader*) (m_pMap + m_nMapOffset);
+    m_nMapOffset += sizeof(packetheader);
+
+    m_nWireLen = pFrameHeader->origLen;
+    m_TimeSec = pFrameHeader->sec;
+    if (m_nFirstFrameTime == 0)
+        m_nFirstFrameTime = m_TimeSec;
+    m_nCaptureLen = pFrameHeader->captureLen;
+
+    if (m_nCaptureLen > m_nMapLen - m_nMapOffset)
+        return false;
+
+    // no copy, the frame points straight into the mapping
+    m_pFrameStart = m_pMap + m_nMapOffset;
+    m_nMapOffset += m_nCaptureLen;
+
+    if (m_nCaptureLen > BJ_MAX_PACKET) // same truncation as the stdio path
+        m_nCaptureLen = BJ_MAX_PACKET;
+
+    m_CurrentFrame.Set(m_pFrameStart, m_nCaptureLen,pFrameHeader->sec*1000000ll + pFrameHeader->usec);
+
+    return true;
+}
+
 bool CCaptureFile::NextFrame()
 {
     packetheader* pFrameHeader = NULL;
 
+    if (m_pMap)
+        return NextMappedFrame();
+
     if(!m_hFile)
         return false;
 
@@ -113,6 +204,7 @@ bool CCaptureFile::NextFrame()
     if (nSkip)
         fseek(m_hFile, nSkip, SEEK_CUR);
 
+    m_pFrameStart = m_pFrameData;
     m_CurrentFrame.Set(m_pFrameData, m_nCaptureLen,pFrameHeader->sec*1000000ll + pFrameHeader->usec);
 
 
@@ -132,7 +224,7 @@ __uint32_t CCaptureFile::GetDeltaTime()
 
 __uint32_t CCaptureFile::GetBufferLen(BJ_UINT8* pStart)
 {
-    return m_nCaptureLen -  (__uint32_t) (pStart - m_pFrameData);
+    return m_nCaptureLen -  (__uint32_t) (pStart - m_pFrameStart);
 }
 
 
@@ -33,14 +33,26 @@ public:
 
     __uint32_t GetWiredLength(){ return m_nWireLen;};
 
+    __uint32_t GetCaptureLength(){ return m_nCaptureLen;};
+
+    // true when the file is memory mapped. Frame data then stays valid until
+    // the capture file is destroyed, instead of being overwritten by NextFrame.
+    bool IsMapped(){ return (m_pMap != NULL);};
+
 
 private:
     bool Init();
     bool Clear();
+    bool MapFile(const char* pFileName);
+    bool NextMappedFrame();
 
     FILE* m_hFile;
+    BJ_UINT8* m_pMap;
+    size_t m_nMapLen;
+    size_t m_nMapOffset;
     BJ_UINT8* m_pFrameHeader;
     BJ_UINT8* m_pFrameData;
+    BJ_UINT8* m_pFrameStart;
     BJ_UINT8* m_pFileHeader;
     __uint32_t  m_nCaptureLen;
     __uint32_t  m_nWireLen;
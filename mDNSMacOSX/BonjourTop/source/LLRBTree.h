@@ -11,6 +11,7 @@
 #define __TestTB__LLRBTree__
 
 #include <iostream>
+#include <vector>
 #include "bjtypes.h"
 #include <sys/socket.h>
 #include "bjstring.h"
@@ -78,6 +79,11 @@ public:
     NodeType* GetRoot() { return m_Root;};
     void ClearAll() { delete m_Root; m_Root = NULL;};
 
+    // Moves every node into Nodes, leaving the tree empty
+    void DetachNodes(std::vector<NodeType*>& Nodes);
+    // Inserts a node detached from another tree, its key must not be in this tree yet
+    void AdoptNode(NodeType* pRecord);
+
     BJ_UINT64 GetCount();
 
 
@@ -89,6 +95,7 @@ public:
 
 private:
     NodeType* RemoveRecord(NodeType* pRecord,KeyType* pKey);
+    void DetachNodes(NodeType* pRecord,std::vector<NodeType*>& Nodes);
 
     virtual NodeType* newNode(KeyType* pKey) { return new NodeType(pKey);}
     virtual void freeNode(NodeType * pNode){ delete pNode;};
@@ -356,6 +363,42 @@ NodeType* CLLRBTree<KeyType,NodeType>::FindwithAddRecord(KeyType* pKey)
     return pRecord;
 }
 
+template<class KeyType,class NodeType>
+void CLLRBTree<KeyType,NodeType>::DetachNodes(std::vector<NodeType*>& Nodes)
+{
+    if (m_Root)
+        DetachNodes(m_Root, Nodes);
+    m_Root = NULL;
+}
+
+template<class KeyType,class NodeType>
+void CLLRBTree<KeyType,NodeType>::DetachNodes(NodeType* pRecord,std::vector<NodeType*>& Nodes)
+{
+    NodeType* pLeft = (NodeType*)pRecord->m_rbLeft;
+    NodeType* pRight = (NodeType*)pRecord->m_rbRight;
+
+    pRecord->m_rbLeft = pRecord->m_rbRight = NULL;
+    pRecord->m_bIsRed = true;
+    Nodes.push_back(pRecord);
+
+    if (pLeft)
+        DetachNodes(pLeft, Nodes);
+    if (pRight)
+        DetachNodes(pRight, Nodes);
+}
+
+template<class KeyType,class NodeType>
+void CLLRBTree<KeyType,NodeType>::AdoptNode(NodeType* pRecord)
+{
+    if (m_Root)
+        m_Root = (NodeType*) m_Root->AddRecord(pRecord);
+    else
+        m_Root = pRecord;
+
+    if (m_Root)
+        m_Root->m_bIsRed = false;
+}
+
 template<class KeyType,class NodeType>
 void CLLRBTree<KeyType,NodeType>::RemoveRecord(KeyType* pKey)
 {
@@ -0,0 +1,220 @@
+//
+//  bjHashTable.h
+//  TestTB
+//
+//  Open addressing hash table for the unordered aggregate maps (per record
+//  device sets, IP and MAC lookups). Nodes are CRBNode derived so they share
+//  the node classes used with CLLRBTree, but they live in a block arena owned
+//  by the table and are only freed by ClearAll() or the destructor.
+//
+//  KeyType must provide BJ_UINT32 Hash(), equal keys must hash equal.
+//  Iteration (GetNode/CallBack) is in insertion order.
+
+#ifndef __TestTB__bjHashTable__
+#define __TestTB__bjHashTable__
+
+#include <new>
+#include <vector>
+#include <stdlib.h>
+#include "bjtypes.h"
+#include "LLRBTree.h"
+
+#define BJ_HASH_FIRST_SLOTS     8       // power of 2
+#define BJ_HASH_FIRST_BLOCK     4       // nodes in the first arena block
+#define BJ_HASH_MAX_BLOCK       256     // arena blocks double up to this size
+
+template <class KeyType, class NodeType>
+class CBJHashTable
+{
+public:
+    CBJHashTable();
+    virtual ~CBJHashTable() { ClearAll(); };
+
+    NodeType* Find(KeyType* pKey);
+
+    NodeType* FindwithAddRecord(KeyType* pKey);
+    NodeType* AddRecord(KeyType* pKey);     // the key must not be in the table yet
+
+    BJ_UINT64 GetCount() { return m_nCount; };
+    void ClearAll();
+
+    NodeType* GetNode(BJ_UINT64 nIndex);
+    void  CallBack(int(*callback)(const void*, const void*),void* pParam);
+
+private:
+    CBJHashTable(const CBJHashTable&);
+    void operator=(const CBJHashTable&);
+
+    struct Slot
+    {
+        BJ_UINT32 nHash;
+        NodeType* pNode;
+    };
+
+    static BJ_UINT64 BlockSize(BJ_UINT64 nBlock)
+    {
+        BJ_UINT64 nSize = BJ_HASH_FIRST_BLOCK;
+        while (nBlock-- && nSize < BJ_HASH_MAX_BLOCK)
+            nSize <<= 1;
+        return nSize;
+    };
+
+    NodeType* newNode(KeyType* pKey);
+    void InsertSlot(BJ_UINT32 nHash,NodeType* pNode);
+    void Grow();
+
+    Slot*       m_pSlots;
+    BJ_UINT32   m_nSlots;
+    BJ_UINT64   m_nCount;
+
+    std::vector<NodeType*> m_Blocks;
+    BJ_UINT64   m_nBlockUsed;       // nodes handed out from the last block
+};
+
+/////////////////
+
+template<class KeyType,class NodeType>
+CBJHashTable<KeyType,NodeType>::CBJHashTable()
+{
+    m_pSlots = NULL;
+    m_nSlots = 0;
+    m_nCount = 0;
+    m_nBlockUsed = 0;
+}
+
+template<class KeyType,class NodeType>
+NodeType* CBJHashTable<KeyType,NodeType>::Find(KeyType* pKey)
+{
+    if (m_pSlots == NULL)
+        return NULL;
+
+    BJ_UINT32 nHash = pKey->Hash();
+    BJ_UINT32 nMask = m_nSlots - 1;
+
+    for (BJ_UINT32 i = nHash & nMask; m_pSlots[i].pNode; i = (i + 1) & nMask)
+    {
+        if (m_pSlots[i].nHash == nHash && m_pSlots[i].pNode->Compare(pKey) == BJ_EQUAL)
+            return m_pSlots[i].pNode;
+    }
+
+    return NULL;
+}
+
+template<class KeyType,class NodeType>
+NodeType* CBJHashTable<KeyType,NodeType>::FindwithAddRecord(KeyType* pKey)
+{
+    NodeType* pRecord = Find(pKey);
+
+    if (pRecord == NULL)
+        pRecord = AddRecord(pKey);
+
+    return pRecord;
+}
+
+template<class KeyType,class NodeType>
+NodeType* CBJHashTable<KeyType,NodeType>::AddRecord(KeyType* pKey)
+{
+    // keep the load under 3/4 so probe runs stay short
+    if ((m_nCount + 1) * 4 > (BJ_UINT64)m_nSlots * 3)
+        Grow();
+
+    NodeType* pRecord = newNode(pKey);
+    InsertSlot(pKey->Hash(), pRecord);
+    m_nCount++;
+
+    return pRecord;
+}
+
+template<class KeyType,class NodeType>
+void CBJHashTable<KeyType,NodeType>::ClearAll()
+{
+    BJ_UINT64 nLeft = m_nCount;
+
+    for (BJ_UINT64 nBlock = 0; nBlock < m_Blocks.size(); nBlock++)
+    {
+        NodeType* pBlock = m_Blocks[nBlock];
+        BJ_UINT64 nSize = BlockSize(nBlock);
+        for (BJ_UINT64 i = 0; i < nSize && nLeft; i++, nLeft--)
+            pBlock[i].~NodeType();
+        ::operator delete(pBlock);
+    }
+    m_Blocks.clear();
+    m_nBlockUsed = 0;
+
+    free(m_pSlots);
+    m_pSlots = NULL;
+    m_nSlots = 0;
+    m_nCount = 0;
+}
+
+template<class KeyType,class NodeType>
+NodeType* CBJHashTable<KeyType,NodeType>::GetNode(BJ_UINT64 nIndex)
+{
+    if (nIndex >= m_nCount)
+        return NULL;
+
+    // skip the growing blocks, the rest are all BJ_HASH_MAX_BLOCK long
+    BJ_UINT64 nBlock = 0;
+    while (BlockSize(nBlock) < BJ_HASH_MAX_BLOCK && nIndex >= BlockSize(nBlock))
+        nIndex -= BlockSize(nBlock++);
+    nBlock += nIndex / BJ_HASH_MAX_BLOCK;
+
+    return &m_Blocks[nBlock][nIndex % BJ_HASH_MAX_BLOCK];
+}
+
+template<class KeyType,class NodeType>
+void  CBJHashTable<KeyType,NodeType>::CallBack(int(*callback)(const void*, const void*),void* pParam)
+{
+    BJ_UINT64 nLeft = m_nCount;
+
+    for (BJ_UINT64 nBlock = 0; nBlock < m_Blocks.size(); nBlock++)
+    {
+        BJ_UINT64 nSize = BlockSize(nBlock);
+        for (BJ_UINT64 i = 0; i < nSize && nLeft; i++, nLeft--)
+            callback(&m_Blocks[nBlock][i],pParam);
+    }
+}
+
+template<class KeyType,class NodeType>
+NodeType* CBJHashTable<KeyType,NodeType>::newNode(KeyType* pKey)
+{
+    if (m_Blocks.empty() || m_nBlockUsed == BlockSize(m_Blocks.size() - 1))
+    {
+        m_Blocks.push_back((NodeType*) ::operator new(sizeof(NodeType) * BlockSize(m_Blocks.size())));
+        m_nBlockUsed = 0;
+    }
+
+    return new (&m_Blocks.back()[m_nBlockUsed++]) NodeType(pKey);
+}
+
+template<class KeyType,class NodeType>
+void CBJHashTable<KeyType,NodeType>::InsertSlot(BJ_UINT32 nHash,NodeType* pNode)
+{
+    BJ_UINT32 nMask = m_nSlots - 1;
+    BJ_UINT32 i = nHash & nMask;
+
+    while (m_pSlots[i].pNode)
+        i = (i + 1) & nMask;
+
+    m_pSlots[i].nHash = nHash;
+    m_pSlots[i].pNode = pNode;
+}
+
+template<class KeyType,class NodeType>
+void CBJHashTable<KeyType,NodeType>::Grow()
+{
+    Slot* pOldSlots = m_pSlots;
+    BJ_UINT32 nOldSlots = m_nSlots;
+
+    m_nSlots = m_nSlots ? m_nSlots * 2 : BJ_HASH_FIRST_SLOTS;
+    m_pSlots = (Slot*) calloc(m_nSlots, sizeof(Slot));
+
+    for (BJ_UINT32 i = 0; i < nOldSlots; i++)
+    {
+        if (pOldSlots[i].pNode)
+            InsertSlot(pOldSlots[i].nHash, pOldSlots[i].pNode);
+    }
+    free(pOldSlots);
+}
+
+#endif /* defined(__TestTB__bjHashTable__) */
@@ -14,13 +14,12 @@
 
 
 //   static
-sockaddr_storage BJIPAddr::emptySockAddrStorage;
+sockaddr_storage BJIPAddr::emptySockAddrStorage; // zero filled, never written so it can be shared by threads
 
 
 
 BJIPAddr::BJIPAddr()
 {
-    memset(&emptySockAddrStorage,0,sizeof(emptySockAddrStorage));
     Empty();
 }
 
@@ -256,6 +255,33 @@ BJ_COMPARE BJIPAddr::Compare(BJIPAddr* pIPAddr)
 
 }
 
+BJ_UINT32 BJIPAddr::Hash()
+{
+    // FNV-1a over the same bytes Compare() looks at
+    BJ_UINT32 nHash = 2166136261U ^ sockAddrStorage.ss_family;
+    BJ_UINT8* pBytes;
+    size_t nLen;
+
+    if (sockAddrStorage.ss_family == AF_INET)
+    {
+        pBytes = (BJ_UINT8*) &((sockaddr_in*) &sockAddrStorage)->sin_addr;
+        nLen = sizeof(in_addr);
+    }
+    else
+    {
+        pBytes = (BJ_UINT8*) &((sockaddr_in6*) &sockAddrStorage)->sin6_addr;
+        nLen = sizeof(sockaddr_in6);
+    }
+
+    for (size_t i = 0; i < nLen; i++)
+    {
+        nHash ^= pBytes[i];
+        nHash *= 16777619U;
+    }
+
+    return nHash;
+}
+
 /*
 
  take the mac address: for example 52:74:f2:b1:a8:7f
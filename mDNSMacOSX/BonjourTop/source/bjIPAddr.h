@@ -43,6 +43,7 @@ public:
 
     void CreateLinkLocalIPv6(BJ_UINT8* mac);
     BJ_COMPARE Compare(BJIPAddr* addr);
+    BJ_UINT32 Hash();   // equal under Compare() implies equal Hash()
     BJ_UINT16 GetPortNumber();
     char* GetString();
 private:
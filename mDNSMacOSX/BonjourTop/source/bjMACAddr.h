@@ -44,6 +44,16 @@ public:
             return BJ_LT;
         return BJ_EQUAL;
     };
+    BJ_UINT32 Hash()
+    {
+        BJ_UINT32 nHash = 2166136261U;
+        for (size_t i = 0; i < sizeof(addr); i++)
+        {
+            nHash ^= addr[i];
+            nHash *= 16777619U;
+        }
+        return nHash;
+    };
     bool IsEmpty() { return (addr[0] | addr[1] | addr[2] | addr[3] | addr[4] | addr[5]) == 0;};
 
 private:
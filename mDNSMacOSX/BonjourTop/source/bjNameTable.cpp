@@ -0,0 +1,45 @@
+//
+//  bjNameTable.cpp
+//  TestTB
+//
+
+#include "bjNameTable.h"
+
+/////////////////////
+
+CNameNode::CNameNode(BJString* pKey)
+{
+    m_Key = *pKey;
+    m_nID = 0;
+}
+
+void CNameNode::CopyNode(CRBNode* pSource)
+{
+    m_Key = ((CNameNode*)pSource)->m_Key;
+    m_nID = ((CNameNode*)pSource)->m_nID;
+}
+
+/////////////////////
+
+BJ_UINT64 CNameTable::Intern(BJString& sName)
+{
+    CNameNode* pNode = Find(&sName);
+
+    if (pNode == NULL)
+    {
+        pNode = AddRecord(&sName);
+        pNode->m_nID = GetCount() - 1;  // nodes are kept in insertion order, see GetName()
+    }
+
+    return pNode->m_nID;
+}
+
+const char* CNameTable::GetName(BJ_UINT64 nID)
+{
+    CNameNode* pNode = GetNode(nID);
+
+    if (pNode == NULL || pNode->m_Key.GetBuffer() == NULL)
+        return "";
+
+    return pNode->m_Key.GetBuffer();
+}
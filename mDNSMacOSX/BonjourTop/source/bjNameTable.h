@@ -0,0 +1,40 @@
+//
+//  bjNameTable.h
+//  TestTB
+//
+//  Interns the record names seen in a capture. Each distinct name is stored
+//  once and gets a small integer ID, handed out in order of first use, which
+//  the record caches use as their key.
+//
+
+#ifndef __TestTB__bjNameTable__
+#define __TestTB__bjNameTable__
+
+#include <iostream>
+#include "bjtypes.h"
+#include "bjstring.h"
+#include "bjHashTable.h"
+
+class CNameNode : public CRBNode<BJString>
+{
+public:
+    CNameNode(BJString* pKey);
+    ~CNameNode() {};
+    inline virtual BJ_COMPARE Compare(BJString* pKey) { return m_Key.Compare(*pKey);};
+    virtual void CopyNode(CRBNode* pSource);
+    inline virtual void Init() {};
+    inline virtual void Clear() {};
+
+    BJ_UINT64 m_nID;
+};
+
+class CNameTable : public CBJHashTable<BJString, CNameNode>
+{
+public:
+    BJ_UINT64 Intern(BJString& sName);
+
+    // The returned buffer stays valid, and unchanged, until ClearAll()
+    const char* GetName(BJ_UINT64 nID);
+};
+
+#endif /* defined(__TestTB__bjNameTable__) */
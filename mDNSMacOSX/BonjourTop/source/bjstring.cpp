@@ -110,6 +110,20 @@ BJ_COMPARE BJString::Compare(const BJString& str)
 
 }
 
+BJ_UINT32 BJString::Hash()
+{
+    // FNV-1a, NULL and "" hash alike but Compare() tells them apart
+    BJ_UINT32 nHash = 2166136261U;
+
+    for (const char* p = buffer; p && *p; p++)
+    {
+        nHash ^= (BJ_UINT8) *p;
+        nHash *= 16777619U;
+    }
+
+    return nHash;
+}
+
 BJString& BJString::operator+=(const char* str)
 {
     if (buffer == NULL)
@@ -30,6 +30,7 @@ public:
     bool operator<(const BJString& str) const;
 
     BJ_COMPARE Compare(const BJString& str);
+    BJ_UINT32 Hash();
 
 
     BJString& operator+=(const char* str);
@@ -7,6 +7,7 @@
 //
 
 #include <stdio.h>
+#include <string.h>
 #include <curses.h>
 
 #include "bjtypes.h"
@@ -35,6 +36,9 @@ usage()
     printf("\t\t\t [-v] 'report the version number'  \n");
     printf("\t\t\t [-d] filename 'export device map. Adds timestamp and csv extension to the filename'  \n");
     printf("\t\t\t [-f application] 'filter application for device map (only available with -t -d options)'  \n");
+    printf("\t\t\t [-j threads] 'threads used to parse the -t file (default one per core, 1 = serial)'  \n");
+    printf("\t\t\t [-l seconds] 'stream per interval deltas as JSON lines, then reset the counts'  \n");
+    printf("\t\t\t [-o target] 'stream output: - (stdout, default), a file name or unix:/path/to/socket'  \n");
     printf("While running the follow keys may be used:\n");
     printf("\t b - sort by Bytes\n");
     printf("\t p - sort by Packets (default)\n");
@@ -75,6 +79,9 @@ int main(int argc, char * const *argv)
         {   "version", no_argument, NULL, 'v' },
         {   "devicemap", required_argument, NULL, 'd' },
         {   "filter", required_argument, NULL, 'f' },
+        {   "threads", required_argument, NULL, 'j' },
+        {   "stream", required_argument, NULL, 'l' },
+        {   "stream_output", required_argument, NULL, 'o' },
         {   NULL, 0, NULL, 0 }
     };
 
@@ -92,7 +99,7 @@ int main(int argc, char * const *argv)
     bool bLiveCapture = true;
     bool bExport = false;
 
-    while ((c = getopt_long(argc, argv, "t:i:m:e:x:svd:f:phb", longopts, NULL)) != -1) {
+    while ((c = getopt_long(argc, argv, "t:i:m:e:x:svd:f:j:l:o:phb", longopts, NULL)) != -1) {
         switch (c) {
             case 't':
                 BjTop.m_pTcpDumpFileName = optarg; // TCP Dump Filename
@@ -123,6 +130,17 @@ int main(int argc, char * const *argv)
             case 'f':
                 BjTop.filterApplicationName = optarg;
                 break;
+            case 'j':
+                sTemp = optarg;                     // parse threads for the trace file
+                BjTop.m_nParseThreads = sTemp.GetUINT32();
+                break;
+            case 'l':
+                sTemp = optarg;                     // time in seconds per streamed interval
+                BjTop.m_StreamSeconds = sTemp.GetUINT32();
+                break;
+            case 'o':
+                BjTop.m_pStreamTarget = optarg;
+                break;
             case 's':
                 BjTop.m_CurrentDisplay = CBonjourTop::BJ_DISPLAY_SERVICE;
                 break;
@@ -144,6 +162,17 @@ int main(int argc, char * const *argv)
         }
     }
 
+    if (BjTop.m_StreamSeconds && BjTop.m_SnapshotSeconds)
+    {
+        printf("-l and -x both reset the counts, use one of them\n");
+        usage();
+        exit(EXIT_FAILURE);
+    }
+
+    // the stream owns stdout
+    if (BjTop.m_StreamSeconds && strcmp(BjTop.m_pStreamTarget, "-") == 0)
+        BjTop.m_bCursers = false;
+
     if (BjTop.m_bCursers)
     {
         signal(SIGWINCH, handle_window_change);
@@ -157,6 +186,8 @@ int main(int argc, char * const *argv)
     else
         BjTop.CaptureFile();
 
+    BjTop.CloseStream();
+
 
     if (bExport)
     {
@@ -107,7 +107,13 @@ typedef struct D2DRecordListElem
                                     // allocated for large records.
 } D2DRecordListElem;
 
-static D2DRecordListElem *D2DRecords = NULL; // List of records returned with D2DServiceFound events
+// In AWDL peer-dense environments there can be a great many records and browses, so both lists are
+// hashed by name, and each D2D callback only has to search the elements in one hash slot.
+#ifndef D2D_HASH_SLOTS
+#define D2D_HASH_SLOTS 64
+#endif
+
+static D2DRecordListElem *D2DRecords[D2D_HASH_SLOTS]; // Lists of records returned with D2DServiceFound events
 
 typedef struct D2DBrowseListElem
 {
@@ -117,7 +123,12 @@ typedef struct D2DBrowseListElem
     unsigned int refCount;
 } D2DBrowseListElem;
 
-D2DBrowseListElem* D2DBrowseList = NULL;
+static D2DBrowseListElem *D2DBrowseList[D2D_HASH_SLOTS];
+
+mDNSlocal D2DRecordListElem **D2DRecordsSlot(const mDNSu32 namehash)
+{
+    return &D2DRecords[namehash % D2D_HASH_SLOTS];
+}
 
 mDNSlocal mDNSu8 *putVal16(mDNSu8 *ptr, mDNSu16 val)
 {
@@ -180,7 +191,7 @@ mDNSlocal void FreeD2DARElemCallback(mDNS *const m, AuthRecord *const rr, mStatu
     (void)m;  // unused
     if (result == mStatus_MemFree)
     {
-        D2DRecordListElem **ptr = &D2DRecords;
+        D2DRecordListElem **ptr = D2DRecordsSlot(rr->resrec.namehash);
         D2DRecordListElem *tmp;
         while (*ptr && &(*ptr)->ar != rr) ptr = &(*ptr)->next;
         if (!*ptr) { LogMsg("FreeD2DARElemCallback: Could not find in D2DRecords: %s", ARDisplayString(m, rr)); return; }
@@ -195,23 +206,28 @@ mDNSlocal void FreeD2DARElemCallback(mDNS *const m, AuthRecord *const rr, mStatu
 mDNSexport void external_connection_release(const domainname *instance)
 {
     (void) instance;
-    D2DRecordListElem *ptr = D2DRecords;
+    unsigned int slot;
 
-    for ( ; ptr ; ptr = ptr->next)
+    // The instance name is in the PTR records' rdata rather than their names, so every slot has to be searched
+    for (slot = 0; slot < D2D_HASH_SLOTS; slot++)
     {
-        if ((ptr->ar.resrec.rrtype == kDNSServiceType_PTR) &&
-             SameDomainName(&ptr->ar.rdatastorage.u.name, instance))
+        D2DRecordListElem *ptr = D2DRecords[slot];
+        for ( ; ptr ; ptr = ptr->next)
         {
-            LogInfo("external_connection_release: Calling D2DRelease(instanceHandle = %p, transportType = %d", 
-                ptr->instanceHandle,  ptr->transportType);
-            if (D2DRelease) D2DRelease(ptr->instanceHandle, ptr->transportType);
+            if ((ptr->ar.resrec.rrtype == kDNSServiceType_PTR) &&
+                 SameDomainName(&ptr->ar.rdatastorage.u.name, instance))
+            {
+                LogInfo("external_connection_release: Calling D2DRelease(instanceHandle = %p, transportType = %d",
+                    ptr->instanceHandle,  ptr->transportType);
+                if (D2DRelease) D2DRelease(ptr->instanceHandle, ptr->transportType);
+            }
         }
     }
 }
 
 mDNSlocal void xD2DClearCache(const domainname *regType, DNS_TypeValues qtype)
 {
-    D2DRecordListElem *ptr = D2DRecords;
+    D2DRecordListElem *ptr = *D2DRecordsSlot(DomainNameHashValue(regType));
     for ( ; ptr ; ptr = ptr->next)
     {
         if ((ptr->ar.resrec.rrtype == qtype) && SameDomainName(&ptr->ar.namestorage, regType))
@@ -224,7 +240,7 @@ mDNSlocal void xD2DClearCache(const domainname *regType, DNS_TypeValues qtype)
 
 mDNSlocal D2DBrowseListElem ** D2DFindInBrowseList(const domainname *const name, mDNSu16 type)
 {
-    D2DBrowseListElem **ptr = &D2DBrowseList;
+    D2DBrowseListElem **ptr = &D2DBrowseList[(DomainNameHashValue(name) + type) % D2D_HASH_SLOTS];
 
     for ( ; *ptr; ptr = &(*ptr)->next)
         if ((*ptr)->type == type && SameDomainName(&(*ptr)->name, name))
@@ -274,7 +290,9 @@ mDNSlocal bool D2DBrowseListRelease(const domainname *const name, mDNSu16 type)
     return true;
 }
 
-mDNSlocal mStatus xD2DParse(const mDNSu8 * const lhs, const mDNSu16 lhs_len, const mDNSu8 * const rhs, const mDNSu16 rhs_len, D2DRecordListElem **D2DListp)
+// Rebuilds the record described by a D2D key and value in m->rec, reusing the static fake wire packet.
+// On success the caller must mark m->rec as no longer in use when it's done with it.
+mDNSlocal mStatus xD2DParseToCacheRecord(const mDNSu8 * const lhs, const mDNSu16 lhs_len, const mDNSu8 * const rhs, const mDNSu16 rhs_len)
 {
     mDNS *const m = &mDNSStorage;
 
@@ -349,9 +367,17 @@ mDNSlocal mStatus xD2DParse(const mDNSu8 * const lhs, const mDNSu16 lhs_len, con
     {
         LogInfo("xD2DParse: got rr: %s", CRDisplayString(m, &m->rec.r));
     }
+    return mStatus_NoError;
+}
+
+mDNSlocal mStatus xD2DParse(const mDNSu8 * const lhs, const mDNSu16 lhs_len, const mDNSu8 * const rhs, const mDNSu16 rhs_len, D2DRecordListElem **D2DListp)
+{
+    mDNS *const m = &mDNSStorage;
+    mStatus err = xD2DParseToCacheRecord(lhs, lhs_len, rhs, rhs_len);
+    if (err) return err;
 
     *D2DListp = (D2DRecordListElem *) mDNSPlatformMemAllocateClear(sizeof(D2DRecordListElem) + (m->rec.r.resrec.rdlength <= sizeof(RDataBody) ? 0 : m->rec.r.resrec.rdlength - sizeof(RDataBody)));
-    if (!*D2DListp) return mStatus_NoMemoryErr;
+    if (!*D2DListp) { m->rec.r.resrec.RecordType = 0; return mStatus_NoMemoryErr; }
 
     AuthRecord *rr = &(*D2DListp)->ar;
     mDNS_SetupResourceRecord(rr, mDNSNULL, mDNSInterface_P2P, m->rec.r.resrec.rrtype, 7200, kDNSRecordTypeShared, AuthRecordP2P, FreeD2DARElemCallback, NULL);
@@ -405,8 +431,9 @@ mDNSexport void xD2DAddToCache(D2DStatus result, D2DServiceInstance instanceHand
         LogInfo("xD2DAddToCache: mDNS_Register succeeded for %s", ARDisplayString(m, &ptr->ar));
         ptr->instanceHandle = instanceHandle;
         ptr->transportType = transportType;
-        ptr->next = D2DRecords;
-        D2DRecords = ptr;
+        D2DRecordListElem **const slot = D2DRecordsSlot(ptr->ar.resrec.namehash);
+        ptr->next = *slot;
+        *slot = ptr;
     }
     else
         LogMsg("xD2DAddToCache: Unexpected result %d", result);
@@ -414,29 +441,27 @@ mDNSexport void xD2DAddToCache(D2DStatus result, D2DServiceInstance instanceHand
 
 mDNSlocal D2DRecordListElem * xD2DFindInList(const Byte *const key, const size_t keySize, const Byte *const value, const size_t valueSize)
 {
-    D2DRecordListElem *ptr = D2DRecords;
-    D2DRecordListElem *arptr = NULL;
+    mDNS *const m = &mDNSStorage;
+    D2DRecordListElem *ptr;
 
     if ( key == NULL || value == NULL || keySize == 0 || valueSize == 0) { LogMsg("xD2DFindInList: NULL Byte * passed in or length == 0"); return NULL; }
 
-    mStatus err = xD2DParse((const mDNSu8 *const)key, (const mDNSu16)keySize, (const mDNSu8 *const)value, (const mDNSu16)valueSize, &arptr);
+    // The record only needs to be compared, so it's parsed into m->rec rather than into a newly allocated element
+    mStatus err = xD2DParseToCacheRecord((const mDNSu8 *const)key, (const mDNSu16)keySize, (const mDNSu8 *const)value, (const mDNSu16)valueSize);
     if (err)
     {
         LogMsg("xD2DFindInList: xD2DParse returned error: %d", err);
         PrintHelper(__func__, (mDNSu8 *)key, (mDNSu16)keySize, (mDNSu8 *)value, (mDNSu16)valueSize);
-        if (arptr)
-            mDNSPlatformMemFree(arptr);
         return NULL;
     }
 
-    while (ptr)
+    for (ptr = *D2DRecordsSlot(m->rec.r.resrec.namehash); ptr; ptr = ptr->next)
     {
-        if (IdenticalResourceRecord(&arptr->ar.resrec, &ptr->ar.resrec)) break;
-        ptr = ptr->next;
+        if (IdenticalResourceRecord(&m->rec.r.resrec, &ptr->ar.resrec)) break;
     }
 
-    if (!ptr) LogMsg("xD2DFindInList: Could not find in D2DRecords: %s", ARDisplayString(&mDNSStorage, &arptr->ar));
-    mDNSPlatformMemFree(arptr);
+    if (!ptr) LogMsg("xD2DFindInList: Could not find in D2DRecords: %s", CRDisplayString(m, &m->rec.r));
+    m->rec.r.resrec.RecordType = 0; // Mark m->rec as no longer in use
     return ptr;
 }
 
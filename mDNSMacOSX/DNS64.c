@@ -42,20 +42,52 @@ check_compile_time(sizeof(kDNS64IPv4OnlyFQDNString) == kDNS64IPv4OnlyFQDNLength)
 check_compile_time(sizeof_field(DNSQuestion, qname) >= kDNS64IPv4OnlyFQDNLength);
 check_compile_time(sizeof_field(DNS64, qnameStash)  == kDNS64IPv4OnlyFQDNLength);
 
+#define kDNS64PrefixCacheSize       4   // Number of DNS services whose NAT64 prefixes are remembered.
+
+//===========================================================================================================================
+//  Types
+//===========================================================================================================================
+
+// The NAT64 prefixes discovered for a DNS service, which stay valid as long as the "ipv4only.arpa." AAAA records from
+// which they were derived.
+
+typedef struct
+{
+#if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+    mdns_dns_service_id_t   serviceID;      // ID of the DNS service that the prefixes were discovered with.
+#else
+    mDNSu32                 resGroupID;     // Resolver group ID of the DNS servers that the prefixes were discovered with.
+#endif
+    nw_nat64_prefix_t *     prefixes;       // The discovered prefixes.
+    uint32_t                prefixCount;    // Number of discovered prefixes.
+    mDNSs32                 expireTime;     // Time when the first of the "ipv4only.arpa." AAAA records expires.
+}   DNS64PrefixCacheEntry;
+
+//===========================================================================================================================
+//  Globals
+//===========================================================================================================================
+
+static DNS64PrefixCacheEntry    gDNS64PrefixCache[kDNS64PrefixCacheSize];
+
 //===========================================================================================================================
 //  Local Prototypes
 //===========================================================================================================================
 
 #if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
-mDNSlocal mStatus   _DNS64GetIPv6Addrs(mDNS *m, mdns_dns_service_t inDNSService, struct in6_addr **outAddrs, uint32_t *outAddrCount);
+mDNSlocal mStatus   _DNS64GetIPv6Addrs(mDNS *m, mdns_dns_service_t inDNSService, struct in6_addr **outAddrs, uint32_t *outAddrCount, mDNSs32 *outExpireTime);
 #else
-mDNSlocal mStatus   _DNS64GetIPv6Addrs(mDNS *m, mDNSu32 inResGroupID, struct in6_addr **outAddrs, uint32_t *outAddrCount);
+mDNSlocal mStatus   _DNS64GetIPv6Addrs(mDNS *m, mDNSu32 inResGroupID, struct in6_addr **outAddrs, uint32_t *outAddrCount, mDNSs32 *outExpireTime);
 #endif
 #if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
 mDNSlocal mStatus   _DNS64GetPrefixes(mDNS *m, mdns_dns_service_t inDNSService, nw_nat64_prefix_t **outPrefixes, uint32_t *outPrefixCount);
 #else
 mDNSlocal mStatus   _DNS64GetPrefixes(mDNS *m, mDNSu32 inResGroupID, nw_nat64_prefix_t **outPrefixes, uint32_t *outPrefixCount);
 #endif
+#if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+mDNSlocal mDNSBool  _DNS64HaveCachedPrefixes(mDNS *m, mdns_dns_service_t inDNSService);
+#else
+mDNSlocal mDNSBool  _DNS64HaveCachedPrefixes(mDNS *m, mDNSu32 inResGroupID);
+#endif
 mDNSlocal mDNSu32   _DNS64IPv4OnlyFQDNHash(void);
 mDNSlocal void      _DNS64RestartQuestion(mDNS *m, DNSQuestion *q, DNS64State newState);
 #if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
@@ -99,7 +131,19 @@ mDNSexport mDNSBool DNS64StateMachine(mDNS *m, DNSQuestion *inQ, const ResourceR
                 _DNS64InterfaceSupportsNAT64((uint32_t)((uintptr_t)inQ->qDNSServer->interface)))
 #endif
             {
-                _DNS64RestartQuestion(m, inQ, kDNS64State_PrefixDiscovery);
+                // If the NAT64 prefixes for this DNS service are already known, then skip prefix discovery.
+#if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+                if (_DNS64HaveCachedPrefixes(m, inQ->dnsservice))
+#else
+                if (_DNS64HaveCachedPrefixes(m, inQ->qDNSServer->resGroupID))
+#endif
+                {
+                    _DNS64RestartQuestion(m, inQ, kDNS64State_QueryA);
+                }
+                else
+                {
+                    _DNS64RestartQuestion(m, inQ, kDNS64State_PrefixDiscovery);
+                }
                 return (mDNStrue);
             }
             else if ((inQ->qtype == kDNSType_PTR) &&
@@ -113,7 +157,18 @@ mDNSexport mDNSBool DNS64StateMachine(mDNS *m, DNSQuestion *inQ, const ResourceR
 #endif
                 GetReverseIPv6Addr(&inQ->qname, NULL))
             {
-                _DNS64RestartQuestion(m, inQ, kDNS64State_PrefixDiscoveryPTR);
+#if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+                if (_DNS64HaveCachedPrefixes(m, inQ->dnsservice))
+#else
+                if (_DNS64HaveCachedPrefixes(m, inQ->qDNSServer->resGroupID))
+#endif
+                {
+                    _DNS64RestartQuestion(m, inQ, kDNS64State_QueryPTR);
+                }
+                else
+                {
+                    _DNS64RestartQuestion(m, inQ, kDNS64State_PrefixDiscoveryPTR);
+                }
                 return (mDNStrue);
             }
         }
@@ -402,9 +457,11 @@ mDNSexport void DNS64RestartQuestions(mDNS *m)
 #endif
 
 #if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
-mDNSlocal mStatus _DNS64GetIPv6Addrs(mDNS *m, mdns_dns_service_t inDNSService, struct in6_addr **outAddrs, uint32_t *outAddrCount)
+mDNSlocal mStatus _DNS64GetIPv6Addrs(mDNS *m, mdns_dns_service_t inDNSService, struct in6_addr **outAddrs, uint32_t *outAddrCount,
+    mDNSs32 *outExpireTime)
 #else
-mDNSlocal mStatus _DNS64GetIPv6Addrs(mDNS *m, const mDNSu32 inResGroupID, struct in6_addr **outAddrs, uint32_t *outAddrCount)
+mDNSlocal mStatus _DNS64GetIPv6Addrs(mDNS *m, const mDNSu32 inResGroupID, struct in6_addr **outAddrs, uint32_t *outAddrCount,
+    mDNSs32 *outExpireTime)
 #endif
 {
     mStatus                 err;
@@ -413,6 +470,7 @@ mDNSlocal mStatus _DNS64GetIPv6Addrs(mDNS *m, const mDNSu32 inResGroupID, struct
     struct in6_addr *       addrs = NULL;
     uint32_t                addrCount;
     uint32_t                recordCount;
+    mDNSs32                 expireTime = 0;
 
     cg = CacheGroupForName(m, _DNS64IPv4OnlyFQDNHash(), kDNS64IPv4OnlyFQDN);
     require_action_quiet(cg, exit, err = mStatus_NoSuchRecord);
@@ -443,7 +501,10 @@ mDNSlocal mStatus _DNS64GetIPv6Addrs(mDNS *m, const mDNSu32 inResGroupID, struct
         if (IsPositiveAAAAFromResGroup(&cr->resrec, inResGroupID))
 #endif
         {
+            const mDNSs32 recordExpireTime = cr->TimeRcvd + (mDNSs32)cr->resrec.rroriginalttl * mDNSPlatformOneSecond;
+
             memcpy(addrs[addrCount].s6_addr, cr->resrec.rdata->u.ipv6.b, 16);
+            if ((addrCount == 0) || ((recordExpireTime - expireTime) < 0)) expireTime = recordExpireTime;
             addrCount++;
         }
     }
@@ -451,6 +512,7 @@ mDNSlocal mStatus _DNS64GetIPv6Addrs(mDNS *m, const mDNSu32 inResGroupID, struct
     *outAddrs = addrs;
     addrs = NULL;
     *outAddrCount = addrCount;
+    *outExpireTime = expireTime;
     err = mStatus_NoError;
 
 exit:
@@ -462,36 +524,131 @@ exit:
 //  _DNS64GetPrefixes
 //===========================================================================================================================
 
+mDNSlocal void _DNS64ForgetPrefixes(DNS64PrefixCacheEntry *inEntry)
+{
+    if (inEntry->prefixes)
+    {
+        free(inEntry->prefixes);
+        inEntry->prefixes = NULL;
+    }
+    inEntry->prefixCount = 0;
+}
+
+#if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+mDNSlocal DNS64PrefixCacheEntry * _DNS64GetPrefixCacheEntry(mDNS *m, mdns_dns_service_t inDNSService)
+#else
+mDNSlocal DNS64PrefixCacheEntry * _DNS64GetPrefixCacheEntry(mDNS *m, mDNSu32 inResGroupID)
+#endif
+{
+    DNS64PrefixCacheEntry *     entry;
+    uint32_t                    i;
+
+    for (i = 0; i < kDNS64PrefixCacheSize; i++)
+    {
+        entry = &gDNS64PrefixCache[i];
+        if (!entry->prefixes) continue;
+        if ((entry->expireTime - m->timenow) <= 0)
+        {
+            // The "ipv4only.arpa." records have expired, so the prefixes need to be discovered again.
+            _DNS64ForgetPrefixes(entry);
+            continue;
+        }
+#if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+        if (entry->serviceID == mdns_dns_service_get_id(inDNSService)) return (entry);
+#else
+        if (entry->resGroupID == inResGroupID) return (entry);
+#endif
+    }
+    return (mDNSNULL);
+}
+
 #if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
 mDNSlocal mStatus _DNS64GetPrefixes(mDNS *m, mdns_dns_service_t inDNSService, nw_nat64_prefix_t **outPrefixes, uint32_t *outPrefixCount)
 #else
 mDNSlocal mStatus _DNS64GetPrefixes(mDNS *m, mDNSu32 inResGroupID, nw_nat64_prefix_t **outPrefixes, uint32_t *outPrefixCount)
 #endif
 {
-    mStatus                 err;
-    struct in6_addr *       v6Addrs;
-    uint32_t                v6AddrCount;
-    nw_nat64_prefix_t *     prefixes;
-    int32_t                 prefixCount;
+    mStatus                     err;
+    struct in6_addr *           v6Addrs;
+    uint32_t                    v6AddrCount;
+    mDNSs32                     expireTime;
+    nw_nat64_prefix_t *         prefixes;
+    int32_t                     prefixCount;
+    nw_nat64_prefix_t *         copy;
+    DNS64PrefixCacheEntry *     entry;
+    uint32_t                    i;
+
+    // Use the prefixes that were previously discovered for the DNS service if the records they came from haven't expired.
+    // Every caller gets its own copy because answering a question can cause the cache entries to change.
 
 #if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
-    err = _DNS64GetIPv6Addrs(m, inDNSService, &v6Addrs, &v6AddrCount);
+    entry = _DNS64GetPrefixCacheEntry(m, inDNSService);
 #else
-    err = _DNS64GetIPv6Addrs(m, inResGroupID, &v6Addrs, &v6AddrCount);
+    entry = _DNS64GetPrefixCacheEntry(m, inResGroupID);
 #endif
-    require_noerr_quiet(err, exit);
+    if (!entry)
+    {
+#if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+        err = _DNS64GetIPv6Addrs(m, inDNSService, &v6Addrs, &v6AddrCount, &expireTime);
+#else
+        err = _DNS64GetIPv6Addrs(m, inResGroupID, &v6Addrs, &v6AddrCount, &expireTime);
+#endif
+        require_noerr_quiet(err, exit);
+
+        prefixCount = nw_nat64_copy_prefixes_from_ipv4only_records(v6Addrs, v6AddrCount, &prefixes);
+        free(v6Addrs);
+        require_action_quiet(prefixCount > 0, exit, err = mStatus_UnknownErr);
+
+        // Reuse an empty entry if there is one. Otherwise, replace the entry that's going to expire the soonest.
+        entry = &gDNS64PrefixCache[0];
+        for (i = 0; i < kDNS64PrefixCacheSize; i++)
+        {
+            if (!gDNS64PrefixCache[i].prefixes)
+            {
+                entry = &gDNS64PrefixCache[i];
+                break;
+            }
+            if ((gDNS64PrefixCache[i].expireTime - entry->expireTime) < 0) entry = &gDNS64PrefixCache[i];
+        }
+        _DNS64ForgetPrefixes(entry);
+#if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+        entry->serviceID    = mdns_dns_service_get_id(inDNSService);
+#else
+        entry->resGroupID   = inResGroupID;
+#endif
+        entry->prefixes     = prefixes;
+        entry->prefixCount  = (uint32_t)prefixCount;
+        entry->expireTime   = expireTime;
+    }
 
-    prefixCount = nw_nat64_copy_prefixes_from_ipv4only_records(v6Addrs, v6AddrCount, &prefixes);
-    free(v6Addrs);
-    require_action_quiet(prefixCount > 0, exit, err = mStatus_UnknownErr);
+    copy = (nw_nat64_prefix_t *)calloc(entry->prefixCount, sizeof(*copy));
+    require_action_quiet(copy, exit, err = mStatus_NoMemoryErr);
+    memcpy(copy, entry->prefixes, entry->prefixCount * sizeof(*copy));
 
-    *outPrefixes    = prefixes;
-    *outPrefixCount = prefixCount;
+    *outPrefixes    = copy;
+    *outPrefixCount = entry->prefixCount;
+    err = mStatus_NoError;
 
 exit:
     return (err);
 }
 
+//===========================================================================================================================
+//  _DNS64HaveCachedPrefixes
+//===========================================================================================================================
+
+#if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+mDNSlocal mDNSBool _DNS64HaveCachedPrefixes(mDNS *m, mdns_dns_service_t inDNSService)
+{
+    return (_DNS64GetPrefixCacheEntry(m, inDNSService) ? mDNStrue : mDNSfalse);
+}
+#else
+mDNSlocal mDNSBool _DNS64HaveCachedPrefixes(mDNS *m, mDNSu32 inResGroupID)
+{
+    return (_DNS64GetPrefixCacheEntry(m, inResGroupID) ? mDNStrue : mDNSfalse);
+}
+#endif
+
 //===========================================================================================================================
 //  _DNS64IPv4OnlyFQDNHash
 //===========================================================================================================================
@@ -93,6 +93,17 @@ mDNSlocal int ProxyTCPRead(ProxyTCPInfo_t *tcpInfo)
         return 1;
 }
 
+// The connection carries any number of queries, so when it goes away the core is told with an empty message,
+// to let it free the clients still waiting on it; the core disposes of the context in turn.
+mDNSlocal void ProxyTCPClose(ProxyTCPInfo_t *ti)
+{
+    mDNSAddr zeroAddr;
+
+    mDNSPlatformMemZero(&zeroAddr, sizeof(zeroAddr));
+    ti->sock.m->p->TCPProxyCallback(&ti->sock, (DNSMessage *)&zeroAddr, (mDNSu8 *)&zeroAddr, &zeroAddr, zeroIPPort,
+        &zeroAddr, zeroIPPort, mDNSInterface_Any, ti);
+}
+
 mDNSlocal void ProxyTCPSocketCallBack(int s1, short filter, void *context, __unused mDNSBool encounteredEOF)
 {
     int ret;
@@ -105,13 +116,15 @@ mDNSlocal void ProxyTCPSocketCallBack(int s1, short filter, void *context, __unu
     struct tcp_info tcp_if;
     socklen_t size = sizeof(tcp_if);
     int32_t intf_id = 0;
+    DNSMessage *reply;
+    mDNSu16 replyLen;
 
     (void) filter;
 
     ret = ProxyTCPRead(ti);
     if (ret == -1)
     {
-        mDNSPlatformDisposeProxyContext(ti);
+        ProxyTCPClose(ti);
         return; 
     }
     else if (!ret)
@@ -119,8 +132,11 @@ mDNSlocal void ProxyTCPSocketCallBack(int s1, short filter, void *context, __unu
         debugf("ProxyTCPReceive: Not yet read completely Actual length %d, Read length %d", ti->replyLen, ti->nread);
         return;
     }
-    // We read all the data and hence not interested in read events anymore
-    KQueueSet(s1, EV_DELETE, EVFILT_READ, &sock->kqEntry);
+    // Get ready for the next query on the connection, which the client may send before this one is answered
+    reply = ti->reply;
+    replyLen = ti->replyLen;
+    ti->reply = mDNSNULL;
+    ti->nread = 0;
 
     mDNSPlatformMemZero(&to, sizeof(to));
     mDNSPlatformMemZero(&from, sizeof(from));
@@ -129,19 +145,22 @@ mDNSlocal void ProxyTCPSocketCallBack(int s1, short filter, void *context, __unu
     if (ret < 0)
     {
         LogMsg("ProxyTCPReceive: getsockname(fd=%d) errno %d", s1, errno);
-        mDNSPlatformDisposeProxyContext(ti);
+        freeL("ProxyTCPInfoLen", reply);
+        ProxyTCPClose(ti);
         return;
     }
     ret = getpeername(s1, (struct sockaddr*) &from, &len);
     if (ret < 0)
     {
         LogMsg("ProxyTCPReceive: getpeername(fd=%d) errno %d", s1, errno);
-        mDNSPlatformDisposeProxyContext(ti);
+        freeL("ProxyTCPInfoLen", reply);
+        ProxyTCPClose(ti);
         return;
     }
     if (getsockopt(s1, IPPROTO_TCP, TCP_INFO, &tcp_if, &size) != 0)
     {
         LogMsg("ProxyTCPReceive: getsockopt for TCP_INFO failed (fd=%d) errno %d", s1, errno);
+        freeL("ProxyTCPInfoLen", reply);
         return;
     }
     intf_id = tcp_if.tcpi_last_outif;
@@ -159,7 +178,7 @@ mDNSlocal void ProxyTCPSocketCallBack(int s1, short filter, void *context, __unu
         destAddr.ip.v4.NotAnInteger = s->sin_addr.s_addr;
 
         LogInfo("ProxyTCPReceive received IPv4 packet(len %d) from %#-15a to %#-15a on skt %d %s ifindex %d",
-                ti->replyLen, &senderAddr, &destAddr, s1, NULL, intf_id);
+                replyLen, &senderAddr, &destAddr, s1, NULL, intf_id);
     }
     else if (from.ss_family == AF_INET6)
     {
@@ -173,20 +192,22 @@ mDNSlocal void ProxyTCPSocketCallBack(int s1, short filter, void *context, __unu
         destAddr.ip.v6 = *(mDNSv6Addr*)&sin6->sin6_addr;
 
         LogInfo("ProxyTCPReceive received IPv6 packet(len %d) from %#-15a to %#-15a on skt %d %s ifindex %d",
-                ti->replyLen, &senderAddr, &destAddr, s1, NULL, intf_id);
+                replyLen, &senderAddr, &destAddr, s1, NULL, intf_id);
     }
     else
     {
         LogMsg("ProxyTCPReceive from is unknown address family %d", from.ss_family);
-        mDNSPlatformDisposeProxyContext(ti);
+        freeL("ProxyTCPInfoLen", reply);
+        ProxyTCPClose(ti);
         return;
     }
 
     // We pass sock for the TCPSocket and the "ti" for context as that's what we want to free at the end.
     // In the UDP case, there is just a single socket and nothing to free. Hence, the context (last argument)
-    // would be NULL.
-    ti->sock.m->p->TCPProxyCallback(sock, ti->reply, (mDNSu8 *)ti->reply + ti->replyLen, &senderAddr, senderPort, &destAddr,
+    // would be NULL. The core may dispose of "ti" before returning, so it isn't touched afterwards.
+    ti->sock.m->p->TCPProxyCallback(sock, reply, (mDNSu8 *)reply + replyLen, &senderAddr, senderPort, &destAddr,
         UnicastDNSPort, (mDNSInterfaceID)(uintptr_t)intf_id, ti);
+    freeL("ProxyTCPInfoLen", reply);
 }
 
 mDNSlocal void ProxyTCPAccept(int s1, short filter, void *context, __unused mDNSBool encounteredEOF)
@@ -77,6 +77,10 @@ shared_session(dispatch_queue_t queue)
 			configuration._allowsTLSSessionTickets = YES;
 			configuration._allowsTCPFastOpen = YES;
 
+			// DoH servers speak HTTP/2, so all queries to a server are multiplexed over a single connection instead of
+			// paying for a new TCP and TLS handshake when several queries are outstanding.
+			configuration.HTTPMaximumConnectionsPerHost = 1;
+
 			NSOperationQueue *operationQueue = [[NSOperationQueue alloc] init];
 			operationQueue.underlyingQueue = queue;
 			session = [NSURLSession sessionWithConfiguration:configuration
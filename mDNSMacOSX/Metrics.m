@@ -78,6 +78,12 @@ SOFT_LINK_CLASS(WirelessDiagnostics, AWDMDNSResponderDNSMessageSizeStats)
 #define kQueryStatsLatencyBinCount          55
 #define kQueryStatsExpiredAnswerStateCount  (ExpiredAnswer_EnumCount)
 #define kQueryStatsDNSOverTCPStateCount     (DNSOverTCP_EnumCount)
+#define kQueryStatsNetworkCount             2       // Non-cellular, cellular.
+#define kQueryStatsRecordTypeCount          2       // A, AAAA.
+#define kQueryStatsDomainCount              11      // Must match countof(kQueryStatsArgs).
+#define kQueryStatsDomainSetValid           0x8000  // Set in a cached domain set once the query name has been classified.
+
+check_compile_time(kQueryStatsDomainCount < 16);
 
 //===========================================================================================================================
 //  Data structures
@@ -86,17 +92,16 @@ SOFT_LINK_CLASS(WirelessDiagnostics, AWDMDNSResponderDNSMessageSizeStats)
 // Data structures for query stats.
 
 typedef struct QueryStats       QueryStats;
-typedef struct DNSHistSet       DNSHistSet;
 typedef mDNSBool                (*QueryNameTest_f)(const QueryStats *inStats, const domainname *inQueryName);
 
+// A QueryStats only describes a domain. Its histograms live in the fixed gQueryStatsCounters table, indexed by the
+// QueryStats' position in gQueryStats, so that counting an answer never allocates or walks a list.
+
 struct QueryStats
 {
-    QueryStats *        next;           // Pointer to next domain stats in list.
     const char *        domainStr;      // Domain (see below) as a C string.
     uint8_t *           domain;         // Domain for which these stats are collected.
     const char *        altDomainStr;   // Alt domain string to use in the AWD version of the stats instead of domainStr.
-    DNSHistSet *        nonCellular;    // Query stats for queries sent over non-cellular interfaces.
-    DNSHistSet *        cellular;       // Query stats for queries sent over cellular interfaces.
     QueryNameTest_f     test;           // Function that tests whether a given query's stats belong based on the query name.
     int                 labelCount;     // Number of labels in domain name. Used for domain name comparisons.
     mDNSBool            terminal;       // If true and test passes, then no other QueryStats on the list should be visited.
@@ -164,11 +169,15 @@ check_compile_time(countof_field(DNSHist, unansweredQueryDurationBins) == (count
 check_compile_time(countof_field(DNSHist, responseLatencyBins)         == (countof(kResponseLatencyMsLimits) + 1));
 check_compile_time(countof_field(DNSHist, negResponseLatencyBins)      == (countof(kResponseLatencyMsLimits) + 1));
 
-struct DNSHistSet
+// All of the query stats histograms, indexed by domain, network type (non-cellular, cellular) and record type (A, AAAA).
+// used[net][type] has bit i set if hist[i][net][type] has been updated since the last submission.
+
+typedef struct
 {
-    DNSHist *       histA;      // Histogram data for queries for A resource records.
-    DNSHist *       histAAAA;   // Histogram data for queries for AAAA resource records.
-};
+    DNSHist     hist[kQueryStatsDomainCount][kQueryStatsNetworkCount][kQueryStatsRecordTypeCount];
+    uint16_t    used[kQueryStatsNetworkCount][kQueryStatsRecordTypeCount];
+
+}   QueryStatsCounters;
 
 typedef struct
 {
@@ -212,27 +221,22 @@ check_compile_time(sizeof(DNSMessageSizeStats) <= 264);
 
 // Query stats
 
-mDNSlocal mStatus       QueryStatsCreate(const char *inDomainStr, const char *inAltDomainStr, QueryNameTest_f inTest, mDNSBool inTerminal, QueryStats **outStats);
-mDNSlocal void          QueryStatsFree(QueryStats *inStats);
-mDNSlocal void          QueryStatsFreeList(QueryStats *inList);
-mDNSlocal mStatus       QueryStatsUpdate(QueryStats *inStats, int inType, const ResourceRecord *inRR, mDNSu32 inQuerySendCount, ExpiredAnswerMetric inExpiredAnswerState, DNSOverTCPMetric inDNSOverTCPState, mDNSu32 inLatencyMs, mDNSBool inForCell);
+mDNSlocal mStatus       QueryStatsInit(QueryStats *inStats, const char *inDomainStr, const char *inAltDomainStr, QueryNameTest_f inTest, mDNSBool inTerminal);
+mDNSlocal uint16_t      QueryStatsClassify(const domainname *inQueryName);
+mDNSlocal void          QueryStatsUpdate(DNSHist *inHist, const ResourceRecord *inRR, mDNSu32 inQuerySendCount, ExpiredAnswerMetric inExpiredAnswerState, DNSOverTCPMetric inDNSOverTCPState, mDNSu32 inLatencyMs);
+mDNSlocal int           QueryStatsLatencyBin(mDNSu32 inLatencyMs);
 mDNSlocal const char *  QueryStatsGetDomainString(const QueryStats *inStats);
 mDNSlocal mDNSBool      QueryStatsDomainTest(const QueryStats *inStats, const domainname *inQueryName);
 mDNSlocal mDNSBool      QueryStatsHostnameTest(const QueryStats *inStats, const domainname *inQueryName);
 mDNSlocal mDNSBool      QueryStatsContentiCloudTest(const QueryStats *inStats, const domainname *inQueryName);
 mDNSlocal mDNSBool      QueryStatsCourierPushTest(const QueryStats *inStats, const domainname *inQueryName);
 
-// DNS message size stats
-
-mDNSlocal mStatus   DNSMessageSizeStatsCreate(DNSMessageSizeStats **outStats);
-mDNSlocal void      DNSMessageSizeStatsFree(DNSMessageSizeStats *inStats);
-
-mDNSlocal mStatus   CreateQueryStatsList(QueryStats **outList);
+mDNSlocal mStatus   CreateQueryStatsTable(void);
 mDNSlocal mStatus   SubmitAWDMetric(UInt32 inMetricID);
 mDNSlocal mStatus   SubmitAWDMetricQueryStats(void);
 mDNSlocal mStatus   SubmitAWDMetricDNSMessageSizeStats(void);
-mDNSlocal mStatus   CreateAWDDNSDomainStats(DNSHist *inHist, const char *inDomain, mDNSBool inForCell, AWDDNSDomainStats_RecordType inType, AWDDNSDomainStats **outStats);
-mDNSlocal void      LogDNSHistSetToFD(int fd, const DNSHistSet *inSet, const char *inDomain, mDNSBool inForCell);
+mDNSlocal mStatus   CreateAWDDNSDomainStats(const DNSHist *inHist, const char *inDomain, mDNSBool inForCell, AWDDNSDomainStats_RecordType inType, AWDDNSDomainStats **outStats);
+mDNSlocal void      LogDNSHistSetToFD(int fd, const QueryStatsCounters *inCounters, int inDomainIndex, const char *inDomain, mDNSBool inForCell);
 mDNSlocal void      LogDNSHistToFD(int fd, const DNSHist *inHist, const char *inDomain, mDNSBool inForCell, const char *inType);
 mDNSlocal void      LogDNSHistSendCountsToFD(int fd, const uint16_t inSendCountBins[kQueryStatsSendCountBinCount]);
 mDNSlocal void      LogDNSHistLatenciesToFD(int fd, const uint16_t inLatencyBins[kQueryStatsLatencyBinCount]);
@@ -256,7 +260,7 @@ INCREMENT_BIN_DEFINITION(32);
 //  bin and all bins with non-zero values.
 
 #define COPY_BINS_DEFINITION(BIN_SIZE) \
-    mDNSlocal size_t CopyBins ## BIN_SIZE (uint32_t *inDstBins, uint ## BIN_SIZE ## _t *inSrcBins, size_t inBinCount) \
+    mDNSlocal size_t CopyBins ## BIN_SIZE (uint32_t *inDstBins, const uint ## BIN_SIZE ## _t *inSrcBins, size_t inBinCount) \
     { \
         if (inBinCount == 0) return (0); \
         size_t minCount = 1; \
@@ -276,9 +280,12 @@ COPY_BINS_DEFINITION(32);
 //  Globals
 //===========================================================================================================================
 
-static AWDServerConnection *        gAWDServerConnection    = nil;
-static QueryStats *                 gQueryStatsList         = NULL;
-static DNSMessageSizeStats *        gDNSMessageSizeStats    = NULL;
+static AWDServerConnection *        gAWDServerConnection        = nil;
+static QueryStats                   gQueryStats[kQueryStatsDomainCount];
+static mDNSBool                     gQueryStatsReady            = mDNSfalse;
+static QueryStatsCounters           gQueryStatsCounters;
+static mDNSBool                     gDNSMessageSizeStatsReady   = mDNSfalse;
+static DNSMessageSizeStats          gDNSMessageSizeStats;
 
 // Important: Do not add to this list without getting privacy approval. See <rdar://problem/24155761&26397203&34763471>.
 
@@ -297,7 +304,7 @@ static const QueryStatsArgs     kQueryStatsArgs[] =
     { "qq.com.",                NULL,                               QueryStatsDomainTest,           mDNStrue  }
 };
 
-check_compile_time(countof(kQueryStatsArgs) == 11);
+check_compile_time(countof(kQueryStatsArgs) == kQueryStatsDomainCount);
 
 //===========================================================================================================================
 //  MetricsInit
@@ -342,8 +349,8 @@ mStatus MetricsInit(void)
 
     if( gAWDServerConnection )
     {
-        CreateQueryStatsList(&gQueryStatsList);
-        DNSMessageSizeStatsCreate(&gDNSMessageSizeStats);
+        if (CreateQueryStatsTable() == mStatus_NoError) gQueryStatsReady = mDNStrue;
+        gDNSMessageSizeStatsReady = mDNStrue;
     }
 
     return (mStatus_NoError);
@@ -353,21 +360,33 @@ mStatus MetricsInit(void)
 //  MetricsUpdateDNSQueryStats
 //===========================================================================================================================
 
-mDNSexport void MetricsUpdateDNSQueryStats(const domainname *inQueryName, mDNSu16 inType, const ResourceRecord *inRR, mDNSu32 inSendCount, ExpiredAnswerMetric inExpiredAnswerState, DNSOverTCPMetric inDNSOverTCPState, mDNSu32 inLatencyMs, mDNSBool inForCell)
+//  Which domains a query's stats belong to only depends on the query name, so it's worked out the first time the question
+//  is counted and cached in *ioDomainSet (the question's metrics.queryStatsDomains). After that, counting an answer is
+//  just a few increments in gQueryStatsCounters.
+
+mDNSexport void MetricsUpdateDNSQueryStats(const domainname *inQueryName, mDNSu16 *ioDomainSet, mDNSu16 inType, const ResourceRecord *inRR, mDNSu32 inSendCount, ExpiredAnswerMetric inExpiredAnswerState, DNSOverTCPMetric inDNSOverTCPState, mDNSu32 inLatencyMs, mDNSBool inForCell)
 {
-    QueryStats *        stats;
-    mDNSBool            match;
+    uint16_t            domains;
+    const int           net  = inForCell ? 1 : 0;
+    const int           type = (inType == kDNSType_A) ? 0 : 1;
+    int                 i;
 
-    require_quiet(gAWDServerConnection, exit);
+    require_quiet(gQueryStatsReady, exit);
     require_quiet((inType == kDNSType_A) || (inType == kDNSType_AAAA), exit);
+    require_quiet(inRR || (inSendCount > 0), exit);
+
+    if (!(*ioDomainSet & kQueryStatsDomainSetValid))
+    {
+        *ioDomainSet = QueryStatsClassify(inQueryName) | kQueryStatsDomainSetValid;
+    }
+    domains = *ioDomainSet & (uint16_t)~kQueryStatsDomainSetValid;
+    gQueryStatsCounters.used[net][type] |= domains;
 
-    for (stats = gQueryStatsList; stats; stats = stats->next)
+    for (i = 0; domains; ++i, domains >>= 1)
     {
-        match = stats->test(stats, inQueryName);
-        if (match)
+        if (domains & 1)
         {
-            QueryStatsUpdate(stats, inType, inRR, inSendCount, inExpiredAnswerState, inDNSOverTCPState, inLatencyMs, inForCell);
-            if (stats->terminal) break;
+            QueryStatsUpdate(&gQueryStatsCounters.hist[i][net][type], inRR, inSendCount, inExpiredAnswerState, inDNSOverTCPState, inLatencyMs);
         }
     }
 
@@ -383,8 +402,8 @@ mDNSlocal void UpdateMessageSizeCounts(uint32_t *inBins, size_t inBinCount, unsi
 
 mDNSexport void MetricsUpdateDNSQuerySize(mDNSu32 inSize)
 {
-    if (!gDNSMessageSizeStats) return;
-    UpdateMessageSizeCounts(gDNSMessageSizeStats->querySizeBins, kQuerySizeBinCount, kQuerySizeBinWidth, inSize);
+    if (!gDNSMessageSizeStatsReady) return;
+    UpdateMessageSizeCounts(gDNSMessageSizeStats.querySizeBins, kQuerySizeBinCount, kQuerySizeBinWidth, inSize);
 }
 
 mDNSlocal void UpdateMessageSizeCounts(uint32_t *inBins, size_t inBinCount, unsigned int inBinWidth, uint32_t inSize)
@@ -403,8 +422,8 @@ mDNSlocal void UpdateMessageSizeCounts(uint32_t *inBins, size_t inBinCount, unsi
 
 mDNSexport void MetricsUpdateDNSResponseSize(mDNSu32 inSize)
 {
-    if (!gDNSMessageSizeStats) return;
-    UpdateMessageSizeCounts(gDNSMessageSizeStats->responseSizeBins, kResponseSizeBinCount, kResponseSizeBinWidth, inSize);
+    if (!gDNSMessageSizeStatsReady) return;
+    UpdateMessageSizeCounts(gDNSMessageSizeStats.responseSizeBins, kResponseSizeBinCount, kResponseSizeBinWidth, inSize);
 }
 
 //===========================================================================================================================
@@ -413,33 +432,38 @@ mDNSexport void MetricsUpdateDNSResponseSize(mDNSu32 inSize)
 
 mDNSexport void LogMetricsToFD(int fd)
 {
-    QueryStats *        stats;
+    const QueryStatsCounters * const    counters = &gQueryStatsCounters;
+    int                                 i;
 
     LogToFD(fd, "gAWDServerConnection %p", gAWDServerConnection);
     LogToFD(fd, "---- DNS query stats by domain -----");
-
-    for (stats = gQueryStatsList; stats; stats = stats->next)
+    for (i = 0; gQueryStatsReady && (i < kQueryStatsDomainCount); ++i)
     {
-        if (!stats->nonCellular && !stats->cellular)
+        const char * const      domainStr   = QueryStatsGetDomainString(&gQueryStats[i]);
+        const uint16_t          mask        = (uint16_t)(1U << i);
+        const mDNSBool          nonCell     = ((counters->used[0][0] | counters->used[0][1]) & mask) ? mDNStrue : mDNSfalse;
+        const mDNSBool          cell        = ((counters->used[1][0] | counters->used[1][1]) & mask) ? mDNStrue : mDNSfalse;
+
+        if (!nonCell && !cell)
         {
-            LogToFD(fd, "No data for %s", QueryStatsGetDomainString(stats));
+            LogToFD(fd, "No data for %s", domainStr);
             continue;
         }
-        if (stats->nonCellular) LogDNSHistSetToFD(fd, stats->nonCellular, QueryStatsGetDomainString(stats), mDNSfalse);
-        if (stats->cellular)    LogDNSHistSetToFD(fd, stats->cellular,    QueryStatsGetDomainString(stats), mDNStrue);
+        if (nonCell) LogDNSHistSetToFD(fd, counters, i, domainStr, mDNSfalse);
+        if (cell)    LogDNSHistSetToFD(fd, counters, i, domainStr, mDNStrue);
     }
 
     LogToFD(fd, "---- Num of Services Registered -----");
     LogToFD(fd, "Current_number_of_services_registered :[%d], Max_number_of_services_registered :[%d]",
               curr_num_regservices, max_num_regservices);
 
-    if (gDNSMessageSizeStats)
+    if (gDNSMessageSizeStatsReady)
     {
         LogToFD(fd, "---- DNS query size stats ---");
-        LogDNSMessageSizeStatsToFD(fd, gDNSMessageSizeStats->querySizeBins, kQuerySizeBinCount, kQuerySizeBinWidth);
+        LogDNSMessageSizeStatsToFD(fd, gDNSMessageSizeStats.querySizeBins, kQuerySizeBinCount, kQuerySizeBinWidth);
 
         LogToFD(fd, "-- DNS response size stats --");
-        LogDNSMessageSizeStatsToFD(fd, gDNSMessageSizeStats->responseSizeBins, kResponseSizeBinCount, kResponseSizeBinWidth);
+        LogDNSMessageSizeStatsToFD(fd, gDNSMessageSizeStats.responseSizeBins, kResponseSizeBinCount, kResponseSizeBinWidth);
     }
     else
     {
@@ -448,34 +472,27 @@ mDNSexport void LogMetricsToFD(int fd)
 }
 
 //===========================================================================================================================
-//  QueryStatsCreate
+//  QueryStatsInit
 //===========================================================================================================================
 
 mDNSlocal mStatus StringToDomainName(const char *inString, uint8_t **outDomainName);
 
-mDNSlocal mStatus QueryStatsCreate(const char *inDomainStr, const char *inAltDomainStr, QueryNameTest_f inTest, mDNSBool inTerminal, QueryStats **outStats)
+mDNSlocal mStatus QueryStatsInit(QueryStats *inStats, const char *inDomainStr, const char *inAltDomainStr, QueryNameTest_f inTest, mDNSBool inTerminal)
 {
-    mStatus             err;
-    QueryStats *        obj;
-
-    obj = (QueryStats *)calloc(1, sizeof(*obj));
-    require_action_quiet(obj, exit, err = mStatus_NoMemoryErr);
+    mStatus     err;
 
-    obj->domainStr = inDomainStr;
-    err = StringToDomainName(obj->domainStr, &obj->domain);
+    memset(inStats, 0, sizeof(*inStats));
+    inStats->domainStr = inDomainStr;
+    err = StringToDomainName(inStats->domainStr, &inStats->domain);
     require_noerr_quiet(err, exit);
 
-    obj->altDomainStr   = inAltDomainStr;
-    obj->test           = inTest;
-    obj->labelCount     = CountLabels((const domainname *)obj->domain);
-    obj->terminal       = inTerminal;
-
-    *outStats = obj;
-    obj = NULL;
+    inStats->altDomainStr   = inAltDomainStr;
+    inStats->test           = inTest;
+    inStats->labelCount     = CountLabels((const domainname *)inStats->domain);
+    inStats->terminal       = inTerminal;
     err = mStatus_NoError;
 
 exit:
-    if (obj) QueryStatsFree(obj);
     return (err);
 }
 
@@ -512,107 +529,78 @@ exit:
 }
 
 //===========================================================================================================================
-//  QueryStatsFree
+//  QueryStatsClassify
 //===========================================================================================================================
 
-mDNSlocal void QueryStatsFree(QueryStats *inStats)
-{
-    ForgetMem(&inStats->domain);
-    if (inStats->nonCellular)
-    {
-        ForgetMem(&inStats->nonCellular->histA);
-        ForgetMem(&inStats->nonCellular->histAAAA);
-        free(inStats->nonCellular);
-        inStats->nonCellular = NULL;
-    }
-    if (inStats->cellular)
-    {
-        ForgetMem(&inStats->cellular->histA);
-        ForgetMem(&inStats->cellular->histAAAA);
-        free(inStats->cellular);
-        inStats->cellular = NULL;
-    }
-    free(inStats);
-}
-
-//===========================================================================================================================
-//  QueryStatsFreeList
-//===========================================================================================================================
+//  Returns the set of gQueryStats entries, as a bit mask of their indexes, whose stats a query for inQueryName counts
+//  towards.
 
-mDNSlocal void QueryStatsFreeList(QueryStats *inList)
+mDNSlocal uint16_t QueryStatsClassify(const domainname *inQueryName)
 {
-    QueryStats *        stats;
+    uint16_t        domains = 0;
+    int             i;
 
-    while ((stats = inList) != NULL)
+    for (i = 0; i < kQueryStatsDomainCount; ++i)
     {
-        inList = stats->next;
-        QueryStatsFree(stats);
+        const QueryStats * const    stats = &gQueryStats[i];
+
+        if (stats->test(stats, inQueryName))
+        {
+            domains |= (uint16_t)(1U << i);
+            if (stats->terminal) break;
+        }
     }
+    return (domains);
 }
 
 //===========================================================================================================================
 //  QueryStatsUpdate
 //===========================================================================================================================
 
-mDNSlocal mStatus QueryStatsUpdate(QueryStats *inStats, int inType, const ResourceRecord *inRR, mDNSu32 inQuerySendCount, ExpiredAnswerMetric inExpiredAnswerState, DNSOverTCPMetric inDNSOverTCPState, mDNSu32 inLatencyMs, mDNSBool inForCell)
+mDNSlocal void QueryStatsUpdate(DNSHist *inHist, const ResourceRecord *inRR, mDNSu32 inQuerySendCount, ExpiredAnswerMetric inExpiredAnswerState, DNSOverTCPMetric inDNSOverTCPState, mDNSu32 inLatencyMs)
 {
-    mStatus             err;
-    DNSHistSet *        set;
-    DNSHistSet **       pSet;
-    DNSHist *           hist;
-    DNSHist **          pHist;
-    int                 i;
-
-    require_action_quiet(inRR || (inQuerySendCount > 0), exit, err = mStatus_NoError);
-    require_action_quiet((inType == kDNSType_A) || (inType == kDNSType_AAAA), exit, err = mStatus_NoError);
-
-    pSet = inForCell ? &inStats->cellular : &inStats->nonCellular;
-    if ((set = *pSet) == NULL)
-    {
-        set = (DNSHistSet *)calloc(1, sizeof(*set));
-        require_action_quiet(set, exit, err = mStatus_NoMemoryErr);
-        *pSet = set;
-    }
-    pHist = (inType == kDNSType_A) ? &set->histA : &set->histAAAA;
-    if ((hist = *pHist) == NULL)
-    {
-        hist = (DNSHist *)calloc(1, sizeof(*hist));
-        require_action_quiet(hist, exit, err = mStatus_NoMemoryErr);
-        *pHist = hist;
-    }
+    const int       sendCountBin = (int)Min(inQuerySendCount, kQueryStatsMaxQuerySendCount);
 
     if (inRR)
     {
-        uint16_t *          sendCountBins;
-        uint16_t *          latencyBins;
         const mDNSBool      isNegative = (inRR->RecordType == kDNSRecordTypePacketNegative);
 
-        i = Min(inQuerySendCount, kQueryStatsMaxQuerySendCount);
-
-        sendCountBins = isNegative ? hist->negAnsweredQuerySendCountBins : hist->answeredQuerySendCountBins;
-        IncrementBin16(&sendCountBins[i]);
-
+        IncrementBin16(isNegative ? &inHist->negAnsweredQuerySendCountBins[sendCountBin] : &inHist->answeredQuerySendCountBins[sendCountBin]);
         if (inQuerySendCount > 0)
         {
-            for (i = 0; (i < (int)countof(kResponseLatencyMsLimits)) && (inLatencyMs >= kResponseLatencyMsLimits[i]); ++i) {}
-            latencyBins = isNegative ? hist->negResponseLatencyBins : hist->responseLatencyBins;
-            IncrementBin16(&latencyBins[i]);
+            const int       latencyBin = QueryStatsLatencyBin(inLatencyMs);
+            IncrementBin16(isNegative ? &inHist->negResponseLatencyBins[latencyBin] : &inHist->responseLatencyBins[latencyBin]);
         }
     }
     else
     {
-        i = Min(inQuerySendCount, kQueryStatsMaxQuerySendCount);
-        IncrementBin16(&hist->unansweredQuerySendCountBins[i]);
-
-        for (i = 0; (i < (int)countof(kResponseLatencyMsLimits)) && (inLatencyMs >= kResponseLatencyMsLimits[i]); ++i) {}
-        IncrementBin16(&hist->unansweredQueryDurationBins[i]);
+        IncrementBin16(&inHist->unansweredQuerySendCountBins[sendCountBin]);
+        IncrementBin16(&inHist->unansweredQueryDurationBins[QueryStatsLatencyBin(inLatencyMs)]);
     }
-    IncrementBin32(&hist->expiredAnswerStateBins[Min(inExpiredAnswerState, (kQueryStatsExpiredAnswerStateCount - 1))]);
-    IncrementBin32(&hist->dnsOverTCPStateBins[Min(inDNSOverTCPState, (kQueryStatsDNSOverTCPStateCount - 1))]);
-    err = mStatus_NoError;
+    IncrementBin32(&inHist->expiredAnswerStateBins[Min(inExpiredAnswerState, (kQueryStatsExpiredAnswerStateCount - 1))]);
+    IncrementBin32(&inHist->dnsOverTCPStateBins[Min(inDNSOverTCPState, (kQueryStatsDNSOverTCPStateCount - 1))]);
+}
 
-exit:
-    return (err);
+//===========================================================================================================================
+//  QueryStatsLatencyBin
+//===========================================================================================================================
+
+//  Returns the index of the first kResponseLatencyMsLimits upper bound that inLatencyMs is below, or the index of the
+//  unbounded last bin.
+
+mDNSlocal int QueryStatsLatencyBin(mDNSu32 inLatencyMs)
+{
+    int     lo = 0;
+    int     hi = (int)countof(kResponseLatencyMsLimits);
+
+    while (lo < hi)
+    {
+        const int   mid = (lo + hi) / 2;
+
+        if (inLatencyMs >= kResponseLatencyMsLimits[mid]) lo = mid + 1;
+        else                                               hi = mid;
+    }
+    return (lo);
 }
 
 //===========================================================================================================================
@@ -747,62 +735,24 @@ mDNSlocal mDNSBool QueryStatsCourierPushTest(const QueryStats *inStats, const do
 }
 
 //===========================================================================================================================
-//  DNSMessageSizeStatsCreate
+//  CreateQueryStatsTable
 //===========================================================================================================================
 
-mDNSlocal mStatus DNSMessageSizeStatsCreate(DNSMessageSizeStats **outStats)
+mDNSlocal mStatus CreateQueryStatsTable(void)
 {
-    mStatus                     err;
-    DNSMessageSizeStats *       stats;
-
-    stats = (DNSMessageSizeStats *)calloc(1, sizeof(*stats));
-    require_action_quiet(stats, exit, err = mStatus_NoMemoryErr);
-
-    *outStats = stats;
-    err = mStatus_NoError;
-
-exit:
-    return (err);
-}
-
-//===========================================================================================================================
-//  DNSMessageSizeStatsFree
-//===========================================================================================================================
-
-mDNSlocal void DNSMessageSizeStatsFree(DNSMessageSizeStats *inStats)
-{
-    free(inStats);
-}
-
-//===========================================================================================================================
-//  CreateQueryStatsList
-//===========================================================================================================================
+    mStatus     err;
+    int         i;
 
-mDNSlocal mStatus CreateQueryStatsList(QueryStats **outList)
-{
-    mStatus                             err;
-    QueryStats **                       p;
-    QueryStats *                        stats;
-    const QueryStatsArgs *              args;
-    const QueryStatsArgs * const        end     = kQueryStatsArgs + countof(kQueryStatsArgs);
-    QueryStats *                        list    = NULL;
-
-    p = &list;
-    for (args = kQueryStatsArgs; args < end; ++args)
+    for (i = 0; i < kQueryStatsDomainCount; ++i)
     {
-        err = QueryStatsCreate(args->domainStr, args->altDomainStr, args->test, args->terminal, &stats);
-        require_noerr_quiet(err, exit);
+        const QueryStatsArgs * const    args = &kQueryStatsArgs[i];
 
-        *p = stats;
-        p = &stats->next;
+        err = QueryStatsInit(&gQueryStats[i], args->domainStr, args->altDomainStr, args->test, args->terminal);
+        require_noerr_quiet(err, exit);
     }
-
-    *outList = list;
-    list = NULL;
     err = mStatus_NoError;
 
 exit:
-    QueryStatsFreeList(list);
     return (err);
 }
 
@@ -846,25 +796,26 @@ mDNSlocal mStatus SubmitAWDMetric(UInt32 inMetricID)
 //  SubmitAWDMetricQueryStats
 //===========================================================================================================================
 
-mDNSlocal mStatus   AddQueryStats(AWDMDNSResponderDNSStatistics *inMetric, const QueryStats *inStats);
-mDNSlocal mStatus   AddDNSHistSet(AWDMDNSResponderDNSStatistics *inMetric, DNSHistSet *inSet, const char *inDomain, mDNSBool inForCell);
+mDNSlocal mStatus   AddDNSHistSet(AWDMDNSResponderDNSStatistics *inMetric, const QueryStatsCounters *inCounters, int inDomainIndex, mDNSBool inForCell);
 
 mDNSlocal mStatus SubmitAWDMetricQueryStats(void)
 {
     mStatus                             err;
     BOOL                                success;
-    QueryStats *                        stats;
-    QueryStats *                        statsList;
-    QueryStats *                        newStatsList;
+    int                                 i;
+    QueryStatsCounters *                counters;
     AWDMetricContainer *                container   = nil;
     AWDMDNSResponderDNSStatistics *     metric      = nil;
 
-    newStatsList = NULL;
-    CreateQueryStatsList(&newStatsList);
+    // Take the counters accumulated since the last submission and start over with zeroed ones. The AWD objects are built
+    // from the copy, so the KQueue lock is only held for the copy.
+
+    counters = (QueryStatsCounters *)malloc(sizeof(*counters));
+    require_action_quiet(counters, exit, err = mStatus_NoMemoryErr);
 
     KQueueLock();
-    statsList       = gQueryStatsList;
-    gQueryStatsList = newStatsList;
+    memcpy(counters, &gQueryStatsCounters, sizeof(*counters));
+    memset(&gQueryStatsCounters, 0, sizeof(gQueryStatsCounters));
     KQueueUnlock("SubmitAWDMetricQueryStats");
 
     container = [gAWDServerConnection newMetricContainerWithIdentifier:AWDMetricId_MDNSResponder_DNSStatistics];
@@ -873,13 +824,13 @@ mDNSlocal mStatus SubmitAWDMetricQueryStats(void)
     metric = [[AWDMDNSResponderDNSStatisticsSoft alloc] init];
     require_action_quiet(metric, exit, err = mStatus_UnknownErr);
 
-    while ((stats = statsList) != NULL)
+    for (i = 0; gQueryStatsReady && (i < kQueryStatsDomainCount); ++i)
     {
-        err = AddQueryStats(metric, stats);
+        err = AddDNSHistSet(metric, counters, i, mDNSfalse);
         require_noerr_quiet(err, exit);
 
-        statsList = stats->next;
-        QueryStatsFree(stats);
+        err = AddDNSHistSet(metric, counters, i, mDNStrue);
+        require_noerr_quiet(err, exit);
     }
 
     container.metric = metric;
@@ -888,45 +839,28 @@ mDNSlocal mStatus SubmitAWDMetricQueryStats(void)
     err = success ? mStatus_NoError : mStatus_UnknownErr;
 
 exit:
-    QueryStatsFreeList(statsList);
-    return (err);
-}
-
-mDNSlocal mStatus AddQueryStats(AWDMDNSResponderDNSStatistics *inMetric, const QueryStats *inStats)
-{
-    mStatus     err;
-
-    if (inStats->nonCellular)
-    {
-        err = AddDNSHistSet(inMetric, inStats->nonCellular, QueryStatsGetDomainString(inStats), mDNSfalse);
-        require_noerr_quiet(err, exit);
-    }
-    if (inStats->cellular)
-    {
-        err = AddDNSHistSet(inMetric, inStats->cellular, QueryStatsGetDomainString(inStats), mDNStrue);
-        require_noerr_quiet(err, exit);
-    }
-    err = mStatus_NoError;
-
-exit:
+    ForgetMem(&counters);
     return (err);
 }
 
-mDNSlocal mStatus AddDNSHistSet(AWDMDNSResponderDNSStatistics *inMetric, DNSHistSet *inSet, const char *inDomain, mDNSBool inForCell)
+mDNSlocal mStatus AddDNSHistSet(AWDMDNSResponderDNSStatistics *inMetric, const QueryStatsCounters *inCounters, int inDomainIndex, mDNSBool inForCell)
 {
     mStatus                 err;
     AWDDNSDomainStats *     awdStats;
+    const char * const      domain  = QueryStatsGetDomainString(&gQueryStats[inDomainIndex]);
+    const uint16_t          mask    = (uint16_t)(1U << inDomainIndex);
+    const int               net     = inForCell ? 1 : 0;
 
-    if (inSet->histA)
+    if (inCounters->used[net][0] & mask)
     {
-        err = CreateAWDDNSDomainStats(inSet->histA, inDomain, inForCell, AWDDNSDomainStats_RecordType_A, &awdStats);
+        err = CreateAWDDNSDomainStats(&inCounters->hist[inDomainIndex][net][0], domain, inForCell, AWDDNSDomainStats_RecordType_A, &awdStats);
         require_noerr_quiet(err, exit);
 
         [inMetric addStats:awdStats];
     }
-    if (inSet->histAAAA)
+    if (inCounters->used[net][1] & mask)
     {
-        err = CreateAWDDNSDomainStats(inSet->histAAAA, inDomain, inForCell, AWDDNSDomainStats_RecordType_AAAA, &awdStats);
+        err = CreateAWDDNSDomainStats(&inCounters->hist[inDomainIndex][net][1], domain, inForCell, AWDDNSDomainStats_RecordType_AAAA, &awdStats);
         require_noerr_quiet(err, exit);
 
         [inMetric addStats:awdStats];
@@ -944,18 +878,14 @@ exit:
 mDNSlocal mStatus SubmitAWDMetricDNSMessageSizeStats(void)
 {
     mStatus                                     err;
-    DNSMessageSizeStats *                       stats;
-    DNSMessageSizeStats *                       newStats;
+    DNSMessageSizeStats                         stats;
     AWDMetricContainer *                        container;
     AWDMDNSResponderDNSMessageSizeStats *       metric = nil;
     BOOL                                        success;
 
-    newStats = NULL;
-    DNSMessageSizeStatsCreate(&newStats);
-
     KQueueLock();
-    stats                   = gDNSMessageSizeStats;
-    gDNSMessageSizeStats    = newStats;
+    stats = gDNSMessageSizeStats;
+    memset(&gDNSMessageSizeStats, 0, sizeof(gDNSMessageSizeStats));
     KQueueUnlock("SubmitAWDMetricDNSMessageSizeStats");
 
     container = [gAWDServerConnection newMetricContainerWithIdentifier:AWDMetricId_MDNSResponder_DNSMessageSizeStats];
@@ -964,19 +894,19 @@ mDNSlocal mStatus SubmitAWDMetricDNSMessageSizeStats(void)
     metric = [[AWDMDNSResponderDNSMessageSizeStatsSoft alloc] init];
     require_action_quiet(metric, exit, err = mStatus_UnknownErr);
 
-    if (stats)
+    if (gDNSMessageSizeStatsReady)
     {
         size_t          binCount;
         uint32_t        bins[Max(kQuerySizeBinCount, kResponseSizeBinCount)];
 
         // Set query size counts.
 
-        binCount = CopyBins32(bins, stats->querySizeBins, kQuerySizeBinCount);
+        binCount = CopyBins32(bins, stats.querySizeBins, kQuerySizeBinCount);
         [metric setQuerySizeCounts:bins count:(NSUInteger)binCount];
 
         // Set response size counts.
 
-        binCount = CopyBins32(bins, stats->responseSizeBins, kResponseSizeBinCount);
+        binCount = CopyBins32(bins, stats.responseSizeBins, kResponseSizeBinCount);
         [metric setResponseSizeCounts:bins count:(NSUInteger)binCount];
     }
 
@@ -986,7 +916,6 @@ mDNSlocal mStatus SubmitAWDMetricDNSMessageSizeStats(void)
     err = success ? mStatus_NoError : mStatus_UnknownErr;
 
 exit:
-    if (stats) DNSMessageSizeStatsFree(stats);
     return (err);
 }
 
@@ -994,7 +923,7 @@ exit:
 //  CreateAWDDNSDomainStats
 //===========================================================================================================================
 
-mDNSlocal mStatus CreateAWDDNSDomainStats(DNSHist *inHist, const char *inDomain, mDNSBool inForCell, AWDDNSDomainStats_RecordType inType, AWDDNSDomainStats **outStats)
+mDNSlocal mStatus CreateAWDDNSDomainStats(const DNSHist *inHist, const char *inDomain, mDNSBool inForCell, AWDDNSDomainStats_RecordType inType, AWDDNSDomainStats **outStats)
 {
     mStatus                 err;
     AWDDNSDomainStats *     awdStats    = nil;
@@ -1072,10 +1001,13 @@ exit:
 //  LogDNSHistSetToFD
 //===========================================================================================================================
 
-mDNSlocal void LogDNSHistSetToFD(int fd, const DNSHistSet *inSet, const char *inDomain, mDNSBool inForCell)
+mDNSlocal void LogDNSHistSetToFD(int fd, const QueryStatsCounters *inCounters, int inDomainIndex, const char *inDomain, mDNSBool inForCell)
 {
-    if (inSet->histA)       LogDNSHistToFD(fd, inSet->histA,    inDomain, inForCell, "A");
-    if (inSet->histAAAA)    LogDNSHistToFD(fd, inSet->histAAAA, inDomain, inForCell, "AAAA");
+    const uint16_t      mask    = (uint16_t)(1U << inDomainIndex);
+    const int           net     = inForCell ? 1 : 0;
+
+    if (inCounters->used[net][0] & mask) LogDNSHistToFD(fd, &inCounters->hist[inDomainIndex][net][0], inDomain, inForCell, "A");
+    if (inCounters->used[net][1] & mask) LogDNSHistToFD(fd, &inCounters->hist[inDomainIndex][net][1], inDomain, inForCell, "AAAA");
 }
 
 //===========================================================================================================================
@@ -287,6 +287,8 @@ mDNSexport void Querier_SetDNSServiceForQuestion(DNSQuestion *q)
     }
     if (retryPathEval)
     {
+        // The cached result is what gave us the stale or non-private answer, so evaluate afresh.
+        mDNSPlatformFlushDNSRoutePolicyCache();
         mDNSPlatformGetDNSRoutePolicy(q);
         service = _Querier_GetDNSService(q);
     }
@@ -467,8 +469,10 @@ mDNSlocal void _Querier_HandleQuerierResponse(const mdns_querier_t querier, cons
     {
         mdns_set_remove(set, (uintptr_t)dnsservice, querier);
     }
-    DNSQuestion *const q = Querier_GetDNSQuestion(querier);
-    if (q)
+    // A querier may be shared by several questions for the same query on the same DNS service, see
+    // _Querier_FindInFlightQuerier(). Every one of them has to let go of it.
+    DNSQuestion *q;
+    while ((q = Querier_GetDNSQuestion(querier)) != mDNSNULL)
     {
 #if MDNSRESPONDER_SUPPORTS(APPLE, METRICS)
         _Querier_UpdateQuestionMetrics(q);
@@ -494,13 +498,62 @@ mDNSlocal void _Querier_HandleQuerierResponse(const mdns_querier_t querier, cons
     KQueueUnlock("_Querier_HandleQuerierResponse");
 }
 
+mDNSlocal mDNSBool _Querier_QuestionWantsDNSSEC(const DNSQuestion *const q)
+{
+#if MDNSRESPONDER_SUPPORTS(APPLE, DNSSECv2)
+    return (q->DNSSECStatus.enable_dnssec ? mDNStrue : mDNSfalse);
+#else
+    (void)q;
+    return mDNSfalse;
+#endif
+}
+
+// Returns an active querier that another question started for the same query on the same DNS service, if any, so that
+// questions asked at the same time by different clients, which mDNSCore does not treat as duplicates, share one
+// outstanding query instead of each sending their own.
+mDNSlocal mdns_querier_t _Querier_FindInFlightQuerier(const DNSQuestion *const q)
+{
+    const mDNSBool wantsDNSSEC = _Querier_QuestionWantsDNSSEC(q);
+    for (const DNSQuestion *other = mDNSStorage.Questions; other; other = other->next)
+    {
+        if ((other != q) && other->querier && (other->dnsservice == q->dnsservice) &&
+            !mdns_querier_has_concluded(other->querier) &&
+            mdns_querier_match(other->querier, q->qname.c, q->qtype, q->qclass) &&
+            ((mdns_querier_get_dnssec_ok(other->querier) ? mDNStrue : mDNSfalse) == wantsDNSSEC))
+        {
+            return other->querier;
+        }
+    }
+    return mDNSNULL;
+}
+
+mDNSlocal mDNSBool _Querier_QuerierIsShared(const DNSQuestion *const q)
+{
+    for (const DNSQuestion *other = mDNSStorage.Questions; other; other = other->next)
+    {
+        if ((other != q) && (other->querier == q->querier))
+        {
+            return mDNStrue;
+        }
+    }
+    return mDNSfalse;
+}
+
 mDNSexport void Querier_HandleUnicastQuestion(DNSQuestion *q)
 {
     mDNS *const m = &mDNSStorage;
     mdns_querier_t querier = NULL;
     if (!q->dnsservice || q->querier) goto exit;
 
-    const mdns_set_t set = _Querier_GetOrphanedQuerierSet();
+    const mdns_querier_t inFlight = _Querier_FindInFlightQuerier(q);
+    if (inFlight)
+    {
+        q->querier = inFlight;
+        mdns_retain(q->querier);
+        LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO,
+            "[Q%u->Q%u] Joined in-flight querier", mDNSVal16(q->TargetQID), mdns_querier_get_user_id(q->querier));
+    }
+    const mdns_set_t set = q->querier ? NULL : _Querier_GetOrphanedQuerierSet();
     if (set)
     {
         __block mdns_querier_t orphan = NULL;
@@ -792,6 +845,11 @@ mDNSexport mDNSBool Querier_SameNameCacheRecordIsAnswer(const CacheRecord *const
 
 mDNSexport void Querier_HandleStoppedDNSQuestion(DNSQuestion *q)
 {
+    // The other questions sharing the querier still need its response.
+    if (q->querier && _Querier_QuerierIsShared(q))
+    {
+        mdns_forget(&q->querier);
+    }
     if (q->querier && !mdns_querier_has_concluded(q->querier) &&
         q->dnsservice && !mdns_dns_service_is_defunct(q->dnsservice))
     {
@@ -15,6 +15,7 @@
  */
 
 #include "unittest_common.h"
+#include "mDNSMacOSX.h"
 #import <XCTest/XCTest.h>
 
 #import <NetworkExtension/NEPolicySession.h>
@@ -72,6 +73,8 @@
     [policySession addPolicy:policy];
     [policySession apply];
 
+    // Policy changes aren't signalled to the path evaluation cache
+    mDNSPlatformFlushDNSRoutePolicyCache();
     mDNSPlatformGetDNSRoutePolicy(&q);
     //  Either if these asserts indicate a regression in mDNSPlatformGetDNSRoutePolicy
     if (routableIndex)  XCTAssertTrue(q.BlockedByPolicy, "blocked by (policy) test failure");
@@ -1739,38 +1739,39 @@ _dnssd_getaddrinfo_result_create_svcb(xpc_object_t hostname, xpc_object_t actual
 	require_action_quiet(obj->actual_hostname, exit, err = kNoResourcesErr);
 
 	if (svcb_data != NULL && svcb_length > 0) {
-		obj->valid_svcb = dnssd_svcb_is_valid(svcb_data, svcb_length);
-		obj->priority = dnssd_svcb_get_priority(svcb_data, svcb_length);
-		obj->port = dnssd_svcb_get_port(svcb_data, svcb_length);
-
-		char *service_name = dnssd_svcb_copy_domain(svcb_data, svcb_length);
-		if (service_name != NULL) {
+		// Parse the SvcParams once for all of the values below.
+		dnssd_svcb_view_t svcb;
+		const bool svcb_parsed = dnssd_svcb_view_init(&svcb, svcb_data, svcb_length);
+		obj->valid_svcb = dnssd_svcb_view_is_valid(&svcb);
+		obj->priority = dnssd_svcb_view_get_priority(&svcb);
+		obj->port = dnssd_svcb_view_get_port(&svcb);
+
+		char service_name[DNSSD_MAX_ESCAPED_DOMAIN_NAME];
+		if (svcb_parsed && dnssd_svcb_view_get_domain_string(&svcb, service_name) != NULL) {
 			if (strcmp(service_name, ".") == 0) {
 				// The empty name is an placeholder for the name for the record
 				obj->service_name = xpc_copy(obj->hostname);
 			} else {
 				obj->service_name = xpc_string_create(service_name);
 			}
-			free(service_name);
 			require_action_quiet(obj->service_name, exit, err = kNoResourcesErr);
 		}
 
-		char *doh_uri = dnssd_svcb_copy_doh_uri(svcb_data, svcb_length);
+		size_t doh_uri_length = 0;
+		const char *doh_uri = dnssd_svcb_view_get_doh_uri(&svcb, &doh_uri_length);
 		if (doh_uri != NULL) {
-			obj->doh_uri = xpc_string_create(doh_uri);
-			free(doh_uri);
+			obj->doh_uri = xpc_string_create_with_format("%.*s", (int)doh_uri_length, doh_uri);
 			require_action_quiet(obj->doh_uri, exit, err = kNoResourcesErr);
 		}
 
 		size_t ech_config_length = 0;
-		uint8_t *ech_config = dnssd_svcb_copy_ech_config(svcb_data, svcb_length, &ech_config_length);
+		const uint8_t *ech_config = dnssd_svcb_view_get_ech_config(&svcb, &ech_config_length);
 		if (ech_config != NULL) {
 			obj->ech_config = xpc_data_create(ech_config, ech_config_length);
-			free(ech_config);
 			require_action_quiet(obj->ech_config, exit, err = kNoResourcesErr);
 		}
 
-		dnssd_svcb_access_alpn_values(svcb_data, svcb_length, ^bool(const char *alpn) {
+		dnssd_svcb_view_access_alpn_values(&svcb, ^bool(const char *alpn) {
 			xpc_object_t alpn_string = xpc_string_create(alpn);
 			if (obj->alpn_values == NULL) {
 				obj->alpn_values = xpc_array_create(NULL, 0);
@@ -1780,7 +1781,7 @@ _dnssd_getaddrinfo_result_create_svcb(xpc_object_t hostname, xpc_object_t actual
 			return true;
 		});
 
-		dnssd_svcb_access_address_hints(svcb_data, svcb_length, ^bool(const struct sockaddr *address) {
+		dnssd_svcb_view_access_address_hints(&svcb, ^bool(const struct sockaddr *address) {
 			xpc_object_t address_hint = xpc_data_create(address, address->sa_len);
 			if (obj->address_hints == NULL) {
 				obj->address_hints = xpc_array_create(NULL, 0);
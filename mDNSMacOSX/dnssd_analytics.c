@@ -31,17 +31,18 @@ typedef xpc_object_t COREANALYTICS_RETURNS_RETAINED
 
 #if MDNSRESPONDER_SUPPORTS(APPLE, CACHE_ANALYTICS)
 
-// Local aggregate counters to track request counts
+// Local aggregate counters to track request counts, indexed by CacheRequestType and CacheState so that counting a
+// request is a single increment. They're only turned into events when the daily analytics activity runs.
 
-mDNSlocal uint64_t sCacheUsage_UnicastHitCount = 0;
-mDNSlocal uint64_t sCacheUsage_UnicastMissCount = 0;
-mDNSlocal uint64_t sCacheUsage_MulticastHitCount = 0;
-mDNSlocal uint64_t sCacheUsage_MulticastMissCount = 0;
+#define CACHE_REQUEST_TYPE_COUNT    2
+#define CACHE_STATE_COUNT           2
 
-mDNSlocal uint64_t sCacheRequest_UnicastHitCount = 0;
-mDNSlocal uint64_t sCacheRequest_UnicastMissCount = 0;
-mDNSlocal uint64_t sCacheRequest_MulticastHitCount = 0;
-mDNSlocal uint64_t sCacheRequest_MulticastMissCount = 0;
+typedef struct {
+    uint64_t    usage[CACHE_REQUEST_TYPE_COUNT][CACHE_STATE_COUNT];
+    uint64_t    request[CACHE_REQUEST_TYPE_COUNT][CACHE_STATE_COUNT];
+} cache_analytics_counts_t;
+
+mDNSlocal cache_analytics_counts_t sCacheCounts;
 
 #if COMPILER_LIKES_PRAGMA_MARK
 #pragma mark -
@@ -69,23 +70,18 @@ dnssd_analytics_post_cache_request_count(CacheRequestType inType, CacheState inS
 }
 
 mDNSlocal void
-dnssd_analytics_post_cache_request_counts()
+dnssd_analytics_post_cache_request_counts(const cache_analytics_counts_t *inCounts)
 {
-    if (sCacheRequest_UnicastHitCount > 0) {
-        dnssd_analytics_post_cache_request_count(CacheRequestType_unicast, CacheState_hit, sCacheRequest_UnicastHitCount);
-        sCacheRequest_UnicastHitCount = 0;
-    }
-    if (sCacheRequest_UnicastMissCount > 0) {
-        dnssd_analytics_post_cache_request_count(CacheRequestType_unicast, CacheState_miss, sCacheRequest_UnicastMissCount);
-        sCacheRequest_UnicastMissCount = 0;
-    }
-    if (sCacheRequest_MulticastHitCount > 0) {
-        dnssd_analytics_post_cache_request_count(CacheRequestType_multicast, CacheState_hit, sCacheRequest_MulticastHitCount);
-        sCacheRequest_MulticastHitCount = 0;
-    }
-    if (sCacheRequest_MulticastMissCount > 0) {
-        dnssd_analytics_post_cache_request_count(CacheRequestType_multicast, CacheState_miss, sCacheRequest_MulticastMissCount);
-        sCacheRequest_MulticastMissCount = 0;
+    static const CacheRequestType kTypes[] = { CacheRequestType_unicast, CacheRequestType_multicast };
+    static const CacheState kStates[] = { CacheState_hit, CacheState_miss };
+
+    for (size_t i = 0; i < sizeof(kTypes) / sizeof(kTypes[0]); i++) {
+        for (size_t j = 0; j < sizeof(kStates) / sizeof(kStates[0]); j++) {
+            const uint64_t count = inCounts->request[kTypes[i]][kStates[j]];
+            if (count > 0) {
+                dnssd_analytics_post_cache_request_count(kTypes[i], kStates[j], count);
+            }
+        }
     }
 }
 
@@ -110,17 +106,16 @@ dnssd_analytics_post_cache_usage_counts_for_type(CacheRequestType inType, uint64
 }
 
 mDNSlocal void
-dnssd_analytics_post_cache_usage_counts()
+dnssd_analytics_post_cache_usage_counts(const cache_analytics_counts_t *inCounts)
 {
-	if (sCacheUsage_MulticastHitCount || sCacheUsage_MulticastMissCount) {
-		dnssd_analytics_post_cache_usage_counts_for_type(CacheRequestType_multicast, sCacheUsage_MulticastHitCount, sCacheUsage_MulticastMissCount);
-		sCacheUsage_MulticastHitCount = 0;
-		sCacheUsage_MulticastMissCount = 0;
-	}
-	if (sCacheUsage_UnicastHitCount || sCacheUsage_UnicastMissCount) {
-		dnssd_analytics_post_cache_usage_counts_for_type(CacheRequestType_unicast, sCacheUsage_UnicastHitCount, sCacheUsage_UnicastMissCount);
-		sCacheUsage_UnicastHitCount = 0;
-		sCacheUsage_UnicastMissCount = 0;
+	static const CacheRequestType kTypes[] = { CacheRequestType_multicast, CacheRequestType_unicast };
+
+	for (size_t i = 0; i < sizeof(kTypes) / sizeof(kTypes[0]); i++) {
+		const uint64_t hits   = inCounts->usage[kTypes[i]][CacheState_hit];
+		const uint64_t misses = inCounts->usage[kTypes[i]][CacheState_miss];
+		if (hits || misses) {
+			dnssd_analytics_post_cache_usage_counts_for_type(kTypes[i], hits, misses);
+		}
 	}
 }
 
@@ -132,34 +127,20 @@ dnssd_analytics_post_cache_usage_counts()
 mDNSexport void
 dnssd_analytics_update_cache_request(CacheRequestType inType, CacheState inState)
 {
-    if (inType == CacheRequestType_unicast) {
-        if (inState == CacheState_hit) {
-            sCacheRequest_UnicastHitCount++;
-        } else if (inState == CacheState_miss) {
-            sCacheRequest_UnicastMissCount++;
-        } else {
-			LogRedact(MDNS_LOG_CATEGORY_ANALYTICS, MDNS_LOG_WARNING, "dnssd_analytics_update_cache_request:  unknown CacheState %d for unicast", inState);
-        }
-    } else if (inType == CacheRequestType_multicast) {
-        if (inState == CacheState_hit) {
-            sCacheRequest_MulticastHitCount++;
-        } else if (inState == CacheState_miss) {
-            sCacheRequest_MulticastMissCount++;
-        } else {
-            LogRedact(MDNS_LOG_CATEGORY_ANALYTICS, MDNS_LOG_WARNING, "dnssd_analytics_update_cache_request:  unknown CacheState %d for multicast", inState);
-        }
+    if (((unsigned int)inType < CACHE_REQUEST_TYPE_COUNT) && ((unsigned int)inState < CACHE_STATE_COUNT)) {
+        sCacheCounts.request[inType][inState]++;
     } else {
-        LogRedact(MDNS_LOG_CATEGORY_ANALYTICS, MDNS_LOG_WARNING, "dnssd_analytics_update_cache_request:  unknown CacheRequestType %d", inType);
+        LogRedact(MDNS_LOG_CATEGORY_ANALYTICS, MDNS_LOG_WARNING, "dnssd_analytics_update_cache_request:  unknown CacheRequestType %d or CacheState %d", inType, inState);
     }
 }
 
 mDNSexport void
 dnssd_analytics_update_cache_usage_counts(uint32_t inHitMulticastCount, uint32_t inMissMulticastCount, uint32_t inHitUnicastCount, uint32_t inMissUnicastCount)
 {
-	sCacheUsage_MulticastHitCount += inHitMulticastCount;
-	sCacheUsage_MulticastMissCount += inMissMulticastCount;
-	sCacheUsage_UnicastHitCount += inHitUnicastCount;
-	sCacheUsage_UnicastMissCount += inMissUnicastCount;
+	sCacheCounts.usage[CacheRequestType_multicast][CacheState_hit] += inHitMulticastCount;
+	sCacheCounts.usage[CacheRequestType_multicast][CacheState_miss] += inMissMulticastCount;
+	sCacheCounts.usage[CacheRequestType_unicast][CacheState_hit] += inHitUnicastCount;
+	sCacheCounts.usage[CacheRequestType_unicast][CacheState_miss] += inMissUnicastCount;
 }
 
 #endif // CACHE_ANALYTICS
@@ -328,15 +309,19 @@ dnssd_analytics_init()
 			} else {
 				dispatch_async(sAnalyticsQueue, ^{
 #if MDNSRESPONDER_SUPPORTS(APPLE, ANALYTICS)
+#if MDNSRESPONDER_SUPPORTS(APPLE, CACHE_ANALYTICS)
+					// Only take the counts under the lock; the events are built and posted after it's dropped.
+					cache_analytics_counts_t counts;
 					KQueueLock();
 					mDNS_Lock(&mDNSStorage);
-#if MDNSRESPONDER_SUPPORTS(APPLE, CACHE_ANALYTICS)
-					dnssd_analytics_post_cache_request_counts();
-					dnssd_analytics_post_cache_usage_counts();
-#endif	//	CACHE_ANALYTICS
-					LogRedact(MDNS_LOG_CATEGORY_ANALYTICS, MDNS_LOG_INFO, "Analytics Posted");
+					counts = sCacheCounts;
+					memset(&sCacheCounts, 0, sizeof(sCacheCounts));
 					mDNS_Unlock(&mDNSStorage);
 					KQueueUnlock("Analytics Update");
+					dnssd_analytics_post_cache_request_counts(&counts);
+					dnssd_analytics_post_cache_usage_counts(&counts);
+#endif	//	CACHE_ANALYTICS
+					LogRedact(MDNS_LOG_CATEGORY_ANALYTICS, MDNS_LOG_INFO, "Analytics Posted");
 #endif	//	ANALYTICS
 				});
 				if (!xpc_activity_set_state(activity, XPC_ACTIVITY_STATE_DONE)) {
@@ -981,10 +981,16 @@ _dx_request_locked(const dx_any_request_t any, const dx_block_t block)
 
 //======================================================================================================================
 
+// Results are normally delivered as a single message per request at the end of each event-loop turn. During a burst,
+// once this many results are pending, delivery is triggered early to bound the size of each message.
+
+#define DX_REQUEST_PENDING_RESULTS_DELIVERY_COUNT	64
+
 static void
 _dx_request_append_result(const dx_any_request_t any, const xpc_object_t result)
 {
 	const dx_request_t me = any.request;
+	__block bool deliver_now = false;
 	_dx_request_locked(me,
 	^{
 		if (!me->results) {
@@ -992,12 +998,18 @@ _dx_request_append_result(const dx_any_request_t any, const xpc_object_t result)
 		}
 		if (likely(me->results)) {
 			xpc_array_append_value(me->results, result);
+			if (xpc_array_get_count(me->results) == DX_REQUEST_PENDING_RESULTS_DELIVERY_COUNT) {
+				deliver_now = true;
+			}
 		} else {
 			if (!me->error) {
 				me->error = kDNSServiceErr_NoMemory;
 			}
 		}
 	});
+	if (deliver_now) {
+		dnssd_server_idle();
+	}
 }
 
 //======================================================================================================================
@@ -1480,9 +1492,25 @@ _dx_gai_request_query_result_handler(mDNS * const m, DNSQuestion * const q, cons
 			_dx_gai_request_log_svcb_result(me, query_id, if_index, answer->name, type_str, rdata_ptr, rdata_len,
 				answer, add_result);
 #if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
-			char * const svcb_doh_uri = dnssd_svcb_copy_doh_uri(rdata_ptr, rdata_len);
-			// Check for a valid DoH URI.
+			// Check for a valid DoH URI. Nothing is copied unless the record has one.
+			dnssd_svcb_view_t svcb;
+			size_t svcb_doh_uri_len = 0;
+			const char *svcb_doh_uri_value = NULL;
+			if (dnssd_svcb_view_init(&svcb, rdata_ptr, rdata_len) && dnssd_svcb_view_is_valid(&svcb)) {
+				svcb_doh_uri_value = dnssd_svcb_view_get_doh_uri(&svcb, &svcb_doh_uri_len);
+			}
+			char svcb_doh_uri_buffer[256];
+			char *svcb_doh_uri = NULL;
+			if (svcb_doh_uri_value) {
+				if (svcb_doh_uri_len < sizeof(svcb_doh_uri_buffer)) {
+					svcb_doh_uri = svcb_doh_uri_buffer;
+				} else {
+					svcb_doh_uri = (char *)malloc(svcb_doh_uri_len + 1);
+				}
+			}
 			if (svcb_doh_uri) {
+				memcpy(svcb_doh_uri, svcb_doh_uri_value, svcb_doh_uri_len);
+				svcb_doh_uri[svcb_doh_uri_len] = '\0';
 				// Pass the domain to map if the record is DNSSEC signed.
 				char *svcb_domain = NULL;
 #if MDNSRESPONDER_SUPPORTS(APPLE, DNSSECv2)
@@ -1494,7 +1522,9 @@ _dx_gai_request_query_result_handler(mDNS * const m, DNSQuestion * const q, cons
 				}
 #endif
 				Querier_RegisterDoHURI(svcb_doh_uri, svcb_domain);
-				free(svcb_doh_uri);
+				if (svcb_doh_uri != svcb_doh_uri_buffer) {
+					free(svcb_doh_uri);
+				}
 			}
 #endif
 		} else {
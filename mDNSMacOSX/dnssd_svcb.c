@@ -30,8 +30,6 @@ typedef enum
     dnssd_svcb_key_doh_uri = 32768,
 } dnssd_svcb_key_t;
 
-typedef bool (^_dnssd_svcb_access_value_block_t)(const void *value, size_t value_size);
-
 uint16_t
 dnssd_svcb_get_priority(const uint8_t *buffer, size_t buffer_size)
 {
@@ -45,7 +43,6 @@ dnssd_svcb_get_priority(const uint8_t *buffer, size_t buffer_size)
 
 #define DNSSD_MAX_DOMAIN_NAME 256
 #define DNSSD_MAX_DOMAIN_LABEL 63
-#define DNSSD_MAX_ESCAPED_DOMAIN_NAME 1009
 
 static bool
 _dnssd_svcb_get_domain_name_length(const uint8_t *buffer, size_t buffer_size, size_t *out_name_length)
@@ -114,84 +111,255 @@ _dnssd_svcb_get_string_from_domain_name(const uint8_t *source, char *string_buff
     return string_buffer; // and return
 }
 
-char *
-dnssd_svcb_copy_domain(const uint8_t *buffer, size_t buffer_size)
-{
-	if (buffer_size < sizeof(uint16_t)) {
-		return NULL;
-	}
+//======================================================================================================================
+// MARK: - Parsed View
 
-	buffer += sizeof(uint16_t);
-	buffer_size -= sizeof(uint16_t);
+static uint16_t
+_dnssd_svcb_read_u16(const uint8_t *ptr)
+{
+	return (uint16_t)((ptr[0] << 8) | ptr[1]);
+}
 
-	size_t domain_length = 0;
-	if (!_dnssd_svcb_get_domain_name_length(buffer, buffer_size, &domain_length)) {
-		return NULL;
+// Index of a known key in the view's value tables, or -1
+static int
+_dnssd_svcb_key_index(uint16_t key)
+{
+	if (key <= dnssd_svcb_key_ipv6_hint) {
+		return (int)key;
+	} else if (key == dnssd_svcb_key_doh_uri) {
+		return DNSSD_SVCB_VIEW_KEY_COUNT - 1;
 	}
+	return -1;
+}
 
-	char *name_str = calloc(1, DNSSD_MAX_ESCAPED_DOMAIN_NAME);
-	if (_dnssd_svcb_get_string_from_domain_name(buffer, name_str) == NULL) {
-		free(name_str);
+static const uint8_t *
+_dnssd_svcb_view_get_value(const dnssd_svcb_view_t *view, dnssd_svcb_key_t key, size_t *out_length)
+{
+	const int index = _dnssd_svcb_key_index((uint16_t)key);
+	if (index < 0 || (view->present & (1U << index)) == 0) {
+		*out_length = 0;
 		return NULL;
 	}
-	return name_str;
+	*out_length = view->value_length[index];
+	return view->buffer + view->value_offset[index];
 }
 
-static bool
-_dnssd_svcb_extract_values(const uint8_t *buffer, size_t buffer_size,
-						   dnssd_svcb_key_t match_key, _dnssd_svcb_access_value_block_t value_block)
+bool
+dnssd_svcb_view_init(dnssd_svcb_view_t *view, const uint8_t *buffer, size_t buffer_size)
 {
+	memset(view, 0, sizeof(*view));
+	view->buffer = buffer;
+	view->buffer_size = buffer_size;
+
 	if (buffer_size < sizeof(uint16_t)) {
 		return false;
 	}
+	view->priority = _dnssd_svcb_read_u16(buffer);
 
-	const uint16_t *priority_p = (const uint16_t *)buffer;
-	uint16_t priority = (uint16_t)htons(*priority_p);
-	if (priority == 0) {
-		// Alias form, no value
+	size_t domain_length = 0;
+	if (!_dnssd_svcb_get_domain_name_length(buffer + sizeof(uint16_t), buffer_size - sizeof(uint16_t), &domain_length)) {
 		return false;
 	}
+	view->domain_length = (uint16_t)domain_length;
 
-	buffer += sizeof(uint16_t);
-	buffer_size -= sizeof(uint16_t);
+	if (view->priority == 0) {
+		// Alias form, no values
+		return true;
+	}
 
-	size_t domain_length = 0;
-	if (!_dnssd_svcb_get_domain_name_length(buffer, buffer_size, &domain_length)) {
+	size_t offset = sizeof(uint16_t) + domain_length;
+	while (buffer_size - offset >= (sizeof(uint16_t) + sizeof(uint16_t))) {
+		const uint16_t param_key = _dnssd_svcb_read_u16(buffer + offset);
+		const uint16_t param_value_length = _dnssd_svcb_read_u16(buffer + offset + sizeof(uint16_t));
+		offset += sizeof(uint16_t) + sizeof(uint16_t);
+
+		if (param_value_length > buffer_size - offset) {
+			break;
+		}
+
+		// Only the first value of a key counts
+		const int index = _dnssd_svcb_key_index(param_key);
+		if (index >= 0 && (view->present & (1U << index)) == 0) {
+			view->present |= (uint16_t)(1U << index);
+			view->value_offset[index] = (uint32_t)offset;
+			view->value_length[index] = param_value_length;
+		}
+
+		offset += param_value_length;
+	}
+
+	return true;
+}
+
+bool
+dnssd_svcb_view_is_valid(const dnssd_svcb_view_t *view)
+{
+	if (view->priority == 0) {
+		// Alias forms don't need further validation
+		return true;
+	}
+
+	size_t value_size = 0;
+	const uint8_t *value = _dnssd_svcb_view_get_value(view, dnssd_svcb_key_mandatory, &value_size);
+	if (value == NULL || value_size == 0) {
+		return true;
+	}
+	if ((value_size % sizeof(uint16_t)) != 0) {
+		// Value must be a list of keys, as 16-bit integers
 		return false;
 	}
 
-	buffer += domain_length;
-	buffer_size -= domain_length;
+	for (size_t i = 0; i < value_size; i += sizeof(uint16_t)) {
+		const uint16_t param_key = _dnssd_svcb_read_u16(value + i);
+		switch (param_key) {
+			case dnssd_svcb_key_mandatory:
+				// Mandatory key cannot be listed
+				return false;
+			case dnssd_svcb_key_alpn:
+			case dnssd_svcb_key_no_default_alpn:
+			case dnssd_svcb_key_port:
+			case dnssd_svcb_key_ipv4_hint:
+			case dnssd_svcb_key_ech_config:
+			case dnssd_svcb_key_ipv6_hint:
+			case dnssd_svcb_key_doh_uri:
+				// Known keys are fine
+				break;
+			default:
+				// Unknown mandatory key means we should ignore the record
+				return false;
+		}
+	}
+	return true;
+}
+
+uint16_t
+dnssd_svcb_view_get_priority(const dnssd_svcb_view_t *view)
+{
+	return view->priority;
+}
+
+const uint8_t *
+dnssd_svcb_view_get_domain(const dnssd_svcb_view_t *view, size_t *out_length)
+{
+	*out_length = view->domain_length;
+	return (view->domain_length > 0) ? (view->buffer + sizeof(uint16_t)) : NULL;
+}
+
+char *
+dnssd_svcb_view_get_domain_string(const dnssd_svcb_view_t *view, char *string_buffer)
+{
+	if (view->domain_length == 0) {
+		return NULL;
+	}
+	if (_dnssd_svcb_get_string_from_domain_name(view->buffer + sizeof(uint16_t), string_buffer) == NULL) {
+		return NULL;
+	}
+	return string_buffer;
+}
+
+uint16_t
+dnssd_svcb_view_get_port(const dnssd_svcb_view_t *view)
+{
+	size_t value_size = 0;
+	const uint8_t *value = _dnssd_svcb_view_get_value(view, dnssd_svcb_key_port, &value_size);
+	if (value != NULL && value_size == sizeof(uint16_t)) {
+		return _dnssd_svcb_read_u16(value);
+	}
+	return 0;
+}
+
+const char *
+dnssd_svcb_view_get_doh_uri(const dnssd_svcb_view_t *view, size_t *out_length)
+{
+	const uint8_t *value = _dnssd_svcb_view_get_value(view, dnssd_svcb_key_doh_uri, out_length);
+	return (*out_length > 0) ? (const char *)value : NULL;
+}
 
-	while (buffer != NULL && buffer_size >= (sizeof(uint16_t) + sizeof(uint16_t))) {
-		const uint16_t *param_key_p = (const uint16_t *)buffer;
-		uint16_t param_key = (uint16_t)htons(*param_key_p);
+const uint8_t *
+dnssd_svcb_view_get_ech_config(const dnssd_svcb_view_t *view, size_t *out_length)
+{
+	const uint8_t *value = _dnssd_svcb_view_get_value(view, dnssd_svcb_key_ech_config, out_length);
+	return (*out_length > 0) ? value : NULL;
+}
 
-		buffer += sizeof(uint16_t);
-		buffer_size -= sizeof(uint16_t);
+void
+dnssd_svcb_view_access_alpn_values(const dnssd_svcb_view_t *view, DNSSD_NOESCAPE _dnssd_svcb_access_alpn_t block)
+{
+	size_t value_size = 0;
+	const uint8_t *value = _dnssd_svcb_view_get_value(view, dnssd_svcb_key_alpn, &value_size);
+	if (value == NULL) {
+		return;
+	}
 
-		const uint16_t *param_value_length_p = (const uint16_t *)buffer;
-		uint16_t param_value_length = (uint16_t)htons(*param_value_length_p);
+	size_t value_read = 0;
+	while (value_read < value_size) {
+		char alpn_value[UINT8_MAX + 1] = "";
 
-		buffer += sizeof(uint16_t);
-		buffer_size -= sizeof(uint16_t);
+		const uint8_t alpn_length = value[value_read];
+		value_read++;
 
-		if (param_value_length > buffer_size) {
+		if (value_read + alpn_length > value_size) {
 			break;
 		}
 
-		if (match_key == param_key) {
-			bool continue_looping = value_block(buffer, param_value_length);
-			if (!continue_looping) {
-				break;
+		memcpy(alpn_value, value + value_read, alpn_length);
+		if (!block((const char *)alpn_value)) {
+			break;
+		}
+		value_read += alpn_length;
+	}
+}
+
+void
+dnssd_svcb_view_access_address_hints(const dnssd_svcb_view_t *view, DNSSD_NOESCAPE _dnssd_svcb_access_address_t block)
+{
+	size_t value_size = 0;
+	const uint8_t *value = _dnssd_svcb_view_get_value(view, dnssd_svcb_key_ipv4_hint, &value_size);
+	if (value != NULL && (value_size % sizeof(struct in_addr)) == 0) {
+		for (size_t value_read = 0; value_read < value_size; value_read += sizeof(struct in_addr)) {
+			struct sockaddr_in v4addr;
+			memset(&v4addr, 0, sizeof(v4addr));
+			v4addr.sin_family = AF_INET;
+			v4addr.sin_len = sizeof(v4addr);
+			memcpy(&v4addr.sin_addr, value + value_read, sizeof(struct in_addr));
+			if (!block((const struct sockaddr *)&v4addr)) {
+				return;
 			}
 		}
+	}
 
-		buffer += param_value_length;
-		buffer_size -= param_value_length;
+	value = _dnssd_svcb_view_get_value(view, dnssd_svcb_key_ipv6_hint, &value_size);
+	if (value != NULL && (value_size % sizeof(struct in6_addr)) == 0) {
+		for (size_t value_read = 0; value_read < value_size; value_read += sizeof(struct in6_addr)) {
+			struct sockaddr_in6 v6addr;
+			memset(&v6addr, 0, sizeof(v6addr));
+			v6addr.sin6_family = AF_INET6;
+			v6addr.sin6_len = sizeof(v6addr);
+			memcpy(&v6addr.sin6_addr, value + value_read, sizeof(struct in6_addr));
+			if (!block((const struct sockaddr *)&v6addr)) {
+				return;
+			}
+		}
 	}
+}
 
-	return true;
+//======================================================================================================================
+// MARK: - Rdata Accessors
+
+char *
+dnssd_svcb_copy_domain(const uint8_t *buffer, size_t buffer_size)
+{
+	dnssd_svcb_view_t view;
+	if (!dnssd_svcb_view_init(&view, buffer, buffer_size)) {
+		return NULL;
+	}
+
+	char *name_str = calloc(1, DNSSD_MAX_ESCAPED_DOMAIN_NAME);
+	if (dnssd_svcb_view_get_domain_string(&view, name_str) == NULL) {
+		free(name_str);
+		return NULL;
+	}
+	return name_str;
 }
 
 bool
@@ -201,92 +369,49 @@ dnssd_svcb_is_valid(const uint8_t *buffer, size_t buffer_size)
 		return false;
 	}
 
-	uint16_t priority = dnssd_svcb_get_priority(buffer, buffer_size);
-	if (priority == 0) {
-		// Alias forms don't need further validation
-		return true;
-	}
-
-	__block bool invalid_mandatory_value = false;
-	(void)_dnssd_svcb_extract_values(buffer, buffer_size, dnssd_svcb_key_mandatory, ^bool(const void *value, size_t value_size) {
-		if (value != NULL && value_size > 0) {
-			if ((value_size % sizeof(uint16_t)) != 0) {
-				// Value must be a list of keys, as 16-bit integers
-				invalid_mandatory_value = true;
-			} else {
-				const uint16_t mandatory_key_count = (uint16_t)(value_size / sizeof(uint16_t));
-				for (uint16_t i = 0; i < mandatory_key_count && !invalid_mandatory_value; i++) {
-					const uint16_t *param_key_p = ((const uint16_t *)value) + i;
-					uint16_t param_key = (uint16_t)htons(*param_key_p);
-					switch (param_key) {
-						case dnssd_svcb_key_mandatory:
-							// Mandatory key cannot be listed
-							invalid_mandatory_value = true;
-							break;
-						case dnssd_svcb_key_alpn:
-						case dnssd_svcb_key_no_default_alpn:
-						case dnssd_svcb_key_port:
-						case dnssd_svcb_key_ipv4_hint:
-						case dnssd_svcb_key_ech_config:
-						case dnssd_svcb_key_ipv6_hint:
-						case dnssd_svcb_key_doh_uri:
-							// Known keys are fine
-							break;
-						default:
-							// Unknown mandatory key means we should ignore the record
-							invalid_mandatory_value = true;
-							break;
-					}
-				}
-			}
-		}
-		return false;
-	});
-	if (invalid_mandatory_value) {
-		return false;
-	} else {
-		return true;
-	}
+	// A malformed TargetName leaves the view without values, which passes the mandatory key check
+	dnssd_svcb_view_t view;
+	(void)dnssd_svcb_view_init(&view, buffer, buffer_size);
+	return dnssd_svcb_view_is_valid(&view);
 }
 
 uint16_t
 dnssd_svcb_get_port(const uint8_t *buffer, size_t buffer_size)
 {
-	__block uint16_t port = false;
-	(void)_dnssd_svcb_extract_values(buffer, buffer_size, dnssd_svcb_key_port, ^bool(const void *value, size_t value_size) {
-		if (value != NULL && value_size == sizeof(uint16_t)) {
-			port = (uint16_t)htons(*(const uint16_t *)value);
-		}
-		return false;
-	});
-	return port;
+	dnssd_svcb_view_t view;
+	(void)dnssd_svcb_view_init(&view, buffer, buffer_size);
+	return dnssd_svcb_view_get_port(&view);
 }
 
 char *
 dnssd_svcb_copy_doh_uri(const uint8_t *buffer, size_t buffer_size)
 {
-	__block char *doh_uri = NULL;
-	(void)_dnssd_svcb_extract_values(buffer, buffer_size, dnssd_svcb_key_doh_uri, ^bool(const void *value, size_t value_size) {
-		if (value != NULL && value_size > 0) {
-			asprintf(&doh_uri, "%.*s", (int)value_size, value);
-		}
-		return false;
-	});
+	dnssd_svcb_view_t view;
+	(void)dnssd_svcb_view_init(&view, buffer, buffer_size);
+
+	char *doh_uri = NULL;
+	size_t doh_uri_length = 0;
+	const char *value = dnssd_svcb_view_get_doh_uri(&view, &doh_uri_length);
+	if (value != NULL) {
+		asprintf(&doh_uri, "%.*s", (int)doh_uri_length, value);
+	}
 	return doh_uri;
 }
 
 uint8_t *
 dnssd_svcb_copy_ech_config(const uint8_t *buffer, size_t buffer_size, size_t *out_length)
 {
-	__block uint8_t *ech_config = NULL;
-	(void)_dnssd_svcb_extract_values(buffer, buffer_size, dnssd_svcb_key_ech_config, ^bool(const void *value, size_t value_size) {
-		if (value != NULL && value_size > 0) {
-			ech_config = calloc(1, value_size);
-			*out_length = value_size;
-			memcpy(ech_config, value, value_size);
-		}
-		return false;
-	});
+	dnssd_svcb_view_t view;
+	(void)dnssd_svcb_view_init(&view, buffer, buffer_size);
+
+	uint8_t *ech_config = NULL;
+	size_t ech_config_length = 0;
+	const uint8_t *value = dnssd_svcb_view_get_ech_config(&view, &ech_config_length);
+	if (value != NULL) {
+		ech_config = calloc(1, ech_config_length);
+		*out_length = ech_config_length;
+		memcpy(ech_config, value, ech_config_length);
+	}
 	return ech_config;
 }
 
@@ -294,72 +419,15 @@ void
 dnssd_svcb_access_alpn_values(const uint8_t *buffer, size_t buffer_size,
 							  DNSSD_NOESCAPE _dnssd_svcb_access_alpn_t block)
 {
-	(void)_dnssd_svcb_extract_values(buffer, buffer_size, dnssd_svcb_key_alpn, ^bool(const void *value, size_t value_size) {
-		if (value != NULL) {
-			size_t value_read = 0;
-			while (value_size > 0 && value_read < value_size) {
-				char alpn_value[UINT8_MAX] = "";
-
-				uint8_t alpn_length = *(const uint8_t *)value;
-				value_read++;
-
-				if (value_read + alpn_length > value_size) {
-					break;
-				}
-
-				memcpy(alpn_value, ((const uint8_t *)value) + value_read, alpn_length);
-				if (!block((const char *)alpn_value)) {
-					break;
-				}
-				value_read += alpn_length;
-			}
-		}
-		return false;
-	});
+	dnssd_svcb_view_t view;
+	(void)dnssd_svcb_view_init(&view, buffer, buffer_size);
+	dnssd_svcb_view_access_alpn_values(&view, block);
 }
 
 void
 dnssd_svcb_access_address_hints(const uint8_t *buffer, size_t buffer_size, DNSSD_NOESCAPE _dnssd_svcb_access_address_t block)
 {
-	__block bool continue_enumerating = true;
-	(void)_dnssd_svcb_extract_values(buffer, buffer_size, dnssd_svcb_key_ipv4_hint, ^bool(const void *value, size_t value_size) {
-		if (value != NULL && (value_size % sizeof(struct in_addr)) == 0) {
-			size_t value_read = 0;
-			while (value_read < value_size) {
-				struct sockaddr_in v4addr;
-				memset(&v4addr, 0, sizeof(v4addr));
-				v4addr.sin_family = AF_INET;
-				v4addr.sin_len = sizeof(v4addr);
-				memcpy(&v4addr.sin_addr, ((const uint8_t *)value) + value_read, sizeof(struct in_addr));
-				continue_enumerating = block((const struct sockaddr *)&v4addr);
-				if (!continue_enumerating) {
-					break;
-				}
-				value_read += sizeof(struct in_addr);
-			}
-		}
-		return false;
-	});
-	if (!continue_enumerating) {
-		return;
-	}
-	(void)_dnssd_svcb_extract_values(buffer, buffer_size, dnssd_svcb_key_ipv6_hint, ^bool(const void *value, size_t value_size) {
-
-		if (value != NULL && (value_size % sizeof(struct in6_addr)) == 0) {
-			size_t value_read = 0;
-			while (value_read < value_size) {
-				struct sockaddr_in6 v6addr;
-				memset(&v6addr, 0, sizeof(v6addr));
-				v6addr.sin6_family = AF_INET6;
-				v6addr.sin6_len = sizeof(v6addr);
-				memcpy(&v6addr.sin6_addr, ((const uint8_t *)value) + value_read, sizeof(struct in6_addr));
-				continue_enumerating = block((const struct sockaddr *)&v6addr);
-				if (!continue_enumerating) {
-					break;
-				}
-				value_read += sizeof(struct in6_addr);
-			}
-		}
-		return false;
-	});
+	dnssd_svcb_view_t view;
+	(void)dnssd_svcb_view_init(&view, buffer, buffer_size);
+	dnssd_svcb_view_access_address_hints(&view, block);
 }
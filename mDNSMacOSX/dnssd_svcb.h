@@ -42,6 +42,54 @@ uint8_t *
 dnssd_svcb_copy_ech_config(const uint8_t *buffer, size_t buffer_size,
 						   size_t *out_length);
 
+// A parsed view of SVCB/HTTPS rdata. dnssd_svcb_view_init() walks the SvcParams once and records where the first
+// value of each known SvcParamKey is, so any number of the dnssd_svcb_view_* accessors can then be used without
+// walking the rdata again. The accessors return pointers into the rdata, which must outlive the view, and never
+// allocate. The dnssd_svcb_* functions above are each a single init plus the matching accessor.
+
+#define DNSSD_SVCB_VIEW_KEY_COUNT		8		// mandatory through ipv6hint, and the DoH URI key
+#define DNSSD_MAX_ESCAPED_DOMAIN_NAME	1009
+
+typedef struct {
+	const uint8_t *	buffer;
+	size_t			buffer_size;
+	uint16_t		priority;
+	uint16_t		domain_length;								// Wire length of the TargetName, 0 if malformed
+	uint16_t		present;									// Bit per key index whose value was found
+	uint16_t		value_length[DNSSD_SVCB_VIEW_KEY_COUNT];
+	uint32_t		value_offset[DNSSD_SVCB_VIEW_KEY_COUNT];	// From the start of buffer
+} dnssd_svcb_view_t;
+
+// Returns false if the rdata is too short or its TargetName is malformed. SvcParams are only parsed for the
+// service form (priority > 0); a truncated SvcParam ends the walk, keeping the values recorded before it.
+bool
+dnssd_svcb_view_init(dnssd_svcb_view_t *view, const uint8_t *buffer, size_t buffer_size);
+
+bool
+dnssd_svcb_view_is_valid(const dnssd_svcb_view_t *view);
+
+uint16_t
+dnssd_svcb_view_get_priority(const dnssd_svcb_view_t *view);
+
+// The TargetName in wire format
+const uint8_t *
+dnssd_svcb_view_get_domain(const dnssd_svcb_view_t *view, size_t *out_length);
+
+// Writes the TargetName as an escaped C string ("." for the root) to string_buffer, which must hold
+// DNSSD_MAX_ESCAPED_DOMAIN_NAME bytes. Returns string_buffer, or NULL if there is no valid TargetName.
+char *
+dnssd_svcb_view_get_domain_string(const dnssd_svcb_view_t *view, char *string_buffer);
+
+uint16_t
+dnssd_svcb_view_get_port(const dnssd_svcb_view_t *view);
+
+// Not NUL-terminated
+const char *
+dnssd_svcb_view_get_doh_uri(const dnssd_svcb_view_t *view, size_t *out_length);
+
+const uint8_t *
+dnssd_svcb_view_get_ech_config(const dnssd_svcb_view_t *view, size_t *out_length);
+
 #ifdef __BLOCKS__
 
 typedef bool (^_dnssd_svcb_access_alpn_t)(const char *alpn);
@@ -56,6 +104,12 @@ void
 dnssd_svcb_access_address_hints(const uint8_t *buffer, size_t buffer_size,
 								DNSSD_NOESCAPE _dnssd_svcb_access_address_t block);
 
+void
+dnssd_svcb_view_access_alpn_values(const dnssd_svcb_view_t *view, DNSSD_NOESCAPE _dnssd_svcb_access_alpn_t block);
+
+void
+dnssd_svcb_view_access_address_hints(const dnssd_svcb_view_t *view, DNSSD_NOESCAPE _dnssd_svcb_access_address_t block);
+
 #endif //  __BLOCKS__
 
 #ifdef __cplusplus
@@ -21,6 +21,19 @@
 
 #define DNSSEC_OK_BIT 0x8000
 
+// MARK: - Local Prototypes
+
+mDNSlocal void
+validate_and_fetch_dnssec_records(
+	mDNS * const				_Nonnull	m,
+	DNSQuestion * const			_Nonnull	question,
+	dnssec_context_t * const	_Nonnull	dnssec_context,
+	dnssec_retrieval_result_t				retrieval_result,
+	const DNSServiceErrorType				dns_result_error);
+
+mDNSlocal void
+resume_dnssec_validation(dnssec_context_t * const _Nonnull dnssec_context);
+
 // MARK: - External Functions
 
 mDNSexport mDNSBool
@@ -223,12 +236,8 @@ query_record_result_reply_with_dnssec(
 	dnssec_context_t *				dnssec_context		= (dnssec_context_t *)context;
 	QueryRecordClientRequest *		primary_request		= GET_PRIMARY_REQUEST(dnssec_context);
 	ResourceRecord * const			answer				= (ResourceRecord *)const_answer;
-	mDNSBool						anchor_reached		= mDNSfalse;
-	mDNSBool						stop_process		= mDNSfalse;
 	dnssec_retrieval_result_t		retrieval_result	= dnssec_retrieval_no_error;
-	dnssec_validation_result_t		validation_result;
 	mDNSu32							request_id			= primary_request->op.reqID;
-	returned_answers_t * const		returned_answers	= &dnssec_context->returned_answers;
 
 	switch (add_record) {
 		case QC_add:
@@ -251,6 +260,26 @@ query_record_result_reply_with_dnssec(
 		retrieval_result = add_denial_of_existence_records(m, question, answer, add_record, dns_result_error, dnssec_context);
 	}
 
+	validate_and_fetch_dnssec_records(m, question, dnssec_context, retrieval_result, dns_result_error);
+}
+
+//======================================================================================================================
+
+// Takes the records added to the DNSSEC context as far as they go: validates them if they reach a trust anchor, and
+// asks for the records that are still missing if they do not, as often as new records make it worth trying again.
+mDNSlocal void
+validate_and_fetch_dnssec_records(
+	mDNS * const				_Nonnull	m,
+	DNSQuestion * const			_Nonnull	question,
+	dnssec_context_t * const	_Nonnull	dnssec_context,
+	dnssec_retrieval_result_t				retrieval_result,
+	const DNSServiceErrorType				dns_result_error) {
+
+	mDNSBool						anchor_reached		= mDNSfalse;
+	mDNSBool						stop_process		= mDNSfalse;
+	dnssec_validation_result_t		validation_result;
+	returned_answers_t * const		returned_answers	= &dnssec_context->returned_answers;
+
 	do {
 		// handle any error case when addign records
 		stop_process = handle_retrieval_result(question, context, retrieval_result, dns_result_error, m);
@@ -266,7 +295,12 @@ query_record_result_reply_with_dnssec(
 		anchor_reached = trust_anchor_can_be_reached(dnssec_context);
 		if (anchor_reached) {
 			// if so, validate the from the leaf to the root(trust anchor)
-			validation_result = validate_dnssec(dnssec_context);
+			validation_result = validate_dnssec_with_workers(dnssec_context, resume_dnssec_validation);
+			if (validation_result == dnssec_validation_validating) {
+				// The signatures are being verified off the core thread, resume_dnssec_validation carries on from here.
+				dnssec_context->pending_dns_result_error = dns_result_error;
+				break;
+			}
 
 			// handle the validation result such as returning DNSSEC-secure answer to user, return error code to user
 			stop_process = handle_validation_result(question, context, validation_result, dns_result_error, m);
@@ -307,6 +341,26 @@ exit:
 
 //======================================================================================================================
 
+// Called with KQueueLock held once the verification workers are done with the context's signatures. The answers go out
+// as they would while the core is delivering them for the context's own question, so that the handlers can tell as
+// usual if the client stopped it from its callback.
+mDNSlocal void
+resume_dnssec_validation(dnssec_context_t * const _Nonnull dnssec_context) {
+	mDNS * const		m			= &mDNSStorage;
+	DNSQuestion * const	question	= &dnssec_context->me->op.q;
+
+	mDNS_Lock(m);
+	m->CurrentQuestion = question;
+	mDNS_DropLockBeforeCallback();
+	validate_and_fetch_dnssec_records(m, question, dnssec_context, dnssec_retrieval_no_error,
+		dnssec_context->pending_dns_result_error);
+	mDNS_ReclaimLockAfterCallback();
+	m->CurrentQuestion = mDNSNULL;
+	mDNS_Unlock(m);
+}
+
+//======================================================================================================================
+
 mDNSexport void
 stop_dnssec_if_enable_dnssec(QueryRecordClientRequest * const _Nonnull request) {
 	DNSQuestion * const q = &request->op.q;
@@ -342,6 +396,9 @@ stop_dnssec(QueryRecordClientRequest * const _Nonnull request) {
 		stop_and_clean_dnssec_zone_t(zone);
 	}
 
+	// stop the speculative DNSKEY/DS queries that have not been replaced by any zone query yet
+	stop_dnssec_prefetch_requests(dnssec_context);
+
 	// Stop the sub CNAME request.
 	if (dnssec_context->subtask_dnssec_context != mDNSNULL) {
 		// Since we will not deliver RMV so there is no need to check if we should stop the request immediately because
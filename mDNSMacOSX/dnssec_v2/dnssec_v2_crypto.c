@@ -8,6 +8,9 @@
 #include "mDNSEmbeddedAPI.h"
 #if MDNSRESPONDER_SUPPORTS(APPLE, DNSSECv2)
 #include <stdio.h>
+#include <stdatomic.h>
+#include <dispatch/dispatch.h>
+#include <os/lock.h>
 #include <CommonCrypto/CommonDigestSPI.h>
 #include <Security/Security.h>
 #include <Security/SecKeyPriv.h>
@@ -126,6 +129,162 @@ get_priority_of_dnskey_algorithm(mDNSu8 algorithm) {
 	return priority;
 }
 
+//======================================================================================================================
+//	DNSKEY public key cache
+//		Most RRsets of a zone are signed by the same ZSK, so the SecKey created from a DNSKEY is kept and reused by the
+//		following verifications instead of being imported again for every RRSIG. An entry is identified by the key tag,
+//		the algorithm and the digest of the DNSKEY public key, the least recently used one is replaced when it is full.
+//		The verification workers share it with the core thread, so it is only touched with key_cache_lock held.
+//======================================================================================================================
+
+#ifndef DNSSEC_KEY_CACHE_SIZE
+#define DNSSEC_KEY_CACHE_SIZE	32	// number of DNSKEY public key objects kept
+#endif
+
+typedef struct dnssec_key_cache_entry dnssec_key_cache_entry_t;
+struct dnssec_key_cache_entry {
+	mDNSu8					public_key_digest[SHA256_OUTPUT_SIZE];
+	SecKeyRef	_Nullable	key;			// NULL if the entry is not in use.
+	mDNSu32					last_used;		// The value of key_cache_clock when the entry was last used.
+	mDNSu16					key_tag;		// The key tag of the DNSKEY.
+	mDNSu8					algorithm;		// The algorithm of the DNSKEY.
+};
+
+mDNSlocal dnssec_key_cache_entry_t	key_cache[DNSSEC_KEY_CACHE_SIZE];
+mDNSlocal mDNSu32					key_cache_clock;
+mDNSlocal os_unfair_lock			key_cache_lock = OS_UNFAIR_LOCK_INIT;
+
+//	Verification workers
+//		validate_signed_data_batch_on_workers verifies signatures on a concurrent queue, so that the public key
+//		operations neither hold up the core thread nor wait for each other. The number of signatures waiting there is
+//		bounded; past it, the caller verifies on its own thread, which slows down the requests adding the work.
+//======================================================================================================================
+
+#ifndef DNSSEC_MAX_QUEUED_VERIFICATIONS
+#define DNSSEC_MAX_QUEUED_VERIFICATIONS	256	// number of signatures waiting for, or being verified by, the workers
+#endif
+
+mDNSlocal atomic_uint queued_verifications;
+
+//======================================================================================================================
+//	create_key_for_dnskey
+//======================================================================================================================
+
+mDNSlocal SecKeyRef _Nullable
+create_key_for_dnskey(const dnssec_dnskey_t * const _Nonnull dnskey, const void * const _Nonnull public_key_type) {
+	SecKeyRef key = mDNSNULL;
+
+	// public key creation for RSA and ECDSA is different
+	if (public_key_type == kSecAttrKeyTypeRSA) {
+		// RSA
+		// The format of public key is not the standard PEM DER ASN.1 PKCS#1 RSA Public key format, so we need to parse
+		// the modulus and exponent explicitly.
+		SecRSAPublicKeyParams params;
+		parse_rsa_pubkey(dnskey->public_key, dnskey->public_key_length, &params.modulus, &params.modulusLength, &params.exponent, &params.exponentLength);
+		key = SecKeyCreateRSAPublicKey(kCFAllocatorDefault, (const uint8_t *)&params, sizeof(params), kSecKeyEncodingRSAPublicParams);
+	} else if (public_key_type == kSecAttrKeyTypeECSECPrimeRandom) {
+		// ECDSA
+		const void *	public_key_options_key[]	= {kSecAttrKeyType,						kSecAttrKeyClass};
+		const void *	public_key_options_values[] = {kSecAttrKeyTypeECSECPrimeRandom,		kSecAttrKeyClassPublic};
+		CFDataRef		public_key_CFData			= mDNSNULL;
+		CFDictionaryRef public_key_options			= mDNSNULL;
+		CFErrorRef		cf_error					= mDNSNULL;
+		mDNSu8 *		ecdsa_key_bytes_encoding	= mDNSNULL;
+		mDNSu32			ecdsa_key_length			= dnskey->public_key_length + 1;
+
+		// create security framework readable public key format
+		ecdsa_key_bytes_encoding = malloc(ecdsa_key_length);
+		require_quiet(ecdsa_key_bytes_encoding != mDNSNULL, ecdsa_exit);
+
+		ecdsa_key_bytes_encoding[0] = 4;
+		memcpy(ecdsa_key_bytes_encoding + 1, dnskey->public_key, dnskey->public_key_length);
+
+		public_key_CFData = CFDataCreate(kCFAllocatorDefault, ecdsa_key_bytes_encoding, ecdsa_key_length);
+		require_quiet(public_key_CFData != NULL, ecdsa_exit);
+
+		public_key_options = CFDictionaryCreate(kCFAllocatorDefault, public_key_options_key,
+			public_key_options_values, sizeof(public_key_options_key) / sizeof(void *),
+			&kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
+		require_quiet(public_key_options != NULL, ecdsa_exit);
+
+		// create the public key
+		key = SecKeyCreateWithData(public_key_CFData, public_key_options, &cf_error);
+		require_action(key != mDNSNULL, ecdsa_exit, log_error("SecKeyCreateWithData failed: %@", CFErrorCopyDescription(cf_error)));
+
+	ecdsa_exit:
+		if (public_key_CFData			!= NULL) CFRelease(public_key_CFData);
+		if (public_key_options			!= NULL) CFRelease(public_key_options);
+		if (cf_error					!= NULL) CFRelease(cf_error);
+		if (ecdsa_key_bytes_encoding	!= mDNSNULL) free(ecdsa_key_bytes_encoding);
+	}
+
+	return key;
+}
+
+//======================================================================================================================
+//	copy_key_for_dnskey
+//		returns the SecKey of the DNSKEY from the key cache, or creates and caches it, the caller releases it
+//======================================================================================================================
+
+mDNSlocal SecKeyRef _Nullable
+copy_key_for_dnskey(const dnssec_dnskey_t * const _Nonnull dnskey, const void * const _Nonnull public_key_type) {
+	mDNSu8						public_key_digest[SHA256_OUTPUT_SIZE];
+	dnssec_key_cache_entry_t *	victim	= mDNSNULL;
+	SecKeyRef					key;
+
+	// The cache is only an optimization, if the digest cannot be computed, just create the key.
+	require_quiet(dnskey->public_key != mDNSNULL, create);
+	require_quiet(calculate_digest_for_data(dnskey->public_key, dnskey->public_key_length, DIGEST_SHA_256,
+		public_key_digest, sizeof(public_key_digest)), create);
+
+	os_unfair_lock_lock(&key_cache_lock);
+	key_cache_clock++;
+	for (mDNSu32 i = 0; i < DNSSEC_KEY_CACHE_SIZE; i++) {
+		dnssec_key_cache_entry_t * const entry = &key_cache[i];
+
+		if (entry->key != mDNSNULL && entry->key_tag == dnskey->key_tag && entry->algorithm == dnskey->algorithm
+			&& memcmp(entry->public_key_digest, public_key_digest, sizeof(public_key_digest)) == 0) {
+			entry->last_used = key_cache_clock;
+			key = (SecKeyRef)CFRetain(entry->key);
+			os_unfair_lock_unlock(&key_cache_lock);
+			return key;
+		}
+	}
+	os_unfair_lock_unlock(&key_cache_lock);
+
+	// The key is created without the lock held, another worker creating the same one meanwhile only costs a duplicate.
+	key = create_key_for_dnskey(dnskey, public_key_type);
+	require_quiet(key != mDNSNULL, exit);
+
+	os_unfair_lock_lock(&key_cache_lock);
+	for (mDNSu32 i = 0; i < DNSSEC_KEY_CACHE_SIZE; i++) {
+		dnssec_key_cache_entry_t * const entry = &key_cache[i];
+
+		if (entry->key == mDNSNULL) {
+			if (victim == mDNSNULL || victim->key != mDNSNULL) {
+				victim = entry;
+			}
+		} else if (victim == mDNSNULL || (victim->key != mDNSNULL && entry->last_used < victim->last_used)) {
+			victim = entry;
+		}
+	}
+	if (victim->key != mDNSNULL) {
+		CFRelease(victim->key);
+	}
+	memcpy(victim->public_key_digest, public_key_digest, sizeof(public_key_digest));
+	victim->key			= (SecKeyRef)CFRetain(key);
+	victim->last_used	= key_cache_clock;
+	victim->key_tag		= dnskey->key_tag;
+	victim->algorithm	= dnskey->algorithm;
+	os_unfair_lock_unlock(&key_cache_lock);
+
+exit:
+	return key;
+
+create:
+	return create_key_for_dnskey(dnskey, public_key_type);
+}
+
 //======================================================================================================================
 //	validate_signed_data_with_rrsig_and_dnskey
 //		the main function doing signature validation
@@ -149,6 +308,7 @@ validate_signed_data_with_rrsig_and_dnskey(
 	CFDataRef				sig_to_match_CFData			= mDNSNULL;
 	SecKeyRef				key							= mDNSNULL;
 	digest_type_t			digest_type					= DIGEST_UNSUPPORTED;
+	mDNSu8					data_digest[MAX_HASH_OUTPUT_SIZE];
 
 	// choose different signature validation algorithm and public key
 	switch (dnskey->algorithm) {
@@ -185,70 +345,22 @@ validate_signed_data_with_rrsig_and_dnskey(
 			goto exit;
 	}
 
-	// public key creation for RSA and ECDSA is different
-	if (public_key_type == kSecAttrKeyTypeRSA) {
-		// RSA
-		// The format of public key is not the standard PEM DER ASN.1 PKCS#1 RSA Public key format, so we need to parse
-		// the modulus and exponent explicitly.
-		SecRSAPublicKeyParams params;
-		parse_rsa_pubkey(dnskey->public_key, dnskey->public_key_length, &params.modulus, &params.modulusLength, &params.exponent, &params.exponentLength);
-		key = SecKeyCreateRSAPublicKey(kCFAllocatorDefault, (const uint8_t *)&params, sizeof(params), kSecKeyEncodingRSAPublicParams);
-		require_quiet(key != mDNSNULL, exit);
+	// the key object is shared by every RRSIG made with the same DNSKEY
+	key = copy_key_for_dnskey(dnskey, public_key_type);
+	require_quiet(key != mDNSNULL, exit);
 
+	if (public_key_type == kSecAttrKeyTypeRSA) {
+		// RSA uses original data to verify record.
 		data_or_digest_be_signed			= signed_data;
 		data_or_digest_be_signed_length		= signed_data_length;
-		// RSA uses original data to verify record.
-	} else if (public_key_type == kSecAttrKeyTypeECSECPrimeRandom) {
-		// ECDSA
-		const void *	public_key_options_key[]	= {kSecAttrKeyType,						kSecAttrKeyClass};
-		const void *	public_key_options_values[] = {kSecAttrKeyTypeECSECPrimeRandom,		kSecAttrKeyClassPublic};
-		CFDataRef		public_key_CFData			= mDNSNULL;
-		CFDictionaryRef public_key_options			= mDNSNULL;
-		CFNumberRef		key_size_CFNumber			= mDNSNULL;
-		mDNSu8 *		ecdsa_key_bytes_encoding	= mDNSNULL;
-		mDNSu32			ecdsa_key_length			= dnskey->public_key_length + 1;
-		mDNSu8			data_digest[MAX_HASH_OUTPUT_SIZE];
-
-		// create security framework readable public key format
-		ecdsa_key_bytes_encoding = malloc(ecdsa_key_length);
-		require_quiet(ecdsa_key_bytes_encoding != mDNSNULL, ecdsa_exit);
-
-		ecdsa_key_bytes_encoding[0] = 4;
-		memcpy(ecdsa_key_bytes_encoding + 1, dnskey->public_key, dnskey->public_key_length);
-
-		public_key_CFData = CFDataCreate(kCFAllocatorDefault, ecdsa_key_bytes_encoding, ecdsa_key_length);
-		require_quiet(public_key_CFData != NULL, ecdsa_exit);
-
-		public_key_options = CFDictionaryCreate(kCFAllocatorDefault, public_key_options_key,
-			public_key_options_values, sizeof(public_key_options_key) / sizeof(void *),
-			&kCFTypeDictionaryKeyCallBacks, &kCFTypeDictionaryValueCallBacks);
-		require_quiet(public_key_options != NULL, ecdsa_exit);
-
-		// create the public key
-		key = SecKeyCreateWithData(public_key_CFData, public_key_options, &cf_error);
-		require_action(key != mDNSNULL, ecdsa_exit, log_error("SecKeyCreateWithData failed: %@", CFErrorCopyDescription(cf_error)));
-
+	} else {
 		// ECDSA uses digest to verify record.
 		mDNSBool calculated = calculate_digest_for_data(signed_data, signed_data_length, digest_type, data_digest, sizeof(data_digest));
-		require_action(calculated, ecdsa_exit, log_error("calculate_digest_for_data failed to return the digest;"));
+		require_action(calculated, exit, log_error("calculate_digest_for_data failed to return the digest;"));
 		data_or_digest_be_signed = data_digest;
 		// data_be_signed_length is set in the previous switch statement.
-
-	ecdsa_exit:
-		if (public_key_CFData			!= NULL) CFRelease(public_key_CFData);
-		if (public_key_options			!= NULL) CFRelease(public_key_options);
-		if (key_size_CFNumber			!= NULL) CFRelease(key_size_CFNumber);
-		if (cf_error					!= NULL) {
-			CFRelease(cf_error);
-			cf_error = mDNSNULL;
-		}
-		if (ecdsa_key_bytes_encoding	!= mDNSNULL) free(ecdsa_key_bytes_encoding);
-	} else {
-		goto exit;
 	}
 
-	require_quiet(key != mDNSNULL, exit);
-
 	// create data and signature to verify
 	data_to_verify_CFData	= CFDataCreate(kCFAllocatorDefault, data_or_digest_be_signed, data_or_digest_be_signed_length);
 	sig_to_match_CFData		= CFDataCreate(kCFAllocatorDefault, rrsig->signature, rrsig->signature_length);
@@ -271,6 +383,72 @@ exit:
 	return valid;
 }
 
+//======================================================================================================================
+//	validate_signed_data_batch_with_rrsig_and_dnskey
+//		verifies all the signatures of a response in one pass, the signatures made with the same DNSKEY share one key
+//		object through the key cache
+//======================================================================================================================
+
+mDNSexport mDNSu32
+validate_signed_data_batch_with_rrsig_and_dnskey(
+	const mDNSu32										request_id,
+	dnssec_signature_to_verify_t * const	_Nonnull	signatures,
+	const mDNSu32										signature_count) {
+
+	mDNSu32 valid_count = 0;
+
+	for (mDNSu32 i = 0; i < signature_count; i++) {
+		dnssec_signature_to_verify_t * const signature = &signatures[i];
+
+		signature->valid = validate_signed_data_with_rrsig_and_dnskey(request_id, signature->signed_data,
+			signature->signed_data_length, signature->rrsig, signature->dnskey);
+		if (signature->valid) {
+			valid_count++;
+		}
+	}
+
+	return valid_count;
+}
+
+//======================================================================================================================
+//	validate_signed_data_batch_on_workers
+//		verifies the signatures on the verification queue, several at a time, and then calls the completion there
+//======================================================================================================================
+
+mDNSexport mDNSBool
+validate_signed_data_batch_on_workers(
+	const mDNSu32										request_id,
+	dnssec_signature_to_verify_t * const	_Nonnull	signatures,
+	const mDNSu32										signature_count,
+	dispatch_block_t						_Nonnull	completion) {
+
+	static dispatch_once_t	once;
+	static dispatch_queue_t	verification_queue;
+	const unsigned int		queued	= atomic_fetch_add(&queued_verifications, signature_count);
+
+	if (queued + signature_count > DNSSEC_MAX_QUEUED_VERIFICATIONS) {
+		atomic_fetch_sub(&queued_verifications, signature_count);
+		log_debug("[R%u] Verification workers are full, verifying %u signatures inline; queued=%u", request_id,
+			signature_count, queued);
+		return mDNSfalse;
+	}
+
+	dispatch_once(&once, ^{
+		verification_queue = dispatch_queue_create("com.apple.mDNSResponder.dnssec-verification", DISPATCH_QUEUE_CONCURRENT);
+	});
+	dispatch_async(verification_queue, ^{
+		dispatch_apply(signature_count, verification_queue, ^(size_t i) {
+			dnssec_signature_to_verify_t * const signature = &signatures[i];
+			signature->valid = validate_signed_data_with_rrsig_and_dnskey(request_id, signature->signed_data,
+				signature->signed_data_length, signature->rrsig, signature->dnskey);
+		});
+		atomic_fetch_sub(&queued_verifications, signature_count);
+		completion();
+	});
+
+	return mDNStrue;
+}
+
 //======================================================================================================================
 //	Hash
 //======================================================================================================================
@@ -356,12 +534,12 @@ exit:
 }
 
 //======================================================================================================================
-//	calculate_hash_for_nsec3
+//	compute_hash_for_nsec3
 //		get the hash value for nsec3 which includes salt and multiple iteration
 //======================================================================================================================
 
-mDNSexport mDNSBool
-calculate_hash_for_nsec3(
+mDNSlocal mDNSBool
+compute_hash_for_nsec3(
 	mDNSu8 * const			_Nonnull	hash_buffer,
 	const mDNSu32						buffer_size,
 	const mDNSu8						hash_type,
@@ -409,6 +587,103 @@ exit:
 	return calculated;
 }
 
+//======================================================================================================================
+//	NSEC3 hash cache
+//		Every negative response with NSEC3 makes the closest encloser proof hash the qname and each of its ancestors
+//		with the zone's salt and iteration count, and the same names are hashed again for the next NXDOMAIN under the
+//		same zone. The results are kept in a small direct-mapped table indexed by (name, salt, iterations), so that the
+//		walk up the name only does the iterated SHA-1 for the labels that have not been seen yet.
+//======================================================================================================================
+
+#ifndef NSEC3_HASH_CACHE_SIZE
+#define NSEC3_HASH_CACHE_SIZE	64	// number of NSEC3 hashes remembered, must be a power of two
+#endif
+
+typedef struct nsec3_hash_cache_entry nsec3_hash_cache_entry_t;
+struct nsec3_hash_cache_entry {
+	mDNSu8		name[MAX_DOMAIN_NAME];		// The name that has been hashed, as it is passed to calculate_hash_for_nsec3.
+	mDNSu8		salt[UINT8_MAX];
+	mDNSu8		hash[SHA1_OUTPUT_SIZE];
+	mDNSu16		name_length;
+	mDNSu16		iterations;
+	mDNSu8		salt_length;
+	mDNSBool	in_use;
+};
+
+mDNSlocal nsec3_hash_cache_entry_t nsec3_hash_cache[NSEC3_HASH_CACHE_SIZE];
+
+mDNSlocal mDNSu32
+nsec3_hash_cache_index(
+	const mDNSu8 * const	_Nonnull	name,
+	const mDNSu16						name_length,
+	const mDNSu8 * const	_Nullable	salt,
+	const mDNSu32						salt_length,
+	const mDNSu16						iterations) {
+
+	// FNV-1a over the name, the salt and the iteration count.
+	mDNSu32 hash = 2166136261U;
+	for (mDNSu32 i = 0; i < name_length; i++) {
+		hash = (hash ^ name[i]) * 16777619U;
+	}
+	for (mDNSu32 i = 0; i < salt_length; i++) {
+		hash = (hash ^ salt[i]) * 16777619U;
+	}
+	hash = (hash ^ (iterations & 0xFF)) * 16777619U;
+	hash = (hash ^ (iterations >> 8)) * 16777619U;
+
+	return hash & (NSEC3_HASH_CACHE_SIZE - 1);
+}
+
+//======================================================================================================================
+//	calculate_hash_for_nsec3
+//======================================================================================================================
+
+mDNSexport mDNSBool
+calculate_hash_for_nsec3(
+	mDNSu8 * const			_Nonnull	hash_buffer,
+	const mDNSu32						buffer_size,
+	const mDNSu8						hash_type,
+	const mDNSu8 * const	_Nonnull	name,
+	const mDNSu16						name_length,
+	const mDNSu8 * const	_Nullable	salt,
+	const mDNSu32						salt_length,
+	const mDNSu16						iterations) {
+
+	nsec3_hash_cache_entry_t *	entry;
+	mDNSBool					calculated;
+
+	// Only SHA-1 is defined for NSEC3, anything else is left to compute_hash_for_nsec3 to reject.
+	require_quiet(hash_type == NSEC3_HASH_ALGORITHM_SHA_1 && buffer_size >= SHA1_OUTPUT_SIZE, compute);
+	require_quiet(name_length <= MAX_DOMAIN_NAME && salt_length <= UINT8_MAX, compute);
+
+	entry = &nsec3_hash_cache[nsec3_hash_cache_index(name, name_length, salt, salt_length, iterations)];
+	if (entry->in_use && entry->name_length == name_length && entry->salt_length == salt_length
+		&& entry->iterations == iterations && memcmp(entry->name, name, name_length) == 0
+		&& (salt_length == 0 || memcmp(entry->salt, salt, salt_length) == 0)) {
+		memcpy(hash_buffer, entry->hash, SHA1_OUTPUT_SIZE);
+		return mDNStrue;
+	}
+
+	calculated = compute_hash_for_nsec3(hash_buffer, buffer_size, hash_type, name, name_length, salt, salt_length, iterations);
+	require_quiet(calculated, exit);
+
+	memcpy(entry->name, name, name_length);
+	if (salt_length != 0) {
+		memcpy(entry->salt, salt, salt_length);
+	}
+	memcpy(entry->hash, hash_buffer, SHA1_OUTPUT_SIZE);
+	entry->name_length	= name_length;
+	entry->salt_length	= (mDNSu8)salt_length;
+	entry->iterations	= iterations;
+	entry->in_use		= mDNStrue;
+
+exit:
+	return calculated;
+
+compute:
+	return compute_hash_for_nsec3(hash_buffer, buffer_size, hash_type, name, name_length, salt, salt_length, iterations);
+}
+
 //======================================================================================================================
 //	get_hash_length_for_nsec3_hash_type
 //======================================================================================================================
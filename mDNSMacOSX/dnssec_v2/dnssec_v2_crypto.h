@@ -11,6 +11,7 @@
 #include "mDNSEmbeddedAPI.h"
 #if MDNSRESPONDER_SUPPORTS(APPLE, DNSSECv2)
 #include <stdio.h>
+#include <dispatch/dispatch.h>
 #include <corecrypto/ccsha1.h>
 #include "dnssec_v2_structs.h"
 
@@ -85,6 +86,32 @@ validate_signed_data_with_rrsig_and_dnskey(
 	const dnssec_rrsig_t * const	_Nonnull	rrsig,
 	const dnssec_dnskey_t * const	_Nonnull	dnskey);
 
+// One signature of a batch passed to validate_signed_data_batch_with_rrsig_and_dnskey.
+typedef struct dnssec_signature_to_verify dnssec_signature_to_verify_t;
+struct dnssec_signature_to_verify {
+	const mDNSu8 *			_Nonnull	signed_data;		// The reconstructed data covered by the RRSIG.
+	mDNSu32								signed_data_length;
+	const dnssec_rrsig_t *	_Nonnull	rrsig;
+	const dnssec_dnskey_t *	_Nonnull	dnskey;
+	mDNSBool							valid;				// Set to the verification result.
+};
+
+mDNSexport mDNSu32
+validate_signed_data_batch_with_rrsig_and_dnskey(
+	const mDNSu32										request_id,
+	dnssec_signature_to_verify_t * const	_Nonnull	signatures,
+	const mDNSu32										signature_count);
+
+// Verifies the signatures on the verification worker queue, setting each one's valid, and then calls completion on that
+// queue. The signatures, and everything they point to, must stay as they are until then. Returns false, having done
+// nothing, if the workers already have as much work as they are allowed to queue, and the caller should verify itself.
+mDNSexport mDNSBool
+validate_signed_data_batch_on_workers(
+	const mDNSu32										request_id,
+	dnssec_signature_to_verify_t * const	_Nonnull	signatures,
+	const mDNSu32										signature_count,
+	dispatch_block_t						_Nonnull	completion);
+
 mDNSexport mDNSBool
 calculate_digest_for_data(
 	const mDNSu8 * const	_Nonnull	data,
@@ -13,6 +13,7 @@
 #include "dnssec_v2.h"
 #include "dnssec_v2_helper.h"
 #include "dnssec_v2_retrieval.h"
+#include "dnssec_v2_validation.h"
 #include "dnssec_v2_client.h"
 
 
@@ -119,6 +120,7 @@ create_dnssec_context_t(
 	context->me = request;
 
 	list_init(&context->zone_chain, sizeof(dnssec_zone_t));
+	list_init(&context->prefetch_requests, sizeof(QueryRecordClientRequest));
 
 	// initialize original request fields
 	original_t * const original = &context->original;
@@ -218,7 +220,9 @@ print_dnssec_context_t(const dnssec_context_t * const _Nonnull context) {
 #pragma mark destroy_dnssec_context_t
 mDNSexport void
 destroy_dnssec_context_t(dnssec_context_t * const _Nonnull context) {
+	cancel_dnssec_verifications(context);
 	list_uninit(&context->zone_chain);
+	list_uninit(&context->prefetch_requests);
 	uninitialize_returned_answers_t(&context->returned_answers);
 	free(context);
 }
@@ -316,6 +320,147 @@ exit:
 	return result;
 }
 
+//======================================================================================================================
+//	prefetch_result_reply
+//		The answers of the speculative queries are only wanted in the cache, the real zone queries will pick them up.
+//======================================================================================================================
+
+mDNSlocal void
+prefetch_result_reply(
+	mDNS *const						_Null_unspecified	__unused m,
+	DNSQuestion *					_Null_unspecified	__unused question,
+	const ResourceRecord * const	_Null_unspecified	__unused answer,
+	QC_result											__unused add_record,
+	DNSServiceErrorType									__unused dns_result_error,
+	void *							_Null_unspecified	context) {
+
+	dnssec_context_t * const dnssec_context = (dnssec_context_t *)context;
+
+	// mDNSCore passes the denial of existence records of a negative answer through the question's DNSSEC context,
+	// drop them so that they are never taken as the ones of the original response.
+	dnssec_context->denial_of_existence_records = mDNSNULL;
+}
+
+//======================================================================================================================
+//	start_dnssec_prefetch_request
+//======================================================================================================================
+
+mDNSlocal mStatus
+start_dnssec_prefetch_request(
+	dnssec_context_t * const	_Nonnull	context,
+	const mDNSu8 * const		_Nonnull	name,
+	const mDNSu16							type) {
+
+	mStatus								error;
+	QueryRecordClientRequest *			request;
+	original_request_parameters_t *	params	= &context->original.original_parameters;
+
+	error = list_append_uinitialized(&context->prefetch_requests, sizeof(QueryRecordClientRequest), (void **)&request);
+	require_action(error == mStatus_NoError, exit,
+		log_debug("list_append_uinitialized failed; error_description='%s'", mStatusDescription(error)));
+	bzero(request, sizeof(QueryRecordClientRequest));
+
+	// Use the same parameters as the real zone queries, so that the cached answers match them.
+	error = QueryRecordOpStartForClientRequest(
+		&request->op, params->request_id, (const domainname *)name, type,
+		params->question_class, params->interface_id, params->service_id, params->flags, params->append_search_domains,
+		params->pid, params->uuid, params->uid,
+#if MDNSRESPONDER_SUPPORTS(APPLE, AUDIT_TOKEN)
+		params->has_peer_audit_token ? &params->peer_audit_token : mDNSNULL,
+		params->has_delegate_audit_token ? &params->delegate_audit_token : mDNSNULL,
+#endif
+#if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+		params->resolver_uuid, params->need_encryption, params->custom_id,
+#endif
+		prefetch_result_reply, context);
+	if (error != mStatus_NoError) {
+		log_debug("QueryRecordOpStart failed; error_description='%s'", mStatusDescription(error));
+		list_delete_node_with_data_ptr(&context->prefetch_requests, request);
+	}
+
+exit:
+	return error;
+}
+
+//======================================================================================================================
+//	prefetch_ancestor_zone_records
+//		Starts the DNSKEY/DS queries of every ancestor of the signer name up to the closest trust anchor at once, instead
+//		of waiting for each zone to be validated before asking for its parent.
+//======================================================================================================================
+
+mDNSlocal void
+prefetch_ancestor_zone_records(dnssec_context_t * const _Nonnull context, const mDNSu8 * const _Nonnull signer_name) {
+	const mDNSu8 *				name				= signer_name;
+	const trust_anchors_t *	anchor;
+	mDNSu32						zone_count			= list_count_node(&context->zone_chain);
+	mStatus						error;
+
+	while (!is_root_domain(name) && zone_count < MAX_ZONES_ALLOWED) {
+		name += 1 + *name;
+		zone_count++;
+
+		anchor = get_trust_anchor_with_name(name);
+		if (anchor != mDNSNULL && trust_anchor_contains_dnskey(anchor)) {
+			break;
+		}
+
+		error = start_dnssec_prefetch_request(context, name, kDNSType_DNSKEY);
+		require_quiet(error == mStatus_NoError, exit);
+
+		if (anchor != mDNSNULL && trust_anchor_contains_ds(anchor)) {
+			break;
+		}
+
+		if (!is_root_domain(name)) {
+			error = start_dnssec_prefetch_request(context, name, kDNSType_DS);
+			require_quiet(error == mStatus_NoError, exit);
+		}
+	}
+
+	log_debug("[R%u] %u speculative DNSKEY/DS queries started", context->original.original_parameters.request_id,
+		list_count_node(&context->prefetch_requests));
+exit:
+	return;
+}
+
+//======================================================================================================================
+//	stop_dnssec_prefetch_requests_with_name
+//		Once the real queries of a zone have been started, they are answered by the cache (or become the duplicates of the
+//		outstanding speculative ones inside mDNSCore), so the speculative queries for the same name are no longer needed.
+//======================================================================================================================
+
+mDNSlocal void
+stop_dnssec_prefetch_requests_with_name(dnssec_context_t * const _Nonnull context, const mDNSu8 * const _Nonnull name) {
+	list_t * const	requests	= &context->prefetch_requests;
+	list_node_t *	node		= list_get_first(requests);
+	list_node_t *	next;
+
+	while (!list_has_ended(requests, node)) {
+		QueryRecordClientRequest * const request = (QueryRecordClientRequest *)node->data;
+		next = list_next(node);
+		if (DOMAIN_NAME_EQUALS(request->op.q.qname.c, name)) {
+			QueryRecordOpStopForClientRequest(&request->op);
+			list_node_delete(node);
+		}
+		node = next;
+	}
+}
+
+//======================================================================================================================
+//	stop_dnssec_prefetch_requests
+//======================================================================================================================
+
+mDNSexport void
+stop_dnssec_prefetch_requests(dnssec_context_t * const _Nonnull context) {
+	list_t * const requests = &context->prefetch_requests;
+
+	for (list_node_t *node = list_get_first(requests); !list_has_ended(requests, node); node = list_next(node)) {
+		QueryRecordClientRequest * const request = (QueryRecordClientRequest *)node->data;
+		QueryRecordOpStopForClientRequest(&request->op);
+	}
+	list_node_delete_all(requests);
+}
+
 //======================================================================================================================
 //	fetch_necessary_dnssec_records
 //======================================================================================================================
@@ -395,6 +540,12 @@ fetch_necessary_dnssec_records(dnssec_context_t * const _Nonnull context, mDNSBo
 			require_action(error == mStatus_NoError, exit, retrieval_result = dnssec_retrieval_query_failed;
 							log_debug("QueryRecordOpStart failed; error_description='%s'", mStatusDescription(error)));
 		}
+
+		stop_dnssec_prefetch_requests_with_name(context, parent_zone_name);
+		if (list_count_node(zones) == 1 && zone->trust_anchor == mDNSNULL) {
+			// The rest of the chain is only known one zone at a time, start querying all the ancestors in parallel.
+			prefetch_ancestor_zone_records(context, parent_zone_name);
+		}
 	} else {
 		// special case where the trust anchor does not verify the records
 		require_action_quiet(anchor_reached, exit,
@@ -106,6 +106,9 @@ add_denial_of_existence_records(
 mDNSexport dnssec_retrieval_result_t
 fetch_necessary_dnssec_records(dnssec_context_t * const _Nonnull context, mDNSBool anchor_reached);
 
+mDNSexport void
+stop_dnssec_prefetch_requests(dnssec_context_t * const _Nonnull context);
+
 // list_t<dnssec_zone_t>
 mDNSexport dnssec_zone_t * _Nullable
 find_dnssec_zone_t(const list_t * const _Nonnull zones, const mDNSu8 * const _Nonnull name);
@@ -459,6 +459,7 @@ struct returned_answers {			// This structure contains all the records that are
 // This structure contains the DNSSEC context that is needed to track additional information that is not provided by
 // mDNSCore, each DNSSEC-enabled DNS request would have a seperated DNSSEC context.
 typedef struct dnssec_context dnssec_context_t;
+typedef struct dnssec_verification_batch dnssec_verification_batch_t;	// Defined in dnssec_v2_validation.c.
 struct dnssec_context {
 	// Necessary request
 	QueryRecordClientRequest *		_Nonnull	me;								// The request of the question that we are currently working on.
@@ -466,6 +467,7 @@ struct dnssec_context {
 
 	// Zone records that could be used to validate records.
 	list_t										zone_chain;						// list_t<dnssec_zone_t>, the validation tree consists of zone nodes from root to leaf.
+	list_t										prefetch_requests;				// list_t<QueryRecordClientRequest>, speculative DNSKEY/DS queries for the ancestors of the first signer.
 
 	// original request fields
 	original_t original;														// Information about the user's original request.
@@ -476,6 +478,11 @@ struct dnssec_context {
 	// save the records that are returned to the user
 	returned_answers_t							returned_answers;				// The records that have been returned to the user.
 
+	// signature verification off the core thread, see validate_dnssec_with_workers
+	dnssec_verification_batch_t *	_Nullable	pending_verifications;			// The signatures out with the verification workers, one batch at a time so results come back in order.
+	dnssec_verification_batch_t *	_Nullable	finished_verifications;			// The batches back from the workers, used until the validation has a result.
+	DNSServiceErrorType							pending_dns_result_error;		// The error of the latest answer handled while a batch was out, for when validation resumes.
+
 	// DNSSEC context pointer
 	dnssec_context_t *				_Nullable	primary_dnssec_context;			// This points to the initial DNSSEC context of the first query coming from the user, i.e. the first name in the CNAME chain.
 	dnssec_context_t *				_Nullable	subtask_dnssec_context;			// If the DNSSEC-enabled DNS query has CNAMEs, this field is used to create another new DNSSEC context that resolves and validates the new CNAME.
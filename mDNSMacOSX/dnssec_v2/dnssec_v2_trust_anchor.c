@@ -128,6 +128,25 @@ print_trust_anchors_t(const trust_anchors_t * const _Nonnull anchor, mDNSu8 num_
 	}
 }
 
+//======================================================================================================================
+//	trust_anchor_ds_comparator
+//		puts the DS trust anchor with the strongest digest first, so that it is the one matched against the DNSKEY
+//======================================================================================================================
+
+mDNSlocal mDNSs8
+trust_anchor_ds_comparator(const list_node_t * _Nonnull const left, const list_node_t * _Nonnull const right) {
+	const mDNSs16 left_priority		= get_priority_of_ds_digest(((const dnssec_ds_t *)left->data)->digest_type);
+	const mDNSs16 right_priority	= get_priority_of_ds_digest(((const dnssec_ds_t *)right->data)->digest_type);
+
+	if (left_priority > right_priority) {
+		return -1;
+	} else if (left_priority < right_priority) {
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
 //======================================================================================================================
 //	init_and_load_trust_anchors
 //		load trust anchor when mDNSResponder initializes
@@ -135,7 +154,7 @@ print_trust_anchors_t(const trust_anchors_t * const _Nonnull anchor, mDNSu8 num_
 
 mDNSexport mStatus
 init_and_load_trust_anchors(void) {
-	mStatus				error;
+	mStatus				error						= mStatus_NoError;
 	list_t *			trust_anchor_list			= &trust_anchors;
 
 	list_init(trust_anchor_list, sizeof(trust_anchors_t));
@@ -145,6 +164,17 @@ init_and_load_trust_anchors(void) {
 		trust_anchors_t *				trust_anchors_from_same_zone	= get_trust_anchor_with_name(hardcoded_trust_anchor_ds->name.c);
 		trust_anchors_t	*				new_trust_anchors_initialized	= mDNSNULL;
 		dnssec_ds_t * 					ds_to_insert;
+
+		// What would otherwise be checked every time the anchor is matched against a DNSKEY is checked once here: an
+		// anchor whose digest cannot be computed, or whose length does not fit its digest type, can never match.
+		if (get_priority_of_ds_digest(hardcoded_trust_anchor_ds->digest_type) < 0
+			|| get_digest_length_for_ds_digest_type(hardcoded_trust_anchor_ds->digest_type) != hardcoded_trust_anchor_ds->digest_length) {
+			log_error("Ignoring unusable DS trust anchor; name=" PRI_DM_NAME ", key_tag=%u, digest_type=%u, digest_length=%u",
+				DM_NAME_PARAM(&hardcoded_trust_anchor_ds->name), hardcoded_trust_anchor_ds->key_tag,
+				hardcoded_trust_anchor_ds->digest_type, hardcoded_trust_anchor_ds->digest_length);
+			continue;
+		}
+
 		if (trust_anchors_from_same_zone == mDNSNULL) {
 			error = list_append_uinitialized(trust_anchor_list, sizeof(trust_anchors_t), (void **)&trust_anchors_from_same_zone);
 			require_quiet(error == mStatus_NoError, for_loop_exit);
@@ -164,7 +194,7 @@ init_and_load_trust_anchors(void) {
 
 		ds_to_insert->dnssec_rr.rr_type			= kDNSType_DS;
 		ds_to_insert->dnssec_rr.rr_class		= 1; // IN_CLASS
-		ds_to_insert->dnssec_rr.rdata_length	= 36; // 4 + 32
+		ds_to_insert->dnssec_rr.rdata_length	= 4 + hardcoded_trust_anchor_ds->digest_length;
 		ds_to_insert->dnssec_rr.name_hash		= DomainNameHashValue(&trust_anchors_from_same_zone->name);
 		memcpy(ds_to_insert->dnssec_rr.name.c, trust_anchors_from_same_zone->name.c, DomainNameLength(&trust_anchors_from_same_zone->name));
 		ds_to_insert->dnssec_rr.rdata_hash		= 0; // fake value
@@ -179,6 +209,10 @@ init_and_load_trust_anchors(void) {
 		}
 	}
 
+	for (list_node_t *node = list_get_first(trust_anchor_list); !list_has_ended(trust_anchor_list, node); node = list_next(node)) {
+		list_sort(&((trust_anchors_t *)node->data)->ds_trust_anchors, &trust_anchor_ds_comparator);
+	}
+
 	return error;
 }
 
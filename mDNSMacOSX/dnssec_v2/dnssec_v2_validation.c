@@ -10,6 +10,7 @@
 #include <string.h>					// for strerror
 #include <errno.h>					// for errno
 #include "DNSCommon.h"				// DomainNameHashValue
+#include "mDNSMacOSX.h"				// KQueueLock
 #include "dnssec_v2_structs.h"
 #include "dnssec_v2_validation.h"
 #include "dnssec_v2_retrieval.h"
@@ -26,6 +27,14 @@
 #define NSEC3_FLAG_OPT_OUT_BIT	1
 #define NSEC3_FLAG_SET			NSEC3_FLAG_OPT_OUT_BIT
 
+#ifndef DNSSEC_VERIFICATION_CACHE_SIZE
+#define DNSSEC_VERIFICATION_CACHE_SIZE	128	// number of signature verification results remembered
+#endif
+
+#ifndef DNSSEC_DS_LINK_CACHE_SIZE
+#define DNSSEC_DS_LINK_CACHE_SIZE		32	// number of DS to DNSKEY matches remembered
+#endif
+
 //======================================================================================================================
 // MARK: - validator type define
 //======================================================================================================================
@@ -60,6 +69,86 @@ struct dnssec_validator_node {
 	mDNSBool									trusted;
 };
 
+//======================================================================================================================
+// MARK: - signature verification cache type define
+//======================================================================================================================
+// A successful signature verification is remembered by the digest of the signed data (which covers the canonical
+// RRset and the RRSIG fields, including the key tag), the digest of the signature and the digest of the DNSKEY that was
+// used, so that an RRset validated for many questions only goes through the public key operation once. An entry is
+// used until the RRSIG expires, or until the original TTL has passed since the verification, whichever comes first.
+typedef struct dnssec_verification_cache_entry dnssec_verification_cache_entry_t;
+struct dnssec_verification_cache_entry {
+	mDNSu8		signed_data_digest[SHA256_OUTPUT_SIZE];
+	mDNSu8		signature_digest[SHA256_OUTPUT_SIZE];
+	mDNSu8		public_key_digest[SHA256_OUTPUT_SIZE];
+	mDNSu32		expiration;		// The epoch time after which the entry must not be used.
+	mDNSu32		last_used;		// The epoch time when the entry was last used, the least recently used one is replaced.
+	mDNSu16		key_tag;		// The key tag of the DNSKEY.
+	mDNSu8		algorithm;		// The algorithm of the DNSKEY.
+	mDNSBool	in_use;
+};
+
+mDNSlocal dnssec_verification_cache_entry_t verification_cache[DNSSEC_VERIFICATION_CACHE_SIZE];
+
+//======================================================================================================================
+// MARK: - DS link cache type define
+//======================================================================================================================
+// A DS that has matched a DNSKEY is remembered with its own fields and a copy of the DNSKEY rdata, so that every later
+// validation through the same zone (the root's KSK and its trust anchor above all) compares bytes instead of hashing
+// the key again. An entry is used until the TTL of the DNSKEY, or of the DS if it did not come from a trust anchor, has
+// passed since the match.
+typedef struct dnssec_ds_link_cache_entry dnssec_ds_link_cache_entry_t;
+struct dnssec_ds_link_cache_entry {
+	domainname				owner;							// The owner name of both the DS and the DNSKEY.
+	mDNSu32					owner_hash;
+	mDNSu8					ds_digest[MAX_HASH_OUTPUT_SIZE];
+	mDNSu16					ds_digest_length;
+	mDNSu16					key_tag;
+	mDNSu8					algorithm;
+	mDNSu8					digest_type;
+	mDNSu16					dnskey_rdata_length;
+	mDNSu8 *	_Nullable	dnskey_rdata;					// Owned by the entry.
+	mDNSu32					expiration;						// The epoch time after which the entry must not be used.
+	mDNSu32					last_used;						// The least recently used entry is replaced.
+	mDNSBool				in_use;
+};
+
+mDNSlocal dnssec_ds_link_cache_entry_t ds_link_cache[DNSSEC_DS_LINK_CACHE_SIZE];
+
+//======================================================================================================================
+// MARK: - asynchronous signature verification type define
+//======================================================================================================================
+
+// validate_dnssec_with_workers first runs the validation as a collecting pass: a signature that neither the cache nor the
+// context's finished batches can answer is copied into a batch and taken to be valid, so that the walk goes on to find
+// the rest, and the result of the pass is thrown away. The batch then goes to the verification workers, and once they
+// are done the validation runs again and finds its answers. Everything in a batch is its own copy, so the records it
+// came from can change or go away while it is out.
+typedef struct dnssec_verification dnssec_verification_t;
+struct dnssec_verification {
+	dnssec_verification_cache_entry_t	key;			// Identifies the signature, as it would in the cache.
+	mDNSu8 *				_Nullable	signed_data;
+	mDNSu32								signed_data_length;
+	dnssec_rrsig_t						rrsig;			// Copies whose signature and public_key point at buffers the
+	dnssec_dnskey_t						dnskey;			// verification owns, with their other pointers cleared.
+	mDNSBool							valid;
+};
+
+struct dnssec_verification_batch {
+	dnssec_verification_batch_t *	_Nullable	next;
+	dnssec_context_t *				_Nullable	context;	// Cleared if the context goes away while the batch is out.
+	dnssec_validation_resume_t		_Nullable	resume;
+	dnssec_verification_t *			_Nullable	verifications;
+	dnssec_signature_to_verify_t *	_Nullable	signatures;	// What the workers verify, pointing into verifications.
+	mDNSu32										count;
+	mDNSu32										capacity;
+	mDNSu32										request_id;
+};
+
+// Only used on the core thread, while validate_dnssec_with_workers runs the validation.
+mDNSlocal dnssec_context_t *			answering_context;	// Whose finished batches answer signatures.
+mDNSlocal dnssec_verification_batch_t *	collecting_batch;	// Where unanswered signatures go in a collecting pass.
+
 //======================================================================================================================
 // MARK: - local functions prototype
 //======================================================================================================================
@@ -326,6 +415,63 @@ check_rrsig_validity_with_dnssec_rr(
 	const dnssec_rrsig_t * const	_Nonnull	rrsig,
 	const dnssec_rr_t * const		_Nonnull	rr);
 
+mDNSlocal mDNSBool
+validate_signed_data_with_cache(
+	const mDNSu32								request_id,
+	const mDNSu8 * const			_Nonnull	signed_data,
+	const mDNSu32								signed_data_length,
+	const dnssec_rrsig_t * const	_Nonnull	rrsig,
+	const dnssec_dnskey_t * const	_Nonnull	dnskey);
+
+mDNSlocal mDNSBool
+make_verification_cache_entry(
+	const mDNSu8 * const						_Nonnull	signed_data,
+	const mDNSu32											signed_data_length,
+	const dnssec_rrsig_t * const				_Nonnull	rrsig,
+	const dnssec_dnskey_t * const				_Nonnull	dnskey,
+	dnssec_verification_cache_entry_t * const	_Nonnull	entry);
+
+mDNSlocal mDNSBool
+lookup_verification_cache(const dnssec_verification_cache_entry_t * const _Nonnull key);
+
+mDNSlocal void
+remember_verification(
+	const dnssec_verification_cache_entry_t * const	_Nonnull	key,
+	const dnssec_rrsig_t * const					_Nonnull	rrsig);
+
+mDNSlocal mDNSBool
+lookup_finished_verifications(
+	const dnssec_context_t * const					_Nonnull	context,
+	const dnssec_verification_cache_entry_t * const	_Nonnull	key,
+	mDNSBool * const								_Nonnull	out_valid);
+
+mDNSlocal mDNSBool
+add_verification_to_batch(
+	dnssec_verification_batch_t * const				_Nonnull	batch,
+	const dnssec_verification_cache_entry_t * const	_Nonnull	key,
+	const mDNSu8 * const							_Nonnull	signed_data,
+	const mDNSu32												signed_data_length,
+	const dnssec_rrsig_t * const					_Nonnull	rrsig,
+	const dnssec_dnskey_t * const					_Nonnull	dnskey);
+
+mDNSlocal void
+free_verification_batch(dnssec_verification_batch_t * const _Nonnull batch);
+
+mDNSlocal mDNSBool
+lookup_ds_link_cache(const dnssec_ds_t * const _Nonnull ds, const dnssec_dnskey_t * const _Nonnull ksk);
+
+mDNSlocal void
+remember_ds_link(const dnssec_ds_t * const _Nonnull ds, const dnssec_dnskey_t * const _Nonnull ksk);
+
+mDNSlocal void
+free_finished_verifications(dnssec_context_t * const _Nonnull context);
+
+mDNSlocal mDNSBool
+submit_verification_batch(dnssec_verification_batch_t * const _Nonnull batch);
+
+mDNSlocal void
+finish_verification_batch(dnssec_verification_batch_t * const _Nonnull batch);
+
 mDNSlocal dnssec_validation_result_t
 check_rrsig_validity_with_rrs(
 	const dnssec_rrsig_t * const	_Nonnull	rrsig,
@@ -413,6 +559,63 @@ rr_array_dedup(const dnssec_rr_t * rr_array[_Nonnull], const mDNSu8 rr_count);
 //======================================================================================================================
 
 
+// MARK: validate_dnssec_with_workers
+
+mDNSexport dnssec_validation_result_t
+validate_dnssec_with_workers(dnssec_context_t * const _Nonnull context, const dnssec_validation_resume_t _Nonnull resume) {
+	dnssec_verification_batch_t *	batch;
+	dnssec_validation_result_t		validation_result;
+
+	// The validation runs again on whatever has changed meanwhile when the batch that is out comes back.
+	require_action_quiet(context->pending_verifications == mDNSNULL, exit, validation_result = dnssec_validation_validating);
+
+	answering_context = context;
+	batch = calloc(1, sizeof(*batch));
+	if (batch == mDNSNULL) {
+		validation_result = validate_dnssec(context);
+		goto done;
+	}
+	batch->context		= context;
+	batch->resume		= resume;
+	batch->request_id	= context->original.original_parameters.request_id;
+
+	collecting_batch = batch;
+	validation_result = validate_dnssec(context);
+	collecting_batch = mDNSNULL;
+
+	if (batch->count == 0) {
+		// Every signature was answered, so the result stands.
+		free_verification_batch(batch);
+		goto done;
+	}
+	if (submit_verification_batch(batch)) {
+		context->pending_verifications = batch;
+		answering_context = mDNSNULL;
+		log_debug("[R%u] %u signatures sent to the verification workers", batch->request_id, batch->count);
+		validation_result = dnssec_validation_validating;
+		goto exit;
+	}
+	// The workers are full, so verify here as validate_dnssec always did.
+	free_verification_batch(batch);
+	validation_result = validate_dnssec(context);
+
+done:
+	answering_context = mDNSNULL;
+	free_finished_verifications(context);
+exit:
+	return validation_result;
+}
+
+mDNSexport void
+cancel_dnssec_verifications(dnssec_context_t * const _Nonnull context) {
+	if (context->pending_verifications != mDNSNULL) {
+		// The workers still have it; finish_verification_batch frees it without resuming once they are done.
+		context->pending_verifications->context = mDNSNULL;
+		context->pending_verifications = mDNSNULL;
+	}
+	free_finished_verifications(context);
+}
+
 // MARK: validate_dnssec
 
 mDNSexport dnssec_validation_result_t
@@ -877,7 +1080,6 @@ validate_nsec3_response(
 	const mDNSu8 * const					salt				= first_dnssec_nsec3->salt;
 	const mDNSu8							salt_length			= first_dnssec_nsec3->salt_length;
 	const mDNSu16							iterations			= first_dnssec_nsec3->iterations;
-	mDNSu8 *								qname_hash_b32		= mDNSNULL;
 	mDNSu16									qname_length		= DOMAIN_NAME_LENGTH(qname);
 	mDNSu8									canonical_name[MAX_DOMAIN_NAME];
 
@@ -929,7 +1131,8 @@ validate_nsec3_response(
 
 		mDNSu8					qname_hash[MAX_HASH_OUTPUT_SIZE];
 		mDNSu32					qname_hash_length;
-		mDNSu8					qname_hash_b32_length;
+		char					qname_hash_b32[mDNSBase32HexEncodedLength(MAX_HASH_OUTPUT_SIZE) + 1];
+		mDNSs32					qname_hash_b32_length;
 		const dnssec_nsec3_t *	nsec3_that_matches_qname = mDNSNULL;
 
 		// get the base32 format of qname hash
@@ -937,8 +1140,8 @@ validate_nsec3_response(
 		qname_hash_length = get_hash_length_for_nsec3_hash_type(hash_algorithm);
 		mDNSBool calculated = calculate_hash_for_nsec3(qname_hash, sizeof(qname_hash), hash_algorithm, qname, qname_length, salt, salt_length, iterations);
 		require_action(calculated, exit, validation_result = dnssec_validation_invalid_internal_state);
-		qname_hash_b32 = (mDNSu8 *)base_n_encode(DNSSEC_BASE_32_HEX, qname_hash, qname_hash_length);
-		qname_hash_b32_length = strlen((char *)qname_hash_b32);
+		qname_hash_b32_length = mDNSBase32HexEncode(qname_hash, qname_hash_length, qname_hash_b32, sizeof(qname_hash_b32));
+		require_action(qname_hash_b32_length > 0, exit, validation_result = dnssec_validation_invalid_internal_state);
 
 		for (list_node_t * one_nsec3_node = list_get_first(nsec3s);
 			!list_has_ended(nsec3s, one_nsec3_node);
@@ -949,7 +1152,7 @@ validate_nsec3_response(
 			const mDNSu8 * const					frist_label_owner_name	= dnssec_nsec3->dnssec_rr.name.c + 1;
 			const mDNSu8							first_label_length		= *dnssec_nsec3->dnssec_rr.name.c;
 
-			if (compare_canonical_dns_label(qname_hash_b32, qname_hash_b32_length, frist_label_owner_name, first_label_length) == 0) {
+			if (compare_canonical_dns_label((const mDNSu8 *)qname_hash_b32, (mDNSu8)qname_hash_b32_length, frist_label_owner_name, first_label_length) == 0) {
 				*out_nsec3_1 = dnssec_nsec3;
 				*out_rrsig_1 = &one_nsec3->rrsig_records;
 				nsec3_that_matches_qname = dnssec_nsec3;
@@ -1084,9 +1287,6 @@ validate_nsec3_response(
 	}
 
 exit:
-	if (qname_hash_b32 != mDNSNULL) {
-		free(qname_hash_b32);
-	}
 	return validation_result;
 }
 
@@ -2337,7 +2537,11 @@ check_if_ds_ksk_matches(const dnssec_ds_t * const _Nonnull ds, const dnssec_dnsk
 	mDNSu32					digest_size;
 	digest_type_t		digest_type;
 	const mDNSu32			data_to_be_hashed_length	= owner_name_length + rdata_length;
-	mDNSu8 * const			data_to_be_hashed			= malloc(data_to_be_hashed_length);
+	mDNSu8 *				data_to_be_hashed			= mDNSNULL;
+
+	require_quiet(!lookup_ds_link_cache(ds, ksk), exit);
+
+	data_to_be_hashed = malloc(data_to_be_hashed_length);
 	require_action(data_to_be_hashed != mDNSNULL, exit, result = dnssec_validation_no_memory);
 
 	memcpy(data_to_be_hashed, owner_name, owner_name_length);
@@ -2365,6 +2569,7 @@ check_if_ds_ksk_matches(const dnssec_ds_t * const _Nonnull ds, const dnssec_dnsk
 	matches = (memcmp(digest_buffer, ds->digest, digest_size) == 0);
 
 	require_action(matches, exit, result = dnssec_validation_bogus);
+	remember_ds_link(ds, ksk);
 
 exit:
 	if (data_to_be_hashed != mDNSNULL) {
@@ -2373,6 +2578,111 @@ exit:
 	return result;
 }
 
+mDNSlocal mDNSBool
+ds_link_cache_entry_matches(
+	const dnssec_ds_link_cache_entry_t * const	_Nonnull	entry,
+	const dnssec_ds_t * const					_Nonnull	ds,
+	const dnssec_dnskey_t * const				_Nonnull	ksk) {
+
+	return entry->owner_hash == ksk->dnssec_rr.name_hash && entry->key_tag == ds->key_tag
+		&& entry->algorithm == ds->algorithm && entry->digest_type == ds->digest_type
+		&& entry->ds_digest_length == ds->digest_length && entry->dnskey_rdata_length == ksk->dnssec_rr.rdata_length
+		&& DOMAIN_NAME_EQUALS(entry->owner.c, ksk->dnssec_rr.name.c)
+		&& memcmp(entry->ds_digest, ds->digest, ds->digest_length) == 0
+		&& memcmp(entry->dnskey_rdata, ksk->dnssec_rr.rdata, ksk->dnssec_rr.rdata_length) == 0;
+}
+
+//======================================================================================================================
+//	lookup_ds_link_cache
+//		returns true if the DS has been matched with the same DNSKEY before, and the entry is still usable
+//======================================================================================================================
+
+mDNSlocal mDNSBool
+lookup_ds_link_cache(const dnssec_ds_t * const _Nonnull ds, const dnssec_dnskey_t * const _Nonnull ksk) {
+	const int64_t now = time(mDNSNULL);
+
+	require_quiet(now >= 0 && now <= UINT32_MAX, exit);
+	require_quiet(ds->digest != mDNSNULL && ds->digest_length <= MAX_HASH_OUTPUT_SIZE && ksk->dnssec_rr.rdata != mDNSNULL, exit);
+
+	for (mDNSu32 i = 0; i < DNSSEC_DS_LINK_CACHE_SIZE; i++) {
+		dnssec_ds_link_cache_entry_t * const entry = &ds_link_cache[i];
+
+		if (entry->in_use && entry->expiration < (mDNSu32)now) {
+			free(entry->dnskey_rdata);
+			entry->dnskey_rdata	= mDNSNULL;
+			entry->in_use		= mDNSfalse;
+		}
+		if (entry->in_use && ds_link_cache_entry_matches(entry, ds, ksk)) {
+			entry->last_used = (mDNSu32)now;
+			return mDNStrue;
+		}
+	}
+
+exit:
+	return mDNSfalse;
+}
+
+//======================================================================================================================
+//	remember_ds_link
+//		adds a DS that matched the DNSKEY to the cache, replacing the least recently used entry if it is full
+//======================================================================================================================
+
+mDNSlocal void
+remember_ds_link(const dnssec_ds_t * const _Nonnull ds, const dnssec_dnskey_t * const _Nonnull ksk) {
+	dnssec_ds_link_cache_entry_t *	victim	= mDNSNULL;
+	const int64_t					now		= time(mDNSNULL);
+	mDNSu32							now_u32;
+	mDNSu32							ttl;
+	mDNSu8 *						rdata;
+
+	require_quiet(now >= 0 && now <= UINT32_MAX, exit);
+	now_u32 = (mDNSu32)now;
+
+	// Without the cached DNSKEY there is no TTL to bound the entry with.
+	require_quiet(ksk->dnssec_rr.rr != mDNSNULL && ksk->dnssec_rr.rdata != mDNSNULL, exit);
+	require_quiet(ds->digest != mDNSNULL && ds->digest_length <= MAX_HASH_OUTPUT_SIZE, exit);
+	ttl = ksk->dnssec_rr.rr->rroriginalttl;
+	if (ds->dnssec_rr.rr != mDNSNULL && ds->dnssec_rr.rr->rroriginalttl < ttl) {
+		ttl = ds->dnssec_rr.rr->rroriginalttl;
+	}
+	require_quiet(ttl > 0, exit);
+
+	rdata = malloc(ksk->dnssec_rr.rdata_length);
+	require_quiet(rdata != mDNSNULL, exit);
+	memcpy(rdata, ksk->dnssec_rr.rdata, ksk->dnssec_rr.rdata_length);
+
+	for (mDNSu32 i = 0; i < DNSSEC_DS_LINK_CACHE_SIZE; i++) {
+		dnssec_ds_link_cache_entry_t * const entry = &ds_link_cache[i];
+
+		if (!entry->in_use || entry->expiration < now_u32) {
+			victim = entry;
+			break;
+		}
+		if (victim == mDNSNULL || entry->last_used < victim->last_used) {
+			victim = entry;
+		}
+	}
+
+	if (victim->dnskey_rdata != mDNSNULL) {
+		free(victim->dnskey_rdata);
+	}
+	memcpy(victim->owner.c, ksk->dnssec_rr.name.c, DOMAIN_NAME_LENGTH(ksk->dnssec_rr.name.c));
+	victim->owner_hash			= ksk->dnssec_rr.name_hash;
+	memcpy(victim->ds_digest, ds->digest, ds->digest_length);
+	victim->ds_digest_length	= ds->digest_length;
+	victim->key_tag				= ds->key_tag;
+	victim->algorithm			= ds->algorithm;
+	victim->digest_type			= ds->digest_type;
+	victim->dnskey_rdata_length	= ksk->dnssec_rr.rdata_length;
+	victim->dnskey_rdata		= rdata;
+	victim->expiration			= (ttl > UINT32_MAX - now_u32) ? UINT32_MAX : now_u32 + ttl;
+	victim->last_used			= now_u32;
+	victim->in_use				= mDNStrue;
+
+exit:
+	return;
+}
+
 mDNSlocal dnssec_validation_result_t
 validate_path_from_zsk_to_rr(
 	const mDNSu32										request_id,
@@ -2392,7 +2702,7 @@ validate_path_from_zsk_to_rr(
 	require_action(signed_data != mDNSNULL, exit, result = dnssec_validation_no_memory;
 		log_default("No enough memory to allocate for signed data;"));
 
-	is_signed_data_valid = validate_signed_data_with_rrsig_and_dnskey(request_id, signed_data, signed_data_length, parent->u.zsk.sig, parent->u.zsk.key);
+	is_signed_data_valid = validate_signed_data_with_cache(request_id, signed_data, signed_data_length, parent->u.zsk.sig, parent->u.zsk.key);
 
 	result = is_signed_data_valid ? dnssec_validation_valid : dnssec_validation_invalid;
 
@@ -2423,7 +2733,7 @@ validate_path_from_ksk_to_zsk(
 	require_action(signed_data != mDNSNULL, exit, result = dnssec_validation_no_memory;
 		log_default("No enough memory to allocate for signed data;"));
 
-	is_signed_data_valid = validate_signed_data_with_rrsig_and_dnskey(request_id, signed_data, signed_data_length, parent->u.ksk.sig, parent->u.ksk.key);
+	is_signed_data_valid = validate_signed_data_with_cache(request_id, signed_data, signed_data_length, parent->u.ksk.sig, parent->u.ksk.key);
 	result = is_signed_data_valid ? dnssec_validation_valid : dnssec_validation_invalid;
 
 exit:
@@ -2453,7 +2763,7 @@ validate_path_from_zsk_to_ds(
 	require_action(signed_data != mDNSNULL, exit, result = dnssec_validation_no_memory;
 					log_default("No enough memory to allocate for signed data;"));
 
-	is_signed_data_valid = validate_signed_data_with_rrsig_and_dnskey(request_id, signed_data, signed_data_length, parent->u.zsk.sig, parent->u.zsk.key);
+	is_signed_data_valid = validate_signed_data_with_cache(request_id, signed_data, signed_data_length, parent->u.zsk.sig, parent->u.zsk.key);
 	result = is_signed_data_valid ? dnssec_validation_valid : dnssec_validation_invalid;
 
 exit:
@@ -2484,7 +2794,7 @@ validate_path_from_zsk_to_nsec(
 	require_action(signed_data != mDNSNULL, exit, result = dnssec_validation_no_memory;
 					log_error("No enough memory to allocate for signed data;"));
 
-	is_signed_data_valid = validate_signed_data_with_rrsig_and_dnskey(request_id, signed_data, signed_data_length, parent->u.zsk.sig, parent->u.zsk.key);
+	is_signed_data_valid = validate_signed_data_with_cache(request_id, signed_data, signed_data_length, parent->u.zsk.sig, parent->u.zsk.key);
 	result = is_signed_data_valid ? dnssec_validation_valid: dnssec_validation_invalid;
 
 exit:
@@ -2514,7 +2824,7 @@ validate_path_from_zsk_to_nsec3(
 	require_action(signed_data != mDNSNULL, exit, result = dnssec_validation_no_memory;
 		log_error("No enough memory to allocate for signed data;"));
 
-	is_signed_data_valid = validate_signed_data_with_rrsig_and_dnskey(request_id, signed_data, signed_data_length, parent->u.zsk.sig, parent->u.zsk.key);
+	is_signed_data_valid = validate_signed_data_with_cache(request_id, signed_data, signed_data_length, parent->u.zsk.sig, parent->u.zsk.key);
 	result = is_signed_data_valid ? dnssec_validation_valid: dnssec_validation_invalid;
 
 exit:
@@ -2525,6 +2835,318 @@ exit:
 	return result;
 }
 
+//======================================================================================================================
+//	validate_signed_data_with_cache
+//		verifies the signed data with the RRSIG and DNSKEY, reusing the result of an earlier identical verification
+//======================================================================================================================
+
+mDNSlocal mDNSBool
+validate_signed_data_with_cache(
+	const mDNSu32								request_id,
+	const mDNSu8 * const			_Nonnull	signed_data,
+	const mDNSu32								signed_data_length,
+	const dnssec_rrsig_t * const	_Nonnull	rrsig,
+	const dnssec_dnskey_t * const	_Nonnull	dnskey) {
+
+	dnssec_verification_cache_entry_t	new_entry;
+	mDNSBool							valid;
+
+	// The cache is only an optimization, if the entry cannot be computed, just do the verification.
+	require_quiet(make_verification_cache_entry(signed_data, signed_data_length, rrsig, dnskey, &new_entry), verify);
+
+	if (lookup_verification_cache(&new_entry)) {
+		log_debug("[R%u] Reusing the earlier signature verification; key_tag=%u", request_id, new_entry.key_tag);
+		return mDNStrue;
+	}
+	if (answering_context != mDNSNULL && lookup_finished_verifications(answering_context, &new_entry, &valid)) {
+		return valid;
+	}
+	// In a collecting pass the signature is taken to be valid for now, the validation runs again once it is verified.
+	if (collecting_batch != mDNSNULL
+		&& add_verification_to_batch(collecting_batch, &new_entry, signed_data, signed_data_length, rrsig, dnskey)) {
+		return mDNStrue;
+	}
+
+	valid = validate_signed_data_with_rrsig_and_dnskey(request_id, signed_data, signed_data_length, rrsig, dnskey);
+	// Failures are not remembered, so that a transient failure to create the key does not stick.
+	if (valid) {
+		remember_verification(&new_entry, rrsig);
+	}
+	return valid;
+
+verify:
+	return validate_signed_data_with_rrsig_and_dnskey(request_id, signed_data, signed_data_length, rrsig, dnskey);
+}
+
+//======================================================================================================================
+//	make_verification_cache_entry
+//		fills in the fields that identify the verification, returns false if they cannot be computed
+//======================================================================================================================
+
+mDNSlocal mDNSBool
+make_verification_cache_entry(
+	const mDNSu8 * const						_Nonnull	signed_data,
+	const mDNSu32											signed_data_length,
+	const dnssec_rrsig_t * const				_Nonnull	rrsig,
+	const dnssec_dnskey_t * const				_Nonnull	dnskey,
+	dnssec_verification_cache_entry_t * const	_Nonnull	entry) {
+
+	mDNSPlatformMemZero(entry, sizeof(*entry));
+	require_quiet(rrsig->signature != mDNSNULL && dnskey->public_key != mDNSNULL, fail);
+	require_quiet(calculate_digest_for_data(signed_data, signed_data_length, DIGEST_SHA_256,
+		entry->signed_data_digest, sizeof(entry->signed_data_digest)), fail);
+	require_quiet(calculate_digest_for_data(rrsig->signature, rrsig->signature_length, DIGEST_SHA_256,
+		entry->signature_digest, sizeof(entry->signature_digest)), fail);
+	require_quiet(calculate_digest_for_data(dnskey->public_key, dnskey->public_key_length, DIGEST_SHA_256,
+		entry->public_key_digest, sizeof(entry->public_key_digest)), fail);
+	entry->key_tag		= dnskey->key_tag;
+	entry->algorithm	= dnskey->algorithm;
+	return mDNStrue;
+
+fail:
+	return mDNSfalse;
+}
+
+mDNSlocal mDNSBool
+verification_cache_entries_match(
+	const dnssec_verification_cache_entry_t * const	_Nonnull	left,
+	const dnssec_verification_cache_entry_t * const	_Nonnull	right) {
+
+	return left->key_tag == right->key_tag && left->algorithm == right->algorithm
+		&& memcmp(left->signed_data_digest, right->signed_data_digest, sizeof(left->signed_data_digest)) == 0
+		&& memcmp(left->signature_digest, right->signature_digest, sizeof(left->signature_digest)) == 0
+		&& memcmp(left->public_key_digest, right->public_key_digest, sizeof(left->public_key_digest)) == 0;
+}
+
+//======================================================================================================================
+//	lookup_verification_cache
+//		returns true if the same signature has been verified successfully before, and the entry is still usable
+//======================================================================================================================
+
+mDNSlocal mDNSBool
+lookup_verification_cache(const dnssec_verification_cache_entry_t * const _Nonnull key) {
+	const int64_t now = time(mDNSNULL);
+
+	require_quiet(now >= 0 && now <= UINT32_MAX, exit);
+
+	for (mDNSu32 i = 0; i < DNSSEC_VERIFICATION_CACHE_SIZE; i++) {
+		dnssec_verification_cache_entry_t * const entry = &verification_cache[i];
+
+		if (entry->in_use && entry->expiration < (mDNSu32)now) {
+			entry->in_use = mDNSfalse;
+		}
+		if (entry->in_use && verification_cache_entries_match(entry, key)) {
+			entry->last_used = (mDNSu32)now;
+			return mDNStrue;
+		}
+	}
+
+exit:
+	return mDNSfalse;
+}
+
+//======================================================================================================================
+//	remember_verification
+//		adds a successful verification to the cache, replacing the least recently used entry if it is full
+//======================================================================================================================
+
+mDNSlocal void
+remember_verification(
+	const dnssec_verification_cache_entry_t * const	_Nonnull	key,
+	const dnssec_rrsig_t * const					_Nonnull	rrsig) {
+
+	dnssec_verification_cache_entry_t *	victim	= mDNSNULL;
+	const int64_t						now		= time(mDNSNULL);
+	mDNSu32								now_u32;
+
+	require_quiet(now >= 0 && now <= UINT32_MAX, exit);
+	now_u32 = (mDNSu32)now;
+
+	for (mDNSu32 i = 0; i < DNSSEC_VERIFICATION_CACHE_SIZE; i++) {
+		dnssec_verification_cache_entry_t * const entry = &verification_cache[i];
+
+		if (!entry->in_use || entry->expiration < now_u32) {
+			victim = entry;
+			break;
+		}
+		if (victim == mDNSNULL || entry->last_used < victim->last_used) {
+			victim = entry;
+		}
+	}
+
+	*victim				= *key;
+	victim->expiration	= (rrsig->original_TTL > UINT32_MAX - now_u32) ? UINT32_MAX : now_u32 + rrsig->original_TTL;
+	if (victim->expiration > rrsig->signature_expiration) {
+		victim->expiration = rrsig->signature_expiration;
+	}
+	victim->last_used	= now_u32;
+	victim->in_use		= mDNStrue;
+
+exit:
+	return;
+}
+
+//======================================================================================================================
+//	lookup_finished_verifications
+//		returns true, and the result, if the signature is in a batch the context has had back from the workers
+//======================================================================================================================
+
+mDNSlocal mDNSBool
+lookup_finished_verifications(
+	const dnssec_context_t * const					_Nonnull	context,
+	const dnssec_verification_cache_entry_t * const	_Nonnull	key,
+	mDNSBool * const								_Nonnull	out_valid) {
+
+	for (const dnssec_verification_batch_t * batch = context->finished_verifications; batch != mDNSNULL; batch = batch->next) {
+		for (mDNSu32 i = 0; i < batch->count; i++) {
+			if (verification_cache_entries_match(&batch->verifications[i].key, key)) {
+				*out_valid = batch->verifications[i].valid;
+				return mDNStrue;
+			}
+		}
+	}
+	return mDNSfalse;
+}
+
+//======================================================================================================================
+//	add_verification_to_batch
+//		copies everything the workers need to verify the signature into the batch, returns false if out of memory
+//======================================================================================================================
+
+mDNSlocal mDNSBool
+add_verification_to_batch(
+	dnssec_verification_batch_t * const				_Nonnull	batch,
+	const dnssec_verification_cache_entry_t * const	_Nonnull	key,
+	const mDNSu8 * const							_Nonnull	signed_data,
+	const mDNSu32												signed_data_length,
+	const dnssec_rrsig_t * const					_Nonnull	rrsig,
+	const dnssec_dnskey_t * const					_Nonnull	dnskey) {
+
+	dnssec_verification_t * verification;
+
+	// The same signature can come up more than once in a pass, it only needs verifying once.
+	for (mDNSu32 i = 0; i < batch->count; i++) {
+		if (verification_cache_entries_match(&batch->verifications[i].key, key)) {
+			return mDNStrue;
+		}
+	}
+
+	if (batch->count == batch->capacity) {
+		const mDNSu32 capacity = batch->capacity != 0 ? batch->capacity * 2 : 8;
+		dnssec_verification_t * const verifications = realloc(batch->verifications, capacity * sizeof(*verifications));
+		require_quiet(verifications != mDNSNULL, fail);
+		batch->verifications	= verifications;
+		batch->capacity			= capacity;
+	}
+
+	verification = &batch->verifications[batch->count];
+	mDNSPlatformMemZero(verification, sizeof(*verification));
+	verification->key					= *key;
+	verification->signed_data			= malloc(signed_data_length);
+	verification->signed_data_length	= signed_data_length;
+	verification->rrsig					= *rrsig;
+	verification->rrsig.signer_name		= mDNSNULL;
+	verification->rrsig.signature		= malloc(rrsig->signature_length);
+	verification->rrsig.dnssec_rr.rdata	= mDNSNULL;
+	verification->rrsig.dnssec_rr.rr	= mDNSNULL;
+	verification->dnskey				= *dnskey;
+	verification->dnskey.public_key		= malloc(dnskey->public_key_length);
+	verification->dnskey.dnssec_rr.rdata = mDNSNULL;
+	verification->dnskey.dnssec_rr.rr	= mDNSNULL;
+	require_quiet(verification->signed_data != mDNSNULL && verification->rrsig.signature != mDNSNULL
+		&& verification->dnskey.public_key != mDNSNULL, free_and_fail);
+
+	memcpy(verification->signed_data, signed_data, signed_data_length);
+	memcpy(verification->rrsig.signature, rrsig->signature, rrsig->signature_length);
+	memcpy(verification->dnskey.public_key, dnskey->public_key, dnskey->public_key_length);
+	batch->count++;
+	return mDNStrue;
+
+free_and_fail:
+	free(verification->signed_data);
+	free(verification->rrsig.signature);
+	free(verification->dnskey.public_key);
+fail:
+	return mDNSfalse;
+}
+
+mDNSlocal void
+free_verification_batch(dnssec_verification_batch_t * const _Nonnull batch) {
+	for (mDNSu32 i = 0; i < batch->count; i++) {
+		free(batch->verifications[i].signed_data);
+		free(batch->verifications[i].rrsig.signature);
+		free(batch->verifications[i].dnskey.public_key);
+	}
+	free(batch->verifications);
+	free(batch->signatures);
+	free(batch);
+}
+
+mDNSlocal void
+free_finished_verifications(dnssec_context_t * const _Nonnull context) {
+	while (context->finished_verifications != mDNSNULL) {
+		dnssec_verification_batch_t * const batch = context->finished_verifications;
+		context->finished_verifications = batch->next;
+		free_verification_batch(batch);
+	}
+}
+
+//======================================================================================================================
+//	submit_verification_batch
+//		hands the batch to the verification workers, returns false if they will not take it
+//======================================================================================================================
+
+mDNSlocal mDNSBool
+submit_verification_batch(dnssec_verification_batch_t * const _Nonnull batch) {
+	batch->signatures = calloc(batch->count, sizeof(*batch->signatures));
+	require_quiet(batch->signatures != mDNSNULL, fail);
+
+	for (mDNSu32 i = 0; i < batch->count; i++) {
+		dnssec_verification_t * const verification = &batch->verifications[i];
+		batch->signatures[i].signed_data		= verification->signed_data;
+		batch->signatures[i].signed_data_length	= verification->signed_data_length;
+		batch->signatures[i].rrsig				= &verification->rrsig;
+		batch->signatures[i].dnskey				= &verification->dnskey;
+	}
+
+	return validate_signed_data_batch_on_workers(batch->request_id, batch->signatures, batch->count, ^{
+		KQueueLock();
+		finish_verification_batch(batch);
+		KQueueUnlock("DNSSEC signature verification");
+	});
+
+fail:
+	return mDNSfalse;
+}
+
+//======================================================================================================================
+//	finish_verification_batch
+//		runs on the core thread when the workers are done with the batch, and resumes the validation that sent it
+//======================================================================================================================
+
+mDNSlocal void
+finish_verification_batch(dnssec_verification_batch_t * const _Nonnull batch) {
+	dnssec_context_t * const context = batch->context;
+
+	if (context == mDNSNULL) {
+		free_verification_batch(batch);
+		return;
+	}
+
+	for (mDNSu32 i = 0; i < batch->count; i++) {
+		dnssec_verification_t * const verification = &batch->verifications[i];
+		verification->valid = batch->signatures[i].valid;
+		if (verification->valid) {
+			remember_verification(&verification->key, &verification->rrsig);
+		}
+	}
+
+	context->pending_verifications	= mDNSNULL;
+	batch->next						= context->finished_verifications;
+	context->finished_verifications	= batch;
+	batch->resume(context);
+}
+
 //======================================================================================================================
 //	check_rrsig_validity_with_rr
 //======================================================================================================================
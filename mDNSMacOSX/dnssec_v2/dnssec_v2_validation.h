@@ -27,6 +27,21 @@ typedef enum dnssec_validator_node_type {
 mDNSexport dnssec_validation_result_t
 validate_dnssec(dnssec_context_t * const _Nonnull context);
 
+// Called on the core thread, with KQueueLock held, when the signatures validate_dnssec_with_workers handed to the
+// verification workers have all come back and the validation can be run again.
+typedef void (*dnssec_validation_resume_t)(dnssec_context_t * const _Nonnull context);
+
+// Like validate_dnssec, except that the signatures the verification cache cannot answer are checked by the verification
+// workers instead of on the core thread. If any are, it returns dnssec_validation_validating and calls resume once they
+// are finished; running it again then finds them answered. It also returns dnssec_validation_validating without doing
+// anything while the context's earlier batch is still out, since resume runs the validation on the latest records.
+mDNSexport dnssec_validation_result_t
+validate_dnssec_with_workers(dnssec_context_t * const _Nonnull context, const dnssec_validation_resume_t _Nonnull resume);
+
+// Forgets the context's verifications; any batch still with the workers is freed when it comes back, without resuming.
+mDNSexport void
+cancel_dnssec_verifications(dnssec_context_t * const _Nonnull context);
+
 mDNSexport mDNSu16
 calculate_key_tag(const mDNSu8 key[_Nonnull], const mDNSu16 key_len, const mDNSu8 algorithm);
 
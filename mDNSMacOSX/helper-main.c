@@ -220,6 +220,59 @@ static mDNSBool check_entitlement(xpc_connection_t conn, const char *password)
 }
 
 
+static int handle_set_localaddr_cacheentry(xpc_object_t req)
+{
+    int if_index, family;
+    size_t ip_len, eth_len;
+    int error_code = 0;
+
+    if_index = xpc_dictionary_get_uint64(req, "slace_ifindex");
+    family   = xpc_dictionary_get_uint64(req, "slace_family");
+
+    const uint8_t * const ip = (const uint8_t *)xpc_dictionary_get_data(req, "slace_ip", &ip_len);
+    if (ip_len != sizeof(v6addr_t))
+    {
+        return kHelperErr_ParamErr;
+    }
+
+    const uint8_t * const eth = (const uint8_t *)xpc_dictionary_get_data(req, "slace_eth", &eth_len);
+    if (eth_len != sizeof(ethaddr_t))
+    {
+        return kHelperErr_ParamErr;
+    }
+
+    os_log_info(log_handle, "Calling new SetLocalAddressCacheEntry() if_index[%d] family[%d] ", if_index, family);
+
+    SetLocalAddressCacheEntry(if_index, family, ip, eth, &error_code);
+    return error_code;
+}
+
+static int handle_send_keepalive(xpc_object_t req)
+{
+    uint16_t lport, rport, win;
+    uint32_t seq, ack;
+    size_t sadd6_len, dadd6_len;
+    
+    lport = xpc_dictionary_get_uint64(req, "send_keepalive_lport");
+    rport = xpc_dictionary_get_uint64(req, "send_keepalive_rport");
+    seq   = xpc_dictionary_get_uint64(req, "send_keepalive_seq");
+    ack   = xpc_dictionary_get_uint64(req, "send_keepalive_ack");
+    win   = xpc_dictionary_get_uint64(req, "send_keepalive_win");
+    
+    const uint8_t * const sadd6 = (const uint8_t *)xpc_dictionary_get_data(req, "send_keepalive_sadd", &sadd6_len);
+    const uint8_t * const dadd6 = (const uint8_t *)xpc_dictionary_get_data(req, "send_keepalive_dadd", &dadd6_len);
+    if ((sadd6_len != sizeof(v6addr_t)) || (dadd6_len != sizeof(v6addr_t)))
+    {
+        return kHelperErr_ParamErr;
+    }
+
+    os_log_info(log_handle, "helper-main: handle_request: send_keepalive: lport is[%d] rport is[%d] seq is[%d] ack is[%d] win is[%d]",
+                   lport, rport, seq, ack, win);
+    
+    SendKeepalive(sadd6, dadd6, lport, rport, seq, ack, win);
+    return 0;
+}
+
 static void handle_request(xpc_object_t req)
 {
     mDNSu32 helper_mode = 0;
@@ -338,56 +391,45 @@ static void handle_request(xpc_object_t req)
             
         case set_localaddr_cacheentry:
         {
-            int if_index, family;
-            size_t ip_len, eth_len;
-
-            if_index = xpc_dictionary_get_uint64(req, "slace_ifindex");
-            family   = xpc_dictionary_get_uint64(req, "slace_family");
-
-            const uint8_t * const ip = (const uint8_t *)xpc_dictionary_get_data(req, "slace_ip", &ip_len);
-            if (ip_len != sizeof(v6addr_t))
-            {
-                error_code = kHelperErr_ParamErr;
-                break;
-            }
-
-            const uint8_t * const eth = (const uint8_t *)xpc_dictionary_get_data(req, "slace_eth", &eth_len);
-            if (eth_len != sizeof(ethaddr_t))
-            {
-                error_code = kHelperErr_ParamErr;
-                break;
-            }
-
-            os_log_info(log_handle, "Calling new SetLocalAddressCacheEntry() if_index[%d] family[%d] ", if_index, family);
-
-            SetLocalAddressCacheEntry(if_index, family, ip, eth, &error_code);
+            error_code = handle_set_localaddr_cacheentry(req);
             break;
         }
             
         case send_keepalive:
         {
-            uint16_t lport, rport, win;
-            uint32_t seq, ack;
-            size_t sadd6_len, dadd6_len;
-            
-            lport = xpc_dictionary_get_uint64(req, "send_keepalive_lport");
-            rport = xpc_dictionary_get_uint64(req, "send_keepalive_rport");
-            seq   = xpc_dictionary_get_uint64(req, "send_keepalive_seq");
-            ack   = xpc_dictionary_get_uint64(req, "send_keepalive_ack");
-            win   = xpc_dictionary_get_uint64(req, "send_keepalive_win");
-            
-            const uint8_t * const sadd6 = (const uint8_t *)xpc_dictionary_get_data(req, "send_keepalive_sadd", &sadd6_len);
-            const uint8_t * const dadd6 = (const uint8_t *)xpc_dictionary_get_data(req, "send_keepalive_dadd", &dadd6_len);
-            if ((sadd6_len != sizeof(v6addr_t)) || (dadd6_len != sizeof(v6addr_t)))
+            error_code = handle_send_keepalive(req);
+            break;
+        }
+
+        case set_localaddr_cacheentries:
+        case send_keepalives:
+        {
+            xpc_object_t entries = xpc_dictionary_get_value(req, kHelperBatchEntries);
+            if (!entries || xpc_get_type(entries) != XPC_TYPE_ARRAY)
             {
                 error_code = kHelperErr_ParamErr;
                 break;
             }
 
-            os_log_info(log_handle, "helper-main: handle_request: send_keepalive: lport is[%d] rport is[%d] seq is[%d] ack is[%d] win is[%d]",
-                           lport, rport, seq, ack, win);
-            
-            SendKeepalive(sadd6, dadd6, lport, rport, seq, ack, win);
+            // Each entry is handled as if it had come on its own, and gets its own error code in the reply
+            xpc_object_t errors = xpc_array_create(NULL, 0);
+            const size_t count = xpc_array_get_count(entries);
+            os_log_info(log_handle, "helper-main: handle_request: batch of %zu requests in mode %d", count, helper_mode);
+            for (size_t i = 0; i < count; i++)
+            {
+                xpc_object_t entry = xpc_array_get_value(entries, i);
+                int entry_error = kHelperErr_ParamErr;
+                if (xpc_get_type(entry) == XPC_TYPE_DICTIONARY)
+                {
+                    entry_error = (helper_mode == set_localaddr_cacheentries) ? handle_set_localaddr_cacheentry(entry) : handle_send_keepalive(entry);
+                }
+                xpc_array_set_int64(errors, XPC_ARRAY_APPEND, entry_error);
+            }
+            if (response)
+            {
+                xpc_dictionary_set_value(response, kHelperBatchErrors, errors);
+            }
+            xpc_release(errors);
             break;
         }
     
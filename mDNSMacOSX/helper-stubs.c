@@ -39,6 +39,12 @@
 // an argument to the function, the blocks can reference them as they are passed in as pointers. But care should
 // be taken to copy them locally as they may cease to exist when the function returns.
 //
+// Requests that the core doesn't need an answer to before carrying on (packet filter changes, wakeup packets,
+// keepalives and local address cache entries) are sent asynchronously over one long-lived connection, so they reach
+// the helper in the order they were made. Keepalives and cache entries are queued in a HelperBatch first: the first
+// request of a burst schedules a flush on HelperQueue, and everything queued before the flush runs goes to the helper
+// as a single message. Requests that return data to the core (keychain secrets, TCP info) remain synchronous.
+//
 
 
 //*************************************************************************************************************
@@ -47,6 +53,22 @@ static dispatch_queue_t HelperQueue;
 
 static int64_t maxwait_secs = 5LL;
 
+static xpc_connection_t HelperConnection;   // Connection used for asynchronous requests. Only used on HelperQueue.
+
+#define kHelperMaxBatchCount 64             // A batch that reaches this many entries is sent right away
+
+typedef struct
+{
+    HelperModes             mode;           // Mode of the batched message
+    xpc_object_t            entries;        // Array of queued request dictionaries, NULL if none are queued
+    mDNSHelperCompletion   *completions;    // Completion for each queued entry (may be NULL)
+    size_t                  count;
+    size_t                  capacity;
+} HelperBatch;
+
+static HelperBatch LocalAddressCacheBatch = { set_localaddr_cacheentries, NULL, NULL, 0, 0 };
+static HelperBatch KeepaliveBatch         = { send_keepalives,            NULL, NULL, 0, 0 };
+
 #define mDNSHELPER_DEBUG LogOperation
 
 //*************************************************************************************************************
@@ -168,6 +190,155 @@ exit:
     return errorcode;
 }
 
+// Must be called on HelperQueue
+mDNSlocal xpc_connection_t Get_AsyncConnection(void)
+{
+    if (!HelperConnection)
+    {
+        xpc_connection_t connection = xpc_connection_create_mach_service(kHelperService, HelperQueue,
+            XPC_CONNECTION_MACH_SERVICE_PRIVILEGED);
+        if (!connection)
+        {
+            return NULL;
+        }
+        xpc_connection_set_event_handler(connection, ^(xpc_object_t event)
+        {
+            mDNSHELPER_DEBUG("Get_AsyncConnection xpc: [%s] \n", xpc_dictionary_get_string(event, XPC_ERROR_KEY_DESCRIPTION));
+            // An interrupted connection is re-established by XPC on the next send; an invalid one has to be replaced.
+            if (event == XPC_ERROR_CONNECTION_INVALID && HelperConnection == connection)
+            {
+                xpc_release(HelperConnection);
+                HelperConnection = NULL;
+            }
+        });
+        xpc_connection_activate(connection);
+        HelperConnection = connection;
+    }
+    return HelperConnection;
+}
+
+// Must be called on HelperQueue. The handler, if any, is called on HelperQueue with the reply dictionary (NULL if
+// there was none) and the helper's error code.
+mDNSlocal void SendDict_ToServerAsync(xpc_object_t msg, void (^handler)(xpc_object_t reply, int error))
+{
+    xpc_connection_t connection = Get_AsyncConnection();
+    if (!connection)
+    {
+        LogMsg("SendDict_ToServerAsync: no connection to helper");
+        if (handler)
+        {
+            handler(NULL, kHelperErr_NotConnected);
+        }
+        return;
+    }
+
+    HelperLog("SendDict_ToServerAsync Sending msg to Daemon", msg);
+    xpc_connection_send_message_with_reply(connection, msg, HelperQueue, ^(xpc_object_t recv_msg)
+    {
+        xpc_object_t reply = NULL;
+        int errorcode = kHelperErr_NoResponse;
+
+        if (xpc_get_type(recv_msg) == XPC_TYPE_DICTIONARY)
+        {
+            HelperLog("SendDict_ToServerAsync Received reply msg from Daemon", recv_msg);
+            errorcode = (int)xpc_dictionary_get_int64(recv_msg, kHelperErrCode);
+            reply = recv_msg;
+        }
+        else
+        {
+            LogMsg("SendDict_ToServerAsync Received unexpected reply from daemon [%s]",
+                    xpc_dictionary_get_string(recv_msg, XPC_ERROR_KEY_DESCRIPTION));
+        }
+        if (handler)
+        {
+            handler(reply, errorcode);
+        }
+    });
+}
+
+// Must be called on HelperQueue
+mDNSlocal void HelperBatchFlush(HelperBatch *batch)
+{
+    xpc_object_t entries = batch->entries;
+    mDNSHelperCompletion *completions = batch->completions;
+    const size_t count = batch->count;
+
+    if (!entries)
+    {
+        return;
+    }
+    batch->entries     = NULL;
+    batch->completions = NULL;
+    batch->count       = 0;
+    batch->capacity    = 0;
+
+    xpc_object_t dict = xpc_dictionary_create(NULL, NULL, 0);
+    xpc_dictionary_set_uint64(dict, kHelperMode, batch->mode);
+    xpc_dictionary_set_value(dict, kHelperBatchEntries, entries);
+    xpc_release(entries);
+
+    mDNSHELPER_DEBUG("HelperBatchFlush: sending %u requests in mode %d", (unsigned int)count, batch->mode);
+
+    SendDict_ToServerAsync(dict, ^(xpc_object_t reply, int error)
+    {
+        xpc_object_t errors = reply ? xpc_dictionary_get_value(reply, kHelperBatchErrors) : NULL;
+        if (errors && xpc_get_type(errors) != XPC_TYPE_ARRAY)
+        {
+            errors = NULL;
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            if (completions[i])
+            {
+                // A failure of the whole message applies to every entry
+                int entry_error = error;
+                if (!error && errors && i < xpc_array_get_count(errors))
+                {
+                    entry_error = (int)xpc_array_get_int64(errors, i);
+                }
+                completions[i](entry_error);
+                Block_release(completions[i]);
+            }
+        }
+        free(completions);
+    });
+    xpc_release(dict);
+}
+
+// Must be called on HelperQueue
+mDNSlocal void HelperBatchAdd(HelperBatch *batch, xpc_object_t entry, mDNSHelperCompletion completion)
+{
+    if (batch->count == batch->capacity)
+    {
+        const size_t capacity = batch->capacity ? batch->capacity * 2 : 8;
+        mDNSHelperCompletion *completions = realloc(batch->completions, capacity * sizeof(*completions));
+        if (!completions)
+        {
+            LogMsg("HelperBatchAdd: out of memory, dropping request");
+            if (completion)
+            {
+                completion(kHelperErr_DefaultErr);
+            }
+            return;
+        }
+        batch->completions = completions;
+        batch->capacity    = capacity;
+    }
+    if (!batch->entries)
+    {
+        batch->entries = xpc_array_create(NULL, 0);
+        // Requests made before this block runs join the batch
+        dispatch_async(HelperQueue, ^{ HelperBatchFlush(batch); });
+    }
+    xpc_array_append_value(batch->entries, entry);
+    batch->completions[batch->count++] = completion ? Block_copy(completion) : NULL;
+
+    if (batch->count >= kHelperMaxBatchCount)
+    {
+        HelperBatchFlush(batch);
+    }
+}
+
 //**************************************************************************************************************
 
 mDNSexport mStatus mDNSHelperInit()
@@ -247,28 +418,26 @@ int mDNSPowerRequest(int key, int interval)
     return err_code;
 }
 
-int mDNSSetLocalAddressCacheEntry(int ifindex, int family, const v6addr_t ip, const ethaddr_t eth)
+void mDNSSetLocalAddressCacheEntry(int ifindex, int family, const v6addr_t ip, const ethaddr_t eth, mDNSHelperCompletion completion)
 {
-    int err_code = kHelperErr_NotConnected;
-    
     mDNSHELPER_DEBUG("mDNSSetLocalAddressCacheEntry: Using XPC IPC calling out to Helper: ifindex is [%d] family is [%d]", ifindex, family);
     
-    // Create Dictionary To Send
-    xpc_object_t dict = xpc_dictionary_create(NULL, NULL, 0);
-    xpc_dictionary_set_uint64(dict, kHelperMode, set_localaddr_cacheentry);
-    
-    xpc_dictionary_set_uint64(dict, "slace_ifindex", ifindex);
-    xpc_dictionary_set_uint64(dict, "slace_family", family);
+    // Create the entry here, copying ip and eth, as they won't outlive the call
+    xpc_object_t entry = xpc_dictionary_create(NULL, NULL, 0);
     
-    xpc_dictionary_set_data(dict, "slace_ip", (uint8_t*)ip, sizeof(v6addr_t));
-    xpc_dictionary_set_data(dict, "slace_eth", (uint8_t*)eth, sizeof(ethaddr_t));
+    xpc_dictionary_set_uint64(entry, "slace_ifindex", ifindex);
+    xpc_dictionary_set_uint64(entry, "slace_family", family);
     
-    err_code = SendDict_ToServer(dict, NULL);
-    xpc_release(dict);
-    dict = NULL;
+    xpc_dictionary_set_data(entry, "slace_ip", (uint8_t*)ip, sizeof(v6addr_t));
+    xpc_dictionary_set_data(entry, "slace_eth", (uint8_t*)eth, sizeof(ethaddr_t));
     
-    mDNSHELPER_DEBUG("mDNSSetLocalAddressCacheEntry: Using XPC IPC returning error_code %d", err_code);
-    return err_code;
+    mDNSHelperCompletion copy = completion ? Block_copy(completion) : NULL;
+    dispatch_async(HelperQueue, ^{
+        HelperBatchAdd(&LocalAddressCacheBatch, entry, copy);
+        xpc_release(entry);
+        if (copy)
+            Block_release(copy);
+    });
 }
 
 
@@ -376,9 +545,10 @@ void mDNSSendWakeupPacket(unsigned int ifid, char *eth_addr, char *ip_addr, int
     xpc_dictionary_set_string(dict, "ip_address", ip_addr);
     xpc_dictionary_set_uint64(dict, "swp_iteration", iteration);
     
-    SendDict_ToServer(dict, NULL);
-    xpc_release(dict);
-    dict = NULL;
+    dispatch_async(HelperQueue, ^{
+        SendDict_ToServerAsync(dict, NULL);
+        xpc_release(dict);
+    });
 
 }
 
@@ -415,18 +585,18 @@ void mDNSPacketFilterControl(uint32_t command, char * ifname, uint32_t count, pf
     xpc_release(xpc_obj_portArray);
     xpc_release(xpc_obj_protocolArray);
     
-    SendDict_ToServer(dict, NULL);
-    xpc_release(dict);
-    dict = NULL;
+    dispatch_async(HelperQueue, ^{
+        SendDict_ToServerAsync(dict, NULL);
+        xpc_release(dict);
+    });
     
     mDNSHELPER_DEBUG("mDNSPacketFilterControl: portArray0[%d] portArray1[%d] portArray2[%d] portArray3[%d] protocolArray0[%d] protocolArray1[%d] protocolArray2[%d] protocolArray3[%d]",
             pfa.portArray[0], pfa.portArray[1], pfa.portArray[2], pfa.portArray[3], pfa.protocolArray[0], pfa.protocolArray[1], pfa.protocolArray[2], pfa.protocolArray[3]);
     
 }
 
-void mDNSSendKeepalive(const v6addr_t sadd, const v6addr_t dadd, uint16_t lport, uint16_t rport, uint32_t seq, uint32_t ack, uint16_t win)
+mDNSlocal xpc_object_t Create_KeepaliveEntry(const v6addr_t sadd, const v6addr_t dadd, uint16_t lport, uint16_t rport, uint32_t seq, uint32_t ack, uint16_t win)
 {
-
     mDNSHELPER_DEBUG("mDNSSendKeepalive: Using XPC IPC calling out to Helper: lport is[%d] rport is[%d] seq is[%d] ack is[%d] win is[%d]",
            lport, rport, seq, ack, win);
     
@@ -440,23 +610,51 @@ void mDNSSendKeepalive(const v6addr_t sadd, const v6addr_t dadd, uint16_t lport,
     inet_ntop(AF_INET6, dadd, buf2, sizeof(buf2));
     mDNSHELPER_DEBUG("mDNSSendKeepalive: Using XPC IPC calling out to Helper: sadd is %s, dadd is %s", buf1, buf2);
     
-    // Create Dictionary To Send
-    xpc_object_t dict = xpc_dictionary_create(NULL, NULL, 0);
-    xpc_dictionary_set_uint64(dict, kHelperMode, send_keepalive);
+    xpc_object_t entry = xpc_dictionary_create(NULL, NULL, 0);
     
-    xpc_dictionary_set_data(dict, "send_keepalive_sadd", (uint8_t*)sadd, sizeof(v6addr_t));
-    xpc_dictionary_set_data(dict, "send_keepalive_dadd", (uint8_t*)dadd, sizeof(v6addr_t));
+    xpc_dictionary_set_data(entry, "send_keepalive_sadd", (uint8_t*)sadd, sizeof(v6addr_t));
+    xpc_dictionary_set_data(entry, "send_keepalive_dadd", (uint8_t*)dadd, sizeof(v6addr_t));
     
-    xpc_dictionary_set_uint64(dict, "send_keepalive_lport", lport);
-    xpc_dictionary_set_uint64(dict, "send_keepalive_rport", rport);
-    xpc_dictionary_set_uint64(dict, "send_keepalive_seq", seq);
-    xpc_dictionary_set_uint64(dict, "send_keepalive_ack", ack);
-    xpc_dictionary_set_uint64(dict, "send_keepalive_win", win);
+    xpc_dictionary_set_uint64(entry, "send_keepalive_lport", lport);
+    xpc_dictionary_set_uint64(entry, "send_keepalive_rport", rport);
+    xpc_dictionary_set_uint64(entry, "send_keepalive_seq", seq);
+    xpc_dictionary_set_uint64(entry, "send_keepalive_ack", ack);
+    xpc_dictionary_set_uint64(entry, "send_keepalive_win", win);
     
-    SendDict_ToServer(dict, NULL);
-    xpc_release(dict);
-    dict = NULL;
+    return entry;
+}
+
+void mDNSSendKeepalive(const v6addr_t sadd, const v6addr_t dadd, uint16_t lport, uint16_t rport, uint32_t seq, uint32_t ack, uint16_t win)
+{
+    xpc_object_t entry = Create_KeepaliveEntry(sadd, dadd, lport, rport, seq, ack, win);
+    
+    dispatch_async(HelperQueue, ^{
+        HelperBatchAdd(&KeepaliveBatch, entry, NULL);
+        xpc_release(entry);
+    });
+}
+
+void mDNSSendKeepalives(const mDNSHelperKeepalive *keepalives, int count)
+{
+    if (count <= 0)
+        return;
     
+    // Queue the entries from a single block so that none of them can miss the batch's flush
+    xpc_object_t entries = xpc_array_create(NULL, 0);
+    for (int i = 0; i < count; i++)
+    {
+        const mDNSHelperKeepalive *const ka = &keepalives[i];
+        xpc_object_t entry = Create_KeepaliveEntry(ka->sadd, ka->dadd, ka->lport, ka->rport, ka->seq, ka->ack, ka->win);
+        xpc_array_append_value(entries, entry);
+        xpc_release(entry);
+    }
+    
+    dispatch_async(HelperQueue, ^{
+        const size_t n = xpc_array_get_count(entries);
+        for (size_t i = 0; i < n; i++)
+            HelperBatchAdd(&KeepaliveBatch, xpc_array_get_value(entries, i), NULL);
+        xpc_release(entries);
+    });
 }
 
 int mDNSRetrieveTCPInfo(int family, v6addr_t laddr, uint16_t lport, v6addr_t raddr, uint16_t rport, uint32_t *seq, uint32_t *ack, uint16_t *win, int32_t *intfid)
@@ -28,6 +28,8 @@
 #define kHelperMode             "HelperMode"
 #define kHelperReplyStatus      "HelperReplyStatusToClient"
 #define kHelperErrCode          "HelperErrorCodefromCall"
+#define kHelperBatchEntries     "HelperBatchEntries"        // Array of per-request dictionaries in a batched request
+#define kHelperBatchErrors      "HelperBatchErrors"         // Array of per-request error codes in the reply to one
 
 #define kPrefsNameKey  "PreferencesNameKey"
 #define kPrefsOldName  "PreferencesOldName"
@@ -49,6 +51,8 @@ typedef enum
     send_keepalive = 8,
     retreive_tcpinfo = 9,
     keychain_getsecrets = 10,
+    set_localaddr_cacheentries = 11,    // Batch of set_localaddr_cacheentry requests
+    send_keepalives = 12,               // Batch of send_keepalive requests
 } HelperModes;
 
 typedef enum
@@ -113,16 +117,32 @@ extern const char *mDNSHelperError(int errornum);
 
 extern mStatus mDNSHelperInit(void);
 
+// Asynchronous calls return as soon as the request has been queued for the helper. Their completions, if any, are
+// run on the helper queue, not the core's thread, so they must take the KQueue lock before touching mDNSCore state.
+// Consecutive set-cache-entry and keepalive requests are sent to the helper as one batched message.
+typedef void (^mDNSHelperCompletion)(int error);
+
+typedef struct
+{
+    v6addr_t sadd;
+    v6addr_t dadd;
+    uint16_t lport;
+    uint16_t rport;
+    uint32_t seq;
+    uint32_t ack;
+    uint16_t win;
+} mDNSHelperKeepalive;
 
 extern void mDNSRequestBPF(void);
 extern int  mDNSPowerRequest(int key, int interval);
-extern int  mDNSSetLocalAddressCacheEntry(int ifindex, int family, const v6addr_t ip, const ethaddr_t eth);
+extern void mDNSSetLocalAddressCacheEntry(int ifindex, int family, const v6addr_t ip, const ethaddr_t eth, mDNSHelperCompletion completion);
 extern void mDNSNotify(const char *title, const char *msg);     // Both strings are UTF-8 text
 extern void mDNSPreferencesSetName(int key, domainlabel *old, domainlabel *new);
 extern int  mDNSKeychainGetSecrets(CFArrayRef *secrets);
 extern void mDNSSendWakeupPacket(unsigned ifid, char *eth_addr, char *ip_addr, int iteration);
 extern void mDNSPacketFilterControl(uint32_t command, char * ifname, uint32_t count, pfArray_t portArray, pfArray_t protocolArray);
 extern void mDNSSendKeepalive(const v6addr_t sadd, const v6addr_t dadd, uint16_t lport, uint16_t rport, unsigned seq, unsigned ack, uint16_t win);
+extern void mDNSSendKeepalives(const mDNSHelperKeepalive *keepalives, int count);
 extern int  mDNSRetrieveTCPInfo(int family, v6addr_t laddr, uint16_t lport, v6addr_t raddr, uint16_t rport, uint32_t *seq, uint32_t *ack, uint16_t *win, int32_t *intfid);
 
 extern void RequestBPF(void);
@@ -534,6 +534,8 @@ mDNSexport mdns_interface_monitor_t GetInterfaceMonitorForIndex(uint32_t ifIndex
         if (CFArrayContainsValue(m->p->InterfaceMonitors, range, monitor))
         {
             m->p->if_interface_changed = mDNStrue;
+            // Paths through this interface may evaluate differently now, so don't wait for the network change.
+            mDNSPlatformFlushDNSRoutePolicyCache();
 
 #if MDNSRESPONDER_SUPPORTS(APPLE, OS_LOG)
             LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO, "Monitored interface changed: %@", monitor);
@@ -991,52 +993,32 @@ mDNSexport mStatus mDNSPlatformSendUDP(const mDNS *const m, const void *const ms
     return(result);
 }
 
-mDNSlocal ssize_t myrecvfrom(const int s, void *const buffer, const size_t max,
-                             struct sockaddr *const from, socklen_t *const fromlen, mDNSAddr *dstaddr, char ifname[IF_NAMESIZE], mDNSu8 *ttl)
+// Checks the flags and parses the ancillary data of a datagram that recvmsg (or recvmsg_x) just received into msg.
+// Returns n if the datagram is usable, or -1 if it isn't.
+mDNSlocal ssize_t myrecvfromResults(const int s, struct msghdr *const msg, const ssize_t n,
+                                    mDNSAddr *dstaddr, char ifname[IF_NAMESIZE], mDNSu8 *ttl)
 {
     static unsigned int numLogMessages = 0;
-    struct iovec databuffers = { (char *)buffer, max };
-    struct msghdr msg;
-    ssize_t n;
     struct cmsghdr *cmPtr;
-    char ancillary[1024];
 
     *ttl = 255;  // If kernel fails to provide TTL data (e.g. Jaguar doesn't) then assume the TTL was 255 as it should be
 
-    // Set up the message
-    msg.msg_name       = (caddr_t)from;
-    msg.msg_namelen    = *fromlen;
-    msg.msg_iov        = &databuffers;
-    msg.msg_iovlen     = 1;
-    msg.msg_control    = (caddr_t)&ancillary;
-    msg.msg_controllen = sizeof(ancillary);
-    msg.msg_flags      = 0;
-
-    // Receive the data
-    n = recvmsg(s, &msg, 0);
-    if (n<0)
-    {
-        if (errno != EWOULDBLOCK && numLogMessages++ < 100) LogMsg("mDNSMacOSX.c: recvmsg(%d) returned error %d errno %d", s, n, errno);
-        return(-1);
-    }
-    if (msg.msg_controllen < (int)sizeof(struct cmsghdr))
+    if (msg->msg_controllen < (int)sizeof(struct cmsghdr))
     {
         if (numLogMessages++ < 100) LogMsg("mDNSMacOSX.c: recvmsg(%d) returned %d msg.msg_controllen %d < sizeof(struct cmsghdr) %lu, errno %d",
-                                           s, n, msg.msg_controllen, sizeof(struct cmsghdr), errno);
+                                           s, n, msg->msg_controllen, sizeof(struct cmsghdr), errno);
         return(-1);
     }
     // Note: MSG_TRUNC means the datagram was truncated, while MSG_CTRUNC means that the control data was truncated.
     // The mDNS core is capable of handling truncated DNS messages, so MSG_TRUNC isn't checked.
-    if (msg.msg_flags & MSG_CTRUNC)
+    if (msg->msg_flags & MSG_CTRUNC)
     {
         if (numLogMessages++ < 100) LogMsg("mDNSMacOSX.c: recvmsg(%d) msg.msg_flags & MSG_CTRUNC", s);
         return(-1);
     }
 
-    *fromlen = msg.msg_namelen;
-
     // Parse each option out of the ancillary data.
-    for (cmPtr = CMSG_FIRSTHDR(&msg); cmPtr; cmPtr = CMSG_NXTHDR(&msg, cmPtr))
+    for (cmPtr = CMSG_FIRSTHDR(msg); cmPtr; cmPtr = CMSG_NXTHDR(msg, cmPtr))
     {
         // debugf("myrecvfrom cmsg_level %d cmsg_type %d", cmPtr->cmsg_level, cmPtr->cmsg_type);
         if (cmPtr->cmsg_level == IPPROTO_IP && cmPtr->cmsg_type == IP_RECVDSTADDR)
@@ -1071,6 +1053,103 @@ mDNSlocal ssize_t myrecvfrom(const int s, void *const buffer, const size_t max,
     return(n);
 }
 
+mDNSlocal ssize_t myrecvfrom(const int s, void *const buffer, const size_t max,
+                             struct sockaddr *const from, socklen_t *const fromlen, mDNSAddr *dstaddr, char ifname[IF_NAMESIZE], mDNSu8 *ttl)
+{
+    static unsigned int numLogMessages = 0;
+    struct iovec databuffers = { (char *)buffer, max };
+    struct msghdr msg;
+    ssize_t n;
+    char ancillary[1024];
+
+    // Set up the message
+    msg.msg_name       = (caddr_t)from;
+    msg.msg_namelen    = *fromlen;
+    msg.msg_iov        = &databuffers;
+    msg.msg_iovlen     = 1;
+    msg.msg_control    = (caddr_t)&ancillary;
+    msg.msg_controllen = sizeof(ancillary);
+    msg.msg_flags      = 0;
+
+    // Receive the data
+    n = recvmsg(s, &msg, 0);
+    if (n<0)
+    {
+        if (errno != EWOULDBLOCK && numLogMessages++ < 100) LogMsg("mDNSMacOSX.c: recvmsg(%d) returned error %d errno %d", s, n, errno);
+        return(-1);
+    }
+
+    *fromlen = msg.msg_namelen;
+    return(myrecvfromResults(s, &msg, n, dstaddr, ifname, ttl));
+}
+
+#if MDNSRESPONDER_SUPPORTS(APPLE, RECVMSG_X)
+// The most datagrams myKQSocketCallBack will read from a socket with one recvmsg_x call
+#ifndef KQ_RECV_BATCH_SIZE
+#define KQ_RECV_BATCH_SIZE 8
+#endif
+
+typedef struct
+{
+    ssize_t len;                        // Length of the datagram, or -1 if it's unusable
+    struct sockaddr_storage from;
+    mDNSAddr dstaddr;
+    char ifname[IF_NAMESIZE];
+    mDNSu8 ttl;
+} myrecvdatagram;
+
+// Batched form of myrecvfrom: reads up to count queued datagrams into the buffers with one recvmsg_x call.
+// Returns the number of datagrams read, whose details are in the first entries of dgrams, or -1 with errno set.
+mDNSlocal int myrecvfrom_x(const int s, DNSMessage *const buffers, myrecvdatagram *const dgrams, const u_int count)
+{
+    static unsigned int numLogMessages = 0;
+    struct msghdr_x msgs[KQ_RECV_BATCH_SIZE];
+    struct iovec databuffers[KQ_RECV_BATCH_SIZE];
+    char ancillary[KQ_RECV_BATCH_SIZE][256];    // Room for the destination address, interface, and TTL options
+    ssize_t n;
+    u_int i;
+
+    mDNSPlatformMemZero(msgs, sizeof(msgs));
+    for (i = 0; i < count; i++)
+    {
+        databuffers[i].iov_base = (char *)&buffers[i];
+        databuffers[i].iov_len  = sizeof(buffers[i]);
+        msgs[i].msg_name        = (caddr_t)&dgrams[i].from;
+        msgs[i].msg_namelen     = sizeof(dgrams[i].from);
+        msgs[i].msg_iov         = &databuffers[i];
+        msgs[i].msg_iovlen      = 1;
+        msgs[i].msg_control     = (caddr_t)&ancillary[i];
+        msgs[i].msg_controllen  = sizeof(ancillary[i]);
+    }
+
+    n = recvmsg_x(s, msgs, count, MSG_DONTWAIT);
+    if (n < 0)
+    {
+        if (errno != EWOULDBLOCK && numLogMessages++ < 100) LogMsg("mDNSMacOSX.c: recvmsg_x(%d) returned error %d errno %d", s, n, errno);
+        return(-1);
+    }
+
+    for (i = 0; i < (u_int)n; i++)
+    {
+        struct msghdr msg;
+        msg.msg_name       = msgs[i].msg_name;
+        msg.msg_namelen    = msgs[i].msg_namelen;
+        msg.msg_iov        = msgs[i].msg_iov;
+        msg.msg_iovlen     = msgs[i].msg_iovlen;
+        msg.msg_control    = msgs[i].msg_control;
+        msg.msg_controllen = msgs[i].msg_controllen;
+        msg.msg_flags      = msgs[i].msg_flags;
+        dgrams[i].dstaddr   = zeroAddr;
+        dgrams[i].ifname[0] = 0;
+        dgrams[i].len = myrecvfromResults(s, &msg, (ssize_t)msgs[i].msg_datalen, &dgrams[i].dstaddr, dgrams[i].ifname, &dgrams[i].ttl);
+    }
+    return((int)n);
+}
+
+// Set if the kernel turns out not to implement recvmsg_x, in which case we go back to one myrecvfrom per packet
+static mDNSBool gRecvmsgxUnsupported = mDNSfalse;
+#endif
+
 // What is this for, and why does it use xor instead of a simple equality check? -- SC
 mDNSlocal mDNSInterfaceID FindMyInterface(const mDNSAddr *addr)
 {
@@ -1109,11 +1188,69 @@ mDNSlocal mDNSInterfaceID FindMyInterface(const mDNSAddr *addr)
     return(mDNSInterface_Any);
 }
 
+// Works out where a packet received on a KQSocketSet came from, and which interface it arrived on.
+// Returns mDNSfalse if the packet should be ignored.
+mDNSlocal mDNSBool KQSocketPacketOrigin(mDNS *const m, const struct sockaddr_storage *const from, const mDNSAddr *const destAddr,
+                                        const char *const packetifname, mDNSAddr *const senderAddr, mDNSIPPort *const senderPort,
+                                        mDNSInterfaceID *const outInterfaceID)
+{
+    NetworkInterfaceInfoOSX *intf;
+
+    if ((destAddr->type == mDNSAddrType_IPv4 && (destAddr->ip.v4.b[0] & 0xF0) == 0xE0) ||
+        (destAddr->type == mDNSAddrType_IPv6 && (destAddr->ip.v6.b[0]         == 0xFF))) m->p->num_mcasts++;
+
+    if (from->ss_family == AF_INET)
+    {
+        const struct sockaddr_in *s = (const struct sockaddr_in*)from;
+        senderAddr->type = mDNSAddrType_IPv4;
+        senderAddr->ip.v4.NotAnInteger = s->sin_addr.s_addr;
+        senderPort->NotAnInteger = s->sin_port;
+        //LogInfo("myKQSocketCallBack received IPv4 packet from %#-15a to %#-15a %s", senderAddr, destAddr, packetifname);
+    }
+    else if (from->ss_family == AF_INET6)
+    {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6*)from;
+        senderAddr->type = mDNSAddrType_IPv6;
+        senderAddr->ip.v6 = *(const mDNSv6Addr*)&sin6->sin6_addr;
+        senderPort->NotAnInteger = sin6->sin6_port;
+        //LogInfo("myKQSocketCallBack received IPv6 packet from %#-15a to %#-15a %s", senderAddr, destAddr, packetifname);
+    }
+    else
+    {
+        LogMsg("myKQSocketCallBack from is unknown address family %d", from->ss_family);
+        return(mDNSfalse);
+    }
+
+    // Note: When handling multiple packets in a batch, MUST reset InterfaceID before handling each packet
+    *outInterfaceID = mDNSNULL;
+    for (intf = m->p->InterfaceList; intf; intf = intf->next)
+    {
+        if (intf->Exists && !strcmp(intf->ifinfo.ifname, packetifname))
+            break;
+    }
+
+    // When going to sleep we deregister all our interfaces, but if the machine
+    // takes a few seconds to sleep we may continue to receive multicasts
+    // during that time, which would confuse mDNSCoreReceive, because as far
+    // as it's concerned, we should have no active interfaces any more.
+    // Hence we ignore multicasts for which we can find no matching InterfaceID.
+    if (intf)
+        *outInterfaceID = intf->ifinfo.InterfaceID;
+    else if (mDNSAddrIsDNSMulticast(destAddr))
+        return(mDNSfalse);
+
+    if (!*outInterfaceID)
+    {
+        *outInterfaceID = FindMyInterface(destAddr);
+    }
+    return(mDNStrue);
+}
+
 mDNSexport void myKQSocketCallBack(int s1, short filter, void *context, mDNSBool encounteredEOF)
 {
     KQSocketSet *const ss = (KQSocketSet *)context;
     mDNS *const m = ss->m;
-    ssize_t recvlen;
+    ssize_t recvlen = 0;
     int count = 0, closed = 0, recvfrom_errno = 0;
 
     if (filter != EVFILT_READ)
@@ -1141,10 +1278,61 @@ mDNSexport void myKQSocketCallBack(int s1, short filter, void *context, mDNSBool
         return;
     }
 
+#if MDNSRESPONDER_SUPPORTS(APPLE, RECVMSG_X)
+    // On a busy network there can be many datagrams queued on the socket by the time we get to it, so read as many
+    // as we can with each system call, and hand each batch to mDNSCore under one lock.
+    // The buffers are static since they're too big to put on the stack; socket callbacks are serialized by KQueueLock.
+    // The UDP proxy takes one packet per callback, so proxy sockets still use the per-packet loop below.
+    if (!ss->proxy && !gRecvmsgxUnsupported)
+    {
+        static DNSMessage packets[KQ_RECV_BATCH_SIZE];
+        static myrecvdatagram dgrams[KQ_RECV_BATCH_SIZE];
+        static mDNSReceivedPacket received[KQ_RECV_BATCH_SIZE];
+
+        while (!closed)
+        {
+            mDNSu32 usable = 0;
+            int i, n = myrecvfrom_x(s1, packets, dgrams, KQ_RECV_BATCH_SIZE);
+            if (n < 0 && errno == ENOSYS && count == 0)
+            {
+                LogMsg("myKQSocketCallBack: recvmsg_x not supported; receiving one packet at a time");
+                gRecvmsgxUnsupported = mDNStrue;
+                break;
+            }
+            if (n <= 0)
+            {
+                recvlen = -1;
+                recvfrom_errno = (n < 0) ? errno : EWOULDBLOCK;
+                break;
+            }
+            for (i = 0; i < n; i++)
+            {
+                mDNSReceivedPacket *const pkt = &received[usable];
+                if (dgrams[i].len < 0) continue;
+                count++;
+                if (!KQSocketPacketOrigin(m, &dgrams[i].from, &dgrams[i].dstaddr, dgrams[i].ifname, &pkt->srcaddr, &pkt->srcport, &pkt->InterfaceID))
+                    continue;
+                pkt->msg     = &packets[i];
+                pkt->end     = (mDNSu8 *)&packets[i] + dgrams[i].len;
+                pkt->dstaddr = dgrams[i].dstaddr;
+                pkt->dstport = ss->port;
+                usable++;
+            }
+
+            // See the comment about closeFlag in the per-packet loop below.
+            ss->closeFlag = &closed;
+            mDNSCoreReceiveBatch(m, received, usable);
+            if (!closed) ss->closeFlag = mDNSNULL;
+        }
+        if (!gRecvmsgxUnsupported) goto done;
+    }
+#endif
+
     while (!closed)
     {
         mDNSAddr senderAddr, destAddr = zeroAddr;
         mDNSIPPort senderPort;
+        mDNSInterfaceID InterfaceID;
         struct sockaddr_storage from;
         socklen_t fromlen = sizeof(from);
         char packetifname[IF_NAMESIZE] = "";
@@ -1156,57 +1344,10 @@ mDNSexport void myKQSocketCallBack(int s1, short filter, void *context, mDNSBool
             break;
         }
 
-        if ((destAddr.type == mDNSAddrType_IPv4 && (destAddr.ip.v4.b[0] & 0xF0) == 0xE0) ||
-            (destAddr.type == mDNSAddrType_IPv6 && (destAddr.ip.v6.b[0]         == 0xFF))) m->p->num_mcasts++;
-
         count++;
-        if (from.ss_family == AF_INET)
-        {
-            struct sockaddr_in *s = (struct sockaddr_in*)&from;
-            senderAddr.type = mDNSAddrType_IPv4;
-            senderAddr.ip.v4.NotAnInteger = s->sin_addr.s_addr;
-            senderPort.NotAnInteger = s->sin_port;
-            //LogInfo("myKQSocketCallBack received IPv4 packet from %#-15a to %#-15a on skt %d %s", &senderAddr, &destAddr, s1, packetifname);
-        }
-        else if (from.ss_family == AF_INET6)
-        {
-            struct sockaddr_in6 *sin6 = (struct sockaddr_in6*)&from;
-            senderAddr.type = mDNSAddrType_IPv6;
-            senderAddr.ip.v6 = *(mDNSv6Addr*)&sin6->sin6_addr;
-            senderPort.NotAnInteger = sin6->sin6_port;
-            //LogInfo("myKQSocketCallBack received IPv6 packet from %#-15a to %#-15a on skt %d %s", &senderAddr, &destAddr, s1, packetifname);
-        }
-        else
-        {
-            LogMsg("myKQSocketCallBack from is unknown address family %d", from.ss_family);
-            return;
-        }
-
-        // Note: When handling multiple packets in a batch, MUST reset InterfaceID before handling each packet
-        mDNSInterfaceID InterfaceID = mDNSNULL;
-        NetworkInterfaceInfoOSX *intf = m->p->InterfaceList;
-        while (intf) 
-        {
-            if (intf->Exists && !strcmp(intf->ifinfo.ifname, packetifname))
-                break;
-            intf = intf->next;
-        }
-
-        // When going to sleep we deregister all our interfaces, but if the machine
-        // takes a few seconds to sleep we may continue to receive multicasts
-        // during that time, which would confuse mDNSCoreReceive, because as far
-        // as it's concerned, we should have no active interfaces any more.
-        // Hence we ignore multicasts for which we can find no matching InterfaceID.
-        if (intf)
-            InterfaceID = intf->ifinfo.InterfaceID;
-        else if (mDNSAddrIsDNSMulticast(&destAddr))
+        if (!KQSocketPacketOrigin(m, &from, &destAddr, packetifname, &senderAddr, &senderPort, &InterfaceID))
             continue;
 
-        if (!InterfaceID)
-        {
-            InterfaceID = FindMyInterface(&destAddr);
-        }
-
 //      LogMsg("myKQSocketCallBack got packet from %#a to %#a on interface %#a/%s",
 //          &senderAddr, &destAddr, &ss->info->ifinfo.ip, ss->info->ifinfo.ifname);
 
@@ -1231,6 +1372,9 @@ mDNSexport void myKQSocketCallBack(int s1, short filter, void *context, mDNSBool
         if (!closed) ss->closeFlag = mDNSNULL;
     }
 
+#if MDNSRESPONDER_SUPPORTS(APPLE, RECVMSG_X)
+done:
+#endif
     // If a client application's sockets are marked as defunct
     // sockets we have delegated to it with SO_DELEGATED will also go defunct.
     // We get an ENOTCONN error for defunct sockets and should just close the socket in that case.
@@ -2474,9 +2618,17 @@ mDNSexport void mDNSPlatformSetLocalAddressCacheEntry(const mDNSAddr *const tpa,
         LogSPS("Don't need address cache entry for %s %#a %.6a",            info->ifinfo.ifname, tpa, tha);
     else
     {
-        int result = mDNSSetLocalAddressCacheEntry(info->scope_id, tpa->type, tpa->ip.v6.b, tha->b);
-        if (result) LogMsg("Set local address cache entry for %s %#a %.6a failed: %d", info->ifinfo.ifname, tpa, tha, result);
-        else LogSPS("Set local address cache entry for %s %#a %.6a",            info->ifinfo.ifname, tpa, tha);
+        // The helper applies the entry asynchronously, so the completion logs copies of the arguments.
+        // (The interface name is wrapped in a struct because blocks can't capture arrays.)
+        struct { char ifname[sizeof(info->ifinfo.ifname)]; } name;
+        const mDNSAddr addr = *tpa;
+        const mDNSEthAddr eth = *tha;
+        mDNSPlatformMemCopy(name.ifname, info->ifinfo.ifname, sizeof(name.ifname));
+        mDNSSetLocalAddressCacheEntry(info->scope_id, tpa->type, tpa->ip.v6.b, tha->b, ^(int result)
+        {
+            if (result) LogMsg("Set local address cache entry for %s %#a %.6a failed: %d", name.ifname, &addr, &eth, result);
+            else LogSPS("Set local address cache entry for %s %#a %.6a",            name.ifname, &addr, &eth);
+        });
     }
 }
 
@@ -2569,6 +2721,32 @@ mDNSexport void mDNSPlatformSendKeepalive(mDNSAddr *sadd, mDNSAddr *dadd, mDNSIP
     mDNSSendKeepalive(sadd->ip.v6.b, dadd->ip.v6.b, lport->NotAnInteger, rport->NotAnInteger, seq, ack, win);
 }
 
+// Keepalives that came due together go to the helper in one message
+mDNSexport void mDNSPlatformSendKeepalives(const mDNSKeepalivePacket *packets, int count)
+{
+    mDNSHelperKeepalive keepalives[16];
+    int i, n = 0;
+    LogMsg("mDNSPlatformSendKeepalives called for %d keepalives", count);
+    for (i = 0; i < count; i++)
+    {
+        const mDNSKeepalivePacket *const ka = &packets[i];
+        mDNSHelperKeepalive *const hk = &keepalives[n++];
+        mDNSPlatformMemCopy(hk->sadd, ka->laddr.ip.v6.b, sizeof(hk->sadd));
+        mDNSPlatformMemCopy(hk->dadd, ka->raddr.ip.v6.b, sizeof(hk->dadd));
+        hk->lport = ka->lport.NotAnInteger;
+        hk->rport = ka->rport.NotAnInteger;
+        hk->seq   = ka->seq;
+        hk->ack   = ka->ack;
+        hk->win   = ka->win;
+        // A full array is queued right away; the helper queue batches whatever is pending when it flushes
+        if (n == (int)(sizeof(keepalives) / sizeof(keepalives[0])) || i == count - 1)
+        {
+            mDNSSendKeepalives(keepalives, n);
+            n = 0;
+        }
+    }
+}
+
 mDNSexport mStatus mDNSPlatformClearSPSData(void)
 {
     CFStringRef  spsAddressKey  = NULL;
@@ -4067,7 +4245,10 @@ mDNSlocal mStatus ReorderInterfaceList()
 
     // If we have a valid new list, point to that now
     if (newList != mDNSNULL)
+    {
         m->HostInterfaces = newList;
+        mDNS_RehashInterfaces(m);
+    }
 
     nwi_state_release(state);
 #endif // PR_30071012_FIXED
@@ -5198,6 +5379,8 @@ mDNSexport mDNSBool mDNSPlatformSetDNSConfig(mDNSBool setservers, mDNSBool setse
             }
 #endif
 
+            // A new DNS configuration can change the resolvers and scoping a path evaluation returns
+            if (setservers) mDNSPlatformFlushDNSRoutePolicyCache();
 #if MDNSRESPONDER_SUPPORTS(APPLE, UNICAST_DOTLOCAL)
             SetupActiveDirectoryDomain(config);
 #endif
@@ -6215,6 +6398,7 @@ mDNSexport void mDNSMacOSXNetworkChanged(void)
         m->NetworkChanged ? mDNS_TimeNow(m) - m->NetworkChanged : 0,
         m->NetworkChanged ? "" : " (no scheduled configuration change)");
     m->NetworkChanged = 0;       // If we received a network change event and deferred processing, we're now dealing with it
+    mDNSPlatformFlushDNSRoutePolicyCache();
 
     // If we have *any* TENTATIVE IPv6 addresses, wait until they've finished configuring
     int InfoSocket = socket(AF_INET6, SOCK_DGRAM, 0);
@@ -7723,8 +7907,8 @@ mDNSlocal mDNSBool EtcHostsAddNewEntries(AuthHash *newhosts, mDNSBool justCheck)
     AuthGroup *ag;
     mDNSu32 slot;
     AuthRecord *rr, *primary, *rrnext;
-    for (slot = 0; slot < AUTH_HASH_SLOTS; slot++)
-        for (ag = newhosts->rrauth_hash[slot]; ag; ag = ag->next)
+    for (slot = 0; slot < AuthHashSlots(newhosts); slot++)
+        for (ag = AuthHashHead(newhosts, slot); ag; ag = ag->next)
         {
             primary = NULL;
             for (rr = ag->members; rr; rr = rrnext)
@@ -7783,8 +7967,8 @@ mDNSlocal mDNSBool EtcHostsDeleteOldEntries(AuthHash *newhosts, mDNSBool justChe
     AuthGroup *ag;
     mDNSu32 slot;
     AuthRecord *rr, *rrnext;
-    for (slot = 0; slot < AUTH_HASH_SLOTS; slot++)
-        for (ag = m->rrauth.rrauth_hash[slot]; ag; ag = ag->next)
+    for (slot = 0; slot < AuthHashSlots(&m->rrauth); slot++)
+        for (ag = AuthHashHead(&m->rrauth, slot); ag; ag = ag->next)
             for (rr = ag->members; rr; rr = rrnext)
             {
                 mDNSBool found = mDNSfalse;
@@ -7858,8 +8042,8 @@ mDNSlocal void FreeNewHosts(AuthHash *newhosts)
     AuthGroup *ag, *agnext;
     AuthRecord *rr, *rrnext;
 
-    for (slot = 0; slot < AUTH_HASH_SLOTS; slot++)
-        for (ag = newhosts->rrauth_hash[slot]; ag; ag = agnext)
+    for (slot = 0; slot < AuthHashSlots(newhosts); slot++)
+        for (ag = AuthHashHead(newhosts, slot); ag; ag = agnext)
         {
             agnext = ag->next;
             for (rr = ag->members; rr; rr = rrnext)
@@ -7867,6 +8051,7 @@ mDNSlocal void FreeNewHosts(AuthHash *newhosts)
                 rrnext = rr->next;
                 freeL("etchosts", rr);
             }
+            freeL("AuthGroup name", ag->name);
             freeL("AuthGroups", ag);
         }
 }
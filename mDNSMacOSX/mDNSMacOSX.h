@@ -304,6 +304,9 @@ extern void mDNSPlatformTriggerDNSRetry(const DNSQuestion *v4q, const DNSQuestio
 
 extern mdns_interface_monitor_t GetInterfaceMonitorForIndex(uint32_t ifIndex);
 
+// Drops the path evaluation results cached by mDNSPlatformGetDNSRoutePolicy() (uDNSPathEvaluation.c)
+extern void mDNSPlatformFlushDNSRoutePolicyCache(void);
+
 #ifdef  __cplusplus
 }
 #endif
@@ -29,9 +29,12 @@
 //======================================================================================================================
 // MARK: - DNS Service Manager Kind Definition
 
+typedef struct _domain_trie_node_s *	_domain_trie_node_t;
+
 struct mdns_dns_service_manager_s {
 	struct mdns_object_s	base;				// Object base.
 	CFMutableArrayRef		default_services;	// DNS services from configd.
+	_domain_trie_node_t		default_trie;		// Reversed-label trie of default services' domains.
 	CFMutableArrayRef		path_services;		// DNS services from path clients.
 	CFMutableArrayRef		discovered_services;// DNS services discovered from DNS records.
 	CFMutableArrayRef		custom_services;	// DNS services created for custom use.
@@ -142,6 +145,29 @@ struct _domain_item_s {
 	uint32_t		order;			// Order value from associated dns_resolver_t object, if any.
 };
 
+typedef struct _domain_trie_entry_s *	_domain_trie_entry_t;
+
+// A trie entry records that a service handles the domain that corresponds to the entry's node.
+// The service isn't retained because the trie is rebuilt whenever the array that holds the services changes.
+
+struct _domain_trie_entry_s {
+	_domain_trie_entry_t	next;			// Next entry in list.
+	mdns_dns_service_t		service;		// Service that handles the node's domain (not retained).
+	CFIndex					index;			// Service's index in its service array for breaking ties.
+	uint32_t				order;			// Order value of the service's domain item.
+};
+
+// Each node represents a domain and its children are indexed by their labels, so walking from the root node
+// along a domain name's labels, in reverse order, visits the nodes of all of the domain name's parent domains.
+
+struct _domain_trie_node_s {
+	_domain_trie_node_t *	children;		// Child nodes sorted by label.
+	_domain_trie_entry_t	entries;		// Entries for services that handle this node's domain.
+	size_t					child_count;	// Number of child nodes.
+	size_t					child_capacity;	// Capacity of child node array.
+	uint8_t					label[1 + kDomainLabelLengthMax];	// Label that leads to this node from its parent.
+};
+
 //======================================================================================================================
 // MARK: - Local Prototypes
 
@@ -183,6 +209,9 @@ _mdns_dns_service_create(mdns_dns_service_source_t source, mdns_dns_service_scop
 static void
 _mdns_dns_service_manager_prepare_resolver(mdns_dns_service_manager_t manager, mdns_dns_service_t service);
 
+static void
+_mdns_dns_service_manager_prewarm_service(mdns_dns_service_manager_t manager, mdns_dns_service_t service);
+
 static void
 _mdns_dns_service_manager_start_defuncting(mdns_dns_service_manager_t manager, mdns_dns_service_t service);
 
@@ -229,6 +258,16 @@ _mdns_domain_name_get_parent(const uint8_t *name, int depth);
 static void
 _domain_item_free(_domain_item_t item);
 
+static _domain_trie_node_t
+_domain_trie_create_from_services(CFArrayRef services);
+
+static void
+_domain_trie_forget(_domain_trie_node_t *node_ptr);
+
+static const struct _domain_trie_entry_s *
+_domain_trie_get_best_entry(_domain_trie_node_t trie, const uint8_t *name, mdns_dns_service_scope_t scope,
+	uint32_t scoping_id);
+
 static int
 _domain_item_compare(const struct _domain_item_s *d1, const struct _domain_item_s *d2, bool ignore_order);
 
@@ -454,9 +493,20 @@ _mdns_dns_service_manager_apply_dns_config_internal(const mdns_dns_service_manag
 	me->default_services = new_services;
 	new_services = NULL;
 
+	// If the trie can't be created, service lookups fall back to a linear search of the default services.
+	_domain_trie_forget(&me->default_trie);
+	me->default_trie = _domain_trie_create_from_services(me->default_services);
+
 	_mdns_dns_service_manager_remove_unneeded_interface_monitors(me);
 	_mdns_dns_service_manager_update_interface_properties_for_services(me, me->default_services);
 
+	// Encrypted services get their connection set up now rather than on their first query.
+	const CFIndex n = CFArrayGetCount(me->default_services);
+	for (CFIndex i = 0; i < n; ++i) {
+		const mdns_dns_service_t service = (mdns_dns_service_t)CFArrayGetValueAtIndex(me->default_services, i);
+		_mdns_dns_service_manager_prewarm_service(me, service);
+	}
+
 exit:
 	if (err) {
 		_mdns_dns_service_manager_terminate(me, err);
@@ -935,6 +985,7 @@ _mdns_dns_service_manager_register_doh_uri_internal(const mdns_dns_service_manag
 			_mdns_dns_service_manager_add_service(me, me->discovered_services, service);
 			mdns_release(service);
 			_mdns_dns_service_manager_fetch_doh_pvd(me, service);
+			_mdns_dns_service_manager_prewarm_service(me, service);
 		}
 	}
 
@@ -1286,6 +1337,7 @@ static void
 _mdns_dns_service_manager_finalize(mdns_dns_service_manager_t me)
 {
 	ForgetCF(&me->default_services);
+	_domain_trie_forget(&me->default_trie);
 	ForgetCF(&me->path_services);
 	ForgetCF(&me->discovered_services);
 	ForgetCF(&me->custom_services);
@@ -1408,6 +1460,7 @@ _mdns_dns_service_manager_terminate(const mdns_dns_service_manager_t me, const O
 	}
 	CFArrayRemoveAllValues(me->monitors);
 
+	_domain_trie_forget(&me->default_trie);
 	_mdns_dns_service_manager_terminate_services(me, me->default_services);
 	_mdns_dns_service_manager_terminate_services(me, me->path_services);
 	_mdns_dns_service_manager_terminate_services(me, me->discovered_services);
@@ -1450,10 +1503,37 @@ _mdns_dns_service_manager_add_service(const mdns_dns_service_manager_t me, const
 
 //======================================================================================================================
 
+static bool
+_mdns_dns_service_matches_scope(const mdns_dns_service_t me, const mdns_dns_service_scope_t scope,
+	const uint32_t scoping_id)
+{
+	if (me->scope != scope) {
+		return false;
+	}
+	switch (scope) {
+		case mdns_dns_service_scope_interface:
+			return (me->if_index == scoping_id);
+
+		case mdns_dns_service_scope_service:
+			return (me->service_id == scoping_id);
+
+		default:
+		case mdns_dns_service_scope_none:
+			return true;
+	}
+}
+
 static mdns_dns_service_t
 _mdns_dns_service_manager_get_service(const mdns_dns_service_manager_t me, const uint8_t * const name,
 	const mdns_dns_service_scope_t scope, const uint32_t scoping_id)
 {
+	// Use the trie if it's available. Its cost is proportional to the name's label count instead of to the total
+	// number of domains handled by the default services.
+	if (me->default_trie) {
+		const struct _domain_trie_entry_s * const entry = _domain_trie_get_best_entry(me->default_trie, name, scope,
+			scoping_id);
+		return (entry ? entry->service : NULL);
+	}
 	mdns_dns_service_t	best_service		= NULL;
 	int					best_label_count	= -1;
 	uint32_t			best_order			= 0;
@@ -1461,26 +1541,9 @@ _mdns_dns_service_manager_get_service(const mdns_dns_service_manager_t me, const
 	const CFIndex n = CFArrayGetCount(me->default_services);
 	for (CFIndex i = 0; i < n; ++i) {
 		mdns_dns_service_t candidate = (mdns_dns_service_t)CFArrayGetValueAtIndex(me->default_services, i);
-		if (candidate->scope != scope) {
+		if (!_mdns_dns_service_matches_scope(candidate, scope, scoping_id)) {
 			continue;
 		}
-		switch (scope) {
-			case mdns_dns_service_scope_interface:
-				if (candidate->if_index != scoping_id) {
-					continue;
-				}
-				break;
-
-			case mdns_dns_service_scope_service:
-				if (candidate->service_id != scoping_id) {
-					continue;
-				}
-				break;
-
-			default:
-			case mdns_dns_service_scope_none:
-				break;
-		}
 		uint32_t order = 0;
 		const int label_count = _mdns_dns_service_handles_domain_name(candidate, name, &order);
 		if (label_count < 0) {
@@ -2410,6 +2473,20 @@ exit:
 
 //======================================================================================================================
 
+static void
+_mdns_dns_service_manager_prewarm_service(const mdns_dns_service_manager_t me, const mdns_dns_service_t service)
+{
+	require_return(!mdns_dns_service_is_defunct(service) && !service->defuncting);
+	require_return(mdns_resolver_type_uses_encryption(_mdns_dns_service_get_resolver_type_safe(service)));
+
+	_mdns_dns_service_manager_prepare_resolver(me, service);
+	if (service->resolver) {
+		mdns_resolver_prewarm(service->resolver);
+	}
+}
+
+//======================================================================================================================
+
 static void
 _mdns_dns_service_manager_start_defuncting(const mdns_dns_service_manager_t me, const mdns_dns_service_t service)
 {
@@ -2910,3 +2987,214 @@ _domain_item_compare(const struct _domain_item_s * const d1, const struct _domai
 	}
 	return 0;
 }
+
+//======================================================================================================================
+// MARK: - Domain Trie Private Methods
+
+static int
+_domain_label_compare(const uint8_t * const label1, const uint8_t * const label2)
+{
+	const int length1 = label1[0];
+	const int length2 = label2[0];
+	const int n = Min(length1, length2);
+	for (int i = 1; i <= n; ++i) {
+		const int diff = tolower_safe(label1[i]) - tolower_safe(label2[i]);
+		if (diff != 0) {
+			return diff;
+		}
+	}
+	return (length1 - length2);
+}
+
+//======================================================================================================================
+
+static size_t
+_domain_trie_node_search_children(const _domain_trie_node_t me, const uint8_t * const label, bool * const out_found)
+{
+	// Binary search for the child with the specified label, or for the index where such a child would be inserted.
+	size_t lo = 0;
+	size_t hi = me->child_count;
+	while (lo < hi) {
+		const size_t mid = lo + ((hi - lo) / 2);
+		const int diff = _domain_label_compare(me->children[mid]->label, label);
+		if (diff == 0) {
+			*out_found = true;
+			return mid;
+		}
+		if (diff < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	*out_found = false;
+	return lo;
+}
+
+//======================================================================================================================
+
+static _domain_trie_node_t
+_domain_trie_node_get_child(const _domain_trie_node_t me, const uint8_t * const label)
+{
+	bool found;
+	const size_t i = _domain_trie_node_search_children(me, label, &found);
+	return (found ? me->children[i] : NULL);
+}
+
+//======================================================================================================================
+
+static _domain_trie_node_t
+_domain_trie_node_create(const uint8_t * const label)
+{
+	const _domain_trie_node_t obj = (_domain_trie_node_t)calloc(1, sizeof(*obj));
+	require_return_value(obj, NULL);
+
+	memcpy(obj->label, label, 1 + Min(label[0], kDomainLabelLengthMax));
+	return obj;
+}
+
+//======================================================================================================================
+
+static _domain_trie_node_t
+_domain_trie_node_get_or_add_child(const _domain_trie_node_t me, const uint8_t * const label)
+{
+	bool found;
+	const size_t i = _domain_trie_node_search_children(me, label, &found);
+	if (found) {
+		return me->children[i];
+	}
+	if (me->child_count == me->child_capacity) {
+		const size_t new_capacity = (me->child_capacity > 0) ? (2 * me->child_capacity) : 4;
+		_domain_trie_node_t * const new_children =
+			(_domain_trie_node_t *)realloc(me->children, new_capacity * sizeof(*new_children));
+		require_return_value(new_children, NULL);
+
+		me->children		= new_children;
+		me->child_capacity	= new_capacity;
+	}
+	const _domain_trie_node_t child = _domain_trie_node_create(label);
+	require_return_value(child, NULL);
+
+	memmove(&me->children[i + 1], &me->children[i], (me->child_count - i) * sizeof(me->children[0]));
+	me->children[i] = child;
+	++me->child_count;
+	return child;
+}
+
+//======================================================================================================================
+
+static OSStatus
+_domain_trie_add_domain(const _domain_trie_node_t me, const struct _domain_item_s * const item,
+	const mdns_dns_service_t service, const CFIndex index)
+{
+	// Walk from the root node along the domain's labels in reverse order, creating nodes as needed.
+	_domain_trie_node_t node = me;
+	for (int depth = item->label_count; depth-- > 0; ) {
+		node = _domain_trie_node_get_or_add_child(node, _mdns_domain_name_get_parent(item->name, depth));
+		require_return_value(node, kNoMemoryErr);
+	}
+	const _domain_trie_entry_t entry = (_domain_trie_entry_t)calloc(1, sizeof(*entry));
+	require_return_value(entry, kNoMemoryErr);
+
+	entry->service	= service;
+	entry->index	= index;
+	entry->order	= item->order;
+	entry->next		= node->entries;
+	node->entries	= entry;
+	return kNoErr;
+}
+
+//======================================================================================================================
+
+static _domain_trie_node_t
+_domain_trie_create_from_services(const CFArrayRef services)
+{
+	OSStatus err;
+	_domain_trie_node_t trie = _domain_trie_node_create((const uint8_t *)"");
+	require_action_quiet(trie, exit, err = kNoMemoryErr);
+
+	const CFIndex n = CFArrayGetCount(services);
+	for (CFIndex i = 0; i < n; ++i) {
+		const mdns_dns_service_t service = (mdns_dns_service_t)CFArrayGetValueAtIndex(services, i);
+		for (const struct _domain_item_s *item = service->domain_list; item; item = item->next) {
+			err = _domain_trie_add_domain(trie, item, service, i);
+			require_noerr_quiet(err, exit);
+		}
+	}
+	err = kNoErr;
+
+exit:
+	if (err) {
+		os_log_error(_mdns_dns_service_log(), "Failed to create domain trie -- error: %{mdns:err}ld", (long)err);
+		_domain_trie_forget(&trie);
+	}
+	return trie;
+}
+
+//======================================================================================================================
+
+static void
+_domain_trie_node_free(const _domain_trie_node_t me)
+{
+	for (size_t i = 0; i < me->child_count; ++i) {
+		_domain_trie_node_free(me->children[i]);
+	}
+	ForgetMem(&me->children);
+	_domain_trie_entry_t entry;
+	while ((entry = me->entries) != NULL) {
+		me->entries = entry->next;
+		free(entry);
+	}
+	free(me);
+}
+
+static void
+_domain_trie_forget(_domain_trie_node_t * const node_ptr)
+{
+	if (*node_ptr) {
+		_domain_trie_node_free(*node_ptr);
+		*node_ptr = NULL;
+	}
+}
+
+//======================================================================================================================
+
+static const struct _domain_trie_entry_s *
+_domain_trie_get_best_entry(const _domain_trie_node_t me, const uint8_t * const name,
+	const mdns_dns_service_scope_t scope, const uint32_t scoping_id)
+{
+	const int label_count = DomainNameLabelCount(name);
+	require_return_value(label_count >= 0, NULL);
+
+	// Gather pointers to the name's labels so that they can be visited from right to left.
+	const uint8_t *labels[kDomainNameLengthMax / 2];
+	int n = 0;
+	for (const uint8_t *ptr = name; (*ptr != 0) && (n < (int)countof(labels)); ptr += (1 + *ptr)) {
+		labels[n++] = ptr;
+	}
+	// The deeper a node, the longer the parent domain match, so an eligible entry at a deeper node always supersedes
+	// entries at shallower nodes. Among the eligible entries of the same node, the one with the smaller order value
+	// (higher priority) wins. Remaining ties go to the service that comes first in the service array.
+	const struct _domain_trie_entry_s *best = NULL;
+	_domain_trie_node_t node = me;
+	for (int depth = n; node; ) {
+		const struct _domain_trie_entry_s *node_best = NULL;
+		for (const struct _domain_trie_entry_s *entry = node->entries; entry; entry = entry->next) {
+			if (!_mdns_dns_service_matches_scope(entry->service, scope, scoping_id)) {
+				continue;
+			}
+			if (!node_best || (entry->order < node_best->order) ||
+				((entry->order == node_best->order) && (entry->index < node_best->index))) {
+				node_best = entry;
+			}
+		}
+		if (node_best) {
+			best = node_best;
+		}
+		if (depth-- <= 0) {
+			break;
+		}
+		node = _domain_trie_node_get_child(node, labels[depth]);
+	}
+	return best;
+}
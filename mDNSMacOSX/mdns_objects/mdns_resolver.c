@@ -45,6 +45,10 @@ struct mdns_resolver_s {
 	dispatch_source_t				probe_timer;				// Periodic timer for restarting probe querier.
 	mdns_querier_t					probe_querier;				// Querier to detect when DNS service is usable again.
 	uint32_t						probe_querier_id;			// ID number of current probe querier.
+	dispatch_source_t				keepalive_timer;			// Periodic timer for keeping encrypted connections warm.
+	mdns_querier_t					warmup_querier;				// Querier to set up or keep alive encrypted connections.
+	uint32_t						warmup_querier_id;			// ID number of current warmup querier.
+	uint64_t						last_query_ticks;			// When a user querier was last registered in ticks.
 	uint32_t						initial_dgram_rtx_ms;		// Initial datagram retransmission interval in ms.
 	bool							report_symptoms;			// True if this resolver should report symptoms.
 	bool							squash_cnames;				// True if this resolver should squash CNAMEs.
@@ -1203,7 +1207,8 @@ mdns_resolver_set_initial_datagram_retransmission_interval(const mdns_resolver_t
 void
 mdns_resolver_disable_connection_reuse(const mdns_resolver_t me, const bool disable)
 {
-	if (!me->user_activated) {
+	// Queries to encrypted resolvers always share one connection, so that only one TLS handshake is paid for.
+	if (!me->user_activated && !mdns_resolver_type_uses_encryption(_mdns_resolver_get_type(me))) {
 		me->force_no_stream_sharing = disable ? true : false;
 	}
 }
@@ -1242,6 +1247,22 @@ mdns_resolver_activate(mdns_resolver_t me)
 
 //======================================================================================================================
 
+static void
+_mdns_resolver_prewarm_internal(mdns_resolver_t resolver);
+
+void
+mdns_resolver_prewarm(mdns_resolver_t me)
+{
+	mdns_retain(me);
+	dispatch_async(_mdns_resolver_queue(),
+	^{
+		_mdns_resolver_prewarm_internal(me);
+		mdns_release(me);
+	});
+}
+
+//======================================================================================================================
+
 static void
 _mdns_resolver_invalidate_internal(mdns_resolver_t resolver);
 
@@ -1264,6 +1285,8 @@ _mdns_resolver_invalidate_internal(mdns_resolver_t me)
 	me->invalidated = true;
 	dispatch_source_forget(&me->probe_timer);
 	mdns_querier_forget(&me->probe_querier);
+	dispatch_source_forget(&me->keepalive_timer);
+	mdns_querier_forget(&me->warmup_querier);
 	mdns_server_t server;
 	while ((server = me->server_list) != NULL) {
 		me->server_list = server->next;
@@ -1934,12 +1957,18 @@ _mdns_resolver_session_receive(mdns_session_t session, dispatch_data_t msg_data,
 static bool
 _mdns_resolver_is_in_suspicious_mode(mdns_resolver_t resolver);
 
+static void
+_mdns_resolver_note_user_query(mdns_resolver_t resolver);
+
 static void
 _mdns_resolver_register_querier(mdns_resolver_t me, mdns_querier_t querier, bool force_stream_mode)
 {
 	require_return_action(!me->invalidated,
 		_mdns_querier_conclude_async(querier, mdns_querier_result_type_resolver_invalidation));
 
+	if ((querier != me->probe_querier) && (querier != me->warmup_querier)) {
+		_mdns_resolver_note_user_query(me);
+	}
 	if (_mdns_resolver_is_stream_only(me) || force_stream_mode) {
 		querier->use_stream = true;
 	} else if (_mdns_resolver_is_in_suspicious_mode(me)) {
@@ -2292,6 +2321,96 @@ exit:
 
 //======================================================================================================================
 
+// Servers commonly close idle DoT/DoH connections after 30 seconds or more, so an idle connection is refreshed a bit
+// before that, but only for a while after the last query, to avoid keeping connections that no one uses.
+#define MDNS_RESOLVER_KEEPALIVE_INTERVAL_SECS	25
+#define MDNS_RESOLVER_KEEPALIVE_WINDOW_SECS		(5 * kSecondsPerMinute)
+
+static bool
+_mdns_resolver_needs_warm_connection(const mdns_resolver_t me)
+{
+	return (_mdns_resolver_is_stream_only(me) && mdns_resolver_type_uses_encryption(_mdns_resolver_get_type(me)));
+}
+
+static void
+_mdns_resolver_start_warmup_querier(const mdns_resolver_t me)
+{
+	require_return(!me->warmup_querier || mdns_querier_has_concluded(me->warmup_querier));
+
+	mdns_querier_forget(&me->warmup_querier);
+	me->warmup_querier = mdns_resolver_create_querier(me, NULL);
+	require_action_quiet(me->warmup_querier, exit, os_log_error(_mdns_resolver_log(), "Failed to create warmup querier"));
+
+	mdns_querier_set_log_label(me->warmup_querier, "WQ%u", ++me->warmup_querier_id);
+	mdns_querier_set_queue(me->warmup_querier, _mdns_resolver_queue());
+	const uint8_t * const root_qname = (const uint8_t *)"";
+	mdns_querier_set_query(me->warmup_querier, root_qname, kDNSRecordType_NS, kDNSClassType_IN);
+	mdns_querier_activate(me->warmup_querier);
+
+exit:
+	return;
+}
+
+static void
+_mdns_resolver_handle_keepalive_timer(const mdns_resolver_t me)
+{
+	const uint64_t idle_ticks = mach_continuous_time() - me->last_query_ticks;
+	if (idle_ticks >= (MDNS_RESOLVER_KEEPALIVE_WINDOW_SECS * _mdns_ticks_per_second())) {
+		os_log_debug(_mdns_resolver_log(), "Stopping keepalive for idle %{public}s resolver",
+			_mdns_resolver_get_bytestream_protocol_string(me));
+		dispatch_source_forget(&me->keepalive_timer);
+	} else if (!me->cannot_connect && (idle_ticks >= (MDNS_RESOLVER_KEEPALIVE_INTERVAL_SECS * _mdns_ticks_per_second()))) {
+		// The probe querier takes care of servers with connection problems.
+		_mdns_resolver_start_warmup_querier(me);
+	}
+}
+
+static void
+_mdns_resolver_start_keepalive_timer(const mdns_resolver_t me)
+{
+	require_return(!me->keepalive_timer);
+
+	me->keepalive_timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, _mdns_resolver_queue());
+	require_action_quiet(me->keepalive_timer, exit,
+		os_log_error(_mdns_resolver_log(), "Failed to create keepalive timer"));
+
+	dispatch_source_set_timer(me->keepalive_timer,
+		_dispatch_monotonictime_after_sec(MDNS_RESOLVER_KEEPALIVE_INTERVAL_SECS),
+		MDNS_RESOLVER_KEEPALIVE_INTERVAL_SECS * UINT64_C_safe(kNanosecondsPerSecond),
+		MDNS_RESOLVER_KEEPALIVE_INTERVAL_SECS * UINT64_C_safe(kNanosecondsPerSecond / 20));
+	dispatch_source_set_event_handler(me->keepalive_timer,
+	^{
+		_mdns_resolver_handle_keepalive_timer(me);
+	});
+	dispatch_activate(me->keepalive_timer);
+
+exit:
+	return;
+}
+
+static void
+_mdns_resolver_note_user_query(const mdns_resolver_t me)
+{
+	me->last_query_ticks = mach_continuous_time();
+	if (_mdns_resolver_needs_warm_connection(me)) {
+		_mdns_resolver_start_keepalive_timer(me);
+	}
+}
+
+static void
+_mdns_resolver_prewarm_internal(const mdns_resolver_t me)
+{
+	require_return(me->activated && !me->invalidated);
+	require_return(_mdns_resolver_needs_warm_connection(me));
+
+	os_log_debug(_mdns_resolver_log(), "Prewarming %{public}s resolver",
+		_mdns_resolver_get_bytestream_protocol_string(me));
+	_mdns_resolver_note_user_query(me);
+	_mdns_resolver_start_warmup_querier(me);
+}
+
+//======================================================================================================================
+
 static bool
 _mdns_resolver_has_usable_server_without_connection_problems(const mdns_resolver_t me)
 {
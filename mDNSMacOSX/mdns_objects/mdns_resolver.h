@@ -371,6 +371,25 @@ mdns_resolver_enable_problematic_qtype_workaround(mdns_resolver_t resolver, int
 void
 mdns_resolver_activate(mdns_resolver_t resolver);
 
+/*!
+ *	@brief
+ *		Sets up the connection to the server of an encrypted resolver before it is needed.
+ *
+ *	@param resolver
+ *		The resolver.
+ *
+ *	@discussion
+ *		For DNS over TLS and DNS over HTTPS resolvers, a query for the root NS records is sent to establish the
+ *		connection that the resolver's queriers will share, so that the first real query does not have to wait for the
+ *		TCP, TLS, and HTTP setup. That connection is then kept alive while it's idle for a few minutes after the last
+ *		query.
+ *
+ *		This function has no effect on other types of resolvers, or on a resolver that has not been activated or has
+ *		been invalidated.
+ */
+void
+mdns_resolver_prewarm(mdns_resolver_t resolver);
+
 /*!
  *	@brief
  *		Invalidates a resolver.
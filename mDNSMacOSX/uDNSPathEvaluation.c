@@ -19,6 +19,7 @@
 #include <nw/private.h>
 
 #include "dns_sd_internal.h"
+#include "DNSCommon.h"
 
 #if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
 #include "QuerierSupport.h"
@@ -34,6 +35,112 @@
         }                       \
     } while (0)
 
+// Path evaluation results cache
+//
+// Starting an app commonly starts several unicast questions for the same name (A, AAAA, HTTPS) from the same process,
+// and each one would otherwise pay for a synchronous nw_path evaluation. Results are cached per name, process, euid
+// and requested interface -- the inputs of the evaluation -- in a small direct-mapped table. The whole table is
+// dropped by mDNSPlatformFlushDNSRoutePolicyCache() on network and DNS configuration changes and interface monitor
+// updates. NetworkExtension policy changes aren't signalled to us, so entries also only live long enough to cover
+// a burst of questions. Only called with the mDNS lock held, from the main queue.
+
+#define PATH_EVAL_CACHE_SIZE        64      // power of 2
+#define PATH_EVAL_CACHE_LIFETIME    (2 * mDNSPlatformOneSecond)
+
+typedef struct
+{
+    mDNSBool   valid;
+    mDNSBool   uuidSet;                     // uuid is the effective process UUID used for the evaluation
+    mDNSBool   blocked;
+    mDNSs32    expire;
+    mDNSu32    namehash;
+    mDNSs32    pid;
+    mDNSu32    euid;
+    mDNSu32    clientIfIndex;
+    uuid_t     uuid;
+    domainname qname;
+    // Results
+    mDNSs32    serviceID;                   // Flow divert unit, 0 if none
+    mDNSu32    scopedIfIndex;               // Scoped interface of the path, 0 if none
+#if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+    uuid_t     resolverUUID;
+#endif
+} PathEvalCacheEntry;
+
+static PathEvalCacheEntry PathEvalCache[PATH_EVAL_CACHE_SIZE];
+
+mDNSexport void mDNSPlatformFlushDNSRoutePolicyCache(void)
+{
+    mDNSPlatformMemZero(PathEvalCache, sizeof(PathEvalCache));
+}
+
+mDNSlocal PathEvalCacheEntry *PathEvalCacheSlot(mDNSu32 namehash, mDNSs32 pid, mDNSu32 euid, const uuid_t uuid, mDNSu32 clientIfIndex)
+{
+    mDNSu32 h = namehash ^ ((mDNSu32)pid * 0x9E3779B1) ^ (euid << 7) ^ (clientIfIndex << 13);
+    h ^= (mDNSu32)uuid[0] << 24 | (mDNSu32)uuid[1] << 16 | (mDNSu32)uuid[2] << 8 | uuid[3];
+    h ^= h >> 16;
+    return &PathEvalCache[h & (PATH_EVAL_CACHE_SIZE - 1)];
+}
+
+mDNSlocal const PathEvalCacheEntry *PathEvalCacheLookup(const DNSQuestion *q, mDNSu32 namehash, const uuid_t uuid,
+    mDNSBool uuidSet, mDNSu32 clientIfIndex)
+{
+    const PathEvalCacheEntry *const e = PathEvalCacheSlot(namehash, q->pid, q->euid, uuid, clientIfIndex);
+    if (!e->valid || (e->expire - mDNS_TimeNow_NoLock(&mDNSStorage)) <= 0) return(mDNSNULL);
+    if (e->namehash != namehash || e->pid != q->pid || e->euid != q->euid || e->clientIfIndex != clientIfIndex) return(mDNSNULL);
+    if (e->uuidSet != uuidSet || (uuidSet && uuid_compare(e->uuid, uuid) != 0)) return(mDNSNULL);
+    if (!SameDomainName(&e->qname, &q->qname)) return(mDNSNULL);
+    return(e);
+}
+
+mDNSlocal void PathEvalCacheInsert(const DNSQuestion *q, mDNSu32 namehash, const uuid_t uuid, mDNSBool uuidSet,
+    mDNSu32 clientIfIndex, mDNSs32 serviceID, mDNSu32 scopedIfIndex, mDNSBool blocked)
+{
+    PathEvalCacheEntry *const e = PathEvalCacheSlot(namehash, q->pid, q->euid, uuid, clientIfIndex);
+    e->valid         = mDNStrue;
+    e->expire        = mDNS_TimeNow_NoLock(&mDNSStorage) + PATH_EVAL_CACHE_LIFETIME;
+    e->namehash      = namehash;
+    e->pid           = q->pid;
+    e->euid          = q->euid;
+    e->clientIfIndex = clientIfIndex;
+    e->uuidSet       = uuidSet;
+    uuid_copy(e->uuid, uuid);
+    AssignDomainName(&e->qname, &q->qname);
+    e->serviceID     = serviceID;
+    e->scopedIfIndex = scopedIfIndex;
+    e->blocked       = blocked;
+#if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+    uuid_copy(e->resolverUUID, q->ResolverUUID);
+#endif
+}
+
+// Applies a cached evaluation the same way a fresh one is applied below
+mDNSlocal void PathEvalCacheApply(DNSQuestion *q, const PathEvalCacheEntry *e, mDNSu32 clientIfIndex)
+{
+    if (e->serviceID != 0)
+    {
+        q->ServiceID = e->serviceID;
+    }
+    else if (e->scopedIfIndex != 0)
+    {
+        q->InterfaceID = (mDNSInterfaceID)(uintptr_t)e->scopedIfIndex;
+        if (e->scopedIfIndex != clientIfIndex)
+        {
+            LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO,
+                "[Q%u] mDNSPlatformGetDNSRoutePolicy: DNS Route Policy has changed the scoped ifindex from [%d] to [%d] (cached)",
+                mDNSVal16(q->TargetQID), clientIfIndex, e->scopedIfIndex);
+        }
+    }
+#if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
+    uuid_copy(q->ResolverUUID, e->resolverUUID);
+    if (!uuid_is_null(q->ResolverUUID))
+    {
+        Querier_RegisterPathResolver(q->ResolverUUID);
+    }
+#endif
+    q->BlockedByPolicy = e->blocked;
+}
+
 //Gets the DNSPolicy from NW PATH EVALUATOR
 mDNSexport void mDNSPlatformGetDNSRoutePolicy(DNSQuestion *q)
 {
@@ -51,10 +158,57 @@ mDNSexport void mDNSPlatformGetDNSRoutePolicy(DNSQuestion *q)
     }
 
     mDNSs32 service_id;
-    mDNSu32 client_ifindex, dnspol_ifindex;
+    mDNSu32 client_ifindex, dnspol_ifindex = 0;
     int retval;
     struct proc_uniqidentifierinfo info;
     mDNSBool isUUIDSet;
+    uuid_t e_proc_uuid;
+
+    // Check for all the special (negative) internal value interface indices before initializing client_ifindex
+    if (   (q->InterfaceID == mDNSInterface_Any)
+        || (q->InterfaceID == mDNSInterface_LocalOnly)
+        || (q->InterfaceID == mDNSInterfaceMark)
+        || (q->InterfaceID == mDNSInterface_P2P)
+        || (q->InterfaceID == mDNSInterface_BLE)
+        || (q->InterfaceID == uDNSInterfaceMark))
+    {
+        client_ifindex = 0;
+    }
+    else
+    {
+        client_ifindex = (mDNSu32)(uintptr_t)q->InterfaceID;
+    }
+
+    // The effective process UUID is part of the cache key, so it's needed before the lookup. Keying on it rather
+    // than on the PID alone also keeps a reused PID from hitting another process's entries.
+    uuid_clear(e_proc_uuid);
+    if (q->pid != 0)
+    {
+        retval = proc_pidinfo(q->pid, PROC_PIDUNIQIDENTIFIERINFO, 1, &info, sizeof(info));
+        if (retval == (int)sizeof(info))
+        {
+            uuid_copy(e_proc_uuid, info.p_uuid);
+            isUUIDSet = mDNStrue;
+        }
+        else
+        {
+            debugf("mDNSPlatformGetDNSRoutePolicy: proc_pidinfo returned %d", retval);
+            isUUIDSet = mDNSfalse;
+        }
+    }
+    else
+    {
+        uuid_copy(e_proc_uuid, q->uuid);
+        isUUIDSet = mDNStrue;
+    }
+
+    const mDNSu32 namehash = DomainNameHashValue(&q->qname);
+    const PathEvalCacheEntry *const cached = PathEvalCacheLookup(q, namehash, e_proc_uuid, isUUIDSet, client_ifindex);
+    if (cached)
+    {
+        PathEvalCacheApply(q, cached, client_ifindex);
+        return;
+    }
 
     char unenc_name[MAX_ESCAPED_DOMAIN_NAME];
     ConvertDomainNameToCString(&q->qname, unenc_name);
@@ -99,21 +253,6 @@ mDNSexport void mDNSPlatformGetDNSRoutePolicy(DNSQuestion *q)
     }
 #endif // TARGET_OS_WATCH
 
-    // Check for all the special (negative) internal value interface indices before initializing client_ifindex
-    if (   (q->InterfaceID == mDNSInterface_Any)
-        || (q->InterfaceID == mDNSInterface_LocalOnly)
-        || (q->InterfaceID == mDNSInterfaceMark)
-        || (q->InterfaceID == mDNSInterface_P2P)
-        || (q->InterfaceID == mDNSInterface_BLE)
-        || (q->InterfaceID == uDNSInterfaceMark))
-    {
-        client_ifindex = 0;
-    }
-    else
-    {
-        client_ifindex = (mDNSu32)(uintptr_t)q->InterfaceID;
-    }
-
     if (client_ifindex > 0)
     {
         nw_interface_t client_intf = nw_interface_create_with_index(client_ifindex);
@@ -135,22 +274,10 @@ mDNSexport void mDNSPlatformGetDNSRoutePolicy(DNSQuestion *q)
     if (q->pid != 0)
     {
         nw_parameters_set_pid(parameters, q->pid);
-        retval = proc_pidinfo(q->pid, PROC_PIDUNIQIDENTIFIERINFO, 1, &info, sizeof(info));
-        if (retval == (int)sizeof(info))
-        {
-            nw_parameters_set_e_proc_uuid(parameters, info.p_uuid);
-            isUUIDSet = mDNStrue;
-        }
-        else
-        {
-            debugf("mDNSPlatformGetDNSRoutePolicy: proc_pidinfo returned %d", retval);
-            isUUIDSet = mDNSfalse;
-        }
     }
-    else
+    if (isUUIDSet)
     {
-        nw_parameters_set_e_proc_uuid(parameters, q->uuid);
-        isUUIDSet = mDNStrue;
+        nw_parameters_set_e_proc_uuid(parameters, e_proc_uuid);
     }
 
     evaluator = nw_path_create_evaluator_for_endpoint(host, parameters);
@@ -241,6 +368,7 @@ mDNSexport void mDNSPlatformGetDNSRoutePolicy(DNSQuestion *q)
     {
         isBlocked = mDNStrue;
     }
+    PathEvalCacheInsert(q, namehash, e_proc_uuid, isUUIDSet, client_ifindex, service_id, dnspol_ifindex, isBlocked);
 
 exit:
     _nw_forget(&host);
@@ -255,7 +255,6 @@ mDNSlocal void handle_dps_terminate(void)
 
     KQueueLock();
     mDNSPlatformCloseDNSProxySkts(&mDNSStorage);
-    // TBD: Close TCP Sockets
     DNSProxyTerminate();
     KQueueUnlock("DNSProxy Deactivated");
 }
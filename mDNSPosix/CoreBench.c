@@ -0,0 +1,1121 @@
+/* -*- Mode: C; tab-width: 4 -*-
+ *
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * In-process micro-benchmarks for the mDNSCore hot paths. Each data set size runs in its own child process
+ * against a synthetic cache, using a fake interface whose multicast sockets are closed, so nothing is ever
+ * put on the wire and the numbers measure only the core's own work.
+ */
+
+//*************************************************************************************************************
+// Incorporate mDNS.c functionality
+
+// Like NetMonitor.c, we textually import mDNS.c so we can drive its mDNSlocal routines directly.
+// Its calls to the platform allocator are routed through counting wrappers, so each benchmark can
+// report the number of allocations it makes per operation alongside the time it takes.
+#if !MDNS_MALLOC_DEBUGGING
+#define mDNSPlatformMemAllocate         BenchMemAllocate
+#define mDNSPlatformMemAllocateClear    BenchMemAllocateClear
+#define mDNSPlatformMemFree             BenchMemFree
+#endif
+#include "../mDNSCore/mDNS.c"
+#if !MDNS_MALLOC_DEBUGGING
+#undef mDNSPlatformMemAllocate
+#undef mDNSPlatformMemAllocateClear
+#undef mDNSPlatformMemFree
+extern void *   mDNSPlatformMemAllocate(mDNSu32 len);
+extern void *   mDNSPlatformMemAllocateClear(mDNSu32 len);
+extern void     mDNSPlatformMemFree(void *mem);
+#endif
+
+//*************************************************************************************************************
+// Headers
+
+#include <stdio.h>          // For printf()
+#include <stdlib.h>         // For malloc()
+#include <string.h>         // For memcpy()
+#include <time.h>           // For clock_gettime()
+#include <unistd.h>         // For fork()
+#include <sys/wait.h>       // For waitpid()
+#include "mDNSPosix.h"      // Defines the specific types needed to run mDNS on this platform
+#include "GenHashTable.h"   // For the shared container benchmarks
+
+//*************************************************************************************************************
+// Globals
+
+mDNS mDNSStorage;                       // mDNS core uses this to store its globals
+static mDNS_PlatformSupport PlatformStorage;    // Stores this platform's globals
+mDNSexport const char ProgramName[] = "mDNSCoreBench";
+
+#define BenchRecordsPerPacket   16      // A records carried in each synthetic response
+#define BenchNameRing           1024    // Distinct names cycled through by the name-encoding benchmark
+#define BenchNamesPerMessage    32      // Names written to one message before it is started afresh
+#define BenchMaxAuthRecords     16384   // Cap on the authoritative records registered for the responder benchmarks
+#define BenchMaxQuestions       256     // Cap on the questions started for the SendQueries benchmark
+#define BenchMaxImmedAnswers    256     // Records flagged for each SendResponses call
+#define BenchQueryOps           4096    // ProcessQuery calls made per data set
+#define BenchSendRounds         64      // SendQueries/SendResponses calls made per data set
+#define BenchKnownAnswers       200     // Known answers carried in the busy browse query
+#define BenchSharedPTRs         256     // Shared PTR records registered under the busy query's name
+#define BenchSharedAnswers      16      // Instances announced on every interface at once, for the shared answer check
+#define BenchLookupStride       7919    // Prime step through the names for the cache lookup benchmark
+#define BenchMaxSizes           16
+#define BenchSplitDomains       120     // Split DNS domains configured for the server selection benchmark, each with a server
+#define BenchCodecBlobs         8       // Blobs cycled through by the base 64/base 32 benchmark, blob k being k bytes short
+#define BenchCodecBlobLen       260     // Longest blob: about an RSA-2048 DNSKEY's public key
+
+static const mDNSu32 BenchDefaultSizes[] = { 1000, 10000, 100000 };
+
+static PosixNetworkInterface gBenchIntf;
+static PosixNetworkInterface gBenchIntf2;   // Only registered for the shared answer check
+static unsigned long gBenchAllocs;
+
+typedef struct
+{
+    mDNSu8  *bytes;                     // Packets laid end to end, in wire format
+    mDNSu32 *offsets;                   // offsets[i] is the start of packet i; offsets[count] is the end of the last
+    mDNSu32 count;
+} BenchPackets;
+
+typedef struct BenchElem
+{
+    domainname name;
+    mDNSu32 namehash;
+    struct BenchElem *hashLink;         // GenHashTable link
+    size_t heapIndex;                   // GenMinHeap position
+    mDNSs32 due;                        // GenMinHeap sort key
+} BenchElem;
+
+typedef struct
+{
+    struct timespec start;
+    unsigned long allocs;
+} BenchTimer;
+
+//*************************************************************************************************************
+// Allocation counting
+
+#if !MDNS_MALLOC_DEBUGGING
+mDNSexport void *BenchMemAllocate(mDNSu32 len)
+{
+    gBenchAllocs++;
+    return mDNSPlatformMemAllocate(len);
+}
+
+mDNSexport void *BenchMemAllocateClear(mDNSu32 len)
+{
+    gBenchAllocs++;
+    return mDNSPlatformMemAllocateClear(len);
+}
+
+mDNSexport void BenchMemFree(void *mem)
+{
+    mDNSPlatformMemFree(mem);
+}
+#endif
+
+//*************************************************************************************************************
+// Timing and reporting
+
+mDNSlocal void BenchStart(BenchTimer *const t)
+{
+    t->allocs = gBenchAllocs;
+    clock_gettime(CLOCK_MONOTONIC, &t->start);
+}
+
+mDNSlocal double BenchElapsedNs(const BenchTimer *const t)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - t->start.tv_sec) * 1e9 + (double)(now.tv_nsec - t->start.tv_nsec);
+}
+
+mDNSlocal void BenchReport(const char *const name, const mDNSu32 size, const mDNSu32 ops, const double ns, const unsigned long allocs)
+{
+    if (!ops) return;
+    printf("%-32s %9u %9u %12.1f ns/op %9.3f allocs/op\n", name, size, ops, ns / ops, (double)allocs / ops);
+}
+
+//*************************************************************************************************************
+// Synthetic data
+
+mDNSlocal void BenchName(domainname *const name, const char *const prefix, const mDNSu32 i)
+{
+    char buf[MAX_ESCAPED_DOMAIN_NAME];
+    snprintf(buf, sizeof(buf), "%s%u.bench.local.", prefix, i);
+    MakeDomainNameFromDNSNameString(name, buf);
+}
+
+mDNSlocal mDNSBool BenchPacketsAppend(BenchPackets *const pkts, mDNSu32 *const capacity, const DNSMessage *const msg, const mDNSu8 *const end)
+{
+    const mDNSu32 len = (mDNSu32)(end - (const mDNSu8 *)msg);
+    const mDNSu32 used = pkts->offsets[pkts->count];
+    if (used + len > *capacity)
+    {
+        mDNSu8 *const bytes = realloc(pkts->bytes, (*capacity + len) * 2);
+        if (!bytes) return mDNSfalse;
+        pkts->bytes = bytes;
+        *capacity = (*capacity + len) * 2;
+    }
+    memcpy(pkts->bytes + used, msg, len);
+    pkts->offsets[++pkts->count] = used + len;
+    return mDNStrue;
+}
+
+mDNSlocal mDNSBool BenchPacketsInit(BenchPackets *const pkts, const mDNSu32 maxPackets)
+{
+    pkts->bytes   = mDNSNULL;
+    pkts->count   = 0;
+    pkts->offsets = calloc(maxPackets + 1, sizeof(pkts->offsets[0]));
+    return (pkts->offsets != mDNSNULL);
+}
+
+mDNSlocal void BenchPacketsFree(BenchPackets *const pkts)
+{
+    free(pkts->bytes);
+    free(pkts->offsets);
+}
+
+// Copies packet i into msg, returning the end of the copy. The header is left in wire order.
+mDNSlocal mDNSu8 *BenchPacketsGet(const BenchPackets *const pkts, const mDNSu32 i, DNSMessage *const msg)
+{
+    const mDNSu32 len = pkts->offsets[i + 1] - pkts->offsets[i];
+    memcpy(msg, pkts->bytes + pkts->offsets[i], len);
+    return (mDNSu8 *)msg + len;
+}
+
+// Builds multicast responses carrying one A record for each of hostN.bench.local., N = 0 .. count-1
+mDNSlocal mDNSBool BenchBuildResponses(BenchPackets *const pkts, const mDNSu32 count)
+{
+    static DNSMessage msg;
+    AuthRecord ar;
+    mDNSu32 capacity = 0, i;
+    mDNSu8 *ptr = mDNSNULL;
+
+    if (!BenchPacketsInit(pkts, (count + BenchRecordsPerPacket - 1) / BenchRecordsPerPacket)) return mDNSfalse;
+    mDNS_SetupResourceRecord(&ar, mDNSNULL, mDNSInterface_Any, kDNSType_A, 4500, kDNSRecordTypeShared, AuthRecordAny, mDNSNULL, mDNSNULL);
+    for (i = 0; i < count; i++)
+    {
+        if (i % BenchRecordsPerPacket == 0)
+        {
+            InitializeDNSMessage(&msg.h, zeroID, ResponseFlags);
+            ptr = msg.data;
+        }
+        BenchName(&ar.namestorage, "host", i);
+        ar.resrec.rdata->u.ipv4.b[0] = 10;
+        ar.resrec.rdata->u.ipv4.b[1] = (mDNSu8)(i >> 16);
+        ar.resrec.rdata->u.ipv4.b[2] = (mDNSu8)(i >> 8);
+        ar.resrec.rdata->u.ipv4.b[3] = (mDNSu8)i;
+        SetNewRData(&ar.resrec, mDNSNULL, 0);
+        ptr = PutResourceRecordTTL(&msg, ptr, &msg.h.numAnswers, &ar.resrec, ar.resrec.rroriginalttl);
+        if (!ptr) return mDNSfalse;
+        if (i % BenchRecordsPerPacket == BenchRecordsPerPacket - 1 || i == count - 1)
+        {
+            SwapDNSHeaderBytes(&msg);
+            if (!BenchPacketsAppend(pkts, &capacity, &msg, ptr)) return mDNSfalse;
+        }
+    }
+    return mDNStrue;
+}
+
+// Builds multicast responses carrying a _bench._tcp.local. PTR record for each of instN, N = 0 .. count-1
+mDNSlocal mDNSBool BenchBuildBrowseResponses(BenchPackets *const pkts, const mDNSu32 count)
+{
+    static DNSMessage msg;
+    AuthRecord ar;
+    char buf[MAX_ESCAPED_DOMAIN_NAME];
+    mDNSu32 capacity = 0, i;
+    mDNSu8 *ptr = mDNSNULL;
+
+    if (!BenchPacketsInit(pkts, (count + BenchRecordsPerPacket - 1) / BenchRecordsPerPacket)) return mDNSfalse;
+    mDNS_SetupResourceRecord(&ar, mDNSNULL, mDNSInterface_Any, kDNSType_PTR, 4500, kDNSRecordTypeShared, AuthRecordAny, mDNSNULL, mDNSNULL);
+    MakeDomainNameFromDNSNameString(&ar.namestorage, "_bench._tcp.local.");
+    for (i = 0; i < count; i++)
+    {
+        if (i % BenchRecordsPerPacket == 0)
+        {
+            InitializeDNSMessage(&msg.h, zeroID, ResponseFlags);
+            ptr = msg.data;
+        }
+        snprintf(buf, sizeof(buf), "inst%u._bench._tcp.local.", i);
+        MakeDomainNameFromDNSNameString(&ar.resrec.rdata->u.name, buf);
+        SetNewRData(&ar.resrec, mDNSNULL, 0);
+        ptr = PutResourceRecordTTL(&msg, ptr, &msg.h.numAnswers, &ar.resrec, ar.resrec.rroriginalttl);
+        if (!ptr) return mDNSfalse;
+        if (i % BenchRecordsPerPacket == BenchRecordsPerPacket - 1 || i == count - 1)
+        {
+            SwapDNSHeaderBytes(&msg);
+            if (!BenchPacketsAppend(pkts, &capacity, &msg, ptr)) return mDNSfalse;
+        }
+    }
+    return mDNStrue;
+}
+
+// Builds one-question multicast queries for the TXT record of each of svcN.bench.local., N = 0 .. count-1
+mDNSlocal mDNSBool BenchBuildQueries(BenchPackets *const pkts, const mDNSu32 count)
+{
+    static DNSMessage msg;
+    domainname name;
+    mDNSu32 capacity = 0, i;
+    mDNSu8 *ptr;
+
+    if (!BenchPacketsInit(pkts, count)) return mDNSfalse;
+    for (i = 0; i < count; i++)
+    {
+        InitializeDNSMessage(&msg.h, zeroID, QueryFlags);
+        BenchName(&name, "svc", i);
+        ptr = putQuestion(&msg, msg.data, msg.data + AbsoluteMaxDNSMessageData, &name, kDNSType_TXT, kDNSClass_IN);
+        if (!ptr) return mDNSfalse;
+        SwapDNSHeaderBytes(&msg);
+        if (!BenchPacketsAppend(pkts, &capacity, &msg, ptr)) return mDNSfalse;
+    }
+    return mDNStrue;
+}
+
+// Builds one multicast browse for _kabench._tcp.local. carrying the first BenchKnownAnswers of the PTRs
+// registered by BenchRegisterSharedPTRs as known answers, the way a busy browser's repeat queries look
+mDNSlocal mDNSu8 *BenchBuildKnownAnswerQuery(DNSMessage *const msg)
+{
+    AuthRecord ar;
+    domainname type;
+    mDNSu8 *ptr;
+    mDNSu32 i;
+
+    InitializeDNSMessage(&msg->h, zeroID, QueryFlags);
+    MakeDomainNameFromDNSNameString(&type, "_kabench._tcp.local.");
+    ptr = putQuestion(msg, msg->data, msg->data + AbsoluteMaxDNSMessageData, &type, kDNSType_PTR, kDNSClass_IN);
+    mDNS_SetupResourceRecord(&ar, mDNSNULL, mDNSInterface_Any, kDNSType_PTR, kStandardTTL, kDNSRecordTypeShared, AuthRecordAny, mDNSNULL, mDNSNULL);
+    AssignDomainName(&ar.namestorage, &type);
+    for (i = 0; ptr && i < BenchKnownAnswers; i++)
+    {
+        BenchName(&ar.resrec.rdata->u.name, "inst", i);
+        SetNewRData(&ar.resrec, mDNSNULL, 0);
+        ptr = PutResourceRecordTTLWithLimit(msg, ptr, &msg->h.numAnswers, &ar.resrec, ar.resrec.rroriginalttl, msg->data + AbsoluteMaxDNSMessageData);
+    }
+    if (ptr) SwapDNSHeaderBytes(msg);
+    return ptr;
+}
+
+mDNSlocal mDNSBool BenchRegisterSharedPTRs(mDNS *const m, AuthRecord *const records)
+{
+    mDNSu32 i;
+    for (i = 0; i < BenchSharedPTRs; i++)
+    {
+        AuthRecord *const rr = &records[i];
+        mDNS_SetupResourceRecord(rr, mDNSNULL, gBenchIntf.coreIntf.InterfaceID, kDNSType_PTR, kStandardTTL, kDNSRecordTypeShared, AuthRecordAny, mDNSNULL, mDNSNULL);
+        MakeDomainNameFromDNSNameString(&rr->namestorage, "_kabench._tcp.local.");
+        BenchName(&rr->resrec.rdata->u.name, "inst", i);
+        if (mDNS_Register(m, rr)) return mDNSfalse;
+    }
+    // As with the TXT records, skip the announcements, and make the records due to be multicast again so that
+    // every query has all of them as candidate answers
+    mDNS_Lock(m);
+    for (i = 0; i < BenchSharedPTRs; i++)
+    {
+        records[i].AnnounceCount = 0;
+        records[i].LastMCTime    = m->timenow - mDNSPlatformOneSecond;
+    }
+    mDNS_Unlock(m);
+    return mDNStrue;
+}
+
+mDNSlocal void BenchQuestionCallback(mDNS *const m, DNSQuestion *question, const ResourceRecord *const answer, QC_result AddRecord)
+{
+    (void)m;
+    (void)question;
+    (void)answer;
+    (void)AddRecord;
+}
+
+mDNSlocal void BenchBrowseCallback(mDNS *const m, DNSQuestion *question, const ResourceRecord *const answer, QC_result AddRecord)
+{
+    (void)m;
+    (void)answer;
+    if (AddRecord == QC_add) (*(mDNSu32 *)question->QuestionContext)++;
+}
+
+mDNSlocal void BenchStatusCallback(mDNS *const m, mStatus result)
+{
+    // The cache is sized up front, but don't fail outright if a benchmark outgrows it
+    if (result == mStatus_GrowCache)
+    {
+        CacheEntity *const storage = calloc(BenchNameRing, sizeof(CacheEntity));
+        if (storage) mDNS_GrowCache(m, storage, BenchNameRing);
+    }
+}
+
+//*************************************************************************************************************
+// Benchmarks
+
+mDNSlocal void BenchPutDomainNameAsLabels(const mDNSu32 size)
+{
+    static DNSMessage msg;
+    domainname *const names = calloc(BenchNameRing, sizeof(domainname));
+    const mDNSu8 *const limit = msg.data + AbsoluteMaxDNSMessageData;
+    mDNSu8 *ptr = msg.data;
+    BenchTimer t;
+    mDNSu32 i;
+
+    if (!names) return;
+    for (i = 0; i < BenchNameRing; i++) BenchName(&names[i], "host", i);
+
+    BenchStart(&t);
+    for (i = 0; i < size; i++)
+    {
+        // Start a fresh message every few names, so the compression search sees a realistic amount of history
+        if (i % BenchNamesPerMessage == 0) ptr = msg.data;
+        ptr = putDomainNameAsLabels(&msg, ptr, limit, &names[i % BenchNameRing]);
+        if (!ptr) { ptr = msg.data; }
+    }
+    BenchReport("putDomainNameAsLabels", size, size, BenchElapsedNs(&t), gBenchAllocs - t.allocs);
+    free(names);
+}
+
+// Encodes and decodes key-sized blobs the way TSIG key setup and DNSSEC record handling do, checking the round trip
+mDNSlocal void BenchBaseN(const mDNSu32 size)
+{
+    static mDNSu8 data[BenchCodecBlobs][BenchCodecBlobLen];
+    static char b64[BenchCodecBlobs][mDNSBase64EncodedLength(BenchCodecBlobLen) + 1];
+    static char b32[BenchCodecBlobs][mDNSBase32HexEncodedLength(BenchCodecBlobLen) + 1];
+    mDNSu8 decoded[BenchCodecBlobLen];
+    mDNSu32 i, bad = 0;
+    BenchTimer t;
+
+    for (i = 0; i < BenchCodecBlobs; i++)
+    {
+        mDNSu32 j;
+        for (j = 0; j < BenchCodecBlobLen; j++) data[i][j] = (mDNSu8)(i * 131 + j * 7 + (j >> 3));
+    }
+
+    BenchStart(&t);
+    for (i = 0; i < size; i++)
+        if (mDNSBase64Encode(data[i % BenchCodecBlobs], BenchCodecBlobLen - i % BenchCodecBlobs, b64[i % BenchCodecBlobs], sizeof(b64[0])) < 0) bad++;
+    BenchReport("Base64 encode", size, size, BenchElapsedNs(&t), gBenchAllocs - t.allocs);
+
+    BenchStart(&t);
+    for (i = 0; i < size; i++)
+    {
+        const mDNSu32 k = i % BenchCodecBlobs;
+        if (mDNSBase64Decode(b64[k], decoded, sizeof(decoded)) != (mDNSs32)(BenchCodecBlobLen - k) ||
+            memcmp(decoded, data[k], BenchCodecBlobLen - k)) bad++;
+    }
+    BenchReport("Base64 decode", size, size, BenchElapsedNs(&t), gBenchAllocs - t.allocs);
+
+    BenchStart(&t);
+    for (i = 0; i < size; i++)
+        if (mDNSBase32HexEncode(data[i % BenchCodecBlobs], BenchCodecBlobLen - i % BenchCodecBlobs, b32[i % BenchCodecBlobs], sizeof(b32[0])) < 0) bad++;
+    BenchReport("Base32hex encode", size, size, BenchElapsedNs(&t), gBenchAllocs - t.allocs);
+
+    BenchStart(&t);
+    for (i = 0; i < size; i++)
+    {
+        const mDNSu32 k = i % BenchCodecBlobs;
+        if (mDNSBase32HexDecode(b32[k], decoded, sizeof(decoded)) != (mDNSs32)(BenchCodecBlobLen - k) ||
+            memcmp(decoded, data[k], BenchCodecBlobLen - k)) bad++;
+    }
+    BenchReport("Base32hex decode", size, size, BenchElapsedNs(&t), gBenchAllocs - t.allocs);
+
+    if (bad) fprintf(stderr, "%s: %u of %u base 64/base 32 round trips failed\n", ProgramName, bad, size * 4);
+}
+
+#ifdef USE_LIBIDN
+// Localized computer names of the kind apps keep looking up; the last one doesn't convert (U+2019 isn't allowed)
+static const char *const BenchIDNHosts[] =
+{
+    "Jürgens-MacBook-Pro", "Büro-Drucker", "Ordinateur-de-Hélène", "Mac-mini-de-José", "Компьютер-Ивана", "田中のiMac",
+    "小明的iPhone", "Τηλεόραση-σαλονιού", "Çalışma-odası", "Håkans-iPad", "김민준의-Mac", "Zoë’s-MacBook-Air"
+};
+#define BenchIDNHostCount ((mDNSu32)(sizeof(BenchIDNHosts) / sizeof(BenchIDNHosts[0])))
+
+// PerformNextPunycodeConversion on names under a plain ASCII domain: first with each host name made unique, so every
+// label is one not seen before, then with the same few names over and over, as when their questions are restarted
+mDNSlocal void BenchPunycode(const mDNSu32 size)
+{
+    static DNSQuestion q;
+    domainname *const names = calloc(size, sizeof(domainname));
+    char buf[MAX_ESCAPED_DOMAIN_NAME];
+    domainname newname;
+    mDNSu32 i, converted = 0;
+    BenchTimer t;
+
+    if (!names) return;
+    for (i = 0; i < size; i++)
+    {
+        snprintf(buf, sizeof(buf), "%s-%u.example.com.", BenchIDNHosts[i % BenchIDNHostCount], i);
+        MakeDomainNameFromDNSNameString(&names[i], buf);
+    }
+    BenchStart(&t);
+    for (i = 0; i < size; i++)
+    {
+        AssignDomainName(&q.qname, &names[i]);
+        if (PerformNextPunycodeConversion(&q, &newname)) converted++;
+    }
+    BenchReport("Punycode conversion (new)", size, size, BenchElapsedNs(&t), gBenchAllocs - t.allocs);
+
+    for (i = 0; i < BenchIDNHostCount; i++)
+    {
+        snprintf(buf, sizeof(buf), "%s.example.com.", BenchIDNHosts[i]);
+        MakeDomainNameFromDNSNameString(&names[i], buf);
+    }
+    BenchStart(&t);
+    for (i = 0; i < size; i++)
+    {
+        AssignDomainName(&q.qname, &names[i % BenchIDNHostCount]);
+        if (PerformNextPunycodeConversion(&q, &newname)) converted++;
+    }
+    BenchReport("Punycode conversion (repeated)", size, size, BenchElapsedNs(&t), gBenchAllocs - t.allocs);
+    if (converted < size * 2 / BenchIDNHostCount * (BenchIDNHostCount - 1))
+        fprintf(stderr, "%s: only %u of %u Punycode conversions succeeded\n", ProgramName, converted, size * 2);
+    free(names);
+}
+#endif // USE_LIBIDN
+
+mDNSlocal int BenchElemMatch(const void *elem, const void *key)
+{
+    return SameDomainName(&((const BenchElem *)elem)->name, (const domainname *)key);
+}
+
+mDNSlocal int BenchElemCompare(const void *a, const void *b)
+{
+    const mDNSs32 da = ((const BenchElem *)a)->due, db = ((const BenchElem *)b)->due;
+    return (da > db) - (da < db);
+}
+
+// GenHashTable lookups by name, and GenMinHeap insertion and removal in due order, over size elements. Both also
+// check their results, since nothing else in the tree exercises every operation yet.
+mDNSlocal void BenchGenContainers(const mDNSu32 size)
+{
+    BenchElem *const elems = calloc(size, sizeof(BenchElem));
+    void **const buckets = calloc(size / 2 + 1, sizeof(void *));
+    void **const heapElems = calloc(size, sizeof(void *));
+    GenHashTable table;
+    GenMinHeap heap;
+    mDNSu32 i, found = 0, ordered = 1;
+    mDNSs32 last;
+    BenchTimer t;
+
+    if (!elems || !buckets || !heapElems) { free(elems); free(buckets); free(heapElems); return; }
+    InitHashTable(&table, buckets, size / 2 + 1, offsetof(BenchElem, hashLink));
+    InitMinHeap(&heap, heapElems, size, offsetof(BenchElem, heapIndex), BenchElemCompare);
+    for (i = 0; i < size; i++)
+    {
+        BenchName(&elems[i].name, "host", i);
+        elems[i].namehash = DomainNameHashValue(&elems[i].name);
+        elems[i].due = (mDNSs32)((i * BenchLookupStride) % size);
+    }
+
+    BenchStart(&t);
+    for (i = 0; i < size; i++) HashAdd(&table, &elems[i], elems[i].namehash);
+    BenchReport("GenHashTable add", size, size, BenchElapsedNs(&t), gBenchAllocs - t.allocs);
+
+    BenchStart(&t);
+    for (i = 0; i < size; i++)
+    {
+        const BenchElem *const e = &elems[(i * BenchLookupStride) % size];
+        if (HashLookup(&table, e->namehash, &e->name, BenchElemMatch) == e) found++;
+    }
+    BenchReport("GenHashTable lookup", size, size, BenchElapsedNs(&t), gBenchAllocs - t.allocs);
+
+    for (i = 0; i < size; i += 2) HashRemove(&table, &elems[i], elems[i].namehash);
+    for (i = 0; i < size; i++)
+        if ((HashLookup(&table, elems[i].namehash, &elems[i].name, BenchElemMatch) != mDNSNULL) != (i & 1)) found = 0;
+    if (found != size || table.Count != size / 2)
+        fprintf(stderr, "%s: GenHashTable found %u of %u elements, %u left after removal\n", ProgramName, found, size, (mDNSu32)table.Count);
+
+    BenchStart(&t);
+    for (i = 0; i < size; i++) HeapInsert(&heap, &elems[i]);
+    // Move every fourth element to the back, as when a deadline is pushed out, and drop every tenth
+    for (i = 0; i < size; i += 4) { elems[i].due += (mDNSs32)size; HeapUpdate(&heap, &elems[i]); }
+    for (i = 0; i < size; i += 10) HeapRemove(&heap, &elems[i]);
+    for (last = -1, found = 0; heap.Count; found++)
+    {
+        const BenchElem *const e = HeapRemoveMin(&heap);
+        if (e->due < last) ordered = 0;
+        last = e->due;
+    }
+    BenchReport("GenMinHeap insert/update/remove", size, size * 2, BenchElapsedNs(&t), gBenchAllocs - t.allocs);
+    if (!ordered || found != size - (size + 9) / 10)
+        fprintf(stderr, "%s: GenMinHeap returned %u elements%s\n", ProgramName, found, ordered ? "" : " out of order");
+
+    free(elems);
+    free(buckets);
+    free(heapElems);
+}
+
+// Fills the cache with one record per name in responses, reporting the cost of parsing the records and,
+// separately, of creating the cache entries alone
+mDNSlocal void BenchCreateNewCacheEntry(mDNS *const m, const BenchPackets *const responses, const mDNSu32 size)
+{
+    static DNSMessage msg;
+    const mDNSInterfaceID InterfaceID = gBenchIntf.coreIntf.InterfaceID;
+    mDNSAddr src;
+    double parseNs, totalNs;
+    unsigned long allocs;
+    BenchTimer t;
+    mDNSu32 pass, i, j;
+
+    src.type = mDNSAddrType_IPv4;
+    src.ip.v4.b[0] = 10; src.ip.v4.b[1] = 99; src.ip.v4.b[2] = 1; src.ip.v4.b[3] = 2;
+
+    mDNS_Lock(m);
+    parseNs = 0;
+    for (pass = 0; pass < 2; pass++)
+    {
+        BenchStart(&t);
+        for (i = 0; i < responses->count; i++)
+        {
+            const mDNSu8 *const end = BenchPacketsGet(responses, i, &msg);
+            const mDNSu8 *ptr;
+            SwapDNSHeaderBytes(&msg);
+            ptr = LocateAnswers(&msg, end);
+            for (j = 0; ptr && j < msg.h.numAnswers; j++)
+            {
+                ptr = GetLargeResourceRecord(m, &msg, ptr, end, InterfaceID, kDNSRecordTypePacketAns, &m->rec);
+                if (!ptr) break;
+                if (pass)
+                {
+                    const mDNSu32 slot = HashSlotFromNameHash(m, m->rec.r.resrec.namehash);
+                    CacheGroup *const cg = CacheGroupForRecord(m, &m->rec.r.resrec);
+                    CreateNewCacheEntry(m, slot, cg, 0, mDNStrue, &src);
+                }
+                m->rec.r.resrec.RecordType = 0;     // Clear RecordType to show we're not still using it
+            }
+        }
+        if (!pass)
+        {
+            parseNs = BenchElapsedNs(&t);
+            BenchReport("GetLargeResourceRecord", size, size, parseNs, gBenchAllocs - t.allocs);
+        }
+    }
+    totalNs = BenchElapsedNs(&t);
+    allocs  = gBenchAllocs - t.allocs;
+    mDNS_Unlock(m);
+    BenchReport("CreateNewCacheEntry", size, size, totalNs > parseNs ? totalNs - parseNs : 0, allocs);
+}
+
+// Feeds the responses through the full receive path again, so every record refreshes an existing cache entry
+mDNSlocal void BenchCoreReceive(mDNS *const m, const BenchPackets *const responses, const mDNSu32 size)
+{
+    static DNSMessage msg;
+    mDNSAddr src;
+    BenchTimer t;
+    mDNSu32 i;
+
+    src.type = mDNSAddrType_IPv4;
+    src.ip.v4.b[0] = 10; src.ip.v4.b[1] = 99; src.ip.v4.b[2] = 1; src.ip.v4.b[3] = 2;
+
+    BenchStart(&t);
+    for (i = 0; i < responses->count; i++)
+    {
+        mDNSu8 *const end = BenchPacketsGet(responses, i, &msg);
+        mDNSCoreReceive(m, &msg, end, &src, MulticastDNSPort, &AllDNSLinkGroup_v4, MulticastDNSPort, gBenchIntf.coreIntf.InterfaceID);
+    }
+    BenchReport("mDNSCoreReceive (16 RRs/packet)", size, responses->count, BenchElapsedNs(&t), gBenchAllocs - t.allocs);
+}
+
+// Looks up the A record of each name the responses cached, the way answering questions from the cache does:
+// CacheGroupForName, then CacheRecordAnswersQuestion, the remaining TTL and the rdata of each record in the group.
+// The names are visited in a scattered order so that, as in a real cache, each lookup starts on cold lines.
+mDNSlocal void BenchCacheLookup(mDNS *const m, const mDNSu32 size)
+{
+    static DNSQuestion q;
+    domainname *const names = calloc(size, sizeof(domainname));
+    const mDNSu32 stride = (size % BenchLookupStride) ? BenchLookupStride : 1;
+    mDNSu32 i, n, answers = 0, ttls = 0, octets = 0;
+    BenchTimer t;
+
+    if (!names) return;
+    for (i = 0; i < size; i++) BenchName(&names[i], "host", i);
+    q.InterfaceID = gBenchIntf.coreIntf.InterfaceID;
+    q.qtype       = kDNSType_A;
+    q.qclass      = kDNSClass_IN;
+
+    mDNS_Lock(m);
+    // Finish growing the cache hash table first, as mDNS_Execute would have done by now in the daemon
+    while (m->NextCacheResize) m->NextCacheResize = ResizeCacheHash(m);
+    BenchStart(&t);
+    for (i = 0, n = 0; i < size; i++, n = (n + stride) % size)
+    {
+        const CacheGroup *cg;
+        const CacheRecord *cr;
+        AssignDomainName(&q.qname, &names[n]);
+        q.qnamehash = DomainNameHashValue(&q.qname);
+        cg = CacheGroupForName(m, q.qnamehash, &q.qname);
+        for (cr = cg ? cg->members : mDNSNULL; cr; cr = cr->next)
+            if (CacheRecordAnswersQuestion(cr, &q))
+            {
+                answers++;
+                ttls   += (mDNSu32)(RRExpireTime(cr) - m->timenow);
+                octets += cr->resrec.rdata->u.ipv4.b[3];
+            }
+    }
+    BenchReport("Cache lookup (A record)", size, size, BenchElapsedNs(&t), gBenchAllocs - t.allocs);
+    mDNS_Unlock(m);
+    if (answers != size) fprintf(stderr, "%s: cache lookup found %u of %u answers (%u, %u)\n", ProgramName, answers, size, ttls, octets);
+    free(names);
+}
+
+// Receives responses answering a browse, each packet bringing its 16 PTR records to the question as new answers
+mDNSlocal void BenchBrowseReceive(mDNS *const m, const mDNSu32 size)
+{
+    static DNSMessage msg;
+    static DNSQuestion q;
+    BenchPackets responses;
+    mDNSAddr src;
+    BenchTimer t;
+    mDNSu32 i, answers = 0, batches;
+
+    if (!BenchBuildBrowseResponses(&responses, size)) return;
+    mDNSPlatformMemZero(&q, sizeof(q));
+    MakeDomainNameFromDNSNameString(&q.qname, "_bench._tcp.local.");
+    q.InterfaceID      = gBenchIntf.coreIntf.InterfaceID;
+    q.qtype            = kDNSType_PTR;
+    q.qclass           = kDNSClass_IN;
+    q.QuestionCallback = BenchBrowseCallback;
+    q.QuestionContext  = &answers;
+    if (mDNS_StartQuery(m, &q)) { BenchPacketsFree(&responses); return; }
+    for (i = 0; i < 10 && m->NewQuestions; i++) mDNS_Execute(m);
+
+    src.type = mDNSAddrType_IPv4;
+    src.ip.v4.b[0] = 10; src.ip.v4.b[1] = 99; src.ip.v4.b[2] = 1; src.ip.v4.b[3] = 3;
+    batches = m->mDNSStats.AnswerBatches;
+    BenchStart(&t);
+    for (i = 0; i < responses.count; i++)
+    {
+        mDNSu8 *const end = BenchPacketsGet(&responses, i, &msg);
+        mDNSCoreReceive(m, &msg, end, &src, MulticastDNSPort, &AllDNSLinkGroup_v4, MulticastDNSPort, gBenchIntf.coreIntf.InterfaceID);
+    }
+    BenchReport("mDNSCoreReceive (browse answers)", size, responses.count, BenchElapsedNs(&t), gBenchAllocs - t.allocs);
+    printf("  %u answers delivered in %u batches\n", answers, m->mDNSStats.AnswerBatches - batches);
+    mDNS_StopQuery(m, &q);
+    BenchPacketsFree(&responses);
+}
+
+mDNSlocal void BenchProcessQuery(mDNS *const m, const BenchPackets *const queries, const mDNSu32 size)
+{
+    static DNSMessage msg;
+    mDNSAddr src;
+    BenchTimer t;
+    mDNSu32 i;
+
+    if (!queries->count) return;
+    src.type = mDNSAddrType_IPv4;
+    src.ip.v4.b[0] = 10; src.ip.v4.b[1] = 99; src.ip.v4.b[2] = 1; src.ip.v4.b[3] = 3;
+
+    mDNS_Lock(m);
+    BenchStart(&t);
+    for (i = 0; i < BenchQueryOps; i++)
+    {
+        const mDNSu8 *const end = BenchPacketsGet(queries, i % queries->count, &msg);
+        SwapDNSHeaderBytes(&msg);
+        ProcessQuery(m, &msg, end, &src, gBenchIntf.coreIntf.InterfaceID, mDNSfalse, mDNStrue, mDNSfalse, &m->omsg);
+    }
+    BenchReport("ProcessQuery", size, BenchQueryOps, BenchElapsedNs(&t), gBenchAllocs - t.allocs);
+    mDNS_Unlock(m);
+}
+
+// Each query asks for BenchSharedPTRs answers and already knows BenchKnownAnswers of them
+mDNSlocal void BenchKnownAnswerSuppression(mDNS *const m, const mDNSu32 size)
+{
+    static DNSMessage query, msg;
+    const mDNSu8 *const queryend = BenchBuildKnownAnswerQuery(&query);
+    mDNSAddr src;
+    BenchTimer t;
+    mDNSu32 i;
+
+    if (!queryend) { fprintf(stderr, "%s: couldn't build the known-answer query\n", ProgramName); return; }
+    src.type = mDNSAddrType_IPv4;
+    src.ip.v4.b[0] = 10; src.ip.v4.b[1] = 99; src.ip.v4.b[2] = 1; src.ip.v4.b[3] = 4;
+
+    mDNS_Lock(m);
+    BenchStart(&t);
+    for (i = 0; i < BenchQueryOps; i++)
+    {
+        const mDNSu32 len = (mDNSu32)(queryend - (const mDNSu8 *)&query);
+        memcpy(&msg, &query, len);
+        SwapDNSHeaderBytes(&msg);
+        ProcessQuery(m, &msg, (const mDNSu8 *)&msg + len, &src, gBenchIntf.coreIntf.InterfaceID, mDNSfalse, mDNStrue, mDNSfalse, &m->omsg);
+    }
+    BenchReport("ProcessQuery (200 known answers)", size, BenchQueryOps, BenchElapsedNs(&t), gBenchAllocs - t.allocs);
+    mDNS_Unlock(m);
+}
+
+// One source sending queries as fast as we can take them: all but the first burst should be shed unread
+mDNSlocal void BenchQueryFlood(mDNS *const m, const BenchPackets *const queries, const mDNSu32 size)
+{
+    static DNSMessage msg;
+    const mDNSu32 dropped = m->mDNSStats.QueryFloodSourceDrops;
+    mDNSAddr src;
+    BenchTimer t;
+    mDNSu32 i;
+
+    if (!queries->count) return;
+    src.type = mDNSAddrType_IPv4;
+    src.ip.v4.b[0] = 10; src.ip.v4.b[1] = 99; src.ip.v4.b[2] = 1; src.ip.v4.b[3] = 5;
+
+    BenchStart(&t);
+    for (i = 0; i < BenchQueryOps; i++)
+    {
+        const mDNSu8 *const end = BenchPacketsGet(queries, i % queries->count, &msg);
+        mDNSCoreReceive(m, &msg, end, &src, MulticastDNSPort, &AllDNSLinkGroup_v4, MulticastDNSPort, gBenchIntf.coreIntf.InterfaceID);
+    }
+    BenchReport("mDNSCoreReceive (query flood)", size, BenchQueryOps, BenchElapsedNs(&t), gBenchAllocs - t.allocs);
+    printf("  %u of %u queries shed\n", m->mDNSStats.QueryFloodSourceDrops - dropped, BenchQueryOps);
+}
+
+mDNSlocal void BenchSendResponses(mDNS *const m, AuthRecord *const records, const mDNSu32 numRecords, const mDNSu32 size)
+{
+    const mDNSInterfaceID InterfaceID = gBenchIntf.coreIntf.InterfaceID;
+    const mDNSu32 perRound = (numRecords < BenchMaxImmedAnswers) ? numRecords : BenchMaxImmedAnswers;
+    double ns = 0;
+    unsigned long allocs = 0;
+    BenchTimer t;
+    mDNSu32 round, i;
+
+    // Each call has a different slice of the registered records to send, as if a few queries had come in
+    for (round = 0; round < BenchSendRounds; round++)
+    {
+        mDNS_Lock(m);
+        for (i = 0; i < perRound; i++) records[(round * perRound + i) % numRecords].ImmedAnswer = InterfaceID;
+        m->NextScheduledResponse = m->timenow;
+        BenchStart(&t);
+        SendResponses(m);
+        ns     += BenchElapsedNs(&t);
+        allocs += gBenchAllocs - t.allocs;
+        mDNS_Unlock(m);
+    }
+    BenchReport("SendResponses (per record)", size, BenchSendRounds * perRound, ns, allocs);
+}
+
+mDNSlocal void BenchSendQueries(mDNS *const m, DNSQuestion *const questions, const mDNSu32 numQuestions, const mDNSu32 size)
+{
+    const mDNSInterfaceID InterfaceID = gBenchIntf.coreIntf.InterfaceID;
+    double ns = 0;
+    unsigned long allocs = 0;
+    BenchTimer t;
+    mDNSu32 round, i;
+
+    for (round = 0; round < BenchSendRounds; round++)
+    {
+        mDNS_Lock(m);
+        for (i = 0; i < numQuestions; i++)
+        {
+            questions[i].SendQNow = InterfaceID;
+            questions[i].LastQTime = m->timenow - questions[i].ThisQInterval;
+        }
+        m->NextScheduledQuery = m->timenow;
+        BenchStart(&t);
+        SendQueries(m);
+        ns     += BenchElapsedNs(&t);
+        allocs += gBenchAllocs - t.allocs;
+        mDNS_Unlock(m);
+    }
+    BenchReport("SendQueries (per question)", size, BenchSendRounds * numQuestions, ns, allocs);
+}
+
+// Sends a browse for _bench._tcp.local. whose answers from BenchBrowseReceive are still in the cache, so that every
+// round lists them all as known answers, as a browse of a busy service type does
+mDNSlocal void BenchSendKnownAnswers(mDNS *const m, const mDNSu32 size)
+{
+    static DNSQuestion q;
+    const mDNSInterfaceID InterfaceID = gBenchIntf.coreIntf.InterfaceID;
+    double ns = 0;
+    unsigned long allocs = 0;
+    BenchTimer t;
+    mDNSu32 round, answers = 0;
+
+    mDNSPlatformMemZero(&q, sizeof(q));
+    MakeDomainNameFromDNSNameString(&q.qname, "_bench._tcp.local.");
+    q.InterfaceID      = InterfaceID;
+    q.qtype            = kDNSType_PTR;
+    q.qclass           = kDNSClass_IN;
+    q.QuestionCallback = BenchBrowseCallback;
+    q.QuestionContext  = &answers;
+    if (mDNS_StartQuery(m, &q)) return;
+    for (round = 0; round < 10 && m->NewQuestions; round++) mDNS_Execute(m);
+
+    for (round = 0; round < BenchSendRounds; round++)
+    {
+        mDNS_Lock(m);
+        q.SendQNow  = InterfaceID;
+        q.LastQTime = m->timenow - q.ThisQInterval;
+        m->NextScheduledQuery = m->timenow;
+        BenchStart(&t);
+        SendQueries(m);
+        ns     += BenchElapsedNs(&t);
+        allocs += gBenchAllocs - t.allocs;
+        mDNS_Unlock(m);
+    }
+    BenchReport("SendQueries (browse known answers)", size, BenchSendRounds, ns, allocs);
+    printf("  %u known answers per query round\n", q.CurrentAnswers);
+    mDNS_StopQuery(m, &q);
+}
+
+//*************************************************************************************************************
+// Main
+
+// Picks DNS servers for unicast questions the way starting a question and a DNS configuration change do:
+// SetValidDNSServers then GetServerForQuestion, with a default server and BenchSplitDomains split DNS domains, as an
+// enterprise VPN might configure. Each name falls under one of the split domains, which must be the one chosen.
+mDNSlocal void BenchServerSelection(mDNS *const m, const mDNSu32 size)
+{
+    static DNSQuestion q;
+    mDNSu32 i, wrong = 0;
+    mDNSAddr addr;
+    BenchTimer t;
+    char buf[MAX_ESCAPED_DOMAIN_NAME];
+    domainname domain;
+
+    addr.type = mDNSAddrType_IPv4;
+    mDNS_Lock(m);
+    addr.ip.v4.b[0] = 10; addr.ip.v4.b[1] = 0; addr.ip.v4.b[2] = 0; addr.ip.v4.b[3] = 1;
+    mDNS_AddDNSServer(m, mDNSNULL, mDNSInterface_Any, 0, &addr, UnicastDNSPort, kScopeNone, 0,
+                      mDNSfalse, mDNSfalse, mDNSfalse, mDNSfalse, 0, mDNStrue, mDNStrue, mDNSfalse);
+    for (i = 0; i < BenchSplitDomains; i++)
+    {
+        snprintf(buf, sizeof(buf), "corp%u.example.", i);
+        MakeDomainNameFromDNSNameString(&domain, buf);
+        addr.ip.v4.b[2] = 1; addr.ip.v4.b[3] = (mDNSu8)i;
+        mDNS_AddDNSServer(m, &domain, mDNSInterface_Any, 0, &addr, UnicastDNSPort, kScopeNone, 0,
+                          mDNSfalse, mDNSfalse, mDNSfalse, mDNSfalse, 0, mDNStrue, mDNStrue, mDNSfalse);
+    }
+    q.InterfaceID = mDNSInterface_Any;
+    q.ServiceID   = -1;
+    q.qtype       = kDNSType_A;
+    q.qclass      = kDNSClass_IN;
+
+    BenchStart(&t);
+    for (i = 0; i < size; i++)
+    {
+        const DNSServer *s;
+        snprintf(buf, sizeof(buf), "host%u.site.corp%u.example.", i, i % BenchSplitDomains);
+        MakeDomainNameFromDNSNameString(&q.qname, buf);
+        SetValidDNSServers(m, &q);
+        s = GetServerForQuestion(m, &q);
+        if (!s || s->addr.ip.v4.b[3] != (mDNSu8)(i % BenchSplitDomains)) wrong++;
+    }
+    BenchReport("DNS server selection (split DNS)", size, size, BenchElapsedNs(&t), gBenchAllocs - t.allocs);
+    mDNS_Unlock(m);
+    if (wrong) fprintf(stderr, "%s: server selection chose the wrong server for %u of %u names\n", ProgramName, wrong, size);
+}
+
+mDNSlocal mStatus BenchRegisterInterface(mDNS *const m, PosixNetworkInterface *const pi, const char *const name, const mDNSu8 subnet)
+{
+    NetworkInterfaceInfo *const intf = &pi->coreIntf;
+
+    // With no multicast socket behind it, mDNSPlatformSendUDP quietly drops everything sent on this interface
+    mDNSPlatformMemZero(pi, sizeof(*pi));
+    pi->intfName         = name;
+    pi->multicastSocket4 = -1;
+#if HAVE_IPV6
+    pi->multicastSocket6 = -1;
+#endif
+    intf->InterfaceID = (mDNSInterfaceID)pi;
+    intf->ip.type     = mDNSAddrType_IPv4;
+    intf->ip.ip.v4.b[0] = 10; intf->ip.ip.v4.b[1] = subnet; intf->ip.ip.v4.b[2] = 0; intf->ip.ip.v4.b[3] = 1;
+    intf->mask.type   = mDNSAddrType_IPv4;
+    intf->mask.ip.v4.b[0] = 255; intf->mask.ip.v4.b[1] = 255;
+    strncpy(intf->ifname, pi->intfName, sizeof(intf->ifname) - 1);
+    intf->Advertise   = mDNSfalse;
+    intf->McastTxRx   = mDNStrue;
+    return mDNS_RegisterInterface(m, intf, NormalActivation);
+}
+
+mDNSlocal mDNSu32 BenchBytesSent(const PosixNetworkInterface *const pi)
+{
+    mDNSu32 bytes = 0;
+    int kind;
+    for (kind = 0; kind < mDNSTrafficKind_Count; kind++) bytes += pi->coreIntf.TrafficOut.bytes[kind];
+    return bytes;
+}
+
+// Announces BenchSharedAnswers PTR records on every interface, along with a TXT record for each instance on each of
+// the two bench interfaces. SendResponses starts the second bench interface's packet with the PTR answers already
+// written for the interface before it, then adds its TXT records, so the packet should come out byte for byte the
+// size of the same records written into a message afresh. If it's bigger, the TXT records' names have lost their
+// compression against the reused answers.
+mDNSlocal void BenchSharedAnswerSize(mDNS *const m)
+{
+    static DNSMessage msg;
+    PosixNetworkInterface *const intfs[2] = { &gBenchIntf, &gBenchIntf2 };
+    AuthRecord *const records = calloc(BenchSharedAnswers * 3, sizeof(AuthRecord));
+    mDNSu32 sent, built, shared, i;
+    mDNSu8 *ptr;
+
+    if (!records || BenchRegisterInterface(m, &gBenchIntf2, "bench1", 98)) return;
+    for (i = 0; i < BenchSharedAnswers * 3; i++)
+    {
+        AuthRecord *const rr = &records[i];
+        if (i < BenchSharedAnswers)
+        {
+            mDNS_SetupResourceRecord(rr, mDNSNULL, mDNSInterface_Any, kDNSType_PTR, kStandardTTL, kDNSRecordTypeShared, AuthRecordAny, mDNSNULL, mDNSNULL);
+            MakeDomainNameFromDNSNameString(&rr->namestorage, "_sabench._tcp.local.");
+            BenchName(&rr->resrec.rdata->u.name, "share", i);
+        }
+        else
+        {
+            mDNS_SetupResourceRecord(rr, mDNSNULL, intfs[i / BenchSharedAnswers - 1]->coreIntf.InterfaceID, kDNSType_TXT, kStandardTTL,
+                                     kDNSRecordTypeShared, AuthRecordAny, mDNSNULL, mDNSNULL);
+            BenchName(&rr->namestorage, "share", i % BenchSharedAnswers);
+            rr->resrec.rdata->u.txt.c[0] = 9;
+            mDNSPlatformMemCopy(&rr->resrec.rdata->u.txt.c[1], "bench=yes", 9);
+            rr->resrec.rdlength = 10;
+        }
+        if (mDNS_Register(m, rr)) return;
+    }
+
+    mDNS_Lock(m);
+    for (i = 0; i < BenchSharedAnswers * 3; i++)
+    {
+        records[i].AnnounceCount = 0;
+        records[i].ImmedAnswer   = mDNSInterfaceMark;
+    }
+    sent   = BenchBytesSent(&gBenchIntf2);
+    shared = m->mDNSStats.SharedResponseAnswers;
+    m->NextScheduledResponse = m->timenow;
+    SendResponses(m);
+    sent   = BenchBytesSent(&gBenchIntf2) - sent;
+    shared = m->mDNSStats.SharedResponseAnswers - shared;
+    mDNS_Unlock(m);
+
+    // The same answers in the order SendResponses puts them: the interface-independent ones, then the interface's own
+    InitializeDNSMessage(&msg.h, zeroID, ResponseFlags);
+    ptr = msg.data;
+    for (i = 0; ptr && i < BenchSharedAnswers * 3; i++)
+        if (i < BenchSharedAnswers || i >= BenchSharedAnswers * 2)
+            ptr = PutResourceRecordTTLWithLimit(&msg, ptr, &msg.h.numAnswers, &records[i].resrec, records[i].resrec.rroriginalttl, msg.data + NormalMaxDNSMessageData);
+    built = ptr ? (mDNSu32)(ptr - (mDNSu8 *)&msg) : 0;
+
+    printf("SendResponses (shared answers)   %u bytes reusing the answers, %u bytes built afresh\n", sent, built);
+    if (!shared) fprintf(stderr, "%s: the second bench interface didn't reuse the answers sent before it\n", ProgramName);
+    else if (sent != built) fprintf(stderr, "%s: reusing the shared answers made a %u byte response %u bytes\n", ProgramName, built, sent);
+}
+
+mDNSlocal int RunBenchmarks(const mDNSu32 size)
+{
+    mDNS *const m = &mDNSStorage;
+    const mDNSu32 numRecords   = (size < BenchMaxAuthRecords) ? size : BenchMaxAuthRecords;
+    const mDNSu32 numQuestions = (size < BenchMaxQuestions)   ? size : BenchMaxQuestions;
+    const mDNSu32 cacheSize    = size * 2 + BenchNameRing;
+    CacheEntity *const cache   = calloc(cacheSize, sizeof(CacheEntity));
+    AuthRecord  *const records   = calloc(numRecords, sizeof(AuthRecord));
+    AuthRecord  *const ptrs      = calloc(BenchSharedPTRs, sizeof(AuthRecord));
+    DNSQuestion *const questions = calloc(numQuestions, sizeof(DNSQuestion));
+    BenchPackets responses, queries;
+    mStatus err;
+    mDNSu32 i;
+
+    if (!cache || !records || !ptrs || !questions) { fprintf(stderr, "%s: out of memory for %u records\n", ProgramName, size); return 1; }
+    err = mDNS_Init(m, &PlatformStorage, cache, cacheSize, mDNS_Init_DontAdvertiseLocalAddresses, BenchStatusCallback, mDNS_Init_NoInitCallbackContext);
+    if (!err) err = BenchRegisterInterface(m, &gBenchIntf, "bench0", 99);
+    if (err) { fprintf(stderr, "%s: initialization failed %d\n", ProgramName, (int)err); return 1; }
+
+    if (!BenchBuildResponses(&responses, size) || !BenchBuildQueries(&queries, numRecords))
+    {
+        fprintf(stderr, "%s: couldn't build synthetic packets for %u records\n", ProgramName, size);
+        return 1;
+    }
+
+    BenchPutDomainNameAsLabels(size);
+    BenchGenContainers(size);
+    BenchBaseN(size);
+#ifdef USE_LIBIDN
+    BenchPunycode(size);
+#endif
+    BenchCreateNewCacheEntry(m, &responses, size);
+    BenchCoreReceive(m, &responses, size);
+    BenchCacheLookup(m, size);
+    BenchBrowseReceive(m, size);
+
+    for (i = 0; i < numRecords; i++)
+    {
+        AuthRecord *const rr = &records[i];
+        mDNS_SetupResourceRecord(rr, mDNSNULL, gBenchIntf.coreIntf.InterfaceID, kDNSType_TXT, kStandardTTL, kDNSRecordTypeShared, AuthRecordAny, mDNSNULL, mDNSNULL);
+        BenchName(&rr->namestorage, "svc", i);
+        rr->resrec.rdata->u.txt.c[0] = 9;
+        mDNSPlatformMemCopy(&rr->resrec.rdata->u.txt.c[1], "bench=yes", 9);
+        rr->resrec.rdlength = 10;
+        if (mDNS_Register(m, rr)) { fprintf(stderr, "%s: couldn't register record %u\n", ProgramName, i); return 1; }
+    }
+    // Skip the initial announcements, as if the records had been registered long ago, so SendResponses sends only
+    // the records each round asks for
+    mDNS_Lock(m);
+    for (i = 0; i < numRecords; i++) records[i].AnnounceCount = 0;
+    mDNS_Unlock(m);
+    BenchProcessQuery(m, &queries, size);
+    if (!BenchRegisterSharedPTRs(m, ptrs)) { fprintf(stderr, "%s: couldn't register the shared PTR records\n", ProgramName); return 1; }
+    BenchKnownAnswerSuppression(m, size);
+    BenchQueryFlood(m, &queries, size);
+    BenchSendResponses(m, records, numRecords, size);
+
+    for (i = 0; i < numQuestions; i++)
+    {
+        DNSQuestion *const q = &questions[i];
+        BenchName(&q->qname, "host", i);
+        q->InterfaceID      = gBenchIntf.coreIntf.InterfaceID;
+        q->qtype            = kDNSType_A;
+        q->qclass           = kDNSClass_IN;
+        q->QuestionCallback = BenchQuestionCallback;
+        if (mDNS_StartQuery(m, q)) { fprintf(stderr, "%s: couldn't start question %u\n", ProgramName, i); return 1; }
+    }
+    // Let mDNS_Execute answer the new questions from the cache, since SendQueries skips questions that are still new
+    for (i = 0; i < 10 && m->NewQuestions; i++) mDNS_Execute(m);
+    BenchSendQueries(m, questions, numQuestions, size);
+    BenchSendKnownAnswers(m, size);
+    BenchServerSelection(m, size);
+    BenchSharedAnswerSize(m);
+
+    BenchPacketsFree(&responses);
+    BenchPacketsFree(&queries);
+    return 0;
+}
+
+mDNSlocal void Usage(void)
+{
+    fprintf(stderr, "Usage: %s [-n records]...\n", ProgramName);
+    fprintf(stderr, "  Each -n gives a synthetic cache size to benchmark (default %u, %u and %u)\n",
+            BenchDefaultSizes[0], BenchDefaultSizes[1], BenchDefaultSizes[2]);
+}
+
+mDNSexport int main(int argc, char **argv)
+{
+    mDNSu32 sizes[BenchMaxSizes];
+    int numSizes = 0, result = 0, i;
+
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc && numSizes < BenchMaxSizes && atoi(argv[i + 1]) > 0)
+            sizes[numSizes++] = (mDNSu32)atoi(argv[++i]);
+        else { Usage(); return 2; }
+    }
+    if (!numSizes)
+        for (; numSizes < (int)(sizeof(BenchDefaultSizes) / sizeof(BenchDefaultSizes[0])); numSizes++)
+            sizes[numSizes] = BenchDefaultSizes[numSizes];
+
+    // Every active question is a DNSQuestion somewhere (in a request_state, a QueryRecordOp or a core structure)
+    printf("DNSQuestion %u bytes, %.1f KB per 1K questions\n", (unsigned)sizeof(DNSQuestion), sizeof(DNSQuestion) * 1000.0 / 1024);
+    printf("%-32s %9s %9s %15s %19s\n", "benchmark", "records", "ops", "time", "allocations");
+    fflush(stdout);
+    for (i = 0; i < numSizes; i++)
+    {
+        // Run each size in a fresh process, so one data set's cache and heap state can't skew the next
+        const pid_t pid = fork();
+        int status;
+        if (pid < 0) { perror("fork"); return 1; }
+        if (pid == 0) { const int err = RunBenchmarks(sizes[i]); fflush(stdout); _exit(err); }
+        if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) result = 1;
+    }
+    return result;
+}
@@ -0,0 +1,477 @@
+/* -*- Mode: C; tab-width: 4 -*-
+ *
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * mDNSCoreScenarios drives the core through a few fixed workloads -- so many cached records, active questions,
+ * registered records and interfaces, and a steady mix of incoming responses and queries -- on a virtual clock, with
+ * mDNS_Execute() run for every event the core schedules, the way mDNSReplayPcap does for a capture. The interfaces have
+ * no sockets behind them, so nothing goes on the wire. Each scenario reports the mDNS_Execute() calls it took and the
+ * CPU time per call, the heap in use at its highest, and the packets the core handed to mDNSPlatformSendUDP(), each of
+ * which would have been a sendto() call. With -c, the results are checked against a baseline written earlier with -w,
+ * and the exit status is 1 if any scenario has regressed beyond the tolerances below.
+ */
+
+#include <stdio.h>          // For printf()
+#include <stdlib.h>         // For malloc()
+#include <string.h>         // For strcmp()
+#include <time.h>           // For clock_gettime()
+#include <unistd.h>         // For fork()
+#include <sys/wait.h>       // For waitpid()
+#if defined(__GLIBC__)
+#include <malloc.h>         // For mallinfo2()
+#endif
+
+#include "mDNSEmbeddedAPI.h"// Defines the interface to the client layer above
+#include "DNSCommon.h"       // For building the synthetic packets
+#include "mDNSPosix.h"      // Defines the specific types needed to run mDNS on this platform
+
+#if !POSIX_VIRTUAL_TIME
+#error CoreScenarios.c must be built with POSIX_VIRTUAL_TIME, and linked against mDNSPosix.c built the same way
+#endif
+
+//*************************************************************************************************************
+// Globals
+
+mDNS mDNSStorage;                       // mDNS core uses this to store its globals
+static mDNS_PlatformSupport PlatformStorage;    // Stores this platform's globals
+mDNSexport const char ProgramName[] = "mDNSCoreScenarios";
+
+#define ScenarioStartTime           0x10000 // Virtual time at which each scenario starts
+#define ScenarioSlot                (mDNSPlatformOneSecond / 10)    // Packets arrive in batches, ten a virtual second
+#define ScenarioMaxInterfaces       8
+#define ScenarioMaxSelected         16
+#define ScenarioRecordsPerPacket    16
+#define ScenarioRecordTTL           120     // Seconds: short enough for cached records to be refreshed, or to expire, in a run
+#define ScenarioCacheChunk          500     // Cache entities added each time the core asks for more
+
+// How far a result may exceed its baseline before it counts as a regression. The counts depend only on the core (and
+// the random jitter in its timers), so they get a tight margin; the time depends on the machine as well, so it gets a
+// wide one by default, which -t overrides.
+#define ScenarioCountTolerance      1.10
+#define ScenarioCountSlack          10
+#define ScenarioHeapTolerance       1.25
+#define ScenarioHeapSlackKB         64
+#define ScenarioDefaultTimeTolerance 3.0
+
+typedef struct
+{
+    const char *name;
+    mDNSu32 cached;         // A records in the cache when the clock starts, spread over the interfaces
+    mDNSu32 questions;      // A questions active throughout: half for cached names, half for names nobody answers
+    mDNSu32 registered;     // TXT records registered on every interface
+    mDNSu32 interfaces;
+    mDNSu32 responses;      // Responses received per virtual second, each refreshing ScenarioRecordsPerPacket cached records
+    mDNSu32 queries;        // Queries received per virtual second, each for one of the registered records
+    mDNSu32 seconds;        // Virtual time the scenario runs for
+} Scenario;
+
+static const Scenario gScenarios[] =
+{
+    // name             cached questions registered interfaces responses queries seconds
+    { "idle-cache",      10000,       0,          0,         1,        0,      0,    300 },
+    { "busy-browser",     2000,     200,          0,         1,       20,      0,    300 },
+    { "responder",           0,       0,        256,         2,        0,    100,    120 },
+    { "multi-homed",      5000,     100,         64,         4,       20,     20,    300 },
+};
+#define ScenarioCount ((int)(sizeof(gScenarios) / sizeof(gScenarios[0])))
+
+typedef struct
+{
+    mDNSBool valid;
+    mDNSu32  executes;
+    mDNSu32  sent;                      // Packets the core handed to mDNSPlatformSendUDP
+    mDNSu32  heapKB;                    // Heap in use at its highest, sampled after every mDNS_Execute
+    double   executeNs;                 // CPU time per mDNS_Execute
+} ScenarioResult;
+
+static PosixNetworkInterface gIntf[ScenarioMaxInterfaces];
+static char gIntfNames[ScenarioMaxInterfaces][8];
+static unsigned long gAnswers;
+
+//*************************************************************************************************************
+// Measurement
+
+mDNSlocal double CPUTimeNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+mDNSlocal mDNSu32 HeapInUseKB(void)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    const struct mallinfo2 mi = mallinfo2();
+    return (mDNSu32)((mi.uordblks + mi.hblkhd) / 1024);
+#else
+    return 0;   // No way to tell; the heap check then never fails
+#endif
+}
+
+mDNSlocal mDNSu32 PacketsSent(const Scenario *const s)
+{
+    mDNSu32 sent = 0, i;
+    int kind;
+    for (i = 0; i < s->interfaces; i++)
+        for (kind = 0; kind < mDNSTrafficKind_Count; kind++) sent += gIntf[i].coreIntf.TrafficOut.packets[kind];
+    return sent;
+}
+
+// Runs every event the core has scheduled up to and including 'target', moving the virtual clock from one to the next
+mDNSlocal void ScenarioRunUntil(mDNS *const m, const mDNSs32 target, ScenarioResult *const r, double *const ns)
+{
+    for (;;)
+    {
+        const double start = CPUTimeNs();
+        mDNSs32 next = mDNS_Execute(m) - m->timenow_adjust;   // Core time is raw time plus the adjustment
+        const mDNSu32 heap = (*ns += CPUTimeNs() - start, HeapInUseKB());
+        r->executes++;
+        if (heap > r->heapKB) r->heapKB = heap;
+        if (next - gPosixVirtualRawTime <= 0) next = gPosixVirtualRawTime + 1;
+        if (next - target > 0) break;
+        gPosixVirtualRawTime = next;
+        gPosixVirtualUTC     = (next - ScenarioStartTime) / mDNSPlatformOneSecond;
+    }
+    gPosixVirtualRawTime = target;
+    gPosixVirtualUTC     = (target - ScenarioStartTime) / mDNSPlatformOneSecond;
+}
+
+//*************************************************************************************************************
+// Synthetic traffic
+
+mDNSlocal void ScenarioName(domainname *const name, const char *const prefix, const mDNSu32 i)
+{
+    char buf[MAX_ESCAPED_DOMAIN_NAME];
+    snprintf(buf, sizeof(buf), "%s%u.scenario.local.", prefix, i);
+    MakeDomainNameFromDNSNameString(name, buf);
+}
+
+mDNSlocal void ScenarioSource(mDNSAddr *const src, const mDNSu32 intf, const mDNSu32 host)
+{
+    src->type = mDNSAddrType_IPv4;
+    src->ip.v4.b[0] = 10; src->ip.v4.b[1] = (mDNSu8)(100 + intf); src->ip.v4.b[2] = (mDNSu8)(1 + host / 250); src->ip.v4.b[3] = (mDNSu8)(2 + host % 250);
+}
+
+// Receives one multicast response with the A records of hostN.scenario.local., N = first .. first+count-1, on intf
+mDNSlocal void ScenarioReceiveResponse(mDNS *const m, const mDNSu32 first, const mDNSu32 count, const mDNSu32 intf)
+{
+    static DNSMessage msg;
+    AuthRecord ar;
+    mDNSAddr src;
+    mDNSu8 *ptr = msg.data;
+    mDNSu32 i;
+
+    InitializeDNSMessage(&msg.h, zeroID, ResponseFlags);
+    mDNS_SetupResourceRecord(&ar, mDNSNULL, mDNSInterface_Any, kDNSType_A, ScenarioRecordTTL, kDNSRecordTypeShared, AuthRecordAny, mDNSNULL, mDNSNULL);
+    for (i = first; ptr && i < first + count; i++)
+    {
+        ScenarioName(&ar.namestorage, "host", i);
+        ar.resrec.rdata->u.ipv4.b[0] = 10;
+        ar.resrec.rdata->u.ipv4.b[1] = (mDNSu8)(100 + intf);
+        ar.resrec.rdata->u.ipv4.b[2] = (mDNSu8)(i >> 8);
+        ar.resrec.rdata->u.ipv4.b[3] = (mDNSu8)i;
+        SetNewRData(&ar.resrec, mDNSNULL, 0);
+        ptr = PutResourceRecordTTL(&msg, ptr, &msg.h.numAnswers, &ar.resrec, ar.resrec.rroriginalttl);
+    }
+    if (!ptr) return;
+    SwapDNSHeaderBytes(&msg);
+    ScenarioSource(&src, intf, first / ScenarioRecordsPerPacket);
+    mDNSCoreReceive(m, &msg, ptr, &src, MulticastDNSPort, &AllDNSLinkGroup_v4, MulticastDNSPort, gIntf[intf].coreIntf.InterfaceID);
+}
+
+// Receives one multicast query for the TXT record of svcN.scenario.local. on intf, from one of many hosts, so that no
+// one source is sending fast enough to be throttled
+mDNSlocal void ScenarioReceiveQuery(mDNS *const m, const mDNSu32 n, const mDNSu32 intf, const mDNSu32 host)
+{
+    static DNSMessage msg;
+    domainname name;
+    mDNSAddr src;
+    mDNSu8 *ptr;
+
+    InitializeDNSMessage(&msg.h, zeroID, QueryFlags);
+    ScenarioName(&name, "svc", n);
+    ptr = putQuestion(&msg, msg.data, msg.data + AbsoluteMaxDNSMessageData, &name, kDNSType_TXT, kDNSClass_IN);
+    if (!ptr) return;
+    SwapDNSHeaderBytes(&msg);
+    ScenarioSource(&src, intf, host);
+    mDNSCoreReceive(m, &msg, ptr, &src, MulticastDNSPort, &AllDNSLinkGroup_v4, MulticastDNSPort, gIntf[intf].coreIntf.InterfaceID);
+}
+
+//*************************************************************************************************************
+// Setup
+
+mDNSlocal void mDNS_StatusCallback(mDNS *const m, mStatus result)
+{
+    if (result == mStatus_GrowCache)
+    {
+        // Allocate another chunk of cache storage
+        CacheEntity *storage = malloc(sizeof(CacheEntity) * ScenarioCacheChunk);
+        if (storage) mDNS_GrowCache(m, storage, ScenarioCacheChunk);
+    }
+}
+
+mDNSlocal void ScenarioQuestionCallback(mDNS *const m, DNSQuestion *question, const ResourceRecord *const answer, QC_result AddRecord)
+{
+    (void)m;
+    (void)question;
+    (void)answer;
+    if (AddRecord) gAnswers++;
+}
+
+// Registers an interface with no sockets behind it, so mDNSPlatformSendUDP drops whatever the core sends on it
+mDNSlocal mStatus ScenarioRegisterInterface(mDNS *const m, const mDNSu32 i)
+{
+    PosixNetworkInterface *const intf = &gIntf[i];
+    NetworkInterfaceInfo *const info = &intf->coreIntf;
+
+    mDNSPlatformMemZero(intf, sizeof(*intf));
+    snprintf(gIntfNames[i], sizeof(gIntfNames[i]), "scen%u", i);
+    intf->intfName         = gIntfNames[i];
+    intf->multicastSocket4 = -1;
+#if HAVE_IPV6
+    intf->multicastSocket6 = -1;
+#endif
+    info->InterfaceID = (mDNSInterfaceID)intf;
+    info->ip.type     = mDNSAddrType_IPv4;
+    info->ip.ip.v4.b[0] = 10; info->ip.ip.v4.b[1] = (mDNSu8)(100 + i); info->ip.ip.v4.b[2] = 0; info->ip.ip.v4.b[3] = 1;
+    info->mask.type   = mDNSAddrType_IPv4;
+    info->mask.ip.v4.b[0] = 255; info->mask.ip.v4.b[1] = 255;
+    strncpy(info->ifname, intf->intfName, sizeof(info->ifname) - 1);
+    info->Advertise   = mDNSfalse;
+    info->McastTxRx   = mDNStrue;
+    return mDNS_RegisterInterface(m, info, NormalActivation);
+}
+
+//*************************************************************************************************************
+// Running the scenarios
+
+mDNSlocal int RunScenario(const Scenario *const s, ScenarioResult *const r)
+{
+    mDNS *const m = &mDNSStorage;
+    const mDNSu32 cacheSize = s->cached * 2 + ScenarioCacheChunk;
+    CacheEntity *const cache     = calloc(cacheSize, sizeof(CacheEntity));
+    AuthRecord  *const records   = calloc(s->registered + 1, sizeof(AuthRecord));
+    DNSQuestion *const questions = calloc(s->questions + 1, sizeof(DNSQuestion));
+    const mDNSu32 responsePackets = (s->cached + ScenarioRecordsPerPacket - 1) / ScenarioRecordsPerPacket;
+    mDNSu32 i, slot, responseDue = 0, queryDue = 0, nextResponse = 0, nextQuery = 0;
+    mDNSs32 now = ScenarioStartTime;
+    double ns = 0;
+    mStatus err;
+
+    if (!cache || !records || !questions) { fprintf(stderr, "%s: out of memory for %s\n", ProgramName, s->name); return 1; }
+    gPosixVirtualRawTime = now;
+    gPosixVirtualUTC     = 0;
+    PlatformStorage.OnlyInterfaces = "";    // None of the machine's own interfaces, just the ones registered below
+    err = mDNS_Init(m, &PlatformStorage, cache, cacheSize, mDNS_Init_DontAdvertiseLocalAddresses, mDNS_StatusCallback, mDNS_Init_NoInitCallbackContext);
+    for (i = 0; !err && i < s->interfaces; i++) err = ScenarioRegisterInterface(m, i);
+    for (i = 0; !err && i < s->registered; i++)
+    {
+        AuthRecord *const rr = &records[i];
+        mDNS_SetupResourceRecord(rr, mDNSNULL, mDNSInterface_Any, kDNSType_TXT, kStandardTTL, kDNSRecordTypeShared, AuthRecordAny, mDNSNULL, mDNSNULL);
+        ScenarioName(&rr->namestorage, "svc", i);
+        rr->resrec.rdata->u.txt.c[0] = 12;
+        mDNSPlatformMemCopy(&rr->resrec.rdata->u.txt.c[1], "scenario=yes", 12);
+        rr->resrec.rdlength = 13;
+        err = mDNS_Register(m, rr);
+    }
+    if (err) { fprintf(stderr, "%s: initialization failed %d for %s\n", ProgramName, (int)err, s->name); return 1; }
+
+    // Fill the cache before the clock starts, then ask the questions
+    for (i = 0; i < responsePackets; i++)
+    {
+        const mDNSu32 first = i * ScenarioRecordsPerPacket;
+        ScenarioReceiveResponse(m, first, (s->cached - first < ScenarioRecordsPerPacket) ? s->cached - first : ScenarioRecordsPerPacket, i % s->interfaces);
+    }
+    for (i = 0; i < s->questions; i++)
+    {
+        DNSQuestion *const q = &questions[i];
+        if (i % 2 == 0 && s->cached) ScenarioName(&q->qname, "host", (i / 2) % s->cached);
+        else                         ScenarioName(&q->qname, "miss", i);
+        q->InterfaceID      = mDNSInterface_Any;
+        q->qtype            = kDNSType_A;
+        q->qclass           = kDNSClass_IN;
+        q->QuestionCallback = ScenarioQuestionCallback;
+        if (mDNS_StartQuery(m, q)) { fprintf(stderr, "%s: couldn't start question %u for %s\n", ProgramName, i, s->name); return 1; }
+    }
+
+    mDNSPlatformMemZero(r, sizeof(*r));
+    r->heapKB = HeapInUseKB();
+    for (slot = 1; slot <= s->seconds * 10; slot++)
+    {
+        ScenarioRunUntil(m, now + (mDNSs32)slot * ScenarioSlot, r, &ns);
+        // Each slot gets a tenth of a second's packets, the remainders carried over to the next
+        for (responseDue += s->responses; responsePackets && responseDue >= 10; responseDue -= 10)
+        {
+            const mDNSu32 first = (nextResponse++ % responsePackets) * ScenarioRecordsPerPacket;
+            ScenarioReceiveResponse(m, first, (s->cached - first < ScenarioRecordsPerPacket) ? s->cached - first : ScenarioRecordsPerPacket,
+                                    (first / ScenarioRecordsPerPacket) % s->interfaces);
+        }
+        for (queryDue += s->queries; s->registered && queryDue >= 10; queryDue -= 10, nextQuery++)
+            ScenarioReceiveQuery(m, nextQuery % s->registered, nextQuery % s->interfaces, nextQuery % 1000);
+    }
+    r->sent      = PacketsSent(s);
+    r->executeNs = r->executes ? ns / r->executes : 0;
+    r->valid     = mDNStrue;
+    return 0;
+}
+
+//*************************************************************************************************************
+// Baselines
+
+// A baseline has a line per scenario: the name, then the executes, packets sent, heap KB and ns per execute. Lines
+// starting with '#' are comments.
+mDNSlocal int ReadBaseline(const char *const path, ScenarioResult *const base)
+{
+    FILE *const f = fopen(path, "r");
+    char line[256];
+    if (!f) { perror(path); return 1; }
+    while (fgets(line, sizeof(line), f))
+    {
+        char name[64];
+        ScenarioResult r;
+        int i;
+        mDNSPlatformMemZero(&r, sizeof(r));
+        if (line[0] == '#' || sscanf(line, "%63s %u %u %u %lf", name, &r.executes, &r.sent, &r.heapKB, &r.executeNs) != 5) continue;
+        for (i = 0; i < ScenarioCount; i++)
+            if (!strcmp(name, gScenarios[i].name)) { base[i] = r; base[i].valid = mDNStrue; }
+    }
+    fclose(f);
+    return 0;
+}
+
+mDNSlocal int WriteBaseline(const char *const path, const ScenarioResult *const results, const mDNSBool *const selected)
+{
+    FILE *const f = fopen(path, "w");
+    int i;
+    if (!f) { perror(path); return 1; }
+    fprintf(f, "# %s baseline, written with -w and checked with -c (\"make benchcheck\")\n", ProgramName);
+    fprintf(f, "# scenario executes sent heapKB nsPerExecute\n");
+    for (i = 0; i < ScenarioCount; i++)
+        if (selected[i] && results[i].valid)
+            fprintf(f, "%s %u %u %u %.0f\n", gScenarios[i].name, results[i].executes, results[i].sent, results[i].heapKB, results[i].executeNs);
+    return fclose(f) ? 1 : 0;
+}
+
+mDNSlocal mDNSBool CountRegressed(const mDNSu32 value, const mDNSu32 base)
+{
+    return value > base * ScenarioCountTolerance + ScenarioCountSlack;
+}
+
+// Prints each measure that's over its baseline by more than its tolerance, and returns the number of them
+mDNSlocal int CheckScenario(const Scenario *const s, const ScenarioResult *const r, const ScenarioResult *const base, const double timeTolerance)
+{
+    int regressions = 0;
+    if (!base->valid) { printf("  %s: no baseline\n", s->name); return 0; }
+    if (CountRegressed(r->executes, base->executes))
+    { printf("  %s: %u executes, baseline %u\n", s->name, r->executes, base->executes); regressions++; }
+    if (CountRegressed(r->sent, base->sent))
+    { printf("  %s: %u packets sent, baseline %u\n", s->name, r->sent, base->sent); regressions++; }
+    if (r->heapKB > base->heapKB * ScenarioHeapTolerance + ScenarioHeapSlackKB)
+    { printf("  %s: %u KB heap, baseline %u KB\n", s->name, r->heapKB, base->heapKB); regressions++; }
+    if (r->executeNs > base->executeNs * timeTolerance)
+    { printf("  %s: %.0f ns per execute, baseline %.0f ns\n", s->name, r->executeNs, base->executeNs); regressions++; }
+    return regressions;
+}
+
+//*************************************************************************************************************
+// Main
+
+mDNSlocal void Usage(void)
+{
+    int i;
+    fprintf(stderr, "Usage: %s [-s scenario]... [-c baseline | -w baseline] [-t factor]\n", ProgramName);
+    fprintf(stderr, "  -s runs just the named scenarios (default all:");
+    for (i = 0; i < ScenarioCount; i++) fprintf(stderr, " %s", gScenarios[i].name);
+    fprintf(stderr, ")\n  -c fails if any result has regressed from the baseline file; -w writes the results to it\n");
+    fprintf(stderr, "  -t is how many times its baseline the time per execute may be (default %.1f)\n", ScenarioDefaultTimeTolerance);
+}
+
+// Runs a scenario in a fresh process, so one scenario's core state and heap can't skew the next, and has the child
+// pass its results back through a pipe
+mDNSlocal int RunScenarioInChild(const Scenario *const s, ScenarioResult *const r)
+{
+    int fds[2], status;
+    pid_t pid;
+    ssize_t n;
+
+    if (pipe(fds) < 0) { perror("pipe"); return 1; }
+    fflush(stdout);
+    pid = fork();
+    if (pid < 0) { perror("fork"); close(fds[0]); close(fds[1]); return 1; }
+    if (pid == 0)
+    {
+        ScenarioResult result;
+        int err;
+        close(fds[0]);
+        mDNSPlatformMemZero(&result, sizeof(result));
+        err = RunScenario(s, &result);
+        if (write(fds[1], &result, sizeof(result)) != (ssize_t)sizeof(result)) err = 1;
+        _exit(err);
+    }
+    close(fds[1]);
+    n = read(fds[0], r, sizeof(*r));
+    close(fds[0]);
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) || n != (ssize_t)sizeof(*r)) return 1;
+    return 0;
+}
+
+mDNSexport int main(int argc, char **argv)
+{
+    static ScenarioResult results[ScenarioCount], base[ScenarioCount];
+    mDNSBool selected[ScenarioCount];
+    const char *checkPath = mDNSNULL, *writePath = mDNSNULL;
+    double timeTolerance = ScenarioDefaultTimeTolerance;
+    int numSelected = 0, regressions = 0, failures = 0, i, j;
+
+    mDNSPlatformMemZero(selected, sizeof(selected));
+    for (i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-s") && i + 1 < argc)
+        {
+            for (j = 0; j < ScenarioCount && strcmp(argv[i + 1], gScenarios[j].name); j++) continue;
+            if (j == ScenarioCount) { Usage(); return 2; }
+            selected[j] = mDNStrue;
+            numSelected++;
+            i++;
+        }
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc) checkPath = argv[++i];
+        else if (!strcmp(argv[i], "-w") && i + 1 < argc) writePath = argv[++i];
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc && atof(argv[i + 1]) >= 1.0) timeTolerance = atof(argv[++i]);
+        else { Usage(); return 2; }
+    }
+    if (checkPath && writePath) { Usage(); return 2; }
+    if (!numSelected) for (i = 0; i < ScenarioCount; i++) selected[i] = mDNStrue;
+    if (checkPath && ReadBaseline(checkPath, base)) return 2;
+
+    printf("%-14s %7s %9s %6s %6s %8s %9s %9s %10s\n", "scenario", "cached", "questions", "owned", "intfs", "virtual", "executes", "sent", "heap");
+    for (i = 0; i < ScenarioCount; i++)
+    {
+        const Scenario *const s = &gScenarios[i];
+        ScenarioResult *const r = &results[i];
+        if (!selected[i]) continue;
+        if (RunScenarioInChild(s, r)) { printf("%-14s failed\n", s->name); failures++; continue; }
+        printf("%-14s %7u %9u %6u %6u %7us %9u %9u %7u KB %8.0f ns/execute\n", s->name, s->cached, s->questions, s->registered,
+               s->interfaces, s->seconds, r->executes, r->sent, r->heapKB, r->executeNs);
+    }
+
+    if (writePath && !failures && WriteBaseline(writePath, results, selected)) { perror(writePath); return 2; }
+    if (checkPath)
+    {
+        for (i = 0; i < ScenarioCount; i++)
+            if (selected[i] && results[i].valid) regressions += CheckScenario(&gScenarios[i], &results[i], &base[i], timeTolerance);
+        printf("%d regression%s against %s\n", regressions, regressions == 1 ? "" : "s", checkPath);
+    }
+    return (failures || regressions) ? 1 : 0;
+}
@@ -38,6 +38,7 @@
 #include <netinet/ip.h>             // For IPTOS_LOWDELAY etc.
 #include <arpa/inet.h>
 #include <signal.h>
+#include <stdlib.h>
 
 #include "mDNSEmbeddedAPI.h" // Defines the interface to the mDNS core code
 #include "mDNSPosix.h"    // Defines the specific types needed to run mDNS on this platform
@@ -195,7 +196,8 @@ mDNSlocal void WaitForAnswer(mDNS *const m, int seconds)
     }
 }
 
-mDNSlocal mStatus StartQuery(DNSQuestion *q, char *qname, mDNSu16 qtype, const mDNSAddr *target, mDNSQuestionCallback callback)
+mDNSlocal mStatus StartQueryWithContext(DNSQuestion *q, char *qname, mDNSu16 qtype, const mDNSAddr *target,
+                                        mDNSQuestionCallback callback, void *context)
 {
     lastsrc = zeroAddr;
     if (qname) MakeDomainNameFromDNSNameString(&q->qname, qname);
@@ -220,12 +222,42 @@ mDNSlocal mStatus StartQuery(DNSQuestion *q, char *qname, mDNSu16 qtype, const m
     q->ProxyQuestion    = 0;
     q->pid              = mDNSPlatformGetPID();
     q->QuestionCallback = callback;
-    q->QuestionContext  = NULL;
+    q->QuestionContext  = context;
 
     //mprintf("%##s %s ?\n", q->qname.c, DNSTypeName(qtype));
     return(mDNS_StartQuery(&mDNSStorage, q));
 }
 
+mDNSlocal mStatus StartQuery(DNSQuestion *q, char *qname, mDNSu16 qtype, const mDNSAddr *target, mDNSQuestionCallback callback)
+{
+    return(StartQueryWithContext(q, qname, qtype, target, callback, NULL));
+}
+
+// Writes the reverse-mapping name for addr, e.g. 4.3.2.1.in-addr.arpa. for 1.2.3.4
+mDNSlocal void MakeReverseName(const mDNSAddr *addr, char *buffer, int len)
+{
+    if (addr->type == mDNSAddrType_IPv4)
+    {
+        const mDNSu8 *p = addr->ip.v4.b;
+        // Note: This is reverse order compared to a normal dotted-decimal IP address, so we can't use our customary "%.4a" format code
+        mDNS_snprintf(buffer, len, "%d.%d.%d.%d.in-addr.arpa.", p[3], p[2], p[1], p[0]);
+    }
+    else
+    {
+        int i;
+        const mDNSu8 *p = addr->ip.v6.b;
+        for (i = 0; i < 16; i++)
+        {
+            static const char hexValues[] = "0123456789ABCDEF";
+            buffer[i * 4    ] = hexValues[p[15-i] & 0x0F];
+            buffer[i * 4 + 1] = '.';
+            buffer[i * 4 + 2] = hexValues[p[15-i] >> 4];
+            buffer[i * 4 + 3] = '.';
+        }
+        mDNS_snprintf(&buffer[64], len-64, "ip6.arpa.");
+    }
+}
+
 mDNSlocal void DoOneQuery(DNSQuestion *q, char *qname, mDNSu16 qtype, const mDNSAddr *target, mDNSQuestionCallback callback)
 {
     mStatus status = StartQuery(q, qname, qtype, target, callback);
@@ -251,6 +283,290 @@ mDNSlocal int DoQuery(DNSQuestion *q, char *qname, mDNSu16 qtype, const mDNSAddr
     return(StopNow);
 }
 
+//*************************************************************************************************************
+// Sweep mode: identify many hosts at once
+//
+// Rather than asking one host at a time and waiting up to four seconds per question, -sweep keeps up to
+// SweepParallel targets in flight, each with its own DNSQuestion and deadline, and prints one line per host
+// as soon as that host has answered (or timed out). Targets are IPv4/IPv6 addresses, IPv4 CIDR ranges such as
+// 10.0.1.0/24, dot-local host names, or "-f <file>" (one target per line, "-" for stdin).
+
+typedef enum { Sweep_Idle, Sweep_Name, Sweep_GotName, Sweep_Info, Sweep_Done } SweepStage;
+
+typedef struct
+{
+    SweepStage stage;
+    mDNSBool querying;      // q is running
+    mDNSs32 deadline;
+    mDNSAddr addr;          // zeroAddr when the target was given as a host name
+    DNSQuestion q;
+    int NumAddr, NumAAAA;
+    char hostname[MAX_ESCAPED_DOMAIN_NAME], hardware[256], software[256];
+} SweepTarget;
+
+#define DefaultSweepParallel 32
+#define MaxSweepParallel     256
+
+static int SweepParallel = DefaultSweepParallel;
+static int SweepTimeout  = 2;   // Seconds allowed for each stage
+static int SweepFound, SweepSilent;
+
+// Target generator state: a run of IPv4 addresses in host byte order, the current -f file, and the remaining arguments
+static mDNSu32 SweepNext, SweepLast;
+static mDNSBool SweepRangeActive;
+static FILE *SweepFile;
+static char **SweepArgs;
+static int SweepArgCount;
+
+mDNSlocal void SweepNameCallback(mDNS *const m, DNSQuestion *question, const ResourceRecord *const answer, QC_result AddRecord)
+{
+    SweepTarget *t = (SweepTarget *)question->QuestionContext;
+    (void)m;        // Unused
+    if (!AddRecord || t->stage != Sweep_Name) return;
+    if (answer->rrtype == kDNSType_PTR || answer->rrtype == kDNSType_CNAME)
+    {
+        ConvertDomainNameToCString(&answer->rdata->u.name, t->hostname);
+        t->stage = Sweep_GotName;   // SweepService() moves on to the info query outside the callback
+    }
+}
+
+mDNSlocal void SweepInfoCallback(mDNS *const m, DNSQuestion *question, const ResourceRecord *const answer, QC_result AddRecord)
+{
+    SweepTarget *t = (SweepTarget *)question->QuestionContext;
+    (void)m;        // Unused
+    if (!AddRecord || t->stage != Sweep_Info) return;
+    if (answer->rrtype == kDNSType_A)
+    {
+        if (!t->NumAddr++ && !t->addr.type) { t->addr.type = mDNSAddrType_IPv4; t->addr.ip.v4 = answer->rdata->u.ipv4; }
+    }
+    else if (answer->rrtype == kDNSType_AAAA)
+    {
+        if (!t->NumAAAA++ && !t->addr.type) { t->addr.type = mDNSAddrType_IPv6; t->addr.ip.v6 = answer->rdata->u.ipv6; }
+    }
+    else if (answer->rrtype == kDNSType_HINFO)
+    {
+        mDNSu8 *p = answer->rdata->u.data;
+        strncpy(t->hardware, (char*)(p+1), p[0]);
+        t->hardware[p[0]] = 0;
+        p += 1 + p[0];
+        strncpy(t->software, (char*)(p+1), p[0]);
+        t->software[p[0]] = 0;
+        t->stage = Sweep_Done;      // HINFO is the last thing we're waiting for
+    }
+}
+
+// Parses "a.b.c.d/nn" into an inclusive range of host byte order addresses
+mDNSlocal mDNSBool ParseCIDR(const char *arg, mDNSu32 *first, mDNSu32 *last)
+{
+    char buffer[32];
+    const char *slash = strchr(arg, '/');
+    struct in_addr s4;
+    char *end;
+    long bits;
+    mDNSu32 base, mask;
+
+    if (!slash || slash - arg >= (int)sizeof(buffer)) return(mDNSfalse);
+    memcpy(buffer, arg, slash - arg);
+    buffer[slash - arg] = 0;
+    if (inet_pton(AF_INET, buffer, &s4) != 1) return(mDNSfalse);
+    bits = strtol(slash + 1, &end, 10);
+    if (*end || end == slash + 1 || bits < 0 || bits > 32) return(mDNSfalse);
+
+    mask = bits ? ~0U << (32 - bits) : 0;
+    base = ntohl(s4.s_addr) & mask;
+    *first = base;
+    *last  = base | ~mask;
+    // Skip the network and broadcast addresses of ordinary subnets
+    if (bits < 31) { (*first)++; (*last)--; }
+    return(mDNStrue);
+}
+
+// Fills in t from the next target specification; returns mDNSfalse when there are no more targets
+mDNSlocal mDNSBool SweepNextTarget(SweepTarget *t)
+{
+    char line[256];
+    const char *arg;
+    struct in_addr s4;
+#if HAVE_IPV6
+    struct in6_addr s6;
+#endif
+
+    for (;;)
+    {
+        if (SweepRangeActive)
+        {
+            t->addr.type = mDNSAddrType_IPv4;
+            t->addr.ip.v4.NotAnInteger = htonl(SweepNext);
+            if (SweepNext++ == SweepLast) SweepRangeActive = mDNSfalse;
+            return(mDNStrue);
+        }
+
+        if (SweepFile)
+        {
+            char *p;
+            if (!fgets(line, sizeof(line), SweepFile))
+            {
+                if (SweepFile != stdin) fclose(SweepFile);
+                SweepFile = NULL;
+                continue;
+            }
+            p = line + strcspn(line, "#\r\n");
+            *p = 0;
+            while (p > line && (p[-1] == ' ' || p[-1] == '\t')) *--p = 0;
+            for (p = line; *p == ' ' || *p == '\t'; p++) continue;
+            if (!*p) continue;
+            arg = p;
+        }
+        else if (SweepArgCount)
+        {
+            arg = *SweepArgs++;
+            SweepArgCount--;
+            if (!strcmp(arg, "-f") && SweepArgCount)
+            {
+                arg = *SweepArgs++;
+                SweepArgCount--;
+                SweepFile = strcmp(arg, "-") ? fopen(arg, "r") : stdin;
+                if (!SweepFile) fprintf(stderr, "%s: %s\n", arg, strerror(errno));
+                continue;
+            }
+        }
+        else return(mDNSfalse);
+
+        t->addr = zeroAddr;
+        t->hostname[0] = 0;
+        if (ParseCIDR(arg, &SweepNext, &SweepLast))
+        {
+            SweepRangeActive = (SweepNext <= SweepLast);
+            continue;
+        }
+        if (inet_pton(AF_INET, arg, &s4) == 1)
+        {
+            t->addr.type = mDNSAddrType_IPv4;
+            t->addr.ip.v4.NotAnInteger = s4.s_addr;
+        }
+#if HAVE_IPV6
+        else if (inet_pton(AF_INET6, arg, &s6) == 1)
+        {
+            t->addr.type = mDNSAddrType_IPv6;
+            mDNSPlatformMemCopy(&t->addr.ip.v6, &s6, sizeof(t->addr.ip.v6));
+        }
+#endif
+        else if (strlen(arg) < sizeof(t->hostname)) strcpy(t->hostname, arg);
+        else { fprintf(stderr, "%s: hostname must be < %d characters\n", arg, (int)sizeof(t->hostname)); continue; }
+        return(mDNStrue);
+    }
+}
+
+mDNSlocal void SweepStopQuery(SweepTarget *t)
+{
+    if (t->querying) mDNS_StopQuery(&mDNSStorage, &t->q);
+    t->querying = mDNSfalse;
+}
+
+mDNSlocal void SweepStartInfo(SweepTarget *t)
+{
+    // A name found by reverse lookup is asked of the same host; a name given on the command line goes out via multicast
+    t->stage    = Sweep_Info;
+    t->deadline = mDNSPlatformRawTime() + SweepTimeout * mDNSPlatformOneSecond;
+    t->querying = (StartQueryWithContext(&t->q, t->hostname, kDNSQType_ANY, &t->addr, SweepInfoCallback, t) == mStatus_NoError);
+    if (!t->querying) t->stage = Sweep_Done;
+}
+
+mDNSlocal void SweepStart(SweepTarget *t)
+{
+    char buffer[256];
+    t->NumAddr = t->NumAAAA = 0;
+    t->hardware[0] = t->software[0] = 0;
+    if (!t->addr.type) { SweepStartInfo(t); return; }
+
+    MakeReverseName(&t->addr, buffer, sizeof(buffer));
+    t->stage    = Sweep_Name;
+    t->deadline = mDNSPlatformRawTime() + SweepTimeout * mDNSPlatformOneSecond;
+    t->querying = (StartQueryWithContext(&t->q, buffer, kDNSType_PTR, &t->addr, SweepNameCallback, t) == mStatus_NoError);
+    if (!t->querying) t->stage = Sweep_Done;
+}
+
+mDNSlocal void SweepReport(const SweepTarget *t)
+{
+    char addr[64] = "-";
+    if (!t->hostname[0] || (!t->addr.type && !t->NumAddr && !t->NumAAAA && !t->hardware[0])) { SweepSilent++; return; }
+    SweepFound++;
+    if (t->addr.type) mDNS_snprintf(addr, sizeof(addr), "%#a", &t->addr);
+    printf("%-40s %s", addr, t->hostname);
+    if (t->hardware[0] || t->software[0]) printf("  HINFO \"%s\" \"%s\"", t->hardware, t->software);
+    printf("\n");
+    fflush(stdout);
+}
+
+// Advances every in-flight target whose callback has fired or whose deadline has passed, and refills idle slots.
+// Returns the number of targets still in flight.
+mDNSlocal int SweepService(SweepTarget *targets, mDNSBool *more)
+{
+    const mDNSs32 now = mDNSPlatformRawTime();
+    int i, active = 0;
+
+    for (i = 0; i < SweepParallel; i++)
+    {
+        SweepTarget *t = &targets[i];
+        if (t->stage == Sweep_GotName)
+        {
+            SweepStopQuery(t);
+            SweepStartInfo(t);
+        }
+        else if ((t->stage == Sweep_Name || t->stage == Sweep_Info) && now - t->deadline >= 0)
+            t->stage = Sweep_Done;
+
+        if (t->stage == Sweep_Done)
+        {
+            SweepStopQuery(t);
+            SweepReport(t);
+            t->stage = Sweep_Idle;
+        }
+
+        if (t->stage == Sweep_Idle && *more && !StopNow)
+        {
+            if (SweepNextTarget(t)) SweepStart(t);
+            else *more = mDNSfalse;
+        }
+        if (t->stage != Sweep_Idle) active++;
+    }
+    return(active);
+}
+
+mDNSlocal int SweepMain(char **args, int count)
+{
+    SweepTarget *targets = calloc(SweepParallel, sizeof(*targets));
+    mDNSBool more = mDNStrue;
+    int i;
+
+    if (!targets) { fprintf(stderr, "Out of memory\n"); return(-1); }
+    SweepArgs = args;
+    SweepArgCount = count;
+    StopNow = 0;
+
+    while (SweepService(targets, &more) && StopNow != 2)
+    {
+        int nfds = 0;
+        fd_set readfds, writefds;
+        struct timeval remain = { 0, 100000 };  // Wake at least every 100ms to check per-target deadlines
+        int result;
+
+        FD_ZERO(&readfds);
+        FD_ZERO(&writefds);
+        mDNSPosixGetFDSet(&mDNSStorage, &nfds, &readfds, &writefds, &remain);
+        result = select(nfds, &readfds, &writefds, NULL, &remain);
+        if (result >= 0) mDNSPosixProcessFDSet(&mDNSStorage, &readfds, &writefds);
+        else if (errno != EINTR) StopNow = 2;
+    }
+
+    for (i = 0; i < SweepParallel; i++) SweepStopQuery(&targets[i]);
+    free(targets);
+    if (SweepFile && SweepFile != stdin) fclose(SweepFile);
+
+    fprintf(stderr, "%d host%s identified, %d silent\n", SweepFound, SweepFound == 1 ? "" : "s", SweepSilent);
+    return(StopNow == 2 ? -1 : 0);
+}
+
 mDNSlocal void HandleSIG(int signal)
 {
     (void)signal;   // Unused
@@ -286,6 +602,25 @@ mDNSexport int main(int argc, char **argv)
     signal(SIGINT, HandleSIG);  // SIGINT is what you get for a Ctrl-C
     signal(SIGTERM, HandleSIG);
 
+    if (!strcmp(argv[1], "-sweep"))
+    {
+        int result;
+        for (this_arg = 2; this_arg + 1 < argc; this_arg += 2)
+        {
+            if      (!strcmp(argv[this_arg], "-p")) SweepParallel = atoi(argv[this_arg + 1]);
+            else if (!strcmp(argv[this_arg], "-t")) SweepTimeout  = atoi(argv[this_arg + 1]);
+            else break;
+        }
+        if (SweepParallel < 1 || SweepParallel > MaxSweepParallel || SweepTimeout < 1 || this_arg >= argc)
+        {
+            mDNS_Close(&mDNSStorage);
+            goto usage;
+        }
+        result = SweepMain(&argv[this_arg], argc - this_arg);
+        mDNS_Close(&mDNSStorage);
+        return(result);
+    }
+
     while (this_arg < argc)
     {
         char *arg = argv[this_arg++];
@@ -298,31 +633,19 @@ mDNSexport int main(int argc, char **argv)
 
         if (inet_pton(AF_INET, arg, &s4) == 1)
         {
-            mDNSu8 *p = (mDNSu8 *)&s4;
-            // Note: This is reverse order compared to a normal dotted-decimal IP address, so we can't use our customary "%.4a" format code
-            mDNS_snprintf(buffer, sizeof(buffer), "%d.%d.%d.%d.in-addr.arpa.", p[3], p[2], p[1], p[0]);
-            printf("%s\n", buffer);
             target.type = mDNSAddrType_IPv4;
             target.ip.v4.NotAnInteger = s4.s_addr;
+            MakeReverseName(&target, buffer, sizeof(buffer));
+            printf("%s\n", buffer);
             DoQuery(&q, buffer, kDNSType_PTR, &target, NameCallback);
             if (StopNow == 2) break;
         }
 #if HAVE_IPV6
         else if (inet_pton(AF_INET6, arg, &s6) == 1)
         {
-            int i;
-            mDNSu8 *p = (mDNSu8 *)&s6;
-            for (i = 0; i < 16; i++)
-            {
-                static const char hexValues[] = "0123456789ABCDEF";
-                buffer[i * 4    ] = hexValues[p[15-i] & 0x0F];
-                buffer[i * 4 + 1] = '.';
-                buffer[i * 4 + 2] = hexValues[p[15-i] >> 4];
-                buffer[i * 4 + 3] = '.';
-            }
-            mDNS_snprintf(&buffer[64], sizeof(buffer)-64, "ip6.arpa.");
             target.type = mDNSAddrType_IPv6;
             mDNSPlatformMemCopy(&target.ip.v6, &s6, sizeof(target.ip.v6));
+            MakeReverseName(&target, buffer, sizeof(buffer));
             DoQuery(&q, buffer, kDNSType_PTR, &target, NameCallback);
             if (StopNow == 2) break;
         }
@@ -371,5 +694,8 @@ mDNSexport int main(int argc, char **argv)
 
 usage:
     fprintf(stderr, "Usage: %s <dot-local hostname> or <IPv4 address> or <IPv6 address> ...\n", progname);
+    fprintf(stderr, "       %s -sweep [-p parallel] [-t seconds] <address, a.b.c.d/nn, hostname, or -f file> ...\n", progname);
+    fprintf(stderr, "       -p: hosts identified at once (default %d, max %d); -t: seconds allowed per stage (default 2)\n",
+            DefaultSweepParallel, MaxSweepParallel);
     return(-1);
 }
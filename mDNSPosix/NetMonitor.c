@@ -93,6 +93,7 @@ struct ActivityStat_struct
     domainname srvtype;
     int printed;
     int totalops;
+    int lastops;                // totalops at the last -stats report
     int stat[OP_NumTypes];
 };
 
@@ -127,6 +128,11 @@ static int NumProbes, NumGoodbyes, NumQuestions, NumLegacy, NumAnswers, NumAddit
 
 static ActivityStat *stats;
 
+static int StatsInterval = 0;               // -stats <seconds>: print what changed every so often while running
+static struct timeval tv_laststats;
+static unsigned long NumBytes, LastNumBytes;
+static int LastTotPkt;
+
 #define OPBanner "Total Ops   Probe   Goodbye  BrowseQ  BrowseA ResolveQ ResolveA"
 
 mDNSexport void mDNSCoreReceive(mDNS *const m, DNSMessage *const msg, const mDNSu8 *const end, const mDNSAddr *const srcaddr, const mDNSIPPort srcport, const mDNSAddr *dstaddr, const mDNSIPPort dstport, const mDNSInterfaceID InterfaceID);
@@ -151,7 +157,9 @@ mDNSlocal mDNSu32 mprintf(const char *format, ...)
 //*************************************************************************************************************
 // Host Address List
 //
-// Would benefit from a hash
+// Hosts are kept in an array, in the order first seen, with an open-addressed hash index over it so that finding the
+// host for each packet doesn't mean searching them all. The index holds array positions, which stay valid however the
+// array grows; nothing reorders the array, since reports pick out the top hosts rather than sorting the whole list.
 
 typedef enum
 {
@@ -168,6 +176,9 @@ typedef struct
     unsigned long pkts[HostPkt_NumTypes];
     unsigned long totalops;
     unsigned long stat[OP_NumTypes];
+    unsigned long bytes;
+    unsigned long lastpkts;     // HostEntryTotalPackets() and bytes at the last -stats report
+    unsigned long lastbytes;
     domainname hostname;
     domainname revname;
     UTF8str255 HIHardware;
@@ -183,18 +194,38 @@ typedef struct
     long num;
     long max;
     HostEntry   *hosts;
+    long numslots;              // Size of the index, a power of two kept over a third empty
+    long        *slots;         // Position in hosts plus one, or zero for an empty slot
 } HostList;
 
-static HostList IPv4HostList = { 0, 0, 0 };
-static HostList IPv6HostList = { 0, 0, 0 };
+static HostList IPv4HostList = { 0, 0, 0, 0, 0 };
+static HostList IPv6HostList = { 0, 0, 0, 0, 0 };
+
+mDNSlocal mDNSu32 HostAddrHash(const mDNSAddr *addr)
+{
+    mDNSu32 h = addr->ip.v4.NotAnInteger;
+    if (addr->type == mDNSAddrType_IPv6)
+        h = addr->ip.v6.l[0] ^ addr->ip.v6.l[1] ^ addr->ip.v6.l[2] ^ addr->ip.v6.l[3];
+    h *= 0x9E3779B1;            // Spread the low bits, which vary most between hosts on a subnet, into the high ones
+    return(h ^ (h >> 16));
+}
+
+mDNSlocal void IndexHost(HostList *list, long i)
+{
+    long mask = list->numslots - 1;
+    long slot = (long)(HostAddrHash(&list->hosts[i].addr) & (mDNSu32)mask);
+    while (list->slots[slot]) slot = (slot + 1) & mask;
+    list->slots[slot] = i + 1;
+}
 
 mDNSlocal HostEntry *FindHost(const mDNSAddr *addr, HostList *list)
 {
-    long i;
+    long mask = list->numslots - 1, slot;
 
-    for (i = 0; i < list->num; i++)
+    if (!list->numslots) return NULL;
+    for (slot = (long)(HostAddrHash(addr) & (mDNSu32)mask); list->slots[slot]; slot = (slot + 1) & mask)
     {
-        HostEntry *entry = list->hosts + i;
+        HostEntry *entry = list->hosts + list->slots[slot] - 1;
         if (mDNSSameAddress(addr, &entry->addr))
             return entry;
     }
@@ -208,18 +239,33 @@ mDNSlocal HostEntry *AddHost(const mDNSAddr *addr, HostList *list)
     HostEntry *entry;
     if (list->num >= list->max)
     {
-        long newMax = list->max + 64;
+        long newMax = list->max ? list->max * 2 : 64;
         HostEntry *newHosts = realloc(list->hosts, newMax * sizeof(HostEntry));
         if (newHosts == NULL)
             return NULL;
         list->max = newMax;
         list->hosts = newHosts;
     }
+    if ((list->num + 1) * 3 > list->numslots * 2)
+    {
+        long newSlots = list->numslots ? list->numslots * 2 : 128;
+        long *slots = calloc(newSlots, sizeof(long));
+        if (slots == NULL)
+            return NULL;
+        free(list->slots);
+        list->slots = slots;
+        list->numslots = newSlots;
+        for (i = 0; i < list->num; i++) IndexHost(list, i);
+    }
 
-    entry = list->hosts + list->num++;
-
+    entry = list->hosts + list->num;
     entry->addr = *addr;
+    IndexHost(list, list->num++);
+
     for (i=0; i<HostPkt_NumTypes; i++) entry->pkts[i] = 0;
+    entry->bytes = 0;
+    entry->lastpkts = 0;
+    entry->lastbytes = 0;
     entry->totalops = 0;
     for (i=0; i<OP_NumTypes;      i++) entry->stat[i] = 0;
     entry->hostname.c[0] = 0;
@@ -240,7 +286,7 @@ mDNSlocal HostEntry *AddHost(const mDNSAddr *addr, HostList *list)
     return(entry);
 }
 
-mDNSlocal HostEntry *GotPacketFromHost(const mDNSAddr *addr, HostPkt_Type t, mDNSOpaque16 id)
+mDNSlocal HostEntry *GotPacketFromHost(const mDNSAddr *addr, HostPkt_Type t, mDNSOpaque16 id, mDNSu32 bytes)
 {
     if (ExactlyOneFilter) return(NULL);
     else
@@ -250,7 +296,7 @@ mDNSlocal HostEntry *GotPacketFromHost(const mDNSAddr *addr, HostPkt_Type t, mDN
         if (!entry) entry = AddHost(addr, list);
         if (!entry) return(NULL);
         // Don't count our own interrogation packets
-        if (id.NotAnInteger != 0xFFFF) entry->pkts[t]++;
+        if (id.NotAnInteger != 0xFFFF) { entry->pkts[t]++; entry->bytes += bytes; }
         return(entry);
     }
 }
@@ -342,18 +388,37 @@ mDNSlocal void AnalyseHost(mDNS *const m, HostEntry *entry, const mDNSInterfaceI
     }
 }
 
-mDNSlocal int CompareHosts(const void *p1, const void *p2)
+#define HostEntryRecentPackets(H) (HostEntryTotalPackets(H) - (H)->lastpkts)
+
+// Fills top[] with up to max hosts with the most packets, overall or since the last -stats report, most first.
+// With max small this is much cheaper than sorting every host, and leaves the list (and its index) alone.
+mDNSlocal int TopHosts(const HostList *list, HostEntry **top, int max, mDNSBool recent)
 {
-    return (int)(HostEntryTotalPackets((HostEntry *)p2) - HostEntryTotalPackets((HostEntry *)p1));
+    long i;
+    int n = 0;
+    for (i = 0; i < list->num; i++)
+    {
+        HostEntry *e = &list->hosts[i];
+        unsigned long key = recent ? HostEntryRecentPackets(e) : HostEntryTotalPackets(e);
+        int j;
+        if (recent && !key) continue;
+        if (n == max && key <= (recent ? HostEntryRecentPackets(top[n-1]) : HostEntryTotalPackets(top[n-1]))) continue;
+        if (n < max) n++;
+        for (j = n - 1; j > 0 && key > (recent ? HostEntryRecentPackets(top[j-1]) : HostEntryTotalPackets(top[j-1])); j--)
+            top[j] = top[j-1];
+        top[j] = e;
+    }
+    return(n);
 }
 
 mDNSlocal void ShowSortedHostList(HostList *list, int max)
 {
-    HostEntry *e, *end = &list->hosts[(max < list->num) ? max : list->num];
-    qsort(list->hosts, list->num, sizeof(HostEntry), CompareHosts);
+    HostEntry *top[kReportTopHosts];
+    int i, n = TopHosts(list, top, (max < kReportTopHosts) ? max : kReportTopHosts, mDNSfalse);
     if (list->num) mprintf("\n%-25s%s%s\n", "Source Address", OPBanner, "    Pkts    Query   LegacyQ Response");
-    for (e = &list->hosts[0]; e < end; e++)
+    for (i = 0; i < n; i++)
     {
+        HostEntry *e = top[i];
         int len = mprintf("%#-25a", &e->addr);
         if (len > 25) mprintf("\n%25s", "");
         mprintf("%8lu %8lu %8lu %8lu %8lu %8lu %8lu", e->totalops,
@@ -420,6 +485,7 @@ mDNSlocal void recordstat(HostEntry *entry, const domainname *fqdn, int op, mDNS
         (*s)->srvtype  = srvtype;
         (*s)->printed  = 0;
         (*s)->totalops = 0;
+        (*s)->lastops  = 0;
         for (i=0; i<OP_NumTypes; i++) (*s)->stat[i] = 0;
     }
 
@@ -451,6 +517,57 @@ mDNSlocal void printstats(int max)
     }
 }
 
+// Prints what changed since the last one: the busiest hosts and service types over the window, and totals.
+// Only the few busiest are picked out, so this stays cheap however many hosts there are.
+mDNSlocal void printrecentstats(const struct timeval *now)
+{
+    const long ms = (now->tv_sec - tv_laststats.tv_sec) * 1000 + (now->tv_usec - tv_laststats.tv_usec) / 1000;
+    const long div = ms ? ms : 1;
+    const int TotPkt = NumPktQ + NumPktL + NumPktR;
+    HostList *lists[2] = { &IPv4HostList, &IPv6HostList };
+    ActivityStat *s;
+    int i, l;
+
+    mprintf("\n--- Last %ld.%03lds: %d packets (%ld/s), %lu bytes (%ld/s) ---\n", ms / 1000, ms % 1000,
+            TotPkt - LastTotPkt, (TotPkt - LastTotPkt) * 1000L / div,
+            NumBytes - LastNumBytes, (long)((NumBytes - LastNumBytes) * 1000UL / div));
+    LastTotPkt = TotPkt;
+    LastNumBytes = NumBytes;
+
+    for (i = 0; i < kReportTopServices; i++)
+    {
+        ActivityStat *m = NULL;
+        for (s = stats; s; s = s->next)
+            if (s->totalops > s->lastops && (!m || s->totalops - s->lastops > m->totalops - m->lastops) &&
+                !s->printed) m = s;
+        if (!m) break;
+        m->printed = mDNStrue;
+        if (i == 0) mprintf("%-25s%8s\n", "Service Type", "Ops");
+        mprintf("%##-25s%8d\n", m->srvtype.c, m->totalops - m->lastops);
+    }
+    for (s = stats; s; s = s->next) { s->printed = 0; s->lastops = s->totalops; }
+
+    for (l = 0; l < 2 && !ExactlyOneFilter; l++)
+    {
+        HostEntry *top[kReportTopHosts];
+        int n = TopHosts(lists[l], top, kReportTopHosts, mDNStrue);
+        long j;
+        for (i = 0; i < n; i++)
+        {
+            HostEntry *e = top[i];
+            if (i == 0) mprintf("%-25s%8s %8s %8s\n", "Source Address", "Pkts", "Bytes", "Pkts/s");
+            mprintf("%#-25a%8lu %8lu %8ld\n", &e->addr, HostEntryRecentPackets(e), e->bytes - e->lastbytes,
+                    (long)(HostEntryRecentPackets(e) * 1000UL / div));
+        }
+        for (j = 0; j < lists[l]->num; j++)
+        {
+            lists[l]->hosts[j].lastpkts  = HostEntryTotalPackets(&lists[l]->hosts[j]);
+            lists[l]->hosts[j].lastbytes = lists[l]->hosts[j].bytes;
+        }
+    }
+    tv_laststats = *now;
+}
+
 mDNSlocal const mDNSu8 *FindUpdate(mDNS *const m, const DNSMessage *const query, const mDNSu8 *ptr, const mDNSu8 *const end,
                                    DNSQuestion *q, LargeCacheRecord *pkt)
 {
@@ -629,7 +746,7 @@ mDNSlocal void DisplayQuery(mDNS *const m, const DNSMessage *const msg, const mD
     const mDNSu8 *ptr = msg->data;
     const mDNSu8 *auth = LocateAuthorities(msg, end);
     mDNSBool MQ = (srcport.NotAnInteger == MulticastDNSPort.NotAnInteger);
-    HostEntry *entry = GotPacketFromHost(srcaddr, MQ ? HostPkt_Q : HostPkt_L, msg->h.id);
+    HostEntry *entry = GotPacketFromHost(srcaddr, MQ ? HostPkt_Q : HostPkt_L, msg->h.id, (mDNSu32)(end - (const mDNSu8 *)msg));
     LargeCacheRecord pkt;
 
     DisplayPacketHeader(m, msg, end, srcaddr, srcport, dstaddr, InterfaceID);
@@ -718,7 +835,7 @@ mDNSlocal void DisplayResponse(mDNS *const m, const DNSMessage *const msg, const
     int i;
     int num_opts = 0;
     const mDNSu8 *ptr = msg->data;
-    HostEntry *entry = GotPacketFromHost(srcaddr, HostPkt_R, msg->h.id);
+    HostEntry *entry = GotPacketFromHost(srcaddr, HostPkt_R, msg->h.id, (mDNSu32)(end - (const mDNSu8 *)msg));
     LargeCacheRecord pkt;
 
     DisplayPacketHeader(m, msg, end, srcaddr, srcport, dstaddr, InterfaceID);
@@ -797,7 +914,7 @@ mDNSlocal void ProcessUnicastResponse(mDNS *const m, const DNSMessage *const msg
 {
     int i;
     const mDNSu8 *ptr = LocateAnswers(msg, end);
-    HostEntry *entry = GotPacketFromHost(srcaddr, HostPkt_R, msg->h.id);
+    HostEntry *entry = GotPacketFromHost(srcaddr, HostPkt_R, msg->h.id, (mDNSu32)(end - (const mDNSu8 *)msg));
     //mprintf("%#a R\n", srcaddr);
 
     for (i=0; i<msg->h.numAnswers + msg->h.numAuthorities + msg->h.numAdditionals; i++)
@@ -839,6 +956,7 @@ mDNSexport void mDNSCoreReceive(mDNS *const m, DNSMessage *const msg, const mDNS
     if (!goodinterface) goodinterface = (FilterInterface == (int)mDNSPlatformInterfaceIndexfromInterfaceID(m, InterfaceID, mDNSfalse));
     if (goodinterface && AddressMatchesFilterList(srcaddr))
     {
+        NumBytes += (unsigned long)(end - (const mDNSu8 *)msg);
         mDNS_Lock(m);
         if (!mDNSAddrIsDNSMulticast(dstaddr))
         {
@@ -852,7 +970,7 @@ mDNSexport void mDNSCoreReceive(mDNS *const m, DNSMessage *const msg, const mDNS
             else
             {
                 debugf("Unknown DNS packet type %02X%02X (ignored)", msg->h.flags.b[0], msg->h.flags.b[1]);
-                GotPacketFromHost(srcaddr, HostPkt_B, msg->h.id);
+                GotPacketFromHost(srcaddr, HostPkt_B, msg->h.id, (mDNSu32)(end - (const mDNSu8 *)msg));
                 NumPktB++;
             }
         }
@@ -875,6 +993,7 @@ mDNSlocal mStatus mDNSNetMonitor(void)
     if (status) return(status);
 
     gettimeofday(&tv_start, NULL);
+    tv_laststats = tv_start;
 
 #if defined( WIN32 )
     status = SetupInterfaceList(&mDNSStorage);
@@ -894,6 +1013,16 @@ mDNSlocal mStatus mDNSNetMonitor(void)
     {
         struct timeval timeout = { FutureTime, 0 };     // wait until SIGINT or SIGTERM
         mDNSBool gotSomething;
+        if (StatsInterval)                              // or it's time for the next -stats report
+        {
+            struct timeval now;
+            long ms;
+            gettimeofday(&now, NULL);
+            ms = StatsInterval * 1000L - ((now.tv_sec - tv_laststats.tv_sec) * 1000 + (now.tv_usec - tv_laststats.tv_usec) / 1000);
+            if (ms <= 0) { printrecentstats(&now); ms = StatsInterval * 1000L; }
+            timeout.tv_sec  = ms / 1000;
+            timeout.tv_usec = (ms % 1000) * 1000;
+        }
         mDNSPosixRunEventLoopOnce(&mDNSStorage, &timeout, &signals, &gotSomething);
     }
     while ( !( sigismember( &signals, SIGINT) || sigismember( &signals, SIGTERM)));
@@ -986,6 +1115,12 @@ mDNSexport int main(int argc, char **argv)
             printf("Monitoring interface %d/%s\n", FilterInterface, argv[i+1]);
 			i += 1;
         }
+        else if (i+1 < argc && !strcmp(argv[i], "-stats"))
+        {
+            StatsInterval = atoi(argv[i+1]);
+            if (StatsInterval <= 0) goto usage;
+            i += 1;
+        }
         else if (!strcmp(argv[i], "-6"))
         {
             AddressType = mDNSAddrType_IPv6;
@@ -1026,9 +1161,10 @@ mDNSexport int main(int argc, char **argv)
 
 usage:
     fprintf(stderr, "\nmDNS traffic monitor\n");
-    fprintf(stderr, "Usage: %s [-i index] [-6] [host]\n", progname);
+    fprintf(stderr, "Usage: %s [-i index] [-6] [-stats seconds] [host]\n", progname);
     fprintf(stderr, "Optional [-i index] parameter displays only packets from that interface index\n");
 	fprintf(stderr, "Optional [-6] parameter displays only ipv6 packets (defaults to only ipv4 packets)\n");
+    fprintf(stderr, "Optional [-stats seconds] parameter also reports the busiest hosts and service types over each interval\n");
     fprintf(stderr, "Optional [host] parameter displays only packets from that host\n");
 
     fprintf(stderr, "\nPer-packet header output:\n");
@@ -37,6 +37,10 @@
 #include <pwd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <pthread.h>
 
 #if __APPLE__
 #undef daemon
@@ -49,6 +53,7 @@ extern int daemon(int, int);
 #include "uds_daemon.h"
 #include "PlatformCommon.h"
 #include "posix_utilities.h"    // For getLocalTimestamp()
+#include "dnssd_sharedcache.h"
 
 #define CONFIG_FILE "/etc/mdnsd.conf"
 static domainname DynDNSZone;                // Default wide-area zone for service registration
@@ -58,6 +63,70 @@ static domainname DynDNSHostname;
 static CacheEntity gRRCache[RR_CACHE_SIZE];
 static mDNS_PlatformSupport PlatformStorage;
 
+// Optional cache snapshot file (-cachefile). It's opened while we're still root and kept open,
+// so that we can still rewrite it at exit after we've switched to running as "nobody".
+static int gCacheFileFD = -1;
+
+static mDNSBool gExecuteProfiling = mDNSfalse;
+static int gCachePartitionQuota = -1;        // -cachequota <percent>; negative to keep the core's default
+static mDNSu32 gCacheMemLimit = 0;          // -cachelimit <KB> and -authlimit <KB>; zero for no limit
+static mDNSBool gResponseFilter = mDNSfalse;  // -filterresponses: don't cache responses about names we've no use for
+static mDNSu32 gPassiveCacheBudget = 0;     // -passivecache <records/s>: cache that many of them anyway
+static mDNSu32 gAuthMemLimit = 0;
+static mDNSu32 gConnectionReplyCap = DefaultConnectionReplyCap;  // -replycap <KB> and -processreplycap <KB>; zero for no cap
+static mDNSu32 gProcessReplyCap = DefaultProcessReplyCap;
+static mDNSBool gCoalesceReplies = mDNSfalse;                     // -coalescereplies
+
+// Optional ring of recent packets (-packetring <count>), written to -packetfile as pcapng on SIGUSR2.
+// Like the cache file, the capture file is opened up front so we can still write it as "nobody".
+static mDNSu32 gPacketRingCount = 0;
+static const char *gPacketRingPath = "/tmp/mdnsd.pcapng";
+static int gPacketRingFD = -1;
+
+// Optional read-only export of cached addresses for local resolvers (-sharedcache, see dnssd_sharedcache.h).
+// The table is created up front too, and refreshed from the cache once a second.
+static mDNSBool gSharedCacheEnabled = mDNSfalse;
+static const char *gSharedCachePath = DNSSD_SHARED_CACHE_PATH;
+static dnssd_shared_cache *gSharedCache = NULL;
+static mDNSs32 gSharedCacheNextPublish;
+static mDNSu32 gSharedCacheGeneration = 0;
+static mDNSu32 gSharedCacheDropped = 0;     // Addresses left out because their probe sequence was full
+
+// Optional /etc/hosts entries as LocalOnly records (-etchosts, or -etchostsfile <path> for another file), checked
+// for changes every EtcHostsCheckSeconds and on SIGHUP
+#define EtcHostsCheckSeconds 5
+static const char *gEtcHostsPath = NULL;
+static mDNSs32 gEtcHostsNextCheck;
+
+// SIGUSR1 state dumps are written a section at a time between turns of the event loop (see DumpStateLogContinue).
+// -statesections <cache,records,questions,clients,misc> and -statefilter <domain> narrow them down.
+static mDNSu32 gStateDumpSections = kInfoSection_All;
+static domainname gStateDumpFilter;
+static mDNSBool gStateDumpInProgress = mDNSfalse;
+
+// Startup is timed a phase at a time from the start of main(), and the times logged once we're ready for clients
+#define MaxStartupPhases 10
+static struct timespec gStartupBegan;
+static struct timespec gStartupPhaseBegan;
+static struct { const char *name; mDNSu32 us; } gStartupPhases[MaxStartupPhases];
+static int gStartupPhaseCount = 0;
+
+// Startup work that doesn't touch the core, done on a helper thread while mDNS_Init() sets up sockets and interfaces:
+// reading in the cache snapshot, and looking up the "nobody" account (which may mean asking a directory service)
+typedef struct
+{
+    pthread_t thread;
+    mDNSBool started;
+    mDNSu8 *snapshot;
+    ssize_t snapshotlen;
+    mDNSBool havenobody;
+    uid_t uid;
+    gid_t gid;
+} StartupPrefetch;
+static StartupPrefetch gPrefetch;
+
+extern mDNSBool ParallelSearchDomains;
+
 mDNSlocal void mDNS_StatusCallback(mDNS *const m, mStatus result)
 {
     (void)m; // Unused
@@ -75,9 +144,9 @@ mDNSlocal void mDNS_StatusCallback(mDNS *const m, mStatus result)
     }
     else if (result == mStatus_GrowCache)
     {
-        // Allocate another chunk of cache storage
-        CacheEntity *storage = malloc(sizeof(CacheEntity) * RR_CACHE_SIZE);
-        if (storage) mDNS_GrowCache(m, storage, RR_CACHE_SIZE);
+        // Allocate another chunk of cache storage, which the core hands back once it's no longer needed
+        CacheEntity *storage = mallocL("CacheEntity storage", sizeof(CacheEntity) * RR_CACHE_SIZE);
+        if (storage) mDNS_GrowCacheReleasable(m, storage, RR_CACHE_SIZE);
     }
 }
 
@@ -96,18 +165,221 @@ static void Reconfigure(mDNS *m)
     mDNSPlatformSourceAddrForDest(&DynDNSIP, &dummy);
     if (DynDNSHostname.c[0]) mDNS_AddDynDNSHostName(m, &DynDNSHostname, NULL, NULL);
     if (DynDNSIP.type) mDNS_SetPrimaryInterfaceInfo(m, &DynDNSIP, NULL, NULL);
+    if (gEtcHostsPath) mDNSPosixUpdateEtcHosts(m, gEtcHostsPath);
     mDNS_ConfigChanged(m);
 }
 
+mDNSlocal mDNSu32 ParseStateDumpSections(const char *list)
+{
+    static const struct { const char *name; mDNSu32 section; } names[] =
+    {
+        { "cache", kInfoSection_Cache }, { "records", kInfoSection_Records }, { "questions", kInfoSection_Questions },
+        { "clients", kInfoSection_Clients }, { "misc", kInfoSection_Misc }, { "all", kInfoSection_All }
+    };
+    mDNSu32 sections = 0;
+    while (*list)
+    {
+        const size_t len = strcspn(list, ",");
+        size_t i;
+        for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+            if (strlen(names[i].name) == len && !strncmp(list, names[i].name, len)) sections |= names[i].section;
+        list += len;
+        if (*list) list++;
+    }
+    return sections;
+}
+
+// Builds the table in a temporary file and renames it into place, so a client never maps a half-initialised one.
+// The directory may be writable by others (e.g. -sharedcachefile under /tmp), so the temporary file gets a name no
+// one can guess and is created with O_EXCL by mkstemp, rather than following whatever someone has left at that path.
+mDNSlocal void CreateSharedCache(void)
+{
+    char tmp[1024];
+    void *p = MAP_FAILED;
+    int fd;
+
+    mDNS_snprintf(tmp, sizeof(tmp), "%s.XXXXXX", gSharedCachePath);
+    fd = mkstemp(tmp);
+    if (fd >= 0 && fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH) == 0 && ftruncate(fd, sizeof(dnssd_shared_cache)) == 0)
+        p = mmap(NULL, sizeof(dnssd_shared_cache), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p != MAP_FAILED)
+    {
+        gSharedCache = (dnssd_shared_cache *)p;
+        gSharedCache->magic     = DNSSD_SHARED_CACHE_MAGIC;
+        gSharedCache->version   = DNSSD_SHARED_CACHE_VERSION;
+        gSharedCache->slots     = DNSSD_SHARED_CACHE_SLOTS;
+        gSharedCache->slot_size = sizeof(dnssd_shared_cache_slot);
+        __atomic_store_n(&gSharedCache->open, 1, __ATOMIC_RELEASE);
+    }
+    if (!gSharedCache || rename(tmp, gSharedCachePath) < 0)
+    {
+        LogMsg("Could not create shared cache %s: %s", gSharedCachePath, strerror(errno));
+        if (gSharedCache) { munmap(gSharedCache, sizeof(dnssd_shared_cache)); gSharedCache = NULL; }
+        if (fd >= 0) unlink(tmp);
+    }
+    if (fd >= 0) close(fd);
+}
+
+mDNSlocal mDNSu32 SharedCacheNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (mDNSu32)ts.tv_sec;
+}
+
+mDNSlocal void SharedCacheWriteBegin(dnssd_shared_cache_slot *s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+mDNSlocal void SharedCacheWriteEnd(dnssd_shared_cache_slot *s)
+{
+    __atomic_store_n(&s->seq, s->seq + 1, __ATOMIC_RELEASE);
+}
+
+// mDNS_CachedAddressCallback: refreshes this record's slot, or claims a free one for it
+mDNSlocal void SharedCachePublishRecord(void *context, const ResourceRecord *rr, mDNSu32 ifindex, mDNSu32 remain)
+{
+    const mDNSu32 expires = *(const mDNSu32 *)context + remain;
+    const mDNSu8 *const addr = (rr->rrtype == kDNSType_A) ? rr->rdata->u.ipv4.b : rr->rdata->u.ipv6.b;
+    const mDNSu32 addrlen = (rr->rrtype == kDNSType_A) ? 4 : 16;
+    dnssd_shared_cache_slot *freeslot = mDNSNULL;
+    char name[MAX_ESCAPED_DOMAIN_NAME];
+    mDNSu32 hash, len, i;
+
+    ConvertDomainNameToCString(rr->name, name);
+    for (len = 0; name[len]; len++) name[len] = (name[len] >= 'A' && name[len] <= 'Z') ? (char)(name[len] + 'a' - 'A') : name[len];
+    if (len && name[len - 1] == '.') name[--len] = 0;
+    if (!len || len >= DNSSD_SHARED_CACHE_NAMELEN) return;
+
+    hash = DNSSDSharedCacheHash(name, rr->rrtype);
+    for (i = 0; i < DNSSD_SHARED_CACHE_PROBES; i++)
+    {
+        dnssd_shared_cache_slot *const s = &gSharedCache->slot[(hash + i) & (DNSSD_SHARED_CACHE_SLOTS - 1)];
+        if (!s->rrtype || !s->expires)
+        {
+            if (!freeslot) freeslot = s;
+            if (!s->rrtype) break;
+            continue;
+        }
+        if (s->hash == hash && s->rrtype == rr->rrtype && s->ifindex == ifindex &&
+            mDNSPlatformMemSame(s->addr, addr, addrlen) && !strcmp(s->name, name))
+        {
+            s->generation = gSharedCacheGeneration;
+            if (s->expires != expires) { SharedCacheWriteBegin(s); s->expires = expires; SharedCacheWriteEnd(s); }
+            return;
+        }
+    }
+    if (!freeslot) { gSharedCacheDropped++; return; }
+
+    SharedCacheWriteBegin(freeslot);
+    freeslot->hash       = hash;
+    freeslot->expires    = expires;
+    freeslot->ifindex    = ifindex;
+    freeslot->rrtype     = rr->rrtype;
+    freeslot->generation = gSharedCacheGeneration;
+    mDNSPlatformMemZero(freeslot->addr, sizeof(freeslot->addr));
+    mDNSPlatformMemCopy(freeslot->addr, addr, addrlen);
+    mDNSPlatformMemCopy(freeslot->name, name, len + 1);
+    SharedCacheWriteEnd(freeslot);
+}
+
+// Brings the table up to date with the cache, then frees the slots of records that weren't seen this time round
+mDNSlocal void PublishSharedCache(mDNS *m)
+{
+    const mDNSu32 now = SharedCacheNow();
+    mDNSu32 i;
+
+    gSharedCacheGeneration++;
+    mDNS_ForEachCachedAddress(m, SharedCachePublishRecord, (void *)&now);
+    for (i = 0; i < DNSSD_SHARED_CACHE_SLOTS; i++)
+    {
+        dnssd_shared_cache_slot *const s = &gSharedCache->slot[i];
+        if (s->expires && s->generation != gSharedCacheGeneration)
+        {
+            SharedCacheWriteBegin(s);
+            s->expires = 0;
+            SharedCacheWriteEnd(s);
+        }
+    }
+    __atomic_store_n(&gSharedCache->published, now, __ATOMIC_RELEASE);
+}
+
+mDNSlocal void CloseSharedCache(void)
+{
+    if (!gSharedCache) return;
+    __atomic_store_n(&gSharedCache->open, 0, __ATOMIC_RELEASE);
+    munmap(gSharedCache, sizeof(dnssd_shared_cache));
+    gSharedCache = NULL;
+    // If we're running as "nobody" we may not be allowed to remove it; clients go by the open flag anyway
+    (void)unlink(gSharedCachePath);
+    if (gSharedCacheDropped) LogMsg("Shared cache: %u addresses did not fit", gSharedCacheDropped);
+}
+
 // Do appropriate things at startup with command line arguments. Calls exit() if unhappy.
 mDNSlocal void ParseCmdLinArgs(int argc, char **argv)
 {
-    if (argc > 1)
+    int i;
+    for (i = 1; i < argc; i++)
+    {
+        if (0 == strcmp(argv[i], "-debug")) mDNS_DebugMode = mDNStrue;
+        else if (0 == strcmp(argv[i], "-profile")) gExecuteProfiling = mDNStrue;
+        else if (0 == strcmp(argv[i], "-cachefile") && i + 1 < argc)
+        {
+            // Open before daemon() changes our working directory, so relative paths work as expected
+            gCacheFileFD = open(argv[++i], O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+            if (gCacheFileFD < 0) LogMsg("Could not open cache file %s: %s", argv[i], strerror(errno));
+        }
+        else if (0 == strcmp(argv[i], "-cachequota") && i + 1 < argc) gCachePartitionQuota = atoi(argv[++i]);
+        else if (0 == strcmp(argv[i], "-filterresponses")) gResponseFilter = mDNStrue;
+        else if (0 == strcmp(argv[i], "-passivecache") && i + 1 < argc) gPassiveCacheBudget = (mDNSu32)strtoul(argv[++i], NULL, 10);
+        else if (0 == strcmp(argv[i], "-cachelimit") && i + 1 < argc) gCacheMemLimit = (mDNSu32)strtoul(argv[++i], NULL, 10) * 1024;
+        else if (0 == strcmp(argv[i], "-authlimit") && i + 1 < argc) gAuthMemLimit = (mDNSu32)strtoul(argv[++i], NULL, 10) * 1024;
+        else if (0 == strcmp(argv[i], "-replycap") && i + 1 < argc) gConnectionReplyCap = (mDNSu32)strtoul(argv[++i], NULL, 10) * 1024;
+        else if (0 == strcmp(argv[i], "-processreplycap") && i + 1 < argc) gProcessReplyCap = (mDNSu32)strtoul(argv[++i], NULL, 10) * 1024;
+        else if (0 == strcmp(argv[i], "-coalescereplies")) gCoalesceReplies = mDNStrue;
+        else if (0 == strcmp(argv[i], "-iouring")) PlatformStorage.UseIoUring = mDNStrue;
+        else if (0 == strcmp(argv[i], "-packetring") && i + 1 < argc) gPacketRingCount = (mDNSu32)strtoul(argv[++i], NULL, 10);
+        else if (0 == strcmp(argv[i], "-packetfile") && i + 1 < argc) gPacketRingPath = argv[++i];
+        else if (0 == strcmp(argv[i], "-sharedcache")) gSharedCacheEnabled = mDNStrue;
+        else if (0 == strcmp(argv[i], "-sharedcachefile") && i + 1 < argc) gSharedCachePath = argv[++i];
+        else if (0 == strcmp(argv[i], "-etchosts")) gEtcHostsPath = "/etc/hosts";
+        else if (0 == strcmp(argv[i], "-etchostsfile") && i + 1 < argc) gEtcHostsPath = argv[++i];
+        else if (0 == strcmp(argv[i], "-strictorder")) StrictUnicastOrdering = mDNStrue;
+        else if (0 == strcmp(argv[i], "-raceservers")) RaceUnicastServers = mDNStrue;
+        else if (0 == strcmp(argv[i], "-noprefetch")) PrefetchUnicastAnswers = mDNSfalse;
+        else if (0 == strcmp(argv[i], "-servestale")) ServeStaleUnicastAnswers = mDNStrue;
+        else if (0 == strcmp(argv[i], "-parallelsearch")) ParallelSearchDomains = mDNStrue;
+        else if (0 == strcmp(argv[i], "-statesections") && i + 1 < argc) gStateDumpSections = ParseStateDumpSections(argv[++i]);
+        else if (0 == strcmp(argv[i], "-statefilter") && i + 1 < argc)
+        {
+            if (!MakeDomainNameFromDNSNameString(&gStateDumpFilter, argv[++i]))
+                LogMsg("Bad -statefilter domain %s", argv[i]);
+        }
+        // -interfaces and -socket let several mdnsd processes share a host with many interfaces between them,
+        // each one owning some of the interfaces and serving the clients that point DNSSD_UDS_PATH at its socket
+        else if (0 == strcmp(argv[i], "-interfaces") && i + 1 < argc) PlatformStorage.OnlyInterfaces = argv[++i];
+#if !defined(USE_TCP_LOOPBACK)
+        else if (0 == strcmp(argv[i], "-socket") && i + 1 < argc) udsserver_set_path(argv[++i]);
+#endif
+        else printf("Usage: %s [-debug] [-profile] [-cachefile <path>] [-cachequota <percent>]"
+                    " [-cachelimit <KB>] [-authlimit <KB>] [-filterresponses] [-passivecache <records/s>]"
+                    " [-replycap <KB>] [-processreplycap <KB>] [-coalescereplies] [-iouring]"
+                    " [-packetring <count>] [-packetfile <path>] [-sharedcache] [-sharedcachefile <path>]"
+                    " [-etchosts] [-etchostsfile <path>] [-interfaces <name,...>] [-socket <path>]"
+                    " [-strictorder] [-raceservers] [-noprefetch] [-servestale] [-parallelsearch]"
+                    " [-statesections <section,...>] [-statefilter <domain>]\n", argv[0]);
+    }
+
+    if (gPacketRingCount)
     {
-        if (0 == strcmp(argv[1], "-debug")) mDNS_DebugMode = mDNStrue;
-        else printf("Usage: %s [-debug]\n", argv[0]);
+        gPacketRingFD = open(gPacketRingPath, O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
+        if (gPacketRingFD < 0) LogMsg("Could not open packet capture file %s: %s", gPacketRingPath, strerror(errno));
     }
 
+    if (gSharedCacheEnabled) CreateSharedCache();
+
     if (!mDNS_DebugMode)
     {
         int result = daemon(0, 0);
@@ -119,22 +391,164 @@ mDNSlocal void ParseCmdLinArgs(int argc, char **argv)
     }
 }
 
-mDNSlocal void DumpStateLog()
-// Dump a little log of what we've been up to.
+mDNSlocal void DumpStateLogHeader(const char *what)
 {
     char timestamp[64]; // 64 is enough to store the UTC timestmp
-    
     mDNSu32 major_version = _DNS_SD_H / 10000;
     mDNSu32 minor_version1 = (_DNS_SD_H - major_version * 10000) / 100;
     mDNSu32 minor_version2 = _DNS_SD_H % 100;
 
     getLocalTimestamp(timestamp, sizeof(timestamp));
-    LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEFAULT, "---- BEGIN STATE LOG ---- (%s mDNSResponder Build %d.%02d.%02d)", timestamp, major_version, minor_version1, minor_version2);
+    LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEFAULT, "---- %s STATE LOG ---- (%s mDNSResponder Build %d.%02d.%02d)", what, timestamp, major_version, minor_version1, minor_version2);
+}
 
-    udsserver_info_dump_to_fd(STDERR_FILENO);
+mDNSlocal void DumpStateLog()
+// Dump a little log of what we've been up to. Only the header is written here; the rest follows a piece at a
+// time from DumpStateLogContinue(), so a large cache doesn't stall packet processing while it's written out.
+{
+    if (gStateDumpInProgress) { LogMsg("State dump already in progress; ignoring SIGUSR1"); return; }
+    DumpStateLogHeader("BEGIN");
+    gStateDumpInProgress = udsserver_info_dump_start(STDERR_FILENO, gStateDumpSections, &gStateDumpFilter);
+    if (!gStateDumpInProgress) DumpStateLogHeader("END");
+}
 
-    getLocalTimestamp(timestamp, sizeof(timestamp));
-    LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEFAULT, "---- END STATE LOG ---- (%s mDNSResponder Build %d.%02d.%02d)", timestamp, major_version, minor_version1, minor_version2);
+mDNSlocal void DumpStateLogContinue()
+{
+    if (udsserver_info_dump_continue()) return;
+    gStateDumpInProgress = mDNSfalse;
+    if (mDNSStorage.p->SendBatchFlushes)
+        LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEFAULT, "Send batches: %u flushed, %u packets (%u per batch, largest %u), %u sendmmsg calls",
+            mDNSStorage.p->SendBatchFlushes, mDNSStorage.p->SendBatchPackets,
+            mDNSStorage.p->SendBatchPackets / mDNSStorage.p->SendBatchFlushes, mDNSStorage.p->SendBatchLargest,
+            mDNSStorage.p->SendBatchSyscalls);
+    if (mDNSStorage.p->UringReceives || mDNSStorage.p->UringClientBatches)
+        LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEFAULT, "io_uring: %u packets received, %u receives rearmed (%u out of buffers), "
+            "%u client writes in %u batches",
+            mDNSStorage.p->UringReceives, mDNSStorage.p->UringRearms, mDNSStorage.p->UringStarved,
+            mDNSStorage.p->UringClientWrites, mDNSStorage.p->UringClientBatches);
+    if (mDNSStorage.p->LockContended)
+    {
+        mDNSu32 waited = 0, b;
+        for (b = 1; b < ExecuteHistogramBuckets; b++) waited += mDNSStorage.p->LockWait[b];
+        LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEFAULT, "Platform lock: %u contended acquisitions, %u of them waited a tick or more",
+            mDNSStorage.p->LockContended, waited);
+    }
+    DumpStateLogHeader("END");
+}
+
+mDNSlocal void *StartupPrefetchThread(void *context)
+{
+    StartupPrefetch *const p = (StartupPrefetch *)context;
+    static char pwbuf[16384];
+    struct passwd pwd, *pw = NULL;
+    struct stat st;
+
+    if (gCacheFileFD >= 0 && fstat(gCacheFileFD, &st) == 0 && st.st_size > 0)
+    {
+        p->snapshot = malloc((size_t)st.st_size);
+        if (p->snapshot) p->snapshotlen = pread(gCacheFileFD, p->snapshot, (size_t)st.st_size, 0);
+    }
+    if (getpwnam_r("nobody", &pwd, pwbuf, sizeof(pwbuf), &pw) == 0 && pw)
+    {
+        p->havenobody = mDNStrue;
+        p->uid = pw->pw_uid;
+        p->gid = pw->pw_gid;
+    }
+    return NULL;
+}
+
+mDNSlocal void StartupPrefetchBegin(void)
+{
+    if (pthread_create(&gPrefetch.thread, NULL, StartupPrefetchThread, &gPrefetch) == 0) gPrefetch.started = mDNStrue;
+}
+
+mDNSlocal void StartupPrefetchWait(void)
+{
+    if (gPrefetch.started) pthread_join(gPrefetch.thread, NULL);
+    else StartupPrefetchThread(&gPrefetch);     // Couldn't start the thread, so do it here
+    gPrefetch.started = mDNSfalse;
+}
+
+mDNSlocal mDNSu32 ElapsedUs(const struct timespec *since)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (mDNSu32)((now.tv_sec - since->tv_sec) * 1000000 + (now.tv_nsec - since->tv_nsec) / 1000);
+}
+
+mDNSlocal void StartupPhaseDone(const char *name)
+{
+    if (gStartupPhaseCount < MaxStartupPhases)
+    {
+        gStartupPhases[gStartupPhaseCount].name = name;
+        gStartupPhases[gStartupPhaseCount].us   = ElapsedUs(&gStartupPhaseBegan);
+        gStartupPhaseCount++;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &gStartupPhaseBegan);
+}
+
+mDNSlocal void LogStartupPhases(void)
+{
+    char buffer[512];
+    mDNSu32 len = 0;
+    const mDNSu32 total = ElapsedUs(&gStartupBegan);
+    int i;
+
+    buffer[0] = 0;
+    for (i = 0; i < gStartupPhaseCount && len < sizeof(buffer); i++)
+        len += mDNS_snprintf(buffer + len, sizeof(buffer) - len, "%s%s %u.%03u", i ? ", " : "", gStartupPhases[i].name,
+                             gStartupPhases[i].us / 1000, gStartupPhases[i].us % 1000);
+    LogMsg("Ready for clients %u.%03u ms after starting (ms per phase: %s)", total / 1000, total % 1000, buffer);
+}
+
+mDNSlocal void LoadCacheSnapshot(mDNS *m)
+{
+    if (gPrefetch.snapshot && gPrefetch.snapshotlen > 0)
+        LogMsg("Restored %u records from cache file",
+               mDNS_RestoreCacheSnapshot(m, gPrefetch.snapshot, (mDNSu32)gPrefetch.snapshotlen));
+    free(gPrefetch.snapshot);
+    gPrefetch.snapshot = NULL;
+}
+
+mDNSlocal void SaveCacheSnapshot(mDNS *m)
+{
+    // Worst case per record: interface index, uncompressed name, fixed RR fields, and the largest rdata we cache
+    const size_t length = 16 + (size_t)m->rrcache_totalused * (4 + MAX_DOMAIN_NAME + 10 + MaximumRDSize);
+    mDNSu8 *buffer;
+    mDNSu32 n;
+
+    if (gCacheFileFD < 0) return;
+    buffer = malloc(length);
+    if (!buffer) return;
+    n = mDNS_SnapshotCache(m, buffer, (mDNSu32)length);
+    if (ftruncate(gCacheFileFD, 0) < 0 || pwrite(gCacheFileFD, buffer, n, 0) != (ssize_t)n)
+        LogMsg("Could not write cache file: %s", strerror(errno));
+    free(buffer);
+}
+
+mDNSlocal void WritePacketRingData(void *context, const void *data, mDNSu32 len)
+{
+    int *const fd = (int *)context;
+    if (*fd >= 0 && write(*fd, data, len) != (ssize_t)len)
+    {
+        LogMsg("Could not write packet capture file: %s", strerror(errno));
+        *fd = -1;
+    }
+}
+
+mDNSlocal void DumpPacketRing(mDNS *m)
+{
+    int fd = gPacketRingFD;
+    mDNSu32 n;
+
+    if (!m->PacketRing) { LogMsg("Received SIGUSR2 but not recording packets; use -packetring <count>"); return; }
+    if (fd < 0 || ftruncate(fd, 0) < 0 || lseek(fd, 0, SEEK_SET) < 0)
+    {
+        LogMsg("Could not write packet capture file %s: %s", gPacketRingPath, fd < 0 ? "not open" : strerror(errno));
+        return;
+    }
+    n = mDNS_PacketRingWritePCAP(m, WritePacketRingData, &fd);
+    if (fd >= 0) LogMsg("Wrote %u packets to %s", n, gPacketRingPath);
 }
 
 mDNSlocal mStatus MainLoop(mDNS *m) // Loop until we quit.
@@ -145,8 +559,11 @@ mDNSlocal mStatus MainLoop(mDNS *m) // Loop until we quit.
     mDNSPosixListenForSignalInEventLoop(SIGINT);
     mDNSPosixListenForSignalInEventLoop(SIGTERM);
     mDNSPosixListenForSignalInEventLoop(SIGUSR1);
+    mDNSPosixListenForSignalInEventLoop(SIGUSR2);
     mDNSPosixListenForSignalInEventLoop(SIGPIPE);
     mDNSPosixListenForSignalInEventLoop(SIGHUP) ;
+    gSharedCacheNextPublish = mDNS_TimeNow(m);
+    gEtcHostsNextCheck = mDNS_TimeNow(m) + EtcHostsCheckSeconds * mDNSPlatformOneSecond;   // Reconfigure() loaded it
 
     for (; ;)
     {
@@ -154,24 +571,50 @@ mDNSlocal mStatus MainLoop(mDNS *m) // Loop until we quit.
         struct timeval timeout;
         mDNSs32 ticks;
 
-        // Only idle if we didn't find any data the last time around
-        if (!gotData)
+        // Only idle if we didn't find any data the last time around, unless the core has work that's due,
+        // so that a steady stream of client requests can't hold up our multicast traffic indefinitely
+        if (!gotData || m->NextScheduledEvent - mDNS_TimeNow(m) <= 0)
         {
-            mDNSs32 nextTimerEvent = mDNS_Execute(m);
+            mDNSs32 nextTimerEvent = mDNSPosixExecute(m);
             nextTimerEvent = udsserver_idle(nextTimerEvent);
             ticks = nextTimerEvent - mDNS_TimeNow(m);
             if (ticks < 1) ticks = 1;
         }
         else    // otherwise call EventLoop again with 0 timemout
             ticks = 0;
+        // Don't wait while a state dump has more to write; just pick up whatever has arrived in the meantime
+        if (gStateDumpInProgress) ticks = 0;
+        if (gSharedCache)
+        {
+            if (gSharedCacheNextPublish - mDNS_TimeNow(m) <= 0)
+            {
+                PublishSharedCache(m);
+                gSharedCacheNextPublish = mDNS_TimeNow(m) + mDNSPlatformOneSecond;
+            }
+            if (ticks > gSharedCacheNextPublish - mDNS_TimeNow(m)) ticks = gSharedCacheNextPublish - mDNS_TimeNow(m);
+        }
+        if (gEtcHostsPath)
+        {
+            if (gEtcHostsNextCheck - mDNS_TimeNow(m) <= 0)
+            {
+                mDNSPosixUpdateEtcHosts(m, gEtcHostsPath);
+                gEtcHostsNextCheck = mDNS_TimeNow(m) + EtcHostsCheckSeconds * mDNSPlatformOneSecond;
+            }
+            if (ticks > gEtcHostsNextCheck - mDNS_TimeNow(m)) ticks = gEtcHostsNextCheck - mDNS_TimeNow(m);
+        }
 
         timeout.tv_sec = ticks / mDNSPlatformOneSecond;
         timeout.tv_usec = (ticks % mDNSPlatformOneSecond) * 1000000 / mDNSPlatformOneSecond;
 
+        // Write out what was logged while handling the last batch of events, now that we're about to wait
+        mDNSLogRingDrain();
+
         (void) mDNSPosixRunEventLoopOnce(m, &timeout, &signals, &gotData);
 
         if (sigismember(&signals, SIGHUP )) Reconfigure(m);
         if (sigismember(&signals, SIGUSR1)) DumpStateLog();
+        else if (gStateDumpInProgress) DumpStateLogContinue();
+        if (sigismember(&signals, SIGUSR2)) DumpPacketRing(m);
         // SIGPIPE happens when we try to write to a dead client; death should be detected soon in request_callback() and cleaned up.
         if (sigismember(&signals, SIGPIPE)) LogMsg("Received SIGPIPE - ignoring");
         if (sigismember(&signals, SIGINT) || sigismember(&signals, SIGTERM)) break;
@@ -183,30 +626,60 @@ int main(int argc, char **argv)
 {
     mStatus err;
 
+    clock_gettime(CLOCK_MONOTONIC, &gStartupBegan);
+    gStartupPhaseBegan = gStartupBegan;
     ParseCmdLinArgs(argc, argv);
+    StartupPhaseDone("args");
+
+    // Buffer log messages in a ring so they're formatted and written while idle, not while handling packets
+    if (!mDNSLogRingStart()) LogMsg("Could not allocate log ring; logging synchronously");
 
     LogMsg("%s starting", mDNSResponderVersionString);
 
+    // Take client connections from the start, and get on with what doesn't need the core while it's initialised
+    // (if we can't listen yet, udsserver_init() tries again and reports it)
+    (void)udsserver_listen();
+    StartupPrefetchBegin();
+    StartupPhaseDone("listen");
+
     err = mDNS_Init(&mDNSStorage, &PlatformStorage, gRRCache, RR_CACHE_SIZE, mDNS_Init_AdvertiseLocalAddresses,
                     mDNS_StatusCallback, mDNS_Init_NoInitCallbackContext);
+    StartupPhaseDone("init");
+    StartupPrefetchWait();
+    StartupPhaseDone("prefetch");
 
     if (mStatus_NoError == err)
+    {
+        mDNSStorage.ExecuteProfiling = gExecuteProfiling;
+        if (gCachePartitionQuota >= 0 && gCachePartitionQuota <= 100)
+            mDNSStorage.rrcache_partition_quota = (mDNSu32)gCachePartitionQuota;
+        mDNSStorage.rrcache_mem_limit       = gCacheMemLimit;
+        mDNSStorage.ResponseFilter          = gResponseFilter;
+        mDNSStorage.PassiveCacheBudget      = gPassiveCacheBudget;
+        mDNSStorage.rrauth.rrauth_mem_limit = gAuthMemLimit;
+        if (gPacketRingCount && mDNS_PacketRingInit(&mDNSStorage, gPacketRingCount) != mStatus_NoError)
+            LogMsg("Could not allocate a ring of %u packets", gPacketRingCount);
+        LoadCacheSnapshot(&mDNSStorage);
+        StartupPhaseDone("snapshot");
+        udsserver_set_reply_limits(gConnectionReplyCap, gProcessReplyCap, gCoalesceReplies);
         err = udsserver_init(mDNSNULL, 0);
+        StartupPhaseDone("uds");
+    }
 
     Reconfigure(&mDNSStorage);
+    StartupPhaseDone("config");
 
     // Now that we're finished with anything privileged, switch over to running as "nobody"
     if (mStatus_NoError == err)
     {
-        const struct passwd *pw = getpwnam("nobody");
-        if (pw != NULL)
+        if (gPrefetch.havenobody)
         {
-            if (setgid(pw->pw_gid) < 0)
+            if (setgid(gPrefetch.gid) < 0)
             {
                 LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_ERROR,
                           "WARNING: mdnsd continuing as group root because setgid to \"nobody\" failed with " PUB_S, strerror(errno));
             }
-            if (setuid(pw->pw_uid) < 0)
+            if (setuid(gPrefetch.uid) < 0)
             {
                 LogMsg("WARNING: mdnsd continuing as root because setuid to \"nobody\" failed with %s", strerror(errno));
             }
@@ -217,16 +690,25 @@ int main(int argc, char **argv)
         }
     }
 
+    if (gSharedCache) gSharedCache->pid = (mDNSu32)getpid();    // Now that daemon() has forked
+    StartupPhaseDone("privileges");
     if (mStatus_NoError == err)
+    {
+        LogStartupPhases();
         err = MainLoop(&mDNSStorage);
+    }
 
     LogMsg("%s stopping", mDNSResponderVersionString);
 
+    SaveCacheSnapshot(&mDNSStorage);
+    CloseSharedCache();
     mDNS_Close(&mDNSStorage);
 
     if (udsserver_exit() < 0)
         LogMsg("ExitCallback: udsserver_exit failed");
 
+    mDNSLogRingStop();
+
  #if MDNS_DEBUGMSGS > 0
     printf("mDNSResponder exiting normally with %d\n", err);
  #endif
@@ -258,6 +740,21 @@ mStatus udsSupportRemoveFDFromEventLoop(int fd, void *platform_data)        // N
     return err;
 }
 
+#if UDS_WRITE_READY
+mStatus udsSupportRequestWriteReady(int fd, udsEventCallback callback, void *context, void *platform_data)
+{
+    (void) platform_data;
+    return mDNSPosixRequestWriteEvent(fd, callback, context);
+}
+#endif
+
+#if UDS_WRITE_BATCH
+int udsSupportWriteBatch(const dnssd_sock_t *fds, struct iovec *const *iovs, const int *iovcnts, ssize_t *results, int count)
+{
+    return mDNSPosixWriteBatch(&mDNSStorage, fds, iovs, iovcnts, results, count);
+}
+#endif
+
 mDNSexport void RecordUpdatedNiceLabel(mDNSs32 delay)
 {
     (void)delay;
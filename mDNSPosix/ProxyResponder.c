@@ -24,6 +24,8 @@
 #include <netinet/in.h>         // For INADDR_NONE
 #include <arpa/inet.h>          // For inet_addr()
 #include <netdb.h>              // For gethostbyname()
+#include <fcntl.h>              // For O_NONBLOCK
+#include <sys/time.h>           // For gettimeofday()
 
 #include "mDNSEmbeddedAPI.h"    // Defines the interface to the client layer above
 #include "mDNSPosix.h"          // Defines the specific types needed to run mDNS on this platform
@@ -39,6 +41,7 @@
 mDNS mDNSStorage;       // mDNS core uses this to store its globals
 static mDNS_PlatformSupport PlatformStorage;  // Stores this platform's globals
 mDNSexport const char ProgramName[] = "mDNSProxyResponderPosix";
+static mDNSBool Verbose = mDNStrue;     // Report each registration; off for bulk mode, which reports progress instead
 
 //*************************************************************************************************************
 // Proxy Host Registration
@@ -65,12 +68,12 @@ mDNSlocal void HostNameCallback(mDNS *const m, AuthRecord *const rr, mStatus res
     }
 }
 
-mDNSlocal mStatus mDNS_RegisterProxyHost(mDNS *m, ProxyHost *p)
+mDNSlocal mStatus mDNS_RegisterProxyHost(mDNS *m, ProxyHost *p, mDNSRecordCallback *callback, void *context)
 {
     char buffer[32];
 
-    mDNS_SetupResourceRecord(&p->RR_A,   mDNSNULL, mDNSInterface_Any, kDNSType_A,   60, kDNSRecordTypeUnique,      AuthRecordAny, HostNameCallback, p);
-    mDNS_SetupResourceRecord(&p->RR_PTR, mDNSNULL, mDNSInterface_Any, kDNSType_PTR, 60, kDNSRecordTypeKnownUnique, AuthRecordAny, HostNameCallback, p);
+    mDNS_SetupResourceRecord(&p->RR_A,   mDNSNULL, mDNSInterface_Any, kDNSType_A,   60, kDNSRecordTypeUnique,      AuthRecordAny, callback, context);
+    mDNS_SetupResourceRecord(&p->RR_PTR, mDNSNULL, mDNSInterface_Any, kDNSType_PTR, 60, kDNSRecordTypeKnownUnique, AuthRecordAny, callback, context);
 
     p->RR_A.namestorage.c[0] = 0;
     AppendDomainLabel(&p->RR_A.namestorage, &p->hostlabel);
@@ -130,7 +133,8 @@ mDNSlocal void ServiceCallback(mDNS *const m, ServiceRecordSet *const sr, mStatu
 // parameters, converts them to domainname parameters, and calls mDNS_RegisterService()
 mDNSlocal void RegisterService(mDNS *m, ServiceRecordSet *recordset,
                                const char name[], const char type[], const char domain[],
-                               const domainname *host, mDNSu16 PortAsNumber, int argc, char **argv)
+                               const domainname *host, mDNSu16 PortAsNumber, int argc, char **argv,
+                               mDNSServiceCallback *callback, void *context)
 {
     domainlabel n;
     domainname t, d;
@@ -144,7 +148,7 @@ mDNSlocal void RegisterService(mDNS *m, ServiceRecordSet *recordset,
     {
         int len = strlen(argv[0]);
         if (len > 255 || bptr + 1 + len >= txtbuffer + sizeof(txtbuffer)) break;
-        printf("STR: %s\n", argv[0]);
+        if (Verbose) printf("STR: %s\n", argv[0]);
         bptr[0] = len;
         strcpy((char*)(bptr+1), argv[0]);
         bptr += 1 + len;
@@ -158,10 +162,10 @@ mDNSlocal void RegisterService(mDNS *m, ServiceRecordSet *recordset,
                          mDNSNULL, txtbuffer, bptr-txtbuffer, // TXT data, length
                          mDNSNULL, 0, // Subtypes
                          mDNSInterface_Any, // Interface ID
-                         ServiceCallback, mDNSNULL, 0); // Callback, context, flags
+                         callback, context, 0); // Callback, context, flags
 
     ConvertDomainNameToCString(recordset->RR_SRV.resrec.name, buffer);
-    printf("Made Service Records for %s\n", buffer);
+    if (Verbose) printf("Made Service Records for %s\n", buffer);
 }
 
 //*************************************************************************************************************
@@ -205,7 +209,8 @@ mDNSlocal void NoSuchServiceCallback(mDNS *const m, AuthRecord *const rr, mStatu
 }
 
 mDNSlocal void RegisterNoSuchService(mDNS *m, AuthRecord *const rr, domainname *proxyhostname,
-                                     const char name[], const char type[], const char domain[])
+                                     const char name[], const char type[], const char domain[],
+                                     mDNSRecordCallback *callback, void *context)
 {
     domainlabel n;
     domainname t, d;
@@ -213,9 +218,389 @@ mDNSlocal void RegisterNoSuchService(mDNS *m, AuthRecord *const rr, domainname *
     MakeDomainLabelFromLiteralString(&n, name);
     MakeDomainNameFromDNSNameString(&t, type);
     MakeDomainNameFromDNSNameString(&d, domain);
-    mDNS_RegisterNoSuchService(m, rr, &n, &t, &d, proxyhostname, mDNSInterface_Any, NoSuchServiceCallback, proxyhostname, 0);
+    mDNS_RegisterNoSuchService(m, rr, &n, &t, &d, proxyhostname, mDNSInterface_Any, callback, context, 0);
     ConvertDomainNameToCString(rr->resrec.name, buffer);
-    printf("Made Non-existence Record for %s\n", buffer);
+    if (Verbose) printf("Made Non-existence Record for %s\n", buffer);
+}
+
+//*************************************************************************************************************
+// Bulk Registration
+//
+// With -f, entries come from a file (or a stream on stdin) rather than the command line, one per line, in the same
+// form as the command line arguments: "ip hostlabel [srvname srvtype port [txt ...]]" or "- hostlabel srvname srvtype",
+// with double quotes around any argument containing spaces, and # starting a comment. New entries are registered
+// BulkBatchSize at a time, one batch each BulkPaceMs: the core probes together whatever records it has waiting, so each
+// batch's probes share packets and the whole set finishes probing in a few seconds, without one burst of thousands.
+// SIGHUP rereads the file, deregistering entries no longer in it and registering new ones; unchanged entries are left
+// alone. On a stream, "del <entry>" deregisters an entry.
+
+#define BulkMaxTokens       64
+#define DefaultBulkBatch    100
+#define DefaultBulkPaceMs   250
+
+typedef struct BulkEntry_struct BulkEntry;
+struct BulkEntry_struct
+{
+    BulkEntry *next;
+    char *line;                 // As read, less surrounding white space; identifies the entry across reloads
+    mDNSu32 hash;               // Of line
+    mDNSBool registered;        // Registration started
+    mDNSBool removed;           // Unlinked; freed once pending reaches zero
+    mDNSBool seen;              // Found again during a reload
+    mDNSBool hostgone;          // Host name lost to a conflict, and its records deregistered
+    int pending;                // Registrations not yet freed by the core
+    int unconfirmed;            // Registrations not yet through probing
+    ProxyHost host;             // For a non-existence assertion, only the host label is used
+    domainname hostname;        // Host name for a non-existence assertion
+    ServiceRecordSet *service;
+    AuthRecord *nosuch;
+};
+
+static BulkEntry *BulkEntries;
+static const char *BulkPath;
+static int BulkBatchSize = DefaultBulkBatch;
+static int BulkPaceMs = DefaultBulkPaceMs;
+static struct timeval BulkNextBatch;
+static int BulkNumEntries, BulkNumActive;
+
+// Splits a line into arguments in place, honouring double quotes (with backslash for a literal quote) and # comments
+mDNSlocal int SplitLine(char *line, char **tokens, int max)
+{
+    char *src = line, *dst = line;
+    int n = 0;
+
+    while (n < max)
+    {
+        while (*src == ' ' || *src == '\t' || *src == '\r' || *src == '\n') src++;
+        if (!*src || *src == '#') break;
+        tokens[n++] = dst;
+        while (*src && *src != ' ' && *src != '\t' && *src != '\r' && *src != '\n')
+        {
+            if (*src != '"') *dst++ = *src++;
+            else
+            {
+                for (src++; *src && *src != '"'; *dst++ = *src++)
+                    if (*src == '\\' && src[1]) src++;
+                if (*src) src++;
+            }
+        }
+        if (*src) src++;
+        *dst++ = 0;
+    }
+    return(n);
+}
+
+mDNSlocal mDNSu32 LineHash(const char *line)
+{
+    mDNSu32 h = 2166136261U;
+    while (*line) h = (h ^ (mDNSu8)*line++) * 16777619U;
+    return(h);
+}
+
+mDNSlocal mDNSBool BulkEntryCheck(char **tokens, int n, mDNSv4Addr *ip)
+{
+    if (n < 2) return(mDNSfalse);
+    if (!strcmp(tokens[0], "-")) return(n == 4);
+    if (n != 2 && (n < 5 || atoi(tokens[4]) < 1 || atoi(tokens[4]) > 65535)) return(mDNSfalse);
+
+    ip->NotAnInteger = inet_addr(tokens[0]);
+    if (ip->NotAnInteger == INADDR_NONE)   // INADDR_NONE is 0xFFFFFFFF
+    {
+        struct hostent *h = gethostbyname(tokens[0]);
+        if (h) ip->NotAnInteger = *(long*)h->h_addr;
+    }
+    return(ip->NotAnInteger != INADDR_NONE);
+}
+
+mDNSlocal void BulkEntryFreed(BulkEntry *e)
+{
+    if (--e->pending || !e->removed) return;
+    free(e->service);
+    free(e->nosuch);
+    free(e->line);
+    free(e);
+}
+
+mDNSlocal void BulkEntryConfirmed(BulkEntry *e)
+{
+    if (--e->unconfirmed) return;
+    if (++BulkNumActive == BulkNumEntries) printf("All %d entries registered and active\n", BulkNumActive);
+}
+
+mDNSlocal void BulkHostCallback(mDNS *const m, AuthRecord *const rr, mStatus result)
+{
+    BulkEntry *e = (BulkEntry *)rr->RecordContext;
+    if (result == mStatus_NoError)
+    {
+        if (rr == &e->host.RR_A) BulkEntryConfirmed(e);
+    }
+    else if (result == mStatus_NameConflict)
+    {
+        // Unlike the single host case we carry on with the others; the core has already deregistered this record
+        char buffer[MAX_ESCAPED_DOMAIN_NAME];
+        ConvertDomainNameToCString(rr->resrec.name, buffer);
+        printf("Host name conflict for %s; giving it up\n", buffer);
+        if (!e->hostgone) mDNS_Deregister(m, (rr == &e->host.RR_A) ? &e->host.RR_PTR : &e->host.RR_A);
+        e->hostgone = mDNStrue;
+        BulkEntryFreed(e);
+    }
+    else if (result == mStatus_MemFree) BulkEntryFreed(e);
+}
+
+mDNSlocal void BulkServiceCallback(mDNS *const m, ServiceRecordSet *const sr, mStatus result)
+{
+    BulkEntry *e = (BulkEntry *)sr->ServiceContext;
+    if (result == mStatus_NoError) BulkEntryConfirmed(e);
+    else if (result == mStatus_NameConflict)
+    {
+        char buffer1[MAX_ESCAPED_DOMAIN_NAME], buffer2[MAX_ESCAPED_DOMAIN_NAME];
+        ConvertDomainNameToCString(sr->RR_SRV.resrec.name, buffer1);
+        mDNS_RenameAndReregisterService(m, sr, mDNSNULL);
+        ConvertDomainNameToCString(sr->RR_SRV.resrec.name, buffer2);
+        printf("Name Conflict! %s renamed as %s\n", buffer1, buffer2);
+    }
+    else if (result == mStatus_MemFree) BulkEntryFreed(e);
+}
+
+mDNSlocal void BulkNoSuchServiceCallback(mDNS *const m, AuthRecord *const rr, mStatus result)
+{
+    BulkEntry *e = (BulkEntry *)rr->RecordContext;
+    if (result == mStatus_NoError) BulkEntryConfirmed(e);
+    else if (result == mStatus_NameConflict)
+    {
+        domainlabel n;
+        domainname t, d;
+        char buffer1[MAX_ESCAPED_DOMAIN_NAME], buffer2[MAX_ESCAPED_DOMAIN_NAME];
+        ConvertDomainNameToCString(rr->resrec.name, buffer1);
+        DeconstructServiceName(rr->resrec.name, &n, &t, &d);
+        IncrementLabelSuffix(&n, mDNStrue);
+        mDNS_RegisterNoSuchService(m, rr, &n, &t, &d, &e->hostname, mDNSInterface_Any, BulkNoSuchServiceCallback, e, 0);
+        ConvertDomainNameToCString(rr->resrec.name, buffer2);
+        printf("Name Conflict! %s renamed as %s\n", buffer1, buffer2);
+    }
+    else if (result == mStatus_MemFree) BulkEntryFreed(e);
+}
+
+mDNSlocal void BulkRegister(mDNS *m, BulkEntry *e)
+{
+    char *tokens[BulkMaxTokens];
+    char *line = strdup(e->line);
+    int n;
+
+    if (!line) return;
+    n = SplitLine(line, tokens, BulkMaxTokens);
+    e->registered = mDNStrue;
+
+    if (!strcmp(tokens[0], "-"))
+    {
+        e->nosuch = calloc(1, sizeof(*e->nosuch));
+        if (e->nosuch)
+        {
+            e->hostname.c[0] = 0;
+            AppendLiteralLabelString(&e->hostname, tokens[1]);
+            AppendLiteralLabelString(&e->hostname, "local");
+            e->pending++;
+            e->unconfirmed++;
+            RegisterNoSuchService(m, e->nosuch, &e->hostname, tokens[2], tokens[3], "local.", BulkNoSuchServiceCallback, e);
+        }
+    }
+    else
+    {
+        MakeDomainLabelFromLiteralString(&e->host.hostlabel, tokens[1]);
+        e->pending += 2;
+        e->unconfirmed++;
+        mDNS_RegisterProxyHost(m, &e->host, BulkHostCallback, e);
+        if (n >= 5 && (e->service = calloc(1, sizeof(*e->service))) != mDNSNULL)
+        {
+            e->pending++;
+            e->unconfirmed++;
+            RegisterService(m, e->service, tokens[2], tokens[3], "local.", e->host.RR_A.resrec.name, atoi(tokens[4]),
+                            n - 5, &tokens[5], BulkServiceCallback, e);
+        }
+    }
+    free(line);
+}
+
+mDNSlocal void BulkDeregister(mDNS *m, BulkEntry *e)
+{
+    e->removed = mDNStrue;
+    if (!e->unconfirmed && e->registered) BulkNumActive--;
+    BulkNumEntries--;
+    if (!e->registered) { e->pending = 1; BulkEntryFreed(e); return; }
+    if (e->pending == 0) { e->pending = 1; BulkEntryFreed(e); return; }   // Every registration already failed
+    if (e->nosuch) mDNS_Deregister(m, e->nosuch);
+    else
+    {
+        if (!e->hostgone)
+        {
+            mDNS_Deregister(m, &e->host.RR_A);
+            mDNS_Deregister(m, &e->host.RR_PTR);
+        }
+        if (e->service) mDNS_DeregisterService(m, e->service);
+    }
+}
+
+// Adds the entry on line, returning it, or returns the existing one if it's already there
+mDNSlocal BulkEntry *BulkAdd(const char *line, int lineno)
+{
+    char *tokens[BulkMaxTokens];
+    char *copy = strdup(line);
+    const mDNSu32 hash = LineHash(line);
+    BulkEntry *e, **p;
+    mDNSv4Addr ip;
+    int n;
+
+    for (p = &BulkEntries; *p; p = &(*p)->next)
+        if ((*p)->hash == hash && !strcmp((*p)->line, line)) { free(copy); return(*p); }
+
+    if (!copy) return(mDNSNULL);
+    n = SplitLine(copy, tokens, BulkMaxTokens);
+    if (!BulkEntryCheck(tokens, n, &ip))
+    {
+        fprintf(stderr, "%s:%d: not a valid entry: %s\n", BulkPath, lineno, line);
+        free(copy);
+        return(mDNSNULL);
+    }
+    free(copy);
+
+    e = calloc(1, sizeof(*e));
+    if (!e || (e->line = strdup(line)) == mDNSNULL) { free(e); return(mDNSNULL); }
+    e->hash = hash;
+    e->host.ip = ip;
+    *p = e;
+    BulkNumEntries++;
+    return(e);
+}
+
+mDNSlocal void BulkRemove(mDNS *m, const char *line)
+{
+    const mDNSu32 hash = LineHash(line);
+    BulkEntry **p;
+    for (p = &BulkEntries; *p; p = &(*p)->next)
+        if ((*p)->hash == hash && !strcmp((*p)->line, line))
+        {
+            BulkEntry *e = *p;
+            *p = e->next;
+            BulkDeregister(m, e);
+            return;
+        }
+}
+
+// Strips surrounding white space, and returns NULL for a blank or comment line
+mDNSlocal char *TrimLine(char *line)
+{
+    char *end = line + strlen(line);
+    while (*line == ' ' || *line == '\t') line++;
+    while (end > line && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n')) *--end = 0;
+    return((*line && *line != '#') ? line : mDNSNULL);
+}
+
+mDNSlocal void BulkLoadFile(mDNS *m)
+{
+    char buf[4096];
+    BulkEntry *e, **p;
+    int lineno = 0;
+    FILE *f = fopen(BulkPath, "r");
+
+    if (!f) { fprintf(stderr, "Could not open %s\n", BulkPath); return; }
+    for (e = BulkEntries; e; e = e->next) e->seen = mDNSfalse;
+    while (fgets(buf, sizeof(buf), f))
+    {
+        char *line = TrimLine(buf);
+        lineno++;
+        if (line && (e = BulkAdd(line, lineno)) != mDNSNULL) e->seen = mDNStrue;
+    }
+    fclose(f);
+
+    for (p = &BulkEntries; *p; )
+    {
+        e = *p;
+        if (e->seen) p = &e->next;
+        else { *p = e->next; BulkDeregister(m, e); }
+    }
+    printf("%s: %d entries\n", BulkPath, BulkNumEntries);
+}
+
+static char StreamBuf[4096];
+static size_t StreamLen;
+
+mDNSlocal void BulkStreamCallback(int fd, void *context)
+{
+    mDNS *const m = (mDNS *)context;
+    char *line, *nl;
+    ssize_t n = read(fd, StreamBuf + StreamLen, sizeof(StreamBuf) - 1 - StreamLen);
+
+    if (n <= 0)
+    {
+        if (n < 0 && (errno == EINTR || errno == EAGAIN)) return;
+        mDNSPosixRemoveFDFromEventLoop(fd);     // End of the stream; carry on serving what we have
+        return;
+    }
+    StreamLen += n;
+    StreamBuf[StreamLen] = 0;
+    for (line = StreamBuf; (nl = strchr(line, '\n')) != mDNSNULL; line = nl + 1)
+    {
+        char *l;
+        *nl = 0;
+        l = TrimLine(line);
+        if (l && !strncmp(l, "del ", 4)) BulkRemove(m, TrimLine(l + 4) ? TrimLine(l + 4) : "");
+        else if (l) BulkAdd(l, 0);
+    }
+    StreamLen -= line - StreamBuf;
+    memmove(StreamBuf, line, StreamLen);
+    if (StreamLen == sizeof(StreamBuf) - 1) StreamLen = 0;     // No line is that long; drop it
+}
+
+// Registers the next batch if one is due, and returns how long until the next one (or FutureTime if none is waiting)
+mDNSlocal struct timeval BulkRunBatch(mDNS *m)
+{
+    struct timeval now, wait = { FutureTime, 0 };
+    BulkEntry *e;
+    int n = 0;
+
+    for (e = BulkEntries; e && e->registered; e = e->next) {}
+    if (!e) return(wait);
+
+    gettimeofday(&now, NULL);
+    if (timercmp(&now, &BulkNextBatch, <))
+    {
+        timersub(&BulkNextBatch, &now, &wait);
+        return(wait);
+    }
+    for (; e && n < BulkBatchSize; e = e->next)
+        if (!e->registered) { BulkRegister(m, e); n++; }
+    printf("Registering %d entries\n", n);
+
+    wait.tv_sec  = BulkPaceMs / 1000;
+    wait.tv_usec = (BulkPaceMs % 1000) * 1000;
+    timeradd(&now, &wait, &BulkNextBatch);
+    return(wait);
+}
+
+mDNSlocal int BulkMain(mDNS *m)
+{
+    sigset_t signals;
+
+    Verbose = mDNSfalse;
+    mDNSPosixListenForSignalInEventLoop(SIGHUP);
+    if (strcmp(BulkPath, "-")) BulkLoadFile(m);
+    else
+    {
+        fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+        mDNSPosixAddFDToEventLoop(STDIN_FILENO, BulkStreamCallback, m);
+    }
+
+    do
+    {
+        struct timeval timeout = BulkRunBatch(m);
+        mDNSBool gotSomething;
+        mDNSPosixRunEventLoopOnce(m, &timeout, &signals, &gotSomething);
+        if (sigismember(&signals, SIGHUP) && strcmp(BulkPath, "-")) BulkLoadFile(m);
+    }
+    while ( !( sigismember( &signals, SIGINT) || sigismember( &signals, SIGTERM)));
+
+    mDNS_Close(m);
+    return(0);
 }
 
 //*************************************************************************************************************
@@ -226,7 +611,19 @@ mDNSexport int main(int argc, char **argv)
     mStatus status;
     sigset_t signals;
 
-    if (argc < 3) goto usage;
+    if (argc >= 3 && !strcmp(argv[1], "-f"))
+    {
+        int i;
+        BulkPath = argv[2];
+        for (i = 3; i + 1 < argc; i += 2)
+        {
+            if      (!strcmp(argv[i], "-batch")) BulkBatchSize = atoi(argv[i+1]);
+            else if (!strcmp(argv[i], "-pace"))  BulkPaceMs    = atoi(argv[i+1]);
+            else goto usage;
+        }
+        if (i != argc || BulkBatchSize < 1 || BulkPaceMs < 0) goto usage;
+    }
+    else if (argc < 3) goto usage;
 
     status = mDNS_Init(&mDNSStorage, &PlatformStorage,
                        mDNS_Init_NoCache, mDNS_Init_ZeroCacheSize,
@@ -237,6 +634,8 @@ mDNSexport int main(int argc, char **argv)
     mDNSPosixListenForSignalInEventLoop(SIGINT);
     mDNSPosixListenForSignalInEventLoop(SIGTERM);
 
+    if (BulkPath) return(BulkMain(&mDNSStorage));
+
     if (!strcmp(argv[1], "-"))
     {
         domainname proxyhostname;
@@ -245,7 +644,8 @@ mDNSexport int main(int argc, char **argv)
         proxyhostname.c[0] = 0;
         AppendLiteralLabelString(&proxyhostname, argv[2]);
         AppendLiteralLabelString(&proxyhostname, "local");
-        RegisterNoSuchService(&mDNSStorage, &proxyrecord, &proxyhostname, argv[3], argv[4], "local.");
+        RegisterNoSuchService(&mDNSStorage, &proxyrecord, &proxyhostname, argv[3], argv[4], "local.",
+                              NoSuchServiceCallback, &proxyhostname);
     }
     else
     {
@@ -266,11 +666,11 @@ mDNSexport int main(int argc, char **argv)
 
         MakeDomainLabelFromLiteralString(&proxyhost.hostlabel, argv[2]);
 
-        mDNS_RegisterProxyHost(&mDNSStorage, &proxyhost);
+        mDNS_RegisterProxyHost(&mDNSStorage, &proxyhost, HostNameCallback, &proxyhost);
 
         if (argc >=6)
             RegisterService(&mDNSStorage, &proxyservice, argv[3], argv[4], "local.",
-                            proxyhost.RR_A.resrec.name, atoi(argv[5]), argc-6, &argv[6]);
+                            proxyhost.RR_A.resrec.name, atoi(argv[5]), argc-6, &argv[6], ServiceCallback, mDNSNULL);
     }
 
     do
@@ -296,5 +696,9 @@ usage:
     fprintf(stderr, "e.g. %s 169.254.12.34 thehost                                (just create a dot-local host name)\n", argv[0]);
     fprintf(stderr, "or   %s 169.254.12.34 thehost \"My Printer\" _printer._tcp. 515 rp=lpt1 pdl=application/postscript\n", argv[0]);
     fprintf(stderr, "or   %s -             thehost \"My Printer\" _printer._tcp.           (assertion of non-existence)\n", argv[0]);
+    fprintf(stderr, "or   %s -f file [-batch count] [-pace ms]\n", argv[0]);
+    fprintf(stderr, "          Register every entry in file, one per line in the same form as the arguments above, \"count\"\n");
+    fprintf(stderr, "          (default %d) at a time every \"ms\" (default %d); SIGHUP rereads the file. With \"-\" for file,\n", DefaultBulkBatch, DefaultBulkPaceMs);
+    fprintf(stderr, "          entries are read from stdin as they arrive, and a line \"del <entry>\" deregisters one\n");
     return(-1);
 }
@@ -0,0 +1,508 @@
+/* -*- Mode: C; tab-width: 4 -*-
+ *
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * mDNSReplayPcap reads a capture of multicast DNS traffic and feeds every UDP 5353 payload in it to
+ * mDNSCoreReceive(), on a fake interface whose sockets are closed, so nothing the core sends in reply
+ * goes on the wire. It is linked against a POSIX_VIRTUAL_TIME build of mDNSPosix.c, and the virtual clock
+ * follows the capture's timestamps, with mDNS_Execute() run for every event the core schedules in between,
+ * so a given capture always drives the core through the same sequence of states. Packets go in as fast as
+ * possible, or paced in real time with -r. The report gives throughput, the cache size over time, and the
+ * CPU time spent on queries, responses and scheduled work, plus the packets that cost the most.
+ */
+
+#include <stdio.h>          // For printf()
+#include <stdlib.h>         // For malloc()
+#include <string.h>         // For memcpy()
+#include <time.h>           // For clock_gettime(), nanosleep()
+#include <errno.h>
+
+#include "mDNSEmbeddedAPI.h"// Defines the interface to the client layer above
+#include "mDNSPosix.h"      // Defines the specific types needed to run mDNS on this platform
+
+#if !POSIX_VIRTUAL_TIME
+#error ReplayPcap.c must be built with POSIX_VIRTUAL_TIME, and linked against mDNSPosix.c built the same way
+#endif
+
+//*************************************************************************************************************
+// Globals
+
+mDNS mDNSStorage;                       // mDNS core uses this to store its globals
+static mDNS_PlatformSupport PlatformStorage;    // Stores this platform's globals
+mDNSexport const char ProgramName[] = "mDNSReplayPcap";
+
+#define RR_CACHE_SIZE           500
+#define ReplayTopPackets        10      // Most expensive packets listed in the report
+#define ReplayMaxBrowses        16
+#define ReplayStartTime         0x10000 // Virtual time of the first packet in the capture
+
+static CacheEntity gRRCache[RR_CACHE_SIZE];
+static PosixNetworkInterface gReplayIntf4, gReplayIntf6;
+static DNSQuestion gBrowses[ReplayMaxBrowses];
+static unsigned long gBrowseAdds, gBrowseRemoves;
+
+typedef struct
+{
+    FILE    *file;
+    mDNSBool swapped;                   // File was written with the opposite byte order
+    mDNSBool nanosecond;                // Timestamps have nanosecond rather than microsecond resolution
+    mDNSu32  linktype;
+    mDNSu32  frame;                     // One-based number of the frame last read
+    mDNSu32  sec, frac;                 // Timestamp of the frame last read
+    mDNSu32  len;                       // Captured length of the frame last read
+    mDNSu8   data[65536];
+} ReplayCapture;
+
+typedef struct
+{
+    mDNSu32 frame;
+    mDNSu32 len;
+    mDNSBool query;
+    double  ns;
+} ReplayCostlyPacket;
+
+typedef struct
+{
+    double  receiveQueryNs, receiveResponseNs, executeNs;
+    mDNSu32 queries, responses, executes;
+    mDNSu32 frames, skipped;
+    unsigned long long bytes;
+    ReplayCostlyPacket top[ReplayTopPackets];
+} ReplayStats;
+
+static ReplayStats gStats;
+
+//*************************************************************************************************************
+// Capture file reading
+
+// BonjourTop's CCaptureFile does the same job, but it is C++ and wants BonjourTop's own Frame class,
+// so the classic pcap format (the one tcpdump writes) is read directly here. pcapng isn't supported.
+
+#define PCAP_MAGIC          0xa1b2c3d4
+#define PCAP_MAGIC_NSEC     0xa1b23c4d
+
+#define LINKTYPE_NULL       0
+#define LINKTYPE_ETHERNET   1
+#define LINKTYPE_RAW_OLD    12
+#define LINKTYPE_RAW_BSD    14
+#define LINKTYPE_RAW        101
+#define LINKTYPE_LINUX_SLL  113
+#define LINKTYPE_IPV4       228
+#define LINKTYPE_IPV6       229
+#define LINKTYPE_LINUX_SLL2 276
+
+mDNSlocal mDNSu32 CaptureU32(const ReplayCapture *const cap, const mDNSu8 *const p)
+{
+    if (cap->swapped) return ((mDNSu32)p[3] << 24 | (mDNSu32)p[2] << 16 | (mDNSu32)p[1] << 8 | p[0]);
+    else              return ((mDNSu32)p[0] << 24 | (mDNSu32)p[1] << 16 | (mDNSu32)p[2] << 8 | p[3]);
+}
+
+mDNSlocal mDNSBool CaptureOpen(ReplayCapture *const cap, const char *const path)
+{
+    mDNSu8 header[24];
+    mDNSu32 magic;
+
+    cap->file = fopen(path, "rb");
+    if (!cap->file) { fprintf(stderr, "%s: can't open %s: %s\n", ProgramName, path, strerror(errno)); return mDNSfalse; }
+    if (fread(header, sizeof(header), 1, cap->file) != 1) { fprintf(stderr, "%s: %s is too short\n", ProgramName, path); return mDNSfalse; }
+
+    // The magic number is written in the byte order of the machine that made the capture
+    cap->swapped = mDNSfalse;
+    magic = CaptureU32(cap, header);
+    if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC)
+    {
+        cap->swapped = mDNStrue;
+        magic = CaptureU32(cap, header);
+    }
+    if (magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC)
+    {
+        fprintf(stderr, "%s: %s is not a pcap file (pcapng files must be converted first)\n", ProgramName, path);
+        return mDNSfalse;
+    }
+    cap->nanosecond = (magic == PCAP_MAGIC_NSEC);
+    cap->linktype   = CaptureU32(cap, header + 20) & 0x0FFFFFFF;   // top bits may carry FCS information
+    cap->frame      = 0;
+    return mDNStrue;
+}
+
+mDNSlocal mDNSBool CaptureNextFrame(ReplayCapture *const cap)
+{
+    mDNSu8 header[16];
+    mDNSu32 len, keep;
+
+    if (fread(header, sizeof(header), 1, cap->file) != 1) return mDNSfalse;
+    cap->sec  = CaptureU32(cap, header);
+    cap->frac = CaptureU32(cap, header + 4);
+    len       = CaptureU32(cap, header + 8);
+    keep      = (len < sizeof(cap->data)) ? len : (mDNSu32)sizeof(cap->data);
+    if (fread(cap->data, 1, keep, cap->file) != keep) return mDNSfalse;
+    if (len > keep && fseek(cap->file, (long)(len - keep), SEEK_CUR) != 0) return mDNSfalse;
+    cap->len = keep;
+    cap->frame++;
+    return mDNStrue;
+}
+
+// Finds the IP header in the frame last read, returning NULL if the frame doesn't carry IP
+mDNSlocal const mDNSu8 *CaptureIPHeader(const ReplayCapture *const cap, const mDNSu8 **const end)
+{
+    const mDNSu8 *p = cap->data;
+    mDNSu16 ethertype = 0;              // Stays zero for link types that carry IP directly
+
+    *end = cap->data + cap->len;
+    switch (cap->linktype)
+    {
+    case LINKTYPE_NULL:
+        p += 4;
+        break;
+    case LINKTYPE_RAW_OLD:
+    case LINKTYPE_RAW_BSD:
+    case LINKTYPE_RAW:
+    case LINKTYPE_IPV4:
+    case LINKTYPE_IPV6:
+        break;
+    case LINKTYPE_LINUX_SLL:
+        if (p + 16 > *end) return mDNSNULL;
+        ethertype = (mDNSu16)(p[14] << 8 | p[15]);
+        p += 16;
+        break;
+    case LINKTYPE_LINUX_SLL2:
+        if (p + 20 > *end) return mDNSNULL;
+        ethertype = (mDNSu16)(p[0] << 8 | p[1]);
+        p += 20;
+        break;
+    case LINKTYPE_ETHERNET:
+        if (p + 14 > *end) return mDNSNULL;
+        ethertype = (mDNSu16)(p[12] << 8 | p[13]);
+        p += 14;
+        while (ethertype == 0x8100 || ethertype == 0x88A8)          // Skip VLAN tags
+        {
+            if (p + 4 > *end) return mDNSNULL;
+            ethertype = (mDNSu16)(p[2] << 8 | p[3]);
+            p += 4;
+        }
+        break;
+    default:
+        return mDNSNULL;
+    }
+    if (ethertype && ethertype != 0x0800 && ethertype != 0x86DD) return mDNSNULL;
+    return (p < *end) ? p : mDNSNULL;
+}
+
+// Extracts the mDNS payload and its addressing from the frame last read. Fragments and anything
+// that isn't UDP to or from port 5353 are rejected.
+mDNSlocal const mDNSu8 *CaptureMDNSPayload(const ReplayCapture *const cap, const mDNSu8 **const end,
+                                           mDNSAddr *const src, mDNSIPPort *const srcport, mDNSAddr *const dst, mDNSIPPort *const dstport)
+{
+    const mDNSu8 *p = CaptureIPHeader(cap, end);
+    mDNSu16 udplen;
+
+    if (!p) return mDNSNULL;
+    if ((p[0] >> 4) == 4)
+    {
+        const mDNSu32 ihl = (p[0] & 0x0F) * 4;
+        if (ihl < 20 || p + ihl > *end) return mDNSNULL;
+        if (p[9] != 17 || ((p[6] & 0x3F) | p[7])) return mDNSNULL;  // Not UDP, or a fragment
+        src->type = mDNSAddrType_IPv4; memcpy(&src->ip.v4, p + 12, 4);
+        dst->type = mDNSAddrType_IPv4; memcpy(&dst->ip.v4, p + 16, 4);
+        p += ihl;
+    }
+    else if ((p[0] >> 4) == 6)
+    {
+        mDNSu8 next;
+        if (p + 40 > *end) return mDNSNULL;
+        next = p[6];
+        src->type = mDNSAddrType_IPv6; memcpy(&src->ip.v6, p + 8,  16);
+        dst->type = mDNSAddrType_IPv6; memcpy(&dst->ip.v6, p + 24, 16);
+        p += 40;
+        while (next == 0 || next == 43 || next == 60)                  // Hop-by-hop, routing and destination options
+        {
+            if (p + 8 > *end) return mDNSNULL;
+            next = p[0];
+            p += (p[1] + 1) * 8;
+        }
+        if (next != 17) return mDNSNULL;
+    }
+    else return mDNSNULL;
+
+    if (p + 8 > *end) return mDNSNULL;
+    srcport->b[0] = p[0]; srcport->b[1] = p[1];
+    dstport->b[0] = p[2]; dstport->b[1] = p[3];
+    if (!mDNSSameIPPort(*srcport, MulticastDNSPort) && !mDNSSameIPPort(*dstport, MulticastDNSPort)) return mDNSNULL;
+    udplen = (mDNSu16)(p[4] << 8 | p[5]);
+    if (udplen >= 8 && p + udplen < *end) *end = p + udplen;       // Drop any link-layer padding
+    p += 8;
+    return (p + sizeof(DNSMessageHeader) <= *end) ? p : mDNSNULL;
+}
+
+//*************************************************************************************************************
+// Virtual time and measurement
+
+mDNSlocal double CPUTimeNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+mDNSlocal void ReplaySetTime(const mDNSs32 t, const mDNSs32 utcBase)
+{
+    gPosixVirtualRawTime = t;
+    gPosixVirtualUTC     = utcBase + (t - ReplayStartTime) / mDNSPlatformOneSecond;
+}
+
+// Runs every event the core has scheduled up to and including 'target', moving the virtual clock from one to the next
+mDNSlocal void ReplayRunUntil(mDNS *const m, const mDNSs32 target, const mDNSs32 utcBase)
+{
+    for (;;)
+    {
+        const double start = CPUTimeNs();
+        mDNSs32 next = mDNS_Execute(m) - m->timenow_adjust;   // Core time is raw time plus the adjustment
+        gStats.executeNs += CPUTimeNs() - start;
+        gStats.executes++;
+        if (next - gPosixVirtualRawTime <= 0) next = gPosixVirtualRawTime + 1;
+        if (next - target > 0) break;
+        ReplaySetTime(next, utcBase);
+    }
+    ReplaySetTime(target, utcBase);
+}
+
+mDNSlocal void ReplayNoteCost(const mDNSu32 frame, const mDNSu32 len, const mDNSBool query, const double ns)
+{
+    int i = ReplayTopPackets - 1;
+    if (ns <= gStats.top[i].ns) return;
+    while (i > 0 && gStats.top[i - 1].ns < ns) { gStats.top[i] = gStats.top[i - 1]; i--; }
+    gStats.top[i].frame = frame;
+    gStats.top[i].len   = len;
+    gStats.top[i].query = query;
+    gStats.top[i].ns    = ns;
+}
+
+mDNSlocal void ReplayPace(const struct timespec *const wallStart, const double captureOffsetNs)
+{
+    struct timespec now, delay;
+    double waitNs;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    waitNs = captureOffsetNs - ((double)(now.tv_sec - wallStart->tv_sec) * 1e9 + (double)(now.tv_nsec - wallStart->tv_nsec));
+    if (waitNs <= 0) return;
+    delay.tv_sec  = (time_t)(waitNs / 1e9);
+    delay.tv_nsec = (long)(waitNs - (double)delay.tv_sec * 1e9);
+    nanosleep(&delay, mDNSNULL);
+}
+
+//*************************************************************************************************************
+// Setup
+
+mDNSlocal void mDNS_StatusCallback(mDNS *const m, mStatus result)
+{
+    if (result == mStatus_GrowCache)
+    {
+        // Allocate another chunk of cache storage
+        CacheEntity *storage = malloc(sizeof(CacheEntity) * RR_CACHE_SIZE);
+        if (storage) mDNS_GrowCache(m, storage, RR_CACHE_SIZE);
+    }
+}
+
+mDNSlocal void BrowseCallback(mDNS *const m, DNSQuestion *question, const ResourceRecord *const answer, QC_result AddRecord)
+{
+    (void)m;
+    (void)question;
+    (void)answer;
+    if (AddRecord) gBrowseAdds++;
+    else gBrowseRemoves++;
+}
+
+// Registers an interface with no sockets behind it, so mDNSPlatformSendUDP drops whatever the core sends on it.
+// The IPv6 half shares the IPv4 half's InterfaceID, as an alias on a real interface would.
+mDNSlocal mStatus ReplayRegisterInterface(mDNS *const m, PosixNetworkInterface *const intf, const mDNSAddr *const addr, const mDNSu8 prefixBytes)
+{
+    NetworkInterfaceInfo *const info = &intf->coreIntf;
+    mDNSu8 i;
+
+    mDNSPlatformMemZero(intf, sizeof(*intf));
+    intf->intfName         = "replay0";
+    intf->multicastSocket4 = -1;
+#if HAVE_IPV6
+    intf->multicastSocket6 = -1;
+#endif
+    info->InterfaceID = (mDNSInterfaceID)&gReplayIntf4;
+    info->ip          = *addr;
+    info->mask.type   = addr->type;
+    for (i = 0; i < prefixBytes; i++) info->mask.ip.v6.b[i] = 0xFF;
+    strncpy(info->ifname, intf->intfName, sizeof(info->ifname) - 1);
+    info->Advertise   = mDNSfalse;
+    info->McastTxRx   = mDNStrue;
+    return mDNS_RegisterInterface(m, info, NormalActivation);
+}
+
+mDNSlocal mStatus ReplayStartBrowse(mDNS *const m, DNSQuestion *const q, const char *const type)
+{
+    char name[MAX_ESCAPED_DOMAIN_NAME];
+    snprintf(name, sizeof(name), "%s.local.", type);
+    mDNSPlatformMemZero(q, sizeof(*q));
+    if (!MakeDomainNameFromDNSNameString(&q->qname, name)) return mStatus_BadParamErr;
+    q->InterfaceID      = gReplayIntf4.coreIntf.InterfaceID;
+    q->qtype            = kDNSType_PTR;
+    q->qclass           = kDNSClass_IN;
+    q->QuestionCallback = BrowseCallback;
+    return mDNS_StartQuery(m, q);
+}
+
+//*************************************************************************************************************
+// Main
+
+mDNSlocal void Usage(void)
+{
+    fprintf(stderr, "Usage: %s [-r] [-i seconds] [-b _type._proto]... capture.pcap\n", ProgramName);
+    fprintf(stderr, "  -r            pace the replay with the capture's own timing instead of going as fast as possible\n");
+    fprintf(stderr, "  -i seconds    capture time between cache size samples (default 10)\n");
+    fprintf(stderr, "  -b type       browse for this service type throughout the replay, as a client of mdnsd would\n");
+}
+
+mDNSexport int main(int argc, char **argv)
+{
+    mDNS *const m = &mDNSStorage;
+    static ReplayCapture cap;
+    static DNSMessage msg;
+    const char *path = mDNSNULL;
+    const char *browses[ReplayMaxBrowses];
+    int numBrowses = 0, i;
+    mDNSBool realtime = mDNSfalse;
+    mDNSs32 interval = 10 * mDNSPlatformOneSecond;
+    mDNSu32 firstSec = 0, firstFrac = 0;
+    mDNSs32 utcBase = 0, now = ReplayStartTime, nextSample;
+    struct timespec wallStart, wallEnd;
+    double cpuStart, cpuTotal, wallNs, captureNs = 0;
+    mDNSAddr addr;
+    mStatus err;
+
+    for (i = 1; i < argc; i++)
+    {
+        if      (!strcmp(argv[i], "-r")) realtime = mDNStrue;
+        else if (!strcmp(argv[i], "-i") && i + 1 < argc && atoi(argv[i + 1]) > 0) interval = atoi(argv[++i]) * mDNSPlatformOneSecond;
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc && numBrowses < ReplayMaxBrowses) browses[numBrowses++] = argv[++i];
+        else if (argv[i][0] != '-' && !path) path = argv[i];
+        else { Usage(); return 2; }
+    }
+    if (!path) { Usage(); return 2; }
+    if (!CaptureOpen(&cap, path)) return 1;
+
+    // Start the virtual clock at the first frame, so the core is brought up at the start of the capture
+    if (CaptureNextFrame(&cap))
+    {
+        firstSec  = cap.sec;
+        firstFrac = cap.frac;
+        utcBase   = (mDNSs32)cap.sec;
+    }
+    ReplaySetTime(now, utcBase);
+
+    err = mDNS_Init(m, &PlatformStorage, gRRCache, RR_CACHE_SIZE, mDNS_Init_DontAdvertiseLocalAddresses,
+                    mDNS_StatusCallback, mDNS_Init_NoInitCallbackContext);
+    if (!err)
+    {
+        mDNSPlatformMemZero(&addr, sizeof(addr));
+        addr.type = mDNSAddrType_IPv4;
+        addr.ip.v4.b[0] = 192; addr.ip.v4.b[1] = 0; addr.ip.v4.b[2] = 2; addr.ip.v4.b[3] = 1;    // TEST-NET-1
+        err = ReplayRegisterInterface(m, &gReplayIntf4, &addr, 3);
+    }
+#if HAVE_IPV6
+    if (!err)
+    {
+        mDNSPlatformMemZero(&addr, sizeof(addr));
+        addr.type = mDNSAddrType_IPv6;
+        addr.ip.v6.b[0] = 0x20; addr.ip.v6.b[1] = 0x01; addr.ip.v6.b[2] = 0x0d; addr.ip.v6.b[3] = 0xb8;
+        addr.ip.v6.b[15] = 1;                                                                   // 2001:db8::1
+        err = ReplayRegisterInterface(m, &gReplayIntf6, &addr, 8);
+    }
+#endif
+    for (i = 0; !err && i < numBrowses; i++) err = ReplayStartBrowse(m, &gBrowses[i], browses[i]);
+    if (err) { fprintf(stderr, "%s: initialization failed %d\n", ProgramName, (int)err); return 1; }
+
+    printf("%10s %9s %9s %9s %12s\n", "time (s)", "packets", "cache", "active", "cpu (ms)");
+    nextSample = now + interval;
+    clock_gettime(CLOCK_MONOTONIC, &wallStart);
+    cpuStart = CPUTimeNs();
+
+    if (cap.frame) do
+    {
+        const mDNSu8 *payload, *end;
+        mDNSAddr src, dst;
+        mDNSIPPort srcport, dstport;
+        mDNSs32 frameTime;
+
+        // Capture timestamps may go backwards by a little; the virtual clock just doesn't move for those frames
+        captureNs = (double)(cap.sec - firstSec) * 1e9 + ((double)cap.frac - (double)firstFrac) * (cap.nanosecond ? 1 : 1e3);
+        frameTime = ReplayStartTime + (mDNSs32)(captureNs * mDNSPlatformOneSecond / 1e9);
+        if (frameTime - now > 0)
+        {
+            while (frameTime - nextSample >= 0)
+            {
+                ReplayRunUntil(m, nextSample, utcBase);
+                printf("%10.1f %9u %9u %9u %12.1f\n", (double)(nextSample - ReplayStartTime) / mDNSPlatformOneSecond,
+                       gStats.queries + gStats.responses, m->rrcache_totalused, m->rrcache_active, (CPUTimeNs() - cpuStart) / 1e6);
+                nextSample += interval;
+                fflush(stdout);
+            }
+            ReplayRunUntil(m, frameTime, utcBase);
+            now = frameTime;
+        }
+        if (realtime) ReplayPace(&wallStart, captureNs);
+
+        gStats.frames++;
+        payload = CaptureMDNSPayload(&cap, &end, &src, &srcport, &dst, &dstport);
+        if (!payload) { gStats.skipped++; continue; }
+        {
+            // mDNSCoreReceive byte-swaps the header in place and wants an aligned message, so work on a copy
+            const mDNSu32 len = (mDNSu32)((end - payload) < (long)sizeof(msg) ? (end - payload) : (long)sizeof(msg));
+            const mDNSBool query = !(payload[2] & 0x80);
+            double start, ns;
+            memcpy(&msg, payload, len);
+            start = CPUTimeNs();
+            mDNSCoreReceive(m, &msg, (mDNSu8 *)&msg + len, &src, srcport, &dst, dstport, gReplayIntf4.coreIntf.InterfaceID);
+            ns = CPUTimeNs() - start;
+            if (query) { gStats.queries++;   gStats.receiveQueryNs    += ns; }
+            else       { gStats.responses++; gStats.receiveResponseNs += ns; }
+            gStats.bytes += len;
+            ReplayNoteCost(cap.frame, len, query, ns);
+        }
+    } while (CaptureNextFrame(&cap));
+
+    cpuTotal = CPUTimeNs() - cpuStart;
+    clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+    wallNs = (double)(wallEnd.tv_sec - wallStart.tv_sec) * 1e9 + (double)(wallEnd.tv_nsec - wallStart.tv_nsec);
+    printf("%10.1f %9u %9u %9u %12.1f\n", captureNs / 1e9, gStats.queries + gStats.responses, m->rrcache_totalused, m->rrcache_active, cpuTotal / 1e6);
+
+    printf("\nFrames read %u, mDNS packets %u (%u queries, %u responses, %llu bytes), skipped %u\n",
+           gStats.frames, gStats.queries + gStats.responses, gStats.queries, gStats.responses, gStats.bytes, gStats.skipped);
+    printf("Capture time %.3f s, wall time %.3f s, CPU time %.3f s\n", captureNs / 1e9, wallNs / 1e9, cpuTotal / 1e9);
+    if (cpuTotal > 0)
+        printf("Throughput %.0f packets per CPU second\n", (gStats.queries + gStats.responses) * 1e9 / cpuTotal);
+    printf("Cache entries %u in use of %u, %u answering active questions\n", m->rrcache_totalused, m->rrcache_size, m->rrcache_active);
+    printf("Packets the core would have sent: %u\n", gReplayIntf4.coreIntf.PacketsSent);
+    if (numBrowses) printf("Browse answers: %lu added, %lu removed\n", gBrowseAdds, gBrowseRemoves);
+
+    printf("\nCPU profile                      calls        total ms      us/call\n");
+    printf("  mDNSCoreReceive (queries)   %9u %15.3f %12.2f\n", gStats.queries, gStats.receiveQueryNs / 1e6,
+           gStats.queries ? gStats.receiveQueryNs / gStats.queries / 1e3 : 0);
+    printf("  mDNSCoreReceive (responses) %9u %15.3f %12.2f\n", gStats.responses, gStats.receiveResponseNs / 1e6,
+           gStats.responses ? gStats.receiveResponseNs / gStats.responses / 1e3 : 0);
+    printf("  mDNS_Execute                %9u %15.3f %12.2f\n", gStats.executes, gStats.executeNs / 1e6,
+           gStats.executes ? gStats.executeNs / gStats.executes / 1e3 : 0);
+
+    printf("\nMost expensive packets\n");
+    for (i = 0; i < ReplayTopPackets && gStats.top[i].ns > 0; i++)
+        printf("  frame %7u  %-8s %5u bytes %12.2f us\n", gStats.top[i].frame, gStats.top[i].query ? "query" : "response",
+               gStats.top[i].len, gStats.top[i].ns / 1e3);
+    return 0;
+}
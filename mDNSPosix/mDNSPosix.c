@@ -18,6 +18,7 @@
 
 #include "mDNSEmbeddedAPI.h"           // Defines the interface provided to the client layer above
 #include "DNSCommon.h"
+#include "uDNS.h"                    // For mDNS_Register_internal(), for /etc/hosts
 #include "mDNSPosix.h"               // Defines the specific types needed to run mDNS on this platform
 #include "PlatformCommon.h"
 #include "dns_sd.h"
@@ -35,12 +36,23 @@
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
 #include <sys/select.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <time.h>                   // platform support for UTC time
 #include <ifaddrs.h>
 
+#if HAVE_EPOLL
+#include <stdint.h>
+#include <sys/epoll.h>
+#endif
+
+#if HAVE_IO_URING && !(HAVE_EPOLL && HAVE_RECVMMSG && HAVE_SENDMMSG)
+#error HAVE_IO_URING needs HAVE_EPOLL, HAVE_RECVMMSG and HAVE_SENDMMSG
+#endif
+
 #if USES_NETLINK
 #include <asm/types.h>
 #include <linux/netlink.h>
@@ -86,9 +98,272 @@ mDNSlocal void requestReadEvents(PosixEventSource *eventSource,
 mDNSlocal mStatus stopReadOrWriteEvents(int fd, mDNSBool freeSource, mDNSBool removeSource, int flags);
 mDNSlocal void requestWriteEvents(PosixEventSource *eventSource,
                                      const char *taskName, mDNSPosixEventCallback callback, void *context);
+mDNSlocal mStatus PosixLockInit(mDNS_PlatformSupport *const p);
+mDNSlocal void PosixLockClose(mDNS_PlatformSupport *const p);
+#if HAVE_IO_URING
+mDNSlocal mDNSBool UringWatchUDPSocket(int fd);
+mDNSlocal mDNSBool UringUnwatchUDPSocket(int fd);
+#endif
 // ***************************************************************************
 // Functions
 
+#define InterfaceIndexHashSlot(INDEX) ((mDNSu32)(INDEX) % POSIX_INTERFACE_HASH_SLOTS)
+#define InterfaceIDHashSlot(ID)       ((mDNSu32)((uintptr_t)(ID) / sizeof(void *)) % POSIX_INTERFACE_HASH_SLOTS)
+
+// Adds a newly registered interface to both hashes. Its index chain is kept in registration order, which is also
+// the order of m->HostInterfaces, so the first match for an index is the same one a walk of the list would find.
+mDNSlocal void HashInterface(mDNS *const m, PosixNetworkInterface *const intf)
+{
+    PosixNetworkInterface **p = &m->p->IndexHash[InterfaceIndexHashSlot(intf->index)];
+    while (*p) p = &(*p)->nextInIndexHash;
+    intf->nextInIndexHash = mDNSNULL;
+    *p = intf;
+
+    intf->nextInIDHash = m->p->IDHash[InterfaceIDHashSlot(intf)];
+    m->p->IDHash[InterfaceIDHashSlot(intf)] = intf;
+}
+
+// Safe to call for an interface that isn't in the hashes, which leaves them unchanged
+mDNSlocal void UnhashInterface(mDNS *const m, PosixNetworkInterface *const intf)
+{
+    PosixNetworkInterface **p = &m->p->IndexHash[InterfaceIndexHashSlot(intf->index)];
+    while (*p && *p != intf) p = &(*p)->nextInIndexHash;
+    if (*p) *p = intf->nextInIndexHash;
+    intf->nextInIndexHash = mDNSNULL;
+
+    p = &m->p->IDHash[InterfaceIDHashSlot(intf)];
+    while (*p && *p != intf) p = &(*p)->nextInIDHash;
+    if (*p) *p = intf->nextInIDHash;
+    intf->nextInIDHash = mDNSNULL;
+}
+
+// Returns the first registered interface with the given index, or NULL if there's none
+mDNSlocal PosixNetworkInterface *FirstInterfaceForIndex(const mDNS *const m, int index)
+{
+    PosixNetworkInterface *intf = m->p->IndexHash[InterfaceIndexHashSlot(index)];
+    while (intf && intf->index != index) intf = intf->nextInIndexHash;
+    return intf;
+}
+
+#if HAVE_EPOLL
+// With epoll, mDNSPosixRunEventLoopOnce() waits on a single epoll set holding our own sockets and every
+// PosixEventSource, instead of rebuilding fd_sets for select() each time round, so dispatch is O(ready)
+// rather than O(nfds) and isn't limited to FD_SETSIZE. Clients that run their own select() loop can still
+// use mDNSPosixGetFDSet() and mDNSPosixProcessFDSet(), which work as before.
+// Each epoll_event carries either a PosixEventSource pointer, or for our own UDP sockets the fd and this tag.
+#define EpollUDPSocketTag ((uint64_t)1 << 63)
+#define EpollMaxEvents 256
+
+static int gEpollFD = -1;
+static mDNSBool gEpollFailed = mDNSfalse;
+static struct epoll_event gEpollReady[EpollMaxEvents];  // Events from the epoll_wait() that's being dispatched
+static int gEpollReadyCount = 0;
+
+mDNSlocal int EpollFD(void)
+{
+    if (gEpollFD < 0 && !gEpollFailed)
+    {
+        gEpollFD = epoll_create1(EPOLL_CLOEXEC);
+        if (gEpollFD < 0)
+        {
+            LogMsg("EpollFD: epoll_create1 failed: %s; falling back to select()", strerror(errno));
+            gEpollFailed = mDNStrue;
+        }
+    }
+    return gEpollFD;
+}
+
+// An event that's been returned by epoll_wait but not dispatched yet must not be dispatched once its fd
+// leaves the epoll set, since a callback dispatched before it may have freed its PosixEventSource
+mDNSlocal void EpollForgetReadyEvents(uint64_t data)
+{
+    int i;
+    for (i = 0; i < gEpollReadyCount; i++)
+        if (gEpollReady[i].data.u64 == data) gEpollReady[i].data.u64 = 0;
+}
+
+mDNSlocal void EpollUpdateInterest(PosixEventSource *source)
+{
+    struct epoll_event ev;
+    const int epfd = EpollFD();
+
+    if (epfd < 0) return;
+    mDNSPlatformMemZero(&ev, sizeof(ev));
+    if (source->readCallback)  ev.events |= EPOLLIN;
+    if (source->writeCallback) ev.events |= EPOLLOUT;
+    ev.data.u64 = (uint64_t)(uintptr_t)source;
+
+    if (!ev.events)
+    {
+        if (source->flags & PosixEventFlag_InEpoll)
+        {
+            // Fails harmlessly with EBADF if the fd was already closed, which took it out of the set anyway
+            (void)epoll_ctl(epfd, EPOLL_CTL_DEL, source->fd, &ev);
+            source->flags &= ~PosixEventFlag_InEpoll;
+            EpollForgetReadyEvents(ev.data.u64);
+        }
+    }
+    else if (epoll_ctl(epfd, (source->flags & PosixEventFlag_InEpoll) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, source->fd, &ev) == 0)
+        source->flags |= PosixEventFlag_InEpoll;
+    else
+        LogMsg("EpollUpdateInterest: epoll_ctl failed for fd %d: %s", source->fd, strerror(errno));
+}
+
+mDNSlocal void EpollWatchUDPSocket(int fd)
+{
+    struct epoll_event ev;
+    const int epfd = EpollFD();
+
+#if HAVE_IO_URING
+    if (UringWatchUDPSocket(fd)) return;
+#endif
+    if (epfd < 0) return;
+    mDNSPlatformMemZero(&ev, sizeof(ev));
+    ev.events   = EPOLLIN;
+    ev.data.u64 = EpollUDPSocketTag | (uint32_t)fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) != 0)
+        LogMsg("EpollWatchUDPSocket: epoll_ctl failed for fd %d: %s", fd, strerror(errno));
+}
+
+mDNSlocal void EpollUnwatchUDPSocket(int fd)
+{
+    struct epoll_event ev;
+
+#if HAVE_IO_URING
+    if (UringUnwatchUDPSocket(fd)) return;
+#endif
+    if (gEpollFD < 0) return;
+    mDNSPlatformMemZero(&ev, sizeof(ev));
+    (void)epoll_ctl(gEpollFD, EPOLL_CTL_DEL, fd, &ev);
+    EpollForgetReadyEvents(EpollUDPSocketTag | (uint32_t)fd);
+}
+#endif // HAVE_EPOLL
+
+#if HAVE_IO_URING
+// With m->p->UseIoUring set before mDNS_Init (mdnsd -iouring), our UDP sockets are read through an io_uring instead of
+// the epoll set. Each one has a multishot recvmsg armed on it that takes buffers from a provided buffer ring, so however
+// many packets arrive on however many sockets, they're picked up as completions without a system call each; the ring's
+// own fd sits in the epoll set to wake us when there are some (see UringDispatch). Send batches (see FlushSendBatch)
+// and batches of writes to clients (see mDNSPosixWriteBatch) go out through a second ring, with one io_uring_enter for
+// the lot instead of a sendmmsg or writev per socket. Everything else still goes through epoll, and if the rings can't
+// be set up (a kernel before 6.0, or io_uring disabled) we log it and carry on with epoll alone.
+// The receive buffers and armed receives belong to the event loop, so this only works with mDNSPosixRunEventLoopOnce().
+#ifndef UringRecvBuffers
+#define UringRecvBuffers 64                 // Power of two
+#endif
+#define UringRecvControlSize 256            // Room for the pktinfo and TTL messages, as in recvmmsg_flags
+#define UringRecvBufferSize (((sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_storage) + UringRecvControlSize + \
+                               sizeof(DNSMessage)) + 63) & ~(size_t)63)
+#define UringSendEntries 64                 // Most sends or client writes per io_uring_enter
+
+static mDNSBool gUringActive = mDNSfalse;
+static struct my_uring gRecvRing;
+static struct my_uring gSendRing;
+static struct my_uring_bufs gRecvBufs;
+static struct msghdr gRecvTemplate;
+// Each armed receive's user_data is its fd and a generation number, and gUringWatch[fd] is the generation armed on fd,
+// or zero. A completion whose generation doesn't match is left over from a socket that's been closed (and perhaps
+// reopened with the same fd), so its data is dropped.
+static mDNSu32 *gUringWatch = mDNSNULL;
+static int gUringWatchSize = 0;
+static mDNSu32 gUringGeneration = 0;
+
+#define UringUserData(FD, GEN) (((uint64_t)(GEN) << 32) | (uint32_t)(FD))
+
+mDNSlocal void UringInit(void)
+{
+    if (my_uring_init(&gRecvRing, UringRecvBuffers) < 0)
+    {
+        LogMsg("UringInit: io_uring_setup failed: %s; using epoll", strerror(errno));
+        return;
+    }
+    if (my_uring_bufs_init(&gRecvRing, &gRecvBufs, 0, UringRecvBuffers, UringRecvBufferSize) < 0)
+    {
+        LogMsg("UringInit: could not register receive buffers: %s; using epoll", strerror(errno));
+        my_uring_exit(&gRecvRing);
+        return;
+    }
+    if (my_uring_init(&gSendRing, UringSendEntries) < 0)
+    {
+        LogMsg("UringInit: io_uring_setup failed: %s; using epoll", strerror(errno));
+        my_uring_bufs_exit(&gRecvRing, &gRecvBufs);
+        my_uring_exit(&gRecvRing);
+        return;
+    }
+    mDNSPlatformMemZero(&gRecvTemplate, sizeof(gRecvTemplate));
+    gRecvTemplate.msg_namelen    = sizeof(struct sockaddr_storage);
+    gRecvTemplate.msg_controllen = UringRecvControlSize;
+    EpollWatchUDPSocket(gRecvRing.fd);      // Readable while there are completions waiting
+    gUringActive = mDNStrue;
+    LogInfo("UringInit: receiving through io_uring with %d buffers of %d bytes", UringRecvBuffers, (int)UringRecvBufferSize);
+}
+
+mDNSlocal void UringClose(void)
+{
+    if (!gUringActive) return;
+    gUringActive = mDNSfalse;
+    EpollUnwatchUDPSocket(gRecvRing.fd);
+    my_uring_bufs_exit(&gRecvRing, &gRecvBufs);
+    my_uring_exit(&gRecvRing);          // Also cancels anything still armed
+    my_uring_exit(&gSendRing);
+    free(gUringWatch);
+    gUringWatch     = mDNSNULL;
+    gUringWatchSize = 0;
+}
+
+// Returns an SQE from the receive ring, submitting what's queued first if it's full
+mDNSlocal struct io_uring_sqe *UringRecvSQE(void)
+{
+    struct io_uring_sqe *sqe = my_uring_get_sqe(&gRecvRing);
+    if (!sqe && my_uring_submit(&gRecvRing, 0) >= 0) sqe = my_uring_get_sqe(&gRecvRing);
+    if (!sqe) LogMsg("UringRecvSQE: submission queue full");
+    return sqe;
+}
+
+mDNSlocal void UringArm(int fd)
+{
+    struct io_uring_sqe *const sqe = UringRecvSQE();
+    if (sqe) my_uring_prep_recvmsg_multishot(sqe, fd, &gRecvTemplate, &gRecvBufs, UringUserData(fd, gUringWatch[fd]));
+}
+
+mDNSlocal mDNSBool UringWatchUDPSocket(int fd)
+{
+    if (!gUringActive) return mDNSfalse;
+    if (fd >= gUringWatchSize)
+    {
+        const int size = (fd + 64) & ~63;
+        mDNSu32 *const watch = realloc(gUringWatch, size * sizeof(*watch));
+        if (!watch) return mDNSfalse;       // Leave this one to epoll
+        mDNSPlatformMemZero(watch + gUringWatchSize, (size - gUringWatchSize) * sizeof(*watch));
+        gUringWatch     = watch;
+        gUringWatchSize = size;
+    }
+    if (++gUringGeneration == 0) gUringGeneration = 1;
+    gUringWatch[fd] = gUringGeneration;
+    UringArm(fd);
+    if (my_uring_submit(&gRecvRing, 0) < 0) LogMsg("UringWatchUDPSocket: io_uring_enter failed: %s", strerror(errno));
+    return mDNStrue;
+}
+
+mDNSlocal mDNSBool UringUnwatchUDPSocket(int fd)
+{
+    struct io_uring_sqe *sqe;
+
+    if (!gUringActive || fd >= gUringWatchSize || !gUringWatch[fd]) return mDNSfalse;
+    sqe = UringRecvSQE();
+    if (sqe)
+    {
+        // The ring holds a reference to the socket while the receive is armed, so it must be cancelled before close()
+        // will really close it. The cancellation's own completion has user_data zero and is ignored.
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr   = UringUserData(fd, gUringWatch[fd]);
+    }
+    gUringWatch[fd] = 0;
+    if (my_uring_submit(&gRecvRing, 0) < 0) LogMsg("UringUnwatchUDPSocket: io_uring_enter failed: %s", strerror(errno));
+    return mDNStrue;
+}
+#endif // HAVE_IO_URING
+
 #if MDNS_MALLOC_DEBUGGING
 mDNSexport void mDNSPlatformValidateLists(void)
 {
@@ -139,6 +414,296 @@ mDNSlocal void SockAddrTomDNSAddr(const struct sockaddr *const sa, mDNSAddr *ipA
 #pragma mark ***** Send and Receive
 #endif
 
+#if POSIX_SHARED_MULTICAST_SOCKETS
+#if !defined(IP_PKTINFO)
+#error POSIX_SHARED_MULTICAST_SOCKETS needs IP_PKTINFO to tell which interface a packet arrived on or should leave by
+#endif
+
+// Space for the control message that picks the interface a packet sent on a shared multicast socket goes out on
+typedef union
+{
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+} PosixPacketControl;
+
+// Fills in control with an IP_PKTINFO or IPV6_PKTINFO message naming interface index ifindex, and returns its length.
+// The source address is left for the kernel to choose, as it does for the sockets bound to a single interface.
+mDNSlocal socklen_t SetOutgoingInterface(PosixPacketControl *const control, const int ifindex, const mDNSAddr_Type type)
+{
+    struct cmsghdr *const cmsg = &control->align;
+    mDNSPlatformMemZero(control, sizeof(*control));
+#if HAVE_IPV6
+    if (type == mDNSAddrType_IPv6)
+    {
+        struct in6_pktinfo info6;
+        mDNSPlatformMemZero(&info6, sizeof(info6));
+        info6.ipi6_ifindex = ifindex;
+        cmsg->cmsg_level   = IPPROTO_IPV6;
+        cmsg->cmsg_type    = IPV6_PKTINFO;
+        cmsg->cmsg_len     = CMSG_LEN(sizeof(info6));
+        memcpy(CMSG_DATA(cmsg), &info6, sizeof(info6));
+        return CMSG_SPACE(sizeof(info6));
+    }
+#else
+    (void)type;
+#endif
+    {
+        struct in_pktinfo info;
+        mDNSPlatformMemZero(&info, sizeof(info));
+        info.ipi_ifindex = ifindex;
+        cmsg->cmsg_level = IPPROTO_IP;
+        cmsg->cmsg_type  = IP_PKTINFO;
+        cmsg->cmsg_len   = CMSG_LEN(sizeof(info));
+        memcpy(CMSG_DATA(cmsg), &info, sizeof(info));
+        return CMSG_SPACE(sizeof(info));
+    }
+}
+
+// Like sendto, but sends the packet out through interface index ifindex
+mDNSlocal ssize_t SendToOnInterface(int skt, const void *const msg, size_t len, const struct sockaddr_storage *const to,
+                                    const int ifindex, const mDNSAddr_Type type)
+{
+    PosixPacketControl control;
+    struct iovec iov;
+    struct msghdr mh;
+
+    iov.iov_base = (void *)msg;
+    iov.iov_len  = len;
+    mDNSPlatformMemZero(&mh, sizeof(mh));
+    mh.msg_name       = (void *)to;
+    mh.msg_namelen    = GET_SA_LEN(*to);
+    mh.msg_iov        = &iov;
+    mh.msg_iovlen     = 1;
+    mh.msg_control    = &control;
+    mh.msg_controllen = SetOutgoingInterface(&control, ifindex, type);
+    return sendmsg(skt, &mh, 0);
+}
+
+mDNSlocal mDNSBool IsSharedMulticastSocket(const mDNS *const m, int skt)
+{
+    if (skt == m->p->multicastSocket4) return mDNStrue;
+#if HAVE_IPV6
+    if (skt == m->p->multicastSocket6) return mDNStrue;
+#endif
+    return mDNSfalse;
+}
+
+// Returns the interface that a packet which arrived on shared multicast socket skt through interface index ifindex
+// belongs to: the registered interface with that index that joined the group on skt, or NULL if there's none,
+// in which case the packet came in on an interface we're not using and should be dropped
+mDNSlocal PosixNetworkInterface *SharedSocketInterface(const mDNS *const m, int skt, int ifindex)
+{
+    PosixNetworkInterface *intf;
+    for (intf = FirstInterfaceForIndex(m, ifindex); intf; intf = intf->nextInIndexHash)
+    {
+        if (intf->index != ifindex) continue;
+        if (skt == m->p->multicastSocket4 && intf->joined4) return intf;
+#if HAVE_IPV6
+        if (skt == m->p->multicastSocket6 && intf->joined6) return intf;
+#endif
+    }
+    return NULL;
+}
+
+#endif // POSIX_SHARED_MULTICAST_SOCKETS
+
+// Returns the socket that packets the core sends on intf go out through, or -1 if intf has none for that address type
+mDNSlocal int MulticastSendingSocket(const mDNS *const m, const PosixNetworkInterface *const intf, const mDNSAddr_Type type)
+{
+#if POSIX_SHARED_MULTICAST_SOCKETS
+#if HAVE_IPV6
+    if (type == mDNSAddrType_IPv6) return intf->joined6 ? m->p->multicastSocket6 : -1;
+#endif
+    return (type == mDNSAddrType_IPv4 && intf->joined4) ? m->p->multicastSocket4 : -1;
+#else
+    (void)m;
+#if HAVE_IPV6
+    if (type == mDNSAddrType_IPv6) return intf->multicastSocket6;
+#endif
+    return (type == mDNSAddrType_IPv4) ? intf->multicastSocket4 : -1;
+#endif
+}
+
+#if HAVE_SENDMMSG
+// While a send batch is open (see mDNSPosixExecute), packets the core sends on an interface's multicast sockets
+// are copied here instead of going straight to sendto, and are flushed with one sendmmsg per socket when the
+// batch closes. Packets sent through the unicast sockets are never queued, since uDNS wants their errors right away.
+#ifndef SEND_BATCH_PACKETS
+#define SEND_BATCH_PACKETS 64
+#endif
+#ifndef SEND_BATCH_BYTES
+#define SEND_BATCH_BYTES   65536
+#endif
+
+typedef struct
+{
+    int skt;
+    int ifindex;                        // Interface a packet queued on a shared multicast socket goes out on, else 0
+    mDNSBool sent;
+    mDNSAddr dst;
+    struct sockaddr_storage to;
+    size_t offset;
+    size_t len;
+} PosixQueuedPacket;
+
+static struct
+{
+    mDNSBool open;
+    int count;
+    size_t used;
+    PosixQueuedPacket pkts[SEND_BATCH_PACKETS];
+    mDNSu8 data[SEND_BATCH_BYTES];
+} gSendBatch;
+
+mDNSlocal void LogBatchedSendError(const PosixQueuedPacket *const pkt, int errNum)
+{
+    static int MessageCount = 0;
+    // Don't report EHOSTDOWN (i.e. ARP failure), ENETDOWN, or no route to host for unicast destinations
+    if (!mDNSAddressIsAllDNSLinkGroup(&pkt->dst))
+        if (errNum == EHOSTDOWN || errNum == ENETDOWN || errNum == EHOSTUNREACH || errNum == ENETUNREACH) return;
+    if (MessageCount < 1000)
+    {
+        MessageCount++;
+        LogMsg("FlushSendBatch got error %d (%s) sending packet to %#a on socket %d", errNum, strerror(errNum), &pkt->dst, pkt->skt);
+    }
+}
+
+#if HAVE_IO_URING
+#if SEND_BATCH_PACKETS > UringSendEntries
+#error SEND_BATCH_PACKETS is larger than the io_uring send ring
+#endif
+
+// Sends everything that's queued with one io_uring_enter, which issues the sends in the order they were queued.
+// MSG_DONTWAIT makes each one complete (or fail) there and then, as sendmmsg would, so the batch's buffers can be
+// reused as soon as this returns.
+mDNSlocal void UringFlushSendBatch(const mDNS *const m)
+{
+    struct msghdr msgs[SEND_BATCH_PACKETS];
+    struct iovec iov[SEND_BATCH_PACKETS];
+#if POSIX_SHARED_MULTICAST_SOCKETS
+    PosixPacketControl control[SEND_BATCH_PACKETS];
+#endif
+    struct io_uring_cqe *cqe;
+    int i, queued = 0;
+
+    for (i = 0; i < gSendBatch.count; i++)
+    {
+        PosixQueuedPacket *const pkt = &gSendBatch.pkts[i];
+        struct io_uring_sqe *const sqe = my_uring_get_sqe(&gSendRing);
+        if (!sqe) { LogBatchedSendError(pkt, ENOBUFS); continue; }
+        iov[i].iov_base = &gSendBatch.data[pkt->offset];
+        iov[i].iov_len  = pkt->len;
+        mDNSPlatformMemZero(&msgs[i], sizeof(msgs[i]));
+        msgs[i].msg_name    = &pkt->to;
+        msgs[i].msg_namelen = GET_SA_LEN(pkt->to);
+        msgs[i].msg_iov     = &iov[i];
+        msgs[i].msg_iovlen  = 1;
+#if POSIX_SHARED_MULTICAST_SOCKETS
+        if (pkt->ifindex)
+        {
+            msgs[i].msg_control    = &control[i];
+            msgs[i].msg_controllen = SetOutgoingInterface(&control[i], pkt->ifindex, pkt->dst.type);
+        }
+#endif
+        sqe->opcode    = IORING_OP_SENDMSG;
+        sqe->fd        = pkt->skt;
+        sqe->addr      = (unsigned long)&msgs[i];
+        sqe->len       = 1;
+        sqe->msg_flags = MSG_DONTWAIT;
+        sqe->user_data = (uint64_t)i;
+        queued++;
+    }
+    m->p->SendBatchSyscalls++;
+    if (my_uring_submit(&gSendRing, (unsigned int)queued) < 0)
+        LogMsg("UringFlushSendBatch: io_uring_enter failed: %s", strerror(errno));
+    while ((cqe = my_uring_peek_cqe(&gSendRing)) != mDNSNULL)
+    {
+        if (cqe->res < 0 && cqe->user_data < (uint64_t)gSendBatch.count) LogBatchedSendError(&gSendBatch.pkts[cqe->user_data], -cqe->res);
+        my_uring_cqe_seen(&gSendRing);
+    }
+}
+#endif // HAVE_IO_URING
+
+// Sends everything that's queued, with one sendmmsg call for all the packets queued on each socket
+// (more if a packet fails), keeping the order in which the core sent the packets on that socket
+mDNSlocal void FlushSendBatch(const mDNS *const m)
+{
+    struct mmsghdr msgs[SEND_BATCH_PACKETS];
+    struct iovec iov[SEND_BATCH_PACKETS];
+    PosixQueuedPacket *run[SEND_BATCH_PACKETS];
+#if POSIX_SHARED_MULTICAST_SOCKETS
+    PosixPacketControl control[SEND_BATCH_PACKETS];
+#endif
+    int i, j, n, done, r;
+
+    if (gSendBatch.count == 0) return;
+
+#if HAVE_IO_URING
+    if (gUringActive) UringFlushSendBatch(m);
+    else
+#endif
+    for (i = 0; i < gSendBatch.count; i++)
+    {
+        if (gSendBatch.pkts[i].sent) continue;
+        n = 0;
+        for (j = i; j < gSendBatch.count; j++)
+        {
+            PosixQueuedPacket *const pkt = &gSendBatch.pkts[j];
+            if (pkt->sent || pkt->skt != gSendBatch.pkts[i].skt) continue;
+            pkt->sent = mDNStrue;
+            iov[n].iov_base = &gSendBatch.data[pkt->offset];
+            iov[n].iov_len  = pkt->len;
+            mDNSPlatformMemZero(&msgs[n], sizeof(msgs[n]));
+            msgs[n].msg_hdr.msg_name    = &pkt->to;
+            msgs[n].msg_hdr.msg_namelen = GET_SA_LEN(pkt->to);
+            msgs[n].msg_hdr.msg_iov     = &iov[n];
+            msgs[n].msg_hdr.msg_iovlen  = 1;
+#if POSIX_SHARED_MULTICAST_SOCKETS
+            if (pkt->ifindex)
+            {
+                msgs[n].msg_hdr.msg_control    = &control[n];
+                msgs[n].msg_hdr.msg_controllen = SetOutgoingInterface(&control[n], pkt->ifindex, pkt->dst.type);
+            }
+#endif
+            run[n++] = pkt;
+        }
+        for (done = 0; done < n; )
+        {
+            r = sendmmsg(run[0]->skt, &msgs[done], n - done, 0);
+            m->p->SendBatchSyscalls++;
+            if (r > 0) done += r;
+            else { LogBatchedSendError(run[done], errno); done++; }    // Skip the packet that failed and carry on
+        }
+    }
+
+    m->p->SendBatchFlushes++;
+    m->p->SendBatchPackets += gSendBatch.count;
+    if (m->p->SendBatchLargest < (mDNSu32)gSendBatch.count) m->p->SendBatchLargest = gSendBatch.count;
+    gSendBatch.count = 0;
+    gSendBatch.used  = 0;
+}
+
+mDNSlocal mStatus QueueBatchedPacket(const mDNS *const m, int skt, int ifindex, const struct sockaddr_storage *const to,
+                                     const mDNSAddr *const dst, const void *const msg, const mDNSu8 *const end)
+{
+    const size_t len = (size_t)((const mDNSu8 *)end - (const mDNSu8 *)msg);
+    PosixQueuedPacket *pkt;
+
+    if (gSendBatch.count == SEND_BATCH_PACKETS || gSendBatch.used + len > sizeof(gSendBatch.data)) FlushSendBatch(m);
+    pkt = &gSendBatch.pkts[gSendBatch.count++];
+    pkt->skt    = skt;
+    pkt->ifindex = ifindex;
+    pkt->sent   = mDNSfalse;
+    pkt->dst    = *dst;
+    pkt->to     = *to;
+    pkt->offset = gSendBatch.used;
+    pkt->len    = len;
+    mDNSPlatformMemCopy(&gSendBatch.data[gSendBatch.used], msg, len);
+    gSendBatch.used += len;
+    return mStatus_NoError;
+}
+#endif // HAVE_SENDMMSG
+
 // mDNS core calls this routine when it needs to send a packet.
 mDNSexport mStatus mDNSPlatformSendUDP(const mDNS *const m, const void *const msg, const mDNSu8 *const end,
                                        mDNSInterfaceID InterfaceID, UDPSocket *src, const mDNSAddr *dst,
@@ -148,9 +713,15 @@ mDNSexport mStatus mDNSPlatformSendUDP(const mDNS *const m, const void *const ms
     struct sockaddr_storage to;
     PosixNetworkInterface * thisIntf = (PosixNetworkInterface *)(InterfaceID);
     int sendingsocket = -1;
+#if POSIX_SHARED_MULTICAST_SOCKETS
+    const int ifindex = thisIntf ? thisIntf->index : 0;     // The shared sockets need telling which interface to use
+#else
+    const int ifindex = 0;
+#endif
 
     (void)src;  // Will need to use this parameter once we implement mDNSPlatformUDPSocket/mDNSPlatformUDPClose
     (void) useBackgroundTrafficClass;
+    (void) ifindex;     // Unused unless we have shared multicast sockets or send batching
 
     assert(m != NULL);
     assert(msg != NULL);
@@ -171,7 +742,7 @@ mDNSexport mStatus mDNSPlatformSendUDP(const mDNS *const m, const void *const ms
         sin->sin_family         = AF_INET;
         sin->sin_port           = dstPort.NotAnInteger;
         sin->sin_addr.s_addr    = dst->ip.v4.NotAnInteger;
-        sendingsocket           = thisIntf ? thisIntf->multicastSocket4 : m->p->unicastSocket4;
+        sendingsocket           = thisIntf ? MulticastSendingSocket(m, thisIntf, dst->type) : m->p->unicastSocket4;
     }
 
 #if HAVE_IPV6
@@ -185,10 +756,20 @@ mDNSexport mStatus mDNSPlatformSendUDP(const mDNS *const m, const void *const ms
         sin6->sin6_family         = AF_INET6;
         sin6->sin6_port           = dstPort.NotAnInteger;
         sin6->sin6_addr           = *(struct in6_addr*)&dst->ip.v6;
-        sendingsocket             = thisIntf ? thisIntf->multicastSocket6 : m->p->unicastSocket6;
+        sendingsocket             = thisIntf ? MulticastSendingSocket(m, thisIntf, dst->type) : m->p->unicastSocket6;
     }
 #endif
 
+#if HAVE_SENDMMSG
+    if (gSendBatch.open && thisIntf && sendingsocket >= 0)
+        return QueueBatchedPacket(m, sendingsocket, ifindex, &to, dst, msg, end);
+#endif
+
+#if POSIX_SHARED_MULTICAST_SOCKETS
+    if (sendingsocket >= 0 && ifindex)
+        err = SendToOnInterface(sendingsocket, msg, (char*)end - (char*)msg, &to, ifindex, dst->type);
+    else
+#endif
     if (sendingsocket >= 0)
         err = sendto(sendingsocket, msg, (char*)end - (char*)msg, 0, (struct sockaddr *)&to, GET_SA_LEN(to));
 
@@ -278,6 +859,102 @@ mDNSlocal void tcpConnectCallback(int fd, void *context)
     }
 }
 
+// Works out where a datagram returned by recvfrom_flags (or recvmmsg_flags) came from and was sent to,
+// and decides whether it should be passed to mDNSCore for this socket.
+mDNSlocal mDNSBool AcceptReceivedPacket(PosixNetworkInterface *intf, int skt, int flags,
+                                        const struct sockaddr_storage *from, const struct my_in_pktinfo *packetInfo,
+                                        mDNSAddr *senderAddr, mDNSIPPort *senderPort, mDNSAddr *destAddr)
+{
+    mDNSBool reject;
+
+    (void)skt;      // Unused unless verbose debugging is enabled
+    (void)flags;    // Unused unless we have to apply the broken IP_RECVDSTADDR hack below
+
+    SockAddrTomDNSAddr((const struct sockaddr*)from, senderAddr, senderPort);
+    SockAddrTomDNSAddr((const struct sockaddr*)&packetInfo->ipi_addr, destAddr, NULL);
+
+    // If we have broken IP_RECVDSTADDR functionality (so far
+    // I've only seen this on OpenBSD) then apply a hack to
+    // convince mDNS Core that this isn't a spoof packet.
+    // Basically what we do is check to see whether the
+    // packet arrived as a multicast and, if so, set its
+    // destAddr to the mDNS address.
+    //
+    // I must admit that I could just be doing something
+    // wrong on OpenBSD and hence triggering this problem
+    // but I'm at a loss as to how.
+    //
+    // If this platform doesn't have IP_PKTINFO or IP_RECVDSTADDR, then we have
+    // no way to tell the destination address or interface this packet arrived on,
+    // so all we can do is just assume it's a multicast
+
+    #if HAVE_BROKEN_RECVDSTADDR || (!defined(IP_PKTINFO) && !defined(IP_RECVDSTADDR))
+    if ((destAddr->NotAnInteger == 0) && (flags & MSG_MCAST))
+    {
+        destAddr->type = senderAddr->type;
+        if      (senderAddr->type == mDNSAddrType_IPv4) destAddr->ip.v4 = AllDNSLinkGroup_v4.ip.v4;
+        else if (senderAddr->type == mDNSAddrType_IPv6) destAddr->ip.v6 = AllDNSLinkGroup_v6.ip.v6;
+    }
+    #endif
+
+    // We only accept the packet if the interface on which it came
+    // in matches the interface associated with this socket.
+    // We do this match by name or by index, depending on which
+    // information is available.  recvfrom_flags sets the name
+    // to "" if the name isn't available, or the index to -1
+    // if the index is available.  This accomodates the various
+    // different capabilities of our target platforms.
+
+    reject = mDNSfalse;
+    if (!intf)
+    {
+        // Ignore multicasts accidentally delivered to our unicast receiving socket
+        if (mDNSAddrIsDNSMulticast(destAddr)) reject = mDNStrue;
+    }
+    else
+    {
+        if      (packetInfo->ipi_ifname[0] != 0) reject = (strcmp(packetInfo->ipi_ifname, intf->intfName) != 0);
+        else if (packetInfo->ipi_ifindex != -1) reject = (packetInfo->ipi_ifindex != intf->index);
+
+        if (reject)
+        {
+            verbosedebugf("SocketDataReady ignored a packet from %#a to %#a on interface %s/%d expecting %#a/%s/%d/%d",
+                          senderAddr, destAddr, packetInfo->ipi_ifname, packetInfo->ipi_ifindex,
+                          &intf->coreIntf.ip, intf->intfName, intf->index, skt);
+            num_pkts_rejected++;
+            if (num_pkts_rejected > (num_pkts_accepted + 1) * (num_registered_interfaces + 1) * 2)
+            {
+                fprintf(stderr,
+                        "*** WARNING: Received %d packets; Accepted %d packets; Rejected %d packets because of interface mismatch\n",
+                        num_pkts_accepted + num_pkts_rejected, num_pkts_accepted, num_pkts_rejected);
+                num_pkts_accepted = 0;
+                num_pkts_rejected = 0;
+            }
+        }
+        else
+        {
+            verbosedebugf("SocketDataReady got a packet from %#a to %#a on interface %#a/%s/%d/%d",
+                          senderAddr, destAddr, &intf->coreIntf.ip, intf->intfName, intf->index, skt);
+            num_pkts_accepted++;
+        }
+    }
+    return(!reject);
+}
+
+#if HAVE_RECVMMSG
+// The most datagrams SocketDataReady will drain from a socket per wakeup
+#ifndef RECV_BATCH_SIZE
+#define RECV_BATCH_SIZE 8
+#endif
+
+#if RECV_BATCH_SIZE > MY_RECV_BATCH_MAX
+#error RECV_BATCH_SIZE is larger than recvmmsg_flags supports
+#endif
+
+// Set if the kernel turns out not to implement recvmmsg, in which case we go back to one recvfrom_flags per wakeup
+static mDNSBool gRecvmmsgUnsupported = mDNSfalse;
+#endif
+
 // This routine is called when the main loop detects that data is available on a socket.
 mDNSlocal void SocketDataReady(mDNS *const m, PosixNetworkInterface *intf, int skt)
 {
@@ -290,92 +967,69 @@ mDNSlocal void SocketDataReady(mDNS *const m, PosixNetworkInterface *intf, int s
     socklen_t fromLen;
     int flags;
     mDNSu8 ttl;
-    mDNSBool reject;
-    const mDNSInterfaceID InterfaceID = intf ? intf->coreIntf.InterfaceID : NULL;
+    PosixNetworkInterface *rxIntf = intf;
+#if POSIX_SHARED_MULTICAST_SOCKETS
+    // Packets on the shared sockets can be from any interface, so each one is matched up with its own
+    const mDNSBool shared = IsSharedMulticastSocket(m, skt);
+#endif
 
     assert(m    != NULL);
     assert(skt  >= 0);
 
-    fromLen = sizeof(from);
-    flags   = 0;
-    packetLen = recvfrom_flags(skt, &packet, sizeof(packet), &flags, (struct sockaddr *) &from, &fromLen, &packetInfo, &ttl);
-
-    if (packetLen >= 0)
-    {
-        SockAddrTomDNSAddr((struct sockaddr*)&from, &senderAddr, &senderPort);
-        SockAddrTomDNSAddr((struct sockaddr*)&packetInfo.ipi_addr, &destAddr, NULL);
-
-        // If we have broken IP_RECVDSTADDR functionality (so far
-        // I've only seen this on OpenBSD) then apply a hack to
-        // convince mDNS Core that this isn't a spoof packet.
-        // Basically what we do is check to see whether the
-        // packet arrived as a multicast and, if so, set its
-        // destAddr to the mDNS address.
-        //
-        // I must admit that I could just be doing something
-        // wrong on OpenBSD and hence triggering this problem
-        // but I'm at a loss as to how.
-        //
-        // If this platform doesn't have IP_PKTINFO or IP_RECVDSTADDR, then we have
-        // no way to tell the destination address or interface this packet arrived on,
-        // so all we can do is just assume it's a multicast
-
-        #if HAVE_BROKEN_RECVDSTADDR || (!defined(IP_PKTINFO) && !defined(IP_RECVDSTADDR))
-        if ((destAddr.NotAnInteger == 0) && (flags & MSG_MCAST))
-        {
-            destAddr.type = senderAddr.type;
-            if      (senderAddr.type == mDNSAddrType_IPv4) destAddr.ip.v4 = AllDNSLinkGroup_v4.ip.v4;
-            else if (senderAddr.type == mDNSAddrType_IPv6) destAddr.ip.v6 = AllDNSLinkGroup_v6.ip.v6;
-        }
-        #endif
-
-        // We only accept the packet if the interface on which it came
-        // in matches the interface associated with this socket.
-        // We do this match by name or by index, depending on which
-        // information is available.  recvfrom_flags sets the name
-        // to "" if the name isn't available, or the index to -1
-        // if the index is available.  This accomodates the various
-        // different capabilities of our target platforms.
+#if HAVE_RECVMMSG
+    // During announcement storms there can be many datagrams queued on a socket by the time we get to it,
+    // so drain as many as we can with one system call, and hand them all to mDNSCore under one lock.
+    // The buffers are static since there are far too many to put on the stack; the main loop is single-threaded.
+    if (!gRecvmmsgUnsupported)
+    {
+        static DNSMessage packets[RECV_BATCH_SIZE];
+        static struct my_recv_datagram dgrams[RECV_BATCH_SIZE];
+        static mDNSReceivedPacket received[RECV_BATCH_SIZE];
+        mDNSu32 count = 0;
+        int i, n;
 
-        reject = mDNSfalse;
-        if (!intf)
+        for (i = 0; i < RECV_BATCH_SIZE; i++)
         {
-            // Ignore multicasts accidentally delivered to our unicast receiving socket
-            if (mDNSAddrIsDNSMulticast(&destAddr)) packetLen = -1;
+            dgrams[i].ptr    = &packets[i];
+            dgrams[i].nbytes = sizeof(packets[i]);
         }
-        else
+        n = recvmmsg_flags(skt, dgrams, RECV_BATCH_SIZE);
+        if (n >= 0 || errno != ENOSYS)
         {
-            if      (packetInfo.ipi_ifname[0] != 0) reject = (strcmp(packetInfo.ipi_ifname, intf->intfName) != 0);
-            else if (packetInfo.ipi_ifindex != -1) reject = (packetInfo.ipi_ifindex != intf->index);
-
-            if (reject)
-            {
-                verbosedebugf("SocketDataReady ignored a packet from %#a to %#a on interface %s/%d expecting %#a/%s/%d/%d",
-                              &senderAddr, &destAddr, packetInfo.ipi_ifname, packetInfo.ipi_ifindex,
-                              &intf->coreIntf.ip, intf->intfName, intf->index, skt);
-                packetLen = -1;
-                num_pkts_rejected++;
-                if (num_pkts_rejected > (num_pkts_accepted + 1) * (num_registered_interfaces + 1) * 2)
-                {
-                    fprintf(stderr,
-                            "*** WARNING: Received %d packets; Accepted %d packets; Rejected %d packets because of interface mismatch\n",
-                            num_pkts_accepted + num_pkts_rejected, num_pkts_accepted, num_pkts_rejected);
-                    num_pkts_accepted = 0;
-                    num_pkts_rejected = 0;
-                }
-            }
-            else
+            for (i = 0; i < n; i++)
             {
-                verbosedebugf("SocketDataReady got a packet from %#a to %#a on interface %#a/%s/%d/%d",
-                              &senderAddr, &destAddr, &intf->coreIntf.ip, intf->intfName, intf->index, skt);
-                num_pkts_accepted++;
+                mDNSReceivedPacket *const pkt = &received[count];
+                if (dgrams[i].len < 0) continue;
+#if POSIX_SHARED_MULTICAST_SOCKETS
+                if (shared && (rxIntf = SharedSocketInterface(m, skt, dgrams[i].pktinfo.ipi_ifindex)) == NULL) continue;
+#endif
+                if (!AcceptReceivedPacket(rxIntf, skt, dgrams[i].flags, &dgrams[i].from, &dgrams[i].pktinfo,
+                                          &pkt->srcaddr, &pkt->srcport, &pkt->dstaddr)) continue;
+                pkt->msg         = &packets[i];
+                pkt->end         = (mDNSu8 *)&packets[i] + dgrams[i].len;
+                pkt->dstport     = MulticastDNSPort;
+                pkt->InterfaceID = rxIntf ? rxIntf->coreIntf.InterfaceID : NULL;
+                count++;
             }
+            mDNSCoreReceiveBatch(m, received, count);
+            return;
         }
+        LogMsg("SocketDataReady: recvmmsg not supported by this kernel; receiving one packet at a time");
+        gRecvmmsgUnsupported = mDNStrue;
     }
+#endif
 
-    if (packetLen >= 0)
+    fromLen = sizeof(from);
+    flags   = 0;
+    packetLen = recvfrom_flags(skt, &packet, sizeof(packet), &flags, (struct sockaddr *) &from, &fromLen, &packetInfo, &ttl);
+
+    if (packetLen < 0) return;
+#if POSIX_SHARED_MULTICAST_SOCKETS
+    if (shared && (rxIntf = SharedSocketInterface(m, skt, packetInfo.ipi_ifindex)) == NULL) return;
+#endif
+    if (AcceptReceivedPacket(rxIntf, skt, flags, &from, &packetInfo, &senderAddr, &senderPort, &destAddr))
         mDNSCoreReceive(m, &packet, (mDNSu8 *)&packet + packetLen,
-                        &senderAddr, senderPort, &destAddr, MulticastDNSPort, InterfaceID);
+                        &senderAddr, senderPort, &destAddr, MulticastDNSPort, rxIntf ? rxIntf->coreIntf.InterfaceID : NULL);
 }
 
 mDNSexport TCPSocket *mDNSPlatformTCPSocket(TCPSocketFlags flags, mDNSAddr_Type addrType, mDNSIPPort * port,
@@ -738,11 +1392,212 @@ mDNSexport void mDNSPlatformSetAllowSleep(mDNSBool allowSleep, const char *reaso
 #pragma mark - /etc/hosts support
 #endif
 
-mDNSexport void FreeEtcHosts(mDNS *const m, AuthRecord *const rr, mStatus result)
+// As on OS X, each line of the hosts file becomes LocalOnly AuthRecords: an A or AAAA record for the first name and
+// a CNAME to it for each alias. mDNSPosixUpdateEtcHosts() parses the file into an AuthHash of its own and then changes
+// only what differs from what's registered, deregistering entries that have gone from the file and registering new
+// ones, so editing one line of a large file doesn't remove and re-add every entry for local questions. Both hashes
+// are sized to the file (see AuthHashSize), so looking a name up doesn't get slower as the file grows.
+
+static struct stat gEtcHostsStat;           // The file as last loaded, so an unchanged one isn't reparsed
+static mDNSBool gEtcHostsLoaded = mDNSfalse;
+
+mDNSexport void FreeEtcHosts(mDNS *const m, AuthRecord *const rr, mStatus result)
+{
+    (void)m;  // unused
+    if (result == mStatus_MemFree) mDNSPlatformMemFree(rr);
+}
+
+// Adds a record to hosts unless it has an identical one already
+mDNSlocal void EtcHostsAddEntry(mDNS *const m, AuthHash *hosts, const domainname *name, mDNSInterfaceID InterfaceID,
+                                mDNSu16 rrtype, const void *rdata, mDNSu16 rdlength)
+{
+    AuthRecord *const rr = (AuthRecord *)mDNSPlatformMemAllocateClear(sizeof(*rr));
+    const AuthGroup *ag;
+    const AuthRecord *dup;
+
+    if (!rr) return;
+    mDNS_SetupResourceRecord(rr, mDNSNULL, InterfaceID, rrtype, 1, kDNSRecordTypeKnownUnique, AuthRecordLocalOnly, FreeEtcHosts, mDNSNULL);
+    AssignDomainName(&rr->namestorage, name);
+    rr->resrec.rdlength = rdlength;
+    mDNSPlatformMemCopy(rr->resrec.rdata->u.data, rdata, rdlength);
+    rr->resrec.namehash = DomainNameHashValue(rr->resrec.name);
+    SetNewRData(&rr->resrec, mDNSNULL, 0);  // Sets rr->rdatahash for us
+
+    ag = AuthGroupForRecord(hosts, &rr->resrec);
+    for (dup = ag ? ag->members : mDNSNULL; dup; dup = dup->next)
+        if (IdenticalResourceRecord(&dup->resrec, &rr->resrec) && dup->resrec.InterfaceID == InterfaceID) break;
+    if (dup || !InsertAuthRecord(m, hosts, rr)) mDNSPlatformMemFree(rr);
+}
+
+// Parses one line: an address (IPv6 ones may be scoped with %ifname), then a host name and any aliases
+mDNSlocal void EtcHostsParseLine(mDNS *const m, char *line, AuthHash *hosts)
+{
+    mDNSInterfaceID InterfaceID = mDNSInterface_LocalOnly;
+    char *save = mDNSNULL, *addr, *scope, *name;
+    mDNSu8 ip[16];
+    mDNSu16 rrtype, iplen;
+    domainname first;
+
+    line[strcspn(line, "#")] = 0;
+    addr = strtok_r(line, " \t\r\n", &save);
+    if (!addr) return;
+    scope = strchr(addr, '%');
+    if (scope) *scope++ = 0;
+    if      (inet_pton(AF_INET,  addr, ip) == 1) { rrtype = kDNSType_A;    iplen = 4;  }
+    else if (inet_pton(AF_INET6, addr, ip) == 1) { rrtype = kDNSType_AAAA; iplen = 16; }
+    else { LogInfo("EtcHostsParseLine: bad address %s", addr); return; }
+    if (scope)
+    {
+        const unsigned int ifindex = if_nametoindex(scope);
+        InterfaceID = ifindex ? mDNSPlatformInterfaceIDfromInterfaceIndex(m, ifindex) : mDNSNULL;
+        if (!InterfaceID) { LogMsg("EtcHostsParseLine: %s%%%s: no such interface", addr, scope); return; }
+    }
+
+    name = strtok_r(mDNSNULL, " \t\r\n", &save);
+    if (!name || !MakeDomainNameFromDNSNameString(&first, name)) return;
+    EtcHostsAddEntry(m, hosts, &first, InterfaceID, rrtype, ip, iplen);
+    while ((name = strtok_r(mDNSNULL, " \t\r\n", &save)) != mDNSNULL)
+    {
+        domainname alias;
+        if (!MakeDomainNameFromDNSNameString(&alias, name) || SameDomainName(&alias, &first)) continue;
+        EtcHostsAddEntry(m, hosts, &alias, InterfaceID, kDNSType_CNAME, first.c, DomainNameLength(&first));
+    }
+}
+
+// Deregisters our entries that aren't in newhosts; returns how many
+mDNSlocal mDNSu32 EtcHostsDeleteOldEntries(mDNS *const m, AuthHash *newhosts)
+{
+    mDNSu32 slot, removed = 0;
+    AuthGroup *ag;
+    AuthRecord *rr, *next;
+
+    for (slot = 0; slot < AuthHashSlots(&m->rrauth); slot++)
+        for (ag = AuthHashHead(&m->rrauth, slot); ag; ag = ag->next)
+            for (rr = ag->members; rr; rr = next)
+            {
+                const AuthGroup *const newag = AuthGroupForRecord(newhosts, &rr->resrec);
+                const AuthRecord *keep;
+                next = rr->next;
+                if (rr->RecordCallback != FreeEtcHosts || rr->resrec.RecordType == kDNSRecordTypeDeregistering) continue;
+                for (keep = newag ? newag->members : mDNSNULL; keep; keep = keep->next)
+                    if (IdenticalResourceRecord(&keep->resrec, &rr->resrec) && keep->resrec.InterfaceID == rr->resrec.InterfaceID) break;
+                if (keep) continue;
+                // Whatever's left of this name's set is headed by the next record
+                if (rr->RRSet == rr || rr->RRSet == mDNSNULL)
+                {
+                    AuthRecord *r;
+                    for (r = next; r; r = r->next) if (r->RRSet == rr) r->RRSet = next;
+                }
+                mDNS_Deregister_internal(m, rr, mDNS_Dereg_normal);
+                removed++;
+            }
+    return removed;
+}
+
+// Registers the entries in newhosts that we don't have yet, taking them out of newhosts; returns how many
+mDNSlocal mDNSu32 EtcHostsAddNewEntries(mDNS *const m, AuthHash *newhosts)
+{
+    mDNSu32 slot, added = 0;
+    AuthGroup *ag;
+    AuthRecord *rr, *next;
+
+    for (slot = 0; slot < AuthHashSlots(newhosts); slot++)
+        for (ag = AuthHashHead(newhosts, slot); ag; ag = ag->next)
+            for (rr = ag->members; rr; rr = next)
+            {
+                const AuthGroup *const oldag = AuthGroupForRecord(&m->rrauth, &rr->resrec);
+                AuthRecord *old, *primary = mDNSNULL;
+                next = rr->next;
+                for (old = oldag ? oldag->members : mDNSNULL; old; old = old->next)
+                {
+                    if (old->RecordCallback != FreeEtcHosts || old->resrec.RecordType == kDNSRecordTypeDeregistering) continue;
+                    if (!primary) primary = old;
+                    if (IdenticalResourceRecord(&old->resrec, &rr->resrec) && old->resrec.InterfaceID == rr->resrec.InterfaceID) break;
+                }
+                if (old) continue;
+                RemoveAuthRecord(m, newhosts, rr);
+                rr->RRSet = primary ? primary : rr;
+                rr->next  = mDNSNULL;
+                if (mDNS_Register_internal(m, rr) == mStatus_NoError) added++;
+                else { LogMsg("EtcHostsAddNewEntries: mDNS_Register failed for %s", ARDisplayString(m, rr)); mDNSPlatformMemFree(rr); }
+            }
+    return added;
+}
+
+// Frees what's left in newhosts: the entries we already had, and the AuthGroups
+mDNSlocal void EtcHostsFree(AuthHash *newhosts)
+{
+    mDNSu32 slot;
+    AuthGroup *ag, *agnext;
+    AuthRecord *rr, *rrnext;
+
+    for (slot = 0; slot < AuthHashSlots(newhosts); slot++)
+    {
+        for (ag = AuthHashHead(newhosts, slot); ag; ag = agnext)
+        {
+            agnext = ag->next;
+            for (rr = ag->members; rr; rr = rrnext)
+            {
+                rrnext = rr->next;
+                mDNSPlatformMemFree(rr);
+            }
+            mDNSPlatformMemFree(ag->name);
+            mDNSPlatformMemFree(ag);
+        }
+        AuthHashHead(newhosts, slot) = mDNSNULL;
+    }
+    while (newhosts->rrauth_free)
+    {
+        AuthEntity *const e = newhosts->rrauth_free;
+        newhosts->rrauth_free = e->next;
+        mDNSPlatformMemFree(e);
+    }
+    AuthHashSize(newhosts, 0);
+}
+
+mDNSexport void mDNSPosixUpdateEtcHosts(mDNS *const m, const char *path)
 {
-    (void)m;  // unused
-    (void)rr;
-    (void)result;
+    AuthHash newhosts;
+    struct stat st;
+    char *buffer = mDNSNULL, *line, *end;
+    mDNSu32 lines = 0, added, removed;
+    FILE *fp;
+
+    // A missing file is loaded as an empty one, removing whatever we had
+    if (stat(path, &st) != 0) mDNSPlatformMemZero(&st, sizeof(st));
+    if (gEtcHostsLoaded && st.st_ino == gEtcHostsStat.st_ino && st.st_size == gEtcHostsStat.st_size &&
+        st.st_mtim.tv_sec == gEtcHostsStat.st_mtim.tv_sec && st.st_mtim.tv_nsec == gEtcHostsStat.st_mtim.tv_nsec) return;
+
+    fp = st.st_size > 0 ? fopen(path, "r") : mDNSNULL;
+    if (fp)
+    {
+        buffer = (char *)mDNSPlatformMemAllocate((mDNSu32)st.st_size + 1);
+        if (buffer) buffer[fread(buffer, 1, (size_t)st.st_size, fp)] = 0;
+        fclose(fp);
+        if (!buffer) { LogMsg("mDNSPosixUpdateEtcHosts: no memory for %s", path); return; }
+        for (line = buffer; (line = strchr(line, '\n')) != mDNSNULL; line++) lines++;
+    }
+    gEtcHostsStat   = st;
+    gEtcHostsLoaded = mDNStrue;
+
+    mDNSPlatformMemZero(&newhosts, sizeof(newhosts));
+    AuthHashSize(&newhosts, lines);
+    for (line = buffer; line && *line; line = end)
+    {
+        end = line + strcspn(line, "\n");
+        if (*end) *end++ = 0;
+        EtcHostsParseLine(m, line, &newhosts);
+    }
+    mDNSPlatformMemFree(buffer);
+
+    mDNS_Lock(m);
+    if (newhosts.rrauth_totalused > m->rrauth.rrauth_totalused) AuthHashSize(&m->rrauth, newhosts.rrauth_totalused);
+    else AuthHashSize(&m->rrauth, m->rrauth.rrauth_totalused);
+    removed = EtcHostsDeleteOldEntries(m, &newhosts);
+    added   = EtcHostsAddNewEntries(m, &newhosts);
+    mDNS_Unlock(m);
+    EtcHostsFree(&newhosts);
+    LogMsg("Loaded %s: %u entries added, %u removed", path, added, removed);
 }
 
 
@@ -828,18 +1683,18 @@ mDNSexport int ParseDNSServers(mDNS *m, const char *filePath)
     return (numOfServers > 0) ? 0 : -1;
 }
 
-// Searches the interface list looking for the named interface.
+// Searches the interface list looking for the named interface, which has the given index.
 // Returns a pointer to if it found, or NULL otherwise.
-mDNSlocal PosixNetworkInterface *SearchForInterfaceByName(mDNS *const m, const char *intfName)
+mDNSlocal PosixNetworkInterface *SearchForInterfaceByName(mDNS *const m, const char *intfName, int intfIndex)
 {
     PosixNetworkInterface *intf;
 
     assert(m != NULL);
     assert(intfName != NULL);
 
-    intf = (PosixNetworkInterface*)(m->HostInterfaces);
-    while ((intf != NULL) && (strcmp(intf->intfName, intfName) != 0))
-        intf = (PosixNetworkInterface *)(intf->coreIntf.next);
+    intf = FirstInterfaceForIndex(m, intfIndex);
+    while ((intf != NULL) && (intf->index != intfIndex || strcmp(intf->intfName, intfName) != 0))
+        intf = intf->nextInIndexHash;
 
     return intf;
 }
@@ -854,9 +1709,7 @@ mDNSexport mDNSInterfaceID mDNSPlatformInterfaceIDfromInterfaceIndex(mDNS *const
     if (index == kDNSServiceInterfaceIndexP2P      ) return(mDNSInterface_P2P);
     if (index == kDNSServiceInterfaceIndexAny      ) return(mDNSInterface_Any);
 
-    intf = (PosixNetworkInterface*)(m->HostInterfaces);
-    while ((intf != NULL) && (mDNSu32) intf->index != index)
-        intf = (PosixNetworkInterface *)(intf->coreIntf.next);
+    intf = FirstInterfaceForIndex(m, (int)index);
 
     return (mDNSInterfaceID) intf;
 }
@@ -872,9 +1725,9 @@ mDNSexport mDNSu32 mDNSPlatformInterfaceIndexfromInterfaceID(mDNS *const m, mDNS
     if (id == mDNSInterface_P2P      ) return(kDNSServiceInterfaceIndexP2P);
     if (id == mDNSInterface_Any      ) return(kDNSServiceInterfaceIndexAny);
 
-    intf = (PosixNetworkInterface*)(m->HostInterfaces);
+    intf = m->p->IDHash[InterfaceIDHashSlot(id)];
     while ((intf != NULL) && (mDNSInterfaceID) intf != id)
-        intf = (PosixNetworkInterface *)(intf->coreIntf.next);
+        intf = intf->nextInIDHash;
 
     if (intf) return intf->index;
 
@@ -886,21 +1739,67 @@ mDNSexport mDNSu32 mDNSPlatformInterfaceIndexfromInterfaceID(mDNS *const m, mDNS
     return intf ? intf->index : 0;
 }
 
+#if POSIX_SHARED_MULTICAST_SOCKETS
+// Joins (or leaves) the mDNS group on intf's interface, on the shared socket for the given address family
+mDNSlocal int SharedMulticastMembership(mDNS *const m, PosixNetworkInterface *const intf, int family, mDNSBool join)
+{
+    int err = EINVAL;
+    if (family == AF_INET && m->p->multicastSocket4 != -1)
+    {
+        struct ip_mreqn imr;
+        mDNSPlatformMemZero(&imr, sizeof(imr));
+        imr.imr_multiaddr.s_addr = AllDNSLinkGroup_v4.ip.v4.NotAnInteger;
+        imr.imr_ifindex          = intf->index;
+        err = setsockopt(m->p->multicastSocket4, IPPROTO_IP, join ? IP_ADD_MEMBERSHIP : IP_DROP_MEMBERSHIP, &imr, sizeof(imr));
+        if (err < 0) err = errno;
+        if (err == 0 || (join && err == EADDRINUSE)) { intf->joined4 = join; err = 0; }
+    }
+#if HAVE_IPV6
+    else if (family == AF_INET6 && m->p->multicastSocket6 != -1)
+    {
+        struct ipv6_mreq imr6;
+        imr6.ipv6mr_multiaddr = *(const struct in6_addr*)&AllDNSLinkGroup_v6.ip.v6;
+        imr6.ipv6mr_interface = intf->index;
+        err = setsockopt(m->p->multicastSocket6, IPPROTO_IPV6, join ? IPV6_JOIN_GROUP : IPV6_LEAVE_GROUP, &imr6, sizeof(imr6));
+        if (err < 0) err = errno;
+        if (err == 0 || (join && err == EADDRINUSE)) { intf->joined6 = join; err = 0; }
+    }
+#endif
+    // Leaving fails harmlessly if the interface has already gone, taking its memberships with it
+    if (err && join) LogMsg("SharedMulticastMembership: joining on %s/%d failed: %d (%s)", intf->intfName, intf->index, err, strerror(err));
+    else if (err) debugf("SharedMulticastMembership: leaving on %s/%d failed: %d (%s)", intf->intfName, intf->index, err, strerror(err));
+    return err;
+}
+#endif // POSIX_SHARED_MULTICAST_SOCKETS
+
 // Frees the specified PosixNetworkInterface structure. The underlying
 // interface must have already been deregistered with the mDNS core.
-mDNSlocal void FreePosixNetworkInterface(PosixNetworkInterface *intf)
+mDNSlocal void FreePosixNetworkInterface(mDNS *const m, PosixNetworkInterface *intf)
 {
     int rv;
     assert(intf != NULL);
+    UnhashInterface(m, intf);
+#if POSIX_SHARED_MULTICAST_SOCKETS
+    if (intf->joined4) SharedMulticastMembership(m, intf, AF_INET, mDNSfalse);
+#if HAVE_IPV6
+    if (intf->joined6) SharedMulticastMembership(m, intf, AF_INET6, mDNSfalse);
+#endif
+#endif
     if (intf->intfName != NULL) free((void *)intf->intfName);
     if (intf->multicastSocket4 != -1)
     {
+#if HAVE_EPOLL
+        EpollUnwatchUDPSocket(intf->multicastSocket4);
+#endif
         rv = close(intf->multicastSocket4);
         assert(rv == 0);
     }
 #if HAVE_IPV6
     if (intf->multicastSocket6 != -1)
     {
+#if HAVE_EPOLL
+        EpollUnwatchUDPSocket(intf->multicastSocket6);
+#endif
         rv = close(intf->multicastSocket6);
         assert(rv == 0);
     }
@@ -922,7 +1821,7 @@ mDNSlocal void ClearInterfaceList(mDNS *const m)
         PosixNetworkInterface *intf = (PosixNetworkInterface*)(m->HostInterfaces);
         mDNS_DeregisterInterface(m, &intf->coreIntf, NormalActivation);
         if (gMDNSPlatformPosixVerboseLevel > 0) fprintf(stderr, "Deregistered interface %s\n", intf->intfName);
-        FreePosixNetworkInterface(intf);
+        FreePosixNetworkInterface(m, intf);
     }
     num_registered_interfaces = 0;
     num_pkts_accepted = 0;
@@ -931,6 +1830,7 @@ mDNSlocal void ClearInterfaceList(mDNS *const m)
 
 // Sets up a send/receive socket.
 // If mDNSIPPort port is non-zero, then it's a multicast socket on the specified interface
+// (or, if interfaceIndex is zero, a shared multicast socket that joins the group on each interface afterwards)
 // If mDNSIPPort port is zero, then it's a randomly assigned port number, used for sending unicast queries
 mDNSlocal int SetupSocket(struct sockaddr *intfAddr, mDNSIPPort port, int interfaceIndex, int *sktPtr)
 {
@@ -938,7 +1838,7 @@ mDNSlocal int SetupSocket(struct sockaddr *intfAddr, mDNSIPPort port, int interf
     static const int kOn = 1;
     static const int kIntTwoFiveFive = 255;
     static const unsigned char kByteTwoFiveFive = 255;
-    const mDNSBool JoinMulticastGroup = (port.NotAnInteger != 0);
+    const mDNSBool JoinMulticastGroup = (port.NotAnInteger != 0 && interfaceIndex != 0);
 
     (void) interfaceIndex;  // This parameter unused on plaforms that don't have IPv6
     assert(intfAddr != NULL);
@@ -1022,6 +1922,15 @@ mDNSlocal int SetupSocket(struct sockaddr *intfAddr, mDNSIPPort port, int interf
             // We no longer depend on being able to get the received TTL, so don't worry if the option fails
         }
     #endif
+    #if defined(IP_MULTICAST_ALL)                           // Linux
+        // Only take multicasts that arrive on the interfaces this socket joined the group on, not those for every
+        // interface any socket on the host joined, which we'd only throw away (or which another mdnsd owns)
+        if (err == 0 && port.NotAnInteger)
+        {
+            static const int kOff = 0;
+            setsockopt(*sktPtr, IPPROTO_IP, IP_MULTICAST_ALL, &kOff, sizeof(kOff));
+        }
+    #endif
 
         // Add multicast group membership on this interface
         if (err == 0 && JoinMulticastGroup)
@@ -1088,6 +1997,13 @@ mDNSlocal int SetupSocket(struct sockaddr *intfAddr, mDNSIPPort port, int interf
             if (err < 0) { err = errno; perror("setsockopt - IPV6_HOPLIMIT"); }
         }
     #endif
+    #if defined(IPV6_MULTICAST_ALL)                         // Linux 4.20 and later
+        if (err == 0 && port.NotAnInteger)
+        {
+            static const int kOff = 0;
+            setsockopt(*sktPtr, IPPROTO_IPV6, IPV6_MULTICAST_ALL, &kOff, sizeof(kOff));  // As for IP_MULTICAST_ALL above
+        }
+    #endif
 
         // Add multicast group membership on this interface
         if (err == 0 && JoinMulticastGroup)
@@ -1176,11 +2092,28 @@ mDNSlocal int SetupSocket(struct sockaddr *intfAddr, mDNSIPPort port, int interf
         *sktPtr = -1;
     }
     assert((err == 0) == (*sktPtr != -1));
+#if HAVE_EPOLL
+    if (err == 0) EpollWatchUDPSocket(*sktPtr);
+#endif
     return err;
 }
 
 // Creates a PosixNetworkInterface for the interface whose IP address is
 // intfAddr and whose name is intfName and registers it with mDNS core.
+// Returns the link MTU of the named interface, or zero if it can't be read
+mDNSlocal mDNSu32 GetInterfaceMTU(const char *intfName)
+{
+    struct ifreq ifr;
+    mDNSu32 mtu = 0;
+    int s = socket(AF_INET, SOCK_DGRAM, 0);
+    if (s < 0) return(0);
+    mDNSPlatformMemZero(&ifr, sizeof(ifr));
+    strncpy(ifr.ifr_name, intfName, sizeof(ifr.ifr_name) - 1);
+    if (ioctl(s, SIOCGIFMTU, &ifr) == 0 && ifr.ifr_mtu > 0) mtu = (mDNSu32)ifr.ifr_mtu;
+    close(s);
+    return(mtu);
+}
+
 mDNSlocal int SetupOneInterface(mDNS *const m, struct sockaddr *intfAddr, struct sockaddr *intfMask, const char *intfName, int intfIndex)
 {
     int err = 0;
@@ -1241,7 +2174,7 @@ mDNSlocal int SetupOneInterface(mDNS *const m, struct sockaddr *intfAddr, struct
 #if HAVE_IPV6
         intf->multicastSocket6     = -1;
 #endif
-        alias                      = SearchForInterfaceByName(m, intf->intfName);
+        alias                      = SearchForInterfaceByName(m, intf->intfName, intf->index);
         if (alias == NULL) alias   = intf;
         intf->coreIntf.InterfaceID = (mDNSInterfaceID)alias;
 
@@ -1252,12 +2185,21 @@ mDNSlocal int SetupOneInterface(mDNS *const m, struct sockaddr *intfAddr, struct
     // Set up the multicast socket
     if (err == 0)
     {
+#if POSIX_SHARED_MULTICAST_SOCKETS
+        if (!alias->joined4 && intfAddr->sa_family == AF_INET)
+            err = SharedMulticastMembership(m, alias, AF_INET, mDNStrue);
+#if HAVE_IPV6
+        else if (!alias->joined6 && intfAddr->sa_family == AF_INET6)
+            err = SharedMulticastMembership(m, alias, AF_INET6, mDNStrue);
+#endif
+#else
         if (alias->multicastSocket4 == -1 && intfAddr->sa_family == AF_INET)
             err = SetupSocket(intfAddr, MulticastDNSPort, intf->index, &alias->multicastSocket4);
 #if HAVE_IPV6
         else if (alias->multicastSocket6 == -1 && intfAddr->sa_family == AF_INET6)
             err = SetupSocket(intfAddr, MulticastDNSPort, intf->index, &alias->multicastSocket6);
 #endif
+#endif // POSIX_SHARED_MULTICAST_SOCKETS
     }
 
     // If interface is a direct link, address record will be marked as kDNSRecordTypeKnownUnique
@@ -1268,6 +2210,7 @@ mDNSlocal int SetupOneInterface(mDNS *const m, struct sockaddr *intfAddr, struct
         intf->coreIntf.DirectLink = mDNStrue;
 #endif
     intf->coreIntf.SupportsUnicastMDNSResponse = mDNStrue;
+    intf->coreIntf.MTU = GetInterfaceMTU(intfName);
 
     // The interface is all ready to go, let's register it with the mDNS core.
     if (err == 0)
@@ -1276,6 +2219,7 @@ mDNSlocal int SetupOneInterface(mDNS *const m, struct sockaddr *intfAddr, struct
     // Clean up.
     if (err == 0)
     {
+        HashInterface(m, intf);
         num_registered_interfaces++;
         debugf("SetupOneInterface: %s %#a Registered", intf->intfName, &intf->coreIntf.ip);
         if (gMDNSPlatformPosixVerboseLevel > 0)
@@ -1285,7 +2229,7 @@ mDNSlocal int SetupOneInterface(mDNS *const m, struct sockaddr *intfAddr, struct
     {
         // Use intfName instead of intf->intfName in the next line to avoid dereferencing NULL.
         debugf("SetupOneInterface: %s %#a failed to register %d", intfName, &intf->coreIntf.ip, err);
-        if (intf) { FreePosixNetworkInterface(intf); intf = NULL; }
+        if (intf) { FreePosixNetworkInterface(m, intf); intf = NULL; }
     }
 
     assert((err == 0) == (intf != NULL));
@@ -1293,14 +2237,80 @@ mDNSlocal int SetupOneInterface(mDNS *const m, struct sockaddr *intfAddr, struct
     return err;
 }
 
-// Call get_ifi_info() to obtain a list of active interfaces and call SetupOneInterface() on each one.
+// Returns true if there's no m->p->OnlyInterfaces list, or if name (less any Linux ":label" suffix) is on it
+mDNSlocal mDNSBool InterfaceNameAllowed(const mDNS *const m, const char *const name)
+{
+    const char *list = m->p->OnlyInterfaces;
+    const size_t len = strcspn(name, ":");
+    if (list == NULL) return mDNStrue;
+    while (*list)
+    {
+        const size_t n = strcspn(list, ",");
+        if (n == len && strncmp(list, name, len) == 0) return mDNStrue;
+        list += n;
+        if (*list == ',') list++;
+    }
+    return mDNSfalse;
+}
+
+// Returns the interface index of ifa if it's an address we'd use, or 0 if not
+mDNSlocal int UsableInterfaceIndex(const mDNS *const m, const struct ifaddrs *const ifa)
+{
+    if (ifa->ifa_addr == NULL || ifa->ifa_netmask == NULL) return 0;
+    if (!InterfaceNameAllowed(m, ifa->ifa_name)) return 0;
+    if (!(ifa->ifa_flags & IFF_UP) || (ifa->ifa_flags & IFF_POINTOPOINT)) return 0;
+    if (ifa->ifa_addr->sa_family != AF_INET
+#if HAVE_IPV6
+        && ifa->ifa_addr->sa_family != AF_INET6
+#endif
+        ) return 0;
+    return (int)if_nametoindex(ifa->ifa_name);
+}
+
+mDNSlocal mDNSBool InterfaceMatchesAddr(const PosixNetworkInterface *const intf, const struct ifaddrs *const ifa, const int ifIndex)
+{
+    mDNSAddr ip, mask;
+    SockAddrTomDNSAddr(ifa->ifa_addr, &ip, NULL);
+    SockAddrTomDNSAddr(ifa->ifa_netmask, &mask, NULL);
+    return (intf->index == ifIndex && mDNSSameAddress(&intf->coreIntf.ip, &ip) && mDNSSameAddress(&intf->coreIntf.mask, &mask));
+}
+
+// Deregisters and frees intf. If other addresses of the same interface share its sockets (their InterfaceID is intf)
+// they go too, since the sockets are about to be closed; they're still in the interface list, so the caller sets
+// them up again, with fresh sockets.
+mDNSlocal void RemoveOneInterface(mDNS *const m, PosixNetworkInterface *const intf)
+{
+    PosixNetworkInterface *alias = (PosixNetworkInterface *)(m->HostInterfaces);
+    while (alias)
+    {
+        if (alias != intf && alias->coreIntf.InterfaceID == (mDNSInterfaceID)intf)
+        {
+            RemoveOneInterface(m, alias);
+            alias = (PosixNetworkInterface *)(m->HostInterfaces);     // List has changed; start over
+        }
+        else alias = (PosixNetworkInterface *)(alias->coreIntf.next);
+    }
+    mDNS_DeregisterInterface(m, &intf->coreIntf, NormalActivation);
+    if (gMDNSPlatformPosixVerboseLevel > 0) fprintf(stderr, "Deregistered interface %s\n", intf->intfName);
+    debugf("RemoveOneInterface: %s %#a Deregistered", intf->intfName, &intf->coreIntf.ip);
+    FreePosixNetworkInterface(m, intf);
+    num_registered_interfaces--;
+}
+
+// Call getifaddrs() to obtain a list of active interfaces and bring the registered interfaces into line with it:
+// addresses that have gone away are deregistered and ones that have appeared are set up with SetupOneInterface(),
+// while those that are unchanged, along with their sockets and everything the core has learned on them, are left
+// alone. At startup nothing is registered yet, so everything is set up.
 mDNSlocal int SetupInterfaceList(mDNS *const m)
 {
-    mDNSBool foundav4       = mDNSfalse;
     int err            = 0;
-    struct ifaddrs *intfList;
+    struct ifaddrs *intfList = NULL;
+    struct ifaddrs *i;
     struct ifaddrs *firstLoopback = NULL;
-    int firstLoopbackIndex = 0;
+    mDNSBool havev4    = mDNSfalse;
+    int numAddrs       = 0;
+    int *indices       = NULL;
+    int n;
 
     assert(m != NULL);
     debugf("SetupInterfaceList");
@@ -1311,58 +2321,64 @@ mDNSlocal int SetupInterfaceList(mDNS *const m)
     }
     if (intfList == NULL) err = ENOENT;
 
+    // Look up each address's interface index once, rather than once per comparison below. Zero means unusable.
+    if (err == 0)
+    {
+        for (i = intfList; i; i = i->ifa_next) numAddrs++;
+        indices = (int *)calloc(numAddrs, sizeof(*indices));
+        if (indices == NULL) err = ENOMEM;
+    }
+
     if (err == 0)
     {
-        struct ifaddrs *i = intfList;
-        while (i)
+        PosixNetworkInterface *intf;
+
+        for (i = intfList, n = 0; i; i = i->ifa_next, n++)
         {
-            if (     i->ifa_addr != NULL &&
-                     ((i->ifa_addr->sa_family == AF_INET)
-#if HAVE_IPV6
-                      || (i->ifa_addr->sa_family == AF_INET6)
-#endif
-                      ) &&  (i->ifa_flags & IFF_UP) && !(i->ifa_flags & IFF_POINTOPOINT))
+            indices[n] = UsableInterfaceIndex(m, i);
+            if (!indices[n]) continue;
+            if (i->ifa_flags & IFF_LOOPBACK)
             {
-                int ifIndex = if_nametoindex(i->ifa_name);
-                if (ifIndex == 0)
-                {
-                    continue;
-                }
-                if (i->ifa_flags & IFF_LOOPBACK)
-                {
-                    if (firstLoopback == NULL)
-                    {
-                        firstLoopback = i;
-                        firstLoopbackIndex = ifIndex;
-                    }
-                }
-                else
-                {
-                    if (SetupOneInterface(m, i->ifa_addr, i->ifa_netmask, i->ifa_name, ifIndex) == 0)
-                    {
-                        if (i->ifa_addr->sa_family == AF_INET)
-                        {
-                            foundav4 = mDNStrue;
-                        }
-                    }
-                }
+                if (firstLoopback == NULL) firstLoopback = i;
             }
-            i = i->ifa_next;
+            else if (i->ifa_addr->sa_family == AF_INET) havev4 = mDNStrue;
         }
 
-        // If we found no normal interfaces but we did find a loopback interface, register the
-        // loopback interface.  This allows self-discovery if no interfaces are configured.
+        // If we found no normal interfaces but we did find a loopback interface, use the loopback interface.
+        // This allows self-discovery if no interfaces are configured.
         // Temporary workaround: Multicast loopback on IPv6 interfaces appears not to work.
         // In the interim, we skip loopback interface only if we found at least one v4 interface to use
-        // if ((m->HostInterfaces == NULL) && (firstLoopback != NULL))
-        if (!foundav4 && firstLoopback)
+        if (havev4) firstLoopback = NULL;
+        for (i = intfList, n = 0; i; i = i->ifa_next, n++)
+            if ((i->ifa_flags & IFF_LOOPBACK) && i != firstLoopback) indices[n] = 0;
+
+        // First deregister whatever's gone; cf. ClearInterfaceList()
+        intf = (PosixNetworkInterface *)(m->HostInterfaces);
+        while (intf)
+        {
+            for (i = intfList, n = 0; i; i = i->ifa_next, n++)
+                if (indices[n] && InterfaceMatchesAddr(intf, i, indices[n])) break;
+            if (i == NULL)
+            {
+                RemoveOneInterface(m, intf);
+                intf = (PosixNetworkInterface *)(m->HostInterfaces);  // List has changed; start over
+            }
+            else intf = (PosixNetworkInterface *)(intf->coreIntf.next);
+        }
+
+        // Then set up whatever's new
+        for (i = intfList, n = 0; i; i = i->ifa_next, n++)
         {
-            (void)SetupOneInterface(m, firstLoopback->ifa_addr, firstLoopback->ifa_netmask, firstLoopback->ifa_name,
-                                    firstLoopbackIndex);
+            if (!indices[n]) continue;
+            for (intf = (PosixNetworkInterface *)(m->HostInterfaces); intf; intf = (PosixNetworkInterface *)(intf->coreIntf.next))
+                if (InterfaceMatchesAddr(intf, i, indices[n])) break;
+            if (intf == NULL)
+                (void)SetupOneInterface(m, i->ifa_addr, i->ifa_netmask, i->ifa_name, indices[n]);
         }
     }
 
     // Clean up.
+    if (indices != NULL) free(indices);
     if (intfList != NULL) freeifaddrs(intfList);
 
     // Clean up any interfaces that have been hanging around on the RecentInterfaces list for more than a minute
@@ -1401,6 +2417,9 @@ mDNSlocal mStatus OpenIfNotifySocket(int *pFD)
     mDNSPlatformMemZero(&snl, sizeof snl);
     snl.nl_family = AF_NETLINK;
     snl.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR;
+#if HAVE_IPV6
+    snl.nl_groups |= RTMGRP_IPV6_IFADDR;
+#endif
     ret = bind(sock, (struct sockaddr *) &snl, sizeof snl);
     if (0 == ret)
         *pFD = sock;
@@ -1439,7 +2458,7 @@ mDNSlocal void      PrintNetLinkMsg(const struct nlmsghdr *pNLMsg)
 
 mDNSlocal mDNSu32       ProcessRoutingNotification(int sd)
 // Read through the messages on sd and if any indicate that any interface records should
-// be torn down and rebuilt, return affected indices as a bitmask. Otherwise return 0.
+// be torn down and rebuilt, return affected indices as a bitmask (modulo 32). Otherwise return 0.
 {
     ssize_t readCount;
     char buff[4096];
@@ -1480,9 +2499,9 @@ mDNSlocal mDNSu32       ProcessRoutingNotification(int sd)
 
         // Process the NetLink message
         if (pNLMsg->nlmsg_type == RTM_GETLINK || pNLMsg->nlmsg_type == RTM_NEWLINK)
-            result |= 1 << ((struct ifinfomsg*) NLMSG_DATA(pNLMsg))->ifi_index;
+            result |= 1U << (((struct ifinfomsg*) NLMSG_DATA(pNLMsg))->ifi_index & 31);
         else if (pNLMsg->nlmsg_type == RTM_DELADDR || pNLMsg->nlmsg_type == RTM_NEWADDR)
-            result |= 1 << ((struct ifaddrmsg*) NLMSG_DATA(pNLMsg))->ifa_index;
+            result |= 1U << (((struct ifaddrmsg*) NLMSG_DATA(pNLMsg))->ifa_index & 31);
 
         // Advance pNLMsg to the next message in the buffer
         if ((pNLMsg->nlmsg_flags & NLM_F_MULTI) != 0 && pNLMsg->nlmsg_type != NLMSG_DONE)
@@ -1528,7 +2547,7 @@ mDNSlocal void      PrintRoutingSocketMsg(const struct ifa_msghdr *pRSMsg)
 
 mDNSlocal mDNSu32       ProcessRoutingNotification(int sd)
 // Read through the messages on sd and if any indicate that any interface records should
-// be torn down and rebuilt, return affected indices as a bitmask. Otherwise return 0.
+// be torn down and rebuilt, return affected indices as a bitmask (modulo 32). Otherwise return 0.
 {
     ssize_t readCount;
     char buff[4096];
@@ -1548,9 +2567,9 @@ mDNSlocal mDNSu32       ProcessRoutingNotification(int sd)
         pRSMsg->ifam_type == RTM_IFINFO)
     {
         if (pRSMsg->ifam_type == RTM_IFINFO)
-            result |= 1 << ((struct if_msghdr*) pRSMsg)->ifm_index;
+            result |= 1U << (((struct if_msghdr*) pRSMsg)->ifm_index & 31);
         else
-            result |= 1 << pRSMsg->ifam_index;
+            result |= 1U << (pRSMsg->ifam_index & 31);
     }
 
     return result;
@@ -1577,9 +2596,8 @@ mDNSlocal void InterfaceChangeCallback(int fd, void *context)
     }
     while (0 < select(pChgRec->NotifySD + 1, &readFDs, (fd_set*) NULL, (fd_set*) NULL, &zeroTimeout));
 
-    // Currently we rebuild the entire interface list whenever any interface change is
-    // detected. If this ever proves to be a performance issue in a multi-homed
-    // configuration, more care should be paid to changedInterfaces.
+    // Any change brings the whole interface list up to date, but only the addresses
+    // that have actually come or gone are registered or deregistered.
     if (changedInterfaces)
         mDNSPlatformPosixRefreshInterfaceList(pChgRec->mDNS);
 }
@@ -1645,6 +2663,16 @@ mDNSexport mStatus mDNSPlatformInit(mDNS *const m)
 
     mDNS_SetFQDN(m);
 
+    mDNSPlatformMemZero(m->p->IndexHash, sizeof(m->p->IndexHash));
+    mDNSPlatformMemZero(m->p->IDHash, sizeof(m->p->IDHash));
+
+    err = PosixLockInit(m->p);
+#if HAVE_IO_URING
+    if (err == mStatus_NoError && m->p->UseIoUring && EpollFD() >= 0) UringInit();
+#else
+    if (m->p->UseIoUring) LogMsg("mDNSPlatformInit: built without io_uring support; using the usual event loop");
+#endif
+
     sa.sa_family = AF_INET;
     m->p->unicastSocket4 = -1;
     if (err == mStatus_NoError) err = SetupSocket(&sa, zeroIPPort, 0, &m->p->unicastSocket4);
@@ -1652,6 +2680,17 @@ mDNSexport mStatus mDNSPlatformInit(mDNS *const m)
     sa.sa_family = AF_INET6;
     m->p->unicastSocket6 = -1;
     if (err == mStatus_NoError) err = SetupSocket(&sa, zeroIPPort, 0, &m->p->unicastSocket6);
+#endif
+#if POSIX_SHARED_MULTICAST_SOCKETS
+    // One multicast socket of each family serves every interface; SetupOneInterface() joins the group on each
+    sa.sa_family = AF_INET;
+    m->p->multicastSocket4 = -1;
+    if (err == mStatus_NoError) err = SetupSocket(&sa, MulticastDNSPort, 0, &m->p->multicastSocket4);
+#if HAVE_IPV6
+    sa.sa_family = AF_INET6;
+    m->p->multicastSocket6 = -1;
+    if (err == mStatus_NoError) err = SetupSocket(&sa, MulticastDNSPort, 0, &m->p->multicastSocket6);
+#endif
 #endif
 
     // Tell mDNS core about the network interfaces on this machine.
@@ -1691,16 +2730,46 @@ mDNSexport void mDNSPlatformClose(mDNS *const m)
     ClearInterfaceList(m);
     if (m->p->unicastSocket4 != -1)
     {
+#if HAVE_EPOLL
+        EpollUnwatchUDPSocket(m->p->unicastSocket4);
+#endif
         rv = close(m->p->unicastSocket4);
         assert(rv == 0);
     }
 #if HAVE_IPV6
     if (m->p->unicastSocket6 != -1)
     {
+#if HAVE_EPOLL
+        EpollUnwatchUDPSocket(m->p->unicastSocket6);
+#endif
         rv = close(m->p->unicastSocket6);
         assert(rv == 0);
     }
 #endif
+#if POSIX_SHARED_MULTICAST_SOCKETS
+    if (m->p->multicastSocket4 != -1)
+    {
+#if HAVE_EPOLL
+        EpollUnwatchUDPSocket(m->p->multicastSocket4);
+#endif
+        rv = close(m->p->multicastSocket4);
+        assert(rv == 0);
+    }
+#if HAVE_IPV6
+    if (m->p->multicastSocket6 != -1)
+    {
+#if HAVE_EPOLL
+        EpollUnwatchUDPSocket(m->p->multicastSocket6);
+#endif
+        rv = close(m->p->multicastSocket6);
+        assert(rv == 0);
+    }
+#endif
+#endif
+#if HAVE_IO_URING
+    UringClose();
+#endif
+    PosixLockClose(m->p);
 }
 
 // This is used internally by InterfaceChangeCallback.
@@ -1709,10 +2778,8 @@ mDNSexport void mDNSPlatformClose(mDNS *const m)
 mDNSexport mStatus mDNSPlatformPosixRefreshInterfaceList(mDNS *const m)
 {
     int err;
-    // This is a pretty heavyweight way to process interface changes --
-    // destroying the entire interface list and then making fresh one from scratch.
-    // We should make it like the OS X version, which leaves unchanged interfaces alone.
-    ClearInterfaceList(m);
+    // Like the OS X version, this leaves unchanged interfaces alone;
+    // see SetupInterfaceList().
     err = SetupInterfaceList(m);
     return PosixErrorToStatus(err);
 }
@@ -1721,21 +2788,57 @@ mDNSexport mStatus mDNSPlatformPosixRefreshInterfaceList(mDNS *const m)
 #pragma mark ***** Locking
 #endif
 
-// On the Posix platform, locking is a no-op because we only ever enter
-// mDNS core on the main thread.
+// The platform lock is a recursive mutex, because the core takes it again when a client callback it's running
+// calls back into the mDNS API. Most of the time only the event loop thread enters the core and the lock costs
+// an uncontended trylock.
+// Before mDNSPlatformInit has set the mutex up there can only be the one thread, and the lock does nothing.
 
 // mDNS core calls this routine when it wants to prevent
 // the platform from reentering mDNS core code.
 mDNSexport void    mDNSPlatformLock   (const mDNS *const m)
 {
-    (void) m;   // Unused
+    mDNS_PlatformSupport *const p = m->p;
+    if (!p || !p->LockReady) return;
+    if (pthread_mutex_trylock(&p->Lock) != 0)
+    {
+        const mDNSs32 start = mDNSPlatformRawTime();
+        pthread_mutex_lock(&p->Lock);
+        p->LockContended++;
+        p->LockWait[ExecuteHistogramBucket(mDNSPlatformRawTime() - start)]++;
+    }
 }
 
 // mDNS core calls this routine when it release the lock taken by
 // mDNSPlatformLock and allow the platform to reenter mDNS core code.
 mDNSexport void    mDNSPlatformUnlock (const mDNS *const m)
 {
-    (void) m;   // Unused
+    mDNS_PlatformSupport *const p = m->p;
+    if (!p || !p->LockReady) return;
+    pthread_mutex_unlock(&p->Lock);
+}
+
+mDNSlocal mStatus PosixLockInit(mDNS_PlatformSupport *const p)
+{
+    pthread_mutexattr_t attr;
+    int err;
+    if (p->LockReady) return(mStatus_NoError);
+    err = pthread_mutexattr_init(&attr);
+    if (!err)
+    {
+        err = pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+        if (!err) err = pthread_mutex_init(&p->Lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+    }
+    if (err) { LogMsg("PosixLockInit: can't set up the platform lock: %s", strerror(err)); return(mStatus_UnknownErr); }
+    p->LockReady = mDNStrue;
+    return(mStatus_NoError);
+}
+
+mDNSlocal void PosixLockClose(mDNS_PlatformSupport *const p)
+{
+    if (!p->LockReady) return;
+    p->LockReady = mDNSfalse;
+    pthread_mutex_destroy(&p->Lock);
 }
 
 #if COMPILER_LIKES_PRAGMA_MARK
@@ -1826,9 +2929,9 @@ mDNSexport void  mDNSPlatformMemZero(void *dst, mDNSu32 len)
     memset(dst, 0, len);
 }
 
-#if !MDNS_MALLOC_DEBUGGING
+#if !MDNS_MALLOC_DEBUGGING && !MDNS_MALLOC_PROFILING
 mDNSexport void *mDNSPlatformMemAllocate(mDNSu32 len)      { return(mallocL("mDNSPlatformMemAllocate", len)); }
-mDNSexport void *mDNSPlatformMemAllocateClear(mDNSu32 len) { return(callocL(name, len)); }
+mDNSexport void *mDNSPlatformMemAllocateClear(mDNSu32 len) { return(callocL("mDNSPlatformMemAllocateClear", len)); }
 mDNSexport void  mDNSPlatformMemFree    (void *mem)        {          freeL("mDNSPlatformMemFree", mem); }
 #endif
 
@@ -1856,6 +2959,20 @@ mDNSexport mStatus mDNSPlatformTimeInit(void)
     return(mStatus_NoError);
 }
 
+#if POSIX_VIRTUAL_TIME
+mDNSexport mDNSs32 gPosixVirtualRawTime;
+mDNSexport mDNSs32 gPosixVirtualUTC;
+
+mDNSexport mDNSs32  mDNSPlatformRawTime()
+{
+    return gPosixVirtualRawTime;
+}
+
+mDNSexport mDNSs32 mDNSPlatformUTC(void)
+{
+    return gPosixVirtualUTC;
+}
+#else
 mDNSexport mDNSs32  mDNSPlatformRawTime()
 {
     struct timespec tm;
@@ -1876,6 +2993,7 @@ mDNSexport mDNSs32 mDNSPlatformUTC(void)
 {
     return time(NULL);
 }
+#endif // POSIX_VIRTUAL_TIME
 
 mDNSexport void mDNSPlatformSendWakeupPacket(mDNSInterfaceID InterfaceID, char *EthAddr, char *IPAddr, int iteration)
 {
@@ -1919,6 +3037,12 @@ mDNSexport void mDNSPlatformSendKeepalive(mDNSAddr *sadd, mDNSAddr *dadd, mDNSIP
     (void) win;     // Unused
 }
 
+mDNSexport void mDNSPlatformSendKeepalives(const mDNSKeepalivePacket *packets, int count)
+{
+    (void) packets; // Unused
+    (void) count;   // Unused
+}
+
 mDNSexport mStatus mDNSPlatformRetrieveTCPInfo(mDNSAddr *laddr, mDNSIPPort *lport, mDNSAddr *raddr, mDNSIPPort *rport, mDNSTCPInfo *mti)
 {
     (void) laddr;   // Unused
@@ -2001,6 +3125,12 @@ mDNSexport void mDNSPosixGetFDSetForSelect(mDNS *m, int *nfds, fd_set *readfds,
     if (m->p->unicastSocket4 != -1) mDNSPosixAddToFDSet(&numFDs, readfds, m->p->unicastSocket4);
 #if HAVE_IPV6
     if (m->p->unicastSocket6 != -1) mDNSPosixAddToFDSet(&numFDs, readfds, m->p->unicastSocket6);
+#endif
+#if POSIX_SHARED_MULTICAST_SOCKETS
+    if (m->p->multicastSocket4 != -1) mDNSPosixAddToFDSet(&numFDs, readfds, m->p->multicastSocket4);
+#if HAVE_IPV6
+    if (m->p->multicastSocket6 != -1) mDNSPosixAddToFDSet(&numFDs, readfds, m->p->multicastSocket6);
+#endif
 #endif
     while (info)
     {
@@ -2015,6 +3145,9 @@ mDNSexport void mDNSPosixGetFDSetForSelect(mDNS *m, int *nfds, fd_set *readfds,
     // to initialize their FD sets first and then call mDNSPosixGetFDSet()
     for (iSource = gEventSources; iSource; iSource = iSource->next)
     {
+#if HAVE_EPOLL
+        if (iSource->fd >= (int) FD_SETSIZE) continue;  // Only reachable through mDNSPosixRunEventLoopOnce()
+#endif
         if (iSource->readCallback != NULL)
             FD_SET(iSource->fd, readfds);
         if (iSource->writeCallback != NULL)
@@ -2025,13 +3158,79 @@ mDNSexport void mDNSPosixGetFDSetForSelect(mDNS *m, int *nfds, fd_set *readfds,
     *nfds = numFDs;
 }
 
+mDNSexport mDNSs32 mDNSPosixExecute(mDNS *const m)
+{
+    mDNSs32 nextevent;
+#if HAVE_SENDMMSG
+    // Everything one round of SendQueries and SendResponses multicasts goes out together when mDNS_Execute returns
+    gSendBatch.open = mDNStrue;
+    nextevent = mDNS_Execute(m);
+    FlushSendBatch(m);
+    gSendBatch.open = mDNSfalse;
+#else
+    nextevent = mDNS_Execute(m);
+#endif
+    return nextevent;
+}
+
+mDNSexport int mDNSPosixWriteBatch(mDNS *const m, const int *fds, struct iovec *const *iovs, const int *iovcnts,
+                                   ssize_t *results, int count)
+{
+#if HAVE_IO_URING
+    struct msghdr msgs[UringSendEntries];
+    struct io_uring_cqe *cqe;
+    int done, i, n;
+
+    if (!gUringActive) return -1;
+    for (done = 0; done < count; done += n)
+    {
+        int queued = 0;
+        n = (count - done < UringSendEntries) ? count - done : UringSendEntries;
+        for (i = 0; i < n; i++)
+        {
+            struct io_uring_sqe *const sqe = my_uring_get_sqe(&gSendRing);
+            results[done + i] = -EAGAIN;    // Until we hear otherwise
+            if (!sqe) continue;
+            mDNSPlatformMemZero(&msgs[i], sizeof(msgs[i]));
+            msgs[i].msg_iov    = iovs[done + i];
+            msgs[i].msg_iovlen = iovcnts[done + i];
+            sqe->opcode    = IORING_OP_SENDMSG;
+            sqe->fd        = fds[done + i];
+            sqe->addr      = (unsigned long)&msgs[i];
+            sqe->len       = 1;
+            sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+            sqe->user_data = (uint64_t)(done + i);
+            queued++;
+        }
+        if (my_uring_submit(&gSendRing, (unsigned int)queued) < 0)
+            LogMsg("mDNSPosixWriteBatch: io_uring_enter failed: %s", strerror(errno));
+        while ((cqe = my_uring_peek_cqe(&gSendRing)) != mDNSNULL)
+        {
+            if (cqe->user_data < (uint64_t)count) results[cqe->user_data] = cqe->res;
+            my_uring_cqe_seen(&gSendRing);
+        }
+        m->p->UringClientBatches++;
+        m->p->UringClientWrites += queued;
+    }
+    return count;
+#else
+    (void)m;
+    (void)fds;
+    (void)iovs;
+    (void)iovcnts;
+    (void)results;
+    (void)count;
+    return -1;
+#endif
+}
+
 mDNSexport void mDNSPosixGetNextDNSEventTime(mDNS *m, struct timeval *timeout)
 {
     mDNSs32 ticks;
     struct timeval interval;
 
     // 1. Call mDNS_Execute() to let mDNSCore do what it needs to do
-    mDNSs32 nextevent = mDNS_Execute(m);
+    mDNSs32 nextevent = mDNSPosixExecute(m);
 
     // 3. Calculate the time remaining to the next scheduled event (in struct timeval format)
     ticks = nextevent - mDNS_TimeNow(m);
@@ -2070,6 +3269,20 @@ mDNSexport void mDNSPosixProcessFDSet(mDNS *const m, fd_set *readfds, fd_set *wr
         FD_CLR(m->p->unicastSocket6, readfds);
         SocketDataReady(m, NULL, m->p->unicastSocket6);
     }
+#endif
+#if POSIX_SHARED_MULTICAST_SOCKETS
+    if (m->p->multicastSocket4 != -1 && FD_ISSET(m->p->multicastSocket4, readfds))
+    {
+        FD_CLR(m->p->multicastSocket4, readfds);
+        SocketDataReady(m, NULL, m->p->multicastSocket4);
+    }
+#if HAVE_IPV6
+    if (m->p->multicastSocket6 != -1 && FD_ISSET(m->p->multicastSocket6, readfds))
+    {
+        FD_CLR(m->p->multicastSocket6, readfds);
+        SocketDataReady(m, NULL, m->p->multicastSocket6);
+    }
+#endif
 #endif
 
     while (info)
@@ -2117,7 +3330,12 @@ mDNSlocal void requestIOEvents(PosixEventSource *newSource, const char *taskName
 {
     PosixEventSource **epp = &gEventSources;
 
+#if HAVE_EPOLL
+    // With epoll there's no FD_SETSIZE limit, except for clients running their own select() loop
+    if ((newSource->fd >= (int) FD_SETSIZE && EpollFD() < 0) || newSource->fd < 0)
+#else
     if (newSource->fd >= (int) FD_SETSIZE || newSource->fd < 0)
+#endif
     {
         LogMsg("requestIOEvents called with fd %d > FD_SETSIZE %d.", newSource->fd, FD_SETSIZE);
         assert(0);
@@ -2163,6 +3381,9 @@ mDNSlocal void requestIOEvents(PosixEventSource *newSource, const char *taskName
         newSource->flags |= PosixEventFlag_Write;
         newSource->writeTaskName = taskName;
     }
+#if HAVE_EPOLL
+    EpollUpdateInterest(newSource);
+#endif
 }
 
 mDNSlocal void requestReadEvents(PosixEventSource *eventSource,
@@ -2197,6 +3418,9 @@ mDNSlocal mStatus stopReadOrWriteEvents(int fd, mDNSBool freeContext, mDNSBool r
                 iSource->writeCallback = NULL;
                 iSource->writeContext = NULL;
             }
+#if HAVE_EPOLL
+            EpollUpdateInterest(iSource);
+#endif
             if (iSource->writeCallback == NULL && iSource->readCallback == NULL)
             {
                 if (removeContext || freeContext)
@@ -2233,6 +3457,21 @@ mStatus mDNSPosixRemoveFDFromEventLoop(int fd)
     return stopReadOrWriteEvents(fd, mDNStrue, mDNStrue, PosixEventFlag_Read | PosixEventFlag_Write);
 }
 
+// Asks for one call to callback as soon as fd, which must already have been added with mDNSPosixAddFDToEventLoop,
+// can be written to. Like every write event, it's one-shot, so ask again if it's still wanted after that.
+mStatus mDNSPosixRequestWriteEvent(int fd, mDNSPosixEventCallback callback, void *context)
+{
+    PosixEventSource *iSource;
+
+    for (iSource = gEventSources; iSource; iSource = iSource->next)
+        if (iSource->fd == fd)
+        {
+            requestWriteEvents(iSource, "mDNSPosixRequestWriteEvent", callback, context);
+            return mStatus_NoError;
+        }
+    return mStatus_NoSuchNameErr;
+}
+
 // Simply note the received signal in gEventSignals.
 mDNSlocal void  NoteSignal(int signum)
 {
@@ -2269,6 +3508,169 @@ mStatus mDNSPosixIgnoreSignalInEventLoop(int signum)
     return err;
 }
 
+#if HAVE_EPOLL
+// Returns mDNStrue if fd is one of our UDP sockets, setting *intf to the interface it belongs to,
+// or NULL for the unicast sockets and the shared multicast ones
+mDNSlocal mDNSBool FindUDPSocketOwner(mDNS *const m, int fd, PosixNetworkInterface **intf)
+{
+    PosixNetworkInterface *info;
+
+    *intf = NULL;
+    if (fd == m->p->unicastSocket4) return mDNStrue;
+#if HAVE_IPV6
+    if (fd == m->p->unicastSocket6) return mDNStrue;
+#endif
+#if POSIX_SHARED_MULTICAST_SOCKETS
+    if (IsSharedMulticastSocket(m, fd)) return mDNStrue;
+#endif
+    for (info = (PosixNetworkInterface *)(m->HostInterfaces); info; info = (PosixNetworkInterface *)(info->coreIntf.next))
+    {
+        if (fd == info->multicastSocket4) { *intf = info; return mDNStrue; }
+#if HAVE_IPV6
+        if (fd == info->multicastSocket6) { *intf = info; return mDNStrue; }
+#endif
+    }
+    return mDNSfalse;
+}
+
+#if HAVE_IO_URING
+// Reaps up to UringRecvBuffers receive completions and hands the datagrams to mDNSCore in one batch, straight out of
+// the provided buffers, which are then given back to the kernel. Any socket whose multishot receive has stopped (the
+// kernel does that when it runs out of buffers) is armed again once they're back.
+mDNSlocal void UringDispatch(mDNS *const m)
+{
+    static mDNSReceivedPacket received[UringRecvBuffers];
+    unsigned int bids[UringRecvBuffers];
+    int rearm[UringRecvBuffers];
+    int nbids = 0, nrearm = 0, i;
+    mDNSu32 count = 0;
+    struct io_uring_cqe *cqe;
+
+    while (nbids < UringRecvBuffers && nrearm < UringRecvBuffers && (cqe = my_uring_peek_cqe(&gRecvRing)) != mDNSNULL)
+    {
+        const int fd = (int)(uint32_t)cqe->user_data;
+        const mDNSu32 gen = (mDNSu32)(cqe->user_data >> 32);
+        const mDNSBool current = (gen != 0 && fd < gUringWatchSize && gUringWatch[fd] == gen);
+
+        if (cqe->flags & IORING_CQE_F_BUFFER)
+        {
+            const unsigned int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            PosixNetworkInterface *intf;
+            bids[nbids++] = bid;
+            if (current && cqe->res > 0 && FindUDPSocketOwner(m, fd, &intf))
+            {
+                mDNSReceivedPacket *const pkt = &received[count];
+                struct my_recv_datagram dgram;
+                my_uring_recvmsg_results(&gRecvTemplate, gRecvBufs.mem + bid * gRecvBufs.bufsize, cqe->res, &dgram);
+#if POSIX_SHARED_MULTICAST_SOCKETS
+                if (IsSharedMulticastSocket(m, fd)) intf = SharedSocketInterface(m, fd, dgram.pktinfo.ipi_ifindex);
+                if (!intf && IsSharedMulticastSocket(m, fd)) dgram.len = -1;
+#endif
+                m->p->UringReceives++;
+                if (dgram.len >= 0 && AcceptReceivedPacket(intf, fd, dgram.flags, &dgram.from, &dgram.pktinfo,
+                                                           &pkt->srcaddr, &pkt->srcport, &pkt->dstaddr))
+                {
+                    pkt->msg         = (DNSMessage *)dgram.ptr;
+                    pkt->end         = (mDNSu8 *)dgram.ptr + dgram.len;
+                    pkt->dstport     = MulticastDNSPort;
+                    pkt->InterfaceID = intf ? intf->coreIntf.InterfaceID : NULL;
+                    count++;
+                }
+            }
+        }
+        if (current && !(cqe->flags & IORING_CQE_F_MORE))
+        {
+            if (cqe->res == -ENOBUFS) m->p->UringStarved++;
+            else if (cqe->res < 0) LogMsg("UringDispatch: receive on socket %d stopped: %s", fd, strerror(-cqe->res));
+            rearm[nrearm++] = fd;
+        }
+        my_uring_cqe_seen(&gRecvRing);
+    }
+
+    mDNSCoreReceiveBatch(m, received, count);
+
+    for (i = 0; i < nbids; i++) my_uring_bufs_put(&gRecvBufs, bids[i]);
+    for (i = 0; i < nrearm; i++)
+    {
+        // Unless the socket was closed meanwhile
+        if (gUringWatch[rearm[i]]) { UringArm(rearm[i]); m->p->UringRearms++; }
+    }
+    if (nrearm && my_uring_submit(&gRecvRing, 0) < 0) LogMsg("UringDispatch: io_uring_enter failed: %s", strerror(errno));
+}
+#endif // HAVE_IO_URING
+
+mDNSlocal void EpollDispatchUDPSocket(mDNS *const m, int fd)
+{
+    PosixNetworkInterface *intf;
+
+#if HAVE_IO_URING
+    if (gUringActive && fd == gRecvRing.fd) { UringDispatch(m); return; }
+#endif
+    if (FindUDPSocketOwner(m, fd, &intf)) SocketDataReady(m, intf, fd);
+}
+
+// The most PosixEventSource callbacks EpollWaitAndDispatch makes per wait. Sources left over are still ready, since
+// the epoll set is level-triggered, so they're served next time round, after the core has had a chance to run;
+// otherwise a burst of client connections and requests could hold up our multicast traffic until it had all been handled.
+#ifndef EpollMaxSourceCallbacks
+#define EpollMaxSourceCallbacks 16
+#endif
+
+// Waits for events on the epoll set and dispatches them: every packet socket first, then up to
+// EpollMaxSourceCallbacks event sources. Returns the number of events, or -1 on error.
+mDNSlocal int EpollWaitAndDispatch(mDNS *const m, const struct timeval *timeout)
+{
+    int i, numReady, numSources = 0;
+    const int ms = (int)(timeout->tv_sec * 1000 + (timeout->tv_usec + 999) / 1000);
+
+    numReady = epoll_wait(gEpollFD, gEpollReady, EpollMaxEvents, ms);
+    if (numReady <= 0) return numReady;
+
+    gEpollReadyCount = numReady;
+    for (i = 0; i < numReady; i++)
+    {
+        const struct epoll_event *const ev = &gEpollReady[i];
+        if (ev->data.u64 & EpollUDPSocketTag) EpollDispatchUDPSocket(m, (int)(uint32_t)ev->data.u64);
+    }
+    for (i = 0; i < numReady && numSources < EpollMaxSourceCallbacks; i++)
+    {
+        const struct epoll_event *const ev = &gEpollReady[i];
+        PosixEventSource *source;
+
+        if (ev->data.u64 == 0) continue;        // Its fd left the epoll set after epoll_wait returned
+        if (ev->data.u64 & EpollUDPSocketTag) continue;
+
+        numSources++;
+        source = (PosixEventSource *)(uintptr_t)ev->data.u64;
+        if ((ev->events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && source->readCallback != NULL)
+        {
+            source->readCallback(source->fd, source->readContext);
+            if (ev->data.u64 == 0) continue;    // The callback removed this event source
+        }
+        if ((ev->events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) && source->writeCallback != NULL)
+        {
+            mDNSPosixEventCallback writeCallback = source->writeCallback;
+            void *writeContext = source->writeContext;
+            // Write events are one-shot, as in mDNSPosixProcessFDSet()
+            source->writeCallback = NULL;
+            EpollUpdateInterest(source);
+            writeCallback(source->fd, writeContext);
+        }
+    }
+    gEpollReadyCount = 0;
+    return numReady;
+}
+#endif // HAVE_EPOLL
+
+// Collect the signals we're listening for that have arrived since the last time round
+mDNSlocal void GetReceivedSignals(sigset_t *pSignalsReceived)
+{
+    (void) sigprocmask(SIG_BLOCK, &gEventSignalSet, (sigset_t*) NULL);
+    *pSignalsReceived = gEventSignals;
+    sigemptyset(&gEventSignals);
+    (void) sigprocmask(SIG_UNBLOCK, &gEventSignalSet, (sigset_t*) NULL);
+}
+
 // Do a single pass through the attendent event sources and dispatch any found to their callbacks.
 // Return as soon as internal timeout expires, or a signal we're listening for is received.
 mStatus mDNSPosixRunEventLoopOnce(mDNS *m, const struct timeval *pTimeout,
@@ -2279,6 +3681,23 @@ mStatus mDNSPosixRunEventLoopOnce(mDNS *m, const struct timeval *pTimeout,
     int numFDs = 0, numReady;
     struct timeval timeout = *pTimeout;
 
+#if HAVE_EPOLL
+    if (EpollFD() >= 0)
+    {
+        mDNSPosixGetNextDNSEventTime(m, &timeout);
+        numReady = EpollWaitAndDispatch(m, &timeout);
+        *pDataDispatched = (numReady > 0);
+        if (numReady < 0 && errno != EINTR)
+        {
+            // As with select() below, this represents a coding error and is not recoverable
+            LogMsg("epoll_wait failed: %s", strerror(errno));
+            abort();
+        }
+        GetReceivedSignals(pSignalsReceived);
+        return mStatus_NoError;
+    }
+#endif
+
     // 1. Set up the fd_set as usual here.
     // This example client has no file descriptors of its own,
     // but a real application would call FD_SET to add them to the set here
@@ -2310,10 +3729,7 @@ mStatus mDNSPosixRunEventLoopOnce(mDNS *m, const struct timeval *pTimeout,
     else
         *pDataDispatched = mDNSfalse;
 
-    (void) sigprocmask(SIG_BLOCK, &gEventSignalSet, (sigset_t*) NULL);
-    *pSignalsReceived = gEventSignals;
-    sigemptyset(&gEventSignals);
-    (void) sigprocmask(SIG_UNBLOCK, &gEventSignalSet, (sigset_t*) NULL);
+    GetReceivedSignals(pSignalsReceived);
 
     return mStatus_NoError;
 }
@@ -20,6 +20,8 @@
 
 #include <signal.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <pthread.h>
 
 #ifdef  __cplusplus
 extern "C" {
@@ -31,30 +33,84 @@ extern "C" {
 // IMPORTANT: coreIntf must be the first field in the structure because
 // we cast between pointers to the two different types regularly.
 
+// With POSIX_SHARED_MULTICAST_SOCKETS set, mDNS traffic on every interface goes through one IPv4 and one IPv6
+// socket in mDNS_PlatformSupport, joined to the group on each interface, instead of through sockets of the
+// interface's own. Incoming packets are matched to their interface by the index IP_PKTINFO reports, and outgoing
+// ones carry the index in the same way, so it needs IP_PKTINFO on both the receive and the send side (e.g. Linux).
+#ifndef POSIX_SHARED_MULTICAST_SOCKETS
+#define POSIX_SHARED_MULTICAST_SOCKETS 0
+#endif
+
 typedef struct PosixNetworkInterface PosixNetworkInterface;
 
+// Registered interfaces are hashed by index and by address, so finding one for a packet or a client doesn't mean
+// walking the whole interface list
+#ifndef POSIX_INTERFACE_HASH_SLOTS
+#define POSIX_INTERFACE_HASH_SLOTS 37
+#endif
+
 struct PosixNetworkInterface
 {
     NetworkInterfaceInfo coreIntf;      // MUST be the first element in this structure
     mDNSs32 LastSeen;
     const char *            intfName;
     PosixNetworkInterface * aliasIntf;
+    PosixNetworkInterface * nextInIndexHash;    // Next registered interface in this one's m->p->IndexHash chain
+    PosixNetworkInterface * nextInIDHash;       // Next registered interface in this one's m->p->IDHash chain
     int index;
     int multicastSocket4;
 #if HAVE_IPV6
     int multicastSocket6;
 #endif
+#if POSIX_SHARED_MULTICAST_SOCKETS
+    mDNSBool joined4;                   // Set if this interface has joined the group on the shared IPv4 socket
+    mDNSBool joined6;                   // Likewise for the shared IPv6 socket
+#endif
 };
 
 // This is a global because debugf_() needs to be able to check its value
 extern int gMDNSPlatformPosixVerboseLevel;
 
+// With POSIX_VIRTUAL_TIME set, mDNSPlatformRawTime() and mDNSPlatformUTC() return these variables instead of reading
+// the system clocks, so a tool replaying recorded traffic (see ReplayPcap.c) can run the core on the recording's
+// timeline, and the same input always produces the same behaviour.
+#ifndef POSIX_VIRTUAL_TIME
+#define POSIX_VIRTUAL_TIME 0
+#endif
+#if POSIX_VIRTUAL_TIME
+extern mDNSs32 gPosixVirtualRawTime;
+extern mDNSs32 gPosixVirtualUTC;
+#endif
+
 struct mDNS_PlatformSupport_struct
 {
     int unicastSocket4;
 #if HAVE_IPV6
     int unicastSocket6;
 #endif
+#if POSIX_SHARED_MULTICAST_SOCKETS
+    int multicastSocket4;               // Shared by all interfaces; see POSIX_SHARED_MULTICAST_SOCKETS
+#if HAVE_IPV6
+    int multicastSocket6;
+#endif
+#endif
+    const char *OnlyInterfaces;         // If set before mDNS_Init, comma-separated names of the only interfaces to use
+    mDNSBool UseIoUring;                // If set before mDNS_Init, use the io_uring backend where built with HAVE_IO_URING
+    PosixNetworkInterface *IndexHash[POSIX_INTERFACE_HASH_SLOTS];   // Registered interfaces by index, oldest first
+    PosixNetworkInterface *IDHash[POSIX_INTERFACE_HASH_SLOTS];      // Registered interfaces by address
+    mDNSu32 SendBatchFlushes;           // Number of send batches flushed that had at least one packet in them
+    mDNSu32 SendBatchPackets;           // Total packets sent from those batches
+    mDNSu32 SendBatchSyscalls;          // Number of sendmmsg (or io_uring_enter) calls made to send them
+    mDNSu32 UringReceives;              // Datagrams picked up from the io_uring
+    mDNSu32 UringRearms;                // Times a multishot receive stopped and was armed again
+    mDNSu32 UringStarved;               // ...because the provided buffers had all been taken
+    mDNSu32 UringClientWrites;          // Client writes made through the io_uring
+    mDNSu32 UringClientBatches;         // io_uring_enter calls made for them
+    mDNSu32 SendBatchLargest;           // Most packets flushed at once
+    pthread_mutex_t Lock;               // Recursive; taken by mDNSPlatformLock, so other threads can call into the core
+    mDNSBool LockReady;                 // Set once mDNSPlatformInit has set up Lock
+    mDNSu32 LockContended;              // Times mDNSPlatformLock found Lock held by another thread
+    mDNSu32 LockWait[ExecuteHistogramBuckets];  // How long those waits were, as in mDNSExecuteProfile
 };
 
 // We keep a list of client-supplied event sources in PosixEventSource records
@@ -62,6 +118,7 @@ struct mDNS_PlatformSupport_struct
 #define PosixEventFlag_OnList   1
 #define PosixEventFlag_Read     2
 #define PosixEventFlag_Write    4
+#define PosixEventFlag_InEpoll  8   // The fd is in the epoll set that mDNSPosixRunEventLoopOnce() waits on
     
 typedef void (*mDNSPosixEventCallback)(int fd, void *context);
 struct PosixEventSource
@@ -105,9 +162,22 @@ struct TCPListener_struct
     
 #define uDNS_SERVERS_FILE "/etc/resolv.conf"
 extern int ParseDNSServers(mDNS *m, const char *filePath);
+// Loads the hosts file (if it's changed since last time) as LocalOnly records, registering and deregistering
+// just the entries that were added to or removed from it
+extern void mDNSPosixUpdateEtcHosts(mDNS *const m, const char *path);
 extern mStatus mDNSPlatformPosixRefreshInterfaceList(mDNS *const m);
 // See comment in implementation.
 
+// Calls mDNS_Execute(), queueing the packets it multicasts and sending them when it returns,
+// with one sendmmsg call per socket where the platform supports it. Returns what mDNS_Execute() returned.
+extern mDNSs32 mDNSPosixExecute(mDNS *const m);
+
+// Writes each of count gathered buffers to its socket, as writev() with MSG_DONTWAIT would, through the io_uring in
+// as few system calls as possible; results[i] gets what that writev() would have returned, or -errno.
+// Returns -1 without writing anything if the io_uring backend isn't in use.
+extern int mDNSPosixWriteBatch(mDNS *const m, const int *fds, struct iovec *const *iovs, const int *iovcnts,
+                               ssize_t *results, int count);
+
 // Get the next upcoming mDNS (or DNS) event time as a posix timeval that can be passed to select.
 // This will only update timeout if the next mDNS event is sooner than the value that was passed.
 // Therefore, use { FutureTime, 0 } as an initializer if no other timer events are being managed.
@@ -130,6 +200,7 @@ extern void mDNSPosixProcessFDSet(mDNS *const m, fd_set *readfds, fd_set *writef
 
 extern mStatus mDNSPosixAddFDToEventLoop( int fd, mDNSPosixEventCallback callback, void *context);
 extern mStatus mDNSPosixRemoveFDFromEventLoop( int fd);
+extern mStatus mDNSPosixRequestWriteEvent( int fd, mDNSPosixEventCallback callback, void *context);
 extern mStatus mDNSPosixListenForSignalInEventLoop( int signum);
 extern mStatus mDNSPosixIgnoreSignalInEventLoop( int signum);
 extern mStatus mDNSPosixRunEventLoopOnce( mDNS *m, const struct timeval *pTimeout, sigset_t *pSignalsReceived, mDNSBool *pDataDispatched);
@@ -44,41 +44,19 @@
     #include <net/if_dl.h>
 #endif
 
-ssize_t
-recvfrom_flags(int fd, void *ptr, size_t nbytes, int *flagsp,
-               struct sockaddr *sa, socklen_t *salenptr, struct my_in_pktinfo *pktp, u_char *ttl)
+/* Passes back the source address length, flags, destination address, interface and TTL of a datagram
+   that recvmsg (or recvmmsg) just received into msg. */
+static ssize_t
+recvfrom_flags_results(struct msghdr *msg, ssize_t n, int *flagsp,
+                       socklen_t *salenptr, struct my_in_pktinfo *pktp, u_char *ttl)
 {
-    struct msghdr msg;
-    struct iovec iov[1];
-    ssize_t n;
-
 #ifdef CMSG_FIRSTHDR
     struct cmsghdr  *cmptr;
-    union {
-        struct cmsghdr cm;
-        char control[1024];
-    } control_un;
 
     *ttl = 255;         // If kernel fails to provide TTL data then assume the TTL was 255 as it should be
-
-    msg.msg_control = control_un.control;
-    msg.msg_controllen = sizeof(control_un.control);
-    msg.msg_flags = 0;
-#else
-    memset(&msg, 0, sizeof(msg));   /* make certain msg_accrightslen = 0 */
 #endif /* CMSG_FIRSTHDR */
 
-    msg.msg_name = (char *) sa;
-    msg.msg_namelen = *salenptr;
-    iov[0].iov_base = (char *)ptr;
-    iov[0].iov_len = nbytes;
-    msg.msg_iov = iov;
-    msg.msg_iovlen = 1;
-
-    if ( (n = recvmsg(fd, &msg, *flagsp)) < 0)
-        return(n);
-
-    *salenptr = msg.msg_namelen;    /* pass back results */
+    *salenptr = msg->msg_namelen;    /* pass back results */
     if (pktp) {
         /* 0.0.0.0, i/f = -1 */
         /* We set the interface to -1 so that the caller can
@@ -90,22 +68,19 @@ recvfrom_flags(int fd, void *ptr, size_t nbytes, int *flagsp,
         memset(pktp, 0, sizeof(struct my_in_pktinfo));
         pktp->ipi_ifindex = -1;
     }
-/* end recvfrom_flags1 */
-
-/* include recvfrom_flags2 */
 #ifndef CMSG_FIRSTHDR
     #warning CMSG_FIRSTHDR not defined. Will not be able to determine destination address, received interface, etc.
     *flagsp = 0;                    /* pass back results */
     return(n);
 #else
 
-    *flagsp = msg.msg_flags;        /* pass back results */
-    if (msg.msg_controllen < (socklen_t)sizeof(struct cmsghdr) ||
-        (msg.msg_flags & MSG_CTRUNC) || pktp == NULL)
+    *flagsp = msg->msg_flags;        /* pass back results */
+    if (msg->msg_controllen < (socklen_t)sizeof(struct cmsghdr) ||
+        (msg->msg_flags & MSG_CTRUNC) || pktp == NULL)
         return(n);
 
-    for (cmptr = CMSG_FIRSTHDR(&msg); cmptr != NULL;
-         cmptr = CMSG_NXTHDR(&msg, cmptr)) {
+    for (cmptr = CMSG_FIRSTHDR(msg); cmptr != NULL;
+         cmptr = CMSG_NXTHDR(msg, cmptr)) {
 
 #ifdef  IP_PKTINFO
 #if in_pktinfo_definition_is_missing
@@ -207,6 +182,296 @@ recvfrom_flags(int fd, void *ptr, size_t nbytes, int *flagsp,
 #endif /* CMSG_FIRSTHDR */
 }
 
+
+ssize_t
+recvfrom_flags(int fd, void *ptr, size_t nbytes, int *flagsp,
+               struct sockaddr *sa, socklen_t *salenptr, struct my_in_pktinfo *pktp, u_char *ttl)
+{
+    struct msghdr msg;
+    struct iovec iov[1];
+    ssize_t n;
+
+#ifdef CMSG_FIRSTHDR
+    union {
+        struct cmsghdr cm;
+        char control[1024];
+    } control_un;
+
+    msg.msg_control = control_un.control;
+    msg.msg_controllen = sizeof(control_un.control);
+    msg.msg_flags = 0;
+#else
+    memset(&msg, 0, sizeof(msg));   /* make certain msg_accrightslen = 0 */
+#endif /* CMSG_FIRSTHDR */
+
+    msg.msg_name = (char *) sa;
+    msg.msg_namelen = *salenptr;
+    iov[0].iov_base = (char *)ptr;
+    iov[0].iov_len = nbytes;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 1;
+
+    if ( (n = recvmsg(fd, &msg, *flagsp)) < 0)
+        return(n);
+
+    return(recvfrom_flags_results(&msg, n, flagsp, salenptr, pktp, ttl));
+}
+
+#if HAVE_RECVMMSG
+int
+recvmmsg_flags(int fd, struct my_recv_datagram *dgrams, unsigned int count)
+{
+    struct mmsghdr msgs[MY_RECV_BATCH_MAX];
+    struct iovec iov[MY_RECV_BATCH_MAX];
+    union {
+        struct cmsghdr cm;
+        char control[256];          /* room for the pktinfo and TTL messages, which is all we ask for */
+    } control_un[MY_RECV_BATCH_MAX];
+    unsigned int i;
+    int n;
+
+    if (count > MY_RECV_BATCH_MAX) count = MY_RECV_BATCH_MAX;
+    memset(msgs, 0, count * sizeof(msgs[0]));
+    for (i = 0; i < count; i++) {
+        iov[i].iov_base = dgrams[i].ptr;
+        iov[i].iov_len = dgrams[i].nbytes;
+        msgs[i].msg_hdr.msg_name = (char *) &dgrams[i].from;
+        msgs[i].msg_hdr.msg_namelen = sizeof(dgrams[i].from);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = control_un[i].control;
+        msgs[i].msg_hdr.msg_controllen = sizeof(control_un[i].control);
+    }
+
+    if ( (n = recvmmsg(fd, msgs, count, MSG_DONTWAIT, NULL)) < 0)
+        return(n);
+
+    for (i = 0; i < (unsigned int)n; i++)
+        dgrams[i].len = recvfrom_flags_results(&msgs[i].msg_hdr, (ssize_t)msgs[i].msg_len, &dgrams[i].flags,
+                                               &dgrams[i].fromlen, &dgrams[i].pktinfo, &dgrams[i].ttl);
+    return(n);
+}
+#endif /* HAVE_RECVMMSG */
+
+#if HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+int
+my_uring_init(struct my_uring *ring, unsigned int entries)
+{
+    struct io_uring_params p;
+    unsigned char *sq, *cq;
+
+    memset(ring, 0, sizeof(*ring));
+    memset(&p, 0, sizeof(p));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0)
+        return(-1);
+    if (!(p.features & IORING_FEAT_NODROP)) {   /* 5.5; we can't cope with lost completions */
+        close(ring->fd);
+        errno = EINVAL;
+        return(-1);
+    }
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    ring->sqes    = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         ring->fd, IORING_OFF_SQES);
+    if (ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        int err = errno;
+        ring->sq_entries = p.sq_entries;
+        my_uring_exit(ring);
+        errno = err;
+        return(-1);
+    }
+
+    sq = ring->sq_ring;
+    cq = ring->cq_ring;
+    ring->sq_entries = p.sq_entries;
+    ring->cq_entries = p.cq_entries;
+    ring->sq_head  = (unsigned int *)(sq + p.sq_off.head);
+    ring->sq_tail  = (unsigned int *)(sq + p.sq_off.tail);
+    ring->sq_mask  = (unsigned int *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned int *)(sq + p.sq_off.array);
+    ring->cq_head  = (unsigned int *)(cq + p.cq_off.head);
+    ring->cq_tail  = (unsigned int *)(cq + p.cq_off.tail);
+    ring->cq_mask  = (unsigned int *)(cq + p.cq_off.ring_mask);
+    ring->cqes     = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    ring->sq_local_tail = ring->sq_submitted = *ring->sq_tail;
+    return(0);
+}
+
+void
+my_uring_exit(struct my_uring *ring)
+{
+    if (ring->sqes && ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sq_entries * sizeof(struct io_uring_sqe));
+    if (ring->cq_ring && ring->cq_ring != MAP_FAILED) munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring && ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->fd >= 0) close(ring->fd);
+    memset(ring, 0, sizeof(*ring));
+    ring->fd = -1;
+}
+
+struct io_uring_sqe *
+my_uring_get_sqe(struct my_uring *ring)
+{
+    const unsigned int head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    struct io_uring_sqe *sqe;
+    unsigned int idx;
+
+    if (ring->sq_local_tail - head >= ring->sq_entries)
+        return(NULL);
+    idx = ring->sq_local_tail & *ring->sq_mask;
+    ring->sq_array[idx] = idx;
+    ring->sq_local_tail++;
+    sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    return(sqe);
+}
+
+int
+my_uring_submit(struct my_uring *ring, unsigned int wait_nr)
+{
+    const unsigned int count = ring->sq_local_tail - ring->sq_submitted;
+    int n;
+
+    __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+    ring->sq_submitted = ring->sq_local_tail;
+    if (!count && !wait_nr)
+        return(0);
+    do {
+        n = (int)syscall(__NR_io_uring_enter, ring->fd, count, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while (n < 0 && errno == EINTR && !count);
+    return(n);
+}
+
+struct io_uring_cqe *
+my_uring_peek_cqe(struct my_uring *ring)
+{
+    const unsigned int head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        return(NULL);
+    return(&ring->cqes[head & *ring->cq_mask]);
+}
+
+void
+my_uring_cqe_seen(struct my_uring *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+int
+my_uring_bufs_init(struct my_uring *ring, struct my_uring_bufs *bufs, unsigned short bgid,
+                   unsigned int entries, size_t bufsize)
+{
+    struct io_uring_buf_reg reg;
+    const size_t ringsize = entries * sizeof(struct io_uring_buf);
+    unsigned int i;
+
+    memset(bufs, 0, sizeof(*bufs));
+    bufs->br = mmap(NULL, ringsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (bufs->br == MAP_FAILED) {
+        bufs->br = NULL;
+        return(-1);
+    }
+    bufs->mem = malloc(entries * bufsize);
+    if (!bufs->mem) {
+        munmap(bufs->br, ringsize);
+        bufs->br = NULL;
+        errno = ENOMEM;
+        return(-1);
+    }
+    bufs->entries = entries;
+    bufs->bgid    = bgid;
+    bufs->bufsize = bufsize;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr    = (unsigned long)bufs->br;
+    reg.ring_entries = entries;
+    reg.bgid         = bgid;
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        int err = errno;
+        free(bufs->mem);
+        munmap(bufs->br, ringsize);
+        memset(bufs, 0, sizeof(*bufs));
+        errno = err;
+        return(-1);
+    }
+    for (i = 0; i < entries; i++)
+        my_uring_bufs_put(bufs, i);
+    return(0);
+}
+
+void
+my_uring_bufs_exit(struct my_uring *ring, struct my_uring_bufs *bufs)
+{
+    struct io_uring_buf_reg reg;
+
+    if (!bufs->br) return;
+    memset(&reg, 0, sizeof(reg));
+    reg.bgid = bufs->bgid;
+    (void)syscall(__NR_io_uring_register, ring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+    munmap(bufs->br, bufs->entries * sizeof(struct io_uring_buf));
+    free(bufs->mem);
+    memset(bufs, 0, sizeof(*bufs));
+}
+
+void
+my_uring_bufs_put(struct my_uring_bufs *bufs, unsigned int bid)
+{
+    /* The tail lives in the reserved field of the first entry; only we write it */
+    const unsigned short tail = bufs->br->tail;
+    struct io_uring_buf *const buf = &bufs->br->bufs[tail & (bufs->entries - 1)];
+
+    buf->addr = (unsigned long)(bufs->mem + bid * bufs->bufsize);
+    buf->len  = (unsigned int)bufs->bufsize;
+    buf->bid  = (unsigned short)bid;
+    __atomic_store_n(&bufs->br->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+void
+my_uring_prep_recvmsg_multishot(struct io_uring_sqe *sqe, int fd, struct msghdr *tmpl,
+                                const struct my_uring_bufs *bufs, unsigned long long user_data)
+{
+    sqe->opcode    = IORING_OP_RECVMSG;
+    sqe->fd        = fd;
+    sqe->addr      = (unsigned long)tmpl;
+    sqe->len       = 1;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = bufs->bgid;
+    sqe->user_data = user_data;
+}
+
+void
+my_uring_recvmsg_results(const struct msghdr *tmpl, void *buf, int res, struct my_recv_datagram *dgram)
+{
+    /* The buffer holds an io_uring_recvmsg_out, then room for the source address and the ancillary data */
+    /* as sized by tmpl, then the datagram. */
+    const struct io_uring_recvmsg_out *const out = (const struct io_uring_recvmsg_out *)buf;
+    unsigned char *const name    = (unsigned char *)(out + 1);
+    unsigned char *const control = name + tmpl->msg_namelen;
+    unsigned char *const payload = control + tmpl->msg_controllen;
+    const ssize_t avail = (ssize_t)res - (payload - (unsigned char *)buf);
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    memset(&dgram->from, 0, sizeof(dgram->from));
+    memcpy(&dgram->from, name, (out->namelen < tmpl->msg_namelen) ? out->namelen : tmpl->msg_namelen);
+    msg.msg_name       = &dgram->from;
+    msg.msg_namelen    = out->namelen;
+    msg.msg_control    = control;
+    msg.msg_controllen = (out->controllen < tmpl->msg_controllen) ? out->controllen : tmpl->msg_controllen;
+    msg.msg_flags      = (int)out->flags;
+    dgram->ptr    = payload;
+    dgram->nbytes = (avail > 0) ? (size_t)avail : 0;
+    dgram->len    = recvfrom_flags_results(&msg, (ssize_t)dgram->nbytes, &dgram->flags, &dgram->fromlen, &dgram->pktinfo, &dgram->ttl);
+}
+#endif /* HAVE_IO_URING */
+
 // **********************************************************************************************
 
 // daemonize the process. Adapted from "Unix Network Programming" vol 1 by Stevens, section 12.4.
@@ -74,6 +74,79 @@ struct my_in_pktinfo {
 extern ssize_t recvfrom_flags(int fd, void *ptr, size_t nbytes, int *flagsp,
                               struct sockaddr *sa, socklen_t *salenptr, struct my_in_pktinfo *pktp, u_char *ttl);
 
+#if HAVE_RECVMMSG
+/* Batched form of recvfrom_flags: drains up to count (at most MY_RECV_BATCH_MAX) queued datagrams */
+/* with one recvmmsg call, without blocking. The caller sets ptr and nbytes of each entry; the */
+/* other fields of the first n entries are filled in, where n is the return value. */
+#define MY_RECV_BATCH_MAX 32
+
+struct my_recv_datagram {
+    void *ptr;                                      /* buffer for the datagram */
+    size_t nbytes;                                  /* size of that buffer */
+    ssize_t len;                                    /* length of the datagram received */
+    int flags;                                      /* returned msg_flags */
+    struct sockaddr_storage from;                   /* source address */
+    socklen_t fromlen;
+    struct my_in_pktinfo pktinfo;                   /* destination address and received interface */
+    u_char ttl;
+};
+
+extern int recvmmsg_flags(int fd, struct my_recv_datagram *dgrams, unsigned int count);
+#endif
+
+#if HAVE_IO_URING
+/* Just enough io_uring, through the raw system calls, for the Posix event loop's io_uring backend */
+/* (see HAVE_IO_URING in mDNSPosix.c). Needs Linux 6.0 or later for multishot recvmsg and provided */
+/* buffer rings; my_uring_init fails with EINVAL or ENOSYS on older kernels. */
+#include <linux/io_uring.h>
+
+struct my_uring {
+    int fd;
+    unsigned int sq_entries, cq_entries;
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    unsigned int sq_local_tail;                     /* SQEs handed out but not yet submitted end here */
+    unsigned int sq_submitted;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size;
+};
+
+/* A ring of equal-sized receive buffers the kernel picks from (IORING_REGISTER_PBUF_RING) */
+struct my_uring_bufs {
+    struct io_uring_buf_ring *br;
+    unsigned char *mem;
+    unsigned int entries;                           /* power of two */
+    unsigned short bgid;
+    size_t bufsize;
+};
+
+extern int my_uring_init(struct my_uring *ring, unsigned int entries);
+extern void my_uring_exit(struct my_uring *ring);
+/* Returns a zeroed SQE, or NULL if the submission queue is full */
+extern struct io_uring_sqe *my_uring_get_sqe(struct my_uring *ring);
+/* Submits the SQEs handed out since the last call and waits for at least wait_nr completions */
+extern int my_uring_submit(struct my_uring *ring, unsigned int wait_nr);
+/* The oldest completion not yet seen, or NULL */
+extern struct io_uring_cqe *my_uring_peek_cqe(struct my_uring *ring);
+extern void my_uring_cqe_seen(struct my_uring *ring);
+
+extern int my_uring_bufs_init(struct my_uring *ring, struct my_uring_bufs *bufs, unsigned short bgid,
+                              unsigned int entries, size_t bufsize);
+extern void my_uring_bufs_exit(struct my_uring *ring, struct my_uring_bufs *bufs);
+/* Gives buffer bid back to the kernel */
+extern void my_uring_bufs_put(struct my_uring_bufs *bufs, unsigned int bid);
+
+/* Prepares sqe for a multishot IORING_OP_RECVMSG on fd into buffers from bufs. tmpl must stay valid */
+/* while the receive is armed; only its msg_namelen and msg_controllen are used. */
+extern void my_uring_prep_recvmsg_multishot(struct io_uring_sqe *sqe, int fd, struct msghdr *tmpl,
+                                            const struct my_uring_bufs *bufs, unsigned long long user_data);
+/* Like recvmmsg_flags for one datagram that a multishot recvmsg prepared with tmpl put in buf (res bytes); */
+/* sets dgram->ptr to the datagram within buf. */
+extern void my_uring_recvmsg_results(const struct msghdr *tmpl, void *buf, int res, struct my_recv_datagram *dgram);
+#endif
+
 #if defined(AF_INET6) && HAVE_IPV6
 #define INET6_ADDRSTRLEN 46 /*Maximum length of IPv6 address */
 #endif
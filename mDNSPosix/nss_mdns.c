@@ -76,6 +76,9 @@
 #include <syslog.h>
 #include <pthread.h>
 #include <ctype.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <sys/types.h>
 #include <sys/time.h>
@@ -88,6 +91,7 @@
 #include <arpa/nameser.h>
 
 #include <dns_sd.h>
+#include "dnssd_sharedcache.h"
 
 
 //----------
@@ -446,6 +450,37 @@ _nss_mdns_gethostbyname2_r (
     );
 
 
+/*
+   gethostbyname4 implementation, used by getaddrinfo: looks up the IPv4
+   and IPv6 addresses of name at the same time
+
+    name:
+        name to look up
+    pat:
+        resulting list of addresses
+    buf:
+        auxillary buffer
+    buflen:
+        length of auxillary buffer
+    errnop:
+        pointer to errno
+    h_errnop:
+        pointer to h_errno
+    ttlp:
+        if non-NULL, set to the TTL of the result
+ */
+nss_status
+_nss_mdns_gethostbyname4_r (
+    const char *name,
+    struct gaih_addrtuple ** pat,
+    char *buf,
+    size_t buflen,
+    int *errnop,
+    int *h_errnop,
+    int32_t *ttlp
+    );
+
+
 /*
    gethostbyaddr implementation
 
@@ -515,12 +550,67 @@ typedef struct result_map
     // Index points to lowest entry
     int r_errno;
     int r_h_errno;
+    uint32_t ttl;
+    // Smallest TTL of the records received
+    int conn_error;
+    // Non-zero if the connection to the daemon failed during the lookup
+    int cut_short;
+    // Non-zero if the lookup was abandoned early because another one
+    // it ran alongside had finished
 } result_map_t;
 
 static const struct timeval
 k_select_time = { 0, 500000 };
 // 0 seconds, 500 milliseconds
 
+static const struct timeval
+k_grace_time = { 0, 100000 };
+// 0 seconds, 100 milliseconds
+
+#define k_query_max 2
+// Most lookups run concurrently by mdns_query_multi
+
+#define k_gethostbyname4_scratch 4096
+// Size of the buffer for each family's answers in gethostbyname4
+
+// Each thread keeps one connection to the daemon for all its lookups,
+// making each query a kDNSServiceFlagsShareConnection subordinate of it,
+// instead of connecting afresh for every lookup.
+typedef struct mdns_connection
+{
+    DNSServiceRef sdref;
+    pid_t pid;
+    // Process that made the connection; a forked child must make its own
+} mdns_connection_t;
+
+// Results of recent lookups, shared by all threads in the process, so that
+// repeated lookups of the same name or address don't go to the daemon at
+// all, and repeated misses don't wait for the lookup to time out each time.
+#define k_cache_entries 32
+#define k_cache_names_size 512
+#define k_cache_positive_ttl 10
+// Seconds; records with a smaller TTL are cached for that long instead
+#define k_cache_negative_ttl 5
+// Seconds
+
+typedef struct cache_entry
+{
+    time_t expires;
+    // Zero if the entry is unused
+    ns_type_t rrtype;
+    // kDNSServiceType_A, kDNSServiceType_AAAA or kDNSServiceType_PTR
+    char key [k_hostname_maxlen + 1];
+    // Name or reverse address looked up
+    int found;
+    int addr_len;
+    int addrs_count;
+    unsigned char addrs [k_addrs_max] [16];
+    // Not used for reverse lookups, which already have their address
+    int names_len;
+    char names [k_cache_names_size];
+    // Hostname followed by aliases, each null terminated
+} cache_entry_t;
+
 //----------
 // Local prototypes
 
@@ -560,10 +650,68 @@ mdns_lookup_addr (
 
 
 /*
-    Handle incoming MDNS events
+    Query the daemon on this thread's persistent connection
  */
 static nss_status
-handle_events (DNSServiceRef sdref, result_map_t * result, const char * str);
+mdns_query (
+    const char * str,
+    ns_type_t rrtype,
+    result_map_t * result
+    );
+
+
+/*
+    Query the daemon concurrently for several record types
+ */
+static void
+mdns_query_multi (
+    const char * str,
+    const ns_type_t * rrtypes,
+    result_map_t ** results,
+    int count,
+    int answered
+    );
+
+
+/*
+    Handle incoming MDNS events
+ */
+static void
+handle_events (DNSServiceRef sdref, result_map_t ** results, int count, int answered, const char * str);
+
+
+/*
+    Per-thread persistent connection to the daemon
+ */
+static DNSServiceRef
+get_connection (void);
+static void
+reset_connection (void);
+
+
+/*
+    Lookup cache
+ */
+static int
+cache_lookup (
+    const char * key,
+    ns_type_t rrtype,
+    result_map_t * result,
+    nss_status * status
+    );
+static void
+cache_store (
+    const char * key,
+    ns_type_t rrtype,
+    const result_map_t * result,
+    nss_status status
+    );
+static int
+shared_cache_lookup (
+    const char * name,
+    ns_type_t rrtype,
+    result_map_t * result
+    );
 
 
 // Callback for mdns_lookup operations
@@ -651,6 +799,14 @@ static nss_status set_err_success (result_map_t * result);
 //----------
 // Global variables
 
+static pthread_once_t g_connection_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_connection_key;
+static int g_connection_key_ok = 0;
+// This thread's mdns_connection_t, if it has one
+
+static cache_entry_t g_cache [k_cache_entries];
+static pthread_mutex_t g_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 
 //----------
 // NSS functions
@@ -702,6 +858,150 @@ _nss_mdns_gethostbyname2_r (
 }
 
 
+nss_status
+_nss_mdns_gethostbyname4_r (
+    const char *name,
+    struct gaih_addrtuple ** pat,
+    char *buf,
+    size_t buflen,
+    int *errnop,
+    int *h_errnop,
+    int32_t *ttlp
+    )
+{
+    static const int k_afs [k_query_max] = { AF_INET, AF_INET6 };
+    static const ns_type_t k_rrtypes [k_query_max] = { kDNSServiceType_A, kDNSServiceType_AAAA };
+    char lookup_name [k_hostname_maxlen + 1];
+    hostent hostents [k_query_max];
+    char scratch [k_query_max] [k_gethostbyname4_scratch];
+    result_map_t maps [k_query_max];
+    result_map_t * results [k_query_max];
+    ns_type_t rrtypes [k_query_max];
+    result_map_t * error_result = NULL;
+    struct gaih_addrtuple * first = NULL;
+    struct gaih_addrtuple ** next = &first;
+    const char * hostname = NULL;
+    char * out_name = NULL;
+    uint32_t ttl = k_cache_positive_ttl;
+    size_t used = 0;
+    int count = 0;
+    int answered = 0;
+    int i;
+    int j;
+
+    if (MDNS_VERBOSE)
+        syslog (LOG_DEBUG,
+                "mdns: Called nss_mdns_gethostbyname4 with %s",
+                name
+                );
+
+    for (i = 0; i < k_query_max; i++)
+    {
+        nss_status status;
+        int err_status = init_result (&maps [i], &hostents [i], scratch [i], sizeof (scratch [i]));
+        if (err_status)
+        {
+            *errnop = err_status;
+            *h_errnop = NETDB_INTERNAL;
+            return NSS_STATUS_TRYAGAIN;
+        }
+        hostents [i].h_addrtype = k_afs [i];
+        hostents [i].h_length = (k_afs [i] == AF_INET) ? 4 : 16;
+
+        if (i == 0 && !is_applicable_name (&maps [0], name, lookup_name))
+        {
+            *errnop = maps [0].r_errno;
+            *h_errnop = maps [0].r_h_errno;
+            return maps [0].status;
+        }
+
+        if (cache_lookup (name, k_rrtypes [i], &maps [i], &status))
+        {
+            answered |= (status == NSS_STATUS_SUCCESS);
+        }
+        else if (shared_cache_lookup (name, k_rrtypes [i], &maps [i]))
+        {
+            answered |= (maps [i].status == NSS_STATUS_SUCCESS);
+        }
+        else
+        {
+            results [count] = &maps [i];
+            rrtypes [count] = k_rrtypes [i];
+            count++;
+        }
+    }
+
+    if (count)
+    {
+        mdns_query_multi (name, rrtypes, results, count, answered);
+        for (i = 0; i < count; i++)
+            cache_store (name, rrtypes [i], results [i], results [i]->status);
+    }
+
+    // Lay out the answers in buf: the hostname, then a gaih_addrtuple for
+    // each address of either family.
+    for (i = 0; i < k_query_max; i++)
+    {
+        if (maps [i].status != NSS_STATUS_SUCCESS)
+        {
+            if (maps [i].status != NSS_STATUS_NOTFOUND)
+                error_result = &maps [i];
+            continue;
+        }
+        if (!hostname)
+        {
+            size_t len = strlen (hostents [i].h_name) + 1;
+            if (len > buflen)
+                goto too_small;
+            hostname = hostents [i].h_name;
+            out_name = memcpy (buf, hostname, len);
+            used = len;
+        }
+        if (maps [i].ttl < ttl)
+            ttl = maps [i].ttl;
+        for (j = 0; j < maps [i].addrs_count; j++)
+        {
+            struct gaih_addrtuple * tuple;
+
+            used = (used + __alignof__ (struct gaih_addrtuple) - 1) & ~(__alignof__ (struct gaih_addrtuple) - 1);
+            if (used + sizeof (*tuple) > buflen)
+                goto too_small;
+            tuple = (struct gaih_addrtuple *) (buf + used);
+            used += sizeof (*tuple);
+            memset (tuple, 0, sizeof (*tuple));
+            tuple->name = out_name;
+            tuple->family = k_afs [i];
+            memcpy (tuple->addr, maps [i].header->addrs [j], hostents [i].h_length);
+            *next = tuple;
+            next = &tuple->next;
+        }
+    }
+
+    if (!first)
+    {
+        // Report a failure to look up either family in preference to
+        // not finding anything
+        result_map_t * result = error_result ? error_result : &maps [0];
+        *errnop = result->r_errno;
+        *h_errnop = result->r_h_errno;
+        return result->status;
+    }
+
+    if (*pat)
+        **pat = *first;
+    else
+        *pat = first;
+    if (ttlp)
+        *ttlp = ttl;
+    return NSS_STATUS_SUCCESS;
+
+too_small:
+    *errnop = ERANGE;
+    *h_errnop = NETDB_INTERNAL;
+    return NSS_STATUS_TRYAGAIN;
+}
+
+
 nss_status
 _nss_mdns_gethostbyaddr_r (
     const void *addr,
@@ -849,8 +1149,6 @@ mdns_lookup_name (
     )
 {
     // Lookup using mDNS.
-    DNSServiceErrorType errcode;
-    DNSServiceRef sdref;
     ns_type_t rrtype;
     nss_status status;
 
@@ -883,29 +1181,18 @@ mdns_lookup_name (
     }
     result->hostent->h_addrtype = af;
 
-    errcode =
-        DNSServiceQueryRecord (
-            &sdref,
-            kDNSServiceFlagsForceMulticast,     // force multicast query
-            kDNSServiceInterfaceIndexAny,   // all interfaces
-            fullname,   // full name to query for
-            rrtype,     // resource record type
-            kDNSServiceClass_IN,    // internet class records
-            mdns_lookup_callback,   // callback
-            result      // Context - result buffer
-            );
+    if (cache_lookup (fullname, rrtype, result, &status))
+    {
+        return status;
+    }
 
-    if (errcode)
+    if (shared_cache_lookup (fullname, rrtype, result))
     {
-        syslog (LOG_WARNING,
-                "mdns: Failed to initialise lookup, error %d",
-                errcode
-                );
-        return set_err_mdns_failed (result);
+        return result->status;
     }
 
-    status = handle_events (sdref, result, fullname);
-    DNSServiceRefDeallocate (sdref);
+    status = mdns_query (fullname, rrtype, result);
+    cache_store (fullname, rrtype, result, status);
     return status;
 }
 
@@ -937,8 +1224,6 @@ mdns_lookup_addr (
     result_map_t * result
     )
 {
-    DNSServiceErrorType errcode;
-    DNSServiceRef sdref;
     nss_status status;
 
     if (MDNS_VERBOSE)
@@ -958,59 +1243,199 @@ mdns_lookup_addr (
 
     result->hostent->h_name [0] = 0;
 
-    errcode =
-        DNSServiceQueryRecord (
-            &sdref,
-            kDNSServiceFlagsForceMulticast,     // force multicast query
-            kDNSServiceInterfaceIndexAny,   // all interfaces
-            addr_str,   // address string to query for
-            kDNSServiceType_PTR,    // pointer RRs
-            kDNSServiceClass_IN,    // internet class records
-            mdns_lookup_callback,   // callback
-            result      // Context - result buffer
-            );
-
-    if (errcode)
+    if (cache_lookup (addr_str, kDNSServiceType_PTR, result, &status))
     {
-        syslog (LOG_WARNING,
-                "mdns: Failed to initialise mdns lookup, error %d",
-                errcode
-                );
-        return set_err_mdns_failed (result);
+        return status;
     }
 
-    status = handle_events (sdref, result, addr_str);
-    DNSServiceRefDeallocate (sdref);
+    status = mdns_query (addr_str, kDNSServiceType_PTR, result);
+    cache_store (addr_str, kDNSServiceType_PTR, result, status);
     return status;
 }
 
 
 /*
-    Wait on result of callback, and process it when it arrives.
+    Query for records of type rrtype named str, and wait for the result.
 
     Parameters
-        sdref
-            dns-sd reference
+        str
+            Name to query for.
+        rrtype
+            Resource record type to query for.
         result
             Initialised 'result' data structure.
+ */
+static nss_status
+mdns_query (
+    const char * str,
+    ns_type_t rrtype,
+    result_map_t * result
+    )
+{
+    mdns_query_multi (str, &rrtype, &result, 1, 0);
+    return result->status;
+}
+
+
+/*
+    Query concurrently, on this thread's connection, for records of each of
+    the given types named str, and wait for the results.
+
+    Parameters
+        str
+            Name to query for.
+        rrtypes
+            Resource record types to query for.
+        results
+            Initialised 'result' data structure for each type.
+        count
+            Number of types; at most k_query_max.
+        answered
+            Non-zero if a related lookup has already been answered, so these
+            should only wait the grace time (see handle_events).
+ */
+static void
+mdns_query_multi (
+    const char * str,
+    const ns_type_t * rrtypes,
+    result_map_t ** results,
+    int count,
+    int answered
+    )
+{
+    DNSServiceErrorType errcode;
+    DNSServiceRef conn;
+    DNSServiceRef sdrefs [k_query_max];
+    int started;
+    int i;
+
+    conn = get_connection ();
+    if (!conn)
+    {
+        for (i = 0; i < count; i++)
+            set_err_mdns_failed (results [i]);
+        return;
+    }
+
+    for (started = 0; started < count; started++)
+    {
+        sdrefs [started] = conn;
+        errcode =
+            DNSServiceQueryRecord (
+                &sdrefs [started],
+                kDNSServiceFlagsShareConnection |  // on this thread's connection
+                kDNSServiceFlagsForceMulticast,     // force multicast query
+                kDNSServiceInterfaceIndexAny,   // all interfaces
+                str,        // name to query for
+                rrtypes [started],  // resource record type
+                kDNSServiceClass_IN,    // internet class records
+                mdns_lookup_callback,   // callback
+                results [started]   // Context - result buffer
+                );
+
+        if (errcode)
+        {
+            syslog (LOG_WARNING,
+                    "mdns: Failed to initialise lookup, error %d",
+                    errcode
+                    );
+            break;
+        }
+    }
+
+    if (started == count)
+    {
+        handle_events (conn, results, count, answered, str);
+    }
+    else
+    {
+        // Connect afresh next time, in case the daemon has restarted
+        for (i = 0; i < count; i++)
+        {
+            set_err_mdns_failed (results [i]);
+            results [i]->conn_error = 1;
+        }
+    }
+
+    for (i = 0; i < started; i++)
+    {
+        DNSServiceRefDeallocate (sdrefs [i]);
+    }
+    if (results [0]->conn_error)
+    {
+        reset_connection ();
+    }
+}
+
+
+/*
+    Wait on results of callbacks, and process them when they arrive.
+
+    Waits until every lookup is done, or until no reply has arrived for
+    k_select_time.  Once one lookup is done, the others get only another
+    k_grace_time, since when the host has both kinds of address it
+    answers for both at once, so a name with only one kind doesn't wait
+    the full timeout for the other.
+
+    Parameters
+        sdref
+            dns-sd reference of the connection the queries are on
+        results
+            Initialised 'result' data structure for each lookup.
+        count
+            Number of lookups.
+        answered
+            Non-zero if a related lookup was answered before these started,
+            in which case they only get the grace time from the outset.
         str
             lookup string, used for status/error reporting.
  */
-static nss_status
-handle_events (DNSServiceRef sdref, result_map_t * result, const char * str)
+static void
+handle_events (DNSServiceRef sdref, result_map_t ** results, int count, int answered, const char * str)
 {
     int dns_sd_fd = DNSServiceRefSockFD(sdref);
     int nfds = dns_sd_fd + 1;
     fd_set readfds;
     struct timeval tv;
+    struct timeval now;
+    struct timeval grace_end;
+    int grace = 0;
     int select_result;
+    int pending;
+    int i;
 
-    while (!result->done)
+    for (;;)
     {
-        FD_ZERO(&readfds);
-        FD_SET(dns_sd_fd, &readfds);
+        pending = 0;
+        for (i = 0; i < count; i++)
+        {
+            if (!results [i]->done)
+                pending++;
+        }
+        if (!pending)
+            break;
 
         tv = k_select_time;
+        if (pending < count || answered)
+        {
+            gettimeofday (&now, NULL);
+            if (!grace)
+            {
+                timeradd (&now, &k_grace_time, &grace_end);
+                grace = 1;
+            }
+            if (!timercmp (&now, &grace_end, <))
+            {
+                tv.tv_sec = tv.tv_usec = 0;
+            }
+            else
+            {
+                timersub (&grace_end, &now, &tv);
+            }
+        }
+
+        FD_ZERO(&readfds);
+        FD_SET(dns_sd_fd, &readfds);
 
         select_result =
             select (nfds, &readfds, (fd_set*)NULL, (fd_set*)NULL, &tv);
@@ -1023,7 +1448,31 @@ handle_events (DNSServiceRef sdref, result_map_t * result, const char * str)
                             "mdns: Reply received for %s",
                             str
                             );
-                DNSServiceProcessResult(sdref);
+                if (DNSServiceProcessResult(sdref) != kDNSServiceErr_NoError)
+                {
+                    syslog (LOG_WARNING,
+                            "mdns: Lost connection to daemon during lookup of %s",
+                            str
+                            );
+                    for (i = 0; i < count; i++)
+                    {
+                        results [i]->conn_error = 1;
+                        if (!results [i]->done)
+                            set_err_mdns_failed (results [i]);
+                    }
+                    return;
+                }
+                // On a shared connection kDNSServiceFlagsMoreComing is set if
+                // more replies are waiting for any of its operations, so a
+                // lookup's last answer may have said more was coming when it
+                // was another lookup's answers that were.  Having returned,
+                // ProcessResult has delivered everything that had arrived, so
+                // every lookup that has answers is done.
+                for (i = 0; i < count; i++)
+                {
+                    if (results [i]->status == NSS_STATUS_SUCCESS)
+                        results [i]->done = 1;
+                }
             }
             else
             {
@@ -1041,12 +1490,17 @@ handle_events (DNSServiceRef sdref, result_map_t * result, const char * str)
                         "mdns: %s not found - timer expired",
                         str
                         );
-            set_err_notfound (result);
+            for (i = 0; i < count; i++)
+            {
+                if (!results [i]->done)
+                {
+                    set_err_notfound (results [i]);
+                    results [i]->cut_short = (pending < count || answered);
+                }
+            }
             break;
         }
     }
-
-    return result->status;
 }
 
 
@@ -1076,7 +1530,6 @@ mdns_lookup_callback
 
     (void)sdref; // Unused
     (void)interface_index; // Unused
-    (void)ttl; // Unused
 
     if (!(flags & kDNSServiceFlagsMoreComing) )
     {
@@ -1145,6 +1598,9 @@ mdns_lookup_callback
             return;
         }
 
+        if (ttl < result->ttl)
+            result->ttl = ttl;
+
         if (result->status != NSS_STATUS_SUCCESS)
             set_err_success (result);
     }
@@ -1158,6 +1614,357 @@ mdns_lookup_callback
     }
 }
 
+/*
+    Connection management.
+
+    ProcessResult on a shared connection isn't safe to call from more than
+    one thread at once, so rather than serialising all lookups in the
+    process on one connection, each thread that does lookups keeps its own,
+    closed when the thread exits.
+ */
+static void
+connection_destructor (void * value)
+{
+    mdns_connection_t * connection = (mdns_connection_t *) value;
+
+    if (connection->sdref)
+    {
+        DNSServiceRefDeallocate (connection->sdref);
+    }
+    free (connection);
+}
+
+
+static void
+connection_key_init (void)
+{
+    g_connection_key_ok =
+        (pthread_key_create (&g_connection_key, connection_destructor) == 0);
+}
+
+
+/*
+    Return this thread's connection to the daemon, connecting if necessary.
+
+    Returns
+        Connection's DNSServiceRef, or NULL on failure
+ */
+static DNSServiceRef
+get_connection (void)
+{
+    mdns_connection_t * connection;
+    DNSServiceErrorType errcode;
+
+    pthread_once (&g_connection_once, connection_key_init);
+    if (!g_connection_key_ok)
+    {
+        return NULL;
+    }
+
+    connection = (mdns_connection_t *) pthread_getspecific (g_connection_key);
+    if (!connection)
+    {
+        connection = (mdns_connection_t *) calloc (1, sizeof (mdns_connection_t));
+        if (!connection)
+        {
+            return NULL;
+        }
+        if (pthread_setspecific (g_connection_key, connection))
+        {
+            free (connection);
+            return NULL;
+        }
+    }
+
+    if (connection->sdref && connection->pid != getpid ())
+    {
+        // Inherited across fork, so shared with the parent.  Deallocating a
+        // connection just closes our copy of its socket; the parent's
+        // lookups carry on.
+        DNSServiceRefDeallocate (connection->sdref);
+        connection->sdref = NULL;
+    }
+
+    if (!connection->sdref)
+    {
+        errcode = DNSServiceCreateConnection (&connection->sdref);
+        if (errcode)
+        {
+            syslog (LOG_WARNING,
+                    "mdns: Failed to connect to daemon, error %d",
+                    errcode
+                    );
+            connection->sdref = NULL;
+            return NULL;
+        }
+        connection->pid = getpid ();
+    }
+
+    return connection->sdref;
+}
+
+
+/*
+    Close this thread's connection to the daemon after a failure, so the
+    next lookup connects afresh.
+ */
+static void
+reset_connection (void)
+{
+    mdns_connection_t * connection;
+
+    if (!g_connection_key_ok)
+    {
+        return;
+    }
+
+    connection = (mdns_connection_t *) pthread_getspecific (g_connection_key);
+    if (connection && connection->sdref)
+    {
+        DNSServiceRefDeallocate (connection->sdref);
+        connection->sdref = NULL;
+    }
+}
+
+
+/*
+    Cache functions.
+ */
+static cache_entry_t *
+cache_find (const char * key, ns_type_t rrtype, time_t now)
+{
+    int i;
+
+    for (i = 0; i < k_cache_entries; i++)
+    {
+        cache_entry_t * entry = &g_cache [i];
+        if (entry->expires > now &&
+            entry->rrtype == rrtype &&
+            strcasecmp (entry->key, key) == 0)
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+
+/*
+    Answer a lookup from the cache, if possible.
+
+    Parameters
+        key
+            Name or reverse address being looked up.
+        rrtype
+            Resource record type being looked up.
+        result
+            Initialised 'result' data structure; for reverse lookups the
+            address must already have been added.
+        status
+            Set to the lookup's status if answered from the cache.
+
+    Returns
+        Non-zero if the lookup was answered from the cache
+ */
+static int
+cache_lookup (
+    const char * key,
+    ns_type_t rrtype,
+    result_map_t * result,
+    nss_status * status
+    )
+{
+    cache_entry_t * entry;
+    int hit = 0;
+
+    pthread_mutex_lock (&g_cache_mutex);
+    entry = cache_find (key, rrtype, time (NULL));
+    if (entry)
+    {
+        int i;
+        int offset;
+
+        hit = 1;
+        if (!entry->found)
+        {
+            *status = set_err_notfound (result);
+        }
+        else
+        {
+            set_err_success (result);
+            for (i = 0; i < entry->addrs_count; i++)
+            {
+                if (!add_address_to_buffer (result, entry->addrs [i], entry->addr_len))
+                    break;
+            }
+            for (offset = 0; offset < entry->names_len && result->status == NSS_STATUS_SUCCESS;)
+            {
+                const char * name = entry->names + offset;
+                int len = strlen (name) + 1;
+                if (!add_hostname_or_alias (result, name, len))
+                    break;
+                offset += len;
+            }
+            // If it doesn't fit, the caller will retry with a bigger buffer
+            *status = result->status;
+        }
+    }
+    pthread_mutex_unlock (&g_cache_mutex);
+
+    if (hit && MDNS_VERBOSE)
+        syslog (LOG_DEBUG,
+                "mdns: Answered lookup of %s from cache",
+                key
+                );
+
+    return hit;
+}
+
+
+/*
+    Answer an address lookup from the daemon's shared cache export, if it
+    is running with one (see dnssd_sharedcache.h).  Returns 1 with the
+    result filled in if the export knows the name, otherwise 0 and the
+    caller asks the daemon.  The export is kept up to date by the daemon,
+    so hits aren't copied into our own cache.
+ */
+static int
+shared_cache_lookup (
+    const char * name,
+    ns_type_t rrtype,
+    result_map_t * result
+    )
+{
+    dnssd_shared_cache_addr addrs [k_addrs_max];
+    int count;
+    int i;
+
+    count = dnssd_shared_cache_lookup (name, rrtype, 0, addrs, k_addrs_max);
+    if (count <= 0)
+    {
+        return 0;
+    }
+
+    // If it doesn't fit, the error is set and the caller will retry with a
+    // bigger buffer
+    if (!add_hostname_or_alias (result, name, strlen (name)))
+    {
+        return 1;
+    }
+    for (i = 0; i < count; i++)
+    {
+        if (!add_address_to_buffer (result, addrs [i].addr, result->hostent->h_length))
+        {
+            return 1;
+        }
+        if (addrs [i].ttl < result->ttl)
+            result->ttl = addrs [i].ttl;
+    }
+    set_err_success (result);
+
+    if (MDNS_VERBOSE)
+        syslog (LOG_DEBUG,
+                "mdns: Answered lookup of %s from shared cache",
+                name
+                );
+
+    return 1;
+}
+
+
+/*
+    Remember the outcome of a lookup.  Successes are cached for their
+    records' TTL, up to k_cache_positive_ttl; lookups that found nothing are
+    cached for k_cache_negative_ttl.  Other failures, such as being unable to
+    reach the daemon, running out of buffer or being abandoned early by
+    _nss_mdns_gethostbyname4_r, aren't cached.
+ */
+static void
+cache_store (
+    const char * key,
+    ns_type_t rrtype,
+    const result_map_t * result,
+    nss_status status
+    )
+{
+    const time_t now = time (NULL);
+    cache_entry_t * entry;
+    cache_entry_t local;
+    int i;
+
+    if (strlen (key) > k_hostname_maxlen || result->conn_error || result->cut_short)
+    {
+        return;
+    }
+
+    memset (&local, 0, sizeof (local));
+    local.rrtype = rrtype;
+    strcpy (local.key, key);
+
+    if (status == NSS_STATUS_SUCCESS)
+    {
+        const char * hostname = result->hostent->h_name;
+        int len;
+
+        local.found = 1;
+        local.expires = now + result->ttl;
+
+        // Reverse lookups' only address is the one that was looked up
+        if (rrtype != kDNSServiceType_PTR)
+        {
+            local.addr_len = result->hostent->h_length;
+            if (local.addr_len > (int) sizeof (local.addrs [0]))
+            {
+                return;
+            }
+            for (i = 0; i < result->addrs_count; i++)
+            {
+                memcpy (local.addrs [i], result->header->addrs [i], local.addr_len);
+            }
+            local.addrs_count = result->addrs_count;
+        }
+
+        for (i = -1; i < result->aliases_count; i++)
+        {
+            const char * name = (i < 0) ? hostname : result->header->aliases [i];
+            len = strlen (name) + 1;
+            if (local.names_len + len > k_cache_names_size)
+            {
+                // Too big to cache
+                return;
+            }
+            memcpy (local.names + local.names_len, name, len);
+            local.names_len += len;
+        }
+    }
+    else if (status == NSS_STATUS_NOTFOUND)
+    {
+        local.expires = now + k_cache_negative_ttl;
+    }
+    else
+    {
+        return;
+    }
+
+    pthread_mutex_lock (&g_cache_mutex);
+    // Replace this key's entry, or else an unused or expired one, or else
+    // the one that would have expired soonest
+    entry = cache_find (key, rrtype, now);
+    if (!entry)
+    {
+        entry = &g_cache [0];
+        for (i = 1; i < k_cache_entries && entry->expires > now; i++)
+        {
+            if (g_cache [i].expires < entry->expires)
+                entry = &g_cache [i];
+        }
+    }
+    *entry = local;
+    pthread_mutex_unlock (&g_cache_mutex);
+}
+
+
 static int
 callback_body_ptr (
     const char * fullname,
@@ -1517,6 +2324,9 @@ init_result (
     result->addr_idx = 0;
     result->alias_idx = buflen - sizeof (buf_header_t);
     result->done = 0;
+    result->ttl = k_cache_positive_ttl;
+    result->conn_error = 0;
+    result->cut_short = 0;
     set_err_notfound (result);
 
     // Point hostent to the right buffers
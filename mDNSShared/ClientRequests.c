@@ -63,6 +63,17 @@ mDNSBool AlwaysAppendSearchDomains = mDNSfalse;
 // Control enabling optimistic DNS - Phil
 mDNSBool EnableAllowExpired = mDNStrue;
 
+// Normally search domains are tried one after another, each waiting for the previous one to fail. This can be
+// overridden to query every candidate at once and answer with the first one in search-list order that exists.
+mDNSBool ParallelSearchDomains = mDNSfalse;
+
+enum
+{
+    SearchProbe_Pending = 0,
+    SearchProbe_Negative,
+    SearchProbe_Positive
+};
+
 
 typedef struct
 {
@@ -102,6 +113,7 @@ mDNSlocal mStatus QueryRecordOpStart(QueryRecordOp *inOp, const QueryRecordOpPar
     QueryRecordResultHandler inResultHandler, void *inResultContext);
 mDNSlocal void QueryRecordOpStop(QueryRecordOp *op);
 mDNSlocal mDNSBool QueryRecordOpIsMulticast(const QueryRecordOp *op);
+mDNSlocal mDNSu32 QueryRecordOpGetQueriesSent(const QueryRecordOp *inOp);
 mDNSlocal void QueryRecordOpCallback(mDNS *m, DNSQuestion *inQuestion, const ResourceRecord *inAnswer,
     QC_result inAddRecord);
 mDNSlocal void QueryRecordOpResetHandler(DNSQuestion *inQuestion);
@@ -113,6 +125,8 @@ mDNSlocal mStatus InterfaceIndexToInterfaceID(mDNSu32 inInterfaceIndex, mDNSInte
 mDNSlocal mDNSBool DomainNameIsSingleLabel(const domainname *inName);
 mDNSlocal mDNSBool StringEndsWithDot(const char *inString);
 mDNSlocal const domainname * NextSearchDomain(QueryRecordOp *inOp);
+mDNSlocal mDNSBool QueryRecordOpStartSearchProbes(QueryRecordOp *inOp, DNSQuestion *inQuestion);
+mDNSlocal void QueryRecordOpStopSearchProbes(QueryRecordOp *inOp);
 #if MDNSRESPONDER_SUPPORTS(APPLE, UNICAST_DOTLOCAL)
 mDNSlocal mDNSBool DomainNameIsInSearchList(const domainname *domain, mDNSBool inExcludeLocal);
 #endif
@@ -293,6 +307,14 @@ mDNSexport const domainname * GetAddrInfoClientRequestGetQName(const GetAddrInfo
     return (const domainname *)"";
 }
 
+mDNSexport mDNSu32 GetAddrInfoClientRequestGetQueriesSent(const GetAddrInfoClientRequest *inRequest)
+{
+    mDNSu32 sent = 0;
+    if (inRequest->op4) sent += QueryRecordOpGetQueriesSent(inRequest->op4);
+    if (inRequest->op6) sent += QueryRecordOpGetQueriesSent(inRequest->op6);
+    return sent;
+}
+
 mDNSexport mDNSBool GetAddrInfoClientRequestIsMulticast(const GetAddrInfoClientRequest *inRequest)
 {
     if ((inRequest->op4 && QueryRecordOpIsMulticast(inRequest->op4)) ||
@@ -314,6 +336,7 @@ mDNSexport mStatus QueryRecordClientRequestStart(QueryRecordClientRequest *inReq
     mStatus             err;
     domainname          qname;
     mDNSInterfaceID     interfaceID;
+    mDNSBool            absolute;
     mDNSBool            appendSearchDomains;
     QueryRecordOpParams opParams;
 #if MDNSRESPONDER_SUPPORTS(APPLE, DNSSECv2)
@@ -323,15 +346,24 @@ mDNSexport mStatus QueryRecordClientRequestStart(QueryRecordClientRequest *inReq
     err = InterfaceIndexToInterfaceID(inParams->interfaceIndex, &interfaceID);
     if (err) goto exit;
 
-    if (!MakeDomainNameFromDNSNameString(&qname, inParams->qnameStr))
+    if (inParams->qname)
     {
-        LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEFAULT,
-               "[R%u] ERROR: bad domain name '" PRI_S "'", inParams->requestID, inParams->qnameStr);
-        err = mStatus_BadParamErr;
-        goto exit;
+        AssignDomainName(&qname, inParams->qname);
+        absolute = inParams->qnameAbsolute;
+    }
+    else
+    {
+        if (!MakeDomainNameFromDNSNameString(&qname, inParams->qnameStr))
+        {
+            LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEFAULT,
+                   "[R%u] ERROR: bad domain name '" PRI_S "'", inParams->requestID, inParams->qnameStr);
+            err = mStatus_BadParamErr;
+            goto exit;
+        }
+        absolute = StringEndsWithDot(inParams->qnameStr);
     }
 
-    if (RecordTypeIsAddress(inParams->qtype) && !StringEndsWithDot(inParams->qnameStr) &&
+    if (RecordTypeIsAddress(inParams->qtype) && !absolute &&
         (AlwaysAppendSearchDomains || DomainNameIsSingleLabel(&qname)))
     {
         appendSearchDomains = mDNStrue;
@@ -412,6 +444,11 @@ mDNSexport void QueryRecordClientRequestStop(QueryRecordClientRequest *inRequest
 #endif
 }
 
+mDNSexport mDNSu32 QueryRecordClientRequestGetQueriesSent(const QueryRecordClientRequest *inRequest)
+{
+    return QueryRecordOpGetQueriesSent(&inRequest->op);
+}
+
 mDNSexport const domainname * QueryRecordClientRequestGetQName(const QueryRecordClientRequest *inRequest)
 {
     return &inRequest->op.q.qname;
@@ -482,17 +519,57 @@ mDNSexport void QueryRecordOpStopForClientRequest(QueryRecordOp *op) {
 
 #endif // MDNSRESPONDER_SUPPORTS(APPLE, DNSSECv2)
 
+// Each DNSServiceGetAddrInfo request allocates a QueryRecordOp (with its DNSQuestion) for each address family, so
+// rather than going back to the allocator for these kilobyte-sized objects every time, freed ones are kept on a
+// freelist, up to QueryRecordOpPoolMaxFree of them, and handed out again. As with the UDS object pools, pooling is
+// disabled under MDNS_MALLOC_DEBUGGING.
+#ifndef QueryRecordOpPoolMaxFree
+#if MDNS_MALLOC_DEBUGGING
+#define QueryRecordOpPoolMaxFree 0
+#else
+#define QueryRecordOpPoolMaxFree 64
+#endif
+#endif
+
+typedef struct QueryRecordOpPoolItem_struct QueryRecordOpPoolItem;
+struct QueryRecordOpPoolItem_struct
+{
+    QueryRecordOpPoolItem *next;
+};
+
+static QueryRecordOpPoolItem *gQueryRecordOpFreeList = mDNSNULL;
+static QueryRecordOpPoolStats gQueryRecordOpPoolStats;
+
+mDNSexport void QueryRecordOpGetPoolStats(QueryRecordOpPoolStats *outStats)
+{
+    *outStats = gQueryRecordOpPoolStats;
+}
+
 mDNSlocal mStatus QueryRecordOpCreate(QueryRecordOp **outOp)
 {
     mStatus err;
     QueryRecordOp *op;
 
-    op = (QueryRecordOp *) mDNSPlatformMemAllocateClear(sizeof(*op));
-    if (!op)
+    if (gQueryRecordOpFreeList)
     {
-        err = mStatus_NoMemoryErr;
-        goto exit;
+        QueryRecordOpPoolItem *const item = gQueryRecordOpFreeList;
+        gQueryRecordOpFreeList = item->next;
+        gQueryRecordOpPoolStats.numFree--;
+        gQueryRecordOpPoolStats.hits++;
+        op = (QueryRecordOp *)item;
+        mDNSPlatformMemZero(op, (mDNSu32)sizeof(*op));
     }
+    else
+    {
+        op = (QueryRecordOp *) mDNSPlatformMemAllocateClear(sizeof(*op));
+        if (!op)
+        {
+            err = mStatus_NoMemoryErr;
+            goto exit;
+        }
+    }
+    gQueryRecordOpPoolStats.allocs++;
+    gQueryRecordOpPoolStats.inUse++;
     *outOp = op;
     err = mStatus_NoError;
 
@@ -502,7 +579,15 @@ exit:
 
 mDNSlocal void QueryRecordOpFree(QueryRecordOp *operation)
 {
-    mDNSPlatformMemFree(operation);
+    gQueryRecordOpPoolStats.inUse--;
+    if (gQueryRecordOpPoolStats.numFree < QueryRecordOpPoolMaxFree)
+    {
+        QueryRecordOpPoolItem *const item = (QueryRecordOpPoolItem *)operation;
+        item->next = gQueryRecordOpFreeList;
+        gQueryRecordOpFreeList = item;
+        gQueryRecordOpPoolStats.numFree++;
+    }
+    else mDNSPlatformMemFree(operation);
 }
 
 #define VALID_MSAD_SRV_TRANSPORT(T) \
@@ -658,6 +743,7 @@ exit:
 
 mDNSlocal void QueryRecordOpStop(QueryRecordOp *op)
 {
+    QueryRecordOpStopSearchProbes(op);
     if (op->q.QuestionContext)
     {
         QueryRecordOpStopQuestion(&op->q);
@@ -688,6 +774,19 @@ mDNSlocal mDNSBool QueryRecordOpIsMulticast(const QueryRecordOp *op)
     return ((mDNSOpaque16IsZero(op->q.TargetQID) && (op->q.ThisQInterval > 0)) ? mDNStrue : mDNSfalse);
 }
 
+// Queries sent for the operation's questions as they stand: the main one, any search-list candidates still out,
+// and the unicast twin of a dot-local name
+mDNSlocal mDNSu32 QueryRecordOpGetQueriesSent(const QueryRecordOp *inOp)
+{
+    mDNSu32 sent = inOp->q.SentInQueries;
+    int i;
+    for (i = 0; inOp->searchProbes && i < inOp->searchProbeCount; i++) sent += inOp->searchProbes[i].q.SentInQueries;
+#if MDNSRESPONDER_SUPPORTS(APPLE, UNICAST_DOTLOCAL)
+    if (inOp->q2) sent += inOp->q2->SentInQueries;
+#endif
+    return sent;
+}
+
 // GetTimeNow is a callback-safe alternative to mDNS_TimeNow(), which expects to be called with m->mDNS_busy == 0.
 mDNSlocal mDNSs32 GetTimeNow(mDNS *m)
 {
@@ -755,6 +854,11 @@ mDNSlocal void QueryRecordOpCallback(mDNS *m, DNSQuestion *inQuestion, const Res
         {
             if (inQuestion->AppendSearchDomains && (op->searchListIndex >= 0) && inAddRecord)
             {
+                if (ParallelSearchDomains && (op->searchListIndex == 0) && (inQuestion == &op->q) &&
+                    QueryRecordOpStartSearchProbes(op, inQuestion))
+                {
+                    goto exit;
+                }
                 domain = NextSearchDomain(op);
                 if (domain || DomainNameIsSingleLabel(op->qname))
                 {
@@ -965,6 +1069,118 @@ mDNSlocal const domainname * NextSearchDomain(QueryRecordOp *inOp)
     return domain;
 }
 
+// Once every candidate ahead of the first positive one has answered negatively, that candidate is the answer, so the
+// client's question is restarted with it and gets the answer from the cache. If they're all negative, the last one is
+// used, so the client sees the same negative answer it would have got by trying them in turn.
+mDNSlocal void QueryRecordOpCheckSearchProbes(QueryRecordOp *inOp)
+{
+    QueryRecordSearchProbe *    probe;
+    const domainname *          domain;
+    int                         i;
+
+    for (i = 0; i < inOp->searchProbeCount; i++)
+    {
+        if (inOp->searchProbes[i].state == SearchProbe_Pending) return;
+        if (inOp->searchProbes[i].state == SearchProbe_Positive) break;
+    }
+    if (i == inOp->searchProbeCount) i = inOp->searchProbeCount - 1;
+    probe = &inOp->searchProbes[i];
+
+    LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO,
+           "[R%u] QueryRecordOpCheckSearchProbes: using " PRI_DM_NAME " (" PUB_S "), candidate %d of %d",
+           inOp->reqID, DM_NAME_PARAM(&probe->q.qname), DNSTypeName(probe->q.qtype), i + 1, inOp->searchProbeCount);
+
+    // domain points into the probe's qname, so restart before the probes go away
+    domain = SkipLeadingLabels(&probe->q.qname, CountLabels(inOp->qname));
+    QueryRecordOpRestartUnicastQuestion(inOp, &inOp->q, domain);
+    QueryRecordOpStopSearchProbes(inOp);
+}
+
+mDNSlocal void QueryRecordOpSearchProbeCallback(mDNS *m, DNSQuestion *inQuestion, const ResourceRecord *inAnswer, QC_result inAddRecord)
+{
+    QueryRecordOp *const            op = (QueryRecordOp *)inQuestion->QuestionContext;
+    QueryRecordSearchProbe *const   probe = (QueryRecordSearchProbe *)inQuestion;
+    (void)m;
+
+    if (!inAddRecord || (probe->state != SearchProbe_Pending)) return;
+    if ((inAddRecord == QC_suppressed) || (inAnswer->RecordType == kDNSRecordTypePacketNegative))
+    {
+        probe->state = SearchProbe_Negative;
+    }
+    else
+    {
+        probe->state = SearchProbe_Positive;
+    }
+    QueryRecordOpCheckSearchProbes(op);
+}
+
+// Starts a query for every remaining search-list candidate in place of inQuestion. Returns false, leaving inQuestion
+// alone, if there aren't at least two candidates to run side by side.
+mDNSlocal mDNSBool QueryRecordOpStartSearchProbes(QueryRecordOp *inOp, DNSQuestion *inQuestion)
+{
+    const mDNSBool          bare = DomainNameIsSingleLabel(inOp->qname);
+    const int               savedIndex = inOp->searchListIndex;
+    const domainname *      domain;
+    int                     count, i;
+
+    count = 0;
+    while (NextSearchDomain(inOp)) count++;
+    inOp->searchListIndex = savedIndex;
+    if (bare) count++;
+    if (count < 2) return mDNSfalse;
+
+    QueryRecordOpStopSearchProbes(inOp);
+    inOp->searchProbes = (QueryRecordSearchProbe *) mDNSPlatformMemAllocateClear(count * (mDNSu32)sizeof(*inOp->searchProbes));
+    if (!inOp->searchProbes) return mDNSfalse;
+    inOp->searchProbeCount = count;
+
+    QueryRecordOpStopQuestion(inQuestion);
+    for (i = 0; i < count; i++)
+    {
+        QueryRecordSearchProbe *const   probe = &inOp->searchProbes[i];
+        DNSQuestion *const              q = &probe->q;
+
+        // The single-label name on its own goes last, as it does when the search domains are tried in turn
+        domain = NextSearchDomain(inOp);
+        *q = *inQuestion;
+        q->InterfaceID = inOp->interfaceID;
+        AssignDomainName(&q->qname, inOp->qname);
+        if (domain) AppendDomainName(&q->qname, domain);
+        q->IsUnicastDotLocal = SameDomainLabel(LastLabel(&q->qname), (const mDNSu8 *)&localdomain) ? mDNStrue : mDNSfalse;
+        q->QuestionCallback  = QueryRecordOpSearchProbeCallback;
+        q->ResetHandler      = mDNSNULL;
+        q->QuestionContext   = inOp;
+        if (mDNS_StartQuery(&mDNSStorage, q))
+        {
+            q->QuestionContext = mDNSNULL;
+            probe->state = SearchProbe_Negative;
+        }
+    }
+    inOp->searchListIndex = -1;
+
+    LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO,
+           "[R%u] QueryRecordOpStartSearchProbes: querying %d search-list candidates for " PRI_DM_NAME " (" PUB_S ") at once",
+           inOp->reqID, count, DM_NAME_PARAM(inOp->qname), DNSTypeName(inQuestion->qtype));
+
+    // If none of them could be started, there's nothing left to wait for
+    QueryRecordOpCheckSearchProbes(inOp);
+    return mDNStrue;
+}
+
+mDNSlocal void QueryRecordOpStopSearchProbes(QueryRecordOp *inOp)
+{
+    int     i;
+
+    if (!inOp->searchProbes) return;
+    for (i = 0; i < inOp->searchProbeCount; i++)
+    {
+        if (inOp->searchProbes[i].q.QuestionContext) QueryRecordOpStopQuestion(&inOp->searchProbes[i].q);
+    }
+    mDNSPlatformMemFree(inOp->searchProbes);
+    inOp->searchProbes = mDNSNULL;
+    inOp->searchProbeCount = 0;
+}
+
 #if MDNSRESPONDER_SUPPORTS(APPLE, UNICAST_DOTLOCAL)
 mDNSlocal mDNSBool DomainNameIsInSearchList(const domainname *inName, mDNSBool inExcludeLocal)
 {
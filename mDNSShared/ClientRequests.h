@@ -23,6 +23,13 @@
 typedef void (*QueryRecordResultHandler)(mDNS *const m, DNSQuestion *question, const ResourceRecord *const answer, QC_result AddRecord,
     DNSServiceErrorType error, void *context);
 
+typedef struct
+{
+    DNSQuestion                 q;                      // Query for the original name with one search domain appended.
+    mDNSu8                      state;                  // Pending, answered negatively, or answered positively.
+
+}   QueryRecordSearchProbe;
+
 typedef struct
 {
     DNSQuestion                 q;                      // DNSQuestion for record query.
@@ -32,6 +39,8 @@ typedef struct
     void *                      resultContext;          // Context to pass to result handler.
     mDNSu32                     reqID;                  // 
     int                         searchListIndex;        // Index that indicates the next search domain to try.
+    QueryRecordSearchProbe *    searchProbes;           // Queries for every search-list candidate at once (ParallelSearchDomains).
+    int                         searchProbeCount;       // Number of candidates in searchProbes, in search-list order.
 #if MDNSRESPONDER_SUPPORTS(APPLE, UNICAST_DOTLOCAL)
     DNSQuestion *               q2;                     // DNSQuestion for unicast version of a record with a dot-local name.
     mDNSu16                     q2Type;                 // q2's original qtype value.
@@ -88,6 +97,8 @@ typedef struct
 {
     mDNSu32                 requestID;
     const char *            qnameStr;
+    const domainname *      qname;          // If non-NULL, the name to query for, and qnameStr is ignored.
+    mDNSBool                qnameAbsolute;  // With qname, whether the client gave the name with a trailing dot.
     mDNSu32                 interfaceIndex;
     DNSServiceFlags         flags;
     mDNSu16                 qtype;
@@ -108,16 +119,26 @@ typedef struct
 
 }   QueryRecordClientRequestParams;
 
+typedef struct
+{
+    mDNSu32                 inUse;          // QueryRecordOps currently handed out
+    mDNSu32                 numFree;        // Freed QueryRecordOps kept for reuse
+    mDNSu32                 allocs;         // Total QueryRecordOps handed out
+    mDNSu32                 hits;           // How many of those were reused
+}   QueryRecordOpPoolStats;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+mDNSexport void QueryRecordOpGetPoolStats(QueryRecordOpPoolStats *outStats);
 mDNSexport void GetAddrInfoClientRequestParamsInit(GetAddrInfoClientRequestParams *inParams);
 mDNSexport mStatus GetAddrInfoClientRequestStart(GetAddrInfoClientRequest *inRequest,
     const GetAddrInfoClientRequestParams *inParams, QueryRecordResultHandler inResultHandler, void *inResultContext);
 mDNSexport void GetAddrInfoClientRequestStop(GetAddrInfoClientRequest *inRequest);
 mDNSexport const domainname * GetAddrInfoClientRequestGetQName(const GetAddrInfoClientRequest *inRequest);
 mDNSexport mDNSBool GetAddrInfoClientRequestIsMulticast(const GetAddrInfoClientRequest *inRequest);
+mDNSexport mDNSu32 GetAddrInfoClientRequestGetQueriesSent(const GetAddrInfoClientRequest *inRequest);
 
 mDNSexport void QueryRecordClientRequestParamsInit(QueryRecordClientRequestParams *inParams);
 mDNSexport mStatus QueryRecordClientRequestStart(QueryRecordClientRequest *inRequest,
@@ -126,6 +147,7 @@ mDNSexport void QueryRecordClientRequestStop(QueryRecordClientRequest *inRequest
 mDNSexport const domainname * QueryRecordClientRequestGetQName(const QueryRecordClientRequest *inRequest);
 mDNSexport mDNSu16 QueryRecordClientRequestGetType(const QueryRecordClientRequest *inRequest);
 mDNSexport mDNSBool QueryRecordClientRequestIsMulticast(QueryRecordClientRequest *inRequest);
+mDNSexport mDNSu32 QueryRecordClientRequestGetQueriesSent(const QueryRecordClientRequest *inRequest);
 
 #if MDNSRESPONDER_SUPPORTS(APPLE, DNSSECv2)
 // This is a "mDNSexport" wrapper around the "static" QueryRecordOpStart that cannot be called by outside, which can be
@@ -0,0 +1,254 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "GenHashTable.h"
+
+
+// Return the link pointer contained within element e at offset o.
+#define     GETLINK( e, o)          ( *(void**)((char*) (e) + (o)) )
+
+// Assign the link pointer l to element e at offset o.
+#define     ASSIGNLINK( e, l, o)    ( *((void**)((char*) (e) + (o))) = (l))
+
+// The heap position (plus one) stored within element e at offset o.
+#define     HEAPINDEX( e, o)        ( *(size_t*)((char*) (e) + (o)) )
+
+
+//		GenHashTable		/////////////////////////////////////////////////////////////
+
+void        InitHashTable( GenHashTable *pTable, void **buckets, size_t numBuckets, size_t linkOffset)
+/* Initialize pTable as an empty hash table using the numBuckets pointers at buckets. */
+{
+    size_t i;
+
+    for ( i = 0; i < numBuckets; i++)
+        buckets[i] = NULL;
+    pTable->Buckets = buckets;
+    pTable->NumBuckets = numBuckets;
+    pTable->LinkOffset = linkOffset;
+    pTable->Count = 0;
+}
+
+
+void        HashAdd( GenHashTable *pTable, void *elem, unsigned int hash)
+/* Add an element to the head of its bucket. */
+{
+    void    **pBucket = &pTable->Buckets[ hash % pTable->NumBuckets];
+
+    ASSIGNLINK( elem, *pBucket, pTable->LinkOffset);
+    *pBucket = elem;
+    pTable->Count++;
+}
+
+
+int     HashRemove( GenHashTable *pTable, void *elem, unsigned int hash)
+/* Remove an element from the table. Return 0 if it was not found. */
+/* If the element is removed, its link will be set to NULL. */
+{
+    void    *iElem, *lastElem;
+    void    **pBucket = &pTable->Buckets[ hash % pTable->NumBuckets];
+
+    for ( iElem = *pBucket, lastElem = NULL; iElem; iElem = GETLINK( iElem, pTable->LinkOffset)) {
+        if ( iElem == elem) {
+            if ( lastElem)          // somewhere past the head of the bucket
+                ASSIGNLINK( lastElem, GETLINK( elem, pTable->LinkOffset), pTable->LinkOffset);
+            else
+                *pBucket = GETLINK( elem, pTable->LinkOffset);
+            ASSIGNLINK( elem, NULL, pTable->LinkOffset);
+            pTable->Count--;
+            return 1;
+        }
+        lastElem = iElem;
+    }
+
+    return 0;
+}
+
+
+void        *HashLookup( GenHashTable *pTable, unsigned int hash, const void *key, GenHashMatchFunc match)
+/* Return the first element in hash's bucket for which match( elem, key) is nonzero, or NULL. */
+{
+    void    *iElem;
+
+    for ( iElem = pTable->Buckets[ hash % pTable->NumBuckets]; iElem; iElem = GETLINK( iElem, pTable->LinkOffset)) {
+        if ( match( iElem, key))
+            return iElem;
+    }
+
+    return NULL;
+}
+
+
+void        *HashLookupNext( GenHashTable *pTable, void *elem, const void *key, GenHashMatchFunc match)
+/* Return the next element after elem in the same bucket that also matches key, or NULL. */
+{
+    void    *iElem;
+
+    for ( iElem = GETLINK( elem, pTable->LinkOffset); iElem; iElem = GETLINK( iElem, pTable->LinkOffset)) {
+        if ( match( iElem, key))
+            return iElem;
+    }
+
+    return NULL;
+}
+
+
+void        *HashBucketHead( GenHashTable *pTable, size_t bucket)
+/* Return the first element in bucket number bucket, or NULL. With HashNext, walks the whole table. */
+{
+    return bucket < pTable->NumBuckets ? pTable->Buckets[ bucket] : NULL;
+}
+
+
+void        *HashNext( GenHashTable *pTable, void *elem)
+/* Return the element after elem in its bucket, or NULL. */
+{
+    return GETLINK( elem, pTable->LinkOffset);
+}
+
+
+//		GenMinHeap		/////////////////////////////////////////////////////////////////
+
+static void     HeapPlace( GenMinHeap *pHeap, size_t i, void *elem);
+static void     HeapSiftUp( GenMinHeap *pHeap, size_t i);
+static void     HeapSiftDown( GenMinHeap *pHeap, size_t i);
+
+
+static void     HeapPlace( GenMinHeap *pHeap, size_t i, void *elem)
+// Store elem at position i and record the position in the element.
+{
+    pHeap->Elems[i] = elem;
+    HEAPINDEX( elem, pHeap->IndexOffset) = i + 1;
+}
+
+
+static void     HeapSiftUp( GenMinHeap *pHeap, size_t i)
+// Move the element at position i up until its parent doesn't come after it.
+{
+    void    *elem = pHeap->Elems[i];
+
+    while ( i > 0) {
+        size_t parent = (i - 1) / 2;
+        if ( pHeap->Compare( pHeap->Elems[parent], elem) <= 0)
+            break;
+        HeapPlace( pHeap, i, pHeap->Elems[parent]);
+        i = parent;
+    }
+    HeapPlace( pHeap, i, elem);
+}
+
+
+static void     HeapSiftDown( GenMinHeap *pHeap, size_t i)
+// Move the element at position i down until neither child comes before it.
+{
+    void    *elem = pHeap->Elems[i];
+
+    for ( ;;) {
+        size_t child = 2 * i + 1;
+        if ( child >= pHeap->Count)
+            break;
+        if ( child + 1 < pHeap->Count && pHeap->Compare( pHeap->Elems[child + 1], pHeap->Elems[child]) < 0)
+            child++;
+        if ( pHeap->Compare( elem, pHeap->Elems[child]) <= 0)
+            break;
+        HeapPlace( pHeap, i, pHeap->Elems[child]);
+        i = child;
+    }
+    HeapPlace( pHeap, i, elem);
+}
+
+
+void        InitMinHeap( GenMinHeap *pHeap, void **elems, size_t capacity, size_t indexOffset,
+                         GenHeapCompareFunc compare)
+/* Initialize pHeap as an empty heap that can hold capacity elements in the array at elems. */
+{
+    pHeap->Elems = elems;
+    pHeap->Count = 0;
+    pHeap->Capacity = capacity;
+    pHeap->IndexOffset = indexOffset;
+    pHeap->Compare = compare;
+}
+
+
+int     HeapInsert( GenMinHeap *pHeap, void *elem)
+/* Add an element to the heap. Return 0 if the heap is full. */
+{
+    if ( pHeap->Count == pHeap->Capacity)
+        return 0;
+
+    pHeap->Elems[ pHeap->Count] = elem;
+    HeapSiftUp( pHeap, pHeap->Count++);
+    return 1;
+}
+
+
+void        *HeapMin( GenMinHeap *pHeap)
+/* Return the element that comes first, without removing it, or NULL if the heap is empty. */
+{
+    return pHeap->Count ? pHeap->Elems[0] : NULL;
+}
+
+
+void        *HeapRemoveMin( GenMinHeap *pHeap)
+/* Remove and return the element that comes first, or NULL if the heap is empty. */
+{
+    void    *elem = HeapMin( pHeap);
+
+    if ( elem)
+        HeapRemove( pHeap, elem);
+    return elem;
+}
+
+
+int     HeapRemove( GenMinHeap *pHeap, void *elem)
+/* Remove an element from the heap. Return 0 if it was not in the heap. */
+/* If the element is removed, its index will be set to 0. */
+{
+    size_t i = HEAPINDEX( elem, pHeap->IndexOffset);
+    void    *last;
+
+    if ( i == 0 || i > pHeap->Count || pHeap->Elems[i - 1] != elem)
+        return 0;
+    i--;
+
+    HEAPINDEX( elem, pHeap->IndexOffset) = 0;
+    last = pHeap->Elems[ --pHeap->Count];
+    if ( i < pHeap->Count) {
+        // Fill the hole with the last element, which may belong either above or below it.
+        pHeap->Elems[i] = last;
+        if ( i > 0 && pHeap->Compare( last, pHeap->Elems[(i - 1) / 2]) < 0)
+            HeapSiftUp( pHeap, i);
+        else
+            HeapSiftDown( pHeap, i);
+    }
+    return 1;
+}
+
+
+void        HeapUpdate( GenMinHeap *pHeap, void *elem)
+/* Restore the heap order after the sort key of elem, which must be in the heap, has changed. */
+{
+    size_t i = HEAPINDEX( elem, pHeap->IndexOffset);
+
+    if ( i == 0 || i > pHeap->Count || pHeap->Elems[i - 1] != elem)
+        return;
+    i--;
+
+    if ( i > 0 && pHeap->Compare( elem, pHeap->Elems[(i - 1) / 2]) < 0)
+        HeapSiftUp( pHeap, i);
+    else
+        HeapSiftDown( pHeap, i);
+}
@@ -0,0 +1,88 @@
+/* -*- Mode: C; tab-width: 4 -*-
+ *
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __GenHashTable__
+#define __GenHashTable__
+
+
+#include <stddef.h>
+
+
+/* Like GenLinkedList, these containers never allocate: elements carry their own link (or index) */
+/* field at a fixed offset, and any array a container needs is supplied by the caller at init time. */
+
+
+/* A GenHashTable chains elements into buckets through a link field in each element. The caller */
+/* computes the hash; the same hash must be given for an element when it is added and removed. */
+
+typedef int (*GenHashMatchFunc)( const void *elem, const void *key);
+
+struct  GenHashTable
+{
+    void        **Buckets;
+    size_t NumBuckets,
+           LinkOffset,
+           Count;
+};
+typedef struct GenHashTable GenHashTable;
+
+
+void        InitHashTable( GenHashTable *pTable, void **buckets, size_t numBuckets, size_t linkOffset);
+
+void        HashAdd( GenHashTable *pTable, void *elem, unsigned int hash);
+
+int     HashRemove( GenHashTable *pTable, void *elem, unsigned int hash);
+
+void        *HashLookup( GenHashTable *pTable, unsigned int hash, const void *key, GenHashMatchFunc match);
+void        *HashLookupNext( GenHashTable *pTable, void *elem, const void *key, GenHashMatchFunc match);
+
+void        *HashBucketHead( GenHashTable *pTable, size_t bucket);
+void        *HashNext( GenHashTable *pTable, void *elem);
+
+
+
+/* A GenMinHeap keeps elements ordered by a comparison function in a caller-supplied array of */
+/* element pointers. Each element records its position in a size_t field at IndexOffset, so it can */
+/* be removed or re-sorted without a search; the field is 0 while the element is not in the heap. */
+
+typedef int (*GenHeapCompareFunc)( const void *a, const void *b);     // < 0 if a comes out first
+
+struct  GenMinHeap
+{
+    void        **Elems;
+    size_t Count,
+           Capacity,
+           IndexOffset;
+    GenHeapCompareFunc Compare;
+};
+typedef struct GenMinHeap GenMinHeap;
+
+
+void        InitMinHeap( GenMinHeap *pHeap, void **elems, size_t capacity, size_t indexOffset,
+                         GenHeapCompareFunc compare);
+
+int     HeapInsert( GenMinHeap *pHeap, void *elem);
+
+void        *HeapMin( GenMinHeap *pHeap);
+void        *HeapRemoveMin( GenMinHeap *pHeap);
+
+int     HeapRemove( GenMinHeap *pHeap, void *elem);
+
+void        HeapUpdate( GenMinHeap *pHeap, void *elem);
+
+
+#endif //	__GenHashTable__
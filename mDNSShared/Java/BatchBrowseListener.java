@@ -0,0 +1,49 @@
+/* -*- Mode: Java; tab-width: 4 -*-
+ *
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+package	com.apple.dnssd;
+
+import	java.nio.ByteBuffer;
+
+
+/**	A {@link BrowseListener} that receives its results in batches, rather than one call per result.<P>
+
+	Results are gathered in native memory and handed over together once no more are immediately
+	coming, which saves an upcall and three Strings per result for browses with many results.
+	serviceFound() and serviceLost() are not called for a browse with a BatchBrowseListener.
+*/
+
+public interface BatchBrowseListener extends BrowseListener
+{
+	/** Called to report a batch of discovered and deregistered services.<P> 
+
+		@param	browser
+					The active browse service.
+		<P>
+		@param	results
+					A direct buffer holding the results, from its position up to its limit. Each result is
+					a big-endian int of flags ({@link DNSSD#ADD} is set for a service found and clear for one
+					lost), an int interface index, then the service name, registration type and domain, each as
+					an unsigned short length followed by that many bytes of UTF-8. The buffer is reused for the
+					next batch, so it is only valid until this call returns or the browser is stopped.
+		<P>
+		@param	count
+					The number of results in the buffer.
+	*/
+	void	servicesChanged( DNSSDService browser, ByteBuffer results, int count);
+}
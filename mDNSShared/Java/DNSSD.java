@@ -54,6 +54,9 @@ abstract public class	DNSSD
 	*/
 	public static final int		MORE_COMING = ( 1 << 0 );
 
+	/** Flag is set in a {@link BatchBrowseListener} result for a service found, and clear for one lost. */
+	public static final int		ADD = ( 1 << 1 );
+
 	/** If flag is set in a {@link DomainListener} callback, indicates that the result is the default domain. */
 	public static final int		DEFAULT = ( 1 << 2 );
 
@@ -543,7 +546,7 @@ class	AppleDNSSD extends DNSSD
 	{
 		System.loadLibrary( "jdns_sd");
 	
-		int		libInitResult = InitLibrary( 2);	// Current version number (must be sync'd with jnilib version)
+		int		libInitResult = InitLibrary( 3);	// Current version number (must be sync'd with jnilib version)
 
 		if (libInitResult != DNSSDException.NO_ERROR)
 			throw new InternalError( "cannot instantiate DNSSD: " + new AppleDNSSDException( libInitResult).getMessage());
@@ -708,6 +711,14 @@ class	AppleBrowser extends AppleService
 
 	// Sets fNativeContext. Returns non-zero on error.
 	protected native int	CreateBrowser( int flags, int ifIndex, String regType, String domain);
+
+	// Called from native code with a batch of results for a BatchBrowseListener.
+	protected void			deliverBatch( java.nio.ByteBuffer results, int count, int length)
+	{
+		results.clear();
+		results.limit( length);
+		((BatchBrowseListener) fListener).servicesChanged( this, results, count);
+	}
 }
 
 class	AppleResolver extends AppleService
@@ -75,9 +75,17 @@ static DWORD    win32_if_nametoindex( const char * nameStr );
 
 enum {
     kInterfaceVersionOne = 1,
+    kInterfaceVersionTwo,
     kInterfaceVersionCurrent        // Must match version in .jar file
 };
 
+// A BatchBrowseListener's results are packed into a direct ByteBuffer over this much native memory, and handed
+// over together once no more are coming (or the buffer can't be sure of holding another), so a busy browse costs
+// one JNI upcall per batch rather than one per result plus three Strings apiece. Each result takes at most
+// kBatchBrowseMaxResult bytes: flags and ifIndex, then three UTF-8 strings, each with a 16-bit length in front.
+#define kBatchBrowseBufferSize  (16 * 1024)
+#define kBatchBrowseMaxResult   (4 + 4 + 3 * (2 + kDNSServiceMaxDomainName))
+
 typedef struct OpContext OpContext;
 
 struct  OpContext
@@ -88,6 +96,14 @@ struct  OpContext
     jobject ClientObj;
     jmethodID Callback;
     jmethodID Callback2;
+    char            *LastRegType;   // Browse results mostly repeat the type and domain, so keep the last String of each
+    jstring RegTypeObj;
+    char            *LastDomain;
+    jstring DomainObj;
+    unsigned char   *BatchMem;      // Only for a BatchBrowseListener
+    jobject BatchBuf;
+    int BatchLen;
+    int BatchCount;
 };
 
 // For AUTO_CALLBACKS, we must attach the callback thread to the Java VM prior to upcall.
@@ -95,6 +111,14 @@ struct  OpContext
 JavaVM      *gJavaVM = NULL;
 #endif
 
+// Looked up once by InitLibrary() rather than on every call and callback
+static jfieldID gNativeContextField;        // AppleService.fNativeContext
+static jmethodID gOperationFailed;          // BaseListener.operationFailed()
+static jclass gTXTRecordClass;
+static jmethodID gTXTRecordCtor;
+static jclass gBatchBrowseListenerClass;
+static jmethodID gDeliverBatch;             // AppleBrowser.deliverBatch()
+
 
 JNIEXPORT jint JNICALL Java_com_apple_dnssd_AppleDNSSD_InitLibrary( JNIEnv *pEnv, jclass cls,
                                                                     jint callerVersion)
@@ -123,6 +147,36 @@ JNIEXPORT jint JNICALL Java_com_apple_dnssd_AppleDNSSD_InitLibrary( JNIEnv *pEnv
         (*pEnv)->SetStaticBooleanField( pEnv, cls, hasAutoCField, hasAutoC);
     }
 
+    // Cache the classes and members the callbacks need; the classes must be global refs to stay valid
+    {
+        jclass serviceCls = (*pEnv)->FindClass( pEnv, "com/apple/dnssd/AppleService");
+        jclass listenerCls = (*pEnv)->FindClass( pEnv, "com/apple/dnssd/BaseListener");
+        jclass txtCls = (*pEnv)->FindClass( pEnv, "com/apple/dnssd/TXTRecord");
+        jclass batchCls = (*pEnv)->FindClass( pEnv, "com/apple/dnssd/BatchBrowseListener");
+        jclass browserCls = (*pEnv)->FindClass( pEnv, "com/apple/dnssd/AppleBrowser");
+
+        if ( serviceCls == NULL || listenerCls == NULL || txtCls == NULL || batchCls == NULL || browserCls == NULL)
+            return kDNSServiceErr_BadState;
+
+        gNativeContextField = (*pEnv)->GetFieldID( pEnv, serviceCls, "fNativeContext", "J");
+        gOperationFailed = (*pEnv)->GetMethodID( pEnv, listenerCls, "operationFailed",
+                                                 "(Lcom/apple/dnssd/DNSSDService;I)V");
+        gTXTRecordClass = (*pEnv)->NewGlobalRef( pEnv, txtCls);
+        gTXTRecordCtor = (*pEnv)->GetMethodID( pEnv, txtCls, "<init>", "([B)V");
+        gBatchBrowseListenerClass = (*pEnv)->NewGlobalRef( pEnv, batchCls);
+        gDeliverBatch = (*pEnv)->GetMethodID( pEnv, browserCls, "deliverBatch", "(Ljava/nio/ByteBuffer;II)V");
+
+        if ( gNativeContextField == 0 || gOperationFailed == 0 || gTXTRecordClass == NULL || gTXTRecordCtor == 0 ||
+             gBatchBrowseListenerClass == NULL || gDeliverBatch == 0)
+            return kDNSServiceErr_BadState;
+
+        (*pEnv)->DeleteLocalRef( pEnv, serviceCls);
+        (*pEnv)->DeleteLocalRef( pEnv, listenerCls);
+        (*pEnv)->DeleteLocalRef( pEnv, txtCls);
+        (*pEnv)->DeleteLocalRef( pEnv, batchCls);
+        (*pEnv)->DeleteLocalRef( pEnv, browserCls);
+    }
+
     return kDNSServiceErr_NoError;
 }
 
@@ -184,27 +238,55 @@ static OpContext    *NewContext( JNIEnv *pEnv, jobject owner,
                                                    (*pEnv)->GetObjectClass( pEnv, pContext->ClientObj),
                                                    callbackName, callbackSig);
         pContext->Callback2 = NULL;     // not always used
+        pContext->LastRegType = NULL;
+        pContext->RegTypeObj = NULL;
+        pContext->LastDomain = NULL;
+        pContext->DomainObj = NULL;
+        pContext->BatchMem = NULL;
+        pContext->BatchBuf = NULL;
+        pContext->BatchLen = 0;
+        pContext->BatchCount = 0;
     }
 
     return pContext;
 }
 
 
+static jstring      CachedString( JNIEnv *pEnv, char **pLast, jstring *pObj, const char *str)
+// Return a String for str, reusing the previous one if str is unchanged. The String is a global ref owned
+// by the OpContext; callers must not delete it.
+{
+    if ( *pObj == NULL || strcmp( *pLast, str) != 0)
+    {
+        jstring local = (*pEnv)->NewStringUTF( pEnv, str);
+        char *copy = strdup( str);
+
+        if ( local == NULL || copy == NULL)
+        {
+            free( copy);
+            return local;   // Still hand back what we could make, uncached
+        }
+        if ( *pObj != NULL)
+            (*pEnv)->DeleteGlobalRef( pEnv, *pObj);
+        free( *pLast);
+        *pObj = (*pEnv)->NewGlobalRef( pEnv, local);
+        *pLast = copy;
+        (*pEnv)->DeleteLocalRef( pEnv, local);
+    }
+    return *pObj;
+}
+
+
 static void         ReportError( JNIEnv *pEnv, jobject target, jobject service, DNSServiceErrorType err)
 // Invoke operationFailed() method on target with err.
 {
-    jclass cls = (*pEnv)->GetObjectClass( pEnv, target);
-    jmethodID opFailed = (*pEnv)->GetMethodID( pEnv, cls, "operationFailed",
-                                               "(Lcom/apple/dnssd/DNSSDService;I)V");
-
-    (*pEnv)->CallVoidMethod( pEnv, target, opFailed, service, err);
+    (*pEnv)->CallVoidMethod( pEnv, target, gOperationFailed, service, err);
 }
 
 JNIEXPORT void JNICALL Java_com_apple_dnssd_AppleService_HaltOperation( JNIEnv *pEnv, jobject pThis)
 /* Deallocate the dns_sd service browser and set the Java object's fNativeContext field to 0. */
 {
-    jclass cls = (*pEnv)->GetObjectClass( pEnv, pThis);
-    jfieldID contextField = (*pEnv)->GetFieldID( pEnv, cls, "fNativeContext", "J");
+    jfieldID contextField = gNativeContextField;
 
     if ( contextField != 0)
     {
@@ -218,6 +300,15 @@ JNIEXPORT void JNICALL Java_com_apple_dnssd_AppleService_HaltOperation( JNIEnv *
 
             (*pEnv)->DeleteWeakGlobalRef( pEnv, pContext->JavaObj);
             (*pEnv)->DeleteWeakGlobalRef( pEnv, pContext->ClientObj);
+            if ( pContext->RegTypeObj != NULL)
+                (*pEnv)->DeleteGlobalRef( pEnv, pContext->RegTypeObj);
+            if ( pContext->DomainObj != NULL)
+                (*pEnv)->DeleteGlobalRef( pEnv, pContext->DomainObj);
+            if ( pContext->BatchBuf != NULL)
+                (*pEnv)->DeleteGlobalRef( pEnv, pContext->BatchBuf);
+            free( pContext->LastRegType);
+            free( pContext->LastDomain);
+            free( pContext->BatchMem);
             free( pContext);
         }
     }
@@ -229,8 +320,7 @@ JNIEXPORT jint JNICALL Java_com_apple_dnssd_AppleService_BlockForData( JNIEnv *p
 {
 // BlockForData() not supported with AUTO_CALLBACKS
 #if !AUTO_CALLBACKS
-    jclass cls = (*pEnv)->GetObjectClass( pEnv, pThis);
-    jfieldID contextField = (*pEnv)->GetFieldID( pEnv, cls, "fNativeContext", "J");
+    jfieldID contextField = gNativeContextField;
 
     if ( contextField != 0)
     {
@@ -273,9 +363,7 @@ JNIEXPORT jint JNICALL Java_com_apple_dnssd_AppleService_ProcessResults( JNIEnv
 {
 #if !AUTO_CALLBACKS // ProcessResults() not supported with AUTO_CALLBACKS
 
-    jclass cls = (*pEnv)->GetObjectClass( pEnv, pThis);
-    jfieldID contextField = (*pEnv)->GetFieldID( pEnv, cls, "fNativeContext", "J");
-    OpContext       *pContext = (OpContext*) (long) (*pEnv)->GetLongField(pEnv, pThis, contextField);
+    OpContext       *pContext = (OpContext*) (long) (*pEnv)->GetLongField(pEnv, pThis, gNativeContextField);
     DNSServiceErrorType err = kDNSServiceErr_BadState;
 
     if ( pContext != NULL)
@@ -292,6 +380,8 @@ JNIEXPORT jint JNICALL Java_com_apple_dnssd_AppleService_ProcessResults( JNIEnv
         err = kDNSServiceErr_NoError;
         if (0 < select(sd + 1, &readFDs, (fd_set*) NULL, (fd_set*) NULL, &zeroTimeout))
         {
+            // The client library dispatches every reply it has buffered, so this is one crossing for the
+            // whole lot; a BatchBrowseListener then gets them in as few upcalls as the buffer allows.
             err = DNSServiceProcessResult(pContext->ServiceRef);
             // Use caution here!
             // We cannot touch any data structures associated with this operation!
@@ -308,6 +398,53 @@ JNIEXPORT jint JNICALL Java_com_apple_dnssd_AppleService_ProcessResults( JNIEnv
 }
 
 
+static unsigned char *  PutBatchInt( unsigned char *ptr, uint32_t val)
+{
+    *ptr++ = (unsigned char) (val >> 24);
+    *ptr++ = (unsigned char) (val >> 16);
+    *ptr++ = (unsigned char) (val >>  8);
+    *ptr++ = (unsigned char) val;
+    return ptr;
+}
+
+static unsigned char *  PutBatchString( unsigned char *ptr, const char *str)
+{
+    size_t len = strlen( str);
+
+    if ( len > kDNSServiceMaxDomainName)
+        len = kDNSServiceMaxDomainName;
+    *ptr++ = (unsigned char) (len >> 8);
+    *ptr++ = (unsigned char) len;
+    memcpy( ptr, str, len);
+    return ptr + len;
+}
+
+static void         AddBatchBrowseResult( OpContext *pContext, DNSServiceFlags flags, uint32_t interfaceIndex,
+                                          const char *serviceName, const char *regtype, const char *replyDomain)
+// Append one result to the batch, and hand the batch over if it's complete or full.
+// The listener may stop the operation, and so free pContext, in the upcall; don't touch it afterwards.
+{
+    unsigned char *ptr = pContext->BatchMem + pContext->BatchLen;
+
+    ptr = PutBatchInt( ptr, flags);
+    ptr = PutBatchInt( ptr, interfaceIndex);
+    ptr = PutBatchString( ptr, serviceName);
+    ptr = PutBatchString( ptr, regtype);
+    ptr = PutBatchString( ptr, replyDomain);
+    pContext->BatchLen = (int) (ptr - pContext->BatchMem);
+    pContext->BatchCount++;
+
+    if ( ( flags & kDNSServiceFlagsMoreComing) == 0 || pContext->BatchLen + kBatchBrowseMaxResult > kBatchBrowseBufferSize)
+    {
+        int count = pContext->BatchCount;
+        int len = pContext->BatchLen;
+
+        pContext->BatchLen = 0;
+        pContext->BatchCount = 0;
+        (*pContext->Env)->CallVoidMethod( pContext->Env, pContext->JavaObj, gDeliverBatch, pContext->BatchBuf, count, len);
+    }
+}
+
 static void DNSSD_API   ServiceBrowseReply( DNSServiceRef sdRef _UNUSED, DNSServiceFlags flags, uint32_t interfaceIndex,
                                             DNSServiceErrorType errorCode, const char *serviceName, const char *regtype,
                                             const char *replyDomain, void *context)
@@ -318,17 +455,27 @@ static void DNSSD_API   ServiceBrowseReply( DNSServiceRef sdRef _UNUSED, DNSServ
 
     if ( pContext->ClientObj != NULL && pContext->Callback != NULL)
     {
-        if ( errorCode == kDNSServiceErr_NoError)
+        if ( errorCode == kDNSServiceErr_NoError && pContext->BatchMem != NULL)
+            AddBatchBrowseResult( pContext, flags, interfaceIndex, serviceName, regtype, replyDomain);
+        else if ( errorCode == kDNSServiceErr_NoError)
         {
-            (*pContext->Env)->CallVoidMethod( pContext->Env, pContext->ClientObj,
-                                              ( flags & kDNSServiceFlagsAdd) != 0 ? pContext->Callback : pContext->Callback2,
-                                              pContext->JavaObj, flags, interfaceIndex,
-                                              (*pContext->Env)->NewStringUTF( pContext->Env, serviceName),
-                                              (*pContext->Env)->NewStringUTF( pContext->Env, regtype),
-                                              (*pContext->Env)->NewStringUTF( pContext->Env, replyDomain));
+            JNIEnv *pEnv = pContext->Env;
+            jstring nameObj = (*pEnv)->NewStringUTF( pEnv, serviceName);
+            jstring typeObj = CachedString( pEnv, &pContext->LastRegType, &pContext->RegTypeObj, regtype);
+            jstring domainObj = CachedString( pEnv, &pContext->LastDomain, &pContext->DomainObj, replyDomain);
+
+            // A single ProcessResults() can dispatch many results, so drop each local ref once its upcall is done
+            (*pEnv)->CallVoidMethod( pEnv, pContext->ClientObj,
+                                     ( flags & kDNSServiceFlagsAdd) != 0 ? pContext->Callback : pContext->Callback2,
+                                     pContext->JavaObj, flags, interfaceIndex, nameObj, typeObj, domainObj);
+            (*pEnv)->DeleteLocalRef( pEnv, nameObj);
         }
         else
+        {
+            pContext->BatchLen = 0;     // Whatever had been gathered is moot now
+            pContext->BatchCount = 0;
             ReportError( pContext->Env, pContext->ClientObj, pContext->JavaObj, errorCode);
+        }
     }
 
     TeardownCallbackState();
@@ -357,6 +504,24 @@ JNIEXPORT jint JNICALL Java_com_apple_dnssd_AppleBrowser_CreateBrowser( JNIEnv *
                                                     (*pEnv)->GetObjectClass( pEnv, pContext->ClientObj),
                                                     "serviceLost", "(Lcom/apple/dnssd/DNSSDService;IILjava/lang/String;Ljava/lang/String;Ljava/lang/String;)V");
 
+        if ( (*pEnv)->IsInstanceOf( pEnv, pContext->ClientObj, gBatchBrowseListenerClass))
+        {
+            jobject buf;
+
+            pContext->BatchMem = (unsigned char*) malloc( kBatchBrowseBufferSize);
+            buf = pContext->BatchMem != NULL ? (*pEnv)->NewDirectByteBuffer( pEnv, pContext->BatchMem, kBatchBrowseBufferSize) : NULL;
+            if ( buf != NULL)
+            {
+                pContext->BatchBuf = (*pEnv)->NewGlobalRef( pEnv, buf);
+                (*pEnv)->DeleteLocalRef( pEnv, buf);
+            }
+            else
+            {
+                free( pContext->BatchMem);     // No direct buffers in this VM; fall back to one call per result
+                pContext->BatchMem = NULL;
+            }
+        }
+
         err = DNSServiceBrowse( &pContext->ServiceRef, flags, ifIndex, regStr, domainStr, ServiceBrowseReply, pContext);
         if ( err == kDNSServiceErr_NoError)
         {
@@ -378,18 +543,12 @@ static void DNSSD_API   ServiceResolveReply( DNSServiceRef sdRef _UNUSED, DNSSer
                                              uint16_t port, uint16_t txtLen, const unsigned char *txtRecord, void *context)
 {
     OpContext       *pContext = (OpContext*) context;
-    jclass txtCls;
-    jmethodID txtCtor;
     jbyteArray txtBytes;
     jobject txtObj;
-    jbyte           *pBytes;
 
     SetupCallbackState( &pContext->Env);
 
-    txtCls = (*pContext->Env)->FindClass( pContext->Env, "com/apple/dnssd/TXTRecord");
-    txtCtor = (*pContext->Env)->GetMethodID( pContext->Env, txtCls, "<init>", "([B)V");
-
-    if ( pContext->ClientObj != NULL && pContext->Callback != NULL && txtCtor != NULL &&
+    if ( pContext->ClientObj != NULL && pContext->Callback != NULL &&
          NULL != ( txtBytes = (*pContext->Env)->NewByteArray( pContext->Env, txtLen)))
     {
         if ( errorCode == kDNSServiceErr_NoError)
@@ -399,12 +558,10 @@ static void DNSSD_API   ServiceResolveReply( DNSServiceRef sdRef _UNUSED, DNSSer
             port = ( ((unsigned char*) &port)[0] << 8) | ((unsigned char*) &port)[1];
 
             // Initialize txtBytes with contents of txtRecord
-            pBytes = (*pContext->Env)->GetByteArrayElements( pContext->Env, txtBytes, NULL);
-            memcpy( pBytes, txtRecord, txtLen);
-            (*pContext->Env)->ReleaseByteArrayElements( pContext->Env, txtBytes, pBytes, JNI_COMMIT);
+            (*pContext->Env)->SetByteArrayRegion( pContext->Env, txtBytes, 0, txtLen, (const jbyte*) txtRecord);
 
             // Construct txtObj with txtBytes
-            txtObj = (*pContext->Env)->NewObject( pContext->Env, txtCls, txtCtor, txtBytes);
+            txtObj = (*pContext->Env)->NewObject( pContext->Env, gTXTRecordClass, gTXTRecordCtor, txtBytes);
             (*pContext->Env)->DeleteLocalRef( pContext->Env, txtBytes);
 
             (*pContext->Env)->CallVoidMethod( pContext->Env, pContext->ClientObj, pContext->Callback,
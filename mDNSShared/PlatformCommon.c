@@ -35,6 +35,10 @@
 #include <os/log.h>
 #endif 
 
+#if MDNS_MALLOC_PROFILING
+#include <pthread.h>
+#endif
+
 #include "mDNSEmbeddedAPI.h"    // Defines the interface provided to the client layer above
 #include "DNSCommon.h"
 #include "PlatformCommon.h"
@@ -161,6 +165,100 @@ mDNSexport void freeL(const char *msg, void *x)
     }
 }
 
+#elif MDNS_MALLOC_PROFILING
+
+// Each block carries a four-word header (keeping the caller's data as aligned as malloc's) holding a magic number,
+// the index of its tag's slot and its size, so freeL can charge it back to the tag it was allocated under.
+// Tags are hashed on their text rather than their address, so the same name used in two files is one tag.
+// The table is shared by every thread that allocates, so it has a mutex of its own.
+
+#define kProfileMagic     0xC0FFEE42
+#define kProfileFreeMagic 0xDEADDEAD
+#define kProfileHeader    4
+
+static mDNSMallocProfileEntry gMallocProfile[MDNS_MALLOC_PROFILE_TAGS];
+static pthread_mutex_t gMallocProfileLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Called with gMallocProfileLock held. The last slot is kept for "(other tags)" once the table fills.
+mDNSlocal mDNSu32 MallocProfileSlot(const char *tag)
+{
+    const mDNSu32 slots = MDNS_MALLOC_PROFILE_TAGS - 1;
+    mDNSu32 hash = 2166136261U, i, probes;
+    const char *p;
+
+    if (!tag) tag = "(untagged)";
+    for (p = tag; *p; p++) hash = (hash ^ (mDNSu8)*p) * 16777619U;
+    for (i = hash % slots, probes = 0; probes < slots; i = (i + 1) % slots, probes++)
+    {
+        if (!gMallocProfile[i].tag) { gMallocProfile[i].tag = tag; return(i); }
+        if (gMallocProfile[i].tag == tag || !strcmp(gMallocProfile[i].tag, tag)) return(i);
+    }
+    gMallocProfile[slots].tag = "(other tags)";
+    return(slots);
+}
+
+mDNSlocal void *MallocProfileCharge(mDNSu32 *mem, const char *msg, mDNSu32 size)
+{
+    mDNSMallocProfileEntry *e;
+    pthread_mutex_lock(&gMallocProfileLock);
+    mem[0] = kProfileMagic;
+    mem[1] = MallocProfileSlot(msg);
+    mem[2] = size;
+    e = &gMallocProfile[mem[1]];
+    e->blocks++;
+    e->bytes += size;
+    e->allocations++;
+    if (e->peakBytes < e->bytes) e->peakBytes = e->bytes;
+    pthread_mutex_unlock(&gMallocProfileLock);
+    return(&mem[kProfileHeader]);
+}
+
+mDNSexport void *mallocL(const char *msg, mDNSu32 size)
+{
+    mDNSu32 *mem = (mDNSu32 *)malloc(sizeof(mDNSu32) * kProfileHeader + size);
+    if (!mem) { LogMsg("malloc( %s : %u ) failed", msg, size); return(NULL); }
+    return(MallocProfileCharge(mem, msg, size));
+}
+
+mDNSexport void *callocL(const char *msg, mDNSu32 size)
+{
+    mDNSu32 *mem = (mDNSu32 *)calloc(1, sizeof(mDNSu32) * kProfileHeader + size);
+    if (!mem) { LogMsg("calloc( %s : %u ) failed", msg, size); return(NULL); }
+    return(MallocProfileCharge(mem, msg, size));
+}
+
+mDNSexport void freeL(const char *msg, void *x)
+{
+    mDNSu32 *mem;
+    mDNSMallocProfileEntry *e;
+
+    if (!x) return;
+    mem = ((mDNSu32 *)x) - kProfileHeader;
+    if (mem[0] != kProfileMagic || mem[1] >= MDNS_MALLOC_PROFILE_TAGS)
+    {
+        // Not one of ours (or already freed): leak it rather than hand free() a pointer it didn't give out
+        LogMsg("free( %s @ %p ) !!!! %s !!!!", msg, x, mem[0] == kProfileFreeMagic ? "ALREADY DISPOSED" : "NEVER ALLOCATED");
+        return;
+    }
+    pthread_mutex_lock(&gMallocProfileLock);
+    e = &gMallocProfile[mem[1]];
+    e->blocks--;
+    e->bytes -= mem[2];
+    pthread_mutex_unlock(&gMallocProfileLock);
+    mem[0] = kProfileFreeMagic;
+    free(mem);
+}
+
+mDNSexport mDNSu32 mDNSMallocProfileCopy(mDNSMallocProfileEntry *entries, mDNSu32 max)
+{
+    mDNSu32 i, n = 0;
+    pthread_mutex_lock(&gMallocProfileLock);
+    for (i = 0; i < MDNS_MALLOC_PROFILE_TAGS && n < max; i++)
+        if (gMallocProfile[i].tag) entries[n++] = gMallocProfile[i];
+    pthread_mutex_unlock(&gMallocProfileLock);
+    return(n);
+}
+
 #endif
 
 // Bind a UDP socket to find the source address to a destination
@@ -222,6 +222,34 @@ enum
      * (i.e. the default name is not used.)
      */
 
+    kDNSServiceFlagsCoalesceBrowse      = 0x8,
+    /* Flag for DNSServiceBrowse only (it shares its value with NoAutoRename, which is for registration).
+     * Results are held back for a short window (about 50ms) after the first one arrives and then
+     * delivered together, with kDNSServiceFlagsMoreComing set on all but the last. A remove and an add
+     * (or an add and a remove) of the same instance within the window cancel out, so an instance that's
+     * briefly lost and found again, as when a device sleeps and wakes, produces no callbacks at all.
+     * Intended for clients browsing many busy service types, at the cost of that much added latency.
+     */
+
+    kDNSServiceFlagsHappyEyeballs       = 0x8,
+    /* Flag for DNSServiceGetAddrInfo only (it too shares its value with NoAutoRename). When both IPv4 and IPv6
+     * addresses are asked for, the first results are held back until the AAAA query has been answered, either way,
+     * or for at most 50ms after the first A answer if it hasn't (the Resolution Delay of RFC 8305), and then
+     * delivered together, with kDNSServiceFlagsMoreComing set on all but the last. They come in the order they
+     * should be tried: sorted by the destination address rules of RFC 6724 that don't depend on the source address
+     * (precedence, then scope), with the two families interleaved starting with the preferred one (RFC 8305
+     * section 4). Results after those are delivered as they arrive.
+     */
+
+    kDNSServiceFlagsWireFormat          = 0x8,
+    /* Flag for DNSServiceQueryRecord only (it also shares its value with NoAutoRename). The fullname passed to the
+     * callback is the record's name in uncompressed DNS wire format (length-prefixed labels ending with a zero
+     * byte, at most kDNSServiceMaxDomainName bytes in all) rather than an escaped, dot-separated C string, and
+     * the flag is set in the callback's flags. The rdata is in wire format either way, with any names in it
+     * uncompressed. This spares the daemon converting names to text, and callers that build DNS messages from
+     * the results parsing them back.
+     */
+
     kDNSServiceFlagsShared              = 0x10,
     kDNSServiceFlagsUnique              = 0x20,
     /* Flag for registering individual records on a connected
@@ -383,6 +411,15 @@ enum
      * and zero length rdata will be returned for DNSServiceQueryRecord.
      */
 
+    kDNSServiceFlagsBrowseSnapshot     = 0x10000,
+    /* Flag for DNSServiceBrowse only (it shares its value with kDNSServiceFlagsTimeout, which is for queries).
+     * Lists what's there right now rather than following changes: instances already in the cache are delivered
+     * straight away, a single query is sent (listing them all as known answers), and answers are collected for a
+     * short window (about two seconds). Then the browse stops, and the callback is called one last time with
+     * kDNSServiceFlagsBrowseSnapshot set in flags, kDNSServiceErr_NoError and empty names, to mark the end of the
+     * snapshot. No further results are delivered; DNSServiceRefDeallocate() must still be called as usual.
+     */
+
     kDNSServiceFlagsIncludeP2P          = 0x20000,
     /*
      * Include P2P interfaces when kDNSServiceInterfaceIndexAny is specified.
@@ -907,7 +944,8 @@ typedef int32_t DNSServiceErrorType;
 /* DNSServiceGetProperty() Parameters:
  *
  * property:        The requested property.
- *                  Currently the only property defined is kDNSServiceProperty_DaemonVersion.
+ *                  Currently defined properties are kDNSServiceProperty_DaemonVersion,
+ *                  kDNSServiceProperty_Statistics, kDNSServiceProperty_TopTalkers and kDNSServiceProperty_Traffic.
  *
  * result:          Place to store result.
  *                  For retrieving DaemonVersion, this should be the address of a uint32_t.
@@ -950,6 +988,98 @@ DNSServiceErrorType DNSSD_API DNSServiceGetProperty
 
 #define kDNSServiceProperty_DaemonVersion "DaemonVersion"
 
+/*
+ * When requesting kDNSServiceProperty_Statistics, the result pointer must point to an array
+ * of 32-bit unsigned integers, and the size parameter must be set to the size of that array
+ * in bytes. The daemon's counters are cheap to read, so this may be polled every few seconds.
+ *
+ * On return the array contains, in local process byte order:
+ *   [0]                    kDNSServiceStatistics_Version
+ *   [1]                    N, the number of counters that follow (indexed by kDNSServiceStatistic_*)
+ *   [2 ... N+1]            the counters
+ *   [N+2]                  K, the number of interfaces that follow
+ *   [N+3 ... N+2+3K]       per interface: interface index, packets received, packets sent
+ *
+ * Counters are cumulative since the daemon started (except CacheSize and CacheUsed) and wrap at 2^32.
+ * Newer daemons may append counters, so use N rather than kDNSServiceStatistic_Count to find the
+ * interface list. If the array is too small the result is truncated; the returned size is always
+ * the full size the daemon had to send.
+ */
+
+#define kDNSServiceProperty_Statistics "Statistics"
+#define kDNSServiceStatistics_Version 1
+
+enum
+{
+    kDNSServiceStatistic_CacheSize                = 0,  /* Cache entries available */
+    kDNSServiceStatistic_CacheUsed                = 1,  /* Cache entries in use */
+    kDNSServiceStatistic_CacheHits                = 2,  /* Cached answers delivered to new questions */
+    kDNSServiceStatistic_CacheMisses              = 3,  /* New questions the cache had no answer for */
+    kDNSServiceStatistic_CacheEvictions           = 4,  /* Cache records evicted to make room for new ones */
+    kDNSServiceStatistic_KnownAnswerSuppressions  = 5,  /* Responses suppressed by known answers */
+    kDNSServiceStatistic_DuplicateQuestions       = 6,  /* New questions that duplicated an existing one */
+    kDNSServiceStatistic_DupQuerySuppressions     = 7,  /* Queries suppressed because another host asked them */
+    kDNSServiceStatistic_PacketsReceived          = 8,  /* DNS packets received */
+    kDNSServiceStatistic_MulticastPacketsReceived = 9,  /* Multicast DNS packets received */
+    kDNSServiceStatistic_ExecuteRuns              = 10, /* Rounds of scheduled work (sending, cache expiry) */
+    kDNSServiceStatistic_ExecuteMilliseconds      = 11, /* Total time spent on scheduled work */
+    kDNSServiceStatistic_ExecuteMaxMilliseconds   = 12, /* Longest single round of scheduled work */
+    kDNSServiceStatistic_ReceiveRuns              = 13, /* Rounds of received packet processing */
+    kDNSServiceStatistic_ReceiveMilliseconds      = 14, /* Total time spent processing received packets */
+    kDNSServiceStatistic_ReceiveMaxMilliseconds   = 15, /* Longest single round of packet processing */
+    kDNSServiceStatistic_QueryFloodSourceDrops    = 16, /* Queries dropped because their sender was sending too many */
+    kDNSServiceStatistic_QueryFloodInterfaceDrops = 17, /* Queries dropped because their interface was getting too many */
+    kDNSServiceStatistic_QueryFloodThrottles      = 18, /* Times a sender or interface went over its query rate limit */
+    kDNSServiceStatistic_Count                    = 19
+};
+
+/*
+ * When requesting kDNSServiceProperty_TopTalkers, the result pointer must point to a char buffer
+ * (kDNSServiceTopTalkers_MaxSize bytes is always enough), and the size parameter must be set to its size.
+ * On return the buffer holds NUL-terminated text describing who is sending the multicast DNS traffic
+ * the daemon receives, one line each, with fields separated by single spaces:
+ *
+ *   interval <seconds> decays <n>      All counts are halved every <seconds>, and have been <n> times
+ *   types <total>                      Question and answer names counted, by service type:
+ *   type <type> <count> <error> <queries> <responses>
+ *   sources <total>                    Packets counted, by source address:
+ *   source <address> <count> <error> <queries> <responses> <bytes>
+ *
+ * Service types look like "_ipp._tcp"; "(other)" covers names that aren't part of a service (host
+ * names, reverse lookups). The heaviest entries come first. The daemon keeps only a bounded number
+ * of entries per table, so <count> is an estimate that may be up to <error> too high, while the
+ * per-entry <queries>, <responses> and <bytes> are exact since the entry was last taken over.
+ * If the buffer is too small the text is truncated (and not NUL-terminated); the returned size is
+ * always the full size of the text, including the NUL.
+ */
+
+#define kDNSServiceProperty_TopTalkers "TopTalkers"
+#define kDNSServiceTopTalkers_MaxSize 8704
+
+/*
+ * When requesting kDNSServiceProperty_Traffic, the result pointer must point to a char buffer
+ * (kDNSServiceTraffic_MaxSize bytes is always enough), and the size parameter must be set to its size.
+ * On return the buffer holds NUL-terminated text describing the DNS traffic the daemon has sent and
+ * received since each interface came up, and which client operations caused what it sent, one line
+ * each, with fields separated by single spaces:
+ *
+ *   interfaces <n>                     Then two lines per interface, "in" and "out":
+ *   interface <index> in|out <query packets> <query bytes> <response packets> <response bytes> <probe packets> <probe bytes> <name>
+ *   requests <total>                   Client operations that have sent anything, busiest first:
+ *   request <pid> <request id> <operation> <queries> <responses> <probes> <process name>
+ *
+ * Bytes are whole DNS messages, without IP or UDP headers. A probe is a query carrying the records
+ * it proposes to claim. For a request, <queries> is the number of times its questions were put in a
+ * query, and <responses> and <probes> the number of times its records were put in a response or a
+ * probe; a packet often carries several requests' questions or records, so these don't add up to the
+ * interface packet counts. <operation> is the API call, e.g. "Browse" or "Register". At most 64
+ * requests are listed. If the buffer is too small the text is truncated (and not NUL-terminated);
+ * the returned size is always the full size of the text, including the NUL.
+ */
+
+#define kDNSServiceProperty_Traffic "Traffic"
+#define kDNSServiceTraffic_MaxSize 24832
+
 /*********************************************************************************************
 *
 * Unix Domain Socket access, DNSServiceRef deallocation, and data processing functions
@@ -1316,6 +1446,59 @@ DNSServiceErrorType DNSSD_API DNSServiceRegister
 );
 
 
+/* DNSServiceRegisterBatch()
+ *
+ * Register many services with a single request to the daemon. Each entry is registered exactly as if
+ * DNSServiceRegister() had been called for it with kDNSServiceFlagsShareConnection on sdRef, but
+ * the whole batch costs one round trip to the daemon instead of one per service, and the services
+ * are probed and announced together, sharing packets where they fit.
+ *
+ * Parameters:
+ *
+ * sdRef:           A DNSServiceRef initialized by DNSServiceCreateConnection().
+ *
+ * sdRefs:          An array of count uninitialized DNSServiceRefs. On success, each is set to a
+ *                  subordinate DNSServiceRef for the corresponding entry, which may be passed to
+ *                  DNSServiceAddRecord() etc. and is disposed of with DNSServiceRefDeallocate(),
+ *                  as for DNSServiceRegister(). On error, every element is set to NULL.
+ *
+ * count:           The number of entries in sdRefs and entries.
+ *
+ * entries:         An array of count DNSServiceRegisterBatchEntry structures, whose fields have the
+ *                  same meaning as the corresponding DNSServiceRegister() parameters.
+ *
+ * return value:    Returns kDNSServiceErr_NoError if the batch was accepted. A service in the batch
+ *                  that the daemon cannot register reports its error through its callback, as with an
+ *                  asynchronous DNSServiceRegister() failure. Otherwise returns an error code indicating
+ *                  the error that occurred, in which case none of the services were registered and no
+ *                  callbacks are invoked.
+ */
+
+typedef struct
+{
+    DNSServiceFlags flags;
+    uint32_t interfaceIndex;
+    const char                          *name;         /* may be NULL */
+    const char                          *regtype;
+    const char                          *domain;       /* may be NULL */
+    const char                          *host;         /* may be NULL */
+    uint16_t port;                                     /* In network byte order */
+    uint16_t txtLen;
+    const void                          *txtRecord;    /* may be NULL */
+    DNSServiceRegisterReply callBack;                  /* may be NULL */
+    void                                *context;      /* may be NULL */
+} DNSServiceRegisterBatchEntry;
+
+DNSSD_EXPORT
+DNSServiceErrorType DNSSD_API DNSServiceRegisterBatch
+(
+    DNSServiceRef sdRef,
+    DNSServiceRef                       *sdRefs,
+    uint32_t count,
+    const DNSServiceRegisterBatchEntry  *entries
+);
+
+
 /* DNSServiceAddRecord()
  *
  * Add a record to a registered service. The name of the record will be the same as the
@@ -1712,7 +1895,8 @@ DNSServiceErrorType DNSSD_API DNSServiceResolve
  *                  indicate the failure that occurred. Other parameters are undefined if
  *                  errorCode is nonzero.
  *
- * fullname:        The resource record's full domain name.
+ * fullname:        The resource record's full domain name. With kDNSServiceFlagsWireFormat, this is
+ *                  the name in uncompressed wire format, not a C string.
  *
  * rrtype:          The resource record's type (e.g. kDNSServiceType_PTR, kDNSServiceType_SRV, etc)
  *
@@ -1810,6 +1994,54 @@ DNSServiceErrorType DNSSD_API DNSServiceQueryRecord
 );
 
 
+/* DNSServiceQueryRecordBatch()
+ *
+ * Start many record queries with a single request to the daemon. Each entry is started exactly as if
+ * DNSServiceQueryRecord() had been called for it with kDNSServiceFlagsShareConnection on sdRef, and its
+ * results are delivered to its callback on sdRef's socket, but the whole batch costs one round trip to
+ * the daemon instead of one per query. For example, a client that needs the SRV, TXT and address records
+ * of several services can ask for them all at once.
+ *
+ * Parameters:
+ *
+ * sdRef:           A DNSServiceRef initialized by DNSServiceCreateConnection().
+ *
+ * sdRefs:          An array of count uninitialized DNSServiceRefs. On success, each is set to a
+ *                  subordinate DNSServiceRef for the corresponding entry; pass it to
+ *                  DNSServiceRefDeallocate() to stop that query. On error, every element is set to NULL.
+ *
+ * count:           The number of entries in sdRefs and entries.
+ *
+ * entries:         An array of count DNSServiceQueryRecordBatchEntry structures, whose fields have the
+ *                  same meaning as the corresponding DNSServiceQueryRecord() parameters.
+ *
+ * return value:    Returns kDNSServiceErr_NoError if the batch was accepted. A query in the batch that
+ *                  the daemon cannot start reports its error through its callback. Otherwise returns an
+ *                  error code indicating the error that occurred, in which case none of the queries were
+ *                  started and no callbacks are invoked.
+ */
+
+typedef struct
+{
+    DNSServiceFlags flags;
+    uint32_t interfaceIndex;
+    const char                          *fullname;
+    uint16_t rrtype;
+    uint16_t rrclass;
+    DNSServiceQueryRecordReply callBack;
+    void                                *context;  /* may be NULL */
+} DNSServiceQueryRecordBatchEntry;
+
+DNSSD_EXPORT
+DNSServiceErrorType DNSSD_API DNSServiceQueryRecordBatch
+(
+    DNSServiceRef sdRef,
+    DNSServiceRef                          *sdRefs,
+    uint32_t count,
+    const DNSServiceQueryRecordBatchEntry  *entries
+);
+
+
 /*********************************************************************************************
 *
 *  Unified lookup of both IPv4 and IPv6 addresses for a fully qualified hostname
@@ -2045,6 +2277,62 @@ DNSServiceErrorType DNSSD_API DNSServiceRegisterRecord
 );
 
 
+/* DNSServiceRegisterRecordBatch()
+ *
+ * Register many records on a shared connection with a single request to the daemon. Each entry is
+ * registered exactly as if DNSServiceRegisterRecord() had been called for it on sdRef, but the whole
+ * batch costs one round trip to the daemon instead of one per record, the records are registered
+ * together, and the records of each name are probed and announced together.
+ *
+ * Parameters:
+ *
+ * sdRef:           A DNSServiceRef initialized by DNSServiceCreateConnection().
+ *
+ * RecordRefs:      An array of count DNSRecordRefs. Each one whose entry was registered is set to a
+ *                  DNSRecordRef for it, which may be passed to DNSServiceUpdateRecord() or
+ *                  DNSServiceRemoveRecord(), as for DNSServiceRegisterRecord(). Each one whose entry
+ *                  was not registered, and on error every element, is set to NULL.
+ *
+ * count:           The number of entries in RecordRefs, entries and errors.
+ *
+ * entries:         An array of count DNSServiceRegisterRecordBatchEntry structures, whose fields have the
+ *                  same meaning as the corresponding DNSServiceRegisterRecord() parameters.
+ *
+ * errors:          An array of count error codes, or NULL. If the batch was accepted, each is set to the
+ *                  error DNSServiceRegisterRecord() would have returned for the corresponding entry.
+ *
+ * return value:    Returns kDNSServiceErr_NoError if the batch was accepted. An entry that could be
+ *                  registered reports its later, asynchronous results through its callback; one that
+ *                  could not has its error in errors and its callback is never invoked. Otherwise returns
+ *                  an error code indicating the error that occurred, in which case none of the records
+ *                  were registered and no callbacks are invoked.
+ */
+
+typedef struct
+{
+    DNSServiceFlags flags;
+    uint32_t interfaceIndex;
+    const char                          *fullname;
+    uint16_t rrtype;
+    uint16_t rrclass;
+    uint16_t rdlen;
+    const void                          *rdata;
+    uint32_t ttl;
+    DNSServiceRegisterRecordReply callBack;
+    void                                *context;  /* may be NULL */
+} DNSServiceRegisterRecordBatchEntry;
+
+DNSSD_EXPORT
+DNSServiceErrorType DNSSD_API DNSServiceRegisterRecordBatch
+(
+    DNSServiceRef sdRef,
+    DNSRecordRef                              *RecordRefs,
+    uint32_t count,
+    const DNSServiceRegisterRecordBatchEntry  *entries,
+    DNSServiceErrorType                       *errors     /* may be NULL */
+);
+
+
 /* DNSServiceReconfirmRecord
  *
  * Instruct the daemon to verify the validity of a resource record that appears
@@ -70,6 +70,8 @@ mDNSexport const char ProgramName[] = "dnsextd";
 #endif
 #define RECV_BUFLEN                 9000
 #define LEASETABLE_INIT_NBUCKETS    256                 // initial hashtable size (doubles as table fills)
+#define LEASETABLE_REHASH_STEP      4                   // old buckets moved per update while the table is growing
+#define REQUEST_WORKER_THREADS      16                  // threads relaying queries and updates to the nameserver
 #define EXPIRATION_INTERVAL         300                 // check for expired records every 5 minutes
 #define SRV_TTL                     7200                // TTL For _dns-update SRV records
 #define CONFIG_FILE                 "/etc/dnsextd.conf"
@@ -115,11 +117,21 @@ typedef struct
     DaemonInfo *d;
 } TCPContext;
 
-// args passed to UpdateAnswerList thread as void*
+// request queued for the worker threads
+typedef struct RequestJob
+{
+    struct RequestJob *next;
+    void *(*handler)(void *);  // UDPMessageHandler or TCPMessageHandler
+    void *context;             // owned by the handler once dispatched
+} RequestJob;
+
+// args passed to UpdateAnswerList threads as void*
 typedef struct
 {
     DaemonInfo *d;
-    AnswerListElem *a;
+    pthread_mutex_t lock;      // protects the scan position below, which is shared by all refresh threads
+    int bucket;                // AnswerTable bucket being scanned for lists to refresh
+    AnswerListElem *a;         // next list to examine in that bucket
 } UpdateAnswerListArgs;
 
 //
@@ -486,6 +498,77 @@ exit:
     return pkt;
 }
 
+// Connections to the nameserver are shared by the request threads and kept open between requests, rather than
+// opening a new connection for every message relayed over TCP.
+
+// return a connection to the nameserver, reusing an idle one if possible
+// *pooled is set if the connection came from the pool, in which case the server may since have closed it
+mDNSlocal TCPSocket *GetServerConnection(DaemonInfo *d, mDNSBool *pooled)
+{
+    TCPSocket *sock = NULL;
+
+    if (pthread_mutex_lock(&d->serverlock)) LogErr("GetServerConnection", "pthread_mutex_lock");
+    else
+    {
+        while (!sock && d->nserverconns)
+        {
+            fd_set rset;
+            struct timeval timeout = { 0, 0 };
+            int fd;
+
+            sock = d->serverconns[--d->nserverconns];
+            fd = mDNSPlatformTCPGetFD( sock );
+            FD_ZERO(&rset);
+            FD_SET(fd, &rset);
+            // an idle connection has nothing to read, so if it's readable the server has closed it
+            if (select(fd+1, &rset, NULL, NULL, &timeout)) { mDNSPlatformTCPCloseConnection( sock ); sock = NULL; }
+        }
+        pthread_mutex_unlock(&d->serverlock);
+    }
+    *pooled = (sock != NULL);
+    return sock ? sock : ConnectToServer(d);
+}
+
+// return a connection that has finished a transaction to the pool, or close it if the pool is full
+mDNSlocal void ReleaseServerConnection(DaemonInfo *d, TCPSocket *sock)
+{
+    if (pthread_mutex_lock(&d->serverlock)) LogErr("ReleaseServerConnection", "pthread_mutex_lock");
+    else
+    {
+        if (d->nserverconns < SERVER_POOL_SIZE) { d->serverconns[d->nserverconns++] = sock; sock = NULL; }
+        pthread_mutex_unlock(&d->serverlock);
+    }
+    if (sock) mDNSPlatformTCPCloseConnection( sock );
+}
+
+// Relay a message to the nameserver over TCP and return its reply, or NULL on failure.  storage is as for RecvPacket.
+// If a pooled connection turns out to have been closed by the server, the message is retried on a new connection.
+mDNSlocal PktMsg *ServerTCPTransaction(DaemonInfo *d, PktMsg *request, PktMsg *storage)
+{
+    TCPSocket *sock;
+    PktMsg *reply;
+    mDNSBool pooled, closed;
+
+    while (1)
+    {
+        sock = GetServerConnection(d, &pooled);
+        if (!sock) return NULL;
+
+        closed = mDNStrue;
+        if (SendPacket(sock, request) == 0)
+        {
+            closed = mDNSfalse;
+            reply = RecvPacket(sock, storage, &closed);
+            if (reply) { ReleaseServerConnection(d, sock); return reply; }
+        }
+        mDNSPlatformTCPCloseConnection( sock );
+
+        // a timeout or a bad reply on a working connection isn't worth retrying
+        if (!pooled || !closed) return NULL;
+        VLog("ServerTCPTransaction - pooled connection closed by server.  Reconnecting");
+    }
+}
+
 
 mDNSlocal DNSZone*
 FindZone
@@ -798,33 +881,141 @@ mDNSlocal CacheRecord *CopyCacheRecord(const CacheRecord *orig, domainname *name
 // Lease Hashtable Utility Routines
 //
 
+// Return the hash chain that holds records whose name hashes to namehash.  While the table is growing, buckets
+// that haven't been moved yet are still in the old table.
+// caller must lock table prior to invocation
+mDNSlocal RRTableElem **LeaseBucket(DaemonInfo *d, mDNSu32 namehash)
+{
+    if (d->oldtable && (mDNSs32)(namehash % d->oldnbuckets) >= d->rehashpos) return &d->oldtable[namehash % d->oldnbuckets];
+    return &d->table[namehash % d->nbuckets];
+}
+
 // double hash table size
+// Only the new bucket array is allocated here; records are moved over a few buckets at a time by RehashStep, so
+// that no single update pays for moving the whole table.
 // caller must lock table prior to invocation
 mDNSlocal void RehashTable(DaemonInfo *d)
 {
-    RRTableElem *ptr, *tmp, **new;
-    int i, bucket, newnbuckets = d->nbuckets * 2;
+    RRTableElem **new;
+    int newnbuckets = d->nbuckets * 2;
+
+    if (d->oldtable) return;    // still moving records from the last time the table grew
 
     VLog("Rehashing lease table (new size %d buckets)", newnbuckets);
     new = malloc(sizeof(RRTableElem *) * newnbuckets);
     if (!new) { LogErr("RehashTable", "malloc");  return; }
     mDNSPlatformMemZero(new, newnbuckets * sizeof(RRTableElem *));
 
-    for (i = 0; i < d->nbuckets; i++)
+    d->oldtable = d->table;
+    d->oldnbuckets = d->nbuckets;
+    d->rehashpos = 0;
+    d->table = new;
+    d->nbuckets = newnbuckets;
+}
+
+// move the next few buckets of the old table, if any, into the new table
+// caller must lock table prior to invocation
+mDNSlocal void RehashStep(DaemonInfo *d)
+{
+    RRTableElem *ptr, *tmp, **bucket;
+    int i;
+
+    for (i = 0; d->oldtable && i < LEASETABLE_REHASH_STEP; i++)
     {
-        ptr = d->table[i];
+        ptr = d->oldtable[d->rehashpos];
+        d->oldtable[d->rehashpos++] = NULL;
         while (ptr)
         {
-            bucket = ptr->rr.resrec.namehash % newnbuckets;
             tmp = ptr;
             ptr = ptr->next;
-            tmp->next = new[bucket];
-            new[bucket] = tmp;
+            bucket = &d->table[tmp->rr.resrec.namehash % d->nbuckets];
+            tmp->next = *bucket;
+            *bucket = tmp;
+        }
+        if (d->rehashpos == d->oldnbuckets)
+        {
+            free(d->oldtable);
+            d->oldtable = NULL;
+            d->oldnbuckets = 0;
+            d->rehashpos = 0;
         }
     }
-    d->nbuckets = newnbuckets;
-    free(d->table);
-    d->table = new;
+}
+
+//
+// Lease Expiration Heap Routines
+//
+// Every record in the lease table is also in leaseheap, a binary min-heap ordered by expiration time, so that
+// finding expired records costs only as much as the number of records that have expired.
+// caller must lock table prior to invocation of all of these routines
+
+mDNSlocal void LeaseHeapSet(DaemonInfo *d, mDNSs32 i, RRTableElem *e)
+{
+    d->leaseheap[i] = e;
+    e->heapindex = i;
+}
+
+mDNSlocal void LeaseHeapSiftUp(DaemonInfo *d, mDNSs32 i)
+{
+    RRTableElem *e = d->leaseheap[i];
+    while (i > 0)
+    {
+        mDNSs32 parent = (i - 1) / 2;
+        if (d->leaseheap[parent]->expire <= e->expire) break;
+        LeaseHeapSet(d, i, d->leaseheap[parent]);
+        i = parent;
+    }
+    LeaseHeapSet(d, i, e);
+}
+
+mDNSlocal void LeaseHeapSiftDown(DaemonInfo *d, mDNSs32 i)
+{
+    RRTableElem *e = d->leaseheap[i];
+    while (1)
+    {
+        mDNSs32 child = 2 * i + 1;
+        if (child >= d->nelems) break;
+        if (child + 1 < d->nelems && d->leaseheap[child + 1]->expire < d->leaseheap[child]->expire) child++;
+        if (d->leaseheap[child]->expire >= e->expire) break;
+        LeaseHeapSet(d, i, d->leaseheap[child]);
+        i = child;
+    }
+    LeaseHeapSet(d, i, e);
+}
+
+// add a record to the heap, counting it as a table element; returns -1 if the heap couldn't grow
+mDNSlocal int LeaseHeapInsert(DaemonInfo *d, RRTableElem *e)
+{
+    if (d->nelems == d->heapsize)
+    {
+        mDNSs32 newsize = d->heapsize ? d->heapsize * 2 : LEASETABLE_INIT_NBUCKETS;
+        RRTableElem **new = realloc(d->leaseheap, sizeof(RRTableElem *) * newsize);
+        if (!new) { LogErr("LeaseHeapInsert", "realloc"); return -1; }
+        d->leaseheap = new;
+        d->heapsize = newsize;
+    }
+    LeaseHeapSet(d, d->nelems, e);
+    d->nelems++;
+    LeaseHeapSiftUp(d, e->heapindex);
+    return 0;
+}
+
+mDNSlocal void LeaseHeapRemove(DaemonInfo *d, RRTableElem *e)
+{
+    mDNSs32 i = e->heapindex;
+    RRTableElem *last = d->leaseheap[--d->nelems];
+
+    if (last == e) return;
+    LeaseHeapSet(d, i, last);
+    LeaseHeapSiftUp(d, i);
+    LeaseHeapSiftDown(d, last->heapindex);
+}
+
+// restore heap order after e->expire has changed
+mDNSlocal void LeaseHeapUpdate(DaemonInfo *d, RRTableElem *e)
+{
+    LeaseHeapSiftUp(d, e->heapindex);
+    LeaseHeapSiftDown(d, e->heapindex);
 }
 
 // print entire contents of hashtable, invoked via SIGINFO
@@ -840,16 +1031,14 @@ mDNSlocal void PrintLeaseTable(DaemonInfo *d)
     if (pthread_mutex_lock(&d->tablelock)) { LogErr("PrintTable", "pthread_mutex_lock"); return; }
 
     Log("Dumping Lease Table Contents (table contains %d resource records)", d->nelems);
-    for (i = 0; i < d->nbuckets; i++)
+    for (i = 0; i < d->nelems; i++)
     {
-        for (ptr = d->table[i]; ptr; ptr = ptr->next)
-        {
-            hr = ((ptr->expire - now.tv_sec) / 60) / 60;
-            min = ((ptr->expire - now.tv_sec) / 60) % 60;
-            sec = (ptr->expire - now.tv_sec) % 60;
-            Log("Update from %s, Expires in %d:%d:%d\n\t%s", inet_ntop(AF_INET, &ptr->cli.sin_addr, addrbuf, 16), hr, min, sec,
-                GetRRDisplayString_rdb(&ptr->rr.resrec, &ptr->rr.resrec.rdata->u, rrbuf));
-        }
+        ptr = d->leaseheap[i];
+        hr = ((ptr->expire - now.tv_sec) / 60) / 60;
+        min = ((ptr->expire - now.tv_sec) / 60) % 60;
+        sec = (ptr->expire - now.tv_sec) % 60;
+        Log("Update from %s, Expires in %d:%d:%d\n\t%s", inet_ntop(AF_INET, &ptr->cli.sin_addr, addrbuf, 16), hr, min, sec,
+            GetRRDisplayString_rdb(&ptr->rr.resrec, &ptr->rr.resrec.rdata->u, rrbuf));
     }
     pthread_mutex_unlock(&d->tablelock);
 }
@@ -1143,6 +1332,21 @@ mDNSlocal int InitLeaseTable(DaemonInfo *d)
     d->table = malloc(sizeof(RRTableElem *) * LEASETABLE_INIT_NBUCKETS);
     if (!d->table) { LogErr("InitLeaseTable", "malloc"); return -1; }
     mDNSPlatformMemZero(d->table, sizeof(RRTableElem *) * LEASETABLE_INIT_NBUCKETS);
+    d->oldtable = NULL;
+    d->oldnbuckets = 0;
+    d->rehashpos = 0;
+    d->leaseheap = NULL;
+    d->heapsize = 0;
+    return 0;
+}
+
+// Initialize the list of names whose LLQs need to be checked for events
+mDNSlocal int InitLLQEvents(DaemonInfo *d)
+{
+    if (pthread_mutex_init(&d->LLQEventLock, NULL)) { LogErr("InitLLQEvents", "pthread_mutex_init"); return -1; }
+    d->LLQEventNames = NULL;
+    d->LLQEventNameCount = 0;
+    d->LLQEventAll = mDNSfalse;
     return 0;
 }
 
@@ -1331,34 +1535,78 @@ end:
     if (reply) free(reply);
 }
 
-// iterate over table, deleting expired records (or all records if DeleteAll is true)
-mDNSlocal void DeleteRecords(DaemonInfo *d, mDNSBool DeleteAll)
+// Remember that records named name changed, so that the next round of LLQ events re-queries only the LLQs that
+// ask about that name.  A NULL name means we don't know what changed, and every LLQ must be re-queried.
+mDNSlocal void NoteLLQEventName(DaemonInfo *d, const domainname *name)
 {
-    struct timeval now;
-    int i;
-    TCPSocket *sock = ConnectToServer(d);
-    if (!sock) { Log("DeleteRecords: ConnectToServer failed"); return; }
-    if (gettimeofday(&now, NULL)) { LogErr("DeleteRecords ", "gettimeofday"); return; }
-    if (pthread_mutex_lock(&d->tablelock)) { LogErr("DeleteRecords", "pthread_mutex_lock"); return; }
+    DNameListElem *elem;
 
-    for (i = 0; i < d->nbuckets; i++)
+    if (pthread_mutex_lock(&d->LLQEventLock)) { LogErr("NoteLLQEventName", "pthread_mutex_lock"); return; }
+    if (d->LLQEventAll) goto exit;
+    if (name)
     {
-        RRTableElem **ptr = &d->table[i];
-        while (*ptr)
+        for (elem = d->LLQEventNames; elem; elem = elem->next)
+            if (SameDomainName(&elem->name, name)) goto exit;
+        if (d->LLQEventNameCount < LLQ_EVENT_MAX_NAMES)
         {
-            if (DeleteAll || (*ptr)->expire - now.tv_sec < 0)
+            elem = malloc(sizeof(*elem));
+            if (elem)
             {
-                RRTableElem *fptr;
-                // delete record from server
-                DeleteOneRecord(d, &(*ptr)->rr, &(*ptr)->zone, sock);
-                fptr = *ptr;
-                *ptr = (*ptr)->next;
-                free(fptr);
-                d->nelems--;
+                AssignDomainName(&elem->name, name);
+                elem->uid = 0;
+                elem->next = d->LLQEventNames;
+                d->LLQEventNames = elem;
+                d->LLQEventNameCount++;
+                goto exit;
             }
-            else ptr = &(*ptr)->next;
+            LogErr("NoteLLQEventName", "malloc");
         }
     }
+
+    // Fall back to refreshing everything; the individual names are no longer needed
+    while (d->LLQEventNames)
+    {
+        elem = d->LLQEventNames;
+        d->LLQEventNames = elem->next;
+        free(elem);
+    }
+    d->LLQEventNameCount = 0;
+    d->LLQEventAll = mDNStrue;
+
+exit:
+    pthread_mutex_unlock(&d->LLQEventLock);
+}
+
+// delete expired records (or all records if DeleteAll is true), taking them from the top of the expiration heap
+mDNSlocal void DeleteRecords(DaemonInfo *d, mDNSBool DeleteAll)
+{
+    struct timeval now;
+    TCPSocket *sock;
+    mDNSBool expired;
+
+    if (gettimeofday(&now, NULL)) { LogErr("DeleteRecords ", "gettimeofday"); return; }
+
+    // don't bother connecting to the server if nothing has expired
+    if (pthread_mutex_lock(&d->tablelock)) { LogErr("DeleteRecords", "pthread_mutex_lock"); return; }
+    expired = d->nelems && (DeleteAll || d->leaseheap[0]->expire - now.tv_sec < 0);
+    pthread_mutex_unlock(&d->tablelock);
+    if (!expired) return;
+
+    sock = ConnectToServer(d);
+    if (!sock) { Log("DeleteRecords: ConnectToServer failed"); return; }
+    if (pthread_mutex_lock(&d->tablelock)) { LogErr("DeleteRecords", "pthread_mutex_lock"); return; }
+
+    while (d->nelems && (DeleteAll || d->leaseheap[0]->expire - now.tv_sec < 0))
+    {
+        RRTableElem *fptr = d->leaseheap[0], **ptr;
+        // delete record from server
+        DeleteOneRecord(d, &fptr->rr, &fptr->zone, sock);
+        NoteLLQEventName(d, &fptr->name);
+        for (ptr = LeaseBucket(d, fptr->rr.resrec.namehash); *ptr != fptr; ptr = &(*ptr)->next) continue;
+        *ptr = fptr->next;
+        LeaseHeapRemove(d, fptr);
+        free(fptr);
+    }
     pthread_mutex_unlock(&d->tablelock);
     mDNSPlatformTCPCloseConnection( sock );
 }
@@ -1377,8 +1625,9 @@ mDNSlocal void UpdateLeaseTable(PktMsg *pkt, DaemonInfo *d, mDNSs32 lease)
     struct timeval tv;
     DNSQuestion zone;
     char buf[MaxMsg];
+    mDNSBool complete = mDNSfalse;
 
-    if (pthread_mutex_lock(&d->tablelock)) { LogErr("UpdateLeaseTable", "pthread_mutex_lock"); return; }
+    if (pthread_mutex_lock(&d->tablelock)) { LogErr("UpdateLeaseTable", "pthread_mutex_lock"); NoteLLQEventName(d, mDNSNULL); return; }
     HdrNToH(pkt);
     ptr = pkt->msg.data;
     end = (mDNSu8 *)&pkt->msg + pkt->len;
@@ -1393,8 +1642,9 @@ mDNSlocal void UpdateLeaseTable(PktMsg *pkt, DaemonInfo *d, mDNSs32 lease)
 
         ptr = GetLargeResourceRecord(NULL, &pkt->msg, ptr, end, 0, kDNSRecordTypePacketAns, &lcr);
         if (!ptr || lcr.r.resrec.RecordType == kDNSRecordTypePacketNegative) { Log("UpdateLeaseTable: GetLargeResourceRecord failed"); goto cleanup; }
-        int bucket = rr->namehash % d->nbuckets;
-        RRTableElem *tmp, **rptr = &d->table[bucket];
+        NoteLLQEventName(d, rr->name);
+        RehashStep(d);
+        RRTableElem *tmp, **rptr = LeaseBucket(d, rr->namehash);
 
         // handle deletions
         if (rr->rrtype == kDNSQType_ANY && !rr->rroriginalttl && rr->rrclass == kDNSQClass_ANY && !rr->rdlength)
@@ -1416,8 +1666,8 @@ mDNSlocal void UpdateLeaseTable(PktMsg *pkt, DaemonInfo *d, mDNSs32 lease)
                     tmp = *rptr;
                     VLog("Received deletion update for %s", GetRRDisplayString_rdb(&tmp->rr.resrec, &tmp->rr.resrec.rdata->u, buf));
                     *rptr = (*rptr)->next;
+                    LeaseHeapRemove(d, tmp);
                     free(tmp);
-                    d->nelems--;
                 }
                 else rptr = &(*rptr)->next;
             }
@@ -1431,16 +1681,13 @@ mDNSlocal void UpdateLeaseTable(PktMsg *pkt, DaemonInfo *d, mDNSs32 lease)
                 // refresh
                 if (gettimeofday(&tv, NULL)) { LogErr("UpdateLeaseTable", "gettimeofday"); goto cleanup; }
                 (*rptr)->expire = tv.tv_sec + (unsigned)lease;
+                LeaseHeapUpdate(d, *rptr);
                 VLog("Refreshing lease for %s", GetRRDisplayString_rdb(&lcr.r.resrec, &lcr.r.resrec.rdata->u, buf));
             }
             else
             {
                 // New record - add to table
-                if (d->nelems > d->nbuckets)
-                {
-                    RehashTable(d);
-                    bucket = rr->namehash % d->nbuckets;
-                }
+                if (d->nelems > d->nbuckets) RehashTable(d);
                 if (gettimeofday(&tv, NULL)) { LogErr("UpdateLeaseTable", "gettimeofday"); goto cleanup; }
                 allocsize = sizeof(RRTableElem);
                 if (rr->rdlength > InlineCacheRDSize) allocsize += (rr->rdlength - InlineCacheRDSize);
@@ -1453,15 +1700,19 @@ mDNSlocal void UpdateLeaseTable(PktMsg *pkt, DaemonInfo *d, mDNSs32 lease)
                 tmp->expire = tv.tv_sec + (unsigned)lease;
                 tmp->cli.sin_addr = pkt->src.sin_addr;
                 AssignDomainName(&tmp->zone, &zone.qname);
-                tmp->next = d->table[bucket];
-                d->table[bucket] = tmp;
-                d->nelems++;
+                if (LeaseHeapInsert(d, tmp) < 0) { free(tmp); goto cleanup; }
+                rptr = LeaseBucket(d, rr->namehash);
+                tmp->next = *rptr;
+                *rptr = tmp;
                 VLog("Adding update for %s to lease table", GetRRDisplayString_rdb(&lcr.r.resrec, &lcr.r.resrec.rdata->u, buf));
             }
         }
     }
+    complete = mDNStrue;
 
 cleanup:
+    // If we couldn't see every name in the update, any LLQ may be affected
+    if (!complete) NoteLLQEventName(d, mDNSNULL);
     pthread_mutex_unlock(&d->tablelock);
     HdrHToN(pkt);
 }
@@ -1503,7 +1754,6 @@ HandleRequest
     PktMsg      *   leaseReply;
     PktMsg buf;
     char addrbuf[32];
-    TCPSocket * sock = NULL;
     mStatus err;
     mDNSu32 lease = 0;
     mDNSBool gotlease;
@@ -1558,16 +1808,8 @@ HandleRequest
 
     if ( !reply )
     {
-        mDNSBool closed;
-        int res;
-
-        sock = ConnectToServer( self );
-        require_action_quiet( sock, exit, err = mStatus_UnknownErr ; Log( "Discarding request from %s due to connection errors", inet_ntop( AF_INET, &request->src.sin_addr, addrbuf, 32 ) ) );
-
-        res = SendPacket( sock, request );
-        require_action_quiet( res >= 0, exit, err = mStatus_UnknownErr ; Log( "Couldn't relay message from %s to server.  Discarding.", inet_ntop(AF_INET, &request->src.sin_addr, addrbuf, 32 ) ) );
-
-        reply = RecvPacket( sock, &buf, &closed );
+        reply = ServerTCPTransaction( self, request, &buf );
+        require_action_quiet( reply, exit, err = mStatus_UnknownErr ; Log( "Couldn't relay message from %s to server.  Discarding.", inet_ntop(AF_INET, &request->src.sin_addr, addrbuf, 32 ) ) );
     }
 
     // IMPORTANT: reply is in network byte order at this point in the code
@@ -1606,11 +1848,6 @@ HandleRequest
 
 exit:
 
-    if ( sock )
-    {
-        mDNSPlatformTCPCloseConnection( sock );
-    }
-
     if ( reply == &buf )
     {
         reply = malloc( sizeof( *reply ) );
@@ -1732,7 +1969,6 @@ mDNSlocal CacheRecord *AnswerQuestion(DaemonInfo *d, AnswerListElem *e)
 {
     PktMsg q;
     int i;
-    TCPSocket *sock = NULL;
     const mDNSu8 *ansptr;
     mDNSu8 *end = q.msg.data;
     PktMsg buf, *reply = NULL;
@@ -1763,14 +1999,8 @@ mDNSlocal CacheRecord *AnswerQuestion(DaemonInfo *d, AnswerListElem *e)
 
     if (!reply)
     {
-        mDNSBool closed;
-
-        sock = ConnectToServer(d);
-        if (!sock) { Log("AnswerQuestion: ConnectToServer failed"); goto end; }
-        if (SendPacket( sock, &q)) { Log("AnswerQuestion: SendPacket failed"); mDNSPlatformTCPCloseConnection( sock ); goto end; }
-        reply = RecvPacket( sock, NULL, &closed );
-        mDNSPlatformTCPCloseConnection( sock );
-        require_action( reply, end, Log( "AnswerQuestion: RecvPacket returned NULL" ) );
+        reply = ServerTCPTransaction(d, &q, NULL);
+        require_action( reply, end, Log( "AnswerQuestion: ServerTCPTransaction returned NULL" ) );
     }
 
     HdrNToH(&q);
@@ -1811,15 +2041,10 @@ end:
     return AnswerList;
 }
 
-// Routine forks a thread to set EventList to contain Add/Remove events, and deletes any removes from the KnownAnswer list
-mDNSlocal void *UpdateAnswerList(void *args)
+// Set EventList to contain Add/Remove events, and delete any removes from the KnownAnswer list
+mDNSlocal void RefreshAnswerList(DaemonInfo *d, AnswerListElem *a)
 {
     CacheRecord *cr, *NewAnswers, **na, **ka; // "new answer", "known answer"
-    DaemonInfo *d = ((UpdateAnswerListArgs *)args)->d;
-    AnswerListElem *a = ((UpdateAnswerListArgs *)args)->a;
-
-    free(args);
-    args = NULL;
 
     // get up to date answers
     NewAnswers = AnswerQuestion(d, a);
@@ -1877,7 +2102,35 @@ mDNSlocal void *UpdateAnswerList(void *args)
         NewAnswers = NewAnswers->next;
         free(cr);
     }
+}
+
+// Claim the next answer list marked for refresh, or return NULL when none are left
+mDNSlocal AnswerListElem *NextAnswerListToRefresh(UpdateAnswerListArgs *u)
+{
+    AnswerListElem *a = NULL;
+
+    if (pthread_mutex_lock(&u->lock)) { LogErr("NextAnswerListToRefresh", "pthread_mutex_lock"); return NULL; }
+    while (!a && u->bucket < LLQ_TABLESIZE)
+    {
+        if (!u->a)
+        {
+            if (++u->bucket < LLQ_TABLESIZE) u->a = u->d->AnswerTable[u->bucket];
+            continue;
+        }
+        if (u->a->RefreshPending) { a = u->a; a->RefreshPending = mDNSfalse; }
+        u->a = u->a->next;
+    }
+    pthread_mutex_unlock(&u->lock);
+    return a;
+}
+
+// Thread routine - refreshes marked answer lists until there are none left
+mDNSlocal void *UpdateAnswerList(void *args)
+{
+    UpdateAnswerListArgs *u = (UpdateAnswerListArgs *)args;
+    AnswerListElem *a;
 
+    while ((a = NextAnswerListToRefresh(u)) != NULL) RefreshAnswerList(u->d, a);
     return NULL;
 }
 
@@ -1971,39 +2224,67 @@ mDNSlocal void PrintLLQTable(DaemonInfo *d)
 mDNSlocal void GenLLQEvents(DaemonInfo *d)
 {
     LLQEntry **e;
-    int i;
+    int i, count = 0, nthreads;
     struct timeval t;
-    UpdateAnswerListArgs *args;
-
-    VLog("Generating LLQ Events");
+    DNameListElem *names, *n;
+    mDNSBool all;
+    UpdateAnswerListArgs args;
+    pthread_t tids[LLQ_REFRESH_THREADS];
 
     gettimeofday(&t, NULL);
 
-    // get all answers up to date
-    for (i = 0; i < LLQ_TABLESIZE; i++)
+    // take the names changed since the last round of events
+    if (pthread_mutex_lock(&d->LLQEventLock)) { LogErr("GenLLQEvents", "pthread_mutex_lock"); return; }
+    names = d->LLQEventNames;
+    all = d->LLQEventAll;
+    d->LLQEventNames = NULL;
+    d->LLQEventNameCount = 0;
+    d->LLQEventAll = mDNSfalse;
+    pthread_mutex_unlock(&d->LLQEventLock);
+
+    // mark the answer lists that ask about those names (the answer table is hashed by question name)
+    if (all)
     {
-        AnswerListElem *a = d->AnswerTable[i];
-        while(a)
+        for (i = 0; i < LLQ_TABLESIZE; i++)
         {
-            args = malloc(sizeof(*args));
-            if (!args) { LogErr("GenLLQEvents", "malloc"); return; }
-            args->d = d;
-            args->a = a;
-            if (pthread_create(&a->tid, NULL, UpdateAnswerList, args) < 0) { LogErr("GenLLQEvents", "pthread_create"); return; }
-            usleep(1);
-            a = a->next;
+            AnswerListElem *a;
+            for (a = d->AnswerTable[i]; a; a = a->next) { a->RefreshPending = mDNStrue; count++; }
         }
     }
-
-    for (i = 0; i < LLQ_TABLESIZE; i++)
+    else
     {
-        AnswerListElem *a = d->AnswerTable[i];
-        while(a)
+        for (n = names; n; n = n->next)
         {
-            if (pthread_join(a->tid, NULL)) LogErr("GenLLQEvents", "pthread_join");
-            a = a->next;
+            AnswerListElem *a;
+            for (a = d->AnswerTable[DomainNameHashValue(&n->name) % LLQ_TABLESIZE]; a; a = a->next)
+                if (!a->RefreshPending && SameDomainName(&a->name, &n->name)) { a->RefreshPending = mDNStrue; count++; }
         }
     }
+    while (names)
+    {
+        n = names;
+        names = names->next;
+        free(n);
+    }
+
+    VLog("Generating LLQ Events for %d of %d answer lists", count, d->AnswerTableCount);
+
+    // get the marked answers up to date on a bounded set of threads; this thread does its share too
+    if (count)
+    {
+        args.d = d;
+        args.bucket = 0;
+        args.a = d->AnswerTable[0];
+        if (pthread_mutex_init(&args.lock, NULL)) { LogErr("GenLLQEvents", "pthread_mutex_init"); return; }
+        nthreads = (count < LLQ_REFRESH_THREADS ? count : LLQ_REFRESH_THREADS) - 1;
+        for (i = 0; i < nthreads; i++)
+            if (pthread_create(&tids[i], NULL, UpdateAnswerList, &args)) { LogErr("GenLLQEvents", "pthread_create"); break; }
+        nthreads = i;
+        UpdateAnswerList(&args);
+        for (i = 0; i < nthreads; i++)
+            if (pthread_join(tids[i], NULL)) LogErr("GenLLQEvents", "pthread_join");
+        pthread_mutex_destroy(&args.lock);
+    }
 
     // for each established LLQ, send events
     for (i = 0; i < LLQ_TABLESIZE; i++)
@@ -2062,6 +2343,7 @@ mDNSlocal void SetAnswerList(DaemonInfo *d, LLQEntry *e)
         a->refcount = 0;
         a->EventList = NULL;
         a->UseTCP = mDNSfalse;
+        a->RefreshPending = mDNSfalse;
         a->next = d->AnswerTable[bucket];
         d->AnswerTable[bucket] = a;
         d->AnswerTableCount++;
@@ -2514,6 +2796,66 @@ exit:
     return ok;
 }
 
+// Requests that have to be relayed to the nameserver are queued for a fixed set of worker threads, so that a burst
+// of requests doesn't create a burst of threads.
+
+mDNSlocal void *RequestWorker(void *vptr)
+{
+    DaemonInfo *d = (DaemonInfo *)vptr;
+    RequestJob *job;
+
+    while (1)
+    {
+        if (pthread_mutex_lock(&d->requestlock)) { LogErr("RequestWorker", "pthread_mutex_lock"); return NULL; }
+        while (!d->requesthead) pthread_cond_wait(&d->requestcond, &d->requestlock);
+        job = d->requesthead;
+        d->requesthead = job->next;
+        if (!d->requesthead) d->requesttail = &d->requesthead;
+        pthread_mutex_unlock(&d->requestlock);
+
+        job->handler(job->context);
+        free(job);
+    }
+}
+
+// queue a request for the worker threads; the handler takes ownership of context unless an error is returned
+mDNSlocal mStatus DispatchRequest(DaemonInfo *d, void *(*handler)(void *), void *context)
+{
+    RequestJob *job = malloc(sizeof(*job));
+    if (!job) { LogErr("DispatchRequest", "malloc"); return mStatus_NoMemoryErr; }
+    job->next = NULL;
+    job->handler = handler;
+    job->context = context;
+
+    if (pthread_mutex_lock(&d->requestlock)) { LogErr("DispatchRequest", "pthread_mutex_lock"); free(job); return mStatus_UnknownErr; }
+    *d->requesttail = job;
+    d->requesttail = &job->next;
+    pthread_cond_signal(&d->requestcond);
+    pthread_mutex_unlock(&d->requestlock);
+    return mStatus_NoError;
+}
+
+// Start the request worker threads and set up the nameserver connection pool they share
+mDNSlocal int InitRequestWorkers(DaemonInfo *d)
+{
+    int i;
+    pthread_t tid;
+
+    if (pthread_mutex_init(&d->serverlock, NULL)) { LogErr("InitRequestWorkers", "pthread_mutex_init"); return -1; }
+    d->nserverconns = 0;
+    if (pthread_mutex_init(&d->requestlock, NULL)) { LogErr("InitRequestWorkers", "pthread_mutex_init"); return -1; }
+    if (pthread_cond_init(&d->requestcond, NULL)) { LogErr("InitRequestWorkers", "pthread_cond_init"); return -1; }
+    d->requesthead = NULL;
+    d->requesttail = &d->requesthead;
+
+    for (i = 0; i < REQUEST_WORKER_THREADS; i++)
+    {
+        if (pthread_create(&tid, NULL, RequestWorker, d)) { LogErr("InitRequestWorkers", "pthread_create"); break; }
+        pthread_detach(tid);
+    }
+    return i ? 0 : -1;
+}
+
 // request handler wrappers for TCP and UDP requests
 // (read message off socket, fork thread that invokes main processing routine and handles cleanup)
 
@@ -2546,8 +2888,6 @@ exit:
 
     free( context );
 
-    pthread_exit( NULL );
-
     return NULL;
 }
 
@@ -2560,7 +2900,6 @@ RecvUDPMessage
 )
 {
     UDPContext      *   context = NULL;
-    pthread_t tid;
     mDNSu16 rcode;
     mDNSu16 tcode;
     DomainAuthInfo  *   key;
@@ -2612,10 +2951,8 @@ RecvUDPMessage
             return 0;
         }
 
-        err = pthread_create( &tid, NULL, UDPMessageHandler, context );
-        require_action( !err, exit, LogErr( "RecvUDPMessage", "pthread_create" ) );
-
-        pthread_detach(tid);
+        err = DispatchRequest( self, UDPMessageHandler, context );
+        require_action( !err, exit, LogErr( "RecvUDPMessage", "DispatchRequest" ) );
     }
     else
     {
@@ -2693,7 +3030,7 @@ exit:
         free( reply );
     }
 
-    pthread_exit(NULL);
+    return NULL;
 }
 
 
@@ -2706,7 +3043,6 @@ RecvTCPMessage
     TCPContext      *   context = ( TCPContext* ) param;
     mDNSu16 rcode;
     mDNSu16 tcode;
-    pthread_t tid;
     DomainAuthInfo  *   key;
     PktMsg          *   pkt;
     mDNSBool closed;
@@ -2745,20 +3081,18 @@ RecvTCPMessage
             }
             else
             {
-                err = pthread_create( &tid, NULL, TCPMessageHandler, context );
+                err = DispatchRequest( context->d, TCPMessageHandler, context );
 
                 if ( err )
                 {
-                    LogErr( "RecvTCPMessage", "pthread_create" );
+                    LogErr( "RecvTCPMessage", "DispatchRequest" );
                     err = mStatus_NoError;
                     goto exit;
                 }
 
-                // Let the thread free the context
+                // Let the worker thread free the context
 
                 freeContext = mDNSfalse;
-
-                pthread_detach(tid);
             }
         }
         else
@@ -3073,6 +3407,8 @@ int main(int argc, char *argv[])
     }
 
     if (InitLeaseTable(d) < 0) { LogErr("main", "InitLeaseTable"); exit(1); }
+    if (InitLLQEvents(d) < 0) { LogErr("main", "InitLLQEvents"); exit(1); }
+    if (InitRequestWorkers(d) < 0) { LogErr("main", "InitRequestWorkers"); exit(1); }
     if (SetupSockets(d) < 0) { LogErr("main", "SetupSockets"); exit(1); }
     if (SetUpdateSRV(d) < 0) { LogErr("main", "SetUpdateSRV"); exit(1); }
 
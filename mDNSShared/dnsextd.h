@@ -29,6 +29,9 @@
 
 
 #define LLQ_TABLESIZE   1024    // !!!KRS make this dynamically growable
+#define LLQ_EVENT_MAX_NAMES  256   // changed names remembered between event rounds before we refresh everything
+#define LLQ_REFRESH_THREADS  8     // threads used to refresh answer lists after a change
+#define SERVER_POOL_SIZE     16    // idle connections to the nameserver kept open for reuse
 
 
 typedef enum DNSZoneSpecType
@@ -64,6 +67,7 @@ typedef struct RRTableElem
     struct RRTableElem *next;
     struct sockaddr_in cli;   // client's source address
     long expire;              // expiration time, in seconds since epoch
+    mDNSs32 heapindex;        // position in the lease expiration heap
     domainname zone;          // from zone field of update message
     domainname name;          // name of the record
     CacheRecord rr;           // last field in struct allows for allocation of oversized RRs
@@ -85,7 +89,7 @@ typedef struct AnswerListElem
     CacheRecord *EventList;     // New answers (adds/removes) to be sent to client
     int refcount;
     mDNSBool UseTCP;            // Use TCP if UDP would cause truncation
-    pthread_t tid;              // Allow parallel list updates
+    mDNSBool RefreshPending;    // Name was touched by an update; answers must be re-queried
 } AnswerListElem;
 
 // llq table entry
@@ -139,16 +143,38 @@ typedef struct
     RRTableElem **table;       // hashtable for records with leases
     pthread_mutex_t tablelock; // mutex for lease table
     mDNSs32 nbuckets;          // buckets allocated
-    mDNSs32 nelems;            // elements in table
+    mDNSs32 nelems;            // elements in table (and in leaseheap)
+    RRTableElem **oldtable;    // smaller table still being moved into table a few buckets at a time, or NULL
+    mDNSs32 oldnbuckets;       // buckets in oldtable
+    mDNSs32 rehashpos;         // oldtable buckets below this index have been moved
+    RRTableElem **leaseheap;   // min-heap of every record in the table, ordered by expiration
+    mDNSs32 heapsize;          // heap slots allocated
 
     // LLQ table variables
     LLQEntry *LLQTable[LLQ_TABLESIZE];  // !!!KRS change this and RRTable to use a common data structure
     AnswerListElem *AnswerTable[LLQ_TABLESIZE];
     int AnswerTableCount;
+
+    // LLQ event variables (locked via mutex after initialization)
+    pthread_mutex_t LLQEventLock;    // mutex for changed name list
+    DNameListElem *LLQEventNames;    // names touched by updates or lease expirations since the last round of events
+    int LLQEventNameCount;           // elements in LLQEventNames
+    mDNSBool LLQEventAll;            // too many names to track; refresh every answer list
     int LLQEventNotifySock;          // Unix domain socket pair - update handling thread writes to EventNotifySock, which wakes
     int LLQEventListenSock;          // the main thread listening on EventListenSock, indicating that the zone has changed
 
     GenLinkedList eventSources;     // linked list of EventSource's
+
+    // request worker variables (locked via mutex after initialization)
+    pthread_mutex_t requestlock;        // mutex for request queue
+    pthread_cond_t requestcond;         // signalled when a request is queued
+    struct RequestJob *requesthead;     // requests waiting for a worker thread, oldest first
+    struct RequestJob **requesttail;
+
+    // nameserver connection pool (locked via mutex after initialization)
+    pthread_mutex_t serverlock;                 // mutex for connection pool
+    TCPSocket *serverconns[SERVER_POOL_SIZE];   // idle connections to the nameserver
+    int nserverconns;                           // elements in serverconns
 } DaemonInfo;
 
 
@@ -20,10 +20,13 @@
  * The shim is responsible for two main things:
  * - converting string parameters between C string format and native DNS format,
  * - and for allocating and freeing memory.
+ * dnssd_clientshim.h adds calls that skip the string conversion and a synchronous cached GetAddrInfo.
  */
 
 #include "dns_sd.h"             // Defines the interface to the client layer above
+#include "dnssd_clientshim.h"   // Wire-format and synchronous extensions only this shim provides
 #include "mDNSEmbeddedAPI.h"        // The interface we're building on top of
+#include "DNSCommon.h"              // For DomainNameHashValue()
 #include <sys/socket.h>
 #include <netinet/in.h>
 extern mDNS mDNSStorage;        // We need to pass the address of this storage to the lower-layer functions
@@ -98,6 +101,14 @@ typedef struct
     DNSQuestion                aaaa;
 } mDNS_DirectOP_GetAddrInfo;
 
+typedef struct
+{
+    mDNS_DirectOP_Dispose *disposefn;
+    DNSServiceDirectReply  callback;
+    void                  *context;
+    DNSQuestion q;
+} mDNS_DirectOP_Direct;
+
 dnssd_sock_t DNSServiceRefSockFD(DNSServiceRef sdRef)
 {
     (void)sdRef;    // Unused
@@ -700,6 +711,294 @@ fail:
     return(err);
 }
 
+//*************************************************************************************************************
+// Wire-format Browse and QueryRecord (see dnssd_clientshim.h)
+
+static void DNSServiceDirectDispose(mDNS_DirectOP *op)
+{
+    mDNS_DirectOP_Direct *x = (mDNS_DirectOP_Direct*)op;
+    if (x->q.ThisQInterval >= 0) mDNS_StopQuery(&mDNSStorage, &x->q);
+    mDNSPlatformMemFree(x);
+}
+
+mDNSlocal void DNSServiceDirectResponse(mDNS *const m, DNSQuestion *question, const ResourceRecord *const answer, QC_result AddRecord)
+{
+    mDNS_DirectOP_Direct *x = (mDNS_DirectOP_Direct*)question->QuestionContext;
+    // Negative and suppressed answers carry no rdata, so there is nothing to hand over
+    if (AddRecord == QC_suppressed || answer->RecordType == kDNSRecordTypePacketNegative) return;
+    if (x->callback)
+        x->callback((DNSServiceRef)x, AddRecord ? kDNSServiceFlagsAdd : (DNSServiceFlags)0,
+                    mDNSPlatformInterfaceIndexfromInterfaceID(m, answer->InterfaceID, mDNStrue), answer, x->context);
+}
+
+DNSServiceErrorType DNSServiceBrowseDirect
+(
+    DNSServiceRef         *sdRef,
+    DNSServiceFlags        flags,
+    uint32_t               interfaceIndex,
+    const domainname      *regtype,
+    const domainname      *domain,      /* may be NULL */
+    DNSServiceDirectReply  callback,
+    void                  *context      /* may be NULL */
+)
+{
+    mStatus err;
+    mDNSInterfaceID InterfaceID = DNSServiceInterfaceIndexToID(interfaceIndex, &flags);
+    mDNS_DirectOP_Direct *x;
+
+    if (!regtype || !regtype->c[0]) { err = mStatus_BadParamErr; goto fail; }
+
+    x = (mDNS_DirectOP_Direct *) mDNSPlatformMemAllocateClear(sizeof(*x));
+    if (!x) { err = mStatus_NoMemoryErr; goto fail; }
+
+    x->disposefn = DNSServiceDirectDispose;
+    x->callback  = callback;
+    x->context   = context;
+    x->q.QuestionContext = x;
+
+    err = mDNS_StartBrowse(&mDNSStorage, &x->q, regtype, domain ? domain : &localdomain, InterfaceID, flags,
+                           (flags & kDNSServiceFlagsForceMulticast) != 0, (flags & kDNSServiceFlagsBackgroundTrafficClass) != 0,
+                           DNSServiceDirectResponse, x);
+    if (err) { mDNSPlatformMemFree(x); goto fail; }
+
+    *sdRef = (DNSServiceRef)x;
+    return(mStatus_NoError);
+
+fail:
+    LogMsg("DNSServiceBrowseDirect(%##s, %##s) failed: %ld", regtype ? regtype->c : mDNSNULL, domain ? domain->c : mDNSNULL, err);
+    return(err);
+}
+
+DNSServiceErrorType DNSServiceQueryRecordDirect
+(
+    DNSServiceRef         *sdRef,
+    DNSServiceFlags        flags,
+    uint32_t               interfaceIndex,
+    const domainname      *fullname,
+    uint16_t               rrtype,
+    uint16_t               rrclass,
+    DNSServiceDirectReply  callback,
+    void                  *context      /* may be NULL */
+)
+{
+    mStatus err;
+    mDNS_DirectOP_Direct *x;
+
+    if (!fullname) { err = mStatus_BadParamErr; goto fail; }
+
+    x = (mDNS_DirectOP_Direct *) mDNSPlatformMemAllocateClear(sizeof(*x));
+    if (!x) { err = mStatus_NoMemoryErr; goto fail; }
+
+    x->disposefn = DNSServiceDirectDispose;
+    x->callback  = callback;
+    x->context   = context;
+
+    x->q.ThisQInterval        = -1;      // So that DNSServiceDirectDispose() knows whether to cancel this question
+    x->q.InterfaceID          = DNSServiceInterfaceIndexToID(interfaceIndex, &flags);
+    x->q.flags                = flags;
+    AssignDomainName(&x->q.qname, fullname);
+    x->q.qtype                = rrtype;
+    x->q.qclass               = rrclass;
+    x->q.LongLived            = (flags & kDNSServiceFlagsLongLivedQuery) != 0;
+    x->q.ExpectUnique         = mDNSfalse;
+    x->q.ForceMCast           = (flags & kDNSServiceFlagsForceMulticast) != 0;
+    x->q.ReturnIntermed       = (flags & kDNSServiceFlagsReturnIntermediates) != 0;
+    x->q.SuppressUnusable     = (flags & kDNSServiceFlagsSuppressUnusable) != 0;
+    x->q.AppendSearchDomains  = 0;
+    x->q.TimeoutQuestion      = 0;
+    x->q.WakeOnResolve        = 0;
+    x->q.UseBackgroundTraffic = (flags & kDNSServiceFlagsBackgroundTrafficClass) != 0;
+    x->q.ProxyQuestion        = 0;
+    x->q.pid                  = mDNSPlatformGetPID();
+    x->q.QuestionCallback     = DNSServiceDirectResponse;
+    x->q.QuestionContext      = x;
+
+    err = mDNS_StartQuery(&mDNSStorage, &x->q);
+    if (err) { DNSServiceDirectDispose((mDNS_DirectOP*)x); goto fail; }
+
+    *sdRef = (DNSServiceRef)x;
+    return(mStatus_NoError);
+
+fail:
+    LogMsg("DNSServiceQueryRecordDirect(%##s, %d, %d) failed: %ld", fullname ? fullname->c : mDNSNULL, rrtype, rrclass, err);
+    return(err);
+}
+
+//*************************************************************************************************************
+// Shim address cache (see dnssd_clientshim.h)
+
+#if DNSSD_SHIM_ADDR_CACHE_SIZE
+
+#define ShimAddrCacheMaxTTL (7 * 24 * 3600)     // Keeps expiry times well inside mDNSs32 tick arithmetic
+
+typedef struct
+{
+    mDNSAddr addr;
+    mDNSu32  interfaceIndex;
+    mDNSs32  expire;
+} ShimCachedAddr;
+
+typedef struct
+{
+    domainname     name;                    // Empty when the slot is free
+    mDNSu32        namehash;
+    mDNSs32        lastused;
+    mDNSu32        count;
+    ShimCachedAddr addrs[DNSSD_SHIM_ADDRS_PER_NAME];
+} ShimAddrCacheEntry;
+
+static ShimAddrCacheEntry ShimAddrCache[DNSSD_SHIM_ADDR_CACHE_SIZE];
+
+mDNSlocal ShimAddrCacheEntry *ShimAddrCacheFind(const domainname *const name, mDNSu32 namehash)
+{
+    int i;
+    for (i = 0; i < DNSSD_SHIM_ADDR_CACHE_SIZE; i++)
+    {
+        ShimAddrCacheEntry *e = &ShimAddrCache[i];
+        if (e->name.c[0] && e->namehash == namehash && SameDomainName(&e->name, name)) return(e);
+    }
+    return(mDNSNULL);
+}
+
+mDNSlocal void ShimAddrCacheRemoveAt(ShimAddrCacheEntry *e, mDNSu32 i)
+{
+    e->addrs[i] = e->addrs[--e->count];
+    if (!e->count) e->name.c[0] = 0;
+}
+
+// Called with each valid A/AAAA answer delivered to a DNSServiceGetAddrInfo() operation
+mDNSlocal void ShimAddrCacheUpdate(const ResourceRecord *const answer, QC_result AddRecord)
+{
+    const mDNSs32 now = mDNS_TimeNow(&mDNSStorage);
+    const mDNSu32 ttl = answer->rroriginalttl < ShimAddrCacheMaxTTL ? answer->rroriginalttl : ShimAddrCacheMaxTTL;
+    const mDNSu32 interfaceIndex = mDNSPlatformInterfaceIndexfromInterfaceID(&mDNSStorage, answer->InterfaceID, mDNStrue);
+    ShimAddrCacheEntry *e = ShimAddrCacheFind(answer->name, answer->namehash);
+    mDNSAddr addr;
+    mDNSu32 i;
+
+    if (answer->rrtype == kDNSType_A) { addr.type = mDNSAddrType_IPv4; addr.ip.v4 = answer->rdata->u.ipv4; }
+    else                              { addr.type = mDNSAddrType_IPv6; addr.ip.v6 = answer->rdata->u.ipv6; }
+
+    if (AddRecord == QC_rmv)
+    {
+        if (!e) return;
+        for (i = 0; i < e->count; i++)
+            if (e->addrs[i].interfaceIndex == interfaceIndex && mDNSSameAddress(&e->addrs[i].addr, &addr))
+            { ShimAddrCacheRemoveAt(e, i); break; }
+        return;
+    }
+
+    if (!e)
+    {
+        // Take a free slot if there is one, otherwise the least recently used name
+        ShimAddrCacheEntry *lru = &ShimAddrCache[0];
+        for (i = 0; i < DNSSD_SHIM_ADDR_CACHE_SIZE; i++)
+        {
+            if (!ShimAddrCache[i].name.c[0]) { lru = &ShimAddrCache[i]; break; }
+            if (ShimAddrCache[i].lastused - lru->lastused < 0) lru = &ShimAddrCache[i];
+        }
+        e = lru;
+        AssignDomainName(&e->name, answer->name);
+        e->namehash = answer->namehash;
+        e->count    = 0;
+    }
+    e->lastused = now;
+
+    for (i = 0; i < e->count; i++)
+        if (e->addrs[i].interfaceIndex == interfaceIndex && mDNSSameAddress(&e->addrs[i].addr, &addr)) break;
+    if (i == e->count)
+    {
+        if (e->count < DNSSD_SHIM_ADDRS_PER_NAME) e->count++;
+        else
+        {
+            // Full: replace whichever address is closest to expiring
+            mDNSu32 j;
+            for (i = 0, j = 1; j < e->count; j++) if (e->addrs[j].expire - e->addrs[i].expire < 0) i = j;
+        }
+        e->addrs[i].addr           = addr;
+        e->addrs[i].interfaceIndex = interfaceIndex;
+    }
+    e->addrs[i].expire = now + (mDNSs32)ttl * mDNSPlatformOneSecond;
+}
+
+#endif // DNSSD_SHIM_ADDR_CACHE_SIZE
+
+DNSServiceErrorType DNSServiceGetAddrInfoCached
+(
+    DNSServiceFlags            flags,
+    uint32_t                   interfaceIndex,
+    DNSServiceProtocol         protocol,
+    const char                *hostname,
+    DNSServiceGetAddrInfoReply callback,
+    void                      *context  /* may be NULL */
+)
+{
+#if DNSSD_SHIM_ADDR_CACHE_SIZE
+    ShimCachedAddr found[DNSSD_SHIM_ADDRS_PER_NAME];
+    ShimAddrCacheEntry *e;
+    domainname name;
+    mDNSs32 now;
+    mDNSu32 i, n = 0;
+    (void)flags;    // Unused
+
+    if (!MakeDomainNameFromDNSNameString(&name, hostname)) return(kDNSServiceErr_BadParam);
+    if (!protocol) protocol = kDNSServiceProtocol_IPv4 | kDNSServiceProtocol_IPv6;
+
+    e = ShimAddrCacheFind(&name, DomainNameHashValue(&name));
+    if (!e) return(kDNSServiceErr_NoSuchRecord);
+
+    // Copy the matches out first: the callback may start or stop operations that change the cache
+    now = mDNS_TimeNow(&mDNSStorage);
+    e->lastused = now;
+    for (i = 0; i < e->count; )
+    {
+        const ShimCachedAddr *a = &e->addrs[i];
+        if (a->expire - now <= 0) { ShimAddrCacheRemoveAt(e, i); continue; }
+        if ((a->addr.type == mDNSAddrType_IPv4 ? (protocol & kDNSServiceProtocol_IPv4) : (protocol & kDNSServiceProtocol_IPv6)) &&
+            (!interfaceIndex || a->interfaceIndex == interfaceIndex))
+            found[n++] = *a;
+        i++;
+    }
+    if (!n) return(kDNSServiceErr_NoSuchRecord);
+
+    for (i = 0; i < n; i++)
+    {
+        struct sockaddr_storage sas;
+        mDNSPlatformMemZero(&sas, sizeof sas);
+        if (found[i].addr.type == mDNSAddrType_IPv4)
+        {
+            struct sockaddr_in *sin = (struct sockaddr_in *)&sas;
+            sin->sin_family = AF_INET;
+#ifndef NOT_HAVE_SA_LEN
+            sin->sin_len = sizeof *sin;
+#endif
+            mDNSPlatformMemCopy(&sin->sin_addr, &found[i].addr.ip.v4, sizeof sin->sin_addr.s_addr);
+        }
+        else
+        {
+            struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&sas;
+            sin6->sin6_family = AF_INET6;
+#ifndef NOT_HAVE_SA_LEN
+            sin6->sin6_len = sizeof *sin6;
+#endif
+            mDNSPlatformMemCopy(&sin6->sin6_addr, &found[i].addr.ip.v6, sizeof sin6->sin6_addr.s6_addr);
+        }
+        callback(mDNSNULL, kDNSServiceFlagsAdd | (i + 1 < n ? kDNSServiceFlagsMoreComing : 0), found[i].interfaceIndex,
+                 kDNSServiceErr_NoError, hostname, (const struct sockaddr *)&sas,
+                 (uint32_t)((found[i].expire - now) / mDNSPlatformOneSecond), context);
+    }
+    return(kDNSServiceErr_NoError);
+#else
+    (void)flags;            // Unused
+    (void)interfaceIndex;   // Unused
+    (void)protocol;         // Unused
+    (void)hostname;         // Unused
+    (void)callback;         // Unused
+    (void)context;          // Unused
+    return(kDNSServiceErr_NoSuchRecord);
+#endif
+}
+
 //*************************************************************************************************************
 // DNSServiceGetAddrInfo
 //
@@ -804,6 +1103,10 @@ mDNSlocal void DNSServiceGetAddrInfoResponse(mDNS *const m, DNSQuestion *questio
         }
     }
 
+#if DNSSD_SHIM_ADDR_CACHE_SIZE
+    if (err == mStatus_NoError) ShimAddrCacheUpdate(answer, addRecord);
+#endif
+
     x->callback((DNSServiceRef)x, addRecord ? kDNSServiceFlagsAdd : (DNSServiceFlags)0, x->interfaceIndex, err,
                 fullname, (const struct sockaddr *)&sas, answer->rroriginalttl, x->context);
 }
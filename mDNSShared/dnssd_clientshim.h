@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ * Extensions available only when the dns_sd.h calls are served by dnssd_clientshim.c against an mDNSCore
+ * in the same address space (embedded builds with no daemon). They are not part of the dns_sd.h API and
+ * are not implemented by the client stub library.
+ */
+
+#ifndef __DNSSD_CLIENTSHIM_H
+#define __DNSSD_CLIENTSHIM_H
+
+#include "dns_sd.h"
+#include "mDNSEmbeddedAPI.h"
+
+//*************************************************************************************************************
+// Wire-format results
+//
+// DNSServiceBrowseDirect() and DNSServiceQueryRecordDirect() take their names in DNS wire format and hand
+// the core's ResourceRecord straight to the callback, so no C string is built in either direction.
+// For a browse the instance's full name is answer->rdata->u.name (use DeconstructServiceName() if the parts
+// are needed); for a query, answer->name and answer->rdata->u.data/rdlength.
+// The record is owned by mDNSCore and is only valid for the duration of the callback.
+// Results are delivered from mDNS_Execute(), so as with the other shim calls DNSServiceProcessResult() is a no-op
+// and the returned DNSServiceRef is disposed of with DNSServiceRefDeallocate().
+
+typedef void (*DNSServiceDirectReply)
+(
+    DNSServiceRef sdRef,
+    DNSServiceFlags flags,                  // kDNSServiceFlagsAdd, or 0 for a removal
+    uint32_t interfaceIndex,
+    const ResourceRecord *answer,
+    void *context
+);
+
+extern DNSServiceErrorType DNSServiceBrowseDirect
+(
+    DNSServiceRef *sdRef,
+    DNSServiceFlags flags,
+    uint32_t interfaceIndex,
+    const domainname *regtype,
+    const domainname *domain,               // may be NULL for "local."
+    DNSServiceDirectReply callback,
+    void *context                           // may be NULL
+);
+
+extern DNSServiceErrorType DNSServiceQueryRecordDirect
+(
+    DNSServiceRef *sdRef,
+    DNSServiceFlags flags,
+    uint32_t interfaceIndex,
+    const domainname *fullname,
+    uint16_t rrtype,
+    uint16_t rrclass,
+    DNSServiceDirectReply callback,
+    void *context                           // may be NULL
+);
+
+//*************************************************************************************************************
+// Synchronous address lookup
+//
+// Addresses delivered to DNSServiceGetAddrInfo() callbacks are also kept in a small fixed-size shim cache
+// (DNSSD_SHIM_ADDR_CACHE_SIZE host names, DNSSD_SHIM_ADDRS_PER_NAME addresses each, least recently used name
+// replaced first) until their TTL runs out or the core reports them removed. DNSServiceGetAddrInfoCached()
+// answers from that cache before returning: the callback is called once per cached address (sdRef NULL,
+// kDNSServiceFlagsMoreComing set on all but the last) and the call returns kDNSServiceErr_NoError, or
+// kDNSServiceErr_NoSuchRecord without calling the callback if nothing usable is cached. On a miss, start an ordinary
+// DNSServiceGetAddrInfo() to populate the cache. Build with DNSSD_SHIM_ADDR_CACHE_SIZE=0 to leave the cache out.
+
+#ifndef DNSSD_SHIM_ADDR_CACHE_SIZE
+#define DNSSD_SHIM_ADDR_CACHE_SIZE 16
+#endif
+
+#ifndef DNSSD_SHIM_ADDRS_PER_NAME
+#define DNSSD_SHIM_ADDRS_PER_NAME 4
+#endif
+
+extern DNSServiceErrorType DNSServiceGetAddrInfoCached
+(
+    DNSServiceFlags flags,
+    uint32_t interfaceIndex,                // 0 matches addresses learned on any interface
+    DNSServiceProtocol protocol,            // 0 means both IPv4 and IPv6
+    const char *hostname,
+    DNSServiceGetAddrInfoReply callback,
+    void *context                           // may be NULL
+);
+
+#endif // __DNSSD_CLIENTSHIM_H
@@ -30,6 +30,8 @@
 #include <stdlib.h>
 
 #include "dnssd_ipc.h"
+#include "dnssd_sharedcache.h"
+#include "mDNSTrace.h"
 
 #if APPLE_OSX_mDNSResponder
 #include <mach-o/dyld.h>
@@ -91,6 +93,9 @@ static void syslog( int priority, const char * message, ...)
     #include <sys/time.h>
     #include <sys/socket.h>
     #include <syslog.h>
+    #include <pthread.h>
+    #include <strings.h>    // For strcasecmp
+    #include <time.h>
 
     #define sockaddr_mdns sockaddr_un
     #define AF_MDNS AF_LOCAL
@@ -117,6 +122,14 @@ static void syslog( int priority, const char * message, ...)
 // in mDNSResponder's INIT may take a much longer time to return
 #define DNSSD_CLIENT_TIMEOUT 60
 
+// Size of the per-connection buffer that replies from the daemon are read into (see read_reply)
+#ifndef ReplyBufferSize
+#define ReplyBufferSize 8192
+#endif
+
+// Reply bodies up to this size are handed to the callbacks from DNSServiceProcessResult()'s stack, rather than malloc()
+#define ReplyStackBufferSize 1024
+
 #ifndef CTL_PATH_PREFIX
 #define CTL_PATH_PREFIX "/var/tmp/dnssd_result_socket."
 #endif
@@ -138,6 +151,15 @@ typedef struct
     void             *AppCallback;      // Client callback function and context
     void             *AppContext;
 } SleepKAContext;
+
+// What a DNSServiceGetAddrInfo() DNSServiceRef needs to know to feed, or be fed from, the addrinfo cache
+typedef struct
+{
+    char *hostname;                     // The hostname, protocol and interface the client asked for
+    uint32_t protocol;
+    uint32_t interfaceIndex;
+    dnssd_sock_t peer;                  // For an operation answered from the cache, the other end of its socket
+} AddrInfoCacheKey;
 #endif
 
 // client stub callback to process message from server and deliver results to client application
@@ -173,6 +195,14 @@ struct _DNSServiceRef_t
     dispatch_queue_t disp_queue;
 #endif
     void             *kacontext;
+#if !defined(_WIN32)
+    AddrInfoCacheKey *aikey;            // Set for DNSServiceGetAddrInfo() when the addrinfo cache is enabled
+    int autoshared;                     // Set for the hidden primary connection of the automatic connection sharing mode
+    int wireformat;                     // Set for DNSServiceQueryRecord() with kDNSServiceFlagsWireFormat
+#endif
+    char             *readbuf;          // Replies read from the daemon but not yet processed (primary only; see read_reply)
+    int readlen;                        // Number of unprocessed bytes in readbuf
+    int readpos;                        // Offset of the first of them
 };
 
 struct _DNSRecordRef_t
@@ -256,15 +286,18 @@ static int write_all(dnssd_sock_t sd, char *buf, size_t len)
 
 enum { read_all_success = 0, read_all_fail = -1, read_all_wouldblock = -2, read_all_defunct = -3 };
 
-// Read len bytes. Return 0 on success, read_all_fail on error, or read_all_wouldblock for
-static int read_all(dnssd_sock_t sd, char *buf, int len)
+// Read at least len bytes, and up to len + extra bytes if the socket already has them, into buf.
+// *nread is set to the number of bytes read, even on failure.
+// Return 0 on success, read_all_fail on error, or read_all_wouldblock for
+static int read_atleast(dnssd_sock_t sd, char *buf, int len, int extra, int *nread)
 {
     // Don't use "MSG_WAITALL"; it returns "Invalid argument" on some Linux versions; use an explicit while() loop instead.
     //if (recv(sd, buf, len, MSG_WAITALL) != len) return -1;
 
-    while (len)
+    *nread = 0;
+    while (len > 0)
     {
-        ssize_t num_read = recv(sd, buf, len, 0);
+        ssize_t num_read = recv(sd, buf, len + extra, 0);
         // It is valid to get an interrupted system call error e.g., somebody attaching
         // in a debugger, retry without failing
         if ((num_read < 0) && (errno == EINTR)) 
@@ -272,7 +305,7 @@ static int read_all(dnssd_sock_t sd, char *buf, int len)
             syslog(LOG_INFO, "dnssd_clientstub read_all: EINTR continue"); 
             continue; 
         }
-        if ((num_read == 0) || (num_read < 0) || (num_read > len))
+        if ((num_read == 0) || (num_read < 0) || (num_read > len + extra))
         {
             int printWarn = 0;
             int defunct = 0;
@@ -304,12 +337,69 @@ static int read_all(dnssd_sock_t sd, char *buf, int len)
                 syslog(LOG_INFO, "dnssd_clientstub read_all(%d) DEFUNCT", sd);
             return (num_read < 0 && dnssd_errno == dnssd_EWOULDBLOCK) ? read_all_wouldblock : (defunct ? read_all_defunct : read_all_fail);
         }
-        buf += num_read;
-        len -= num_read;
+        buf    += num_read;
+        len    -= num_read;
+        *nread += num_read;
+        if (len < 0) { extra += len; len = 0; }
     }
     return read_all_success;
 }
 
+// Read len bytes. Return 0 on success, read_all_fail on error, or read_all_wouldblock for
+static int read_all(dnssd_sock_t sd, char *buf, int len)
+{
+    int nread;
+    return read_atleast(sd, buf, len, 0, &nread);
+}
+
+// Replies from the daemon on sdr's socket are read into sdr->readbuf, which holds sdr->readlen bytes not yet processed,
+// starting at sdr->readpos. Rather than the two recv() calls (header, then body) per reply that read_all would need,
+// each read takes whatever the daemon has already written, up to ReplyBufferSize bytes, and subsequent replies are
+// served from the buffer. When the daemon is sending a burst of results it gathers them into a single write, so one
+// system call typically delivers the lot. Replies are consumed by advancing readpos; the unprocessed bytes are only
+// moved back to the start of the buffer when more must be read in behind them.
+
+// Make sure at least len (at most ReplyBufferSize) unprocessed bytes are in sdr->readbuf, reading more if necessary.
+// When a non-blocking read would block, whatever has arrived so far stays buffered for the next call.
+static int fill_reply_buffer(DNSServiceOp *const sdr, int len)
+{
+    int nread, result;
+    if (sdr->readlen >= len) return read_all_success;
+    if (sdr->readpos)
+    {
+        memmove(sdr->readbuf, sdr->readbuf + sdr->readpos, sdr->readlen);
+        sdr->readpos = 0;
+    }
+    mDNS_TRACE2(client__read__start, sdr->sockfd, len - sdr->readlen);
+    result = read_atleast(sdr->sockfd, sdr->readbuf + sdr->readlen, len - sdr->readlen, ReplyBufferSize - len, &nread);
+    mDNS_TRACE2(client__read__done, sdr->sockfd, nread);
+    sdr->readlen += nread;
+    return result;
+}
+
+// Take the next len bytes of reply from sdr->readbuf, reading more from the socket if necessary
+static int read_reply(DNSServiceOp *const sdr, char *buf, int len)
+{
+    if (len > ReplyBufferSize)
+    {
+        // Too big to stage in the buffer; hand over what we have and read the remainder directly
+        const int have = sdr->readlen;
+        memcpy(buf, sdr->readbuf + sdr->readpos, have);
+        sdr->readlen = 0;
+        sdr->readpos = 0;
+        return read_all(sdr->sockfd, buf + have, len - have);
+    }
+    else
+    {
+        const int result = fill_reply_buffer(sdr, len);
+        if (result != read_all_success) return result;
+        memcpy(buf, sdr->readbuf + sdr->readpos, len);
+        sdr->readlen -= len;
+        sdr->readpos = sdr->readlen ? sdr->readpos + len : 0;
+        return read_all_success;
+    }
+}
+
 // Returns 1 if more bytes remain to be read on socket descriptor sd, 0 otherwise
 static int more_bytes(dnssd_sock_t sd)
 {
@@ -493,10 +583,112 @@ static void FreeDNSServiceOp(DNSServiceOp *x)
             free(x->kacontext);
             x->kacontext = NULL;
         }
+        if (x->readbuf)
+        {
+            free(x->readbuf);
+            x->readbuf = NULL;
+        }
+#if !defined(_WIN32)
+        if (x->aikey)
+        {
+            if (dnssd_SocketValid(x->aikey->peer)) dnssd_close(x->aikey->peer);
+            free(x->aikey->hostname);
+            free(x->aikey);
+            x->aikey = NULL;
+        }
+#endif
         free(x);
     }
 }
 
+// Return a new, unconnected DNSServiceOp (or NULL if out of memory)
+static DNSServiceOp *NewDNSServiceOp(uint32_t op, ProcessReplyFn ProcessReply, void *AppCallback, void *AppContext)
+{
+    DNSServiceOp *const sdr = malloc(sizeof(DNSServiceOp));
+    if (!sdr) return NULL;
+    sdr->next          = NULL;
+    sdr->primary       = NULL;
+    sdr->sockfd        = dnssd_InvalidSocket;
+    sdr->validator     = sdr->sockfd ^ ValidatorBits;
+    sdr->op            = op;
+    sdr->max_index     = 0;
+    sdr->logcounter    = 0;
+    sdr->moreptr       = NULL;
+    sdr->uid.u32[0]    = 0;
+    sdr->uid.u32[1]    = 0;
+    sdr->ProcessReply  = ProcessReply;
+    sdr->AppCallback   = AppCallback;
+    sdr->AppContext    = AppContext;
+    sdr->rec           = NULL;
+#if _DNS_SD_LIBDISPATCH
+    sdr->disp_source   = NULL;
+    sdr->disp_queue    = NULL;
+#endif
+    sdr->kacontext     = NULL;
+#if !defined(_WIN32)
+    sdr->aikey         = NULL;
+    sdr->autoshared    = 0;
+#endif
+    sdr->readbuf       = NULL;
+    sdr->readlen       = 0;
+    sdr->readpos       = 0;
+    return sdr;
+}
+
+#if !defined(_WIN32)
+// Automatic connection sharing: when the DNSSD_SHARED_CONNECTION environment variable is set to anything other than "0",
+// every DNSServiceRegister, DNSServiceBrowse, DNSServiceResolve, DNSServiceQueryRecord, DNSServiceGetAddrInfo,
+// DNSServiceEnumerateDomains and DNSServiceNATPortMappingCreate call that doesn't already use
+// kDNSServiceFlagsShareConnection is made on a single hidden DNSServiceCreateConnection() connection, as its subordinate.
+// This saves a process that runs hundreds of operations a socket, a daemon request_state and an event loop entry per
+// operation. The DNSServiceRefs returned still behave as independent ones: DNSServiceRefSockFD() returns the shared
+// socket (so every one returns the same descriptor), DNSServiceProcessResult() on any of them processes whatever has
+// arrived on it, invoking the callbacks of whichever operations the replies are for, and DNSServiceRefDeallocate()
+// stops just that operation. That suits the common single-threaded event loop; a client that processes results on
+// several threads, or relies on each DNSServiceRef having a socket of its own, should leave this off.
+
+#define AUTOSHARE_ENVVAR "DNSSD_SHARED_CONNECTION"
+
+static pthread_mutex_t AutoSharedConnectionLock = PTHREAD_MUTEX_INITIALIZER;
+static DNSServiceOp *AutoSharedConnection = NULL;
+
+static int AutoShareEnabled(void)
+{
+    static int enabled = -1;
+    if (enabled < 0)
+    {
+        const char *const value = getenv(AUTOSHARE_ENVVAR);
+        enabled = (value && *value && strcmp(value, "0")) ? 1 : 0;
+    }
+    return enabled;
+}
+
+static int AutoShareOp(const uint32_t op)
+{
+    return (op == reg_service_request || op == browse_request || op == resolve_request || op == query_request ||
+            op == addrinfo_request || op == enumeration_request || op == port_mapping_request);
+}
+
+// Returns the hidden shared connection, (re)connecting it if necessary, or NULL if we can't connect
+static DNSServiceOp *GetAutoSharedConnection(void)
+{
+    DNSServiceOp *primary;
+    pthread_mutex_lock(&AutoSharedConnectionLock);
+    // If the daemon has gone away (DNSServiceProcessResult clears ProcessReply when the connection fails), start afresh.
+    // A dead connection that still has operations on it is freed when the last of them is deallocated.
+    if (AutoSharedConnection && !AutoSharedConnection->ProcessReply)
+    {
+        if (!AutoSharedConnection->next) DNSServiceRefDeallocate(AutoSharedConnection);
+        AutoSharedConnection = NULL;
+    }
+    if (!AutoSharedConnection && DNSServiceCreateConnection(&AutoSharedConnection) == kDNSServiceErr_NoError)
+        AutoSharedConnection->autoshared = 1;
+    primary = AutoSharedConnection;
+    pthread_mutex_unlock(&AutoSharedConnectionLock);
+    return primary;
+}
+#endif // !defined(_WIN32)
+
 // Return a connected service ref (deallocate with DNSServiceRefDeallocate)
 static DNSServiceErrorType ConnectToServer(DNSServiceRef *ref, DNSServiceFlags flags, uint32_t op, ProcessReplyFn ProcessReply, void *AppCallback, void *AppContext)
 {
@@ -513,6 +705,14 @@ static DNSServiceErrorType ConnectToServer(DNSServiceRef *ref, DNSServiceFlags f
         return kDNSServiceErr_BadParam; 
     }
 
+#if !defined(_WIN32)
+    if (!(flags & kDNSServiceFlagsShareConnection) && AutoShareOp(op) && AutoShareEnabled())
+    {
+        DNSServiceOp *const primary = GetAutoSharedConnection();
+        if (primary) { *ref = primary; flags |= kDNSServiceFlagsShareConnection; }
+    }
+#endif
+
     if (flags & kDNSServiceFlagsShareConnection)
     {
         if (!*ref)
@@ -541,32 +741,13 @@ static DNSServiceErrorType ConnectToServer(DNSServiceRef *ref, DNSServiceFlags f
         NumTries = DNSSD_CLIENT_MAXTRIES;
     #endif
 
-    sdr = malloc(sizeof(DNSServiceOp));
+    sdr = NewDNSServiceOp(op, ProcessReply, AppCallback, AppContext);
     if (!sdr) 
     { 
         syslog(LOG_WARNING, "dnssd_clientstub ConnectToServer: malloc failed"); 
         *ref = NULL; 
         return kDNSServiceErr_NoMemory; 
     }
-    sdr->next          = NULL;
-    sdr->primary       = NULL;
-    sdr->sockfd        = dnssd_InvalidSocket;
-    sdr->validator     = sdr->sockfd ^ ValidatorBits;
-    sdr->op            = op;
-    sdr->max_index     = 0;
-    sdr->logcounter    = 0;
-    sdr->moreptr       = NULL;
-    sdr->uid.u32[0]    = 0;
-    sdr->uid.u32[1]    = 0;
-    sdr->ProcessReply  = ProcessReply;
-    sdr->AppCallback   = AppCallback;
-    sdr->AppContext    = AppContext;
-    sdr->rec           = NULL;
-#if _DNS_SD_LIBDISPATCH
-    sdr->disp_source   = NULL;
-    sdr->disp_queue    = NULL;
-#endif
-    sdr->kacontext     = NULL;
     
     if (flags & kDNSServiceFlagsShareConnection)
     {
@@ -694,7 +875,9 @@ static DNSServiceErrorType ConnectToServer(DNSServiceRef *ref, DNSServiceFlags f
 #define deliver_request_bailout(MSG) \
     do { syslog(LOG_WARNING, "dnssd_clientstub deliver_request: %s failed %d (%s)", (MSG), dnssd_errno, dnssd_strerror(dnssd_errno)); goto cleanup; } while(0)
 
-static DNSServiceErrorType deliver_request(ipc_msg_hdr *hdr, DNSServiceOp *sdr)
+// Sends the request and waits for its error code. For a request whose reply carries more than that (so far only
+// reg_record_batch_request), the nresults network order uint32s that follow a kDNSServiceErr_NoError are read into results.
+static DNSServiceErrorType deliver_request_with_results(ipc_msg_hdr *hdr, DNSServiceOp *sdr, uint32_t *results, uint32_t nresults)
 {
     uint32_t datalen;
     dnssd_sock_t listenfd = dnssd_InvalidSocket, errsd = dnssd_InvalidSocket;
@@ -720,8 +903,8 @@ static DNSServiceErrorType deliver_request(ipc_msg_hdr *hdr, DNSServiceOp *sdr)
     // hdr->op contains the code for the specific operation we're currently doing, whereas sdr->op
     // contains the original parent DNSServiceOp (e.g. for an add_record_request, hdr->op will be
     // add_record_request but the parent sdr->op will be connection_request or reg_service_request)
-    MakeSeparateReturnSocket = (sdr->primary ||
-        hdr->op == reg_record_request || hdr->op == add_record_request || hdr->op == update_record_request || hdr->op == remove_record_request);
+    MakeSeparateReturnSocket = (sdr->primary || hdr->op == reg_service_batch_request || hdr->op == query_batch_request ||
+        hdr->op == reg_record_batch_request || hdr->op == reg_record_request || hdr->op == add_record_request || hdr->op == update_record_request || hdr->op == remove_record_request);
 
     if (!DNSServiceRefValid(sdr))
     {
@@ -934,6 +1117,15 @@ static DNSServiceErrorType deliver_request(ipc_msg_hdr *hdr, DNSServiceOp *sdr)
             err = (ioresult == read_all_defunct) ? kDNSServiceErr_DefunctConnection : kDNSServiceErr_ServiceNotRunning; // On failure read_all will have written a message to syslog for us
         else
             err = ntohl(err);
+        if (!err && nresults)
+        {
+            uint32_t i;
+            ioresult = read_all(errsd, (char *)results, (int)(nresults * sizeof(uint32_t)));
+            if (ioresult < read_all_success)
+                err = (ioresult == read_all_defunct) ? kDNSServiceErr_DefunctConnection : kDNSServiceErr_ServiceNotRunning;
+            else
+                for (i = 0; i < nresults; i++) results[i] = ntohl(results[i]);
+        }
     }
     //syslog(LOG_WARNING, "dnssd_clientstub deliver_request: retrieved error code %d", err);
 
@@ -954,6 +1146,11 @@ cleanup:
     return err;
 }
 
+static DNSServiceErrorType deliver_request(ipc_msg_hdr *hdr, DNSServiceOp *sdr)
+{
+    return deliver_request_with_results(hdr, sdr, NULL, 0);
+}
+
 dnssd_sock_t DNSSD_API DNSServiceRefSockFD(DNSServiceRef sdRef)
 {
     if (!sdRef) { syslog(LOG_WARNING, "dnssd_clientstub DNSServiceRefSockFD called with NULL DNSServiceRef"); return dnssd_InvalidSocket; }
@@ -965,7 +1162,11 @@ dnssd_sock_t DNSSD_API DNSServiceRefSockFD(DNSServiceRef sdRef)
         return dnssd_InvalidSocket;
     }
 
-    if (sdRef->primary)
+    if (sdRef->primary
+#if !defined(_WIN32)
+        && !sdRef->primary->autoshared
+#endif
+        )
     {
         syslog(LOG_WARNING, "dnssd_clientstub DNSServiceRefSockFD undefined for kDNSServiceFlagsShareConnection subordinate DNSServiceRef %p", sdRef);
         return dnssd_InvalidSocket;
@@ -1060,6 +1261,11 @@ DNSServiceErrorType DNSSD_API DNSServiceProcessResult(DNSServiceRef sdRef)
         return kDNSServiceErr_BadReference;
     }
 
+#if !defined(_WIN32)
+    // With automatic connection sharing, processing results for any operation means processing the shared connection
+    if (sdRef->primary && sdRef->primary->autoshared) sdRef = sdRef->primary;
+#endif
+
     if (sdRef->primary)
     {
         syslog(LOG_WARNING, "dnssd_clientstub DNSServiceProcessResult undefined for kDNSServiceFlagsShareConnection subordinate DNSServiceRef %p", sdRef);
@@ -1074,16 +1280,35 @@ DNSServiceErrorType DNSSD_API DNSServiceProcessResult(DNSServiceRef sdRef)
         return kDNSServiceErr_BadReference;
     }
 
+    if (!sdRef->readbuf)
+    {
+        sdRef->readbuf = malloc(ReplyBufferSize);
+        if (!sdRef->readbuf) return kDNSServiceErr_NoMemory;
+        sdRef->readlen = 0;
+        sdRef->readpos = 0;
+    }
+
+    // Each pass round this loop dispatches one reply; we keep going for as long as the daemon has more for us,
+    // so an event loop that's woken for a burst of replies gets the whole burst from one DNSServiceProcessResult()
     do
     {
         CallbackHeader cbh;
+        char replybuf[ReplyStackBufferSize];
         char *data;
 
         // return NoError on EWOULDBLOCK. This will handle the case
         // where a non-blocking socket is told there is data, but it was a false positive.
         // On error, read_all will write a message to syslog for us, so don't need to duplicate that here
-        // Note: If we want to properly support using non-blocking sockets in the future
-        ioresult = read_all(sdRef->sockfd, (void *)&cbh.ipc_hdr, sizeof(cbh.ipc_hdr));
+        // A reply that fits in the buffer is only taken from it once the whole reply has arrived, so a non-blocking
+        // socket whose reply is still on its way just leaves what it has buffered for the next call.
+        ioresult = fill_reply_buffer(sdRef, sizeof(cbh.ipc_hdr));
+        if (ioresult == read_all_success)
+        {
+            memcpy(&cbh.ipc_hdr, sdRef->readbuf + sdRef->readpos, sizeof(cbh.ipc_hdr));
+            ConvertHeaderBytes(&cbh.ipc_hdr);
+            if (cbh.ipc_hdr.version == VERSION && cbh.ipc_hdr.datalen <= ReplyBufferSize - sizeof(cbh.ipc_hdr))
+                ioresult = fill_reply_buffer(sdRef, (int)(sizeof(cbh.ipc_hdr) + cbh.ipc_hdr.datalen));
+        }
         if (ioresult == read_all_fail || ioresult == read_all_defunct)
         {
             error = (ioresult == read_all_defunct) ? kDNSServiceErr_DefunctConnection : kDNSServiceErr_ServiceNotRunning;
@@ -1118,17 +1343,18 @@ DNSServiceErrorType DNSSD_API DNSServiceProcessResult(DNSServiceRef sdRef)
             return kDNSServiceErr_NoError;
         }
 
-        ConvertHeaderBytes(&cbh.ipc_hdr);
         if (cbh.ipc_hdr.version != VERSION)
         {
             syslog(LOG_WARNING, "dnssd_clientstub DNSServiceProcessResult daemon version %d does not match client version %d", cbh.ipc_hdr.version, VERSION);
             sdRef->ProcessReply = NULL;
             return kDNSServiceErr_Incompatible;
         }
+        sdRef->readpos += sizeof(cbh.ipc_hdr);    // Header's done with; now take the body
+        sdRef->readlen -= sizeof(cbh.ipc_hdr);
 
-        data = malloc(cbh.ipc_hdr.datalen);
+        data = (cbh.ipc_hdr.datalen <= sizeof(replybuf)) ? replybuf : malloc(cbh.ipc_hdr.datalen);
         if (!data) return kDNSServiceErr_NoMemory;
-        ioresult = read_all(sdRef->sockfd, data, cbh.ipc_hdr.datalen);
+        ioresult = read_reply(sdRef, data, cbh.ipc_hdr.datalen);
         if (ioresult < read_all_success) // On error, read_all will write a message to syslog for us
         {
             error = (ioresult == read_all_defunct) ? kDNSServiceErr_DefunctConnection : kDNSServiceErr_ServiceNotRunning;
@@ -1149,7 +1375,7 @@ DNSServiceErrorType DNSSD_API DNSServiceProcessResult(DNSServiceRef sdRef)
             }
 #endif
             // Don't touch sdRef anymore as it might have been deallocated
-            free(data);
+            if (data != replybuf) free(data);
             return error;
         }
         else
@@ -1162,13 +1388,15 @@ DNSServiceErrorType DNSSD_API DNSServiceProcessResult(DNSServiceRef sdRef)
             // CAUTION: We have to handle the case where the client calls DNSServiceRefDeallocate from within the callback function.
             // To do this we set moreptr to point to morebytes. If the client does call DNSServiceRefDeallocate(),
             // then that routine will clear morebytes for us, and cause us to exit our loop.
-            morebytes = more_bytes(sdRef->sockfd);
+            morebytes = (sdRef->readlen > 0) || more_bytes(sdRef->sockfd);
             if (morebytes)
             {
                 cbh.cb_flags |= kDNSServiceFlagsMoreComing;
                 sdRef->moreptr = &morebytes;
             }
+            mDNS_TRACE2(client__reply__start, cbh.ipc_hdr.op, cbh.ipc_hdr.datalen);
             if (ptr) sdRef->ProcessReply(sdRef, &cbh, ptr, data + cbh.ipc_hdr.datalen);
+            mDNS_TRACE2(client__reply__done, cbh.ipc_hdr.op, cbh.ipc_hdr.datalen);
             // Careful code here:
             // If morebytes is non-zero, that means we set sdRef->moreptr above, and the operation was not
             // cancelled out from under us, so now we need to clear sdRef->moreptr so we don't leave a stray
@@ -1179,7 +1407,7 @@ DNSServiceErrorType DNSSD_API DNSServiceProcessResult(DNSServiceRef sdRef)
             //     so we MUST NOT try to dereference our stale sdRef pointer.
             if (morebytes) sdRef->moreptr = NULL;
         }
-        free(data);
+        if (data != replybuf) free(data);
     } while (morebytes);
 
     return kDNSServiceErr_NoError;
@@ -1200,7 +1428,8 @@ void DNSSD_API DNSServiceRefDeallocate(DNSServiceRef sdRef)
 
     if (sdRef->primary)     // If this is a subordinate DNSServiceOp, just send a 'stop' command
     {
-        DNSServiceOp **p = &sdRef->primary->next;
+        DNSServiceOp *const primary = sdRef->primary;
+        DNSServiceOp **p = &primary->next;
         while (*p && *p != sdRef) p = &(*p)->next;
         if (*p)
         {
@@ -1215,6 +1444,15 @@ void DNSSD_API DNSServiceRefDeallocate(DNSServiceRef sdRef)
             }
             *p = sdRef->next;
             FreeDNSServiceOp(sdRef);
+#if !defined(_WIN32)
+            // A dead automatically shared connection that's been replaced goes when its last operation does
+            if (primary->autoshared && !primary->next)
+            {
+                pthread_mutex_lock(&AutoSharedConnectionLock);
+                if (primary != AutoSharedConnection) DNSServiceRefDeallocate(primary);
+                pthread_mutex_unlock(&AutoSharedConnectionLock);
+            }
+#endif
         }
     }
     else                    // else, make sure to terminate all subordinates as well
@@ -1299,6 +1537,13 @@ DNSServiceErrorType DNSSD_API DNSServiceGetProperty(const char *property, void *
     if (!strcmp(property, kDNSServiceProperty_DaemonVersion) && *size >= 4)
         *(uint32_t*)result = ntohl(*(uint32_t*)result);
 
+    // Statistics are an array of 32-bit words, all in network byte order
+    if (!strcmp(property, kDNSServiceProperty_Statistics))
+    {
+        uint32_t i, words = (actualsize < *size ? actualsize : *size) / sizeof(uint32_t);
+        for (i = 0; i < words; i++) ((uint32_t*)result)[i] = ntohl(((uint32_t*)result)[i]);
+    }
+
     *size = actualsize;
     return kDNSServiceErr_NoError;
 }
@@ -1455,10 +1700,26 @@ static void handle_query_response(DNSServiceOp *const sdr, const CallbackHeader
 #endif
     uint32_t ttl;
     char name[kDNSServiceMaxDomainName];
+    const char *fullname = name;
+    DNSServiceFlags flags = cbh->cb_flags;
     uint16_t rrtype, rrclass, rdlen;
     const char *rdata;
 
-    get_string(&data, end, name, kDNSServiceMaxDomainName);
+    // A wire-format name is handed to the callback where it lies. One that came as a string (from a daemon that
+    // doesn't know kDNSServiceFlagsWireFormat, or in an error result) is converted, so the caller always gets what it asked for.
+    if (flags & kDNSServiceFlagsWireFormat) fullname = get_wire_name(&data, end);
+    else
+    {
+        get_string(&data, end, name, kDNSServiceMaxDomainName);
+        if (data && sdr->wireformat)
+        {
+            uint8_t wirename[IPC_MAX_WIRE_NAME];
+            const int wirelen = put_wire_name_from_string(name, wirename, NULL);
+            if (wirelen < 0) data = NULL;
+            else memcpy(name, wirename, (size_t)wirelen);
+            flags |= kDNSServiceFlagsWireFormat;
+        }
+    }
     rrtype  = get_uint16(&data, end);
     rrclass = get_uint16(&data, end);
     rdlen   = get_uint16(&data, end);
@@ -1466,7 +1727,7 @@ static void handle_query_response(DNSServiceOp *const sdr, const CallbackHeader
     ttl     = get_uint32(&data, end);
 
     if (!data) syslog(LOG_WARNING, "dnssd_clientstub handle_query_response: error reading result from daemon");
-    else ((DNSServiceQueryRecordReply)sdr->AppCallback)(sdr, cbh->cb_flags, cbh->cb_interface, cbh->cb_err, name, rrtype, rrclass, rdlen, rdata, ttl, sdr->AppContext);
+    else ((DNSServiceQueryRecordReply)sdr->AppCallback)(sdr, flags, cbh->cb_interface, cbh->cb_err, fullname, rrtype, rrclass, rdlen, rdata, ttl, sdr->AppContext);
     // MUST NOT touch sdr after invoking AppCallback -- client is allowed to dispose it from within callback function
 }
 
@@ -1501,41 +1762,36 @@ static void put_tlvs_for_defaults(const xpc_object_t defaults, ipc_msg_hdr *cons
 }
 #endif
 
-DNSServiceErrorType DNSSD_API DNSServiceQueryRecord
-(
-    DNSServiceRef              *sdRef,
-    DNSServiceFlags flags,
-    uint32_t interfaceIndex,
-    const char                 *name,
-    uint16_t rrtype,
-    uint16_t rrclass,
-    DNSServiceQueryRecordReply callBack,
-    void                       *context
-)
+// IPC version negotiation (see IPC_VERSION_2 in dnssd_ipc.h). Until we know better, a query on a connection of its
+// own goes to the daemon as version 2. A daemon that predates version 2 drops the connection instead of answering, so
+// if that happens we remember it and send the query again, as version 1, on a new connection. A query on a shared
+// connection is only sent as version 2 once the daemon has accepted one, as a refusal would take the whole connection
+// down with it. (A daemon that goes away just as a version 2 query is sent looks like a refusal too, which costs
+// nothing but version 2 for the rest of this process.)
+enum { ipc_version_2_unknown, ipc_version_2_accepted, ipc_version_2_refused };
+static int gIPCVersion2 = ipc_version_2_unknown;
+
+static ipc_msg_hdr *create_query_hdr(DNSServiceOp *const sdr, DNSServiceFlags flags, uint32_t interfaceIndex, const char *name,
+                                     uint16_t rrtype, uint16_t rrclass, const uint8_t *const wirename, const int wirelen, const int absolute)
 {
     char *ptr;
     size_t len;
     ipc_msg_hdr *hdr;
-    DNSServiceErrorType err;
 #if APPLE_OSX_mDNSResponder
     xpc_object_t defaults;
 #endif
-    // NULL name handled below.
-    if (!sdRef || !callBack) return kDNSServiceErr_BadParam;
-
-    if ((interfaceIndex == kDNSServiceInterfaceIndexAny) && includeP2PWithIndexAny())
-        flags |= kDNSServiceFlagsIncludeP2P;
-
-    err = ConnectToServer(sdRef, flags, query_request, handle_query_response, callBack, context);
-    if (err) return err;    // On error ConnectToServer leaves *sdRef set to NULL
-
-    if (!name) name = "\0";
 
     // Calculate total message length
     len = sizeof(flags);
     len += sizeof(uint32_t);  // interfaceIndex
-    len += strlen(name) + 1;
     len += 2 * sizeof(uint16_t);  // rrtype, rrclass
+    if (wirename)
+    {
+        len += get_required_tlv16_length((uint16_t)wirelen);
+        if (absolute) len += get_required_tlv16_length(sizeof(uint8_t));
+    }
+    else
+        len += strlen(name) + 1;
 #if APPLE_OSX_mDNSResponder
     defaults = DNSServiceGetRetainedResolverDefaults();
     if (defaults)
@@ -1543,21 +1799,32 @@ DNSServiceErrorType DNSSD_API DNSServiceQueryRecord
         len += get_required_length_for_defaults(defaults);
     }
 #endif
-    hdr = create_hdr(query_request, &len, &ptr, (*sdRef)->primary ? 1 : 0, *sdRef);
+    hdr = create_hdr(query_request, &len, &ptr, sdr->primary ? 1 : 0, sdr);
     if (!hdr)
     {
-        DNSServiceRefDeallocate(*sdRef);
-        *sdRef = NULL;
 #if APPLE_OSX_mDNSResponder
         xpc_forget(&defaults);
 #endif
-        return kDNSServiceErr_NoMemory;
+        return NULL;
     }
     put_flags(flags, &ptr);
     put_uint32(interfaceIndex, &ptr);
-    put_string(name, &ptr);
-    put_uint16(rrtype, &ptr);
-    put_uint16(rrclass, &ptr);
+    if (wirename)
+    {
+        const uint8_t absolute_byte = 1;
+        hdr->version = IPC_VERSION_2;
+        put_uint16(rrtype, &ptr);
+        put_uint16(rrclass, &ptr);
+        put_tlv16(IPC_TLV_TYPE_NAME, (uint16_t)wirelen, wirename, &ptr);
+        if (absolute) put_tlv16(IPC_TLV_TYPE_NAME_IS_ABSOLUTE, sizeof(absolute_byte), &absolute_byte, &ptr);
+        hdr->ipc_flags |= IPC_FLAGS_TRAILING_TLVS;
+    }
+    else
+    {
+        put_string(name, &ptr);
+        put_uint16(rrtype, &ptr);
+        put_uint16(rrclass, &ptr);
+    }
 #if APPLE_OSX_mDNSResponder
     if (defaults)
     {
@@ -1565,7 +1832,61 @@ DNSServiceErrorType DNSSD_API DNSServiceQueryRecord
         xpc_forget(&defaults);
     }
 #endif
-    err = deliver_request(hdr, *sdRef);     // Will free hdr for us
+    return hdr;
+}
+
+DNSServiceErrorType DNSSD_API DNSServiceQueryRecord
+(
+    DNSServiceRef              *sdRef,
+    DNSServiceFlags flags,
+    uint32_t interfaceIndex,
+    const char                 *name,
+    uint16_t rrtype,
+    uint16_t rrclass,
+    DNSServiceQueryRecordReply callBack,
+    void                       *context
+)
+{
+    ipc_msg_hdr *hdr;
+    DNSServiceErrorType err;
+    uint8_t wirename[IPC_MAX_WIRE_NAME];
+    int wirelen, absolute, v2;
+    // NULL name handled below.
+    if (!sdRef || !callBack) return kDNSServiceErr_BadParam;
+
+    if ((interfaceIndex == kDNSServiceInterfaceIndexAny) && includeP2PWithIndexAny())
+        flags |= kDNSServiceFlagsIncludeP2P;
+
+    if (!name) name = "\0";
+
+    // A name that doesn't convert goes as version 1, so the daemon reports it exactly as it always has
+    wirelen = put_wire_name_from_string(name, wirename, &absolute);
+
+    for (;;)
+    {
+        err = ConnectToServer(sdRef, flags, query_request, handle_query_response, callBack, context);
+        if (err) return err;    // On error ConnectToServer leaves *sdRef set to NULL
+        (*sdRef)->wireformat = (flags & kDNSServiceFlagsWireFormat) ? 1 : 0;
+
+        v2 = (wirelen > 0) && (gIPCVersion2 == ipc_version_2_accepted ||
+                               (gIPCVersion2 == ipc_version_2_unknown && !(*sdRef)->primary));
+        hdr = create_query_hdr(*sdRef, flags, interfaceIndex, name, rrtype, rrclass, v2 ? wirename : NULL, wirelen, absolute);
+        if (!hdr)
+        {
+            DNSServiceRefDeallocate(*sdRef);
+            *sdRef = NULL;
+            return kDNSServiceErr_NoMemory;
+        }
+        err = deliver_request(hdr, *sdRef);     // Will free hdr for us
+        if (!v2 || gIPCVersion2 != ipc_version_2_unknown || err != kDNSServiceErr_ServiceNotRunning)
+        {
+            if (v2 && !err) gIPCVersion2 = ipc_version_2_accepted;
+            break;
+        }
+        gIPCVersion2 = ipc_version_2_refused;
+        DNSServiceRefDeallocate(*sdRef);
+        *sdRef = NULL;
+    }
 #if CHECK_BUNDLE_VERSION
     if (err == kDNSServiceErr_NoAuth && !_should_return_noauth_error())
     {
@@ -1576,6 +1897,330 @@ DNSServiceErrorType DNSSD_API DNSServiceQueryRecord
     return err;
 }
 
+static DNSServiceFlags query_batch_flags(const DNSServiceQueryRecordBatchEntry *const e)
+{
+    DNSServiceFlags flags = e->flags | kDNSServiceFlagsShareConnection;
+    if ((e->interfaceIndex == kDNSServiceInterfaceIndexAny) && includeP2PWithIndexAny())
+        flags |= kDNSServiceFlagsIncludeP2P;
+    return flags;
+}
+
+DNSServiceErrorType DNSSD_API DNSServiceQueryRecordBatch
+(
+    DNSServiceRef sdRef,
+    DNSServiceRef                          *sdRefs,
+    uint32_t count,
+    const DNSServiceQueryRecordBatchEntry  *entries
+)
+{
+    char *ptr;
+    size_t len;
+    ipc_msg_hdr *hdr;
+    uint32_t i;
+    DNSServiceErrorType err = kDNSServiceErr_NoError;
+
+    if (!sdRef || !sdRefs || !entries || !count) return kDNSServiceErr_BadParam;
+    if (!DNSServiceRefValid(sdRef) || sdRef->op != connection_request)
+    {
+        syslog(LOG_WARNING, "dnssd_clientstub DNSServiceQueryRecordBatch called with invalid or non-shared DNSServiceRef %p", sdRef);
+        return kDNSServiceErr_BadReference;
+    }
+    for (i = 0; i < count; i++)
+    {
+        sdRefs[i] = NULL;
+        if (!entries[i].callBack) return kDNSServiceErr_BadParam;
+    }
+
+    len = sizeof(uint32_t);   // count
+    for (i = 0; i < count; i++)
+    {
+        const DNSServiceQueryRecordBatchEntry *const e = &entries[i];
+        sdRefs[i] = sdRef;
+        err = ConnectToServer(&sdRefs[i], query_batch_flags(e), query_request, handle_query_response, e->callBack, e->context);
+        if (err) { sdRefs[i] = NULL; goto fail; }
+        sdRefs[i]->wireformat = (e->flags & kDNSServiceFlagsWireFormat) ? 1 : 0;
+        len += sizeof(client_context_t) + 2 * sizeof(uint32_t);   // client context, ipc flags, body length
+        len += sizeof(DNSServiceFlags) + sizeof(uint32_t) + strlen(e->fullname ? e->fullname : "") + 1 + 2 * sizeof(uint16_t);
+    }
+
+    hdr = create_hdr(query_batch_request, &len, &ptr, 1, sdRef);
+    if (!hdr) { err = kDNSServiceErr_NoMemory; goto fail; }
+
+    put_uint32(count, &ptr);
+    for (i = 0; i < count; i++)
+    {
+        const DNSServiceQueryRecordBatchEntry *const e = &entries[i];
+        const char *const name = e->fullname ? e->fullname : "";
+
+        memcpy(ptr, &sdRefs[i]->uid, sizeof(client_context_t));
+        ptr += sizeof(client_context_t);
+        put_uint32(0, &ptr);    // ipc flags
+        put_uint32((uint32_t)(sizeof(DNSServiceFlags) + sizeof(uint32_t) + strlen(name) + 1 + 2 * sizeof(uint16_t)), &ptr);
+        put_flags(query_batch_flags(e), &ptr);
+        put_uint32(e->interfaceIndex, &ptr);
+        put_string(name, &ptr);
+        put_uint16(e->rrtype, &ptr);
+        put_uint16(e->rrclass, &ptr);
+    }
+
+    err = deliver_request(hdr, sdRef);      // Will free hdr for us
+    if (!err) return kDNSServiceErr_NoError;
+
+fail:
+    for (i = 0; i < count; i++)
+        if (sdRefs[i]) { DNSServiceRefDeallocate(sdRefs[i]); sdRefs[i] = NULL; }
+    return err;
+}
+
+static void handle_addrinfo_response(DNSServiceOp *const sdr, const CallbackHeader *const cbh, const char *data, const char *const end);
+
+#if !defined(_WIN32)
+// Optional in-process cache of DNSServiceGetAddrInfo() answers, for clients that look up the same hosts over and over.
+// It's enabled by setting the DNSSD_ADDRINFO_CACHE environment variable to anything other than "0".
+// Answers are cached as they arrive for daemon-backed DNSServiceGetAddrInfo() calls, keyed by the hostname, protocol
+// and interface index the client asked for, and kept for the TTL the daemon reported. A remove event for an answer
+// (e.g. the host has gone away) drops it from the cache straight away. A later DNSServiceGetAddrInfo() call with the
+// same key, while any of its answers are still live, gets a DNSServiceRef whose socket is already primed with those
+// answers, so it's answered as soon as the client calls DNSServiceProcessResult(), without contacting the daemon.
+// Such a DNSServiceRef only ever delivers the cached answers; it receives no further add or remove events.
+// When the in-process cache has nothing for a lookup, the daemon's shared cache export (dnssd_sharedcache.h) is
+// consulted the same way, so a process's first lookup of a host the daemon already knows about needn't wait either.
+// Calls using kDNSServiceFlagsShareConnection are never answered from the cache, since their replies arrive on the
+// shared connection's socket.
+
+#define ADDRINFO_CACHE_ENVVAR "DNSSD_ADDRINFO_CACHE"
+#define AddrInfoCacheMaxEntries 256
+
+typedef struct AddrInfoCacheEntry_struct AddrInfoCacheEntry;
+struct AddrInfoCacheEntry_struct
+{
+    AddrInfoCacheEntry *next;
+    char *key;                          // Hostname the client asked for (compared case-insensitively)
+    uint32_t protocol;
+    uint32_t interfaceIndex;
+    char *hostname;                     // Hostname as returned in the answer
+    uint32_t cb_interface;
+    uint16_t rrtype;
+    uint16_t rdlen;
+    unsigned char rdata[16];            // Large enough for an IPv6 address
+    time_t expires;
+};
+
+static pthread_mutex_t AddrInfoCacheLock = PTHREAD_MUTEX_INITIALIZER;
+static AddrInfoCacheEntry *AddrInfoCache = NULL;
+
+static int AddrInfoCacheEnabled(void)
+{
+    static int enabled = -1;
+    if (enabled < 0)
+    {
+        const char *const value = getenv(ADDRINFO_CACHE_ENVVAR);
+        enabled = (value && *value && strcmp(value, "0")) ? 1 : 0;
+    }
+    return enabled;
+}
+
+static int AddrInfoCacheKeyMatches(const AddrInfoCacheEntry *const e, const char *const hostname, const uint32_t protocol, const uint32_t interfaceIndex)
+{
+    return (e->protocol == protocol && e->interfaceIndex == interfaceIndex && !strcasecmp(e->key, hostname));
+}
+
+static void FreeAddrInfoCacheEntry(AddrInfoCacheEntry *const e)
+{
+    free(e->key);
+    free(e->hostname);
+    free(e);
+}
+
+// Called with each A or AAAA answer delivered to a daemon-backed DNSServiceGetAddrInfo() operation
+static void AddrInfoCacheUpdate(const AddrInfoCacheKey *const key, const CallbackHeader *const cbh, const char *const hostname,
+                                const uint16_t rrtype, const uint16_t rdlen, const char *const rdata, const uint32_t ttl)
+{
+    const time_t now = time(NULL);
+    AddrInfoCacheEntry **p = &AddrInfoCache;
+    int count = 0;
+
+    if (rdlen > sizeof(((AddrInfoCacheEntry *)0)->rdata)) return;
+
+    pthread_mutex_lock(&AddrInfoCacheLock);
+    while (*p)
+    {
+        AddrInfoCacheEntry *const e = *p;
+        // Drop expired entries, any existing copy of this answer, and anything beyond our size limit
+        if (e->expires <= now || count >= AddrInfoCacheMaxEntries - 1 ||
+            (AddrInfoCacheKeyMatches(e, key->hostname, key->protocol, key->interfaceIndex) && e->cb_interface == cbh->cb_interface &&
+             e->rrtype == rrtype && e->rdlen == rdlen && !memcmp(e->rdata, rdata, rdlen)))
+        {
+            *p = e->next;
+            FreeAddrInfoCacheEntry(e);
+        }
+        else
+        {
+            p = &e->next;
+            count++;
+        }
+    }
+    if ((cbh->cb_flags & kDNSServiceFlagsAdd) && ttl)
+    {
+        AddrInfoCacheEntry *const e = calloc(1, sizeof(*e));
+        if (e) { e->key = strdup(key->hostname); e->hostname = strdup(hostname); }
+        if (!e || !e->key || !e->hostname)
+        {
+            if (e) FreeAddrInfoCacheEntry(e);
+        }
+        else
+        {
+            e->protocol       = key->protocol;
+            e->interfaceIndex = key->interfaceIndex;
+            e->cb_interface   = cbh->cb_interface;
+            e->rrtype         = rrtype;
+            e->rdlen          = rdlen;
+            memcpy(e->rdata, rdata, rdlen);
+            e->expires        = now + ttl;
+            e->next           = AddrInfoCache;  // Newest first, so the size limit evicts the oldest
+            AddrInfoCache     = e;
+        }
+    }
+    pthread_mutex_unlock(&AddrInfoCacheLock);
+}
+
+// Builds the replies for the daemon's shared cache entries for this lookup, setting *end past the last one,
+// or returns NULL if there are none
+static char *AddrInfoSharedCacheReplies(const uint32_t interfaceIndex, const uint32_t protocol, const char *const hostname, char **end)
+{
+    static const uint16_t rrtypes[2] = { kDNSServiceType_A, kDNSServiceType_AAAA };
+    dnssd_shared_cache_addr addrs[2][8];
+    const size_t namelen = strlen(hostname);
+    const int dot = (namelen && hostname[namelen - 1] == '.');
+    int found[2] = { 0, 0 };
+    char *msgs, *ptr;
+    size_t len = 0;
+    int t, i;
+
+    for (t = 0; t < 2; t++)
+    {
+        const uint32_t want = (t == 0) ? kDNSServiceProtocol_IPv4 : kDNSServiceProtocol_IPv6;
+        if (protocol && !(protocol & want)) continue;
+        found[t] = dnssd_shared_cache_lookup(hostname, rrtypes[t], interfaceIndex, addrs[t], (int)(sizeof(addrs[t]) / sizeof(addrs[t][0])));
+        if (found[t] < 0) return NULL;      // No shared cache at all
+        len += (size_t)found[t] * (sizeof(ipc_msg_hdr) + 3 * sizeof(uint32_t) + namelen + 2 + 3 * sizeof(uint16_t) + 16 + sizeof(uint32_t));
+    }
+    if (!len || !(msgs = malloc(len))) return NULL;
+
+    // The hostname is reported the way the daemon would, as a fully qualified name
+    ptr = msgs;
+    for (t = 0; t < 2; t++)
+        for (i = 0; i < found[t]; i++)
+        {
+            const uint16_t rdlen = (rrtypes[t] == kDNSServiceType_A) ? 4 : 16;
+            ipc_msg_hdr *const hdr = (ipc_msg_hdr *)ptr;
+            memset(hdr, 0, sizeof(*hdr));
+            hdr->version = VERSION;
+            hdr->op      = addrinfo_reply_op;
+            ptr += sizeof(ipc_msg_hdr);
+            put_flags(kDNSServiceFlagsAdd, &ptr);
+            put_uint32(addrs[t][i].ifindex, &ptr);
+            put_uint32(kDNSServiceErr_NoError, &ptr);
+            memcpy(ptr, hostname, namelen);
+            ptr += namelen;
+            if (!dot) *ptr++ = '.';
+            *ptr++ = 0;
+            put_uint16(rrtypes[t], &ptr);
+            put_uint16(kDNSServiceClass_IN, &ptr);
+            put_uint16(rdlen, &ptr);
+            put_rdata(rdlen, addrs[t][i].addr, &ptr);
+            put_uint32(addrs[t][i].ttl, &ptr);
+            hdr->datalen = (uint32_t)(ptr - (char *)hdr - sizeof(ipc_msg_hdr));
+            ConvertHeaderBytes(hdr);
+        }
+    *end = ptr;
+    return msgs;
+}
+
+// If the cache holds live answers for this lookup, sets *sdRef to a DNSServiceRef that will deliver them
+// and returns 1. Otherwise returns 0 and the caller goes to the daemon as usual.
+static int AddrInfoCacheAnswer(DNSServiceRef *sdRef, const uint32_t interfaceIndex, const uint32_t protocol, const char *const hostname,
+                               DNSServiceGetAddrInfoReply callBack, void *context)
+{
+    const time_t now = time(NULL);
+    const AddrInfoCacheEntry *e;
+    char *msgs = NULL, *ptr;
+    size_t len = 0;
+    dnssd_sock_t fds[2];
+    DNSServiceOp *sdr;
+    int i, ok;
+
+    pthread_mutex_lock(&AddrInfoCacheLock);
+    for (e = AddrInfoCache; e; e = e->next)
+        if (e->expires > now && AddrInfoCacheKeyMatches(e, hostname, protocol, interfaceIndex))
+            len += sizeof(ipc_msg_hdr) + 3 * sizeof(uint32_t) + strlen(e->hostname) + 1 + 3 * sizeof(uint16_t) + e->rdlen + sizeof(uint32_t);
+    if (len) msgs = malloc(len);
+    ptr = msgs;
+    if (msgs)
+    {
+        // Exactly the replies the daemon would have sent (see queryrecord_result_reply), with the TTLs aged
+        for (e = AddrInfoCache; e; e = e->next)
+            if (e->expires > now && AddrInfoCacheKeyMatches(e, hostname, protocol, interfaceIndex))
+            {
+                ipc_msg_hdr *const hdr = (ipc_msg_hdr *)ptr;
+                memset(hdr, 0, sizeof(*hdr));
+                hdr->version = VERSION;
+                hdr->op      = addrinfo_reply_op;
+                ptr += sizeof(ipc_msg_hdr);
+                put_flags(kDNSServiceFlagsAdd, &ptr);
+                put_uint32(e->cb_interface, &ptr);
+                put_uint32(kDNSServiceErr_NoError, &ptr);
+                put_string(e->hostname, &ptr);
+                put_uint16(e->rrtype, &ptr);
+                put_uint16(kDNSServiceClass_IN, &ptr);
+                put_uint16(e->rdlen, &ptr);
+                put_rdata(e->rdlen, e->rdata, &ptr);
+                put_uint32((uint32_t)(e->expires - now), &ptr);
+                hdr->datalen = (uint32_t)(ptr - (char *)hdr - sizeof(ipc_msg_hdr));
+                ConvertHeaderBytes(hdr);
+            }
+    }
+    pthread_mutex_unlock(&AddrInfoCacheLock);
+    if (!msgs) msgs = AddrInfoSharedCacheReplies(interfaceIndex, protocol, hostname, &ptr);
+    if (!msgs) return 0;
+
+    sdr = NewDNSServiceOp(addrinfo_request, handle_addrinfo_response, callBack, context);
+    if (sdr) sdr->aikey = calloc(1, sizeof(AddrInfoCacheKey));
+    if (sdr && sdr->aikey) sdr->aikey->peer = dnssd_InvalidSocket;
+    ok = (sdr && sdr->aikey && socketpair(AF_LOCAL, SOCK_STREAM, 0, fds) == 0);
+    if (ok)
+    {
+        for (i = 0; i < 2; i++) fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+        sdr->sockfd       = fds[0];
+        sdr->validator    = sdr->sockfd ^ ValidatorBits;
+        sdr->aikey->peer  = fds[1];             // Kept open until the DNSServiceRef is deallocated, so the client never sees EOF
+        ok = (write_all(fds[1], msgs, ptr - msgs) == write_all_success);
+    }
+    free(msgs);
+    if (!ok)
+    {
+        if (sdr && dnssd_SocketValid(sdr->sockfd)) dnssd_close(sdr->sockfd);
+        if (sdr) FreeDNSServiceOp(sdr);     // Also closes aikey->peer
+        return 0;
+    }
+    *sdRef = sdr;
+    return 1;
+}
+
+// Attaches the lookup's key to a daemon-backed DNSServiceGetAddrInfo() operation, so its answers are cached
+static void AddrInfoCacheAttach(DNSServiceOp *const sdr, const uint32_t interfaceIndex, const uint32_t protocol, const char *const hostname)
+{
+    AddrInfoCacheKey *const key = calloc(1, sizeof(*key));
+    if (!key) return;
+    key->hostname = strdup(hostname);
+    if (!key->hostname) { free(key); return; }
+    key->protocol       = protocol;
+    key->interfaceIndex = interfaceIndex;
+    key->peer           = dnssd_InvalidSocket;
+    sdr->aikey          = key;
+}
+#endif // !defined(_WIN32)
+
 static void handle_addrinfo_response(DNSServiceOp *const sdr, const CallbackHeader *const cbh, const char *data, const char *const end)
 {
 #if CHECK_BUNDLE_VERSION
@@ -1634,6 +2279,12 @@ static void handle_addrinfo_response(DNSServiceOp *const sdr, const CallbackHead
             }
         }
 
+#if !defined(_WIN32)
+        // Feed the addrinfo cache from daemon-backed operations (but not from those it answered itself)
+        if (sdr->aikey && !dnssd_SocketValid(sdr->aikey->peer) && !cbh->cb_err)
+            AddrInfoCacheUpdate(sdr->aikey, cbh, hostname, rrtype, rdlen, rdata, ttl);
+#endif
+
 		((DNSServiceGetAddrInfoReply)sdr->AppCallback)(sdr, cbh->cb_flags, cbh->cb_interface, cbh->cb_err, hostname, sa, ttl, sdr->AppContext);
     }
     else if (cbh->cb_err == kDNSServiceErr_PolicyDenied)
@@ -1663,11 +2314,20 @@ DNSServiceErrorType DNSSD_API DNSServiceGetAddrInfo
 
     if (!sdRef || !hostname || !callBack) return kDNSServiceErr_BadParam;
 
+#if !defined(_WIN32)
+    if (AddrInfoCacheEnabled() && !(flags & kDNSServiceFlagsShareConnection) &&
+        AddrInfoCacheAnswer(sdRef, interfaceIndex, protocol, hostname, callBack, context))
+        return kDNSServiceErr_NoError;
+#endif
+
     err = ConnectToServer(sdRef, flags, addrinfo_request, handle_addrinfo_response, callBack, context);
     if (err)
     {
          return err;    // On error ConnectToServer leaves *sdRef set to NULL
     }
+#if !defined(_WIN32)
+    if (AddrInfoCacheEnabled()) AddrInfoCacheAttach(*sdRef, interfaceIndex, protocol, hostname);
+#endif
 
     // Calculate total message length
     len = sizeof(flags);
@@ -1890,6 +2550,101 @@ DNSServiceErrorType DNSSD_API DNSServiceRegister
     return err;
 }
 
+static DNSServiceFlags regservice_batch_flags(const DNSServiceRegisterBatchEntry *const e)
+{
+    DNSServiceFlags flags = e->flags | kDNSServiceFlagsShareConnection;
+    if ((e->interfaceIndex == kDNSServiceInterfaceIndexAny) && includeP2PWithIndexAny())
+        flags |= kDNSServiceFlagsIncludeP2P;
+    return flags;
+}
+
+static size_t regservice_body_len(const DNSServiceRegisterBatchEntry *const e, const char *const name, const char *const domain, const char *const host)
+{
+    size_t len = sizeof(DNSServiceFlags);
+    len += sizeof(uint32_t);  // interfaceIndex
+    len += strlen(name) + strlen(e->regtype) + strlen(domain) + strlen(host) + 4;
+    len += 2 * sizeof(uint16_t);  // port, txtLen
+    len += e->txtLen;
+    return len;
+}
+
+DNSServiceErrorType DNSSD_API DNSServiceRegisterBatch
+(
+    DNSServiceRef sdRef,
+    DNSServiceRef                       *sdRefs,
+    uint32_t count,
+    const DNSServiceRegisterBatchEntry  *entries
+)
+{
+    char *ptr;
+    size_t len;
+    ipc_msg_hdr *hdr;
+    uint32_t i;
+    DNSServiceErrorType err = kDNSServiceErr_NoError;
+
+    if (!sdRef || !sdRefs || !entries || !count) return kDNSServiceErr_BadParam;
+    if (!DNSServiceRefValid(sdRef) || sdRef->op != connection_request)
+    {
+        syslog(LOG_WARNING, "dnssd_clientstub DNSServiceRegisterBatch called with invalid or non-shared DNSServiceRef %p", sdRef);
+        return kDNSServiceErr_BadReference;
+    }
+    for (i = 0; i < count; i++)
+    {
+        sdRefs[i] = NULL;
+        if (!entries[i].regtype) return kDNSServiceErr_BadParam;
+        // No callback must have auto-rename
+        if (!entries[i].callBack && (entries[i].flags & kDNSServiceFlagsNoAutoRename)) return kDNSServiceErr_BadParam;
+    }
+
+    len = sizeof(uint32_t);   // count
+    for (i = 0; i < count; i++)
+    {
+        const DNSServiceRegisterBatchEntry *const e = &entries[i];
+        sdRefs[i] = sdRef;
+        err = ConnectToServer(&sdRefs[i], regservice_batch_flags(e), reg_service_request, e->callBack ? handle_regservice_response : NULL, e->callBack, e->context);
+        if (err) { sdRefs[i] = NULL; goto fail; }
+        len += sizeof(client_context_t) + 2 * sizeof(uint32_t);   // client context, ipc flags, body length
+        len += regservice_body_len(e, e->name ? e->name : "", e->domain ? e->domain : "", e->host ? e->host : "");
+    }
+
+    hdr = create_hdr(reg_service_batch_request, &len, &ptr, 1, sdRef);
+    if (!hdr) { err = kDNSServiceErr_NoMemory; goto fail; }
+
+    put_uint32(count, &ptr);
+    for (i = 0; i < count; i++)
+    {
+        const DNSServiceRegisterBatchEntry *const e = &entries[i];
+        const char *const name   = e->name   ? e->name   : "";
+        const char *const domain = e->domain ? e->domain : "";
+        const char *const host   = e->host   ? e->host   : "";
+        const void *const txt    = e->txtRecord ? e->txtRecord : (const void *)"";
+        union { uint16_t s; u_char b[2]; } port = { e->port };
+
+        memcpy(ptr, &sdRefs[i]->uid, sizeof(client_context_t));
+        ptr += sizeof(client_context_t);
+        put_uint32(e->callBack ? 0 : IPC_FLAGS_NOREPLY, &ptr);
+        put_uint32((uint32_t)regservice_body_len(e, name, domain, host), &ptr);
+        put_flags(regservice_batch_flags(e), &ptr);
+        put_uint32(e->interfaceIndex, &ptr);
+        put_string(name, &ptr);
+        put_string(e->regtype, &ptr);
+        put_string(domain, &ptr);
+        put_string(host, &ptr);
+        *ptr++ = port.b[0];
+        *ptr++ = port.b[1];
+        put_uint16(e->txtLen, &ptr);
+        put_rdata(e->txtLen, txt, &ptr);
+    }
+
+    err = deliver_request(hdr, sdRef);      // Will free hdr for us
+    if (!err) return kDNSServiceErr_NoError;
+
+fail:
+    for (i = 0; i < count; i++)
+        if (sdRefs[i]) { DNSServiceRefDeallocate(sdRefs[i]); sdRefs[i] = NULL; }
+    return err;
+}
+
 static void handle_enumeration_response(DNSServiceOp *const sdr, const CallbackHeader *const cbh, const char *data, const char *const end)
 {
     char domain[kDNSServiceMaxDomainName];
@@ -2190,6 +2945,155 @@ DNSServiceErrorType DNSSD_API DNSServiceRegisterRecord
     return err;
 }
 
+static int regrecord_flags_valid(const DNSServiceFlags flags)
+{
+    // Exactly one of these must be set
+    const int f1 = (flags & kDNSServiceFlagsShared) != 0;
+    const int f2 = (flags & kDNSServiceFlagsUnique) != 0;
+    const int f3 = (flags & kDNSServiceFlagsKnownUnique) != 0;
+    return (f1 + f2 + f3 == 1);
+}
+
+static DNSServiceFlags regrecord_batch_flags(const DNSServiceRegisterRecordBatchEntry *const e)
+{
+    DNSServiceFlags flags = e->flags;
+    if ((e->interfaceIndex == kDNSServiceInterfaceIndexAny) && includeP2PWithIndexAny())
+        flags |= kDNSServiceFlagsIncludeP2P;
+    return flags;
+}
+
+static size_t regrecord_body_len(const DNSServiceRegisterRecordBatchEntry *const e)
+{
+    size_t len = sizeof(DNSServiceFlags);
+    len += 2 * sizeof(uint32_t);  // interfaceIndex, ttl
+    len += 3 * sizeof(uint16_t);  // rrtype, rrclass, rdlen
+    len += strlen(e->fullname) + 1;
+    len += e->rdlen;
+    return len;
+}
+
+DNSServiceErrorType DNSSD_API DNSServiceRegisterRecordBatch
+(
+    DNSServiceRef sdRef,
+    DNSRecordRef                              *RecordRefs,
+    uint32_t count,
+    const DNSServiceRegisterRecordBatchEntry  *entries,
+    DNSServiceErrorType                       *errors
+)
+{
+    char *ptr;
+    size_t len;
+    ipc_msg_hdr *hdr;
+    uint32_t i, *results;
+    DNSRecord **p;
+    DNSServiceErrorType err;
+
+    if (!sdRef || !RecordRefs || !entries || !count) return kDNSServiceErr_BadParam;
+    if (!DNSServiceRefValid(sdRef) || (sdRef->op != connection_request && sdRef->op != connection_delegate_request))
+    {
+        syslog(LOG_WARNING, "dnssd_clientstub DNSServiceRegisterRecordBatch called with invalid or non-DNSServiceCreateConnection DNSServiceRef %p", sdRef);
+        return kDNSServiceErr_BadReference;
+    }
+    for (i = 0; i < count; i++) RecordRefs[i] = NULL;
+    for (i = 0; i < count; i++)
+    {
+        const DNSServiceRegisterRecordBatchEntry *const e = &entries[i];
+        if (!regrecord_flags_valid(e->flags) || !e->fullname || (!e->rdata && e->rdlen) || !e->callBack) return kDNSServiceErr_BadParam;
+    }
+
+    results = malloc(count * sizeof(uint32_t));
+    if (!results) return kDNSServiceErr_NoMemory;
+
+    len = sizeof(uint32_t);   // count
+    for (i = 0; i < count; i++)
+    {
+        len += sizeof(client_context_t) + 2 * sizeof(uint32_t);   // client context, record index, body length
+        len += regrecord_body_len(&entries[i]);
+    }
+    hdr = create_hdr(reg_record_batch_request, &len, &ptr, 1, sdRef);
+    if (!hdr) { free(results); return kDNSServiceErr_NoMemory; }
+
+    put_uint32(count, &ptr);
+    for (i = 0; i < count; i++)
+    {
+        const DNSServiceRegisterRecordBatchEntry *const e = &entries[i];
+        DNSRecordRef rref = malloc(sizeof(DNSRecord));
+        if (!rref) { err = kDNSServiceErr_NoMemory; goto fail; }
+
+        // Each record gets its own uid, as in DNSServiceRegisterRecord, so that ConnectionResponse can find it
+        if (++sdRef->uid.u32[0] == 0)
+            ++sdRef->uid.u32[1];
+        rref->AppContext   = e->context;
+        rref->AppCallback  = e->callBack;
+        rref->record_index = sdRef->max_index++;
+        rref->sdr          = sdRef;
+        rref->recnext      = NULL;
+        rref->uid          = sdRef->uid;
+        RecordRefs[i]      = rref;
+
+        memcpy(ptr, &rref->uid, sizeof(client_context_t));
+        ptr += sizeof(client_context_t);
+        put_uint32(rref->record_index, &ptr);
+        put_uint32((uint32_t)regrecord_body_len(e), &ptr);
+        put_flags(regrecord_batch_flags(e), &ptr);
+        put_uint32(e->interfaceIndex, &ptr);
+        put_string(e->fullname, &ptr);
+        put_uint16(e->rrtype, &ptr);
+        put_uint16(e->rrclass, &ptr);
+        put_uint16(e->rdlen, &ptr);
+        put_rdata(e->rdlen, e->rdata, &ptr);
+        put_uint32(e->ttl, &ptr);
+    }
+
+    // Link the records in before the request goes out, since their callbacks may arrive straight afterwards
+    p = &sdRef->rec;
+    while (*p) p = &(*p)->recnext;
+    for (i = 0; i < count; i++) { *p = RecordRefs[i]; p = &RecordRefs[i]->recnext; }
+
+    err = deliver_request_with_results(hdr, sdRef, results, count);     // Will free hdr for us
+    hdr = NULL;
+#if CHECK_BUNDLE_VERSION
+    if (err == kDNSServiceErr_NoAuth && !_should_return_noauth_error())
+    {
+        err = kDNSServiceErr_NoError;
+        memset(results, 0, count * sizeof(uint32_t));
+    }
+#endif
+    if (!err)
+    {
+        for (i = 0; i < count; i++)
+        {
+            DNSServiceErrorType result = (DNSServiceErrorType)results[i];
+#if CHECK_BUNDLE_VERSION
+            if (result == kDNSServiceErr_NoAuth && !_should_return_noauth_error()) result = kDNSServiceErr_NoError;
+#endif
+            if (errors) errors[i] = result;
+            if (result)
+            {
+                // A record the daemon didn't take is never called back, so it needn't stay on the list
+                for (p = &sdRef->rec; *p && *p != RecordRefs[i]; p = &(*p)->recnext) continue;
+                if (*p) *p = RecordRefs[i]->recnext;
+                free(RecordRefs[i]);
+                RecordRefs[i] = NULL;
+            }
+        }
+        free(results);
+        return kDNSServiceErr_NoError;
+    }
+
+fail:
+    if (hdr) free(hdr);
+    for (i = 0; i < count && RecordRefs[i]; i++)
+    {
+        for (p = &sdRef->rec; *p && *p != RecordRefs[i]; p = &(*p)->recnext) continue;
+        if (*p) *p = RecordRefs[i]->recnext;
+        free(RecordRefs[i]);
+        RecordRefs[i] = NULL;
+    }
+    free(results);
+    return err;
+}
+
 // sdRef returned by DNSServiceRegister()
 DNSServiceErrorType DNSSD_API DNSServiceAddRecord
 (
@@ -167,8 +167,115 @@ void put_tlv16(const uint16_t type, const uint16_t length, const uint8_t *value,
 	mdns_tlv16_set(dst, NULL, type, length, value, &dst);
     *ptr = (char *)dst;
 }
+
+const uint8_t *get_tlv16(const uint8_t *start, const uint8_t *end, uint16_t type, uint16_t *length)
+{
+    size_t len = 0;
+    const uint8_t *value = NULL;
+    if (mdns_tlv16_get_value(start, end, type, &len, &value, NULL) != 0) return NULL;
+    if (length) *length = (uint16_t)len;
+    return value;
+}
+#else
+// Same layout as mdns_tlv16: two-byte type and two-byte length, both big-endian, then the value.
+size_t get_required_tlv16_length(const uint16_t valuelen)
+{
+    return 2 * sizeof(uint16_t) + valuelen;
+}
+
+void put_tlv16(const uint16_t type, const uint16_t length, const uint8_t *value, char **ptr)
+{
+    put_uint16(type, ptr);
+    put_uint16(length, ptr);
+    if (length) memcpy(*ptr, value, length);
+    *ptr += length;
+}
+
+const uint8_t *get_tlv16(const uint8_t *start, const uint8_t *end, uint16_t type, uint16_t *length)
+{
+    const uint8_t *ptr = start;
+    while (ptr && end - ptr >= 4)
+    {
+        const uint16_t tlvtype = (uint16_t)((ptr[0] << 8) | ptr[1]);
+        const uint16_t tlvlen  = (uint16_t)((ptr[2] << 8) | ptr[3]);
+        const uint8_t *const value = ptr + 4;
+        if (end - value < tlvlen) break;
+        if (tlvtype == type)
+        {
+            if (length) *length = tlvlen;
+            return value;
+        }
+        ptr = value + tlvlen;
+    }
+    return NULL;
+}
 #endif
 
+#define ipc_IsDigit(X) ((X) >= '0' && (X) <= '9')
+
+int put_wire_name_from_string(const char *str, uint8_t *wire, int *absolute)
+{
+    uint8_t *ptr = wire;
+    const uint8_t *const lim = wire + IPC_MAX_WIRE_NAME - 1;   // Limit of how much we can add (not counting final zero)
+    if (absolute) *absolute = 0;
+    while (*str && ptr < lim)
+    {
+        uint8_t *const lengthbyte = ptr++;
+        if (*str == '.') return -1;                             // Illegal empty label
+        while (*str && *str != '.' && ptr < lim)
+        {
+            uint8_t c = (uint8_t)*str++;
+            if (c == '\\')
+            {
+                if (*str == '\0') break;
+                c = (uint8_t)*str++;
+                if (ipc_IsDigit(str[-1]) && ipc_IsDigit(str[0]) && ipc_IsDigit(str[1]))
+                {
+                    const int val = (str[-1] - '0') * 100 + (str[0] - '0') * 10 + (str[1] - '0');
+                    if (val <= 255) { c = (uint8_t)val; str += 2; }
+                }
+            }
+            *ptr++ = c;
+        }
+        if (*str == '.' && *++str == '\0' && absolute) *absolute = 1;
+        if (ptr - lengthbyte - 1 > 63) return -1;              // Illegal label length
+        *lengthbyte = (uint8_t)(ptr - lengthbyte - 1);
+    }
+    *ptr++ = 0;                                                 // Root label
+    if (*str) return -1;                                        // Didn't consume all input
+    return (int)(ptr - wire);
+}
+
+int get_wire_name_length(const uint8_t *name, size_t len)
+{
+    size_t i = 0;
+    while (i < len && i < IPC_MAX_WIRE_NAME)
+    {
+        if (name[i] == 0) return (i + 1 == len) ? (int)len : -1;
+        if (name[i] > 63) return -1;
+        i += 1 + name[i];
+    }
+    return -1;
+}
+
+const char *get_wire_name(const char **ptr, const char *end)
+{
+    const uint8_t *const name = (const uint8_t *)*ptr;
+    size_t i = 0;
+    while (name && (const char *)name + i < end && i < IPC_MAX_WIRE_NAME)
+    {
+        if (name[i] == 0)
+        {
+            *ptr += i + 1;
+            return((const char *)name);
+        }
+        if (name[i] > 63) break;
+        i += 1 + name[i];
+    }
+    *ptr = NULL;
+    return(0);
+}
+
 void ConvertHeaderBytes(ipc_msg_hdr *hdr)
 {
     hdr->version   = htonl(hdr->version);
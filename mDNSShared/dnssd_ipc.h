@@ -99,12 +99,32 @@ extern char *win32_strerror(int inErrorCode);
 #define TXT_RECORD_INDEX ((uint32_t)(-1))   // record index for default text record
 
 // IPC data encoding constants and types
+//
+// IPC_VERSION_2 requests have the same ipc_msg_hdr as version 1 requests, with version set to IPC_VERSION_2. Their
+// bodies start with the request's fixed-size fields, and carry everything else, names included, as trailing TLVs.
+// Names are uncompressed wire-format names, so the daemon copies them straight into its questions instead of parsing
+// escaped C strings. Requests that have no version 2 layout of their own (all but query_request, so far) keep their
+// version 1 body, and the entries of a query_batch_request are always version 1. Replies are always version 1, except
+// that a query_reply_op with kDNSServiceFlagsWireFormat set in its flags carries the record's name as an uncompressed
+// wire-format name instead of a C string.
+//
+// query_request, version 2:
+//     flags (uint32), interface index (uint32), rrtype (uint16), rrclass (uint16), and then the TLVs:
+//     IPC_TLV_TYPE_NAME (required), IPC_TLV_TYPE_NAME_IS_ABSOLUTE, and any other IPC_TLV_TYPE_* options.
+//
+// A daemon that predates version 2 closes any connection whose header carries a version it doesn't know, so the
+// client library only relies on version 2 once a request made that way has been accepted (see dnssd_clientstub.c).
 #define VERSION 1
+#define IPC_VERSION_2 2
 #define IPC_FLAGS_NOREPLY       (1U << 0) // Set flag if no asynchronous replies are to be sent to client.
 #define IPC_FLAGS_TRAILING_TLVS (1U << 1) // Set flag if TLVs follow the standard request data.
 
 #define IPC_TLV_TYPE_RESOLVER_CONFIG_PLIST_DATA 1   // An nw_resolver_config as a binary property list.
 #define IPC_TLV_TYPE_REQUIRE_PRIVACY            2   // A uint8. Non-zero means privacy is required, zero means not required.
+#define IPC_TLV_TYPE_NAME                       3   // An uncompressed wire-format domain name.
+#define IPC_TLV_TYPE_NAME_IS_ABSOLUTE           4   // A uint8. Non-zero means the name was given with a trailing dot.
+
+#define IPC_MAX_WIRE_NAME 256   // Longest legal wire-format domain name, including the root label
 
 // Structure packing macro. If we're not using GNUC, it's not fatal. Most compilers naturally pack the on-the-wire
 // structures correctly anyway, so a plain "struct" is usually fine. In the event that structures are not packed
@@ -141,6 +161,9 @@ typedef enum
     getpid_request,
     release_request,
     connection_delegate_request,
+    reg_service_batch_request, // Several reg_service_requests on a shared connection, for DNSServiceRegisterBatch()
+    query_batch_request,       // Several query_requests on a shared connection, for DNSServiceQueryRecordBatch()
+    reg_record_batch_request,  // Several reg_record_requests, for DNSServiceRegisterRecordBatch()
 
     cancel_request = 63
 } request_op_t;
@@ -211,10 +234,20 @@ void put_rdata(const int rdlen, const unsigned char *rdata, char **ptr);
 const char *get_rdata(const char **ptr, const char *end, int rdlen);  // return value is rdata pointed to by *ptr -
 // rdata is not copied from buffer.
 
-#if APPLE_OSX_mDNSResponder
 size_t get_required_tlv16_length(const uint16_t valuelen);
 void put_tlv16(const uint16_t type, const uint16_t length, const uint8_t *value, char **ptr);
-#endif
+const uint8_t *get_tlv16(const uint8_t *start, const uint8_t *end, uint16_t type, uint16_t *length);
+// return value is the value of the first TLV of that type in [start, end), or NULL if there's none -
+// the value is not copied from buffer.
+
+// Converts an escaped, dot-separated name to wire format in wire, which must have room for IPC_MAX_WIRE_NAME bytes.
+// Takes the same syntax as the daemon's MakeDomainNameFromDNSNameString(). Returns the length of the wire-format name,
+// or -1 if str is not a legal name. If absolute is non-NULL, it's set to whether str ends with an unescaped dot.
+int put_wire_name_from_string(const char *str, uint8_t *wire, int *absolute);
+int get_wire_name_length(const uint8_t *name, size_t len);  // return value is len if the len bytes at name are exactly
+// one legal wire-format name, otherwise -1.
+const char *get_wire_name(const char **ptr, const char *end);  // return value is the wire-format name at *ptr -
+// the name is not copied from buffer. Like get_rdata, sets *ptr to NULL if there's no legal name there.
 
 void ConvertHeaderBytes(ipc_msg_hdr *hdr);
 
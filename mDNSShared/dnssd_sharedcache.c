@@ -0,0 +1,153 @@
+/* -*- Mode: C; tab-width: 4 -*-
+ *
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Client side of the daemon's shared cache export (see dnssd_sharedcache.h)
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "dnssd_sharedcache.h"
+
+#define SHARED_CACHE_ENVVAR "DNSSD_SHARED_CACHE"
+#define SharedCacheRetrySeconds 5   // How long to wait before trying again to map a missing or stale table
+#define SharedCacheReadTries 8      // Give up on a slot the writer keeps changing under us
+
+static pthread_mutex_t SharedCacheLock = PTHREAD_MUTEX_INITIALIZER;
+static const dnssd_shared_cache *SharedCache = NULL;
+static uint32_t SharedCacheLastTry = 0;
+static int SharedCacheTried = 0;
+
+static uint32_t SharedCacheNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)ts.tv_sec;
+}
+
+// Whether the daemon is still keeping t up to date: it clears open as it exits, and refreshes published once a second
+static int SharedCacheLive(const dnssd_shared_cache *t, uint32_t now)
+{
+    return __atomic_load_n(&t->open, __ATOMIC_ACQUIRE) &&
+           (int32_t)(now - __atomic_load_n(&t->published, __ATOMIC_ACQUIRE)) <= DNSSD_SHARED_CACHE_STALE;
+}
+
+static const dnssd_shared_cache *SharedCacheMap(void)
+{
+    const dnssd_shared_cache *c;
+    const uint32_t now = SharedCacheNow();
+
+    pthread_mutex_lock(&SharedCacheLock);
+    // A table the daemon has stopped updating is dropped (but not unmapped, since other threads may still be reading it;
+    // that's one small leak per daemon restart) and we look for its successor
+    if (SharedCache && !SharedCacheLive(SharedCache, now)) SharedCache = NULL;
+    if (!SharedCache && (!SharedCacheTried || now - SharedCacheLastTry >= SharedCacheRetrySeconds))
+    {
+        const char *path = getenv(SHARED_CACHE_ENVVAR);
+        struct stat st;
+        int fd;
+
+        SharedCacheTried   = 1;
+        SharedCacheLastTry = now;
+        if (!path || !*path) path = DNSSD_SHARED_CACHE_PATH;
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0)
+        {
+            if (fstat(fd, &st) == 0 && st.st_size == (off_t)sizeof(dnssd_shared_cache))
+            {
+                void *const p = mmap(NULL, sizeof(dnssd_shared_cache), PROT_READ, MAP_SHARED, fd, 0);
+                if (p != MAP_FAILED)
+                {
+                    const dnssd_shared_cache *const t = (const dnssd_shared_cache *)p;
+                    if (t->magic == DNSSD_SHARED_CACHE_MAGIC && t->version == DNSSD_SHARED_CACHE_VERSION &&
+                        t->slots == DNSSD_SHARED_CACHE_SLOTS && t->slot_size == sizeof(dnssd_shared_cache_slot) &&
+                        SharedCacheLive(t, now))
+                        SharedCache = t;
+                    else
+                        munmap(p, sizeof(dnssd_shared_cache));
+                }
+            }
+            close(fd);
+        }
+    }
+    c = SharedCache;
+    pthread_mutex_unlock(&SharedCacheLock);
+    return c;
+}
+
+// Copies the first len bytes of a slot, returning 0 if we couldn't get a consistent copy
+static int SharedCacheReadSlot(const dnssd_shared_cache_slot *s, dnssd_shared_cache_slot *copy, size_t len)
+{
+    int i;
+    for (i = 0; i < SharedCacheReadTries; i++)
+    {
+        const uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) continue;
+        memcpy(copy, s, len);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) == seq) return 1;
+    }
+    return 0;
+}
+
+int dnssd_shared_cache_lookup(const char *hostname, uint16_t rrtype, uint32_t ifindex,
+                              dnssd_shared_cache_addr *addrs, int max)
+{
+    const dnssd_shared_cache *const c = SharedCacheMap();
+    char name[DNSSD_SHARED_CACHE_NAMELEN];
+    uint32_t hash, now;
+    size_t len;
+    int i, n = 0;
+
+    if (!c) return -1;
+
+    // Names are stored in lower case, without the trailing dot
+    len = strlen(hostname);
+    if (len && hostname[len - 1] == '.') len--;
+    if (!len || len >= sizeof(name)) return 0;
+    for (i = 0; i < (int)len; i++) name[i] = (hostname[i] >= 'A' && hostname[i] <= 'Z') ? (char)(hostname[i] + 'a' - 'A') : hostname[i];
+    name[len] = 0;
+
+    hash = DNSSDSharedCacheHash(name, rrtype);
+    now  = SharedCacheNow();
+    for (i = 0; i < DNSSD_SHARED_CACHE_PROBES && n < max; i++)
+    {
+        const dnssd_shared_cache_slot *const s = &c->slot[(hash + i) & (DNSSD_SHARED_CACHE_SLOTS - 1)];
+        dnssd_shared_cache_slot copy;
+
+        // Look at the fixed fields first, and only copy the name out of slots that might be ours
+        if (!SharedCacheReadSlot(s, &copy, offsetof(dnssd_shared_cache_slot, name))) continue;
+        if (!copy.rrtype) break;
+        if (!copy.expires || copy.hash != hash || copy.rrtype != rrtype || copy.expires <= now) continue;
+        if (ifindex && copy.ifindex != ifindex) continue;
+        if (!SharedCacheReadSlot(s, &copy, sizeof(copy))) continue;
+        copy.name[sizeof(copy.name) - 1] = 0;
+        if (copy.hash != hash || copy.rrtype != rrtype || copy.expires <= now || strcmp(copy.name, name)) continue;
+
+        addrs[n].ifindex = copy.ifindex;
+        addrs[n].ttl     = copy.expires - now;
+        memcpy(addrs[n].addr, copy.addr, sizeof(addrs[n].addr));
+        n++;
+    }
+    return n;
+}
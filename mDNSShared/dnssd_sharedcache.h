@@ -0,0 +1,100 @@
+/* -*- Mode: C; tab-width: 4 -*-
+ *
+ * Copyright (c) 2026 Apple Inc. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DNSSD_SHAREDCACHE_H
+#define DNSSD_SHAREDCACHE_H
+
+#include <stdint.h>
+
+// Read-only shared export of the daemon's fresh multicast A and AAAA records.
+//
+// With -sharedcache, the Posix mdnsd keeps a fixed-size open-addressed table of the address records in its cache in a
+// file it maps shared (DNSSD_SHARED_CACHE_PATH, or DNSSD_SHARED_CACHE environment variable in the clients), refreshed
+// once a second. Clients map the same file read-only and answer hot host name lookups from it without a round trip
+// to the daemon; anything not found there still goes over the usual IPC. The table is a snapshot, so an entry can
+// outlive the record by up to a second if the record goes away early (goodbye packet, interface change), and never
+// outlives the record's own TTL.
+//
+// Each slot is guarded by a sequence count: the writer makes it odd before changing the slot and even again after, and
+// a reader copies the slot out and keeps the copy only if the count was even and unchanged across the copy. Slots are
+// placed by DNSSDSharedCacheHash and found by linear probing over at most DNSSD_SHARED_CACHE_PROBES slots; a slot
+// whose rrtype is zero has never been used and ends the probe, one whose expires is zero has been freed and doesn't.
+// The daemon clears the header's open flag just before it exits and unlinks the file, so readers know to map afresh.
+// It also stamps the header with the time of each refresh, and a reader stops trusting a table that hasn't been
+// refreshed for DNSSD_SHARED_CACHE_STALE seconds, since one left behind by a daemon that crashed still looks open.
+
+#ifndef DNSSD_SHARED_CACHE_PATH
+#define DNSSD_SHARED_CACHE_PATH "/var/run/mdnsd.cache"
+#endif
+
+#define DNSSD_SHARED_CACHE_MAGIC    0x6D445343  // 'mDSC'
+#define DNSSD_SHARED_CACHE_VERSION  2
+#define DNSSD_SHARED_CACHE_SLOTS    1024        // Power of two
+#define DNSSD_SHARED_CACHE_PROBES   16
+#define DNSSD_SHARED_CACHE_NAMELEN  256         // Lower case, dotted, no trailing dot, NUL terminated
+#define DNSSD_SHARED_CACHE_STALE    5           // Seconds without a refresh after which readers drop the table
+
+typedef struct
+{
+    uint32_t seq;                               // Odd while the writer is changing the slot
+    uint32_t hash;                              // DNSSDSharedCacheHash of name and rrtype
+    uint32_t expires;                           // CLOCK_MONOTONIC seconds; zero for a freed slot
+    uint32_t ifindex;
+    uint16_t rrtype;                            // 1 (A) or 28 (AAAA); zero for a never-used slot
+    uint16_t reserved;
+    uint32_t generation;                        // Writer's bookkeeping: the refresh that last saw this record
+    uint8_t  addr[16];                          // Four bytes used for an A record
+    char     name[DNSSD_SHARED_CACHE_NAMELEN];
+} dnssd_shared_cache_slot;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slots;
+    uint32_t slot_size;
+    uint32_t open;                              // Cleared when the daemon stops updating the table
+    uint32_t pid;                               // The daemon's, for diagnostics
+    uint32_t published;                         // CLOCK_MONOTONIC seconds of the daemon's last refresh
+    uint32_t reserved;
+    dnssd_shared_cache_slot slot[DNSSD_SHARED_CACHE_SLOTS];
+} dnssd_shared_cache;
+
+// FNV-1a over the name (already lower case) and the rrtype
+static inline uint32_t DNSSDSharedCacheHash(const char *name, uint16_t rrtype)
+{
+    uint32_t h = 2166136261U;
+    while (*name) { h ^= (uint8_t)*name++; h *= 16777619U; }
+    h ^= rrtype & 0xFF;  h *= 16777619U;
+    h ^= rrtype >> 8;    h *= 16777619U;
+    return(h);
+}
+
+typedef struct
+{
+    uint32_t ifindex;
+    uint32_t ttl;                               // Seconds remaining
+    uint8_t  addr[16];
+} dnssd_shared_cache_addr;
+
+// Copies up to max addresses of type rrtype (1 or 28) cached for hostname into addrs, considering only those learned
+// on ifindex unless it's zero. Returns the number copied, or -1 if there is no shared cache to consult (the daemon isn't
+// exporting one, or has stopped), in which case the caller should ask the daemon. Thread safe.
+extern int dnssd_shared_cache_lookup(const char *hostname, uint16_t rrtype, uint32_t ifindex,
+                                     dnssd_shared_cache_addr *addrs, int max);
+
+#endif // DNSSD_SHAREDCACHE_H
@@ -31,6 +31,9 @@ mDNSexport int mDNS_LoggingEnabled       = 0;
 mDNSexport int mDNS_PacketLoggingEnabled = 0;
 mDNSexport int mDNS_McastLoggingEnabled  = 0;
 mDNSexport int mDNS_McastTracingEnabled  = 0; 
+#if !MDNSRESPONDER_SUPPORTS(APPLE, OS_LOG)
+mDNSexport int mDNS_LogLevel             = MDNS_LOG_DEBUG;
+#endif
 
 #if MDNS_DEBUGMSGS
 mDNSexport int mDNS_DebugMode = mDNStrue;
@@ -61,11 +64,410 @@ mDNSlocal void LogMsgWithLevelv(os_log_t category, os_log_type_t level, const ch
     os_log_with_type(category ? category : mDNSLogCategory_Default, level, "%{private}s", buffer);
 }
 #else
+
+#if defined(__GNUC__)
+#define MDNS_LOG_RING_SUPPORTED 1
+#else
+#define MDNS_LOG_RING_SUPPORTED 0
+#endif
+
+#if MDNS_LOG_RING_SUPPORTED
+// The log ring lets hot paths hand a message off without formatting it. Each entry holds the format string
+// pointer (every caller passes a literal, so it doubles as the message ID) and a binary copy of the arguments.
+// Arguments passed by pointer -- strings, domain names, addresses, hex dumps -- are copied by value, because
+// callers commonly pass buffers they reuse straight away, like the m->MsgBuffer behind CRDisplayString().
+// Entries are formatted with mDNS_vsnprintf and written out by mDNSLogRingDrain(), which the daemon calls
+// from its event loop when it is about to go idle, so the formatting and the syslog() call happen off the
+// packet processing path. Producers claim slots with compare-and-swap, so messages logged from other
+// threads are fine; only one thread drains at a time.
+
+#define MDNS_LOG_RING_ENTRIES   256     // Must be a power of two
+#define MDNS_LOG_RING_DATA_SIZE 512     // The same as the formatted message buffer
+
+typedef struct
+{
+    mDNSu32 seq;                        // == position when free, position + 1 once the entry is filled in
+    mDNSLogLevel_t level;
+    mDNSLogCategory_t category;
+    const char *format;
+    mDNSu32 length;
+    mDNSu8 data[MDNS_LOG_RING_DATA_SIZE];
+} LogRingEntry;
+
+typedef struct
+{
+    mDNSu32 tail;                       // Next position for producers
+    mDNSu32 head;                       // Next position to drain; only touched while holding 'draining'
+    mDNSu32 draining;
+    mDNSu32 dropped;
+    LogRingEntry entries[MDNS_LOG_RING_ENTRIES];
+} LogRing;
+
+mDNSlocal LogRing *gLogRing = mDNSNULL;
+
+// mDNS_vsnprintf conversion spec, as far as the ring needs to understand it
+typedef struct
+{
+    int altForm;
+    int havePrecision;
+    int lSize;
+    unsigned int precision;
+    int conv;
+} LogRingSpec;
+
+// Walks the flags, width, precision and length modifiers the same way mDNS_vsnprintf does, calling 'star'
+// for each '*' so the caller can either capture or replay the int argument it stands for.
+mDNSlocal const char *LogRingParseSpec(const char *fmt, LogRingSpec *spec, unsigned int (*star)(void *), void *context)
+{
+    int c;
+    mDNSPlatformMemZero(spec, sizeof(*spec));
+    while ((c = *++fmt) == '-' || c == '+' || c == ' ' || c == '#' || c == '0')
+        if (c == '#') spec->altForm++;
+    if (c == '*') { (void)star(context); c = *++fmt; }
+    else while (c >= '0' && c <= '9') c = *++fmt;
+    if (c == '.')
+    {
+        spec->havePrecision = 1;
+        if ((c = *++fmt) == '*') { spec->precision = star(context); c = *++fmt; }
+        else for (; c >= '0' && c <= '9'; c = *++fmt) spec->precision = (10 * spec->precision) + (c - '0');
+    }
+    for (; c == 'h' || c == 'l' || c == 'L'; c = *++fmt)
+        if (c != 'h') spec->lSize = 1;
+    spec->conv = c;
+    return(fmt);
+}
+
+typedef struct
+{
+    va_list args;
+    mDNSu8 *ptr;
+    mDNSu8 *lim;
+    mDNSBool overflow;
+} LogRingWriter;
+
+mDNSlocal void LogRingPut(LogRingWriter *w, const void *src, mDNSu32 len)
+{
+    if (len > (mDNSu32)(w->lim - w->ptr)) { w->overflow = mDNStrue; return; }
+    mDNSPlatformMemCopy(w->ptr, src, len);
+    w->ptr += len;
+}
+
+mDNSlocal unsigned int LogRingCaptureStar(void *context)
+{
+    LogRingWriter *const w = (LogRingWriter *)context;
+    const int value = va_arg(w->args, int);
+    LogRingPut(w, &value, sizeof(value));
+    return((unsigned int)value);
+}
+
+// Pointer arguments are stored as a 16-bit length followed by the bytes; 0xFFFF marks a NULL pointer
+#define LOG_RING_NULL_PTR 0xFFFF
+
+mDNSlocal void LogRingPutBytes(LogRingWriter *w, const mDNSu8 *src, mDNSu32 len, mDNSBool terminate)
+{
+    const mDNSu8 zero = 0;
+    mDNSu16 stored = src ? (mDNSu16)(len + (terminate ? 1 : 0)) : LOG_RING_NULL_PTR;
+    if (src && len > MDNS_LOG_RING_DATA_SIZE) { w->overflow = mDNStrue; return; }
+    LogRingPut(w, &stored, sizeof(stored));
+    if (!src) return;
+    LogRingPut(w, src, len);
+    if (terminate) LogRingPut(w, &zero, 1);
+}
+
+// Copies the arguments 'format' asks for, consuming a copy of 'args' exactly as mDNS_vsnprintf would.
+// Returns false if they don't all fit.
+mDNSlocal mDNSBool LogRingCapture(const char *format, va_list args, LogRingEntry *entry)
+{
+    LogRingWriter w;
+    const char *fmt;
+    va_copy(w.args, args);
+    w.ptr = entry->data;
+    w.lim = entry->data + sizeof(entry->data);
+    w.overflow = mDNSfalse;
+
+    for (fmt = format; *fmt && !w.overflow; fmt++)
+    {
+        LogRingSpec spec;
+        if (*fmt != '%') continue;
+        fmt = LogRingParseSpec(fmt, &spec, LogRingCaptureStar, &w);
+        switch (spec.conv)
+        {
+            case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'p':
+            {
+                const unsigned long n = (spec.lSize || spec.conv == 'p') ? va_arg(w.args, unsigned long) : va_arg(w.args, unsigned int);
+                LogRingPut(&w, &n, sizeof(n));
+                break;
+            }
+            case 'c':
+            {
+                const int n = va_arg(w.args, int);
+                LogRingPut(&w, &n, sizeof(n));
+                break;
+            }
+            case 'a':
+            {
+                const mDNSu8 *const a = va_arg(w.args, const mDNSu8 *);
+                mDNSu32 len = 0;
+                if (spec.altForm) len = sizeof(mDNSAddr);
+                else if (spec.precision == 4 || spec.precision == 6 || spec.precision == 16) len = spec.precision;
+                LogRingPutBytes(&w, a, len, mDNSfalse);
+                break;
+            }
+            case 's':
+            {
+                const mDNSu8 *const s = va_arg(w.args, const mDNSu8 *);
+                mDNSu32 len = 0;
+                if (s) switch (spec.altForm)
+                {
+                    case 0:  while (s[len] && (!spec.havePrecision || len < spec.precision)) len++;
+                             break;
+                    case 1:  len = 1 + (mDNSu32)s[0];
+                             break;
+                    default: // Copy the labels up to the root label, or up to a bad label length so it still gets reported
+                             while (s[len] && len < MAX_DOMAIN_NAME)
+                             {
+                                 if (s[len] > MAX_DOMAIN_LABEL) { len++; break; }
+                                 len += 1 + s[len];
+                             }
+                             if (len > MAX_DOMAIN_NAME) len = MAX_DOMAIN_NAME;
+                             break;
+                }
+                LogRingPutBytes(&w, s, len, spec.altForm != 1);
+                break;
+            }
+            case 'H':
+            {
+                const mDNSu8 *const h = va_arg(w.args, const mDNSu8 *);
+                LogRingPutBytes(&w, h, spec.havePrecision ? spec.precision : 0, mDNSfalse);
+                break;
+            }
+            case 'n':
+                (void)va_arg(w.args, void *);   // Nothing is written when the message is only formatted later
+                break;
+            case 0:
+                fmt--;
+                break;
+            default:
+                break;
+        }
+    }
+
+    va_end(w.args);
+    entry->length = (mDNSu32)(w.ptr - entry->data);
+    return(!w.overflow);
+}
+
+typedef struct
+{
+    const mDNSu8 *ptr;
+    const mDNSu8 *lim;
+} LogRingReader;
+
+mDNSlocal mDNSBool LogRingGet(LogRingReader *r, void *dst, mDNSu32 len)
+{
+    if (len > (mDNSu32)(r->lim - r->ptr)) { mDNSPlatformMemZero(dst, len); r->ptr = r->lim; return(mDNSfalse); }
+    mDNSPlatformMemCopy(dst, r->ptr, len);
+    r->ptr += len;
+    return(mDNStrue);
+}
+
+mDNSlocal const mDNSu8 *LogRingGetBytes(LogRingReader *r)
+{
+    mDNSu16 stored;
+    const mDNSu8 *bytes;
+    if (!LogRingGet(r, &stored, sizeof(stored)) || stored == LOG_RING_NULL_PTR) return(mDNSNULL);
+    if (stored > (mDNSu32)(r->lim - r->ptr)) { r->ptr = r->lim; return(mDNSNULL); }
+    bytes = r->ptr;
+    r->ptr += stored;
+    return(bytes);
+}
+
+mDNSlocal unsigned int LogRingSkipStar(void *context)
+{
+    (void)context;
+    return(0);
+}
+
+// Replays a captured message: literal text is copied, and each conversion is handed to mDNS_vsnprintf on its
+// own with the captured argument, so every conversion prints exactly as it would have at the call site
+mDNSlocal void LogRingFormat(char *dst, const char *const lim, const char *format, const mDNSu8 *data, mDNSu32 length)
+{
+    LogRingReader r;
+    const char *fmt;
+    r.ptr = data;
+    r.lim = data + length;
+
+    for (fmt = format; *fmt && dst < lim - 1; fmt++)
+    {
+        char spec[64];
+        char *sp = spec;
+        const char *const specLim = &spec[sizeof(spec)];
+        const char *src;
+        LogRingSpec parsed;
+
+        if (*fmt != '%') { *dst++ = *fmt; continue; }
+
+        // Rebuild the spec with the captured '*' width and precision written in as numbers
+        src = fmt;
+        fmt = LogRingParseSpec(fmt, &parsed, LogRingSkipStar, mDNSNULL);
+        for (; src <= fmt && sp < specLim - 12; src++)
+        {
+            if (*src == '*')
+            {
+                int value;
+                (void)LogRingGet(&r, &value, sizeof(value));
+                mDNS_snprintf_add(&sp, specLim, "%d", value);
+            }
+            else *sp++ = *src;
+        }
+        *sp = 0;
+
+        switch (parsed.conv)
+        {
+            case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'p':
+            {
+                unsigned long n;
+                (void)LogRingGet(&r, &n, sizeof(n));
+                if (parsed.lSize || parsed.conv == 'p') mDNS_snprintf_add(&dst, lim, spec, n);
+                else mDNS_snprintf_add(&dst, lim, spec, (unsigned int)n);
+                break;
+            }
+            case 'c':
+            {
+                int n;
+                (void)LogRingGet(&r, &n, sizeof(n));
+                mDNS_snprintf_add(&dst, lim, spec, n);
+                break;
+            }
+            case 'a': case 's': case 'H':
+                mDNS_snprintf_add(&dst, lim, spec, LogRingGetBytes(&r));
+                break;
+            case 'n':
+                break;
+            default:
+                mDNS_snprintf_add(&dst, lim, spec);
+                break;
+        }
+        if (parsed.conv == 0) fmt--;
+    }
+    *dst = 0;
+}
+
+// Returns the entry claimed for the next message, or NULL if the ring is full
+mDNSlocal LogRingEntry *LogRingClaim(LogRing *ring)
+{
+    mDNSu32 pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    for (;;)
+    {
+        LogRingEntry *const entry = &ring->entries[pos & (MDNS_LOG_RING_ENTRIES - 1)];
+        const mDNSs32 dif = (mDNSs32)(__atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE) - pos);
+        if (dif == 0)
+        {
+            if (__atomic_compare_exchange_n(&ring->tail, &pos, pos + 1, mDNSfalse, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                return(entry);
+        }
+        else if (dif < 0) return(mDNSNULL);
+        else pos = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    }
+}
+
+// Writes out everything recorded so far. Returns without doing anything if another thread is already draining.
+mDNSexport void mDNSLogRingDrain(void)
+{
+    LogRing *const ring = gLogRing;
+    mDNSu32 dropped;
+    if (!ring || __atomic_exchange_n(&ring->draining, 1, __ATOMIC_ACQUIRE)) return;
+
+    for (;;)
+    {
+        LogRingEntry *const entry = &ring->entries[ring->head & (MDNS_LOG_RING_ENTRIES - 1)];
+        char buffer[512];
+        char *dst = buffer;
+        const char *const lim = &buffer[512];
+        if (__atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE) != ring->head + 1) break;
+        if (entry->category) mDNS_snprintf_add(&dst, lim, "%s: ", entry->category);
+        if (entry->format) LogRingFormat(dst, lim, entry->format, entry->data, entry->length);
+        else mDNS_snprintf_add(&dst, lim, "%s", (const char *)entry->data);
+        mDNSPlatformWriteLogMsg(ProgramName, buffer, entry->level);
+        __atomic_store_n(&entry->seq, ring->head + MDNS_LOG_RING_ENTRIES, __ATOMIC_RELEASE);
+        ring->head++;
+    }
+
+    dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+    if (dropped)
+    {
+        char message[64];
+        mDNS_snprintf(message, sizeof(message), "Log ring full: %u messages dropped", dropped);
+        mDNSPlatformWriteLogMsg(ProgramName, message, MDNS_LOG_WARNING);
+    }
+    __atomic_store_n(&ring->draining, 0, __ATOMIC_RELEASE);
+}
+
+// Records the message in the ring. Returns false, leaving 'args' untouched, if the caller should log it directly.
+mDNSlocal mDNSBool LogRingRecord(mDNSLogCategory_t category, mDNSLogLevel_t level, const char *format, va_list args)
+{
+    LogRing *const ring = gLogRing;
+    LogRingEntry *entry;
+
+    // Errors and faults are written straight away, after anything already queued, in case we're about to go down
+    if (!ring || level <= MDNS_LOG_ERROR) { mDNSLogRingDrain(); return(mDNSfalse); }
+
+    entry = LogRingClaim(ring);
+    if (!entry)
+    {
+        // Full: empty it ourselves if nobody else is, otherwise the message is lost and counted
+        mDNSLogRingDrain();
+        entry = LogRingClaim(ring);
+        if (!entry) { __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED); return(mDNStrue); }
+    }
+
+    entry->category = category;
+    entry->level    = level;
+    entry->format   = format;
+    if (!LogRingCapture(format, args, entry))
+    {
+        // Too many or too long arguments to copy; keep the formatted text instead
+        entry->format = mDNSNULL;
+        mDNS_vsnprintf((char *)entry->data, (mDNSu32)sizeof(entry->data), format, args);
+    }
+    __atomic_store_n(&entry->seq, __atomic_load_n(&entry->seq, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+    return(mDNStrue);
+}
+
+mDNSexport int mDNSLogRingStart(void)
+{
+    LogRing *ring;
+    mDNSu32 i;
+    if (gLogRing) return(mDNStrue);
+    ring = (LogRing *)mDNSPlatformMemAllocateClear(sizeof(*ring));
+    if (!ring) return(mDNSfalse);
+    for (i = 0; i < MDNS_LOG_RING_ENTRIES; i++) ring->entries[i].seq = i;
+    gLogRing = ring;
+    return(mDNStrue);
+}
+
+mDNSexport void mDNSLogRingStop(void)
+{
+    LogRing *const ring = gLogRing;
+    if (!ring) return;
+    mDNSLogRingDrain();
+    gLogRing = mDNSNULL;
+    mDNSPlatformMemFree(ring);
+}
+#else
+mDNSexport int      mDNSLogRingStart(void)  { return(0); }
+mDNSexport void     mDNSLogRingDrain(void)  { }
+mDNSexport void     mDNSLogRingStop(void)   { }
+#endif // MDNS_LOG_RING_SUPPORTED
+
 mDNSlocal void LogMsgWithLevelv(const char *category, mDNSLogLevel_t level, const char *format, va_list args)
 {
     char buffer[512];
     char *dst = buffer;
     const char *const lim = &buffer[512];
+#if MDNS_LOG_RING_SUPPORTED
+    if (LogRingRecord(category, level, format, args)) return;
+#endif
     if (category) mDNS_snprintf_add(&dst, lim, "%s: ", category);
     mDNS_vsnprintf(dst, (mDNSu32)(lim - dst), format, args);
     mDNSPlatformWriteLogMsg(ProgramName, buffer, level);
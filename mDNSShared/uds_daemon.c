@@ -24,6 +24,8 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/uio.h>
+#include <limits.h>
 #endif
 
 #include <stdlib.h>
@@ -34,6 +36,7 @@
 #include "uDNS.h"
 #include "uds_daemon.h"
 #include "dns_sd_internal.h"
+#include "mDNSTrace.h"
 
 // Apple-specific functionality, not required for other platforms
 #if APPLE_OSX_mDNSResponder
@@ -112,6 +115,8 @@ static request_state *all_requests = NULL;
 struct proc_bsdshortinfo proc;
 #endif //LOCAL_PEEREPID
 mDNSlocal void set_peer_pid(request_state *request);
+mDNSlocal int send_msg(request_state *const req, const char *const prefix, const mDNSu32 prefixlen);
+mDNSlocal void free_sent_replies(request_state *const r);
 mDNSlocal void LogMcastClientInfo(request_state *req);
 mDNSlocal void GetMcastClients(request_state *req);
 static mDNSu32 mcount;     // tracks the current active mcast operations for McastLogging
@@ -193,6 +198,178 @@ mDNSlocal void my_throttled_perror(char *err_msg)
         my_perror(err_msg);
 }
 
+// ***************************************************************************
+#if COMPILER_LIKES_PRAGMA_MARK
+#pragma mark -
+#pragma mark - Object Pools
+#endif
+
+// Every client operation allocates a request_state (and a registered_record_entry for each DNSServiceRegisterRecord),
+// and every reply a reply_state. Rather than going back to the allocator each time, freed objects are kept on
+// per-type freelists, up to UDSPoolMaxFree objects each, and handed out again. Replies vary in size, so they're pooled
+// in buckets by allocation size; a reply too big for the largest bucket is allocated and freed as usual.
+// Pooling is disabled under MDNS_MALLOC_DEBUGGING, where it would get in the way of catching use-after-free bugs.
+#ifndef UDSPoolMaxFree
+#if MDNS_MALLOC_DEBUGGING
+#define UDSPoolMaxFree 0
+#else
+#define UDSPoolMaxFree 64
+#endif
+#endif
+
+typedef struct UDSPoolItem_struct UDSPoolItem;
+struct UDSPoolItem_struct
+{
+    UDSPoolItem *next;
+};
+
+typedef struct
+{
+    const char  *name;
+    mDNSu32      size;          // Allocation size of the objects in this pool
+    UDSPoolItem *freelist;
+    mDNSu32      numFree;       // Objects currently on the freelist
+    mDNSu32      inUse;         // Objects currently handed out
+    mDNSu32      allocs;        // Total objects handed out
+    mDNSu32      hits;          // How many of those came from the freelist
+} UDSPool;
+
+static UDSPool RequestPool     = { "request_state",           sizeof(request_state),           mDNSNULL, 0, 0, 0, 0 };
+static UDSPool RecordEntryPool = { "registered_record_entry", sizeof(registered_record_entry), mDNSNULL, 0, 0, 0, 0 };
+#define ReplyPoolBuckets 4
+static UDSPool ReplyPools[ReplyPoolBuckets] =
+{
+    { "reply_state <= 128",  128,  mDNSNULL, 0, 0, 0, 0 },
+    { "reply_state <= 256",  256,  mDNSNULL, 0, 0, 0, 0 },
+    { "reply_state <= 512",  512,  mDNSNULL, 0, 0, 0, 0 },
+    { "reply_state <= 1024", 1024, mDNSNULL, 0, 0, 0, 0 }
+};
+
+// Returns a zeroed object from pool, like callocL
+mDNSlocal void *PoolAlloc(UDSPool *const pool)
+{
+    void *obj;
+    pool->allocs++;
+    pool->inUse++;
+    if (pool->freelist)
+    {
+        UDSPoolItem *const item = pool->freelist;
+        pool->freelist = item->next;
+        pool->numFree--;
+        pool->hits++;
+        mDNSPlatformMemZero(item, pool->size);
+        return(item);
+    }
+    obj = callocL(pool->name, pool->size);
+    if (!obj) FatalError("ERROR: calloc");
+    return(obj);
+}
+
+mDNSlocal void PoolFree(UDSPool *const pool, void *const obj)
+{
+    pool->inUse--;
+    if (pool->numFree < UDSPoolMaxFree)
+    {
+        UDSPoolItem *const item = (UDSPoolItem *)obj;
+        item->next = pool->freelist;
+        pool->freelist = item;
+        pool->numFree++;
+    }
+    else freeL(pool->name, obj);
+}
+
+// A reply_state is allocated with room for datalen bytes of reply data (of which the reply_hdr is the start)
+#define ReplyAllocSize(DATALEN) (sizeof(reply_state) + (DATALEN) - sizeof(reply_hdr))
+
+mDNSlocal UDSPool *ReplyPoolForSize(const size_t size)
+{
+    int i;
+    for (i = 0; i < ReplyPoolBuckets; i++) if (size <= ReplyPools[i].size) return(&ReplyPools[i]);
+    return(mDNSNULL);
+}
+
+mDNSlocal void FreeReply(reply_state *const rep)
+{
+    UDSPool *const pool = ReplyPoolForSize(ReplyAllocSize(rep->totallen - sizeof(ipc_msg_hdr)));
+    if (pool) PoolFree(pool, rep);
+    else freeL("reply_state", rep);
+}
+
+// Replies wait on a primary request's list until its client reads them. A client that stops reading would let that
+// list grow without limit, so once it's behind (it has already failed to take everything we had for it, see
+// udsserver_idle) its replies are capped, per connection and across all of a process's connections. The first reply
+// over a cap is dropped and marks the connection, which udsserver_idle then aborts; the client sees its connection
+// fail and can start afresh, rather than carrying on with a silently incomplete picture.
+typedef struct client_process
+{
+    struct client_process *next;
+    mDNSs32 pid;
+    mDNSu32 connections;            // Primary requests sharing this record
+    mDNSu32 reply_bytes;            // Total of their reply_bytes
+} client_process;
+
+static client_process *client_processes = mDNSNULL;
+static mDNSu32  ConnectionReplyCap  = DefaultConnectionReplyCap;
+static mDNSu32  ProcessReplyCap     = DefaultProcessReplyCap;
+static mDNSBool CoalesceReplies     = mDNSfalse;
+static mDNSu32  RepliesDropped      = 0;   // Replies never delivered because their connection went over a cap
+static mDNSu32  RepliesCoalesced    = 0;   // Replies cancelled out by a later one before they were sent
+static mDNSu32  ReplyCapAborts      = 0;   // Connections aborted for going over a cap
+
+mDNSexport void udsserver_set_reply_limits(mDNSu32 connection_bytes, mDNSu32 process_bytes, mDNSBool coalesce)
+{
+    ConnectionReplyCap = connection_bytes;
+    ProcessReplyCap    = process_bytes;
+    CoalesceReplies    = coalesce;
+}
+
+mDNSlocal void AttachClientProcess(request_state *const req)
+{
+    client_process *p;
+    if (req->process_id < 0) return;
+    for (p = client_processes; p && p->pid != req->process_id; p = p->next) {}
+    if (!p)
+    {
+        p = (client_process *) callocL("client_process", sizeof(*p));
+        if (!p) FatalError("ERROR: calloc");
+        p->pid  = req->process_id;
+        p->next = client_processes;
+        client_processes = p;
+    }
+    p->connections++;
+    req->process = p;
+}
+
+mDNSlocal void DetachClientProcess(request_state *const req)
+{
+    client_process *const p = req->process, **pp;
+    if (!p) return;
+    req->process = mDNSNULL;
+    p->reply_bytes -= req->reply_bytes;
+    if (--p->connections) return;
+    for (pp = &client_processes; *pp && *pp != p; pp = &(*pp)->next) {}
+    if (*pp) *pp = p->next;
+    freeL("client_process", p);
+}
+
+// Call when rep comes off primary request r's reply list, before freeing it
+mDNSlocal void ReplyDequeued(request_state *const r, const reply_state *const rep)
+{
+    r->reply_bytes -= rep->totallen;
+    if (r->process) r->process->reply_bytes -= rep->totallen;
+}
+
+mDNSlocal void FreeRequest(request_state *const req)
+{
+    DetachClientProcess(req);
+    PoolFree(&RequestPool, req);
+}
+
+mDNSlocal void LogPoolToFD(int fd, const UDSPool *const pool)
+{
+    LogToFD(fd, "%-24s %6u in use %6u free %10u allocated %10u reused", pool->name, pool->inUse, pool->numFree, pool->allocs, pool->hits);
+}
+
 // LogMcastQuestion/LogMcastQ should be called after the DNSQuestion struct is initialized(especially for q->TargetQID)
 // Hence all calls are made after mDNS_StartQuery()/mDNS_StopQuery()/mDNS_StopBrowse() is called.
 mDNSlocal void LogMcastQuestion(const DNSQuestion *const q, request_state *req, q_state status)
@@ -368,8 +545,10 @@ mDNSlocal void abort_request(request_state *req)
         {
             reply_state *ptr = req->replies;
             req->replies = req->replies->next;
-            freeL("reply_state (abort)", ptr);
+            ReplyDequeued(req, ptr);
+            FreeReply(ptr);
         }
+        DetachClientProcess(req);
     }
 
     // Set req->sd to something invalid, so that udsserver_idle knows to unlink and free this structure
@@ -405,14 +584,104 @@ mDNSexport int IsDebugSocketInUse(void)
 }
 #endif
 
+#if !defined(USE_TCP_LOOPBACK)
+// Makes udsserver_init() listen on path instead of MDNS_UDS_SERVERPATH, so that more than one daemon can run at once
+mDNSexport void udsserver_set_path(const char *path)
+{
+    boundPath = (char *)path;
+}
+#endif
+
+// ***************************************************************************
+#if COMPILER_LIKES_PRAGMA_MARK
+#pragma mark -
+#pragma mark - Request Lists
+#endif
+
+// all_requests is doubly linked, and each shared connection's primary keeps its own list of subordinate operations,
+// so unlinking a request or terminating a connection doesn't mean walking every request the daemon has. Subordinates
+// are also indexed by (primary, client_context) in SubordinateHash, because every cancel, add/update/remove record,
+// and similar message arriving on a shared connection has to find the operation it's for.
+
+#ifndef SubordinateHashSize
+#define SubordinateHashSize 1024
+#endif
+
+static request_state *all_requests_last = NULL;
+static request_state *SubordinateHash[SubordinateHashSize];
+
+mDNSlocal mDNSu32 SubordinateHashSlot(const request_state *const primary, const client_context_t context)
+{
+    const mDNSu32 p = (mDNSu32)((uintptr_t)primary / sizeof(void *));
+    return(((p * 2654435761U) ^ context.u32[0] ^ (context.u32[1] * 40503U)) % SubordinateHashSize);
+}
+
+// Appends req to all_requests
+mDNSlocal void LinkRequest(request_state *const req)
+{
+    req->prev = all_requests_last;
+    req->next = mDNSNULL;
+    if (all_requests_last) all_requests_last->next = req;
+    else                   all_requests = req;
+    all_requests_last = req;
+}
+
+// Adds req, whose primary and hdr.client_context are already set, to its primary's subordinates and to SubordinateHash.
+// Within a bucket the oldest request comes first, so that, as before, a client that reuses a client context finds the
+// operation it started first.
+mDNSlocal void LinkSubordinateRequest(request_state *const req)
+{
+    request_state *const primary = req->primary;
+    request_state **p = &SubordinateHash[SubordinateHashSlot(primary, req->hdr.client_context)];
+    req->prevsub = mDNSNULL;
+    req->nextsub = primary->subordinates;
+    if (primary->subordinates) primary->subordinates->prevsub = req;
+    primary->subordinates = req;
+    while (*p) p = &(*p)->hashnext;
+    req->hashnext = mDNSNULL;
+    *p = req;
+}
+
+// Removes req from all_requests and, if it's a subordinate, from its primary's list and SubordinateHash.
+// Doesn't free req.
+mDNSlocal void UnlinkRequest(request_state *const req)
+{
+    if (req->prev) req->prev->next = req->next;
+    else           all_requests = req->next;
+    if (req->next) req->next->prev = req->prev;
+    else           all_requests_last = req->prev;
+    req->prev = req->next = mDNSNULL;
+
+    if (req->primary)
+    {
+        request_state *const primary = req->primary;
+        request_state **p = &SubordinateHash[SubordinateHashSlot(primary, req->hdr.client_context)];
+        if (req->prevsub) req->prevsub->nextsub = req->nextsub;
+        else if (primary->subordinates == req) primary->subordinates = req->nextsub;
+        if (req->nextsub) req->nextsub->prevsub = req->prevsub;
+        req->prevsub = req->nextsub = mDNSNULL;
+        while (*p && *p != req) p = &(*p)->hashnext;
+        if (*p) *p = req->hashnext;
+        req->hashnext = mDNSNULL;
+    }
+}
+
+mDNSlocal request_state *FindSubordinateRequest(const request_state *const primary, const client_context_t context)
+{
+    request_state *req;
+    for (req = SubordinateHash[SubordinateHashSlot(primary, context)]; req; req = req->hashnext)
+        if (req->primary == primary &&
+            req->hdr.client_context.u32[0] == context.u32[0] &&
+            req->hdr.client_context.u32[1] == context.u32[1]) return(req);
+    return(mDNSNULL);
+}
+
 mDNSlocal void AbortUnlinkAndFree(request_state *req)
 {
-    request_state **p = &all_requests;
     abort_request(req);
-    while (*p && *p != req) p=&(*p)->next;
-    if (*p)
+    if (req == all_requests || req->prev)
     {
-        *p = req->next;
+        UnlinkRequest(req);
 #if MDNSRESPONDER_SUPPORTS(APPLE, TRUST_ENFORCEMENT)
         if (req->trust)
         {
@@ -422,7 +691,7 @@ mDNSlocal void AbortUnlinkAndFree(request_state *req)
             mdns_trust_forget(&req->trust);
         }
 #endif
-        freeL("request_state/AbortUnlinkAndFree", req);
+        FreeRequest(req);
     }
     else LogMsg("AbortUnlinkAndFree: ERROR: Attempt to abort operation %p not in list", req);
 }
@@ -430,6 +699,7 @@ mDNSlocal void AbortUnlinkAndFree(request_state *req)
 mDNSlocal reply_state *create_reply(const reply_op_t op, const size_t datalen, request_state *const request)
 {
     reply_state *reply;
+    UDSPool *pool;
 
     if ((unsigned)datalen < sizeof(reply_hdr))
     {
@@ -437,8 +707,13 @@ mDNSlocal reply_state *create_reply(const reply_op_t op, const size_t datalen, r
         return NULL;
     }
 
-    reply = (reply_state *) callocL("reply_state", sizeof(reply_state) + datalen - sizeof(reply_hdr));
-    if (!reply) FatalError("ERROR: calloc");
+    pool = ReplyPoolForSize(ReplyAllocSize(datalen));
+    if (pool) reply = (reply_state *) PoolAlloc(pool);
+    else
+    {
+        reply = (reply_state *) callocL("reply_state", ReplyAllocSize(datalen));
+        if (!reply) FatalError("ERROR: calloc");
+    }
 
     reply->next     = mDNSNULL;
     reply->totallen = (mDNSu32)datalen + sizeof(ipc_msg_hdr);
@@ -454,25 +729,93 @@ mDNSlocal reply_state *create_reply(const reply_op_t op, const size_t datalen, r
     return reply;
 }
 
+// Finds the latest reply on list for the same browse result, record or address as rep, ignoring whether each is an
+// add or a remove. Only the latest counts; e.g. a queued add, remove, add is cancelled out by one more remove.
+mDNSlocal reply_state *FindLastSameResult(reply_state *list, const reply_state *const rep, reply_state **const prevp)
+{
+    const mDNSu32 ignoring = dnssd_htonl(kDNSServiceFlagsAdd | kDNSServiceFlagsMoreComing);
+    reply_state *x, *prev = mDNSNULL, *last = mDNSNULL;
+    mDNSu32 len = rep->mhdr->datalen - sizeof(reply_hdr);
+
+    // Query and address results end with a TTL, which differs between an add and its remove
+    if (rep->mhdr->op == query_reply_op || rep->mhdr->op == addrinfo_reply_op) len -= sizeof(mDNSu32);
+    else if (rep->mhdr->op != browse_reply_op) return(mDNSNULL);
+
+    for (x = list; x; prev = x, x = x->next)
+    {
+        if (x->mhdr->op == rep->mhdr->op && x->mhdr->datalen == rep->mhdr->datalen &&
+            x->mhdr->client_context.u32[0] == rep->mhdr->client_context.u32[0] &&
+            x->mhdr->client_context.u32[1] == rep->mhdr->client_context.u32[1] &&
+            x->rhdr->ifi == rep->rhdr->ifi && x->rhdr->error == rep->rhdr->error &&
+            !((x->rhdr->flags ^ rep->rhdr->flags) & ~ignoring) &&
+            mDNSPlatformMemSame(&x->rhdr[1], &rep->rhdr[1], len))
+        {
+            last = x;
+            *prevp = prev;
+        }
+    }
+    if (last && !((last->rhdr->flags ^ rep->rhdr->flags) & dnssd_htonl(kDNSServiceFlagsAdd))) return(mDNSNULL);
+    return(last);
+}
+
+// With CoalesceReplies, while a client is behind, an add (or remove) event that's still waiting to be sent is cancelled
+// out by a remove (or add) of the same browse result, record or address, and neither is sent: the client would only
+// have ended up where it started. Returns mDNStrue if rep was coalesced that way, in which case it has been freed.
+mDNSlocal mDNSBool CoalesceReply(request_state *const r, reply_state *const rep)
+{
+    reply_state *prev = mDNSNULL;
+    reply_state *const last = FindLastSameResult(r->replies, rep, &prev);
+    if (!last || last->nwriten) return(mDNSfalse);
+
+    if (prev) prev->next = last->next;
+    else r->replies = last->next;
+    if (r->replies_last == last) r->replies_last = prev;
+    ReplyDequeued(r, last);
+    FreeReply(last);
+    FreeReply(rep);
+    RepliesCoalesced += 2;
+    return(mDNStrue);
+}
+
 // Append a reply to the list in a request object
 // If our request is sharing a connection, then we append our reply_state onto the primary's list
 // If the request does not want asynchronous replies, then the reply is freed instead of being appended to any list.
 mDNSlocal void append_reply(request_state *req, reply_state *rep)
 {
     request_state *r;
-    reply_state **ptr;
 
     if (req->no_reply)
     {
-        freeL("reply_state/append_reply", rep);
+        FreeReply(rep);
         return;
     }
 
     r = req->primary ? req->primary : req;
-    ptr = &r->replies;
-    while (*ptr) ptr = &(*ptr)->next;
-    *ptr = rep;
+    if (r->time_blocked)    // Client is behind (see client_process for the caps)
+    {
+        if (CoalesceReplies && r->replies && CoalesceReply(r, rep)) return;
+        if (!r->reply_overflow &&
+            ((ConnectionReplyCap && r->reply_bytes + rep->totallen > ConnectionReplyCap) ||
+             (ProcessReplyCap && r->process && r->process->reply_bytes + rep->totallen > ProcessReplyCap)))
+        {
+            LogMsg("%3d: Client PID[%d](%s) has %u bytes of replies waiting (%u for the process); aborting connection",
+                   r->sd, r->process_id, r->pid_name, r->reply_bytes, r->process ? r->process->reply_bytes : r->reply_bytes);
+            r->reply_overflow = mDNStrue;
+        }
+        if (r->reply_overflow)
+        {
+            RepliesDropped++;
+            FreeReply(rep);
+            return;
+        }
+    }
+
     rep->next = NULL;
+    if (r->replies) r->replies_last->next = rep;
+    else r->replies = rep;
+    r->replies_last = rep;
+    r->reply_bytes += rep->totallen;
+    if (r->process) r->process->reply_bytes += rep->totallen;
 }
 
 // Generates a response message giving name, type, domain, plus interface index,
@@ -1159,7 +1502,7 @@ mDNSlocal void regrecord_callback(mDNS *const m, AuthRecord *rr, mStatus result)
                 }
                 *ptr = (*ptr)->next;
                 freeL("registered_record_entry AuthRecord regrecord_callback", re->rr);
-                freeL("registered_record_entry regrecord_callback", re);
+                PoolFree(&RecordEntryPool, re);
              }
         }
         else
@@ -1203,6 +1546,14 @@ mDNSlocal void set_peer_pid(request_state *request)
     mDNSPlatformStrLCopy(request->pid_name, proc.pbsi_comm, sizeof(request->pid_name));
     request->process_id = p;
     debugf("set_peer_pid: Client PEEREPID is %d %s", p, request->pid_name);
+#elif defined(SO_PEERCRED) && defined(HAVE_LINUX)
+    struct ucred    cred;
+    socklen_t       len  = sizeof(cred);
+    if (request->sd < 0)
+        return;
+    if (getsockopt(request->sd, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+        return;
+    request->process_id = cred.pid;
 #else   // !LOCAL_PEEREPID
     LogInfo("set_peer_pid: Not Supported on this version of OS");
     if (request->sd < 0)
@@ -1212,37 +1563,29 @@ mDNSlocal void set_peer_pid(request_state *request)
 
 mDNSlocal void connection_termination(request_state *request)
 {
-    // When terminating a shared connection, we need to scan the all_requests list
-    // and terminate any subbordinate operations sharing this file descriptor
-    request_state **req = &all_requests;
-
+    // When terminating a shared connection, we need to terminate any subbordinate operations sharing this file descriptor
     LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO,
            "[R%d] DNSServiceCreateConnection STOP PID[%d](" PUB_S ")",
            request->request_id, request->process_id, request->pid_name);
 
-    while (*req)
+    while (request->subordinates)
     {
-        if ((*req)->primary == request)
-        {
-            // Since we're already doing a list traversal, we unlink the request directly instead of using AbortUnlinkAndFree()
-            request_state *tmp = *req;
-            if (tmp->primary == tmp) LogMsg("connection_termination ERROR (*req)->primary == *req for %p %d",                  tmp, tmp->sd);
-            if (tmp->replies) LogMsg("connection_termination ERROR How can subordinate req %p %d have replies queued?", tmp, tmp->sd);
-            abort_request(tmp);
-            *req = tmp->next;
+        // We unlink the request directly instead of using AbortUnlinkAndFree(), which first checks it's in all_requests
+        request_state *tmp = request->subordinates;
+        if (tmp->primary == tmp) LogMsg("connection_termination ERROR tmp->primary == tmp for %p %d",                      tmp, tmp->sd);
+        if (tmp->replies) LogMsg("connection_termination ERROR How can subordinate req %p %d have replies queued?", tmp, tmp->sd);
+        abort_request(tmp);
+        UnlinkRequest(tmp);
 #if MDNSRESPONDER_SUPPORTS(APPLE, TRUST_ENFORCEMENT)
-            if (tmp->trust)
-            {
-                void * context = mdns_trust_get_context(tmp->trust);
-                mdns_trust_set_context(tmp->trust, NULL);
-                if (context) freeL("context/connection_termination", context);
-                mdns_trust_forget(&tmp->trust);
-            }
-#endif
-            freeL("request_state/connection_termination", tmp);
+        if (tmp->trust)
+        {
+            void * context = mdns_trust_get_context(tmp->trust);
+            mdns_trust_set_context(tmp->trust, NULL);
+            if (context) freeL("context/connection_termination", context);
+            mdns_trust_forget(&tmp->trust);
         }
-        else
-            req = &(*req)->next;
+#endif
+        FreeRequest(tmp);
     }
 
     while (request->u.reg_recs)
@@ -1263,42 +1606,34 @@ mDNSlocal void connection_termination(request_state *request)
         }
         LogMcastS(ptr->rr, request, reg_stop);
         mDNS_Deregister(&mDNSStorage, ptr->rr);     // Will free ptr->rr for us
-        freeL("registered_record_entry/connection_termination", ptr);
+        PoolFree(&RecordEntryPool, ptr);
     }
 }
 
 mDNSlocal void handle_cancel_request(request_state *request)
 {
-    request_state **req = &all_requests;
+    request_state *tmp;
     LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEBUG, "[R%d] Cancel %08X %08X",
            request->request_id, request->hdr.client_context.u32[1], request->hdr.client_context.u32[0]);
-    while (*req)
+    while ((tmp = FindSubordinateRequest(request, request->hdr.client_context)) != mDNSNULL)
     {
-        if ((*req)->primary == request &&
-            (*req)->hdr.client_context.u32[0] == request->hdr.client_context.u32[0] &&
-            (*req)->hdr.client_context.u32[1] == request->hdr.client_context.u32[1])
-        {
-            // Since we're already doing a list traversal, we unlink the request directly instead of using AbortUnlinkAndFree()
-            request_state *tmp = *req;
-            abort_request(tmp);
-            *req = tmp->next;
+        abort_request(tmp);
+        UnlinkRequest(tmp);
 #if MDNSRESPONDER_SUPPORTS(APPLE, TRUST_ENFORCEMENT)
-            if (tmp->trust)
-            {
-                void * context = mdns_trust_get_context(tmp->trust);
-                mdns_trust_set_context(tmp->trust, NULL);
-                if (context) freeL("context/handle_cancel_request", context);
-                mdns_trust_forget(&tmp->trust);
-            }
-#endif
-            freeL("request_state/handle_cancel_request", tmp);
+        if (tmp->trust)
+        {
+            void * context = mdns_trust_get_context(tmp->trust);
+            mdns_trust_set_context(tmp->trust, NULL);
+            if (context) freeL("context/handle_cancel_request", context);
+            mdns_trust_forget(&tmp->trust);
         }
-        else
-            req = &(*req)->next;
+#endif
+        FreeRequest(tmp);
     }
 }
 
-mDNSlocal mStatus _handle_regrecord_request_start(request_state *request, AuthRecord * rr)
+// With locked set, the caller already holds mDNS_Lock (see handle_regrecord_batch_request)
+mDNSlocal mStatus regrecord_start(request_state *request, AuthRecord *rr, const mDNSBool locked)
 {
     mStatus err;
     registered_record_entry *re;
@@ -1312,8 +1647,7 @@ mDNSlocal mStatus _handle_regrecord_request_start(request_state *request, AuthRe
         return (mStatus_BadParamErr);
     }
     // allocate registration entry, link into list
-    re = (registered_record_entry *) callocL("registered_record_entry", sizeof(*re));
-    if (!re) FatalError("ERROR: calloc");
+    re = (registered_record_entry *) PoolAlloc(&RecordEntryPool);
     re->key                   = request->hdr.reg_index;
     re->rr                    = rr;
     re->regrec_client_context = request->hdr.client_context;
@@ -1336,13 +1670,13 @@ mDNSlocal mStatus _handle_regrecord_request_start(request_state *request, AuthRe
            request->request_id, request->flags, request->interfaceIndex, RRDisplayString(&mDNSStorage, &rr->resrec), request->process_id,
            request->pid_name);
 
-    err = mDNS_Register(&mDNSStorage, rr);
+    err = locked ? mDNS_Register_internal(&mDNSStorage, rr) : mDNS_Register(&mDNSStorage, rr);
     if (err)
     {
         LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO,
                "[R%d] DNSServiceRegisterRecord(0x%X, %d," PRI_S ") ERROR (%d)",
                request->request_id, request->flags, request->interfaceIndex, RRDisplayString(&mDNSStorage, &rr->resrec), err);
-        freeL("registered_record_entry", re);
+        PoolFree(&RecordEntryPool, re);
         freeL("registered_record_entry/AuthRecord", rr);
     }
     else
@@ -1354,6 +1688,11 @@ mDNSlocal mStatus _handle_regrecord_request_start(request_state *request, AuthRe
     return err;
 }
 
+mDNSlocal mStatus _handle_regrecord_request_start(request_state *request, AuthRecord * rr)
+{
+    return(regrecord_start(request, rr, mDNSfalse));
+}
+
 #if MDNSRESPONDER_SUPPORTS(APPLE, TRUST_ENFORCEMENT)
 
 mDNSlocal void _return_regrecord_request_error(request_state *request, mStatus error)
@@ -1481,6 +1820,88 @@ mDNSlocal mStatus handle_regrecord_request(request_state *request)
     return(err);
 }
 
+// DNSServiceRegisterRecordBatch: a count followed by that many entries, each being the client context and record index
+// the entry would have had as its own reg_record_request, the length of its body, and the reg_record_request body itself.
+// The records are registered in one pass under a single mDNS_Lock, so they all share one m->timenow and with it one
+// probe and announcement schedule (see InitializeLastAPTime); SendQueries then probes each name once, with all of that
+// name's records in the authority section. Instead of the single error code of a reg_record_request, the reply on the
+// error return socket is a zero followed by one error code per entry, which this routine sends itself. An entry that
+// fails here gets no callback, just as a DNSServiceRegisterRecord call that returns an error doesn't. Only a malformed
+// batch fails as a whole: then nothing is registered and request_callback returns the error as for any other request.
+mDNSlocal mStatus handle_regrecord_batch_request(request_state *request)
+{
+    const mDNSu32 count = get_uint32(&request->msgptr, request->msgend);
+    const char *ptr = request->msgptr;
+    char *const end = request->msgend;
+    mStatus *results;
+    mDNSu32 i, failed = 0;
+#if MDNSRESPONDER_SUPPORTS(APPLE, TRUST_ENFORCEMENT)
+    // A record that needs a trust check may be registered from the check's callback, so it can't be done under the lock
+    const mDNSBool locked = !os_feature_enabled(mDNSResponder, bonjour_privacy);
+#else
+    const mDNSBool locked = mDNStrue;
+#endif
+
+    if (request->terminate != connection_termination)
+    { LogMsg("%3d: DNSServiceRegisterRecordBatch(not a shared connection ref)", request->sd); return(mStatus_BadParamErr); }
+    if (!ptr) { LogMsg("%3d: DNSServiceRegisterRecordBatch(unreadable parameters)", request->sd); return(mStatus_BadParamErr); }
+
+    // Check the framing of the whole batch first, so that a malformed one registers nothing
+    for (i = 0; i < count; i++)
+    {
+        mDNSu32 bodylen;
+        if (end - ptr < (long)sizeof(client_context_t)) break;
+        ptr += sizeof(client_context_t);
+        (void)get_uint32(&ptr, end);
+        bodylen = get_uint32(&ptr, end);
+        if (!ptr || bodylen > (mDNSu32)(end - ptr)) break;
+        ptr += bodylen;
+    }
+    if (i < count) { LogMsg("%3d: DNSServiceRegisterRecordBatch(entry %u of %u unreadable)", request->sd, i, count); return(mStatus_BadParamErr); }
+
+    results = (mStatus *)mallocL("DNSServiceRegisterRecordBatch results", (count + 1) * sizeof(mStatus));
+    if (!results) return(mStatus_NoMemoryErr);
+    results[0] = mStatus_NoError;
+
+    if (locked) mDNS_Lock(&mDNSStorage);
+    for (i = 0; i < count; i++)
+    {
+        char *entryend;
+        mDNSu32 bodylen;
+        AuthRecord *rr;
+        mStatus err = mStatus_BadParamErr;
+
+        // Each entry is handled as its own reg_record_request would be, with that request's context and record index
+        mDNSPlatformMemCopy(&request->hdr.client_context, request->msgptr, sizeof(client_context_t));
+        request->msgptr       += sizeof(client_context_t);
+        request->hdr.reg_index = get_uint32(&request->msgptr, end);
+        bodylen                = get_uint32(&request->msgptr, end);
+        entryend               = (char *)request->msgptr + bodylen;
+        request->msgend        = entryend;
+
+        rr = read_rr_from_ipc_msg(request, 1, 1);
+        if (rr)
+        {
+#if MDNSRESPONDER_SUPPORTS(APPLE, TRUST_ENFORCEMENT)
+            if (!locked && IsLocalDomain(rr->resrec.name))
+                err = _handle_regrecord_request_with_trust(request, rr);
+            else
+#endif
+            err = regrecord_start(request, rr, locked);
+        }
+        if (err) failed++;
+        results[i + 1] = dnssd_htonl(err);
+        request->msgptr = entryend;
+    }
+    if (locked) mDNS_Unlock(&mDNSStorage);
+    request->msgend = end;
+
+    LogOperation("%3d: DNSServiceRegisterRecordBatch(%u records, %u failed)", request->sd, count, failed);
+    send_all(request->errsd, (const char *)results, (int)((count + 1) * sizeof(mStatus)));
+    freeL("DNSServiceRegisterRecordBatch results", results);
+    return(mStatus_NoError);
+}
+
 mDNSlocal void UpdateDeviceInfoRecord(mDNS *const m);
 
 mDNSlocal void regservice_termination_callback(request_state *request)
@@ -1531,12 +1952,8 @@ mDNSlocal void regservice_termination_callback(request_state *request)
 
 mDNSlocal request_state *LocateSubordinateRequest(request_state *request)
 {
-    request_state *req;
-    for (req = all_requests; req; req = req->next)
-        if (req->primary == request &&
-            req->hdr.client_context.u32[0] == request->hdr.client_context.u32[0] &&
-            req->hdr.client_context.u32[1] == request->hdr.client_context.u32[1]) return(req);
-    return(request);
+    request_state *const req = FindSubordinateRequest(request, request->hdr.client_context);
+    return(req ? req : request);
 }
 
 mDNSlocal mStatus add_record_to_service(request_state *request, service_instance *instance, mDNSu16 rrtype, mDNSu16 rdlen,
@@ -1836,7 +2253,7 @@ mDNSlocal mStatus remove_record(request_state *request)
         LogMsg("ERROR: remove_record, mDNS_Deregister: %d", err);
         freeL("registered_record_entry AuthRecord remove_record", e->rr);
     }
-    freeL("registered_record_entry remove_record", e);
+    PoolFree(&RecordEntryPool, e);
     return err;
 }
 
@@ -2461,6 +2878,61 @@ bad_param:
 #pragma mark - DNSServiceBrowse
 #endif
 
+// With kDNSServiceFlagsCoalesceBrowse, results wait on u.browser.pending for BrowseCoalesceWindow after the first
+// one, so that a remove and re-add of an instance (or an add and remove) cancel out rather than reaching the client.
+// udsserver_idle hands whatever's left to append_reply all at once, which then goes out as a single write.
+#define BrowseCoalesceWindow (mDNSPlatformOneSecond / 20)
+
+mDNSlocal void hold_browse_reply(request_state *const req, reply_state *const rep)
+{
+    reply_state *prev = mDNSNULL, **ptr;
+    reply_state *const last = FindLastSameResult(req->u.browser.pending, rep, &prev);
+
+    if (last)
+    {
+        if (prev) prev->next = last->next;
+        else req->u.browser.pending = last->next;
+        FreeReply(last);
+        FreeReply(rep);
+        RepliesCoalesced += 2;
+        return;
+    }
+    for (ptr = &req->u.browser.pending; *ptr; ptr = &(*ptr)->next) {}
+    *ptr = rep;
+    rep->next = mDNSNULL;
+    if (!req->u.browser.FlushTime) req->u.browser.FlushTime = NonZeroTime(mDNS_TimeNow(&mDNSStorage) + BrowseCoalesceWindow);
+}
+
+mDNSlocal void flush_browse_replies(request_state *const req)
+{
+    while (req->u.browser.pending)
+    {
+        reply_state *const rep = req->u.browser.pending;
+        req->u.browser.pending = rep->next;
+        append_reply(req, rep);
+    }
+    req->u.browser.FlushTime = 0;
+}
+
+// With kDNSServiceFlagsBrowseSnapshot, the browse questions send one query each (see SendQueries) and are stopped
+// BrowseSnapshotWindow after the browse starts, when the client gets one last callback to say the snapshot is complete.
+#define BrowseSnapshotWindow (mDNSPlatformOneSecond * 2)
+
+mDNSlocal void browse_termination_callback(request_state *info);
+
+mDNSlocal void end_browse_snapshot(request_state *const req)
+{
+    reply_state *rep;
+
+    flush_browse_replies(req);
+    browse_termination_callback(req);
+    req->u.browser.default_domain = mDNSfalse;  // Keeps automatic browse domain changes from restarting it
+    req->u.browser.SnapshotEnd = 0;
+
+    GenerateBrowseReply(mDNSNULL, mDNSInterface_Any, req, &rep, browse_reply_op, kDNSServiceFlagsBrowseSnapshot, mStatus_NoError);
+    if (rep) append_reply(req, rep);
+}
+
 mDNSlocal void FoundInstance(mDNS *const m, DNSQuestion *question, const ResourceRecord *const answer, QC_result AddRecord)
 {
     DNSServiceFlags flags = AddRecord ? kDNSServiceFlagsAdd : 0;
@@ -2506,7 +2978,8 @@ validReply:
            AddRecord ? "ADD" : "RMV", mDNSPlatformInterfaceIndexfromInterfaceID(m, answer->InterfaceID, mDNSfalse),
            RRDisplayString(m, answer));
 
-    append_reply(req, rep);
+    if (req->flags & kDNSServiceFlagsCoalesceBrowse) hold_browse_reply(req, rep);
+    else append_reply(req, rep);
 }
 
 mDNSlocal void SetQuestionPolicy(DNSQuestion *q, request_state *req)
@@ -2617,6 +3090,13 @@ mDNSlocal void browse_termination_callback(request_state *info)
         LogMcastQ(&ptr->q, info, q_stop);
         freeL("browser_t/browse_termination_callback", ptr);
     }
+    while (info->u.browser.pending)
+    {
+        reply_state *const rep = info->u.browser.pending;
+        info->u.browser.pending = rep->next;
+        FreeReply(rep);
+    }
+    info->u.browser.FlushTime = 0;
 }
 
 mDNSlocal void udsserver_automatic_browse_domain_changed(const DNameListElem *const d, const mDNSBool add)
@@ -3105,6 +3585,8 @@ mDNSlocal mStatus handle_browse_request(request_state *request)
     AssignDomainName(&request->u.browser.regtype, &typedn);
     request->u.browser.default_domain = !domain[0];
     request->u.browser.browsers = NULL;
+    request->u.browser.SnapshotEnd = (flags & kDNSServiceFlagsBrowseSnapshot) ?
+        NonZeroTime(mDNS_TimeNow(&mDNSStorage) + BrowseSnapshotWindow) : 0;
 
     LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO, "[R%d] DNSServiceBrowse(%X, %d, \"" PRI_DM_NAME "\", \"" PRI_S "\") START PID[%d](" PUB_S ")",
            request->request_id, request->flags, interfaceIndex, DM_NAME_PARAM(&request->u.browser.regtype), domain,
@@ -3149,6 +3631,79 @@ mDNSlocal mStatus handle_browse_request(request_state *request)
 #pragma mark - DNSServiceResolve
 #endif
 
+// Once the SRV is known, the target's addresses are looked up too, on the SRV's interface. Responders usually send
+// them along with the SRV as additional records, and then these questions are answered from the cache without
+// sending anything. Otherwise their queries go out now, while the result is on its way to the client, rather than a
+// round trip later when the client gets round to DNSServiceGetAddrInfo, whose questions then join these ones.
+mDNSlocal void resolve_address_callback(mDNS *const m, DNSQuestion *question, const ResourceRecord *const answer, QC_result AddRecord)
+{
+    (void)m;            // Unused
+    (void)question;     // Unused
+    (void)answer;       // Unused
+    (void)AddRecord;    // Unused; the questions are only here so the answers are in the cache
+}
+
+mDNSlocal void resolve_stop_addresses(request_state *request)
+{
+    if (request->u.resolve.addr)
+    {
+        mDNS_StopQuery(&mDNSStorage, &request->u.resolve.addr[0]);
+        mDNS_StopQuery(&mDNSStorage, &request->u.resolve.addr[1]);
+        freeL("DNSQuestion/resolve_stop_addresses", request->u.resolve.addr);
+        request->u.resolve.addr = mDNSNULL;
+    }
+}
+
+mDNSlocal void resolve_start_addresses(request_state *request, const ResourceRecord *const srv)
+{
+    static const mDNSu16 types[2] = { kDNSType_A, kDNSType_AAAA };
+    const domainname *const target = &srv->rdata->u.srv.target;
+    DNSQuestion *q;
+    int i;
+
+    if (!target->c[0]) return;  // A target of "." means the service isn't offered
+    q = request->u.resolve.addr;
+    if (q && q[0].InterfaceID == srv->InterfaceID && SameDomainName(&q[0].qname, target)) return;
+    resolve_stop_addresses(request);
+
+    q = (DNSQuestion *) callocL("DNSQuestion/resolve_start_addresses", 2 * sizeof(*q));
+    if (!q) return;
+    for (i = 0; i < 2; i++)
+    {
+        q[i].InterfaceID          = srv->InterfaceID;
+        q[i].flags                = request->flags;
+        AssignDomainName(&q[i].qname, target);
+        q[i].qtype                = types[i];
+        q[i].qclass               = kDNSClass_IN;
+        q[i].LongLived            = mDNSfalse;
+        q[i].ExpectUnique         = mDNStrue;
+        q[i].ForceMCast           = request->u.resolve.qsrv.ForceMCast;
+        q[i].ReturnIntermed       = mDNSfalse;
+        q[i].SuppressUnusable     = mDNStrue;
+        q[i].AppendSearchDomains  = 0;
+        q[i].TimeoutQuestion      = 0;
+        q[i].WakeOnResolve        = 0;
+        q[i].UseBackgroundTraffic = request->u.resolve.qsrv.UseBackgroundTraffic;
+        q[i].ProxyQuestion        = 0;
+        q[i].pid                  = request->process_id;
+        q[i].euid                 = request->uid;
+        q[i].QuestionCallback     = resolve_address_callback;
+        q[i].QuestionContext      = request;
+    }
+    if (mDNS_StartQuery(&mDNSStorage, &q[0]) != mStatus_NoError)
+    {
+        freeL("DNSQuestion/resolve_start_addresses", q);
+        return;
+    }
+    if (mDNS_StartQuery(&mDNSStorage, &q[1]) != mStatus_NoError)
+    {
+        mDNS_StopQuery(&mDNSStorage, &q[0]);
+        freeL("DNSQuestion/resolve_start_addresses", q);
+        return;
+    }
+    request->u.resolve.addr = q;
+}
+
 mDNSlocal void resolve_termination_callback(request_state *request)
 {
     LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO,
@@ -3158,6 +3713,7 @@ mDNSlocal void resolve_termination_callback(request_state *request)
     mDNS_StopQuery(&mDNSStorage, &request->u.resolve.qtxt);
     mDNS_StopQuery(&mDNSStorage, &request->u.resolve.qsrv);
     LogMcastQ(&request->u.resolve.qsrv, request, q_stop);
+    resolve_stop_addresses(request);
 #if MDNSRESPONDER_SUPPORTS(APPLE, D2D)
     if (request->u.resolve.external_advertise)
     {
@@ -3226,7 +3782,11 @@ mDNSlocal void resolve_result_callback(mDNS *const m, DNSQuestion *question, con
         return;
     }
 
-    if (answer->rrtype == kDNSType_SRV) req->u.resolve.srv = answer;
+    if (answer->rrtype == kDNSType_SRV)
+    {
+        req->u.resolve.srv = answer;
+        if (answer->RecordType != kDNSRecordTypePacketNegative) resolve_start_addresses(req, answer);
+    }
     if (answer->rrtype == kDNSType_TXT) req->u.resolve.txt = answer;
 
     if (!req->u.resolve.txt || !req->u.resolve.srv) return;     // only deliver result to client if we have both answers
@@ -3529,17 +4089,171 @@ mDNSlocal mStatus handle_resolve_request(request_state *request)
 #pragma mark - DNSServiceQueryRecord
 #endif
 
+// With kDNSServiceFlagsHappyEyeballs, a DNSServiceGetAddrInfo's first results wait on u.addrinfo.held until its AAAA
+// query has been answered, or until AddrInfoResolutionDelay after the first A result if it hasn't, so the client
+// isn't left to race the two itself (RFC 8305 section 3). They're then sorted into the order the client should try
+// them and handed to append_reply all at once, going out as a single write like coalesced browse results.
+#define AddrInfoResolutionDelay (mDNSPlatformOneSecond / 20)
+
+// Gets the address out of an addrinfo reply, returning mDNSfalse for a negative answer
+mDNSlocal mDNSBool AddrInfoReplyAddr(const reply_state *const rep, mDNSAddr *const addr)
+{
+    const char *ptr = (const char *)&rep->rhdr[1];
+    const char *const end = (const char *)rep->rhdr + rep->mhdr->datalen;
+    mDNSu16 rrtype, rdlen;
+
+    while (ptr < end && *ptr) ptr++;
+    if (ptr++ >= end) return(mDNSfalse);
+    rrtype = get_uint16(&ptr, end);
+    (void)get_uint16(&ptr, end);    // rrclass
+    rdlen  = get_uint16(&ptr, end);
+    if (!ptr || end - ptr < rdlen || (mDNSu32)rep->rhdr->error != dnssd_htonl(kDNSServiceErr_NoError)) return(mDNSfalse);
+    if (rrtype == kDNSType_A && rdlen == sizeof(addr->ip.v4))
+    {
+        addr->type = mDNSAddrType_IPv4;
+        mDNSPlatformMemCopy(&addr->ip.v4, ptr, sizeof(addr->ip.v4));
+        return(mDNStrue);
+    }
+    if (rrtype == kDNSType_AAAA && rdlen == sizeof(addr->ip.v6))
+    {
+        addr->type = mDNSAddrType_IPv6;
+        mDNSPlatformMemCopy(&addr->ip.v6, ptr, sizeof(addr->ip.v6));
+        return(mDNStrue);
+    }
+    return(mDNSfalse);
+}
+
+// The precedence of an address in the RFC 6724 default policy table, and its scope. IPv4 addresses are looked up
+// as IPv4-mapped ones; loopback and link-local IPv4 addresses have link-local scope, the rest global (section 3.2).
+mDNSlocal int AddrInfoPrecedence(const mDNSAddr *const addr, int *const scope)
+{
+    const mDNSu8 *const b = addr->ip.v6.b;
+    static const mDNSu8 v4mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xFF, 0xFF };
+    static const mDNSu8 zero[15] = { 0 };
+    mDNSBool loopback;
+
+    if (addr->type == mDNSAddrType_IPv4 || mDNSPlatformMemSame(b, v4mapped, sizeof(v4mapped)))
+    {
+        const mDNSu8 *const v4 = (addr->type == mDNSAddrType_IPv4) ? addr->ip.v4.b : &b[12];
+        *scope = (v4[0] == 127 || (v4[0] == 169 && v4[1] == 254)) ? 0x2 : 0xE;
+        return(35);
+    }
+    loopback = mDNSPlatformMemSame(b, zero, sizeof(zero)) && b[15] == 1;
+    if (b[0] == 0xFF) *scope = b[1] & 0x0F;                                     // Multicast
+    else if (loopback || mDNSv6AddressIsLinkLocal(&addr->ip.v6)) *scope = 0x2;
+    else if (b[0] == 0xFE && (b[1] & 0xC0) == 0xC0) *scope = 0x5;              // Deprecated site-local
+    else *scope = 0xE;
+
+    if (loopback)                                          return(50);
+    if (b[0] == 0x20 && b[1] == 0x02)                      return(30);
+    if (b[0] == 0x20 && b[1] == 0x01 && !b[2] && !b[3])    return(5);
+    if ((b[0] & 0xFE) == 0xFC)                             return(3);
+    if (mDNSPlatformMemSame(b, zero, 12))                  return(1);
+    if (b[0] == 0xFE && (b[1] & 0xC0) == 0xC0)             return(1);
+    if (b[0] == 0x3F && b[1] == 0xFE)                      return(1);
+    return(40);
+}
+
+// Whether the address in a should be tried after the one in b: RFC 6724 section 6 rules 6 (higher precedence first)
+// and 8 (smaller scope first), the ones that need no source address. Negative answers go after all addresses.
+mDNSlocal mDNSBool AddrInfoReplyAfter(const reply_state *const a, const reply_state *const b)
+{
+    mDNSAddr aa, ba;
+    int ascope, bscope, aprec, bprec;
+
+    if (!AddrInfoReplyAddr(b, &ba)) return(mDNSfalse);
+    if (!AddrInfoReplyAddr(a, &aa)) return(mDNStrue);
+    aprec = AddrInfoPrecedence(&aa, &ascope);
+    bprec = AddrInfoPrecedence(&ba, &bscope);
+    if (aprec != bprec) return(aprec < bprec);
+    return(ascope > bscope);
+}
+
+mDNSlocal void release_addrinfo_replies(request_state *const req)
+{
+    reply_state *sorted = mDNSNULL, *rep, **ptr;
+    reply_state *list[3] = { mDNSNULL, mDNSNULL, mDNSNULL }, **tail[3] = { &list[0], &list[1], &list[2] };
+    mDNSAddr addr;
+    mDNSAddr_Type first = mDNSAddrType_IPv6;
+    int i;
+
+    // An insertion sort, leaving results the rules can't tell apart in the order they came
+    while ((rep = req->u.addrinfo.held) != mDNSNULL)
+    {
+        req->u.addrinfo.held = rep->next;
+        for (ptr = &sorted; *ptr && !AddrInfoReplyAfter(*ptr, rep); ptr = &(*ptr)->next) {}
+        rep->next = *ptr;
+        *ptr = rep;
+    }
+
+    // Then the families take turns, starting with that of the most preferred address (RFC 8305 section 4)
+    if (sorted && AddrInfoReplyAddr(sorted, &addr)) first = addr.type;
+    while ((rep = sorted) != mDNSNULL)
+    {
+        sorted = rep->next;
+        i = !AddrInfoReplyAddr(rep, &addr) ? 2 : (addr.type == first) ? 0 : 1;
+        rep->next = mDNSNULL;
+        *tail[i] = rep;
+        tail[i] = &rep->next;
+    }
+    for (i = 0; list[0] || list[1] || list[2]; i = !i)
+    {
+        reply_state **const from = (list[0] || list[1]) ? (list[i] ? &list[i] : &list[!i]) : &list[2];
+        rep = *from;
+        *from = rep->next;
+        append_reply(req, rep);
+    }
+    req->u.addrinfo.ReleaseTime = 0;
+    req->u.addrinfo.released = mDNStrue;
+}
+
+mDNSlocal void hold_addrinfo_reply(const mDNS *const m, request_state *const req, reply_state *const rep, const mDNSu16 qtype)
+{
+    reply_state *prev = mDNSNULL, **ptr;
+    reply_state *const last = FindLastSameResult(req->u.addrinfo.held, rep, &prev);
+
+    // An address that came and went while we waited is dropped, as for a coalesced browse
+    if (last)
+    {
+        if (prev) prev->next = last->next;
+        else req->u.addrinfo.held = last->next;
+        FreeReply(last);
+        FreeReply(rep);
+        RepliesCoalesced += 2;
+    }
+    else
+    {
+        for (ptr = &req->u.addrinfo.held; *ptr; ptr = &(*ptr)->next) {}
+        *ptr = rep;
+        rep->next = mDNSNULL;
+    }
+    // The rest of the AAAA answers (and any A answers) come in this same pass, so udsserver_idle sends them all on
+    if (qtype == kDNSType_AAAA) req->u.addrinfo.ReleaseTime = NonZeroTime(m->timenow);
+    else if (!req->u.addrinfo.ReleaseTime) req->u.addrinfo.ReleaseTime = NonZeroTime(m->timenow + AddrInfoResolutionDelay);
+}
+
 mDNSlocal void queryrecord_result_reply(mDNS *const m, DNSQuestion *question, const ResourceRecord *const answer, QC_result AddRecord, DNSServiceErrorType error, void *context)
 {
     char name[MAX_ESCAPED_DOMAIN_NAME];
-    size_t len;
+    size_t len, namelen;
     DNSServiceFlags flags = 0;
     reply_state *rep;
     char *data;
     request_state *req = (request_state *)context;
     const char *dnssec_result_description = "";
+    // With kDNSServiceFlagsWireFormat the name goes to the client just as the cache holds it
+    const mDNSBool wire = (req->hdr.op == query_request && (req->flags & kDNSServiceFlagsWireFormat));
 
-    ConvertDomainNameToCString(answer->name, name);
+    if (wire)
+    {
+        namelen = DomainNameLength(answer->name);
+        flags |= kDNSServiceFlagsWireFormat;
+    }
+    else
+    {
+        ConvertDomainNameToCString(answer->name, name);
+        namelen = strlen(name) + 1;
+    }
 
 #if MDNSRESPONDER_SUPPORTS(APPLE, DNSSECv2)
     if (question->DNSSECStatus.enable_dnssec) {
@@ -3582,7 +4296,7 @@ mDNSlocal void queryrecord_result_reply(mDNS *const m, DNSQuestion *question, co
     len = sizeof(DNSServiceFlags);  // calculate reply data length
     len += sizeof(mDNSu32);     // interface index
     len += sizeof(DNSServiceErrorType);
-    len += strlen(name) + 1;
+    len += namelen;
     len += 3 * sizeof(mDNSu16); // type, class, rdlen
     len += answer->rdlength;
     len += sizeof(mDNSu32);     // TTL
@@ -3609,7 +4323,8 @@ mDNSlocal void queryrecord_result_reply(mDNS *const m, DNSQuestion *question, co
 
     data = (char *)&rep->rhdr[1];
 
-    put_string(name,             &data);
+    if (wire) put_rdata((int)namelen, answer->name->c, &data);
+    else      put_string(name, &data);
     put_uint16(answer->rrtype,   &data);
     put_uint16(answer->rrclass,  &data);
     put_uint16(answer->rdlength, &data);
@@ -3619,9 +4334,16 @@ mDNSlocal void queryrecord_result_reply(mDNS *const m, DNSQuestion *question, co
         if (!putRData(mDNSNULL, (mDNSu8 *)data, (mDNSu8 *)rep->rhdr + len, answer))
             LogMsg("queryrecord_result_reply putRData failed %d", (mDNSu8 *)rep->rhdr + len - (mDNSu8 *)data);
     data += answer->rdlength;
-    put_uint32(AddRecord ? answer->rroriginalttl : 0, &data);
+    // Expired data is only handed out until something fresher turns up, so don't let the client hold on to it (RFC 8767)
+    if (AddRecord && answer->mortality == Mortality_Ghost && answer->rroriginalttl > SERVE_STALE_ANSWER_TTL)
+        put_uint32(SERVE_STALE_ANSWER_TTL, &data);
+    else
+        put_uint32(AddRecord ? answer->rroriginalttl : 0, &data);
 
-    append_reply(req, rep);
+    if (req->hdr.op == addrinfo_request && (req->flags & kDNSServiceFlagsHappyEyeballs) && !req->u.addrinfo.released &&
+        req->u.addrinfo.op.protocols == (kDNSServiceProtocol_IPv4 | kDNSServiceProtocol_IPv6))
+        hold_addrinfo_reply(m, req, rep, question->qtype);
+    else append_reply(req, rep);
 }
 
 mDNSlocal void queryrecord_termination_callback(request_state *request)
@@ -3637,6 +4359,9 @@ mDNSlocal void queryrecord_termination_callback(request_state *request)
 
 typedef struct {
     char            qname[MAX_ESCAPED_DOMAIN_NAME];
+    domainname      qname_wire;         // Set, instead of qname, for an IPC_VERSION_2 request
+    mDNSBool        qname_is_wire;
+    mDNSBool        qname_absolute;     // Whether the client's name had a trailing dot, with qname_wire
     mDNSu32         interfaceIndex;
     DNSServiceFlags flags;
     mDNSu16         qtype;
@@ -3679,6 +4404,8 @@ mDNSlocal mStatus _handle_queryrecord_request_start(request_state *request, cons
     QueryRecordClientRequestParamsInit(&queryParams);
     queryParams.requestID      = request->request_id;
     queryParams.qnameStr       = params->qname;
+    queryParams.qname          = params->qname_is_wire ? &params->qname_wire : mDNSNULL;
+    queryParams.qnameAbsolute  = params->qname_absolute;
     queryParams.interfaceIndex = params->interfaceIndex;
     queryParams.flags          = params->flags;
     queryParams.qtype          = params->qtype;
@@ -3736,7 +4463,7 @@ mDNSlocal void _return_queryrecord_request_error(request_state * request, mStatu
     append_reply(request, rep);
 }
 
-mDNSlocal mStatus _handle_queryrecord_request_with_trust(request_state *request, const _queryrecord_start_params_t * const params)
+mDNSlocal mStatus _handle_queryrecord_request_with_trust(request_state *request, _queryrecord_start_params_t * const params)
 {
     mStatus err;
     if (audit_token_to_pid(request->audit_token) == 0)
@@ -3749,6 +4476,11 @@ mDNSlocal mStatus _handle_queryrecord_request_with_trust(request_state *request,
         const char *service_ptr = NULL;
         char type_str[MAX_ESCAPED_DOMAIN_NAME] = "";
         domainname query_name;
+        if (params->qname_is_wire)
+        {
+            // The trust check works on the name as a string
+            ConvertDomainNameToCString(&params->qname_wire, params->qname);
+        }
         if (MakeDomainNameFromDNSNameString(&query_name, params->qname))
         {
             domainlabel name;
@@ -3832,6 +4564,22 @@ exit:
 }
 #endif // TRUST_ENFORCEMENT
 
+// Copies the IPC_TLV_TYPE_NAME name from the trailing TLVs of an IPC_VERSION_2 request. Its wire format is checked,
+// but it's otherwise taken as is. Returns mDNSfalse if it's missing or isn't a legal name.
+mDNSlocal mDNSBool get_ipc_wire_name(const request_state *const request, domainname *const name, mDNSBool *const absolute)
+{
+    const mDNSu8 *const start = (const mDNSu8 *)request->msgptr;
+    const mDNSu8 *const end   = (const mDNSu8 *)request->msgend;
+    mDNSu16 len = 0;
+    const mDNSu8 *value = get_tlv16(start, end, IPC_TLV_TYPE_NAME, &len);
+
+    if (!value || get_wire_name_length(value, len) < 0) return(mDNSfalse);
+    mDNSPlatformMemCopy(name->c, value, len);
+    value = get_tlv16(start, end, IPC_TLV_TYPE_NAME_IS_ABSOLUTE, &len);
+    *absolute = (value && len == 1 && *value) ? mDNStrue : mDNSfalse;
+    return(mDNStrue);
+}
+
 mDNSlocal mStatus handle_queryrecord_request(request_state *request)
 {
     mStatus err;
@@ -3839,13 +4587,32 @@ mDNSlocal mStatus handle_queryrecord_request(request_state *request)
 
     params.flags           = get_flags(&request->msgptr, request->msgend);
     params.interfaceIndex  = get_uint32(&request->msgptr, request->msgend);
-    if (get_string(&request->msgptr, request->msgend, params.qname, sizeof(params.qname)) < 0)
+    params.qname[0]        = 0;
+    params.qname_is_wire   = mDNSfalse;
+    params.qname_absolute  = mDNSfalse;
+    if (request->hdr.version == IPC_VERSION_2)
+    {
+        params.qtype       = get_uint16(&request->msgptr, request->msgend);
+        params.qclass      = get_uint16(&request->msgptr, request->msgend);
+        if (request->msgptr && !get_ipc_wire_name(request, &params.qname_wire, &params.qname_absolute))
+        {
+            LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_DEFAULT,
+                   "[R%d] DNSServiceQueryRecord(missing or bad wire-format name)", request->request_id);
+            err = mStatus_BadParamErr;
+            goto exit;
+        }
+        params.qname_is_wire = mDNStrue;
+    }
+    else
     {
-        err = mStatus_BadParamErr;
-        goto exit;
+        if (get_string(&request->msgptr, request->msgend, params.qname, sizeof(params.qname)) < 0)
+        {
+            err = mStatus_BadParamErr;
+            goto exit;
+        }
+        params.qtype       = get_uint16(&request->msgptr, request->msgend);
+        params.qclass      = get_uint16(&request->msgptr, request->msgend);
     }
-    params.qtype           = get_uint16(&request->msgptr, request->msgend);
-    params.qclass          = get_uint16(&request->msgptr, request->msgend);
 
     if (!request->msgptr)
     {
@@ -3874,10 +4641,20 @@ mDNSlocal mStatus handle_queryrecord_request(request_state *request)
     request->flags          = params.flags;
     request->interfaceIndex = params.interfaceIndex;
 
-    LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO,
-           "[R%d] DNSServiceQueryRecord(%X, %d, " PRI_S ", " PUB_S ") START PID[%d](" PUB_S ")",
-           request->request_id, request->flags, request->interfaceIndex, params.qname, DNSTypeName(params.qtype), request->process_id,
-           request->pid_name);
+    if (params.qname_is_wire)
+    {
+        LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO,
+               "[R%d] DNSServiceQueryRecord(%X, %d, " PRI_DM_NAME ", " PUB_S ") START PID[%d](" PUB_S ")",
+               request->request_id, request->flags, request->interfaceIndex, DM_NAME_PARAM(&params.qname_wire),
+               DNSTypeName(params.qtype), request->process_id, request->pid_name);
+    }
+    else
+    {
+        LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO,
+               "[R%d] DNSServiceQueryRecord(%X, %d, " PRI_S ", " PUB_S ") START PID[%d](" PUB_S ")",
+               request->request_id, request->flags, request->interfaceIndex, params.qname, DNSTypeName(params.qtype), request->process_id,
+               request->pid_name);
+    }
 
     mDNSPlatformMemZero(&request->u.queryrecord, (mDNSu32)sizeof(request->u.queryrecord));
     request->terminate = NULL;
@@ -4148,6 +4925,269 @@ typedef packedstruct
     mDNSu32 vers;
 } DaemonVersionReply;
 
+// Interfaces beyond this are left out of the kDNSServiceProperty_Statistics reply
+#define StatisticsMaxInterfaces 64
+
+mDNSlocal mDNSu32 TicksToMilliseconds(mDNSu32 ticks)
+{
+    // Split the conversion so it can't overflow 32 bits
+    return((ticks / mDNSPlatformOneSecond) * 1000 + (ticks % mDNSPlatformOneSecond) * 1000 / mDNSPlatformOneSecond);
+}
+
+// The kDNSServiceProperty_TopTalkers text is three header lines and one per slot, each well under 128 bytes
+#define TopTalkersReplySize kDNSServiceTopTalkers_MaxSize
+#if TopTalkersReplySize < (2 * TrafficStatsSlots + 3) * 128
+#error kDNSServiceTopTalkers_MaxSize is too small for the traffic statistics tables
+#endif
+
+// Builds the kDNSServiceProperty_TopTalkers reply (see dns_sd.h for the format) and sends it
+mDNSlocal void send_top_talkers_reply(request_state *request)
+{
+    mDNS *const m = &mDNSStorage;
+    const mDNSTrafficStats *const s = &m->TrafficStats;
+    const mDNSTrafficStatsEntry *sorted[TrafficStatsSlots];
+    static char reply[2 * sizeof(mDNSu32) + TopTalkersReplySize];
+    char *const text = reply + 2 * sizeof(mDNSu32);
+    mDNSu32 i, n, len, word;
+
+    len = mDNS_snprintf(text, TopTalkersReplySize, "interval %d decays %u\n",
+                        TrafficStatsDecayInterval / mDNSPlatformOneSecond, s->decays);
+    n = mDNS_TrafficStatsSorted(&s->types, sorted);
+    len += mDNS_snprintf(text + len, TopTalkersReplySize - len, "types %u\n", s->types.total);
+    for (i = 0; i < n; i++)
+        len += mDNS_snprintf(text + len, TopTalkersReplySize - len, "type %s %u %u %u %u\n", sorted[i]->key.type,
+                             sorted[i]->count, sorted[i]->error, sorted[i]->queries, sorted[i]->responses);
+    n = mDNS_TrafficStatsSorted(&s->sources, sorted);
+    len += mDNS_snprintf(text + len, TopTalkersReplySize - len, "sources %u\n", s->sources.total);
+    for (i = 0; i < n; i++)
+        len += mDNS_snprintf(text + len, TopTalkersReplySize - len, "source %#a %u %u %u %u %u\n", &sorted[i]->key.addr,
+                             sorted[i]->count, sorted[i]->error, sorted[i]->queries, sorted[i]->responses, sorted[i]->bytes);
+    len++;  // The NUL
+
+    word = 0;   // mStatus_NoError
+    mDNSPlatformMemCopy(reply, &word, sizeof(word));
+    word = dnssd_htonl(len);
+    mDNSPlatformMemCopy(reply + sizeof(word), &word, sizeof(word));
+    send_all(request->sd, reply, (int)(2 * sizeof(mDNSu32) + len));
+}
+
+// What a client operation has put on the wire: the times its questions went out in queries, and its records in responses
+// and probes. One packet usually carries several operations' questions or records, so these count items, not packets or
+// bytes; the per-interface packet and byte counts are in NetworkInterfaceInfo's TrafficIn and TrafficOut.
+typedef struct
+{
+    const request_state *request;
+    const char *op;
+    mDNSu32 queries;
+    mDNSu32 responses;
+    mDNSu32 probes;
+} request_traffic;
+
+// Requests beyond this many (the least busy ones) are left out of the traffic listings
+#define TrafficMaxRequests 64
+
+// The kDNSServiceProperty_Traffic text is two header lines, two lines per interface and one per request, each under 128 bytes
+#define TrafficReplySize kDNSServiceTraffic_MaxSize
+#if TrafficReplySize < (2 * StatisticsMaxInterfaces + TrafficMaxRequests + 2) * 128
+#error kDNSServiceTraffic_MaxSize is too small for the traffic listings
+#endif
+
+mDNSlocal void addrinfo_termination_callback(request_state *request);
+
+mDNSlocal void AddRecordTraffic(request_traffic *const t, const AuthRecord *const rr)
+{
+    t->responses += rr->SentInResponses;
+    t->probes    += rr->SentInProbes;
+}
+
+// Fills in t for one request, returning mDNSfalse if it isn't an operation that sends anything
+mDNSlocal mDNSBool GetRequestTraffic(const request_state *const req, request_traffic *const t)
+{
+    mDNSPlatformMemZero(t, sizeof(*t));
+    t->request = req;
+    if (req->terminate == connection_termination)
+    {
+        const registered_record_entry *p;
+        t->op = "RegisterRecord";
+        for (p = req->u.reg_recs; p; p = p->next) AddRecordTraffic(t, p->rr);
+    }
+    else if (req->terminate == regservice_termination_callback)
+    {
+        const service_instance *ptr;
+        t->op = "Register";
+        for (ptr = req->u.servicereg.instances; ptr; ptr = ptr->next)
+        {
+            const ExtraResourceRecord *e;
+            mDNSu32 i;
+            AddRecordTraffic(t, &ptr->srs.RR_ADV);
+            AddRecordTraffic(t, &ptr->srs.RR_PTR);
+            AddRecordTraffic(t, &ptr->srs.RR_SRV);
+            AddRecordTraffic(t, &ptr->srs.RR_TXT);
+            for (i = 0; i < ptr->srs.NumSubTypes; i++) AddRecordTraffic(t, &ptr->srs.SubTypes[i]);
+            for (e = ptr->srs.Extras; e; e = e->next) AddRecordTraffic(t, &e->r);
+        }
+    }
+    else if (req->terminate == browse_termination_callback)
+    {
+        const browser_t *b;
+        t->op = "Browse";
+        for (b = req->u.browser.browsers; b; b = b->next) t->queries += b->q.SentInQueries;
+    }
+    else if (req->terminate == resolve_termination_callback)
+    {
+        t->op = "Resolve";
+        t->queries = req->u.resolve.qtxt.SentInQueries + req->u.resolve.qsrv.SentInQueries;
+        if (req->u.resolve.addr) t->queries += req->u.resolve.addr[0].SentInQueries + req->u.resolve.addr[1].SentInQueries;
+    }
+    else if (req->terminate == queryrecord_termination_callback)
+    {
+        t->op = "QueryRecord";
+        t->queries = QueryRecordClientRequestGetQueriesSent(&req->u.queryrecord);
+    }
+    else if (req->terminate == addrinfo_termination_callback)
+    {
+        t->op = "GetAddrInfo";
+        t->queries = GetAddrInfoClientRequestGetQueriesSent(&req->u.addrinfo.op);
+    }
+    else if (req->terminate == enum_termination_callback)
+    {
+        t->op = "EnumerateDomains";
+        t->queries = req->u.enumeration.q_all.SentInQueries + req->u.enumeration.q_default.SentInQueries +
+                     req->u.enumeration.q_autoall.SentInQueries;
+    }
+    else
+        return mDNSfalse;
+    return mDNStrue;
+}
+
+// Fills busiest[] with the requests that have sent the most, busiest first, and returns how many that is;
+// *total is set to the number of requests that have sent anything at all
+mDNSlocal mDNSu32 GetBusiestRequests(request_traffic busiest[TrafficMaxRequests], mDNSu32 *const total)
+{
+    const request_state *req;
+    mDNSu32 n = 0;
+    *total = 0;
+    for (req = all_requests; req; req = req->next)
+    {
+        request_traffic t;
+        mDNSu32 sent, i;
+        if (!GetRequestTraffic(req, &t)) continue;
+        sent = t.queries + t.responses + t.probes;
+        if (!sent) continue;
+        (*total)++;
+        for (i = n; i > 0 && busiest[i - 1].queries + busiest[i - 1].responses + busiest[i - 1].probes < sent; i--)
+            if (i < TrafficMaxRequests) busiest[i] = busiest[i - 1];
+        if (i < TrafficMaxRequests)
+        {
+            busiest[i] = t;
+            if (n < TrafficMaxRequests) n++;
+        }
+    }
+    return n;
+}
+
+// The first NetworkInterfaceInfo for its InterfaceID, which is the one the core counts traffic on
+mDNSlocal mDNSBool IsFirstInterfaceForID(const NetworkInterfaceInfo *const intf)
+{
+    const NetworkInterfaceInfo *first = mDNSStorage.HostInterfaces;
+    while (first->InterfaceID != intf->InterfaceID) first = first->next;
+    return (first == intf);
+}
+
+// Builds the kDNSServiceProperty_Traffic reply (see dns_sd.h for the format) and sends it
+mDNSlocal void send_traffic_reply(request_state *request)
+{
+    mDNS *const m = &mDNSStorage;
+    static char reply[2 * sizeof(mDNSu32) + TrafficReplySize];
+    static request_traffic busiest[TrafficMaxRequests];
+    char *const text = reply + 2 * sizeof(mDNSu32);
+    const NetworkInterfaceInfo *intf;
+    mDNSu32 i, n, total, len, word, interfaces = 0;
+
+    for (intf = m->HostInterfaces; intf; intf = intf->next)
+        if (IsFirstInterfaceForID(intf) && interfaces < StatisticsMaxInterfaces) interfaces++;
+    len = mDNS_snprintf(text, TrafficReplySize, "interfaces %u\n", interfaces);
+    for (intf = m->HostInterfaces, i = 0; intf && i < interfaces; intf = intf->next)
+    {
+        const mDNSInterfaceTraffic *const dir[2] = { &intf->TrafficIn, &intf->TrafficOut };
+        const mDNSu32 index = mDNSPlatformInterfaceIndexfromInterfaceID(m, intf->InterfaceID, mDNStrue);
+        int d;
+        if (!IsFirstInterfaceForID(intf)) continue;
+        for (d = 0; d < 2; d++)
+            len += mDNS_snprintf(text + len, TrafficReplySize - len, "interface %u %s %u %u %u %u %u %u %s\n", index,
+                                 d ? "out" : "in",
+                                 dir[d]->packets[mDNSTrafficKind_Query],    dir[d]->bytes[mDNSTrafficKind_Query],
+                                 dir[d]->packets[mDNSTrafficKind_Response], dir[d]->bytes[mDNSTrafficKind_Response],
+                                 dir[d]->packets[mDNSTrafficKind_Probe],    dir[d]->bytes[mDNSTrafficKind_Probe], intf->ifname);
+        i++;
+    }
+    n = GetBusiestRequests(busiest, &total);
+    len += mDNS_snprintf(text + len, TrafficReplySize - len, "requests %u\n", total);
+    for (i = 0; i < n; i++)
+        len += mDNS_snprintf(text + len, TrafficReplySize - len, "request %d %u %s %u %u %u %s\n",
+                             busiest[i].request->process_id, busiest[i].request->request_id, busiest[i].op,
+                             busiest[i].queries, busiest[i].responses, busiest[i].probes, busiest[i].request->pid_name);
+    len++;  // The NUL
+
+    word = 0;   // mStatus_NoError
+    mDNSPlatformMemCopy(reply, &word, sizeof(word));
+    word = dnssd_htonl(len);
+    mDNSPlatformMemCopy(reply + sizeof(word), &word, sizeof(word));
+    send_all(request->sd, reply, (int)(2 * sizeof(mDNSu32) + len));
+}
+
+// Builds the kDNSServiceProperty_Statistics reply (see dns_sd.h for the layout) and sends it.
+// Everything here is a straight read of counters the core maintains, so it's cheap enough to poll.
+mDNSlocal void send_statistics_reply(request_state *request)
+{
+    mDNS *const m = &mDNSStorage;
+    mDNSu32 reply[2 + 2 + kDNSServiceStatistic_Count + 1 + 3 * StatisticsMaxInterfaces];
+    mDNSu32 *const counters = &reply[4];
+    mDNSu32 *ptr = &counters[kDNSServiceStatistic_Count];
+    mDNSu32 *const numInterfaces = ptr++;
+    const NetworkInterfaceInfo *intf;
+    mDNSu32 i, words;
+
+    counters[kDNSServiceStatistic_CacheSize]                = m->rrcache_size;
+    counters[kDNSServiceStatistic_CacheUsed]                = m->rrcache_totalused;
+    counters[kDNSServiceStatistic_CacheHits]                = m->mDNSStats.CacheHits;
+    counters[kDNSServiceStatistic_CacheMisses]              = m->mDNSStats.CacheMisses;
+    counters[kDNSServiceStatistic_CacheEvictions]           = m->rrcache_evictions;
+    counters[kDNSServiceStatistic_KnownAnswerSuppressions]  = m->mDNSStats.KnownAnswerSuppressions;
+    counters[kDNSServiceStatistic_DuplicateQuestions]       = m->mDNSStats.DuplicateQuestions;
+    counters[kDNSServiceStatistic_DupQuerySuppressions]     = m->mDNSStats.DupQuerySuppressions;
+    counters[kDNSServiceStatistic_PacketsReceived]          = (mDNSu32)m->PktNum;
+    counters[kDNSServiceStatistic_MulticastPacketsReceived] = (mDNSu32)m->MPktNum;
+    counters[kDNSServiceStatistic_ExecuteRuns]              = m->mDNSStats.ExecuteRuns;
+    counters[kDNSServiceStatistic_ExecuteMilliseconds]      = TicksToMilliseconds(m->mDNSStats.ExecuteTicks);
+    counters[kDNSServiceStatistic_ExecuteMaxMilliseconds]   = TicksToMilliseconds(m->mDNSStats.ExecuteMaxTicks);
+    counters[kDNSServiceStatistic_ReceiveRuns]              = m->mDNSStats.ReceiveRuns;
+    counters[kDNSServiceStatistic_ReceiveMilliseconds]      = TicksToMilliseconds(m->mDNSStats.ReceiveTicks);
+    counters[kDNSServiceStatistic_ReceiveMaxMilliseconds]   = TicksToMilliseconds(m->mDNSStats.ReceiveMaxTicks);
+    counters[kDNSServiceStatistic_QueryFloodSourceDrops]    = m->mDNSStats.QueryFloodSourceDrops;
+    counters[kDNSServiceStatistic_QueryFloodInterfaceDrops] = m->mDNSStats.QueryFloodInterfaceDrops;
+    counters[kDNSServiceStatistic_QueryFloodThrottles]      = m->mDNSStats.QueryFloodThrottles;
+
+    // The core counts packets on the first NetworkInterfaceInfo for each InterfaceID, so report only those
+    *numInterfaces = 0;
+    for (intf = m->HostInterfaces; intf && *numInterfaces < StatisticsMaxInterfaces; intf = intf->next)
+    {
+        if (!IsFirstInterfaceForID(intf)) continue;
+        *ptr++ = mDNSPlatformInterfaceIndexfromInterfaceID(m, intf->InterfaceID, mDNStrue);
+        *ptr++ = intf->PacketsReceived;
+        *ptr++ = intf->PacketsSent;
+        (*numInterfaces)++;
+    }
+
+    words = (mDNSu32)(ptr - reply);
+    reply[0] = 0;   // mStatus_NoError
+    reply[1] = dnssd_htonl((words - 2) * (mDNSu32)sizeof(mDNSu32));
+    reply[2] = kDNSServiceStatistics_Version;
+    reply[3] = kDNSServiceStatistic_Count;
+    for (i = 2; i < words; i++) reply[i] = dnssd_htonl(reply[i]);
+    send_all(request->sd, (const char *)reply, words * sizeof(mDNSu32));
+}
+
 mDNSlocal void handle_getproperty_request(request_state *request)
 {
     const mStatus BadParamErr = dnssd_htonl((mDNSu32)mStatus_BadParamErr);
@@ -4162,6 +5202,21 @@ mDNSlocal void handle_getproperty_request(request_state *request)
             send_all(request->sd, (const char *)&x, sizeof(x));
             return;
         }
+        if (!strcmp(prop, kDNSServiceProperty_Statistics))
+        {
+            send_statistics_reply(request);
+            return;
+        }
+        if (!strcmp(prop, kDNSServiceProperty_TopTalkers))
+        {
+            send_top_talkers_reply(request);
+            return;
+        }
+        if (!strcmp(prop, kDNSServiceProperty_Traffic))
+        {
+            send_traffic_reply(request);
+            return;
+        }
     }
 
     // If we didn't recogize the requested property name, return BadParamErr
@@ -4358,10 +5413,17 @@ mDNSlocal void addrinfo_termination_callback(request_state *request)
 {
     LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO,
            "[R%u] DNSServiceGetAddrInfo(" PRI_DM_NAME ") STOP PID[%d](" PUB_S ")",
-           request->request_id, DM_NAME_PARAM(GetAddrInfoClientRequestGetQName(&request->u.addrinfo)),
+           request->request_id, DM_NAME_PARAM(GetAddrInfoClientRequestGetQName(&request->u.addrinfo.op)),
            request->process_id, request->pid_name);
 
-    GetAddrInfoClientRequestStop(&request->u.addrinfo);
+    GetAddrInfoClientRequestStop(&request->u.addrinfo.op);
+    while (request->u.addrinfo.held)
+    {
+        reply_state *const rep = request->u.addrinfo.held;
+        request->u.addrinfo.held = rep->next;
+        FreeReply(rep);
+    }
+    request->u.addrinfo.ReleaseTime = 0;
 }
 
 typedef struct {
@@ -4395,7 +5457,7 @@ mDNSlocal mStatus _handle_addrinfo_request_start(request_state *request, const _
 #if MDNSRESPONDER_SUPPORTS(APPLE, AUDIT_TOKEN)
     gaiParams.peerAuditToken = &request->audit_token;
 #endif
-    err = GetAddrInfoClientRequestStart(&request->u.addrinfo, &gaiParams, queryrecord_result_reply, request);
+    err = GetAddrInfoClientRequestStart(&request->u.addrinfo.op, &gaiParams, queryrecord_result_reply, request);
 
     return err;
 }
@@ -4562,15 +5624,144 @@ exit:
 
 mDNSlocal request_state *NewRequest(void)
 {
-    request_state *request;
-    request_state **p = &all_requests;
-    request = (request_state *) callocL("request_state", sizeof(*request));
-    if (!request) FatalError("ERROR: calloc");
-    while (*p) p = &(*p)->next;
-    *p = request;
+    request_state *const request = (request_state *) PoolAlloc(&RequestPool);
+    LinkRequest(request);
     return(request);
 }
 
+// Creates a request_state for an operation sharing primary's connection (kDNSServiceFlagsShareConnection).
+// The new request starts out with a copy of primary's current message header and read position, but with the given
+// client context, which is how later messages on the connection refer to the operation.
+mDNSlocal request_state *NewSubordinateRequest(request_state *const primary, const client_context_t context)
+{
+    request_state *const newreq = NewRequest();
+    newreq->primary = primary;
+    newreq->sd      = primary->sd;
+    newreq->errsd   = primary->errsd;
+    newreq->uid     = primary->uid;
+    newreq->hdr     = primary->hdr;
+    newreq->hdr.client_context = context;
+    LinkSubordinateRequest(newreq);
+    newreq->msgptr  = primary->msgptr;
+    newreq->msgend  = primary->msgend;
+    newreq->request_id = GetNewRequestID();
+#if MDNSRESPONDER_SUPPORTS(APPLE, AUDIT_TOKEN)
+    newreq->audit_token = primary->audit_token;
+#endif
+    // if the parent request is a delegate connection, copy the
+    // relevant bits
+    if (primary->validUUID)
+    {
+        newreq->validUUID = mDNStrue;
+        mDNSPlatformMemCopy(newreq->uuid, primary->uuid, UUID_SIZE);
+    }
+    else
+    {
+        if (primary->process_id)
+        {
+            newreq->process_id = primary->process_id;
+            mDNSPlatformStrLCopy(newreq->pid_name, primary->pid_name, (mDNSu32)sizeof(newreq->pid_name));
+        }
+        else
+        {
+            set_peer_pid(newreq);
+        }
+    }
+    return(newreq);
+}
+
+// Batch requests (DNSServiceRegisterBatch, DNSServiceQueryRecordBatch) carry a count followed by that many entries,
+// each being the client context and ipc_flags the entry would have had as its own request, the length of its body,
+// and the body of an ordinary request of the batch's kind. Each entry becomes an ordinary subordinate operation on the
+// shared connection, so replies and cancellation work exactly as if the client had made each call separately, but
+// the client pays for one IPC round trip instead of one per entry. An entry that can't be started gets its error
+// through its callback, via fail(); only a malformed batch fails as a whole.
+typedef mStatus (*batch_entry_handler)(request_state *request);
+typedef void (*batch_entry_failure)(request_state *request, mStatus err);
+
+mDNSlocal mStatus handle_batch_request(request_state *request, const request_op_t op, batch_entry_handler handler,
+                                       batch_entry_failure fail, const char *const opname)
+{
+    const mDNSu32 count = get_uint32(&request->msgptr, request->msgend);
+    mDNSu32 i, failed = 0;
+
+    if (!request->msgptr) { LogMsg("%3d: %s(unreadable parameters)", request->sd, opname); return(mStatus_BadParamErr); }
+
+    for (i = 0; i < count; i++)
+    {
+        client_context_t context;
+        mDNSu32 ipc_flags, bodylen;
+        request_state *newreq;
+        mStatus err;
+
+        if (request->msgend - request->msgptr < (long)sizeof(context)) break;
+        mDNSPlatformMemCopy(&context, request->msgptr, sizeof(context));
+        request->msgptr += sizeof(context);
+        ipc_flags = get_uint32(&request->msgptr, request->msgend);
+        bodylen   = get_uint32(&request->msgptr, request->msgend);
+        if (!request->msgptr || bodylen > (mDNSu32)(request->msgend - request->msgptr)) break;
+
+        newreq = NewSubordinateRequest(request, context);
+        newreq->hdr.op             = op;
+        newreq->hdr.ipc_flags      = ipc_flags;
+        newreq->hdr.datalen        = bodylen;
+        newreq->msgend             = (char *)newreq->msgptr + bodylen;
+        if (ipc_flags & IPC_FLAGS_NOREPLY) newreq->no_reply = 1;
+        request->msgptr += bodylen;
+
+        err = handler(newreq);
+        if (err)
+        {
+            // Same as an asynchronous failure of a single operation: the client's callback gets the error,
+            // and the client then deallocates its DNSServiceRef, whose cancel_request frees newreq
+            fail(newreq, err);
+            failed++;
+        }
+    }
+
+    LogOperation("%3d: %s(%u entries, %u failed)", request->sd, opname, i, failed);
+    if (i < count) { LogMsg("%3d: %s(entry %u of %u unreadable)", request->sd, opname, i, count); return(mStatus_BadParamErr); }
+    return(mStatus_NoError);
+}
+
+mDNSlocal void regservice_batch_failure(request_state *request, mStatus err)
+{
+    reply_state *rep;
+    if (GenerateNTDResponse(mDNSNULL, mDNSInterface_Any, request, &rep, reg_service_reply_op, 0, err) == mStatus_NoError)
+        append_reply(request, rep);
+}
+
+// Registering the whole batch in one go means the services share a single probe suppression window
+// (see InitializeLastAPTime), so their probes and announcements are packed into as few packets as possible.
+mDNSlocal mStatus handle_regservice_batch_request(request_state *request)
+{
+    return(handle_batch_request(request, reg_service_request, handle_regservice_request, regservice_batch_failure, "DNSServiceRegisterBatch"));
+}
+
+mDNSlocal void queryrecord_batch_failure(request_state *request, mStatus err)
+{
+    // An empty DNSServiceQueryRecordReply (no name, type, class or rdata) carrying the error
+    const size_t len = sizeof(reply_hdr) + 1 + 3 * sizeof(mDNSu16) + sizeof(mDNSu32);
+    reply_state *const rep = create_reply(query_reply_op, len, request);
+    char *data = (char *)&rep->rhdr[1];
+    rep->rhdr->flags = 0;
+    rep->rhdr->ifi   = 0;
+    rep->rhdr->error = dnssd_htonl(err);
+    put_string("", &data);
+    put_uint16(0, &data);
+    put_uint16(0, &data);
+    put_uint16(0, &data);
+    put_uint32(0, &data);
+    append_reply(request, rep);
+}
+
+// Each question of a batch is started on its own, just as a single query request starts its one question, taking and
+// releasing the lock in mDNS_StartQuery. request_callback then answers the whole batch from the cache in one pass.
+mDNSlocal mStatus handle_queryrecord_batch_request(request_state *request)
+{
+    return(handle_batch_request(request, query_request, handle_queryrecord_request, queryrecord_batch_failure, "DNSServiceQueryRecordBatch"));
+}
+
 // read_msg may be called any time when the transfer state (req->ts) is t_morecoming.
 // if there is no data on the socket, the socket will be closed and t_terminated will be returned
 mDNSlocal void read_msg(request_state *req)
@@ -4622,7 +5813,7 @@ mDNSlocal void read_msg(request_state *req)
         if (req->hdr_bytes == sizeof(ipc_msg_hdr))
         {
             ConvertHeaderBytes(&req->hdr);
-            if (req->hdr.version != VERSION)
+            if (req->hdr.version != VERSION && req->hdr.version != IPC_VERSION_2)
             {
                 LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_ERROR,
                           "[R%u] ERROR: client version 0x%08X daemon version 0x%08X", req->request_id, req->hdr.version, VERSION);
@@ -4826,6 +6017,7 @@ mDNSlocal mStatus handle_client_request(request_state *req)
 #if MDNSRESPONDER_SUPPORTS(APPLE, AUDIT_TOKEN)
     SetupAuditTokenForRequest(req);
 #endif
+    mDNS_TRACE3(request__start, req->hdr.op, req->request_id, req->process_id);
     switch(req->hdr.op)
     {
             // These are all operations that have their own first-class request_state object
@@ -4860,6 +6052,9 @@ mDNSlocal mStatus handle_client_request(request_state *req)
         case update_record_request:        err = handle_update_request      (req);  break;
         case remove_record_request:        err = handle_removerecord_request(req);  break;
         case cancel_request:                     handle_cancel_request      (req);  break;
+        case reg_service_batch_request:    err = handle_regservice_batch_request(req); break;
+        case reg_record_batch_request:     err = handle_regrecord_batch_request(req); break;
+        case query_batch_request:          err = handle_queryrecord_batch_request(req); break;
         case release_request:              err = handle_release_request     (req);  break;
         default: LogMsg("request_callback: %3d:ERROR: Unsupported UDS req:%d PID[%d][%s]",
                         req->sd, req->hdr.op, req->process_id, req->pid_name);
@@ -4867,6 +6062,7 @@ mDNSlocal mStatus handle_client_request(request_state *req)
             break;
     }
 
+    mDNS_TRACE3(request__done, req->hdr.op, req->request_id, err);
     return err;
 }
 
@@ -4874,17 +6070,20 @@ mDNSlocal mStatus handle_client_request(request_state *req)
     ((X) == reg_record_request || (X) == add_record_request || (X) == update_record_request || (X) == remove_record_request)
 
 // The lightweight operations are the ones that don't need a dedicated request_state structure allocated for them
-#define LightweightOp(X) (RecordOrientedOp(X) || (X) == cancel_request)
+// (a batch request creates one subordinate request_state per entry itself)
+#define LightweightOp(X) (RecordOrientedOp(X) || (X) == cancel_request || (X) == reg_service_batch_request || (X) == query_batch_request || \
+                          (X) == reg_record_batch_request)
 
 mDNSlocal void request_callback(int fd, void *info)
 {
     mStatus err = 0;
     request_state *req = info;
-    mDNSs32 min_size = sizeof(DNSServiceFlags);
+    mDNSs32 min_size;
     (void)fd; // Unused
 
     for (;;)
     {
+        min_size = sizeof(DNSServiceFlags);     // Reset for each message, since the switch below adds to it
         read_msg(req);
         if (req->ts == t_morecoming)
             return;
@@ -4921,6 +6120,9 @@ mDNSlocal void request_callback(int fd, void *info)
             case send_bpf:                 // Same as cancel_request below
             case cancel_request:           min_size = 0;                                                                           break;
             case release_request:          min_size += sizeof(mDNSu32) + 3 /* type, type, domain */;                               break;
+            case reg_service_batch_request: // Same as query_batch_request below
+            case reg_record_batch_request:  // Same as query_batch_request below
+            case query_batch_request:      min_size = sizeof(mDNSu32) /* count */;                                                 break;
             default: LogMsg("request_callback: ERROR: validate_message - unsupported req type: %d PID[%d][%s]",
                             req->hdr.op, req->process_id, req->pid_name);
                      min_size = -1;                                                                                                break;
@@ -4944,38 +6146,8 @@ mDNSlocal void request_callback(int fd, void *info)
         // If req->terminate is already set, this means this operation is sharing an existing connection
         if (req->terminate && !LightweightOp(req->hdr.op))
         {
-            request_state *newreq = NewRequest();
-            newreq->primary = req;
-            newreq->sd      = req->sd;
-            newreq->errsd   = req->errsd;
-            newreq->uid     = req->uid;
-            newreq->hdr     = req->hdr;
+            request_state *newreq = NewSubordinateRequest(req, req->hdr.client_context);
             newreq->msgbuf  = req->msgbuf;
-            newreq->msgptr  = req->msgptr;
-            newreq->msgend  = req->msgend;
-            newreq->request_id = GetNewRequestID();
-#if MDNSRESPONDER_SUPPORTS(APPLE, AUDIT_TOKEN)
-            newreq->audit_token = req->audit_token;
-#endif
-            // if the parent request is a delegate connection, copy the
-            // relevant bits
-            if (req->validUUID)
-            {
-                newreq->validUUID = mDNStrue;
-                mDNSPlatformMemCopy(newreq->uuid, req->uuid, UUID_SIZE);
-            }
-            else
-            {
-                if (req->process_id)
-                {
-                    newreq->process_id = req->process_id;
-                    mDNSPlatformStrLCopy(newreq->pid_name, req->pid_name, (mDNSu32)sizeof(newreq->pid_name));
-                }
-                else
-                {
-                    set_peer_pid(newreq);
-                }
-            }
             req = newreq;
         }
 
@@ -4989,6 +6161,11 @@ mDNSlocal void request_callback(int fd, void *info)
         else
             err = handle_client_request(req);
 
+        // A new query or address lookup that can be answered from the cache needn't wait for the next mDNS_Execute pass;
+        // its question continues as normal afterwards, delivering any later changes the usual way
+        if (!err && (req->hdr.op == query_request || req->hdr.op == query_batch_request || req->hdr.op == addrinfo_request))
+            mDNS_AnswerNewQuestions(&mDNSStorage);
+
         // req->msgbuf may be NULL, e.g. for connection_request or remove_record_request
         if (req->msgbuf) freeL("request_state msgbuf", req->msgbuf);
 
@@ -4997,7 +6174,17 @@ mDNSlocal void request_callback(int fd, void *info)
         if (req->hdr.op != cancel_request && req->hdr.op != getproperty_request && req->hdr.op != send_bpf && req->hdr.op != getpid_request)
         {
             const mStatus err_netorder = dnssd_htonl(err);
-            send_all(req->errsd, (const char *)&err_netorder, sizeof(err_netorder));
+            // A record registration batch that was accepted has already sent its per-record error codes
+            if (req->hdr.op == reg_record_batch_request && !err)
+                ;
+            // If replies are already waiting and go on the same socket, send them along with the error code
+            else if (req->errsd == req->sd && req->replies)
+            {
+                const transfer_state result = send_msg(req, (const char *)&err_netorder, sizeof(err_netorder));
+                free_sent_replies(req);
+                if (result == t_terminated || result == t_error) LogInfo("%3d: request_callback: could not send replies", req->sd);
+            }
+            else send_all(req->errsd, (const char *)&err_netorder, sizeof(err_netorder));
             if (req->errsd != req->sd)
             {
                 dnssd_close(req->errsd);
@@ -5060,6 +6247,7 @@ mDNSlocal void connect_callback(int fd, void *info)
         request->errsd = sd;
         request->request_id = GetNewRequestID();
         set_peer_pid(request);
+        AttachClientProcess(request);
 #if APPLE_OSX_mDNSResponder
         struct xucred x;
         socklen_t xucredlen = sizeof(x);
@@ -5120,11 +6308,75 @@ mDNSlocal mDNSBool uds_socket_setup(dnssd_sock_t skt)
 mDNSlocal void udsserver_validatelists(void *context);
 #endif
 
-mDNSexport int udsserver_init(dnssd_sock_t skts[], const size_t count)
+mDNSexport int udsserver_listen(void)
 {
     dnssd_sockaddr_t laddr;
     int ret;
 
+    if (dnssd_SocketValid(listenfd)) return 0;
+    listenfd = socket(AF_DNSSD, SOCK_STREAM, 0);
+    if (!dnssd_SocketValid(listenfd))
+    {
+        my_perror("ERROR: socket(AF_DNSSD, SOCK_STREAM, 0); failed");
+        return -1;
+    }
+
+    mDNSPlatformMemZero(&laddr, sizeof(laddr));
+
+    #if defined(USE_TCP_LOOPBACK)
+    {
+        laddr.sin_family = AF_INET;
+        laddr.sin_port = htons(MDNS_TCP_SERVERPORT);
+        laddr.sin_addr.s_addr = inet_addr(MDNS_TCP_SERVERADDR);
+        ret = bind(listenfd, (struct sockaddr *) &laddr, sizeof(laddr));
+        if (ret < 0)
+        {
+            my_perror("ERROR: bind(listenfd, (struct sockaddr *) &laddr, sizeof(laddr)); failed");
+            goto error;
+        }
+    }
+    #else
+    {
+        mode_t mask = umask(0);
+        unlink(boundPath);  // OK if this fails
+        laddr.sun_family = AF_LOCAL;
+        #ifndef NOT_HAVE_SA_LEN
+        // According to Stevens (section 3.2), there is no portable way to
+        // determine whether sa_len is defined on a particular platform.
+        laddr.sun_len = sizeof(struct sockaddr_un);
+        #endif
+        if (strlen(boundPath) >= sizeof(laddr.sun_path))
+        {
+            LogMsg("ERROR: MDNS_UDS_SERVERPATH must be < %d characters", (int)sizeof(laddr.sun_path));
+            goto error;
+        }
+        mDNSPlatformStrLCopy(laddr.sun_path, boundPath, sizeof(laddr.sun_path));
+        ret = bind(listenfd, (struct sockaddr *) &laddr, sizeof(laddr));
+        umask(mask);
+        if (ret < 0)
+        {
+            my_perror("ERROR: bind(listenfd, (struct sockaddr *) &laddr, sizeof(laddr)); failed");
+            goto error;
+        }
+    }
+    #endif
+
+    // Clients that connect before udsserver_init() wait in the backlog, their requests unread until then
+    if (listen(listenfd, LISTENQ) != 0)
+    {
+        my_perror("ERROR: could not listen on listen socket");
+        goto error;
+    }
+    return 0;
+
+error:
+    dnssd_close(listenfd);
+    listenfd = dnssd_InvalidSocket;
+    return -1;
+}
+
+mDNSexport int udsserver_init(dnssd_sock_t skts[], const size_t count)
+{
 #ifndef NO_PID_FILE
     FILE *fp = fopen(PID_FILE, "w");
     if (fp != NULL)
@@ -5148,53 +6400,7 @@ mDNSexport int udsserver_init(dnssd_sock_t skts[], const size_t count)
     }
     else
     {
-        listenfd = socket(AF_DNSSD, SOCK_STREAM, 0);
-        if (!dnssd_SocketValid(listenfd))
-        {
-            my_perror("ERROR: socket(AF_DNSSD, SOCK_STREAM, 0); failed");
-            goto error;
-        }
-
-        mDNSPlatformMemZero(&laddr, sizeof(laddr));
-
-        #if defined(USE_TCP_LOOPBACK)
-        {
-            laddr.sin_family = AF_INET;
-            laddr.sin_port = htons(MDNS_TCP_SERVERPORT);
-            laddr.sin_addr.s_addr = inet_addr(MDNS_TCP_SERVERADDR);
-            ret = bind(listenfd, (struct sockaddr *) &laddr, sizeof(laddr));
-            if (ret < 0)
-            {
-                my_perror("ERROR: bind(listenfd, (struct sockaddr *) &laddr, sizeof(laddr)); failed");
-                goto error;
-            }
-        }
-        #else
-        {
-            mode_t mask = umask(0);
-            unlink(boundPath);  // OK if this fails
-            laddr.sun_family = AF_LOCAL;
-            #ifndef NOT_HAVE_SA_LEN
-            // According to Stevens (section 3.2), there is no portable way to
-            // determine whether sa_len is defined on a particular platform.
-            laddr.sun_len = sizeof(struct sockaddr_un);
-            #endif
-            if (strlen(boundPath) >= sizeof(laddr.sun_path))
-            {
-                LogMsg("ERROR: MDNS_UDS_SERVERPATH must be < %d characters", (int)sizeof(laddr.sun_path));
-                goto error;
-            }
-            mDNSPlatformStrLCopy(laddr.sun_path, boundPath, sizeof(laddr.sun_path));
-            ret = bind(listenfd, (struct sockaddr *) &laddr, sizeof(laddr));
-            umask(mask);
-            if (ret < 0)
-            {
-                my_perror("ERROR: bind(listenfd, (struct sockaddr *) &laddr, sizeof(laddr)); failed");
-                goto error;
-            }
-        }
-        #endif
-
+        if (udsserver_listen() != 0) goto error;
         if (!uds_socket_setup(listenfd)) goto error;
     }
 
@@ -5345,9 +6551,9 @@ mDNSlocal void LogClientInfoToFD(int fd, request_state *req)
     else if (req->terminate == addrinfo_termination_callback)
         LogToFD(fd, "%s DNSServiceGetAddrInfo      0x%08X %2d %s%s %##s PID[%d](%s)",
                   prefix, req->flags, req->interfaceIndex,
-                  req->u.addrinfo.protocols & kDNSServiceProtocol_IPv4 ? "v4" : "  ",
-                  req->u.addrinfo.protocols & kDNSServiceProtocol_IPv6 ? "v6" : "  ",
-                  GetAddrInfoClientRequestGetQName(&req->u.addrinfo), req->process_id, req->pid_name);
+                  req->u.addrinfo.op.protocols & kDNSServiceProtocol_IPv4 ? "v4" : "  ",
+                  req->u.addrinfo.op.protocols & kDNSServiceProtocol_IPv6 ? "v6" : "  ",
+                  GetAddrInfoClientRequestGetQName(&req->u.addrinfo.op), req->process_id, req->pid_name);
     else
         LogToFD(fd, "%s Unrecognized operation %p", prefix, req->terminate);
 }
@@ -5421,9 +6627,9 @@ mDNSlocal void LogClientInfo(request_state *req)
     else if (req->terminate == addrinfo_termination_callback)
     LogMsgNoIdent("%s DNSServiceGetAddrInfo      0x%08X %2d %s%s %##s PID[%d](%s)",
                   prefix, req->flags, req->interfaceIndex,
-                  req->u.addrinfo.protocols & kDNSServiceProtocol_IPv4 ? "v4" : "  ",
-                  req->u.addrinfo.protocols & kDNSServiceProtocol_IPv6 ? "v6" : "  ",
-                  GetAddrInfoClientRequestGetQName(&req->u.addrinfo), req->process_id, req->pid_name);
+                  req->u.addrinfo.op.protocols & kDNSServiceProtocol_IPv4 ? "v4" : "  ",
+                  req->u.addrinfo.op.protocols & kDNSServiceProtocol_IPv6 ? "v6" : "  ",
+                  GetAddrInfoClientRequestGetQName(&req->u.addrinfo.op), req->process_id, req->pid_name);
     else
     LogMsgNoIdent("%s Unrecognized operation %p", prefix, req->terminate);
 }
@@ -5479,7 +6685,7 @@ mDNSlocal void GetMcastClients(request_state *req)
     }
     else if (req->terminate == addrinfo_termination_callback)
     {
-        if (GetAddrInfoClientRequestIsMulticast(&req->u.addrinfo))
+        if (GetAddrInfoClientRequestIsMulticast(&req->u.addrinfo.op))
             n_mquests++;
     }
     else
@@ -5551,12 +6757,12 @@ mDNSlocal void LogMcastClientInfo(request_state *req)
     }
     else if (req->terminate == addrinfo_termination_callback)
     {
-        if (GetAddrInfoClientRequestIsMulticast(&req->u.addrinfo))
+        if (GetAddrInfoClientRequestIsMulticast(&req->u.addrinfo.op))
         {
             LogMcastNoIdent("Q: DNSServiceGetAddrInfo  %s%s %##s PID[%d](%s)",
-                          req->u.addrinfo.protocols & kDNSServiceProtocol_IPv4 ? "v4" : "  ",
-                          req->u.addrinfo.protocols & kDNSServiceProtocol_IPv6 ? "v6" : "  ",
-                          GetAddrInfoClientRequestGetQName(&req->u.addrinfo), req->process_id, req->pid_name, i_mcount++);
+                          req->u.addrinfo.op.protocols & kDNSServiceProtocol_IPv4 ? "v4" : "  ",
+                          req->u.addrinfo.op.protocols & kDNSServiceProtocol_IPv6 ? "v6" : "  ",
+                          GetAddrInfoClientRequestGetQName(&req->u.addrinfo.op), req->process_id, req->pid_name, i_mcount++);
         }
     }
 }
@@ -5586,10 +6792,10 @@ mDNSlocal int LogEtcHostsToFD(int fd, mDNS *const m)
     int authslot = 0;
     mDNSBool truncated = 0;
 
-    for (slot = 0; slot < AUTH_HASH_SLOTS; slot++)
+    for (slot = 0; slot < AuthHashSlots(&m->rrauth); slot++)
     {
-        if (m->rrauth.rrauth_hash[slot]) authslot++;
-        for (ag = m->rrauth.rrauth_hash[slot]; ag; ag = ag->next)
+        if (AuthHashHead(&m->rrauth, slot)) authslot++;
+        for (ag = AuthHashHead(&m->rrauth, slot); ag; ag = ag->next)
             for (ar = ag->members; ar; ar = ar->next)
             {
                 if (ar->RecordCallback != FreeEtcHosts) continue;
@@ -5603,7 +6809,7 @@ mDNSlocal int LogEtcHostsToFD(int fd, mDNS *const m)
                         LogToFD(fd, " %s   LO %s", RecordTypeName(ar->resrec.RecordType), ARDisplayString(m, ar));
                     else
                     {
-                        mDNSu32 scopeid  = (mDNSu32)(uintptr_t)ar->resrec.InterfaceID;
+                        mDNSu32 scopeid  = mDNSPlatformInterfaceIndexfromInterfaceID(m, ar->resrec.InterfaceID, mDNStrue);
                         LogToFD(fd, " %s   %u  %s", RecordTypeName(ar->resrec.RecordType), scopeid, ARDisplayString(m, ar));
                     }
                 }
@@ -5622,9 +6828,9 @@ mDNSlocal void LogLocalOnlyAuthRecordsToFD(int fd, mDNS *const m)
     mDNSu32 slot;
     AuthGroup *ag;
 
-    for (slot = 0; slot < AUTH_HASH_SLOTS; slot++)
+    for (slot = 0; slot < AuthHashSlots(&m->rrauth); slot++)
     {
-        for (ag = m->rrauth.rrauth_hash[slot]; ag; ag = ag->next)
+        for (ag = AuthHashHead(&m->rrauth, slot); ag; ag = ag->next)
             for (ar = ag->members; ar; ar = ar->next)
             {
                 if (ar->RecordCallback == FreeEtcHosts) continue;
@@ -5744,8 +6950,70 @@ mDNSlocal void PrintCachedRecordsToFD(int fd, const CacheRecord *cr, mDNSu32 slo
     }
 }
 
+mDNSlocal void LogExecuteHistogramToFD(int fd, const char *const name, const mDNSu32 *const hist)
+{
+    char buffer[256];
+    mDNSu32 length = 0;
+    int b;
+    for (b = 0; b < ExecuteHistogramBuckets; b++)
+        length += mDNS_snprintf(buffer + length, sizeof(buffer) - length, " %7u", hist[b]);
+    LogToFD(fd, "%-14s%s", name, buffer);
+}
+
+#if MDNS_MALLOC_PROFILING
+mDNSlocal int CompareMallocProfileBytes(const void *a, const void *b)
+{
+    const mDNSu32 x = ((const mDNSMallocProfileEntry *)a)->bytes, y = ((const mDNSMallocProfileEntry *)b)->bytes;
+    return((x < y) - (x > y));
+}
+
+mDNSlocal void LogMallocProfileToFD(int fd)
+{
+    static mDNSMallocProfileEntry entries[MDNS_MALLOC_PROFILE_TAGS];
+    const mDNSu32 n = mDNSMallocProfileCopy(entries, MDNS_MALLOC_PROFILE_TAGS);
+    mDNSu32 i, blocks = 0, bytes = 0;
+
+    mDNSPlatformQsort(entries, (int)n, sizeof(entries[0]), CompareMallocProfileBytes);
+    LogToFD(fd, "--- Allocations by callsite (live blocks, live bytes, peak bytes, allocations) ---");
+    for (i = 0; i < n; i++)
+    {
+        blocks += entries[i].blocks;
+        bytes  += entries[i].bytes;
+        if (entries[i].blocks || entries[i].peakBytes)
+            LogToFD(fd, "%8u %10u %10u %10u  %s", entries[i].blocks, entries[i].bytes, entries[i].peakBytes,
+                    entries[i].allocations, entries[i].tag);
+    }
+    LogToFD(fd, "%8u %10u  total", blocks, bytes);
+}
+#endif
+
+mDNSlocal void LogTrafficStatsToFD(int fd, mDNS *const m)
+{
+    const mDNSTrafficStats *const s = &m->TrafficStats;
+    const mDNSTrafficStatsEntry *sorted[TrafficStatsSlots];
+    mDNSu32 i, n;
+
+    LogToFD(fd, "--- Top Talkers (counts halved every %d s, %u times so far; error is the possible overcount) ---",
+            TrafficStatsDecayInterval / mDNSPlatformOneSecond, s->decays);
+    n = mDNS_TrafficStatsSorted(&s->types, sorted);
+    LogToFD(fd, "Service type                      names    error  queries responses  (%u names in all)", s->types.total);
+    for (i = 0; i < n; i++)
+        LogToFD(fd, "%-30s %8u %8u %8u %9u", sorted[i]->key.type, sorted[i]->count, sorted[i]->error,
+                sorted[i]->queries, sorted[i]->responses);
+    n = mDNS_TrafficStatsSorted(&s->sources, sorted);
+    LogToFD(fd, "Source address                  packets    error  queries responses     bytes  (%u packets in all)", s->sources.total);
+    for (i = 0; i < n; i++)
+        LogToFD(fd, "%-30#a %8u %8u %8u %9u %9u", &sorted[i]->key.addr, sorted[i]->count, sorted[i]->error,
+                sorted[i]->queries, sorted[i]->responses, sorted[i]->bytes);
+}
+
 mDNSexport void LogMDNSStatisticsToFD(int fd, mDNS *const m)
 {
+    const NetworkInterfaceInfo *intf;
+    const mDNSs32 now = mDNS_TimeNow(m);
+    mDNSu32 i;
+    int phase;
+
     LogToFD(fd, "--- MDNS Statistics ---");
 
     LogToFD(fd, "Name Conflicts                 %u", m->mDNSStats.NameConflicts);
@@ -5765,6 +7033,7 @@ mDNSexport void LogMDNSStatisticsToFD(int fd, mDNS *const m)
     LogToFD(fd, "Unicast responses              %u", m->mDNSStats.UnicastResponses);
     LogToFD(fd, "Multicast responses            %u", m->mDNSStats.MulticastResponses);
     LogToFD(fd, "Unicast response Demotions     %u", m->mDNSStats.UnicastDemotedToMulticast);
+    LogToFD(fd, "Shared response answers        %u", m->mDNSStats.SharedResponseAnswers);
     LogToFD(fd, "--------------------------------");
 
     LogToFD(fd, "Sleeps                         %u", m->mDNSStats.Sleeps);
@@ -5776,36 +7045,135 @@ mDNSexport void LogMDNSStatisticsToFD(int fd, mDNS *const m)
     LogToFD(fd, "Cache refresh queries          %u", m->mDNSStats.CacheRefreshQueries);
     LogToFD(fd, "Cache refreshed                %u", m->mDNSStats.CacheRefreshed);
     LogToFD(fd, "Wakeup on Resolves             %u", m->mDNSStats.WakeOnResolves);
+    LogToFD(fd, "--------------------------------");
+
+    LogToFD(fd, "Cache hits                     %u", m->mDNSStats.CacheHits);
+    LogToFD(fd, "Cache misses                   %u", m->mDNSStats.CacheMisses);
+    LogToFD(fd, "Duplicate questions            %u", m->mDNSStats.DuplicateQuestions);
+    LogToFD(fd, "Execute runs                   %u (%u ticks total, %u max)", m->mDNSStats.ExecuteRuns,
+            m->mDNSStats.ExecuteTicks, m->mDNSStats.ExecuteMaxTicks);
+    LogToFD(fd, "Receive runs                   %u (%u ticks total, %u max)", m->mDNSStats.ReceiveRuns,
+            m->mDNSStats.ReceiveTicks, m->mDNSStats.ReceiveMaxTicks);
+    LogToFD(fd, "Question restart bursts        %u (%u questions max, %u spread out)", m->mDNSStats.QuestionRestartBursts,
+            m->mDNSStats.QuestionRestartMax, m->mDNSStats.QuestionRestartsSpread);
+    LogToFD(fd, "Busy link query backoffs       %u", m->mDNSStats.BusyLinkQueryBackoffs);
+    LogToFD(fd, "Query flood drops              %u over a source limit, %u over an interface limit (%u throttles)",
+            m->mDNSStats.QueryFloodSourceDrops, m->mDNSStats.QueryFloodInterfaceDrops, m->mDNSStats.QueryFloodThrottles);
+    LogToFD(fd, "Batched answers                %u in %u batches (%u max)",
+            m->mDNSStats.AnswerBatchAnswers, m->mDNSStats.AnswerBatches, m->mDNSStats.AnswerBatchMaxAnswers);
+    for (i = 0; i < m->QueryFlood.used; i++)
+    {
+        const mDNSQueryFloodSource *const s = &m->QueryFlood.source[i];
+        if (s->dropped)
+            LogToFD(fd, "Query flood source %#-39a %-10s %u dropped%s", &s->addr, InterfaceNameForID(m, s->InterfaceID),
+                    s->dropped, s->bucket.throttled ? ", throttled" : "");
+    }
+    LogToFD(fd, "Wakeups per minute             %u this minute, %u last minute, %u max", m->mDNSStats.WakeupsThisMinute,
+            m->mDNSStats.WakeupsLastMinute, m->mDNSStats.WakeupsMaxPerMinute);
+    for (intf = m->HostInterfaces; intf; intf = intf->next)
+        if (intf->PacketsReceived || intf->PacketsSent)
+            LogToFD(fd, "Interface %-20s %u received, %u sent, %u multicast/s", intf->ifname, intf->PacketsReceived,
+                    intf->PacketsSent, mDNSCoreInterfaceMulticastRate(intf, now));
+    for (intf = m->HostInterfaces; intf; intf = intf->next)
+    {
+        const mDNSInterfaceTraffic *const dir[2] = { &intf->TrafficIn, &intf->TrafficOut };
+        int d;
+        if (!intf->PacketsReceived && !intf->PacketsSent) continue;
+        for (d = 0; d < 2; d++)
+            LogToFD(fd, "Interface %-20s %-3s %u queries (%u bytes), %u responses (%u bytes), %u probes (%u bytes)",
+                    intf->ifname, d ? "out" : "in",
+                    dir[d]->packets[mDNSTrafficKind_Query],    dir[d]->bytes[mDNSTrafficKind_Query],
+                    dir[d]->packets[mDNSTrafficKind_Response], dir[d]->bytes[mDNSTrafficKind_Response],
+                    dir[d]->packets[mDNSTrafficKind_Probe],    dir[d]->bytes[mDNSTrafficKind_Probe]);
+    }
+    LogTrafficStatsToFD(fd, m);
+
+    if (m->ExecuteProfiling)
+    {
+        LogToFD(fd, "--- mDNS_Execute profile (bucket b counts samples of [2^(b-1), 2^b) ticks) ---");
+        LogExecuteHistogramToFD(fd, "Late", m->ExecuteProfile.Lateness);
+        for (phase = 0; phase < ExecutePhase_Count; phase++)
+            LogExecuteHistogramToFD(fd, ExecutePhaseNames[phase], m->ExecuteProfile.Duration[phase]);
+        LogExecuteHistogramToFD(fd, "Lock", m->ExecuteProfile.LockHold);
+        if (m->ExecuteProfile.LockHoldLongestBy)
+            LogToFD(fd, "Longest mDNS lock hold %d ticks, taken by %s", m->ExecuteProfile.LockHoldLongest,
+                    m->ExecuteProfile.LockHoldLongestBy);
+    }
+#if MDNS_MALLOC_PROFILING
+    LogMallocProfileToFD(fd);
+#endif
 }
 
-mDNSexport void udsserver_info_dump_to_fd(int fd)
+// A state dump in progress. When it's streamed, udsserver_info_dump_continue() writes one section at a time, and
+// the cache a bounded number of records at a time, so a large cache doesn't hold up everything else while it's
+// written out. Records added, removed or moved by a hash resize between steps can be missed or listed twice, so the
+// cache counters are written first, before the walk, rather than checked against it.
+typedef struct
+{
+    int fd;
+    mDNSu32 sections;               // kInfoSection_* bits still to be written
+    mDNSBool streamed;
+    mDNSBool CacheStarted;
+    mDNSu32 slot;                   // Next cache hash slot to walk
+    int FilterLabels;               // Zero for no filter, otherwise one more than the label count of filter
+    domainname filter;
+    mDNSu32 groups, mcast, ucast, active;
+    mDNSu32 neg, negSOA, negShared, negSharedBytes;
+    mDNSBool ProxyCounted;
+    int ProxyA, ProxyD;
+} InfoDump;
+
+#define InfoDumpRecordsPerStep 256
+
+static InfoDump StreamedDump;
+static mDNSBool StreamedDumpActive = mDNSfalse;
+
+mDNSlocal void InfoDumpInit(InfoDump *const dump, int fd, mDNSu32 sections, const domainname *const filter, mDNSBool streamed)
+{
+    mDNSPlatformMemZero(dump, sizeof(*dump));
+    dump->fd       = fd;
+    dump->sections = sections & kInfoSection_All;
+    dump->streamed = streamed;
+    if (filter && filter->c[0])
+    {
+        AssignDomainName(&dump->filter, filter);
+        dump->FilterLabels = CountLabels(filter) + 1;
+    }
+}
+
+mDNSlocal mDNSBool InfoDumpNameMatches(const InfoDump *const dump, const domainname *const name)
+{
+    int skip;
+    if (!dump->FilterLabels) return mDNStrue;
+    skip = CountLabels(name) - (dump->FilterLabels - 1);
+    return (skip >= 0 && SameDomainName(SkipLeadingLabels(name, skip), &dump->filter));
+}
+
+// Walks cache slots from dump->slot, stopping at the end of a slot once InfoDumpRecordsPerStep records have been
+// written if the dump is streamed
+mDNSlocal void LogCacheSlotsToFD(InfoDump *const dump)
 {
     mDNS *const m = &mDNSStorage;
+    const int fd = dump->fd;
     const mDNSs32 now = mDNS_TimeNow(m);
-    mDNSu32 CacheUsed = 0, CacheActive = 0, slot;
-    int ProxyA = 0, ProxyD = 0;
-    mDNSu32 groupCount = 0;
-    mDNSu32 mcastRecordCount = 0;
-    mDNSu32 ucastRecordCount = 0;
+    mDNSu32 written = 0;
     const CacheGroup *cg;
     const CacheRecord *cr;
-    const DNSQuestion *q;
-    const DNameListElem *d;
-    const SearchListElem *s;
 
-    LogToFD(fd, "------------ Cache -------------");
-    LogToFD(fd, "Slt Q     TTL if     U Type rdlen");
-    for (slot = 0; slot < CACHE_HASH_SLOTS; slot++)
+    for (; dump->slot < m->rrcache_slots; dump->slot++)
     {
+        const mDNSu32 slot = dump->slot;
+        if (dump->streamed && written >= InfoDumpRecordsPerStep) break;
         for (cg = m->rrcache_hash[slot]; cg; cg=cg->next)
         {
-            groupCount++;   // Count one cache entity for the CacheGroup object
+            if (!InfoDumpNameMatches(dump, cg->name)) continue;
+            dump->groups++;   // Count one cache entity for the CacheGroup object
             for (cr = cg->members; cr; cr=cr->next)
             {
                 const mDNSs32 remain = cr->resrec.rroriginalttl - (now - cr->TimeRcvd) / mDNSPlatformOneSecond;
                 const char *ifname;
                 mDNSInterfaceID InterfaceID = cr->resrec.InterfaceID;
-                mDNSu32 *const countPtr = InterfaceID ? &mcastRecordCount : &ucastRecordCount;
+                mDNSu32 *const countPtr = InterfaceID ? &dump->mcast : &dump->ucast;
 #if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
                 if (!InterfaceID && cr->resrec.dnsservice &&
                     (mdns_dns_service_get_scope(cr->resrec.dnsservice) == mdns_dns_service_scope_interface))
@@ -5817,20 +7185,100 @@ mDNSexport void udsserver_info_dump_to_fd(int fd)
                     InterfaceID = cr->resrec.rDNSServer->interface;
 #endif
                 ifname = InterfaceNameForID(m, InterfaceID);
-                if (cr->CRActiveQuestion) CacheActive++;
+                if (cr->CRActiveQuestion) dump->active++;
+                if (cr->resrec.RecordType == kDNSRecordTypePacketNegative)
+                {
+                    const CacheRecord *const soa = NegativeCacheRecordSOA(m, cr);
+                    dump->neg++;
+                    if (cr->soa) dump->negSOA++;
+                    else if (soa)
+                    {
+                        dump->negShared++;
+                        dump->negSharedBytes += (mDNSu32)sizeof(CacheEntity);
+                        if (soa->resrec.rdata != (const RData *)&soa->smallrdatastorage)
+                            dump->negSharedBytes += sizeofRDataHeader + soa->resrec.rdata->MaxRDLength;
+                    }
+                }
                 PrintOneCacheRecordToFD(fd, cr, slot, remain, ifname, countPtr);
                 PrintCachedRecordsToFD(fd, cr, slot, remain, ifname, countPtr);
+                written++;
             }
         }
     }
+}
 
-    CacheUsed = groupCount + mcastRecordCount + ucastRecordCount;
-    if (m->rrcache_totalused != CacheUsed)
-        LogToFD(fd, "Cache use mismatch: rrcache_totalused is %lu, true count %lu", m->rrcache_totalused, CacheUsed);
-    if (m->rrcache_active != CacheActive)
-        LogToFD(fd, "Cache use mismatch: rrcache_active is %lu, true count %lu", m->rrcache_active, CacheActive);
-    LogToFD(fd, "Cache size %u entities; %u in use (%u group, %u multicast, %u unicast); %u referenced by active questions",
-              m->rrcache_size, CacheUsed, groupCount, mcastRecordCount, ucastRecordCount, CacheActive);
+// Totals over the records the walk listed. Only an unfiltered walk done in one go can be checked against the
+// core's own counts.
+mDNSlocal void LogCacheWalkToFD(const InfoDump *const dump)
+{
+    mDNS *const m = &mDNSStorage;
+    const int fd = dump->fd;
+    const mDNSu32 CacheUsed = dump->groups + dump->mcast + dump->ucast;
+
+    if (!dump->streamed && !dump->FilterLabels)
+    {
+        if (m->rrcache_totalused != CacheUsed)
+            LogToFD(fd, "Cache use mismatch: rrcache_totalused is %lu, true count %lu", m->rrcache_totalused, CacheUsed);
+        if (m->rrcache_active != dump->active)
+            LogToFD(fd, "Cache use mismatch: rrcache_active is %lu, true count %lu", m->rrcache_active, dump->active);
+        LogToFD(fd, "Cache size %u entities; %u in use (%u group, %u multicast, %u unicast); %u referenced by active questions",
+                  m->rrcache_size, CacheUsed, dump->groups, dump->mcast, dump->ucast, dump->active);
+    }
+    else
+        LogToFD(fd, "Listed %u entities%s (%u group, %u multicast, %u unicast); %u referenced by active questions",
+                  CacheUsed, dump->FilterLabels ? " matching the filter" : "", dump->groups, dump->mcast, dump->ucast, dump->active);
+    LogToFD(fd, "Negative cache entries %u; %u hold an SOA copy, %u share one (%u bytes saved); %u SOA copies not kept in all",
+              dump->neg, dump->negSOA, dump->negShared, dump->negSharedBytes, m->mDNSStats.NegativeSOAShared);
+}
+
+mDNSlocal void LogCacheCountersToFD(int fd, mDNS *const m, mDNSBool streamed)
+{
+    mDNSu32 slot;
+    int i;
+
+    if (streamed)
+        LogToFD(fd, "Cache size %u entities; %u in use; %u referenced by active questions",
+                  m->rrcache_size, m->rrcache_totalused, m->rrcache_active);
+    LogToFD(fd, "Cache hash %u slots (%u allocated); %u groups", m->rrcache_slots, m->rrcache_hash_capacity, m->rrcache_groups);
+    LogToFD(fd, "Cache evictions %u; %u/s in the last second (peak %u/s); last evicted age %d s (oldest %d s)",
+              m->rrcache_evictions, m->rrcache_evict_rate, m->rrcache_evict_peak,
+              m->rrcache_evict_age / mDNSPlatformOneSecond, m->rrcache_evict_age_max / mDNSPlatformOneSecond);
+    LogToFD(fd, "Cache storage %u bytes (limit %u); %u blocks released; auth %u entities (limit %u bytes), %u released",
+              m->rrcache_size * (mDNSu32)sizeof(CacheEntity), m->rrcache_mem_limit, m->rrcache_blocks_released,
+              m->rrauth.rrauth_size, m->rrauth.rrauth_mem_limit, m->rrauth.rrauth_released);
+    LogToFD(fd, "Cache partition quota %u%% per multicast interface; %u records recycled within their partition; %u unaccounted",
+              m->rrcache_partition_quota, m->rrcache_partition_evictions, m->rrcache_partition_overflow);
+    if (m->ResponseFilter)
+        LogToFD(fd, "Response filter: %u records accepted, %u rejected, %u cached passively (budget %u/s)",
+                  m->ResponseFilterAccepted, m->ResponseFilterRejected, m->ResponseFilterPassive, m->PassiveCacheBudget);
+    for (i = 0; i < CachePartitionCount; i++)
+    {
+        const CachePartition *const p = &m->rrcache_partitions[i];
+        if (p->used)
+        {
+            const char *const ifname = p->InterfaceID ? InterfaceNameForID(m, p->InterfaceID) : mDNSNULL;
+            LogToFD(fd, "Cache partition %-20s %u records", p->InterfaceID ? (ifname ? ifname : "(gone)") : "(unicast)", p->used);
+        }
+    }
+    for (slot = 0; slot < MemSlabClasses; slot++)
+    {
+        const MemSlabClass *const c = &m->rrcache_slabs[slot];
+        if (slot == MemSlabOversize)
+            LogToFD(fd, "Cache storage oversize: %u in use (peak %u); %u allocations",
+                      c->inuse, c->peak, c->allocs);
+        else
+            LogToFD(fd, "Cache storage %4u-byte class: %u in use (peak %u) in %u slabs; %u allocations; %u slabs released",
+                      c->objsize, c->inuse, c->peak, c->slabs, c->allocs, c->released);
+    }
+    LogToFD(fd, "Interned names %u (%u bytes) in %u buckets; %u copies saved by sharing",
+              m->names_count, m->names_bytes, m->names_slots, m->names_shared);
+}
+
+mDNSlocal void LogRecordsSectionToFD(InfoDump *const dump)
+{
+    mDNS *const m = &mDNSStorage;
+    const int fd = dump->fd;
+    const mDNSs32 now = mDNS_TimeNow(m);
 
     LogToFD(fd, "--------- Auth Records ---------");
     LogAuthRecordsToFD(fd, now, m->ResourceRecords, mDNSNULL);
@@ -5845,23 +7293,32 @@ mDNSexport void udsserver_info_dump_to_fd(int fd)
     LogAuthRecordsToFD(fd, now, m->DuplicateRecords, mDNSNULL);
 
     LogToFD(fd, "----- Auth Records Proxied -----");
-    LogAuthRecordsToFD(fd, now, m->ResourceRecords, &ProxyA);
+    LogAuthRecordsToFD(fd, now, m->ResourceRecords, &dump->ProxyA);
 
     LogToFD(fd, "-- Duplicate Records Proxied ---");
-    LogAuthRecordsToFD(fd, now, m->DuplicateRecords, &ProxyD);
+    LogAuthRecordsToFD(fd, now, m->DuplicateRecords, &dump->ProxyD);
+    dump->ProxyCounted = mDNStrue;
+}
+
+mDNSlocal void LogQuestionsSectionToFD(const InfoDump *const dump)
+{
+    mDNS *const m = &mDNSStorage;
+    const int fd = dump->fd;
+    const mDNSs32 now = mDNS_TimeNow(m);
+    mDNSu32 CacheUsed = 0, CacheActive = 0;
+    const DNSQuestion *q;
 
     LogToFD(fd, "---------- Questions -----------");
     if (!m->Questions) LogToFD(fd, "<None>");
     else
     {
-        CacheUsed = 0;
-        CacheActive = 0;
         LogToFD(fd, "   Int  Next if     T NumAns VDNS                               Qptr               DupOf              SU SQ Type Name");
         for (q = m->Questions; q; q=q->next)
         {
             mDNSs32 i = q->ThisQInterval / mDNSPlatformOneSecond;
             mDNSs32 n = (NextQSendTime(q) - now) / mDNSPlatformOneSecond;
             char *ifname = InterfaceNameForID(m, q->InterfaceID);
+            if (!InfoDumpNameMatches(dump, &q->qname)) continue;
             CacheUsed++;
             if (q->ThisQInterval) CacheActive++;
 #if MDNSRESPONDER_SUPPORTS(APPLE, QUERIER)
@@ -5886,9 +7343,14 @@ mDNSexport void udsserver_info_dump_to_fd(int fd)
     LogToFD(fd, "----- LocalOnly, P2P Questions -----");
     if (!m->LocalOnlyQuestions) LogToFD(fd, "<None>");
     else for (q = m->LocalOnlyQuestions; q; q=q->next)
-        LogToFD(fd, "                 %3s   %5d  %-6s%##s%s",
+        if (InfoDumpNameMatches(dump, &q->qname)) LogToFD(fd, "                 %3s   %5d  %-6s%##s%s",
                   q->InterfaceID == mDNSInterface_LocalOnly ? "LO ": q->InterfaceID == mDNSInterface_BLE ? "BLE": "P2P",
                   q->CurrentAnswers, DNSTypeName(q->qtype), q->qname.c, q->DuplicateOf ? " (dup)" : "");
+}
+
+mDNSlocal void LogClientsSectionToFD(int fd)
+{
+    int i;
 
     LogToFD(fd, "---- Active UDS Client Requests ----");
     if (!all_requests) LogToFD(fd, "<None>");
@@ -5908,11 +7370,59 @@ mDNSexport void udsserver_info_dump_to_fd(int fd)
         }
     }
 
+    LogToFD(fd, "------ UDS Object Pools --------");
+    LogPoolToFD(fd, &RequestPool);
+    LogPoolToFD(fd, &RecordEntryPool);
+    for (i = 0; i < ReplyPoolBuckets; i++) LogPoolToFD(fd, &ReplyPools[i]);
+    {
+        QueryRecordOpPoolStats stats;
+        QueryRecordOpGetPoolStats(&stats);
+        LogToFD(fd, "%-24s %6u in use %6u free %10u allocated %10u reused", "QueryRecordOp", stats.inUse, stats.numFree, stats.allocs, stats.hits);
+    }
+
+    LogToFD(fd, "------ Client Reply Queues ------");
+    LogToFD(fd, "Caps %u bytes per connection, %u bytes per process (0 = none); coalescing %s",
+            ConnectionReplyCap, ProcessReplyCap, CoalesceReplies ? "on" : "off");
+    LogToFD(fd, "%u replies dropped, %u coalesced, %u connections aborted over a cap", RepliesDropped, RepliesCoalesced, ReplyCapAborts);
+    {
+        const client_process *p;
+        for (p = client_processes; p; p = p->next)
+            if (p->reply_bytes) LogToFD(fd, "PID[%d]: %u connections, %u bytes of replies waiting", p->pid, p->connections, p->reply_bytes);
+    }
+
+    LogToFD(fd, "-------- Client Traffic ---------");
+    {
+        static request_traffic busiest[TrafficMaxRequests];
+        mDNSu32 total;
+        const mDNSu32 n = GetBusiestRequests(busiest, &total);
+        char reqIDStr[14];
+        LogToFD(fd, "Times each request's questions went out in queries and its records in responses and probes (%u requests)", total);
+        for (i = 0; i < (int)n; i++)
+        {
+            mDNS_snprintf(reqIDStr, sizeof(reqIDStr), "[R%u]", busiest[i].request->request_id);
+            LogToFD(fd, "%-6s %-16s %10u queries %10u responses %10u probes PID[%d](%s)", reqIDStr, busiest[i].op,
+                    busiest[i].queries, busiest[i].responses, busiest[i].probes,
+                    busiest[i].request->process_id, busiest[i].request->pid_name);
+        }
+    }
+}
+
+mDNSlocal void LogMiscSectionToFD(const InfoDump *const dump)
+{
+    mDNS *const m = &mDNSStorage;
+    const int fd = dump->fd;
+    const mDNSs32 now = mDNS_TimeNow(m);
+    const DNameListElem *d;
+    const SearchListElem *s;
+
     LogToFD(fd, "-------- NAT Traversals --------");
     LogToFD(fd, "ExtAddress %.4a Retry %d Interval %d",
               &m->ExtAddress,
               m->retryGetAddr ? (m->retryGetAddr - now) / mDNSPlatformOneSecond : 0,
               m->retryIntervalGetAddr / mDNSPlatformOneSecond);
+    if (m->NATGatewayLatency)
+        LogToFD(fd, "Gateway latency %d ms, longest %d ms",
+                  m->NATGatewayLatency * 1000 / mDNSPlatformOneSecond, m->NATGatewayMaxLatency * 1000 / mDNSPlatformOneSecond);
     if (m->NATTraversals)
     {
         const NATTraversalInfo *nat;
@@ -5965,8 +7475,9 @@ mDNSexport void udsserver_info_dump_to_fd(int fd)
 #ifndef SPC_DISABLED
     else LogToFD(fd, "Offering Sleep Proxy Service: %#s", m->SPSRecords.RR_SRV.resrec.name->c);
 #endif
-    if (m->ProxyRecords == ProxyA + ProxyD) LogToFD(fd, "ProxyRecords: %d + %d = %d", ProxyA, ProxyD, ProxyA + ProxyD);
-    else LogToFD(fd, "ProxyRecords: MISMATCH %d + %d = %d ≠ %d", ProxyA, ProxyD, ProxyA + ProxyD, m->ProxyRecords);
+    if (!dump->ProxyCounted) LogToFD(fd, "ProxyRecords: %d", m->ProxyRecords);
+    else if (m->ProxyRecords == dump->ProxyA + dump->ProxyD) LogToFD(fd, "ProxyRecords: %d + %d = %d", dump->ProxyA, dump->ProxyD, dump->ProxyA + dump->ProxyD);
+    else LogToFD(fd, "ProxyRecords: MISMATCH %d + %d = %d ≠ %d", dump->ProxyA, dump->ProxyD, dump->ProxyA + dump->ProxyD, m->ProxyRecords);
 
     LogToFD(fd, "------ Auto Browse Domains -----");
     if (!AutoBrowseDomains) LogToFD(fd, "<None>");
@@ -6063,6 +7574,71 @@ mDNSexport void udsserver_info_dump_to_fd(int fd)
     LogTimerToFD(fd, "m->NextScheduledStopTime ", m->NextScheduledStopTime);
 }
 
+// Writes the next part of a dump, returning mDNStrue while there's more to write
+mDNSlocal mDNSBool InfoDumpStep(InfoDump *const dump)
+{
+    mDNS *const m = &mDNSStorage;
+    const int fd = dump->fd;
+
+    if (dump->sections & kInfoSection_Cache)
+    {
+        if (!dump->CacheStarted)
+        {
+            LogToFD(fd, "------------ Cache -------------");
+            if (dump->streamed) LogCacheCountersToFD(fd, m, mDNStrue);
+            LogToFD(fd, "Slt Q     TTL if     U Type rdlen");
+            dump->CacheStarted = mDNStrue;
+        }
+        LogCacheSlotsToFD(dump);
+        if (dump->slot < m->rrcache_slots) return mDNStrue;
+        LogCacheWalkToFD(dump);
+        if (!dump->streamed) LogCacheCountersToFD(fd, m, mDNSfalse);
+        dump->sections &= ~kInfoSection_Cache;
+    }
+    else if (dump->sections & kInfoSection_Records)
+    {
+        LogRecordsSectionToFD(dump);
+        dump->sections &= ~kInfoSection_Records;
+    }
+    else if (dump->sections & kInfoSection_Questions)
+    {
+        LogQuestionsSectionToFD(dump);
+        dump->sections &= ~kInfoSection_Questions;
+    }
+    else if (dump->sections & kInfoSection_Clients)
+    {
+        LogClientsSectionToFD(fd);
+        dump->sections &= ~kInfoSection_Clients;
+    }
+    else if (dump->sections & kInfoSection_Misc)
+    {
+        LogMiscSectionToFD(dump);
+        dump->sections &= ~kInfoSection_Misc;
+    }
+    return (dump->sections != 0);
+}
+
+mDNSexport void udsserver_info_dump_to_fd(int fd)
+{
+    InfoDump dump;
+    InfoDumpInit(&dump, fd, kInfoSection_All, mDNSNULL, mDNSfalse);
+    while (InfoDumpStep(&dump)) continue;
+}
+
+mDNSexport mDNSBool udsserver_info_dump_start(int fd, mDNSu32 sections, const domainname *filter)
+{
+    if (StreamedDumpActive) return mDNSfalse;
+    InfoDumpInit(&StreamedDump, fd, sections, filter, mDNStrue);
+    StreamedDumpActive = (StreamedDump.sections != 0);
+    return StreamedDumpActive;
+}
+
+mDNSexport mDNSBool udsserver_info_dump_continue(void)
+{
+    if (StreamedDumpActive) StreamedDumpActive = InfoDumpStep(&StreamedDump);
+    return StreamedDumpActive;
+}
+
 #if MDNS_MALLOC_DEBUGGING
 mDNSlocal void udsserver_validatelists(void *context)
 {
@@ -6134,14 +7710,95 @@ mDNSlocal void udsserver_validatelists(void *context)
 }
 #endif // MDNS_MALLOC_DEBUGGING
 
-mDNSlocal int send_msg(request_state *const req)
+// Limits on how much send_msg hands to the kernel in a single write: at most MaxRepliesPerWrite replies,
+// and no more replies once ReplyWriteHighWater bytes have been gathered. The high-water mark keeps one
+// write from being much larger than a typical socket send buffer, where the excess would only come back
+// as a partial write anyway.
+#ifndef MaxRepliesPerWrite
+#define MaxRepliesPerWrite 64
+#endif
+#ifndef ReplyWriteHighWater
+#define ReplyWriteHighWater 65536
+#endif
+#if !defined(_WIN32) && defined(IOV_MAX) && (IOV_MAX < MaxRepliesPerWrite)
+#undef MaxRepliesPerWrite
+#define MaxRepliesPerWrite IOV_MAX
+#endif
+
+#if !defined(_WIN32)
+// Gathers the waiting replies after iov[first] into iov for a single write, putting their headers into network byte order
+// until ungather_replies puts them back. Returns the number of iov entries used in all.
+mDNSlocal int gather_replies(request_state *const req, struct iovec *const iov, const int first)
 {
-    reply_state *const rep = req->replies;      // Send the first waiting reply
-    ssize_t nwriten;
+    reply_state *rep;
+    mDNSu32 gathered = 0;
+    int n = first;
+
+    for (rep = req->replies; rep && n < MaxRepliesPerWrite && gathered < ReplyWriteHighWater; rep = rep->next, n++)
+    {
+        if (rep->next && !rep->nwriten) rep->rhdr->flags |= dnssd_htonl(kDNSServiceFlagsMoreComing);
+        ConvertHeaderBytes(rep->mhdr);
+        iov[n].iov_base = (char *)&rep->mhdr + rep->nwriten;
+        iov[n].iov_len  = rep->totallen - rep->nwriten;
+        gathered += rep->totallen - rep->nwriten;
+    }
+    return n;
+}
+
+mDNSlocal void ungather_replies(request_state *const req, const int first, const int n)
+{
+    reply_state *rep;
+    int i;
+    for (rep = req->replies, i = first; i < n; rep = rep->next, i++) ConvertHeaderBytes(rep->mhdr);
+}
+#endif
 
+// Credits the bytes written to the replies in order; the last one touched may be only partly sent
+mDNSlocal void credit_replies(request_state *const req, ssize_t nwriten)
+{
+    reply_state *rep;
+    for (rep = req->replies; rep && nwriten > 0; rep = rep->next)
+    {
+        const mDNSu32 remaining = rep->totallen - rep->nwriten;
+        const mDNSu32 chunk = ((mDNSu32)nwriten < remaining) ? (mDNSu32)nwriten : remaining;
+        rep->nwriten += chunk;
+        nwriten      -= chunk;
+    }
+}
+
+// Sends as many of the waiting replies as will fit in the socket buffer, gathering them into a single
+// writev() so that a client being sent a burst of results (e.g. a browse on a busy network) doesn't cost
+// the daemon a system call per result. Replies for subordinate operations on a shared connection are
+// queued on the primary (see append_reply), so they're coalesced along with the primary's own.
+// If prefix is given (the error code acknowledging the request, when replies are already waiting for a brand new
+// request), it's sent first, in the same write, and always sent in full.
+// Returns t_complete if every reply it gathered was sent, t_morecoming if the socket filled up.
+// Replies that were completely sent are left on the list for the caller to free.
+mDNSlocal int send_msg(request_state *const req, const char *const prefix, const mDNSu32 prefixlen)
+{
+    reply_state *rep;
+    ssize_t nwriten;
+#if defined(_WIN32)
+    if (prefixlen) send_all(req->sd, prefix, prefixlen);
+    rep = req->replies;     // No writev(); send the first waiting reply
+    if (rep->next && !rep->nwriten) rep->rhdr->flags |= dnssd_htonl(kDNSServiceFlagsMoreComing);
     ConvertHeaderBytes(rep->mhdr);
     nwriten = send(req->sd, (char *)&rep->mhdr + rep->nwriten, rep->totallen - rep->nwriten, 0);
     ConvertHeaderBytes(rep->mhdr);
+#else
+    struct iovec iov[MaxRepliesPerWrite];
+    int i, n, first = 0;
+
+    if (prefixlen)
+    {
+        iov[0].iov_base = (char *)prefix;
+        iov[0].iov_len  = prefixlen;
+        first = 1;
+    }
+    n = gather_replies(req, iov, first);
+    nwriten = writev(req->sd, iov, n);
+    ungather_replies(req, first, n);
+#endif
 
     if (nwriten < 0)
     {
@@ -6154,24 +7811,115 @@ mDNSlocal int send_msg(request_state *const req)
             else
 #endif
             {
+                rep = req->replies;
                 LogMsg("send_msg ERROR: failed to write %d of %d bytes to fd %d errno %d (%s)",
                        rep->totallen - rep->nwriten, rep->totallen, req->sd, dnssd_errno, dnssd_strerror(dnssd_errno));
                 return(t_error);
             }
         }
     }
-    rep->nwriten += nwriten;
-    return (rep->nwriten == rep->totallen) ? t_complete : t_morecoming;
+
+#if !defined(_WIN32)
+    if (prefixlen)
+    {
+        // The client is blocked waiting for the whole of the prefix, so if the socket filled up before then, finish it off
+        if (nwriten < (ssize_t)prefixlen) { send_all(req->sd, prefix + nwriten, prefixlen - (mDNSu32)nwriten); nwriten = 0; }
+        else nwriten -= prefixlen;
+    }
+#endif
+
+    credit_replies(req, nwriten);
+#if defined(_WIN32)
+    return (req->replies->nwriten == req->replies->totallen) ? t_complete : t_morecoming;
+#else
+    for (rep = req->replies, i = first; i < n; rep = rep->next, i++)
+        if (rep->nwriten != rep->totallen) return(t_morecoming);
+    return(t_complete);
+#endif
+}
+
+mDNSlocal void free_sent_replies(request_state *const r)
+{
+    while (r->replies && r->replies->nwriten == r->replies->totallen)
+    {
+        reply_state *fptr = r->replies;
+        r->replies = r->replies->next;
+        ReplyDequeued(r, fptr);
+        FreeReply(fptr);
+        r->time_blocked = 0; // reset failure counter after successful send
+        r->unresponsiveness_reports = 0;
+    }
+}
+
+#if UDS_WRITE_BATCH
+#ifndef MaxClientsPerWriteBatch
+#define MaxClientsPerWriteBatch 64
+#endif
+
+// Gives every client with replies waiting its first send_msg's worth in one udsSupportWriteBatch call per
+// MaxClientsPerWriteBatch clients, instead of a writev() each. Whatever doesn't get sent this way, including
+// anything a write failed on, is left for udsserver_idle's own send_msg loop, which deals with errors as usual.
+mDNSlocal void send_replies_batched(void)
+{
+    static struct iovec iovs[MaxClientsPerWriteBatch][MaxRepliesPerWrite];
+    static struct iovec *iovp[MaxClientsPerWriteBatch];
+    request_state *reqs[MaxClientsPerWriteBatch];
+    dnssd_sock_t fds[MaxClientsPerWriteBatch];
+    int iovcnts[MaxClientsPerWriteBatch];
+    ssize_t results[MaxClientsPerWriteBatch];
+    request_state *r = all_requests;
+    int i, n;
+
+    while (r)
+    {
+        for (n = 0; r && n < MaxClientsPerWriteBatch; r = r->next)
+        {
+            if (!r->replies || r->reply_overflow || !dnssd_SocketValid(r->sd)) continue;
+            reqs[n]    = r;
+            fds[n]     = r->sd;
+            iovp[n]    = iovs[n];
+            iovcnts[n] = gather_replies(r, iovs[n], 0);
+            n++;
+        }
+        if (!n) return;
+        if (udsSupportWriteBatch(fds, iovp, iovcnts, results, n) < 0)
+        {
+            for (i = 0; i < n; i++) ungather_replies(reqs[i], 0, iovcnts[i]);
+            return;
+        }
+        for (i = 0; i < n; i++)
+        {
+            ungather_replies(reqs[i], 0, iovcnts[i]);
+            if (results[i] > 0)
+            {
+                credit_replies(reqs[i], results[i]);
+                free_sent_replies(reqs[i]);
+            }
+        }
+    }
+}
+#endif // UDS_WRITE_BATCH
+
+#if UDS_WRITE_READY
+// Nothing to do here: waking the event loop is enough, since udsserver_idle then runs and sends what it can
+mDNSlocal void client_writable(int fd, void *context)
+{
+    (void)fd;
+    (void)context;
 }
+#endif
 
 mDNSexport mDNSs32 udsserver_idle(mDNSs32 nextevent)
 {
     mDNSs32 now = mDNS_TimeNow(&mDNSStorage);
-    request_state **req = &all_requests;
+    request_state *r, *next;
+
+#if UDS_WRITE_BATCH
+    send_replies_batched();
+#endif
 
-    while (*req)
+    for (r = all_requests; r; r = next)
     {
-        request_state *const r = *req;
 
         if (r->terminate == resolve_termination_callback)
             if (r->u.resolve.ReportTime && now - r->u.resolve.ReportTime >= 0)
@@ -6182,22 +7930,51 @@ mDNSexport mDNSs32 udsserver_idle(mDNSs32 nextevent)
                     LogMsgNoIdent("Client application PID[%d](%s) has received results for DNSServiceResolve(%##s) yet remains active over two minutes.", r->process_id, r->pid_name, r->u.resolve.qsrv.qname.c);
             }
 
-        // Note: Only primary req's have reply lists, not subordinate req's.
-        while (r->replies)      // Send queued replies
+        if (r->terminate == browse_termination_callback && r->u.browser.SnapshotEnd)
+        {
+            if (now - r->u.browser.SnapshotEnd >= 0)
+            {
+                end_browse_snapshot(r);
+                if (r->primary) nextevent = now;
+            }
+            else if (nextevent - r->u.browser.SnapshotEnd > 0) nextevent = r->u.browser.SnapshotEnd;
+        }
+
+        if (r->terminate == browse_termination_callback && r->u.browser.FlushTime)
+        {
+            if (now - r->u.browser.FlushTime >= 0)
+            {
+                flush_browse_replies(r);
+                if (r->primary) nextevent = now;    // The primary may have had its turn already this time round
+            }
+            else if (nextevent - r->u.browser.FlushTime > 0) nextevent = r->u.browser.FlushTime;
+        }
+
+        if (r->terminate == addrinfo_termination_callback && r->u.addrinfo.ReleaseTime)
         {
-            transfer_state result;
-            if (r->replies->next)
-                r->replies->rhdr->flags |= dnssd_htonl(kDNSServiceFlagsMoreComing);
-            result = send_msg(r);   // Returns t_morecoming if buffer full because client is not reading
-            if (result == t_complete)
+            if (now - r->u.addrinfo.ReleaseTime >= 0)
             {
-                reply_state *fptr = r->replies;
-                r->replies = r->replies->next;
-                freeL("reply_state/udsserver_idle", fptr);
-                r->time_blocked = 0; // reset failure counter after successful send
-                r->unresponsiveness_reports = 0;
-                continue;
+                release_addrinfo_replies(r);
+                if (r->primary) nextevent = now;
             }
+            else if (nextevent - r->u.addrinfo.ReleaseTime > 0) nextevent = r->u.addrinfo.ReleaseTime;
+        }
+
+        if (r->reply_overflow && dnssd_SocketValid(r->sd))   // See append_reply
+        {
+            const reply_state *x;
+            for (x = r->replies; x; x = x->next) RepliesDropped++;
+            ReplyCapAborts++;
+            LogClientInfo(r);
+            abort_request(r);
+        }
+
+        // Note: Only primary req's have reply lists, not subordinate req's.
+        while (r->replies)      // Send queued replies
+        {
+            const transfer_state result = send_msg(r, mDNSNULL, 0);   // Returns t_morecoming if buffer full because client is not reading
+            free_sent_replies(r);
+            if (result == t_complete) continue;
             else if (result == t_terminated)
             {
                 LogInfo("%3d: Could not write data to client PID[%d](%s) because connection is terminated by the client", r->sd, r->process_id, r->pid_name);
@@ -6216,6 +7993,9 @@ mDNSexport mDNSs32 udsserver_idle(mDNSs32 nextevent)
         {
             if (nextevent - now > mDNSPlatformOneSecond)
                 nextevent = now + mDNSPlatformOneSecond;
+#if UDS_WRITE_READY
+            if (dnssd_SocketValid(r->sd)) udsSupportRequestWriteReady(r->sd, client_writable, mDNSNULL, r->platform_data);
+#endif
 
             LogRedact(MDNS_LOG_CATEGORY_DEFAULT, MDNS_LOG_INFO,
                "[R%u] Could not send all replies. Will try again in %d ticks.", r->request_id, nextevent - now);
@@ -6243,14 +8023,14 @@ mDNSexport mDNSs32 udsserver_idle(mDNSs32 nextevent)
             }
         }
 
+        // Aborting r above may have unlinked the subordinates that followed it, so only now look at what comes next
+        next = r->next;
         if (!dnssd_SocketValid(r->sd)) // If this request is finished, unlink it from the list and free the memory
         {
-            // Since we're already doing a list traversal, we unlink the request directly instead of using AbortUnlinkAndFree()
-            *req = r->next;
-            freeL("request_state/udsserver_idle", r);
+            // We unlink the request directly instead of using AbortUnlinkAndFree(), since it's already been aborted
+            UnlinkRequest(r);
+            FreeRequest(r);
         }
-        else
-            req = &r->next;
     }
     return nextevent;
 }
@@ -95,6 +95,11 @@ struct request_state
 	request_state *next;
 	request_state *primary;         // If this operation is on a shared socket, pointer to primary
 	// request_state for the original DNSServiceCreateConnection() operation
+	request_state *prev;            // Previous request in all_requests
+	request_state *subordinates;    // For a primary, the operations sharing its connection, newest first
+	request_state *nextsub;         // For a subordinate, the next and previous operations sharing its primary's connection
+	request_state *prevsub;
+	request_state *hashnext;        // For a subordinate, the next request in its SubordinateHash bucket
 	dnssd_sock_t sd;
 	pid_t process_id;               // Client's PID value
 	char  pid_name[MAXCOMLEN];      // Client's process name
@@ -126,6 +131,10 @@ struct request_state
 	mDNSs32 time_blocked;           // record time of a blocked client
 	int unresponsiveness_reports;
 	struct reply_state *replies;    // corresponding (active) reply list
+	struct reply_state *replies_last; // last reply on that list, where append_reply adds the next
+	mDNSu32 reply_bytes;            // bytes of replies on that list
+	mDNSBool reply_overflow;        // replies exceeded a cap while the client was behind; connection is to be aborted
+	struct client_process *process; // reply accounting for the client process, when its pid is known (primary only)
 	req_termination_fn terminate;
 	DNSServiceFlags flags;
 	mDNSu32 interfaceIndex;
@@ -143,6 +152,9 @@ struct request_state
 			mDNSBool ForceMCast;
 			domainname regtype;
 			browser_t *browsers;
+			struct reply_state *pending;    // With kDNSServiceFlagsCoalesceBrowse, results held back until FlushTime
+			mDNSs32 FlushTime;              // Zero when nothing's pending
+			mDNSs32 SnapshotEnd;            // With kDNSServiceFlagsBrowseSnapshot, when to stop and report the end
 		} browser;
 		struct
 		{
@@ -181,8 +193,15 @@ struct request_state
 			const ResourceRecord *srv;
 			mDNSs32 ReportTime;
 			mDNSBool external_advertise;
+			DNSQuestion *addr;              // A and AAAA questions for the SRV target, once it's known
 		} resolve;
-        GetAddrInfoClientRequest addrinfo;
+        struct
+        {
+            GetAddrInfoClientRequest op;
+            struct reply_state *held;       // With kDNSServiceFlagsHappyEyeballs, the first results, until ReleaseTime
+            mDNSs32 ReleaseTime;            // Zero until the first A result
+            mDNSBool released;              // The first results have gone, so later ones aren't held
+        } addrinfo;
         QueryRecordClientRequest queryrecord;
 	} u;
 };
@@ -210,11 +229,39 @@ typedef struct reply_state
 
 #define LogTimerToFD(FILE_DESCRIPTOR, MSG, T) LogToFD((FILE_DESCRIPTOR), MSG " %08X %11d  %08X %11d", (T), (T), (T)-now, (T)-now)
 
+// Optionally called before udsserver_init() when it's to create the listening socket itself, as early as possible:
+// binds the socket and starts listening, so clients can connect while the daemon is still starting up. The kernel
+// holds their connections and requests until udsserver_init() starts accepting them.
+extern int udsserver_listen(void);
 extern int udsserver_init(dnssd_sock_t skts[], size_t count);
 extern mDNSs32 udsserver_idle(mDNSs32 nextevent);
 extern void udsserver_info_dump_to_fd(int fd);
+// Sections of the state dump, for udsserver_info_dump_start()
+#define kInfoSection_Cache      0x01    // Cache records and cache statistics
+#define kInfoSection_Records    0x02    // Auth, LocalOnly, /etc/hosts, duplicate and proxied records
+#define kInfoSection_Questions  0x04
+#define kInfoSection_Clients    0x08    // UDS client requests, object pools and reply queues
+#define kInfoSection_Misc       0x10    // NAT, auth info, domains, statistics and scheduling timers
+#define kInfoSection_All        0x1F
+// Starts writing the chosen sections of the state dump to fd a piece at a time; udsserver_info_dump_continue()
+// writes the next piece and returns mDNSfalse once it's done. With a filter, only cache records and questions at or
+// under that domain are listed. Fails if a streamed dump is already under way.
+extern mDNSBool udsserver_info_dump_start(int fd, mDNSu32 sections, const domainname *filter);
+extern mDNSBool udsserver_info_dump_continue(void);
 extern void udsserver_handle_configchange(mDNS *const m);
 extern int udsserver_exit(void);    // should be called prior to app exit
+#if !defined(USE_TCP_LOOPBACK)
+extern void udsserver_set_path(const char *path);   // Call before udsserver_init; path must stay valid
+#endif
+#ifndef DefaultConnectionReplyCap
+#define DefaultConnectionReplyCap (2 * 1024 * 1024)
+#endif
+#ifndef DefaultProcessReplyCap
+#define DefaultProcessReplyCap    (8 * 1024 * 1024)
+#endif
+// Caps, in bytes, on the replies queued for a client connection and for all of a client process's connections while
+// the client isn't keeping up (zero for no cap), and whether to coalesce superseded events meanwhile (see append_reply)
+extern void udsserver_set_reply_limits(mDNSu32 connection_bytes, mDNSu32 process_bytes, mDNSBool coalesce);
 extern void LogMcastStateInfo(mDNSBool mflag, mDNSBool start, mDNSBool mstatelog);
 #define LogMcastQ       (mDNS_McastLoggingEnabled == 0) ? ((void)0) : LogMcastQuestion
 #define LogMcastS       (mDNS_McastLoggingEnabled == 0) ? ((void)0) : LogMcastService
@@ -227,6 +274,19 @@ typedef void (*udsEventCallback)(int fd, void *context);
 extern mStatus udsSupportAddFDToEventLoop(dnssd_sock_t fd, udsEventCallback callback, void *context, void **platform_data);
 extern int     udsSupportReadFD(dnssd_sock_t fd, char* buf, int len, int flags, void *platform_data);
 extern mStatus udsSupportRemoveFDFromEventLoop(dnssd_sock_t fd, void *platform_data); // Note: This also CLOSES the file descriptor as well
+#if UDS_WRITE_READY
+// Platforms that build with UDS_WRITE_READY provide this to call callback once, as soon as fd can be written to again.
+// udsserver_idle uses it when a client's socket fills up, so that the rest of its replies go as soon as it has read
+// some, instead of the next time round (up to a second later).
+extern mStatus udsSupportRequestWriteReady(dnssd_sock_t fd, udsEventCallback callback, void *context, void *platform_data);
+#endif
+#if UDS_WRITE_BATCH
+// Platforms that can write to many sockets at once build with UDS_WRITE_BATCH and provide this; udsserver_idle then
+// sends every waiting client its replies with one call. Each fds[i] gets the gathered buffer iovs[i], as writev() with
+// MSG_DONTWAIT would, and results[i] is what that returned, or -errno. Returns -1 without writing anything if batching
+// isn't available at the moment, in which case the replies are sent one client at a time as usual.
+extern int     udsSupportWriteBatch(const dnssd_sock_t *fds, struct iovec *const *iovs, const int *iovcnts, ssize_t *results, int count);
+#endif
 
 extern void RecordUpdatedNiceLabel(mDNSs32 delay);
 